@@ -106,13 +106,17 @@ opfile = None
 sep = "  "              # Default separator is 2 spaces
 version = "0.4"
 l2exist = False
-cmd = ("Usage: arcstat.py [-hvx] [-f fields] [-o file] [-s string] [interval "
-       "[count]]\n")
+cmd = ("Usage: arcstat.py [-hvxm] [-f fields] [-o file] [-s string] "
+       "[interval [count]]\n")
 cur = {}
 d = {}
 out = None
 kstat = None
 float_pobj = re.compile("^[0-9]+(\.[0-9]+)?$")
+mflag = False
+trace_last = 0         # Time of the newest arc_trace entry already shown
+heat_width = 40        # Number of blkid buckets per heatmap row
+heat_chars = " .:-=+*#%@"
 
 
 def detailed_usage():
@@ -131,6 +135,8 @@ def usage():
     sys.stderr.write("\t -v : List all possible field headers and definitions"
                      "\n")
     sys.stderr.write("\t -x : Print extended stats\n")
+    sys.stderr.write("\t -m : Print per-objset heatmaps of sampled reads "
+                     "(needs zfs_arc_trace_entries)\n")
     sys.stderr.write("\t -f : Specify specific fields to print (see -v)\n")
     sys.stderr.write("\t -o : Redirect output to the specified file\n")
     sys.stderr.write("\t -s : Override default field separator with custom "
@@ -140,6 +146,7 @@ def usage():
     sys.stderr.write("\tarcstat.py -s \",\" -o /tmp/a.log 2 10\n")
     sys.stderr.write("\tarcstat.py -v\n")
     sys.stderr.write("\tarcstat.py -f time,hit%,dh%,ph%,mh% 1\n")
+    sys.stderr.write("\tarcstat.py -m 5\n")
     sys.stderr.write("\n")
 
     sys.exit(1)
@@ -181,6 +188,66 @@ def snap_stats():
             d[key] = cur[key]
 
 
+def trace_update():
+    global trace_last
+
+    try:
+        k = [line.split() for line in
+             open('/proc/spl/kstat/zfs/arc_trace')]
+    except IOError:
+        sys.stderr.write("arc_trace kstat not found, set "
+                         "zfs_arc_trace_entries to enable it\n")
+        sys.exit(1)
+
+    # Skip the kstat header and the column names
+    entries = []
+    newest = trace_last
+    for e in k[2:]:
+        if len(e) != 8:
+            continue
+        t = int(e[0])
+        if t <= trace_last:
+            continue
+        newest = max(newest, t)
+        entries.append((int(e[1], 16), int(e[4]), e[5], int(e[7])))
+
+    trace_last = newest
+    return entries
+
+
+def print_heatmaps():
+    objsets = {}
+
+    for objset, blkid, result, latency in trace_update():
+        objsets.setdefault(objset, []).append((blkid, result, latency))
+
+    sys.stdout.write("%s\n" % time.strftime("%H:%M:%S", time.localtime()))
+    sys.stdout.write("%-10s%s%6s%s%5s%s%5s%s%5s%s%8s%s%s\n" % (
+        "objset", sep, "reads", sep, "hit%", sep, "l2%", sep, "miss%", sep,
+        "lat(us)", sep, "blkid heat"))
+
+    for objset in sorted(objsets):
+        reads = objsets[objset]
+        n = len(reads)
+        hits = len([r for r in reads if r[1] == "hit"])
+        l2hits = len([r for r in reads if r[1] == "l2hit"])
+        lat = sum([r[2] for r in reads]) / n / 1000
+
+        top = max([r[0] for r in reads]) + 1
+        buckets = [0] * heat_width
+        for r in reads:
+            buckets[r[0] * heat_width // top] += 1
+        peak = max(buckets)
+        heat = "".join([heat_chars[b * (len(heat_chars) - 1) // peak]
+                        for b in buckets])
+
+        sys.stdout.write("0x%-8x%s%6d%s%5d%s%5d%s%5d%s%8d%s|%s|\n" % (
+            objset, sep, n, sep, 100 * hits // n, sep, 100 * l2hits // n,
+            sep, 100 * (n - hits - l2hits) // n, sep, lat, sep, heat))
+    sys.stdout.write("\n")
+    sys.stdout.flush()
+
+
 def prettynum(sz, scale, num=0):
     suffix = [' ', 'K', 'M', 'G', 'T', 'P', 'E', 'Z']
     index = 0
@@ -264,6 +331,7 @@ def init():
     global sep
     global out
     global l2exist
+    global mflag
 
     desired_cols = None
     xflag = False
@@ -274,9 +342,10 @@ def init():
     try:
         opts, args = getopt.getopt(
             sys.argv[1:],
-            "xo:hvs:f:",
+            "xo:hvs:f:m",
             [
                 "extended",
+                "heatmap",
                 "outfile",
                 "help",
                 "verbose",
@@ -292,6 +361,8 @@ def init():
     for opt, arg in opts:
         if opt in ('-x', '--extended'):
             xflag = True
+        if opt in ('-m', '--heatmap'):
+            mflag = True
         if opt in ('-o', '--outfile'):
             opfile = arg
             i += 1
@@ -322,6 +393,9 @@ def init():
     if hflag or (xflag and desired_cols):
         usage()
 
+    if mflag and (xflag or desired_cols):
+        usage()
+
     if vflag:
         detailed_usage()
 
@@ -439,13 +513,21 @@ def main():
 
     signal(SIGINT, SIG_DFL)
     signal(SIGWINCH, resize_handler)
+    if mflag:
+        # Only show reads sampled from now on
+        trace_update()
+        time.sleep(sint)
+
     while True:
-        if i == 0:
-            print_header()
+        if mflag:
+            print_heatmaps()
+        else:
+            if i == 0:
+                print_header()
 
-        snap_stats()
-        calculate()
-        print_values()
+            snap_stats()
+            calculate()
+            print_values()
 
         if count_flag == 1:
             if count <= 1:
@@ -37,14 +37,127 @@
 
 #define	GEN_BENCH_MEMORY	(((uint64_t)1ULL)<<32)
 #define	REC_BENCH_MEMORY	(((uint64_t)1ULL)<<29)
+#define	MIXED_BENCH_MEMORY	(((uint64_t)1ULL)<<30)
+#define	THREAD_BENCH_MEMORY	(((uint64_t)1ULL)<<29)
+#define	COLD_BENCH_MEMORY	(((uint64_t)1ULL)<<28)
 #define	BENCH_ASHIFT		12
 #define	MIN_CS_SHIFT		BENCH_ASHIFT
 #define	MAX_CS_SHIFT		SPA_MAXBLOCKSHIFT
+#define	COLD_MIN_CS_SHIFT	16
+#define	COLD_PASSES		2
+#define	THREAD_CS_SHIFT		17
+#define	MIXED_NMAPS		256
 
 static zio_t zio_bench;
 static raidz_map_t *rm_bench;
 static size_t max_data_size = SPA_MAXBLOCKSIZE;
 
+/*
+ * A raidz map of a benchmark pool, with the columns to reconstruct.
+ */
+typedef struct bench_map {
+	raidz_map_t	*bm_rm;
+	uint64_t	bm_size;
+	int		bm_tgts[PARITY_PQR];
+	int		bm_ntgts;
+} bench_map_t;
+
+static const int rec_tgt[7][3] = {
+	{1, 2, 3},	/* rec_p:   bad QR & D[0]	*/
+	{0, 2, 3},	/* rec_q:   bad PR & D[0]	*/
+	{0, 1, 3},	/* rec_r:   bad PQ & D[0]	*/
+	{2, 3, 4},	/* rec_pq:  bad R  & D[0][1]	*/
+	{1, 3, 4},	/* rec_pr:  bad Q  & D[0][1]	*/
+	{0, 3, 4},	/* rec_qr:  bad P  & D[0][1]	*/
+	{3, 4, 5}	/* rec_pqr: bad    & D[0][1][2] */
+};
+
+static int bench_nresults;
+
+static void
+bench_header(const char *what, boolean_t threads)
+{
+	if (rto_opts.rto_json)
+		return;
+
+	LOG(D_INFO, DBLSEP "\nBenchmarking %s...\n\n", what);
+	LOG(D_ALL, "impl, math, dcols, iosize, %sdisk_bw, total_bw, iter\n",
+	    threads ? "threads, " : "");
+}
+
+/*
+ * Print one result, either as a line of the table or as an element of the
+ * JSON results array.  Bandwidths are in MiB/s; iosize is the average size
+ * of the blocks, and threads is zero outside of the threads suite.
+ */
+static void
+bench_report(const char *suite, const char *impl, const char *math,
+    uint64_t ncols, uint64_t bytes, uint64_t iter, size_t threads,
+    double elapsed)
+{
+	uint64_t iosize = bytes / MAX(iter, 1);
+	double d_bw;
+
+	d_bw = (double)bytes / (double)rto_opts.rto_dcols;
+	d_bw /= (1024.0 * 1024.0 * elapsed);
+
+	if (rto_opts.rto_json) {
+		(void) fprintf(stdout, "%s\n\t\t{ \"suite\": \"%s\", "
+		    "\"impl\": \"%s\", \"math\": \"%s\", \"dcols\": %zu, "
+		    "\"iosize\": %llu, \"threads\": %zu, \"disk_bw\": %lf, "
+		    "\"total_bw\": %lf, \"iter\": %llu }",
+		    bench_nresults++ > 0 ? "," : "", suite, impl, math,
+		    rto_opts.rto_dcols, (u_longlong_t)iosize, MAX(threads, 1),
+		    d_bw, d_bw * (double)ncols, (u_longlong_t)iter);
+	} else if (threads > 0) {
+		LOG(D_ALL, "%10s, %8s, %zu, %10llu, %zu, %lf, %lf, %u\n",
+		    impl, math, rto_opts.rto_dcols, (u_longlong_t)iosize,
+		    threads, d_bw, d_bw * (double)ncols, (unsigned)iter);
+	} else {
+		LOG(D_ALL, "%10s, %8s, %zu, %10llu, %lf, %lf, %u\n",
+		    impl, math, rto_opts.rto_dcols, (u_longlong_t)iosize,
+		    d_bw, d_bw * (double)ncols, (unsigned)iter);
+	}
+}
+
+/*
+ * The mixed and degraded pools have to be the same for every run, so they
+ * are built from a fixed seed rather than with rand().
+ */
+static uint64_t bench_seed;
+
+static uint64_t
+bench_rand(void)
+{
+	bench_seed = bench_seed * 6364136223846793005ULL +
+	    1442695040888963407ULL;
+	return (bench_seed >> 33);
+}
+
+/*
+ * Pick a block size from a rough model of a filesystem with the default
+ * recordsize: small metadata and file tail blocks, compressed records of
+ * any number of sectors, full 128K records and the odd 1M record.
+ */
+static uint64_t
+bench_mixed_size(void)
+{
+	switch (bench_rand() % 8) {
+	case 0:
+	case 1:
+		return ((1 + bench_rand() % 8) << BENCH_ASHIFT);
+	case 2:
+	case 3:
+	case 4:
+		return ((1 + bench_rand() % 32) << BENCH_ASHIFT);
+	case 5:
+	case 6:
+		return (1ULL << 17);
+	default:
+		return (1ULL << 20);
+	}
+}
+
 static void
 bench_init_raidz_map(void)
 {
@@ -68,13 +181,73 @@ bench_fini_raidz_maps(void)
 	bzero(&zio_bench, sizeof (zio_t));
 }
 
+static void
+bench_free_pool(bench_map_t *pool, size_t nmaps)
+{
+	size_t i;
+
+	for (i = 0; i < nmaps; i++)
+		vdev_raidz_map_free(pool[i].bm_rm);
+	umem_free(pool, nmaps * sizeof (bench_map_t));
+}
+
+/*
+ * Generate parity of the maps in the pool in turn until at least total
+ * bytes of data were processed.  Returns the elapsed time in seconds.
+ */
+static double
+bench_gen_pool(bench_map_t *pool, size_t nmaps, uint64_t total,
+    uint64_t *bytes, uint64_t *iter)
+{
+	hrtime_t start;
+	size_t i = 0;
+
+	*bytes = *iter = 0;
+
+	start = gethrtime();
+	while (*bytes < total) {
+		vdev_raidz_generate_parity(pool[i].bm_rm);
+		*bytes += pool[i].bm_size;
+		(*iter)++;
+		if (++i == nmaps)
+			i = 0;
+	}
+
+	return (NSEC2SEC((double)(gethrtime() - start)));
+}
+
+/*
+ * As bench_gen_pool(), reconstructing the targets of each map.
+ */
+static double
+bench_rec_pool(bench_map_t *pool, size_t nmaps, uint64_t total,
+    uint64_t *bytes, uint64_t *iter)
+{
+	hrtime_t start;
+	size_t i = 0;
+
+	*bytes = *iter = 0;
+
+	start = gethrtime();
+	while (*bytes < total) {
+		vdev_raidz_reconstruct(pool[i].bm_rm, pool[i].bm_tgts,
+		    pool[i].bm_ntgts);
+		*bytes += pool[i].bm_size;
+		(*iter)++;
+		if (++i == nmaps)
+			i = 0;
+	}
+
+	return (NSEC2SEC((double)(gethrtime() - start)));
+}
+
 static inline void
 run_gen_bench_impl(const char *impl)
 {
 	int fn, ncols;
-	uint64_t ds, iter_cnt, iter, disksize;
+	uint64_t ds, iter_cnt, iter;
 	hrtime_t start;
-	double elapsed, d_bw;
+	double elapsed;
 
 	/* Benchmark generate functions */
 	for (fn = 0; fn < RAIDZ_GEN_NUM; fn++) {
@@ -95,18 +268,8 @@ run_gen_bench_impl(const char *impl)
 				vdev_raidz_generate_parity(rm_bench);
 			elapsed = NSEC2SEC((double)(gethrtime() - start));
 
-			disksize = (1ULL << ds) / rto_opts.rto_dcols;
-			d_bw = (double)iter_cnt * (double)disksize;
-			d_bw /= (1024.0 * 1024.0 * elapsed);
-
-			LOG(D_ALL, "%10s, %8s, %zu, %10llu, %lf, %lf, %u\n",
-			    impl,
-			    raidz_gen_name[fn],
-			    rto_opts.rto_dcols,
-			    (1ULL<<ds),
-			    d_bw,
-			    d_bw * (double)(ncols),
-			    (unsigned)iter_cnt);
+			bench_report("gen", impl, raidz_gen_name[fn], ncols,
+			    iter_cnt << ds, iter_cnt, 0, elapsed);
 
 			vdev_raidz_map_free(rm_bench);
 		}
@@ -118,8 +281,7 @@ run_gen_bench(void)
 {
 	char **impl_name;
 
-	LOG(D_INFO, DBLSEP "\nBenchmarking parity generation...\n\n");
-	LOG(D_ALL, "impl, math, dcols, iosize, disk_bw, total_bw, iter\n");
+	bench_header("parity generation", B_FALSE);
 
 	for (impl_name = (char **)raidz_impl_names; *impl_name != NULL;
 	    impl_name++) {
@@ -135,18 +297,9 @@ static void
 run_rec_bench_impl(const char *impl)
 {
 	int fn, ncols, nbad;
-	uint64_t ds, iter_cnt, iter, disksize;
+	uint64_t ds, iter_cnt, iter;
 	hrtime_t start;
-	double elapsed, d_bw;
-	static const int tgt[7][3] = {
-		{1, 2, 3},	/* rec_p:   bad QR & D[0]	*/
-		{0, 2, 3},	/* rec_q:   bad PR & D[0]	*/
-		{0, 1, 3},	/* rec_r:   bad PQ & D[0]	*/
-		{2, 3, 4},	/* rec_pq:  bad R  & D[0][1]	*/
-		{1, 3, 4},	/* rec_pr:  bad Q  & D[0][1]	*/
-		{0, 3, 4},	/* rec_qr:  bad P  & D[0][1]	*/
-		{3, 4, 5}	/* rec_pqr: bad    & D[0][1][2] */
-	};
+	double elapsed;
 
 	for (fn = 0; fn < RAIDZ_REC_NUM; fn++) {
 		for (ds = MIN_CS_SHIFT; ds <= MAX_CS_SHIFT; ds++) {
@@ -176,21 +329,12 @@ run_rec_bench_impl(const char *impl)
 
 			start = gethrtime();
 			for (iter = 0; iter < iter_cnt; iter++)
-				vdev_raidz_reconstruct(rm_bench, tgt[fn], nbad);
+				vdev_raidz_reconstruct(rm_bench, rec_tgt[fn],
+				    nbad);
 			elapsed = NSEC2SEC((double)(gethrtime() - start));
 
-			disksize = (1ULL << ds) / rto_opts.rto_dcols;
-			d_bw = (double)iter_cnt * (double)(disksize);
-			d_bw /= (1024.0 * 1024.0 * elapsed);
-
-			LOG(D_ALL, "%10s, %8s, %zu, %10llu, %lf, %lf, %u\n",
-			    impl,
-			    raidz_rec_name[fn],
-			    rto_opts.rto_dcols,
-			    (1ULL<<ds),
-			    d_bw,
-			    d_bw * (double)ncols,
-			    (unsigned)iter_cnt);
+			bench_report("rec", impl, raidz_rec_name[fn], ncols,
+			    iter_cnt << ds, iter_cnt, 0, elapsed);
 
 			vdev_raidz_map_free(rm_bench);
 		}
@@ -202,8 +346,7 @@ run_rec_bench(void)
 {
 	char **impl_name;
 
-	LOG(D_INFO, DBLSEP "\nBenchmarking data reconstruction...\n\n");
-	LOG(D_ALL, "impl, math, dcols, iosize, disk_bw, total_bw, iter\n");
+	bench_header("data reconstruction", B_FALSE);
 
 	for (impl_name = (char **)raidz_impl_names; *impl_name != NULL;
 	    impl_name++) {
@@ -215,13 +358,404 @@ run_rec_bench(void)
 	}
 }
 
+/*
+ * Parity generation over a pool of blocks of mixed sizes at random offsets,
+ * so that the column count, big columns and padding change from one block
+ * to the next as they do for a real vdev.
+ */
+static void
+run_mixed_bench(void)
+{
+	bench_map_t *pool[RAIDZ_GEN_NUM];
+	uint64_t bytes, iter;
+	char **impl_name;
+	double elapsed;
+	int fn, i;
+
+	bench_header("parity generation of mixed block sizes", B_FALSE);
+
+	for (fn = 0; fn < RAIDZ_GEN_NUM; fn++) {
+		pool[fn] = umem_zalloc(MIXED_NMAPS * sizeof (bench_map_t),
+		    UMEM_NOFAIL);
+		bench_seed = fn + 1;
+
+		for (i = 0; i < MIXED_NMAPS; i++) {
+			zio_bench.io_size = bench_mixed_size();
+			zio_bench.io_offset = (bench_rand() % 1024) <<
+			    BENCH_ASHIFT;
+			pool[fn][i].bm_size = zio_bench.io_size;
+			pool[fn][i].bm_rm = vdev_raidz_map_alloc(&zio_bench,
+			    BENCH_ASHIFT, rto_opts.rto_dcols + fn + 1, fn + 1);
+		}
+	}
+	zio_bench.io_offset = 0;
+
+	for (impl_name = (char **)raidz_impl_names; *impl_name != NULL;
+	    impl_name++) {
+
+		if (vdev_raidz_impl_set(*impl_name) != 0)
+			continue;
+
+		for (fn = 0; fn < RAIDZ_GEN_NUM; fn++) {
+			elapsed = bench_gen_pool(pool[fn], MIXED_NMAPS,
+			    MIXED_BENCH_MEMORY, &bytes, &iter);
+			bench_report("mixed", *impl_name, raidz_gen_name[fn],
+			    rto_opts.rto_dcols + fn + 1, bytes, iter, 0,
+			    elapsed);
+		}
+	}
+
+	for (fn = 0; fn < RAIDZ_GEN_NUM; fn++)
+		bench_free_pool(pool[fn], MIXED_NMAPS);
+}
+
+/*
+ * Reads of mixed blocks from a raidz vdev with its first nbad children
+ * faulted.  Depending on its offset and size, a block has those children
+ * as parity columns, data columns or not at all; only the blocks with
+ * missing data need reconstruction, and only those are in the pool.
+ */
+static bench_map_t *
+bench_degraded_pool(int parity, int nbad)
+{
+	bench_map_t *pool, *bm;
+	raidz_map_t *rm;
+	int i, c;
+
+	pool = umem_zalloc(MIXED_NMAPS * sizeof (bench_map_t), UMEM_NOFAIL);
+	bench_seed = parity * PARITY_PQR + nbad;
+
+	for (i = 0; i < MIXED_NMAPS; ) {
+		bm = &pool[i];
+		zio_bench.io_size = bench_mixed_size();
+		zio_bench.io_offset = (bench_rand() % 1024) << BENCH_ASHIFT;
+		rm = vdev_raidz_map_alloc(&zio_bench, BENCH_ASHIFT,
+		    rto_opts.rto_dcols + parity, parity);
+
+		bm->bm_ntgts = 0;
+		for (c = 0; c < raidz_ncols(rm); c++) {
+			if (rm->rm_col[c].rc_devidx < nbad)
+				bm->bm_tgts[bm->bm_ntgts++] = c;
+		}
+
+		if (bm->bm_ntgts == 0 ||
+		    bm->bm_tgts[bm->bm_ntgts - 1] < raidz_parity(rm)) {
+			vdev_raidz_map_free(rm);
+			continue;
+		}
+
+		bm->bm_rm = rm;
+		bm->bm_size = zio_bench.io_size;
+		i++;
+	}
+	zio_bench.io_offset = 0;
+
+	return (pool);
+}
+
+static void
+run_degraded_bench(void)
+{
+	bench_map_t *pool[PARITY_PQR][PARITY_PQR];
+	uint64_t bytes, iter;
+	char **impl_name;
+	char name[16];
+	double elapsed;
+	int p, b;
+
+	bench_header("degraded reads", B_FALSE);
+
+	for (p = 1; p <= PARITY_PQR; p++) {
+		for (b = 1; b <= p; b++)
+			pool[p - 1][b - 1] = bench_degraded_pool(p, b);
+	}
+
+	for (impl_name = (char **)raidz_impl_names; *impl_name != NULL;
+	    impl_name++) {
+
+		if (vdev_raidz_impl_set(*impl_name) != 0)
+			continue;
+
+		for (p = 1; p <= PARITY_PQR; p++) {
+			for (b = 1; b <= p; b++) {
+				elapsed = bench_rec_pool(pool[p - 1][b - 1],
+				    MIXED_NMAPS, REC_BENCH_MEMORY, &bytes,
+				    &iter);
+				(void) snprintf(name, sizeof (name),
+				    "raidz%d_f%d", p, b);
+				bench_report("degraded", *impl_name, name,
+				    rto_opts.rto_dcols + p, bytes, iter, 0,
+				    elapsed);
+			}
+		}
+	}
+
+	for (p = 1; p <= PARITY_PQR; p++) {
+		for (b = 1; b <= p; b++)
+			bench_free_pool(pool[p - 1][b - 1], MIXED_NMAPS);
+	}
+}
+
+/*
+ * Parity generation of 128K blocks from an increasing number of threads,
+ * each with blocks of its own.  The threads wait for all of them to have
+ * been created before they start, and the bandwidth is of all of them.
+ */
+typedef struct bench_thread {
+	zio_t		bt_zio;
+	raidz_map_t	*bt_rm;
+	kt_did_t	bt_tid;
+} bench_thread_t;
+
+static kmutex_t bench_mtx;
+static kcondvar_t bench_cv;
+static boolean_t bench_go;
+static uint64_t bench_thread_iter;
+
+static void
+bench_thread(void *arg)
+{
+	bench_thread_t *bt = arg;
+	uint64_t iter;
+
+	mutex_enter(&bench_mtx);
+	while (!bench_go)
+		cv_wait(&bench_cv, &bench_mtx);
+	mutex_exit(&bench_mtx);
+
+	for (iter = 0; iter < bench_thread_iter; iter++)
+		vdev_raidz_generate_parity(bt->bt_rm);
+
+	thread_exit();
+}
+
+static double
+bench_run_threads(bench_thread_t *bt, size_t nthreads)
+{
+	kthread_t *kt;
+	hrtime_t start;
+	size_t t;
+
+	bench_go = B_FALSE;
+
+	for (t = 0; t < nthreads; t++) {
+		kt = zk_thread_create(NULL, 0, (thread_func_t)bench_thread,
+		    &bt[t], 0, NULL, TS_RUN, 0, PTHREAD_CREATE_JOINABLE);
+		VERIFY3P(kt, !=, NULL);
+		bt[t].bt_tid = kt->t_tid;
+	}
+
+	mutex_enter(&bench_mtx);
+	bench_go = B_TRUE;
+	start = gethrtime();
+	cv_broadcast(&bench_cv);
+	mutex_exit(&bench_mtx);
+
+	for (t = 0; t < nthreads; t++)
+		thread_join(bt[t].bt_tid);
+
+	return (NSEC2SEC((double)(gethrtime() - start)));
+}
+
+static void
+run_thread_bench(void)
+{
+	const size_t ncpus = MAX(1, boot_ncpus);
+	const uint64_t size = 1ULL << THREAD_CS_SHIFT;
+	bench_thread_t *bt;
+	char **impl_name;
+	size_t nthreads, t;
+	double elapsed;
+	int fn;
+
+	bench_header("parity generation scaling", B_TRUE);
+
+	mutex_init(&bench_mtx, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&bench_cv, NULL, CV_DEFAULT, NULL);
+	bench_thread_iter = THREAD_BENCH_MEMORY / size;
+
+	bt = umem_zalloc(ncpus * sizeof (bench_thread_t), UMEM_NOFAIL);
+	for (t = 0; t < ncpus; t++) {
+		bt[t].bt_zio.io_size = size;
+		bt[t].bt_zio.io_abd = raidz_alloc(size);
+		init_zio_abd(&bt[t].bt_zio);
+	}
+
+	for (fn = 0; fn < RAIDZ_GEN_NUM; fn++) {
+		for (t = 0; t < ncpus; t++) {
+			bt[t].bt_rm = vdev_raidz_map_alloc(&bt[t].bt_zio,
+			    BENCH_ASHIFT, rto_opts.rto_dcols + fn + 1, fn + 1);
+		}
+
+		for (impl_name = (char **)raidz_impl_names;
+		    *impl_name != NULL; impl_name++) {
+
+			if (vdev_raidz_impl_set(*impl_name) != 0)
+				continue;
+
+			for (nthreads = 1; nthreads <= ncpus;
+			    nthreads = (nthreads == ncpus) ? ncpus + 1 :
+			    MIN(2 * nthreads, ncpus)) {
+				elapsed = bench_run_threads(bt, nthreads);
+				bench_report("threads", *impl_name,
+				    raidz_gen_name[fn],
+				    rto_opts.rto_dcols + fn + 1,
+				    nthreads * bench_thread_iter * size,
+				    nthreads * bench_thread_iter, nthreads,
+				    elapsed);
+			}
+		}
+
+		for (t = 0; t < ncpus; t++)
+			vdev_raidz_map_free(bt[t].bt_rm);
+	}
+
+	for (t = 0; t < ncpus; t++)
+		raidz_free(bt[t].bt_zio.io_abd, size);
+	umem_free(bt, ncpus * sizeof (bench_thread_t));
+
+	cv_destroy(&bench_cv);
+	mutex_destroy(&bench_mtx);
+}
+
+/*
+ * Generation and reconstruction with every block in a different buffer,
+ * COLD_BENCH_MEMORY of them in all, so that the data has to come from
+ * memory instead of from the cache of the previous iteration.
+ */
+static void
+run_cold_bench(void)
+{
+	const uint64_t ncols = rto_opts.rto_dcols + PARITY_PQR;
+	bench_map_t *pool;
+	zio_t *zios;
+	abd_t *abd;
+	uint64_t ds, size, nmaps, i, bytes, iter;
+	char **impl_name;
+	double elapsed;
+	int fn, nbad;
+
+	bench_header("cache-cold generation and reconstruction", B_FALSE);
+
+	abd = raidz_alloc(COLD_BENCH_MEMORY);
+	zios = umem_zalloc(sizeof (zio_t) *
+	    (COLD_BENCH_MEMORY >> COLD_MIN_CS_SHIFT), UMEM_NOFAIL);
+
+	for (ds = COLD_MIN_CS_SHIFT; ds <= MAX_CS_SHIFT; ds++) {
+		size = 1ULL << ds;
+		nmaps = COLD_BENCH_MEMORY >> ds;
+
+		for (i = 0; i < nmaps; i++) {
+			zios[i].io_offset = i * size;
+			zios[i].io_size = size;
+			zios[i].io_abd = abd_get_offset_size(abd, i * size,
+			    size);
+			init_zio_abd(&zios[i]);
+		}
+
+		for (fn = 0; fn < RAIDZ_GEN_NUM; fn++) {
+			pool = umem_zalloc(nmaps * sizeof (bench_map_t),
+			    UMEM_NOFAIL);
+			for (i = 0; i < nmaps; i++) {
+				pool[i].bm_size = size;
+				pool[i].bm_rm = vdev_raidz_map_alloc(&zios[i],
+				    BENCH_ASHIFT, rto_opts.rto_dcols + fn + 1,
+				    fn + 1);
+			}
+
+			for (impl_name = (char **)raidz_impl_names;
+			    *impl_name != NULL; impl_name++) {
+
+				if (vdev_raidz_impl_set(*impl_name) != 0)
+					continue;
+
+				elapsed = bench_gen_pool(pool, nmaps,
+				    COLD_PASSES * COLD_BENCH_MEMORY, &bytes,
+				    &iter);
+				bench_report("cold", *impl_name,
+				    raidz_gen_name[fn],
+				    rto_opts.rto_dcols + fn + 1, bytes, iter, 0,
+				    elapsed);
+			}
+
+			bench_free_pool(pool, nmaps);
+		}
+
+		/* as in run_rec_bench_impl() */
+		if (size / rto_opts.rto_dcols >= (1ULL << BENCH_ASHIFT)) {
+			pool = umem_zalloc(nmaps * sizeof (bench_map_t),
+			    UMEM_NOFAIL);
+			for (i = 0; i < nmaps; i++) {
+				pool[i].bm_size = size;
+				pool[i].bm_rm = vdev_raidz_map_alloc(&zios[i],
+				    BENCH_ASHIFT, ncols, PARITY_PQR);
+			}
+			nbad = MIN(3, raidz_ncols(pool[0].bm_rm) -
+			    raidz_parity(pool[0].bm_rm));
+
+			for (fn = 0; fn < RAIDZ_REC_NUM; fn++) {
+				for (i = 0; i < nmaps; i++) {
+					memcpy(pool[i].bm_tgts, rec_tgt[fn],
+					    sizeof (rec_tgt[fn]));
+					pool[i].bm_ntgts = nbad;
+				}
+
+				for (impl_name = (char **)raidz_impl_names;
+				    *impl_name != NULL; impl_name++) {
+
+					if (vdev_raidz_impl_set(*impl_name))
+						continue;
+
+					elapsed = bench_rec_pool(pool, nmaps,
+					    COLD_PASSES * COLD_BENCH_MEMORY,
+					    &bytes, &iter);
+					bench_report("cold", *impl_name,
+					    raidz_rec_name[fn], ncols, bytes,
+					    iter, 0, elapsed);
+				}
+			}
+
+			bench_free_pool(pool, nmaps);
+		}
+
+		for (i = 0; i < nmaps; i++)
+			abd_put(zios[i].io_abd);
+	}
+
+	umem_free(zios, sizeof (zio_t) *
+	    (COLD_BENCH_MEMORY >> COLD_MIN_CS_SHIFT));
+	raidz_free(abd, COLD_BENCH_MEMORY);
+}
+
 void
 run_raidz_benchmark(void)
 {
+	const size_t suites = rto_opts.rto_bench_suites;
+
 	bench_init_raidz_map();
 
-	run_gen_bench();
-	run_rec_bench();
+	if (rto_opts.rto_json) {
+		(void) fprintf(stdout, "{\n\t\"dcols\": %zu,\n"
+		    "\t\"ashift\": %d,\n\t\"ncpus\": %d,\n\t\"results\": [",
+		    rto_opts.rto_dcols, BENCH_ASHIFT, (int)boot_ncpus);
+		bench_nresults = 0;
+	}
+
+	if (suites & BENCH_GEN)
+		run_gen_bench();
+	if (suites & BENCH_REC)
+		run_rec_bench();
+	if (suites & BENCH_MIXED)
+		run_mixed_bench();
+	if (suites & BENCH_DEGRADED)
+		run_degraded_bench();
+	if (suites & BENCH_THREADS)
+		run_thread_bench();
+	if (suites & BENCH_COLD)
+		run_cold_bench();
+
+	if (rto_opts.rto_json)
+		(void) fprintf(stdout, "\n\t]\n}\n");
 
 	bench_fini_raidz_maps();
 }
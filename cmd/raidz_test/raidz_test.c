@@ -104,6 +104,10 @@ static void usage(boolean_t requested)
 	    "\t[-S parameter sweep (default: %s)]\n"
 	    "\t[-t timeout for parameter sweep test]\n"
 	    "\t[-B benchmark all raidz implementations]\n"
+	    "\t[-b benchmark suites: all or a comma separated list of\n"
+	    "\t    gen, rec, mixed, degraded, threads, cold"
+	    " (default: gen,rec)]\n"
+	    "\t[-j print benchmark results as JSON]\n"
 	    "\t[-v increase verbosity (default: %zu)]\n"
 	    "\t[-h (print help)]\n"
 	    "\t[-T test the test, see if failure would be detected]\n"
@@ -119,6 +123,45 @@ static void usage(boolean_t requested)
 	exit(requested ? 0 : 1);
 }
 
+static const char *raidz_bench_names[] = {
+	"gen",
+	"rec",
+	"mixed",
+	"degraded",
+	"threads",
+	"cold",
+	NULL
+};
+
+static size_t parse_bench_suites(char *list)
+{
+	size_t suites = 0;
+	char *name;
+	int i;
+
+	for (name = strtok(list, ","); name != NULL;
+	    name = strtok(NULL, ",")) {
+		if (strcmp(name, "all") == 0) {
+			suites |= BENCH_ALL;
+			continue;
+		}
+
+		for (i = 0; raidz_bench_names[i] != NULL; i++) {
+			if (strcmp(name, raidz_bench_names[i]) == 0)
+				break;
+		}
+
+		if (raidz_bench_names[i] == NULL) {
+			ERR("raidz_test: unknown benchmark suite '%s'\n", name);
+			usage(B_FALSE);
+		}
+
+		suites |= 1 << i;
+	}
+
+	return (suites);
+}
+
 static void process_options(int argc, char **argv)
 {
 	size_t value;
@@ -128,7 +171,7 @@ static void process_options(int argc, char **argv)
 
 	bcopy(&rto_opts_defaults, o, sizeof (*o));
 
-	while ((opt = getopt(argc, argv, "TDBSvha:o:d:s:t:")) != -1) {
+	while ((opt = getopt(argc, argv, "TDBSjvha:b:o:d:s:t:")) != -1) {
 		value = 0;
 
 		switch (opt) {
@@ -162,6 +205,13 @@ static void process_options(int argc, char **argv)
 		case 'B':
 			o->rto_benchmark = 1;
 			break;
+		case 'b':
+			o->rto_benchmark = 1;
+			o->rto_bench_suites = parse_bench_suites(optarg);
+			break;
+		case 'j':
+			o->rto_json = 1;
+			break;
 		case 'D':
 			o->rto_gdb = 1;
 			break;
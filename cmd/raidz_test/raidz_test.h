@@ -41,6 +41,19 @@ static const char *raidz_impl_names[] = {
 	NULL
 };
 
+/*
+ * Benchmark suites, selected with -b.  The bit of each suite in
+ * rto_bench_suites is its index in raidz_bench_names, in raidz_test.c.
+ */
+#define	BENCH_GEN	(1 << 0)
+#define	BENCH_REC	(1 << 1)
+#define	BENCH_MIXED	(1 << 2)
+#define	BENCH_DEGRADED	(1 << 3)
+#define	BENCH_THREADS	(1 << 4)
+#define	BENCH_COLD	(1 << 5)
+#define	BENCH_DEFAULT	(BENCH_GEN | BENCH_REC)
+#define	BENCH_ALL	((1 << 6) - 1)
+
 typedef struct raidz_test_opts {
 	size_t rto_ashift;
 	size_t rto_offset;
@@ -50,6 +63,8 @@ typedef struct raidz_test_opts {
 	size_t rto_sweep;
 	size_t rto_sweep_timeout;
 	size_t rto_benchmark;
+	size_t rto_bench_suites;
+	size_t rto_json;
 	size_t rto_sanity;
 	size_t rto_gdb;
 
@@ -68,6 +83,8 @@ static const raidz_test_opts_t rto_opts_defaults = {
 	.rto_v = 0,
 	.rto_sweep = 0,
 	.rto_benchmark = 0,
+	.rto_bench_suites = BENCH_DEFAULT,
+	.rto_json = 0,
 	.rto_sanity = 0,
 	.rto_gdb = 0,
 	.rto_should_stop = B_FALSE
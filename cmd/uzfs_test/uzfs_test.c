@@ -46,8 +46,20 @@ zfs_rlock_t zrl;
 char *data;
 uint64_t *iodata;
 uint64_t g_io_num = 10;
+int rebuild_streams = 1;
+uint64_t rebuild_stream_bw = 0;
+int rebuild_dirty_pct = -1;
+int rebuild_clustered = 0;
+int perf_mode = 0;
+int perf_jobs = 1;
+int perf_qdepth = 1;
+int perf_read_pct = 0;
+int perf_sequential = 0;
+int perf_interval = 1;
+int perf_json = 0;
 
 void uzfs_test_get_metablk_details(void *arg);
+void uzfs_perf_test(void *arg);
 uzfs_test_info_t uzfs_tests[] = {
 	{ uzfs_zvol_zap_operation, "uzfs zap operation test" },
 	{ replay_fn, "zvol replay test" },
@@ -429,7 +441,14 @@ static void usage(int num)
 	    " -p <pool name> -s(for sync on) -S(for silent)"
 	    " -V <data to verify during replay> -w(for write during replay)"
 	    " -T <test id> "
-	    "-x(directory to scan for pool import default:/tmp/)\n");
+	    "-x(directory to scan for pool import default:/tmp/)"
+	    " -R <parallel rebuild streams> -B <bandwidth cap per rebuild"
+	    " stream in bytes/sec> -D <percent of blocks dirty, turns the"
+	    " rebuild test into a benchmark> -C(for clustered dirty blocks)\n");
+	printf("uzfs_test -P(for perf mode) -j <jobs> -q <queue depth per job>"
+	    " -M <read percentage> -e(for sequential IO, default random)"
+	    " -I <report interval in sec> -J(for json output)"
+	    " [-t -a -i -v -c -d -p -S as above]\n");
 
 	printf("Test id:\n");
 
@@ -503,8 +522,8 @@ static void process_options(int argc, char **argv)
 	uint64_t num_tests = sizeof (uzfs_tests) / sizeof (uzfs_tests[0]);
 	uint64_t vol_blocks;
 
-	while ((opt = getopt(argc, argv, "a:b:cd:i:lm:p:sSt:v:V:wT:n:x:"))
-	    != EOF) {
+	while ((opt = getopt(argc, argv,
+	    "a:b:B:cCd:D:ei:I:j:Jlm:M:p:Pq:R:sSt:v:V:wT:n:x:")) != EOF) {
 		switch (opt) {
 			case 'd':
 			case 'p':
@@ -523,24 +542,62 @@ static void process_options(int argc, char **argv)
 			case 'b':
 				block_size = val;
 				break;
+			case 'B':
+				rebuild_stream_bw = val;
+				break;
 			case 'c':
 				create = 1;
 				break;
+			case 'C':
+				rebuild_clustered = 1;
+				break;
 			case 'd':
 				ds = optarg;
 				break;
+			case 'D':
+				if (val > 100)
+					usage(0);
+				rebuild_dirty_pct = val;
+				break;
+			case 'e':
+				perf_sequential = 1;
+				break;
 			case 'i':
 				io_block_size = val;
 				break;
+			case 'I':
+				perf_interval = val;
+				break;
+			case 'j':
+				perf_jobs = val;
+				break;
+			case 'J':
+				perf_json = 1;
+				break;
 			case 'l':
 				log_device = 1;
 				break;
 			case 'm':
 				metaverify = val;
 				break;
+			case 'M':
+				if (val > 100)
+					usage(0);
+				perf_read_pct = val;
+				break;
 			case 'p':
 				pool = optarg;
 				break;
+			case 'P':
+				perf_mode = 1;
+				run_test = 1;
+				break;
+			case 'q':
+				perf_qdepth = val;
+				break;
+			case 'R':
+				rebuild_streams = val;
+				break;
 			case 's':
 				sync_data = 1;
 				break;
@@ -584,6 +641,9 @@ static void process_options(int argc, char **argv)
 	if (active_size > vol_size)
 		vol_size = active_size << 1;
 
+	if (perf_jobs <= 0 || perf_qdepth <= 0 || perf_interval <= 0)
+		usage(0);
+
 	if (uzfs_test_id == 8) {
 		data = kmem_zalloc(vol_size, KM_SLEEP);
 		vol_blocks = (vol_size) / io_block_size;
@@ -593,8 +653,8 @@ static void process_options(int argc, char **argv)
 	if (silent == 0) {
 		printf("vol size: %lu active size: %lu create: %d\n", vol_size,
 		    active_size, create);
-		printf("pool: %s ds: %s Test: %s\n", pool, ds,
-		    uzfs_tests[uzfs_test_id].name);
+		printf("pool: %s ds: %s Test: %s\n", pool, ds, perf_mode ?
+		    "perf" : uzfs_tests[uzfs_test_id].name);
 		printf("block size: %lu io blksize: %lu\n", block_size,
 		    io_block_size);
 		printf("log: %d sync: %d silent: %d\n", log_device, sync_data,
@@ -806,7 +866,7 @@ main(int argc, char **argv)
 	int err;
 	process_options(argc, argv);
 
-	zfs_rlock_init(&zrl);
+	zfs_rlock_init_sharded(&zrl);
 
 	zfs_arc_max = (512 << 20);
 	zfs_arc_min = (256 << 20);
@@ -823,7 +883,10 @@ main(int argc, char **argv)
 	if (!run_test)
 		usage(0);
 
-	uzfs_tests[uzfs_test_id].func(&uzfs_tests[uzfs_test_id]);
+	if (perf_mode)
+		uzfs_perf_test(NULL);
+	else
+		uzfs_tests[uzfs_test_id].func(&uzfs_tests[uzfs_test_id]);
 	zfs_rlock_destroy(&zrl);
 	uzfs_fini();
 	return (0);
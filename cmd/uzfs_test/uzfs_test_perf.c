@@ -0,0 +1,331 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Performance mode of uzfs_test (-P): a fixed mix of reads and writes of
+ * io_block_size bytes is issued to the dataset for total_time_in_sec by
+ * perf_jobs jobs of perf_qdepth threads each, as uzfs IO calls are
+ * synchronous.  IOPS, MB/s and latency percentiles are reported every
+ * perf_interval seconds and at the end, as text or as one JSON object per
+ * line.
+ */
+
+#include <sys/zfs_context.h>
+#include <uzfs_mgmt.h>
+#include <uzfs_io.h>
+#include <uzfs_test.h>
+#include <math.h>
+#include <zrepl_mgmt.h>
+
+extern int perf_jobs;
+extern int perf_qdepth;
+extern int perf_read_pct;
+extern int perf_sequential;
+extern int perf_interval;
+extern int perf_json;
+
+/*
+ * Latencies are kept in microseconds in a histogram with 8 linear buckets
+ * per power of two, so percentiles are within 12.5% of the real value.
+ */
+#define	PERF_HIST_SUB		8
+#define	PERF_HIST_BUCKETS	(64 * PERF_HIST_SUB)
+
+enum { PERF_READ, PERF_WRITE, PERF_NOPS };
+static const char *perf_op_names[PERF_NOPS] = { "read", "write" };
+
+typedef struct perf_stats {
+	uint64_t	ps_ios;
+	uint64_t	ps_bytes;
+	uint64_t	ps_lat_max;
+	uint64_t	ps_hist[PERF_HIST_BUCKETS];
+} perf_stats_t;
+
+typedef struct perf_worker {
+	zvol_state_t	*pw_zv;
+	uint64_t	*pw_cursor;	/* next block, if sequential */
+	uint64_t	pw_first;	/* first block of the job */
+	uint64_t	pw_nblocks;	/* blocks of the job */
+	kmutex_t	*pw_mtx;
+	kcondvar_t	*pw_cv;
+	int		*pw_threads_done;
+} perf_worker_t;
+
+static perf_stats_t perf_stats[PERF_NOPS];
+static volatile boolean_t perf_stop;
+
+static int
+perf_lat_bucket(uint64_t us)
+{
+	int msb;
+
+	if (us < PERF_HIST_SUB)
+		return (us);
+	msb = highbit64(us) - 1;
+	return ((msb - 2) * PERF_HIST_SUB +
+	    ((us >> (msb - 3)) & (PERF_HIST_SUB - 1)));
+}
+
+/* lowest latency in us that falls in bucket b */
+static uint64_t
+perf_bucket_lat(int b)
+{
+	int msb;
+
+	if (b < PERF_HIST_SUB)
+		return (b);
+	msb = b / PERF_HIST_SUB + 2;
+	return ((uint64_t)(PERF_HIST_SUB + b % PERF_HIST_SUB) << (msb - 3));
+}
+
+static void
+perf_account(int op, uint64_t bytes, hrtime_t start)
+{
+	perf_stats_t *ps = &perf_stats[op];
+	uint64_t us = (gethrtime() - start) / (NANOSEC / MICROSEC);
+	uint64_t max;
+
+	atomic_inc_64(&ps->ps_ios);
+	atomic_add_64(&ps->ps_bytes, bytes);
+	atomic_inc_64(&ps->ps_hist[perf_lat_bucket(us)]);
+	while ((max = ps->ps_lat_max) < us)
+		(void) atomic_cas_64(&ps->ps_lat_max, max, us);
+}
+
+static void
+perf_worker_thread(void *arg)
+{
+	perf_worker_t *pw = arg;
+	char *buf = umem_alloc(io_block_size, UMEM_NOFAIL);
+	metadata_desc_t *md;
+	blk_metadata_t wmd;
+	uint64_t blk, offset;
+	hrtime_t start;
+	int i, op, err;
+
+	for (i = 0; i < io_block_size; i++)
+		buf[i] = uzfs_random(200);
+
+	while (!perf_stop) {
+		if (perf_sequential)
+			blk = atomic_inc_64_nv(pw->pw_cursor) - 1;
+		else
+			blk = uzfs_random(pw->pw_nblocks);
+		offset = (pw->pw_first + blk % pw->pw_nblocks) * io_block_size;
+		op = (uzfs_random(100) < perf_read_pct) ? PERF_READ :
+		    PERF_WRITE;
+
+		start = gethrtime();
+		if (op == PERF_READ) {
+			err = uzfs_read_data(pw->pw_zv, buf, offset,
+			    io_block_size, &md);
+			if (err == 0)
+				FREE_METADATA_LIST(md);
+		} else {
+			wmd.io_num = atomic_inc_64_nv(&g_io_num);
+			err = uzfs_write_data(pw->pw_zv, buf, offset,
+			    io_block_size, &wmd, B_FALSE);
+		}
+		if (err != 0) {
+			printf("%s error %d at offset: %lu len: %lu\n",
+			    perf_op_names[op], err, offset, io_block_size);
+			continue;
+		}
+		perf_account(op, io_block_size, start);
+	}
+
+	umem_free(buf, io_block_size);
+	mutex_enter(pw->pw_mtx);
+	*pw->pw_threads_done = *pw->pw_threads_done + 1;
+	cv_signal(pw->pw_cv);
+	mutex_exit(pw->pw_mtx);
+	zk_thread_exit();
+}
+
+static uint64_t
+perf_percentile(const perf_stats_t *ps, double pct)
+{
+	uint64_t want = (uint64_t)ceil(ps->ps_ios * pct / 100);
+	uint64_t seen = 0;
+	int b;
+
+	if (ps->ps_ios == 0)
+		return (0);
+	for (b = 0; b < PERF_HIST_BUCKETS; b++) {
+		seen += ps->ps_hist[b];
+		if (seen >= MAX(want, 1))
+			return (MIN(perf_bucket_lat(b), ps->ps_lat_max));
+	}
+	return (ps->ps_lat_max);
+}
+
+/*
+ * Print the IOs done in secs seconds, for the interval that ends at
+ * elapsed seconds or for the whole run if final is set.
+ */
+static void
+perf_report(const perf_stats_t *delta, double secs, int elapsed,
+    boolean_t final)
+{
+	int op;
+
+	if (perf_json) {
+		printf("{\"time\": %d, \"final\": %s", elapsed,
+		    final ? "true" : "false");
+		for (op = 0; op < PERF_NOPS; op++) {
+			const perf_stats_t *ps = &delta[op];
+
+			printf(", \"%s\": {\"ios\": %lu, \"iops\": %.1f, "
+			    "\"mbps\": %.2f, \"lat_us\": {\"p50\": %lu, "
+			    "\"p90\": %lu, \"p99\": %lu, \"p99.9\": %lu, "
+			    "\"max\": %lu}}", perf_op_names[op], ps->ps_ios,
+			    ps->ps_ios / secs, ps->ps_bytes / secs / (1 << 20),
+			    perf_percentile(ps, 50), perf_percentile(ps, 90),
+			    perf_percentile(ps, 99), perf_percentile(ps, 99.9),
+			    ps->ps_lat_max);
+		}
+		printf("}\n");
+	} else {
+		printf("%s%4ds", final ? "total " : "", elapsed);
+		for (op = 0; op < PERF_NOPS; op++) {
+			const perf_stats_t *ps = &delta[op];
+
+			printf("  %s: %8.0f IOPS %8.2f MB/s lat(us) "
+			    "p50 %lu p99 %lu p99.9 %lu max %lu",
+			    perf_op_names[op], ps->ps_ios / secs,
+			    ps->ps_bytes / secs / (1 << 20),
+			    perf_percentile(ps, 50), perf_percentile(ps, 99),
+			    perf_percentile(ps, 99.9), ps->ps_lat_max);
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+/* delta = cur - prev, and prev = cur */
+static void
+perf_interval_delta(perf_stats_t *delta, perf_stats_t *prev)
+{
+	perf_stats_t cur;
+	int op, b;
+
+	for (op = 0; op < PERF_NOPS; op++) {
+		cur = perf_stats[op];
+		delta[op].ps_ios = cur.ps_ios - prev[op].ps_ios;
+		delta[op].ps_bytes = cur.ps_bytes - prev[op].ps_bytes;
+		delta[op].ps_lat_max = 0;
+		for (b = 0; b < PERF_HIST_BUCKETS; b++) {
+			delta[op].ps_hist[b] = cur.ps_hist[b] -
+			    prev[op].ps_hist[b];
+			if (delta[op].ps_hist[b] != 0)
+				delta[op].ps_lat_max = perf_bucket_lat(b + 1);
+		}
+		prev[op] = cur;
+	}
+}
+
+void
+uzfs_perf_test(void *arg)
+{
+	spa_t *spa;
+	zvol_state_t *zv;
+	perf_worker_t *workers;
+	perf_stats_t *prev, *delta;
+	uint64_t *cursors, job_blocks;
+	int nworkers = perf_jobs * perf_qdepth;
+	int threads_done = 0;
+	int elapsed = 0, i;
+	hrtime_t start, last, now;
+	kmutex_t mtx;
+	kcondvar_t cv;
+
+	mutex_init(&mtx, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&cv, NULL, CV_DEFAULT, NULL);
+
+	if (create == 1) {
+		setup_unit_test();
+		unit_test_create_pool_ds();
+	}
+
+	open_pool(&spa);
+	open_ds(spa, ds, &zv);
+
+	job_blocks = active_size / io_block_size / perf_jobs;
+	if (job_blocks == 0) {
+		printf("active size too small for %d jobs\n", perf_jobs);
+		exit(1);
+	}
+
+	if (silent == 0) {
+		printf("perf: %d jobs x %d qdepth, %d%% reads, %s, io size "
+		    "%lu, interval %ds\n", perf_jobs, perf_qdepth,
+		    perf_read_pct, perf_sequential ? "sequential" : "random",
+		    io_block_size, perf_interval);
+	}
+
+	prev = umem_zalloc(sizeof (perf_stats_t) * PERF_NOPS, UMEM_NOFAIL);
+	delta = umem_zalloc(sizeof (perf_stats_t) * PERF_NOPS, UMEM_NOFAIL);
+	cursors = umem_zalloc(sizeof (uint64_t) * perf_jobs, UMEM_NOFAIL);
+	workers = umem_zalloc(sizeof (perf_worker_t) * nworkers, UMEM_NOFAIL);
+	for (i = 0; i < nworkers; i++) {
+		perf_worker_t *pw = &workers[i];
+
+		pw->pw_zv = zv;
+		pw->pw_cursor = &cursors[i / perf_qdepth];
+		pw->pw_first = (i / perf_qdepth) * job_blocks;
+		pw->pw_nblocks = job_blocks;
+		pw->pw_mtx = &mtx;
+		pw->pw_cv = &cv;
+		pw->pw_threads_done = &threads_done;
+		(void) zk_thread_create(NULL, 0,
+		    (thread_func_t)perf_worker_thread, pw, 0, NULL, TS_RUN, 0,
+		    PTHREAD_CREATE_DETACHED);
+	}
+
+	start = last = gethrtime();
+	while (elapsed < total_time_in_sec) {
+		(void) sleep(MIN(perf_interval, total_time_in_sec - elapsed));
+		now = gethrtime();
+		elapsed = (now - start) / NANOSEC;
+		perf_interval_delta(delta, prev);
+		perf_report(delta, (double)(now - last) / NANOSEC, elapsed,
+		    B_FALSE);
+		last = now;
+	}
+	perf_stop = B_TRUE;
+
+	mutex_enter(&mtx);
+	while (threads_done != nworkers)
+		cv_wait(&cv, &mtx);
+	mutex_exit(&mtx);
+
+	perf_report(perf_stats, (double)(gethrtime() - start) / NANOSEC,
+	    elapsed, B_TRUE);
+
+	umem_free(workers, sizeof (perf_worker_t) * nworkers);
+	umem_free(cursors, sizeof (uint64_t) * perf_jobs);
+	umem_free(delta, sizeof (perf_stats_t) * PERF_NOPS);
+	umem_free(prev, sizeof (perf_stats_t) * PERF_NOPS);
+	cv_destroy(&cv);
+	mutex_destroy(&mtx);
+	uzfs_close_dataset(zv);
+	uzfs_close_pool(spa);
+}
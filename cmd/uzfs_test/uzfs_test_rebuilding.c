@@ -21,6 +21,9 @@
 
 #include <sys/zfs_context.h>
 #include <sys/spa.h>
+#include <sys/arc.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
 #include <sys/dsl_destroy.h>
 #include <sys/uzfs_zvol.h>
 #include <uzfs_mgmt.h>
@@ -31,10 +34,15 @@
 #include <uzfs_test.h>
 #include <data_conn.h>
 #include <string.h>
+#include <sys/resource.h>
 
 extern void make_vdev(char *path);
 extern void populate_string(char *buf, uint64_t size);
 extern void uzfs_test_import_pool(char *pool_name);
+extern int rebuild_streams;
+extern uint64_t rebuild_stream_bw;
+extern int rebuild_dirty_pct;
+extern int rebuild_clustered;
 
 spa_t *spa1, *spa2;
 zvol_state_t *zvol1, *zvol2;
@@ -47,6 +55,7 @@ struct rebuilding_info {
 	zvol_state_t *to_zvol;
 	zvol_state_t *from_zvol;
 	uint64_t base_io_num;
+	uint64_t rebuilt_bytes;
 	kmutex_t mtx;
 	kcondvar_t cv;
 	int active;
@@ -71,6 +80,26 @@ struct replica_read_data {
 	uint64_t len;
 };
 
+/*
+ * One rebuild stream scans a disjoint offset range of the volume. Streams
+ * run in parallel, each paced to rebuild_stream_bw bytes per second.
+ */
+struct rebuild_stream {
+	uzfs_rebuild_data_t *r_data;
+	zvol_state_t *zvol;
+	zvol_state_t *snap_zv;
+	blk_metadata_t md;
+	zvol_prefetch_cursor_t prefetch;
+	off_t offset;
+	size_t len;
+	hrtime_t start;
+	uint64_t bytes;
+	int err;
+	kmutex_t *mtx;
+	kcondvar_t *cv;
+	int *streams_done;
+};
+
 static uint64_t
 verify_replica_data(char *buf1, char *buf2, uint64_t len)
 {
@@ -178,73 +207,153 @@ replica_reader_thread(void *arg)
 	zk_thread_exit();
 }
 
+/*
+ * Sleep long enough to keep the stream under rebuild_stream_bw.
+ */
+static void
+rebuild_stream_throttle(struct rebuild_stream *stream, size_t len)
+{
+	hrtime_t expected, elapsed;
+
+	stream->bytes += len;
+	if (rebuild_stream_bw == 0)
+		return;
+
+	expected = (hrtime_t)(stream->bytes * NANOSEC / rebuild_stream_bw);
+	elapsed = gethrtime() - stream->start;
+	if (expected > elapsed)
+		usleep((expected - elapsed) / (NANOSEC / MICROSEC));
+}
+
 static int
 uzfs_test_meta_diff_traverse_cb(off_t offset, size_t len,
     blk_metadata_t *md, zvol_state_t *snap_zv, void *arg)
 {
-	uzfs_rebuild_data_t *r_data = (uzfs_rebuild_data_t *)arg;
+	struct rebuild_stream *stream = arg;
+	uzfs_rebuild_data_t *r_data = stream->r_data;
 	uzfs_io_chunk_list_t *io;
+	uint64_t end = offset + len, elen;
+	boolean_t hole;
 	int err = 0;
 
-	io = umem_alloc(sizeof (*io), UMEM_NOFAIL);
-	io->offset = offset;
-	io->len = len;
-	io->io_number = md->io_num;
-	io->buf = umem_alloc(len, UMEM_NOFAIL);
+	zvol_rebuild_prefetch(snap_zv, &stream->prefetch, offset,
+	    stream->md.io_num);
 
-	err = uzfs_read_data(snap_zv, io->buf, offset, len, NULL);
-	if (err) {
-		printf("Failed to read data from snapshot(%s) err(%d)\n",
-		    snap_zv->zv_name, err);
-		umem_free(io, sizeof (*io));
-		umem_free(io->buf, len);
-		goto done;
-	}
+	/*
+	 * Holes go over as extents without a buffer, the rebuilding replica
+	 * frees them instead of writing zeros.
+	 */
+	for (; offset < end; offset += elen) {
+		zvol_next_extent(snap_zv, offset, end, &elen, &hole);
+
+		io = umem_alloc(sizeof (*io), UMEM_NOFAIL);
+		io->offset = offset;
+		io->len = elen;
+		io->io_number = md->io_num;
+		io->buf = NULL;
+
+		if (!hole) {
+			io->buf = umem_alloc(elen, UMEM_NOFAIL);
+			err = uzfs_read_data(snap_zv, io->buf, offset, elen,
+			    NULL);
+			if (err) {
+				printf("Failed to read data from snapshot(%s) "
+				    "err(%d)\n", snap_zv->zv_name, err);
+				umem_free(io->buf, elen);
+				umem_free(io, sizeof (*io));
+				break;
+			}
+		}
 
-	mutex_enter(&r_data->mtx);
-	list_insert_tail(r_data->io_list, io);
-	mutex_exit(&r_data->mtx);
+		mutex_enter(&r_data->mtx);
+		list_insert_tail(r_data->io_list, io);
+		mutex_exit(&r_data->mtx);
+
+		if (!hole)
+			rebuild_stream_throttle(stream, elen);
+	}
 
-done:
 	return (err);
 }
 
+static void
+rebuild_stream_thread(void *arg)
+{
+	struct rebuild_stream *stream = arg;
+
+	stream->start = gethrtime();
+	stream->err = uzfs_get_io_diff(stream->zvol, &stream->md,
+	    stream->snap_zv, uzfs_test_meta_diff_traverse_cb, stream->offset,
+	    stream->len, stream);
+
+	mutex_enter(stream->mtx);
+	*stream->streams_done = *stream->streams_done + 1;
+	cv_signal(stream->cv);
+	mutex_exit(stream->mtx);
+
+	zk_thread_exit();
+}
+
 static void
 fetch_modified_data(void *arg)
 {
 	struct rebuilding_data *repl_data = arg;
 	uzfs_rebuild_data_t *r_data = repl_data->r_data;
-	int err;
-	blk_metadata_t md;
-	off_t offset, end;
+	uint64_t volsize = r_data->zvol->zv_volsize;
+	struct rebuild_stream *streams;
+	int nstreams = MAX(rebuild_streams, 1);
 	zvol_state_t *snap_zv = NULL;
+	int streams_done = 0;
+	kmutex_t mtx;
+	kcondvar_t cv;
 	size_t len;
-	int max_count = 4;
+	int i, err = 0;
 	char *snap_name;
 
-	printf("fetching modified data\n");
-	md.io_num = repl_data->base_io;
+	printf("fetching modified data with %d stream(s)\n", nstreams);
 
-	len = r_data->zvol->zv_volsize / max_count;
+	mutex_init(&mtx, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&cv, NULL, CV_DEFAULT, NULL);
 
 	uzfs_zvol_create_internal_snapshot(repl_data->zvol, &snap_zv,
-	    md.io_num);
+	    repl_data->base_io);
+
+	len = P2ROUNDUP(volsize / nstreams, r_data->zvol->zv_volblocksize);
+	streams = umem_zalloc(sizeof (*streams) * nstreams, UMEM_NOFAIL);
+	for (i = 0; i < nstreams; i++) {
+		struct rebuild_stream *stream = &streams[i];
+
+		stream->r_data = r_data;
+		stream->zvol = repl_data->zvol;
+		stream->snap_zv = snap_zv;
+		stream->md.io_num = repl_data->base_io;
+		stream->offset = i * len;
+		stream->len = (i == nstreams - 1) ? volsize - i * len : len;
+		stream->mtx = &mtx;
+		stream->cv = &cv;
+		stream->streams_done = &streams_done;
+		if (stream->offset >= volsize) {
+			streams_done++;
+			continue;
+		}
 
-	for (offset = 0; offset < r_data->zvol->zv_volsize; ) {
-		end = offset + len;
-		if (end > r_data->zvol->zv_volsize)
-			len = r_data->zvol->zv_volsize - offset;
+		(void) zk_thread_create(NULL, 0,
+		    (thread_func_t)rebuild_stream_thread, stream, 0, NULL,
+		    TS_RUN, 0, PTHREAD_CREATE_DETACHED);
+	}
 
-		err = uzfs_get_io_diff(repl_data->zvol, &md, snap_zv,
-		    uzfs_test_meta_diff_traverse_cb, offset, len,
-		    r_data);
-		if (err)
-			break;
+	mutex_enter(&mtx);
+	while (streams_done != nstreams)
+		cv_wait(&cv, &mtx);
+	mutex_exit(&mtx);
 
-		offset += len;
-		if (offset == r_data->zvol->zv_volsize)
-			break;
+	for (i = 0; i < nstreams; i++) {
+		if (streams[i].err != 0)
+			err = streams[i].err;
 	}
+	umem_free(streams, sizeof (*streams) * nstreams);
+	cv_destroy(&cv);
+	mutex_destroy(&mtx);
 
 	if (err) {
 		printf("error(%d)... while fetching modified data\n", err);
@@ -326,16 +435,34 @@ rebuild_replica_thread(void *arg)
 
 		temp_metadata.io_num = node->io_number;
 
-		err = uzfs_write_data(to_zvol, node->buf, node->offset,
-		    node->len, &temp_metadata, B_TRUE);
+		if (node->buf == NULL) {
+			zvol_write_req_t req = { 0 };
+			uint64_t end = node->offset + node->len;
+
+			req.zwr_metadata = &temp_metadata;
+			err = 0;
+			for (req.zwr_offset = node->offset; err == 0 &&
+			    req.zwr_offset < end;
+			    req.zwr_offset += req.zwr_len) {
+				req.zwr_len = MIN(end - req.zwr_offset,
+				    zvol_write_batch_max_bytes);
+				err = zvol_write_batch(to_zvol, &req, 1,
+				    B_TRUE);
+			}
+		} else {
+			err = uzfs_write_data(to_zvol, node->buf, node->offset,
+			    node->len, &temp_metadata, B_TRUE);
+		}
 		if (err) {
 			printf("IO error at offset: %lu len: %lu in rebuild"
 			    " err(%d)\n", node->offset, node->len, err);
 			exit(2);
 		}
-		diff_data += node->len;
 
-		umem_free(node->buf, node->len);
+		if (node->buf != NULL) {
+			diff_data += node->len;
+			umem_free(node->buf, node->len);
+		}
 		umem_free(node, sizeof (*node));
 		mutex_enter(&r_data.mtx);
 	}
@@ -344,6 +471,7 @@ rebuild_replica_thread(void *arg)
 
 	printf("rebuilding finished.. written:%lu, actual written:%lu\n",
 	    diff_data, to_zvol->rebuild_info.rebuild_bytes);
+	r_info->rebuilt_bytes = diff_data;
 	umem_free(io_list, sizeof (*io_list));
 	mutex_destroy(&r_data.mtx);
 	cv_destroy(&r_data.cv);
@@ -560,6 +688,147 @@ close_pool_and_dataset(spa_t *spa, zvol_state_t *zvol)
 	uzfs_close_pool(spa);
 }
 
+/*
+ * Blocks dirtied together in clustered mode of the rebuild benchmark, and
+ * size of the writes filling the volumes before it.
+ */
+#define	REBUILD_BENCH_CLUSTER	256
+#define	REBUILD_BENCH_FILL_SIZE	(128 * 1024)
+
+static uint64_t
+rebuild_bench_pool_read_bytes(spa_t *spa)
+{
+	vdev_stat_t vs;
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	vdev_get_stats(spa->spa_root_vdev, &vs);
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+	return (vs.vs_bytes[ZIO_TYPE_READ]);
+}
+
+static double
+rebuild_bench_cpu_secs(void)
+{
+	struct rusage ru;
+
+	(void) getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6);
+}
+
+static void
+rebuild_bench_write(zvol_state_t *zv, char *buf, uint64_t offset,
+    uint64_t len, uint64_t io_num)
+{
+	blk_metadata_t md;
+	int err;
+
+	md.io_num = io_num;
+	err = uzfs_write_data(zv, buf, offset, len, &md, B_FALSE);
+	if (err != 0) {
+		printf("IO error at offset: %lu len: %lu in write err(%d)\n",
+		    offset, len, err);
+		exit(1);
+	}
+}
+
+/*
+ * Rebuild benchmark (-D): both replicas get the same active_size of data,
+ * then rebuild_dirty_pct percent of the io_block_size blocks of the first
+ * one are rewritten, scattered at random or in runs of
+ * REBUILD_BENCH_CLUSTER blocks with -C.  The second replica is rebuilt
+ * from the first with a cold ARC, and the duration, bytes rebuilt, pool
+ * bytes read besides the rebuilt data (metadata, mostly ZVOL_META_OBJ)
+ * and CPU time per GB of the volume are printed.
+ */
+static void
+uzfs_rebuild_bench(zvol_state_t *from, zvol_state_t *to, spa_t *from_spa)
+{
+	uint64_t nblocks = active_size / io_block_size;
+	uint64_t io_num = 0, base_io_num, dirty = 0;
+	uint64_t offset, blk, run, read_bytes, meta_bytes;
+	struct rebuilding_info rebuild_info;
+	hrtime_t start, elapsed;
+	double cpu, gb;
+	char *buf;
+
+	buf = umem_alloc(REBUILD_BENCH_FILL_SIZE, UMEM_NOFAIL);
+	populate_string(buf, REBUILD_BENCH_FILL_SIZE);
+
+	for (offset = 0; offset < active_size;
+	    offset += REBUILD_BENCH_FILL_SIZE) {
+		uint64_t len = MIN(REBUILD_BENCH_FILL_SIZE,
+		    active_size - offset);
+
+		io_num++;
+		rebuild_bench_write(from, buf, offset, len, io_num);
+		rebuild_bench_write(to, buf, offset, len, io_num);
+	}
+	base_io_num = io_num;
+	uzfs_zvol_store_last_committed_io_no(to, HEALTHY_IO_SEQNUM,
+	    base_io_num);
+
+	run = rebuild_clustered ? REBUILD_BENCH_CLUSTER : 1;
+	for (blk = 0; blk < nblocks; blk += run) {
+		uint64_t n = MIN(run, nblocks - blk), i;
+
+		if (uzfs_random(100) >= rebuild_dirty_pct)
+			continue;
+		for (i = 0; i < n; i++) {
+			rebuild_bench_write(from, buf,
+			    (blk + i) * io_block_size, io_block_size, ++io_num);
+		}
+		dirty += n;
+	}
+	uzfs_zvol_store_last_committed_io_no(from, HEALTHY_IO_SEQNUM,
+	    io_num);
+	umem_free(buf, REBUILD_BENCH_FILL_SIZE);
+
+	printf("rebuild bench: %lu of %lu blocks of %lu bytes dirty (%s)\n",
+	    dirty, nblocks, io_block_size,
+	    rebuild_clustered ? "clustered" : "scattered");
+
+	txg_wait_synced(spa_get_dsl(from_spa), 0);
+	arc_flush(from_spa, B_TRUE);
+
+	uzfs_zvol_set_status(to, ZVOL_STATUS_DEGRADED);
+	rebuild_info.to_zvol = to;
+	rebuild_info.from_zvol = from;
+	rebuild_info.base_io_num = base_io_num;
+	rebuild_info.rebuilt_bytes = 0;
+	rebuild_info.active = B_TRUE;
+	mutex_init(&rebuild_info.mtx, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&rebuild_info.cv, NULL, CV_DEFAULT, NULL);
+
+	read_bytes = rebuild_bench_pool_read_bytes(from_spa);
+	cpu = rebuild_bench_cpu_secs();
+	start = gethrtime();
+
+	mutex_enter(&rebuild_info.mtx);
+	(void) zk_thread_create(NULL, 0,
+	    (thread_func_t)rebuild_replica_thread, &rebuild_info, 0, NULL,
+	    TS_RUN, 0, PTHREAD_CREATE_DETACHED);
+	while (rebuild_info.active)
+		cv_wait(&rebuild_info.cv, &rebuild_info.mtx);
+	mutex_exit(&rebuild_info.mtx);
+
+	elapsed = gethrtime() - start;
+	cpu = rebuild_bench_cpu_secs() - cpu;
+	read_bytes = rebuild_bench_pool_read_bytes(from_spa) - read_bytes;
+	meta_bytes = read_bytes - MIN(read_bytes, rebuild_info.rebuilt_bytes);
+	gb = (double)from->zv_volsize / (1ULL << 30);
+
+	printf("rebuild bench: %d stream(s), %.3f secs, rebuilt %lu bytes "
+	    "(%.1f MB/s), pool read %lu bytes, metadata read %lu bytes, "
+	    "cpu %.3f secs (%.3f secs/GB of volume)\n", MAX(rebuild_streams,
+	    1), (double)elapsed / NANOSEC, rebuild_info.rebuilt_bytes,
+	    rebuild_info.rebuilt_bytes / ((double)elapsed / NANOSEC) /
+	    (1 << 20), read_bytes, meta_bytes, cpu, cpu / gb);
+
+	mutex_destroy(&rebuild_info.mtx);
+	cv_destroy(&rebuild_info.cv);
+}
+
 void
 uzfs_rebuild_test(void *arg)
 {
@@ -589,6 +858,11 @@ uzfs_rebuild_test(void *arg)
 	open_ds(spa1, ds1, &zvol1);
 	open_ds(spa2, ds2, &zvol2);
 
+	if (rebuild_dirty_pct >= 0) {
+		uzfs_rebuild_bench(zvol1, zvol2, spa1);
+		n = test_iterations;
+	}
+
 	while (n++ < test_iterations) {
 		mutex_init(&mtx, NULL, MUTEX_DEFAULT, NULL);
 		cv_init(&cv, NULL, CV_DEFAULT, NULL);
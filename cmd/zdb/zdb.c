@@ -129,7 +129,7 @@ usage(void)
 	    "[-I <inflight I/Os>]\n"
 	    "\t\t[-o <var>=<value>]... [-t <txg>] [-U <cache>] [-x <dumpdir>]\n"
 	    "\t\t[<poolname> [<object> ...]]\n"
-	    "\t%s [-AdiPv] [-e [-V] [-p <path> ...]] [-U <cache>] <dataset> "
+	    "\t%s [-AdfiPv] [-e [-V] [-p <path> ...]] [-U <cache>] <dataset> "
 	    "[<object> ...]\n"
 	    "\t%s -C [-A] [-U <cache>]\n"
 	    "\t%s -l [-Aqu] <device>\n"
@@ -159,6 +159,9 @@ usage(void)
 	(void) fprintf(stderr, "        -D dedup statistics\n");
 	(void) fprintf(stderr, "        -E decode and display block from an "
 	    "embedded block pointer\n");
+	(void) fprintf(stderr, "        -f object layout: fragmentation, "
+	    "indirect overhead,\n           gang blocks and sequential "
+	    "read amplification\n");
 	(void) fprintf(stderr, "        -h pool history\n");
 	(void) fprintf(stderr, "        -i intent logs\n");
 	(void) fprintf(stderr, "        -l read label contents\n");
@@ -707,7 +710,7 @@ verify_spacemap_refcounts(spa_t *spa)
 static void
 dump_spacemap(objset_t *os, space_map_t *sm)
 {
-	uint64_t alloc, offset, entry;
+	uint64_t alloc, offset, entry, word;
 	char *ddata[] = { "ALLOC", "FREE", "CONDENSE", "INVALID",
 			    "INVALID", "INVALID", "INVALID", "INVALID" };
 
@@ -719,34 +722,56 @@ dump_spacemap(objset_t *os, space_map_t *sm)
 	 */
 	alloc = 0;
 	for (offset = 0; offset < space_map_length(sm);
-	    offset += sizeof (entry)) {
+	    offset += sizeof (word)) {
 		uint8_t mapshift = sm->sm_shift;
+		uint64_t entry_off, entry_run, entry_type;
 
 		VERIFY0(dmu_read(os, space_map_object(sm), offset,
-		    sizeof (entry), &entry, DMU_READ_PREFETCH));
-		if (SM_DEBUG_DECODE(entry)) {
+		    sizeof (word), &word, DMU_READ_PREFETCH));
+		entry = offset / sizeof (word);
 
+		if (SM_ENTRY_IS_DEBUG(word)) {
+			if (SM_DEBUG_TXG_DECODE(word) == 0) {
+				(void) printf("\t    [%6llu] PADDING\n",
+				    (u_longlong_t)entry);
+				continue;
+			}
 			(void) printf("\t    [%6llu] %s: txg %llu, pass %llu\n",
-			    (u_longlong_t)(offset / sizeof (entry)),
-			    ddata[SM_DEBUG_ACTION_DECODE(entry)],
-			    (u_longlong_t)SM_DEBUG_TXG_DECODE(entry),
-			    (u_longlong_t)SM_DEBUG_SYNCPASS_DECODE(entry));
+			    (u_longlong_t)entry,
+			    ddata[SM_DEBUG_ACTION_DECODE(word)],
+			    (u_longlong_t)SM_DEBUG_TXG_DECODE(word),
+			    (u_longlong_t)SM_DEBUG_SYNCPASS_DECODE(word));
+			continue;
+		}
+
+		if (SM_ENTRY_IS_DOUBLE(word)) {
+			uint64_t word2;
+
+			entry_run = SM2_RUN_DECODE(word) << mapshift;
+			offset += sizeof (word2);
+			VERIFY0(dmu_read(os, space_map_object(sm), offset,
+			    sizeof (word2), &word2, DMU_READ_PREFETCH));
+			entry_type = SM2_TYPE_DECODE(word2);
+			entry_off = (SM2_OFFSET_DECODE(word2) << mapshift) +
+			    sm->sm_start;
 		} else {
-			(void) printf("\t    [%6llu]    %c  range:"
-			    " %010llx-%010llx  size: %06llx\n",
-			    (u_longlong_t)(offset / sizeof (entry)),
-			    SM_TYPE_DECODE(entry) == SM_ALLOC ? 'A' : 'F',
-			    (u_longlong_t)((SM_OFFSET_DECODE(entry) <<
-			    mapshift) + sm->sm_start),
-			    (u_longlong_t)((SM_OFFSET_DECODE(entry) <<
-			    mapshift) + sm->sm_start +
-			    (SM_RUN_DECODE(entry) << mapshift)),
-			    (u_longlong_t)(SM_RUN_DECODE(entry) << mapshift));
-			if (SM_TYPE_DECODE(entry) == SM_ALLOC)
-				alloc += SM_RUN_DECODE(entry) << mapshift;
-			else
-				alloc -= SM_RUN_DECODE(entry) << mapshift;
+			entry_run = SM_RUN_DECODE(word) << mapshift;
+			entry_type = SM_TYPE_DECODE(word);
+			entry_off = (SM_OFFSET_DECODE(word) << mapshift) +
+			    sm->sm_start;
 		}
+
+		(void) printf("\t    [%6llu]    %c  range:"
+		    " %010llx-%010llx  size: %06llx\n",
+		    (u_longlong_t)entry,
+		    entry_type == SM_ALLOC ? 'A' : 'F',
+		    (u_longlong_t)entry_off,
+		    (u_longlong_t)(entry_off + entry_run),
+		    (u_longlong_t)entry_run);
+		if (entry_type == SM_ALLOC)
+			alloc += entry_run;
+		else
+			alloc -= entry_run;
 	}
 	if (alloc != space_map_allocated(sm)) {
 		(void) printf("space_map_object alloc (%llu) INCONSISTENT "
@@ -760,13 +785,13 @@ dump_metaslab_stats(metaslab_t *msp)
 {
 	char maxbuf[32];
 	range_tree_t *rt = msp->ms_tree;
-	avl_tree_t *t = &msp->ms_size_tree;
+	zfs_btree_t *t = &msp->ms_size_tree;
 	int free_pct = range_tree_space(rt) * 100 / msp->ms_size;
 
 	zdb_nicenum(metaslab_block_maxsize(msp), maxbuf);
 
 	(void) printf("\t %25s %10lu   %7s  %6s   %4s %4d%%\n",
-	    "segments", avl_numnodes(t), "maxsize", maxbuf,
+	    "segments", zfs_btree_numnodes(t), "maxsize", maxbuf,
 	    "freepct", free_pct);
 	(void) printf("\tIn-memory histogram:\n");
 	dump_histogram(rt->rt_histogram, RANGE_TREE_HISTOGRAM_SIZE, 0);
@@ -1351,6 +1376,164 @@ dump_indirect(dnode_t *dn)
 	(void) printf("\n");
 }
 
+/*
+ * Physical layout of one object, gathered by -f.  The L0 blocks are
+ * visited in logical order, and a block whose first DVA starts where the
+ * previous one ended on the same vdev extends the current extent; a
+ * sequential scan of the object costs one IO per extent plus one per
+ * indirect block.
+ */
+typedef struct zdb_layout {
+	uint64_t	zl_data_blocks;	/* L0 blocks, embedded included */
+	uint64_t	zl_embedded;
+	uint64_t	zl_gang;
+	uint64_t	zl_data_lsize;
+	uint64_t	zl_data_asize;
+	uint64_t	zl_ind_blocks;
+	uint64_t	zl_ind_asize;
+	uint64_t	zl_extents;
+	uint64_t	zl_max_extent;
+	uint64_t	zl_cur_extent;
+	uint64_t	zl_last_vdev;
+	uint64_t	zl_last_end;
+} zdb_layout_t;
+
+static void
+layout_add_data(zdb_layout_t *zl, const blkptr_t *bp)
+{
+	const dva_t *dva = &bp->blk_dva[0];
+	uint64_t vdev = DVA_GET_VDEV(dva);
+	uint64_t offset = DVA_GET_OFFSET(dva);
+	uint64_t asize = DVA_GET_ASIZE(dva);
+
+	zl->zl_data_lsize += BP_GET_LSIZE(bp);
+	zl->zl_data_asize += asize;
+
+	/* the gang header always costs a separate IO */
+	if (zl->zl_extents == 0 || BP_IS_GANG(bp) ||
+	    vdev != zl->zl_last_vdev || offset != zl->zl_last_end) {
+		zl->zl_extents++;
+		zl->zl_cur_extent = 0;
+	}
+	zl->zl_cur_extent += asize;
+	zl->zl_max_extent = MAX(zl->zl_max_extent, zl->zl_cur_extent);
+	zl->zl_last_vdev = vdev;
+	zl->zl_last_end = offset + asize;
+}
+
+static int
+layout_visit(spa_t *spa, blkptr_t *bp, const zbookmark_phys_t *zb,
+    zdb_layout_t *zl)
+{
+	arc_flags_t flags = ARC_FLAG_WAIT;
+	arc_buf_t *buf;
+	blkptr_t *cbp;
+	int epb, i;
+	int err;
+
+	if (BP_IS_HOLE(bp))
+		return (0);
+
+	if (BP_IS_EMBEDDED(bp)) {
+		zl->zl_data_blocks++;
+		zl->zl_embedded++;
+		zl->zl_data_lsize += BPE_GET_LSIZE(bp);
+		return (0);
+	}
+
+	if (BP_IS_GANG(bp))
+		zl->zl_gang++;
+
+	if (BP_GET_LEVEL(bp) == 0) {
+		zl->zl_data_blocks++;
+		layout_add_data(zl, bp);
+		return (0);
+	}
+
+	zl->zl_ind_blocks++;
+	zl->zl_ind_asize += DVA_GET_ASIZE(&bp->blk_dva[0]);
+
+	err = arc_read(NULL, spa, bp, arc_getbuf_func, &buf,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_CANFAIL, &flags, zb);
+	if (err)
+		return (err);
+
+	epb = BP_GET_LSIZE(bp) >> SPA_BLKPTRSHIFT;
+	cbp = buf->b_data;
+	for (i = 0; i < epb; i++, cbp++) {
+		zbookmark_phys_t czb;
+
+		SET_BOOKMARK(&czb, zb->zb_objset, zb->zb_object,
+		    zb->zb_level - 1, zb->zb_blkid * epb + i);
+		err = layout_visit(spa, cbp, &czb, zl);
+		if (err)
+			break;
+	}
+	arc_buf_destroy(buf, &buf);
+
+	return (err);
+}
+
+static void
+dump_layout(dnode_t *dn)
+{
+	dnode_phys_t *dnp = dn->dn_phys;
+	zdb_layout_t zl = { 0 };
+	zbookmark_phys_t czb;
+	char lsize[32], dasize[32], iasize[32], avgext[32], maxext[32];
+	char readsize[32];
+	uint64_t holes, ios, nread;
+	int j, err = 0;
+
+	SET_BOOKMARK(&czb, dmu_objset_id(dn->dn_objset),
+	    dn->dn_object, dnp->dn_nlevels - 1, 0);
+	for (j = 0; j < dnp->dn_nblkptr && err == 0; j++) {
+		czb.zb_blkid = j;
+		err = layout_visit(dmu_objset_spa(dn->dn_objset),
+		    &dnp->dn_blkptr[j], &czb, &zl);
+	}
+	if (err != 0) {
+		(void) printf("\tlayout: read failed, errno %d\n", err);
+		return;
+	}
+	if (zl.zl_data_blocks == 0) {
+		(void) printf("\tlayout: no data blocks\n");
+		return;
+	}
+
+	holes = dnp->dn_maxblkid + 1 - MIN(dnp->dn_maxblkid + 1,
+	    zl.zl_data_blocks);
+	ios = zl.zl_extents + zl.zl_ind_blocks;
+	nread = zl.zl_data_asize + zl.zl_ind_asize +
+	    zl.zl_gang * SPA_GANGBLOCKSIZE;
+
+	zdb_nicenum(zl.zl_data_lsize, lsize);
+	zdb_nicenum(zl.zl_data_asize, dasize);
+	zdb_nicenum(zl.zl_ind_asize, iasize);
+	zdb_nicenum(zl.zl_extents == 0 ? 0 :
+	    zl.zl_data_asize / zl.zl_extents, avgext);
+	zdb_nicenum(zl.zl_max_extent, maxext);
+	zdb_nicenum(nread, readsize);
+
+	(void) printf("\tlayout: %llu data blocks (%llu embedded, "
+	    "%llu gang), %llu holes\n",
+	    (u_longlong_t)zl.zl_data_blocks, (u_longlong_t)zl.zl_embedded,
+	    (u_longlong_t)zl.zl_gang, (u_longlong_t)holes);
+	(void) printf("\t\tdata      lsize %5s  asize %5s  %llu extents, "
+	    "avg %s, max %s\n", lsize, dasize,
+	    (u_longlong_t)zl.zl_extents, avgext, maxext);
+	(void) printf("\t\tindirect  %llu blocks  asize %5s  "
+	    "(%.2f%% of data)\n", (u_longlong_t)zl.zl_ind_blocks, iasize,
+	    zl.zl_data_asize == 0 ? 0.0 :
+	    100.0 * zl.zl_ind_asize / zl.zl_data_asize);
+	(void) printf("\t\tseq scan  %llu IOs  %s read  "
+	    "amplification %.2fx  %.1f IOs/MB\n", (u_longlong_t)ios,
+	    readsize, zl.zl_data_lsize == 0 ? 0.0 :
+	    (double)nread / zl.zl_data_lsize,
+	    zl.zl_data_lsize == 0 ? 0.0 :
+	    (double)ios * (1 << 20) / zl.zl_data_lsize);
+}
+
 /*ARGSUSED*/
 static void
 dump_dsl_dir(objset_t *os, uint64_t object, void *data, size_t size)
@@ -2023,6 +2206,9 @@ dump_object(objset_t *os, uint64_t object, int verbosity, int *print_header,
 	if (verbosity >= 5)
 		dump_indirect(dn);
 
+	if (dump_opt['f'])
+		dump_layout(dn);
+
 	if (verbosity >= 5) {
 		/*
 		 * Report the list of segments that comprise the object.
@@ -4200,7 +4386,7 @@ main(int argc, char **argv)
 		spa_config_path = spa_config_path_env;
 
 	while ((c = getopt(argc, argv,
-	    "AbcCdDeEFGhiI:lLmMo:Op:PqRsSt:uU:vVx:X")) != -1) {
+	    "AbcCdDeEfFGhiI:lLmMo:Op:PqRsSt:uU:vVx:X")) != -1) {
 		switch (c) {
 		case 'b':
 		case 'c':
@@ -4208,6 +4394,7 @@ main(int argc, char **argv)
 		case 'd':
 		case 'D':
 		case 'E':
+		case 'f':
 		case 'G':
 		case 'h':
 		case 'i':
@@ -4328,12 +4515,16 @@ main(int argc, char **argv)
 		verbose = MAX(verbose, 1);
 
 	for (c = 0; c < 256; c++) {
-		if (dump_all && strchr("AeEFlLOPRSX", c) == NULL)
+		if (dump_all && strchr("AeEfFlLOPRSX", c) == NULL)
 			dump_opt[c] = 1;
 		if (dump_opt[c])
 			dump_opt[c] += verbose;
 	}
 
+	/* -f reports per object, so it needs the object listing of -dd */
+	if (dump_opt['f'])
+		dump_opt['d'] = MAX(dump_opt['d'], 2);
+
 	aok = (dump_opt['A'] == 1) || (dump_opt['A'] > 2);
 	zfs_recover = (dump_opt['A'] > 1);
 
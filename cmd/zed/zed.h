@@ -45,6 +45,12 @@
  */
 #define	ZED_MIN_EVENTS		0
 
+/*
+ * Default window in milliseconds within which identical ereports are
+ * coalesced (0 disables coalescing).
+ */
+#define	ZED_COALESCE_MS		0
+
 /*
  * String prefix for ZED variables passed via environment variables.
  */
@@ -51,6 +51,7 @@ zed_conf_create(void)
 	zcp->state_fd = -1;		/* opened via zed_conf_open_state() */
 	zcp->zfs_hdl = NULL;		/* opened via zed_event_init() */
 	zcp->zevent_fd = -1;		/* opened via zed_event_init() */
+	zcp->coalesce_ms = ZED_COALESCE_MS;
 
 	if (!(zcp->conf_file = strdup(ZED_CONF_FILE)))
 		goto nomem;
@@ -164,6 +165,8 @@ _zed_conf_display_help(const char *prog, int got_err)
 	fprintf(fp, "%*c%*s %s [%s]\n", w1, 0x20, -w2, "-c FILE",
 	    "Read configuration from FILE.", ZED_CONF_FILE);
 #endif
+	fprintf(fp, "%*c%*s %s [%d]\n", w1, 0x20, -w2, "-e MS",
+	    "Coalesce identical ereports within MS msecs.", ZED_COALESCE_MS);
 	fprintf(fp, "%*c%*s %s [%s]\n", w1, 0x20, -w2, "-d DIR",
 	    "Read enabled ZEDLETs from DIR.", ZED_ZEDLET_DIR);
 	fprintf(fp, "%*c%*s %s [%s]\n", w1, 0x20, -w2, "-p FILE",
@@ -243,13 +246,34 @@ _zed_conf_parse_path(char **resultp, const char *path)
 		zed_log_die("Failed to copy path: %s", strerror(ENOMEM));
 }
 
+/*
+ * Parse the non-negative number of milliseconds in [str] into [resultp].
+ */
+static void
+_zed_conf_parse_msecs(int *resultp, const char *str)
+{
+	char *end;
+	long val;
+
+	assert(resultp != NULL);
+	assert(str != NULL);
+
+	errno = 0;
+	val = strtol(str, &end, 10);
+	if (errno != 0 || end == str || *end != '\0' || val < 0 ||
+	    val > INT_MAX)
+		zed_log_die("Invalid number of milliseconds: \"%s\"", str);
+
+	*resultp = (int)val;
+}
+
 /*
  * Parse the command-line options into the configuration [zcp].
  */
 void
 zed_conf_parse_opts(struct zed_conf *zcp, int argc, char **argv)
 {
-	const char * const opts = ":hLVc:d:p:P:s:vfFMZ";
+	const char * const opts = ":hLVc:d:e:p:P:s:vfFMZ";
 	int opt;
 
 	if (!zcp || !argv || !argv[0])
@@ -274,6 +298,9 @@ zed_conf_parse_opts(struct zed_conf *zcp, int argc, char **argv)
 		case 'd':
 			_zed_conf_parse_path(&zcp->zedlet_dir, optarg);
 			break;
+		case 'e':
+			_zed_conf_parse_msecs(&zcp->coalesce_ms, optarg);
+			break;
 		case 'p':
 			_zed_conf_parse_path(&zcp->pid_file, optarg);
 			break;
@@ -38,6 +38,7 @@ struct zed_conf {
 	libzfs_handle_t	*zfs_hdl;		/* handle to libzfs */
 	int		zevent_fd;		/* fd for access to zevents */
 	char		*path;		/* custom $PATH for zedlets to use */
+	int		coalesce_ms;	/* ereport coalescing window in ms */
 };
 
 struct zed_conf *zed_conf_create(void);
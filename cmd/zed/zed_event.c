@@ -869,6 +869,74 @@ _zed_event_add_time_strings(uint64_t eid, zed_strings_t *zsp, int64_t etime[])
 	}
 }
 
+/*
+ * Identical ereports (same class, pool and vdev) seen within the coalescing
+ * window of the last one handed to the ZEDLETs are not run through them
+ * again; a failing disk can otherwise post thousands of them, each costing
+ * a fork and exec per enabled ZEDLET.  The internal agents still see every
+ * event, since their diagnosis depends on the error counts.
+ */
+#define	ZED_COALESCE_SLOTS	64
+
+typedef struct zed_coalesce {
+	char		zc_class[64];
+	uint64_t	zc_pool_guid;
+	uint64_t	zc_vdev_guid;
+	int64_t		zc_msecs;	/* event time of the last one run */
+	uint64_t	zc_skipped;	/* events coalesced since then */
+} zed_coalesce_t;
+
+static zed_coalesce_t _zed_coalesce[ZED_COALESCE_SLOTS];
+
+/*
+ * Return 1 if the ereport [nvl] is to be coalesced into an earlier one;
+ * otherwise, return 0 and store in [skippedp] the number of identical
+ * ereports coalesced since the last one that was run.
+ */
+static int
+_zed_event_coalesce(struct zed_conf *zcp, const char *class, nvlist_t *nvl,
+    int64_t etime[], uint64_t *skippedp)
+{
+	zed_coalesce_t *zc;
+	uint64_t pool_guid = 0, vdev_guid = 0, hash;
+	int64_t msecs;
+	const char *p;
+
+	*skippedp = 0;
+	if (zcp->coalesce_ms <= 0 || strncmp(class, "ereport.", 8) != 0 ||
+	    strlen(class) >= sizeof (zc->zc_class))
+		return (0);
+
+	(void) nvlist_lookup_uint64(nvl, FM_EREPORT_PAYLOAD_ZFS_POOL_GUID,
+	    &pool_guid);
+	(void) nvlist_lookup_uint64(nvl, FM_EREPORT_PAYLOAD_ZFS_VDEV_GUID,
+	    &vdev_guid);
+	msecs = etime[0] * 1000 + etime[1] / 1000000;
+
+	hash = pool_guid ^ vdev_guid;
+	for (p = class; *p != '\0'; p++)
+		hash = hash * 31 + (unsigned char)*p;
+	zc = &_zed_coalesce[hash % ZED_COALESCE_SLOTS];
+
+	if (zc->zc_pool_guid == pool_guid && zc->zc_vdev_guid == vdev_guid &&
+	    strcmp(zc->zc_class, class) == 0 &&
+	    msecs >= zc->zc_msecs && msecs - zc->zc_msecs < zcp->coalesce_ms) {
+		zc->zc_skipped++;
+		return (1);
+	}
+
+	if (zc->zc_pool_guid == pool_guid && zc->zc_vdev_guid == vdev_guid &&
+	    strcmp(zc->zc_class, class) == 0)
+		*skippedp = zc->zc_skipped;
+
+	(void) strlcpy(zc->zc_class, class, sizeof (zc->zc_class));
+	zc->zc_pool_guid = pool_guid;
+	zc->zc_vdev_guid = vdev_guid;
+	zc->zc_msecs = msecs;
+	zc->zc_skipped = 0;
+	return (0);
+}
+
 /*
  * Service the next zevent, blocking until one is available.
  */
@@ -884,6 +952,7 @@ zed_event_service(struct zed_conf *zcp)
 	uint_t nelem;
 	char *class;
 	const char *subclass;
+	uint64_t skipped;
 	int rv;
 
 	if (!zcp) {
@@ -922,6 +991,15 @@ zed_event_service(struct zed_conf *zcp)
 		/* let internal modules see this event first */
 		zfs_agent_post_event(class, NULL, nvl);
 
+		if (_zed_event_coalesce(zcp, class, nvl, etime, &skipped)) {
+			zed_conf_write_state(zcp, eid, etime);
+			nvlist_free(nvl);
+			return;
+		}
+		if (skipped > 0)
+			zed_log_msg(LOG_INFO, "Coalesced %llu %s events",
+			    (u_longlong_t)skipped, class);
+
 		zsp = zed_strings_create();
 
 		nvp = NULL;
@@ -935,6 +1013,8 @@ zed_event_service(struct zed_conf *zcp)
 		    "%d", (int)getpid());
 		_zed_event_add_var(eid, zsp, ZED_VAR_PREFIX, "ZEDLET_DIR",
 		    "%s", zcp->zedlet_dir);
+		_zed_event_add_var(eid, zsp, ZED_VAR_PREFIX, "COALESCED",
+		    "%llu", (u_longlong_t)skipped);
 		subclass = _zed_event_get_subclass(class);
 		_zed_event_add_var(eid, zsp, ZEVENT_VAR_PREFIX, "SUBCLASS",
 		    "%s", (subclass ? subclass : class));
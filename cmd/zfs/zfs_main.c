@@ -7052,9 +7052,10 @@ get_stats(nvlist_t *outnvl)
 {
 	nvlist_t *cnv = NULL;
 	nvpair_t *elem = NULL;
-	uint64_t val;
+	uint64_t val, *vals;
+	uint_t i, nvals;
 	char *str_val;
-	struct json_object *jobj;
+	struct json_object *jobj, *jarray;
 
 	jobj = json_object_new_object();
 	while ((elem = nvlist_next_nvpair(outnvl, elem)) != NULL) {
@@ -7064,6 +7065,15 @@ get_stats(nvlist_t *outnvl)
 				json_object_object_add(jobj, nvpair_name(elem),
 				    json_object_new_int64(val));
 				break;
+			case DATA_TYPE_UINT64_ARRAY:
+				nvpair_value_uint64_array(elem, &vals, &nvals);
+				jarray = json_object_new_array();
+				for (i = 0; i < nvals; i++)
+					json_object_array_add(jarray,
+					    json_object_new_int64(vals[i]));
+				json_object_object_add(jobj, nvpair_name(elem),
+				    jarray);
+				break;
 			case DATA_TYPE_STRING:
 				nvpair_value_string(elem, &str_val);
 				json_object_object_add(jobj, nvpair_name(elem),
@@ -484,12 +484,16 @@ translate_device(const char *pool, const char *device, err_type_t label_type,
 
 	/*
 	 * Device faults can take on three different forms:
-	 * 1). delayed or hanging I/O
+	 * 1). delayed, throttled, stalled or hanging I/O
 	 * 2). zfs label faults
 	 * 3). generic disk faults
 	 */
-	if (record->zi_timer != 0) {
+	if (record->zi_timer != 0 || record->zi_bandwidth != 0 ||
+	    record->zi_stall_period != 0) {
 		record->zi_cmd = ZINJECT_DELAY_IO;
+		/* a bandwidth cap or stall given without -D has one lane */
+		if (record->zi_nlanes == 0)
+			record->zi_nlanes = 1;
 	} else if (label_type != TYPE_INVAL) {
 		record->zi_cmd = ZINJECT_LABEL_FAULT;
 	} else {
@@ -274,6 +274,22 @@ usage(void)
 	    "\t\tcreate 3 lanes on the device; one lane with a latency\n"
 	    "\t\tof 10 ms and two lanes with a 25 ms latency.\n"
 	    "\n"
+	    "\tzinject -d device [-D latency:lanes[:normal|tail:jitter]]\n"
+	    "\t    [-B bandwidth] [-S period:duration] pool\n"
+	    "\n"
+	    "\t\tShape the IO of a device for performance testing. With\n"
+	    "\t\t'normal', the latency of each request is drawn from a\n"
+	    "\t\tnormal distribution with a standard deviation of 'jitter'\n"
+	    "\t\tms; with 'tail', half of the requests take 'latency' ms\n"
+	    "\t\tand the extra latency of the others doubles with each\n"
+	    "\t\thalving of their share: a quarter take 1 x 'jitter' ms\n"
+	    "\t\tmore, an eighth 3 x, and so on up to 1023 x.\n"
+	    "\n"
+	    "\t\t-B caps the throughput of the device to 'bandwidth' MB/s,\n"
+	    "\t\tshared by all of its lanes. -S stalls the device for\n"
+	    "\t\t'duration' ms every 'period' ms; requests that would\n"
+	    "\t\tcomplete during a stall complete when it ends.\n"
+	    "\n"
 	    "\tzinject -I [-s <seconds> | -g <txgs>] pool\n"
 	    "\t\tCause the pool to stop writing blocks yet not\n"
 	    "\t\treport errors for a duration.  Simulates buggy hardware\n"
@@ -409,6 +425,8 @@ print_delay_handler(int id, const char *pool, zinject_record_t *record,
     void *data)
 {
 	int *count = data;
+	char jitter[32];
+	char stall[48];
 
 	if (record->zi_guid == 0 || record->zi_func[0] != '\0')
 		return (0);
@@ -417,17 +435,35 @@ print_delay_handler(int id, const char *pool, zinject_record_t *record,
 		return (0);
 
 	if (*count == 0) {
-		(void) printf("%3s  %-15s  %-15s  %-15s  %s\n",
-		    "ID", "POOL", "DELAY (ms)", "LANES", "GUID");
+		(void) printf("%3s  %-15s  %-15s  %-15s  %-15s  %-10s  "
+		    "%-15s  %s\n", "ID", "POOL", "DELAY (ms)", "LANES",
+		    "JITTER (ms)", "BW (MB/s)", "STALL (ms)", "GUID");
 		(void) printf("---  ---------------  ---------------  "
+		    "---------------  ---------------  ----------  "
 		    "---------------  ----------------\n");
 	}
 
 	*count += 1;
 
-	(void) printf("%3d  %-15s  %-15llu  %-15llu  %llx\n", id, pool,
+	if (record->zi_delay_dist == ZINJECT_DELAY_FIXED)
+		(void) snprintf(jitter, sizeof (jitter), "-");
+	else
+		(void) snprintf(jitter, sizeof (jitter), "%s %llu",
+		    record->zi_delay_dist == ZINJECT_DELAY_NORMAL ?
+		    "normal" : "tail",
+		    (u_longlong_t)NSEC2MSEC(record->zi_jitter));
+	if (record->zi_stall_period == 0)
+		(void) snprintf(stall, sizeof (stall), "-");
+	else
+		(void) snprintf(stall, sizeof (stall), "%llu every %llu",
+		    (u_longlong_t)NSEC2MSEC(record->zi_stall_time),
+		    (u_longlong_t)NSEC2MSEC(record->zi_stall_period));
+
+	(void) printf("%3d  %-15s  %-15llu  %-15llu  %-15s  %-10llu  "
+	    "%-15s  %llx\n", id, pool,
 	    (u_longlong_t)NSEC2MSEC(record->zi_timer),
-	    (u_longlong_t)record->zi_nlanes,
+	    (u_longlong_t)record->zi_nlanes, jitter,
+	    (u_longlong_t)(record->zi_bandwidth >> 20), stall,
 	    (u_longlong_t)record->zi_guid);
 
 	return (0);
@@ -620,12 +656,17 @@ perform_action(const char *pool, zinject_record_t *record, int cmd)
 }
 
 static int
-parse_delay(char *str, uint64_t *delay, uint64_t *nlanes)
+parse_delay(char *str, zinject_record_t *record)
 {
 	unsigned long scan_delay;
 	unsigned long scan_nlanes;
+	unsigned long scan_jitter;
+	char scan_dist[8];
+	int n;
 
-	if (sscanf(str, "%lu:%lu", &scan_delay, &scan_nlanes) != 2)
+	n = sscanf(str, "%lu:%lu:%7[a-z]:%lu", &scan_delay, &scan_nlanes,
+	    scan_dist, &scan_jitter);
+	if (n != 2 && n != 4)
 		return (1);
 
 	/*
@@ -642,8 +683,36 @@ parse_delay(char *str, uint64_t *delay, uint64_t *nlanes)
 	 * Thus we scale the milliseconds to nanoseconds here, and this
 	 * nanosecond value is used to pass the delay to the kernel.
 	 */
-	*delay = MSEC2NSEC(scan_delay);
-	*nlanes = scan_nlanes;
+	record->zi_timer = MSEC2NSEC(scan_delay);
+	record->zi_nlanes = scan_nlanes;
+
+	if (n == 4) {
+		if (strcmp(scan_dist, "normal") == 0)
+			record->zi_delay_dist = ZINJECT_DELAY_NORMAL;
+		else if (strcmp(scan_dist, "tail") == 0)
+			record->zi_delay_dist = ZINJECT_DELAY_TAIL;
+		else
+			return (1);
+		record->zi_jitter = MSEC2NSEC(scan_jitter);
+	}
+
+	return (0);
+}
+
+static int
+parse_stall(char *str, zinject_record_t *record)
+{
+	unsigned long scan_period;
+	unsigned long scan_time;
+
+	if (sscanf(str, "%lu:%lu", &scan_period, &scan_time) != 2)
+		return (1);
+
+	if (scan_time == 0 || scan_time >= scan_period)
+		return (1);
+
+	record->zi_stall_period = MSEC2NSEC(scan_period);
+	record->zi_stall_time = MSEC2NSEC(scan_time);
 
 	return (0);
 }
@@ -725,7 +794,7 @@ main(int argc, char **argv)
 	}
 
 	while ((c = getopt(argc, argv,
-	    ":aA:b:d:D:f:Fg:qhIc:t:T:l:mr:s:e:uL:p:")) != -1) {
+	    ":aA:b:B:d:D:f:Fg:qhIc:t:T:l:mr:s:S:e:uL:p:")) != -1) {
 		switch (c) {
 		case 'a':
 			flags |= ZINJECT_FLUSH_ARC;
@@ -746,6 +815,18 @@ main(int argc, char **argv)
 		case 'b':
 			raw = optarg;
 			break;
+		case 'B':
+			record.zi_bandwidth = strtoull(optarg, &end, 10) *
+			    1024 * 1024;
+			if (record.zi_bandwidth == 0 || *end != '\0') {
+				(void) fprintf(stderr, "invalid bandwidth "
+				    "'%s': must be a positive number of "
+				    "MB/s\n", optarg);
+				usage();
+				libzfs_fini(g_zfs);
+				return (1);
+			}
+			break;
 		case 'c':
 			cancel = optarg;
 			break;
@@ -754,8 +835,7 @@ main(int argc, char **argv)
 			break;
 		case 'D':
 			errno = 0;
-			ret = parse_delay(optarg, &record.zi_timer,
-			    &record.zi_nlanes);
+			ret = parse_delay(optarg, &record);
 			if (ret != 0) {
 
 				(void) fprintf(stderr, "invalid i/o delay "
@@ -855,6 +935,16 @@ main(int argc, char **argv)
 				return (1);
 			}
 			break;
+		case 'S':
+			if (parse_stall(optarg, &record) != 0) {
+				(void) fprintf(stderr, "invalid stall '%s': "
+				    "must be period:duration with 0 < "
+				    "duration < period\n", optarg);
+				usage();
+				libzfs_fini(g_zfs);
+				return (1);
+			}
+			break;
 		case 'T':
 			if (strcasecmp(optarg, "read") == 0) {
 				io_type = ZIO_TYPE_READ;
@@ -91,6 +91,7 @@ static int zpool_do_replace(int, char **);
 static int zpool_do_split(int, char **);
 
 static int zpool_do_scrub(int, char **);
+static int zpool_do_trim(int, char **);
 
 static int zpool_do_import(int, char **);
 static int zpool_do_export(int, char **);
@@ -142,6 +143,7 @@ typedef enum {
 	HELP_REPLACE,
 	HELP_REMOVE,
 	HELP_SCRUB,
+	HELP_TRIM,
 	HELP_STATUS,
 	HELP_DUMP,
 	HELP_UPGRADE,
@@ -269,6 +271,7 @@ static zpool_command_t command_table[] = {
 	{ "split",	zpool_do_split,		HELP_SPLIT		},
 	{ NULL },
 	{ "scrub",	zpool_do_scrub,		HELP_SCRUB		},
+	{ "trim",	zpool_do_trim,		HELP_TRIM		},
 	{ NULL },
 	{ "import",	zpool_do_import,	HELP_IMPORT		},
 	{ "export",	zpool_do_export,	HELP_EXPORT		},
@@ -347,6 +350,8 @@ get_usage(zpool_help_t idx)
 		return (gettext("\treopen <pool>\n"));
 	case HELP_SCRUB:
 		return (gettext("\tscrub [-s | -p] <pool> ...\n"));
+	case HELP_TRIM:
+		return (gettext("\ttrim [-s | -r rate] <pool> ...\n"));
 	case HELP_STATUS:
 		return (gettext("\tstatus [-c [script1,script2,...]] [-gLPvxD]"
 		    "[-T d|u] [pool] ... [interval [count]]\n"));
@@ -1785,12 +1790,12 @@ print_status_config(zpool_handle_t *zhp, status_cbdata_t *cb, const char *name,
 	for (c = 0; c < children; c++) {
 		uint64_t islog = B_FALSE, ishole = B_FALSE;
 
-		/* Don't print logs or holes here */
+		/* Don't print logs, special vdevs or holes here */
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
 		    &islog);
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_HOLE,
 		    &ishole);
-		if (islog || ishole)
+		if (islog || ishole || vdev_is_special(child[c]))
 			continue;
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags | VDEV_NAME_TYPE_ID);
@@ -1872,7 +1877,7 @@ print_import_config(status_cbdata_t *cb, const char *name, nvlist_t *nv,
 
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
 		    &is_log);
-		if (is_log)
+		if (is_log || vdev_is_special(child[c]))
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, NULL, child[c],
@@ -1905,33 +1910,38 @@ print_import_config(status_cbdata_t *cb, const char *name, nvlist_t *nv,
 }
 
 /*
- * Print log vdevs.
- * Logs are recorded as top level vdevs in the main pool child array
- * but with "is_log" set to 1. We use either print_status_config() or
- * print_import_config() to print the top level logs then any log
- * children (eg mirrored slogs) are printed recursively - which
- * works because only the top level vdev is marked "is_log"
+ * Print log vdevs, or with special set the special allocation class vdevs.
+ * Both are recorded as top level vdevs in the main pool child array, but
+ * with "is_log" set to 1 or an "alloc_bias" of "special". We use either
+ * print_status_config() or print_import_config() to print the top level
+ * vdevs then any children (eg mirrored slogs) are printed recursively -
+ * which works because only the top level vdev is marked.
  */
 static void
-print_logs(zpool_handle_t *zhp, status_cbdata_t *cb, nvlist_t *nv)
+print_logs(zpool_handle_t *zhp, status_cbdata_t *cb, nvlist_t *nv,
+    boolean_t special)
 {
 	uint_t c, children;
 	nvlist_t **child;
+	boolean_t header = B_FALSE;
 
 	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN, &child,
 	    &children) != 0)
 		return;
 
-	(void) printf(gettext("\tlogs\n"));
-
 	for (c = 0; c < children; c++) {
 		uint64_t is_log = B_FALSE;
 		char *name;
 
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
 		    &is_log);
-		if (!is_log)
+		if (special ? !vdev_is_special(child[c]) : !is_log)
 			continue;
+		if (!header) {
+			(void) printf("\t%s\n",
+			    special ? gettext("special") : gettext("logs"));
+			header = B_TRUE;
+		}
 		name = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags | VDEV_NAME_TYPE_ID);
 		if (cb->cb_print_status)
@@ -2227,8 +2237,9 @@ show_import(nvlist_t *config)
 		cb.cb_namewidth = 10;
 
 	print_import_config(&cb, name, nvroot, 0);
+	print_logs(NULL, &cb, nvroot, B_TRUE);
 	if (num_logs(nvroot) > 0)
-		print_logs(NULL, &cb, nvroot);
+		print_logs(NULL, &cb, nvroot, B_FALSE);
 
 	if (reason == ZPOOL_STATUS_BAD_GUID_SUM) {
 		(void) printf(gettext("\n\tAdditional devices are known to "
@@ -5940,6 +5951,86 @@ zpool_do_scrub(int argc, char **argv)
 	return (for_each_pool(argc, argv, B_TRUE, NULL, scrub_callback, &cb));
 }
 
+typedef struct trim_cbdata {
+	pool_trim_cmd_t	cb_cmd;
+	uint64_t	cb_rate;
+} trim_cbdata_t;
+
+static int
+trim_callback(zpool_handle_t *zhp, void *data)
+{
+	trim_cbdata_t *cb = data;
+
+	/*
+	 * Ignore faulted pools.
+	 */
+	if (zpool_get_state(zhp) == POOL_STATE_UNAVAIL) {
+		(void) fprintf(stderr, gettext("cannot trim '%s': pool is "
+		    "currently unavailable\n"), zpool_get_name(zhp));
+		return (1);
+	}
+
+	return (zpool_trim(zhp, cb->cb_cmd, cb->cb_rate) != 0);
+}
+
+/*
+ * zpool trim [-s | -r rate] <pool> ...
+ *
+ *	-s	Stop.  Stops any in-progress trim.
+ *	-r	Rate.  Trims at most rate bytes per second.
+ */
+int
+zpool_do_trim(int argc, char **argv)
+{
+	int c;
+	trim_cbdata_t cb;
+
+	cb.cb_cmd = POOL_TRIM_START;
+	cb.cb_rate = 0;
+
+	/* check options */
+	while ((c = getopt(argc, argv, "sr:")) != -1) {
+		switch (c) {
+		case 's':
+			cb.cb_cmd = POOL_TRIM_STOP;
+			break;
+		case 'r':
+			if (zfs_nicestrtonum(g_zfs, optarg,
+			    &cb.cb_rate) != 0 || cb.cb_rate == 0) {
+				(void) fprintf(stderr,
+				    gettext("invalid rate '%s'\n"), optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case ':':
+			(void) fprintf(stderr, gettext("missing argument for "
+			    "'%c' option\n"), optopt);
+			usage(B_FALSE);
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	if (cb.cb_cmd == POOL_TRIM_STOP && cb.cb_rate != 0) {
+		(void) fprintf(stderr, gettext("invalid option combination: "
+		    "-s and -r are mutually exclusive\n"));
+		usage(B_FALSE);
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing pool name argument\n"));
+		usage(B_FALSE);
+	}
+
+	return (for_each_pool(argc, argv, B_TRUE, NULL, trim_callback, &cb));
+}
+
 /*
  * Print out detailed scrub status.
  */
@@ -6506,8 +6597,9 @@ status_callback(zpool_handle_t *zhp, void *data)
 		print_status_config(zhp, cbp, zpool_get_name(zhp), nvroot, 0,
 		    B_FALSE);
 
+		print_logs(zhp, cbp, nvroot, B_TRUE);
 		if (num_logs(nvroot) > 0)
-			print_logs(zhp, cbp, nvroot);
+			print_logs(zhp, cbp, nvroot, B_FALSE);
 		if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
 		    &l2cache, &nl2cache) == 0)
 			print_l2cache(zhp, cbp, l2cache, nl2cache);
@@ -86,6 +86,18 @@ num_logs(nvlist_t *nv)
 	return (nlogs);
 }
 
+/*
+ * Return whether a top level vdev belongs to the special allocation class
+ */
+boolean_t
+vdev_is_special(nvlist_t *nv)
+{
+	char *bias;
+
+	return (nvlist_lookup_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS,
+	    &bias) == 0 && strcmp(bias, VDEV_ALLOC_BIAS_SPECIAL) == 0);
+}
+
 /* Find the max element in an array of uint64_t values */
 uint64_t
 array64_max(uint64_t array[], unsigned int len)
@@ -1470,6 +1470,12 @@ is_grouping(const char *type, int *mindev, int *maxdev)
 		return (VDEV_TYPE_L2CACHE);
 	}
 
+	if (strcmp(type, "special") == 0) {
+		if (mindev != NULL)
+			*mindev = 1;
+		return (VDEV_ALLOC_BIAS_SPECIAL);
+	}
+
 	return (NULL);
 }
 
@@ -1483,10 +1489,10 @@ nvlist_t *
 construct_spec(nvlist_t *props, int argc, char **argv)
 {
 	nvlist_t *nvroot, *nv, **top, **spares, **l2cache;
-	int t, toplevels, mindev, maxdev, nspares, nlogs, nl2cache;
+	int t, toplevels, mindev, maxdev, nspares, nlogs, nl2cache, nspecial;
 	const char *type;
 	uint64_t is_log;
-	boolean_t seen_logs;
+	boolean_t seen_logs, is_special, seen_special;
 
 	top = NULL;
 	toplevels = 0;
@@ -1495,8 +1501,11 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 	nspares = 0;
 	nlogs = 0;
 	nl2cache = 0;
+	nspecial = 0;
 	is_log = B_FALSE;
 	seen_logs = B_FALSE;
+	is_special = B_FALSE;
+	seen_special = B_FALSE;
 	nvroot = NULL;
 
 	while (argc > 0) {
@@ -1519,6 +1528,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					goto spec_out;
 				}
 				is_log = B_FALSE;
+				is_special = B_FALSE;
 			}
 
 			if (strcmp(type, VDEV_TYPE_LOG) == 0) {
@@ -1531,6 +1541,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				}
 				seen_logs = B_TRUE;
 				is_log = B_TRUE;
+				is_special = B_FALSE;
 				argc--;
 				argv++;
 				/*
@@ -1540,6 +1551,26 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				continue;
 			}
 
+			if (strcmp(type, VDEV_ALLOC_BIAS_SPECIAL) == 0) {
+				if (seen_special) {
+					(void) fprintf(stderr,
+					    gettext("invalid vdev "
+					    "specification: 'special' can be "
+					    "specified only once\n"));
+					goto spec_out;
+				}
+				seen_special = B_TRUE;
+				is_special = B_TRUE;
+				is_log = B_FALSE;
+				argc--;
+				argv++;
+				/*
+				 * Like a log, this only marks the vdevs
+				 * which follow.
+				 */
+				continue;
+			}
+
 			if (strcmp(type, VDEV_TYPE_L2CACHE) == 0) {
 				if (l2cache != NULL) {
 					(void) fprintf(stderr,
@@ -1549,6 +1580,7 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 					goto spec_out;
 				}
 				is_log = B_FALSE;
+				is_special = B_FALSE;
 			}
 
 			if (is_log) {
@@ -1619,6 +1651,12 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 				    type) == 0);
 				verify(nvlist_add_uint64(nv,
 				    ZPOOL_CONFIG_IS_LOG, is_log) == 0);
+				if (is_special) {
+					verify(nvlist_add_string(nv,
+					    ZPOOL_CONFIG_ALLOCATION_BIAS,
+					    VDEV_ALLOC_BIAS_SPECIAL) == 0);
+					nspecial++;
+				}
 				if (strcmp(type, VDEV_TYPE_RAIDZ) == 0) {
 					verify(nvlist_add_uint64(nv,
 					    ZPOOL_CONFIG_NPARITY,
@@ -1643,6 +1681,12 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 
 			if (is_log)
 				nlogs++;
+			if (is_special) {
+				verify(nvlist_add_string(nv,
+				    ZPOOL_CONFIG_ALLOCATION_BIAS,
+				    VDEV_ALLOC_BIAS_SPECIAL) == 0);
+				nspecial++;
+			}
 			argc--;
 			argv++;
 		}
@@ -1667,6 +1711,12 @@ construct_spec(nvlist_t *props, int argc, char **argv)
 		goto spec_out;
 	}
 
+	if (seen_special && nspecial == 0) {
+		(void) fprintf(stderr, gettext("invalid vdev specification: "
+		    "special requires at least 1 device\n"));
+		goto spec_out;
+	}
+
 	/*
 	 * Finally, create nvroot and add all top-level vdevs to it.
 	 */
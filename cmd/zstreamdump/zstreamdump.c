@@ -52,6 +52,11 @@
  * by newlines or spaces
  */
 #define	DUMP_GROUPING	4
+/*
+ * Size of the stdio buffer of the stream, large enough that reading it
+ * is not bound by the number of read(2) calls
+ */
+#define	STREAM_BUFSIZE	(16 * 1024 * 1024)
 
 uint64_t total_write_size = 0;
 uint64_t total_stream_len = 0;
@@ -59,14 +64,43 @@ FILE *send_stream = 0;
 boolean_t do_byteswap = B_FALSE;
 boolean_t do_cksum = B_TRUE;
 
+/*
+ * Statistics gathered in stats mode (-s).  Sizes are counted in power of
+ * two buckets, by their highest bit.  A run is a sequence of writes to
+ * the same object, each starting where the previous one ended.
+ */
+#define	STATS_BUCKETS	64
+
+typedef struct stream_stats {
+	uint64_t	ss_bytes[DRR_NUMTYPES];	/* headers and payloads */
+	uint64_t	ss_write_lsize;
+	uint64_t	ss_write_psize;
+	uint64_t	ss_embedded_lsize;
+	uint64_t	ss_embedded_psize;
+	uint64_t	ss_write_hist[STATS_BUCKETS];
+	uint64_t	ss_free_hist[STATS_BUCKETS];
+	uint64_t	ss_free_bytes;
+	uint64_t	ss_free_to_end;
+	uint64_t	ss_write_runs;
+	uint64_t	ss_objects_written;
+	uint64_t	ss_last_object;
+	uint64_t	ss_last_end;
+} stream_stats_t;
+
+boolean_t do_stats = B_FALSE;
+stream_stats_t stats;
+
 static void
 usage(void)
 {
-	(void) fprintf(stderr, "usage: zstreamdump [-v] [-C] [-d] < file\n");
+	(void) fprintf(stderr, "usage: zstreamdump [-v] [-C] [-d] [-s] "
+	    "< file\n");
 	(void) fprintf(stderr, "\t -v -- verbose\n");
 	(void) fprintf(stderr, "\t -C -- suppress checksum verification\n");
 	(void) fprintf(stderr, "\t -d -- dump contents of blocks modified, "
 	    "implies verbose\n");
+	(void) fprintf(stderr, "\t -s -- report throughput and statistics "
+	    "of the record mix\n");
 #ifdef	_UZFS
 	(void) fprintf(stderr, "\t -w -- create dump files(object_number.dump)"
 	    " for object (use `-w -1` to dump all the objects)\n");
@@ -109,6 +143,109 @@ ssread(void *buf, size_t len, zio_cksum_t *cksum)
 	return (outlen);
 }
 
+static int
+stats_bucket(uint64_t size)
+{
+	int bucket = 0;
+
+	while (size > 1 && bucket < STATS_BUCKETS - 1) {
+		size >>= 1;
+		bucket++;
+	}
+	return (bucket);
+}
+
+static void
+stats_write(uint64_t object, uint64_t offset, uint64_t lsize,
+    uint64_t psize)
+{
+	stats.ss_write_lsize += lsize;
+	stats.ss_write_psize += psize;
+	stats.ss_write_hist[stats_bucket(lsize)]++;
+
+	if (stats.ss_write_runs == 0 || object != stats.ss_last_object) {
+		stats.ss_objects_written++;
+		stats.ss_write_runs++;
+	} else if (offset != stats.ss_last_end) {
+		stats.ss_write_runs++;
+	}
+	stats.ss_last_object = object;
+	stats.ss_last_end = offset + lsize;
+}
+
+static void
+stats_free(uint64_t length)
+{
+	/* a length of -1 frees to the end of the object */
+	if (length == -1ULL) {
+		stats.ss_free_to_end++;
+		return;
+	}
+	stats.ss_free_bytes += length;
+	stats.ss_free_hist[stats_bucket(length)]++;
+}
+
+static void
+print_stats_histogram(const char *name, const uint64_t *hist)
+{
+	int i;
+
+	(void) printf("\t%s:\n", name);
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		if (hist[i] != 0) {
+			(void) printf("\t\t%20llu: %llu\n",
+			    1ULL << i, (u_longlong_t)hist[i]);
+		}
+	}
+}
+
+static void
+print_stats(hrtime_t elapsed)
+{
+	static const char *names[DRR_NUMTYPES] = {
+		"BEGIN", "OBJECT", "FREEOBJECTS", "WRITE", "FREE", "END",
+		"WRITE_BYREF", "SPILL", "WRITE_EMBEDDED"
+	};
+	double secs = (double)elapsed / NANOSEC;
+	uint64_t writes = 0;
+	int i;
+
+	(void) printf("STATS:\n");
+	(void) printf("\tParsed %llu bytes in %.3f s (%.1f MB/s)\n",
+	    (u_longlong_t)total_stream_len, secs, secs == 0 ? 0.0 :
+	    total_stream_len / secs / (1024 * 1024));
+	(void) printf("\tBytes by record type (headers and payloads):\n");
+	for (i = 0; i < DRR_NUMTYPES; i++) {
+		if (stats.ss_bytes[i] == 0)
+			continue;
+		(void) printf("\t\t%-16s %16llu (%.1f%%)\n", names[i],
+		    (u_longlong_t)stats.ss_bytes[i],
+		    100.0 * stats.ss_bytes[i] / total_stream_len);
+	}
+	(void) printf("\tWRITE payload = %llu, logical = %llu (%.2fx)\n",
+	    (u_longlong_t)stats.ss_write_psize,
+	    (u_longlong_t)stats.ss_write_lsize,
+	    stats.ss_write_psize == 0 ? 0.0 :
+	    (double)stats.ss_write_lsize / stats.ss_write_psize);
+	(void) printf("\tWRITE_EMBEDDED payload = %llu, logical = %llu\n",
+	    (u_longlong_t)stats.ss_embedded_psize,
+	    (u_longlong_t)stats.ss_embedded_lsize);
+
+	for (i = 0; i < STATS_BUCKETS; i++)
+		writes += stats.ss_write_hist[i];
+	print_stats_histogram("WRITE logical sizes", stats.ss_write_hist);
+	print_stats_histogram("FREE lengths", stats.ss_free_hist);
+	(void) printf("\tFREE bytes = %llu, frees to end of object = %llu\n",
+	    (u_longlong_t)stats.ss_free_bytes,
+	    (u_longlong_t)stats.ss_free_to_end);
+	(void) printf("\tWRITE locality: %llu objects, %llu sequential runs, "
+	    "%.1f writes per run\n",
+	    (u_longlong_t)stats.ss_objects_written,
+	    (u_longlong_t)stats.ss_write_runs,
+	    stats.ss_write_runs == 0 ? 0.0 :
+	    (double)writes / stats.ss_write_runs);
+}
+
 #ifdef	_UZFS
 int object_fd = -1;
 uint64_t last_object;
@@ -265,11 +402,13 @@ main(int argc, char *argv[])
 	int err;
 	zio_cksum_t zc = { { 0 } };
 	zio_cksum_t pcksum = { { 0 } };
+	uint64_t record_start = 0;
+	hrtime_t start_time;
 
 #ifdef	_UZFS
-	while ((c = getopt(argc, argv, ":vCdw:")) != -1) {
+	while ((c = getopt(argc, argv, ":vCdsw:")) != -1) {
 #else
-	while ((c = getopt(argc, argv, ":vCd")) != -1) {
+	while ((c = getopt(argc, argv, ":vCds")) != -1) {
 #endif
 		switch (c) {
 		case 'C':
@@ -285,6 +424,9 @@ main(int argc, char *argv[])
 			verbose = B_TRUE;
 			very_verbose = B_TRUE;
 			break;
+		case 's':
+			do_stats = B_TRUE;
+			break;
 #ifdef	_UZFS
 		case 'w':
 			dump_object = B_TRUE;
@@ -317,6 +459,8 @@ main(int argc, char *argv[])
 	fletcher_4_init();
 
 	send_stream = stdin;
+	(void) setvbuf(send_stream, NULL, _IOFBF, STREAM_BUFSIZE);
+	start_time = gethrtime();
 	while (read_hdr(drr, &zc)) {
 
 		/*
@@ -570,6 +714,10 @@ main(int argc, char *argv[])
 			if (dump) {
 				print_block(buf, payload_size);
 			}
+			if (do_stats) {
+				stats_write(drrw->drr_object, drrw->drr_offset,
+				    drrw->drr_logical_size, payload_size);
+			}
 			total_write_size += payload_size;
 			break;
 
@@ -623,6 +771,8 @@ main(int argc, char *argv[])
 				    (u_longlong_t)drrf->drr_offset,
 				    (longlong_t)drrf->drr_length);
 			}
+			if (do_stats)
+				stats_free(drrf->drr_length);
 			break;
 		case DRR_SPILL:
 			if (do_byteswap) {
@@ -671,6 +821,10 @@ main(int argc, char *argv[])
 			}
 			(void) ssread(buf,
 			    P2ROUNDUP(drrwe->drr_psize, 8), &zc);
+			if (do_stats) {
+				stats.ss_embedded_lsize += drrwe->drr_lsize;
+				stats.ss_embedded_psize += drrwe->drr_psize;
+			}
 			break;
 		case DRR_NUMTYPES:
 			/* should never be reached */
@@ -683,6 +837,11 @@ main(int argc, char *argv[])
 			    (longlong_t)drrc->drr_checksum.zc_word[2],
 			    (longlong_t)drrc->drr_checksum.zc_word[3]);
 		}
+		if (do_stats) {
+			stats.ss_bytes[drr->drr_type] +=
+			    total_stream_len - record_start;
+			record_start = total_stream_len;
+		}
 		pcksum = zc;
 	}
 	free(buf);
@@ -720,5 +879,7 @@ main(int argc, char *argv[])
 	    (u_longlong_t)total_write_size, (u_longlong_t)total_write_size);
 	(void) printf("\tTotal stream length = %lld (0x%llx)\n",
 	    (u_longlong_t)total_stream_len, (u_longlong_t)total_stream_len);
+	if (do_stats)
+		print_stats(gethrtime() - start_time);
 	return (0);
 }
@@ -168,6 +168,8 @@ typedef struct ztest_shared_opts {
 	uint64_t zo_maxloops;
 	uint64_t zo_metaslab_gang_bang;
 	int zo_mmp_test;
+	int zo_perf;
+	uint64_t zo_perf_seed;
 } ztest_shared_opts_t;
 
 static const ztest_shared_opts_t ztest_opts_defaults = {
@@ -190,7 +192,9 @@ static const ztest_shared_opts_t ztest_opts_defaults = {
 	.zo_init = 1,
 	.zo_time = 300,			/* 5 minutes */
 	.zo_maxloops = 50,		/* max loops during spa_freeze() */
-	.zo_metaslab_gang_bang = 32 << 10
+	.zo_metaslab_gang_bang = 32 << 10,
+	.zo_perf = 0,
+	.zo_perf_seed = 1
 };
 
 extern uint64_t metaslab_gang_bang;
@@ -340,6 +344,7 @@ ztest_func_t ztest_spa_upgrade;
 ztest_func_t ztest_fletcher;
 ztest_func_t ztest_fletcher_incr;
 ztest_func_t ztest_verify_dnode_bt;
+ztest_func_t ztest_perf_txg_sync;
 
 uint64_t zopt_always = 0ULL * NANOSEC;		/* all the time */
 uint64_t zopt_incessant = 1ULL * NANOSEC / 10;	/* every 1/10 second */
@@ -393,6 +398,42 @@ ztest_info_t ztest_info[] = {
 
 #define	ZTEST_FUNCS	(sizeof (ztest_info) / sizeof (ztest_info_t))
 
+/*
+ * Perf mode (-X) runs a fixed mix of these instead of random picks from
+ * ztest_info[].  Each op gets zp_weight slots of a schedule which every
+ * thread walks in order, starting at its own id.
+ */
+typedef struct ztest_perf_op {
+	ztest_func_t	*zp_func;
+	uint64_t	zp_weight;
+	const char	*zp_funcname;
+	uint64_t	zp_count;
+	uint64_t	zp_time;
+} ztest_perf_op_t;
+
+#define	ZTP_INIT(func, weight) \
+	{   .zp_func = (func), \
+	    .zp_weight = (weight), \
+	    .zp_funcname = # func }
+
+ztest_perf_op_t ztest_perf_ops[] = {
+	ZTP_INIT(ztest_dmu_write_parallel, 8),
+	ZTP_INIT(ztest_dmu_read_write, 4),
+	ZTP_INIT(ztest_zap, 4),
+	ZTP_INIT(ztest_zap_parallel, 2),
+	ZTP_INIT(ztest_fzap, 1),
+	ZTP_INIT(ztest_zil_commit, 2),
+	ZTP_INIT(ztest_dmu_snapshot_create_destroy, 1),
+	ZTP_INIT(ztest_perf_txg_sync, 1),
+};
+
+#define	ZTEST_PERF_OPS \
+	(sizeof (ztest_perf_ops) / sizeof (ztest_perf_op_t))
+#define	ZTEST_PERF_SLOTS	64
+
+static int ztest_perf_schedule[ZTEST_PERF_SLOTS];
+static int ztest_perf_slots;
+
 /*
  * The following struct is used to hold a list of uncalled commit callbacks.
  * The callbacks are ordered by txg number.
@@ -637,6 +678,9 @@ usage(boolean_t requested)
 	    "\t[-B alt_ztest (default: <none>)] alternate ztest path\n"
 	    "\t[-o variable=value] ... set global variable to an unsigned\n"
 	    "\t    32-bit integer value\n"
+	    "\t[-X] perf mode: fixed op mix for the whole run, no kills,\n"
+	    "\t    ops/sec and txg stats at the end\n"
+	    "\t[-S seed (default: %llu)] random seed of perf mode\n"
 	    "\t[-h] (print help)\n"
 	    "",
 	    zo->zo_pool,
@@ -655,7 +699,8 @@ usage(boolean_t requested)
 	    zo->zo_dir,					/* -f */
 	    (u_longlong_t)zo->zo_time,			/* -T */
 	    (u_longlong_t)zo->zo_maxloops,		/* -F */
-	    (u_longlong_t)zo->zo_passtime);
+	    (u_longlong_t)zo->zo_passtime,		/* -P */
+	    (u_longlong_t)zo->zo_perf_seed);		/* -S */
 	exit(requested ? 0 : 1);
 }
 
@@ -672,7 +717,7 @@ process_options(int argc, char **argv)
 	bcopy(&ztest_opts_defaults, zo, sizeof (*zo));
 
 	while ((opt = getopt(argc, argv,
-	    "v:s:a:m:r:R:d:t:g:i:k:p:f:MVET:P:hF:B:o:")) != EOF) {
+	    "v:s:a:m:r:R:d:t:g:i:k:p:f:MVET:P:hF:B:o:XS:")) != EOF) {
 		value = 0;
 		switch (opt) {
 		case 'v':
@@ -689,6 +734,7 @@ process_options(int argc, char **argv)
 		case 'T':
 		case 'P':
 		case 'F':
+		case 'S':
 			value = nicenumtoull(optarg);
 		}
 		switch (opt) {
@@ -767,6 +813,12 @@ process_options(int argc, char **argv)
 			if (set_global_var(optarg) != 0)
 				usage(B_FALSE);
 			break;
+		case 'X':
+			zo->zo_perf = 1;
+			break;
+		case 'S':
+			zo->zo_perf_seed = value;
+			break;
 		case 'h':
 			usage(B_TRUE);
 			break;
@@ -779,6 +831,12 @@ process_options(int argc, char **argv)
 
 	zo->zo_raidz_parity = MIN(zo->zo_raidz_parity, zo->zo_raidz - 1);
 
+	/* perf mode is a single pass over the whole run time */
+	if (zo->zo_perf) {
+		zo->zo_killrate = 0;
+		zo->zo_passtime = zo->zo_time;
+	}
+
 	zo->zo_vdevtime =
 	    (zo->zo_vdevs > 0 ? zo->zo_time * NANOSEC / zo->zo_vdevs :
 	    UINT64_MAX >> 2);
@@ -848,6 +906,27 @@ ztest_kill(ztest_shared_t *zs)
 	(void) kill(getpid(), SIGKILL);
 }
 
+/*
+ * Seeded xorshift generator used instead of /dev/urandom in perf mode, so
+ * that runs with the same seed do the same work.  Worker threads seed it
+ * from their id, see ztest_perf_thread().
+ */
+static __thread uint64_t ztest_perf_rand_state;
+
+static uint64_t
+ztest_perf_random(void)
+{
+	uint64_t x = ztest_perf_rand_state;
+
+	if (x == 0)
+		x = ztest_opts.zo_perf_seed * 0x9e3779b97f4a7c15ULL | 1;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	ztest_perf_rand_state = x;
+	return (x);
+}
+
 static uint64_t
 ztest_random(uint64_t range)
 {
@@ -858,6 +937,9 @@ ztest_random(uint64_t range)
 	if (range == 0)
 		return (0);
 
+	if (ztest_opts.zo_perf)
+		return (ztest_perf_random() % range);
+
 	if (read(ztest_fd_rand, &r, sizeof (r)) != sizeof (r))
 		fatal(1, "short read from /dev/urandom");
 
@@ -2094,14 +2176,15 @@ ztest_get_done(zgd_t *zgd, int error)
 	ztest_object_unlock(zd, object);
 
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	umem_free(zgd, sizeof (*zgd));
 	umem_free(zzp, sizeof (*zzp));
 }
 
 static int
-ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
+ztest_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio)
 {
 	ztest_ds_t *zd = arg;
 	objset_t *os = zd->zd_os;
@@ -2136,7 +2219,7 @@ ztest_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
 	db = NULL;
 
 	zgd = umem_zalloc(sizeof (*zgd), UMEM_NOFAIL);
-	zgd->zgd_zilog = zd->zd_zilog;
+	zgd->zgd_lwb = lwb;
 	zgd_private = umem_zalloc(sizeof (ztest_zgd_private_t), UMEM_NOFAIL);
 	zgd_private->z_zd = zd;
 	zgd_private->z_object = object;
@@ -2848,7 +2931,8 @@ ztest_vdev_add_remove(ztest_ds_t *zd, uint64_t id)
 		/*
 		 * Grab the guid from the head of the log class rotor.
 		 */
-		guid = spa_log_class(spa)->mc_rotor->mg_vd->vdev_guid;
+		guid = spa_log_class(spa)->mc_allocator[0].mca_rotor->
+		    mg_vd->vdev_guid;
 
 		spa_config_exit(spa, SCL_VDEV, FTAG);
 
@@ -6124,6 +6208,100 @@ ztest_deadman_alarm(int sig)
 }
 #endif
 
+/*
+ * Perf mode only: wait for a txg sync, like an fsync heavy application or
+ * a full dirty data limit makes writers do.
+ */
+/* ARGSUSED */
+void
+ztest_perf_txg_sync(ztest_ds_t *zd, uint64_t id)
+{
+	txg_wait_synced(dmu_objset_pool(zd->zd_os), 0);
+}
+
+/*
+ * Spread the weights of ztest_perf_ops[] over the schedule, so that ops
+ * with a high weight are interleaved with the others instead of bunched.
+ */
+static void
+ztest_perf_init(void)
+{
+	int64_t credit[ZTEST_PERF_OPS] = { 0 };
+	uint64_t total = 0;
+	int p, s, best;
+
+	for (p = 0; p < ZTEST_PERF_OPS; p++)
+		total += ztest_perf_ops[p].zp_weight;
+	VERIFY3U(total, <=, ZTEST_PERF_SLOTS);
+
+	for (s = 0; s < total; s++) {
+		best = 0;
+		for (p = 0; p < ZTEST_PERF_OPS; p++) {
+			credit[p] += ztest_perf_ops[p].zp_weight;
+			if (credit[p] > credit[best])
+				best = p;
+		}
+		credit[best] -= total;
+		ztest_perf_schedule[s] = best;
+	}
+	ztest_perf_slots = total;
+}
+
+static void *
+ztest_perf_thread(void *arg)
+{
+	uint64_t id = (uintptr_t)arg;
+	ztest_shared_t *zs = ztest_shared;
+	ztest_ds_t *zd = &ztest_ds[id % ztest_opts.zo_datasets];
+	ztest_perf_op_t *zp;
+	hrtime_t functime;
+	uint64_t n;
+
+	ztest_perf_rand_state = (ztest_opts.zo_perf_seed + id + 1) *
+	    0x9e3779b97f4a7c15ULL | 1;
+
+	for (n = id; gethrtime() < zs->zs_thread_stop; n++) {
+		if (zs->zs_enospc_count > 10)
+			break;
+
+		zp = &ztest_perf_ops[ztest_perf_schedule[n % ztest_perf_slots]];
+		functime = gethrtime();
+		zp->zp_func(zd, id);
+		functime = gethrtime() - functime;
+
+		atomic_add_64(&zp->zp_count, 1);
+		atomic_add_64(&zp->zp_time, functime);
+	}
+
+	thread_exit();
+
+	return (NULL);
+}
+
+static void
+ztest_perf_report(hrtime_t elapsed, uint64_t txgs)
+{
+	double secs = MAX((double)elapsed / NANOSEC, 1e-9);
+	ztest_perf_op_t *zp;
+	int p;
+
+	(void) printf("\nPerf summary (seed %llu, %.1f sec):\n\n",
+	    (u_longlong_t)ztest_opts.zo_perf_seed, secs);
+	(void) printf("%10s %10s %10s   %s\n",
+	    "Calls", "Calls/s", "Avg usec", "Function");
+	(void) printf("%10s %10s %10s   %s\n",
+	    "-----", "-------", "--------", "--------");
+	for (p = 0; p < ZTEST_PERF_OPS; p++) {
+		zp = &ztest_perf_ops[p];
+		(void) printf("%10llu %10.1f %10.1f   %s\n",
+		    (u_longlong_t)zp->zp_count, zp->zp_count / secs,
+		    zp->zp_count ? (double)zp->zp_time / zp->zp_count /
+		    (NANOSEC / MICROSEC) : 0.0, zp->zp_funcname);
+	}
+	(void) printf("\n%llu txgs synced, %.2f txgs/s\n\n",
+	    (u_longlong_t)txgs, txgs / secs);
+}
+
 static void
 ztest_execute(int test, ztest_info_t *zi, uint64_t id)
 {
@@ -6156,6 +6334,9 @@ ztest_thread(void *arg)
 	ztest_info_t *zi;
 	ztest_shared_callstate_t *zc;
 
+	if (ztest_opts.zo_perf)
+		return (ztest_perf_thread(arg));
+
 	while ((now = gethrtime()) < zs->zs_thread_stop) {
 		/*
 		 * See if it's time to force a crash.
@@ -6318,7 +6499,7 @@ ztest_run(ztest_shared_t *zs)
 	spa_t *spa;
 	objset_t *os;
 	kthread_t *resume_thread;
-	uint64_t object;
+	uint64_t object, txg = 0;
 	int error;
 	int t, d;
 
@@ -6420,6 +6601,11 @@ ztest_run(ztest_shared_t *zs)
 	if (ztest_opts.zo_verbose >= 4)
 		(void) printf("starting main threads...\n");
 
+	if (ztest_opts.zo_perf) {
+		ztest_perf_init();
+		txg = spa_last_synced_txg(spa);
+	}
+
 	/*
 	 * Kick off all the tests that run in parallel.
 	 */
@@ -6450,6 +6636,11 @@ ztest_run(ztest_shared_t *zs)
 			ztest_dataset_close(t);
 	}
 
+	if (ztest_opts.zo_perf) {
+		ztest_perf_report(gethrtime() - zs->zs_thread_start,
+		    spa_last_synced_txg(spa) - txg);
+	}
+
 	txg_wait_synced(spa_get_dsl(spa), 0);
 
 	zs->zs_alloc = metaslab_class_get_alloc(spa_normal_class(spa));
@@ -6490,7 +6681,8 @@ ztest_run(ztest_shared_t *zs)
 	 * Verify that we can export the pool and reimport it under a
 	 * different name.
 	 */
-	if ((ztest_random(2) == 0) && !ztest_opts.zo_mmp_test) {
+	if ((ztest_random(2) == 0) && !ztest_opts.zo_mmp_test &&
+	    !ztest_opts.zo_perf) {
 		char name[ZFS_MAX_DATASET_NAME_LEN];
 		(void) snprintf(name, sizeof (name), "%s_import",
 		    ztest_opts.zo_pool);
@@ -0,0 +1,18 @@
+dnl #
+dnl # Check for Google Benchmark, used by the optional bench_uzfs
+dnl # micro-benchmarks of tests/cstor.
+dnl #
+AC_DEFUN([ZFS_AC_CONFIG_USER_BENCHMARK], [
+	AC_ARG_WITH([benchmark],
+		[AC_HELP_STRING([--with-benchmark],
+		    [build the bench_uzfs micro-benchmarks [[default: no]]])],
+		[],
+		[with_benchmark=no])
+
+	AS_IF([test "x$with_benchmark" != xno], [
+		AC_LANG_PUSH([C++])
+		AC_CHECK_HEADER([benchmark/benchmark.h], [],
+		    [AC_MSG_FAILURE([Google Benchmark package required])])
+		AC_LANG_POP([C++])
+	])
+])
@@ -0,0 +1,22 @@
+dnl #
+dnl # Check for the Linux io_uring interface, used by the user space file
+dnl # vdev to keep many IOs in flight without a thread for each of them.
+dnl #
+AC_DEFUN([ZFS_AC_CONFIG_USER_IO_URING], [
+	AC_MSG_CHECKING([for io_uring])
+	AC_TRY_COMPILE([
+		#include <linux/io_uring.h>
+		#include <sys/syscall.h>
+	],[
+		struct io_uring_params p;
+		(void) p;
+		return (__NR_io_uring_setup + __NR_io_uring_enter +
+		    __NR_io_uring_register + IORING_REGISTER_FILES +
+		    IORING_OP_READV);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE([HAVE_IO_URING], 1, [Define if io_uring is available])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
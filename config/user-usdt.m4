@@ -0,0 +1,17 @@
+dnl #
+dnl # Check for the systemtap <sys/sdt.h>, used to turn the DTRACE_PROBE
+dnl # sites of libzpool into USDT probes for bpftrace, perf and systemtap.
+dnl #
+AC_DEFUN([ZFS_AC_CONFIG_USER_USDT], [
+	AC_MSG_CHECKING([for USDT probes])
+	AC_TRY_COMPILE([
+		#include <sys/sdt.h>
+	],[
+		STAP_PROBE2(zfs, conftest, 1, 2);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE([HAVE_USDT], 1, [Define if USDT probes are available])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
@@ -0,0 +1,17 @@
+dnl #
+dnl # Check for libzstd, which backs the zstd compression algorithm in
+dnl # user space.  It is optional: without it zstd cannot be selected.
+dnl # ZSTD_minCLevel() marks a release (1.4.0) with the negative levels.
+dnl #
+AC_DEFUN([ZFS_AC_CONFIG_USER_ZSTD], [
+	LIBZSTD=
+
+	AC_CHECK_HEADER([zstd.h], [
+		AC_CHECK_LIB([zstd], [ZSTD_minCLevel], [
+			LIBZSTD="-lzstd"
+			AC_DEFINE([HAVE_ZSTD], 1, [Define if you have libzstd])
+		])
+	])
+
+	AC_SUBST([LIBZSTD])
+])
@@ -7,6 +7,7 @@ AC_DEFUN([ZFS_AC_CONFIG_USER], [
 	ZFS_AC_CONFIG_USER_SYSTEMD
 	ZFS_AC_CONFIG_USER_DRACUT
 	ZFS_AC_CONFIG_USER_ZLIB
+	ZFS_AC_CONFIG_USER_ZSTD
 	ZFS_AC_CONFIG_USER_LIBUUID
 	ZFS_AC_CONFIG_USER_LIBTIRPC
 	ZFS_AC_CONFIG_USER_LIBBLKID
@@ -20,6 +21,9 @@ AC_DEFUN([ZFS_AC_CONFIG_USER], [
 	ZFS_AC_CONFIG_USER_LIBAIO
 	ZFS_AC_CONFIG_USER_JEMALLOC
 	ZFS_AC_CONFIG_USER_FIO
+	ZFS_AC_CONFIG_USER_BENCHMARK
+	ZFS_AC_CONFIG_USER_IO_URING
+	ZFS_AC_CONFIG_USER_USDT
 
 	ZFS_AC_TEST_FRAMEWORK
 
@@ -75,6 +75,25 @@ AC_DEFUN([ZFS_AC_DEBUGINFO], [
 	AC_MSG_RESULT([$enable_debuginfo])
 ])
 
+AC_DEFUN([ZFS_AC_LOCKSTAT], [
+	AC_MSG_CHECKING([whether userspace lock statistics will be collected])
+	AC_ARG_ENABLE([lockstat],
+		[AS_HELP_STRING([--enable-lockstat],
+		[Profile libzpool mutexes and rwlocks @<:@default=no@:>@])],
+		[],
+		[enable_lockstat=no])
+
+	AS_CASE(["x$enable_lockstat"],
+		["xyes"],
+		[DEBUG_CFLAGS="${DEBUG_CFLAGS} -DZFS_LOCKSTAT"],
+		["xno"],
+		[],
+		[AC_MSG_ERROR([Unknown option $enable_lockstat])])
+
+	AC_SUBST(DEBUG_CFLAGS)
+	AC_MSG_RESULT([$enable_lockstat])
+])
+
 AC_DEFUN([ZFS_AC_CONFIG_ALWAYS], [
 	ZFS_AC_CONFIG_ALWAYS_NO_UNUSED_BUT_SET_VARIABLE
 	ZFS_AC_CONFIG_ALWAYS_NO_BOOL_COMPARE
@@ -123,6 +142,7 @@ AC_DEFUN([ZFS_AC_CONFIG], [
 	AM_CONDITIONAL([WANT_DEVNAME2DEVID], [test "x$user_libudev" = xyes ])
 	AM_CONDITIONAL([WANT_MMAP_LIBAIO], [test "x$user_libaio" = xyes ])
 	AM_CONDITIONAL([CONFIG_FIO], [test x$FIO_SRCDIR != x ])
+	AM_CONDITIONAL([WANT_BENCHMARK], [test "x$with_benchmark" = xyes ])
 ])
 
 dnl #
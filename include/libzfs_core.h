@@ -97,6 +97,9 @@ int lzc_sync(const char *, nvlist_t *, nvlist_t **);
 
 int lzc_stats(const char *dataset, nvlist_t *innvl, nvlist_t **outnvl);
 int lzc_list_snap(const char *dataset, nvlist_t *innvl, nvlist_t **outnvl);
+int lzc_stats_binary(const char *dataset, void **bufp, size_t *sizep);
+int lzc_set_props_multi(const char *, nvlist_t *, nvlist_t **);
+int lzc_batch(const char *, nvlist_t **, uint_t, nvlist_t **);
 
 #ifdef	__cplusplus
 }
@@ -72,6 +72,7 @@ struct libzfs_handle {
 	boolean_t libzfs_mnttab_enable;
 	avl_tree_t libzfs_mnttab_cache;
 	int libzfs_pool_iter;
+	size_t libzfs_dst_size_hint; /* largest nvlist_dst size needed */
 #if defined(HAVE_LIBTOPO)
 	topo_hdl_t *libzfs_topo_hdl;
 	libzfs_fru_t **libzfs_fru_hash;
@@ -148,6 +149,8 @@ int zpool_standard_error(libzfs_handle_t *, int, const char *);
 int zpool_standard_error_fmt(libzfs_handle_t *, int, const char *, ...);
 
 zfs_handle_t *make_dataset_handle_zc(libzfs_handle_t *, zfs_cmd_t *);
+zfs_handle_t *make_dataset_handle_nvl(libzfs_handle_t *, const char *,
+    const dmu_objset_stats_t *, nvlist_t *);
 zfs_handle_t *make_dataset_simple_handle_zc(zfs_handle_t *, zfs_cmd_t *);
 
 int zprop_parse_value(libzfs_handle_t *, nvpair_t *, int, zfs_type_t,
@@ -94,6 +94,25 @@ blk_queue_set_write_cache(struct request_queue *q, bool wc, bool fua)
 #endif
 }
 
+/*
+ * Whether the device has a volatile write cache which must be flushed for
+ * writes to be stable, see blk_queue_set_write_cache() for the interfaces.
+ * Devices such as persistent memory don't.  Kernels with the legacy
+ * blk_queue_ordered() interface are assumed to have one.
+ */
+static inline boolean_t
+blk_queue_has_write_cache(struct request_queue *q)
+{
+#if defined(HAVE_BLK_QUEUE_WRITE_CACHE_GPL_ONLY) || \
+	defined(HAVE_BLK_QUEUE_WRITE_CACHE)
+	return (test_bit(QUEUE_FLAG_WC, &q->queue_flags));
+#elif defined(HAVE_BLK_QUEUE_FLUSH_GPL_ONLY) || defined(HAVE_BLK_QUEUE_FLUSH)
+	return ((q->flush_flags & REQ_FLUSH) != 0);
+#else
+	return (B_TRUE);
+#endif
+}
+
 /*
  * Most of the blk_* macros were removed in 2.6.36.  Ostensibly this was
  * done to improve readability and allow easier grepping.  However, from
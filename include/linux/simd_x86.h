@@ -50,6 +50,10 @@
  * 	zfs_bmi1_available()
  * 	zfs_bmi2_available()
  *
+ * 	zfs_shani_available()
+ *
+ * 	zfs_gfni_available()
+ *
  * 	zfs_avx512f_available()
  * 	zfs_avx512cd_available()
  * 	zfs_avx512er_available()
@@ -148,7 +152,9 @@ typedef enum cpuid_inst_sets {
 	AVX512VBMI,
 	AVX512PF,
 	AVX512ER,
-	AVX512VL
+	AVX512VL,
+	SHA_NI,
+	GFNI
 } cpuid_inst_sets_t;
 
 /*
@@ -194,7 +200,9 @@ static const cpuid_feature_desc_t cpuid_features[] = {
 	[AVX512VBMI]	= {7U, 0U, _AVX512VBMI_BIT,	ECX	},
 	[AVX512PF]	= {7U, 0U, _AVX512PF_BIT,	EBX	},
 	[AVX512ER]	= {7U, 0U, _AVX512ER_BIT,	EBX	},
-	[AVX512VL]	= {7U, 0U, _AVX512ER_BIT,	EBX	}
+	[AVX512VL]	= {7U, 0U, _AVX512ER_BIT,	EBX	},
+	[SHA_NI]	= {7U, 0U,	1U << 29,	EBX	},
+	[GFNI]		= {7U, 0U,	1U << 8,	ECX	}
 };
 
 /*
@@ -265,6 +273,8 @@ CPUID_FEATURE_CHECK(avx512vbmi, AVX512VBMI);
 CPUID_FEATURE_CHECK(avx512pf, AVX512PF);
 CPUID_FEATURE_CHECK(avx512er, AVX512ER);
 CPUID_FEATURE_CHECK(avx512vl, AVX512VL);
+CPUID_FEATURE_CHECK(sha_ni, SHA_NI);
+CPUID_FEATURE_CHECK(gfni, GFNI);
 
 #endif /* !defined(_KERNEL) */
 
@@ -442,6 +452,36 @@ zfs_bmi2_available(void)
 #endif
 }
 
+/*
+ * Check if SHA extensions are available
+ */
+static inline boolean_t
+zfs_shani_available(void)
+{
+#if defined(_KERNEL) && defined(X86_FEATURE_SHA_NI)
+	return (!!boot_cpu_has(X86_FEATURE_SHA_NI));
+#elif defined(_KERNEL) && !defined(X86_FEATURE_SHA_NI)
+	return (B_FALSE);
+#else
+	return (__cpuid_has_sha_ni());
+#endif
+}
+
+/*
+ * Check if the Galois Field New Instructions are available
+ */
+static inline boolean_t
+zfs_gfni_available(void)
+{
+#if defined(_KERNEL) && defined(X86_FEATURE_GFNI)
+	return (!!boot_cpu_has(X86_FEATURE_GFNI));
+#elif defined(_KERNEL) && !defined(X86_FEATURE_GFNI)
+	return (B_FALSE);
+#else
+	return (__cpuid_has_gfni());
+#endif
+}
+
 
 /*
  * AVX-512 family of instruction sets:
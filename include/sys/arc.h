@@ -125,6 +125,20 @@ typedef enum arc_flags
 	ARC_FLAG_COMPRESSED_ARC		= 1 << 17,
 	ARC_FLAG_SHARED_DATA		= 1 << 18,
 
+	/*
+	 * Indicates that the buffer was read by a scan-like consumer (scrub,
+	 * rebuild) and should not displace the cached working set.  It may be
+	 * passed into arc_read() by callers, and is also set by the ARC for
+	 * reads whose priority is in zfs_arc_uncached_prio_mask.
+	 */
+	ARC_FLAG_UNCACHED		= 1 << 19,
+
+	/*
+	 * Returned by arc_read() when a demand read found the block brought
+	 * in, or being brought in, by a predictive prefetch.
+	 */
+	ARC_FLAG_PREFETCH_HIT		= 1 << 20,
+
 	/*
 	 * The arc buffer's compression mode is stored in the top 7 bits of the
 	 * flags field, so these dummy flags are included so that MDB can
@@ -207,6 +221,7 @@ void arc_space_consume(uint64_t space, arc_space_type_t type);
 void arc_space_return(uint64_t space, arc_space_type_t type);
 boolean_t arc_is_metadata(arc_buf_t *buf);
 enum zio_compress arc_get_compression(arc_buf_t *buf);
+boolean_t arc_buf_is_decompressed(arc_buf_t *buf);
 int arc_decompress(arc_buf_t *buf);
 arc_buf_t *arc_alloc_buf(spa_t *spa, void *tag, arc_buf_contents_t type,
     int32_t size);
@@ -246,6 +261,10 @@ void arc_remove_prune_callback(arc_prune_t *p);
 void arc_freed(spa_t *spa, const blkptr_t *bp);
 
 void arc_flush(spa_t *spa, boolean_t retry);
+void arc_objset_set_limit(spa_t *spa, uint64_t objset, uint64_t limit,
+    uint_t weight);
+int arc_objset_get_limit(spa_t *spa, uint64_t objset, uint64_t *size,
+    uint64_t *limit, uint_t *weight);
 void arc_tempreserve_clear(uint64_t reserve);
 int arc_tempreserve_space(uint64_t reserve, uint64_t txg);
 
@@ -86,6 +86,24 @@ typedef struct arc_state {
 	arc_state_type_t arcs_state;
 } arc_state_t;
 
+/*
+ * Per-objset ARC accounting, created by arc_objset_set_limit().  ao_size
+ * is the size of the hdr data blocks owned by the objset (the same bytes
+ * counted in arcstat_compressed_size).  With a non-zero ao_limit the
+ * reclaim thread evicts the objset's own buffers once it goes over; with
+ * a non-zero ao_weight the objset's buffers are passed over by general
+ * eviction while it holds less than its weighted share of arc_c.  Entries
+ * are referenced by headers without a hold, so they live until arc_fini().
+ */
+typedef struct arc_objset {
+	avl_node_t	ao_node;
+	uint64_t	ao_spa;		/* spa_load_guid() of the pool */
+	uint64_t	ao_objset;
+	uint64_t	ao_limit;	/* bytes, 0 for no limit */
+	uint_t		ao_weight;	/* 0 for no protection */
+	uint64_t	ao_size;	/* updated atomically */
+} arc_objset_t;
+
 typedef struct arc_callback arc_callback_t;
 
 struct arc_callback {
@@ -95,6 +113,10 @@ struct arc_callback {
 	boolean_t		acb_compressed;
 	zio_t			*acb_zio_dummy;
 	arc_callback_t		*acb_next;
+	/* set when the read was sampled for the arc_trace kstat */
+	hrtime_t		acb_trace_start;
+	boolean_t		acb_trace_l2;
+	zbookmark_phys_t	acb_trace_zb;
 };
 
 typedef struct arc_write_callback arc_write_callback_t;
@@ -167,8 +189,98 @@ typedef struct l1arc_buf_hdr {
 
 	arc_callback_t		*b_acb;
 	abd_t			*b_pabd;
+
+	/*
+	 * owning objset when it has ARC limits; set under the hash lock,
+	 * or by arc_write() while the hdr is still anonymous
+	 */
+	arc_objset_t		*b_objset;
 } l1arc_buf_hdr_t;
 
+/*
+ * Persistent L2ARC on-disk structures.
+ *
+ * The first L2ARC_DEV_HDR_SIZE bytes after the front vdev labels of a cache
+ * device hold an l2arc_dev_hdr_phys_t.  Every L2ARC_LOG_BLK_ENTRIES buffers
+ * written by l2arc_write_buffers() are described by an l2arc_log_blk_phys_t
+ * written inline with the data at the write hand.  Log blocks are chained
+ * from the newest to the oldest via l2arc_log_blkptr_t back pointers which
+ * carry the checksum of the block they point to; the device header points
+ * at the newest one.  On import the chain is walked to recreate L2-only
+ * headers without reading any of the cached data.
+ *
+ * All structures are stored in native byte order; a device written by a
+ * host of the other endianness is simply not rebuilt.
+ */
+#define	L2ARC_DEV_HDR_MAGIC	0x5a46534341434845ULL	/* "ZFSCACHE" */
+#define	L2ARC_LOG_BLK_MAGIC	0x4c4f47424c4b4844ULL	/* "LOGBLKHD" */
+#define	L2ARC_PERSIST_VERSION	1
+
+#define	L2ARC_DEV_HDR_SIZE	SPA_MINBLOCKSIZE
+#define	L2ARC_LOG_BLK_SIZE	(16 * 1024)
+
+/* l2dh_flags */
+#define	L2ARC_DEV_HDR_WRAPPED	(1ULL << 0)	/* write hand has wrapped */
+
+typedef struct l2arc_log_blkptr {
+	uint64_t		lbp_daddr;	/* device address, 0 if none */
+	uint64_t		lbp_asize;	/* allocated size on device */
+	zio_cksum_t		lbp_cksum;	/* fletcher4 of the log block */
+} l2arc_log_blkptr_t;
+
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t		l2dh_magic;
+	uint64_t		l2dh_version;
+	uint64_t		l2dh_spa_guid;
+	uint64_t		l2dh_vdev_guid;
+	uint64_t		l2dh_flags;
+	uint64_t		l2dh_start;	/* l2ad_start when written */
+	uint64_t		l2dh_end;	/* l2ad_end when written */
+	uint64_t		l2dh_hand;	/* l2ad_hand when written */
+	l2arc_log_blkptr_t	l2dh_head;	/* newest log block */
+	uint64_t		l2dh_pad[(L2ARC_DEV_HDR_SIZE -
+	    8 * sizeof (uint64_t) - sizeof (l2arc_log_blkptr_t) -
+	    sizeof (zio_cksum_t)) / sizeof (uint64_t)];
+	zio_cksum_t		l2dh_cksum;	/* fletcher4 of the above */
+} l2arc_dev_hdr_phys_t;
+
+/*
+ * One cached buffer.  le_prop is encoded with the L2ARC_LE_* macros below.
+ */
+typedef struct l2arc_log_ent_phys {
+	dva_t			le_dva;
+	uint64_t		le_birth;
+	uint64_t		le_prop;
+	uint64_t		le_daddr;
+} l2arc_log_ent_phys_t;
+
+#define	L2ARC_LE_GET_LSIZE(le)	\
+	BF64_GET_SB((le)->le_prop, 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2ARC_LE_SET_LSIZE(le, x)	\
+	BF64_SET_SB((le)->le_prop, 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2ARC_LE_GET_PSIZE(le)	\
+	BF64_GET_SB((le)->le_prop, 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2ARC_LE_SET_PSIZE(le, x)	\
+	BF64_SET_SB((le)->le_prop, 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2ARC_LE_GET_COMPRESS(le)	BF64_GET((le)->le_prop, 32, 7)
+#define	L2ARC_LE_SET_COMPRESS(le, x)	BF64_SET((le)->le_prop, 32, 7, x)
+#define	L2ARC_LE_GET_TYPE(le)		BF64_GET((le)->le_prop, 40, 8)
+#define	L2ARC_LE_SET_TYPE(le, x)	BF64_SET((le)->le_prop, 40, 8, x)
+
+#define	L2ARC_LOG_BLK_HDR_SIZE	\
+	(3 * sizeof (uint64_t) + sizeof (l2arc_log_blkptr_t))
+#define	L2ARC_LOG_BLK_ENTRIES	\
+	((L2ARC_LOG_BLK_SIZE - L2ARC_LOG_BLK_HDR_SIZE) / \
+	sizeof (l2arc_log_ent_phys_t))
+
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;
+	uint64_t		lb_version;
+	uint64_t		lb_nentries;	/* entries in use */
+	l2arc_log_blkptr_t	lb_prev;	/* next older log block */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_ENTRIES];
+} l2arc_log_blk_phys_t;
+
 typedef struct l2arc_dev {
 	vdev_t			*l2ad_vdev;	/* vdev */
 	spa_t			*l2ad_spa;	/* spa */
@@ -181,6 +293,18 @@ typedef struct l2arc_dev {
 	list_t			l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
 	refcount_t		l2ad_alloc;	/* allocated bytes */
+
+	/* persistent L2ARC, protected by the feed thread */
+	l2arc_dev_hdr_phys_t	*l2ad_dev_hdr;	/* in-core device header */
+	uint64_t		l2ad_dev_hdr_asize;
+	l2arc_log_blk_phys_t	*l2ad_log_blk;	/* log block being filled */
+	uint64_t		l2ad_log_blk_asize;
+	boolean_t		l2ad_log_blk_written; /* this write round */
+
+	/* protected by l2ad_mtx */
+	boolean_t		l2ad_rebuild;	/* rebuild in progress */
+	boolean_t		l2ad_rebuild_cancel;
+	kcondvar_t		l2ad_rebuild_cv;
 } l2arc_dev_t;
 
 typedef struct l2arc_buf_hdr {
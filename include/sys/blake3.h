@@ -0,0 +1,84 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * BLAKE3 hashing, following the specification and reference
+ * implementation at https://github.com/BLAKE3-team/BLAKE3.
+ */
+
+#ifndef	_SYS_BLAKE3_H_
+#define	_SYS_BLAKE3_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#ifdef  _KERNEL
+#include <sys/types.h>
+#else
+#include <stdint.h> /* uint32_t... */
+#include <stdlib.h> /* size_t ... */
+#endif
+
+#define	BLAKE3_KEY_LEN		32
+#define	BLAKE3_OUT_LEN		32
+#define	BLAKE3_BLOCK_LEN	64
+#define	BLAKE3_CHUNK_LEN	1024
+
+/*
+ * The chaining value stack holds one entry per set bit of the number of
+ * chunks hashed so far, plus one.  This is enough for 2^16 chunks (64MiB),
+ * four times the largest block, and keeps the context small enough to live
+ * on the stack.
+ */
+#define	BLAKE3_MAX_DEPTH	17
+
+typedef struct blake3_chunk_state {
+	uint32_t	cv[8];
+	uint64_t	chunk_counter;
+	uint8_t		buf[BLAKE3_BLOCK_LEN];
+	uint8_t		buf_len;
+	uint8_t		blocks_compressed;
+	uint8_t		flags;
+} blake3_chunk_state_t;
+
+typedef struct {
+	uint32_t		key[8];
+	blake3_chunk_state_t	chunk;
+	uint8_t			cv_stack_len;
+	uint8_t			cv_stack[BLAKE3_MAX_DEPTH * BLAKE3_OUT_LEN];
+} BLAKE3_CTX;
+
+void Blake3_Init(BLAKE3_CTX *ctx);
+void Blake3_InitKeyed(BLAKE3_CTX *ctx, const uint8_t key[BLAKE3_KEY_LEN]);
+void Blake3_Update(BLAKE3_CTX *ctx, const void *data, size_t len);
+void Blake3_Final(const BLAKE3_CTX *ctx, uint8_t out[BLAKE3_OUT_LEN]);
+
+/* Implementation selection, as for fletcher 4 */
+void blake3_impl_init(void);
+void blake3_impl_fini(void);
+int blake3_impl_set(const char *val);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_BLAKE3_H_ */
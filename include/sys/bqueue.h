@@ -25,18 +25,27 @@ extern "C" {
 
 #include	<sys/zfs_context.h>
 
+/*
+ * A bqueue has one producer and one consumer thread, which pass elements
+ * through a ring without taking bq_lock; it is only taken to sleep on a
+ * full or empty queue, or to wake the other side.
+ */
 typedef struct bqueue {
-	list_t bq_list;
+	void **bq_ring;
+	uint64_t bq_nslots;		/* power of 2 */
+	volatile uint64_t bq_head;	/* next slot to dequeue */
+	volatile uint64_t bq_tail;	/* next slot to enqueue */
+	volatile uint64_t bq_size;
+	uint64_t bq_maxsize;
+	size_t bq_node_offset;
 	kmutex_t bq_lock;
 	kcondvar_t bq_add_cv;
 	kcondvar_t bq_pop_cv;
-	uint64_t bq_size;
-	uint64_t bq_maxsize;
-	size_t bq_node_offset;
+	volatile uint64_t bq_add_need;	/* size a sleeping producer adds */
+	volatile uint32_t bq_pop_waiting; /* the consumer is sleeping */
 } bqueue_t;
 
 typedef struct bqueue_node {
-	list_node_t bqn_node;
 	uint64_t bqn_size;
 } bqueue_node_t;
 
@@ -0,0 +1,131 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_BTREE_H
+#define	_SYS_BTREE_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * An in-memory B+ tree of fixed size elements, for sets with too many
+ * members for an AVL tree.  An AVL tree needs a node allocation and three
+ * pointers per element, and a lookup visits a cache line per level.  Here
+ * the elements are copied into sorted arrays in 4k leaves, and the core
+ * nodes above them hold a copy of the first element of each child but the
+ * first, so a lookup is a binary search in a few core nodes and one leaf.
+ *
+ * Elements are moved around as the tree changes, so pointers into the tree
+ * are only good until the next insertion or removal.  A caller may change
+ * an element in place as long as its position in the order stays the same,
+ * but must then call zfs_btree_update() on its index so that the copy in
+ * the core nodes is fixed up as well.
+ *
+ * Trees are not locked; the caller must serialize access.
+ */
+
+/*
+ * The number of separators in a core node, and the size of a leaf.  A core
+ * node has one more child than it has separators.
+ */
+#define	BTREE_CORE_ELEMS	126
+#define	BTREE_LEAF_SIZE		4096
+
+typedef struct zfs_btree_hdr {
+	struct zfs_btree_core	*bth_parent;
+	boolean_t		bth_core;
+	uint32_t		bth_count;	/* elements or separators */
+} zfs_btree_hdr_t;
+
+/*
+ * The separators follow the children in the same allocation; separator i
+ * is a copy of the first element below child i + 1.
+ */
+typedef struct zfs_btree_core {
+	zfs_btree_hdr_t	btc_hdr;
+	zfs_btree_hdr_t	*btc_children[BTREE_CORE_ELEMS + 1];
+} zfs_btree_core_t;
+
+/*
+ * The position of an element, or of the insertion point after a failed
+ * zfs_btree_find().  Indexes always refer to a leaf.
+ */
+typedef struct zfs_btree_index {
+	zfs_btree_hdr_t	*bti_node;
+	uint32_t	bti_offset;
+} zfs_btree_index_t;
+
+typedef struct zfs_btree {
+	zfs_btree_hdr_t	*bt_root;
+	int		bt_height;	/* levels of core nodes */
+	size_t		bt_elem_size;
+	uint32_t	bt_leaf_cap;	/* elements per leaf */
+	uint64_t	bt_num_elems;
+	uint64_t	bt_num_nodes;
+	int		(*bt_compar)(const void *, const void *);
+} zfs_btree_t;
+
+void zfs_btree_init(void);
+void zfs_btree_fini(void);
+
+/*
+ * The comparison function has the same semantics as for avl_create().
+ */
+void zfs_btree_create(zfs_btree_t *, int (*)(const void *, const void *),
+    size_t);
+void zfs_btree_destroy(zfs_btree_t *);
+
+void *zfs_btree_find(zfs_btree_t *, const void *, zfs_btree_index_t *);
+void zfs_btree_add_idx(zfs_btree_t *, const void *, const zfs_btree_index_t *);
+void zfs_btree_add(zfs_btree_t *, const void *);
+void zfs_btree_remove_idx(zfs_btree_t *, zfs_btree_index_t *);
+void zfs_btree_remove(zfs_btree_t *, const void *);
+void zfs_btree_update(zfs_btree_t *, const zfs_btree_index_t *);
+
+void *zfs_btree_get(zfs_btree_t *, const zfs_btree_index_t *);
+void *zfs_btree_first(zfs_btree_t *, zfs_btree_index_t *);
+void *zfs_btree_last(zfs_btree_t *, zfs_btree_index_t *);
+void *zfs_btree_next(zfs_btree_t *, const zfs_btree_index_t *,
+    zfs_btree_index_t *);
+void *zfs_btree_prev(zfs_btree_t *, const zfs_btree_index_t *,
+    zfs_btree_index_t *);
+
+/*
+ * The element at or after, or the element before, the insertion point
+ * returned by a failed zfs_btree_find().
+ */
+void *zfs_btree_nearest_after(zfs_btree_t *, const zfs_btree_index_t *,
+    zfs_btree_index_t *);
+void *zfs_btree_nearest_before(zfs_btree_t *, const zfs_btree_index_t *,
+    zfs_btree_index_t *);
+
+ulong_t zfs_btree_numnodes(zfs_btree_t *);
+void zfs_btree_clear(zfs_btree_t *);
+void zfs_btree_verify(zfs_btree_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_BTREE_H */
@@ -54,6 +54,7 @@ extern "C" {
 #define	DB_RF_NOPREFETCH	(1 << 3)
 #define	DB_RF_NEVERWAIT		(1 << 4)
 #define	DB_RF_CACHED		(1 << 5)
+#define	DB_RF_UNCACHED		(1 << 6)
 
 /*
  * The simplified state transition diagram for dbufs looks like:
@@ -68,6 +69,14 @@ extern "C" {
  *		|			 |
  *		|			 |
  *		+--------> NOFILL -------+
+ *		|		^
+ *		|		|
+ *		+----> PARTIAL -+
+ *
+ * A level-0 dbuf is PARTIAL while db_buf only holds the sectors written
+ * by dmu_buf_will_dirty_range() since it was UNCACHED; the rest of the
+ * block is read and merged in before anything else may look at db_buf,
+ * or when the dirty record is synced (see dbuf_partial_read()).
  *
  * DB_SEARCH is an invalid state for a dbuf. It is used by dbuf_free_range
  * to find all dbufs in a range of a dnode and must be less than any other
@@ -80,7 +89,8 @@ typedef enum dbuf_states {
 	DB_NOFILL,
 	DB_READ,
 	DB_CACHED,
-	DB_EVICTING
+	DB_EVICTING,
+	DB_PARTIAL
 } dbuf_states_t;
 
 struct dnode;
@@ -131,8 +141,14 @@ typedef struct dbuf_dirty_record {
 			/* protect access to list */
 			kmutex_t dr_mtx;
 
-			/* Our list of dirty children */
+			/*
+			 * Our list of dirty children, in the order they were
+			 * dirtied.  That is also blkid order unless
+			 * dr_unsorted is set, see dbuf_dirty_add_child().
+			 */
 			list_t dr_children;
+			uint64_t dr_last_blkid;
+			boolean_t dr_unsorted;
 		} di;
 		struct dirty_leaf {
 
@@ -146,6 +162,17 @@ typedef struct dbuf_dirty_record {
 			override_states_t dr_override_state;
 			uint8_t dr_copies;
 			boolean_t dr_nopwrite;
+
+			/*
+			 * dr_partial is set while dr_data only holds the
+			 * sectors written by dmu_buf_will_dirty_range(),
+			 * one bit per SPA_MINBLOCKSIZE sector, of which
+			 * dr_partial_count are set.  dr_partial_io is set
+			 * while the old block is read to fill in the rest.
+			 */
+			uint64_t *dr_partial;
+			uint32_t dr_partial_count;
+			boolean_t dr_partial_io;
 		} dl;
 	} dt;
 } dbuf_dirty_record_t;
@@ -258,16 +285,39 @@ typedef struct dmu_buf_impl {
 	 */
 	uint8_t db_pending_evict;
 
+	/*
+	 * Number of times this dbuf was taken back out of the dbuf cache,
+	 * halved each time it is spared by dbuf_evict_one().
+	 */
+	uint8_t db_cache_hits;
+
 	uint8_t db_dirtycnt;
 } dmu_buf_impl_t;
 
-/* Note: the dbuf hash table is exposed only for the mdb module */
+/*
+ * Note: the dbuf hash table is exposed only for the mdb module and the
+ * dbufs kstat.
+ *
+ * The table doubles in size once it averages more than
+ * dbuf_hash_load_factor dbufs per chain.  While the old table is being
+ * drained into the new one both are searched.  A dbuf's hash value picks
+ * both its chain and its mutex, and there are never more mutexes than
+ * chains, so the old and the new chain of a dbuf are covered by the same
+ * mutex.  The table pointers only change with every hash mutex held.
+ */
 #define	DBUF_MUTEXES 8192
-#define	DBUF_HASH_MUTEX(h, idx) (&(h)->hash_mutexes[(idx) & (DBUF_MUTEXES-1)])
+#define	DBUF_HASH_MUTEX(h, idx) \
+	(&(h)->hash_mutexes[(idx) & (h)->hash_mutex_mask])
 typedef struct dbuf_hash_table {
 	uint64_t hash_table_mask;
 	dmu_buf_impl_t **hash_table;
-	kmutex_t hash_mutexes[DBUF_MUTEXES];
+	uint64_t hash_old_mask;
+	dmu_buf_impl_t **hash_old_table;	/* NULL unless rehashing */
+	uint64_t hash_count;
+	uint64_t hash_mutex_mask;
+	kmutex_t *hash_mutexes;
+	uint32_t hash_growing;
+	taskq_ent_t hash_grow_ent;
 } dbuf_hash_table_t;
 
 uint64_t dbuf_whichblock(const struct dnode *di, const int64_t level,
@@ -298,10 +348,14 @@ void dbuf_rele_and_unlock(dmu_buf_impl_t *db, void *tag);
 
 dmu_buf_impl_t *dbuf_find(struct objset *os, uint64_t object, uint8_t level,
     uint64_t blkid);
+int dbuf_dnode_findbp(dnode_t *dn, uint64_t level, uint64_t blkid,
+    blkptr_t *bp);
 
 int dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags);
 void dmu_buf_will_not_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_will_fill(dmu_buf_t *db, dmu_tx_t *tx);
+boolean_t dbuf_partial_write_ok(uint64_t blksz, uint64_t off, uint64_t len);
+void dbuf_partial_discard(dmu_buf_impl_t *db, dbuf_dirty_record_t *dr);
 void dmu_buf_fill_done(dmu_buf_t *db, dmu_tx_t *tx);
 void dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx);
 dbuf_dirty_record_t *dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx);
@@ -313,6 +367,8 @@ void dmu_buf_write_embedded(dmu_buf_t *dbuf, void *data,
 void dbuf_destroy(dmu_buf_impl_t *db);
 
 void dbuf_unoverride(dbuf_dirty_record_t *dr);
+void dbuf_dirty_add_child(dbuf_dirty_record_t *parent,
+    dbuf_dirty_record_t *dr);
 void dbuf_sync_list(list_t *list, int level, dmu_tx_t *tx);
 void dbuf_release_bp(dmu_buf_impl_t *db);
 
@@ -323,6 +379,45 @@ void dbuf_new_size(dmu_buf_impl_t *db, int size, dmu_tx_t *tx);
 
 void dbuf_stats_init(dbuf_hash_table_t *hash);
 void dbuf_stats_destroy(void);
+void dbuf_stats_objset_init(objset_t *os);
+void dbuf_stats_objset_destroy(objset_t *os);
+
+#define	DBUF_OS_STAT_ADD(os, stat, val)	\
+	atomic_add_64(&(os)->os_dbuf_stats.stat, (val))
+#define	DBUF_OS_STAT_BUMP(os, stat)	\
+	atomic_inc_64(&(os)->os_dbuf_stats.stat)
+
+/*
+ * Dbuf cache statistics, exported by dbuf_stats.c as the "dbufstats" kstat.
+ */
+typedef struct dbuf_cache_stats {
+	kstat_named_t cache_count;
+	kstat_named_t cache_size_bytes;
+	kstat_named_t cache_target_bytes;
+	kstat_named_t cache_hits;
+	kstat_named_t cache_hot_retained;
+	kstat_named_t cache_total_evicts;
+	/*
+	 * Number of dbufs and chains in the hash table, the longest chain
+	 * seen on insert, the inserts which landed on a non-empty chain,
+	 * and the number of times the table has been grown.
+	 */
+	kstat_named_t hash_elements;
+	kstat_named_t hash_table_size;
+	kstat_named_t hash_chain_max;
+	kstat_named_t hash_collisions;
+	kstat_named_t hash_resizes;
+} dbuf_cache_stats_t;
+
+extern dbuf_cache_stats_t dbuf_cache_stats;
+
+#define	DBUF_CACHE_STAT_BUMP(stat)	\
+	atomic_inc_64(&dbuf_cache_stats.stat.value.ui64)
+#define	DBUF_CACHE_STAT_BUMPDOWN(stat)	\
+	atomic_dec_64(&dbuf_cache_stats.stat.value.ui64)
+
+uint64_t dbuf_cache_size_bytes(void);
+uint64_t dbuf_cache_target_bytes(void);
 
 #define	DB_DNODE(_db)		((_db)->db_dnode_handle->dnh_dnode)
 #define	DB_DNODE_LOCK(_db)	((_db)->db_dnode_handle->dnh_zrlock)
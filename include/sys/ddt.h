@@ -120,6 +120,21 @@ struct ddt_entry {
 	avl_node_t	dde_node;
 };
 
+/*
+ * In-core copy of a synced on-disk entry, see ddt_cache_lookup().  It is
+ * just the on-disk entry and its location, without the i/o state of an
+ * in-core entry.
+ */
+typedef struct ddt_cache_entry {
+	ddt_key_t	dce_key;
+	ddt_phys_t	dce_phys[DDT_PHYS_TYPES];
+	uint8_t		dce_type;
+	uint8_t		dce_class;
+	uint8_t		dce_referenced;	/* looked up since passed by clock */
+	avl_node_t	dce_node;
+	list_node_t	dce_clock_node;
+} ddt_cache_entry_t;
+
 /*
  * In-core ddt
  */
@@ -135,6 +150,10 @@ struct ddt {
 	ddt_histogram_t	ddt_histogram[DDT_TYPES][DDT_CLASSES];
 	ddt_histogram_t	ddt_histogram_cache[DDT_TYPES][DDT_CLASSES];
 	ddt_object_t	ddt_object_stats[DDT_TYPES][DDT_CLASSES];
+	boolean_t	ddt_stats_loaded; /* see ddt_object_stats_load() */
+	avl_tree_t	ddt_cache_tree;
+	list_t		ddt_cache_clock;
+	uint64_t	ddt_cache_count;
 	avl_node_t	ddt_node;
 };
 
@@ -223,6 +242,7 @@ extern void ddt_init(void);
 extern void ddt_fini(void);
 extern ddt_entry_t *ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add);
 extern void ddt_prefetch(spa_t *spa, const blkptr_t *bp);
+extern boolean_t ddt_prefetch_entry(ddt_t *ddt, const blkptr_t *bp);
 extern void ddt_remove(ddt_t *ddt, ddt_entry_t *dde);
 
 extern boolean_t ddt_class_contains(spa_t *spa, enum ddt_class max_class,
@@ -284,6 +284,8 @@ int dmu_objset_clone(const char *name, const char *origin);
 int dsl_destroy_snapshots_nvl(struct nvlist *snaps, boolean_t defer,
     struct nvlist *errlist);
 int dmu_objset_snapshot_one(const char *fsname, const char *snapname);
+int dmu_objset_snapshot_prepare(const char *fsname);
+int dmu_objset_snapshot_batched(const char *fsname, const char *snapname);
 int dmu_objset_snapshot_tmp(const char *, const char *, int);
 int dmu_objset_find(char *name, int func(const char *, void *), void *arg,
     int flags);
@@ -656,6 +658,15 @@ struct blkptr *dmu_buf_get_blkptr(dmu_buf_t *db);
  */
 void dmu_buf_will_dirty(dmu_buf_t *db, dmu_tx_t *tx);
 
+/*
+ * Like dmu_buf_will_dirty(), for a write of only [off, off + len) of the
+ * buffer.  When the block isn't cached the write may be staged without
+ * reading it first; only the given range of db_data may then be written
+ * until the tx is committed.
+ */
+void dmu_buf_will_dirty_range(dmu_buf_t *db, uint64_t off, uint64_t len,
+    dmu_tx_t *tx);
+
 /*
  * You must create a transaction, then hold the objects which you will
  * (or might) modify as part of this transaction.  Then you must assign
@@ -742,16 +753,54 @@ int dmu_free_long_object(objset_t *os, uint64_t object);
  */
 #define	DMU_READ_PREFETCH	0 /* prefetch */
 #define	DMU_READ_NO_PREFETCH	1 /* don't prefetch */
+#define	DMU_READ_UNCACHED	2 /* scan read, don't displace the ARC */
 int dmu_read(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 	void *buf, uint32_t flags);
 int dmu_read_by_dnode(dnode_t *dn, uint64_t offset, uint64_t size, void *buf,
     uint32_t flags);
+int dmu_read_compressed(objset_t *os, uint64_t object, uint64_t offset,
+    struct arc_buf **abufp);
+int dmu_range_shared(objset_t *os1, objset_t *os2, uint64_t object,
+    uint64_t offset, uint64_t len, uint64_t *sharedp);
 void dmu_write(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 	const void *buf, dmu_tx_t *tx);
 void dmu_write_by_dnode(dnode_t *dn, uint64_t offset, uint64_t size,
     const void *buf, dmu_tx_t *tx);
 void dmu_prealloc(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 	dmu_tx_t *tx);
+
+/*
+ * Vectored reads and writes of many discontiguous ranges of one object.
+ */
+typedef struct dmu_vec {
+	uint64_t	dv_offset;
+	uint64_t	dv_len;
+	void		*dv_buf;
+} dmu_vec_t;
+
+int dmu_read_vec_by_dnode(dnode_t *dn, dmu_vec_t *vecs, int nvecs,
+    uint32_t flags);
+void dmu_write_vec_by_dnode(dnode_t *dn, const dmu_vec_t *vecs, int nvecs,
+    dmu_tx_t *tx);
+
+/*
+ * Loaned reads hold the dbufs covering a range and describe their cached
+ * contents with an iovec array, so that the caller can hand the data straight
+ * to writev()/sendmsg() without first copying it into a linear buffer.  The
+ * caller must keep writers out of the range (e.g. with a range lock) until
+ * the loan is returned with dmu_read_loan_return().
+ */
+typedef struct dmu_read_loan {
+	dmu_buf_t	**drl_dbp;	/* held dbufs */
+	int		drl_numbufs;	/* number of held dbufs */
+	iovec_t		*drl_iov;	/* one iovec per held dbuf */
+	int		drl_iovcnt;	/* number of valid iovecs */
+	uint64_t	drl_size;	/* total bytes described */
+} dmu_read_loan_t;
+
+int dmu_read_loan_by_dnode(dnode_t *dn, uint64_t offset, uint64_t size,
+    dmu_read_loan_t *drl, void *tag, uint32_t flags);
+void dmu_read_loan_return(dmu_read_loan_t *drl, void *tag);
 #ifdef _KERNEL
 #include <linux/blkdev_compat.h>
 int dmu_read_uio(objset_t *os, uint64_t object, struct uio *uio, uint64_t size);
@@ -768,6 +817,8 @@ struct arc_buf *dmu_request_arcbuf(dmu_buf_t *handle, int size);
 void dmu_return_arcbuf(struct arc_buf *buf);
 void dmu_assign_arcbuf(dmu_buf_t *handle, uint64_t offset, struct arc_buf *buf,
     dmu_tx_t *tx);
+void dmu_assign_arcbuf_by_dnode(dnode_t *dn, uint64_t offset,
+    struct arc_buf *buf, dmu_tx_t *tx);
 #ifdef HAVE_UIO_ZEROCOPY
 int dmu_xuio_init(struct xuio *uio, int niov);
 void dmu_xuio_fini(struct xuio *uio);
@@ -940,7 +991,7 @@ uint64_t dmu_tx_get_txg(dmu_tx_t *tx);
  * {zfs,zvol,ztest}_get_done() args
  */
 typedef struct zgd {
-	struct zilog	*zgd_zilog;
+	struct lwb	*zgd_lwb;
 	struct blkptr	*zgd_bp;
 	dmu_buf_t	*zgd_db;
 	struct rl	*zgd_rl;
@@ -58,6 +58,8 @@ struct dmu_tx;
 #define	OBJSET_FLAG_USERACCOUNTING_COMPLETE	(1ULL<<0)
 #define	OBJSET_FLAG_USEROBJACCOUNTING_COMPLETE	(1ULL<<1)
 
+#define	DMU_OBJSET_PINNED_DNODES	4
+
 typedef struct objset_phys {
 	dnode_phys_t os_meta_dnode;
 	zil_header_t os_zil_header;
@@ -71,6 +73,50 @@ typedef struct objset_phys {
 
 typedef int (*dmu_objset_upgrade_cb_t)(objset_t *);
 
+/*
+ * A CPU's cursor in its chunk of object numbers, see
+ * dmu_object_alloc_dnsize().  Each one is padded to a cache line, so
+ * that creates on different CPUs don't bounce a line shared by their
+ * cursors.
+ */
+#define	OS_OBJ_NEXT_ALIGN	64
+typedef struct os_obj_next {
+	uint64_t	oon_object;
+	uint8_t		oon_pad[OS_OBJ_NEXT_ALIGN - sizeof (uint64_t)];
+} os_obj_next_t;
+
+/*
+ * The i/o limits of an objset, see dmu_objset_io_throttle().
+ */
+typedef enum objset_io_limit {
+	OS_IO_READ_IOPS,
+	OS_IO_WRITE_IOPS,
+	OS_IO_READ_BW,
+	OS_IO_WRITE_BW,
+	OS_IO_LIMITS
+} objset_io_limit_t;
+
+typedef struct objset_io_bucket {
+	uint64_t	oib_rate;	/* per second, 0 for no limit */
+	hrtime_t	oib_next;	/* earliest start of the next i/o */
+} objset_io_bucket_t;
+
+/*
+ * Dbuf cache efficiency of an objset, updated atomically by dbuf.c and
+ * exported by dbuf_stats.c.  A dbuf_read() is a hit if the dbuf holds its
+ * data, an ARC hit if the block is found in the ARC, and a miss if it has
+ * to be read from disk; prefetch hits are the reads satisfied by a
+ * predictive prefetch.  Cached bytes is the size of the dbufs of the
+ * objset in the dbuf hash table.
+ */
+typedef struct objset_dbuf_stats {
+	uint64_t	ods_cached_bytes;
+	uint64_t	ods_hits;
+	uint64_t	ods_arc_hits;
+	uint64_t	ods_misses;
+	uint64_t	ods_prefetch_hits;
+} objset_dbuf_stats_t;
+
 struct objset {
 	/* Immutable: */
 	struct dsl_dataset *os_dsl_dataset;
@@ -94,6 +140,7 @@ struct objset {
 	uint64_t os_dnodesize; /* default dnode size for new objects */
 	enum zio_checksum os_checksum;
 	enum zio_compress os_compress;
+	uint16_t os_complevel;
 	uint8_t os_copies;
 	enum zio_checksum os_dedup_checksum;
 	boolean_t os_dedup_verify;
@@ -123,9 +170,17 @@ struct objset {
 	uint64_t os_obj_next_chunk;
 
 	/* Per-CPU next object to allocate, protected by atomic ops. */
-	uint64_t *os_obj_next_percpu;
+	os_obj_next_t *os_obj_next_percpu;
 	int os_obj_next_percpu_len;
 
+	/*
+	 * Protected by the pool's dp_lock: this objset's part of
+	 * dp_dirty_pertxg[], and its own dp_last_wakeup for the fair
+	 * dirty data throttle (see dmu_tx_delay()).
+	 */
+	uint64_t os_dirty_pertxg[TXG_SIZE];
+	hrtime_t os_last_wakeup;
+
 	/* Protected by os_lock */
 	kmutex_t os_lock;
 	multilist_t *os_dirty_dnodes[TXG_SIZE];
@@ -135,11 +190,24 @@ struct objset {
 	/* Protects changes to DMU_{USER,GROUP}USED_OBJECT */
 	kmutex_t os_userused_lock;
 
+	/* Held hot dnodes, see dmu_objset_pin_dnode() */
+	krwlock_t os_pinned_lock;
+	int os_pinned_count;
+	dnode_t *os_pinned[DMU_OBJSET_PINNED_DNODES];
+
 	/* stuff we store for the user */
 	kmutex_t os_user_ptr_lock;
 	void *os_user_ptr;
 	sa_os_t *os_sa;
 
+	/* Rates set under dsl_dir's locks, the rest under os_io_lock */
+	kmutex_t os_io_lock;
+	objset_io_bucket_t os_io_bucket[OS_IO_LIMITS];
+
+	/* Updated atomically, see objset_dbuf_stats_t */
+	objset_dbuf_stats_t os_dbuf_stats;
+	kstat_t *os_dbuf_ksp;
+
 	/* kernel thread to upgrade this dataset */
 	kmutex_t os_upgrade_lock;
 	taskqid_t os_upgrade_id;
@@ -179,7 +247,13 @@ int dmu_objset_find_dp(struct dsl_pool *dp, uint64_t ddobj,
     int func(struct dsl_pool *, struct dsl_dataset *, void *),
     void *arg, int flags);
 void dmu_objset_evict_dbufs(objset_t *os);
+int dmu_objset_pin_dnode(objset_t *os, uint64_t object);
+void dmu_objset_unpin_dnode(objset_t *os, uint64_t object);
+boolean_t dmu_objset_hold_pinned(objset_t *os, uint64_t object, void *tag,
+    dnode_t **dnp);
 timestruc_t dmu_objset_snap_cmtime(objset_t *os);
+void dmu_objset_io_throttle(objset_t *os, boolean_t write, uint64_t nios,
+    uint64_t size);
 
 /* called from dsl */
 void dmu_objset_sync(objset_t *os, zio_t *zio, dmu_tx_t *tx);
@@ -40,9 +40,21 @@ extern unsigned long	zfetch_array_rd_sz;
 
 struct dnode;				/* so we can reference dnode */
 
+/*
+ * A stream is either sequential (zs_stride == 0), following accesses of any
+ * size which each start where the last one ended, or strided, following
+ * accesses of zs_nblks blocks which each start zs_stride blocks from the
+ * last one.  A negative stride is a backward scan.  For a strided stream
+ * zs_blkid and zs_pf_blkid are the first blocks of the next access and of
+ * the next access to prefetch.
+ */
 typedef struct zstream {
 	uint64_t	zs_blkid;	/* expect next access at this blkid */
 	uint64_t	zs_pf_blkid;	/* next block to prefetch */
+	int64_t		zs_stride;	/* blocks between strided accesses */
+	uint64_t	zs_nblks;	/* blocks in the last access */
+	uint64_t	zs_last_blkid;	/* first block of the last access */
+	uint64_t	zs_hits;	/* accesses which matched the stream */
 
 	/*
 	 * We will next prefetch the L1 indirect block of this level-0
@@ -58,6 +70,7 @@ typedef struct zstream {
 typedef struct zfetch {
 	krwlock_t	zf_rwlock;	/* protects zfetch structure */
 	list_t		zf_stream;	/* list of zstream_t's */
+	uint32_t	zf_max_streams;	/* current limit on zf_stream length */
 	struct dnode	*zf_dnode;	/* dnode that owns this zfetch */
 } zfetch_t;
 
@@ -388,6 +388,12 @@ typedef struct dnode_stats {
 	 * the common case when looking up any allocated object number.
 	 */
 	kstat_named_t dnode_hold_alloc_hits;
+	/*
+	 * Number of times dnode_hold(..., DNODE_MUST_BE_ALLOCATED) found the
+	 * requested object among the objset's pinned dnodes, which skips the
+	 * meta dnode dbuf and the dnode_children slot locks.
+	 */
+	kstat_named_t dnode_hold_pinned_hits;
 	/*
 	 * Number of times dnode_hold(..., DNODE_MUST_BE_ALLOCATED) was not
 	 * able to hold the request object number because it was not allocated.
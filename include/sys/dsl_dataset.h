@@ -92,6 +92,14 @@ struct dsl_pool;
  */
 #define	DS_FIELD_LARGE_DNODE "org.zfsonlinux:large_dnode"
 
+/*
+ * This field is present on clones which keep a livelist.  Its value is a
+ * pair of bpobjs, of the blocks born in the clone and of the ones among
+ * them which it has freed.  Each such clone is counted in the refcount of
+ * the SPA_FEATURE_CLONE_LIVELIST feature.
+ */
+#define	DS_FIELD_LIVELIST "io.openebs:livelist"
+
 /*
  * These fields are set on datasets that are in the middle of a resumable
  * receive, and allow the sender to resume the send if it is interrupted.
@@ -167,6 +175,12 @@ typedef struct dsl_dataset {
 	dsl_deadlist_t ds_deadlist;
 	bplist_t ds_pending_deadlist;
 
+	/* livelist of a clone, see dsl_dataset_has_livelist() */
+	bpobj_t ds_livelist_born;
+	bpobj_t ds_livelist_freed;
+	bplist_t ds_pending_born;
+	bplist_t ds_pending_freed;
+
 	/* protected by lock on pool's dp_dirty_datasets list */
 	txg_node_t ds_dirty_link;
 	list_node_t ds_synced_link;
@@ -245,6 +259,9 @@ dsl_dataset_phys(dsl_dataset_t *ds)
 #define	DS_UNIQUE_IS_ACCURATE(ds)	\
 	((dsl_dataset_phys(ds)->ds_flags & DS_FLAG_UNIQUE_ACCURATE) != 0)
 
+extern uint64_t dsl_dataset_snapshot_gen;
+extern unsigned long zfs_livelist_max_entries;
+
 int dsl_dataset_hold(struct dsl_pool *dp, const char *name, void *tag,
     dsl_dataset_t **dsp);
 boolean_t dsl_dataset_try_add_ref(struct dsl_pool *dp, dsl_dataset_t *ds,
@@ -286,6 +303,9 @@ void dsl_dataset_block_born(dsl_dataset_t *ds, const blkptr_t *bp,
     dmu_tx_t *tx);
 int dsl_dataset_block_kill(dsl_dataset_t *ds, const blkptr_t *bp,
     dmu_tx_t *tx, boolean_t async);
+boolean_t dsl_dataset_has_livelist(dsl_dataset_t *ds);
+boolean_t dsl_dataset_livelist_free(dsl_dataset_t *ds, dmu_tx_t *tx);
+void dsl_dataset_livelist_destroy(dsl_dataset_t *ds, dmu_tx_t *tx);
 int dsl_dataset_snap_lookup(dsl_dataset_t *ds, const char *name,
     uint64_t *value);
 
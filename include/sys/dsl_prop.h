@@ -91,6 +91,8 @@ void dsl_prop_set_sync_impl(struct dsl_dataset *ds, const char *propname,
     zprop_source_t source, int intsz, int numints, const void *value,
     dmu_tx_t *tx);
 int dsl_props_set(const char *dsname, zprop_source_t source, nvlist_t *nvl);
+int dsl_props_set_multi(const char *poolname, zprop_source_t source,
+    nvlist_t *dsprops);
 int dsl_prop_set_int(const char *dsname, const char *propname,
     zprop_source_t source, uint64_t value);
 int dsl_prop_set_string(const char *dsname, const char *propname,
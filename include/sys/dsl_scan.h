@@ -105,6 +105,19 @@ typedef enum dsl_scan_flags {
  * a bpobj structure. The scn_is_bptree flag will indicate the type of
  * deferred free that is in progress. If the deferred free is part of an
  * asynchronous destroy then the scn_async_destroying flag will be set.
+ *
+ * While a scrub or resilver traverses the pool in a txg, the blocks it
+ * finds are kept in scn_queues, one queue per top-level vdev sorted by
+ * offset, rather than read as they are found.  The queues are issued in
+ * offset order once the traversal of the txg suspends or completes, so
+ * that the reads are sequential on each vdev.  scn_queued_bytes is the
+ * memory used by the queues and scn_queued_psize the data they will read;
+ * the traversal suspends early when either reaches its limit, set by
+ * zfs_scan_mem_lim_fact and zfs_scan_queue_limit.
+ *
+ * With a zfs_scan_latency_target_us, scn_pace_pct scales the scrub i/o
+ * allowed in flight: it is cut when too many of the synchronous reads of
+ * an interval take longer than the target, and grows back otherwise.
  */
 typedef struct dsl_scan {
 	struct dsl_pool *scn_dp;
@@ -121,12 +134,27 @@ typedef struct dsl_scan {
 	boolean_t scn_async_stalled;
 	uint64_t scn_visited_this_txg;
 
+	/* for sorting scrub and resilver i/o */
+	avl_tree_t *scn_queues;
+	uint64_t scn_nqueues;
+	uint64_t scn_queued_bytes;
+	uint64_t scn_queued_psize;
+
+	/* for pacing scrub and resilver i/o by foreground latency */
+	uint64_t scn_pace_pct;
+	hrtime_t scn_pace_start;
+	uint64_t scn_pace_reads;
+	uint64_t scn_pace_slow;
+
 	dsl_scan_phys_t scn_phys;
 } dsl_scan_t;
 
+extern unsigned long zfs_free_max_blocks;
+
 int dsl_scan_init(struct dsl_pool *dp, uint64_t txg);
 void dsl_scan_fini(struct dsl_pool *dp);
 void dsl_scan_sync(struct dsl_pool *, dmu_tx_t *);
+void dsl_scan_free_budget_update(struct dsl_pool *, hrtime_t synctime);
 int dsl_scan_cancel(struct dsl_pool *);
 int dsl_scan(struct dsl_pool *, pool_scan_func_t);
 boolean_t dsl_scan_scrubbing(const struct dsl_pool *dp);
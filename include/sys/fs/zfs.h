@@ -176,6 +176,10 @@ typedef enum {
 	ZFS_PROP_REPLICA_ID,
 	ZFS_PROP_ZVOL_READONLY,
 	ZFS_PROP_WORKERS,
+	ZFS_PROP_READ_IOPS_LIMIT,
+	ZFS_PROP_WRITE_IOPS_LIMIT,
+	ZFS_PROP_READ_BW_LIMIT,
+	ZFS_PROP_WRITE_BW_LIMIT,
 	ZFS_NUM_PROPS
 } zfs_prop_t;
 
@@ -229,6 +233,7 @@ typedef enum {
 	ZPOOL_PROP_TNAME,
 	ZPOOL_PROP_MAXDNODESIZE,
 	ZPOOL_PROP_MULTIHOST,
+	ZPOOL_PROP_AUTOTRIM,
 #ifdef	_UZFS
 	ZPOOL_PROP_UZFS_READONLY,
 #endif
@@ -616,6 +621,9 @@ typedef struct zpool_rewind_policy {
 #define	ZPOOL_CONFIG_VDEV_ASYNC_AGG_W_HISTO	"vdev_async_agg_w_histo"
 #define	ZPOOL_CONFIG_VDEV_AGG_SCRUB_HISTO	"vdev_agg_scrub_histo"
 
+/* ZIOs merged into aggregated IOs, per priority */
+#define	ZPOOL_CONFIG_VDEV_AGG_MERGED		"vdev_agg_merged"
+
 /* vdev enclosure sysfs path */
 #define	ZPOOL_CONFIG_VDEV_ENC_SYSFS_PATH	"vdev_enc_sysfs_path"
 
@@ -631,6 +639,7 @@ typedef struct zpool_rewind_policy {
 #define	ZPOOL_CONFIG_UNSPARE		"unspare"
 #define	ZPOOL_CONFIG_PHYS_PATH		"phys_path"
 #define	ZPOOL_CONFIG_IS_LOG		"is_log"
+#define	ZPOOL_CONFIG_ALLOCATION_BIAS	"alloc_bias"
 #define	ZPOOL_CONFIG_L2CACHE		"l2cache"
 #define	ZPOOL_CONFIG_HOLE_ARRAY		"hole_array"
 #define	ZPOOL_CONFIG_VDEV_CHILDREN	"vdev_children"
@@ -702,6 +711,12 @@ typedef struct zpool_rewind_policy {
 #define	VDEV_TYPE_LOG			"log"
 #define	VDEV_TYPE_L2CACHE		"l2cache"
 
+/*
+ * Values of ZPOOL_CONFIG_ALLOCATION_BIAS.  A top-level vdev with this bias
+ * belongs to the special allocation class, which holds metadata.
+ */
+#define	VDEV_ALLOC_BIAS_SPECIAL		"special"
+
 /*
  * This is needed in userland to report the minimum necessary device size.
  */
@@ -809,6 +824,15 @@ typedef enum pool_scrub_cmd {
 	POOL_SCRUB_FLAGS_END
 } pool_scrub_cmd_t;
 
+/*
+ * Used to start and stop a manual trim.
+ */
+typedef enum pool_trim_cmd {
+	POOL_TRIM_START = 0,
+	POOL_TRIM_STOP,
+	POOL_TRIM_CMDS_END
+} pool_trim_cmd_t;
+
 
 /*
  * ZIO types.  Needed to interpret vdev statistics below.
@@ -943,6 +967,9 @@ typedef struct vdev_stat_ex {
 	uint64_t vsx_agg_histo[ZIO_PRIORITY_NUM_QUEUEABLE]
 	    [VDEV_RQ_HISTO_BUCKETS];
 
+	/* Number of ZIOs issued as part of an aggregated IO */
+	uint64_t vsx_agg_merged[ZIO_PRIORITY_NUM_QUEUEABLE];
+
 } vdev_stat_ex_t;
 
 /*
@@ -1072,6 +1099,11 @@ typedef enum zfs_ioc {
 	ZFS_IOC_POOL_SYNC,
 	ZFS_IOC_STATS,
 	ZFS_IOC_LIST_SNAP,
+	ZFS_IOC_POOL_TRIM,
+	ZFS_IOC_STATS_BINARY,
+	ZFS_IOC_DATASET_LIST_BATCH,
+	ZFS_IOC_SET_PROPS_MULTI,
+	ZFS_IOC_BATCH,
 
 	/*
 	 * Linux - 3/64 numbers reserved.
@@ -1089,6 +1121,68 @@ typedef enum zfs_ioc {
 	ZFS_IOC_LAST
 } zfs_ioc_t;
 
+/*
+ * ZFS_IOC_STATS_BINARY fills zc_nvlist_dst with a zvol_stats_hdr_t followed
+ * by zsh_nrecs records of zsh_reclen bytes each, one per volume.  Fields
+ * are only ever appended to zvol_stats_rec_t, with a new version, so a
+ * reader steps through the records by zsh_reclen and reads the fields of
+ * the version it knows.  The counters are cumulative; rates come from
+ * diffing two calls, zsh_time apart.
+ */
+#define	ZVOL_STATS_MAGIC	0x7a766f6c73746174ULL	/* "zvolstat" */
+#define	ZVOL_STATS_VERSION	2
+
+typedef struct zvol_stats_hdr {
+	uint64_t	zsh_magic;
+	uint32_t	zsh_version;
+	uint32_t	zsh_reclen;
+	uint64_t	zsh_nrecs;
+	uint64_t	zsh_time;	/* gethrtime() at the call, in ns */
+} zvol_stats_hdr_t;
+
+typedef enum zvol_stats_status {
+	ZVOL_STATS_OFFLINE,
+	ZVOL_STATS_HEALTHY,
+	ZVOL_STATS_DEGRADED,
+	ZVOL_STATS_REBUILDING
+} zvol_stats_status_t;
+
+typedef struct zvol_stats_rec {
+	char		zsr_name[ZFS_MAX_DATASET_NAME_LEN];
+	uint8_t		zsr_status;		/* zvol_stats_status_t */
+	uint8_t		zsr_readonly;
+	uint8_t		zsr_rebuild_status;
+	uint8_t		zsr_io_ack_sender_created;
+	uint8_t		zsr_io_receiver_created;
+	uint8_t		zsr_pad[3];
+	uint64_t	zsr_running_ionum;
+	uint64_t	zsr_checkpointed_ionum;
+	uint64_t	zsr_degraded_checkpointed_ionum;
+	uint64_t	zsr_checkpointed_time;
+	uint64_t	zsr_zvol_workers;
+	uint64_t	zsr_quorum;
+	uint64_t	zsr_rebuild_bytes;
+	uint64_t	zsr_rebuild_cnt;
+	uint64_t	zsr_rebuild_done_cnt;
+	uint64_t	zsr_rebuild_failed_cnt;
+	uint64_t	zsr_read_count;
+	uint64_t	zsr_read_latency;
+	uint64_t	zsr_read_bytes;
+	uint64_t	zsr_write_count;
+	uint64_t	zsr_write_latency;
+	uint64_t	zsr_write_bytes;
+	uint64_t	zsr_sync_count;
+	uint64_t	zsr_sync_latency;
+	uint64_t	zsr_inflight_io_cnt;
+	uint64_t	zsr_dispatched_io_cnt;
+	/* version 2: dbuf cache efficiency, see objset_dbuf_stats_t */
+	uint64_t	zsr_dbuf_cached_bytes;
+	uint64_t	zsr_dbuf_hits;
+	uint64_t	zsr_dbuf_arc_hits;
+	uint64_t	zsr_dbuf_misses;
+	uint64_t	zsr_dbuf_prefetch_hits;
+} zvol_stats_rec_t;
+
 /*
  * zvol ioctl to get dataset name
  */
@@ -72,9 +72,11 @@ typedef enum trace_alloc_type {
 
 #define	METASLAB_WEIGHT_PRIMARY		(1ULL << 63)
 #define	METASLAB_WEIGHT_SECONDARY	(1ULL << 62)
-#define	METASLAB_WEIGHT_TYPE		(1ULL << 61)
+#define	METASLAB_WEIGHT_CLAIM		(1ULL << 61)
+#define	METASLAB_WEIGHT_TYPE		(1ULL << 60)
 #define	METASLAB_ACTIVE_MASK		\
-	(METASLAB_WEIGHT_PRIMARY | METASLAB_WEIGHT_SECONDARY)
+	(METASLAB_WEIGHT_PRIMARY | METASLAB_WEIGHT_SECONDARY | \
+	METASLAB_WEIGHT_CLAIM)
 
 /*
  * The metaslab weight is used to encode the amount of free space in a
@@ -97,37 +99,37 @@ typedef enum trace_alloc_type {
  *
  *      64      56      48      40      32      24      16      8       0
  *      +-------+-------+-------+-------+-------+-------+-------+-------+
- *      |PS1|                   weighted-free space                     |
+ *      |PSC1|                  weighted-free space                     |
  *      +-------+-------+-------+-------+-------+-------+-------+-------+
  *
- *	PS - indicates primary and secondary activation
+ *	PSC - indicates primary, secondary and claim activation
  *	space - the fragmentation-weighted space
  *
  * Segment-based weight:
  *
  *      64      56      48      40      32      24      16      8       0
  *      +-------+-------+-------+-------+-------+-------+-------+-------+
- *      |PS0| idx|             count of segments in region              |
+ *      |PSC0| idx|            count of segments in region              |
  *      +-------+-------+-------+-------+-------+-------+-------+-------+
  *
- *	PS - indicates primary and secondary activation
+ *	PSC - indicates primary, secondary and claim activation
  *	idx - index for the highest bucket in the histogram
  *	count - number of segments in the specified bucket
  */
-#define	WEIGHT_GET_ACTIVE(weight)		BF64_GET((weight), 62, 2)
-#define	WEIGHT_SET_ACTIVE(weight, x)		BF64_SET((weight), 62, 2, x)
+#define	WEIGHT_GET_ACTIVE(weight)		BF64_GET((weight), 61, 3)
+#define	WEIGHT_SET_ACTIVE(weight, x)		BF64_SET((weight), 61, 3, x)
 
 #define	WEIGHT_IS_SPACEBASED(weight)		\
-	((weight) == 0 || BF64_GET((weight), 61, 1))
-#define	WEIGHT_SET_SPACEBASED(weight)		BF64_SET((weight), 61, 1, 1)
+	((weight) == 0 || BF64_GET((weight), 60, 1))
+#define	WEIGHT_SET_SPACEBASED(weight)		BF64_SET((weight), 60, 1, 1)
 
 /*
  * These macros are only applicable to segment-based weighting.
  */
-#define	WEIGHT_GET_INDEX(weight)		BF64_GET((weight), 55, 6)
-#define	WEIGHT_SET_INDEX(weight, x)		BF64_SET((weight), 55, 6, x)
-#define	WEIGHT_GET_COUNT(weight)		BF64_GET((weight), 0, 55)
-#define	WEIGHT_SET_COUNT(weight, x)		BF64_SET((weight), 0, 55, x)
+#define	WEIGHT_GET_INDEX(weight)		BF64_GET((weight), 54, 6)
+#define	WEIGHT_SET_INDEX(weight, x)		BF64_SET((weight), 54, 6, x)
+#define	WEIGHT_GET_COUNT(weight)		BF64_GET((weight), 0, 54)
+#define	WEIGHT_SET_COUNT(weight, x)		BF64_SET((weight), 0, 54, x)
 
 /*
  * A metaslab class encompasses a category of allocatable top-level vdevs.
@@ -138,7 +140,8 @@ typedef enum trace_alloc_type {
  * When a block allocation is requested from the SPA it is associated with a
  * metaslab_class_t, and only top-level vdevs (i.e. metaslab groups) belonging
  * to the class can be used to satisfy that request. Allocations are done
- * by traversing the metaslab groups that are linked off of the mc_rotor field.
+ * by traversing the metaslab groups that are linked off of the rotor of one
+ * of the class's allocators (see metaslab_class_allocator_t below).
  * This rotor points to the next metaslab group where allocations will be
  * attempted. Allocating a block is a 3 step process -- select the metaslab
  * group, select the metaslab, and then allocate the block. The metaslab
@@ -146,12 +149,35 @@ typedef enum trace_alloc_type {
  * final step in allocation. These allocators are pluggable allowing each class
  * to use a block allocator that best suits that class.
  */
+
+/*
+ * A class has spa_alloc_count allocators, each with a rotor, an aliquot and
+ * throttle slots of its own, so that allocations happening on many CPUs at
+ * once don't all go through the same metaslab group and metaslab.  Writes
+ * are assigned to an allocator by a hash of their bookmark (see zio.c).
+ *
+ * The allocation throttle works on a reservation system. Whenever
+ * an asynchronous zio wants to perform an allocation it must
+ * first reserve the number of blocks that it wants to allocate.
+ * If there aren't sufficient slots available for the pending zio
+ * then that I/O is throttled until more slots free up. The current
+ * number of reserved allocations is maintained by the mca_alloc_slots
+ * refcount. The mca_alloc_max_slots value determines the maximum
+ * number of allocations that the system allows. Gang blocks are
+ * allowed to reserve slots even if we've reached the maximum
+ * number of allocations allowed.
+ */
+typedef struct metaslab_class_allocator {
+	metaslab_group_t	*mca_rotor;
+	uint64_t		mca_aliquot;
+	uint64_t		mca_alloc_max_slots;
+	refcount_t		mca_alloc_slots;
+} metaslab_class_allocator_t;
+
 struct metaslab_class {
 	kmutex_t		mc_lock;
 	spa_t			*mc_spa;
-	metaslab_group_t	*mc_rotor;
 	metaslab_ops_t		*mc_ops;
-	uint64_t		mc_aliquot;
 
 	/*
 	 * Track the number of metaslab groups that have been initialized
@@ -166,21 +192,6 @@ struct metaslab_class {
 	 */
 	boolean_t		mc_alloc_throttle_enabled;
 
-	/*
-	 * The allocation throttle works on a reservation system. Whenever
-	 * an asynchronous zio wants to perform an allocation it must
-	 * first reserve the number of blocks that it wants to allocate.
-	 * If there aren't sufficient slots available for the pending zio
-	 * then that I/O is throttled until more slots free up. The current
-	 * number of reserved allocations is maintained by the mc_alloc_slots
-	 * refcount. The mc_alloc_max_slots value determines the maximum
-	 * number of allocations that the system allows. Gang blocks are
-	 * allowed to reserve slots even if we've reached the maximum
-	 * number of allocations allowed.
-	 */
-	uint64_t		mc_alloc_max_slots;
-	refcount_t		mc_alloc_slots;
-
 	uint64_t		mc_alloc_groups; /* # of allocatable groups */
 
 	uint64_t		mc_alloc;	/* total allocated space */
@@ -188,6 +199,8 @@ struct metaslab_class {
 	uint64_t		mc_space;	/* total space (alloc + free) */
 	uint64_t		mc_dspace;	/* total deflated space */
 	uint64_t		mc_histogram[RANGE_TREE_HISTOGRAM_SIZE];
+
+	metaslab_class_allocator_t *mc_allocator; /* spa_alloc_count of them */
 };
 
 /*
@@ -199,6 +212,20 @@ struct metaslab_class {
  * simply find the next metaslab group in the linked list and attempt
  * to allocate from that group instead.
  */
+/*
+ * The metaslabs each allocator of the class is using in this group, and
+ * the queue depth of its allocations.  An allocator starts with a queue
+ * depth of zfs_vdev_def_queue_depth (mga_cur_max_alloc_queue_depth), which
+ * grows up to mg_max_alloc_queue_depth as its allocations complete, so
+ * that a single busy allocator can still keep the vdev busy.
+ */
+typedef struct metaslab_group_allocator {
+	metaslab_t	*mga_primary;
+	metaslab_t	*mga_secondary;
+	uint64_t	mga_cur_max_alloc_queue_depth;
+	refcount_t	mga_alloc_queue_depth;
+} metaslab_group_allocator_t;
+
 struct metaslab_group {
 	kmutex_t		mg_lock;
 	avl_tree_t		mg_metaslab_tree;
@@ -223,14 +250,16 @@ struct metaslab_group {
 	metaslab_group_t	*mg_next;
 
 	/*
-	 * Each metaslab group can handle mg_max_alloc_queue_depth allocations
-	 * which are tracked by mg_alloc_queue_depth. It's possible for a
-	 * metaslab group to handle more allocations than its max. This
-	 * can occur when gang blocks are required or when other groups
-	 * are unable to handle their share of allocations.
+	 * Each allocator can have up to mg_max_alloc_queue_depth allocations
+	 * to this metaslab group, which are tracked by its
+	 * mga_alloc_queue_depth. It's possible for a metaslab group to
+	 * handle more allocations than its max. This can occur when gang
+	 * blocks are required or when other groups are unable to handle
+	 * their share of allocations.
 	 */
 	uint64_t		mg_max_alloc_queue_depth;
-	refcount_t		mg_alloc_queue_depth;
+	int			mg_allocators;
+	metaslab_group_allocator_t *mg_allocator; /* mg_allocators of them */
 
 	/*
 	 * A metalab group that can no longer allocate the minimum block
@@ -244,6 +273,14 @@ struct metaslab_group {
 	uint64_t		mg_failed_allocations;
 	uint64_t		mg_fragmentation;
 	uint64_t		mg_histogram[RANGE_TREE_HISTOGRAM_SIZE];
+
+	/*
+	 * Space synced out of the group's metaslabs' alloctrees in the
+	 * current txg, and a decaying average of it over past txgs, used
+	 * to decide how many metaslabs to keep preloaded.
+	 */
+	uint64_t		mg_alloc_txg;
+	uint64_t		mg_alloc_rate;
 };
 
 /*
@@ -253,6 +290,13 @@ struct metaslab_group {
  */
 #define	MAX_LBAS	64
 
+/*
+ * The number of size buckets of the segregated fit allocator. Bucket i
+ * holds the free segments of 2^(ashift + i) up to 2^(ashift + i + 1) bytes,
+ * except for the last one, which holds all of the larger segments too.
+ */
+#define	METASLAB_SF_BUCKETS	16
+
 /*
  * Each metaslab maintains a set of in-core trees to track metaslab
  * operations.  The in-core free tree (ms_tree) contains the list of
@@ -307,10 +351,17 @@ struct metaslab_group {
  * metaslab needs to condense then we must set the ms_condensing flag to
  * ensure that allocations are not performed on the metaslab that is
  * being written.
+ *
+ * With autotrim on, the frees which go back into the ms_tree are also
+ * added to the ms_trimtree, and allocations take their space back out
+ * of it, so that it holds the free space which has not been trimmed
+ * yet.  While the ranges of a metaslab are being trimmed, ms_trimming
+ * keeps it from being allocated from.
  */
 struct metaslab {
 	kmutex_t	ms_lock;
 	kcondvar_t	ms_load_cv;
+	kcondvar_t	ms_trim_cv;
 	space_map_t	*ms_sm;
 	uint64_t	ms_id;
 	uint64_t	ms_start;
@@ -319,6 +370,7 @@ struct metaslab {
 
 	range_tree_t	*ms_alloctree[TXG_SIZE];
 	range_tree_t	*ms_tree;
+	range_tree_t	*ms_trimtree;	/* freed, not yet trimmed */
 
 	/*
 	 * The following range trees are accessed only from syncing context.
@@ -331,6 +383,7 @@ struct metaslab {
 
 	boolean_t	ms_condensing;	/* condensing? */
 	boolean_t	ms_condense_wanted;
+	boolean_t	ms_trimming;	/* trims in flight? */
 
 	/*
 	 * We must hold both ms_lock and ms_group->mg_lock in order to
@@ -360,9 +413,25 @@ struct metaslab {
 	 * same number of segments as the ms_tree. The only difference
 	 * is that the ms_size_tree is ordered by segment sizes.
 	 */
-	avl_tree_t	ms_size_tree;
+	zfs_btree_t	ms_size_tree;
 	uint64_t	ms_lbas[MAX_LBAS];
 
+	/*
+	 * The segregated fit allocator keeps another copy of the segments,
+	 * split by size into METASLAB_SF_BUCKETS offset-ordered trees.
+	 * NULL with the other allocators.
+	 */
+	zfs_btree_t	*ms_sf_buckets;
+
+	/*
+	 * The allocator this metaslab is the primary or secondary metaslab
+	 * of, or -1 if it is not active.  Both are sort keys of the group's
+	 * metaslab tree, so they only change while the metaslab is out of it
+	 * and with the mg_lock held.
+	 */
+	int		ms_allocator;
+	boolean_t	ms_primary;
+
 	metaslab_group_t *ms_group;	/* metaslab group		*/
 	avl_node_t	ms_group_node;	/* node in metaslab group tree	*/
 	txg_node_t	ms_txg_node;	/* per-txg dirty metaslab links	*/
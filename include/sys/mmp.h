@@ -39,6 +39,7 @@ typedef struct mmp_thread {
 	uint8_t		mmp_thread_exiting;
 	kmutex_t	mmp_io_lock;	/* protect below */
 	hrtime_t	mmp_last_write;	/* last successful MMP write */
+	hrtime_t	mmp_last_sync;	/* last uberblock write by spa_sync */
 	uint64_t	mmp_delay;	/* decaying avg ns between MMP writes */
 	uberblock_t	mmp_ub;		/* last ub written by sync */
 	zio_t		*mmp_zio_root;	/* root of mmp write zios */
@@ -140,6 +140,7 @@ struct nv_alloc_ops {
 };
 
 extern const nv_alloc_ops_t *nv_fixed_ops;
+extern const nv_alloc_ops_t *nv_arena_ops;
 extern nv_alloc_t *nv_alloc_nosleep;
 
 #if defined(_KERNEL) && !defined(_BOOT)
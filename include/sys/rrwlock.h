@@ -87,18 +87,24 @@ void rrw_tsd_destroy(void *arg);
  * A reader-mostly lock implementation, tuning above reader-writer locks
  * for hightly parallel read acquisitions, pessimizing write acquisitions.
  *
- * This should be a prime number.  See comment in rrwlock.c near
- * RRM_TD_LOCK() for details.
+ * The number of locks is taken from zfs_rrm_locks when the lock is
+ * initialized, limited to RRM_MAX_LOCKS.  It should be a prime number.
+ * See comment in rrwlock.c near RRM_TD_LOCK() for details.
  */
 #define	RRM_NUM_LOCKS		17
+#define	RRM_MAX_LOCKS		251
 typedef struct rrmlock {
-	rrwlock_t	locks[RRM_NUM_LOCKS];
+	rrwlock_t	*locks;
+	int		nlocks;
 } rrmlock_t;
 
+extern int zfs_rrm_locks;
+
 void rrm_init(rrmlock_t *rrl, boolean_t track_all);
 void rrm_destroy(rrmlock_t *rrl);
 void rrm_enter(rrmlock_t *rrl, krw_t rw, void *tag);
 void rrm_enter_read(rrmlock_t *rrl, void *tag);
+void rrm_enter_read_prio(rrmlock_t *rrl, void *tag);
 void rrm_enter_write(rrmlock_t *rrl);
 void rrm_exit(rrmlock_t *rrl, void *tag);
 boolean_t rrm_held(rrmlock_t *rrl, krw_t rw);
@@ -132,7 +132,16 @@ typedef struct sa_idx_tab {
  * need to be compared against the list of attributes you have in hand.
  * The assumption is that typically attributes will just be updated and
  * adding a completely new attribute is a very rare operation.
+ *
+ * Both lookups are made for every znode that is set up or gains or loses an
+ * attribute, so they are fronted by caches.  Layout numbers are handed out
+ * densely, so sa_layout_cache maps a number straight to its layout, and
+ * sa_layout_hash_cache remembers the layout last found for each hash slot.
+ * All of these are protected by sa_lock.
  */
+#define	SA_LAYOUT_CACHE_MAX	1024	/* larger numbers only in the tree */
+#define	SA_LAYOUT_HASH_CACHE	16
+
 struct sa_os {
 	kmutex_t 	sa_lock;
 	boolean_t	sa_need_attr_registration;
@@ -145,6 +154,9 @@ struct sa_os {
 	sa_update_cb_t	*sa_update_cb;
 	avl_tree_t	sa_layout_num_tree;  /* keyed by layout number */
 	avl_tree_t	sa_layout_hash_tree; /* keyed by layout hash value */
+	sa_lot_t	**sa_layout_cache;   /* indexed by layout number */
+	int		sa_layout_cache_sz;  /* entries in sa_layout_cache */
+	sa_lot_t	*sa_layout_hash_cache[SA_LAYOUT_HASH_CACHE];
 	int		sa_user_table_sz;
 	sa_attr_type_t	*sa_user_table; /* user name->attr mapping table */
 };
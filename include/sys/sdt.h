@@ -29,11 +29,27 @@
 
 #ifndef _KERNEL
 
-#define	ZFS_PROBE(a)			((void) 0)
+/*
+ * In user space the DTRACE_PROBE sites become USDT probes of provider
+ * "zfs" when the systemtap <sys/sdt.h> is available.  A disabled probe is
+ * a single nop; its arguments are only located, not copied.  For example:
+ * bpftrace -e 'usdt:libzpool.so:zfs:txg__syncing { @[arg1] = count(); }'
+ */
+#ifdef HAVE_USDT
+#include_next <sys/sdt.h>
+
+#define	ZFS_PROBE0(a)			STAP_PROBE(zfs, a)
+#define	ZFS_PROBE1(a, c)		STAP_PROBE1(zfs, a, c)
+#define	ZFS_PROBE2(a, c, e)		STAP_PROBE2(zfs, a, c, e)
+#define	ZFS_PROBE3(a, c, e, g)		STAP_PROBE3(zfs, a, c, e, g)
+#define	ZFS_PROBE4(a, c, e, g, i)	STAP_PROBE4(zfs, a, c, e, g, i)
+#else
+#define	ZFS_PROBE0(a)			((void) 0)
 #define	ZFS_PROBE1(a, c)		((void) 0)
 #define	ZFS_PROBE2(a, c, e)		((void) 0)
 #define	ZFS_PROBE3(a, c, e, g)		((void) 0)
 #define	ZFS_PROBE4(a, c, e, g, i)	((void) 0)
+#endif /* HAVE_USDT */
 
 #endif /* _KERNEL */
 
@@ -118,6 +118,12 @@ extern void SHA512Update(SHA512_CTX *, const void *, size_t);
 
 extern void SHA512Final(void *, SHA512_CTX *);
 
+/* Block transform implementation selection */
+extern void sha2_impl_init(void);
+extern void sha2_impl_fini(void);
+extern int sha256_impl_set(const char *);
+extern int sha512_impl_set(const char *);
+
 #ifdef _SHA2_IMPL
 /*
  * The following types/functions are all private to the implementation
@@ -598,6 +598,7 @@ extern int spa_open_rewind(const char *pool, spa_t **, void *tag,
     nvlist_t *policy, nvlist_t **config);
 extern int spa_get_stats(const char *pool, nvlist_t **config, char *altroot,
     size_t buflen);
+extern void spa_stats_cache_invalidate(spa_t *spa);
 extern int spa_create(const char *pool, nvlist_t *config, nvlist_t *props,
     nvlist_t *zplprops);
 extern int spa_import(char *pool, nvlist_t *config, nvlist_t *props,
@@ -679,6 +680,7 @@ extern kmutex_t spa_namespace_lock;
 #define	SPA_CONFIG_UPDATE_VDEVS	1
 
 extern void spa_config_sync(spa_t *, boolean_t, boolean_t);
+extern void spa_config_sync_flush(void);
 extern void spa_config_load(void);
 extern nvlist_t *spa_all_configs(uint64_t *);
 extern void spa_config_set(spa_t *spa, nvlist_t *config);
@@ -728,10 +730,25 @@ typedef struct spa_stats {
 	spa_stats_history_t	read_history;
 	spa_stats_history_t	txg_history;
 	spa_stats_history_t	tx_assign_histogram;
+	spa_stats_history_t	txg_wait_open_histogram;
+	spa_stats_history_t	txg_wait_synced_histogram;
+	spa_stats_history_t	config_sync_histogram;
 	spa_stats_history_t	io_history;
 	spa_stats_history_t	mmp_history;
+	spa_stats_history_t	zio_stage_histogram;
+	spa_stats_history_t	load_stats;
 } spa_stats_t;
 
+/*
+ * Progress of the current or last load of the pool, in the "load" kstat.
+ */
+typedef enum spa_load_stat {
+	SPA_LOAD_METASLABS,		/* metaslabs to initialize */
+	SPA_LOAD_METASLABS_LOADED,	/* metaslabs initialized so far */
+	SPA_LOAD_METASLAB_NS,		/* time taken to initialize them */
+	SPA_LOAD_STATS
+} spa_load_stat_t;
+
 typedef enum txg_state {
 	TXG_STATE_BIRTH		= 0,
 	TXG_STATE_OPEN		= 1,
@@ -748,6 +765,21 @@ typedef struct txg_stat {
 	uint64_t		ndirty;
 } txg_stat_t;
 
+/*
+ * The phases of spa_sync() whose times are kept in the "txgs" kstat.
+ */
+typedef enum spa_sync_phase {
+	SPA_SYNC_CONFIG,	/* config object, aux devices, error log */
+	SPA_SYNC_DATASETS,	/* dirty datasets and their dnodes */
+	SPA_SYNC_MOS,		/* dirty dirs, the MOS and sync tasks */
+	SPA_SYNC_FREES,		/* frees, deferred or not */
+	SPA_SYNC_SCAN,		/* ddt_sync() and dsl_scan_sync() */
+	SPA_SYNC_VDEVS,		/* vdev_sync(): metaslabs and space maps */
+	SPA_SYNC_UBERBLOCK,	/* labels and uberblocks */
+	SPA_SYNC_DONE,		/* sync done callbacks and space update */
+	SPA_SYNC_PHASES
+} spa_sync_phase_t;
+
 extern void spa_stats_init(spa_t *spa);
 extern void spa_stats_destroy(spa_t *spa);
 extern void spa_read_history_add(spa_t *spa, const zbookmark_phys_t *zb,
@@ -758,7 +790,18 @@ extern int spa_txg_history_set(spa_t *spa,  uint64_t txg,
 extern txg_stat_t *spa_txg_history_init_io(spa_t *, uint64_t,
     struct dsl_pool *);
 extern void spa_txg_history_fini_io(spa_t *, txg_stat_t *);
+extern hrtime_t spa_sync_phase_end(spa_t *spa, spa_sync_phase_t phase,
+    hrtime_t start);
 extern void spa_tx_assign_add_nsecs(spa_t *spa, uint64_t nsecs);
+extern void spa_txg_wait_open_add_nsecs(spa_t *spa, uint64_t nsecs);
+extern void spa_txg_wait_synced_add_nsecs(spa_t *spa, uint64_t nsecs);
+extern void spa_config_sync_add_nsecs(spa_t *spa, uint64_t nsecs);
+extern void spa_zio_stage_exec(spa_t *spa, int stage, hrtime_t ns);
+extern void spa_zio_stage_elapsed(spa_t *spa, int stage, hrtime_t ns);
+extern void spa_load_stat_set(spa_t *spa, spa_load_stat_t stat,
+    uint64_t value);
+extern void spa_load_stat_add(spa_t *spa, spa_load_stat_t stat,
+    uint64_t delta);
 extern int spa_mmp_history_set_skip(spa_t *spa, uint64_t mmp_kstat_id);
 extern int spa_mmp_history_set(spa_t *spa, uint64_t mmp_kstat_id, int io_error,
     hrtime_t duration);
@@ -826,6 +869,9 @@ extern uint64_t spa_version(spa_t *spa);
 extern boolean_t spa_deflate(spa_t *spa);
 extern metaslab_class_t *spa_normal_class(spa_t *spa);
 extern metaslab_class_t *spa_log_class(spa_t *spa);
+extern metaslab_class_t *spa_special_class(spa_t *spa);
+extern metaslab_class_t *spa_preferred_class(spa_t *spa, uint64_t size,
+    dmu_object_type_t objtype, uint_t level, boolean_t special);
 extern void spa_evicting_os_register(spa_t *, objset_t *os);
 extern void spa_evicting_os_deregister(spa_t *, objset_t *os);
 extern void spa_evicting_os_wait(spa_t *spa);
@@ -42,6 +42,7 @@
 #include <sys/refcount.h>
 #include <sys/bplist.h>
 #include <sys/bpobj.h>
+#include <sys/vdev_trim.h>
 #include <sys/zfeature.h>
 #include <zfeature_common.h>
 
@@ -144,6 +145,67 @@ typedef struct zfs_histogram {
 	uint64_t latency;
 } zfs_histogram_t;
 
+/*
+ * Latency histograms of replica IOs, kept per opcode and per stage of the
+ * IO path so that the stage which dominates the tail latency can be told
+ * apart.  Buckets are log2 of nanoseconds like the vdev latency histograms
+ * (see L_HISTO()).
+ */
+typedef enum zfs_lat_op {
+	ZFS_LAT_OP_READ,
+	ZFS_LAT_OP_WRITE,
+	ZFS_LAT_OP_SYNC,
+	ZFS_LAT_OP_REBUILD_STEP,
+	ZFS_LAT_OPS
+} zfs_lat_op_t;
+
+typedef enum zfs_lat_stage {
+	ZFS_LAT_STAGE_NET_RECV,		/* receiving the request */
+	ZFS_LAT_STAGE_TX_WAIT,		/* waiting in dmu_tx_assign() */
+	ZFS_LAT_STAGE_ZIL_COMMIT,	/* zil_commit() */
+	ZFS_LAT_STAGE_ACK_SEND,		/* queueing and sending the ack */
+	ZFS_LAT_STAGES
+} zfs_lat_stage_t;
+
+typedef struct zfs_lat_histogram {
+	uint64_t zlh_buckets[VDEV_L_HISTO_BUCKETS];
+} zfs_lat_histogram_t;
+
+#define	zfs_lat_histogram_add(_array, _op, _stage, _ns) \
+    atomic_inc_64(&((_array)[_op][_stage].zlh_buckets[L_HISTO(_ns)]))
+
+/*
+ * Latency histograms of replica reads and writes broken down by IO size,
+ * in log2 buckets from 512 bytes up to 1MB and beyond.  Each volume keeps
+ * ZFS_SIZE_LAT_SHARDS copies, picked by CPU, so that the IO threads do
+ * not bounce a shared cache line; the shards are summed when the stats
+ * are read.
+ */
+#define	ZFS_SIZE_LAT_OPS	2	/* ZFS_LAT_OP_READ and _WRITE */
+#define	ZFS_SIZE_HISTO_SHIFT	9
+#define	ZFS_SIZE_HISTO_BUCKETS	12
+#define	ZFS_SIZE_LAT_SHARDS	4
+
+typedef struct zfs_size_lat_histogram {
+	uint64_t zslh_buckets[ZFS_SIZE_LAT_OPS][ZFS_SIZE_HISTO_BUCKETS]
+	    [VDEV_L_HISTO_BUCKETS];
+} zfs_size_lat_histogram_t;
+
+#define	ZFS_SIZE_HISTO(_size) \
+    HISTO(((_size) >> ZFS_SIZE_HISTO_SHIFT), ZFS_SIZE_HISTO_BUCKETS)
+
+#define	zfs_size_lat_histogram_add(_shards, _op, _size, _ns) \
+    atomic_inc_64(&((_shards)[CPU_SEQID % ZFS_SIZE_LAT_SHARDS].zslh_buckets \
+    [_op][ZFS_SIZE_HISTO(_size)][L_HISTO(_ns)]))
+
+extern uint64_t zfs_lat_histogram_percentile(const uint64_t *buckets,
+    uint64_t count, uint64_t permille);
+extern void zfs_lat_histogram_to_nvl(nvlist_t *nvl, const char *name,
+    const zfs_lat_histogram_t *zlh);
+extern void zfs_size_lat_histogram_to_nvl(nvlist_t *nvl, const char *name,
+    const zfs_size_lat_histogram_t *shards);
+extern void spa_zio_stage_histogram_to_nvl(spa_t *spa, nvlist_t *nvl);
+
 struct spa {
 	/*
 	 * Fields protected by spa_namespace_lock.
@@ -167,6 +229,7 @@ struct spa {
 	boolean_t	spa_is_initializing;	/* true while opening pool */
 	metaslab_class_t *spa_normal_class;	/* normal data class */
 	metaslab_class_t *spa_log_class;	/* intent log data class */
+	metaslab_class_t *spa_special_class;	/* metadata class */
 	uint64_t	spa_first_txg;		/* first txg after spa_open() */
 	uint64_t	spa_final_txg;		/* txg of export/destroy */
 	uint64_t	spa_freeze_txg;		/* freeze pool at this txg */
@@ -186,8 +249,13 @@ struct spa {
 	uint64_t	spa_last_synced_guid;	/* last synced guid */
 	list_t		spa_config_dirty_list;	/* vdevs with dirty config */
 	list_t		spa_state_dirty_list;	/* vdevs with dirty state */
-	kmutex_t	spa_alloc_lock;
-	avl_tree_t	spa_alloc_tree;
+	/*
+	 * The zios waiting in the allocation throttle, a queue for each of
+	 * the spa_alloc_count allocators of the metaslab classes.
+	 */
+	int		spa_alloc_count;
+	kmutex_t	*spa_alloc_locks;
+	avl_tree_t	*spa_alloc_trees;
 	spa_aux_vdev_t	spa_spares;		/* hot spares */
 	spa_aux_vdev_t	spa_l2cache;		/* L2ARC cache devices */
 	nvlist_t	*spa_label_features;	/* Features for reading MOS */
@@ -204,6 +272,9 @@ struct spa {
 	uberblock_t	spa_uberblock;		/* current uberblock */
 	boolean_t	spa_extreme_rewind;	/* rewind past deferred frees */
 	uint64_t	spa_last_io;		/* lbolt of last non-scan I/O */
+	hrtime_t	spa_scan_lat_target;	/* sync read latency goal */
+	uint64_t	spa_scan_lat_reads;	/* sync reads seen under scan */
+	uint64_t	spa_scan_lat_slow;	/* of which over the goal */
 	kmutex_t	spa_scrub_lock;		/* resilver/scrub lock */
 	uint64_t	spa_scrub_inflight;	/* in-flight scrub I/Os */
 	kcondvar_t	spa_scrub_io_cv;	/* scrub I/O completion */
@@ -242,6 +313,11 @@ struct spa {
 	kmutex_t	spa_history_lock;	/* history lock */
 	vdev_t		*spa_pending_vdev;	/* pending vdev additions */
 	kmutex_t	spa_props_lock;		/* property lock */
+	kmutex_t	spa_stats_cache_lock;	/* protects spa_stats_cache* */
+	nvlist_t	*spa_stats_cache;	/* last spa_get_stats() config */
+	hrtime_t	spa_stats_cache_time;	/* when it was generated */
+	uint64_t	spa_stats_cache_valid;	/* generation it is valid for */
+	uint64_t	spa_stats_cache_gen;	/* bumped on state changes */
 	uint64_t	spa_pool_props_object;	/* object for properties */
 	uint64_t	spa_bootfs;		/* default boot filesystem */
 	uint64_t	spa_failmode;		/* failure mode for the pool */
@@ -260,6 +336,7 @@ struct spa {
 	int		spa_mode;		/* FREAD | FWRITE */
 	spa_log_state_t spa_log_state;		/* log state */
 	uint64_t	spa_autoexpand;		/* lun expansion on/off */
+	uint64_t	spa_autotrim;		/* automatic trim on/off */
 	ddt_t		*spa_ddt[ZIO_CHECKSUM_FUNCTIONS]; /* in-core DDTs */
 	uint64_t	spa_ddt_stat_object;	/* DDT statistics */
 	uint64_t	spa_dedup_dspace;	/* Cache get_dedup_dspace() */
@@ -287,6 +364,8 @@ struct spa {
 	taskqid_t	spa_deadman_tqid;	/* Task id */
 	uint64_t	spa_deadman_calls;	/* number of deadman calls */
 	hrtime_t	spa_sync_starttime;	/* starting time of spa_sync */
+	hrtime_t	spa_sync_phase_ns[SPA_SYNC_PHASES]; /* time per phase */
+	int		spa_sync_passes;	/* passes of the last sync */
 	uint64_t	spa_deadman_synctime;	/* deadman expiration timer */
 	uint64_t	spa_all_vdev_zaps;	/* ZAP of per-vd ZAP obj #s */
 	spa_avz_action_t	spa_avz_action;	/* destroy/rebuild AVZ? */
@@ -297,10 +376,20 @@ struct spa {
 	taskq_t		*spa_prefetch_taskq;	/* Taskq for prefetch threads */
 	uint64_t	spa_multihost;		/* multihost aware (mmp) */
 	mmp_thread_t	spa_mmp;		/* multihost mmp thread */
+	trim_thread_t	spa_trim;		/* manual and auto trim */
 #ifdef	_UZFS
 	boolean_t readonly;		/* pool is readonly or not */
 #endif
 
+	/*
+	 * Vdevs whose write caches must be flushed for the log blocks of all
+	 * datasets of the pool, see zil_lwb_flush_queue().
+	 */
+	kmutex_t	spa_zil_flush_lock;
+	avl_tree_t	spa_zil_flush_tree;	/* zil_vdev_node_t's */
+	list_t		spa_zil_flush_list;	/* lwbs for the next round */
+	boolean_t	spa_zil_flushing;	/* flush round in progress */
+
 	/*
 	 * spa_refcount & spa_config_lock must be the last elements
 	 * because refcount_t changes size based on compilation options.
@@ -320,7 +409,8 @@ struct spa {
 extern char *spa_config_path;
 
 extern void spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
-    task_func_t *func, void *arg, uint_t flags, taskq_ent_t *ent);
+    task_func_t *func, void *arg, uint_t flags, taskq_ent_t *ent,
+    uint_t hint);
 extern void spa_taskq_dispatch_sync(spa_t *, zio_type_t t, zio_taskq_type_t q,
     task_func_t *func, void *arg, uint_t flags);
 
@@ -89,6 +89,8 @@ typedef struct space_map {
 } space_map_t;
 
 /*
+ * The top two bits of a word tell what kind of entry it starts.
+ *
  * debug entry
  *
  *    1      3         10                     50
@@ -97,14 +99,37 @@ typedef struct space_map {
  *  `---+--------+------------+---------------------------------'
  *   63  62    60 59        50 49                               0
  *
+ * The action is an SM_ALLOC or SM_FREE maptype_t, so bit 62 is always
+ * clear. A debug entry with a txg of zero pads out a block in which there is no
+ * room left for a two-word entry.
+ *
  *
- * non-debug entry
+ * single-word entry
  *
  *    1               47                   1           15
  *  ,-----------------------------------------------------------.
  *  | 0 |   offset (sm_shift units)    | type |       run       |
  *  `-----------------------------------------------------------'
  *   63  62                          17   16   15               0
+ *
+ *
+ * two-word entry, only written with SPA_FEATURE_SPACEMAP_V2
+ *
+ *     2     2               36                      24
+ *  ,---+--------+---------------------------+-------------------.
+ *  | 11|  pad   |   run (sm_shift units)    |       vdev        |
+ *  `---+--------+---------------------------+-------------------'
+ *   63  62    60 59                       24 23                 0
+ *
+ *     1                            63
+ *  ,------+-----------------------------------------------------.
+ *  | type |                offset (sm_shift units)              |
+ *  `------+-----------------------------------------------------'
+ *   63     62                                                   0
+ *
+ * Two-word entries are used for runs that do not fit in a single-word
+ * entry, and never straddle a block. The vdev field is there for space
+ * maps that cover more than one vdev; those of a metaslab leave it zero.
  */
 
 /* All this stuff takes and returns bytes */
@@ -128,12 +153,51 @@ typedef struct space_map {
 
 #define	SM_RUN_MAX			SM_RUN_DECODE(~0ULL)
 
+#define	SM_PREFIX_DECODE(x)	BF64_DECODE(x, 62, 2)
+#define	SM_PREFIX_ENCODE(x)	BF64_ENCODE(x, 62, 2)
+
+#define	SM_DEBUG_PREFIX		2
+#define	SM2_PREFIX		3
+
+#define	SM_ENTRY_IS_DEBUG(x)	(SM_PREFIX_DECODE(x) == SM_DEBUG_PREFIX)
+#define	SM_ENTRY_IS_DOUBLE(x)	(SM_PREFIX_DECODE(x) == SM2_PREFIX)
+
+#define	SM2_RUN_BITS		36
+#define	SM2_VDEV_BITS		24
+
+#define	SM2_RUN_DECODE(x)	\
+	(BF64_DECODE(x, SM2_VDEV_BITS, SM2_RUN_BITS) + 1)
+#define	SM2_RUN_ENCODE(x)	\
+	BF64_ENCODE((x) - 1, SM2_VDEV_BITS, SM2_RUN_BITS)
+#define	SM2_VDEV_DECODE(x)	BF64_DECODE(x, 0, SM2_VDEV_BITS)
+#define	SM2_VDEV_ENCODE(x)	BF64_ENCODE(x, 0, SM2_VDEV_BITS)
+#define	SM2_TYPE_DECODE(x)	BF64_DECODE(x, 63, 1)
+#define	SM2_TYPE_ENCODE(x)	BF64_ENCODE(x, 63, 1)
+#define	SM2_OFFSET_DECODE(x)	BF64_DECODE(x, 0, 63)
+#define	SM2_OFFSET_ENCODE(x)	BF64_ENCODE(x, 0, 63)
+
+#define	SM2_RUN_MAX			SM2_RUN_DECODE(~0ULL)
+
 typedef enum {
 	SM_ALLOC,
 	SM_FREE
 } maptype_t;
 
+/*
+ * A decoded allocation or free, in bytes.
+ */
+typedef struct space_map_entry {
+	maptype_t	sme_type;
+	uint32_t	sme_vdev;
+	uint64_t	sme_offset;
+	uint64_t	sme_run;
+} space_map_entry_t;
+
+typedef int (*sm_cb_t)(space_map_entry_t *sme, void *arg);
+
 int space_map_load(space_map_t *sm, range_tree_t *rt, maptype_t maptype);
+int space_map_iterate(space_map_t *sm, sm_cb_t callback, void *arg);
+uint64_t space_map_segment_size(space_map_t *sm, uint64_t size);
 
 void space_map_histogram_clear(space_map_t *sm);
 void space_map_histogram_add(space_map_t *sm, range_tree_t *rt,
@@ -53,7 +53,6 @@ DECLARE_EVENT_CLASS(zfs_zil_class,
 	    __field(uint8_t,	zl_keep_first)
 	    __field(uint8_t,	zl_replay)
 	    __field(uint8_t,	zl_stop_sync)
-	    __field(uint8_t,	zl_writer)
 	    __field(uint8_t,	zl_logbias)
 	    __field(uint8_t,	zl_sync)
 	    __field(int,	zl_parse_error)
@@ -61,9 +60,8 @@ DECLARE_EVENT_CLASS(zfs_zil_class,
 	    __field(uint64_t,	zl_parse_lr_seq)
 	    __field(uint64_t,	zl_parse_blk_count)
 	    __field(uint64_t,	zl_parse_lr_count)
-	    __field(uint64_t,	zl_next_batch)
-	    __field(uint64_t,	zl_com_batch)
 	    __field(uint64_t,	zl_cur_used)
+	    __field(hrtime_t,	zl_last_lwb_latency)
 	    __field(clock_t,	zl_replay_time)
 	    __field(uint64_t,	zl_replay_blks)
 	),
@@ -77,7 +75,6 @@ DECLARE_EVENT_CLASS(zfs_zil_class,
 	    __entry->zl_keep_first	= zilog->zl_keep_first;
 	    __entry->zl_replay		= zilog->zl_replay;
 	    __entry->zl_stop_sync	= zilog->zl_stop_sync;
-	    __entry->zl_writer		= zilog->zl_writer;
 	    __entry->zl_logbias		= zilog->zl_logbias;
 	    __entry->zl_sync		= zilog->zl_sync;
 	    __entry->zl_parse_error	= zilog->zl_parse_error;
@@ -85,26 +82,26 @@ DECLARE_EVENT_CLASS(zfs_zil_class,
 	    __entry->zl_parse_lr_seq	= zilog->zl_parse_lr_seq;
 	    __entry->zl_parse_blk_count	= zilog->zl_parse_blk_count;
 	    __entry->zl_parse_lr_count	= zilog->zl_parse_lr_count;
-	    __entry->zl_next_batch	= zilog->zl_next_batch;
-	    __entry->zl_com_batch	= zilog->zl_com_batch;
 	    __entry->zl_cur_used	= zilog->zl_cur_used;
+	    __entry->zl_last_lwb_latency = zilog->zl_last_lwb_latency;
 	    __entry->zl_replay_time	= zilog->zl_replay_time;
 	    __entry->zl_replay_blks	= zilog->zl_replay_blks;
 	),
 	TP_printk("zl { lr_seq %llu commit_lr_seq %llu destroy_txg %llu "
 	    "replaying_seq %llu suspend %u suspending %u keep_first %u "
-	    "replay %u stop_sync %u writer %u logbias %u sync %u "
+	    "replay %u stop_sync %u logbias %u sync %u "
 	    "parse_error %u parse_blk_seq %llu parse_lr_seq %llu "
-	    "parse_blk_count %llu parse_lr_count %llu next_batch %llu "
-	    "com_batch %llu cur_used %llu replay_time %lu replay_blks %llu }",
+	    "parse_blk_count %llu parse_lr_count %llu "
+	    "cur_used %llu last_lwb_latency %llu "
+	    "replay_time %lu replay_blks %llu }",
 	    __entry->zl_lr_seq, __entry->zl_commit_lr_seq,
 	    __entry->zl_destroy_txg, __entry->zl_replaying_seq,
 	    __entry->zl_suspend, __entry->zl_suspending, __entry->zl_keep_first,
-	    __entry->zl_replay, __entry->zl_stop_sync, __entry->zl_writer,
+	    __entry->zl_replay, __entry->zl_stop_sync,
 	    __entry->zl_logbias, __entry->zl_sync, __entry->zl_parse_error,
 	    __entry->zl_parse_blk_seq, __entry->zl_parse_lr_seq,
 	    __entry->zl_parse_blk_count, __entry->zl_parse_lr_count,
-	    __entry->zl_next_batch, __entry->zl_com_batch, __entry->zl_cur_used,
+	    __entry->zl_cur_used, __entry->zl_last_lwb_latency,
 	    __entry->zl_replay_time, __entry->zl_replay_blks)
 );
 /* END CSTYLED */
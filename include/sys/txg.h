@@ -82,6 +82,7 @@ extern void txg_register_callbacks(txg_handle_t *txghp, list_t *tx_callbacks);
 extern void txg_delay(struct dsl_pool *dp, uint64_t txg, hrtime_t delta,
     hrtime_t resolution);
 extern void txg_kick(struct dsl_pool *dp);
+extern uint64_t txg_dirty_sync_threshold(struct dsl_pool *dp);
 
 /*
  * Wait until the given transaction group has finished syncing.
@@ -136,6 +137,7 @@ extern void *txg_list_next(txg_list_t *tl, void *p, uint64_t txg);
 
 /* Global tuning */
 extern int zfs_txg_timeout;
+extern int zfs_txg_sync_target_ms;
 
 #ifdef	__cplusplus
 }
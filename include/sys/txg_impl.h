@@ -73,8 +73,7 @@ struct tx_cpu {
 	kcondvar_t	tc_cv[TXG_SIZE];
 	uint64_t	tc_count[TXG_SIZE];	/* tx hold count on each txg */
 	list_t		tc_callbacks[TXG_SIZE]; /* commit cb list */
-	char		tc_pad[8];		/* pad to fill 3 cache lines */
-};
+} __attribute__((aligned(64)));	/* no two CPUs share a cache line */
 
 /*
  * The tx_state structure maintains the state information about the different
@@ -101,6 +100,9 @@ typedef struct tx_state {
 	uint64_t	tx_sync_txg_waiting; /* txg we're waiting to sync */
 	uint64_t	tx_quiesce_txg_waiting; /* txg we're waiting to open */
 
+	uint64_t	tx_sync_bw;	/* bytes synced per ms, averaged */
+	uint64_t	tx_dirty_sync;	/* see txg_dirty_sync_threshold() */
+
 	kcondvar_t	tx_sync_more_cv;
 	kcondvar_t	tx_sync_done_cv;
 	kcondvar_t	tx_quiesce_more_cv;
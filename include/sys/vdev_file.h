@@ -35,6 +35,9 @@ extern "C" {
 
 typedef struct vdev_file {
 	vnode_t		*vf_vnode;
+	struct vdev_file_ring *vf_ring;	/* user space io_uring, or NULL */
+	struct vdev_file_aio *vf_aio;	/* user space Linux AIO, or NULL */
+	boolean_t	vf_direct;	/* user space file is O_DIRECT */
 } vdev_file_t;
 
 extern void vdev_file_init(void);
@@ -56,8 +56,18 @@ typedef struct vdev_cache_entry vdev_cache_entry_t;
 struct abd;
 
 extern int zfs_vdev_queue_depth_pct;
+extern int zfs_vdev_def_queue_depth;
 extern uint32_t zfs_vdev_async_write_max_active;
 
+/*
+ * The allocation class a top-level vdev belongs to, other than the
+ * normal and log classes.
+ */
+typedef enum vdev_alloc_bias {
+	VDEV_BIAS_NONE,
+	VDEV_BIAS_SPECIAL	/* metadata and optionally small blocks */
+} vdev_alloc_bias_t;
+
 /*
  * Virtual device operations
  */
@@ -108,6 +118,7 @@ struct vdev_cache {
 
 typedef struct vdev_queue_class {
 	uint32_t	vqc_active;
+	uint64_t	vqc_merged;	/* i/os issued within aggregates */
 
 	/*
 	 * Sorted by offset or timestamp, depending on if the queue is
@@ -122,11 +133,25 @@ struct vdev_queue {
 	avl_tree_t	vq_active_tree;
 	avl_tree_t	vq_read_offset_tree;
 	avl_tree_t	vq_write_offset_tree;
+	avl_tree_t	vq_trim_offset_tree;
+	avl_tree_t	vq_deadline_tree; /* queued i/os with a deadline */
 	uint64_t	vq_last_offset;
 	hrtime_t	vq_io_complete_ts; /* time last i/o completed */
 	hrtime_t	vq_io_delta_ts;
+	hrtime_t	vq_lat_ewma;	/* decayed average device latency */
+
+	/* Adaptive queue depth, see vdev_queue_adapt() */
+	uint32_t	vq_depth_pct;	/* scale of the classes' max_active */
+	boolean_t	vq_depth_limited; /* a class was held at max_active */
+	uint32_t	vq_depth_samples;
+	uint32_t	vq_depth_intervals; /* since the baseline was taken */
+	hrtime_t	vq_depth_start;	/* start of the sampling interval */
+	hrtime_t	vq_depth_min_lat; /* lowest latency of the interval */
+	hrtime_t	vq_depth_base_lat; /* lowest latency, the baseline */
 	zio_t		vq_io_search; /* used as local for stack reduction */
 	kmutex_t	vq_lock;
+	kstat_io_t	vq_io_stats;	/* wait/run queues, under vq_lock */
+	kstat_t		*vq_io_kstat;	/* exports vq_io_stats of a leaf */
 };
 
 /*
@@ -160,6 +185,7 @@ struct vdev {
 	boolean_t	vdev_expanding;	/* expand the vdev?		*/
 	boolean_t	vdev_reopening;	/* reopen in progress?		*/
 	boolean_t	vdev_nonrot;	/* true if solid state		*/
+	uint64_t	vdev_max_transfer; /* largest i/o, 0 if no limit */
 	int		vdev_open_error; /* error on last open		*/
 	kthread_t	*vdev_open_thread; /* thread opening children	*/
 	uint64_t	vdev_crtxg;	/* txg when top-level was added */
@@ -182,6 +208,7 @@ struct vdev {
 	list_node_t	vdev_state_dirty_node; /* state dirty list	*/
 	uint64_t	vdev_deflate_ratio; /* deflation ratio (x512)	*/
 	uint64_t	vdev_islog;	/* is an intent log device	*/
+	vdev_alloc_bias_t vdev_alloc_bias; /* metaslab class bias	*/
 	uint64_t	vdev_removing;	/* device is being removed?	*/
 	boolean_t	vdev_ishole;	/* is a hole in the namespace	*/
 	kmutex_t	vdev_queue_lock; /* protects vdev_queue_depth	*/
@@ -220,6 +247,7 @@ struct vdev {
 	uint64_t	vdev_not_present; /* not present during import	*/
 	uint64_t	vdev_unspare;	/* unspare when resilvering done */
 	boolean_t	vdev_nowritecache; /* true if flushwritecache failed */
+	boolean_t	vdev_notrim;	/* true if trim failed */
 	boolean_t	vdev_checkremove; /* temporary online test	*/
 	boolean_t	vdev_forcefault; /* force online fault		*/
 	boolean_t	vdev_splitting;	/* split or repair in progress  */
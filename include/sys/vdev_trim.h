@@ -0,0 +1,61 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_VDEV_TRIM_H
+#define	_SYS_VDEV_TRIM_H
+
+#include <sys/spa.h>
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * The state of a pool's trim thread, which runs the manual trims started
+ * by zpool trim and, with the autotrim property on, trims the space freed
+ * by each batch of txgs.
+ */
+typedef struct trim_thread {
+	kmutex_t	tt_lock;	/* protects the fields below */
+	kcondvar_t	tt_cv;
+	kthread_t	*tt_thread;
+	boolean_t	tt_exiting;
+	boolean_t	tt_manual;	/* a manual trim is wanted or running */
+	boolean_t	tt_stop;	/* and should be stopped */
+	uint64_t	tt_rate;	/* its rate in bytes/sec, or 0 */
+	uint64_t	tt_last_txg;	/* last txg seen by autotrim */
+} trim_thread_t;
+
+extern void vdev_trim_init(spa_t *spa);
+extern void vdev_trim_fini(spa_t *spa);
+extern void vdev_trim_thread_start(spa_t *spa);
+extern void vdev_trim_thread_stop(spa_t *spa);
+extern void vdev_trim_wakeup(spa_t *spa);
+
+extern int spa_trim(spa_t *spa, uint64_t rate);
+extern int spa_trim_stop(spa_t *spa);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_VDEV_TRIM_H */
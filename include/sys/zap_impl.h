@@ -65,11 +65,14 @@ typedef struct mzap_phys {
 	/* actually variable size depending on block size */
 } mzap_phys_t;
 
+/*
+ * In-core index of a microzap: one entry per name, kept in an array sorted
+ * by (hash, cd).
+ */
 typedef struct mzap_ent {
-	avl_node_t mze_node;
-	int mze_chunkid;
 	uint64_t mze_hash;
 	uint32_t mze_cd; /* copy from mze_phys->mze_cd */
+	uint16_t mze_chunkid;
 } mzap_ent_t;
 
 #define	MZE_PHYS(zap, mze) \
@@ -164,7 +167,9 @@ typedef struct zap {
 			int16_t zap_num_entries;
 			int16_t zap_num_chunks;
 			int16_t zap_alloc_next;
-			avl_tree_t zap_avl;
+			int16_t zap_mze_count;
+			int16_t zap_mze_size;
+			mzap_ent_t *zap_mze;
 		} zap_micro;
 	} zap_u;
 } zap_t;
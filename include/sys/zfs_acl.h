@@ -167,6 +167,12 @@ typedef struct zfs_acl {
 	zfs_acl_node_t	*z_curr_node;	/* current node iterator is handling */
 	list_t		z_acl;		/* chunks of ACE data */
 	acl_ops_t	*z_ops;		/* ACL operations */
+	cred_t		*z_acc_cred;	/* held cred of last access check */
+	uid_t		z_acc_fowner;	/* file owner at that check */
+	uid_t		z_acc_gowner;	/* file group at that check */
+	uint32_t	z_acc_mode;	/* access mask that was checked */
+	uint32_t	z_acc_left;	/* access mask it left unresolved */
+	int		z_acc_error;	/* and its result */
 } zfs_acl_t;
 
 typedef struct acl_locator_cb {
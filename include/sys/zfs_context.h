@@ -93,6 +93,7 @@
 #include <string.h>
 #include <strings.h>
 #include <pthread.h>
+#include <sched.h>
 #include <synch.h>
 #include <assert.h>
 #include <alloca.h>
@@ -169,46 +170,43 @@ extern int aok;
  * the kernel.  If they're being used in kernel code, re-define them out of
  * existence for their counterparts in libzpool.
  *
- * Here's an example of how to use the set-error probes in userland:
- * zfs$target:::set-error /arg0 == EBUSY/ {stack();}
- *
- * Here's an example of how to use DTRACE_PROBE probes in userland:
- * If there is a probe declared as follows:
+ * In userland they are USDT probes of provider "zfs" named after the
+ * probe, see sys/sdt.h.  If there is a probe declared as follows:
  * DTRACE_PROBE2(zfs__probe_name, uint64_t, blkid, dnode_t *, dn);
  * Then you can use it as follows:
- * zfs$target:::probe2 /copyinstr(arg0) == "zfs__probe_name"/
- *     {printf("%u %p\n", arg1, arg2);}
+ * bpftrace -e 'usdt:libzpool.so:zfs:zfs__probe_name
+ *     { printf("%u %p\n", arg0, arg1); }'
  */
 
 #ifdef DTRACE_PROBE
 #undef	DTRACE_PROBE
 #endif	/* DTRACE_PROBE */
 #define	DTRACE_PROBE(a) \
-	ZFS_PROBE0(#a)
+	ZFS_PROBE0(a)
 
 #ifdef DTRACE_PROBE1
 #undef	DTRACE_PROBE1
 #endif	/* DTRACE_PROBE1 */
 #define	DTRACE_PROBE1(a, b, c) \
-	ZFS_PROBE1(#a, (unsigned long)c)
+	ZFS_PROBE1(a, (unsigned long)c)
 
 #ifdef DTRACE_PROBE2
 #undef	DTRACE_PROBE2
 #endif	/* DTRACE_PROBE2 */
 #define	DTRACE_PROBE2(a, b, c, d, e) \
-	ZFS_PROBE2(#a, (unsigned long)c, (unsigned long)e)
+	ZFS_PROBE2(a, (unsigned long)c, (unsigned long)e)
 
 #ifdef DTRACE_PROBE3
 #undef	DTRACE_PROBE3
 #endif	/* DTRACE_PROBE3 */
 #define	DTRACE_PROBE3(a, b, c, d, e, f, g) \
-	ZFS_PROBE3(#a, (unsigned long)c, (unsigned long)e, (unsigned long)g)
+	ZFS_PROBE3(a, (unsigned long)c, (unsigned long)e, (unsigned long)g)
 
 #ifdef DTRACE_PROBE4
 #undef	DTRACE_PROBE4
 #endif	/* DTRACE_PROBE4 */
 #define	DTRACE_PROBE4(a, b, c, d, e, f, g, h, i) \
-	ZFS_PROBE4(#a, (unsigned long)c, (unsigned long)e, (unsigned long)g, \
+	ZFS_PROBE4(a, (unsigned long)c, (unsigned long)e, (unsigned long)g, \
 	(unsigned long)i)
 
 /*
@@ -241,14 +239,15 @@ typedef struct kthread {
 	thread_func_t	t_func;
 	void *		t_arg;
 	pri_t		t_pri;
+	const char	*t_name;	/* for thread placement, or NULL */
 } kthread_t;
 
 #define	curthread			zk_thread_current()
 #define	getcomm()			"unknown"
 #define	thread_exit			zk_thread_exit
 #define	thread_create(stk, stksize, func, arg, len, pp, state, pri)	\
-	zk_thread_create(stk, stksize, (thread_func_t)func, arg,	\
-	    len, NULL, state, pri, PTHREAD_CREATE_DETACHED)
+	zk_thread_create_named(#func, stk, stksize, (thread_func_t)func, \
+	    arg, len, NULL, state, pri, PTHREAD_CREATE_DETACHED)
 #define	thread_join(t)			zk_thread_join(t)
 #define	newproc(f, a, cid, pri, ctp, pid)	(ENOSYS)
 
@@ -257,7 +256,11 @@ extern void zk_thread_exit(void);
 extern kthread_t *zk_thread_create(caddr_t stk, size_t  stksize,
 	thread_func_t func, void *arg, uint64_t len,
 	proc_t *pp, int state, pri_t pri, int detachstate);
+extern kthread_t *zk_thread_create_named(const char *name, caddr_t stk,
+	size_t stksize, thread_func_t func, void *arg, uint64_t len,
+	proc_t *pp, int state, pri_t pri, int detachstate);
 extern void zk_thread_join(kt_did_t tid);
+extern int zk_thread_set_affinity(const char *name);
 
 #define	kpreempt_disable()	((void)0)
 #define	kpreempt_enable()	((void)0)
@@ -274,10 +277,37 @@ extern void zk_thread_join(kt_did_t tid);
 #define	MTX_INIT	((void *)NULL)
 #define	MTX_DEST	((void *)-1UL)
 
+/*
+ * With ZFS_LOCKSTAT (configure --enable-lockstat) every mutex_init() and
+ * rw_init() call site gets a lockstat_site_t, which counts how often the
+ * locks initialized there are taken and contended, the time spent waiting
+ * for them and the longest time one was held.  The sites are printed by
+ * kstat_dump_all() and lockstat_dump().
+ */
+#ifdef ZFS_LOCKSTAT
+typedef struct lockstat_site {
+	const char		*ls_file;
+	int			ls_line;
+	const char		*ls_kind;
+	struct lockstat_site	*ls_next;	/* on the list of all sites */
+	volatile uint_t		ls_registered;
+	uint64_t		ls_acquired;
+	uint64_t		ls_contended;
+	uint64_t		ls_wait_time;	/* ns, contended only */
+	uint64_t		ls_max_hold;	/* ns, writers only for rwlocks */
+} lockstat_site_t;
+
+extern void lockstat_dump(void);
+#endif
+
 typedef struct kmutex {
 	void		*m_owner;
 	uint64_t	m_magic;
 	pthread_mutex_t	m_lock;
+#ifdef ZFS_LOCKSTAT
+	lockstat_site_t	*m_site;
+	hrtime_t	m_hold_start;
+#endif
 } kmutex_t;
 
 #define	MUTEX_DEFAULT	0
@@ -293,6 +323,16 @@ extern int mutex_tryenter(kmutex_t *mp);
 extern void *mutex_owner(kmutex_t *mp);
 extern int mutex_held(kmutex_t *mp);
 
+#if defined(ZFS_LOCKSTAT) && !defined(ZFS_LOCKSTAT_IMPL)
+extern void mutex_init_site(kmutex_t *mp, char *name, int type, void *cookie,
+    lockstat_site_t *ls);
+#define	mutex_init(mp, name, type, cookie)				\
+do {									\
+	static lockstat_site_t __ls = { __FILE__, __LINE__, "mutex" };	\
+	mutex_init_site(mp, name, type, cookie, &__ls);			\
+} while (0)
+#endif
+
 /*
  * RW locks
  */
@@ -305,7 +345,13 @@ typedef struct krwlock {
 	void			*rw_wr_owner;
 	uint64_t		rw_magic;
 	pthread_rwlock_t	rw_lock;
-	uint_t			rw_readers;
+	uint_t			rw_readers;	/* readers of rw_lock */
+	volatile uint_t		rw_rbias;	/* readers may bypass rw_lock */
+	hrtime_t		rw_rbias_inhibit; /* no rw_rbias until then */
+#ifdef ZFS_LOCKSTAT
+	lockstat_site_t		*rw_site;
+	hrtime_t		rw_hold_start;	/* of the writer */
+#endif
 } krwlock_t;
 
 typedef int krw_t;
@@ -315,7 +361,7 @@ typedef int krw_t;
 #define	RW_DEFAULT	RW_READER
 #define	RW_NOLOCKDEP	RW_READER
 
-#define	RW_READ_HELD(x)		((x)->rw_readers > 0)
+#define	RW_READ_HELD(x)		(rw_read_held(x))
 #define	RW_WRITE_HELD(x)	((x)->rw_wr_owner == curthread)
 #define	RW_LOCK_HELD(x)		(RW_READ_HELD(x) || RW_WRITE_HELD(x))
 
@@ -331,6 +377,17 @@ extern void rw_enter(krwlock_t *rwlp, krw_t rw);
 extern int rw_tryenter(krwlock_t *rwlp, krw_t rw);
 extern int rw_tryupgrade(krwlock_t *rwlp);
 extern void rw_exit(krwlock_t *rwlp);
+extern int rw_read_held(krwlock_t *rwlp);
+
+#if defined(ZFS_LOCKSTAT) && !defined(ZFS_LOCKSTAT_IMPL)
+extern void rw_init_site(krwlock_t *rwlp, char *name, int type, void *arg,
+    lockstat_site_t *ls);
+#define	rw_init(rwlp, name, type, arg)					\
+do {									\
+	static lockstat_site_t __ls = { __FILE__, __LINE__, "rwlock" };	\
+	rw_init_site(rwlp, name, type, arg, &__ls);			\
+} while (0)
+#endif
 #define	rw_downgrade(rwlp) do { } while (0)
 
 extern uid_t crgetuid(cred_t *cr);
@@ -417,13 +474,7 @@ extern void kstat_dump_all(void);
 #define	vmem_alloc(_s, _f)	kmem_alloc(_s, _f)
 #define	vmem_zalloc(_s, _f)	kmem_zalloc(_s, _f)
 #define	vmem_free(_b, _s)	kmem_free(_b, _s)
-#define	kmem_cache_create(_a, _b, _c, _d, _e, _f, _g, _h, _i) \
-	umem_cache_create(_a, _b, _c, _d, _e, _f, _g, _h, _i)
-#define	kmem_cache_destroy(_c)	umem_cache_destroy(_c)
-#define	kmem_cache_alloc(_c, _f) umem_cache_alloc(_c, _f)
-#define	kmem_cache_free(_c, _b)	umem_cache_free(_c, _b)
 #define	kmem_debugging()	0
-#define	kmem_cache_reap_now(_c)	umem_cache_reap_now(_c);
 #define	kmem_cache_set_move(_c, _cb)	/* nothing */
 #define	vmem_qcache_reap(_v)		/* nothing */
 #define	POINTER_INVALIDATE(_pp)		/* nothing */
@@ -431,7 +482,21 @@ extern void kstat_dump_all(void);
 
 extern vmem_t *zio_arena;
 
-typedef umem_cache_t kmem_cache_t;
+/*
+ * kmem caches are umem caches with per-thread magazines in front of them,
+ * see kernel.c.
+ */
+typedef struct kmem_cache kmem_cache_t;
+
+extern kmem_cache_t *kmem_cache_create(char *name, size_t bufsize,
+    size_t align, umem_constructor_t *constructor,
+    umem_destructor_t *destructor, umem_reclaim_t *reclaim, void *priv,
+    void *vmp, int cflags);
+extern void kmem_cache_destroy(kmem_cache_t *cp);
+extern void *kmem_cache_alloc(kmem_cache_t *cp, int flags);
+extern void kmem_cache_free(kmem_cache_t *cp, void *buf);
+extern void kmem_cache_reap_now(kmem_cache_t *cp);
+extern void kmem_cache_stats_dump(void);
 
 typedef enum kmem_cbrc {
 	KMEM_CBRC_YES,
@@ -458,23 +523,36 @@ typedef struct taskq_ent {
 	uintptr_t		tqent_flags;
 } taskq_ent_t;
 
+/*
+ * Each thread of a taskq has its own queue and entry freelist, see
+ * lib/libzpool/taskq.c.  tq_lock only serializes the slow paths: waiting
+ * for the queue to drain, for tq_maxalloc, and starting and retiring the
+ * threads of a TASKQ_DYNAMIC taskq, which runs tq_nthreads of them out of
+ * tq_maxthreads.
+ */
+struct taskq_worker;
+
 typedef struct taskq {
 	char		tq_name[TASKQ_NAMELEN + 1];
 	kmutex_t	tq_lock;
 	krwlock_t	tq_threadlock;
-	kcondvar_t	tq_dispatch_cv;
 	kcondvar_t	tq_wait_cv;
 	kthread_t	**tq_threadlist;
+	struct taskq_worker *tq_workers;
 	int		tq_flags;
-	int		tq_active;
 	int		tq_nthreads;
-	int		tq_nalloc;
+	int		tq_maxthreads;
+	pri_t		tq_pri;
+	volatile uint64_t tq_pending;	/* tasks queued or running */
+	volatile uint32_t tq_seq;	/* futex, bumped by each dispatch */
+	volatile uint32_t tq_idle;	/* threads waiting on tq_seq */
+	volatile uint32_t tq_waiters;	/* threads in taskq_wait() */
+	volatile uint32_t tq_rotor;	/* next queue for outside dispatch */
+	volatile uint32_t tq_nalloc;
 	int		tq_minalloc;
 	int		tq_maxalloc;
 	kcondvar_t	tq_maxalloc_cv;
 	int		tq_maxalloc_wait;
-	taskq_ent_t	*tq_freelist;
-	taskq_ent_t	tq_task;
 } taskq_t;
 
 #define	TQENT_FLAG_PREALLOC	0x1	/* taskq_dispatch_ent used */
@@ -494,6 +572,8 @@ typedef struct taskq {
 
 extern taskq_t *system_taskq;
 extern taskq_t *system_delay_taskq;
+extern int taskq_dynamic_budget;
+extern int taskq_dynamic_idle_ms;
 
 extern taskq_t	*taskq_create(const char *, int, pri_t, int, int, uint_t);
 #define	taskq_create_proc(a, b, c, d, e, p, f) \
@@ -613,6 +693,8 @@ extern int vn_openat(char *path, int x1, int oflags, int mode, vnode_t **vpp,
     int x2, int x3, vnode_t *vp, int fd);
 extern int vn_rdwr(int uio, vnode_t *vp, void *addr, ssize_t len,
     offset_t offset, int x1, int x2, rlim64_t x3, void *x4, ssize_t *residp);
+extern int vn_readv(vnode_t *vp, const struct iovec *iov, int iovcnt,
+    offset_t offset, ssize_t *residp);
 extern void vn_close(vnode_t *vp);
 
 #define	vn_remove(path, x1, x2)		remove(path)
@@ -655,7 +737,7 @@ extern void delay(clock_t ticks);
 	} while (0);
 
 #define	max_ncpus	64
-#define	boot_ncpus	(MIN(sysconf(_SC_NPROCESSORS_ONLN), max_ncpus))
+extern int boot_ncpus;		/* online CPUs, at most max_ncpus */
 
 /*
  * Process priorities as defined by setpriority(2) and getpriority(2).
@@ -664,7 +746,13 @@ extern void delay(clock_t ticks);
 #define	maxclsyspri	-20
 #define	defclsyspri	0
 
-#define	CPU_SEQID	(((uintptr_t)pthread_self() >> 16) % boot_ncpus)
+/*
+ * The CPU the thread is running on, as in the kernel, so that per-CPU
+ * structures such as the txg tx_cpu array are only shared by the threads
+ * running on one CPU.  glibc gets it from rseq or the vDSO, without a
+ * system call.
+ */
+#define	CPU_SEQID	((uint_t)sched_getcpu() % boot_ncpus)
 
 #define	kcred		NULL
 #define	CRED()		NULL
@@ -672,6 +760,12 @@ extern void delay(clock_t ticks);
 #define	ptob(x)		((x) * PAGESIZE)
 
 extern uint64_t physmem;
+extern uint64_t cgroup_mem_limit;
+extern uint64_t cgroup_mem_free;
+extern uint64_t cgroup_mem_pressure;
+
+extern boolean_t cgroup_mem_monitor_init(uint64_t, uint64_t);
+extern void cgroup_mem_monitor_fini(void);
 
 extern int highbit64(uint64_t i);
 extern int lowbit64(uint64_t i);
@@ -344,7 +344,11 @@ typedef struct zinject_record {
 	uint64_t	zi_timer;
 	uint64_t	zi_nlanes;
 	uint32_t	zi_cmd;
-	uint32_t	zi_pad;
+	uint32_t	zi_delay_dist;
+	uint64_t	zi_jitter;
+	uint64_t	zi_bandwidth;
+	uint64_t	zi_stall_period;
+	uint64_t	zi_stall_time;
 } zinject_record_t;
 
 #define	ZINJECT_NULL		0x1
@@ -372,6 +376,17 @@ typedef enum zinject_type {
 	ZINJECT_DELAY_IO,
 } zinject_type_t;
 
+/*
+ * How the latency of a ZINJECT_DELAY_IO handler varies around zi_timer;
+ * zi_jitter is the standard deviation of the normal distribution and the
+ * scale of the long tail.
+ */
+typedef enum zinject_delay_dist {
+	ZINJECT_DELAY_FIXED,
+	ZINJECT_DELAY_NORMAL,
+	ZINJECT_DELAY_TAIL,
+} zinject_delay_dist_t;
+
 typedef struct zfs_share {
 	uint64_t	z_exportdata;
 	uint64_t	z_sharedata;
@@ -51,6 +51,9 @@ typedef struct zfs_rlock {
 	uint64_t *zr_size;	/* points to znode->z_size */
 	uint_t *zr_blksz;	/* points to znode->z_blksz */
 	uint64_t *zr_max_blksz; /* points to zfsvfs->z_max_blksz */
+	struct zfs_rlock *zr_shards; /* see zfs_rlock_init_sharded() */
+	uint_t zr_nshards;	/* number of zr_shards */
+	uint_t zr_shard_shift;	/* log2 of the stripe mapped to a shard */
 } zfs_rlock_t;
 
 typedef struct rl {
@@ -66,6 +69,7 @@ typedef struct rl {
 	uint8_t r_write_wanted;	/* writer wants to lock this range */
 	uint8_t r_read_wanted;	/* reader wants to lock this range */
 	list_node_t rl_node;	/* used for deferred release */
+	struct rl **r_shard_rl;	/* shard locks making up a sharded lock */
 } rl_t;
 
 /*
@@ -92,6 +96,14 @@ void zfs_range_reduce(rl_t *rl, uint64_t off, uint64_t len);
  */
 int zfs_range_compare(const void *arg1, const void *arg2);
 
+/*
+ * Split the range lock into independently locked shards, see zfs_rlock.c.
+ * Only for consumers that neither append nor grow the block size, such as
+ * zvols.
+ */
+void zfs_rlock_init_sharded(zfs_rlock_t *zrl);
+void zfs_rlock_destroy_shards(zfs_rlock_t *zrl);
+
 static inline void
 zfs_rlock_init(zfs_rlock_t *zrl)
 {
@@ -101,11 +113,16 @@ zfs_rlock_init(zfs_rlock_t *zrl)
 	zrl->zr_size = NULL;
 	zrl->zr_blksz = NULL;
 	zrl->zr_max_blksz = NULL;
+	zrl->zr_shards = NULL;
+	zrl->zr_nshards = 0;
+	zrl->zr_shard_shift = 0;
 }
 
 static inline void
 zfs_rlock_destroy(zfs_rlock_t *zrl)
 {
+	if (zrl->zr_shards != NULL)
+		zfs_rlock_destroy_shards(zrl);
 	avl_destroy(&zrl->zr_avl);
 	mutex_destroy(&zrl->zr_mutex);
 }
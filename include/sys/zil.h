@@ -39,6 +39,7 @@ extern "C" {
 
 struct dsl_pool;
 struct dsl_dataset;
+struct lwb;
 
 /*
  * Intent log format:
@@ -139,6 +140,7 @@ typedef enum zil_create {
 /*
  * Intent log transaction types and record structures
  */
+#define	TX_COMMIT		0	/* Commit marker (no on-disk state) */
 #define	TX_CREATE		1	/* Create file */
 #define	TX_MKDIR		2	/* Make directory */
 #define	TX_MKXATTR		3	/* Make XATTR directory */
@@ -378,7 +380,8 @@ typedef struct {
  *    There are a few requirements for this to occur:
  *	- write is greater than zfs/zvol_immediate_write_sz
  *	- not using slogs (as slogs are assumed to always be faster
- *	  than writing into the main pool)
+ *	  than writing into the main pool), or for zvols, the commit
+ *	  it goes into having already logged zil_slog_bulk bytes
  *	- the write occupies only one block
  * WR_COPIED:
  *    If we know we'll immediately be committing the
@@ -462,6 +465,14 @@ typedef struct zil_stats {
 	 */
 	kstat_named_t zil_itx_metaslab_slog_count;
 	kstat_named_t zil_itx_metaslab_slog_bytes;
+
+	/*
+	 * Number of vdev write cache flush rounds issued by ZIL commits and
+	 * number of commits whose flushes were merged into a round issued
+	 * by a commit of another dataset of the same pool.
+	 */
+	kstat_named_t zil_flush_count;
+	kstat_named_t zil_flush_merged_count;
 } zil_stats_t;
 
 extern zil_stats_t zil_stats;
@@ -476,7 +487,10 @@ typedef int zil_parse_blk_func_t(zilog_t *zilog, blkptr_t *bp, void *arg,
 typedef int zil_parse_lr_func_t(zilog_t *zilog, lr_t *lr, void *arg,
     uint64_t txg);
 typedef int (*const zil_replay_func_t)(void *, char *, boolean_t);
-typedef int zil_get_data_t(void *arg, lr_write_t *lr, char *dbuf, zio_t *zio);
+typedef int zil_replay_range_func_t(void *arg, const lr_t *lr, uint64_t *objp,
+    uint64_t *offsetp, uint64_t *lengthp);
+typedef int zil_get_data_t(void *arg, lr_write_t *lr, char *dbuf,
+    struct lwb *lwb, zio_t *zio);
 
 extern int zil_parse(zilog_t *zilog, zil_parse_blk_func_t *parse_blk_func,
     zil_parse_lr_func_t *parse_lr_func, void *arg, uint64_t txg);
@@ -492,6 +506,9 @@ extern void	zil_close(zilog_t *zilog);
 
 extern void	zil_replay(objset_t *os, void *arg,
     zil_replay_func_t replay_func[TX_MAX_TYPE]);
+extern void	zil_replay_parallel(objset_t *os, void *arg,
+    zil_replay_func_t replay_func[TX_MAX_TYPE],
+    zil_replay_range_func_t *range_func);
 extern boolean_t zil_replaying(zilog_t *zilog, dmu_tx_t *tx);
 extern void	zil_destroy(zilog_t *zilog, boolean_t keep_first);
 extern void	zil_destroy_sync(zilog_t *zilog, dmu_tx_t *tx);
@@ -513,7 +530,9 @@ extern void	zil_clean(zilog_t *zilog, uint64_t synced_txg);
 extern int	zil_suspend(const char *osname, void **cookiep);
 extern void	zil_resume(void *cookie);
 
-extern void	zil_add_block(zilog_t *zilog, const blkptr_t *bp);
+extern void	zil_lwb_add_block(struct lwb *lwb, const blkptr_t *bp);
+extern void	zil_flush_group_init(spa_t *spa);
+extern void	zil_flush_group_fini(spa_t *spa);
 extern int	zil_bp_tree_add(zilog_t *zilog, const blkptr_t *bp);
 
 extern void	zil_set_sync(zilog_t *zilog, uint64_t syncval);
@@ -521,6 +540,7 @@ extern void	zil_set_sync(zilog_t *zilog, uint64_t syncval);
 extern void	zil_set_logbias(zilog_t *zilog, uint64_t slogval);
 
 extern int zil_replay_disable;
+extern unsigned long zil_slog_bulk;
 
 #ifdef	__cplusplus
 }
@@ -38,11 +38,23 @@
 #include <sys/avl.h>
 #include <sys/fs/zfs.h>
 #include <sys/zio_impl.h>
+#include <sys/dkio.h>
 
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
+/*
+ * The ioctl of a trim zio, which discards io_size bytes at io_offset of a
+ * leaf vdev.
+ */
+#ifndef	DKIOCTRIM
+#define	DKIOCTRIM	(DKIOC | 35)
+#endif
+
+#define	ZIO_IS_TRIM(zio)	\
+	((zio)->io_type == ZIO_TYPE_IOCTL && (zio)->io_cmd == DKIOCTRIM)
+
 /*
  * Embedded checksum
  */
@@ -86,6 +98,7 @@ enum zio_checksum {
 	ZIO_CHECKSUM_SHA512,
 	ZIO_CHECKSUM_SKEIN,
 	ZIO_CHECKSUM_EDONR,
+	ZIO_CHECKSUM_BLAKE3,
 	ZIO_CHECKSUM_FUNCTIONS
 };
 
@@ -314,12 +327,14 @@ struct zbookmark_phys {
 typedef struct zio_prop {
 	enum zio_checksum	zp_checksum;
 	enum zio_compress	zp_compress;
+	uint16_t		zp_complevel;	/* 0 for the default */
 	dmu_object_type_t	zp_type;
 	uint8_t			zp_level;
 	uint8_t			zp_copies;
 	boolean_t		zp_dedup;
 	boolean_t		zp_dedup_verify;
 	boolean_t		zp_nopwrite;
+	boolean_t		zp_special;	/* prefer the special class */
 } zio_prop_t;
 
 typedef struct zio_cksum_report zio_cksum_report_t;
@@ -435,6 +450,9 @@ struct zio {
 	struct abd	*io_orig_abd;
 	uint64_t	io_size;
 	uint64_t	io_orig_size;
+	/* Checksum of io_abd computed by zio_write_compress(), if any */
+	enum zio_checksum io_fused_checksum;
+	zio_cksum_t	io_fused_cksum;
 
 	/* Stuff for the vdev stack */
 	vdev_t		*io_vd;
@@ -444,14 +462,18 @@ struct zio {
 	uint64_t	io_offset;
 	hrtime_t	io_timestamp;	/* submitted at */
 	hrtime_t	io_queued_timestamp;
+	hrtime_t	io_stage_timestamp; /* io_stage started at */
 	hrtime_t	io_target_timestamp;
+	hrtime_t	io_deadline;	/* issue by, 0 for none */
 	hrtime_t	io_delta;	/* vdev queue service delta */
 	hrtime_t	io_delay;	/* Device access time (disk or */
 					/* file). */
 	avl_node_t	io_queue_node;
 	avl_node_t	io_offset_node;
+	avl_node_t	io_deadline_node;
 	avl_node_t	io_alloc_node;
 	zio_alloc_list_t 	io_alloc_list;
+	int		io_allocator;	/* see zio_allocator() */
 
 	/* Internal pipeline state */
 	enum zio_flag	io_flags;
@@ -481,6 +503,7 @@ struct zio {
 
 	/* Taskq dispatching state */
 	taskq_ent_t	io_tqent;
+	uint_t		io_taskq_hint;	/* CPU which created the zio */
 };
 
 extern int zio_bookmark_compare(const void *, const void *);
@@ -518,6 +541,9 @@ extern zio_t *zio_claim(zio_t *pio, spa_t *spa, uint64_t txg,
 extern zio_t *zio_ioctl(zio_t *pio, spa_t *spa, vdev_t *vd, int cmd,
     zio_done_func_t *done, void *priv, enum zio_flag flags);
 
+extern zio_t *zio_trim(zio_t *pio, spa_t *spa, vdev_t *vd, uint64_t offset,
+    uint64_t size, zio_done_func_t *done, void *priv, enum zio_flag flags);
+
 extern zio_t *zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset,
     uint64_t size, struct abd *data, int checksum,
     zio_done_func_t *done, void *priv, zio_priority_t priority,
@@ -531,8 +557,8 @@ extern zio_t *zio_write_phys(zio_t *pio, vdev_t *vd, uint64_t offset,
 extern zio_t *zio_free_sync(zio_t *pio, spa_t *spa, uint64_t txg,
     const blkptr_t *bp, enum zio_flag flags);
 
-extern int zio_alloc_zil(spa_t *spa, uint64_t txg, blkptr_t *new_bp,
-    uint64_t size, boolean_t *slog);
+extern int zio_alloc_zil(spa_t *spa, uint64_t objset, uint64_t txg,
+    blkptr_t *new_bp, uint64_t size, boolean_t *slog);
 extern void zio_free_zil(spa_t *spa, uint64_t txg, blkptr_t *bp);
 extern void zio_flush(zio_t *zio, vdev_t *vd);
 extern void zio_shrink(zio_t *zio, uint64_t size);
@@ -51,9 +51,28 @@ enum zio_compress {
 	ZIO_COMPRESS_GZIP_9,
 	ZIO_COMPRESS_ZLE,
 	ZIO_COMPRESS_LZ4,
+	ZIO_COMPRESS_ZSTD,
 	ZIO_COMPRESS_FUNCTIONS
 };
 
+/*
+ * The compression property value carries an algorithm level above the
+ * algorithm itself, so one on-disk ZIO_COMPRESS_ZSTD covers every zstd
+ * level.  Only zstd uses it; level 0 selects the algorithm's default.
+ * Negative ("fast") zstd levels are stored as ZIO_ZSTD_LEVEL_FAST + N.
+ */
+#define	ZIO_COMPLEVEL_SHIFT	7
+#define	ZIO_COMPRESS_MASK	((1ULL << ZIO_COMPLEVEL_SHIFT) - 1)
+#define	ZIO_COMPRESS_RAW(x)	((x) & ZIO_COMPRESS_MASK)
+#define	ZIO_COMPRESS_LEVEL(x)	((x) >> ZIO_COMPLEVEL_SHIFT)
+#define	ZIO_COMPLEVEL_ZSTD(l)	\
+	(ZIO_COMPRESS_ZSTD | ((uint64_t)(l) << ZIO_COMPLEVEL_SHIFT))
+
+#define	ZIO_ZSTD_LEVEL_DEFAULT	3
+#define	ZIO_ZSTD_LEVEL_MAX	19
+#define	ZIO_ZSTD_LEVEL_FAST	1000
+#define	ZIO_ZSTD_LEVEL_FAST_MAX	1000
+
 /* Common signature for all zio compress functions. */
 typedef size_t zio_compress_func_t(void *src, void *dst,
     size_t s_len, size_t d_len, int);
@@ -80,12 +99,41 @@ typedef const struct zio_compress_info {
 
 extern zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS];
 
+/*
+ * A compression accelerator.  Requests for the algorithms in zca_algs
+ * (a mask of 1 << ZIO_COMPRESS_*) are offered to the device when
+ * zca_usable() accepts their uncompressed length; a non-zero return from
+ * zca_compress() or zca_decompress() sends the request to software.
+ * Output must match the software format of the algorithm exactly.  A
+ * provider may only unregister once no I/O can reach it.
+ */
+typedef struct zio_compress_accel {
+	const char	*zca_name;
+	uint64_t	zca_algs;
+	boolean_t	(*zca_usable)(enum zio_compress c, size_t len);
+	int		(*zca_compress)(enum zio_compress c, int level,
+	    void *src, void *dst, size_t s_len, size_t d_len, size_t *c_len);
+	int		(*zca_decompress)(enum zio_compress c, int level,
+	    void *src, void *dst, size_t s_len, size_t d_len);
+} zio_compress_accel_t;
+
+#define	ZIO_COMPRESS_ACCEL_MAX	4
+
+extern int zio_compress_accel_register(const zio_compress_accel_t *zca);
+extern void zio_compress_accel_unregister(const zio_compress_accel_t *zca);
+
 /*
  * lz4 compression init & free
  */
 extern void lz4_init(void);
 extern void lz4_fini(void);
 
+/*
+ * zstd compression init & free
+ */
+extern void zstd_init(void);
+extern void zstd_fini(void);
+
 /*
  * Compression routines.
  */
@@ -107,15 +155,20 @@ extern int lz4_decompress_zfs(void *src, void *dst, size_t s_len, size_t d_len,
     int level);
 extern int lz4_decompress_abd(abd_t *src, void *dst, size_t s_len, size_t d_len,
     int level);
+extern size_t zstd_compress_zfs(void *src, void *dst, size_t s_len,
+    size_t d_len, int level);
+extern int zstd_decompress_zfs(void *src, void *dst, size_t s_len,
+    size_t d_len, int level);
 /*
  * Compress and decompress data if necessary.
  */
 extern size_t zio_compress_data(enum zio_compress c, abd_t *src, void *dst,
-    size_t s_len);
+    size_t s_len, int level);
 extern int zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
     size_t s_len, size_t d_len);
 extern int zio_decompress_data_buf(enum zio_compress c, void *src, void *dst,
     size_t s_len, size_t d_len);
+extern boolean_t zio_buf_is_zero(const void *buf, size_t len);
 
 #ifdef	__cplusplus
 }
@@ -138,6 +138,8 @@ enum zio_stage {
 	ZIO_STAGE_DONE			= 1 << 23	/* RWFCI */
 };
 
+#define	ZIO_STAGES	24	/* highbit64(ZIO_STAGE_DONE) */
+
 #define	ZIO_INTERLOCK_STAGES			\
 	(ZIO_STAGE_READY |			\
 	ZIO_STAGE_DONE)
@@ -234,6 +236,11 @@ enum zio_stage {
 	ZIO_STAGE_VDEV_IO_START |		\
 	ZIO_STAGE_VDEV_IO_ASSESS)
 
+/* Trims are queued, so they also pass vdev_queue_io_done() */
+#define	ZIO_TRIM_PIPELINE			\
+	(ZIO_IOCTL_PIPELINE |			\
+	ZIO_STAGE_VDEV_IO_DONE)
+
 #define	ZIO_BLOCKING_STAGES			\
 	(ZIO_STAGE_DVA_ALLOCATE |		\
 	ZIO_STAGE_DVA_CLAIM |			\
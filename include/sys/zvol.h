@@ -50,6 +50,179 @@ extern int zvol_update_volsize(uint64_t volsize, objset_t *os);
 extern void zvol_size_changed(zvol_state_t *zv, uint64_t volsize);
 extern int zvol_set_volsize(const char *, uint64_t);
 
+#ifndef _KERNEL
+#include <sys/zil.h>
+#include <sys/range_tree.h>
+
+/*
+ * One write of a batch handed to zvol_write_batch().  All writes of a batch
+ * are committed in a single transaction; zwr_metadata may be NULL if the
+ * write carries no io_num.  If zwr_abuf is set, the data is in that buffer
+ * from zvol_request_buf() instead of in zwr_buf, and a full, aligned block
+ * is written by handing the buffer itself to the dbuf, without a copy.
+ * The buffer belongs to zvol_write_batch() once it returns 0.  A write
+ * with neither buffer is a hole: the range is freed, the io_num recorded.
+ */
+typedef struct zvol_write_req {
+	uint64_t	zwr_offset;
+	uint64_t	zwr_len;
+	const void	*zwr_buf;
+	struct arc_buf	*zwr_abuf;
+	blk_metadata_t	*zwr_metadata;
+} zvol_write_req_t;
+
+extern struct arc_buf *zvol_request_buf(zvol_state_t *zv);
+
+extern void zvol_write_metadata_run(zvol_state_t *zv, uint64_t offset,
+    uint64_t len, blk_metadata_t *metadata, dmu_tx_t *tx);
+
+/*
+ * Checkpoint of the highest io_num written to a zvol, kept in the
+ * zic_key entry of ZVOL_ZAP_OBJ.  zvol_write_batch_ckpt() updates the
+ * entry in the transaction of the first batch of each txg, with the
+ * io_num of the batches committed before it, so it costs no transaction
+ * of its own.  zic_synced is the value of the entry known to be on disk.
+ */
+typedef struct zvol_ionum_ckpt {
+	kmutex_t	zic_lock;
+	const char	*zic_key;
+	uint64_t	zic_committed;	/* highest io_num of committed batches */
+	uint64_t	zic_txg;	/* txg the entry was last updated in */
+	uint64_t	zic_synced;
+} zvol_ionum_ckpt_t;
+
+extern int zvol_ionum_ckpt_init(zvol_state_t *zv, zvol_ionum_ckpt_t *zic,
+    const char *key);
+extern void zvol_ionum_ckpt_fini(zvol_state_t *zv, zvol_ionum_ckpt_t *zic);
+
+extern uint64_t zvol_write_batch_max_bytes;
+extern int zvol_write_batch(zvol_state_t *zv, zvol_write_req_t *reqs,
+    int nreqs, boolean_t sync);
+extern int zvol_write_batch_ckpt(zvol_state_t *zv, zvol_write_req_t *reqs,
+    int nreqs, boolean_t sync, zvol_ionum_ckpt_t *zic);
+
+/*
+ * Writes of a replica that is not in quorum, made by
+ * zvol_write_batch_degraded() without their io_num metadata.  Only the
+ * ranges written and the highest io_num among them are kept, and
+ * zvol_dirty_log_reconcile() stamps that io_num into ZVOL_META_OBJ over
+ * all of them once the replica has caught up.  The log is in memory: if
+ * it is lost, the ranges keep an older io_num, which can only make a
+ * later rebuild copy them again.
+ */
+typedef struct zvol_dirty_log {
+	kmutex_t	zdl_lock;
+	range_tree_t	*zdl_ranges;
+	uint64_t	zdl_io_num;	/* highest io_num logged */
+	int		zdl_inflight;	/* degraded writes not yet logged */
+	boolean_t	zdl_closed;	/* reconciled, writes are full again */
+} zvol_dirty_log_t;
+
+extern uint64_t zvol_dirty_log_reconcile_bytes;
+extern zvol_dirty_log_t *zvol_dirty_log_create(void);
+extern void zvol_dirty_log_destroy(zvol_dirty_log_t *zdl);
+extern int zvol_write_batch_degraded(zvol_state_t *zv, zvol_write_req_t *reqs,
+    int nreqs, boolean_t sync, zvol_dirty_log_t *zdl);
+extern int zvol_dirty_log_reconcile(zvol_state_t *zv, zvol_dirty_log_t *zdl);
+
+/*
+ * In-memory summary of the io_num metadata of a zvol: the highest io_num
+ * written to each region of zir_region_size bytes.  A rebuild diff against
+ * a base io_num only has to look into ZVOL_META_OBJ for regions whose
+ * summary is newer than the base.
+ */
+typedef struct zvol_ionum_index {
+	uint64_t	zir_region_shift;
+	uint64_t	zir_nregions;
+	uint64_t	*zir_max_ionum;
+} zvol_ionum_index_t;
+
+extern uint64_t zvol_ionum_index_region_size;
+extern zvol_ionum_index_t *zvol_ionum_index_alloc(uint64_t volsize);
+extern void zvol_ionum_index_free(zvol_ionum_index_t *zir);
+extern int zvol_ionum_index_load(zvol_state_t *zv, zvol_ionum_index_t *zir);
+extern void zvol_ionum_index_update(zvol_ionum_index_t *zir, uint64_t offset,
+    uint64_t len, uint64_t io_num);
+extern uint64_t zvol_ionum_index_next_changed(zvol_ionum_index_t *zir,
+    uint64_t offset, uint64_t base_io_num);
+
+/*
+ * How far a rebuild walking the volume has been prefetched, see
+ * zvol_rebuild_prefetch().  Starts out zeroed.
+ */
+typedef struct zvol_prefetch_cursor {
+	uint64_t	zpc_meta_off;	/* metadata prefetched below this */
+	uint64_t	zpc_data_off;	/* changed data prefetched below this */
+} zvol_prefetch_cursor_t;
+
+extern uint64_t zvol_rebuild_prefetch_window;
+extern void zvol_rebuild_prefetch(zvol_state_t *zv,
+    zvol_prefetch_cursor_t *zpc, uint64_t offset, uint64_t base_io_num);
+
+/*
+ * Sequential read detector of one stream of reads, such as a data
+ * connection, see zvol_readahead().  Starts out zeroed.
+ */
+typedef struct zvol_readahead {
+	uint64_t	zra_next;	/* where a sequential read would start */
+	uint64_t	zra_off;	/* prefetched below this */
+	uint64_t	zra_window;	/* last window, 0 while not sequential */
+	uint64_t	zra_hits;	/* sequential reads in a row */
+} zvol_readahead_t;
+
+extern uint64_t zvol_readahead_min;
+extern uint64_t zvol_readahead_max;
+extern uint64_t zvol_readahead_hits;
+extern void zvol_readahead(zvol_state_t *zv, zvol_readahead_t *zra,
+    uint64_t offset, uint64_t len);
+
+/*
+ * The ZVOL_META_OBJ blocks kept held for a zvol by zvol_meta_cache_hold(),
+ * so that they can't be evicted.  It must be destroyed, which lets go of
+ * them, before the zvol is closed.
+ */
+typedef struct zvol_meta_cache {
+	kmutex_t	zmc_lock;
+	avl_tree_t	zmc_tree;	/* pinned blocks by blkid */
+	list_t		zmc_lru;	/* same, most recently used first */
+	uint64_t	zmc_bytes;	/* size of the pinned blocks */
+	uint64_t	zmc_max;
+} zvol_meta_cache_t;
+
+extern uint64_t zvol_meta_cache_max;
+extern zvol_meta_cache_t *zvol_meta_cache_create(uint64_t max);
+extern void zvol_meta_cache_destroy(zvol_meta_cache_t *zmc);
+extern void zvol_meta_cache_hold(zvol_state_t *zv, zvol_meta_cache_t *zmc,
+    uint64_t offset, uint64_t len);
+extern void zvol_next_extent(zvol_state_t *zv, uint64_t offset,
+    uint64_t end, uint64_t *lenp, boolean_t *holep);
+extern int zvol_rebuild_read(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    void *buf, blk_metadata_t *md, uint64_t base_io_num, boolean_t *changedp);
+
+/*
+ * The progress of a rebuild into a volume, checkpointed in ZVOL_ZAP_OBJ so
+ * that a rebuild cut short by a restart can resume from it.
+ */
+typedef struct zvol_rebuild_cursor {
+	uint64_t	zrc_offset;	/* everything below is rebuilt */
+	uint64_t	zrc_base_io_num; /* io_num the rebuild is diffed from */
+	uint64_t	zrc_io_num;	/* highest io_num rebuilt so far */
+} zvol_rebuild_cursor_t;
+
+extern int zvol_rebuild_cursor_save(zvol_state_t *zv,
+    const zvol_rebuild_cursor_t *zrc);
+extern int zvol_rebuild_cursor_load(zvol_state_t *zv,
+    zvol_rebuild_cursor_t *zrc);
+extern int zvol_rebuild_cursor_clear(zvol_state_t *zv);
+
+#ifdef _UZFS
+extern int uzfs_ioc_stats_binary(struct zfs_cmd *zc);
+extern int zvol_snap_list_cache_secs;
+extern void zvol_snap_list_cache_init(void);
+extern void zvol_snap_list_cache_fini(void);
+#endif
+#endif /* !_KERNEL */
+
 #ifdef _KERNEL
 extern boolean_t zvol_is_zvol(const char *);
 extern int zvol_set_volblocksize(const char *, uint64_t);
@@ -57,6 +57,11 @@ typedef enum spa_feature {
 	SPA_FEATURE_SKEIN,
 	SPA_FEATURE_EDONR,
 	SPA_FEATURE_USEROBJ_ACCOUNTING,
+	SPA_FEATURE_ZSTD_COMPRESS,
+	SPA_FEATURE_BLAKE3,
+	SPA_FEATURE_SPACEMAP_V2,
+	SPA_FEATURE_ALLOCATION_CLASSES,
+	SPA_FEATURE_CLONE_LIVELIST,
 	SPA_FEATURES
 } spa_feature_t;
 
@@ -0,0 +1,43 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_ZFS_CRC32C_H
+#define	_ZFS_CRC32C_H
+
+#include <sys/types.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * CRC32C (Castagnoli), as used by iSCSI and NVMe/TCP data digests.  The
+ * crc of a buffer in pieces is zfs_crc32c() of each piece in turn,
+ * starting from 0.
+ */
+extern uint32_t zfs_crc32c(uint32_t crc, const void *buf, size_t size);
+extern const char *zfs_crc32c_impl(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _ZFS_CRC32C_H */
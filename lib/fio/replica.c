@@ -40,10 +40,14 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/poll.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+#include <time.h>
 
 #include <fio.h>
 #include <optgroup.h>
@@ -51,25 +55,94 @@
 #include <zrepl_prot.h>
 
 /*
- * List of IOs in progress.
+ * IO in progress. Entries live in a preallocated ring indexed by the low bits
+ * of io_num, so that a reply is matched to its IO without searching. The ring
+ * has at least twice as many slots as the iodepth, hence there is always a
+ * free slot for a new IO (see alloc_io_entry()).
  */
-struct io_list_entry;
-typedef struct io_list_entry {
+typedef struct io_entry {
 	uint64_t io_num;
 	struct io_u *io_u;
-	struct io_list_entry *io_next;
-} io_list_entry_t;
+	uint64_t start;		/* usecs, if IO latency is tracked */
+	uint64_t min_io_num;	/* io_num a read must return at least */
+} io_entry_t;
+
+/*
+ * Phases of a zvol relative to the rebuild started by rebuild_after, for
+ * which IO latency is reported separately.
+ */
+enum repl_phase {
+	PHASE_BEFORE,
+	PHASE_REBUILD,
+	PHASE_AFTER,
+	PHASE_COUNT
+};
+
+static const char *repl_phase_names[PHASE_COUNT] = {
+	"before rebuild", "during rebuild", "after rebuild"
+};
+
+typedef struct repl_lat_stats {
+	uint64_t ios;
+	uint64_t lat_sum;	/* usecs */
+	uint64_t lat_max;	/* usecs */
+} repl_lat_stats_t;
+
+/*
+ * Data connection. Replies are read through rbuf, so that acks which arrive
+ * together are taken in with one recv() and completed without going back to
+ * epoll. Data of a large read reply bypasses the buffer.
+ */
+typedef struct repl_conn {
+	int fd;
+	char *rbuf;
+	size_t rb_size;	/* 0 if replies are read straight from fd */
+	size_t rb_head;
+	size_t rb_tail;
+} repl_conn_t;
 
 /*
  * Engine per thread data
  */
 struct netio_data {
-	io_list_entry_t *io_inprog;
+	io_entry_t *io_ents;
+	uint64_t io_ents_mask;
 	struct io_u **io_completed;
+	int epfd;
+	struct epoll_event *events;
+	int nevents;
+	repl_conn_t *backlog;	/* conn with replies left in its rbuf */
+	uint64_t snaps;		/* snapshots taken by the thread */
+	uint64_t snap_lat_sum;	/* usecs */
+	uint64_t snap_lat_max;	/* usecs */
+	repl_lat_stats_t phase_lat[PHASE_COUNT];
+	uint64_t io_num_errors;	/* reads older than an acked write */
 };
 
+/*
+ * Engine per file data. A zvol can be served over several data connections.
+ * IOs are sharded over the connections by offset, so that each connection
+ * (and the replica pipeline behind it) owns a disjoint set of offset ranges.
+ */
+typedef struct repl_file_data {
+	int nconns;
+	repl_conn_t *conns;
+	unsigned int nsnaps;
+	uint64_t next_snap;	/* usecs, see now_usec() */
+	uint64_t *io_nums;	/* last acked io_num of each block */
+	uint64_t io_num_bs;	/* block size of io_nums */
+	uint64_t nblocks;
+	volatile int phase;	/* enum repl_phase */
+	struct thread_data *td;	/* for rebuild_thread */
+	struct fio_file *file;
+	int stop_rebuild;
+	pthread_t rebuild_thread;
+	int rebuild_thread_started;
+} repl_file_data_t;
+
 // global because mgmt conn must be shared by all data connections
 int mgmt_conn = -1;
+int mgmt_refs = 0;
 pthread_mutex_t mgmt_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 struct repl_options {
@@ -79,6 +152,15 @@ struct repl_options {
 	unsigned int window_size;
 	unsigned int mss;
 	unsigned int metadata_bs;
+	unsigned int connections;
+	unsigned long long shard_size;
+	unsigned long long ack_buffer;
+	unsigned int snap_interval;
+	unsigned int verify_io_num;
+	unsigned int rebuild_after;
+	const char *rebuild_address;
+	unsigned int rebuild_port;
+	const char *rebuild_volname;
 	const char *address;
 };
 
@@ -142,6 +224,104 @@ static struct fio_option options[] = {
 		.category = FIO_OPT_C_ENGINE,
 		.group	= FIO_OPT_G_NETIO,
 	},
+	{
+		.name	= "connections",
+		.lname	= "Data connections",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct repl_options, connections),
+		.minval	= 1,
+		.maxval	= 64,
+		.def	= "1",
+		.help	= "Number of data connections to open per zvol",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "shard_size",
+		.lname	= "Shard size",
+		.type	= FIO_OPT_STR_VAL,
+		.off1	= offsetof(struct repl_options, shard_size),
+		.minval	= 4096,
+		.def	= "1m",
+		.help	= "Size of offset range mapped to one data connection",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "ack_buffer",
+		.lname	= "Ack buffer size",
+		.type	= FIO_OPT_STR_VAL,
+		.off1	= offsetof(struct repl_options, ack_buffer),
+		.minval	= 0,
+		.def	= "64k",
+		.help	= "Size of the buffer replies of a data connection are "
+			    "read into (0 reads each reply separately)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "snap_interval",
+		.lname	= "Snapshot interval",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct repl_options, snap_interval),
+		.minval	= 0,
+		.def	= "0",
+		.help	= "Snapshot each zvol every given msecs (0 disables)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "verify_io_num",
+		.lname	= "Verify io_num",
+		.type	= FIO_OPT_BOOL,
+		.off1	= offsetof(struct repl_options, verify_io_num),
+		.def	= "0",
+		.help	= "Check that reads return io_num of acked writes",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "rebuild_after",
+		.lname	= "Rebuild after",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct repl_options, rebuild_after),
+		.minval	= 0,
+		.def	= "0",
+		.help	= "Start rebuild of each zvol after given msecs "
+			    "(0 disables)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "rebuild_address",
+		.lname	= "Rebuild helper IP address",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct repl_options, rebuild_address),
+		.help	= "IP address of replica to rebuild from",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "rebuild_port",
+		.lname	= "Rebuild helper port",
+		.type	= FIO_OPT_INT,
+		.off1	= offsetof(struct repl_options, rebuild_port),
+		.minval	= 0,
+		.maxval	= 65535,
+		.help	= "Rebuild port of replica to rebuild from",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
+	{
+		.name	= "rebuild_volname",
+		.lname	= "Rebuild helper zvol",
+		.type	= FIO_OPT_STR_STORE,
+		.off1	= offsetof(struct repl_options, rebuild_volname),
+		.help	= "Zvol to rebuild from (same as the rebuilt one if "
+			    "not set)",
+		.category = FIO_OPT_C_ENGINE,
+		.group	= FIO_OPT_G_NETIO,
+	},
 	{
 		.name	= NULL,
 	},
@@ -242,6 +422,49 @@ static int read_from_socket(int fd, void *buf, size_t nbytes)
 	return (0);
 }
 
+/*
+ * Read nbytes of a reply from data connection. Whatever the socket has is
+ * taken into rbuf with a single recv(), so the following replies are most
+ * likely buffered already.
+ */
+static int conn_read(repl_conn_t *conn, void *buf, size_t nbytes)
+{
+	size_t n;
+	ssize_t rc;
+
+	if (conn->rb_size == 0)
+		return (read_from_socket(conn->fd, buf, nbytes));
+
+	while (nbytes > 0) {
+		if (conn->rb_head == conn->rb_tail) {
+			conn->rb_head = conn->rb_tail = 0;
+			if (nbytes >= conn->rb_size)
+				return (read_from_socket(conn->fd, buf,
+				    nbytes));
+			rc = recv(conn->fd, conn->rbuf, conn->rb_size, 0);
+			if (rc < 0)
+				return (errno);
+			if (rc == 0)
+				return (ESRCH);
+			conn->rb_tail = rc;
+		}
+		n = MIN(nbytes, conn->rb_tail - conn->rb_head);
+		memcpy(buf, conn->rbuf + conn->rb_head, n);
+		conn->rb_head += n;
+		buf = (char *)buf + n;
+		nbytes -= n;
+	}
+	return (0);
+}
+
+/*
+ * True if the header of the next reply is buffered.
+ */
+static int conn_has_reply(repl_conn_t *conn)
+{
+	return (conn->rb_tail - conn->rb_head >= sizeof (zvol_io_hdr_t));
+}
+
 static int write_to_socket(int fd, const void *buf, size_t nbytes, int more)
 {
 	int rc, n = 0;
@@ -256,6 +479,38 @@ static int write_to_socket(int fd, const void *buf, size_t nbytes, int more)
 	return (0);
 }
 
+/*
+ * Send all buffers described by iov with as few syscalls as possible. The
+ * iov array is modified on partial sends.
+ */
+static int writev_to_socket(int fd, struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg;
+	ssize_t rc;
+
+	memset(&msg, 0, sizeof (msg));
+	while (iovcnt > 0) {
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		rc = sendmsg(fd, &msg, 0);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno);
+		}
+		while (iovcnt > 0 && rc >= iov->iov_len) {
+			rc -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + rc;
+			iov->iov_len -= rc;
+		}
+	}
+	return (0);
+}
+
 static int do_handshake(struct thread_data *td, const char *volname,
     mgmt_ack_t *mgmt_ack)
 {
@@ -458,53 +713,256 @@ static int get_data_endpoint(struct thread_data *td, const char *volname,
 	return (0);
 }
 
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
 /*
- * Opens and initializes data connection for zvol.
+ * Take a snapshot of zvol the way the target does: SNAP_PREPARE followed by
+ * SNAP_CREATE of the same name over the mgmt connection. The time it takes
+ * is added to the snapshot stats of the thread.
  */
-static int fio_repl_open_file(struct thread_data *td, struct fio_file *f)
+static int repl_snapshot(struct thread_data *td, struct fio_file *f,
+    uint64_t io_seq)
+{
+	struct netio_data *nd = td->io_ops_data;
+	repl_file_data_t *fd_data = FILE_ENG_DATA(f);
+	zvol_io_hdr_t hdr;
+	char snapname[MAXPATHLEN];
+	uint64_t start = now_usec(), lat;
+	int i, rc = 0;
+
+	snprintf(snapname, sizeof (snapname), "%s@fio_%d_%u", f->file_name,
+	    (int)getpid(), ++fd_data->nsnaps);
+
+	pthread_mutex_lock(&mgmt_mtx);
+	for (i = 0; i < 2; i++) {
+		hdr.version = REPLICA_VERSION;
+		hdr.opcode = (i == 0) ? ZVOL_OPCODE_SNAP_PREPARE :
+		    ZVOL_OPCODE_SNAP_CREATE;
+		hdr.status = 0;
+		hdr.flags = 0;
+		hdr.io_seq = io_seq;
+		hdr.offset = 0;
+		hdr.len = strlen(snapname) + 1;
+
+		rc = write_to_socket(mgmt_conn, &hdr, sizeof (hdr), 1);
+		if (rc == 0)
+			rc = write_to_socket(mgmt_conn, snapname, hdr.len, 0);
+		if (rc == 0)
+			rc = read_from_socket(mgmt_conn, &hdr, sizeof (hdr));
+		if (rc != 0) {
+			td_verror(td, rc, "snapshot");
+			break;
+		}
+		if (hdr.status != ZVOL_OP_STATUS_OK || hdr.len != 0) {
+			log_err("repl: snapshot %s failed\n", snapname);
+			rc = EIO;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mgmt_mtx);
+
+	lat = now_usec() - start;
+	nd->snaps++;
+	nd->snap_lat_sum += lat;
+	if (lat > nd->snap_lat_max)
+		nd->snap_lat_max = lat;
+	return (rc);
+}
+
+/*
+ * Send a mgmt request and read the reply header, which must be for the
+ * same op code and successful. The caller holds mgmt_mtx and reads the
+ * reply payload, if any.
+ */
+static int mgmt_request(int opcode, const void *buf, size_t len,
+    zvol_io_hdr_t *reply)
+{
+	zvol_io_hdr_t hdr;
+	int rc;
+
+	hdr.version = REPLICA_VERSION;
+	hdr.opcode = opcode;
+	hdr.status = 0;
+	hdr.flags = 0;
+	hdr.io_seq = 0;
+	hdr.offset = 0;
+	hdr.len = len;
+
+	rc = write_to_socket(mgmt_conn, &hdr, sizeof (hdr), 1);
+	if (rc == 0)
+		rc = write_to_socket(mgmt_conn, buf, len, 0);
+	if (rc == 0)
+		rc = read_from_socket(mgmt_conn, reply, sizeof (*reply));
+	if (rc != 0)
+		return (rc);
+	if (reply->opcode != opcode || reply->status != ZVOL_OP_STATUS_OK)
+		return (EIO);
+	return (0);
+}
+
+/*
+ * Start rebuild of the zvol from the helper replica given by rebuild_*
+ * options, or with no helper if rebuild_address isn't set, which makes a
+ * lone replica healthy at once.
+ */
+static int start_rebuild(struct thread_data *td, const char *volname)
 {
 	struct repl_options *o = td->eo;
-	struct sockaddr_in addr;
-	short port;
-	char host[256] = "127.0.0.1";
+	zvol_io_hdr_t hdr;
+	rebuild_req_t req;
+	int rc;
 
-	port = o->port;
-	if (port && o->address)
-		strcpy(host, o->address);
+	memset(&req, 0, sizeof (req));
+	strncpy(req.dw_volname, volname, sizeof (req.dw_volname) - 1);
+	if (o->rebuild_address != NULL) {
+		strncpy(req.volname, (o->rebuild_volname != NULL) ?
+		    o->rebuild_volname : volname, sizeof (req.volname) - 1);
+		strncpy(req.ip, o->rebuild_address, sizeof (req.ip) - 1);
+		req.port = o->rebuild_port;
+	}
 
-	// use mgmt connection to get host:port if not explicitly specified
-	if (!port) {
-		if (get_data_endpoint(td, f->file_name, &port, host) != 0)
-			return (1);
+	pthread_mutex_lock(&mgmt_mtx);
+	rc = mgmt_request(ZVOL_OPCODE_START_REBUILD, &req, sizeof (req),
+	    &hdr);
+	pthread_mutex_unlock(&mgmt_mtx);
+	if (rc != 0)
+		log_err("repl: rebuild of %s failed to start\n", volname);
+	return (rc);
+}
+
+static int get_replica_status(const char *volname,
+    struct zrepl_status_ack *status)
+{
+	zvol_io_hdr_t hdr;
+	int rc;
+
+	pthread_mutex_lock(&mgmt_mtx);
+	rc = mgmt_request(ZVOL_OPCODE_REPLICA_STATUS, volname,
+	    strlen(volname) + 1, &hdr);
+	if (rc == 0 && hdr.len != sizeof (*status))
+		rc = EIO;
+	if (rc == 0)
+		rc = read_from_socket(mgmt_conn, status, sizeof (*status));
+	pthread_mutex_unlock(&mgmt_mtx);
+	return (rc);
+}
+
+/*
+ * Per zvol thread which starts the rebuild rebuild_after msecs after the
+ * zvol is opened, and polls the replica status until the zvol is healthy
+ * again. IOs completed meanwhile are accounted to PHASE_REBUILD.
+ */
+static void *rebuild_thread(void *arg)
+{
+	repl_file_data_t *fd_data = arg;
+	struct thread_data *td = fd_data->td;
+	struct fio_file *f = fd_data->file;
+	struct repl_options *o = td->eo;
+	struct zrepl_status_ack status;
+	uint64_t start = now_usec() + o->rebuild_after * 1000ULL;
+
+	while (!fd_data->stop_rebuild && !td->terminate &&
+	    now_usec() < start)
+		usleep(10000);
+	if (fd_data->stop_rebuild || td->terminate)
+		return (NULL);
+
+	start = now_usec();
+	if (start_rebuild(td, f->file_name) != 0)
+		return (NULL);
+	fd_data->phase = PHASE_REBUILD;
+	log_info("repl: rebuild of %s started\n", f->file_name);
+
+	while (!fd_data->stop_rebuild && !td->terminate) {
+		if (get_replica_status(f->file_name, &status) != 0) {
+			log_err("repl: status of %s unknown\n", f->file_name);
+			break;
+		}
+		if (status.state == ZVOL_STATUS_HEALTHY) {
+			fd_data->phase = PHASE_AFTER;
+			log_info("repl: rebuild of %s done in %lu msecs\n",
+			    f->file_name, (now_usec() - start) / 1000);
+			break;
+		}
+		usleep(100000);
 	}
+	return (NULL);
+}
+
+/*
+ * Lowest io_num acked for the blocks of the IO, which a read of them
+ * must return at least.
+ */
+static uint64_t io_num_min(repl_file_data_t *fd_data, struct io_u *io_u)
+{
+	uint64_t blk = io_u->offset / fd_data->io_num_bs;
+	uint64_t end = (io_u->offset + io_u->xfer_buflen +
+	    fd_data->io_num_bs - 1) / fd_data->io_num_bs;
+	uint64_t min = UINT64_MAX;
+
+	for (; blk < end && blk < fd_data->nblocks; blk++)
+		min = MIN(min, fd_data->io_nums[blk]);
+	return ((min == UINT64_MAX) ? 0 : min);
+}
+
+static void io_num_update(repl_file_data_t *fd_data, struct io_u *io_u,
+    uint64_t io_num)
+{
+	uint64_t blk = io_u->offset / fd_data->io_num_bs;
+	uint64_t end = (io_u->offset + io_u->xfer_buflen) /
+	    fd_data->io_num_bs;
+
+	/* only whole blocks are known to carry the io_num of the write */
+	if (io_u->offset % fd_data->io_num_bs != 0)
+		blk++;
+	for (; blk < end && blk < fd_data->nblocks; blk++) {
+		if (fd_data->io_nums[blk] < io_num)
+			fd_data->io_nums[blk] = io_num;
+	}
+}
+
+/*
+ * Opens and initializes one data connection for zvol. Returns socket fd or -1.
+ */
+static int open_data_conn(struct thread_data *td, struct fio_file *f,
+    const char *host, short port)
+{
+	struct repl_options *o = td->eo;
+	struct sockaddr_in addr;
+	int fd;
 again:
-	f->fd = socket(AF_INET, SOCK_STREAM, 0);
-	if (f->fd < 0) {
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
 		td_verror(td, errno, "socket");
-		return (1);
+		return (-1);
 	}
 
 	if (o->nodelay) {
 		int optval = 1;
 
-		if (setsockopt(f->fd, IPPROTO_TCP, TCP_NODELAY,
+		if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
 		    (void *) &optval, sizeof (int)) < 0) {
 			log_err("repl: cannot set TCP_NODELAY option on "
 			    "socket (%s), disable with 'nodelay=0'\n",
 			    strerror(errno));
-			return (1);
+			close(fd);
+			return (-1);
 		}
 	}
 
-	if (set_window_size(td, f->fd)) {
-		close(f->fd);
-		f->fd = -1;
-		return (1);
+	if (set_window_size(td, fd)) {
+		close(fd);
+		return (-1);
 	}
-	if (set_mss(td, f->fd)) {
-		close(f->fd);
-		f->fd = -1;
-		return (1);
+	if (set_mss(td, fd)) {
+		close(fd);
+		return (-1);
 	}
 
 	memset(&addr, 0, sizeof (addr));
@@ -513,41 +971,172 @@ again:
 	addr.sin_port = htons(port);
 	if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0) {
 		td_verror(td, errno, "inet_pton");
-		close(f->fd);
-		f->fd = -1;
-		return (1);
+		close(fd);
+		return (-1);
 	}
 	log_info("repl: opening zvol %s on data connection\n",
 	    f->file_name);
-	if (connect(f->fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
+	if (connect(fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
 		td_verror(td, errno, "connect");
-		close(f->fd);
-		f->fd = -1;
-		return (1);
+		close(fd);
+		return (-1);
 	}
 
 	// send volume name we want to open to replica
-	if (open_zvol(td, f->fd, f->file_name) != 0) {
-		close(f->fd);
+	if (open_zvol(td, fd, f->file_name) != 0) {
+		close(fd);
 		sleep(2);
 		goto again;
 	}
 
-	return (0);
+	return (fd);
 }
 
 /*
- * Close data connection.
+ * Close data connections of a file and free engine file data.
  */
 static int fio_repl_close_file(struct thread_data *td, struct fio_file *f)
 {
-	int rc;
+	struct netio_data *nd = td->io_ops_data;
+	repl_file_data_t *fd_data = FILE_ENG_DATA(f);
+	int i, rc = 0;
+
+	if (fd_data == NULL)
+		return (0);
+
+	if (fd_data->rebuild_thread_started) {
+		fd_data->stop_rebuild = 1;
+		pthread_join(fd_data->rebuild_thread, NULL);
+	}
+	free(fd_data->io_nums);
+
+	for (i = 0; i < fd_data->nconns; i++) {
+		repl_conn_t *conn = &fd_data->conns[i];
 
-	rc = close(f->fd);
+		if (conn->fd >= 0 && close(conn->fd) != 0)
+			rc = -1;
+		free(conn->rbuf);
+		if (nd != NULL && nd->backlog == conn)
+			nd->backlog = NULL;
+	}
+	// closing the socket removes it from the epoll set too
+	free(fd_data->conns);
+	free(fd_data);
+	FILE_SET_ENG_DATA(f, NULL);
 	f->fd = -1;
 	return (rc);
 }
 
+/*
+ * Opens and initializes data connections for zvol.
+ */
+static int fio_repl_open_file(struct thread_data *td, struct fio_file *f)
+{
+	struct repl_options *o = td->eo;
+	struct netio_data *nd = td->io_ops_data;
+	repl_file_data_t *fd_data;
+	struct epoll_event ev;
+	short port;
+	char host[256] = "127.0.0.1";
+	int i;
+
+	port = o->port;
+	if (port && o->address)
+		strcpy(host, o->address);
+
+	// use mgmt connection to get host:port if not explicitly specified
+	if (!port) {
+		if (get_data_endpoint(td, f->file_name, &port, host) != 0)
+			return (1);
+	}
+
+	fd_data = calloc(1, sizeof (*fd_data));
+	if (fd_data == NULL) {
+		log_err("repl: memory allocation failed\n");
+		return (1);
+	}
+	fd_data->nconns = (o->connections) ? o->connections : 1;
+	fd_data->conns = calloc(fd_data->nconns, sizeof (repl_conn_t));
+	if (fd_data->conns == NULL) {
+		log_err("repl: memory allocation failed\n");
+		free(fd_data);
+		return (1);
+	}
+	for (i = 0; i < fd_data->nconns; i++)
+		fd_data->conns[i].fd = -1;
+	if (o->snap_interval)
+		fd_data->next_snap = now_usec() + o->snap_interval * 1000ULL;
+	FILE_SET_ENG_DATA(f, fd_data);
+
+	for (i = 0; i < fd_data->nconns; i++) {
+		repl_conn_t *conn = &fd_data->conns[i];
+
+		if (o->ack_buffer != 0) {
+			conn->rbuf = malloc(o->ack_buffer);
+			if (conn->rbuf == NULL) {
+				log_err("repl: memory allocation failed\n");
+				(void) fio_repl_close_file(td, f);
+				return (1);
+			}
+			conn->rb_size = o->ack_buffer;
+		}
+		conn->fd = open_data_conn(td, f, host, port);
+		if (conn->fd < 0) {
+			(void) fio_repl_close_file(td, f);
+			return (1);
+		}
+		memset(&ev, 0, sizeof (ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		if (epoll_ctl(nd->epfd, EPOLL_CTL_ADD, conn->fd, &ev) != 0) {
+			td_verror(td, errno, "epoll_ctl");
+			(void) fio_repl_close_file(td, f);
+			return (1);
+		}
+	}
+	f->fd = fd_data->conns[0].fd;
+
+	if (o->verify_io_num) {
+		fd_data->io_num_bs = td_min_bs(td);
+		fd_data->nblocks = f->real_file_size / fd_data->io_num_bs + 1;
+		fd_data->io_nums = calloc(fd_data->nblocks, sizeof (uint64_t));
+		if (fd_data->io_nums == NULL) {
+			log_err("repl: memory allocation failed\n");
+			(void) fio_repl_close_file(td, f);
+			return (1);
+		}
+	}
+	if (o->rebuild_after) {
+		fd_data->td = td;
+		fd_data->file = f;
+		if (pthread_create(&fd_data->rebuild_thread, NULL,
+		    rebuild_thread, fd_data) != 0) {
+			td_verror(td, errno, "pthread_create");
+			(void) fio_repl_close_file(td, f);
+			return (1);
+		}
+		fd_data->rebuild_thread_started = 1;
+	}
+
+	return (0);
+}
+
+/*
+ * Return data connection which serves the offset range of the IO.
+ */
+static int repl_shard_fd(struct thread_data *td, struct io_u *io_u)
+{
+	struct repl_options *o = td->eo;
+	repl_file_data_t *fd_data = FILE_ENG_DATA(io_u->file);
+	uint64_t shard_size = (o->shard_size) ? o->shard_size : 1024 * 1024;
+
+	if (fd_data->nconns == 1 || io_u->ddir == DDIR_SYNC)
+		return (fd_data->conns[0].fd);
+
+	return (fd_data->conns[(io_u->offset / shard_size) %
+	    fd_data->nconns].fd);
+}
+
 static void fio_repl_terminate(struct thread_data *td)
 {
 	kill(td->pid, SIGTERM);
@@ -565,6 +1154,7 @@ static int fio_repl_setup(struct thread_data *td)
 {
 	struct repl_options *o = td->eo;
 	struct netio_data *nd;
+	uint64_t nents;
 
 	if (!td->o.use_thread) {
 		log_err("repl: must set thread=1 when using repl plugin\n");
@@ -577,35 +1167,94 @@ static int fio_repl_setup(struct thread_data *td)
 		return (1);
 	}
 	memset(nd, 0, sizeof (*nd));
-	nd->io_inprog = NULL;
+	nd->epfd = -1;
+	td->io_ops_data = nd;
+
+	for (nents = 2; nents < 2 * td->o.iodepth; nents <<= 1)
+		;
+	nd->io_ents_mask = nents - 1;
+	nd->io_ents = calloc(nents, sizeof (io_entry_t));
 	nd->io_completed = calloc(td->o.iodepth, sizeof (struct io_u *));
+	nd->nevents = td->o.iodepth;
+	nd->events = calloc(nd->nevents, sizeof (struct epoll_event));
+	if (nd->io_ents == NULL || nd->io_completed == NULL ||
+	    nd->events == NULL) {
+		log_err("repl: memory allocation failed\n");
+		return (1);
+	}
+	nd->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (nd->epfd < 0) {
+		td_verror(td, errno, "epoll_create");
+		return (1);
+	}
+
+	if ((o->snap_interval || o->rebuild_after) && o->port) {
+		log_err("repl: snap_interval and rebuild_after need the mgmt "
+		    "connection, they can't be used with port\n");
+		return (1);
+	}
 
-	// only create mgmt conn if it is needed
-	if (!o->port && mgmt_conn < 0) {
-		mgmt_conn = create_mgmt_conn(td);
+	// only create mgmt conn if it is needed, it is shared by all threads
+	if (!o->port) {
+		pthread_mutex_lock(&mgmt_mtx);
+		if (mgmt_conn < 0)
+			mgmt_conn = create_mgmt_conn(td);
+		if (mgmt_conn >= 0)
+			mgmt_refs++;
+		pthread_mutex_unlock(&mgmt_mtx);
 		if (mgmt_conn < 0)
 			return (1);
 	}
-	td->io_ops_data = nd;
 
 	return (0);
 }
 
 /*
- * Close mgmt connection and free engine data.
+ * Close mgmt connection once the last thread using it is done, and free
+ * engine data.
  */
 static void fio_repl_cleanup(struct thread_data *td)
 {
+	struct repl_options *o = td->eo;
 	struct netio_data *nd = td->io_ops_data;
 
 	if (nd) {
+		int p;
+
+		if (nd->snaps != 0) {
+			log_info("repl: %s: %lu snapshots, latency avg %lu "
+			    "usec, max %lu usec\n", td->o.name, nd->snaps,
+			    nd->snap_lat_sum / nd->snaps, nd->snap_lat_max);
+		}
+		for (p = 0; o->rebuild_after && p < PHASE_COUNT; p++) {
+			repl_lat_stats_t *ls = &nd->phase_lat[p];
+
+			if (ls->ios == 0)
+				continue;
+			log_info("repl: %s: %s: %lu IOs, latency avg %lu "
+			    "usec, max %lu usec\n", td->o.name,
+			    repl_phase_names[p], ls->ios, ls->lat_sum / ls->ios,
+			    ls->lat_max);
+		}
+		if (nd->io_num_errors != 0) {
+			log_err("repl: %s: %lu reads returned data older "
+			    "than an acked write\n", td->o.name,
+			    nd->io_num_errors);
+		}
+		if (nd->epfd >= 0)
+			close(nd->epfd);
+		free(nd->io_ents);
 		free(nd->io_completed);
+		free(nd->events);
 		free(nd);
+		td->io_ops_data = NULL;
 	}
-	if (mgmt_conn >= 0) {
+	pthread_mutex_lock(&mgmt_mtx);
+	if (!o->port && mgmt_refs > 0 && --mgmt_refs == 0 && mgmt_conn >= 0) {
 		close(mgmt_conn);
 		mgmt_conn = -1;
 	}
+	pthread_mutex_unlock(&mgmt_mtx);
 }
 
 /*
@@ -618,27 +1267,64 @@ static uint64_t gen_sequence_num(void)
 	return (__atomic_fetch_add(&seq_num, 1, __ATOMIC_SEQ_CST));
 }
 
+/*
+ * Take a free slot in the ring of IOs in progress. IO numbers of slots which
+ * are still busy are skipped, which keeps io_num unique and increasing.
+ */
+static io_entry_t *alloc_io_entry(struct netio_data *nd, struct io_u *io_u)
+{
+	io_entry_t *io_ent;
+	uint64_t io_num;
+
+	do {
+		io_num = gen_sequence_num();
+		io_ent = &nd->io_ents[io_num & nd->io_ents_mask];
+	} while (io_ent->io_u != NULL);
+
+	io_ent->io_num = io_num;
+	io_ent->io_u = io_u;
+	return (io_ent);
+}
+
 /*
  * Dispatch command to replica.
  */
 static enum fio_q_status fio_repl_queue(struct thread_data *td,
     struct io_u *io_u)
 {
+	struct repl_options *o = td->eo;
 	struct netio_data *nd = td->io_ops_data;
+	repl_file_data_t *fd_data = FILE_ENG_DATA(io_u->file);
 	zvol_io_hdr_t hdr;
-	io_list_entry_t *io_ent;
+	struct zvol_io_rw_hdr write_hdr;
+	struct iovec iov[3];
+	io_entry_t *io_ent;
+	int iovcnt = 1;
+	int fd = repl_shard_fd(td, io_u);
+	int rc;
 
-	io_ent = malloc(sizeof (*io_ent));
-	if (io_ent == NULL) {
-		io_u->error = ENOMEM;
-		goto end;
+	/*
+	 * Snapshots are taken between IOs of the zvol, so IOs queued behind
+	 * a snapshot see its latency like they would behind a real target.
+	 */
+	if (o->snap_interval && now_usec() >= fd_data->next_snap) {
+		fd_data->next_snap = now_usec() + o->snap_interval * 1000ULL;
+		rc = repl_snapshot(td, io_u->file, gen_sequence_num());
+		if (rc != 0) {
+			io_u->error = rc;
+			return (FIO_Q_COMPLETED);
+		}
 	}
-	io_ent->io_num = gen_sequence_num();
-	io_ent->io_u = io_u;
-	io_ent->io_next = NULL;
+
+	io_ent = alloc_io_entry(nd, io_u);
+	if (o->rebuild_after)
+		io_ent->start = now_usec();
+	if (o->verify_io_num && io_u->ddir == DDIR_READ)
+		io_ent->min_io_num = io_num_min(fd_data, io_u);
 
 	/*
-	 * Send replica message header.
+	 * Replica message header, followed by data in case of write. All of
+	 * it goes out in a single sendmsg().
 	 */
 	hdr.io_seq = io_ent->io_num;
 	hdr.offset = io_u->offset;
@@ -646,10 +1332,20 @@ static enum fio_q_status fio_repl_queue(struct thread_data *td,
 	hdr.status = 0;
 	hdr.flags = 0;
 	hdr.version = REPLICA_VERSION;
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof (hdr);
 
 	if (io_u->ddir == DDIR_WRITE) {
 		hdr.opcode = ZVOL_OPCODE_WRITE;
 		hdr.len += sizeof (struct zvol_io_rw_hdr);
+
+		write_hdr.io_num = hdr.io_seq;
+		write_hdr.len = io_u->xfer_buflen;
+		iov[1].iov_base = &write_hdr;
+		iov[1].iov_len = sizeof (write_hdr);
+		iov[2].iov_base = io_u->xfer_buf;
+		iov[2].iov_len = io_u->xfer_buflen;
+		iovcnt = 3;
 	} else if (io_u->ddir == DDIR_READ) {
 		hdr.opcode = ZVOL_OPCODE_READ;
 	} else {
@@ -657,81 +1353,62 @@ static enum fio_q_status fio_repl_queue(struct thread_data *td,
 		hdr.len = 0;
 	}
 
-	if (write_to_socket(io_u->file->fd, &hdr, sizeof (hdr), 0) != 0) {
-		io_u->error = errno;
-		goto end;
-	}
-
-	/*
-	 * Send data in case of write.
-	 */
-	if (io_u->ddir == DDIR_WRITE) {
-		struct zvol_io_rw_hdr write_hdr;
-
-		write_hdr.io_num = hdr.io_seq;
-		write_hdr.len = io_u->xfer_buflen;
-		if (write_to_socket(io_u->file->fd, &write_hdr,
-		    sizeof (write_hdr), 1) != 0) {
-			io_u->error = errno;
-			goto end;
-		}
-		if (write_to_socket(io_u->file->fd, io_u->xfer_buf,
-		    io_u->xfer_buflen, 0) != 0) {
-			io_u->error = errno;
-			goto end;
-		}
-	}
-
-end:
-	if (io_u->error) {
-		free(io_ent);
+	rc = writev_to_socket(fd, iov, iovcnt);
+	if (rc != 0) {
+		io_ent->io_u = NULL;
+		io_u->error = rc;
 		td_verror(td, io_u->error, "xfer");
 		return (FIO_Q_COMPLETED);
 	}
-	io_ent->io_next = nd->io_inprog;
-	nd->io_inprog = io_ent;
 
 	return (FIO_Q_QUEUED);
 }
 
 /*
- * Read IO acknowledgement.
+ * Read IO acknowledgement. Return IO which has been completed or NULL.
  */
-static io_list_entry_t *read_repl_reply(struct thread_data *td, int fd)
+static struct io_u *read_repl_reply(struct thread_data *td,
+    repl_conn_t *conn)
 {
+	struct repl_options *o = td->eo;
 	struct netio_data *nd = td->io_ops_data;
+	repl_file_data_t *fd_data;
 	zvol_io_hdr_t hdr;
-	io_list_entry_t *iter, *last;
+	io_entry_t *io_ent;
+	struct io_u *io_u;
 	int ret;
 
-	ret = read_from_socket(fd, &hdr, sizeof (hdr));
+	ret = conn_read(conn, &hdr, sizeof (hdr));
 	if (ret != 0) {
 		td_verror(td, ret, "read hdr");
 		return (NULL);
 	}
 
-	iter = nd->io_inprog;
-	last = NULL;
-	while (iter != NULL) {
-		if (iter->io_num == hdr.io_seq)
-			break;
-		last = iter;
-		iter = iter->io_next;
-	}
-	if (iter == NULL) {
+	io_ent = &nd->io_ents[hdr.io_seq & nd->io_ents_mask];
+	if (io_ent->io_u == NULL || io_ent->io_num != hdr.io_seq) {
 		td_verror(td, ENOENT, "unknown IO number");
 		return (NULL);
 	}
-	if (last == NULL)
-		nd->io_inprog = iter->io_next;
-	else
-		last->io_next = iter->io_next;
-	iter->io_next = NULL;
+	io_u = io_ent->io_u;
+	io_ent->io_u = NULL;
+	fd_data = FILE_ENG_DATA(io_u->file);
+
+	if (o->rebuild_after) {
+		repl_lat_stats_t *ls = &nd->phase_lat[fd_data->phase];
+		uint64_t lat = now_usec() - io_ent->start;
+
+		ls->ios++;
+		ls->lat_sum += lat;
+		if (lat > ls->lat_max)
+			ls->lat_max = lat;
+	}
 
 	if (hdr.status != ZVOL_OP_STATUS_OK) {
-		iter->io_u->error = EIO;
-		return (iter);
+		io_u->error = EIO;
+		return (io_u);
 	}
+	if (o->verify_io_num && hdr.opcode == ZVOL_OPCODE_WRITE)
+		io_num_update(fd_data, io_u, io_ent->io_num);
 
 	// read command payload if any (each chunk is preceeded by meta data)
 	if (hdr.opcode == ZVOL_OPCODE_READ) {
@@ -742,103 +1419,121 @@ static io_list_entry_t *read_repl_reply(struct thread_data *td, int fd)
 		while (nread < hdr.len) {
 			// read metadata header
 			if (hdr.len - nread < sizeof (read_hdr)) {
-				iter->io_u->error = EIO;
-				return (iter);
+				io_u->error = EIO;
+				return (io_u);
 			}
-			if (read_from_socket(fd, &read_hdr,
+			if (conn_read(conn, &read_hdr,
 			    sizeof (read_hdr)) != 0) {
-				iter->io_u->error = EIO;
-				return (iter);
+				io_u->error = EIO;
+				return (io_u);
 			}
 			nread += sizeof (read_hdr);
+			if (o->verify_io_num &&
+			    read_hdr.io_num < io_ent->min_io_num) {
+				log_err("repl: read of %s at %llu returned "
+				    "io_num %lu, expected at least %lu\n",
+				    io_u->file->file_name, io_u->offset +
+				    data_offset, read_hdr.io_num,
+				    io_ent->min_io_num);
+				nd->io_num_errors++;
+				io_u->error = EILSEQ;
+			}
 
 			// read the data
 			if (hdr.len - nread < read_hdr.len) {
-				iter->io_u->error = EIO;
-				return (iter);
+				io_u->error = EIO;
+				return (io_u);
 			}
-			if (iter->io_u->xfer_buflen < data_offset +
-			    read_hdr.len) {
-				iter->io_u->error = EIO;
-				return (iter);
+			if (io_u->xfer_buflen < data_offset + read_hdr.len) {
+				io_u->error = EIO;
+				return (io_u);
 			}
-			if (read_from_socket(fd,
-			    (char *)iter->io_u->xfer_buf + data_offset,
+			if (conn_read(conn,
+			    (char *)io_u->xfer_buf + data_offset,
 			    read_hdr.len) != 0) {
-				iter->io_u->error = EIO;
-				return (iter);
+				io_u->error = EIO;
+				return (io_u);
 			}
 			nread += read_hdr.len;
 			data_offset += read_hdr.len;
 		}
 
-		if (data_offset != iter->io_u->xfer_buflen) {
+		if (data_offset != io_u->xfer_buflen) {
 			log_err("repl: unexpected size of data in reply\n");
-			iter->io_u->error = EIO;
-			return (iter);
+			io_u->error = EIO;
+			return (io_u);
 		}
 	}
 
-	return (iter);
+	return (io_u);
 }
 
-static int fio_repl_getevents(struct thread_data *td, unsigned int min,
-    unsigned int max, const struct timespec fio_unused *t)
+/*
+ * Complete the replies of a data connection until none is left in its
+ * buffer or max IOs are completed. A connection stopped short by max is
+ * resumed by the next call, as epoll does not know about buffered replies.
+ */
+static int reap_replies(struct thread_data *td, repl_conn_t *conn,
+    int *count, unsigned int max)
 {
 	struct netio_data *nd = td->io_ops_data;
-	int ret, read_error = 0, count = 0;
-	unsigned int i;
-	struct fio_file *f;
-	int timeout = -1;
-	struct pollfd *pfds;
+	struct io_u *io_u;
 
-	pfds = calloc(1, sizeof (struct pollfd) * td->o.nr_files);
-	if (pfds == NULL)
-		return (0);
+	do {
+		io_u = read_repl_reply(td, conn);
+		if (io_u == NULL)
+			return (-1);
+		assert(nd->io_completed[*count] == NULL);
+		nd->io_completed[(*count)++] = io_u;
+	} while (*count < max && conn_has_reply(conn));
 
-	/*
-	 * Fill in the file descriptors
-	 */
-	for_each_file(td, f, i) {
-		/*
-		 * don't block for min events == 0
-		 */
-		if (!min)
-			timeout = 0;
+	if (conn_has_reply(conn))
+		nd->backlog = conn;
+	return (0);
+}
 
-		pfds[i].fd = f->fd;
-		pfds[i].events = POLLIN;
+static int fio_repl_getevents(struct thread_data *td, unsigned int min,
+    unsigned int max, const struct timespec fio_unused *t)
+{
+	struct netio_data *nd = td->io_ops_data;
+	repl_conn_t *conn;
+	int ret, read_error = 0, count = 0;
+	int j;
+	// don't block for min events == 0
+	int timeout = (min) ? -1 : 0;
+
+	if ((conn = nd->backlog) != NULL) {
+		nd->backlog = NULL;
+		if (reap_replies(td, conn, &count, max) != 0)
+			read_error = 1;
+		if (count >= max)
+			goto end;
 	}
 
 	while (!read_error && count < min) {
 		assert(count < td->o.iodepth);
-		ret = poll(pfds, td->o.nr_files, timeout);
+		ret = epoll_wait(nd->epfd, nd->events, nd->nevents, timeout);
 		if (ret < 0) {
-			td_verror(td, errno, "poll");
+			if (errno == EINTR)
+				continue;
+			td_verror(td, errno, "epoll_wait");
 			goto end;
 		} else if (ret == 0)
 			goto end;
 
-		for (i = 0; i < td->o.nr_files; i++) {
-			if (pfds[i].revents & POLLIN) {
-				io_list_entry_t *ent;
-
-				ent = read_repl_reply(td, pfds[i].fd);
-				if (ent == NULL) {
+		for (j = 0; j < ret; j++) {
+			if (nd->events[j].events & (EPOLLIN | EPOLLERR |
+			    EPOLLHUP)) {
+				if (reap_replies(td, nd->events[j].data.ptr,
+				    &count, max) != 0)
 					read_error = 1;
-				} else {
-					assert(nd->io_completed[count] == NULL);
-					nd->io_completed[count++] = ent->io_u;
-					free(ent);
-					if (count >= max)
-						goto end;
-				}
+				else if (count >= max)
+					goto end;
 			}
 		}
 	}
 
 end:
-	free(pfds);
 	return (count);
 }
 
@@ -40,6 +40,9 @@
 #if !defined(BLKGETSIZE64)
 #define	BLKGETSIZE64		_IOR(0x12, 114, size_t)
 #endif
+#if !defined(BLKDISCARD)
+#define	BLKDISCARD		_IO(0x12, 119)
+#endif
 
 /*
  * Some old glibc headers don't correctly define MS_DIRSYNC and
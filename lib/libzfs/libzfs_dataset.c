@@ -369,16 +369,17 @@ get_recvd_props_ioctl(zfs_handle_t *zhp)
 	return (0);
 }
 
+/*
+ * Store the stats and properties of a dataset in its handle, which takes
+ * over allprops.
+ */
 static int
-put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
+put_stats_zhdl_nvl(zfs_handle_t *zhp, const dmu_objset_stats_t *stats,
+    nvlist_t *allprops)
 {
-	nvlist_t *allprops, *userprops;
+	nvlist_t *userprops;
 
-	zhp->zfs_dmustats = zc->zc_objset_stats; /* structure assignment */
-
-	if (zcmd_read_dst_nvlist(zhp->zfs_hdl, zc, &allprops) != 0) {
-		return (-1);
-	}
+	zhp->zfs_dmustats = *stats; /* structure assignment */
 
 	/*
 	 * XXX Why do we store the user props separately, in addition to
@@ -398,6 +399,18 @@ put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
 	return (0);
 }
 
+static int
+put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
+{
+	nvlist_t *allprops;
+
+	if (zcmd_read_dst_nvlist(zhp->zfs_hdl, zc, &allprops) != 0) {
+		return (-1);
+	}
+
+	return (put_stats_zhdl_nvl(zhp, &zc->zc_objset_stats, allprops));
+}
+
 static int
 get_stats(zfs_handle_t *zhp)
 {
@@ -423,16 +436,9 @@ zfs_refresh_properties(zfs_handle_t *zhp)
 	(void) get_stats(zhp);
 }
 
-/*
- * Makes a handle from the given dataset name.  Used by zfs_open() and
- * zfs_iter_* to create child handles on the fly.
- */
 static int
-make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
+make_dataset_handle_type(zfs_handle_t *zhp)
 {
-	if (put_stats_zhdl(zhp, zc) != 0)
-		return (-1);
-
 	/*
 	 * We've managed to open the dataset and gather statistics.  Determine
 	 * the high-level type.
@@ -461,6 +467,19 @@ make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
 	return (0);
 }
 
+/*
+ * Makes a handle from the given dataset name.  Used by zfs_open() and
+ * zfs_iter_* to create child handles on the fly.
+ */
+static int
+make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
+{
+	if (put_stats_zhdl(zhp, zc) != 0)
+		return (-1);
+
+	return (make_dataset_handle_type(zhp));
+}
+
 zfs_handle_t *
 make_dataset_handle(libzfs_handle_t *hdl, const char *path)
 {
@@ -490,6 +509,36 @@ make_dataset_handle(libzfs_handle_t *hdl, const char *path)
 	return (zhp);
 }
 
+/*
+ * Makes a handle from the stats and properties of one dataset returned by
+ * ZFS_IOC_DATASET_LIST_BATCH.  The properties are copied.
+ */
+zfs_handle_t *
+make_dataset_handle_nvl(libzfs_handle_t *hdl, const char *name,
+    const dmu_objset_stats_t *stats, nvlist_t *props)
+{
+	zfs_handle_t *zhp = calloc(sizeof (zfs_handle_t), 1);
+	nvlist_t *allprops;
+
+	if (zhp == NULL)
+		return (NULL);
+
+	zhp->zfs_hdl = hdl;
+	(void) strlcpy(zhp->zfs_name, name, sizeof (zhp->zfs_name));
+	if (nvlist_dup(props, &allprops, 0) != 0) {
+		free(zhp);
+		return (NULL);
+	}
+	if (put_stats_zhdl_nvl(zhp, stats, allprops) != 0 ||
+	    make_dataset_handle_type(zhp) != 0) {
+		nvlist_free(zhp->zfs_props);
+		nvlist_free(zhp->zfs_user_props);
+		free(zhp);
+		return (NULL);
+	}
+	return (zhp);
+}
+
 zfs_handle_t *
 make_dataset_handle_zc(libzfs_handle_t *hdl, zfs_cmd_t *zc)
 {
@@ -2609,6 +2658,31 @@ zfs_prop_get(zfs_handle_t *zhp, zfs_prop_t prop, char *propbuf, size_t proplen,
 		}
 		break;
 
+	case ZFS_PROP_READ_IOPS_LIMIT:
+	case ZFS_PROP_WRITE_IOPS_LIMIT:
+	case ZFS_PROP_READ_BW_LIMIT:
+	case ZFS_PROP_WRITE_BW_LIMIT:
+
+		if (get_numeric_property(zhp, prop, src, &source, &val) != 0)
+			return (-1);
+
+		/*
+		 * A limit of 0 is no limit, which we print as 'none' unless
+		 * literal is set.
+		 */
+		if (literal) {
+			(void) snprintf(propbuf, proplen, "%llu",
+			    (u_longlong_t)val);
+		} else if (val == 0) {
+			(void) strlcpy(propbuf, "none", proplen);
+		} else if (prop == ZFS_PROP_READ_BW_LIMIT ||
+		    prop == ZFS_PROP_WRITE_BW_LIMIT) {
+			zfs_nicebytes(val, propbuf, proplen);
+		} else {
+			zfs_nicenum(val, propbuf, proplen);
+		}
+		break;
+
 	case ZFS_PROP_REFRATIO:
 	case ZFS_PROP_COMPRESSRATIO:
 		if (get_numeric_property(zhp, prop, src, &source, &val) != 0)
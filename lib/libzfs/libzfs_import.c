@@ -57,10 +57,12 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <libaio.h>
 #include <sys/vtoc.h>
 #include <sys/dktp/fdisk.h>
 #include <sys/efi_partition.h>
 #include <sys/vdev_impl.h>
+#include <zfs_fletcher.h>
 #include <blkid/blkid.h>
 #include "libzfs.h"
 #include "libzfs_impl.h"
@@ -1318,6 +1320,66 @@ label_offset(uint64_t size, int l)
 	    0 : size - VDEV_LABELS * sizeof (vdev_label_t)));
 }
 
+/*
+ * Read the vdev_phys_t of every label of a device.  The reads are issued
+ * together through a Linux AIO context so the two labels at each end of
+ * the device are fetched in parallel rather than one after another; any
+ * label which could not be submitted is read synchronously.  On return
+ * valid[l] tells whether label l was read in full.
+ */
+static void
+zpool_read_label_phys(int fd, uint64_t size, vdev_phys_t *labels,
+    boolean_t *valid)
+{
+	struct iocb iocbs[VDEV_LABELS], *iocbps[VDEV_LABELS];
+	struct io_event events[VDEV_LABELS];
+	io_context_t ctx = 0;
+	int l, n, submitted = 0, reaped = 0;
+
+	for (l = 0; l < VDEV_LABELS; l++) {
+		io_prep_pread(&iocbs[l], fd, &labels[l], sizeof (vdev_phys_t),
+		    label_offset(size, l) + VDEV_SKIP_SIZE);
+		iocbps[l] = &iocbs[l];
+		valid[l] = B_FALSE;
+	}
+
+	if (io_setup(VDEV_LABELS, &ctx) == 0) {
+		while (submitted < VDEV_LABELS) {
+			n = io_submit(ctx, VDEV_LABELS - submitted,
+			    &iocbps[submitted]);
+			if (n == -EINTR || n == -EAGAIN)
+				continue;
+			if (n <= 0)
+				break;
+			submitted += n;
+		}
+
+		while (reaped < submitted) {
+			n = io_getevents(ctx, submitted - reaped,
+			    submitted - reaped, events, NULL);
+			if (n == -EINTR)
+				continue;
+			if (n < 0)
+				break;
+			reaped += n;
+			while (n-- > 0) {
+				l = (struct iocb *)events[n].obj - iocbs;
+				valid[l] = (events[n].res ==
+				    sizeof (vdev_phys_t));
+			}
+		}
+
+		/* io_destroy() waits for anything still in flight */
+		(void) io_destroy(ctx);
+	}
+
+	for (l = submitted; l < VDEV_LABELS; l++) {
+		valid[l] = (pread64(fd, &labels[l], sizeof (vdev_phys_t),
+		    label_offset(size, l) + VDEV_SKIP_SIZE) ==
+		    sizeof (vdev_phys_t));
+	}
+}
+
 /*
  * Given a file descriptor, read the label information and return an nvlist
  * describing the configuration, if there is one.  The number of valid
@@ -1328,7 +1390,8 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 {
 	struct stat64 statbuf;
 	int l, count = 0;
-	vdev_label_t *label;
+	vdev_phys_t *labels;
+	boolean_t valid[VDEV_LABELS];
 	nvlist_t *expected_config = NULL;
 	uint64_t expected_guid = 0, size;
 	int error;
@@ -1339,19 +1402,21 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 		return (0);
 	size = P2ALIGN_TYPED(statbuf.st_size, sizeof (vdev_label_t), uint64_t);
 
-	error = posix_memalign((void **)&label, PAGESIZE, sizeof (*label));
+	error = posix_memalign((void **)&labels, PAGESIZE,
+	    VDEV_LABELS * sizeof (*labels));
 	if (error)
 		return (-1);
 
+	zpool_read_label_phys(fd, size, labels, valid);
+
 	for (l = 0; l < VDEV_LABELS; l++) {
 		uint64_t state, guid, txg;
 
-		if (pread64(fd, label, sizeof (vdev_label_t),
-		    label_offset(size, l)) != sizeof (vdev_label_t))
+		if (!valid[l])
 			continue;
 
-		if (nvlist_unpack(label->vl_vdev_phys.vp_nvlist,
-		    sizeof (label->vl_vdev_phys.vp_nvlist), config, 0) != 0)
+		if (nvlist_unpack(labels[l].vp_nvlist,
+		    sizeof (labels[l].vp_nvlist), config, 0) != 0)
 			continue;
 
 		if (nvlist_lookup_uint64(*config, ZPOOL_CONFIG_GUID,
@@ -1388,12 +1453,45 @@ zpool_read_label(int fd, nvlist_t **config, int *num_labels)
 	if (num_labels != NULL)
 		*num_labels = count;
 
-	free(label);
+	free(labels);
 	*config = expected_config;
 
 	return (0);
 }
 
+/*
+ * Label cache.  When ZPOOL_IMPORT_LABEL_CACHE names a file, the result of
+ * reading each device's labels is saved there after a scan, keyed by the
+ * device path.  On the next scan a device whose dev/inode/size still match
+ * its entry only has label 0 read; when that label carries the cached vdev
+ * guid and txg the cached label count is reused instead of reading all four
+ * labels, two of which live at the far end of the device.  Anything that
+ * does not match, and a cache file that fails its checksum, falls back to
+ * the full label read.
+ */
+#define	LABEL_CACHE_MAGIC	0x4c41424c43414348ULL	/* "LABLCACH" */
+#define	LABEL_CACHE_VERSION	1ULL
+
+#define	LABEL_CACHE_DEV		"dev"
+#define	LABEL_CACHE_INO		"ino"
+#define	LABEL_CACHE_SIZE	"size"
+#define	LABEL_CACHE_GUID	"guid"
+#define	LABEL_CACHE_TXG		"txg"
+#define	LABEL_CACHE_LABELS	"labels"
+
+typedef struct label_cache_phys {
+	uint64_t	lcp_magic;
+	uint64_t	lcp_version;
+	uint64_t	lcp_size;	/* size of the packed nvlist */
+	zio_cksum_t	lcp_cksum;	/* fletcher-4 of the packed nvlist */
+} label_cache_phys_t;
+
+typedef struct label_cache {
+	char		*lc_path;
+	nvlist_t	*lc_old;	/* entries loaded from lc_path */
+	nvlist_t	*lc_new;	/* entries seen by this scan */
+} label_cache_t;
+
 typedef struct rdsk_node {
 	char *rn_name;			/* Full path to device */
 	int rn_order;			/* Preferred order (low to high) */
@@ -1405,6 +1503,8 @@ typedef struct rdsk_node {
 	avl_node_t rn_node;
 	kmutex_t *rn_lock;
 	boolean_t rn_labelpaths;
+	label_cache_t *rn_label_cache;	/* NULL when not caching */
+	nvlist_t *rn_cache_entry;	/* label cache entry to record */
 } rdsk_node_t;
 
 /*
@@ -1509,6 +1609,191 @@ label_paths(libzfs_handle_t *hdl, nvlist_t *label, char **path, char **devid)
 	    devid));
 }
 
+static label_cache_t *
+label_cache_open(libzfs_handle_t *hdl)
+{
+	label_cache_t *lc;
+	label_cache_phys_t lcp;
+	zio_cksum_t cksum;
+	char *path, *buf;
+	int fd;
+
+	path = getenv("ZPOOL_IMPORT_LABEL_CACHE");
+	if (path == NULL || *path == '\0')
+		return (NULL);
+
+	lc = zfs_alloc(hdl, sizeof (label_cache_t));
+	lc->lc_path = zfs_strdup(hdl, path);
+	verify(nvlist_alloc(&lc->lc_new, NV_UNIQUE_NAME, 0) == 0);
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (lc);
+
+	if (read(fd, &lcp, sizeof (lcp)) != sizeof (lcp) ||
+	    lcp.lcp_magic != LABEL_CACHE_MAGIC ||
+	    lcp.lcp_version != LABEL_CACHE_VERSION ||
+	    lcp.lcp_size == 0 || lcp.lcp_size > SPA_MAXBLOCKSIZE * 16) {
+		(void) close(fd);
+		return (lc);
+	}
+
+	if ((buf = malloc(lcp.lcp_size)) == NULL) {
+		(void) close(fd);
+		return (lc);
+	}
+
+	if (read(fd, buf, lcp.lcp_size) == lcp.lcp_size) {
+		fletcher_4_native_varsize(buf, lcp.lcp_size, &cksum);
+		if (ZIO_CHECKSUM_EQUAL(cksum, lcp.lcp_cksum) &&
+		    nvlist_unpack(buf, lcp.lcp_size, &lc->lc_old, 0) != 0)
+			lc->lc_old = NULL;
+	}
+
+	free(buf);
+	(void) close(fd);
+
+	return (lc);
+}
+
+/*
+ * Write out the entries gathered by this scan, replacing the old cache
+ * file atomically.  Failures are ignored; the next scan just reads all
+ * labels again.
+ */
+static void
+label_cache_close(label_cache_t *lc)
+{
+	label_cache_phys_t lcp = { 0 };
+	char *buf = NULL, *tmp = NULL;
+	size_t size = 0;
+	int fd;
+
+	if (lc == NULL)
+		return;
+
+	if (nvlist_pack(lc->lc_new, &buf, &size, NV_ENCODE_XDR, 0) != 0 ||
+	    asprintf(&tmp, "%s.tmp", lc->lc_path) == -1)
+		goto out;
+
+	lcp.lcp_magic = LABEL_CACHE_MAGIC;
+	lcp.lcp_version = LABEL_CACHE_VERSION;
+	lcp.lcp_size = size;
+	fletcher_4_native_varsize(buf, size, &lcp.lcp_cksum);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto out;
+
+	if (write(fd, &lcp, sizeof (lcp)) != sizeof (lcp) ||
+	    write(fd, buf, size) != size || fsync(fd) != 0) {
+		(void) close(fd);
+		(void) unlink(tmp);
+		goto out;
+	}
+
+	(void) close(fd);
+	if (rename(tmp, lc->lc_path) != 0)
+		(void) unlink(tmp);
+out:
+	free(tmp);
+	free(buf);
+	nvlist_free(lc->lc_old);
+	nvlist_free(lc->lc_new);
+	free(lc->lc_path);
+	free(lc);
+}
+
+/*
+ * Read only the first label of a device and, when it is the label that
+ * was cached for this path, return it along with the cached label count.
+ * Returns -1 when the full label read is required.
+ */
+static int
+label_cache_read(label_cache_t *lc, const char *name, int fd,
+    nvlist_t **config, int *num_labels)
+{
+	struct stat64 statbuf;
+	nvlist_t *entry, *label_config;
+	vdev_phys_t *phys;
+	uint64_t dev, ino, size, guid, txg, labels;
+	uint64_t label_guid, label_txg = 0;
+	int error = -1;
+
+	if (lc->lc_old == NULL ||
+	    nvlist_lookup_nvlist(lc->lc_old, name, &entry) != 0 ||
+	    nvlist_lookup_uint64(entry, LABEL_CACHE_DEV, &dev) != 0 ||
+	    nvlist_lookup_uint64(entry, LABEL_CACHE_INO, &ino) != 0 ||
+	    nvlist_lookup_uint64(entry, LABEL_CACHE_SIZE, &size) != 0 ||
+	    nvlist_lookup_uint64(entry, LABEL_CACHE_GUID, &guid) != 0 ||
+	    nvlist_lookup_uint64(entry, LABEL_CACHE_TXG, &txg) != 0 ||
+	    nvlist_lookup_uint64(entry, LABEL_CACHE_LABELS, &labels) != 0)
+		return (-1);
+
+	if (fstat64_blk(fd, &statbuf) != 0 ||
+	    dev != (S_ISBLK(statbuf.st_mode) ? statbuf.st_rdev :
+	    statbuf.st_dev) || ino != statbuf.st_ino ||
+	    size != statbuf.st_size || labels == 0 || labels > VDEV_LABELS)
+		return (-1);
+
+	if (posix_memalign((void **)&phys, PAGESIZE, sizeof (*phys)) != 0)
+		return (-1);
+
+	if (pread64(fd, phys, sizeof (vdev_phys_t), VDEV_SKIP_SIZE) !=
+	    sizeof (vdev_phys_t) ||
+	    nvlist_unpack(phys->vp_nvlist, sizeof (phys->vp_nvlist),
+	    &label_config, 0) != 0) {
+		free(phys);
+		return (-1);
+	}
+	free(phys);
+
+	(void) nvlist_lookup_uint64(label_config, ZPOOL_CONFIG_POOL_TXG,
+	    &label_txg);
+	if (nvlist_lookup_uint64(label_config, ZPOOL_CONFIG_GUID,
+	    &label_guid) == 0 && label_guid == guid && label_txg == txg) {
+		*config = label_config;
+		*num_labels = labels;
+		error = 0;
+	} else {
+		nvlist_free(label_config);
+	}
+
+	return (error);
+}
+
+/*
+ * Build the cache entry describing this device's labels.  The entry is
+ * hung off the slice and merged into the cache by the single thread which
+ * consumes the slices, so the probing threads share no lock for it.
+ */
+static nvlist_t *
+label_cache_entry(int fd, nvlist_t *config, int num_labels)
+{
+	struct stat64 statbuf;
+	nvlist_t *entry;
+	uint64_t guid, txg = 0;
+
+	if (fstat64_blk(fd, &statbuf) != 0 ||
+	    nvlist_lookup_uint64(config, ZPOOL_CONFIG_GUID, &guid) != 0)
+		return (NULL);
+	(void) nvlist_lookup_uint64(config, ZPOOL_CONFIG_POOL_TXG, &txg);
+
+	if (nvlist_alloc(&entry, NV_UNIQUE_NAME, 0) != 0)
+		return (NULL);
+
+	if (nvlist_add_uint64(entry, LABEL_CACHE_DEV,
+	    S_ISBLK(statbuf.st_mode) ? statbuf.st_rdev : statbuf.st_dev) == 0 &&
+	    nvlist_add_uint64(entry, LABEL_CACHE_INO, statbuf.st_ino) == 0 &&
+	    nvlist_add_uint64(entry, LABEL_CACHE_SIZE, statbuf.st_size) == 0 &&
+	    nvlist_add_uint64(entry, LABEL_CACHE_GUID, guid) == 0 &&
+	    nvlist_add_uint64(entry, LABEL_CACHE_TXG, txg) == 0 &&
+	    nvlist_add_uint64(entry, LABEL_CACHE_LABELS, num_labels) == 0)
+		return (entry);
+
+	nvlist_free(entry);
+	return (NULL);
+}
+
 static void
 zpool_open_func(void *arg)
 {
@@ -1580,7 +1865,16 @@ zpool_open_func(void *arg)
 		return;
 	}
 
-	error = zpool_read_label(fd, &config, &num_labels);
+	if (rn->rn_label_cache == NULL ||
+	    label_cache_read(rn->rn_label_cache, rn->rn_name, fd,
+	    &config, &num_labels) != 0)
+		error = zpool_read_label(fd, &config, &num_labels);
+	else
+		error = 0;
+
+	if (error == 0 && config != NULL && num_labels != 0 &&
+	    rn->rn_label_cache != NULL)
+		rn->rn_cache_entry = label_cache_entry(fd, config, num_labels);
 	if (error != 0) {
 		(void) close(fd);
 #ifdef  _UZFS
@@ -1650,6 +1944,7 @@ zpool_open_func(void *arg)
 			slice->rn_hdl = hdl;
 			slice->rn_order = IMPORT_ORDER_PREFERRED_1;
 			slice->rn_labelpaths = B_FALSE;
+			slice->rn_label_cache = rn->rn_label_cache;
 			mutex_enter(rn->rn_lock);
 			if (avl_find(rn->rn_avl, slice, &where)) {
 			mutex_exit(rn->rn_lock);
@@ -1676,6 +1971,7 @@ zpool_open_func(void *arg)
 			slice->rn_hdl = hdl;
 			slice->rn_order = IMPORT_ORDER_PREFERRED_2;
 			slice->rn_labelpaths = B_FALSE;
+			slice->rn_label_cache = rn->rn_label_cache;
 			mutex_enter(rn->rn_lock);
 			if (avl_find(rn->rn_avl, slice, &where)) {
 				mutex_exit(rn->rn_lock);
@@ -1920,6 +2216,7 @@ zpool_find_import_impl(libzfs_handle_t *hdl, importargs_t *iarg)
 	rdsk_node_t *slice;
 	void *cookie;
 	taskq_t *t;
+	label_cache_t *lc;
 
 	verify(iarg->poolname == NULL || iarg->guid == 0);
 	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
@@ -1954,9 +2251,12 @@ zpool_find_import_impl(libzfs_handle_t *hdl, importargs_t *iarg)
 	t = taskq_create("z_import", 2 * boot_ncpus, defclsyspri,
 	    2 * boot_ncpus, INT_MAX, TASKQ_PREPOPULATE);
 
+	lc = label_cache_open(hdl);
 	for (slice = avl_first(cache); slice;
-	    (slice = avl_walk(cache, slice, AVL_AFTER)))
+	    (slice = avl_walk(cache, slice, AVL_AFTER))) {
+		slice->rn_label_cache = lc;
 		(void) taskq_dispatch(t, zpool_open_func, slice, TQ_SLEEP);
+	}
 
 	taskq_wait(t);
 	taskq_destroy(t);
@@ -1967,6 +2267,11 @@ zpool_find_import_impl(libzfs_handle_t *hdl, importargs_t *iarg)
 	 */
 	cookie = NULL;
 	while ((slice = avl_destroy_nodes(cache, &cookie)) != NULL) {
+		if (slice->rn_cache_entry != NULL) {
+			(void) nvlist_add_nvlist(lc->lc_new, slice->rn_name,
+			    slice->rn_cache_entry);
+			nvlist_free(slice->rn_cache_entry);
+		}
 		if (slice->rn_config != NULL) {
 			nvlist_t *config = slice->rn_config;
 			boolean_t matched = B_TRUE;
@@ -2030,6 +2335,7 @@ zpool_find_import_impl(libzfs_handle_t *hdl, importargs_t *iarg)
 	avl_destroy(cache);
 	free(cache);
 	mutex_destroy(&lock);
+	label_cache_close(lc);
 
 	ret = get_configs(hdl, &pools, iarg->can_be_active);
 
@@ -98,6 +98,96 @@ top:
 	return (rc);
 }
 
+/*
+ * Initial size of the buffer for ZFS_IOC_DATASET_LIST_BATCH, enough for
+ * a few hundred volumes with their properties per call.
+ */
+#define	ZFS_LIST_BATCH_SIZE	(256 * 1024)
+
+/*
+ * Iterate over the child filesystems of zhp, fetching as many at a time
+ * as fit in the buffer, so that listing a parent with thousands of
+ * volumes takes a handful of ioctls instead of one per volume.  Sets
+ * *unsupported, without calling func, if the kernel lacks the ioctl.
+ */
+static int
+zfs_iter_filesystems_batch(zfs_handle_t *zhp, zfs_iter_f func, void *data,
+    boolean_t *unsupported)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	zfs_cmd_t zc = {"\0"};
+	nvlist_t *batch, *entry, *props;
+	nvpair_t *pair;
+	uchar_t *stats;
+	uint_t nstats;
+	zfs_handle_t *nzhp;
+	size_t bufsize = ZFS_LIST_BATCH_SIZE;
+	boolean_t first = B_TRUE;
+	int ret = 0;
+
+	*unsupported = B_FALSE;
+	if (zcmd_alloc_dst_nvlist(hdl, &zc, bufsize) != 0)
+		return (-1);
+
+	for (;;) {
+		(void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name));
+		zc.zc_nvlist_dst_size = bufsize;
+		if (uzfs_ioctl(hdl->libzfs_fd, ZFS_IOC_DATASET_LIST_BATCH,
+		    &zc) != 0) {
+			if (errno == ENOMEM) {
+				/* one child needs more than bufsize */
+				bufsize = zc.zc_nvlist_dst_size;
+				if (zcmd_expand_dst_nvlist(hdl, &zc) != 0) {
+					ret = -1;
+					break;
+				}
+				continue;
+			}
+			/* see zfs_do_list_ioctl() */
+			if (errno == ESRCH || errno == ENOENT)
+				break;
+			if (first && (errno == ENOTSUP || errno == ENOTTY ||
+			    errno == EINVAL)) {
+				*unsupported = B_TRUE;
+				break;
+			}
+			ret = zfs_standard_error(hdl, errno,
+			    dgettext(TEXT_DOMAIN, "cannot iterate filesystems"));
+			break;
+		}
+		first = B_FALSE;
+
+		if (zcmd_read_dst_nvlist(hdl, &zc, &batch) != 0) {
+			ret = -1;
+			break;
+		}
+		for (pair = nvlist_next_nvpair(batch, NULL); pair != NULL;
+		    pair = nvlist_next_nvpair(batch, pair)) {
+			if (nvpair_value_nvlist(pair, &entry) != 0 ||
+			    nvlist_lookup_uint8_array(entry, "stats", &stats,
+			    &nstats) != 0 ||
+			    nstats != sizeof (dmu_objset_stats_t) ||
+			    nvlist_lookup_nvlist(entry, "props", &props) != 0)
+				continue;
+
+			/* as in zfs_iter_filesystems(), ignore errors */
+			nzhp = make_dataset_handle_nvl(hdl, nvpair_name(pair),
+			    (dmu_objset_stats_t *)stats, props);
+			if (nzhp == NULL)
+				continue;
+
+			if ((ret = func(nzhp, data)) != 0)
+				break;
+		}
+		nvlist_free(batch);
+		if (ret != 0)
+			break;
+	}
+
+	zcmd_free_nvlists(&zc);
+	return (ret);
+}
+
 /*
  * Iterate over all child filesystems
  */
@@ -106,11 +196,16 @@ zfs_iter_filesystems(zfs_handle_t *zhp, zfs_iter_f func, void *data)
 {
 	zfs_cmd_t zc = {"\0"};
 	zfs_handle_t *nzhp;
+	boolean_t unsupported;
 	int ret;
 
 	if (zhp->zfs_type != ZFS_TYPE_FILESYSTEM)
 		return (0);
 
+	ret = zfs_iter_filesystems_batch(zhp, func, data, &unsupported);
+	if (!unsupported)
+		return (ret);
+
 	if (zcmd_alloc_dst_nvlist(zhp->zfs_hdl, &zc, 0) != 0)
 		return (-1);
 
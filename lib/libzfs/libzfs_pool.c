@@ -2013,6 +2013,45 @@ zpool_scan(zpool_handle_t *zhp, pool_scan_func_t func, pool_scrub_cmd_t cmd)
 	}
 }
 
+/*
+ * Start or stop a manual trim of the pool's free space.  A rate of zero
+ * uses the zfs_trim_rate module parameter.
+ */
+int
+zpool_trim(zpool_handle_t *zhp, pool_trim_cmd_t cmd, uint64_t rate)
+{
+	zfs_cmd_t zc = {"\0"};
+	char msg[1024];
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+
+	(void) strlcpy(zc.zc_name, zhp->zpool_name, sizeof (zc.zc_name));
+	zc.zc_flags = cmd;
+	zc.zc_cookie = rate;
+
+	if (zfs_ioctl(hdl, ZFS_IOC_POOL_TRIM, &zc) == 0)
+		return (0);
+
+	if (cmd == POOL_TRIM_STOP) {
+		(void) snprintf(msg, sizeof (msg), dgettext(TEXT_DOMAIN,
+		    "cannot stop trimming %s"), zc.zc_name);
+	} else {
+		(void) snprintf(msg, sizeof (msg), dgettext(TEXT_DOMAIN,
+		    "cannot trim %s"), zc.zc_name);
+	}
+
+	if (errno == EBUSY) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "currently trimming"));
+		return (zfs_error(hdl, EZFS_BUSY, msg));
+	} else if (errno == ENOENT && cmd == POOL_TRIM_STOP) {
+		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+		    "there is no active trim"));
+		return (zfs_error(hdl, EZFS_NOENT, msg));
+	}
+
+	return (zpool_standard_error(hdl, errno, msg));
+}
+
 /*
  * Find a vdev that matches the search criteria specified. We use the
  * the nvpair name to determine how we should look for the device.
@@ -1359,7 +1359,7 @@ int
 zcmd_alloc_dst_nvlist(libzfs_handle_t *hdl, zfs_cmd_t *zc, size_t len)
 {
 	if (len == 0)
-		len = 16 * 1024;
+		len = MAX(16 * 1024, hdl->libzfs_dst_size_hint);
 	zc->zc_nvlist_dst_size = len;
 	zc->zc_nvlist_dst =
 	    (uint64_t)(uintptr_t)zfs_alloc(hdl, zc->zc_nvlist_dst_size);
@@ -1372,11 +1372,21 @@ zcmd_alloc_dst_nvlist(libzfs_handle_t *hdl, zfs_cmd_t *zc, size_t len)
 /*
  * Called when an ioctl() which returns an nvlist fails with ENOMEM.  This will
  * expand the nvlist to the size specified in 'zc_nvlist_dst_size', which was
- * filled in by the kernel to indicate the actual required size.
+ * filled in by the kernel to indicate the actual required size.  Later
+ * default-sized buffers start out at the largest such size, up to
+ * ZCMD_DST_SIZE_HINT_MAX, so that each round trip to the kernel (a
+ * socket exchange with the target under uZFS) is not made twice.
  */
+#define	ZCMD_DST_SIZE_HINT_MAX	(1024 * 1024)
+
 int
 zcmd_expand_dst_nvlist(libzfs_handle_t *hdl, zfs_cmd_t *zc)
 {
+	if (zc->zc_nvlist_dst_size > hdl->libzfs_dst_size_hint) {
+		hdl->libzfs_dst_size_hint = MIN(zc->zc_nvlist_dst_size,
+		    ZCMD_DST_SIZE_HINT_MAX);
+	}
+
 	free((void *)(uintptr_t)zc->zc_nvlist_dst);
 	zc->zc_nvlist_dst =
 	    (uint64_t)(uintptr_t)zfs_alloc(hdl, zc->zc_nvlist_dst_size);
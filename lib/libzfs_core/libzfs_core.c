@@ -412,6 +412,85 @@ lzc_list_snap(const char *dataset, nvlist_t *innvl, nvlist_t **outnvl)
 	return (lzc_ioctl(ZFS_IOC_LIST_SNAP, dataset, NULL, outnvl));
 }
 
+/*
+ * Set local properties on many datasets of a pool at once.  props maps each
+ * dataset name to the nvlist of properties to set on it; the generic
+ * properties of all the datasets are set in a single txg.  If errlistp is
+ * not NULL and some properties could not be set, *errlistp maps the names
+ * of the datasets concerned to the properties that failed and their errors.
+ */
+int
+lzc_set_props_multi(const char *pool, nvlist_t *props, nvlist_t **errlistp)
+{
+	return (lzc_ioctl(ZFS_IOC_SET_PROPS_MULTI, pool, props, errlistp));
+}
+
+/*
+ * Run the nops operations of ops on the datasets of pool in order, in one
+ * ioctl; see zfs_ioc_batch() for the operations.  Consecutive snapshots
+ * and property sets are merged so that they take a single txg.  On failure
+ * *outnvlp holds "failed_op", the index of the op that failed, along with
+ * the output of the ops run so far.
+ */
+int
+lzc_batch(const char *pool, nvlist_t **ops, uint_t nops, nvlist_t **outnvlp)
+{
+	nvlist_t *args = fnvlist_alloc();
+	int error;
+
+	fnvlist_add_nvlist_array(args, "ops", ops, nops);
+	error = lzc_ioctl(ZFS_IOC_BATCH, pool, args, outnvlp);
+	nvlist_free(args);
+	return (error);
+}
+
+/*
+ * Fetch the stats of a volume, or of all volumes if dataset is NULL or
+ * empty, as a zvol_stats_hdr_t followed by its records.  On success *bufp
+ * is a buffer of *sizep bytes that the caller frees with free().
+ */
+int
+lzc_stats_binary(const char *dataset, void **bufp, size_t *sizep)
+{
+	zfs_cmd_t zc = {"\0"};
+	zvol_stats_hdr_t *zsh;
+	int error = 0;
+
+	ASSERT3S(g_refcount, >, 0);
+	VERIFY3S(g_fd, !=, -1);
+
+	if (dataset != NULL)
+		(void) strlcpy(zc.zc_name, dataset, sizeof (zc.zc_name));
+
+	zc.zc_nvlist_dst_size = sizeof (zvol_stats_hdr_t) +
+	    16 * sizeof (zvol_stats_rec_t);
+	for (;;) {
+		uint64_t size = zc.zc_nvlist_dst_size;
+
+		zc.zc_nvlist_dst = (uint64_t)(uintptr_t)malloc(size);
+		if (zc.zc_nvlist_dst == (uint64_t)0)
+			return (ENOMEM);
+		if (uzfs_ioctl(g_fd, ZFS_IOC_STATS_BINARY, &zc) == 0)
+			break;
+		error = errno;
+		free((void *)(uintptr_t)zc.zc_nvlist_dst);
+		if (error != ENOMEM)
+			return (error);
+		/* volumes may have been added since the size was returned */
+		zc.zc_nvlist_dst_size = MAX(zc.zc_nvlist_dst_size, size) +
+		    16 * sizeof (zvol_stats_rec_t);
+	}
+
+	zsh = (zvol_stats_hdr_t *)(uintptr_t)zc.zc_nvlist_dst;
+	if (zsh->zsh_magic != ZVOL_STATS_MAGIC) {
+		free(zsh);
+		return (EINVAL);
+	}
+	*bufp = zsh;
+	*sizep = zc.zc_nvlist_dst_size;
+	return (0);
+}
+
 /*
  * Create "user holds" on snapshots.  If there is a hold on a snapshot,
  * the snapshot can not be destroyed.  (However, it can be marked for deletion
@@ -32,6 +32,8 @@
 #include <zlib.h>
 #include <libgen.h>
 #include <sys/signal.h>
+#include <sys/prctl.h>
+#define	ZFS_LOCKSTAT_IMPL
 #include <sys/spa.h>
 #include <sys/spa_impl.h>
 #include <sys/stat.h>
@@ -51,6 +53,7 @@
 
 int aok;
 uint64_t physmem;
+int boot_ncpus = 1;
 vnode_t *rootdir = (vnode_t *)0xabcd1234;
 char hw_serial[HW_HOSTID_LEN];
 struct utsname hw_utsname;
@@ -76,6 +79,130 @@ int kthread_nr = 0;
 
 extern kmutex_t zvol_list_mutex;
 
+/*
+ * Thread placement.  ZFS_THREAD_AFFINITY holds rules separated by ';' of
+ * the form <name>=<cpus>, where <cpus> is a list of CPUs and ranges such
+ * as "0-3,8", or "node<N>" for the CPUs of a NUMA node.  A thread is bound
+ * to the CPUs of the rule whose name is the longest prefix of its name,
+ * or of the rule named "*".  Taskq threads are named after their taskq
+ * (z_wr_iss, z_rd_int, ...) and other threads after their function
+ * (txg_sync_thread, arc_reclaim_thread, ...).  Threads created outside
+ * libzpool, such as the replica network threads, can place themselves
+ * under a class name of their choosing with zk_thread_set_affinity().
+ * For example:
+ *
+ * ZFS_THREAD_AFFINITY="z_wr_iss=node0;z_rd_int=node0;txg_sync=2;*=4-15"
+ */
+#define	THREAD_AFFINITY_MAX	32
+
+typedef struct thread_affinity {
+	char		ta_name[TASKQ_NAMELEN];
+	cpu_set_t	ta_cpus;
+} thread_affinity_t;
+
+static thread_affinity_t thread_affinity[THREAD_AFFINITY_MAX];
+static int thread_affinity_count;
+
+static int
+cpulist_parse(const char *str, cpu_set_t *cpus)
+{
+	char buf[256];
+	char *end;
+	FILE *f;
+	unsigned long first, last;
+	int error;
+
+	if (strncmp(str, "node", 4) == 0) {
+		(void) snprintf(buf, sizeof (buf),
+		    "/sys/devices/system/node/node%s/cpulist", str + 4);
+		if ((f = fopen(buf, "r")) == NULL)
+			return (errno);
+		error = (fgets(buf, sizeof (buf), f) == NULL) ? EINVAL : 0;
+		(void) fclose(f);
+		if (error != 0)
+			return (error);
+		buf[strcspn(buf, "\n")] = '\0';
+		return (cpulist_parse(buf, cpus));
+	}
+
+	CPU_ZERO(cpus);
+	while (*str != '\0') {
+		first = last = strtoul(str, &end, 10);
+		if (end == str)
+			return (EINVAL);
+		if (*end == '-') {
+			str = end + 1;
+			last = strtoul(str, &end, 10);
+			if (end == str || last < first)
+				return (EINVAL);
+		}
+		if (*end != ',' && *end != '\0')
+			return (EINVAL);
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, cpus);
+		str = (*end == ',') ? end + 1 : end;
+	}
+
+	return (CPU_COUNT(cpus) != 0 ? 0 : EINVAL);
+}
+
+static void
+thread_affinity_init(void)
+{
+	char *env, *rule, *cpus, *lasts;
+	thread_affinity_t *ta;
+
+	if ((env = getenv("ZFS_THREAD_AFFINITY")) == NULL)
+		return;
+
+	env = strdup(env);
+	for (rule = strtok_r(env, ";", &lasts); rule != NULL;
+	    rule = strtok_r(NULL, ";", &lasts)) {
+		ta = &thread_affinity[thread_affinity_count];
+		if (thread_affinity_count == THREAD_AFFINITY_MAX ||
+		    (cpus = strchr(rule, '=')) == NULL ||
+		    cpulist_parse(cpus + 1, &ta->ta_cpus) != 0) {
+			(void) fprintf(stderr, "ignoring ZFS_THREAD_AFFINITY "
+			    "rule '%s'\n", rule);
+			continue;
+		}
+		*cpus = '\0';
+		(void) strlcpy(ta->ta_name, rule, sizeof (ta->ta_name));
+		thread_affinity_count++;
+	}
+	free(env);
+}
+
+/*
+ * Bind the calling thread to the CPUs the placement rules give to name.
+ */
+int
+zk_thread_set_affinity(const char *name)
+{
+	thread_affinity_t *ta, *best = NULL;
+	size_t len, best_len = 0;
+	int i;
+
+	for (i = 0; i < thread_affinity_count; i++) {
+		ta = &thread_affinity[i];
+		len = strlen(ta->ta_name);
+		if (strcmp(ta->ta_name, "*") == 0) {
+			if (best == NULL)
+				best = ta;
+		} else if (strncmp(name, ta->ta_name, len) == 0 &&
+		    (best == NULL || len > best_len)) {
+			best = ta;
+			best_len = len;
+		}
+	}
+
+	if (best == NULL)
+		return (0);
+
+	return (pthread_setaffinity_np(pthread_self(), sizeof (cpu_set_t),
+	    &best->ta_cpus));
+}
+
 void
 thread_init(void)
 {
@@ -83,6 +210,8 @@ thread_init(void)
 
 	VERIFY3S(pthread_key_create(&kthread_key, NULL), ==, 0);
 
+	thread_affinity_init();
+
 	/* Create entry for primary kthread */
 	kt = umem_zalloc(sizeof (kthread_t), UMEM_NOFAIL);
 	kt->t_tid = pthread_self();
@@ -140,6 +269,10 @@ zk_thread_helper(void *arg)
 	kthread_nr++;
 	VERIFY3S(pthread_mutex_unlock(&kthread_lock), ==, 0);
 	(void) setpriority(PRIO_PROCESS, 0, kt->t_pri);
+	if (kt->t_name != NULL) {
+		(void) prctl(PR_SET_NAME, kt->t_name, 0, 0, 0);
+		(void) zk_thread_set_affinity(kt->t_name);
+	}
 
 	kt->t_tid = pthread_self();
 	((thread_func_arg_t)kt->t_func)(kt->t_arg);
@@ -153,6 +286,19 @@ zk_thread_helper(void *arg)
 kthread_t *
 zk_thread_create(caddr_t stk, size_t stksize, thread_func_t func, void *arg,
     uint64_t len, proc_t *pp, int state, pri_t pri, int detachstate)
+{
+	return (zk_thread_create_named(NULL, stk, stksize, func, arg, len,
+	    pp, state, pri, detachstate));
+}
+
+/*
+ * The name, which thread_create() takes from the thread function, names
+ * the thread and selects its placement, see zk_thread_set_affinity().
+ */
+kthread_t *
+zk_thread_create_named(const char *name, caddr_t stk, size_t stksize,
+    thread_func_t func, void *arg, uint64_t len, proc_t *pp, int state,
+    pri_t pri, int detachstate)
 {
 	kthread_t *kt;
 	pthread_attr_t attr;
@@ -165,6 +311,7 @@ zk_thread_create(caddr_t stk, size_t stksize, thread_func_t func, void *arg,
 	kt->t_func = func;
 	kt->t_arg = arg;
 	kt->t_pri = pri;
+	kt->t_name = name;
 
 	VERIFY0(pthread_attr_init(&attr));
 	VERIFY0(pthread_attr_setdetachstate(&attr, detachstate));
@@ -239,7 +386,7 @@ kstat_t *
 kstat_create(const char *ks_module, int ks_instance, const char *ks_name,
     const char *ks_class, uchar_t ks_type, ulong_t ks_ndata, uchar_t ks_flags)
 {
-	if (ks_type ==  KSTAT_TYPE_IO || ks_type == KSTAT_TYPE_TIMER ||
+	if (ks_type == KSTAT_TYPE_TIMER ||
 	    ks_type == KSTAT_TYPE_INTR || ks_type == KSTAT_TYPE_RAW)
 		return (NULL);
 	kstat_t *ksp;
@@ -266,6 +413,10 @@ kstat_create(const char *ks_module, int ks_instance, const char *ks_name,
 			ksp->ks_ndata = ks_ndata;
 			ksp->ks_data_size = ks_ndata * sizeof (kstat_named_t);
 			break;
+		case KSTAT_TYPE_IO:
+			ksp->ks_ndata = 1;
+			ksp->ks_data_size = sizeof (kstat_io_t);
+			break;
 		default:
 			panic("unknown kstat type");
 	}
@@ -321,33 +472,78 @@ kstat_delete(kstat_t *ksp)
 	nvlist_remove_all(kstat_nvl, buf);
 	pthread_mutex_unlock(&kstat_module_lock);
 }
-/*ARGSUSED*/
+/*
+ * Queue accounting, as in illumos: on every transition the time since the
+ * last one is added to the busy time if the queue was not empty, and
+ * weighted by the queue length to the length*time sum.  The caller
+ * serializes the updates of a kstat_io_t.
+ */
+static inline void
+kstat_io_account(hrtime_t now, hrtime_t *lastupdate, hrtime_t *time,
+    hrtime_t *lentime, uint_t cnt)
+{
+	hrtime_t delta = now - *lastupdate;
+
+	*lastupdate = now;
+	if (cnt != 0) {
+		*lentime += delta * cnt;
+		*time += delta;
+	}
+}
+
 void
 kstat_waitq_enter(kstat_io_t *kiop)
-{}
+{
+	kstat_io_account(gethrtime(), &kiop->wlastupdate, &kiop->wtime,
+	    &kiop->wlentime, kiop->wcnt++);
+}
 
-/*ARGSUSED*/
 void
 kstat_waitq_exit(kstat_io_t *kiop)
-{}
-/*ARGSUSED*/
+{
+	ASSERT3U(kiop->wcnt, >, 0);
+	kstat_io_account(gethrtime(), &kiop->wlastupdate, &kiop->wtime,
+	    &kiop->wlentime, kiop->wcnt--);
+}
+
 void
 kstat_runq_enter(kstat_io_t *kiop)
-{}
-/*ARGSUSED*/
+{
+	kstat_io_account(gethrtime(), &kiop->rlastupdate, &kiop->rtime,
+	    &kiop->rlentime, kiop->rcnt++);
+}
+
 void
 kstat_runq_exit(kstat_io_t *kiop)
-{}
+{
+	ASSERT3U(kiop->rcnt, >, 0);
+	kstat_io_account(gethrtime(), &kiop->rlastupdate, &kiop->rtime,
+	    &kiop->rlentime, kiop->rcnt--);
+}
 
-/*ARGSUSED*/
 void
 kstat_waitq_to_runq(kstat_io_t *kiop)
-{}
+{
+	hrtime_t now = gethrtime();
+
+	ASSERT3U(kiop->wcnt, >, 0);
+	kstat_io_account(now, &kiop->wlastupdate, &kiop->wtime,
+	    &kiop->wlentime, kiop->wcnt--);
+	kstat_io_account(now, &kiop->rlastupdate, &kiop->rtime,
+	    &kiop->rlentime, kiop->rcnt++);
+}
 
-/*ARGSUSED*/
 void
 kstat_runq_back_to_waitq(kstat_io_t *kiop)
-{}
+{
+	hrtime_t now = gethrtime();
+
+	ASSERT3U(kiop->rcnt, >, 0);
+	kstat_io_account(now, &kiop->rlastupdate, &kiop->rtime,
+	    &kiop->rlentime, kiop->rcnt--);
+	kstat_io_account(now, &kiop->wlastupdate, &kiop->wtime,
+	    &kiop->wlentime, kiop->wcnt++);
+}
 
 void
 kstat_set_raw_ops(kstat_t *ksp,
@@ -406,17 +602,55 @@ kstat_show_named(kstat_t *ksp)
 	return (0);
 }
 
+int
+kstat_show_io(kstat_t *ksp)
+{
+	kstat_io_t io;
+
+	VERIFY(ksp != NULL);
+
+	if (ksp->ks_data == NULL)
+		return (1);
+
+	if (ksp->ks_lock != NULL)
+		mutex_enter(ksp->ks_lock);
+	io = *KSTAT_IO_PTR(ksp);
+	if (ksp->ks_lock != NULL)
+		mutex_exit(ksp->ks_lock);
+
+	printf("nread: %llu\n", (u_longlong_t)io.nread);
+	printf("nwritten: %llu\n", (u_longlong_t)io.nwritten);
+	printf("reads: %u\n", io.reads);
+	printf("writes: %u\n", io.writes);
+	printf("wtime: %lld\n", (longlong_t)io.wtime);
+	printf("wlentime: %lld\n", (longlong_t)io.wlentime);
+	printf("wupdate: %lld\n", (longlong_t)io.wlastupdate);
+	printf("rtime: %lld\n", (longlong_t)io.rtime);
+	printf("rlentime: %lld\n", (longlong_t)io.rlentime);
+	printf("rupdate: %lld\n", (longlong_t)io.rlastupdate);
+	printf("wcnt: %u\n", io.wcnt);
+	printf("rcnt: %u\n", io.rcnt);
+
+	return (0);
+}
+
 int
 kstat_read(kstat_t *ksp)
 {
 	int rc = 0;
+
+	if (ksp->ks_update != NULL)
+		(void) ksp->ks_update(ksp, KSTAT_READ);
+
 	switch (ksp->ks_type) {
 	case KSTAT_TYPE_NAMED:
 		rc = kstat_show_named(ksp);
 		break;
+	case KSTAT_TYPE_IO:
+		rc = kstat_show_io(ksp);
+		break;
 	case KSTAT_TYPE_RAW:
 	case KSTAT_TYPE_INTR:
-	case KSTAT_TYPE_IO:
 	case KSTAT_TYPE_TIMER:
 		break;
 	default:
@@ -440,14 +674,533 @@ kstat_dump_all(void)
 		kstat_t *ksp = (kstat_t *)kstat_lookup_ksp(nvpair_name(pair));
 		kstat_read(ksp);
 	}
+	kmem_cache_stats_dump();
+#ifdef ZFS_LOCKSTAT
+	lockstat_dump();
+#endif
+}
+
+/*
+ * =========================================================================
+ * kmem caches
+ * =========================================================================
+ */
+
+/*
+ * umem is a thin wrapper around malloc() here, so every zio_t, dbuf and
+ * ARC header allocation went through the allocator's shared arenas.  A kmem
+ * cache now keeps a magazine of constructed objects for each thread using
+ * it, which serves allocations and frees without any locking.  A thread
+ * that empties its magazine swaps it for a full one from the cache's depot,
+ * and a thread that fills it puts it in the depot; zfs_kmem_depot_max
+ * bounds the full magazines in the depot, beyond which objects go back to
+ * umem.  Magazines hold at most KMEM_MAGAZINE_BYTES of objects, so caches
+ * of large buffers get few rounds or none.  kmem_cache_reap_now() empties
+ * the depot; the magazine of a thread is emptied when the thread exits.
+ */
+#define	KMEM_MAGAZINE_ROUNDS	32
+#define	KMEM_MAGAZINE_BYTES	(128 * 1024)
+
+int zfs_kmem_depot_max = 16;
+
+typedef struct kmem_magazine {
+	list_node_t	km_node;	/* on kc_loaded, kc_full or kc_empty */
+	kmem_cache_t	*km_cache;
+	int		km_rounds;
+	uint64_t	km_alloc_hits;	/* updated by the loading thread */
+	uint64_t	km_free_hits;
+	void		*km_objs[KMEM_MAGAZINE_ROUNDS];
+} kmem_magazine_t;
+
+struct kmem_cache {
+	umem_cache_t	*kc_umem;
+	int		kc_rounds;	/* magazine size, 0 for none */
+	pthread_key_t	kc_key;		/* magazine loaded by this thread */
+	pthread_mutex_t	kc_lock;	/* protects the lists below */
+	list_t		kc_loaded;	/* magazines loaded by threads */
+	list_t		kc_full;	/* the depot */
+	list_t		kc_empty;
+	int		kc_nfull;
+	list_node_t	kc_node;	/* on kmem_caches */
+	uint64_t	kc_alloc_hits;	/* of magazines no longer loaded */
+	uint64_t	kc_free_hits;
+	uint64_t	kc_depot_allocs; /* full magazines taken from the depot */
+	uint64_t	kc_depot_frees;	/* full magazines put in the depot */
+	uint64_t	kc_umem_allocs;
+	uint64_t	kc_umem_frees;
+};
+
+static list_t kmem_caches;
+static pthread_mutex_t kmem_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t kmem_caches_once = PTHREAD_ONCE_INIT;
+
+static void
+kmem_caches_init(void)
+{
+	list_create(&kmem_caches, sizeof (kmem_cache_t),
+	    offsetof(kmem_cache_t, kc_node));
+}
+
+static void *
+kmem_cache_umem_alloc(kmem_cache_t *cp, int flags)
+{
+	atomic_inc_64(&cp->kc_umem_allocs);
+	return (umem_cache_alloc(cp->kc_umem, flags));
+}
+
+static void
+kmem_cache_umem_free(kmem_cache_t *cp, void *buf)
+{
+	atomic_inc_64(&cp->kc_umem_frees);
+	umem_cache_free(cp->kc_umem, buf);
+}
+
+/*
+ * Return the objects of a magazine to umem and free it.  The caller has
+ * taken the magazine off its list.
+ */
+static void
+kmem_magazine_destroy(kmem_magazine_t *km)
+{
+	kmem_cache_t *cp = km->km_cache;
+
+	while (km->km_rounds > 0)
+		kmem_cache_umem_free(cp, km->km_objs[--km->km_rounds]);
+	atomic_add_64(&cp->kc_alloc_hits, km->km_alloc_hits);
+	atomic_add_64(&cp->kc_free_hits, km->km_free_hits);
+	umem_free(km, sizeof (kmem_magazine_t));
+}
+
+static void
+kmem_magazine_thread_exit(void *arg)
+{
+	kmem_magazine_t *km = arg;
+	kmem_cache_t *cp = km->km_cache;
+
+	pthread_mutex_lock(&cp->kc_lock);
+	list_remove(&cp->kc_loaded, km);
+	pthread_mutex_unlock(&cp->kc_lock);
+	kmem_magazine_destroy(km);
+}
+
+/*
+ * Load a magazine for this thread in place of old, which the caller holding
+ * kc_lock has taken off kc_loaded or is NULL.  A full magazine is taken
+ * from the depot if want_full is set and there is one, else an empty one.
+ */
+static kmem_magazine_t *
+kmem_magazine_load(kmem_cache_t *cp, boolean_t want_full)
+{
+	kmem_magazine_t *km = NULL;
+
+	if (want_full && (km = list_remove_head(&cp->kc_full)) != NULL) {
+		cp->kc_nfull--;
+		cp->kc_depot_allocs++;
+	} else if ((km = list_remove_head(&cp->kc_empty)) == NULL) {
+		km = umem_zalloc(sizeof (kmem_magazine_t), UMEM_NOFAIL);
+		km->km_cache = cp;
+	}
+	list_insert_head(&cp->kc_loaded, km);
+	VERIFY0(pthread_setspecific(cp->kc_key, km));
+
+	return (km);
+}
+
+kmem_cache_t *
+kmem_cache_create(char *name, size_t bufsize, size_t align,
+    umem_constructor_t *constructor, umem_destructor_t *destructor,
+    umem_reclaim_t *reclaim, void *priv, void *vmp, int cflags)
+{
+	kmem_cache_t *cp;
+
+	cp = umem_zalloc(sizeof (kmem_cache_t), UMEM_NOFAIL);
+	cp->kc_umem = umem_cache_create(name, bufsize, align, constructor,
+	    destructor, reclaim, priv, vmp, cflags);
+	VERIFY(cp->kc_umem != NULL);
+
+	cp->kc_rounds = MIN(KMEM_MAGAZINE_BYTES / MAX(bufsize, 1),
+	    KMEM_MAGAZINE_ROUNDS);
+	if (cflags & UMC_NOMAGAZINE)
+		cp->kc_rounds = 0;
+	if (cp->kc_rounds != 0 &&
+	    pthread_key_create(&cp->kc_key, kmem_magazine_thread_exit) != 0)
+		cp->kc_rounds = 0;
+
+	pthread_mutex_init(&cp->kc_lock, NULL);
+	list_create(&cp->kc_loaded, sizeof (kmem_magazine_t),
+	    offsetof(kmem_magazine_t, km_node));
+	list_create(&cp->kc_full, sizeof (kmem_magazine_t),
+	    offsetof(kmem_magazine_t, km_node));
+	list_create(&cp->kc_empty, sizeof (kmem_magazine_t),
+	    offsetof(kmem_magazine_t, km_node));
+
+	VERIFY0(pthread_once(&kmem_caches_once, kmem_caches_init));
+	pthread_mutex_lock(&kmem_caches_lock);
+	list_insert_tail(&kmem_caches, cp);
+	pthread_mutex_unlock(&kmem_caches_lock);
+
+	return (cp);
+}
+
+/*
+ * Empty the depot.  With destroy set, also empty the magazines loaded by
+ * threads, which must no longer use the cache.
+ */
+static void
+kmem_cache_drain(kmem_cache_t *cp, boolean_t destroy)
+{
+	list_t drain;
+	kmem_magazine_t *km;
+
+	list_create(&drain, sizeof (kmem_magazine_t),
+	    offsetof(kmem_magazine_t, km_node));
+
+	pthread_mutex_lock(&cp->kc_lock);
+	list_move_tail(&drain, &cp->kc_full);
+	list_move_tail(&drain, &cp->kc_empty);
+	if (destroy)
+		list_move_tail(&drain, &cp->kc_loaded);
+	cp->kc_nfull = 0;
+	pthread_mutex_unlock(&cp->kc_lock);
+
+	while ((km = list_remove_head(&drain)) != NULL)
+		kmem_magazine_destroy(km);
+	list_destroy(&drain);
+}
+
+void
+kmem_cache_destroy(kmem_cache_t *cp)
+{
+	pthread_mutex_lock(&kmem_caches_lock);
+	list_remove(&kmem_caches, cp);
+	pthread_mutex_unlock(&kmem_caches_lock);
+
+	if (cp->kc_rounds != 0)
+		VERIFY0(pthread_key_delete(cp->kc_key));
+	kmem_cache_drain(cp, B_TRUE);
+
+	list_destroy(&cp->kc_loaded);
+	list_destroy(&cp->kc_full);
+	list_destroy(&cp->kc_empty);
+	pthread_mutex_destroy(&cp->kc_lock);
+	umem_cache_destroy(cp->kc_umem);
+	umem_free(cp, sizeof (kmem_cache_t));
+}
+
+void *
+kmem_cache_alloc(kmem_cache_t *cp, int flags)
+{
+	kmem_magazine_t *km;
+
+	if (cp->kc_rounds == 0)
+		return (kmem_cache_umem_alloc(cp, flags));
+
+	km = pthread_getspecific(cp->kc_key);
+	if (km == NULL || km->km_rounds == 0) {
+		pthread_mutex_lock(&cp->kc_lock);
+		if (km != NULL && list_is_empty(&cp->kc_full)) {
+			pthread_mutex_unlock(&cp->kc_lock);
+			return (kmem_cache_umem_alloc(cp, flags));
+		}
+		if (km != NULL) {
+			list_remove(&cp->kc_loaded, km);
+			list_insert_head(&cp->kc_empty, km);
+		}
+		km = kmem_magazine_load(cp, B_TRUE);
+		pthread_mutex_unlock(&cp->kc_lock);
+		if (km->km_rounds == 0)
+			return (kmem_cache_umem_alloc(cp, flags));
+	}
+
+	km->km_alloc_hits++;
+	return (km->km_objs[--km->km_rounds]);
+}
+
+void
+kmem_cache_free(kmem_cache_t *cp, void *buf)
+{
+	kmem_magazine_t *km;
+
+	if (cp->kc_rounds == 0) {
+		kmem_cache_umem_free(cp, buf);
+		return;
+	}
+
+	km = pthread_getspecific(cp->kc_key);
+	if (km == NULL || km->km_rounds == cp->kc_rounds) {
+		pthread_mutex_lock(&cp->kc_lock);
+		if (km != NULL && cp->kc_nfull >= zfs_kmem_depot_max) {
+			pthread_mutex_unlock(&cp->kc_lock);
+			kmem_cache_umem_free(cp, buf);
+			return;
+		}
+		if (km != NULL) {
+			list_remove(&cp->kc_loaded, km);
+			list_insert_head(&cp->kc_full, km);
+			cp->kc_nfull++;
+			cp->kc_depot_frees++;
+		}
+		km = kmem_magazine_load(cp, B_FALSE);
+		pthread_mutex_unlock(&cp->kc_lock);
+	}
+
+	km->km_free_hits++;
+	km->km_objs[km->km_rounds++] = buf;
+}
+
+void
+kmem_cache_reap_now(kmem_cache_t *cp)
+{
+	kmem_cache_drain(cp, B_FALSE);
+	umem_cache_reap_now(cp->kc_umem);
+}
+
+/*
+ * Print the statistics of each cache.  The magazine hits of threads still
+ * running are read without synchronization, so they may be slightly off.
+ */
+void
+kmem_cache_stats_dump(void)
+{
+	kmem_cache_t *cp;
+	kmem_magazine_t *km;
+
+	VERIFY0(pthread_once(&kmem_caches_once, kmem_caches_init));
+	pthread_mutex_lock(&kmem_caches_lock);
+	for (cp = list_head(&kmem_caches); cp != NULL;
+	    cp = list_next(&kmem_caches, cp)) {
+		uint64_t alloc_hits, free_hits;
+
+		pthread_mutex_lock(&cp->kc_lock);
+		alloc_hits = cp->kc_alloc_hits;
+		free_hits = cp->kc_free_hits;
+		for (km = list_head(&cp->kc_loaded); km != NULL;
+		    km = list_next(&cp->kc_loaded, km)) {
+			alloc_hits += km->km_alloc_hits;
+			free_hits += km->km_free_hits;
+		}
+		for (km = list_head(&cp->kc_full); km != NULL;
+		    km = list_next(&cp->kc_full, km)) {
+			alloc_hits += km->km_alloc_hits;
+			free_hits += km->km_free_hits;
+		}
+		for (km = list_head(&cp->kc_empty); km != NULL;
+		    km = list_next(&cp->kc_empty, km)) {
+			alloc_hits += km->km_alloc_hits;
+			free_hits += km->km_free_hits;
+		}
+		printf("%s: rounds %d alloc_hits %llu free_hits %llu "
+		    "depot_allocs %llu depot_frees %llu depot_full %d "
+		    "umem_allocs %llu umem_frees %llu\n",
+		    cp->kc_umem->cache_name, cp->kc_rounds,
+		    (u_longlong_t)alloc_hits, (u_longlong_t)free_hits,
+		    (u_longlong_t)cp->kc_depot_allocs,
+		    (u_longlong_t)cp->kc_depot_frees, cp->kc_nfull,
+		    (u_longlong_t)cp->kc_umem_allocs,
+		    (u_longlong_t)cp->kc_umem_frees);
+		pthread_mutex_unlock(&cp->kc_lock);
+	}
+	pthread_mutex_unlock(&kmem_caches_lock);
+}
+
+/*
+ * =========================================================================
+ * lock statistics
+ * =========================================================================
+ */
+
+#ifdef ZFS_LOCKSTAT
+/*
+ * The counters of a site are shared by all of its locks and updated
+ * atomically, which makes this a profiling build rather than one to run
+ * in production.
+ */
+static lockstat_site_t *lockstat_sites;
+static pthread_mutex_t lockstat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define	LOCKSTAT_NOW()		gethrtime()
+
+static void
+lockstat_register(lockstat_site_t *ls)
+{
+	if (ls->ls_registered)
+		return;
+
+	VERIFY0(pthread_mutex_lock(&lockstat_lock));
+	if (!ls->ls_registered) {
+		ls->ls_next = lockstat_sites;
+		lockstat_sites = ls;
+		ls->ls_registered = B_TRUE;
+	}
+	VERIFY0(pthread_mutex_unlock(&lockstat_lock));
+}
+
+/*
+ * wait_start is the time the caller started waiting for the lock, or 0 if
+ * it got it straight away.
+ */
+static void
+lockstat_acquired(lockstat_site_t *ls, hrtime_t wait_start)
+{
+	if (ls == NULL)
+		return;
+
+	atomic_inc_64(&ls->ls_acquired);
+	if (wait_start != 0) {
+		atomic_inc_64(&ls->ls_contended);
+		atomic_add_64(&ls->ls_wait_time, gethrtime() - wait_start);
+	}
+}
+
+static void
+lockstat_released(lockstat_site_t *ls, hrtime_t hold_start)
+{
+	uint64_t hold, max;
+
+	if (ls == NULL)
+		return;
+
+	hold = gethrtime() - hold_start;
+	while (hold > (max = ls->ls_max_hold)) {
+		if (atomic_cas_64(&ls->ls_max_hold, max, hold) == max)
+			break;
+	}
 }
 
+void
+lockstat_dump(void)
+{
+	lockstat_site_t *ls;
+
+	VERIFY0(pthread_mutex_lock(&lockstat_lock));
+	printf("%-6s %-40s %12s %12s %14s %12s\n", "kind", "site",
+	    "acquired", "contended", "wait_ns", "max_hold_ns");
+	for (ls = lockstat_sites; ls != NULL; ls = ls->ls_next) {
+		char site[MAXPATHLEN];
+
+		if (ls->ls_acquired == 0)
+			continue;
+		(void) snprintf(site, sizeof (site), "%s:%d",
+		    ls->ls_file, ls->ls_line);
+		printf("%-6s %-40s %12llu %12llu %14llu %12llu\n",
+		    ls->ls_kind, site, (u_longlong_t)ls->ls_acquired,
+		    (u_longlong_t)ls->ls_contended,
+		    (u_longlong_t)ls->ls_wait_time,
+		    (u_longlong_t)ls->ls_max_hold);
+	}
+	VERIFY0(pthread_mutex_unlock(&lockstat_lock));
+}
+
+#define	LOCKSTAT_MUTEX_ACQUIRED(mp, wait_start)				\
+do {									\
+	lockstat_acquired((mp)->m_site, wait_start);			\
+	(mp)->m_hold_start = gethrtime();				\
+} while (0)
+#define	LOCKSTAT_MUTEX_RELEASED(mp)					\
+	lockstat_released((mp)->m_site, (mp)->m_hold_start)
+#define	LOCKSTAT_RW_ACQUIRED(rwlp, rw, wait_start)			\
+do {									\
+	lockstat_acquired((rwlp)->rw_site, wait_start);			\
+	if ((rw) == RW_WRITER)						\
+		(rwlp)->rw_hold_start = gethrtime();			\
+} while (0)
+#define	LOCKSTAT_RW_RELEASED(rwlp)					\
+	lockstat_released((rwlp)->rw_site, (rwlp)->rw_hold_start)
+#else
+#define	LOCKSTAT_NOW()				(0)
+#define	LOCKSTAT_MUTEX_ACQUIRED(mp, wait_start)	((void) (wait_start))
+#define	LOCKSTAT_MUTEX_RELEASED(mp)
+#define	LOCKSTAT_RW_ACQUIRED(rwlp, rw, wait_start) ((void) (wait_start))
+#define	LOCKSTAT_RW_RELEASED(rwlp)
+#endif
+
 /*
  * =========================================================================
  * mutexes
  * =========================================================================
  */
 
+/*
+ * pthread_mutex_lock() sleeps in the kernel as soon as a mutex is contended,
+ * which costs a pair of context switches for critical sections that are
+ * only a few hundred instructions long, such as the ARC hash locks.  A
+ * contended mutex_enter() therefore first spins, for as long as the mutex
+ * keeps its owner and at most zfs_mutex_spin_max times, and only sleeps if
+ * the owner holds on to it.  A change of owner restarts the spin, since the
+ * mutex is evidently being passed along quickly, up to four times over.
+ */
+int zfs_mutex_spin_max = 1000;
+
+typedef struct mutex_stats {
+	kstat_named_t mutexstat_contended;
+	kstat_named_t mutexstat_spin_acquired;
+	kstat_named_t mutexstat_slept;
+} mutex_stats_t;
+
+static mutex_stats_t mutex_stats = {
+	/* Number of mutex_enter() calls that found the mutex held */
+	{ "contended",			KSTAT_DATA_UINT64 },
+	/* Number of those that got the mutex by spinning */
+	{ "spin_acquired",		KSTAT_DATA_UINT64 },
+	/* Number of those that went to sleep on the mutex */
+	{ "slept",			KSTAT_DATA_UINT64 },
+};
+
+#define	MUTEXSTAT_BUMP(stat)	\
+	atomic_inc_64(&mutex_stats.stat.value.ui64)
+
+static kstat_t *mutex_ksp;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define	MUTEX_SPIN_PAUSE()	__asm__ __volatile__("pause")
+#else
+#define	MUTEX_SPIN_PAUSE()	__asm__ __volatile__("" ::: "memory")
+#endif
+
+static void
+mutex_stats_init(void)
+{
+	mutex_ksp = kstat_create("zfs", 0, "mutexstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (mutex_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (mutex_ksp != NULL) {
+		mutex_ksp->ks_data = &mutex_stats;
+		kstat_install(mutex_ksp);
+	}
+}
+
+static void
+mutex_stats_fini(void)
+{
+	if (mutex_ksp != NULL) {
+		kstat_delete(mutex_ksp);
+		mutex_ksp = NULL;
+	}
+}
+
+static int
+mutex_spin(kmutex_t *mp)
+{
+	void *owner = mp->m_owner;
+	int spins = 0, restarts = 0;
+
+	while (spins++ < zfs_mutex_spin_max) {
+		void *cur = ((volatile kmutex_t *)mp)->m_owner;
+
+		if (cur == MTX_INIT) {
+			if (pthread_mutex_trylock(&mp->m_lock) == 0)
+				return (1);
+		} else if (cur != owner && restarts < 4) {
+			owner = cur;
+			spins = 0;
+			restarts++;
+		}
+		MUTEX_SPIN_PAUSE();
+	}
+
+	return (0);
+}
+
 void
 mutex_init(kmutex_t *mp, char *name, int type, void *cookie)
 {
@@ -455,9 +1208,23 @@ mutex_init(kmutex_t *mp, char *name, int type, void *cookie)
 	ASSERT3P(cookie, ==, NULL);
 	mp->m_owner = MTX_INIT;
 	mp->m_magic = MTX_MAGIC;
+#ifdef ZFS_LOCKSTAT
+	mp->m_site = NULL;
+#endif
 	VERIFY3S(pthread_mutex_init(&mp->m_lock, NULL), ==, 0);
 }
 
+#ifdef ZFS_LOCKSTAT
+void
+mutex_init_site(kmutex_t *mp, char *name, int type, void *cookie,
+    lockstat_site_t *ls)
+{
+	mutex_init(mp, name, type, cookie);
+	lockstat_register(ls);
+	mp->m_site = ls;
+}
+#endif
+
 void
 mutex_destroy(kmutex_t *mp)
 {
@@ -471,12 +1238,24 @@ mutex_destroy(kmutex_t *mp)
 void
 mutex_enter(kmutex_t *mp)
 {
+	hrtime_t wait_start = 0;
+
 	ASSERT3U(mp->m_magic, ==, MTX_MAGIC);
 	ASSERT3P(mp->m_owner, !=, MTX_DEST);
 	ASSERT3P(mp->m_owner, !=, curthread);
-	VERIFY3S(pthread_mutex_lock(&mp->m_lock), ==, 0);
+	if (pthread_mutex_trylock(&mp->m_lock) != 0) {
+		wait_start = LOCKSTAT_NOW();
+		MUTEXSTAT_BUMP(mutexstat_contended);
+		if (mutex_spin(mp)) {
+			MUTEXSTAT_BUMP(mutexstat_spin_acquired);
+		} else {
+			MUTEXSTAT_BUMP(mutexstat_slept);
+			VERIFY3S(pthread_mutex_lock(&mp->m_lock), ==, 0);
+		}
+	}
 	ASSERT3P(mp->m_owner, ==, MTX_INIT);
 	mp->m_owner = curthread;
+	LOCKSTAT_MUTEX_ACQUIRED(mp, wait_start);
 }
 
 int
@@ -488,6 +1267,7 @@ mutex_tryenter(kmutex_t *mp)
 	if (0 == (err = pthread_mutex_trylock(&mp->m_lock))) {
 		ASSERT3P(mp->m_owner, ==, MTX_INIT);
 		mp->m_owner = curthread;
+		LOCKSTAT_MUTEX_ACQUIRED(mp, 0);
 		return (1);
 	} else {
 		VERIFY3S(err, ==, EBUSY);
@@ -500,6 +1280,7 @@ mutex_exit(kmutex_t *mp)
 {
 	ASSERT3U(mp->m_magic, ==, MTX_MAGIC);
 	ASSERT3P(mutex_owner(mp), ==, curthread);
+	LOCKSTAT_MUTEX_RELEASED(mp);
 	mp->m_owner = MTX_INIT;
 	VERIFY3S(pthread_mutex_unlock(&mp->m_lock), ==, 0);
 }
@@ -523,6 +1304,135 @@ mutex_held(kmutex_t *mp)
  * =========================================================================
  */
 
+/*
+ * Read-mostly locks such as dn_struct_rwlock and the spa config locks are
+ * taken for read on every I/O, and a pthread rwlock makes every reader write
+ * to the lock's cache line.  Readers therefore take a lock through a global
+ * table of visible readers instead, in the manner of BRAVO: while the lock
+ * is reader biased (rw_rbias), a reader publishes the lock in a slot picked
+ * by hashing the lock and the thread, and holds it once the publication is
+ * visible with the bias still set.  A writer takes rw_lock, which keeps out
+ * the slow readers and other writers, clears the bias and waits for the
+ * table to hold no readers of the lock.  Since that scan is expensive, the
+ * bias is only restored by a slow reader after an interval proportional to
+ * the time the revocation took.
+ *
+ * A thread remembers which locks it holds through the table, so a read lock
+ * must be dropped by the thread that took it, as with any pthread rwlock.
+ */
+#define	RW_VR_SHIFT		12
+#define	RW_VR_SIZE		(1 << RW_VR_SHIFT)
+#define	RW_FAST_HELD_MAX	8	/* table read holds per thread */
+#define	RW_RBIAS_INHIBIT_MULT	9
+
+int zfs_rw_reader_bias = B_TRUE;
+
+static krwlock_t *volatile rw_visible_readers[RW_VR_SIZE];
+
+typedef struct rw_fast_hold {
+	krwlock_t	*rfh_lock;
+	uint_t		rfh_slot;
+} rw_fast_hold_t;
+
+static __thread rw_fast_hold_t rw_fast_held[RW_FAST_HELD_MAX];
+static __thread int rw_fast_nheld;
+
+static uint_t
+rw_vr_slot(krwlock_t *rwlp)
+{
+	uint64_t h = ((uintptr_t)rwlp ^ (uintptr_t)pthread_self()) *
+	    0x9E3779B97F4A7C15ULL;
+
+	return (h >> (64 - RW_VR_SHIFT));
+}
+
+static int
+rw_fast_find(krwlock_t *rwlp)
+{
+	int i;
+
+	for (i = 0; i < rw_fast_nheld; i++) {
+		if (rw_fast_held[i].rfh_lock == rwlp)
+			return (i);
+	}
+	return (-1);
+}
+
+static boolean_t
+rw_fast_enter(krwlock_t *rwlp)
+{
+	uint_t slot;
+
+	if (!rwlp->rw_rbias || rw_fast_nheld == RW_FAST_HELD_MAX)
+		return (B_FALSE);
+
+	slot = rw_vr_slot(rwlp);
+	if (atomic_cas_ptr(&rw_visible_readers[slot], NULL, rwlp) != NULL)
+		return (B_FALSE);
+
+	/* the publication above is a full barrier, so recheck the bias */
+	if (!rwlp->rw_rbias) {
+		(void) atomic_swap_ptr(&rw_visible_readers[slot], NULL);
+		return (B_FALSE);
+	}
+
+	rw_fast_held[rw_fast_nheld].rfh_lock = rwlp;
+	rw_fast_held[rw_fast_nheld].rfh_slot = slot;
+	rw_fast_nheld++;
+
+	return (B_TRUE);
+}
+
+static void
+rw_fast_exit(int i)
+{
+	(void) atomic_swap_ptr(&rw_visible_readers[rw_fast_held[i].rfh_slot],
+	    NULL);
+	rw_fast_held[i] = rw_fast_held[--rw_fast_nheld];
+}
+
+/*
+ * Called by a reader holding rw_lock, to set the bias once the interval
+ * after the last revocation has passed.
+ */
+static void
+rw_rbias_restore(krwlock_t *rwlp)
+{
+	if (zfs_rw_reader_bias && !rwlp->rw_rbias &&
+	    gethrtime() >= rwlp->rw_rbias_inhibit)
+		rwlp->rw_rbias = B_TRUE;
+}
+
+/*
+ * Called by a writer holding rw_lock.  Returns B_FALSE if the lock still
+ * has readers in the table and wait isn't set.
+ */
+static boolean_t
+rw_rbias_revoke(krwlock_t *rwlp, boolean_t wait)
+{
+	hrtime_t start, now;
+	int i;
+
+	if (!rwlp->rw_rbias)
+		return (B_TRUE);
+
+	(void) atomic_swap_uint(&rwlp->rw_rbias, B_FALSE);
+	start = gethrtime();
+	for (i = 0; i < RW_VR_SIZE; i++) {
+		while (rw_visible_readers[i] == rwlp) {
+			if (!wait) {
+				rwlp->rw_rbias_inhibit = gethrtime();
+				return (B_FALSE);
+			}
+			(void) sched_yield();
+		}
+	}
+	now = gethrtime();
+	rwlp->rw_rbias_inhibit = now + (now - start) * RW_RBIAS_INHIBIT_MULT;
+
+	return (B_TRUE);
+}
+
 void
 rw_init(krwlock_t *rwlp, char *name, int type, void *arg)
 {
@@ -532,14 +1442,37 @@ rw_init(krwlock_t *rwlp, char *name, int type, void *arg)
 	rwlp->rw_owner = RW_INIT;
 	rwlp->rw_wr_owner = RW_INIT;
 	rwlp->rw_readers = 0;
+	rwlp->rw_rbias = B_FALSE;
+	rwlp->rw_rbias_inhibit = 0;
+#ifdef ZFS_LOCKSTAT
+	rwlp->rw_site = NULL;
+#endif
 	rwlp->rw_magic = RW_MAGIC;
 }
 
+#ifdef ZFS_LOCKSTAT
+void
+rw_init_site(krwlock_t *rwlp, char *name, int type, void *arg,
+    lockstat_site_t *ls)
+{
+	rw_init(rwlp, name, type, arg);
+	lockstat_register(ls);
+	rwlp->rw_site = ls;
+}
+#endif
+
 void
 rw_destroy(krwlock_t *rwlp)
 {
 	ASSERT3U(rwlp->rw_magic, ==, RW_MAGIC);
 	ASSERT(rwlp->rw_readers == 0 && rwlp->rw_wr_owner == RW_INIT);
+	ASSERT3S(rw_fast_find(rwlp), ==, -1);
+
+	/* no reader may be left in the table pointing at freed memory */
+	VERIFY3S(pthread_rwlock_wrlock(&rwlp->rw_lock), ==, 0);
+	(void) rw_rbias_revoke(rwlp, B_TRUE);
+	VERIFY3S(pthread_rwlock_unlock(&rwlp->rw_lock), ==, 0);
+
 	VERIFY3S(pthread_rwlock_destroy(&rwlp->rw_lock), ==, 0);
 	rwlp->rw_magic = 0;
 }
@@ -547,36 +1480,61 @@ rw_destroy(krwlock_t *rwlp)
 void
 rw_enter(krwlock_t *rwlp, krw_t rw)
 {
+	hrtime_t wait_start = 0;
+
 	ASSERT3U(rwlp->rw_magic, ==, RW_MAGIC);
 	ASSERT3P(rwlp->rw_owner, !=, curthread);
 	ASSERT3P(rwlp->rw_wr_owner, !=, curthread);
 
 	if (rw == RW_READER) {
-		VERIFY3S(pthread_rwlock_rdlock(&rwlp->rw_lock), ==, 0);
+		if (rw_fast_enter(rwlp)) {
+			LOCKSTAT_RW_ACQUIRED(rwlp, rw, 0);
+			return;
+		}
+
+		if (pthread_rwlock_tryrdlock(&rwlp->rw_lock) != 0) {
+			wait_start = LOCKSTAT_NOW();
+			VERIFY3S(pthread_rwlock_rdlock(&rwlp->rw_lock), ==, 0);
+		}
 		ASSERT3P(rwlp->rw_wr_owner, ==, RW_INIT);
 
 		atomic_inc_uint(&rwlp->rw_readers);
+		rw_rbias_restore(rwlp);
 	} else {
-		VERIFY3S(pthread_rwlock_wrlock(&rwlp->rw_lock), ==, 0);
+		if (pthread_rwlock_trywrlock(&rwlp->rw_lock) != 0) {
+			wait_start = LOCKSTAT_NOW();
+			VERIFY3S(pthread_rwlock_wrlock(&rwlp->rw_lock), ==, 0);
+		}
 		ASSERT3P(rwlp->rw_wr_owner, ==, RW_INIT);
 		ASSERT3U(rwlp->rw_readers, ==, 0);
 
+		(void) rw_rbias_revoke(rwlp, B_TRUE);
 		rwlp->rw_wr_owner = curthread;
 	}
 
 	rwlp->rw_owner = curthread;
+	LOCKSTAT_RW_ACQUIRED(rwlp, rw, wait_start);
 }
 
 void
 rw_exit(krwlock_t *rwlp)
 {
+	int i;
+
 	ASSERT3U(rwlp->rw_magic, ==, RW_MAGIC);
 	ASSERT(RW_LOCK_HELD(rwlp));
 
-	if (RW_READ_HELD(rwlp))
-		atomic_dec_uint(&rwlp->rw_readers);
-	else
+	if ((i = rw_fast_find(rwlp)) != -1) {
+		rw_fast_exit(i);
+		return;
+	}
+
+	if (rwlp->rw_wr_owner == curthread) {
+		LOCKSTAT_RW_RELEASED(rwlp);
 		rwlp->rw_wr_owner = RW_INIT;
+	} else {
+		atomic_dec_uint(&rwlp->rw_readers);
+	}
 
 	rwlp->rw_owner = RW_INIT;
 	VERIFY3S(pthread_rwlock_unlock(&rwlp->rw_lock), ==, 0);
@@ -589,10 +1547,19 @@ rw_tryenter(krwlock_t *rwlp, krw_t rw)
 
 	ASSERT3U(rwlp->rw_magic, ==, RW_MAGIC);
 
-	if (rw == RW_READER)
+	if (rw == RW_READER) {
+		if (rw_fast_enter(rwlp)) {
+			LOCKSTAT_RW_ACQUIRED(rwlp, rw, 0);
+			return (1);
+		}
 		rv = pthread_rwlock_tryrdlock(&rwlp->rw_lock);
-	else
+	} else {
 		rv = pthread_rwlock_trywrlock(&rwlp->rw_lock);
+		if (rv == 0 && !rw_rbias_revoke(rwlp, B_FALSE)) {
+			VERIFY3S(pthread_rwlock_unlock(&rwlp->rw_lock), ==, 0);
+			rv = EBUSY;
+		}
+	}
 
 	if (rv == 0) {
 		ASSERT3P(rwlp->rw_wr_owner, ==, RW_INIT);
@@ -605,6 +1572,7 @@ rw_tryenter(krwlock_t *rwlp, krw_t rw)
 		}
 
 		rwlp->rw_owner = curthread;
+		LOCKSTAT_RW_ACQUIRED(rwlp, rw, 0);
 		return (1);
 	}
 
@@ -613,6 +1581,16 @@ rw_tryenter(krwlock_t *rwlp, krw_t rw)
 	return (0);
 }
 
+/*
+ * Whether the lock is held for read, by this thread if it took the lock
+ * through the table of visible readers, or by anyone otherwise.
+ */
+int
+rw_read_held(krwlock_t *rwlp)
+{
+	return (rwlp->rw_readers > 0 || rw_fast_find(rwlp) != -1);
+}
+
 int
 rw_tryupgrade(krwlock_t *rwlp)
 {
@@ -648,9 +1626,11 @@ cv_wait(kcondvar_t *cv, kmutex_t *mp)
 {
 	ASSERT3U(cv->cv_magic, ==, CV_MAGIC);
 	ASSERT3P(mutex_owner(mp), ==, curthread);
+	LOCKSTAT_MUTEX_RELEASED(mp);
 	mp->m_owner = MTX_INIT;
 	VERIFY0(pthread_cond_wait(&cv->cv, &mp->m_lock));
 	mp->m_owner = curthread;
+	LOCKSTAT_MUTEX_ACQUIRED(mp, 0);
 }
 
 clock_t
@@ -677,9 +1657,11 @@ cv_timedwait(kcondvar_t *cv, kmutex_t *mp, clock_t abstime)
 	}
 
 	ASSERT3P(mutex_owner(mp), ==, curthread);
+	LOCKSTAT_MUTEX_RELEASED(mp);
 	mp->m_owner = MTX_INIT;
 	error = pthread_cond_timedwait(&cv->cv, &mp->m_lock, &ts);
 	mp->m_owner = curthread;
+	LOCKSTAT_MUTEX_ACQUIRED(mp, 0);
 
 	if (error == ETIMEDOUT)
 		return (-1);
@@ -718,9 +1700,11 @@ cv_timedwait_hires(kcondvar_t *cv, kmutex_t *mp, hrtime_t tim, hrtime_t res,
 	}
 
 	ASSERT(mutex_owner(mp) == curthread);
+	LOCKSTAT_MUTEX_RELEASED(mp);
 	mp->m_owner = MTX_INIT;
 	error = pthread_cond_timedwait(&cv->cv, &mp->m_lock, &ts);
 	mp->m_owner = curthread;
+	LOCKSTAT_MUTEX_ACQUIRED(mp, 0);
 
 	if (error == ETIMEDOUT)
 		return (-1);
@@ -946,6 +1930,48 @@ vn_rdwr(int uio, vnode_t *vp, void *addr, ssize_t len, offset_t offset,
 	return (0);
 }
 
+/*
+ * Read into several buffers with a single system call, like vn_rdwr() with
+ * UIO_READ does into one.  As with a plain read(), the call may return
+ * before all the buffers are filled; *residp is the number of bytes left.
+ */
+int
+vn_readv(vnode_t *vp, const struct iovec *iov, int iovcnt, offset_t offset,
+    ssize_t *residp)
+{
+	struct stat stats;
+	ssize_t rc, len = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	/* the dump file is written one buffer at a time by vn_rdwr() */
+	if (vp->v_dump_fd != -1) {
+		ssize_t resid = 0;
+		int err = 0;
+
+		for (i = 0; i < iovcnt && err == 0 && resid == 0; i++) {
+			err = vn_rdwr(UIO_READ, vp, iov[i].iov_base,
+			    iov[i].iov_len, offset, 0, 0, 0, NULL, &resid);
+			offset += iov[i].iov_len - resid;
+			len -= iov[i].iov_len - resid;
+		}
+		*residp = len;
+		return (err);
+	}
+
+	if (fstat(vp->v_fd, &stats) == 0 && !S_ISSEEK(stats.st_mode))
+		rc = readv(vp->v_fd, iov, iovcnt);
+	else
+		rc = preadv(vp->v_fd, iov, iovcnt, offset);
+	if (rc == -1)
+		return (errno);
+
+	*residp = len - rc;
+	return (0);
+}
+
 void
 vn_close(vnode_t *vp)
 {
@@ -1505,27 +2531,262 @@ get_system_hostid(void)
 	return (system_hostid);
 }
 
+/*
+ * =========================================================================
+ * memory cgroup
+ * =========================================================================
+ *
+ * When we run inside a container the host's physical memory says little
+ * about how much we may use.  The memory cgroup we are charged to (v2 or
+ * v1, mounted at the usual place) provides the real limit, and for v2 a
+ * PSI trigger on memory.pressure tells us when the cgroup starts stalling
+ * on reclaim.  The monitor thread samples the limit and the free memory
+ * left under it, and counts pressure events, so that the ARC can size and
+ * shrink itself against the container instead of the host.
+ */
+#define	CGROUP_V2_DIR		"/sys/fs/cgroup/"
+#define	CGROUP_V1_DIR		"/sys/fs/cgroup/memory/"
+#define	CGROUP_MONITOR_MS	100
+
+uint64_t cgroup_mem_limit;	/* bytes, 0 when not limited */
+uint64_t cgroup_mem_free;	/* bytes left under cgroup_mem_limit */
+uint64_t cgroup_mem_pressure;	/* number of PSI events seen */
+
+static boolean_t cgroup_v2;
+static int cgroup_psi_fd = -1;
+static kmutex_t cgroup_monitor_lock;
+static kcondvar_t cgroup_monitor_cv;
+static boolean_t cgroup_monitor_running;
+static boolean_t cgroup_monitor_exit;
+
+/*
+ * Read a single value from a cgroup control file.  Returns 0 when the
+ * file is missing or the value is "max" (v2's way of saying unlimited).
+ */
+static uint64_t
+cgroup_read_value(const char *dir, const char *name)
+{
+	char path[MAXNAMELEN];
+	uint64_t value = 0;
+	FILE *f;
+
+	(void) snprintf(path, sizeof (path), "%s%s", dir, name);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return (0);
+	if (fscanf(f, "%lu", &value) != 1)
+		value = 0;
+	fclose(f);
+
+	return (value);
+}
+
+/*
+ * Look up a key in a cgroup memory.stat file.
+ */
+static uint64_t
+cgroup_read_stat(const char *dir, const char *key)
+{
+	char path[MAXNAMELEN];
+	char name[64];
+	uint64_t value;
+	FILE *f;
+
+	(void) snprintf(path, sizeof (path), "%smemory.stat", dir);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return (0);
+	while (fscanf(f, "%63s %lu", name, &value) == 2) {
+		if (strcmp(name, key) == 0) {
+			fclose(f);
+			return (value);
+		}
+	}
+	fclose(f);
+
+	return (0);
+}
+
+/*
+ * Return the memory limit of our cgroup in bytes, or 0 if there is none.
+ * A v1 cgroup without a limit reports a huge value, so anything at or
+ * above the host's memory is treated as unlimited.
+ */
+static uint64_t
+cgroup_limit_read(void)
+{
+	uint64_t limit, host;
+
+	if (cgroup_v2)
+		limit = cgroup_read_value(CGROUP_V2_DIR, "memory.max");
+	else
+		limit = cgroup_read_value(CGROUP_V1_DIR,
+		    "memory.limit_in_bytes");
+
+	host = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
+	if (limit >= host)
+		limit = 0;
+
+	return (limit);
+}
+
+/*
+ * Refresh cgroup_mem_limit and cgroup_mem_free.  Inactive file pages are
+ * charged to the cgroup but are the first thing reclaim takes, so they
+ * count as free, the same way arc_free_memory() counts them in the kernel.
+ */
+static void
+cgroup_mem_update(void)
+{
+	uint64_t limit, used, inactive;
+
+	limit = cgroup_limit_read();
+	if (cgroup_v2) {
+		used = cgroup_read_value(CGROUP_V2_DIR, "memory.current");
+		inactive = cgroup_read_stat(CGROUP_V2_DIR, "inactive_file");
+	} else {
+		used = cgroup_read_value(CGROUP_V1_DIR,
+		    "memory.usage_in_bytes");
+		inactive = cgroup_read_stat(CGROUP_V1_DIR,
+		    "total_inactive_file");
+	}
+	used -= MIN(used, inactive);
+
+	cgroup_mem_limit = limit;
+	cgroup_mem_free = (limit > used) ? limit - used : 0;
+}
+
+/*
+ * Arm a PSI trigger firing when tasks in the cgroup stall on memory for
+ * stall_us within any window_us.  Only available for v2.
+ */
+static int
+cgroup_psi_open(uint64_t stall_us, uint64_t window_us)
+{
+	char trigger[64];
+	int fd, len;
+
+	if (!cgroup_v2 || stall_us == 0 || window_us == 0)
+		return (-1);
+
+	fd = open(CGROUP_V2_DIR "memory.pressure", O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		return (-1);
+
+	len = snprintf(trigger, sizeof (trigger), "some %lu %lu",
+	    stall_us, window_us);
+	if (write(fd, trigger, len + 1) < 0) {
+		close(fd);
+		return (-1);
+	}
+
+	return (fd);
+}
+
+static void
+cgroup_monitor_thread(void *arg)
+{
+	struct pollfd pfd;
+
+	pfd.fd = cgroup_psi_fd;
+	pfd.events = POLLPRI;
+
+	mutex_enter(&cgroup_monitor_lock);
+	while (!cgroup_monitor_exit) {
+		mutex_exit(&cgroup_monitor_lock);
+
+		pfd.revents = 0;
+		if (poll(&pfd, pfd.fd >= 0 ? 1 : 0, CGROUP_MONITOR_MS) > 0) {
+			if (pfd.revents & POLLPRI)
+				atomic_inc_64(&cgroup_mem_pressure);
+			/* The cgroup went away; stop watching it. */
+			if (pfd.revents & POLLERR)
+				pfd.fd = -1;
+		}
+		cgroup_mem_update();
+
+		mutex_enter(&cgroup_monitor_lock);
+	}
+
+	cgroup_monitor_exit = B_FALSE;
+	cv_broadcast(&cgroup_monitor_cv);
+	mutex_exit(&cgroup_monitor_lock);
+	thread_exit();
+}
+
+/*
+ * Start sampling the memory cgroup, with a PSI trigger of the given
+ * stall and window if the cgroup supports one.  Returns B_FALSE when we
+ * are not running under a memory limit, in which case nothing is started.
+ */
+boolean_t
+cgroup_mem_monitor_init(uint64_t stall_us, uint64_t window_us)
+{
+	cgroup_mem_update();
+	if (cgroup_mem_limit == 0)
+		return (B_FALSE);
+
+	mutex_init(&cgroup_monitor_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&cgroup_monitor_cv, NULL, CV_DEFAULT, NULL);
+	cgroup_psi_fd = cgroup_psi_open(stall_us, window_us);
+	cgroup_monitor_exit = B_FALSE;
+	cgroup_monitor_running = B_TRUE;
+	(void) thread_create(NULL, 0, cgroup_monitor_thread, NULL, 0, &p0,
+	    TS_RUN, defclsyspri);
+
+	return (B_TRUE);
+}
+
+void
+cgroup_mem_monitor_fini(void)
+{
+	if (!cgroup_monitor_running)
+		return;
+
+	mutex_enter(&cgroup_monitor_lock);
+	cgroup_monitor_exit = B_TRUE;
+	while (cgroup_monitor_exit)
+		cv_wait(&cgroup_monitor_cv, &cgroup_monitor_lock);
+	mutex_exit(&cgroup_monitor_lock);
+
+	if (cgroup_psi_fd >= 0) {
+		close(cgroup_psi_fd);
+		cgroup_psi_fd = -1;
+	}
+	cv_destroy(&cgroup_monitor_cv);
+	mutex_destroy(&cgroup_monitor_lock);
+	cgroup_monitor_running = B_FALSE;
+}
+
+/*
+ * Count the CPUs once, when the library is loaded, rather than calling
+ * sysconf() on every use of boot_ncpus and CPU_SEQID.  This is done
+ * before kernel_init() as libzfs creates taskqs without it.
+ */
+__attribute__((constructor)) static void
+boot_ncpus_init(void)
+{
+	boot_ncpus = MAX(MIN(sysconf(_SC_NPROCESSORS_ONLN), max_ncpus), 1);
+}
+
 void
 kernel_init(int mode)
 {
 	extern uint_t rrw_tsd_key;
 	uint64_t cgroupmem;
-	FILE *f;
 
 	umem_nofail_callback(umem_out_of_memory);
 
 	physmem = sysconf(_SC_PHYS_PAGES);
 
-	/* If we run inside a container get the cgroup mem limit */
-	f = fopen("/sys/fs/cgroup/memory/memory.limit_in_bytes", "r");
-	if (f != NULL) {
-		if (fscanf(f, "%lu", &cgroupmem) == 1) {
-			cgroupmem /= sysconf(_SC_PAGE_SIZE);
-			if (physmem > cgroupmem)
-				physmem = cgroupmem;
-		}
-		fclose(f);
-	}
+	/*
+	 * If we run inside a container get the cgroup mem limit.  The
+	 * unified (v2) hierarchy is recognised by its cgroup.controllers.
+	 */
+	cgroup_v2 = (access(CGROUP_V2_DIR "cgroup.controllers", F_OK) == 0);
+	cgroupmem = cgroup_limit_read() / sysconf(_SC_PAGE_SIZE);
+	if (cgroupmem != 0 && physmem > cgroupmem)
+		physmem = cgroupmem;
 
 	fprintf(stderr, "physmem = %lu pages (%.2f GB)\n", physmem,
 	    (double)physmem * sysconf(_SC_PAGE_SIZE) / (1ULL << 30));
@@ -1535,6 +2796,7 @@ kernel_init(int mode)
 
 	random_init();
 	kstat_nvl = fnvlist_alloc();
+	mutex_stats_init();
 	VERIFY0(uname(&hw_utsname));
 #ifdef  _UZFS
 	mutex_init(&zvol_list_mutex, NULL, MUTEX_DEFAULT, NULL);
@@ -1559,6 +2821,7 @@ kernel_fini(void)
 	system_taskq_fini();
 	thread_fini();
 	random_fini();
+	mutex_stats_fini();
 	fnvlist_free(kstat_nvl);
 #ifdef  _UZFS
 	mutex_destroy(&zvol_list_mutex);
@@ -30,79 +30,246 @@
 
 #include <sys/zfs_context.h>
 #include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <time.h>
 
 int taskq_now;
 taskq_t *system_taskq;
 taskq_t *system_delay_taskq;
 
 #define	TASKQ_ACTIVE	0x00010000
-#define	TASKQ_WAITING	0x00020000
+
+/*
+ * Every thread of a taskq serves its own queue.  A dispatch from one of
+ * them goes to its own queue, any other dispatch to the next queue in
+ * turn, and a thread whose queue is empty steals from the others.  The
+ * queue locks are hardly ever contended, and idle threads sleep on the
+ * tq_seq futex, which a dispatch only needs to wake if tq_idle is set.
+ *
+ * A TASKQ_DYNAMIC taskq starts with one thread, and the nthreads given
+ * to taskq_create() only sizes tq_workers.  A dispatch that finds no idle
+ * thread and more tasks pending than threads starts the next one, and a
+ * thread idle for taskq_dynamic_idle_ms exits if it is the last one.  The
+ * threads past the first of all dynamic taskqs together are capped by
+ * taskq_dynamic_budget, 0 meaning no cap, so that busy taskqs get threads
+ * that idle ones gave back.  Threads are only started and retired at the
+ * top of tq_workers, and since a retired thread may leave tasks behind in
+ * its queue, taskq_take() scans the queues of all tq_maxthreads workers.
+ */
+typedef struct taskq_worker {
+	kmutex_t	tqw_lock;
+	taskq_ent_t	tqw_task;	/* queue head */
+	taskq_ent_t	*tqw_freelist;
+	taskq_t		*tqw_tq;
+} taskq_worker_t;
+
+static __thread taskq_worker_t *taskq_self;
+
+int taskq_dynamic_budget = 0;
+int taskq_dynamic_idle_ms = 1000;
+static volatile uint32_t taskq_dynamic_nthreads;
+
+static int
+taskq_futex(volatile uint32_t *addr, int op, uint32_t val,
+    const struct timespec *timeout)
+{
+	return (syscall(SYS_futex, addr, op, val, timeout, NULL, 0));
+}
+
+static void taskq_thread(void *arg);
+
+/*
+ * Start the next thread of a dynamic taskq, unless it has all of them
+ * already or the node-wide budget is used up.
+ */
+static void
+taskq_grow(taskq_t *tq)
+{
+	int t;
+
+	mutex_enter(&tq->tq_lock);
+	if (!(tq->tq_flags & TASKQ_ACTIVE) ||
+	    (t = tq->tq_nthreads) == tq->tq_maxthreads) {
+		mutex_exit(&tq->tq_lock);
+		return;
+	}
+	if (atomic_inc_32_nv(&taskq_dynamic_nthreads) >
+	    taskq_dynamic_budget && taskq_dynamic_budget != 0) {
+		atomic_dec_32(&taskq_dynamic_nthreads);
+		mutex_exit(&tq->tq_lock);
+		return;
+	}
+	tq->tq_nthreads++;
+	VERIFY((tq->tq_threadlist[t] = thread_create(NULL, 0, taskq_thread,
+	    &tq->tq_workers[t], 0, &p0, TS_RUN, tq->tq_pri)) != NULL);
+	mutex_exit(&tq->tq_lock);
+}
+
+/*
+ * Called by a thread of a dynamic taskq that has been idle for
+ * taskq_dynamic_idle_ms.  Only the last thread may go, and not the first.
+ */
+static boolean_t
+taskq_shrink(taskq_t *tq, taskq_worker_t *tqw)
+{
+	boolean_t retire;
+
+	mutex_enter(&tq->tq_lock);
+	retire = (tq->tq_flags & TASKQ_ACTIVE) && tq->tq_nthreads > 1 &&
+	    tqw == &tq->tq_workers[tq->tq_nthreads - 1];
+	if (retire) {
+		tq->tq_nthreads--;
+		atomic_dec_32(&taskq_dynamic_nthreads);
+	}
+	mutex_exit(&tq->tq_lock);
+
+	/* A dispatch may have raced in; hand it to an idle thread */
+	if (retire && tqw->tqw_task.tqent_next != &tqw->tqw_task) {
+		atomic_inc_32(&tq->tq_seq);
+		taskq_futex(&tq->tq_seq, FUTEX_WAKE_PRIVATE, 1, NULL);
+	}
+
+	return (retire);
+}
+
+static taskq_worker_t *
+taskq_pick(taskq_t *tq)
+{
+	if (taskq_self != NULL && taskq_self->tqw_tq == tq)
+		return (taskq_self);
+
+	return (&tq->tq_workers[atomic_inc_32_nv(&tq->tq_rotor) %
+	    tq->tq_nthreads]);
+}
 
 static taskq_ent_t *
-task_alloc(taskq_t *tq, int tqflags)
+task_freelist_pop(taskq_worker_t *tqw)
 {
 	taskq_ent_t *t;
-	int rv;
 
-again:	if ((t = tq->tq_freelist) != NULL && tq->tq_nalloc >= tq->tq_minalloc) {
+	mutex_enter(&tqw->tqw_lock);
+	if ((t = tqw->tqw_freelist) != NULL)
+		tqw->tqw_freelist = t->tqent_next;
+	mutex_exit(&tqw->tqw_lock);
+
+	return (t);
+}
+
+static taskq_ent_t *
+task_alloc(taskq_t *tq, taskq_worker_t *tqw, int tqflags)
+{
+	taskq_ent_t *t;
+	int i, rv;
+
+again:	if ((t = task_freelist_pop(tqw)) != NULL) {
 		ASSERT(!(t->tqent_flags & TQENT_FLAG_PREALLOC));
-		tq->tq_freelist = t->tqent_next;
-	} else {
-		if (tq->tq_nalloc >= tq->tq_maxalloc) {
-			if (!(tqflags & KM_SLEEP))
-				return (NULL);
-
-			/*
-			 * We don't want to exceed tq_maxalloc, but we can't
-			 * wait for other tasks to complete (and thus free up
-			 * task structures) without risking deadlock with
-			 * the caller.  So, we just delay for one second
-			 * to throttle the allocation rate. If we have tasks
-			 * complete before one second timeout expires then
-			 * taskq_ent_free will signal us and we will
-			 * immediately retry the allocation.
-			 */
-			tq->tq_maxalloc_wait++;
-			rv = cv_timedwait(&tq->tq_maxalloc_cv,
-			    &tq->tq_lock, ddi_get_lbolt() + hz);
-			tq->tq_maxalloc_wait--;
-			if (rv > 0)
-				goto again;		/* signaled */
-		}
-		mutex_exit(&tq->tq_lock);
+		return (t);
+	}
 
-		t = kmem_alloc(sizeof (taskq_ent_t), tqflags);
+	if (atomic_inc_32_nv(&tq->tq_nalloc) > tq->tq_maxalloc) {
+		atomic_dec_32(&tq->tq_nalloc);
 
-		mutex_enter(&tq->tq_lock);
-		if (t != NULL) {
-			/* Make sure we start without any flags */
-			t->tqent_flags = 0;
-			tq->tq_nalloc++;
+		/* Free entries may be parked on the other threads */
+		for (i = 0; i < tq->tq_maxthreads; i++) {
+			if ((t = task_freelist_pop(&tq->tq_workers[i])) != NULL)
+				return (t);
 		}
+
+		if (!(tqflags & KM_SLEEP))
+			return (NULL);
+
+		/*
+		 * We don't want to exceed tq_maxalloc, but we can't
+		 * wait for other tasks to complete (and thus free up
+		 * task structures) without risking deadlock with
+		 * the caller.  So, we just delay for one second
+		 * to throttle the allocation rate. If we have tasks
+		 * complete before one second timeout expires then
+		 * task_free will signal us and we will immediately
+		 * retry the allocation.
+		 */
+		mutex_enter(&tq->tq_lock);
+		tq->tq_maxalloc_wait++;
+		rv = cv_timedwait(&tq->tq_maxalloc_cv,
+		    &tq->tq_lock, ddi_get_lbolt() + hz);
+		tq->tq_maxalloc_wait--;
+		mutex_exit(&tq->tq_lock);
+		if (rv > 0)
+			goto again;		/* signaled */
+		atomic_inc_32(&tq->tq_nalloc);
 	}
+
+	t = kmem_alloc(sizeof (taskq_ent_t), tqflags);
+	if (t == NULL) {
+		atomic_dec_32(&tq->tq_nalloc);
+		return (NULL);
+	}
+	/* Make sure we start without any flags */
+	t->tqent_flags = 0;
+
 	return (t);
 }
 
 static void
-task_free(taskq_t *tq, taskq_ent_t *t)
+task_free(taskq_t *tq, taskq_worker_t *tqw, taskq_ent_t *t)
 {
 	if (tq->tq_nalloc <= tq->tq_minalloc) {
-		t->tqent_next = tq->tq_freelist;
-		tq->tq_freelist = t;
+		mutex_enter(&tqw->tqw_lock);
+		t->tqent_next = tqw->tqw_freelist;
+		tqw->tqw_freelist = t;
+		mutex_exit(&tqw->tqw_lock);
 	} else {
-		tq->tq_nalloc--;
-		mutex_exit(&tq->tq_lock);
+		atomic_dec_32(&tq->tq_nalloc);
 		kmem_free(t, sizeof (taskq_ent_t));
-		mutex_enter(&tq->tq_lock);
 	}
 
-	if (tq->tq_maxalloc_wait)
+	if (tq->tq_maxalloc_wait) {
+		mutex_enter(&tq->tq_lock);
 		cv_signal(&tq->tq_maxalloc_cv);
+		mutex_exit(&tq->tq_lock);
+	}
+}
+
+static void
+taskq_enqueue(taskq_t *tq, taskq_worker_t *tqw, taskq_ent_t *t,
+    task_func_t func, void *arg, uint_t tqflags)
+{
+	atomic_inc_64(&tq->tq_pending);
+
+	mutex_enter(&tqw->tqw_lock);
+	if (tqflags & TQ_FRONT) {
+		t->tqent_next = tqw->tqw_task.tqent_next;
+		t->tqent_prev = &tqw->tqw_task;
+	} else {
+		t->tqent_next = &tqw->tqw_task;
+		t->tqent_prev = tqw->tqw_task.tqent_prev;
+	}
+	t->tqent_next->tqent_prev = t;
+	t->tqent_prev->tqent_next = t;
+	t->tqent_func = func;
+	t->tqent_arg = arg;
+	mutex_exit(&tqw->tqw_lock);
+
+	/*
+	 * Bumping tq_seq before looking at tq_idle pairs with the other
+	 * order in taskq_thread(), so that a thread going to sleep either
+	 * sees the new tq_seq or gets woken.
+	 */
+	atomic_inc_32(&tq->tq_seq);
+	if (tq->tq_idle != 0)
+		taskq_futex(&tq->tq_seq, FUTEX_WAKE_PRIVATE, 1, NULL);
+	else if ((tq->tq_flags & TASKQ_DYNAMIC) &&
+	    tq->tq_nthreads < tq->tq_maxthreads &&
+	    tq->tq_pending > tq->tq_nthreads)
+		taskq_grow(tq);
 }
 
 taskqid_t
 taskq_dispatch(taskq_t *tq, task_func_t func, void *arg, uint_t tqflags)
 {
+	taskq_worker_t *tqw;
 	taskq_ent_t *t;
 
 	if (taskq_now) {
@@ -110,27 +277,12 @@ taskq_dispatch(taskq_t *tq, task_func_t func, void *arg, uint_t tqflags)
 		return (1);
 	}
 
-	mutex_enter(&tq->tq_lock);
 	ASSERT(tq->tq_flags & TASKQ_ACTIVE);
-	if ((t = task_alloc(tq, tqflags)) == NULL) {
-		mutex_exit(&tq->tq_lock);
+	tqw = taskq_pick(tq);
+	if ((t = task_alloc(tq, tqw, tqflags)) == NULL)
 		return (0);
-	}
-	if (tqflags & TQ_FRONT) {
-		t->tqent_next = tq->tq_task.tqent_next;
-		t->tqent_prev = &tq->tq_task;
-	} else {
-		t->tqent_next = &tq->tq_task;
-		t->tqent_prev = tq->tq_task.tqent_prev;
-	}
-	t->tqent_next->tqent_prev = t;
-	t->tqent_prev->tqent_next = t;
-	t->tqent_func = func;
-	t->tqent_arg = arg;
 	t->tqent_flags = 0;
-	if (tq->tq_active < tq->tq_nthreads)
-		cv_signal(&tq->tq_dispatch_cv);
-	mutex_exit(&tq->tq_lock);
+	taskq_enqueue(tq, tqw, t, func, arg, tqflags);
 	return (1);
 }
 
@@ -171,33 +323,17 @@ taskq_dispatch_ent(taskq_t *tq, task_func_t func, void *arg, uint_t flags,
 	/*
 	 * Enqueue the task to the underlying queue.
 	 */
-	mutex_enter(&tq->tq_lock);
-
-	if (flags & TQ_FRONT) {
-		t->tqent_next = tq->tq_task.tqent_next;
-		t->tqent_prev = &tq->tq_task;
-	} else {
-		t->tqent_next = &tq->tq_task;
-		t->tqent_prev = tq->tq_task.tqent_prev;
-	}
-	t->tqent_next->tqent_prev = t;
-	t->tqent_prev->tqent_next = t;
-	t->tqent_func = func;
-	t->tqent_arg = arg;
-	if (tq->tq_active < tq->tq_nthreads)
-		cv_signal(&tq->tq_dispatch_cv);
-	mutex_exit(&tq->tq_lock);
+	taskq_enqueue(tq, taskq_pick(tq), t, func, arg, flags);
 }
 
 void
 taskq_wait(taskq_t *tq)
 {
 	mutex_enter(&tq->tq_lock);
-	while (tq->tq_task.tqent_next != &tq->tq_task || tq->tq_active != 0) {
-		tq->tq_flags |= TASKQ_WAITING;
+	atomic_inc_32(&tq->tq_waiters);
+	while (tq->tq_pending != 0)
 		cv_wait(&tq->tq_wait_cv, &tq->tq_lock);
-		tq->tq_flags &= ~TASKQ_WAITING;
-	}
+	atomic_dec_32(&tq->tq_waiters);
 	mutex_exit(&tq->tq_lock);
 }
 
@@ -216,50 +352,104 @@ taskq_wait_outstanding(taskq_t *tq, taskqid_t id)
 int
 taskq_check_active_ios(taskq_t *tq)
 {
-	int ret = 0;
+	return (tq->tq_pending != 0);
+}
+
+/*
+ * Take the first task of tqw's queue, or failing that of another queue.
+ */
+static taskq_ent_t *
+taskq_take(taskq_t *tq, taskq_worker_t *tqw)
+{
+	taskq_worker_t *victim;
 	taskq_ent_t *t;
-	mutex_enter(&tq->tq_lock);
-	if (((t = tq->tq_task.tqent_next) != &tq->tq_task) ||
-	    (tq->tq_active != 0))
-		ret = 1;
-	mutex_exit(&tq->tq_lock);
-	return (ret);
+	int i;
+
+	for (i = 0; i < tq->tq_maxthreads; i++) {
+		victim = &tq->tq_workers[(tqw - tq->tq_workers + i) %
+		    tq->tq_maxthreads];
+		if (victim->tqw_task.tqent_next == &victim->tqw_task)
+			continue;
+
+		mutex_enter(&victim->tqw_lock);
+		if ((t = victim->tqw_task.tqent_next) != &victim->tqw_task) {
+			t->tqent_prev->tqent_next = t->tqent_next;
+			t->tqent_next->tqent_prev = t->tqent_prev;
+			t->tqent_next = NULL;
+			t->tqent_prev = NULL;
+			mutex_exit(&victim->tqw_lock);
+			return (t);
+		}
+		mutex_exit(&victim->tqw_lock);
+	}
+
+	return (NULL);
 }
 
 static void
 taskq_thread(void *arg)
 {
-	taskq_t *tq = arg;
+	taskq_worker_t *tqw = arg;
+	taskq_t *tq = tqw->tqw_tq;
 	taskq_ent_t *t;
 	boolean_t prealloc;
+	uint32_t seq;
+	struct timespec idle, *timeout = NULL;
+	int rv;
 
-	prctl(PR_SET_NAME, tq->tq_name, 0, 0, 0);
+	if (tq->tq_flags & TASKQ_DYNAMIC) {
+		idle.tv_sec = taskq_dynamic_idle_ms / MILLISEC;
+		idle.tv_nsec = (taskq_dynamic_idle_ms % MILLISEC) *
+		    (NANOSEC / MILLISEC);
+		timeout = &idle;
+	}
 
-	mutex_enter(&tq->tq_lock);
-	while (tq->tq_flags & TASKQ_ACTIVE) {
-		if ((t = tq->tq_task.tqent_next) == &tq->tq_task) {
-			if (--tq->tq_active == 0)
-				if (tq->tq_flags & TASKQ_WAITING)
-					cv_broadcast(&tq->tq_wait_cv);
-			cv_wait(&tq->tq_dispatch_cv, &tq->tq_lock);
-			tq->tq_active++;
+	prctl(PR_SET_NAME, tq->tq_name, 0, 0, 0);
+	(void) zk_thread_set_affinity(tq->tq_name);
+	taskq_self = tqw;
+
+	for (;;) {
+		seq = tq->tq_seq;
+		membar_consumer();
+
+		if ((t = taskq_take(tq, tqw)) == NULL) {
+			if (!(tq->tq_flags & TASKQ_ACTIVE))
+				break;
+			atomic_inc_32(&tq->tq_idle);
+			rv = 0;
+			if (tq->tq_seq == seq && (tq->tq_flags & TASKQ_ACTIVE))
+				rv = taskq_futex(&tq->tq_seq,
+				    FUTEX_WAIT_PRIVATE, seq, timeout);
+			atomic_dec_32(&tq->tq_idle);
+			if (rv == -1 && errno == ETIMEDOUT &&
+			    taskq_shrink(tq, tqw)) {
+				taskq_self = NULL;
+				thread_exit();
+			}
 			continue;
 		}
-		t->tqent_prev->tqent_next = t->tqent_next;
-		t->tqent_next->tqent_prev = t->tqent_prev;
-		t->tqent_next = NULL;
-		t->tqent_prev = NULL;
+
 		prealloc = t->tqent_flags & TQENT_FLAG_PREALLOC;
-		mutex_exit(&tq->tq_lock);
 
 		rw_enter(&tq->tq_threadlock, RW_READER);
 		t->tqent_func(t->tqent_arg);
 		rw_exit(&tq->tq_threadlock);
 
-		mutex_enter(&tq->tq_lock);
 		if (!prealloc)
-			task_free(tq, t);
+			task_free(tq, tqw, t);
+
+		if (atomic_dec_64_nv(&tq->tq_pending) == 0 &&
+		    tq->tq_waiters != 0) {
+			mutex_enter(&tq->tq_lock);
+			cv_broadcast(&tq->tq_wait_cv);
+			mutex_exit(&tq->tq_lock);
+		}
 	}
+
+	taskq_self = NULL;
+	mutex_enter(&tq->tq_lock);
+	if ((tq->tq_flags & TASKQ_DYNAMIC) && tqw != tq->tq_workers)
+		atomic_dec_32(&taskq_dynamic_nthreads);
 	tq->tq_nthreads--;
 	cv_broadcast(&tq->tq_wait_cv);
 	mutex_exit(&tq->tq_lock);
@@ -272,7 +462,7 @@ taskq_create(const char *name, int nthreads, pri_t pri,
     int minalloc, int maxalloc, uint_t flags)
 {
 	taskq_t *tq = kmem_zalloc(sizeof (taskq_t), KM_SLEEP);
-	int t;
+	int maxthreads, t;
 
 	if (flags & TASKQ_THREADS_CPU_PCT) {
 		int pct;
@@ -286,33 +476,46 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 	} else {
 		ASSERT3S(nthreads, >=, 1);
 	}
+	maxthreads = nthreads;
+	if (flags & TASKQ_DYNAMIC)
+		nthreads = 1;
 
 	rw_init(&tq->tq_threadlock, NULL, RW_DEFAULT, NULL);
 	mutex_init(&tq->tq_lock, NULL, MUTEX_DEFAULT, NULL);
-	cv_init(&tq->tq_dispatch_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&tq->tq_wait_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&tq->tq_maxalloc_cv, NULL, CV_DEFAULT, NULL);
 	(void) strncpy(tq->tq_name, name, TASKQ_NAMELEN);
 	tq->tq_flags = flags | TASKQ_ACTIVE;
-	tq->tq_active = nthreads;
 	tq->tq_nthreads = nthreads;
+	tq->tq_maxthreads = maxthreads;
+	tq->tq_pri = pri;
 	tq->tq_minalloc = minalloc;
 	tq->tq_maxalloc = maxalloc;
-	tq->tq_task.tqent_next = &tq->tq_task;
-	tq->tq_task.tqent_prev = &tq->tq_task;
-	tq->tq_threadlist = kmem_alloc(nthreads * sizeof (kthread_t *),
+	tq->tq_threadlist = kmem_zalloc(maxthreads * sizeof (kthread_t *),
 	    KM_SLEEP);
+	tq->tq_workers = kmem_zalloc(maxthreads * sizeof (taskq_worker_t),
+	    KM_SLEEP);
+	for (t = 0; t < maxthreads; t++) {
+		taskq_worker_t *tqw = &tq->tq_workers[t];
+
+		mutex_init(&tqw->tqw_lock, NULL, MUTEX_DEFAULT, NULL);
+		tqw->tqw_task.tqent_next = &tqw->tqw_task;
+		tqw->tqw_task.tqent_prev = &tqw->tqw_task;
+		tqw->tqw_tq = tq;
+	}
 
 	if (flags & TASKQ_PREPOPULATE) {
-		mutex_enter(&tq->tq_lock);
-		while (minalloc-- > 0)
-			task_free(tq, task_alloc(tq, KM_SLEEP));
-		mutex_exit(&tq->tq_lock);
+		for (t = 0; t < minalloc; t++) {
+			taskq_worker_t *tqw = &tq->tq_workers[t % maxthreads];
+
+			task_free(tq, tqw, task_alloc(tq, tqw, KM_SLEEP));
+		}
 	}
 
 	for (t = 0; t < nthreads; t++)
 		VERIFY((tq->tq_threadlist[t] = thread_create(NULL, 0,
-		    taskq_thread, tq, 0, &p0, TS_RUN, pri)) != NULL);
+		    taskq_thread, &tq->tq_workers[t], 0, &p0, TS_RUN,
+		    pri)) != NULL);
 
 	return (tq);
 }
@@ -320,31 +523,39 @@ taskq_create(const char *name, int nthreads, pri_t pri,
 void
 taskq_destroy(taskq_t *tq)
 {
-	int nthreads = tq->tq_nthreads;
+	int nthreads = tq->tq_maxthreads;
+	int t;
 
 	taskq_wait(tq);
 
 	mutex_enter(&tq->tq_lock);
 
 	tq->tq_flags &= ~TASKQ_ACTIVE;
-	cv_broadcast(&tq->tq_dispatch_cv);
+	atomic_inc_32(&tq->tq_seq);
+	taskq_futex(&tq->tq_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
 
 	while (tq->tq_nthreads != 0)
 		cv_wait(&tq->tq_wait_cv, &tq->tq_lock);
 
-	tq->tq_minalloc = 0;
-	while (tq->tq_nalloc != 0) {
-		ASSERT(tq->tq_freelist != NULL);
-		task_free(tq, task_alloc(tq, KM_SLEEP));
-	}
-
 	mutex_exit(&tq->tq_lock);
 
+	for (t = 0; t < nthreads; t++) {
+		taskq_worker_t *tqw = &tq->tq_workers[t];
+		taskq_ent_t *ent;
+
+		while ((ent = task_freelist_pop(tqw)) != NULL) {
+			kmem_free(ent, sizeof (taskq_ent_t));
+			atomic_dec_32(&tq->tq_nalloc);
+		}
+		mutex_destroy(&tqw->tqw_lock);
+	}
+	ASSERT0(tq->tq_nalloc);
+
+	kmem_free(tq->tq_workers, nthreads * sizeof (taskq_worker_t));
 	kmem_free(tq->tq_threadlist, nthreads * sizeof (kthread_t *));
 
 	rw_destroy(&tq->tq_threadlock);
 	mutex_destroy(&tq->tq_lock);
-	cv_destroy(&tq->tq_dispatch_cv);
 	cv_destroy(&tq->tq_wait_cv);
 	cv_destroy(&tq->tq_maxalloc_cv);
 
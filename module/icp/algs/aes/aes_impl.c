@@ -1573,9 +1573,9 @@ aes_alloc_keysched(size_t *size, int kmflag)
 #define	INTEL_AESNI_FLAG (1 << 25)
 
 /*
- * Return 1 if executing on Intel with AES-NI instructions,
- * otherwise 0 (i.e., Intel without AES-NI or AMD64).
- * Cache the result, as the CPU can't change.
+ * Return 1 if executing on a CPU with the AES-NI instructions, otherwise
+ * 0.  The feature bit is the same on Intel and AMD, so the vendor is not
+ * looked at.  Cache the result, as the CPU can't change.
  */
 static int
 intel_aes_instructions_present(void)
@@ -1585,31 +1585,16 @@ intel_aes_instructions_present(void)
 	unsigned func, subfunc;
 
 	if (cached_result == -1) { /* first time */
-		/* check for an intel cpu */
-		func = 0;
+		func = 1;
 		subfunc = 0;
 
+		/* check for aes-ni instruction set */
 		__asm__ __volatile__(
 		    "cpuid"
 		    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
 		    : "a"(func), "c"(subfunc));
 
-		if (memcmp((char *)(&ebx), "Genu", 4) == 0 &&
-		    memcmp((char *)(&edx), "ineI", 4) == 0 &&
-		    memcmp((char *)(&ecx), "ntel", 4) == 0) {
-			func = 1;
-			subfunc = 0;
-
-			/* check for aes-ni instruction set */
-			__asm__ __volatile__(
-			    "cpuid"
-			    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
-			    : "a"(func), "c"(subfunc));
-
-			cached_result = !!(ecx & INTEL_AESNI_FLAG);
-		} else {
-			cached_result = 0;
-		}
+		cached_result = !!(ecx & INTEL_AESNI_FLAG);
 	}
 
 	return (cached_result);
@@ -0,0 +1,340 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * BLAKE3 hashes its input as a binary tree of 1KiB chunks.  Chunks are
+ * compressed a 64 byte block at a time; the chaining values of finished
+ * chunks are kept on a stack and merged into parent nodes as soon as it is
+ * certain they are not the root.  Whole chunks that are not the last of the
+ * input are independent of each other, so they are handed to the selected
+ * implementation to hash as many at once as it has vector lanes.
+ */
+
+#include <blake3/blake3_impl.h>
+
+typedef struct blake3_output {
+	uint32_t	cv[8];
+	uint8_t		block[BLAKE3_BLOCK_LEN];
+	uint64_t	counter;
+	uint8_t		block_len;
+	uint8_t		flags;
+} blake3_output_t;
+
+static void
+chunk_state_init(blake3_chunk_state_t *cs, const uint32_t key[8],
+    uint64_t chunk_counter, uint8_t flags)
+{
+	bcopy(key, cs->cv, sizeof (cs->cv));
+	bzero(cs->buf, sizeof (cs->buf));
+	cs->chunk_counter = chunk_counter;
+	cs->buf_len = 0;
+	cs->blocks_compressed = 0;
+	cs->flags = flags;
+}
+
+static inline size_t
+chunk_state_len(const blake3_chunk_state_t *cs)
+{
+	return (BLAKE3_BLOCK_LEN * (size_t)cs->blocks_compressed +
+	    cs->buf_len);
+}
+
+static inline uint8_t
+chunk_state_start_flag(const blake3_chunk_state_t *cs)
+{
+	return (cs->blocks_compressed == 0 ? BLAKE3_CHUNK_START : 0);
+}
+
+/*
+ * Add input to the current chunk; the caller never passes more than fits.
+ * The last block is always left buffered, since only the next input (or
+ * the end of it) tells whether it ends the chunk.
+ */
+static void
+chunk_state_update(blake3_chunk_state_t *cs, const uint8_t *data, size_t len)
+{
+	while (len > 0) {
+		size_t take;
+
+		if (cs->buf_len == BLAKE3_BLOCK_LEN) {
+			blake3_compress_in_place(cs->cv, cs->buf,
+			    BLAKE3_BLOCK_LEN, cs->chunk_counter,
+			    cs->flags | chunk_state_start_flag(cs));
+			cs->blocks_compressed++;
+			cs->buf_len = 0;
+			bzero(cs->buf, sizeof (cs->buf));
+		}
+
+		/* Compress whole blocks straight from the input */
+		while (cs->buf_len == 0 && len > BLAKE3_BLOCK_LEN) {
+			blake3_compress_in_place(cs->cv, data,
+			    BLAKE3_BLOCK_LEN, cs->chunk_counter,
+			    cs->flags | chunk_state_start_flag(cs));
+			cs->blocks_compressed++;
+			data += BLAKE3_BLOCK_LEN;
+			len -= BLAKE3_BLOCK_LEN;
+		}
+
+		take = MIN(BLAKE3_BLOCK_LEN - cs->buf_len, len);
+		bcopy(data, cs->buf + cs->buf_len, take);
+		cs->buf_len += take;
+		data += take;
+		len -= take;
+	}
+}
+
+static void
+chunk_state_output(const blake3_chunk_state_t *cs, blake3_output_t *out)
+{
+	bcopy(cs->cv, out->cv, sizeof (out->cv));
+	bcopy(cs->buf, out->block, sizeof (out->block));
+	out->counter = cs->chunk_counter;
+	out->block_len = cs->buf_len;
+	out->flags = cs->flags | chunk_state_start_flag(cs) |
+	    BLAKE3_CHUNK_END;
+}
+
+static void
+parent_output(const uint8_t block[BLAKE3_BLOCK_LEN], const uint32_t key[8],
+    uint8_t flags, blake3_output_t *out)
+{
+	bcopy(key, out->cv, sizeof (out->cv));
+	bcopy(block, out->block, sizeof (out->block));
+	out->counter = 0;
+	out->block_len = BLAKE3_BLOCK_LEN;
+	out->flags = flags | BLAKE3_PARENT;
+}
+
+static void
+output_cv(const blake3_output_t *out, uint8_t cv[BLAKE3_OUT_LEN],
+    uint8_t flags)
+{
+	uint32_t words[8];
+	int i;
+
+	bcopy(out->cv, words, sizeof (words));
+	blake3_compress_in_place(words, out->block, out->block_len,
+	    out->counter, out->flags | flags);
+	for (i = 0; i < 8; i++)
+		blake3_store32(cv + 4 * i, words[i]);
+}
+
+static inline uint_t
+popcount64(uint64_t x)
+{
+	uint_t n = 0;
+
+	for (; x != 0; x &= x - 1)
+		n++;
+	return (n);
+}
+
+/*
+ * Merge pairs on the stack down to one entry per set bit of total_chunks.
+ * The newest entry is left unmerged until more input shows it is not the
+ * root's left child.
+ */
+static void
+merge_cv_stack(BLAKE3_CTX *ctx, uint64_t total_chunks)
+{
+	uint_t post_merge = popcount64(total_chunks);
+
+	while (ctx->cv_stack_len > post_merge) {
+		uint8_t *parent = ctx->cv_stack +
+		    (ctx->cv_stack_len - 2) * BLAKE3_OUT_LEN;
+		blake3_output_t out;
+
+		parent_output(parent, ctx->key, ctx->chunk.flags, &out);
+		output_cv(&out, parent, 0);
+		ctx->cv_stack_len--;
+	}
+}
+
+/*
+ * Push the chaining value of chunk chunk_counter, which is also the number
+ * of chunks before it.
+ */
+static void
+push_cv(BLAKE3_CTX *ctx, const uint8_t cv[BLAKE3_OUT_LEN],
+    uint64_t chunk_counter)
+{
+	merge_cv_stack(ctx, chunk_counter);
+
+	VERIFY3U(ctx->cv_stack_len, <, BLAKE3_MAX_DEPTH);
+	bcopy(cv, ctx->cv_stack + ctx->cv_stack_len * BLAKE3_OUT_LEN,
+	    BLAKE3_OUT_LEN);
+	ctx->cv_stack_len++;
+}
+
+/*
+ * Push the chaining values of n chunks hashed in parallel, starting with
+ * chunk counter.  A power of two chunks on a boundary of their own size
+ * is a complete subtree, so its parents are hashed in parallel too, down
+ * to the two halves, since the whole subtree may still be the root.  Each
+ * level is hashed in place, the outputs never overtaking the inputs.
+ */
+static void
+push_cvs(BLAKE3_CTX *ctx, const blake3_ops_t *ops, uint8_t *cvs, size_t n,
+    uint64_t counter)
+{
+	const uint8_t *parents[BLAKE3_MAX_DEGREE / 2];
+	size_t i, m;
+
+	if (!ISP2(n) || (counter & (n - 1)) != 0) {
+		for (i = 0; i < n; i++)
+			push_cv(ctx, cvs + i * BLAKE3_OUT_LEN, counter + i);
+		return;
+	}
+
+	for (m = n / 2; m > 1; m /= 2) {
+		for (i = 0; i < m; i++)
+			parents[i] = cvs + i * BLAKE3_BLOCK_LEN;
+		ops->hash_many(parents, m, 1, ctx->key, 0, B_FALSE,
+		    ctx->chunk.flags | BLAKE3_PARENT, 0, 0, cvs);
+	}
+	push_cv(ctx, cvs, counter);
+	push_cv(ctx, cvs + BLAKE3_OUT_LEN, counter + n / 2);
+}
+
+static void
+blake3_init_common(BLAKE3_CTX *ctx, const uint32_t key[8], uint8_t flags)
+{
+	bcopy(key, ctx->key, sizeof (ctx->key));
+	chunk_state_init(&ctx->chunk, key, 0, flags);
+	ctx->cv_stack_len = 0;
+}
+
+void
+Blake3_Init(BLAKE3_CTX *ctx)
+{
+	blake3_init_common(ctx, blake3_iv, 0);
+}
+
+void
+Blake3_InitKeyed(BLAKE3_CTX *ctx, const uint8_t key[BLAKE3_KEY_LEN])
+{
+	uint32_t words[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		words[i] = blake3_load32(key + 4 * i);
+	blake3_init_common(ctx, words, BLAKE3_KEYED_HASH);
+}
+
+void
+Blake3_Update(BLAKE3_CTX *ctx, const void *data, size_t len)
+{
+	const blake3_ops_t *ops = blake3_impl_get();
+	const uint8_t *input = data;
+
+	while (len > 0) {
+		blake3_chunk_state_t *cs = &ctx->chunk;
+		size_t n, take;
+
+		/* The current chunk is full and more input follows */
+		if (chunk_state_len(cs) == BLAKE3_CHUNK_LEN) {
+			blake3_output_t out;
+			uint8_t cv[BLAKE3_OUT_LEN];
+
+			chunk_state_output(cs, &out);
+			output_cv(&out, cv, 0);
+			push_cv(ctx, cv, cs->chunk_counter);
+			chunk_state_init(cs, ctx->key, cs->chunk_counter + 1,
+			    cs->flags);
+		}
+
+		/*
+		 * Hash whole chunks in parallel.  Two or more at once can
+		 * never be the whole input, so none of them is the root and
+		 * they can be finished without waiting for more input.
+		 */
+		n = MIN(len / BLAKE3_CHUNK_LEN, ops->degree);
+		if (chunk_state_len(cs) == 0 && n > 1) {
+			const uint8_t *inputs[BLAKE3_MAX_DEGREE];
+			uint8_t cvs[BLAKE3_MAX_DEGREE * BLAKE3_OUT_LEN];
+			uint64_t counter = cs->chunk_counter;
+			size_t i;
+
+			for (i = 0; i < n; i++)
+				inputs[i] = input + i * BLAKE3_CHUNK_LEN;
+			ops->hash_many(inputs, n,
+			    BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN, ctx->key,
+			    counter, B_TRUE, cs->flags, BLAKE3_CHUNK_START,
+			    BLAKE3_CHUNK_END, cvs);
+
+			push_cvs(ctx, ops, cvs, n, counter);
+			chunk_state_init(cs, ctx->key, counter + n, cs->flags);
+			input += n * BLAKE3_CHUNK_LEN;
+			len -= n * BLAKE3_CHUNK_LEN;
+			continue;
+		}
+
+		/*
+		 * Input for a chunk also shows that the chunks before it are
+		 * not the root, so Final only finds the last pair unmerged.
+		 */
+		take = MIN(BLAKE3_CHUNK_LEN - chunk_state_len(cs), len);
+		chunk_state_update(cs, input, take);
+		merge_cv_stack(ctx, cs->chunk_counter);
+		input += take;
+		len -= take;
+	}
+}
+
+void
+Blake3_Final(const BLAKE3_CTX *ctx, uint8_t out[BLAKE3_OUT_LEN])
+{
+	blake3_output_t output;
+	uint8_t parent[BLAKE3_BLOCK_LEN];
+	size_t remaining;
+
+	if (ctx->cv_stack_len == 0) {
+		/* A single chunk is the root */
+		chunk_state_output(&ctx->chunk, &output);
+		output_cv(&output, out, BLAKE3_ROOT);
+		return;
+	}
+
+	/*
+	 * Finish the open chunk, or if the input ended on a chunk boundary
+	 * start from the newest pair on the stack, then roll the rest of
+	 * the stack up into the root.
+	 */
+	if (chunk_state_len(&ctx->chunk) > 0) {
+		remaining = ctx->cv_stack_len;
+		chunk_state_output(&ctx->chunk, &output);
+	} else {
+		ASSERT3U(ctx->cv_stack_len, >=, 2);
+		remaining = ctx->cv_stack_len - 2;
+		parent_output(ctx->cv_stack + remaining * BLAKE3_OUT_LEN,
+		    ctx->key, ctx->chunk.flags, &output);
+	}
+
+	while (remaining > 0) {
+		remaining--;
+		bcopy(ctx->cv_stack + remaining * BLAKE3_OUT_LEN, parent,
+		    BLAKE3_OUT_LEN);
+		output_cv(&output, parent + BLAKE3_OUT_LEN, 0);
+		parent_output(parent, ctx->key, ctx->chunk.flags, &output);
+	}
+
+	output_cv(&output, out, BLAKE3_ROOT);
+}
@@ -0,0 +1,143 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Portable BLAKE3 compression function, used for everything the wider
+ * implementations leave over: partial blocks, parent nodes and the root.
+ */
+
+#include <blake3/blake3_impl.h>
+
+const uint32_t blake3_iv[8] = {
+	0x6A09E667UL, 0xBB67AE85UL, 0x3C6EF372UL, 0xA54FF53AUL,
+	0x510E527FUL, 0x9B05688CUL, 0x1F83D9ABUL, 0x5BE0CD19UL
+};
+
+static const uint8_t blake3_msg_schedule[7][16] = BLAKE3_MSG_SCHEDULE;
+
+#define	ROTR32(w, c)	(((w) >> (c)) | ((w) << (32 - (c))))
+
+#define	G(s, a, b, c, d, x, y)						\
+{									\
+	s[a] = s[a] + s[b] + (x);					\
+	s[d] = ROTR32(s[d] ^ s[a], 16);					\
+	s[c] = s[c] + s[d];						\
+	s[b] = ROTR32(s[b] ^ s[c], 12);					\
+	s[a] = s[a] + s[b] + (y);					\
+	s[d] = ROTR32(s[d] ^ s[a], 8);					\
+	s[c] = s[c] + s[d];						\
+	s[b] = ROTR32(s[b] ^ s[c], 7);					\
+}
+
+static blake3_inline void
+blake3_round(uint32_t s[16], const uint32_t m[16], int r)
+{
+	const uint8_t *sc = blake3_msg_schedule[r];
+
+	/* Mix the columns */
+	G(s, 0, 4, 8, 12, m[sc[0]], m[sc[1]]);
+	G(s, 1, 5, 9, 13, m[sc[2]], m[sc[3]]);
+	G(s, 2, 6, 10, 14, m[sc[4]], m[sc[5]]);
+	G(s, 3, 7, 11, 15, m[sc[6]], m[sc[7]]);
+
+	/* Mix the diagonals */
+	G(s, 0, 5, 10, 15, m[sc[8]], m[sc[9]]);
+	G(s, 1, 6, 11, 12, m[sc[10]], m[sc[11]]);
+	G(s, 2, 7, 8, 13, m[sc[12]], m[sc[13]]);
+	G(s, 3, 4, 9, 14, m[sc[14]], m[sc[15]]);
+}
+
+void
+blake3_compress_in_place(uint32_t cv[8], const uint8_t block[BLAKE3_BLOCK_LEN],
+    uint8_t block_len, uint64_t counter, uint8_t flags)
+{
+	uint32_t m[16], s[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		m[i] = blake3_load32(block + 4 * i);
+
+	for (i = 0; i < 8; i++) {
+		s[i] = cv[i];
+		s[i + 8] = blake3_iv[i];
+	}
+	s[12] = (uint32_t)counter;
+	s[13] = (uint32_t)(counter >> 32);
+	s[14] = block_len;
+	s[15] = flags;
+
+	blake3_round(s, m, 0);
+	blake3_round(s, m, 1);
+	blake3_round(s, m, 2);
+	blake3_round(s, m, 3);
+	blake3_round(s, m, 4);
+	blake3_round(s, m, 5);
+	blake3_round(s, m, 6);
+
+	for (i = 0; i < 8; i++)
+		cv[i] = s[i] ^ s[i + 8];
+}
+
+void
+blake3_generic_hash_many(const uint8_t * const *inputs, size_t n,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	size_t i, b;
+	int w;
+
+	for (i = 0; i < n; i++) {
+		uint32_t cv[8];
+
+		bcopy(key, cv, sizeof (cv));
+		for (b = 0; b < blocks; b++) {
+			uint8_t bflags = flags;
+
+			if (b == 0)
+				bflags |= flags_start;
+			if (b == blocks - 1)
+				bflags |= flags_end;
+			blake3_compress_in_place(cv,
+			    inputs[i] + b * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN,
+			    counter, bflags);
+		}
+
+		for (w = 0; w < 8; w++)
+			blake3_store32(out + i * BLAKE3_OUT_LEN + 4 * w, cv[w]);
+
+		if (increment)
+			counter++;
+	}
+}
+
+static boolean_t
+blake3_generic_valid(void)
+{
+	return (B_TRUE);
+}
+
+const blake3_ops_t blake3_generic_ops = {
+	.hash_many = blake3_generic_hash_many,
+	.valid = blake3_generic_valid,
+	.degree = 1,
+	.name = "generic"
+};
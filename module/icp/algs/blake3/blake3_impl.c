@@ -0,0 +1,362 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * BLAKE3 implementation selection.  As for fletcher 4, the supported
+ * implementations are benchmarked when the module loads and the fastest
+ * one is used unless zfs_blake3_impl names another.
+ */
+
+#include <blake3/blake3_impl.h>
+
+static const blake3_ops_t *const blake3_impls[] = {
+	&blake3_generic_ops,
+#if defined(__x86_64) && defined(HAVE_SSE4_1)
+	&blake3_sse41_ops,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX2)
+	&blake3_avx2_ops,
+#endif
+#if defined(__x86_64) && defined(HAVE_AVX512F)
+	&blake3_avx512_ops,
+#endif
+#if defined(__aarch64__) && !defined(_KERNEL)
+	&blake3_neon_ops,
+#endif
+};
+
+/* Hold all supported implementations */
+static uint32_t blake3_supp_impls_cnt = 0;
+static const blake3_ops_t *blake3_supp_impls[ARRAY_SIZE(blake3_impls)];
+
+/* Select blake3 implementation */
+#define	IMPL_FASTEST	(UINT32_MAX)
+#define	IMPL_CYCLE	(UINT32_MAX - 1)
+#define	IMPL_GENERIC	(0)
+
+static uint32_t blake3_impl_chosen = IMPL_FASTEST;
+static const blake3_ops_t *blake3_fastest_impl = &blake3_generic_ops;
+
+#define	IMPL_READ(i)	(*(volatile uint32_t *) &(i))
+
+static struct blake3_impl_selector {
+	const char	*bis_name;
+	uint32_t	bis_sel;
+} blake3_impl_selectors[] = {
+#if !defined(_KERNEL)
+	{ "cycle",	IMPL_CYCLE },
+#endif
+	{ "fastest",	IMPL_FASTEST },
+	{ "generic",	IMPL_GENERIC }
+};
+
+#if defined(_KERNEL)
+static kstat_t *blake3_kstat;
+#endif
+
+/* Bandwidth of each implementation in B/s, and the fastest one's index */
+static uint64_t blake3_stat_data[ARRAY_SIZE(blake3_impls) + 1];
+
+/* Indicate that benchmark has been completed */
+static boolean_t blake3_initialized = B_FALSE;
+
+int
+blake3_impl_set(const char *val)
+{
+	int err = -EINVAL;
+	uint32_t impl = IMPL_READ(blake3_impl_chosen);
+	size_t i, val_len;
+
+	val_len = strlen(val);
+	while ((val_len > 0) && !!isspace(val[val_len-1])) /* trim '\n' */
+		val_len--;
+
+	/* check mandatory implementations */
+	for (i = 0; i < ARRAY_SIZE(blake3_impl_selectors); i++) {
+		const char *name = blake3_impl_selectors[i].bis_name;
+
+		if (val_len == strlen(name) &&
+		    strncmp(val, name, val_len) == 0) {
+			impl = blake3_impl_selectors[i].bis_sel;
+			err = 0;
+			break;
+		}
+	}
+
+	if (err != 0 && blake3_initialized) {
+		/* check all supported implementations */
+		for (i = 0; i < blake3_supp_impls_cnt; i++) {
+			const char *name = blake3_supp_impls[i]->name;
+
+			if (val_len == strlen(name) &&
+			    strncmp(val, name, val_len) == 0) {
+				impl = i;
+				err = 0;
+				break;
+			}
+		}
+	}
+
+	if (err == 0) {
+		atomic_swap_32(&blake3_impl_chosen, impl);
+		membar_producer();
+	}
+
+	return (err);
+}
+
+const blake3_ops_t *
+blake3_impl_get(void)
+{
+	const blake3_ops_t *ops = NULL;
+	const uint32_t impl = IMPL_READ(blake3_impl_chosen);
+
+	/* Hashing before the first init, as zdb can, uses generic code */
+	if (!blake3_initialized)
+		return (&blake3_generic_ops);
+
+	switch (impl) {
+	case IMPL_FASTEST:
+		ops = blake3_fastest_impl;
+		break;
+#if !defined(_KERNEL)
+	case IMPL_CYCLE: {
+		ASSERT3U(blake3_supp_impls_cnt, >, 0);
+
+		static uint32_t cycle_count = 0;
+		uint32_t idx = (++cycle_count) % blake3_supp_impls_cnt;
+		ops = blake3_supp_impls[idx];
+	}
+	break;
+#endif
+	default:
+		ASSERT3U(blake3_supp_impls_cnt, >, 0);
+		ASSERT3U(impl, <, blake3_supp_impls_cnt);
+
+		ops = blake3_supp_impls[impl];
+		break;
+	}
+
+	ASSERT3P(ops, !=, NULL);
+
+	return (ops);
+}
+
+#if defined(_KERNEL)
+static int
+blake3_kstat_headers(char *buf, size_t size)
+{
+	ssize_t off = 0;
+
+	off += snprintf(buf + off, size, "%-17s", "implementation");
+	(void) snprintf(buf + off, size - off, "%-15s\n", "bandwidth");
+
+	return (0);
+}
+
+static int
+blake3_kstat_data(char *buf, size_t size, void *data)
+{
+	uint64_t *fastest_stat = &blake3_stat_data[blake3_supp_impls_cnt];
+	uint64_t *curr_stat = (uint64_t *)data;
+	ssize_t off = 0;
+
+	if (curr_stat == fastest_stat) {
+		off += snprintf(buf + off, size - off, "%-17s", "fastest");
+		(void) snprintf(buf + off, size - off, "%-15s\n",
+		    blake3_supp_impls[*fastest_stat]->name);
+	} else {
+		ptrdiff_t id = curr_stat - blake3_stat_data;
+
+		off += snprintf(buf + off, size - off, "%-17s",
+		    blake3_supp_impls[id]->name);
+		(void) snprintf(buf + off, size - off, "%-15llu\n",
+		    (u_longlong_t)*curr_stat);
+	}
+
+	return (0);
+}
+
+static void *
+blake3_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	if (n <= blake3_supp_impls_cnt)
+		ksp->ks_private = (void *) (blake3_stat_data + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+#define	BLAKE3_BENCH_NS	(MSEC2NSEC(50))		/* 50ms */
+
+static void
+blake3_benchmark(const uint8_t *data, size_t data_size)
+{
+	uint64_t best_run = 0;
+	uint32_t i, l;
+
+	for (i = 0; i < blake3_supp_impls_cnt; i++) {
+		const blake3_ops_t *ops = blake3_supp_impls[i];
+		uint64_t run_count = 0, run_bw, run_time_ns;
+		uint8_t digest[BLAKE3_OUT_LEN];
+		hrtime_t start;
+
+		/* temporary set an implementation */
+		blake3_fastest_impl = ops;
+
+		kpreempt_disable();
+		start = gethrtime();
+		do {
+			for (l = 0; l < 4; l++, run_count++) {
+				BLAKE3_CTX ctx;
+
+				Blake3_Init(&ctx);
+				Blake3_Update(&ctx, data, data_size);
+				Blake3_Final(&ctx, digest);
+			}
+
+			run_time_ns = gethrtime() - start;
+		} while (run_time_ns < BLAKE3_BENCH_NS);
+		kpreempt_enable();
+
+		run_bw = data_size * run_count * NANOSEC;
+		run_bw /= run_time_ns;	/* B/s */
+		blake3_stat_data[i] = run_bw;
+
+		if (run_bw > best_run) {
+			best_run = run_bw;
+			blake3_stat_data[blake3_supp_impls_cnt] = i;
+		}
+	}
+
+	blake3_fastest_impl =
+	    blake3_supp_impls[blake3_stat_data[blake3_supp_impls_cnt]];
+}
+#endif /* _KERNEL */
+
+void
+blake3_impl_init(void)
+{
+#if defined(_KERNEL)
+	static const size_t data_size = 128 * 1024;
+	uint8_t *databuf;
+#endif
+	int i, c;
+
+	/* move supported impl into blake3_supp_impls */
+	for (i = 0, c = 0; i < ARRAY_SIZE(blake3_impls); i++) {
+		const blake3_ops_t *curr_impl = blake3_impls[i];
+
+		if (curr_impl->valid && curr_impl->valid())
+			blake3_supp_impls[c++] = curr_impl;
+	}
+	membar_producer();	/* complete blake3_supp_impls[] init */
+	blake3_supp_impls_cnt = c;	/* number of supported impl */
+
+#if !defined(_KERNEL)
+	/* Skip benchmarking and use last implementation as fastest */
+	blake3_fastest_impl = blake3_supp_impls[blake3_supp_impls_cnt - 1];
+	blake3_stat_data[blake3_supp_impls_cnt] = blake3_supp_impls_cnt - 1;
+	membar_producer();
+
+	blake3_initialized = B_TRUE;
+#else
+	/* Benchmark all supported implementations */
+	databuf = vmem_alloc(data_size, KM_SLEEP);
+	for (i = 0; i < data_size; i++)
+		databuf[i] = (uint8_t)i;
+
+	blake3_initialized = B_TRUE;
+	blake3_benchmark(databuf, data_size);
+
+	vmem_free(databuf, data_size);
+
+	/* install kstats for all implementations */
+	blake3_kstat = kstat_create("zfs", 0, "blake3_bench", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (blake3_kstat != NULL) {
+		blake3_kstat->ks_data = NULL;
+		blake3_kstat->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(blake3_kstat,
+		    blake3_kstat_headers,
+		    blake3_kstat_data,
+		    blake3_kstat_addr);
+		kstat_install(blake3_kstat);
+	}
+#endif
+}
+
+void
+blake3_impl_fini(void)
+{
+#if defined(_KERNEL)
+	if (blake3_kstat != NULL) {
+		kstat_delete(blake3_kstat);
+		blake3_kstat = NULL;
+	}
+#endif
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+#include <linux/mod_compat.h>
+
+static int
+blake3_param_get(char *buffer, zfs_kernel_param_t *unused)
+{
+	const uint32_t impl = IMPL_READ(blake3_impl_chosen);
+	char *fmt;
+	int i, cnt = 0;
+
+	/* list fastest */
+	fmt = (impl == IMPL_FASTEST) ? "[%s] " : "%s ";
+	cnt += sprintf(buffer + cnt, fmt, "fastest");
+
+	/* list all supported implementations */
+	for (i = 0; i < blake3_supp_impls_cnt; i++) {
+		fmt = (i == impl) ? "[%s] " : "%s ";
+		cnt += sprintf(buffer + cnt, fmt,
+		    blake3_supp_impls[i]->name);
+	}
+
+	return (cnt);
+}
+
+static int
+blake3_param_set(const char *val, zfs_kernel_param_t *unused)
+{
+	return (blake3_impl_set(val));
+}
+
+/*
+ * Choose a BLAKE3 implementation.  As with zfs_fletcher_4_impl, "cycle"
+ * exercises all implementations and can only be set in user space.
+ */
+module_param_call(zfs_blake3_impl,
+    blake3_param_set, blake3_param_get, NULL, 0644);
+MODULE_PARM_DESC(zfs_blake3_impl, "Select BLAKE3 implementation.");
+
+EXPORT_SYMBOL(Blake3_Init);
+EXPORT_SYMBOL(Blake3_InitKeyed);
+EXPORT_SYMBOL(Blake3_Update);
+EXPORT_SYMBOL(Blake3_Final);
+EXPORT_SYMBOL(blake3_impl_set);
+#endif
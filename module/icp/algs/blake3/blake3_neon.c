@@ -0,0 +1,62 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * NEON BLAKE3, hashing four chunks at once.  The kernel is built with
+ * -mgeneral-regs-only, which the vector extensions cannot be used under,
+ * so this is only built in user space.
+ */
+
+#if defined(__aarch64__) && !defined(_KERNEL)
+
+#include <linux/simd_aarch64.h>
+
+#define	BLAKE3_VEC_LANES	4
+#define	BLAKE3_VEC_TARGET	/* NEON is part of the base architecture */
+
+#include "blake3_vec_impl.h"
+
+static void
+blake3_neon_hash_many(const uint8_t * const *inputs, size_t n,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	kfpu_begin();
+	blake3_vec_hash_many(inputs, n, blocks, key, counter, increment,
+	    flags, flags_start, flags_end, out);
+	kfpu_end();
+}
+
+static boolean_t
+blake3_neon_valid(void)
+{
+	return (B_TRUE);
+}
+
+const blake3_ops_t blake3_neon_ops = {
+	.hash_many = blake3_neon_hash_many,
+	.valid = blake3_neon_valid,
+	.degree = 4,
+	.name = "neon"
+};
+
+#endif /* defined(__aarch64__) && !defined(_KERNEL) */
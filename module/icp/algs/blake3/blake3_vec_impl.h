@@ -0,0 +1,281 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Template for the SIMD BLAKE3 implementations, written with the compiler's
+ * vector extensions.  Each vector lane hashes a chunk of its own, so the
+ * state words of BLAKE3_VEC_LANES chunks are held in 16 vectors and the
+ * message words are transposed into the same layout as they are loaded.
+ *
+ * The including file defines BLAKE3_VEC_LANES (4, 8 or 16) and
+ * BLAKE3_VEC_TARGET, the target attribute the functions are built with,
+ * and wraps blake3_vec_hash_many() in kfpu_begin()/kfpu_end().  Both x86
+ * and aarch64 are little-endian, so message words load as they are.
+ */
+
+#ifndef	_BLAKE3_VEC_IMPL_H
+#define	_BLAKE3_VEC_IMPL_H
+
+#include <blake3/blake3_impl.h>
+
+#if !defined(BLAKE3_VEC_LANES) || !defined(BLAKE3_VEC_TARGET)
+#error "BLAKE3_VEC_LANES and BLAKE3_VEC_TARGET must be defined"
+#endif
+
+/*
+ * Sixteen state and sixteen message vectors do not fit in the registers,
+ * so blake3_vec_hash_lanes() spills over the 1k frame size limit (to about
+ * 2.5k with AVX512).  It is only called from zio worker threads, which
+ * won't be using much stack, so the warning is ignored as for skein.
+ */
+#pragma GCC diagnostic ignored "-Wframe-larger-than="
+
+#define	L	BLAKE3_VEC_LANES
+
+typedef uint32_t v32_t __attribute__((vector_size(4 * L)));
+
+#if defined(__clang__)
+#define	VSHUF(a, b, ...)	__builtin_shufflevector(a, b, __VA_ARGS__)
+#else
+/* CSTYLED */
+#define	VSHUF(a, b, ...)	__builtin_shuffle(a, b, (v32_t){ __VA_ARGS__ })
+#endif
+
+/*
+ * Transposing an LxL matrix swaps each bit of the row index with the same
+ * bit of the column index.  Stage b does it for bit b, trading the
+ * columns with bit b set in row i for those with it clear in row i + b.
+ */
+#if L == 4
+#define	LO1(a, c)	VSHUF(a, c, 0, 4, 2, 6)
+#define	HI1(a, c)	VSHUF(a, c, 1, 5, 3, 7)
+#define	LO2(a, c)	VSHUF(a, c, 0, 1, 4, 5)
+#define	HI2(a, c)	VSHUF(a, c, 2, 3, 6, 7)
+#elif L == 8
+#define	LO1(a, c)	VSHUF(a, c, 0, 8, 2, 10, 4, 12, 6, 14)
+#define	HI1(a, c)	VSHUF(a, c, 1, 9, 3, 11, 5, 13, 7, 15)
+#define	LO2(a, c)	VSHUF(a, c, 0, 1, 8, 9, 4, 5, 12, 13)
+#define	HI2(a, c)	VSHUF(a, c, 2, 3, 10, 11, 6, 7, 14, 15)
+#define	LO4(a, c)	VSHUF(a, c, 0, 1, 2, 3, 8, 9, 10, 11)
+#define	HI4(a, c)	VSHUF(a, c, 4, 5, 6, 7, 12, 13, 14, 15)
+#elif L == 16
+#define	LO1(a, c)	VSHUF(a, c, 0, 16, 2, 18, 4, 20, 6, 22,		\
+			    8, 24, 10, 26, 12, 28, 14, 30)
+#define	HI1(a, c)	VSHUF(a, c, 1, 17, 3, 19, 5, 21, 7, 23,		\
+			    9, 25, 11, 27, 13, 29, 15, 31)
+#define	LO2(a, c)	VSHUF(a, c, 0, 1, 16, 17, 4, 5, 20, 21,		\
+			    8, 9, 24, 25, 12, 13, 28, 29)
+#define	HI2(a, c)	VSHUF(a, c, 2, 3, 18, 19, 6, 7, 22, 23,		\
+			    10, 11, 26, 27, 14, 15, 30, 31)
+#define	LO4(a, c)	VSHUF(a, c, 0, 1, 2, 3, 16, 17, 18, 19,		\
+			    8, 9, 10, 11, 24, 25, 26, 27)
+#define	HI4(a, c)	VSHUF(a, c, 4, 5, 6, 7, 20, 21, 22, 23,		\
+			    12, 13, 14, 15, 28, 29, 30, 31)
+#define	LO8(a, c)	VSHUF(a, c, 0, 1, 2, 3, 4, 5, 6, 7,		\
+			    16, 17, 18, 19, 20, 21, 22, 23)
+#define	HI8(a, c)	VSHUF(a, c, 8, 9, 10, 11, 12, 13, 14, 15,	\
+			    24, 25, 26, 27, 28, 29, 30, 31)
+#else
+#error "BLAKE3_VEC_LANES must be 4, 8 or 16"
+#endif
+
+#define	TSTAGE(r, b, lo, hi)						\
+{									\
+	int i;								\
+	for (i = 0; i < L; i++) {					\
+		if ((i & (b)) == 0) {					\
+			v32_t t = r[i];					\
+			r[i] = lo(t, r[i + (b)]);			\
+			r[i + (b)] = hi(t, r[i + (b)]);			\
+		}							\
+	}								\
+}
+
+static blake3_inline void BLAKE3_VEC_TARGET
+blake3_vec_transpose(v32_t r[L])
+{
+	TSTAGE(r, 1, LO1, HI1);
+	TSTAGE(r, 2, LO2, HI2);
+#if L >= 8
+	TSTAGE(r, 4, LO4, HI4);
+#endif
+#if L >= 16
+	TSTAGE(r, 8, LO8, HI8);
+#endif
+}
+
+/*
+ * Load block off of every input as m[w] = word w of each lane's block.
+ */
+static blake3_inline void BLAKE3_VEC_TARGET
+blake3_vec_load_msg(v32_t m[16], const uint8_t * const *inputs, size_t off)
+{
+	int g, l;
+
+	for (g = 0; g < 16; g += L) {
+		for (l = 0; l < L; l++) {
+			memcpy(&m[g + l], inputs[l] + off + 4 * g,
+			    sizeof (v32_t));
+		}
+		blake3_vec_transpose(&m[g]);
+	}
+}
+
+static blake3_inline v32_t BLAKE3_VEC_TARGET
+blake3_vec_splat(uint32_t w)
+{
+	v32_t v = { 0 };
+
+	return (v + w);
+}
+
+#define	VROTR(w, c)	(((w) >> (c)) | ((w) << (32 - (c))))
+
+#define	VG(s, a, b, c, d, x, y)						\
+{									\
+	s[a] = s[a] + s[b] + (x);					\
+	s[d] = VROTR(s[d] ^ s[a], 16);					\
+	s[c] = s[c] + s[d];						\
+	s[b] = VROTR(s[b] ^ s[c], 12);					\
+	s[a] = s[a] + s[b] + (y);					\
+	s[d] = VROTR(s[d] ^ s[a], 8);					\
+	s[c] = s[c] + s[d];						\
+	s[b] = VROTR(s[b] ^ s[c], 7);					\
+}
+
+static const uint8_t blake3_vec_msg_schedule[7][16] = BLAKE3_MSG_SCHEDULE;
+
+static blake3_inline void BLAKE3_VEC_TARGET
+blake3_vec_round(v32_t s[16], const v32_t m[16], int r)
+{
+	const uint8_t *sc = blake3_vec_msg_schedule[r];
+
+	VG(s, 0, 4, 8, 12, m[sc[0]], m[sc[1]]);
+	VG(s, 1, 5, 9, 13, m[sc[2]], m[sc[3]]);
+	VG(s, 2, 6, 10, 14, m[sc[4]], m[sc[5]]);
+	VG(s, 3, 7, 11, 15, m[sc[6]], m[sc[7]]);
+
+	VG(s, 0, 5, 10, 15, m[sc[8]], m[sc[9]]);
+	VG(s, 1, 6, 11, 12, m[sc[10]], m[sc[11]]);
+	VG(s, 2, 7, 8, 13, m[sc[12]], m[sc[13]]);
+	VG(s, 3, 4, 9, 14, m[sc[14]], m[sc[15]]);
+}
+
+/*
+ * Hash exactly L inputs, one per lane.
+ */
+static void BLAKE3_VEC_TARGET
+blake3_vec_hash_lanes(const uint8_t * const *inputs, size_t blocks,
+    const uint32_t key[8], uint64_t counter, boolean_t increment,
+    uint8_t flags, uint8_t flags_start, uint8_t flags_end, uint8_t *out)
+{
+	v32_t h[8], m[16], s[16], ctr_lo, ctr_hi;
+	size_t b;
+	int i, l;
+
+	for (i = 0; i < 8; i++)
+		h[i] = blake3_vec_splat(key[i]);
+
+	for (l = 0; l < L; l++) {
+		uint64_t c = counter + (increment ? l : 0);
+
+		ctr_lo[l] = (uint32_t)c;
+		ctr_hi[l] = (uint32_t)(c >> 32);
+	}
+
+	for (b = 0; b < blocks; b++) {
+		uint32_t bflags = flags;
+
+		if (b == 0)
+			bflags |= flags_start;
+		if (b == blocks - 1)
+			bflags |= flags_end;
+
+		blake3_vec_load_msg(m, inputs, b * BLAKE3_BLOCK_LEN);
+
+		for (i = 0; i < 8; i++) {
+			s[i] = h[i];
+			s[i + 8] = blake3_vec_splat(blake3_iv[i]);
+		}
+		s[12] = ctr_lo;
+		s[13] = ctr_hi;
+		s[14] = blake3_vec_splat(BLAKE3_BLOCK_LEN);
+		s[15] = blake3_vec_splat(bflags);
+
+		blake3_vec_round(s, m, 0);
+		blake3_vec_round(s, m, 1);
+		blake3_vec_round(s, m, 2);
+		blake3_vec_round(s, m, 3);
+		blake3_vec_round(s, m, 4);
+		blake3_vec_round(s, m, 5);
+		blake3_vec_round(s, m, 6);
+
+		for (i = 0; i < 8; i++)
+			h[i] = s[i] ^ s[i + 8];
+	}
+
+	for (l = 0; l < L; l++) {
+		for (i = 0; i < 8; i++)
+			blake3_store32(out + l * BLAKE3_OUT_LEN + 4 * i,
+			    h[i][l]);
+	}
+}
+
+/*
+ * Hash n inputs, L at a time.  A short final group is padded out by
+ * repeating its last input, which costs no more than a full group and is
+ * still much faster than the generic code.
+ */
+static void BLAKE3_VEC_TARGET
+blake3_vec_hash_many(const uint8_t * const *inputs, size_t n,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out)
+{
+	while (n >= L) {
+		blake3_vec_hash_lanes(inputs, blocks, key, counter, increment,
+		    flags, flags_start, flags_end, out);
+		if (increment)
+			counter += L;
+		inputs += L;
+		out += L * BLAKE3_OUT_LEN;
+		n -= L;
+	}
+
+	if (n == 1) {
+		blake3_generic_hash_many(inputs, n, blocks, key, counter,
+		    increment, flags, flags_start, flags_end, out);
+	} else if (n > 1) {
+		const uint8_t *pad[L];
+		uint8_t cvs[L * BLAKE3_OUT_LEN];
+		size_t i;
+
+		for (i = 0; i < L; i++)
+			pad[i] = inputs[MIN(i, n - 1)];
+		blake3_vec_hash_lanes(pad, blocks, key, counter, increment,
+		    flags, flags_start, flags_end, cvs);
+		memcpy(out, cvs, n * BLAKE3_OUT_LEN);
+	}
+}
+
+#undef	L
+
+#endif	/* _BLAKE3_VEC_IMPL_H */
@@ -700,12 +700,9 @@ gcm_set_kmflag(gcm_ctx_t *ctx, int kmflag)
 #define	INTEL_PCLMULQDQ_FLAG (1 << 1)
 
 /*
- * Return 1 if executing on Intel with PCLMULQDQ instructions,
- * otherwise 0 (i.e., Intel without PCLMULQDQ or AMD64).
- * Cache the result, as the CPU can't change.
- *
- * Note: the userland version uses getisax().  The kernel version uses
- * is_x86_featureset().
+ * Return 1 if executing on a CPU with the PCLMULQDQ instruction, otherwise
+ * 0.  The feature bit is the same on Intel and AMD, so the vendor is not
+ * looked at.  Cache the result, as the CPU can't change.
  */
 static int
 intel_pclmulqdq_instruction_present(void)
@@ -715,31 +712,16 @@ intel_pclmulqdq_instruction_present(void)
 	unsigned func, subfunc;
 
 	if (cached_result == -1) { /* first time */
-		/* check for an intel cpu */
-		func = 0;
+		func = 1;
 		subfunc = 0;
 
+		/* check for pclmulqdq instruction */
 		__asm__ __volatile__(
 		    "cpuid"
 		    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
 		    : "a"(func), "c"(subfunc));
 
-		if (memcmp((char *)(&ebx), "Genu", 4) == 0 &&
-		    memcmp((char *)(&edx), "ineI", 4) == 0 &&
-		    memcmp((char *)(&ecx), "ntel", 4) == 0) {
-			func = 1;
-			subfunc = 0;
-
-			/* check for aes-ni instruction set */
-			__asm__ __volatile__(
-			    "cpuid"
-			    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
-			    : "a"(func), "c"(subfunc));
-
-			cached_result = !!(ecx & INTEL_PCLMULQDQ_FLAG);
-		} else {
-			cached_result = 0;
-		}
+		cached_result = !!(ecx & INTEL_PCLMULQDQ_FLAG);
 	}
 
 	return (cached_result);
@@ -52,17 +52,7 @@
 static void Encode(uint8_t *, uint32_t *, size_t);
 static void Encode64(uint8_t *, uint64_t *, size_t);
 
-#if	defined(__amd64)
-#define	SHA512Transform(ctx, in) SHA512TransformBlocks((ctx), (in), 1)
-#define	SHA256Transform(ctx, in) SHA256TransformBlocks((ctx), (in), 1)
-
-void SHA512TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
-void SHA256TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
-
-#else
-static void SHA256Transform(SHA2_CTX *, const uint8_t *);
-static void SHA512Transform(SHA2_CTX *, const uint8_t *);
-#endif	/* __amd64 */
+#include <sha2/sha2_impl.h>
 
 static uint8_t PADDING[128] = { 0x80, /* all zeros */ };
 
@@ -142,7 +132,6 @@ static uint8_t PADDING[128] = { 0x80, /* all zeros */ };
 #endif	/* _BIG_ENDIAN */
 
 
-#if	!defined(__amd64)
 /* SHA256 Transform */
 
 static void
@@ -600,7 +589,42 @@ SHA512Transform(SHA2_CTX *ctx, const uint8_t *blk)
 	ctx->state.s64[7] += h;
 
 }
-#endif	/* !__amd64 */
+
+static void
+sha256_generic_transform(SHA2_CTX *ctx, const void *in, size_t blocks)
+{
+	const uint8_t *blk = in;
+
+	for (; blocks > 0; blocks--, blk += 64)
+		SHA256Transform(ctx, blk);
+}
+
+static void
+sha512_generic_transform(SHA2_CTX *ctx, const void *in, size_t blocks)
+{
+	const uint8_t *blk = in;
+
+	for (; blocks > 0; blocks--, blk += 128)
+		SHA512Transform(ctx, blk);
+}
+
+static boolean_t
+sha2_generic_valid(void)
+{
+	return (B_TRUE);
+}
+
+const sha2_ops_t sha256_generic_ops = {
+	.transform = sha256_generic_transform,
+	.valid = sha2_generic_valid,
+	.name = "generic"
+};
+
+const sha2_ops_t sha512_generic_ops = {
+	.transform = sha512_generic_transform,
+	.valid = sha2_generic_valid,
+	.name = "generic"
+};
 
 
 /*
@@ -783,9 +807,8 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 	uint32_t	i, buf_index, buf_len, buf_limit;
 	const uint8_t	*input = inptr;
 	uint32_t	algotype = ctx->algotype;
-#if defined(__amd64)
 	uint32_t	block_count;
-#endif	/* !__amd64 */
+	const sha2_ops_t *ops;
 
 
 	/* check for noop */
@@ -793,6 +816,7 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 		return;
 
 	if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
+		ops = sha256_impl_get();
 		buf_limit = 64;
 
 		/* compute number of bytes mod 64 */
@@ -805,6 +829,7 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 		ctx->count.c32[0] += (input_len >> 29);
 
 	} else {
+		ops = sha512_impl_get();
 		buf_limit = 128;
 
 		/* compute number of bytes mod 128 */
@@ -834,42 +859,16 @@ SHA2Update(SHA2_CTX *ctx, const void *inptr, size_t input_len)
 		 */
 		if (buf_index) {
 			bcopy(input, &ctx->buf_un.buf8[buf_index], buf_len);
-			if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE)
-				SHA256Transform(ctx, ctx->buf_un.buf8);
-			else
-				SHA512Transform(ctx, ctx->buf_un.buf8);
+			ops->transform(ctx, ctx->buf_un.buf8, 1);
 
 			i = buf_len;
 		}
 
-#if !defined(__amd64)
-		if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
-			for (; i + buf_limit - 1 < input_len; i += buf_limit) {
-				SHA256Transform(ctx, &input[i]);
-			}
-		} else {
-			for (; i + buf_limit - 1 < input_len; i += buf_limit) {
-				SHA512Transform(ctx, &input[i]);
-			}
-		}
-
-#else
-		if (algotype <= SHA256_HMAC_GEN_MECH_INFO_TYPE) {
-			block_count = (input_len - i) >> 6;
-			if (block_count > 0) {
-				SHA256TransformBlocks(ctx, &input[i],
-				    block_count);
-				i += block_count << 6;
-			}
-		} else {
-			block_count = (input_len - i) >> 7;
-			if (block_count > 0) {
-				SHA512TransformBlocks(ctx, &input[i],
-				    block_count);
-				i += block_count << 7;
-			}
+		block_count = (input_len - i) / buf_limit;
+		if (block_count > 0) {
+			ops->transform(ctx, &input[i], block_count);
+			i += block_count * buf_limit;
 		}
-#endif	/* !__amd64 */
 
 		/*
 		 * general optimization:
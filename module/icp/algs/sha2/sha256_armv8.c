@@ -0,0 +1,151 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SHA-256 block transform using the ARMv8 cryptography extensions, four
+ * rounds and four message schedule words at a time.  As for the NEON
+ * BLAKE3, the kernel is built with -mgeneral-regs-only, which the NEON
+ * intrinsics cannot be used under, so this is only built in user space.
+ */
+
+#if defined(__aarch64__) && !defined(_KERNEL)
+
+#include <sys/zfs_context.h>
+#include <sha2/sha2_consts.h>
+#define	_SHA2_IMPL
+#include <sha2/sha2_impl.h>
+#include <sys/auxv.h>
+#include <arm_neon.h>
+
+#ifndef	HWCAP_SHA2
+#define	HWCAP_SHA2	(1 << 6)
+#endif
+
+#if defined(__clang__)
+#define	SHA2_CE_TARGET	__attribute__((target("crypto")))
+#else
+#define	SHA2_CE_TARGET	__attribute__((target("+crypto")))
+#endif
+
+static const uint32_t sha256_armv8_k[64] __attribute__((aligned(16))) = {
+	SHA256_CONST_0, SHA256_CONST_1, SHA256_CONST_2,
+	SHA256_CONST_3, SHA256_CONST_4, SHA256_CONST_5,
+	SHA256_CONST_6, SHA256_CONST_7, SHA256_CONST_8,
+	SHA256_CONST_9, SHA256_CONST_10, SHA256_CONST_11,
+	SHA256_CONST_12, SHA256_CONST_13, SHA256_CONST_14,
+	SHA256_CONST_15, SHA256_CONST_16, SHA256_CONST_17,
+	SHA256_CONST_18, SHA256_CONST_19, SHA256_CONST_20,
+	SHA256_CONST_21, SHA256_CONST_22, SHA256_CONST_23,
+	SHA256_CONST_24, SHA256_CONST_25, SHA256_CONST_26,
+	SHA256_CONST_27, SHA256_CONST_28, SHA256_CONST_29,
+	SHA256_CONST_30, SHA256_CONST_31, SHA256_CONST_32,
+	SHA256_CONST_33, SHA256_CONST_34, SHA256_CONST_35,
+	SHA256_CONST_36, SHA256_CONST_37, SHA256_CONST_38,
+	SHA256_CONST_39, SHA256_CONST_40, SHA256_CONST_41,
+	SHA256_CONST_42, SHA256_CONST_43, SHA256_CONST_44,
+	SHA256_CONST_45, SHA256_CONST_46, SHA256_CONST_47,
+	SHA256_CONST_48, SHA256_CONST_49, SHA256_CONST_50,
+	SHA256_CONST_51, SHA256_CONST_52, SHA256_CONST_53,
+	SHA256_CONST_54, SHA256_CONST_55, SHA256_CONST_56,
+	SHA256_CONST_57, SHA256_CONST_58, SHA256_CONST_59,
+	SHA256_CONST_60, SHA256_CONST_61, SHA256_CONST_62,
+	SHA256_CONST_63
+};
+
+/*
+ * Rounds 4g to 4g + 3, with the message words of the group in w[g % 4].
+ * Groups 0 to 11 also compute the words of group g + 4 in its place.
+ */
+static inline __attribute__((always_inline)) void SHA2_CE_TARGET
+sha256_armv8_group(uint32x4_t *abcd, uint32x4_t *efgh, uint32x4_t w[4],
+    int g)
+{
+	const int cur = g % 4;
+	uint32x4_t k, abcd_old = *abcd;
+
+	k = vaddq_u32(w[cur], vld1q_u32(&sha256_armv8_k[4 * g]));
+	if (g < 12)
+		w[cur] = vsha256su0q_u32(w[cur], w[(g + 1) % 4]);
+	*abcd = vsha256hq_u32(*abcd, *efgh, k);
+	*efgh = vsha256h2q_u32(*efgh, abcd_old, k);
+	if (g < 12) {
+		w[cur] = vsha256su1q_u32(w[cur], w[(g + 2) % 4],
+		    w[(g + 3) % 4]);
+	}
+}
+
+static void SHA2_CE_TARGET
+sha256_armv8_transform(SHA2_CTX *ctx, const void *in, size_t blocks)
+{
+	const uint8_t *blk = in;
+	uint32x4_t abcd, efgh, abcd_save, efgh_save, w[4];
+	int i;
+
+	abcd = vld1q_u32(&ctx->state.s32[0]);
+	efgh = vld1q_u32(&ctx->state.s32[4]);
+
+	for (; blocks > 0; blocks--, blk += 64) {
+		abcd_save = abcd;
+		efgh_save = efgh;
+
+		for (i = 0; i < 4; i++) {
+			w[i] = vreinterpretq_u32_u8(
+			    vrev32q_u8(vld1q_u8(blk + 16 * i)));
+		}
+
+		sha256_armv8_group(&abcd, &efgh, w, 0);
+		sha256_armv8_group(&abcd, &efgh, w, 1);
+		sha256_armv8_group(&abcd, &efgh, w, 2);
+		sha256_armv8_group(&abcd, &efgh, w, 3);
+		sha256_armv8_group(&abcd, &efgh, w, 4);
+		sha256_armv8_group(&abcd, &efgh, w, 5);
+		sha256_armv8_group(&abcd, &efgh, w, 6);
+		sha256_armv8_group(&abcd, &efgh, w, 7);
+		sha256_armv8_group(&abcd, &efgh, w, 8);
+		sha256_armv8_group(&abcd, &efgh, w, 9);
+		sha256_armv8_group(&abcd, &efgh, w, 10);
+		sha256_armv8_group(&abcd, &efgh, w, 11);
+		sha256_armv8_group(&abcd, &efgh, w, 12);
+		sha256_armv8_group(&abcd, &efgh, w, 13);
+		sha256_armv8_group(&abcd, &efgh, w, 14);
+		sha256_armv8_group(&abcd, &efgh, w, 15);
+
+		abcd = vaddq_u32(abcd, abcd_save);
+		efgh = vaddq_u32(efgh, efgh_save);
+	}
+
+	vst1q_u32(&ctx->state.s32[0], abcd);
+	vst1q_u32(&ctx->state.s32[4], efgh);
+}
+
+static boolean_t
+sha256_armv8_valid(void)
+{
+	return ((getauxval(AT_HWCAP) & HWCAP_SHA2) != 0);
+}
+
+const sha2_ops_t sha256_armv8_ops = {
+	.transform = sha256_armv8_transform,
+	.valid = sha256_armv8_valid,
+	.name = "armv8"
+};
+
+#endif /* defined(__aarch64__) && !defined(_KERNEL) */
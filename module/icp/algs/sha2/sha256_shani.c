@@ -0,0 +1,191 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SHA-256 block transform using the x86 SHA extensions.  sha256rnds2 does
+ * two rounds at once on the state held as ABEF and CDGH, and sha256msg1
+ * and sha256msg2 extend the message schedule four words at a time.  Only
+ * the three SHA builtins are x86 specific; the shuffles around them are
+ * written with the compiler's vector extensions.
+ */
+
+#if defined(__x86_64) && defined(HAVE_SHA_NI) && defined(HAVE_SSE4_1)
+
+#include <sys/zfs_context.h>
+#include <sha2/sha2_consts.h>
+#define	_SHA2_IMPL
+#include <sha2/sha2_impl.h>
+#include <linux/simd_x86.h>
+
+#define	SHANI_TARGET	__attribute__((target("sha,sse4.1")))
+
+typedef uint32_t v4u_t __attribute__((vector_size(16)));
+typedef int32_t v4si_t __attribute__((vector_size(16)));
+typedef uint8_t v16u_t __attribute__((vector_size(16)));
+
+#if defined(__clang__)
+#define	VSHUF(a, b, ...)	__builtin_shufflevector(a, b, __VA_ARGS__)
+#define	VBSWAP(a)		__builtin_shufflevector(a, a,		\
+				    3, 2, 1, 0, 7, 6, 5, 4,		\
+				    11, 10, 9, 8, 15, 14, 13, 12)
+#else
+/* CSTYLED */
+#define	VSHUF(a, b, ...)	__builtin_shuffle(a, b, (v4u_t){ __VA_ARGS__ })
+/* CSTYLED */
+#define	VBSWAP(a)		__builtin_shuffle(a, (v16u_t){		\
+				    3, 2, 1, 0, 7, 6, 5, 4,		\
+				    11, 10, 9, 8, 15, 14, 13, 12 })
+#endif
+
+#define	RNDS2(s, t, k)	((v4u_t)__builtin_ia32_sha256rnds2(		\
+			    (v4si_t)(s), (v4si_t)(t), (v4si_t)(k)))
+#define	MSG1(a, b)	((v4u_t)__builtin_ia32_sha256msg1(		\
+			    (v4si_t)(a), (v4si_t)(b)))
+#define	MSG2(a, b)	((v4u_t)__builtin_ia32_sha256msg2(		\
+			    (v4si_t)(a), (v4si_t)(b)))
+
+static const uint32_t sha256_shani_k[64] __attribute__((aligned(16))) = {
+	SHA256_CONST_0, SHA256_CONST_1, SHA256_CONST_2,
+	SHA256_CONST_3, SHA256_CONST_4, SHA256_CONST_5,
+	SHA256_CONST_6, SHA256_CONST_7, SHA256_CONST_8,
+	SHA256_CONST_9, SHA256_CONST_10, SHA256_CONST_11,
+	SHA256_CONST_12, SHA256_CONST_13, SHA256_CONST_14,
+	SHA256_CONST_15, SHA256_CONST_16, SHA256_CONST_17,
+	SHA256_CONST_18, SHA256_CONST_19, SHA256_CONST_20,
+	SHA256_CONST_21, SHA256_CONST_22, SHA256_CONST_23,
+	SHA256_CONST_24, SHA256_CONST_25, SHA256_CONST_26,
+	SHA256_CONST_27, SHA256_CONST_28, SHA256_CONST_29,
+	SHA256_CONST_30, SHA256_CONST_31, SHA256_CONST_32,
+	SHA256_CONST_33, SHA256_CONST_34, SHA256_CONST_35,
+	SHA256_CONST_36, SHA256_CONST_37, SHA256_CONST_38,
+	SHA256_CONST_39, SHA256_CONST_40, SHA256_CONST_41,
+	SHA256_CONST_42, SHA256_CONST_43, SHA256_CONST_44,
+	SHA256_CONST_45, SHA256_CONST_46, SHA256_CONST_47,
+	SHA256_CONST_48, SHA256_CONST_49, SHA256_CONST_50,
+	SHA256_CONST_51, SHA256_CONST_52, SHA256_CONST_53,
+	SHA256_CONST_54, SHA256_CONST_55, SHA256_CONST_56,
+	SHA256_CONST_57, SHA256_CONST_58, SHA256_CONST_59,
+	SHA256_CONST_60, SHA256_CONST_61, SHA256_CONST_62,
+	SHA256_CONST_63
+};
+
+/*
+ * Rounds 4g to 4g + 3, with the message words of the group in w[g % 4].
+ * Groups 3 to 14 also finish the words of group g + 1, and groups 1 to 12
+ * start those of group g + 3.
+ */
+static inline __attribute__((always_inline)) void SHANI_TARGET
+sha256_shani_group(v4u_t *abef, v4u_t *cdgh, v4u_t w[4], int g)
+{
+	const int cur = g % 4, next = (g + 1) % 4, prev = (g + 3) % 4;
+	v4u_t k;
+
+	memcpy(&k, &sha256_shani_k[4 * g], sizeof (k));
+	k += w[cur];
+
+	*cdgh = RNDS2(*cdgh, *abef, k);
+	if (g >= 3 && g <= 14) {
+		/* Add the W[t - 7] terms, then the sigma1 ones */
+		w[next] += VSHUF(w[prev], w[cur], 1, 2, 3, 4);
+		w[next] = MSG2(w[next], w[cur]);
+	}
+	k = VSHUF(k, k, 2, 3, 0, 0);
+	*abef = RNDS2(*abef, *cdgh, k);
+	if (g >= 1 && g <= 12)
+		w[prev] = MSG1(w[prev], w[cur]);
+}
+
+static void SHANI_TARGET
+sha256_shani_blocks(SHA2_CTX *ctx, const uint8_t *in, size_t blocks)
+{
+	v4u_t abef, cdgh, abef_save, cdgh_save, t, w[4];
+	int i;
+
+	/* Rearrange ABCD and EFGH into ABEF and CDGH, highest word first */
+	memcpy(&t, &ctx->state.s32[0], sizeof (t));
+	memcpy(&cdgh, &ctx->state.s32[4], sizeof (cdgh));
+	t = VSHUF(t, t, 1, 0, 3, 2);
+	cdgh = VSHUF(cdgh, cdgh, 3, 2, 1, 0);
+	abef = VSHUF(cdgh, t, 2, 3, 4, 5);
+	cdgh = VSHUF(cdgh, t, 0, 1, 6, 7);
+
+	for (; blocks > 0; blocks--, in += 64) {
+		abef_save = abef;
+		cdgh_save = cdgh;
+
+		for (i = 0; i < 4; i++) {
+			v16u_t b;
+
+			memcpy(&b, in + 16 * i, sizeof (b));
+			w[i] = (v4u_t)VBSWAP(b);
+		}
+
+		sha256_shani_group(&abef, &cdgh, w, 0);
+		sha256_shani_group(&abef, &cdgh, w, 1);
+		sha256_shani_group(&abef, &cdgh, w, 2);
+		sha256_shani_group(&abef, &cdgh, w, 3);
+		sha256_shani_group(&abef, &cdgh, w, 4);
+		sha256_shani_group(&abef, &cdgh, w, 5);
+		sha256_shani_group(&abef, &cdgh, w, 6);
+		sha256_shani_group(&abef, &cdgh, w, 7);
+		sha256_shani_group(&abef, &cdgh, w, 8);
+		sha256_shani_group(&abef, &cdgh, w, 9);
+		sha256_shani_group(&abef, &cdgh, w, 10);
+		sha256_shani_group(&abef, &cdgh, w, 11);
+		sha256_shani_group(&abef, &cdgh, w, 12);
+		sha256_shani_group(&abef, &cdgh, w, 13);
+		sha256_shani_group(&abef, &cdgh, w, 14);
+		sha256_shani_group(&abef, &cdgh, w, 15);
+
+		abef += abef_save;
+		cdgh += cdgh_save;
+	}
+
+	/* And back to ABCD and EFGH */
+	t = VSHUF(abef, abef, 3, 2, 1, 0);
+	cdgh = VSHUF(cdgh, cdgh, 1, 0, 3, 2);
+	abef = VSHUF(t, cdgh, 0, 1, 6, 7);
+	cdgh = VSHUF(t, cdgh, 2, 3, 4, 5);
+	memcpy(&ctx->state.s32[0], &abef, sizeof (abef));
+	memcpy(&ctx->state.s32[4], &cdgh, sizeof (cdgh));
+}
+
+static void
+sha256_shani_transform(SHA2_CTX *ctx, const void *in, size_t blocks)
+{
+	kfpu_begin();
+	sha256_shani_blocks(ctx, in, blocks);
+	kfpu_end();
+}
+
+static boolean_t
+sha256_shani_valid(void)
+{
+	return (zfs_shani_available() && zfs_sse4_1_available());
+}
+
+const sha2_ops_t sha256_shani_ops = {
+	.transform = sha256_shani_transform,
+	.valid = sha256_shani_valid,
+	.name = "shani"
+};
+
+#endif /* defined(__x86_64) && defined(HAVE_SHA_NI) && defined(HAVE_SSE4_1) */
@@ -0,0 +1,517 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SHA-256 and SHA-512 block transform selection.  As for fletcher 4, the
+ * supported implementations of each are benchmarked when the module loads
+ * and the fastest one is used unless zfs_sha256_impl or zfs_sha512_impl
+ * names another.  SHA-384 and SHA-512/t share the SHA-512 transform.
+ */
+
+#include <sys/zfs_context.h>
+#define	_SHA2_IMPL
+#include <sha2/sha2_impl.h>
+
+#if defined(__amd64)
+/* OpenSSL derived transforms in asm-x86_64/sha2 */
+extern void SHA256TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
+extern void SHA512TransformBlocks(SHA2_CTX *ctx, const void *in, size_t num);
+
+static boolean_t
+sha2_x86_64_valid(void)
+{
+	return (B_TRUE);
+}
+
+const sha2_ops_t sha256_x86_64_ops = {
+	.transform = SHA256TransformBlocks,
+	.valid = sha2_x86_64_valid,
+	.name = "x86_64"
+};
+
+const sha2_ops_t sha512_x86_64_ops = {
+	.transform = SHA512TransformBlocks,
+	.valid = sha2_x86_64_valid,
+	.name = "x86_64"
+};
+#endif /* __amd64 */
+
+static const sha2_ops_t *const sha256_impls[] = {
+	&sha256_generic_ops,
+#if defined(__amd64)
+	&sha256_x86_64_ops,
+#endif
+#if defined(__x86_64) && defined(HAVE_SHA_NI) && defined(HAVE_SSE4_1)
+	&sha256_shani_ops,
+#endif
+#if defined(__aarch64__) && !defined(_KERNEL)
+	&sha256_armv8_ops,
+#endif
+};
+
+static const sha2_ops_t *const sha512_impls[] = {
+	&sha512_generic_ops,
+#if defined(__amd64)
+	&sha512_x86_64_ops,
+#endif
+};
+
+/* Used until the implementations have been benchmarked */
+#if defined(__amd64)
+#define	SHA256_DEFAULT_IMPL	(&sha256_x86_64_ops)
+#define	SHA512_DEFAULT_IMPL	(&sha512_x86_64_ops)
+#else
+#define	SHA256_DEFAULT_IMPL	(&sha256_generic_ops)
+#define	SHA512_DEFAULT_IMPL	(&sha512_generic_ops)
+#endif
+
+/* Select sha2 implementation */
+#define	IMPL_FASTEST	(UINT32_MAX)
+#define	IMPL_CYCLE	(UINT32_MAX - 1)
+#define	IMPL_GENERIC	(0)
+
+#define	IMPL_READ(i)	(*(volatile uint32_t *) &(i))
+
+static struct sha2_impl_selector {
+	const char	*sis_name;
+	uint32_t	sis_sel;
+} sha2_impl_selectors[] = {
+#if !defined(_KERNEL)
+	{ "cycle",	IMPL_CYCLE },
+#endif
+	{ "fastest",	IMPL_FASTEST },
+	{ "generic",	IMPL_GENERIC }
+};
+
+/*
+ * Implementations and selection state of one of the two transforms.  The
+ * stat array holds the bandwidth of each supported implementation in B/s,
+ * followed by the fastest one's index.
+ */
+typedef struct sha2_impl_family {
+	const char		*sf_name;
+	uint64_t		sf_mech;	/* benchmarked mechanism */
+	const sha2_ops_t *const	*sf_impls;
+	uint32_t		sf_impls_cnt;
+	const sha2_ops_t	**sf_supp_impls;
+	uint32_t		sf_supp_impls_cnt;
+	uint32_t		sf_chosen;
+	const sha2_ops_t	*sf_fastest;
+	uint64_t		*sf_stat;
+#if defined(_KERNEL)
+	kstat_t			*sf_kstat;
+#endif
+} sha2_impl_family_t;
+
+static const sha2_ops_t *sha256_supp_impls[ARRAY_SIZE(sha256_impls)];
+static const sha2_ops_t *sha512_supp_impls[ARRAY_SIZE(sha512_impls)];
+static uint64_t sha256_stat_data[ARRAY_SIZE(sha256_impls) + 1];
+static uint64_t sha512_stat_data[ARRAY_SIZE(sha512_impls) + 1];
+
+static sha2_impl_family_t sha256_family = {
+	.sf_name = "sha256",
+	.sf_mech = SHA256_MECH_INFO_TYPE,
+	.sf_impls = sha256_impls,
+	.sf_impls_cnt = ARRAY_SIZE(sha256_impls),
+	.sf_supp_impls = sha256_supp_impls,
+	.sf_chosen = IMPL_FASTEST,
+	.sf_fastest = SHA256_DEFAULT_IMPL,
+	.sf_stat = sha256_stat_data,
+};
+
+static sha2_impl_family_t sha512_family = {
+	.sf_name = "sha512",
+	.sf_mech = SHA512_MECH_INFO_TYPE,
+	.sf_impls = sha512_impls,
+	.sf_impls_cnt = ARRAY_SIZE(sha512_impls),
+	.sf_supp_impls = sha512_supp_impls,
+	.sf_chosen = IMPL_FASTEST,
+	.sf_fastest = SHA512_DEFAULT_IMPL,
+	.sf_stat = sha512_stat_data,
+};
+
+/* Indicate that benchmark has been completed */
+static boolean_t sha2_initialized = B_FALSE;
+
+static int
+sha2_impl_family_set(sha2_impl_family_t *fam, const char *val)
+{
+	int err = -EINVAL;
+	uint32_t impl = IMPL_READ(fam->sf_chosen);
+	size_t i, val_len;
+
+	val_len = strlen(val);
+	while ((val_len > 0) && !!isspace(val[val_len-1])) /* trim '\n' */
+		val_len--;
+
+	/* check mandatory implementations */
+	for (i = 0; i < ARRAY_SIZE(sha2_impl_selectors); i++) {
+		const char *name = sha2_impl_selectors[i].sis_name;
+
+		if (val_len == strlen(name) &&
+		    strncmp(val, name, val_len) == 0) {
+			impl = sha2_impl_selectors[i].sis_sel;
+			err = 0;
+			break;
+		}
+	}
+
+	if (err != 0 && sha2_initialized) {
+		/* check all supported implementations */
+		for (i = 0; i < fam->sf_supp_impls_cnt; i++) {
+			const char *name = fam->sf_supp_impls[i]->name;
+
+			if (val_len == strlen(name) &&
+			    strncmp(val, name, val_len) == 0) {
+				impl = i;
+				err = 0;
+				break;
+			}
+		}
+	}
+
+	if (err == 0) {
+		atomic_swap_32(&fam->sf_chosen, impl);
+		membar_producer();
+	}
+
+	return (err);
+}
+
+int
+sha256_impl_set(const char *val)
+{
+	return (sha2_impl_family_set(&sha256_family, val));
+}
+
+int
+sha512_impl_set(const char *val)
+{
+	return (sha2_impl_family_set(&sha512_family, val));
+}
+
+static const sha2_ops_t *
+sha2_impl_family_get(sha2_impl_family_t *fam)
+{
+	const sha2_ops_t *ops = NULL;
+	const uint32_t impl = IMPL_READ(fam->sf_chosen);
+
+	/*
+	 * Hashing before the first init, as anything linking libicp without
+	 * calling icp_init() does, uses the default implementation.
+	 */
+	if (!sha2_initialized)
+		return (fam->sf_fastest);
+
+	switch (impl) {
+	case IMPL_FASTEST:
+		ops = fam->sf_fastest;
+		break;
+#if !defined(_KERNEL)
+	case IMPL_CYCLE: {
+		ASSERT3U(fam->sf_supp_impls_cnt, >, 0);
+
+		static uint32_t cycle_count = 0;
+		uint32_t idx = (++cycle_count) % fam->sf_supp_impls_cnt;
+		ops = fam->sf_supp_impls[idx];
+	}
+	break;
+#endif
+	default:
+		ASSERT3U(fam->sf_supp_impls_cnt, >, 0);
+		ASSERT3U(impl, <, fam->sf_supp_impls_cnt);
+
+		ops = fam->sf_supp_impls[impl];
+		break;
+	}
+
+	ASSERT3P(ops, !=, NULL);
+
+	return (ops);
+}
+
+const sha2_ops_t *
+sha256_impl_get(void)
+{
+	return (sha2_impl_family_get(&sha256_family));
+}
+
+const sha2_ops_t *
+sha512_impl_get(void)
+{
+	return (sha2_impl_family_get(&sha512_family));
+}
+
+#if defined(_KERNEL)
+static int
+sha2_kstat_headers(char *buf, size_t size)
+{
+	ssize_t off = 0;
+
+	off += snprintf(buf + off, size, "%-17s", "implementation");
+	(void) snprintf(buf + off, size - off, "%-15s\n", "bandwidth");
+
+	return (0);
+}
+
+static int
+sha2_kstat_data(char *buf, size_t size, void *data)
+{
+	sha2_impl_family_t *fam;
+	uint64_t *fastest_stat;
+	uint64_t *curr_stat = (uint64_t *)data;
+	ssize_t off = 0;
+
+	/* The stat pointer tells which transform's kstat is being read */
+	fam = (curr_stat >= sha256_stat_data &&
+	    curr_stat < sha256_stat_data + ARRAY_SIZE(sha256_stat_data)) ?
+	    &sha256_family : &sha512_family;
+	fastest_stat = &fam->sf_stat[fam->sf_supp_impls_cnt];
+
+	if (curr_stat == fastest_stat) {
+		off += snprintf(buf + off, size - off, "%-17s", "fastest");
+		(void) snprintf(buf + off, size - off, "%-15s\n",
+		    fam->sf_supp_impls[*fastest_stat]->name);
+	} else {
+		ptrdiff_t id = curr_stat - fam->sf_stat;
+
+		off += snprintf(buf + off, size - off, "%-17s",
+		    fam->sf_supp_impls[id]->name);
+		(void) snprintf(buf + off, size - off, "%-15llu\n",
+		    (u_longlong_t)*curr_stat);
+	}
+
+	return (0);
+}
+
+static void *
+sha2_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	sha2_impl_family_t *fam = ksp->ks_data;
+
+	if (n <= fam->sf_supp_impls_cnt)
+		ksp->ks_private = (void *) (fam->sf_stat + n);
+	else
+		ksp->ks_private = NULL;
+
+	return (ksp->ks_private);
+}
+
+#define	SHA2_BENCH_NS	(MSEC2NSEC(50))		/* 50ms */
+
+static void
+sha2_benchmark(sha2_impl_family_t *fam, const uint8_t *data,
+    size_t data_size)
+{
+	uint64_t best_run = 0;
+	uint32_t i, l;
+
+	for (i = 0; i < fam->sf_supp_impls_cnt; i++) {
+		const sha2_ops_t *ops = fam->sf_supp_impls[i];
+		uint64_t run_count = 0, run_bw, run_time_ns;
+		uint8_t digest[SHA512_DIGEST_LENGTH];
+		hrtime_t start;
+
+		/* temporary set an implementation */
+		fam->sf_fastest = ops;
+
+		kpreempt_disable();
+		start = gethrtime();
+		do {
+			for (l = 0; l < 4; l++, run_count++) {
+				SHA2_CTX ctx;
+
+				SHA2Init(fam->sf_mech, &ctx);
+				SHA2Update(&ctx, data, data_size);
+				SHA2Final(digest, &ctx);
+			}
+
+			run_time_ns = gethrtime() - start;
+		} while (run_time_ns < SHA2_BENCH_NS);
+		kpreempt_enable();
+
+		run_bw = data_size * run_count * NANOSEC;
+		run_bw /= run_time_ns;	/* B/s */
+		fam->sf_stat[i] = run_bw;
+
+		if (run_bw > best_run) {
+			best_run = run_bw;
+			fam->sf_stat[fam->sf_supp_impls_cnt] = i;
+		}
+	}
+
+	fam->sf_fastest =
+	    fam->sf_supp_impls[fam->sf_stat[fam->sf_supp_impls_cnt]];
+}
+#endif /* _KERNEL */
+
+static void
+sha2_impl_family_init(sha2_impl_family_t *fam)
+{
+	int i, c;
+
+	/* move supported impl into sf_supp_impls */
+	for (i = 0, c = 0; i < fam->sf_impls_cnt; i++) {
+		const sha2_ops_t *curr_impl = fam->sf_impls[i];
+
+		if (curr_impl->valid && curr_impl->valid())
+			fam->sf_supp_impls[c++] = curr_impl;
+	}
+	membar_producer();	/* complete sf_supp_impls[] init */
+	fam->sf_supp_impls_cnt = c;	/* number of supported impl */
+
+	/* Use last implementation as fastest until benchmarked */
+	fam->sf_fastest = fam->sf_supp_impls[fam->sf_supp_impls_cnt - 1];
+	fam->sf_stat[fam->sf_supp_impls_cnt] = fam->sf_supp_impls_cnt - 1;
+	membar_producer();
+}
+
+#if defined(_KERNEL)
+static void
+sha2_impl_family_kstat_init(sha2_impl_family_t *fam)
+{
+	char name[KSTAT_STRLEN];
+
+	(void) snprintf(name, sizeof (name), "%s_bench", fam->sf_name);
+	fam->sf_kstat = kstat_create("zfs", 0, name, "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (fam->sf_kstat != NULL) {
+		fam->sf_kstat->ks_data = fam;
+		fam->sf_kstat->ks_ndata = UINT32_MAX;
+		kstat_set_raw_ops(fam->sf_kstat,
+		    sha2_kstat_headers,
+		    sha2_kstat_data,
+		    sha2_kstat_addr);
+		kstat_install(fam->sf_kstat);
+	}
+}
+#endif
+
+void
+sha2_impl_init(void)
+{
+#if defined(_KERNEL)
+	static const size_t data_size = 128 * 1024;
+	uint8_t *databuf;
+	int i;
+#endif
+
+	sha2_impl_family_init(&sha256_family);
+	sha2_impl_family_init(&sha512_family);
+	sha2_initialized = B_TRUE;
+
+#if defined(_KERNEL)
+	/* Benchmark all supported implementations */
+	databuf = vmem_alloc(data_size, KM_SLEEP);
+	for (i = 0; i < data_size; i++)
+		databuf[i] = (uint8_t)i;
+
+	sha2_benchmark(&sha256_family, databuf, data_size);
+	sha2_benchmark(&sha512_family, databuf, data_size);
+
+	vmem_free(databuf, data_size);
+
+	/* install kstats for all implementations */
+	sha2_impl_family_kstat_init(&sha256_family);
+	sha2_impl_family_kstat_init(&sha512_family);
+#endif
+}
+
+void
+sha2_impl_fini(void)
+{
+#if defined(_KERNEL)
+	sha2_impl_family_t *fams[] = { &sha256_family, &sha512_family };
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fams); i++) {
+		if (fams[i]->sf_kstat != NULL) {
+			kstat_delete(fams[i]->sf_kstat);
+			fams[i]->sf_kstat = NULL;
+		}
+	}
+#endif
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+#include <linux/mod_compat.h>
+
+static int
+sha2_param_get(sha2_impl_family_t *fam, char *buffer)
+{
+	const uint32_t impl = IMPL_READ(fam->sf_chosen);
+	char *fmt;
+	int i, cnt = 0;
+
+	/* list fastest */
+	fmt = (impl == IMPL_FASTEST) ? "[%s] " : "%s ";
+	cnt += sprintf(buffer + cnt, fmt, "fastest");
+
+	/* list all supported implementations */
+	for (i = 0; i < fam->sf_supp_impls_cnt; i++) {
+		fmt = (i == impl) ? "[%s] " : "%s ";
+		cnt += sprintf(buffer + cnt, fmt,
+		    fam->sf_supp_impls[i]->name);
+	}
+
+	return (cnt);
+}
+
+static int
+sha256_param_get(char *buffer, zfs_kernel_param_t *unused)
+{
+	return (sha2_param_get(&sha256_family, buffer));
+}
+
+static int
+sha256_param_set(const char *val, zfs_kernel_param_t *unused)
+{
+	return (sha256_impl_set(val));
+}
+
+static int
+sha512_param_get(char *buffer, zfs_kernel_param_t *unused)
+{
+	return (sha2_param_get(&sha512_family, buffer));
+}
+
+static int
+sha512_param_set(const char *val, zfs_kernel_param_t *unused)
+{
+	return (sha512_impl_set(val));
+}
+
+/*
+ * Choose the SHA-256 and SHA-512 block transforms.  As with
+ * zfs_fletcher_4_impl, "cycle" exercises all implementations and can only
+ * be set in user space.
+ */
+module_param_call(zfs_sha256_impl,
+    sha256_param_set, sha256_param_get, NULL, 0644);
+MODULE_PARM_DESC(zfs_sha256_impl, "Select SHA-256 implementation.");
+
+module_param_call(zfs_sha512_impl,
+    sha512_param_set, sha512_param_get, NULL, 0644);
+MODULE_PARM_DESC(zfs_sha512_impl, "Select SHA-512 implementation.");
+
+EXPORT_SYMBOL(sha256_impl_set);
+EXPORT_SYMBOL(sha512_impl_set);
+#endif
@@ -581,7 +581,7 @@ static inline int EMPTY_TASKQ(taskq_t *tq)
 #ifdef _KERNEL
 	return (tq->tq_lowest_id == tq->tq_next_id);
 #else
-	return (tq->tq_task.tqent_next == &tq->tq_task || tq->tq_active == 0);
+	return (tq->tq_pending == 0);
 #endif
 }
 
@@ -38,6 +38,8 @@
 #include <sys/crypto/sched_impl.h>
 #include <sys/modhash_impl.h>
 #include <sys/crypto/icp.h>
+#include <sys/blake3.h>
+#include <sys/sha2.h>
 
 /*
  * Changes made to the original Illumos Crypto Layer for the ICP:
@@ -109,8 +111,10 @@
 void __exit
 icp_fini(void)
 {
+	blake3_impl_fini();
 	skein_mod_fini();
 	sha2_mod_fini();
+	sha2_impl_fini();
 	sha1_mod_fini();
 	edonr_mod_fini();
 	aes_mod_fini();
@@ -143,8 +147,10 @@ icp_init(void)
 	aes_mod_init();
 	edonr_mod_init();
 	sha1_mod_init();
+	sha2_impl_init();
 	sha2_mod_init();
 	skein_mod_init();
+	blake3_impl_init();
 
 	return (0);
 }
@@ -0,0 +1,128 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_BLAKE3_IMPL_H
+#define	_BLAKE3_IMPL_H
+
+#include <sys/zfs_context.h>
+#include <sys/blake3.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/* Domain separation flags */
+#define	BLAKE3_CHUNK_START	(1 << 0)
+#define	BLAKE3_CHUNK_END	(1 << 1)
+#define	BLAKE3_PARENT		(1 << 2)
+#define	BLAKE3_ROOT		(1 << 3)
+#define	BLAKE3_KEYED_HASH	(1 << 4)
+
+/* Widest implementation, in chunks hashed at once */
+#define	BLAKE3_MAX_DEGREE	16
+
+#define	blake3_inline	inline __attribute__((always_inline))
+
+extern const uint32_t blake3_iv[8];
+
+/*
+ * Message word order for each round, permuted from the previous one.  Each
+ * implementation keeps a static copy so that, with the rounds unrolled,
+ * the schedule folds into constant indices.
+ */
+#define	BLAKE3_MSG_SCHEDULE {						\
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },	\
+	{ 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },	\
+	{ 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },	\
+	{ 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },	\
+	{ 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },	\
+	{ 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },	\
+	{ 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 }	\
+}
+
+/*
+ * Hash n inputs of the given number of whole blocks each, in parallel,
+ * writing n chaining values to out.  Input i uses counter + i when
+ * increment is set; every block gets flags, the first also flags_start
+ * and the last also flags_end.
+ */
+typedef void blake3_hash_many_f(const uint8_t * const *inputs, size_t n,
+    size_t blocks, const uint32_t key[8], uint64_t counter,
+    boolean_t increment, uint8_t flags, uint8_t flags_start,
+    uint8_t flags_end, uint8_t *out);
+
+typedef struct blake3_ops {
+	blake3_hash_many_f	*hash_many;
+	boolean_t		(*valid)(void);
+	size_t			degree;	/* inputs hashed at once */
+	const char		*name;
+} blake3_ops_t;
+
+extern const blake3_ops_t blake3_generic_ops;
+
+#if defined(__x86_64) && defined(HAVE_SSE4_1)
+extern const blake3_ops_t blake3_sse41_ops;
+#endif
+
+#if defined(__x86_64) && defined(HAVE_AVX2)
+extern const blake3_ops_t blake3_avx2_ops;
+#endif
+
+#if defined(__x86_64) && defined(HAVE_AVX512F)
+extern const blake3_ops_t blake3_avx512_ops;
+#endif
+
+#if defined(__aarch64__) && !defined(_KERNEL)
+extern const blake3_ops_t blake3_neon_ops;
+#endif
+
+extern const blake3_ops_t *blake3_impl_get(void);
+
+extern void blake3_compress_in_place(uint32_t cv[8],
+    const uint8_t block[BLAKE3_BLOCK_LEN], uint8_t block_len,
+    uint64_t counter, uint8_t flags);
+extern blake3_hash_many_f blake3_generic_hash_many;
+
+static inline uint32_t
+blake3_load32(const void *src)
+{
+	const uint8_t *p = src;
+
+	return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static inline void
+blake3_store32(void *dst, uint32_t w)
+{
+	uint8_t *p = dst;
+
+	p[0] = (uint8_t)w;
+	p[1] = (uint8_t)(w >> 8);
+	p[2] = (uint8_t)(w >> 16);
+	p[3] = (uint8_t)(w >> 24);
+}
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _BLAKE3_IMPL_H */
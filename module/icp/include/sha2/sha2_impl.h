@@ -57,6 +57,39 @@ typedef struct sha2_hmac_ctx {
 	SHA2_CTX		hc_ocontext;	/* outer SHA2 context */
 } sha2_hmac_ctx_t;
 
+/*
+ * Hash blocks whole blocks of in into ctx->state.  Each implementation of
+ * the SHA-256 or SHA-512 block transform provides one of these, and
+ * SHA2Update() uses the one selected by zfs_sha256_impl or
+ * zfs_sha512_impl.
+ */
+typedef void sha2_transform_f(SHA2_CTX *ctx, const void *in, size_t blocks);
+
+typedef struct sha2_ops {
+	sha2_transform_f	*transform;
+	boolean_t		(*valid)(void);
+	const char		*name;
+} sha2_ops_t;
+
+extern const sha2_ops_t sha256_generic_ops;
+extern const sha2_ops_t sha512_generic_ops;
+
+#if defined(__amd64)
+extern const sha2_ops_t sha256_x86_64_ops;
+extern const sha2_ops_t sha512_x86_64_ops;
+#endif
+
+#if defined(__x86_64) && defined(HAVE_SHA_NI) && defined(HAVE_SSE4_1)
+extern const sha2_ops_t sha256_shani_ops;
+#endif
+
+#if defined(__aarch64__) && !defined(_KERNEL)
+extern const sha2_ops_t sha256_armv8_ops;
+#endif
+
+extern const sha2_ops_t *sha256_impl_get(void);
+extern const sha2_ops_t *sha512_impl_get(void);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,179 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/isa_defs.h>
+#include <sys/nvpair.h>
+#include <sys/sysmacros.h>
+#include <sys/kmem.h>
+#if defined(_KERNEL) && !defined(_BOOT)
+#include <sys/varargs.h>
+#include <sys/vmem.h>
+#define	nv_arena_mem_alloc(size)	vmem_alloc(size, KM_SLEEP)
+#define	nv_arena_mem_free(buf, size)	vmem_free(buf, size)
+#else
+#include <stdarg.h>
+#include <strings.h>
+#define	nv_arena_mem_alloc(size)	kmem_alloc(size, KM_SLEEP)
+#define	nv_arena_mem_free(buf, size)	kmem_free(buf, size)
+#endif
+
+/*
+ * This allocator carves the memory of an nvlist out of large chunks.
+ *  - an allocation bumps a pointer in the current chunk.
+ *  - it does _not_ free memory until the allocator is reset or fini'd,
+ *    which frees all the chunks at once.
+ *
+ * It suits nvlists that are built or unpacked, used and thrown away as a
+ * whole, such as the ones passed in and out of an ioctl: each nvpair then
+ * costs a few instructions instead of a kmem allocation and free.  The
+ * caller may sleep, and must free every nvlist allocated from the arena
+ * before calling nv_alloc_fini().
+ */
+
+/* default size of a chunk, used when nv_alloc_init() is passed 0 */
+#define	NV_ARENA_CHUNK_SIZE	(16 * 1024)
+
+typedef struct nvarena_chunk {
+	struct nvarena_chunk	*nac_next;
+	size_t			nac_size;	/* including this header */
+} nvarena_chunk_t;
+
+typedef struct nvarena {
+	nvarena_chunk_t	*nar_chunks;	/* current chunk first */
+	uintptr_t	nar_cur;	/* next free address in nar_chunks */
+	uintptr_t	nar_lim;	/* limit address of nar_chunks */
+	size_t		nar_chunk_size;
+} nvarena_t;
+
+/*
+ * Initialize the arena allocator. The caller needs to supply
+ *
+ *   chunksz	size of the chunks to allocate from, or 0 for the default
+ */
+static int
+nv_arena_init(nv_alloc_t *nva, va_list valist)
+{
+	size_t chunksz = va_arg(valist, size_t);
+	nvarena_t *nar;
+
+	if (chunksz == 0)
+		chunksz = NV_ARENA_CHUNK_SIZE;
+	if (chunksz < 2 * sizeof (nvarena_chunk_t))
+		return (EINVAL);
+
+	if ((nar = kmem_alloc(sizeof (nvarena_t), KM_SLEEP)) == NULL)
+		return (ENOMEM);
+
+	nar->nar_chunks = NULL;
+	nar->nar_cur = 0;
+	nar->nar_lim = 0;
+	nar->nar_chunk_size = chunksz;
+	nva->nva_arg = nar;
+
+	return (0);
+}
+
+static void *
+nv_arena_alloc(nv_alloc_t *nva, size_t size)
+{
+	nvarena_t *nar = nva->nva_arg;
+	nvarena_chunk_t *nac;
+	uintptr_t new = nar->nar_cur;
+	size_t chunksz;
+
+	if (size == 0)
+		return (NULL);
+
+	if (new + size <= nar->nar_lim) {
+		nar->nar_cur = P2ROUNDUP(new + size, sizeof (uint64_t));
+		return ((void *)new);
+	}
+
+	/*
+	 * A request larger than a quarter of a chunk gets a chunk of its
+	 * own, which is linked behind the current one so that the space left
+	 * in the current chunk is still used.
+	 */
+	chunksz = sizeof (nvarena_chunk_t) + size;
+	if (size <= nar->nar_chunk_size / 4)
+		chunksz = nar->nar_chunk_size;
+
+	if ((nac = nv_arena_mem_alloc(chunksz)) == NULL)
+		return (NULL);
+	nac->nac_size = chunksz;
+	new = (uintptr_t)&nac[1];
+
+	if (chunksz != nar->nar_chunk_size && nar->nar_chunks != NULL) {
+		nac->nac_next = nar->nar_chunks->nac_next;
+		nar->nar_chunks->nac_next = nac;
+		return ((void *)new);
+	}
+
+	nac->nac_next = nar->nar_chunks;
+	nar->nar_chunks = nac;
+	nar->nar_cur = P2ROUNDUP(new + size, sizeof (uint64_t));
+	nar->nar_lim = (uintptr_t)nac + chunksz;
+
+	return ((void *)new);
+}
+
+/*ARGSUSED*/
+static void
+nv_arena_free(nv_alloc_t *nva, void *buf, size_t size)
+{
+	/* memory is returned when the whole arena is reset */
+}
+
+static void
+nv_arena_reset(nv_alloc_t *nva)
+{
+	nvarena_t *nar = nva->nva_arg;
+	nvarena_chunk_t *nac;
+
+	while ((nac = nar->nar_chunks) != NULL) {
+		nar->nar_chunks = nac->nac_next;
+		nv_arena_mem_free(nac, nac->nac_size);
+	}
+	nar->nar_cur = 0;
+	nar->nar_lim = 0;
+}
+
+static void
+nv_arena_fini(nv_alloc_t *nva)
+{
+	nv_arena_reset(nva);
+	kmem_free(nva->nva_arg, sizeof (nvarena_t));
+	nva->nva_arg = NULL;
+}
+
+const nv_alloc_ops_t nv_arena_ops_def = {
+	.nv_ao_init = nv_arena_init,
+	.nv_ao_fini = nv_arena_fini,
+	.nv_ao_alloc = nv_arena_alloc,
+	.nv_ao_free = nv_arena_free,
+	.nv_ao_reset = nv_arena_reset
+};
+
+const nv_alloc_ops_t *nv_arena_ops = &nv_arena_ops_def;
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+EXPORT_SYMBOL(nv_arena_ops);
+#endif
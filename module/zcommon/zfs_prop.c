@@ -79,6 +79,7 @@ zfs_prop_init(void)
 		{ "sha512",	ZIO_CHECKSUM_SHA512 },
 		{ "skein",	ZIO_CHECKSUM_SKEIN },
 		{ "edonr",	ZIO_CHECKSUM_EDONR },
+		{ "blake3",	ZIO_CHECKSUM_BLAKE3 },
 		{ NULL }
 	};
 
@@ -97,6 +98,9 @@ zfs_prop_init(void)
 				ZIO_CHECKSUM_SKEIN | ZIO_CHECKSUM_VERIFY },
 		{ "edonr,verify",
 				ZIO_CHECKSUM_EDONR | ZIO_CHECKSUM_VERIFY },
+		{ "blake3",	ZIO_CHECKSUM_BLAKE3 },
+		{ "blake3,verify",
+				ZIO_CHECKSUM_BLAKE3 | ZIO_CHECKSUM_VERIFY },
 		{ NULL }
 	};
 
@@ -116,6 +120,70 @@ zfs_prop_init(void)
 		{ "gzip-9",	ZIO_COMPRESS_GZIP_9 },
 		{ "zle",	ZIO_COMPRESS_ZLE },
 		{ "lz4",	ZIO_COMPRESS_LZ4 },
+		{ "zstd",	ZIO_COMPRESS_ZSTD },	/* zstd default */
+		{ "zstd-1",	ZIO_COMPLEVEL_ZSTD(1) },
+		{ "zstd-2",	ZIO_COMPLEVEL_ZSTD(2) },
+		{ "zstd-3",	ZIO_COMPLEVEL_ZSTD(3) },
+		{ "zstd-4",	ZIO_COMPLEVEL_ZSTD(4) },
+		{ "zstd-5",	ZIO_COMPLEVEL_ZSTD(5) },
+		{ "zstd-6",	ZIO_COMPLEVEL_ZSTD(6) },
+		{ "zstd-7",	ZIO_COMPLEVEL_ZSTD(7) },
+		{ "zstd-8",	ZIO_COMPLEVEL_ZSTD(8) },
+		{ "zstd-9",	ZIO_COMPLEVEL_ZSTD(9) },
+		{ "zstd-10",	ZIO_COMPLEVEL_ZSTD(10) },
+		{ "zstd-11",	ZIO_COMPLEVEL_ZSTD(11) },
+		{ "zstd-12",	ZIO_COMPLEVEL_ZSTD(12) },
+		{ "zstd-13",	ZIO_COMPLEVEL_ZSTD(13) },
+		{ "zstd-14",	ZIO_COMPLEVEL_ZSTD(14) },
+		{ "zstd-15",	ZIO_COMPLEVEL_ZSTD(15) },
+		{ "zstd-16",	ZIO_COMPLEVEL_ZSTD(16) },
+		{ "zstd-17",	ZIO_COMPLEVEL_ZSTD(17) },
+		{ "zstd-18",	ZIO_COMPLEVEL_ZSTD(18) },
+		{ "zstd-19",	ZIO_COMPLEVEL_ZSTD(19) },
+		{ "zstd-fast",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 1) },
+		{ "zstd-fast-1",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 1) },
+		{ "zstd-fast-2",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 2) },
+		{ "zstd-fast-3",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 3) },
+		{ "zstd-fast-4",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 4) },
+		{ "zstd-fast-5",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 5) },
+		{ "zstd-fast-6",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 6) },
+		{ "zstd-fast-7",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 7) },
+		{ "zstd-fast-8",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 8) },
+		{ "zstd-fast-9",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 9) },
+		{ "zstd-fast-10",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 10) },
+		{ "zstd-fast-20",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 20) },
+		{ "zstd-fast-30",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 30) },
+		{ "zstd-fast-40",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 40) },
+		{ "zstd-fast-50",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 50) },
+		{ "zstd-fast-60",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 60) },
+		{ "zstd-fast-70",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 70) },
+		{ "zstd-fast-80",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 80) },
+		{ "zstd-fast-90",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 90) },
+		{ "zstd-fast-100",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 100) },
+		{ "zstd-fast-500",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 500) },
+		{ "zstd-fast-1000",
+		    ZIO_COMPLEVEL_ZSTD(ZIO_ZSTD_LEVEL_FAST + 1000) },
 		{ NULL }
 	};
 
@@ -268,15 +336,17 @@ zfs_prop_init(void)
 	    ZIO_CHECKSUM_DEFAULT, PROP_INHERIT, ZFS_TYPE_FILESYSTEM |
 	    ZFS_TYPE_VOLUME,
 	    "on | off | fletcher2 | fletcher4 | sha256 | sha512 | "
-	    "skein | edonr", "CHECKSUM", checksum_table);
+	    "skein | edonr | blake3", "CHECKSUM", checksum_table);
 	zprop_register_index(ZFS_PROP_DEDUP, "dedup", ZIO_CHECKSUM_OFF,
 	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
 	    "on | off | verify | sha256[,verify], sha512[,verify], "
-	    "skein[,verify], edonr,verify", "DEDUP", dedup_table);
+	    "skein[,verify], edonr,verify, blake3[,verify]", "DEDUP",
+	    dedup_table);
 	zprop_register_index(ZFS_PROP_COMPRESSION, "compression",
 	    ZIO_COMPRESS_DEFAULT, PROP_INHERIT,
 	    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
-	    "on | off | lzjb | gzip | gzip-[1-9] | zle | lz4", "COMPRESS",
+	    "on | off | lzjb | gzip | gzip-[1-9] | zle | lz4 | zstd | "
+	    "zstd-[1-19] | zstd-fast-[1-10,20-100,500,1000]", "COMPRESS",
 	    compress_table);
 	zprop_register_index(ZFS_PROP_SNAPDIR, "snapdir", ZFS_SNAPDIR_HIDDEN,
 	    PROP_INHERIT, ZFS_TYPE_FILESYSTEM,
@@ -487,6 +557,18 @@ zfs_prop_init(void)
 	zprop_register_number(ZFS_PROP_SNAPSHOT_LIMIT, "snapshot_limit",
 	    UINT64_MAX, PROP_DEFAULT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
 	    "<count> | none", "SSLIMIT");
+	zprop_register_number(ZFS_PROP_READ_IOPS_LIMIT,
+	    "io.openebs:read_iops_limit", 0, PROP_DEFAULT, ZFS_TYPE_VOLUME,
+	    "<iops> | none", "RIOPSLIMIT");
+	zprop_register_number(ZFS_PROP_WRITE_IOPS_LIMIT,
+	    "io.openebs:write_iops_limit", 0, PROP_DEFAULT, ZFS_TYPE_VOLUME,
+	    "<iops> | none", "WIOPSLIMIT");
+	zprop_register_number(ZFS_PROP_READ_BW_LIMIT,
+	    "io.openebs:read_bw_limit", 0, PROP_DEFAULT, ZFS_TYPE_VOLUME,
+	    "<bytes/s> | none", "RBWLIMIT");
+	zprop_register_number(ZFS_PROP_WRITE_BW_LIMIT,
+	    "io.openebs:write_bw_limit", 0, PROP_DEFAULT, ZFS_TYPE_VOLUME,
+	    "<bytes/s> | none", "WBWLIMIT");
 
 	/* inherit number properties */
 	zprop_register_number(ZFS_PROP_RECORDSIZE, "recordsize",
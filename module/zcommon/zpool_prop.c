@@ -128,6 +128,9 @@ zpool_prop_init(void)
 	zprop_register_index(ZPOOL_PROP_MULTIHOST, "multihost", 0,
 	    PROP_DEFAULT, ZFS_TYPE_POOL, "on | off", "MULTIHOST",
 	    boolean_table);
+	zprop_register_index(ZPOOL_PROP_AUTOTRIM, "autotrim", 0,
+	    PROP_DEFAULT, ZFS_TYPE_POOL, "on | off", "AUTOTRIM",
+	    boolean_table);
 
 	/* default index properties */
 	zprop_register_index(ZPOOL_PROP_FAILUREMODE, "failmode",
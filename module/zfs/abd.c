@@ -123,6 +123,7 @@
 #include <linux/scatterlist.h>
 #include <linux/kmap_compat.h>
 #else
+#include <sys/mman.h>
 #define	MAX_ORDER	1
 #endif
 
@@ -136,8 +137,11 @@ typedef struct abd_stats {
 	kstat_named_t abdstat_scatter_orders[MAX_ORDER];
 	kstat_named_t abdstat_scatter_page_multi_chunk;
 	kstat_named_t abdstat_scatter_page_multi_zone;
+	kstat_named_t abdstat_scatter_page_remote_node;
 	kstat_named_t abdstat_scatter_page_alloc_retry;
 	kstat_named_t abdstat_scatter_sg_table_retry;
+	kstat_named_t abdstat_hugepage_slabs;
+	kstat_named_t abdstat_hugepage_chunks;
 } abd_stats_t;
 
 static abd_stats_t abd_stats = {
@@ -182,6 +186,11 @@ static abd_stats_t abd_stats = {
 	 * ABDs are preferentially allocated using pages from a single zone.
 	 */
 	{ "scatter_page_multi_zone",		KSTAT_DATA_UINT64 },
+	/*
+	 * The number of scatter ABDs which have pages on a NUMA node other
+	 * than the one of the CPU which allocated them.
+	 */
+	{ "scatter_page_remote_node",		KSTAT_DATA_UINT64 },
 	/*
 	 *  The total number of retries encountered when attempting to
 	 *  allocate the pages to populate the scatter ABD.
@@ -192,6 +201,14 @@ static abd_stats_t abd_stats = {
 	 *  allocate the sg table for an ABD.
 	 */
 	{ "scatter_sg_table_retry",		KSTAT_DATA_UINT64 },
+	/*
+	 * The number of 2MB slabs that chunks are carved from when
+	 * zfs_abd_hugepages is set, and the number of chunks in use in them.
+	 * Their ratio to the slabs' 512 chunks each is the huge page
+	 * utilisation.  Userspace only.
+	 */
+	{ "hugepage_slabs",			KSTAT_DATA_UINT64 },
+	{ "hugepage_chunks",			KSTAT_DATA_UINT64 },
 };
 
 #define	ABDSTAT(stat)		(abd_stats.stat.value.ui64)
@@ -201,6 +218,7 @@ static abd_stats_t abd_stats = {
 #define	ABDSTAT_BUMPDOWN(stat)	ABDSTAT_INCR(stat, -1)
 
 #define	ABD_SCATTER(abd)	(abd->abd_u.abd_scatter)
+#define	ABD_GANG(abd)		(abd->abd_u.abd_gang)
 #define	ABD_BUF(abd)		(abd->abd_u.abd_linear.abd_buf)
 #define	abd_for_each_sg(abd, sg, n, i)	\
 	for_each_sg(ABD_SCATTER(abd).abd_sgl, sg, n, i)
@@ -212,6 +230,105 @@ unsigned zfs_abd_scatter_max_order = MAX_ORDER - 1;
 static kmem_cache_t *abd_cache = NULL;
 static kstat_t *abd_ksp;
 
+#ifndef _KERNEL
+/*
+ * In the kernel, pages come from the page allocator and abd_t's from an SPL
+ * kmem cache, both of which already keep per-CPU lists of free objects.  In
+ * userspace, umem is a thin wrapper around malloc, and every chunk is a
+ * page-aligned allocation.  Since every read miss and write allocates ABDs,
+ * free chunks and abd_t's are kept in per-CPU magazines of up to
+ * zfs_abd_magazine_size objects each, and are only handed back to umem when
+ * a magazine is full or when the ARC reaps its caches, see
+ * abd_cache_reap_now().  0 disables the magazines.
+ */
+#define	ABD_MAGAZINE_MAX	256
+
+typedef struct abd_magazine {
+	kmutex_t	am_lock;
+	int		am_rounds;
+	void		*am_objs[ABD_MAGAZINE_MAX];
+} abd_magazine_t;
+
+int zfs_abd_magazine_size = 64;
+
+static abd_magazine_t *abd_chunk_mags;
+static abd_magazine_t *abd_struct_mags;
+
+static abd_magazine_t *
+abd_magazines_create(void)
+{
+	abd_magazine_t *mags;
+	int i;
+
+	mags = kmem_zalloc(boot_ncpus * sizeof (abd_magazine_t), KM_SLEEP);
+	for (i = 0; i < boot_ncpus; i++)
+		mutex_init(&mags[i].am_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	return (mags);
+}
+
+static void *
+abd_magazine_alloc(abd_magazine_t *mags)
+{
+	abd_magazine_t *am = &mags[CPU_SEQID];
+	void *obj = NULL;
+
+	mutex_enter(&am->am_lock);
+	if (am->am_rounds > 0)
+		obj = am->am_objs[--am->am_rounds];
+	mutex_exit(&am->am_lock);
+
+	return (obj);
+}
+
+/*
+ * Returns B_FALSE if the magazine of this CPU is full, in which case the
+ * caller frees obj itself.
+ */
+static boolean_t
+abd_magazine_free(abd_magazine_t *mags, void *obj)
+{
+	abd_magazine_t *am = &mags[CPU_SEQID];
+	int max = MIN(zfs_abd_magazine_size, ABD_MAGAZINE_MAX);
+	boolean_t cached = B_FALSE;
+
+	mutex_enter(&am->am_lock);
+	if (am->am_rounds < max) {
+		am->am_objs[am->am_rounds++] = obj;
+		cached = B_TRUE;
+	}
+	mutex_exit(&am->am_lock);
+
+	return (cached);
+}
+
+static void
+abd_magazines_reap(abd_magazine_t *mags, void (*free_fn)(void *))
+{
+	int i;
+
+	for (i = 0; i < boot_ncpus; i++) {
+		abd_magazine_t *am = &mags[i];
+
+		mutex_enter(&am->am_lock);
+		while (am->am_rounds > 0)
+			free_fn(am->am_objs[--am->am_rounds]);
+		mutex_exit(&am->am_lock);
+	}
+}
+
+static void
+abd_magazines_destroy(abd_magazine_t *mags, void (*free_fn)(void *))
+{
+	int i;
+
+	abd_magazines_reap(mags, free_fn);
+	for (i = 0; i < boot_ncpus; i++)
+		mutex_destroy(&mags[i].am_lock);
+	kmem_free(mags, boot_ncpus * sizeof (abd_magazine_t));
+}
+#endif /* !_KERNEL */
+
 static inline size_t
 abd_chunkcnt_for_bytes(size_t size)
 {
@@ -243,6 +360,12 @@ abd_alloc_chunk(int nid, gfp_t gfp, unsigned int order)
  * progressively decreased until it can be satisfied without performing
  * reclaim or compaction.  When necessary this function will degenerate to
  * allocating individual pages and allowing reclaim to satisfy allocations.
+ *
+ * The pages are taken from the NUMA node of the allocating CPU, which is
+ * normally the one that goes on to access the data.  Compound pages are
+ * only ever taken from that node, so that a local allocation of a lower
+ * order is preferred over a remote one of a higher order.  Only single
+ * pages may fall back to a remote node.
  */
 static void
 abd_alloc_pages(abd_t *abd, size_t size)
@@ -255,9 +378,10 @@ abd_alloc_pages(abd_t *abd, size_t size)
 	gfp_t gfp_comp = (gfp | __GFP_NORETRY | __GFP_COMP) & ~__GFP_RECLAIM;
 	int max_order = MIN(zfs_abd_scatter_max_order, MAX_ORDER - 1);
 	int nr_pages = abd_chunkcnt_for_bytes(size);
-	int chunks = 0, zones = 0;
+	int chunks = 0, zones = 0, remote = 0;
 	size_t remaining_size;
-	int nid = NUMA_NO_NODE;
+	int nid = numa_node_id();
+	int prev_nid = NUMA_NO_NODE;
 	int alloc_pages = 0;
 	int order;
 
@@ -270,7 +394,8 @@ abd_alloc_pages(abd_t *abd, size_t size)
 		order = MIN(highbit64(nr_pages - alloc_pages) - 1, max_order);
 		chunk_pages = (1U << order);
 
-		paddr = abd_alloc_chunk(nid, order ? gfp_comp : gfp, order);
+		paddr = abd_alloc_chunk(nid,
+		    order ? (gfp_comp | __GFP_THISNODE) : gfp, order);
 		if (paddr == 0) {
 			if (order == 0) {
 				ABDSTAT_BUMP(abdstat_scatter_page_alloc_retry);
@@ -284,10 +409,12 @@ abd_alloc_pages(abd_t *abd, size_t size)
 		page = virt_to_page(paddr);
 		list_add_tail(&page->lru, &pages);
 
-		if ((nid != NUMA_NO_NODE) && (page_to_nid(page) != nid))
+		if (prev_nid != NUMA_NO_NODE && page_to_nid(page) != prev_nid)
 			zones++;
+		if (page_to_nid(page) != nid)
+			remote++;
 
-		nid = page_to_nid(page);
+		prev_nid = page_to_nid(page);
 		ABDSTAT_BUMP(abdstat_scatter_orders[order]);
 		chunks++;
 		alloc_pages += chunk_pages;
@@ -312,6 +439,9 @@ abd_alloc_pages(abd_t *abd, size_t size)
 		list_del(&page->lru);
 	}
 
+	if (remote)
+		ABDSTAT_BUMP(abdstat_scatter_page_remote_node);
+
 	if (chunks > 1) {
 		ABDSTAT_BUMP(abdstat_scatter_page_multi_chunk);
 		abd->abd_flags |= ABD_FLAG_MULTI_CHUNK;
@@ -404,9 +534,6 @@ abd_free_pages(abd_t *abd)
 struct page;
 
 #define	kpm_enable			1
-#define	abd_alloc_chunk(o) \
-	((struct page *)umem_alloc_aligned(PAGESIZE << (o), 64, KM_SLEEP))
-#define	abd_free_chunk(chunk, o)	umem_free(chunk, PAGESIZE << (o))
 #define	zfs_kmap_atomic(chunk, km)	((void *)chunk)
 #define	zfs_kunmap_atomic(addr, km)	do { (void)(addr); } while (0)
 #define	local_irq_save(flags)		do { (void)(flags); } while (0)
@@ -420,6 +547,209 @@ struct scatterlist {
 	int end;
 };
 
+/*
+ * With zfs_abd_hugepages set, chunks are carved out of 2MB slabs backed by
+ * huge pages, so that scanning a large ARC takes a TLB miss per 2MB rather
+ * than per page.  A slab is taken from hugetlbfs if pages are reserved
+ * there, and is otherwise a 2MB-aligned mapping that transparent huge pages
+ * can back.  Slabs whose chunks are all free are unmapped when the ARC
+ * reaps, see abd_cache_reap_now().
+ */
+#define	ABD_SLAB_SHIFT		21
+#define	ABD_SLAB_SIZE		(1ULL << ABD_SLAB_SHIFT)
+#define	ABD_SLAB_CHUNKS		(ABD_SLAB_SIZE / PAGESIZE)
+
+typedef struct abd_slab {
+	avl_node_t	as_node;	/* in abd_slab_tree, by as_base */
+	list_node_t	as_partial_node; /* in abd_slab_partial if as_free */
+	uintptr_t	as_base;
+	void		*as_free;	/* free chunks, linked through them */
+	uint_t		as_nfree;
+	boolean_t	as_hugetlb;
+} abd_slab_t;
+
+int zfs_abd_hugepages = B_FALSE;
+
+static kmutex_t abd_slab_lock;
+static avl_tree_t abd_slab_tree;
+static list_t abd_slab_partial;
+
+static int
+abd_slab_compare(const void *x1, const void *x2)
+{
+	const abd_slab_t *as1 = x1;
+	const abd_slab_t *as2 = x2;
+
+	return (AVL_CMP(as1->as_base, as2->as_base));
+}
+
+static abd_slab_t *
+abd_slab_create(void)
+{
+	abd_slab_t *as;
+	boolean_t hugetlb = B_TRUE;
+	uintptr_t base, addr;
+	void *map;
+	int i;
+
+	map = mmap(NULL, ABD_SLAB_SIZE, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (map == MAP_FAILED) {
+		/*
+		 * No reserved huge pages: map twice the size, keep the
+		 * aligned 2MB in it and ask for transparent huge pages.
+		 */
+		hugetlb = B_FALSE;
+		map = mmap(NULL, 2 * ABD_SLAB_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map == MAP_FAILED)
+			return (NULL);
+		base = P2ROUNDUP((uintptr_t)map, ABD_SLAB_SIZE);
+		if (base != (uintptr_t)map)
+			(void) munmap(map, base - (uintptr_t)map);
+		(void) munmap((void *)(base + ABD_SLAB_SIZE),
+		    (uintptr_t)map + ABD_SLAB_SIZE - base);
+		(void) madvise((void *)base, ABD_SLAB_SIZE, MADV_HUGEPAGE);
+	} else {
+		base = (uintptr_t)map;
+		ASSERT0(P2PHASE(base, ABD_SLAB_SIZE));
+	}
+
+	as = kmem_zalloc(sizeof (abd_slab_t), KM_SLEEP);
+	as->as_base = base;
+	as->as_hugetlb = hugetlb;
+	as->as_free = NULL;
+	for (i = ABD_SLAB_CHUNKS - 1; i >= 0; i--) {
+		addr = base + i * PAGESIZE;
+		*(void **)addr = as->as_free;
+		as->as_free = (void *)addr;
+	}
+	as->as_nfree = ABD_SLAB_CHUNKS;
+	ABDSTAT_BUMP(abdstat_hugepage_slabs);
+
+	return (as);
+}
+
+static void
+abd_slab_destroy(abd_slab_t *as)
+{
+	ASSERT3U(as->as_nfree, ==, ABD_SLAB_CHUNKS);
+	VERIFY0(munmap((void *)as->as_base, ABD_SLAB_SIZE));
+	ABDSTAT_BUMPDOWN(abdstat_hugepage_slabs);
+	kmem_free(as, sizeof (abd_slab_t));
+}
+
+static void *
+abd_slab_alloc_chunk(void)
+{
+	abd_slab_t *as;
+	void *p;
+
+	mutex_enter(&abd_slab_lock);
+	if ((as = list_head(&abd_slab_partial)) == NULL) {
+		if ((as = abd_slab_create()) == NULL) {
+			mutex_exit(&abd_slab_lock);
+			return (NULL);
+		}
+		avl_add(&abd_slab_tree, as);
+		list_insert_head(&abd_slab_partial, as);
+	}
+
+	p = as->as_free;
+	as->as_free = *(void **)p;
+	if (--as->as_nfree == 0)
+		list_remove(&abd_slab_partial, as);
+	ABDSTAT_BUMP(abdstat_hugepage_chunks);
+	mutex_exit(&abd_slab_lock);
+
+	return (p);
+}
+
+/*
+ * Returns B_FALSE if p isn't from a slab.
+ */
+static boolean_t
+abd_slab_free_chunk(void *p)
+{
+	abd_slab_t search, *as;
+
+	/* cheap unlocked check for the common case of no slabs at all */
+	if (avl_numnodes(&abd_slab_tree) == 0)
+		return (B_FALSE);
+
+	search.as_base = P2ALIGN((uintptr_t)p, ABD_SLAB_SIZE);
+	mutex_enter(&abd_slab_lock);
+	if ((as = avl_find(&abd_slab_tree, &search, NULL)) == NULL) {
+		mutex_exit(&abd_slab_lock);
+		return (B_FALSE);
+	}
+
+	*(void **)p = as->as_free;
+	as->as_free = p;
+	if (as->as_nfree++ == 0)
+		list_insert_head(&abd_slab_partial, as);
+	ABDSTAT_BUMPDOWN(abdstat_hugepage_chunks);
+	mutex_exit(&abd_slab_lock);
+
+	return (B_TRUE);
+}
+
+static void
+abd_slabs_reap(void)
+{
+	abd_slab_t *as, *next;
+
+	mutex_enter(&abd_slab_lock);
+	for (as = list_head(&abd_slab_partial); as != NULL; as = next) {
+		next = list_next(&abd_slab_partial, as);
+		if (as->as_nfree != ABD_SLAB_CHUNKS)
+			continue;
+		list_remove(&abd_slab_partial, as);
+		avl_remove(&abd_slab_tree, as);
+		abd_slab_destroy(as);
+	}
+	mutex_exit(&abd_slab_lock);
+}
+
+static struct page *
+abd_alloc_chunk(int order)
+{
+	struct page *p = NULL;
+
+	if (order == 0)
+		p = abd_magazine_alloc(abd_chunk_mags);
+	if (p == NULL && order == 0 && zfs_abd_hugepages)
+		p = abd_slab_alloc_chunk();
+	if (p == NULL) {
+		p = umem_alloc_aligned(PAGESIZE << order, PAGESIZE,
+		    KM_SLEEP);
+	}
+
+	return (p);
+}
+
+static void
+abd_free_chunk_cb(void *p)
+{
+	if (!abd_slab_free_chunk(p))
+		umem_free(p, PAGESIZE);
+}
+
+static void
+abd_free_chunk(struct page *p, int order)
+{
+	if (order != 0)
+		umem_free(p, PAGESIZE << order);
+	else if (!abd_magazine_free(abd_chunk_mags, p))
+		abd_free_chunk_cb(p);
+}
+
+static void
+abd_free_struct_cb(void *abd)
+{
+	kmem_cache_free(abd_cache, abd);
+}
+
 static void
 sg_init_table(struct scatterlist *sg, int nr)
 {
@@ -499,6 +829,15 @@ abd_init(void)
 
 	abd_cache = kmem_cache_create("abd_t", sizeof (abd_t),
 	    0, NULL, NULL, NULL, NULL, NULL, 0);
+#ifndef _KERNEL
+	abd_chunk_mags = abd_magazines_create();
+	abd_struct_mags = abd_magazines_create();
+	mutex_init(&abd_slab_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&abd_slab_tree, abd_slab_compare, sizeof (abd_slab_t),
+	    offsetof(abd_slab_t, as_node));
+	list_create(&abd_slab_partial, sizeof (abd_slab_t),
+	    offsetof(abd_slab_t, as_partial_node));
+#endif
 
 	abd_ksp = kstat_create("zfs", 0, "abdstats", "misc", KSTAT_TYPE_NAMED,
 	    sizeof (abd_stats) / sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
@@ -523,12 +862,39 @@ abd_fini(void)
 		abd_ksp = NULL;
 	}
 
+#ifndef _KERNEL
+	abd_magazines_destroy(abd_chunk_mags, abd_free_chunk_cb);
+	abd_magazines_destroy(abd_struct_mags, abd_free_struct_cb);
+	abd_chunk_mags = NULL;
+	abd_struct_mags = NULL;
+	abd_slabs_reap();
+	ASSERT0(avl_numnodes(&abd_slab_tree));
+	list_destroy(&abd_slab_partial);
+	avl_destroy(&abd_slab_tree);
+	mutex_destroy(&abd_slab_lock);
+#endif
+
 	if (abd_cache) {
 		kmem_cache_destroy(abd_cache);
 		abd_cache = NULL;
 	}
 }
 
+/*
+ * Called by the ARC when memory is low, to hand the chunks and abd_t's
+ * cached in the magazines, and the huge page slabs left empty, back to the
+ * system.
+ */
+void
+abd_cache_reap_now(void)
+{
+#ifndef _KERNEL
+	abd_magazines_reap(abd_chunk_mags, abd_free_chunk_cb);
+	abd_magazines_reap(abd_struct_mags, abd_free_struct_cb);
+	abd_slabs_reap();
+#endif
+}
+
 static inline void
 abd_verify(abd_t *abd)
 {
@@ -536,11 +902,22 @@ abd_verify(abd_t *abd)
 	ASSERT3U(abd->abd_size, <=, SPA_MAXBLOCKSIZE);
 	ASSERT3U(abd->abd_flags, ==, abd->abd_flags & (ABD_FLAG_LINEAR |
 	    ABD_FLAG_OWNER | ABD_FLAG_META | ABD_FLAG_MULTI_ZONE |
-	    ABD_FLAG_MULTI_CHUNK));
+	    ABD_FLAG_MULTI_CHUNK | ABD_FLAG_GANG | ABD_FLAG_GANG_FREE));
 	IMPLY(abd->abd_parent != NULL, !(abd->abd_flags & ABD_FLAG_OWNER));
 	IMPLY(abd->abd_flags & ABD_FLAG_META, abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd)) {
 		ASSERT3P(abd->abd_u.abd_linear.abd_buf, !=, NULL);
+	} else if (abd_is_gang(abd)) {
+		abd_t *cabd;
+		size_t size = 0;
+
+		for (cabd = list_head(&ABD_GANG(abd).abd_gang_chain);
+		    cabd != NULL;
+		    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+			ASSERT(!abd_is_gang(cabd));
+			size += cabd->abd_size;
+		}
+		ASSERT3U(size, ==, abd->abd_size);
 	} else {
 		size_t n;
 		int i = 0;
@@ -559,9 +936,16 @@ abd_verify(abd_t *abd)
 static inline abd_t *
 abd_alloc_struct(void)
 {
-	abd_t *abd = kmem_cache_alloc(abd_cache, KM_PUSHPAGE);
+	abd_t *abd = NULL;
+
+#ifndef _KERNEL
+	abd = abd_magazine_alloc(abd_struct_mags);
+#endif
+	if (abd == NULL)
+		abd = kmem_cache_alloc(abd_cache, KM_PUSHPAGE);
 
 	ASSERT3P(abd, !=, NULL);
+	list_link_init(&abd->abd_gang_link);
 	ABDSTAT_INCR(abdstat_struct_size, sizeof (abd_t));
 
 	return (abd);
@@ -570,7 +954,11 @@ abd_alloc_struct(void)
 static inline void
 abd_free_struct(abd_t *abd)
 {
-	kmem_cache_free(abd_cache, abd);
+	ASSERT(!list_link_active(&abd->abd_gang_link));
+#ifndef _KERNEL
+	if (!abd_magazine_free(abd_struct_mags, abd))
+#endif
+		kmem_cache_free(abd_cache, abd);
 	ABDSTAT_INCR(abdstat_struct_size, -sizeof (abd_t));
 }
 
@@ -672,8 +1060,101 @@ abd_free_linear(abd_t *abd)
 }
 
 /*
- * Free an ABD. Only use this on ABDs allocated with abd_alloc() or
- * abd_alloc_linear().
+ * Allocate an empty gang ABD. A gang ABD chains other ABDs together, added
+ * with abd_gang_add(), so that they can be handed to a consumer as one
+ * buffer without copying their data into a new one. Free it with abd_free().
+ */
+abd_t *
+abd_alloc_gang(void)
+{
+	abd_t *abd = abd_alloc_struct();
+
+	abd->abd_flags = ABD_FLAG_GANG | ABD_FLAG_OWNER;
+	abd->abd_size = 0;
+	abd->abd_parent = NULL;
+	refcount_create(&abd->abd_children);
+	list_create(&ABD_GANG(abd).abd_gang_chain, sizeof (abd_t),
+	    offsetof(abd_t, abd_gang_link));
+
+	return (abd);
+}
+
+/*
+ * Append cabd to the gang ABD pabd. If free_on_free is set, cabd is freed
+ * (or put) along with pabd, otherwise the caller must keep cabd around until
+ * pabd is freed. Gang ABDs are not nested.
+ */
+void
+abd_gang_add(abd_t *pabd, abd_t *cabd, boolean_t free_on_free)
+{
+	ASSERT(abd_is_gang(pabd));
+	ASSERT(!abd_is_gang(cabd));
+	abd_verify(cabd);
+	VERIFY3U(pabd->abd_size + cabd->abd_size, <=, SPA_MAXBLOCKSIZE);
+
+	/*
+	 * An ABD can only be linked into one gang at a time, so an ABD that
+	 * is already part of another gang is added through a new ABD that
+	 * refers to its data.
+	 */
+	if (list_link_active(&cabd->abd_gang_link)) {
+		cabd = abd_get_offset(cabd, 0);
+		free_on_free = B_TRUE;
+	}
+
+	if (free_on_free)
+		cabd->abd_flags |= ABD_FLAG_GANG_FREE;
+	list_insert_tail(&ABD_GANG(pabd).abd_gang_chain, cabd);
+	pabd->abd_size += cabd->abd_size;
+}
+
+/*
+ * Find the child of the gang ABD that contains the offset *off, and change
+ * *off to be relative to that child.
+ */
+abd_t *
+abd_gang_get_offset(abd_t *abd, size_t *off)
+{
+	abd_t *cabd;
+
+	ASSERT(abd_is_gang(abd));
+	ASSERT3U(*off, <, abd->abd_size);
+
+	for (cabd = list_head(&ABD_GANG(abd).abd_gang_chain); cabd != NULL;
+	    cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd)) {
+		if (*off < cabd->abd_size)
+			break;
+		*off -= cabd->abd_size;
+	}
+	ASSERT3P(cabd, !=, NULL);
+
+	return (cabd);
+}
+
+static void
+abd_free_gang(abd_t *abd)
+{
+	abd_t *cabd;
+
+	while ((cabd = list_remove_head(&ABD_GANG(abd).abd_gang_chain)) !=
+	    NULL) {
+		if (cabd->abd_flags & ABD_FLAG_GANG_FREE) {
+			cabd->abd_flags &= ~ABD_FLAG_GANG_FREE;
+			if (cabd->abd_flags & ABD_FLAG_OWNER)
+				abd_free(cabd);
+			else
+				abd_put(cabd);
+		}
+	}
+	list_destroy(&ABD_GANG(abd).abd_gang_chain);
+
+	refcount_destroy(&abd->abd_children);
+	abd_free_struct(abd);
+}
+
+/*
+ * Free an ABD. Only use this on ABDs allocated with abd_alloc(),
+ * abd_alloc_linear() or abd_alloc_gang().
  */
 void
 abd_free(abd_t *abd)
@@ -683,6 +1164,8 @@ abd_free(abd_t *abd)
 	ASSERT(abd->abd_flags & ABD_FLAG_OWNER);
 	if (abd_is_linear(abd))
 		abd_free_linear(abd);
+	else if (abd_is_gang(abd))
+		abd_free_gang(abd);
 	else
 		abd_free_scatter(abd);
 }
@@ -736,7 +1219,31 @@ abd_get_offset_impl(abd_t *sabd, size_t off, size_t size)
 	abd_verify(sabd);
 	ASSERT3U(off, <=, sabd->abd_size);
 
-	if (abd_is_linear(sabd)) {
+	if (abd_is_gang(sabd)) {
+		abd_t *cabd = abd_gang_get_offset(sabd, &off);
+
+		/*
+		 * A range within one child refers to that child directly,
+		 * otherwise a new gang is made of the pieces of the children
+		 * that the range spans.
+		 */
+		if (off + size <= cabd->abd_size)
+			return (abd_get_offset_impl(cabd, off, size));
+
+		abd = abd_alloc_gang();
+		abd->abd_flags &= ~ABD_FLAG_OWNER;
+		while (size > 0) {
+			size_t len = MIN(size, cabd->abd_size - off);
+
+			abd_gang_add(abd, abd_get_offset_size(cabd, off, len),
+			    B_TRUE);
+			size -= len;
+			off = 0;
+			cabd = list_next(&ABD_GANG(sabd).abd_gang_chain, cabd);
+		}
+
+		return (abd);
+	} else if (abd_is_linear(sabd)) {
 		abd = abd_alloc_struct();
 
 		/*
@@ -835,6 +1342,12 @@ abd_put(abd_t *abd)
 	abd_verify(abd);
 	ASSERT(!(abd->abd_flags & ABD_FLAG_OWNER));
 
+	if (abd_is_gang(abd)) {
+		ASSERT3P(abd->abd_parent, ==, NULL);
+		abd_free_gang(abd);
+		return;
+	}
+
 	if (abd->abd_parent != NULL) {
 		(void) refcount_remove_many(&abd->abd_parent->abd_children,
 		    abd->abd_size, abd);
@@ -974,7 +1487,10 @@ struct abd_iter {
 
 	/* private */
 	abd_t		*iter_abd;	/* ABD being iterated through */
+	abd_t		*iter_cabd;	/* current child of gang iter_abd, */
+					/* or iter_abd itself */
 	size_t		iter_pos;
+	size_t		iter_cpos;	/* position in iter_cabd */
 	size_t		iter_offset;	/* offset in current sg/abd_buf, */
 					/* abd_offset included */
 	struct scatterlist *iter_sg;	/* current sg */
@@ -983,6 +1499,24 @@ struct abd_iter {
 #endif
 };
 
+/*
+ * Point the abd_iter at the start of cabd, which is either the ABD being
+ * iterated through or one of its children if that is a gang ABD.
+ */
+static void
+abd_iter_set_child(struct abd_iter *aiter, abd_t *cabd)
+{
+	aiter->iter_cabd = cabd;
+	aiter->iter_cpos = 0;
+	if (cabd == NULL || abd_is_linear(cabd)) {
+		aiter->iter_offset = 0;
+		aiter->iter_sg = NULL;
+	} else {
+		aiter->iter_offset = ABD_SCATTER(cabd).abd_offset;
+		aiter->iter_sg = ABD_SCATTER(cabd).abd_sgl;
+	}
+}
+
 /*
  * Initialize the abd_iter.
  */
@@ -994,13 +1528,11 @@ abd_iter_init(struct abd_iter *aiter, abd_t *abd, int km_type)
 	aiter->iter_mapaddr = NULL;
 	aiter->iter_mapsize = 0;
 	aiter->iter_pos = 0;
-	if (abd_is_linear(abd)) {
-		aiter->iter_offset = 0;
-		aiter->iter_sg = NULL;
-	} else {
-		aiter->iter_offset = ABD_SCATTER(abd).abd_offset;
-		aiter->iter_sg = ABD_SCATTER(abd).abd_sgl;
-	}
+	if (abd_is_gang(abd))
+		abd_iter_set_child(aiter,
+		    list_head(&ABD_GANG(abd).abd_gang_chain));
+	else
+		abd_iter_set_child(aiter, abd);
 #ifndef HAVE_1ARG_KMAP_ATOMIC
 	ASSERT3U(km_type, <, NR_KM_TYPE);
 	aiter->iter_km = km_type;
@@ -1023,13 +1555,31 @@ abd_iter_advance(struct abd_iter *aiter, size_t amount)
 		return;
 
 	aiter->iter_pos += amount;
-	aiter->iter_offset += amount;
-	if (!abd_is_linear(aiter->iter_abd)) {
-		while (aiter->iter_offset >= aiter->iter_sg->length) {
-			aiter->iter_offset -= aiter->iter_sg->length;
-			aiter->iter_sg = sg_next(aiter->iter_sg);
-			if (aiter->iter_sg == NULL) {
-				ASSERT0(aiter->iter_offset);
+	while (amount > 0) {
+		abd_t *cabd = aiter->iter_cabd;
+		size_t len = MIN(amount, cabd->abd_size - aiter->iter_cpos);
+
+		aiter->iter_cpos += len;
+		aiter->iter_offset += len;
+		amount -= len;
+		if (!abd_is_linear(cabd)) {
+			while (aiter->iter_offset >= aiter->iter_sg->length) {
+				aiter->iter_offset -= aiter->iter_sg->length;
+				aiter->iter_sg = sg_next(aiter->iter_sg);
+				if (aiter->iter_sg == NULL) {
+					ASSERT0(aiter->iter_offset);
+					break;
+				}
+			}
+		}
+
+		/* move on to the next child of a gang ABD */
+		if (aiter->iter_cpos == cabd->abd_size &&
+		    cabd != aiter->iter_abd) {
+			abd_iter_set_child(aiter, list_next(
+			    &ABD_GANG(aiter->iter_abd).abd_gang_chain, cabd));
+			if (aiter->iter_cabd == NULL) {
+				ASSERT0(amount);
 				break;
 			}
 		}
@@ -1053,15 +1603,15 @@ abd_iter_map(struct abd_iter *aiter)
 	if (aiter->iter_pos == aiter->iter_abd->abd_size)
 		return;
 
-	if (abd_is_linear(aiter->iter_abd)) {
-		ASSERT3U(aiter->iter_pos, ==, aiter->iter_offset);
+	if (abd_is_linear(aiter->iter_cabd)) {
+		ASSERT3U(aiter->iter_cpos, ==, aiter->iter_offset);
 		offset = aiter->iter_offset;
-		aiter->iter_mapsize = aiter->iter_abd->abd_size - offset;
-		paddr = aiter->iter_abd->abd_u.abd_linear.abd_buf;
+		aiter->iter_mapsize = aiter->iter_cabd->abd_size - offset;
+		paddr = aiter->iter_cabd->abd_u.abd_linear.abd_buf;
 	} else {
 		offset = aiter->iter_offset;
 		aiter->iter_mapsize = MIN(aiter->iter_sg->length - offset,
-		    aiter->iter_abd->abd_size - aiter->iter_pos);
+		    aiter->iter_cabd->abd_size - aiter->iter_cpos);
 
 		paddr = zfs_kmap_atomic(sg_page(aiter->iter_sg),
 		    km_table[aiter->iter_km]);
@@ -1081,7 +1631,7 @@ abd_iter_unmap(struct abd_iter *aiter)
 	if (aiter->iter_pos == aiter->iter_abd->abd_size)
 		return;
 
-	if (!abd_is_linear(aiter->iter_abd)) {
+	if (!abd_is_linear(aiter->iter_cabd)) {
 		/* LINTED E_FUNC_SET_NOT_USED */
 		zfs_kunmap_atomic(aiter->iter_mapaddr - aiter->iter_offset,
 		    km_table[aiter->iter_km]);
@@ -1480,6 +2030,22 @@ abd_nr_pages_off(abd_t *abd, unsigned int size, size_t off)
 {
 	unsigned long pos;
 
+	if (abd_is_gang(abd)) {
+		unsigned long nr_pages = 0;
+		abd_t *cabd = abd_gang_get_offset(abd, &off);
+
+		while (size > 0) {
+			unsigned int len = MIN(size, cabd->abd_size - off);
+
+			nr_pages += abd_nr_pages_off(cabd, len, off);
+			size -= len;
+			off = 0;
+			cabd = list_next(&ABD_GANG(abd).abd_gang_chain, cabd);
+		}
+
+		return (nr_pages);
+	}
+
 	if (abd_is_linear(abd))
 		pos = (unsigned long)abd_to_buf(abd) + off;
 	else
@@ -1502,6 +2068,7 @@ abd_scatter_bio_map_off(struct bio *bio, abd_t *abd,
 	struct abd_iter aiter;
 
 	ASSERT(!abd_is_linear(abd));
+	ASSERT(!abd_is_gang(abd));
 	ASSERT3U(io_size, <=, abd->abd_size - off);
 
 	abd_iter_init(&aiter, abd, 0);
@@ -274,6 +274,7 @@
 #include <sys/zio_checksum.h>
 #include <sys/multilist.h>
 #include <sys/abd.h>
+#include <sys/aggsum.h>
 #ifdef _KERNEL
 #include <sys/vmsystm.h>
 #include <vm/anon.h>
@@ -292,6 +293,27 @@
 #ifndef _KERNEL
 /* set with ZFS_DEBUG=watch, to enable watchpoints on frozen buffers */
 boolean_t arc_watch = B_FALSE;
+
+/*
+ * In user space the ARC can size itself against the memory cgroup it runs
+ * in rather than the random pressure used for testing.  This is the
+ * default for uZFS, where the cgroup is the container's memory limit.
+ * The PSI trigger fires when tasks in the cgroup stall on memory for
+ * zfs_arc_psi_stall_us within zfs_arc_psi_window_us; unprivileged
+ * processes need a window that is a multiple of two seconds.
+ */
+#ifdef _UZFS
+int zfs_arc_cgroup_enabled = 1;
+#else
+int zfs_arc_cgroup_enabled = 0;
+#endif
+unsigned long zfs_arc_psi_stall_us = 150000;
+unsigned long zfs_arc_psi_window_us = 2000000;
+
+static boolean_t arc_cgroup_limited = B_FALSE;
+static uint64_t arc_cgroup_pressure_seen;
+static int arc_cgroup_pressure_streak;
+static hrtime_t arc_cgroup_pressure_time;
 #endif
 
 static kmutex_t		arc_reclaim_lock;
@@ -308,6 +330,38 @@ static kcondvar_t	arc_reclaim_waiters_cv;
  */
 int zfs_arc_evict_batch_limit = 10;
 
+/*
+ * Number of threads used to evict from a single arc state when the
+ * eviction target is large. Each thread owns a disjoint subset of the
+ * state's sublists, so the threads never contend on a sublist lock.
+ * A value of 0 sizes the pool automatically from the number of CPUs.
+ */
+int zfs_arc_evict_threads = 0;
+
+/*
+ * Minimum number of bytes each eviction thread must be asked to evict.
+ * Targets smaller than twice this value are evicted by the calling
+ * thread alone, since dispatching would cost more than it saves.
+ */
+unsigned long zfs_arc_evict_thread_bytes = 32 * 1024 * 1024;
+
+/*
+ * Weight given to all objsets without a weight of their own, taken
+ * together, when dividing arc_c into the shares protected for weighted
+ * objsets (see arc_objset_protected()).
+ */
+int zfs_arc_objset_default_weight = 100;
+
+/*
+ * Size of the ring of sampled arc_read() outcomes exported through the
+ * "arc_trace" kstat, and the rate at which reads are sampled into it:
+ * one in every zfs_arc_trace_sample reads.  The ring is allocated when the
+ * ARC is initialized, so zfs_arc_trace_entries must be set at module load;
+ * 0 disables tracing.
+ */
+int zfs_arc_trace_entries = 0;
+int zfs_arc_trace_sample = 64;
+
 /* number of seconds before growing cache again */
 static int		arc_grow_retry = 5;
 
@@ -398,6 +452,13 @@ int zfs_arc_meta_strategy = ARC_STRATEGY_META_BALANCED;
 int zfs_arc_meta_adjust_restarts = 4096;
 int zfs_arc_lotsfree_percent = 10;
 
+/*
+ * Bitmask of zio priorities (1 << ZIO_PRIORITY_*) whose reads are not
+ * admitted into the ARC's working set.  By default scrub and resilver
+ * reads are treated this way, see ARC_FLAG_UNCACHED.
+ */
+int zfs_arc_uncached_prio_mask = (1 << ZIO_PRIORITY_SCRUB);
+
 /* The 6 states: */
 static arc_state_t ARC_anon;
 static arc_state_t ARC_mru;
@@ -449,6 +510,23 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_evict_l2_eligible;
 	kstat_named_t arcstat_evict_l2_ineligible;
 	kstat_named_t arcstat_evict_l2_skip;
+	/*
+	 * Number of uncached (scan) buffers evicted without leaving a
+	 * header behind in the ghost lists.
+	 */
+	kstat_named_t arcstat_evict_uncached;
+	/*
+	 * Number of times arc_evict_state() split its target across the
+	 * eviction threads rather than evicting from the calling thread.
+	 */
+	kstat_named_t arcstat_evict_parallel;
+	/*
+	 * Bytes evicted to bring objsets back under their ARC limits, and
+	 * number of headers passed over because their objset was below its
+	 * weighted share of the ARC.
+	 */
+	kstat_named_t arcstat_evict_objset_limit;
+	kstat_named_t arcstat_evict_objset_protected;
 	kstat_named_t arcstat_hash_elements;
 	kstat_named_t arcstat_hash_elements_max;
 	kstat_named_t arcstat_hash_collisions;
@@ -634,6 +712,13 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_lsize;
 	kstat_named_t arcstat_l2_psize;
 	kstat_named_t arcstat_l2_hdr_size;
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_rebuild_success;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_lb_errors;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_memory_direct_count;
 	kstat_named_t arcstat_memory_indirect_count;
@@ -651,6 +736,11 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_meta_min;
 	kstat_named_t arcstat_sync_wait_for_async;
 	kstat_named_t arcstat_demand_hit_predictive_prefetch;
+	/*
+	 * Number of buffers read by a predictive prefetch which were
+	 * evicted before a demand read used them.
+	 */
+	kstat_named_t arcstat_predictive_prefetch_unused;
 	kstat_named_t arcstat_need_free;
 	kstat_named_t arcstat_sys_free;
 } arc_stats_t;
@@ -679,6 +769,10 @@ static arc_stats_t arc_stats = {
 	{ "evict_l2_eligible",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_ineligible",	KSTAT_DATA_UINT64 },
 	{ "evict_l2_skip",		KSTAT_DATA_UINT64 },
+	{ "evict_uncached",		KSTAT_DATA_UINT64 },
+	{ "evict_parallel",		KSTAT_DATA_UINT64 },
+	{ "evict_objset_limit",		KSTAT_DATA_UINT64 },
+	{ "evict_objset_protected",	KSTAT_DATA_UINT64 },
 	{ "hash_elements",		KSTAT_DATA_UINT64 },
 	{ "hash_elements_max",		KSTAT_DATA_UINT64 },
 	{ "hash_collisions",		KSTAT_DATA_UINT64 },
@@ -733,6 +827,13 @@ static arc_stats_t arc_stats = {
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_asize",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_success",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_lb_errors",	KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "memory_direct_count",	KSTAT_DATA_UINT64 },
 	{ "memory_indirect_count",	KSTAT_DATA_UINT64 },
@@ -750,6 +851,7 @@ static arc_stats_t arc_stats = {
 	{ "arc_meta_min",		KSTAT_DATA_UINT64 },
 	{ "sync_wait_for_async",	KSTAT_DATA_UINT64 },
 	{ "demand_hit_predictive_prefetch", KSTAT_DATA_UINT64 },
+	{ "predictive_prefetch_unused",	KSTAT_DATA_UINT64 },
 	{ "arc_need_free",		KSTAT_DATA_UINT64 },
 	{ "arc_sys_free",		KSTAT_DATA_UINT64 }
 };
@@ -808,7 +910,6 @@ static arc_state_t	*arc_l2c_only;
  * the possibility of inconsistency by having shadow copies of the variables,
  * while still allowing the code to be readable.
  */
-#define	arc_size	ARCSTAT(arcstat_size)	/* actual total arc size */
 #define	arc_p		ARCSTAT(arcstat_p)	/* target size of MRU */
 #define	arc_c		ARCSTAT(arcstat_c)	/* target size of cache */
 #define	arc_c_min	ARCSTAT(arcstat_c_min)	/* min target cache size */
@@ -819,7 +920,6 @@ static arc_state_t	*arc_l2c_only;
 #define	arc_meta_limit	ARCSTAT(arcstat_meta_limit) /* max size for metadata */
 #define	arc_dnode_limit	ARCSTAT(arcstat_dnode_limit) /* max size for dnodes */
 #define	arc_meta_min	ARCSTAT(arcstat_meta_min) /* min size for metadata */
-#define	arc_meta_used	ARCSTAT(arcstat_meta_used) /* size of metadata */
 #define	arc_meta_max	ARCSTAT(arcstat_meta_max) /* max size of metadata */
 #define	arc_dbuf_size	ARCSTAT(arcstat_dbuf_size) /* dbuf metadata */
 #define	arc_dnode_size	ARCSTAT(arcstat_dnode_size) /* dnode metadata */
@@ -827,6 +927,14 @@ static arc_state_t	*arc_l2c_only;
 #define	arc_need_free	ARCSTAT(arcstat_need_free) /* bytes to be freed */
 #define	arc_sys_free	ARCSTAT(arcstat_sys_free) /* target system free bytes */
 
+/*
+ * The total size of the ARC and of its metadata change with every buffer
+ * added or removed, so they are kept in aggsum counters rather than updated
+ * atomically in arc_stats.  arc_kstat_update() reports their values.
+ */
+aggsum_t arc_size;
+aggsum_t arc_meta_used;
+
 /* compressed size of entire arc */
 #define	arc_compressed_size	ARCSTAT(arcstat_compressed_size)
 /* uncompressed size of entire arc */
@@ -837,6 +945,41 @@ static arc_state_t	*arc_l2c_only;
 static list_t arc_prune_list;
 static kmutex_t arc_prune_mtx;
 static taskq_t *arc_prune_taskq;
+static taskq_t *arc_evict_taskq;
+static int arc_evict_threads;
+
+/* objsets with ARC limits or weights, see arc_objset_set_limit() */
+static avl_tree_t arc_objset_tree;
+static krwlock_t arc_objset_lock;
+static uint64_t arc_objset_count;
+static uint64_t arc_objset_weight_total;
+
+/*
+ * Sampled arc_read() outcomes, see arc_trace_record().
+ */
+typedef enum arc_trace_result {
+	ARC_TRACE_HIT,
+	ARC_TRACE_MISS,
+	ARC_TRACE_L2_HIT,
+} arc_trace_result_t;
+
+typedef struct arc_trace_entry {
+	hrtime_t	ate_time;	/* when the data became available */
+	uint64_t	ate_objset;
+	uint64_t	ate_object;
+	int64_t		ate_level;
+	uint64_t	ate_blkid;
+	uint64_t	ate_latency;	/* nanoseconds since arc_read() */
+	uint32_t	ate_size;	/* logical size of the block */
+	uint32_t	ate_result;	/* arc_trace_result_t */
+} arc_trace_entry_t;
+
+static kmutex_t arc_trace_lock;
+static arc_trace_entry_t *arc_trace_ring;
+static uint64_t arc_trace_entries;
+static uint64_t arc_trace_head;		/* total entries ever recorded */
+static uint64_t arc_trace_tick;
+static kstat_t *arc_trace_ksp;
 
 #define	GHOST_STATE(state)	\
 	((state) == arc_mru_ghost || (state) == arc_mfu_ghost ||	\
@@ -846,6 +989,7 @@ static taskq_t *arc_prune_taskq;
 #define	HDR_IO_IN_PROGRESS(hdr)	((hdr)->b_flags & ARC_FLAG_IO_IN_PROGRESS)
 #define	HDR_IO_ERROR(hdr)	((hdr)->b_flags & ARC_FLAG_IO_ERROR)
 #define	HDR_PREFETCH(hdr)	((hdr)->b_flags & ARC_FLAG_PREFETCH)
+#define	HDR_UNCACHED(hdr)	((hdr)->b_flags & ARC_FLAG_UNCACHED)
 #define	HDR_COMPRESSION_ENABLED(hdr)	\
 	((hdr)->b_flags & ARC_FLAG_COMPRESSED_ARC)
 
@@ -891,12 +1035,22 @@ static taskq_t *arc_prune_taskq;
 #define	HT_LOCK_ALIGN	64
 #define	HT_LOCK_PAD	(P2NPHASE(sizeof (kmutex_t), (HT_LOCK_ALIGN)))
 
+/*
+ * Every hash lock sits in a cache line of its own, so that lookups of hot
+ * buffers don't bounce the lines of neighbouring locks between CPUs.  In
+ * user space a kmutex_t is a pthread mutex which isn't a multiple of the
+ * line size, hence the locks are aligned rather than padded there.
+ */
+#ifdef _KERNEL
 struct ht_lock {
 	kmutex_t	ht_lock;
-#ifdef _KERNEL
 	unsigned char	pad[HT_LOCK_PAD];
-#endif
 };
+#else
+struct ht_lock {
+	kmutex_t	ht_lock;
+} __attribute__((aligned(HT_LOCK_ALIGN)));
+#endif
 
 #define	BUF_LOCKS 8192
 typedef struct buf_hash_table {
@@ -950,6 +1104,7 @@ unsigned long l2arc_feed_min_ms = L2ARC_FEED_MIN_MS;	/* min interval msecs */
 int l2arc_noprefetch = B_TRUE;			/* don't cache prefetch bufs */
 int l2arc_feed_again = B_TRUE;			/* turbo warmup */
 int l2arc_norw = B_FALSE;			/* no reads during writes */
+int l2arc_rebuild_enabled = B_TRUE;		/* rebuild on pool import */
 
 /*
  * L2ARC Internals
@@ -1349,6 +1504,17 @@ arc_get_compression(arc_buf_t *buf)
 	    HDR_GET_COMPRESS(buf->b_hdr) : ZIO_COMPRESS_OFF);
 }
 
+/*
+ * Returns B_TRUE if the buf holds a decompressed copy of a block that the
+ * ARC keeps compressed, i.e. recreating the buf costs a decompression.
+ */
+boolean_t
+arc_buf_is_decompressed(arc_buf_t *buf)
+{
+	return (!ARC_BUF_COMPRESSED(buf) &&
+	    HDR_GET_COMPRESS(buf->b_hdr) != ZIO_COMPRESS_OFF);
+}
+
 static inline boolean_t
 arc_buf_is_shared(arc_buf_t *buf)
 {
@@ -1462,7 +1628,13 @@ arc_cksum_is_equal(arc_buf_hdr_t *hdr, zio_t *zio)
 
 		cbuf = zio_buf_alloc(HDR_GET_PSIZE(hdr));
 		lsize = HDR_GET_LSIZE(hdr);
-		csize = zio_compress_data(compress, zio->io_abd, cbuf, lsize);
+		/*
+		 * The level a block was written with is not kept, so a
+		 * zstd block recompressed at the default level may not
+		 * match; the read then falls back to the main pool.
+		 */
+		csize = zio_compress_data(compress, zio->io_abd, cbuf,
+		    lsize, 0);
 
 		ASSERT3U(csize, <=, HDR_GET_PSIZE(hdr));
 		if (csize < HDR_GET_PSIZE(hdr)) {
@@ -2000,7 +2172,21 @@ remove_reference(arc_buf_hdr_t *hdr, kmutex_t *hash_lock, void *tag)
 	 */
 	if (((cnt = refcount_remove(&hdr->b_l1hdr.b_refcnt, tag)) == 0) &&
 	    (state != arc_anon)) {
-		multilist_insert(state->arcs_list[arc_buf_type(hdr)], hdr);
+		multilist_t *ml = state->arcs_list[arc_buf_type(hdr)];
+
+		/*
+		 * Uncached buffers go to the tail of the list so that they
+		 * are the next ones to be evicted from this state.
+		 */
+		if (HDR_UNCACHED(hdr)) {
+			multilist_sublist_t *mls;
+
+			mls = multilist_sublist_lock_obj(ml, hdr);
+			multilist_sublist_insert_tail(mls, hdr);
+			multilist_sublist_unlock(mls);
+		} else {
+			multilist_insert(ml, hdr);
+		}
 		ASSERT3U(hdr->b_l1hdr.b_bufcnt, >, 0);
 		arc_evictable_space_increment(hdr, state);
 	}
@@ -2283,9 +2469,9 @@ arc_space_consume(uint64_t space, arc_space_type_t type)
 	}
 
 	if (type != ARC_SPACE_DATA)
-		ARCSTAT_INCR(arcstat_meta_used, space);
+		aggsum_add(&arc_meta_used, space);
 
-	atomic_add_64(&arc_size, space);
+	aggsum_add(&arc_size, space);
 }
 
 void
@@ -2320,14 +2506,19 @@ arc_space_return(uint64_t space, arc_space_type_t type)
 	}
 
 	if (type != ARC_SPACE_DATA) {
-		ASSERT(arc_meta_used >= space);
-		if (arc_meta_max < arc_meta_used)
-			arc_meta_max = arc_meta_used;
-		ARCSTAT_INCR(arcstat_meta_used, -space);
+		ASSERT(aggsum_compare(&arc_meta_used, space) >= 0);
+		/*
+		 * We use the upper bound here rather than the precise value
+		 * because the arc_meta_max value doesn't need to be
+		 * precise. It's only consumed by humans via arcstats.
+		 */
+		if (arc_meta_max < aggsum_upper_bound(&arc_meta_used))
+			arc_meta_max = aggsum_upper_bound(&arc_meta_used);
+		aggsum_add(&arc_meta_used, -space);
 	}
 
-	ASSERT(arc_size >= space);
-	atomic_add_64(&arc_size, -space);
+	ASSERT(aggsum_compare(&arc_size, space) >= 0);
+	aggsum_add(&arc_size, -space);
 }
 
 /*
@@ -2564,6 +2755,80 @@ arc_hdr_free_on_write(arc_buf_hdr_t *hdr)
 	l2arc_free_abd_on_write(hdr->b_l1hdr.b_pabd, size, type);
 }
 
+/*
+ * Charge (or with a negative count, uncharge) the hdr's owning objset for
+ * its data block.  Called whenever b_pabd is set or cleared, with the same
+ * arc_hdr_size() the compressed_size kstat is adjusted by.
+ */
+static void
+arc_objset_charge(arc_buf_hdr_t *hdr, int64_t bytes)
+{
+	arc_objset_t *ao = hdr->b_l1hdr.b_objset;
+
+	if (ao == NULL)
+		return;
+
+	atomic_add_64(&ao->ao_size, bytes);
+	if (bytes > 0 && ao->ao_limit != 0 && ao->ao_size > ao->ao_limit)
+		cv_signal(&arc_reclaim_thread_cv);
+}
+
+static int
+arc_objset_compare(const void *x1, const void *x2)
+{
+	const arc_objset_t *ao1 = x1;
+	const arc_objset_t *ao2 = x2;
+
+	if (ao1->ao_spa < ao2->ao_spa)
+		return (-1);
+	if (ao1->ao_spa > ao2->ao_spa)
+		return (1);
+	if (ao1->ao_objset < ao2->ao_objset)
+		return (-1);
+	if (ao1->ao_objset > ao2->ao_objset)
+		return (1);
+	return (0);
+}
+
+static arc_objset_t *
+arc_objset_find(uint64_t spa, uint64_t objset)
+{
+	arc_objset_t search;
+
+	ASSERT(RW_LOCK_HELD(&arc_objset_lock));
+
+	search.ao_spa = spa;
+	search.ao_objset = objset;
+	return (avl_find(&arc_objset_tree, &search, NULL));
+}
+
+/*
+ * Record the objset named by the bookmark as the owner of the hdr, if
+ * it has ARC limits.  Once set, the owner doesn't change for the life of
+ * the hdr's L1 portion.
+ */
+static void
+arc_hdr_set_objset(arc_buf_hdr_t *hdr, const zbookmark_phys_t *zb)
+{
+	arc_objset_t *ao;
+
+	ASSERT(HDR_HAS_L1HDR(hdr));
+
+	if (arc_objset_count == 0 || zb == NULL ||
+	    hdr->b_l1hdr.b_objset != NULL)
+		return;
+
+	rw_enter(&arc_objset_lock, RW_READER);
+	ao = arc_objset_find(hdr->b_spa, zb->zb_objset);
+	rw_exit(&arc_objset_lock);
+	if (ao == NULL)
+		return;
+
+	hdr->b_l1hdr.b_objset = ao;
+	if (hdr->b_l1hdr.b_pabd != NULL)
+		arc_objset_charge(hdr, arc_hdr_size(hdr));
+}
+
 /*
  * Share the arc_buf_t's data with the hdr. Whenever we are sharing the
  * data buffer, we transfer the refcount ownership to the hdr and update
@@ -2596,6 +2861,7 @@ arc_share_buf(arc_buf_hdr_t *hdr, arc_buf_t *buf)
 	ARCSTAT_INCR(arcstat_compressed_size, arc_hdr_size(hdr));
 	ARCSTAT_INCR(arcstat_uncompressed_size, HDR_GET_LSIZE(hdr));
 	ARCSTAT_INCR(arcstat_overhead_size, -arc_buf_size(buf));
+	arc_objset_charge(hdr, arc_hdr_size(hdr));
 }
 
 static void
@@ -2623,6 +2889,7 @@ arc_unshare_buf(arc_buf_hdr_t *hdr, arc_buf_t *buf)
 	ARCSTAT_INCR(arcstat_compressed_size, -arc_hdr_size(hdr));
 	ARCSTAT_INCR(arcstat_uncompressed_size, -HDR_GET_LSIZE(hdr));
 	ARCSTAT_INCR(arcstat_overhead_size, arc_buf_size(buf));
+	arc_objset_charge(hdr, -arc_hdr_size(hdr));
 }
 
 /*
@@ -2775,6 +3042,7 @@ arc_hdr_alloc_pabd(arc_buf_hdr_t *hdr)
 
 	ARCSTAT_INCR(arcstat_compressed_size, arc_hdr_size(hdr));
 	ARCSTAT_INCR(arcstat_uncompressed_size, HDR_GET_LSIZE(hdr));
+	arc_objset_charge(hdr, arc_hdr_size(hdr));
 }
 
 static void
@@ -2801,6 +3069,7 @@ arc_hdr_free_pabd(arc_buf_hdr_t *hdr)
 
 	ARCSTAT_INCR(arcstat_compressed_size, -arc_hdr_size(hdr));
 	ARCSTAT_INCR(arcstat_uncompressed_size, -HDR_GET_LSIZE(hdr));
+	arc_objset_charge(hdr, -arc_hdr_size(hdr));
 }
 
 static arc_buf_hdr_t *
@@ -2826,6 +3095,7 @@ arc_hdr_alloc(uint64_t spa, int32_t psize, int32_t lsize,
 	hdr->b_l1hdr.b_arc_access = 0;
 	hdr->b_l1hdr.b_bufcnt = 0;
 	hdr->b_l1hdr.b_buf = NULL;
+	hdr->b_l1hdr.b_objset = NULL;
 
 	/*
 	 * Allocate the hdr's buffer. This will contain either
@@ -2870,6 +3140,7 @@ arc_hdr_realloc(arc_buf_hdr_t *hdr, kmem_cache_t *old, kmem_cache_t *new)
 		 * l2c_only even though it's about to change.
 		 */
 		nhdr->b_l1hdr.b_state = arc_l2c_only;
+		nhdr->b_l1hdr.b_objset = NULL;
 
 		/* Verify previous threads set to NULL before freeing */
 		ASSERT3P(nhdr->b_l1hdr.b_pabd, ==, NULL);
@@ -3201,6 +3472,11 @@ arc_evict_hdr(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 
 		bytes_evicted += arc_hdr_size(hdr);
 
+		if (hdr->b_flags & ARC_FLAG_PREDICTIVE_PREFETCH) {
+			ARCSTAT_BUMP(arcstat_predictive_prefetch_unused);
+			arc_hdr_clear_flags(hdr, ARC_FLAG_PREDICTIVE_PREFETCH);
+		}
+
 		/*
 		 * If this hdr is being evicted and has a compressed
 		 * buffer then we discard it here before we change states.
@@ -3209,6 +3485,18 @@ arc_evict_hdr(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 		 */
 		arc_hdr_free_pabd(hdr);
 
+		/*
+		 * A ghost hit on a buffer that was only ever read by a
+		 * scan would wrongly grow the MRU or MFU target, so such
+		 * headers are destroyed instead of being kept as ghosts.
+		 */
+		if (HDR_UNCACHED(hdr) && !HDR_HAS_L2HDR(hdr)) {
+			ARCSTAT_BUMP(arcstat_evict_uncached);
+			arc_change_state(arc_anon, hdr, hash_lock);
+			arc_hdr_destroy(hdr);
+			return (bytes_evicted);
+		}
+
 		arc_change_state(evicted_state, hdr, hash_lock);
 		ASSERT(HDR_IN_HASH_TABLE(hdr));
 		arc_hdr_set_flags(hdr, ARC_FLAG_IN_HASH_TABLE);
@@ -3218,9 +3506,33 @@ arc_evict_hdr(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
 	return (bytes_evicted);
 }
 
+/*
+ * Return B_TRUE if the hdr belongs to a weighted objset that holds less
+ * than its share of arc_c, in which case general eviction passes it over
+ * while there is anything else to evict.  The shares divide arc_c in the
+ * ratio of the objsets' weights, with zfs_arc_objset_default_weight
+ * standing for everything else.  Called with the hdr's sublist locked,
+ * which keeps it from leaving its state.
+ */
+static boolean_t
+arc_objset_protected(arc_buf_hdr_t *hdr)
+{
+	arc_objset_t *ao = hdr->b_l1hdr.b_objset;
+	uint64_t total, share;
+
+	if (ao == NULL || ao->ao_weight == 0 ||
+	    GHOST_STATE(hdr->b_l1hdr.b_state))
+		return (B_FALSE);
+
+	total = arc_objset_weight_total + MAX(zfs_arc_objset_default_weight, 0);
+	share = (arc_c / total) * ao->ao_weight;
+
+	return (ao->ao_size < share);
+}
+
 static uint64_t
 arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
-    uint64_t spa, int64_t bytes)
+    uint64_t spa, arc_objset_t *ao, boolean_t protect, int64_t bytes)
 {
 	multilist_sublist_t *mls;
 	uint64_t bytes_evicted = 0;
@@ -3270,6 +3582,17 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 			continue;
 		}
 
+		/* or of a certain objset */
+		if (ao != NULL && hdr->b_l1hdr.b_objset != ao) {
+			ARCSTAT_BUMP(arcstat_evict_skip);
+			continue;
+		}
+
+		if (protect && arc_objset_protected(hdr)) {
+			ARCSTAT_BUMP(arcstat_evict_objset_protected);
+			continue;
+		}
+
 		hash_lock = HDR_LOCK(hdr);
 
 		/*
@@ -3330,71 +3653,56 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 }
 
 /*
- * Evict buffers from the given arc state, until we've removed the
- * specified number of bytes. Move the removed buffers to the
- * appropriate evict state.
- *
- * This function makes a "best effort". It skips over any buffers
- * it can't get a hash_lock on, and so, may not catch all candidates.
- * It may also return without evicting as much space as requested.
- *
- * If bytes is specified using the special value ARC_EVICT_ALL, this
- * will evict all available (i.e. unlocked and evictable) buffers from
- * the given arc state; which is used by arc_flush().
+ * State for one eviction thread in arc_evict_state(). Each thread owns
+ * the sublists whose index is congruent to eva_first modulo eva_stride,
+ * and evicts from them until it has removed eva_bytes or can make no
+ * further progress. With eva_protect set, headers of objsets below their
+ * weighted share are passed over until a scan evicts nothing else.
  */
-static uint64_t
-arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
-    arc_buf_contents_t type)
+typedef struct arc_evict_arg {
+	multilist_t		*eva_ml;
+	arc_buf_hdr_t		**eva_markers;
+	uint64_t		eva_spa;
+	arc_objset_t		*eva_objset;
+	boolean_t		eva_protect;
+	int64_t			eva_bytes;
+	arc_buf_contents_t	eva_type;
+	int			eva_first;
+	int			eva_stride;
+	uint64_t		eva_evicted;
+} arc_evict_arg_t;
+
+static void
+arc_evict_sublists(void *arg)
 {
+	arc_evict_arg_t *eva = arg;
+	multilist_t *ml = eva->eva_ml;
+	int64_t bytes = eva->eva_bytes;
 	uint64_t total_evicted = 0;
-	multilist_t *ml = state->arcs_list[type];
-	int num_sublists;
-	arc_buf_hdr_t **markers;
+	int num_sublists = multilist_get_num_sublists(ml);
+	int num_owned;
 	int i;
 
-	IMPLY(bytes < 0, bytes == ARC_EVICT_ALL);
-
-	num_sublists = multilist_get_num_sublists(ml);
-
-	/*
-	 * If we've tried to evict from each sublist, made some
-	 * progress, but still have not hit the target number of bytes
-	 * to evict, we want to keep trying. The markers allow us to
-	 * pick up where we left off for each individual sublist, rather
-	 * than starting from the tail each time.
-	 */
-	markers = kmem_zalloc(sizeof (*markers) * num_sublists, KM_SLEEP);
-	for (i = 0; i < num_sublists; i++) {
-		multilist_sublist_t *mls;
-
-		markers[i] = kmem_cache_alloc(hdr_full_cache, KM_SLEEP);
-
-		/*
-		 * A b_spa of 0 is used to indicate that this header is
-		 * a marker. This fact is used in arc_adjust_type() and
-		 * arc_evict_state_impl().
-		 */
-		markers[i]->b_spa = 0;
-
-		mls = multilist_sublist_lock(ml, i);
-		multilist_sublist_insert_tail(mls, markers[i]);
-		multilist_sublist_unlock(mls);
-	}
+	num_owned = (num_sublists - eva->eva_first + eva->eva_stride - 1) /
+	    eva->eva_stride;
+	ASSERT3S(num_owned, >, 0);
 
 	/*
 	 * While we haven't hit our target number of bytes to evict, or
 	 * we're evicting all available buffers.
 	 */
 	while (total_evicted < bytes || bytes == ARC_EVICT_ALL) {
-		int sublist_idx = multilist_get_random_index(ml);
+		int start = spa_get_random(num_owned);
 		uint64_t scan_evicted = 0;
 
 		/*
 		 * Try to reduce pinned dnodes with a floor of arc_dnode_limit.
 		 * Request that 10% of the LRUs be scanned by the superblock
-		 * shrinker.
+		 * shrinker. Only the first thread asks, so splitting the
+		 * eviction doesn't multiply the request.
 		 */
-		if (type == ARC_BUFC_DATA && arc_dnode_size > arc_dnode_limit)
+		if (eva->eva_first == 0 && eva->eva_type == ARC_BUFC_DATA &&
+		    arc_dnode_size > arc_dnode_limit)
 			arc_prune_async((arc_dnode_size - arc_dnode_limit) /
 			    sizeof (dnode_t) / zfs_arc_dnode_reduce_percent);
 
@@ -3405,7 +3713,9 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 		 * (e.g. index 0) would cause evictions to favor certain
 		 * sublists over others.
 		 */
-		for (i = 0; i < num_sublists; i++) {
+		for (i = 0; i < num_owned; i++) {
+			int sublist_idx = eva->eva_first +
+			    ((start + i) % num_owned) * eva->eva_stride;
 			uint64_t bytes_remaining;
 			uint64_t bytes_evicted;
 
@@ -3417,14 +3727,11 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 				break;
 
 			bytes_evicted = arc_evict_state_impl(ml, sublist_idx,
-			    markers[sublist_idx], spa, bytes_remaining);
+			    eva->eva_markers[sublist_idx], eva->eva_spa,
+			    eva->eva_objset, eva->eva_protect, bytes_remaining);
 
 			scan_evicted += bytes_evicted;
 			total_evicted += bytes_evicted;
-
-			/* we've reached the end, wrap to the beginning */
-			if (++sublist_idx >= num_sublists)
-				sublist_idx = 0;
 		}
 
 		/*
@@ -3437,20 +3744,171 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 			ASSERT3S(bytes, !=, 0);
 
 			/*
-			 * When bytes is ARC_EVICT_ALL, the only way to
-			 * break the loop is when scan_evicted is zero.
-			 * In that case, we actually have evicted enough,
-			 * so we don't want to increment the kstat.
+			 * Only protected headers are left; start over from
+			 * the tail without protecting them.
 			 */
-			if (bytes != ARC_EVICT_ALL) {
-				ASSERT3S(total_evicted, <, bytes);
-				ARCSTAT_BUMP(arcstat_evict_not_enough);
+			if (eva->eva_protect) {
+				eva->eva_protect = B_FALSE;
+				for (i = 0; i < num_owned; i++) {
+					int idx = eva->eva_first +
+					    i * eva->eva_stride;
+					multilist_sublist_t *mls =
+					    multilist_sublist_lock(ml, idx);
+
+					multilist_sublist_remove(mls,
+					    eva->eva_markers[idx]);
+					multilist_sublist_insert_tail(mls,
+					    eva->eva_markers[idx]);
+					multilist_sublist_unlock(mls);
+				}
+				continue;
 			}
-
 			break;
 		}
 	}
 
+	eva->eva_evicted = total_evicted;
+}
+
+/*
+ * Return the number of threads arc_evict_state() should use to evict
+ * the given number of bytes from a multilist with num_sublists sublists.
+ */
+static int
+arc_evict_nthreads(int64_t bytes, int num_sublists)
+{
+	int64_t nthreads;
+
+	if (arc_evict_taskq == NULL || bytes == ARC_EVICT_ALL ||
+	    zfs_arc_evict_thread_bytes == 0)
+		return (1);
+
+	nthreads = bytes / zfs_arc_evict_thread_bytes;
+	nthreads = MIN(nthreads, arc_evict_threads);
+	nthreads = MIN(nthreads, num_sublists);
+
+	return (MAX(nthreads, 1));
+}
+
+/*
+ * Evict buffers from the given arc state, until we've removed the
+ * specified number of bytes. Move the removed buffers to the
+ * appropriate evict state.
+ *
+ * This function makes a "best effort". It skips over any buffers
+ * it can't get a hash_lock on, and so, may not catch all candidates.
+ * It may also return without evicting as much space as requested.
+ *
+ * If bytes is specified using the special value ARC_EVICT_ALL, this
+ * will evict all available (i.e. unlocked and evictable) buffers from
+ * the given arc state; which is used by arc_flush().
+ *
+ * Large targets are split evenly across up to arc_evict_threads threads,
+ * each of which evicts from its own subset of the sublists. The calling
+ * thread does the first share itself and waits for the others.
+ *
+ * If ao is given, only that objset's buffers are evicted. Otherwise,
+ * when evicting for space rather than flushing, the buffers of weighted
+ * objsets below their share are evicted last.
+ */
+static uint64_t
+arc_evict_state_objset(arc_state_t *state, uint64_t spa, arc_objset_t *ao,
+    int64_t bytes, arc_buf_contents_t type)
+{
+	uint64_t total_evicted = 0;
+	multilist_t *ml = state->arcs_list[type];
+	int num_sublists;
+	arc_buf_hdr_t **markers;
+	arc_evict_arg_t *evas;
+	taskqid_t *tqids;
+	int nthreads;
+	int i;
+
+	IMPLY(bytes < 0, bytes == ARC_EVICT_ALL);
+
+	num_sublists = multilist_get_num_sublists(ml);
+
+	/*
+	 * If we've tried to evict from each sublist, made some
+	 * progress, but still have not hit the target number of bytes
+	 * to evict, we want to keep trying. The markers allow us to
+	 * pick up where we left off for each individual sublist, rather
+	 * than starting from the tail each time.
+	 */
+	markers = kmem_zalloc(sizeof (*markers) * num_sublists, KM_SLEEP);
+	for (i = 0; i < num_sublists; i++) {
+		multilist_sublist_t *mls;
+
+		markers[i] = kmem_cache_alloc(hdr_full_cache, KM_SLEEP);
+
+		/*
+		 * A b_spa of 0 is used to indicate that this header is
+		 * a marker. This fact is used in arc_adjust_type() and
+		 * arc_evict_state_impl().
+		 */
+		markers[i]->b_spa = 0;
+
+		mls = multilist_sublist_lock(ml, i);
+		multilist_sublist_insert_tail(mls, markers[i]);
+		multilist_sublist_unlock(mls);
+	}
+
+	nthreads = arc_evict_nthreads(bytes, num_sublists);
+	evas = kmem_zalloc(sizeof (*evas) * nthreads, KM_SLEEP);
+	tqids = kmem_zalloc(sizeof (*tqids) * nthreads, KM_SLEEP);
+	if (nthreads > 1)
+		ARCSTAT_BUMP(arcstat_evict_parallel);
+
+	for (i = 0; i < nthreads; i++) {
+		arc_evict_arg_t *eva = &evas[i];
+
+		eva->eva_ml = ml;
+		eva->eva_markers = markers;
+		eva->eva_spa = spa;
+		eva->eva_objset = ao;
+		eva->eva_protect = (ao == NULL && spa == 0 &&
+		    bytes != ARC_EVICT_ALL && arc_objset_weight_total != 0);
+		eva->eva_type = type;
+		eva->eva_first = i;
+		eva->eva_stride = nthreads;
+		if (bytes == ARC_EVICT_ALL)
+			eva->eva_bytes = ARC_EVICT_ALL;
+		else
+			eva->eva_bytes = bytes / nthreads +
+			    (i < bytes % nthreads ? 1 : 0);
+
+		/*
+		 * If the dispatch fails, evict this share from the
+		 * calling thread below instead.
+		 */
+		if (i > 0) {
+			tqids[i] = taskq_dispatch(arc_evict_taskq,
+			    arc_evict_sublists, eva, TQ_NOSLEEP);
+		}
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		if (tqids[i] == TASKQID_INVALID)
+			arc_evict_sublists(&evas[i]);
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		if (tqids[i] != TASKQID_INVALID)
+			taskq_wait_id(arc_evict_taskq, tqids[i]);
+		total_evicted += evas[i].eva_evicted;
+	}
+
+	kmem_free(tqids, sizeof (*tqids) * nthreads);
+	kmem_free(evas, sizeof (*evas) * nthreads);
+
+	/*
+	 * When bytes is ARC_EVICT_ALL, the threads only stop once they
+	 * have nothing left to evict, so we don't want to increment the
+	 * kstat.
+	 */
+	if (bytes != ARC_EVICT_ALL && total_evicted < bytes)
+		ARCSTAT_BUMP(arcstat_evict_not_enough);
+
 	for (i = 0; i < num_sublists; i++) {
 		multilist_sublist_t *mls = multilist_sublist_lock(ml, i);
 		multilist_sublist_remove(mls, markers[i]);
@@ -3463,6 +3921,13 @@ arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
 	return (total_evicted);
 }
 
+static uint64_t
+arc_evict_state(arc_state_t *state, uint64_t spa, int64_t bytes,
+    arc_buf_contents_t type)
+{
+	return (arc_evict_state_objset(state, spa, NULL, bytes, type));
+}
+
 /*
  * Flush all "evictable" data of the given type from the arc state
  * specified. This will not evict any "active" buffers (i.e. referenced).
@@ -3585,7 +4050,7 @@ arc_adjust_impl(arc_state_t *state, uint64_t spa, int64_t bytes,
  * available for reclaim.
  */
 static uint64_t
-arc_adjust_meta_balanced(void)
+arc_adjust_meta_balanced(uint64_t meta_used)
 {
 	int64_t delta, prune = 0, adjustmnt;
 	uint64_t total_evicted = 0;
@@ -3601,7 +4066,7 @@ restart:
 	 * metadata from the MFU. I think we probably need to implement a
 	 * "metadata arc_p" value to do this properly.
 	 */
-	adjustmnt = arc_meta_used - arc_meta_limit;
+	adjustmnt = meta_used - arc_meta_limit;
 
 	if (adjustmnt > 0 && refcount_count(&arc_mru->arcs_esize[type]) > 0) {
 		delta = MIN(refcount_count(&arc_mru->arcs_esize[type]),
@@ -3626,7 +4091,8 @@ restart:
 		total_evicted += arc_adjust_impl(arc_mfu, 0, delta, type);
 	}
 
-	adjustmnt = arc_meta_used - arc_meta_limit;
+	meta_used = aggsum_value(&arc_meta_used);
+	adjustmnt = meta_used - arc_meta_limit;
 
 	if (adjustmnt > 0 &&
 	    refcount_count(&arc_mru_ghost->arcs_esize[type]) > 0) {
@@ -3650,7 +4116,8 @@ restart:
 	 * meta buffers.  Requests to the upper layers will be made with
 	 * increasingly large scan sizes until the ARC is below the limit.
 	 */
-	if (arc_meta_used > arc_meta_limit) {
+	meta_used = aggsum_value(&arc_meta_used);
+	if (meta_used > arc_meta_limit) {
 		if (type == ARC_BUFC_DATA) {
 			type = ARC_BUFC_METADATA;
 		} else {
@@ -3675,7 +4142,7 @@ restart:
  * capped by the arc_meta_limit tunable.
  */
 static uint64_t
-arc_adjust_meta_only(void)
+arc_adjust_meta_only(uint64_t meta_used)
 {
 	uint64_t total_evicted = 0;
 	int64_t target;
@@ -3687,7 +4154,7 @@ arc_adjust_meta_only(void)
 	 * we're over the meta limit more than we're over arc_p, we
 	 * evict some from the MRU here, and some from the MFU below.
 	 */
-	target = MIN((int64_t)(arc_meta_used - arc_meta_limit),
+	target = MIN((int64_t)(meta_used - arc_meta_limit),
 	    (int64_t)(refcount_count(&arc_anon->arcs_size) +
 	    refcount_count(&arc_mru->arcs_size) - arc_p));
 
@@ -3698,7 +4165,7 @@ arc_adjust_meta_only(void)
 	 * below the meta limit, but not so much as to drop us below the
 	 * space allotted to the MFU (which is defined as arc_c - arc_p).
 	 */
-	target = MIN((int64_t)(arc_meta_used - arc_meta_limit),
+	target = MIN((int64_t)(meta_used - arc_meta_limit),
 	    (int64_t)(refcount_count(&arc_mfu->arcs_size) - (arc_c - arc_p)));
 
 	total_evicted += arc_adjust_impl(arc_mfu, 0, target, ARC_BUFC_METADATA);
@@ -3707,12 +4174,12 @@ arc_adjust_meta_only(void)
 }
 
 static uint64_t
-arc_adjust_meta(void)
+arc_adjust_meta(uint64_t meta_used)
 {
 	if (zfs_arc_meta_strategy == ARC_STRATEGY_META_ONLY)
-		return (arc_adjust_meta_only());
+		return (arc_adjust_meta_only(meta_used));
 	else
-		return (arc_adjust_meta_balanced());
+		return (arc_adjust_meta_balanced(meta_used));
 }
 
 /*
@@ -3791,20 +4258,71 @@ arc_adjust_type(arc_state_t *state)
 }
 
 /*
- * Evict buffers from the cache, such that arc_size is capped by arc_c.
+ * Evict from each objset that is over its ARC limit until it is back
+ * under, taking the oldest buffers first, as arc_adjust() does for the
+ * ARC as a whole.
  */
 static uint64_t
-arc_adjust(void)
+arc_adjust_objsets(void)
+{
+	arc_state_t *states[] = { arc_mru, arc_mfu };
+	uint64_t total_evicted = 0;
+	arc_objset_t *ao;
+	int i, t;
+
+	if (arc_objset_count == 0)
+		return (0);
+
+	rw_enter(&arc_objset_lock, RW_READER);
+	for (ao = avl_first(&arc_objset_tree); ao != NULL;
+	    ao = AVL_NEXT(&arc_objset_tree, ao)) {
+		int64_t over;
+
+		if (ao->ao_limit == 0)
+			continue;
+
+		over = (int64_t)(ao->ao_size - ao->ao_limit);
+		for (i = 0; i < ARRAY_SIZE(states) && over > 0; i++) {
+			for (t = 0; t < ARC_BUFC_NUMTYPES && over > 0; t++) {
+				uint64_t evicted;
+
+				evicted = arc_evict_state_objset(states[i],
+				    ao->ao_spa, ao, over, t);
+				ARCSTAT_INCR(arcstat_evict_objset_limit,
+				    evicted);
+				total_evicted += evicted;
+				over -= evicted;
+			}
+		}
+	}
+	rw_exit(&arc_objset_lock);
+
+	return (total_evicted);
+}
+
+/*
+ * Evict buffers from the cache, such that arc_size is capped by arc_c.
+ */
+static uint64_t
+arc_adjust(void)
 {
 	uint64_t total_evicted = 0;
 	uint64_t bytes;
 	int64_t target;
+	uint64_t asize = aggsum_value(&arc_size);
+	uint64_t ameta = aggsum_value(&arc_meta_used);
+
+	/*
+	 * Objsets over their own limits are brought back first, which
+	 * may also be all that's needed to get back under arc_c.
+	 */
+	total_evicted += arc_adjust_objsets();
 
 	/*
 	 * If we're over arc_meta_limit, we want to correct that before
 	 * potentially evicting data buffers below.
 	 */
-	total_evicted += arc_adjust_meta();
+	total_evicted += arc_adjust_meta(ameta);
 
 	/*
 	 * Adjust MRU size
@@ -3816,9 +4334,9 @@ arc_adjust(void)
 	 * the MRU is over arc_p, we'll evict enough to get back to
 	 * arc_p here, and then evict more from the MFU below.
 	 */
-	target = MIN((int64_t)(arc_size - arc_c),
+	target = MIN((int64_t)(asize - arc_c),
 	    (int64_t)(refcount_count(&arc_anon->arcs_size) +
-	    refcount_count(&arc_mru->arcs_size) + arc_meta_used - arc_p));
+	    refcount_count(&arc_mru->arcs_size) + ameta - arc_p));
 
 	/*
 	 * If we're below arc_meta_min, always prefer to evict data.
@@ -3829,7 +4347,7 @@ arc_adjust(void)
 	 * type, spill over into the next type.
 	 */
 	if (arc_adjust_type(arc_mru) == ARC_BUFC_METADATA &&
-	    arc_meta_used > arc_meta_min) {
+	    ameta > arc_meta_min) {
 		bytes = arc_adjust_impl(arc_mru, 0, target, ARC_BUFC_METADATA);
 		total_evicted += bytes;
 
@@ -3862,10 +4380,16 @@ arc_adjust(void)
 	 * size back to arc_p, if we're still above the target cache
 	 * size, we evict the rest from the MFU.
 	 */
-	target = arc_size - arc_c;
+	/*
+	 * Re-sum ARC stats after the first round of evictions.
+	 */
+	asize = aggsum_value(&arc_size);
+	ameta = aggsum_value(&arc_meta_used);
+
+	target = asize - arc_c;
 
 	if (arc_adjust_type(arc_mfu) == ARC_BUFC_METADATA &&
-	    arc_meta_used > arc_meta_min) {
+	    ameta > arc_meta_min) {
 		bytes = arc_adjust_impl(arc_mfu, 0, target, ARC_BUFC_METADATA);
 		total_evicted += bytes;
 
@@ -3963,6 +4487,67 @@ arc_flush(spa_t *spa, boolean_t retry)
 	(void) arc_flush_state(arc_mfu_ghost, guid, ARC_BUFC_METADATA, retry);
 }
 
+/*
+ * Limit the ARC data held by an objset to 'limit' bytes and give it
+ * 'weight' in the division of arc_c into protected shares; zero turns
+ * either off.  Buffers already cached are charged to the objset only as
+ * they are next read or written.  Volumes of a multi-tenant pool use
+ * this to keep one tenant from flushing the working set of the others.
+ */
+void
+arc_objset_set_limit(spa_t *spa, uint64_t objset, uint64_t limit,
+    uint_t weight)
+{
+	uint64_t guid = spa_load_guid(spa);
+	arc_objset_t *ao;
+
+	rw_enter(&arc_objset_lock, RW_WRITER);
+	ao = arc_objset_find(guid, objset);
+	if (ao == NULL) {
+		if (limit == 0 && weight == 0) {
+			rw_exit(&arc_objset_lock);
+			return;
+		}
+		ao = kmem_zalloc(sizeof (arc_objset_t), KM_SLEEP);
+		ao->ao_spa = guid;
+		ao->ao_objset = objset;
+		avl_add(&arc_objset_tree, ao);
+		arc_objset_count++;
+	}
+	arc_objset_weight_total -= ao->ao_weight;
+	arc_objset_weight_total += weight;
+	ao->ao_limit = limit;
+	ao->ao_weight = weight;
+	rw_exit(&arc_objset_lock);
+
+	if (limit != 0 && ao->ao_size > limit)
+		cv_signal(&arc_reclaim_thread_cv);
+}
+
+/*
+ * Return the size, limit and weight of an objset with ARC limits, or
+ * ENOENT if arc_objset_set_limit() was never called for it.
+ */
+int
+arc_objset_get_limit(spa_t *spa, uint64_t objset, uint64_t *size,
+    uint64_t *limit, uint_t *weight)
+{
+	arc_objset_t *ao;
+
+	rw_enter(&arc_objset_lock, RW_READER);
+	ao = arc_objset_find(spa_load_guid(spa), objset);
+	if (ao == NULL) {
+		rw_exit(&arc_objset_lock);
+		return (SET_ERROR(ENOENT));
+	}
+	*size = ao->ao_size;
+	*limit = ao->ao_limit;
+	*weight = ao->ao_weight;
+	rw_exit(&arc_objset_lock);
+
+	return (0);
+}
+
 void
 arc_shrink(int64_t to_free)
 {
@@ -3971,8 +4556,9 @@ arc_shrink(int64_t to_free)
 	if (c > to_free && c - to_free > arc_c_min) {
 		arc_c = c - to_free;
 		atomic_add_64(&arc_p, -(arc_p >> arc_shrink_shift));
-		if (arc_c > arc_size)
-			arc_c = MAX(arc_size, arc_c_min);
+		uint64_t asize = aggsum_value(&arc_size);
+		if (arc_c > asize)
+			arc_c = MAX(asize, arc_c_min);
 		if (arc_p > arc_c)
 			arc_p = (arc_c >> 1);
 		ASSERT(arc_c >= arc_c_min);
@@ -3981,7 +4567,7 @@ arc_shrink(int64_t to_free)
 		arc_c = arc_c_min;
 	}
 
-	if (arc_size > arc_c)
+	if (aggsum_compare(&arc_size, arc_c) > 0)
 		(void) arc_adjust();
 }
 
@@ -3999,6 +4585,8 @@ arc_all_memory(void)
 	return (ptob(totalram_pages));
 #endif /* CONFIG_HIGHMEM */
 #else
+	if (arc_cgroup_limited)
+		return (cgroup_mem_limit);
 	return (ptob(physmem) / 4);
 #endif /* _KERNEL */
 }
@@ -4024,6 +4612,8 @@ arc_free_memory(void)
 
 #endif /* CONFIG_HIGHMEM */
 #else
+	if (arc_cgroup_limited)
+		return (cgroup_mem_free);
 	return (spa_get_random(arc_all_memory() * 20 / 100));
 #endif /* _KERNEL */
 }
@@ -4165,9 +4755,14 @@ arc_available_memory(void)
 		}
 	}
 #else /* _KERNEL */
-	/* Every 100 calls, free a small amount */
-	if (spa_get_random(100) == 0)
+	if (arc_cgroup_limited) {
+		/* Keep arc_sys_free bytes free below the cgroup limit */
+		lowest = (int64_t)arc_free_memory() - (int64_t)arc_sys_free;
+		r = FMR_LOTSFREE;
+	} else if (spa_get_random(100) == 0) {
+		/* Every 100 calls, free a small amount */
 		lowest = -1024;
+	}
 #endif /* _KERNEL */
 
 	last_free_memory = lowest;
@@ -4176,6 +4771,39 @@ arc_available_memory(void)
 	return (lowest);
 }
 
+/*
+ * Return a negative amount of memory to free when the memory cgroup has
+ * reported PSI events since the last call, or INT64_MAX otherwise.  Each
+ * run of events within arc_grow_retry seconds of one another doubles the
+ * amount, starting from the normal arc_shrink() step, so that sustained
+ * pressure shrinks the ARC quickly while a lone stall only trims it.
+ * Only called from arc_reclaim_thread(), which consumes the events.
+ */
+static int64_t
+arc_pressure_memory(void)
+{
+#ifdef _KERNEL
+	return (INT64_MAX);
+#else
+	uint64_t events = cgroup_mem_pressure;
+	hrtime_t now = gethrtime();
+
+	if (!arc_cgroup_limited || events == arc_cgroup_pressure_seen)
+		return (INT64_MAX);
+
+	if (now - arc_cgroup_pressure_time > SEC2NSEC(arc_grow_retry))
+		arc_cgroup_pressure_streak = 0;
+	else if (arc_cgroup_pressure_streak < arc_shrink_shift - 1)
+		arc_cgroup_pressure_streak++;
+
+	arc_cgroup_pressure_seen = events;
+	arc_cgroup_pressure_time = now;
+
+	return (-(int64_t)(arc_c >>
+	    (arc_shrink_shift - arc_cgroup_pressure_streak)));
+#endif /* _KERNEL */
+}
+
 /*
  * Determine if the system is under memory pressure and is asking
  * to reclaim memory. A return value of B_TRUE indicates that the system
@@ -4198,7 +4826,8 @@ arc_kmem_reap_now(void)
 	extern kmem_cache_t	*range_seg_cache;
 
 #ifdef _KERNEL
-	if ((arc_meta_used >= arc_meta_limit) && zfs_arc_meta_prune) {
+	if ((aggsum_compare(&arc_meta_used, arc_meta_limit) >= 0) &&
+	    zfs_arc_meta_prune) {
 		/*
 		 * We are exceeding our meta-data cache limit.
 		 * Prune some entries to release holds on meta-data.
@@ -4232,6 +4861,7 @@ arc_kmem_reap_now(void)
 	kmem_cache_reap_now(hdr_full_cache);
 	kmem_cache_reap_now(hdr_l2only_cache);
 	kmem_cache_reap_now(range_seg_cache);
+	abd_cache_reap_now();
 
 	if (zio_arena != NULL) {
 		/*
@@ -4298,7 +4928,8 @@ arc_reclaim_thread(void)
 		 */
 		evicted = arc_adjust();
 
-		int64_t free_memory = arc_available_memory();
+		int64_t pressure = arc_pressure_memory();
+		int64_t free_memory = MIN(arc_available_memory(), pressure);
 		if (free_memory < 0) {
 
 			arc_no_grow = B_TRUE;
@@ -4316,7 +4947,7 @@ arc_reclaim_thread(void)
 			 * If we are still low on memory, shrink the ARC
 			 * so that we have arc_shrink_min free space.
 			 */
-			free_memory = arc_available_memory();
+			free_memory = MIN(arc_available_memory(), pressure);
 
 			to_free = (arc_c >> arc_shrink_shift) - free_memory;
 			if (to_free > 0) {
@@ -4342,7 +4973,7 @@ arc_reclaim_thread(void)
 		 * be helpful and could potentially cause us to enter an
 		 * infinite loop.
 		 */
-		if (arc_size <= arc_c || evicted == 0) {
+		if (aggsum_compare(&arc_size, arc_c) <= 0 || evicted == 0) {
 			/*
 			 * We're either no longer overflowing, or we
 			 * can't evict anything more, so we should wake
@@ -4426,7 +5057,8 @@ arc_evictable_memory(void)
 	    refcount_count(&arc_mru->arcs_esize[ARC_BUFC_METADATA]) +
 	    refcount_count(&arc_mfu->arcs_esize[ARC_BUFC_DATA]) +
 	    refcount_count(&arc_mfu->arcs_esize[ARC_BUFC_METADATA]);
-	uint64_t arc_dirty = MAX((int64_t)arc_size - (int64_t)arc_clean, 0);
+	int64_t asize = aggsum_value(&arc_size);
+	uint64_t arc_dirty = MAX(asize - (int64_t)arc_clean, 0);
 
 	/*
 	 * Scale reported evictable memory in proportion to page cache, cap
@@ -4438,7 +5070,7 @@ arc_evictable_memory(void)
 	if (arc_dirty >= min)
 		return (arc_clean);
 
-	return (MAX((int64_t)arc_size - (int64_t)min, 0));
+	return (MAX(asize - (int64_t)min, 0));
 }
 
 /*
@@ -4581,7 +5213,8 @@ arc_adapt(int bytes, arc_state_t *state)
 	 * cache size, increment the target cache size
 	 */
 	ASSERT3U(arc_c, >=, 2ULL << SPA_MAXBLOCKSHIFT);
-	if (arc_size >= arc_c - (2ULL << SPA_MAXBLOCKSHIFT)) {
+	if (aggsum_upper_bound(&arc_size) >=
+	    arc_c - (2ULL << SPA_MAXBLOCKSHIFT)) {
 		atomic_add_64(&arc_c, (int64_t)bytes);
 		if (arc_c > arc_c_max)
 			arc_c = arc_c_max;
@@ -4604,7 +5237,16 @@ arc_is_overflowing(void)
 	uint64_t overflow = MAX(SPA_MAXBLOCKSIZE,
 	    arc_c >> zfs_arc_overflow_shift);
 
-	return (arc_size >= arc_c + overflow);
+	/*
+	 * We just compare the lower bound here for performance reasons. Our
+	 * primary goals are to make sure that the arc never grows without
+	 * bound, and that it can reach its maximum size. This check
+	 * accomplishes both goals. The maximum amount we could run over by is
+	 * 2 * aggsum_borrow_multiplier * NUM_CPUS * the average size of a block
+	 * in the ARC. In practice, that's in the tens of MB, which is low
+	 * enough to be safe.
+	 */
+	return (aggsum_lower_bound(&arc_size) >= arc_c + overflow);
 }
 
 static abd_t *
@@ -4719,7 +5361,8 @@ arc_get_data_impl(arc_buf_hdr_t *hdr, uint64_t size, void *tag)
 		 * If we are growing the cache, and we are adding anonymous
 		 * data, and we have outgrown arc_p, update arc_p
 		 */
-		if (arc_size < arc_c && hdr->b_l1hdr.b_state == arc_anon &&
+		if (aggsum_upper_bound(&arc_size) < arc_c &&
+		    hdr->b_l1hdr.b_state == arc_anon &&
 		    (refcount_count(&arc_anon->arcs_size) +
 		    refcount_count(&arc_mru->arcs_size) > arc_p))
 			arc_p = MIN(arc_c, arc_p + size);
@@ -4964,6 +5607,146 @@ arc_buf_access(arc_buf_t *buf)
 	    !HDR_ISTYPE_METADATA(hdr), data, metadata, hits);
 }
 
+/*
+ * Decide whether this arc_read() is sampled into the trace ring, and if
+ * so return its start time.  The tick is deliberately not atomic: a lost
+ * increment only perturbs the sampling rate.
+ */
+static hrtime_t
+arc_trace_start(const zbookmark_phys_t *zb)
+{
+	if (arc_trace_ring == NULL || zb == NULL || zfs_arc_trace_sample <= 0)
+		return (0);
+
+	if (++arc_trace_tick % zfs_arc_trace_sample != 0)
+		return (0);
+
+	return (gethrtime());
+}
+
+static void
+arc_trace_record(const zbookmark_phys_t *zb, arc_trace_result_t result,
+    uint64_t size, hrtime_t start)
+{
+	arc_trace_entry_t *ate;
+	hrtime_t now = gethrtime();
+
+	mutex_enter(&arc_trace_lock);
+	ate = &arc_trace_ring[arc_trace_head++ % arc_trace_entries];
+	ate->ate_time = now;
+	ate->ate_objset = zb->zb_objset;
+	ate->ate_object = zb->zb_object;
+	ate->ate_level = zb->zb_level;
+	ate->ate_blkid = zb->zb_blkid;
+	ate->ate_latency = now - start;
+	ate->ate_size = size;
+	ate->ate_result = result;
+	mutex_exit(&arc_trace_lock);
+}
+
+static const char *arc_trace_result_names[] = { "hit", "miss", "l2hit" };
+
+static int
+arc_trace_kstat_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-16s %-8s %-16s %-6s %-16s %-6s "
+	    "%-8s %-12s\n", "time", "objset", "object", "level", "blkid",
+	    "result", "size", "latency");
+
+	return (0);
+}
+
+static int
+arc_trace_kstat_data(char *buf, size_t size, void *data)
+{
+	arc_trace_entry_t *ate = data;
+
+	(void) snprintf(buf, size, "%-16llu 0x%-6llx %-16llu %-6lld %-16llu "
+	    "%-6s %-8u %-12llu\n", (u_longlong_t)ate->ate_time,
+	    (u_longlong_t)ate->ate_objset, (u_longlong_t)ate->ate_object,
+	    (longlong_t)ate->ate_level, (u_longlong_t)ate->ate_blkid,
+	    arc_trace_result_names[ate->ate_result], ate->ate_size,
+	    (u_longlong_t)ate->ate_latency);
+
+	return (0);
+}
+
+/*
+ * Return the n'th oldest entry in the ring.  arc_trace_lock is held
+ * until ksp->ks_ndata entries are processed.
+ */
+static void *
+arc_trace_kstat_addr(kstat_t *ksp, loff_t n)
+{
+	uint64_t valid = MIN(arc_trace_head, arc_trace_entries);
+
+	ASSERT(MUTEX_HELD(&arc_trace_lock));
+
+	if (n >= valid)
+		return (NULL);
+
+	return (&arc_trace_ring[(arc_trace_head - valid + n) %
+	    arc_trace_entries]);
+}
+
+/*
+ * When the kstat is written discard all recorded entries.
+ */
+static int
+arc_trace_kstat_update(kstat_t *ksp, int rw)
+{
+	uint64_t valid;
+
+	if (rw == KSTAT_WRITE)
+		arc_trace_head = 0;
+
+	valid = MIN(arc_trace_head, arc_trace_entries);
+	ksp->ks_ndata = valid;
+	ksp->ks_data_size = valid * sizeof (arc_trace_entry_t);
+
+	return (0);
+}
+
+static void
+arc_trace_init(void)
+{
+	if (zfs_arc_trace_entries <= 0)
+		return;
+
+	mutex_init(&arc_trace_lock, NULL, MUTEX_DEFAULT, NULL);
+	arc_trace_entries = zfs_arc_trace_entries;
+	arc_trace_head = 0;
+	arc_trace_ring = vmem_zalloc(arc_trace_entries *
+	    sizeof (arc_trace_entry_t), KM_SLEEP);
+
+	arc_trace_ksp = kstat_create("zfs", 0, "arc_trace", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	if (arc_trace_ksp != NULL) {
+		arc_trace_ksp->ks_lock = &arc_trace_lock;
+		arc_trace_ksp->ks_data = NULL;
+		arc_trace_ksp->ks_update = arc_trace_kstat_update;
+		kstat_set_raw_ops(arc_trace_ksp, arc_trace_kstat_headers,
+		    arc_trace_kstat_data, arc_trace_kstat_addr);
+		kstat_install(arc_trace_ksp);
+	}
+}
+
+static void
+arc_trace_fini(void)
+{
+	if (arc_trace_ring == NULL)
+		return;
+
+	if (arc_trace_ksp != NULL) {
+		kstat_delete(arc_trace_ksp);
+		arc_trace_ksp = NULL;
+	}
+	vmem_free(arc_trace_ring, arc_trace_entries *
+	    sizeof (arc_trace_entry_t));
+	arc_trace_ring = NULL;
+	mutex_destroy(&arc_trace_lock);
+}
+
 /* a generic arc_read_done_func_t which you can use */
 /* ARGSUSED */
 void
@@ -5134,6 +5917,11 @@ arc_read_done(zio_t *zio)
 
 	/* execute each callback and free its structure */
 	while ((acb = callback_list) != NULL) {
+		if (acb->acb_trace_start != 0) {
+			arc_trace_record(&acb->acb_trace_zb, acb->acb_trace_l2 ?
+			    ARC_TRACE_L2_HIT : ARC_TRACE_MISS,
+			    HDR_GET_LSIZE(hdr), acb->acb_trace_start);
+		}
 		if (acb->acb_done)
 			acb->acb_done(zio, acb->acb_buf, acb->acb_private);
 
@@ -5178,6 +5966,9 @@ arc_read(zio_t *pio, spa_t *spa, const blkptr_t *bp, arc_done_func_t *done,
 	zio_t *rzio;
 	uint64_t guid = spa_load_guid(spa);
 	boolean_t compressed_read = (zio_flags & ZIO_FLAG_RAW) != 0;
+	boolean_t uncached = (*arc_flags & ARC_FLAG_UNCACHED) != 0 ||
+	    (zfs_arc_uncached_prio_mask & (1 << priority)) != 0;
+	hrtime_t trace_start = arc_trace_start(zb);
 	int rc = 0;
 
 	ASSERT(!BP_IS_EMBEDDED(bp) ||
@@ -5227,7 +6018,10 @@ top:
 			if (hdr->b_flags & ARC_FLAG_PREDICTIVE_PREFETCH) {
 				arc_hdr_clear_flags(hdr,
 				    ARC_FLAG_PREDICTIVE_PREFETCH);
+				*arc_flags |= ARC_FLAG_PREFETCH_HIT;
 			}
+			if (!uncached)
+				arc_hdr_clear_flags(hdr, ARC_FLAG_UNCACHED);
 
 			if (*arc_flags & ARC_FLAG_WAIT) {
 				cv_wait(&hdr->b_l1hdr.b_cv, hash_lock);
@@ -5244,6 +6038,10 @@ top:
 				acb->acb_done = done;
 				acb->acb_private = private;
 				acb->acb_compressed = compressed_read;
+				if (trace_start != 0) {
+					acb->acb_trace_start = trace_start;
+					acb->acb_trace_zb = *zb;
+				}
 				if (pio != NULL)
 					acb->acb_zio_dummy = zio_null(pio,
 					    spa, NULL, NULL, NULL, zio_flags);
@@ -5275,6 +6073,7 @@ top:
 				    arcstat_demand_hit_predictive_prefetch);
 				arc_hdr_clear_flags(hdr,
 				    ARC_FLAG_PREDICTIVE_PREFETCH);
+				*arc_flags |= ARC_FLAG_PREFETCH_HIT;
 			}
 			ASSERT(!BP_IS_EMBEDDED(bp) || !BP_IS_HOLE(bp));
 
@@ -5286,7 +6085,15 @@ top:
 			arc_hdr_set_flags(hdr, ARC_FLAG_PREFETCH);
 		}
 		DTRACE_PROBE1(arc__hit, arc_buf_hdr_t *, hdr);
-		arc_access(hdr, hash_lock);
+		/*
+		 * An uncached read neither promotes the buffer nor refreshes
+		 * its position; any other read admits a buffer that was
+		 * brought in by a scan into the working set.
+		 */
+		if (!uncached) {
+			arc_hdr_clear_flags(hdr, ARC_FLAG_UNCACHED);
+			arc_access(hdr, hash_lock);
+		}
 		if (*arc_flags & ARC_FLAG_L2CACHE)
 			arc_hdr_set_flags(hdr, ARC_FLAG_L2CACHE);
 		mutex_exit(hash_lock);
@@ -5294,6 +6101,10 @@ top:
 		ARCSTAT_CONDSTAT(!HDR_PREFETCH(hdr),
 		    demand, prefetch, !HDR_ISTYPE_METADATA(hdr),
 		    data, metadata, hits);
+		if (trace_start != 0) {
+			arc_trace_record(zb, ARC_TRACE_HIT, BP_GET_LSIZE(bp),
+			    trace_start);
+		}
 
 		if (done)
 			done(NULL, buf, private);
@@ -5365,6 +6176,7 @@ top:
 			arc_access(hdr, hash_lock);
 			arc_hdr_alloc_pabd(hdr);
 		}
+		arc_hdr_set_objset(hdr, zb);
 		ASSERT3P(hdr->b_l1hdr.b_pabd, !=, NULL);
 		size = arc_hdr_size(hdr);
 
@@ -5386,12 +6198,18 @@ top:
 			arc_hdr_set_flags(hdr, ARC_FLAG_INDIRECT);
 		if (*arc_flags & ARC_FLAG_PREDICTIVE_PREFETCH)
 			arc_hdr_set_flags(hdr, ARC_FLAG_PREDICTIVE_PREFETCH);
+		if (uncached && hdr->b_l1hdr.b_state == arc_anon)
+			arc_hdr_set_flags(hdr, ARC_FLAG_UNCACHED);
 		ASSERT(!GHOST_STATE(hdr->b_l1hdr.b_state));
 
 		acb = kmem_zalloc(sizeof (arc_callback_t), KM_SLEEP);
 		acb->acb_done = done;
 		acb->acb_private = private;
 		acb->acb_compressed = compressed_read;
+		if (trace_start != 0) {
+			acb->acb_trace_start = trace_start;
+			acb->acb_trace_zb = *zb;
+		}
 
 		ASSERT3P(hdr->b_l1hdr.b_acb, ==, NULL);
 		hdr->b_l1hdr.b_acb = acb;
@@ -5448,6 +6266,7 @@ top:
 				uint64_t asize;
 
 				DTRACE_PROBE1(l2arc__hit, arc_buf_hdr_t *, hdr);
+				acb->acb_trace_l2 = B_TRUE;
 				ARCSTAT_BUMP(arcstat_l2_hits);
 				atomic_inc_32(&hdr->b_l2hdr.b_hits);
 
@@ -6131,6 +6950,7 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
 
 	ASSERT(!arc_buf_is_shared(buf));
 	ASSERT3P(hdr->b_l1hdr.b_pabd, ==, NULL);
+	arc_hdr_set_objset(hdr, zb);
 
 	zio = zio_write(pio, spa, txg, bp,
 	    abd_get_from_buf(buf->b_data, HDR_GET_LSIZE(hdr)),
@@ -6299,6 +7119,9 @@ arc_kstat_update(kstat_t *ksp, int rw)
 		    &as->arcstat_mfu_ghost_evictable_data,
 		    &as->arcstat_mfu_ghost_evictable_metadata);
 
+		ARCSTAT(arcstat_size) = aggsum_value(&arc_size);
+		ARCSTAT(arcstat_meta_used) = aggsum_value(&arc_meta_used);
+
 		as->arcstat_memory_all_bytes.value.ui64 =
 		    arc_all_memory();
 		as->arcstat_memory_free_bytes.value.ui64 =
@@ -6504,6 +7327,9 @@ arc_state_init(void)
 	refcount_create(&arc_mfu_ghost->arcs_size);
 	refcount_create(&arc_l2c_only->arcs_size);
 
+	aggsum_init(&arc_meta_used, 0);
+	aggsum_init(&arc_size, 0);
+
 	arc_anon->arcs_state = ARC_STATE_ANON;
 	arc_mru->arcs_state = ARC_STATE_MRU;
 	arc_mru_ghost->arcs_state = ARC_STATE_MRU_GHOST;
@@ -6545,6 +7371,9 @@ arc_state_fini(void)
 	multilist_destroy(arc_mfu_ghost->arcs_list[ARC_BUFC_DATA]);
 	multilist_destroy(arc_l2c_only->arcs_list[ARC_BUFC_METADATA]);
 	multilist_destroy(arc_l2c_only->arcs_list[ARC_BUFC_DATA]);
+
+	aggsum_fini(&arc_meta_used);
+	aggsum_fini(&arc_size);
 }
 
 uint64_t
@@ -6565,6 +7394,19 @@ arc_init(void)
 	/* Convert seconds to clock ticks */
 	arc_min_prefetch_lifespan = 1 * hz;
 
+#ifndef _KERNEL
+	/*
+	 * Follow the memory cgroup's limit and pressure, when there is one,
+	 * before anything below sizes itself with arc_all_memory().
+	 */
+	if (zfs_arc_cgroup_enabled) {
+		arc_cgroup_limited = cgroup_mem_monitor_init(
+		    zfs_arc_psi_stall_us, zfs_arc_psi_window_us);
+		if (arc_cgroup_limited)
+			allmem = arc_all_memory();
+	}
+#endif
+
 #ifdef _KERNEL
 	/*
 	 * Register a shrinker to support synchronous (direct) memory
@@ -6585,18 +7427,27 @@ arc_init(void)
 	/* Set min cache to 1/32 of all memory, or 32MB, whichever is more */
 	arc_c_min = MAX(allmem / 32, 2ULL << SPA_MAXBLOCKSHIFT);
 #else
-	/*
-	 * In userland, there's only the memory pressure that we artificially
-	 * create (see arc_available_memory()).  Don't let arc_c get too
-	 * small, because it can cause transactions to be larger than
-	 * arc_c, causing arc_tempreserve_space() to fail.
-	 */
-	arc_c_min = MAX(arc_c_max / 2, 2ULL << SPA_MAXBLOCKSHIFT);
+	if (arc_cgroup_limited) {
+		/*
+		 * Under a cgroup limit the pressure is real, so size the
+		 * floor and the free target the way the kernel does.
+		 */
+		arc_c_min = MAX(allmem / 32, 2ULL << SPA_MAXBLOCKSHIFT);
+		arc_sys_free = MAX(allmem / 64, (512 * 1024));
+	} else {
+		/*
+		 * In userland, there's only the memory pressure that we
+		 * artificially create (see arc_available_memory()).  Don't
+		 * let arc_c get too small, because it can cause transactions
+		 * to be larger than arc_c, causing arc_tempreserve_space()
+		 * to fail.
+		 */
+		arc_c_min = MAX(arc_c_max / 2, 2ULL << SPA_MAXBLOCKSHIFT);
+	}
 #endif
 
 	arc_c = arc_c_max;
 	arc_p = (arc_c >> 1);
-	arc_size = 0;
 
 	/* Set min to 1/2 of arc_c_min */
 	arc_meta_min = 1ULL << SPA_MAXBLOCKSHIFT;
@@ -6627,9 +7478,26 @@ arc_init(void)
 	    offsetof(arc_prune_t, p_node));
 	mutex_init(&arc_prune_mtx, NULL, MUTEX_DEFAULT, NULL);
 
+	avl_create(&arc_objset_tree, arc_objset_compare,
+	    sizeof (arc_objset_t), offsetof(arc_objset_t, ao_node));
+	rw_init(&arc_objset_lock, NULL, RW_DEFAULT, NULL);
+
 	arc_prune_taskq = taskq_create("arc_prune", boot_ncpus, defclsyspri,
 	    boot_ncpus, INT_MAX, TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
 
+	/*
+	 * The calling thread always evicts one share itself, so the taskq
+	 * only needs arc_evict_threads - 1 threads.
+	 */
+	arc_evict_threads = zfs_arc_evict_threads;
+	if (arc_evict_threads <= 0)
+		arc_evict_threads = MAX(highbit64(boot_ncpus) - 1, 1);
+	if (arc_evict_threads > 1) {
+		arc_evict_taskq = taskq_create("arc_evict",
+		    arc_evict_threads - 1, defclsyspri, arc_evict_threads - 1,
+		    INT_MAX, TASKQ_PREPOPULATE);
+	}
+
 	arc_reclaim_thread_exit = B_FALSE;
 
 	arc_ksp = kstat_create("zfs", 0, "arcstats", "misc", KSTAT_TYPE_NAMED,
@@ -6641,6 +7509,8 @@ arc_init(void)
 		kstat_install(arc_ksp);
 	}
 
+	arc_trace_init();
+
 	(void) thread_create(NULL, 0, arc_reclaim_thread, NULL, 0, &p0,
 	    TS_RUN, defclsyspri);
 
@@ -6671,6 +7541,8 @@ void
 arc_fini(void)
 {
 	arc_prune_t *p;
+	arc_objset_t *ao;
+	void *cookie;
 
 #ifdef _KERNEL
 	spl_unregister_shrinker(&arc_shrinker);
@@ -6698,9 +7570,16 @@ arc_fini(void)
 		arc_ksp = NULL;
 	}
 
+	arc_trace_fini();
+
 	taskq_wait(arc_prune_taskq);
 	taskq_destroy(arc_prune_taskq);
 
+	if (arc_evict_taskq != NULL) {
+		taskq_destroy(arc_evict_taskq);
+		arc_evict_taskq = NULL;
+	}
+
 	mutex_enter(&arc_prune_mtx);
 	while ((p = list_head(&arc_prune_list)) != NULL) {
 		list_remove(&arc_prune_list, p);
@@ -6712,6 +7591,14 @@ arc_fini(void)
 
 	list_destroy(&arc_prune_list);
 	mutex_destroy(&arc_prune_mtx);
+
+	cookie = NULL;
+	while ((ao = avl_destroy_nodes(&arc_objset_tree, &cookie)) != NULL)
+		kmem_free(ao, sizeof (arc_objset_t));
+	avl_destroy(&arc_objset_tree);
+	rw_destroy(&arc_objset_lock);
+	arc_objset_count = 0;
+	arc_objset_weight_total = 0;
 	mutex_destroy(&arc_reclaim_lock);
 	cv_destroy(&arc_reclaim_thread_cv);
 	cv_destroy(&arc_reclaim_waiters_cv);
@@ -6719,6 +7606,13 @@ arc_fini(void)
 	arc_state_fini();
 	buf_fini();
 
+#ifndef _KERNEL
+	if (arc_cgroup_limited) {
+		cgroup_mem_monitor_fini();
+		arc_cgroup_limited = B_FALSE;
+	}
+#endif
+
 	ASSERT0(arc_loaned_bytes);
 }
 
@@ -6840,6 +7734,16 @@ arc_fini(void)
  * 8. If an ARC buffer is written (and dirtied) which also exists in the
  * L2ARC, the now stale L2ARC buffer is immediately dropped.
  *
+ * 9. The L2ARC is persistent.  Along with the data, l2arc_write_buffers()
+ * writes log blocks describing the buffers it wrote, and a device header
+ * pointing at the newest log block (see arc_impl.h).  When a cache device
+ * is added on pool import, l2arc_rebuild() walks the log blocks in the
+ * background and recreates the L2-only headers, so the contents of the
+ * device survive an export or restart without being read back.  A log
+ * block only describes data written before it; any stale entry is caught
+ * by the checksum verification in l2arc_read_done() like any other L2ARC
+ * read error.
+ *
  * The performance of the L2ARC can be tweaked by a number of tunables, which
  * may be necessary for different workloads:
  *
@@ -6853,6 +7757,7 @@ arc_fini(void)
  *				since more compressed buffers are likely to
  *				be present
  *	l2arc_feed_secs		seconds between L2ARC writing
+ *	l2arc_rebuild_enabled	restore the L2ARC contents on pool import
  *
  * Tunables may be removed or added as future performance improvements are
  * integrated, and also may become zpool properties.
@@ -6876,9 +7781,11 @@ l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *hdr)
 	 * 2. is already cached on the L2ARC.
 	 * 3. has an I/O in progress (it may be an incomplete read).
 	 * 4. is flagged not eligible (zfs property).
+	 * 5. was only read by a scan (ARC_FLAG_UNCACHED).
 	 */
 	if (hdr->b_spa != spa_guid || HDR_HAS_L2HDR(hdr) ||
-	    HDR_IO_IN_PROGRESS(hdr) || !HDR_L2CACHE(hdr))
+	    HDR_IO_IN_PROGRESS(hdr) || !HDR_L2CACHE(hdr) ||
+	    HDR_UNCACHED(hdr))
 		return (B_FALSE);
 
 	return (B_TRUE);
@@ -6969,10 +7876,10 @@ l2arc_dev_get_next(void)
 		else if (next == first)
 			break;
 
-	} while (vdev_is_dead(next->l2ad_vdev));
+	} while (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild);
 
 	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
+	if (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild)
 		next = NULL;
 
 	l2arc_dev_last = next;
@@ -7393,6 +8300,118 @@ top:
 	mutex_exit(&dev->l2ad_mtx);
 }
 
+/*
+ * Persistent L2ARC: writing log blocks and the device header.
+ *
+ * All of this runs in the feed thread, with the spa's SCL_L2ARC lock held
+ * as reader, so the in-core log block and device header need no locking.
+ */
+CTASSERT_GLOBAL(sizeof (l2arc_dev_hdr_phys_t) == L2ARC_DEV_HDR_SIZE);
+CTASSERT_GLOBAL(sizeof (l2arc_log_blk_phys_t) <= L2ARC_LOG_BLK_SIZE);
+
+/*
+ * Write a copy of a persistent L2ARC structure to the device as part of the
+ * current write.  The copy is freed once the write has completed.
+ */
+static void
+l2arc_write_phys_copy(zio_t *pio, l2arc_dev_t *dev, uint64_t daddr,
+    const void *buf, uint64_t size, uint64_t asize)
+{
+	abd_t *abd;
+
+	abd = abd_alloc_for_io(asize, B_TRUE);
+	abd_copy_from_buf(abd, buf, size);
+	if (asize != size)
+		abd_zero_off(abd, size, asize - size);
+	l2arc_free_abd_on_write(abd, asize, ARC_BUFC_METADATA);
+
+	(void) zio_nowait(zio_write_phys(pio, dev->l2ad_vdev, daddr, asize,
+	    abd, ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_ASYNC_WRITE,
+	    ZIO_FLAG_CANFAIL, B_FALSE));
+}
+
+/*
+ * Record a buffer that is being written to the device in the current log
+ * block.  Returns B_TRUE when the log block is full and must be committed.
+ */
+static boolean_t
+l2arc_log_blk_insert(l2arc_dev_t *dev, arc_buf_hdr_t *hdr)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log_blk;
+	l2arc_log_ent_phys_t *le;
+
+	ASSERT3U(lb->lb_nentries, <, L2ARC_LOG_BLK_ENTRIES);
+	le = &lb->lb_entries[lb->lb_nentries++];
+
+	le->le_dva = hdr->b_dva;
+	le->le_birth = hdr->b_birth;
+	le->le_prop = 0;
+	L2ARC_LE_SET_LSIZE(le, HDR_GET_LSIZE(hdr));
+	L2ARC_LE_SET_PSIZE(le, HDR_GET_PSIZE(hdr));
+	L2ARC_LE_SET_COMPRESS(le, HDR_GET_COMPRESS(hdr));
+	L2ARC_LE_SET_TYPE(le, arc_buf_type(hdr));
+	le->le_daddr = hdr->b_l2hdr.b_daddr;
+
+	return (lb->lb_nentries == L2ARC_LOG_BLK_ENTRIES);
+}
+
+/*
+ * Write out the current log block at the write hand and make it the head
+ * of the chain.  Returns the number of bytes the hand was advanced by.
+ */
+static uint64_t
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log_blk;
+	l2arc_log_blkptr_t *head = &dev->l2ad_dev_hdr->l2dh_head;
+	uint64_t asize = dev->l2ad_log_blk_asize;
+
+	ASSERT3U(lb->lb_nentries, >, 0);
+
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_version = L2ARC_PERSIST_VERSION;
+	lb->lb_prev = *head;
+
+	head->lbp_daddr = dev->l2ad_hand;
+	head->lbp_asize = asize;
+	fletcher_4_native(lb, sizeof (*lb), NULL, &head->lbp_cksum);
+
+	l2arc_write_phys_copy(pio, dev, dev->l2ad_hand, lb, sizeof (*lb),
+	    asize);
+	dev->l2ad_hand += asize;
+	dev->l2ad_log_blk_written = B_TRUE;
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+
+	bzero(lb, sizeof (*lb));
+
+	return (asize);
+}
+
+/*
+ * Write the device header describing the current write hand and the newest
+ * log block.
+ */
+static void
+l2arc_dev_hdr_write(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_dev_hdr_phys_t *l2dh = dev->l2ad_dev_hdr;
+
+	l2dh->l2dh_magic = L2ARC_DEV_HDR_MAGIC;
+	l2dh->l2dh_version = L2ARC_PERSIST_VERSION;
+	l2dh->l2dh_spa_guid = spa_guid(dev->l2ad_spa);
+	l2dh->l2dh_vdev_guid = dev->l2ad_vdev->vdev_guid;
+	l2dh->l2dh_flags = dev->l2ad_first ? 0 : L2ARC_DEV_HDR_WRAPPED;
+	l2dh->l2dh_start = dev->l2ad_start;
+	l2dh->l2dh_end = dev->l2ad_end;
+	l2dh->l2dh_hand = dev->l2ad_hand;
+	fletcher_4_native(l2dh, offsetof(l2arc_dev_hdr_phys_t, l2dh_cksum),
+	    NULL, &l2dh->l2dh_cksum);
+
+	l2arc_write_phys_copy(pio, dev, VDEV_LABEL_START_SIZE, l2dh,
+	    sizeof (*l2dh), dev->l2ad_dev_hdr_asize);
+	dev->l2ad_log_blk_written = B_FALSE;
+}
+
 /*
  * Find and write ARC buffers to the L2ARC device.
  *
@@ -7449,6 +8468,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 
 		for (; hdr; hdr = hdr_prev) {
 			kmutex_t *hash_lock;
+			boolean_t commit;
 
 			if (arc_warm == B_FALSE)
 				hdr_prev = multilist_sublist_next(mls, hdr);
@@ -7491,8 +8511,16 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			uint64_t psize = arc_hdr_size(hdr);
 			uint64_t asize = vdev_psize_to_asize(dev->l2ad_vdev,
 			    psize);
+			uint64_t lb_asize = 0;
 
-			if ((write_asize + asize) > target_sz) {
+			/*
+			 * Leave room for the log block this buffer completes.
+			 */
+			if (dev->l2ad_log_blk->lb_nentries + 1 ==
+			    L2ARC_LOG_BLK_ENTRIES)
+				lb_asize = dev->l2ad_log_blk_asize;
+
+			if ((write_asize + asize + lb_asize) > target_sz) {
 				full = B_TRUE;
 				mutex_exit(hash_lock);
 				break;
@@ -7571,9 +8599,14 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			write_asize += asize;
 			dev->l2ad_hand += asize;
 
+			commit = l2arc_log_blk_insert(dev, hdr);
+
 			mutex_exit(hash_lock);
 
 			(void) zio_nowait(wzio);
+
+			if (commit)
+				write_asize += l2arc_log_blk_commit(dev, pio);
 		}
 
 		multilist_sublist_unlock(mls);
@@ -7606,6 +8639,9 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 		dev->l2ad_first = B_FALSE;
 	}
 
+	if (dev->l2ad_log_blk_written)
+		l2arc_dev_hdr_write(dev, pio);
+
 	dev->l2ad_writing = B_TRUE;
 	(void) zio_wait(pio);
 	dev->l2ad_writing = B_FALSE;
@@ -7729,6 +8765,262 @@ l2arc_vdev_present(vdev_t *vd)
 	return (dev != NULL);
 }
 
+/*
+ * Persistent L2ARC: rebuilding the L2-only headers of a cache device.
+ */
+
+/*
+ * Take SCL_L2ARC for an I/O issued by the rebuild thread.  The device may
+ * be in the middle of being removed by a thread which holds all of the
+ * config locks as writer and waits for the rebuild to stop, so we can only
+ * ever try for the lock.
+ */
+static boolean_t
+l2arc_rebuild_config_enter(l2arc_dev_t *dev)
+{
+	while (!spa_config_tryenter(dev->l2ad_spa, SCL_L2ARC, dev,
+	    RW_READER)) {
+		if (dev->l2ad_rebuild_cancel)
+			return (B_FALSE);
+		delay(MSEC_TO_TICK(10));
+	}
+
+	return (B_TRUE);
+}
+
+static int
+l2arc_rebuild_read(l2arc_dev_t *dev, uint64_t daddr, uint64_t asize,
+    void *buf, uint64_t size)
+{
+	abd_t *abd;
+	int err;
+
+	if (!l2arc_rebuild_config_enter(dev))
+		return (SET_ERROR(ECANCELED));
+
+	abd = abd_alloc_for_io(asize, B_TRUE);
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev, daddr, asize, abd,
+	    ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
+	    ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY, B_FALSE));
+	spa_config_exit(dev->l2ad_spa, SCL_L2ARC, dev);
+
+	if (err == 0)
+		abd_copy_to_buf(buf, abd, size);
+	abd_free(abd);
+
+	return (err);
+}
+
+/*
+ * Read and validate the device header into dev->l2ad_dev_hdr.  On failure
+ * the in-core header is cleared and the device starts out empty.
+ */
+static int
+l2arc_dev_hdr_read(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dh = dev->l2ad_dev_hdr;
+	zio_cksum_t cksum;
+	int err;
+
+	err = l2arc_rebuild_read(dev, VDEV_LABEL_START_SIZE,
+	    dev->l2ad_dev_hdr_asize, l2dh, sizeof (*l2dh));
+	if (err != 0) {
+		if (err != ECANCELED)
+			ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		bzero(l2dh, sizeof (*l2dh));
+		return (err);
+	}
+
+	fletcher_4_native(l2dh, offsetof(l2arc_dev_hdr_phys_t, l2dh_cksum),
+	    NULL, &cksum);
+	if (l2dh->l2dh_magic != L2ARC_DEV_HDR_MAGIC ||
+	    l2dh->l2dh_version != L2ARC_PERSIST_VERSION ||
+	    !ZIO_CHECKSUM_EQUAL(cksum, l2dh->l2dh_cksum) ||
+	    l2dh->l2dh_spa_guid != spa_guid(dev->l2ad_spa) ||
+	    l2dh->l2dh_vdev_guid != dev->l2ad_vdev->vdev_guid ||
+	    l2dh->l2dh_start != dev->l2ad_start ||
+	    l2dh->l2dh_end != dev->l2ad_end ||
+	    l2dh->l2dh_hand < dev->l2ad_start ||
+	    l2dh->l2dh_hand >= dev->l2ad_end) {
+		bzero(l2dh, sizeof (*l2dh));
+		return (SET_ERROR(EINVAL));
+	}
+
+	return (0);
+}
+
+/*
+ * Recreate the L2-only header of one log entry, unless the block is already
+ * known to the ARC.
+ */
+static void
+l2arc_hdr_restore(l2arc_dev_t *dev, const l2arc_log_ent_phys_t *le)
+{
+	arc_buf_contents_t type = L2ARC_LE_GET_TYPE(le);
+	enum zio_compress compress = L2ARC_LE_GET_COMPRESS(le);
+	arc_buf_hdr_t *hdr, *exists;
+	kmutex_t *hash_lock;
+	uint64_t psize;
+
+	if ((type != ARC_BUFC_DATA && type != ARC_BUFC_METADATA) ||
+	    compress >= ZIO_COMPRESS_FUNCTIONS)
+		return;
+
+	/*
+	 * The device holds compressed data for this buffer, which we can't
+	 * use while the ARC keeps its buffers uncompressed.
+	 */
+	if (compress != ZIO_COMPRESS_OFF && !zfs_compressed_arc_enabled)
+		return;
+
+	hdr = kmem_cache_alloc(hdr_l2only_cache, KM_SLEEP);
+	ASSERT(HDR_EMPTY(hdr));
+	HDR_SET_LSIZE(hdr, L2ARC_LE_GET_LSIZE(le));
+	HDR_SET_PSIZE(hdr, L2ARC_LE_GET_PSIZE(le));
+	hdr->b_spa = spa_load_guid(dev->l2ad_spa);
+	hdr->b_type = type;
+	hdr->b_flags = 0;
+	arc_hdr_set_flags(hdr, arc_bufc_to_flags(type) | ARC_FLAG_HAS_L2HDR);
+	arc_hdr_set_compress(hdr, compress);
+	hdr->b_l2hdr.b_dev = dev;
+	hdr->b_l2hdr.b_daddr = le->le_daddr;
+	hdr->b_l2hdr.b_hits = 0;
+	hdr->b_dva = le->le_dva;
+	hdr->b_birth = le->le_birth;
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		/* cached again since import, or a stale duplicate entry */
+		mutex_exit(hash_lock);
+		buf_discard_identity(hdr);
+		kmem_cache_free(hdr_l2only_cache, hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+		return;
+	}
+
+	psize = arc_hdr_size(hdr);
+	mutex_enter(&dev->l2ad_mtx);
+	/* log blocks are walked newest first, l2arc_evict() starts at tail */
+	list_insert_tail(&dev->l2ad_buflist, hdr);
+	(void) refcount_add_many(&dev->l2ad_alloc, psize, hdr);
+	mutex_exit(&dev->l2ad_mtx);
+	mutex_exit(hash_lock);
+
+	ARCSTAT_INCR(arcstat_l2_lsize, HDR_GET_LSIZE(hdr));
+	ARCSTAT_INCR(arcstat_l2_psize, psize);
+	vdev_space_update(dev->l2ad_vdev, psize, 0, 0);
+	ARCSTAT_BUMP(arcstat_l2_rebuild_bufs);
+}
+
+/*
+ * Walk the log block chain of a cache device from the newest block to the
+ * oldest, restoring the headers of the buffers they describe.
+ *
+ * Log blocks are found at decreasing addresses until the chain jumps back
+ * to the end of the device into the previous sweep of the write hand.  In
+ * that sweep everything below the current hand has since been overwritten,
+ * so the walk ends at the first block found there, and entries pointing
+ * there are skipped.  Every block is verified against the checksum stored
+ * in the pointer to it, which ends the walk at the first block that was
+ * overwritten or never made it to disk.
+ */
+static void
+l2arc_rebuild(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dh = dev->l2ad_dev_hdr;
+	l2arc_log_blk_phys_t *lb;
+	l2arc_log_blkptr_t lbp;
+	zio_cksum_t cksum;
+	uint64_t prev_daddr, lb_count = 0;
+	boolean_t prev_sweep = B_FALSE;
+	int i;
+
+	if (l2arc_dev_hdr_read(dev) != 0)
+		return;
+
+	/*
+	 * Resume writing where we left off, so that the restored buffers are
+	 * evicted before they are overwritten.
+	 */
+	dev->l2ad_hand = l2dh->l2dh_hand;
+	dev->l2ad_first = !(l2dh->l2dh_flags & L2ARC_DEV_HDR_WRAPPED);
+
+	lb = kmem_alloc(sizeof (*lb), KM_SLEEP);
+	lbp = l2dh->l2dh_head;
+	prev_daddr = dev->l2ad_hand;
+
+	while (lbp.lbp_daddr != 0 && !dev->l2ad_rebuild_cancel) {
+		if (lbp.lbp_asize != dev->l2ad_log_blk_asize ||
+		    lbp.lbp_daddr < dev->l2ad_start ||
+		    lbp.lbp_daddr + lbp.lbp_asize > dev->l2ad_end)
+			break;
+
+		if (lbp.lbp_daddr >= prev_daddr) {
+			if (prev_sweep || dev->l2ad_first)
+				break;
+			prev_sweep = B_TRUE;
+		}
+		if (prev_sweep && lbp.lbp_daddr < dev->l2ad_hand)
+			break;
+
+		if (l2arc_rebuild_read(dev, lbp.lbp_daddr, lbp.lbp_asize,
+		    lb, sizeof (*lb)) != 0) {
+			if (!dev->l2ad_rebuild_cancel)
+				ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+			break;
+		}
+
+		fletcher_4_native(lb, sizeof (*lb), NULL, &cksum);
+		if (!ZIO_CHECKSUM_EQUAL(cksum, lbp.lbp_cksum) ||
+		    lb->lb_magic != L2ARC_LOG_BLK_MAGIC ||
+		    lb->lb_version != L2ARC_PERSIST_VERSION ||
+		    lb->lb_nentries > L2ARC_LOG_BLK_ENTRIES) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+			break;
+		}
+
+		for (i = 0; i < lb->lb_nentries; i++) {
+			const l2arc_log_ent_phys_t *le = &lb->lb_entries[i];
+
+			if (le->le_daddr < dev->l2ad_start ||
+			    le->le_daddr >= dev->l2ad_end ||
+			    (prev_sweep && le->le_daddr < dev->l2ad_hand))
+				continue;
+			l2arc_hdr_restore(dev, le);
+		}
+
+		lb_count++;
+		prev_daddr = lbp.lbp_daddr;
+		lbp = lb->lb_prev;
+	}
+
+	kmem_free(lb, sizeof (*lb));
+
+	ARCSTAT_INCR(arcstat_l2_rebuild_log_blks, lb_count);
+	if (lb_count > 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_success);
+}
+
+static void
+l2arc_dev_rebuild_thread(void *arg)
+{
+	l2arc_dev_t *dev = arg;
+	fstrans_cookie_t cookie;
+
+	cookie = spl_fstrans_mark();
+	l2arc_rebuild(dev);
+	spl_fstrans_unmark(cookie);
+
+	/* l2arc_remove_vdev() may free dev as soon as we drop l2ad_mtx */
+	mutex_enter(&dev->l2ad_mtx);
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&dev->l2ad_rebuild_cv);
+	mutex_exit(&dev->l2ad_mtx);
+
+	thread_exit();
+}
+
 /*
  * Add a vdev for use by the L2ARC.  By this point the spa has already
  * validated the vdev and opened it.
@@ -7746,14 +9038,26 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	/* the persistent L2ARC device header comes first */
+	adddev->l2ad_dev_hdr_asize = vdev_psize_to_asize(vd,
+	    sizeof (l2arc_dev_hdr_phys_t));
+	adddev->l2ad_log_blk_asize = vdev_psize_to_asize(vd,
+	    sizeof (l2arc_log_blk_phys_t));
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE +
+	    adddev->l2ad_dev_hdr_asize;
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
 	adddev->l2ad_hand = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
+	adddev->l2ad_dev_hdr = kmem_zalloc(sizeof (l2arc_dev_hdr_phys_t),
+	    KM_SLEEP);
+	adddev->l2ad_log_blk = kmem_zalloc(sizeof (l2arc_log_blk_phys_t),
+	    KM_SLEEP);
+	adddev->l2ad_rebuild = (l2arc_rebuild_enabled != 0);
 	list_link_init(&adddev->l2ad_node);
 
 	mutex_init(&adddev->l2ad_mtx, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&adddev->l2ad_rebuild_cv, NULL, CV_DEFAULT, NULL);
 	/*
 	 * This is a list of all ARC buffers that are still valid on the
 	 * device.
@@ -7771,6 +9075,16 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	/*
+	 * Restore what the device cached before the pool was exported or
+	 * the system restarted.  l2arc_dev_get_next() skips the device
+	 * until this is done.
+	 */
+	if (adddev->l2ad_rebuild) {
+		(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread,
+		    adddev, 0, &p0, TS_RUN, minclsyspri);
+	}
 }
 
 /*
@@ -7802,13 +9116,25 @@ l2arc_remove_vdev(vdev_t *vd)
 	atomic_dec_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
 
+	/*
+	 * Stop a rebuild that may still be running.
+	 */
+	mutex_enter(&remdev->l2ad_mtx);
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	while (remdev->l2ad_rebuild)
+		cv_wait(&remdev->l2ad_rebuild_cv, &remdev->l2ad_mtx);
+	mutex_exit(&remdev->l2ad_mtx);
+
 	/*
 	 * Clear all buflists and ARC references.  L2ARC device flush.
 	 */
 	l2arc_evict(remdev, 0, B_TRUE);
 	list_destroy(&remdev->l2ad_buflist);
 	mutex_destroy(&remdev->l2ad_mtx);
+	cv_destroy(&remdev->l2ad_rebuild_cv);
 	refcount_destroy(&remdev->l2ad_alloc);
+	kmem_free(remdev->l2ad_dev_hdr, sizeof (l2arc_dev_hdr_phys_t));
+	kmem_free(remdev->l2ad_log_blk, sizeof (l2arc_log_blk_phys_t));
 	kmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
@@ -7938,6 +9264,30 @@ MODULE_PARM_DESC(zfs_compressed_arc_enabled, "Disable compressed arc buffers");
 module_param(zfs_arc_min_prefetch_lifespan, int, 0644);
 MODULE_PARM_DESC(zfs_arc_min_prefetch_lifespan, "Min life of prefetch block");
 
+module_param(zfs_arc_evict_threads, int, 0444);
+MODULE_PARM_DESC(zfs_arc_evict_threads,
+	"Number of threads used for ARC eviction (0 = auto)");
+
+module_param(zfs_arc_evict_thread_bytes, ulong, 0644);
+MODULE_PARM_DESC(zfs_arc_evict_thread_bytes,
+	"Min bytes of eviction target per ARC eviction thread");
+
+module_param(zfs_arc_objset_default_weight, int, 0644);
+MODULE_PARM_DESC(zfs_arc_objset_default_weight,
+	"ARC weight of all objsets without a weight of their own");
+
+module_param(zfs_arc_trace_entries, int, 0444);
+MODULE_PARM_DESC(zfs_arc_trace_entries,
+	"Entries in the arc_trace ring of sampled reads (0 = disabled)");
+
+module_param(zfs_arc_trace_sample, int, 0644);
+MODULE_PARM_DESC(zfs_arc_trace_sample,
+	"Sample one in this many ARC reads into arc_trace");
+
+module_param(zfs_arc_uncached_prio_mask, int, 0644);
+MODULE_PARM_DESC(zfs_arc_uncached_prio_mask,
+	"Mask of zio priorities whose reads are not admitted to the ARC");
+
 module_param(l2arc_write_max, ulong, 0644);
 MODULE_PARM_DESC(l2arc_write_max, "Max write bytes per interval");
 
@@ -7965,6 +9315,10 @@ MODULE_PARM_DESC(l2arc_feed_again, "Turbo L2ARC warmup");
 module_param(l2arc_norw, int, 0644);
 MODULE_PARM_DESC(l2arc_norw, "No reads during writes");
 
+module_param(l2arc_rebuild_enabled, int, 0644);
+MODULE_PARM_DESC(l2arc_rebuild_enabled,
+	"Rebuild the L2ARC contents when a cache device is added");
+
 module_param(zfs_arc_lotsfree_percent, int, 0644);
 MODULE_PARM_DESC(zfs_arc_lotsfree_percent,
 	"System free memory I/O throttle in bytes");
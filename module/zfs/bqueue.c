@@ -19,12 +19,22 @@
 #include	<sys/bqueue.h>
 #include	<sys/zfs_context.h>
 
+/* Most elements a bqueue holds, whatever their size */
+#define	BQUEUE_MAX_SLOTS	4096
+
 static inline bqueue_node_t *
 obj2node(bqueue_t *q, void *data)
 {
 	return ((bqueue_node_t *)((char *)data + q->bq_node_offset));
 }
 
+static inline boolean_t
+bqueue_has_room(bqueue_t *q, uint64_t item_size)
+{
+	return (q->bq_size + item_size <= q->bq_maxsize &&
+	    q->bq_tail - q->bq_head < q->bq_nslots);
+}
+
 /*
  * Initialize a blocking queue  The maximum capacity of the queue is set to
  * size.  Types that want to be stored in a bqueue must contain a bqueue_node_t,
@@ -34,14 +44,19 @@ obj2node(bqueue_t *q, void *data)
 int
 bqueue_init(bqueue_t *q, uint64_t size, size_t node_offset)
 {
-	list_create(&q->bq_list, node_offset + sizeof (bqueue_node_t),
-	    node_offset + offsetof(bqueue_node_t, bqn_node));
+	uint64_t nslots = MIN(MAX(size, 2), BQUEUE_MAX_SLOTS);
+
+	q->bq_nslots = 1ULL << highbit64(nslots - 1);
+	q->bq_ring = kmem_zalloc(q->bq_nslots * sizeof (void *), KM_SLEEP);
 	cv_init(&q->bq_add_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&q->bq_pop_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&q->bq_lock, NULL, MUTEX_DEFAULT, NULL);
 	q->bq_node_offset = node_offset;
+	q->bq_head = q->bq_tail = 0;
 	q->bq_size = 0;
 	q->bq_maxsize = size;
+	q->bq_add_need = 0;
+	q->bq_pop_waiting = 0;
 	return (0);
 }
 
@@ -54,51 +69,83 @@ void
 bqueue_destroy(bqueue_t *q)
 {
 	ASSERT0(q->bq_size);
+	ASSERT3U(q->bq_head, ==, q->bq_tail);
 	cv_destroy(&q->bq_add_cv);
 	cv_destroy(&q->bq_pop_cv);
 	mutex_destroy(&q->bq_lock);
-	list_destroy(&q->bq_list);
+	kmem_free(q->bq_ring, q->bq_nslots * sizeof (void *));
 }
 
 /*
  * Add data to q, consuming size units of capacity.  If there is insufficient
  * capacity to consume size units, block until capacity exists.  Asserts size is
- * > 0.
+ * > 0.  Only the producer may call this.
+ *
+ * Each side publishes its progress with an atomic op, which is a full
+ * barrier, before it looks whether the other side is asleep, and sets its
+ * own flag with one before it looks at the other side's progress, so no
+ * wakeup is lost.  A sleeping consumer is woken by the first element put
+ * on the queue; a sleeping producer only once the queue has drained to
+ * half full, so that the two don't take turns element by element.
  */
 void
 bqueue_enqueue(bqueue_t *q, void *data, uint64_t item_size)
 {
 	ASSERT3U(item_size, >, 0);
 	ASSERT3U(item_size, <=, q->bq_maxsize);
-	mutex_enter(&q->bq_lock);
 	obj2node(q, data)->bqn_size = item_size;
-	while (q->bq_size + item_size > q->bq_maxsize) {
-		cv_wait(&q->bq_add_cv, &q->bq_lock);
+	if (!bqueue_has_room(q, item_size)) {
+		mutex_enter(&q->bq_lock);
+		(void) atomic_swap_64(&q->bq_add_need, item_size);
+		while (!bqueue_has_room(q, item_size))
+			cv_wait(&q->bq_add_cv, &q->bq_lock);
+		q->bq_add_need = 0;
+		mutex_exit(&q->bq_lock);
+	}
+
+	q->bq_ring[q->bq_tail & (q->bq_nslots - 1)] = data;
+	(void) atomic_add_64_nv(&q->bq_size, item_size);
+	(void) atomic_inc_64_nv(&q->bq_tail);
+	if (q->bq_pop_waiting) {
+		mutex_enter(&q->bq_lock);
+		cv_signal(&q->bq_pop_cv);
+		mutex_exit(&q->bq_lock);
 	}
-	q->bq_size += item_size;
-	list_insert_tail(&q->bq_list, data);
-	cv_signal(&q->bq_pop_cv);
-	mutex_exit(&q->bq_lock);
 }
+
 /*
  * Take the first element off of q.  If there are no elements on the queue, wait
- * until one is put there.  Return the removed element.
+ * until one is put there.  Return the removed element.  Only the consumer may
+ * call this.
  */
 void *
 bqueue_dequeue(bqueue_t *q)
 {
-	void *ret = NULL;
-	uint64_t item_size;
-	mutex_enter(&q->bq_lock);
-	while (q->bq_size == 0) {
-		cv_wait(&q->bq_pop_cv, &q->bq_lock);
+	void *ret;
+	uint64_t item_size, size, need;
+	if (q->bq_head == q->bq_tail) {
+		mutex_enter(&q->bq_lock);
+		(void) atomic_swap_32(&q->bq_pop_waiting, 1);
+		while (q->bq_head == q->bq_tail)
+			cv_wait(&q->bq_pop_cv, &q->bq_lock);
+		q->bq_pop_waiting = 0;
+		mutex_exit(&q->bq_lock);
 	}
-	ret = list_remove_head(&q->bq_list);
+	membar_consumer();
+
+	ret = q->bq_ring[q->bq_head & (q->bq_nslots - 1)];
 	ASSERT3P(ret, !=, NULL);
 	item_size = obj2node(q, ret)->bqn_size;
-	q->bq_size -= item_size;
-	cv_signal(&q->bq_add_cv);
-	mutex_exit(&q->bq_lock);
+	(void) atomic_inc_64_nv(&q->bq_head);
+	size = atomic_add_64_nv(&q->bq_size, -item_size);
+
+	need = q->bq_add_need;
+	if (need != 0 && q->bq_maxsize - size >= MAX(need, q->bq_maxsize / 2) &&
+	    q->bq_tail - q->bq_head <= q->bq_nslots / 2) {
+		mutex_enter(&q->bq_lock);
+		cv_signal(&q->bq_add_cv);
+		mutex_exit(&q->bq_lock);
+	}
 	return (ret);
 }
 
@@ -0,0 +1,890 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/btree.h>
+
+/*
+ * All leaves are the same size whatever the element size, so they come
+ * from one cache; core nodes are allocated to fit their separators.
+ *
+ * Every core node has at least one separator, except for a root node
+ * that is about to be collapsed, so every node below the root has a
+ * sibling to borrow from or merge with.  Nodes other than the root are
+ * kept at least half full, with one exception: when a full node at the
+ * end of its level is split because an element was added after all of
+ * the others, the old node is left full and the new one starts out with
+ * just the new element.  This keeps the leaves of a tree that is loaded
+ * in order, as a range tree is from a space map, almost completely full.
+ */
+
+static kmem_cache_t *zfs_btree_leaf_cache;
+
+#define	BT_HDR_SIZE	P2ROUNDUP(sizeof (zfs_btree_hdr_t), sizeof (uint64_t))
+#define	BT_CORE_HDR_SIZE	\
+	P2ROUNDUP(sizeof (zfs_btree_core_t), sizeof (uint64_t))
+#define	BT_CORE_SIZE(tree)	\
+	(BT_CORE_HDR_SIZE + BTREE_CORE_ELEMS * (tree)->bt_elem_size)
+#define	BT_CORE_MIN	(BTREE_CORE_ELEMS / 2)
+
+#define	BT_LEAF_ELEM(tree, hdr, i)	\
+	((uint8_t *)(hdr) + BT_HDR_SIZE + (size_t)(i) * (tree)->bt_elem_size)
+#define	BT_CORE_ELEM(tree, core, i)	\
+	((uint8_t *)(core) + BT_CORE_HDR_SIZE +	\
+	(size_t)(i) * (tree)->bt_elem_size)
+
+void
+zfs_btree_init(void)
+{
+	zfs_btree_leaf_cache = kmem_cache_create("zfs_btree_leaf_cache",
+	    BTREE_LEAF_SIZE, 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+zfs_btree_fini(void)
+{
+	kmem_cache_destroy(zfs_btree_leaf_cache);
+}
+
+void
+zfs_btree_create(zfs_btree_t *tree, int (*compar)(const void *, const void *),
+    size_t size)
+{
+	ASSERT3U(size, <=, (BTREE_LEAF_SIZE - BT_HDR_SIZE) / 4);
+
+	bzero(tree, sizeof (*tree));
+	tree->bt_compar = compar;
+	tree->bt_elem_size = size;
+	tree->bt_leaf_cap = (BTREE_LEAF_SIZE - BT_HDR_SIZE) / size;
+}
+
+void
+zfs_btree_destroy(zfs_btree_t *tree)
+{
+	ASSERT0(tree->bt_num_elems);
+	ASSERT3P(tree->bt_root, ==, NULL);
+	ASSERT0(tree->bt_num_nodes);
+}
+
+static zfs_btree_hdr_t *
+zfs_btree_leaf_alloc(zfs_btree_t *tree)
+{
+	zfs_btree_hdr_t *hdr = kmem_cache_alloc(zfs_btree_leaf_cache,
+	    KM_SLEEP);
+
+	hdr->bth_parent = NULL;
+	hdr->bth_core = B_FALSE;
+	hdr->bth_count = 0;
+	tree->bt_num_nodes++;
+	return (hdr);
+}
+
+static zfs_btree_core_t *
+zfs_btree_core_alloc(zfs_btree_t *tree)
+{
+	zfs_btree_core_t *core = kmem_alloc(BT_CORE_SIZE(tree), KM_SLEEP);
+
+	core->btc_hdr.bth_parent = NULL;
+	core->btc_hdr.bth_core = B_TRUE;
+	core->btc_hdr.bth_count = 0;
+	tree->bt_num_nodes++;
+	return (core);
+}
+
+static void
+zfs_btree_node_free(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	if (hdr->bth_core)
+		kmem_free(hdr, BT_CORE_SIZE(tree));
+	else
+		kmem_cache_free(zfs_btree_leaf_cache, hdr);
+	tree->bt_num_nodes--;
+}
+
+/*
+ * Return the index of the first of the n sorted elements that is not less
+ * than value, and whether that element compares equal to it.
+ */
+static uint32_t
+zfs_btree_bsearch(zfs_btree_t *tree, const uint8_t *elems, uint32_t n,
+    const void *value, boolean_t *found)
+{
+	uint32_t lo = 0, hi = n;
+
+	*found = B_FALSE;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = tree->bt_compar(elems +
+		    (size_t)mid * tree->bt_elem_size, value);
+
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			if (cmp == 0)
+				*found = B_TRUE;
+			hi = mid;
+		}
+	}
+	return (lo);
+}
+
+static uint32_t
+zfs_btree_child_idx(zfs_btree_core_t *parent, zfs_btree_hdr_t *child)
+{
+	uint32_t i;
+
+	for (i = 0; parent->btc_children[i] != child; i++)
+		ASSERT3U(i, <, parent->btc_hdr.bth_count);
+	return (i);
+}
+
+/*
+ * Whether the node is the last one on its level.
+ */
+static boolean_t
+zfs_btree_is_last(zfs_btree_hdr_t *hdr)
+{
+	zfs_btree_core_t *parent;
+
+	while ((parent = hdr->bth_parent) != NULL) {
+		uint32_t c = zfs_btree_child_idx(parent, hdr);
+
+		if (c != parent->btc_hdr.bth_count)
+			return (B_FALSE);
+		hdr = &parent->btc_hdr;
+	}
+	return (B_TRUE);
+}
+
+/*
+ * The first element of the leaf has changed; copy it to the separator
+ * in front of the leaf, if there is one.
+ */
+static void
+zfs_btree_fix_sep(zfs_btree_t *tree, zfs_btree_hdr_t *leaf)
+{
+	zfs_btree_hdr_t *hdr = leaf;
+	zfs_btree_core_t *parent;
+
+	ASSERT(!leaf->bth_core);
+	ASSERT3U(leaf->bth_count, >, 0);
+
+	while ((parent = hdr->bth_parent) != NULL) {
+		uint32_t c = zfs_btree_child_idx(parent, hdr);
+
+		if (c > 0) {
+			bcopy(BT_LEAF_ELEM(tree, leaf, 0),
+			    BT_CORE_ELEM(tree, parent, c - 1),
+			    tree->bt_elem_size);
+			return;
+		}
+		hdr = &parent->btc_hdr;
+	}
+}
+
+void *
+zfs_btree_find(zfs_btree_t *tree, const void *value, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+	boolean_t found;
+	uint32_t i;
+	int level;
+
+	if (hdr == NULL) {
+		if (where != NULL) {
+			where->bti_node = NULL;
+			where->bti_offset = 0;
+		}
+		return (NULL);
+	}
+
+	for (level = 0; level < tree->bt_height; level++) {
+		zfs_btree_core_t *core = (zfs_btree_core_t *)hdr;
+
+		ASSERT(hdr->bth_core);
+		i = zfs_btree_bsearch(tree, BT_CORE_ELEM(tree, core, 0),
+		    hdr->bth_count, value, &found);
+		hdr = core->btc_children[found ? i + 1 : i];
+	}
+
+	ASSERT(!hdr->bth_core);
+	i = zfs_btree_bsearch(tree, BT_LEAF_ELEM(tree, hdr, 0),
+	    hdr->bth_count, value, &found);
+	if (where != NULL) {
+		where->bti_node = hdr;
+		where->bti_offset = i;
+	}
+	return (found ? BT_LEAF_ELEM(tree, hdr, i) : NULL);
+}
+
+static void
+zfs_btree_leaf_insert(zfs_btree_t *tree, zfs_btree_hdr_t *leaf,
+    uint32_t off, const void *value)
+{
+	size_t size = tree->bt_elem_size;
+	uint8_t *p = BT_LEAF_ELEM(tree, leaf, off);
+
+	ASSERT3U(leaf->bth_count, <, tree->bt_leaf_cap);
+	memmove(p + size, p, (leaf->bth_count - off) * size);
+	bcopy(value, p, size);
+	leaf->bth_count++;
+}
+
+/*
+ * Insert a separator at position i, and the child it leads to after it.
+ */
+static void
+zfs_btree_core_insert(zfs_btree_t *tree, zfs_btree_core_t *core, uint32_t i,
+    const void *sep, zfs_btree_hdr_t *child)
+{
+	size_t size = tree->bt_elem_size;
+	uint32_t count = core->btc_hdr.bth_count;
+	uint8_t *p = BT_CORE_ELEM(tree, core, i);
+
+	ASSERT3U(count, <, BTREE_CORE_ELEMS);
+	memmove(p + size, p, (count - i) * size);
+	bcopy(sep, p, size);
+	memmove(&core->btc_children[i + 2], &core->btc_children[i + 1],
+	    (count - i) * sizeof (zfs_btree_hdr_t *));
+	core->btc_children[i + 1] = child;
+	child->bth_parent = core;
+	core->btc_hdr.bth_count++;
+}
+
+/*
+ * Remove separator i and the child after it.
+ */
+static void
+zfs_btree_core_remove(zfs_btree_t *tree, zfs_btree_core_t *core, uint32_t i)
+{
+	size_t size = tree->bt_elem_size;
+	uint32_t count = core->btc_hdr.bth_count;
+
+	ASSERT3U(i, <, count);
+	memmove(BT_CORE_ELEM(tree, core, i), BT_CORE_ELEM(tree, core, i + 1),
+	    (count - i - 1) * size);
+	memmove(&core->btc_children[i + 1], &core->btc_children[i + 2],
+	    (count - i - 1) * sizeof (zfs_btree_hdr_t *));
+	core->btc_hdr.bth_count--;
+}
+
+/*
+ * Right has been split off from left; link it in after left, with sep,
+ * the first element below it, as its separator.
+ */
+static void
+zfs_btree_insert_into_parent(zfs_btree_t *tree, zfs_btree_hdr_t *left,
+    zfs_btree_hdr_t *right, const void *sep)
+{
+	zfs_btree_core_t *parent = left->bth_parent;
+	zfs_btree_core_t *new_core;
+	size_t size = tree->bt_elem_size;
+	uint32_t c, count, move, i;
+
+	if (parent == NULL) {
+		ASSERT3P(left, ==, tree->bt_root);
+		parent = zfs_btree_core_alloc(tree);
+		parent->btc_children[0] = left;
+		left->bth_parent = parent;
+		zfs_btree_core_insert(tree, parent, 0, sep, right);
+		tree->bt_root = &parent->btc_hdr;
+		tree->bt_height++;
+		return;
+	}
+
+	c = zfs_btree_child_idx(parent, left);
+	count = parent->btc_hdr.bth_count;
+	if (count < BTREE_CORE_ELEMS) {
+		zfs_btree_core_insert(tree, parent, c, sep, right);
+		return;
+	}
+
+	/*
+	 * The parent is full and has to be split as well.  The separator
+	 * between the two halves moves up, so has to be linked in before
+	 * the halves are changed again.
+	 */
+	new_core = zfs_btree_core_alloc(tree);
+	if (c == count && zfs_btree_is_last(&parent->btc_hdr)) {
+		new_core->btc_children[0] = parent->btc_children[count];
+		new_core->btc_children[0]->bth_parent = new_core;
+		parent->btc_hdr.bth_count--;
+		zfs_btree_insert_into_parent(tree, &parent->btc_hdr,
+		    &new_core->btc_hdr, BT_CORE_ELEM(tree, parent, count - 1));
+		zfs_btree_core_insert(tree, new_core, 0, sep, right);
+		return;
+	}
+
+	move = count - BT_CORE_MIN - 1;
+	bcopy(BT_CORE_ELEM(tree, parent, BT_CORE_MIN + 1),
+	    BT_CORE_ELEM(tree, new_core, 0), move * size);
+	bcopy(&parent->btc_children[BT_CORE_MIN + 1], new_core->btc_children,
+	    (move + 1) * sizeof (zfs_btree_hdr_t *));
+	for (i = 0; i <= move; i++)
+		new_core->btc_children[i]->bth_parent = new_core;
+	new_core->btc_hdr.bth_count = move;
+	parent->btc_hdr.bth_count = BT_CORE_MIN;
+
+	zfs_btree_insert_into_parent(tree, &parent->btc_hdr,
+	    &new_core->btc_hdr, BT_CORE_ELEM(tree, parent, BT_CORE_MIN));
+
+	if (c <= BT_CORE_MIN) {
+		zfs_btree_core_insert(tree, parent, c, sep, right);
+	} else {
+		zfs_btree_core_insert(tree, new_core, c - BT_CORE_MIN - 1,
+		    sep, right);
+	}
+}
+
+/*
+ * Insert value at the position returned by a failed zfs_btree_find().
+ */
+void
+zfs_btree_add_idx(zfs_btree_t *tree, const void *value,
+    const zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *leaf = where->bti_node, *right;
+	uint32_t off = where->bti_offset;
+	uint32_t cap = tree->bt_leaf_cap;
+	size_t size = tree->bt_elem_size;
+	uint32_t keep;
+
+	tree->bt_num_elems++;
+
+	if (leaf == NULL) {
+		ASSERT3P(tree->bt_root, ==, NULL);
+		leaf = zfs_btree_leaf_alloc(tree);
+		tree->bt_root = leaf;
+		tree->bt_height = 0;
+		zfs_btree_leaf_insert(tree, leaf, 0, value);
+		return;
+	}
+
+	ASSERT(!leaf->bth_core);
+	ASSERT3U(off, <=, leaf->bth_count);
+
+	if (leaf->bth_count < cap) {
+		zfs_btree_leaf_insert(tree, leaf, off, value);
+		if (off == 0)
+			zfs_btree_fix_sep(tree, leaf);
+		return;
+	}
+
+	right = zfs_btree_leaf_alloc(tree);
+	keep = (cap + 1) / 2;
+	if (off == cap && zfs_btree_is_last(leaf)) {
+		zfs_btree_leaf_insert(tree, right, 0, value);
+	} else if (off < keep) {
+		bcopy(BT_LEAF_ELEM(tree, leaf, keep - 1),
+		    BT_LEAF_ELEM(tree, right, 0), (cap - keep + 1) * size);
+		right->bth_count = cap - keep + 1;
+		leaf->bth_count = keep - 1;
+		zfs_btree_leaf_insert(tree, leaf, off, value);
+		if (off == 0)
+			zfs_btree_fix_sep(tree, leaf);
+	} else {
+		uint32_t before = off - keep;
+
+		bcopy(BT_LEAF_ELEM(tree, leaf, keep),
+		    BT_LEAF_ELEM(tree, right, 0), before * size);
+		bcopy(value, BT_LEAF_ELEM(tree, right, before), size);
+		bcopy(BT_LEAF_ELEM(tree, leaf, off),
+		    BT_LEAF_ELEM(tree, right, before + 1), (cap - off) * size);
+		right->bth_count = cap - keep + 1;
+		leaf->bth_count = keep;
+	}
+	zfs_btree_insert_into_parent(tree, leaf, right,
+	    BT_LEAF_ELEM(tree, right, 0));
+}
+
+void
+zfs_btree_add(zfs_btree_t *tree, const void *value)
+{
+	zfs_btree_index_t where;
+
+	VERIFY3P(zfs_btree_find(tree, value, &where), ==, NULL);
+	zfs_btree_add_idx(tree, value, &where);
+}
+
+/*
+ * Append the separator and the children of right to left.
+ */
+static void
+zfs_btree_core_merge(zfs_btree_t *tree, zfs_btree_core_t *left,
+    zfs_btree_core_t *right, const void *sep)
+{
+	size_t size = tree->bt_elem_size;
+	uint32_t lc = left->btc_hdr.bth_count;
+	uint32_t rc = right->btc_hdr.bth_count;
+	uint32_t i;
+
+	ASSERT3U(lc + rc + 1, <=, BTREE_CORE_ELEMS);
+	bcopy(sep, BT_CORE_ELEM(tree, left, lc), size);
+	bcopy(BT_CORE_ELEM(tree, right, 0), BT_CORE_ELEM(tree, left, lc + 1),
+	    rc * size);
+	bcopy(right->btc_children, &left->btc_children[lc + 1],
+	    (rc + 1) * sizeof (zfs_btree_hdr_t *));
+	for (i = lc + 1; i <= lc + rc + 1; i++)
+		left->btc_children[i]->bth_parent = left;
+	left->btc_hdr.bth_count = lc + rc + 1;
+}
+
+static void
+zfs_btree_rebalance_core(zfs_btree_t *tree, zfs_btree_core_t *core)
+{
+	zfs_btree_hdr_t *hdr = &core->btc_hdr;
+	zfs_btree_core_t *parent = hdr->bth_parent, *sib, *left, *right;
+	size_t size = tree->bt_elem_size;
+	uint32_t c, count, sc;
+
+	if (parent == NULL) {
+		if (hdr->bth_count == 0) {
+			tree->bt_root = core->btc_children[0];
+			tree->bt_root->bth_parent = NULL;
+			tree->bt_height--;
+			zfs_btree_node_free(tree, hdr);
+		}
+		return;
+	}
+	if (hdr->bth_count >= BT_CORE_MIN)
+		return;
+
+	c = zfs_btree_child_idx(parent, hdr);
+	count = hdr->bth_count;
+
+	if (c > 0) {
+		sib = (zfs_btree_core_t *)parent->btc_children[c - 1];
+		sc = sib->btc_hdr.bth_count;
+		if (sc > BT_CORE_MIN) {
+			/* Rotate the last child of the left sibling over */
+			memmove(BT_CORE_ELEM(tree, core, 1),
+			    BT_CORE_ELEM(tree, core, 0), count * size);
+			memmove(&core->btc_children[1], &core->btc_children[0],
+			    (count + 1) * sizeof (zfs_btree_hdr_t *));
+			bcopy(BT_CORE_ELEM(tree, parent, c - 1),
+			    BT_CORE_ELEM(tree, core, 0), size);
+			core->btc_children[0] = sib->btc_children[sc];
+			core->btc_children[0]->bth_parent = core;
+			bcopy(BT_CORE_ELEM(tree, sib, sc - 1),
+			    BT_CORE_ELEM(tree, parent, c - 1), size);
+			sib->btc_hdr.bth_count--;
+			hdr->bth_count++;
+			return;
+		}
+	}
+
+	if (c < parent->btc_hdr.bth_count) {
+		sib = (zfs_btree_core_t *)parent->btc_children[c + 1];
+		sc = sib->btc_hdr.bth_count;
+		if (sc > BT_CORE_MIN) {
+			/* Rotate the first child of the right sibling over */
+			bcopy(BT_CORE_ELEM(tree, parent, c),
+			    BT_CORE_ELEM(tree, core, count), size);
+			core->btc_children[count + 1] = sib->btc_children[0];
+			core->btc_children[count + 1]->bth_parent = core;
+			hdr->bth_count++;
+			bcopy(BT_CORE_ELEM(tree, sib, 0),
+			    BT_CORE_ELEM(tree, parent, c), size);
+			memmove(BT_CORE_ELEM(tree, sib, 0),
+			    BT_CORE_ELEM(tree, sib, 1), (sc - 1) * size);
+			memmove(&sib->btc_children[0], &sib->btc_children[1],
+			    sc * sizeof (zfs_btree_hdr_t *));
+			sib->btc_hdr.bth_count--;
+			return;
+		}
+	}
+
+	if (c > 0) {
+		left = (zfs_btree_core_t *)parent->btc_children[c - 1];
+		right = core;
+		c--;
+	} else {
+		left = core;
+		right = (zfs_btree_core_t *)parent->btc_children[1];
+	}
+	zfs_btree_core_merge(tree, left, right, BT_CORE_ELEM(tree, parent, c));
+	zfs_btree_core_remove(tree, parent, c);
+	zfs_btree_node_free(tree, &right->btc_hdr);
+	zfs_btree_rebalance_core(tree, parent);
+}
+
+static void
+zfs_btree_rebalance_leaf(zfs_btree_t *tree, zfs_btree_hdr_t *leaf)
+{
+	zfs_btree_core_t *parent = leaf->bth_parent;
+	uint32_t c = zfs_btree_child_idx(parent, leaf);
+	uint32_t min = tree->bt_leaf_cap / 2;
+	size_t size = tree->bt_elem_size;
+	zfs_btree_hdr_t *sib;
+
+	if (c > 0) {
+		sib = parent->btc_children[c - 1];
+		if (sib->bth_count > min) {
+			/* Take the last element of the left sibling */
+			zfs_btree_leaf_insert(tree, leaf, 0,
+			    BT_LEAF_ELEM(tree, sib, sib->bth_count - 1));
+			sib->bth_count--;
+			bcopy(BT_LEAF_ELEM(tree, leaf, 0),
+			    BT_CORE_ELEM(tree, parent, c - 1), size);
+			return;
+		}
+	}
+
+	if (c < parent->btc_hdr.bth_count) {
+		sib = parent->btc_children[c + 1];
+		if (sib->bth_count > min) {
+			/* Take the first element of the right sibling */
+			bcopy(BT_LEAF_ELEM(tree, sib, 0),
+			    BT_LEAF_ELEM(tree, leaf, leaf->bth_count), size);
+			leaf->bth_count++;
+			memmove(BT_LEAF_ELEM(tree, sib, 0),
+			    BT_LEAF_ELEM(tree, sib, 1),
+			    (sib->bth_count - 1) * size);
+			sib->bth_count--;
+			bcopy(BT_LEAF_ELEM(tree, sib, 0),
+			    BT_CORE_ELEM(tree, parent, c), size);
+			if (leaf->bth_count == 1)
+				zfs_btree_fix_sep(tree, leaf);
+			return;
+		}
+	}
+
+	if (c > 0) {
+		sib = parent->btc_children[c - 1];
+		bcopy(BT_LEAF_ELEM(tree, leaf, 0),
+		    BT_LEAF_ELEM(tree, sib, sib->bth_count),
+		    leaf->bth_count * size);
+		sib->bth_count += leaf->bth_count;
+		zfs_btree_core_remove(tree, parent, c - 1);
+		zfs_btree_node_free(tree, leaf);
+	} else {
+		boolean_t was_empty = (leaf->bth_count == 0);
+
+		sib = parent->btc_children[1];
+		bcopy(BT_LEAF_ELEM(tree, sib, 0),
+		    BT_LEAF_ELEM(tree, leaf, leaf->bth_count),
+		    sib->bth_count * size);
+		leaf->bth_count += sib->bth_count;
+		zfs_btree_core_remove(tree, parent, 0);
+		zfs_btree_node_free(tree, sib);
+		if (was_empty)
+			zfs_btree_fix_sep(tree, leaf);
+	}
+	zfs_btree_rebalance_core(tree, parent);
+}
+
+void
+zfs_btree_remove_idx(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *leaf = where->bti_node;
+	uint32_t off = where->bti_offset;
+	size_t size = tree->bt_elem_size;
+	uint8_t *p = BT_LEAF_ELEM(tree, leaf, off);
+
+	ASSERT(!leaf->bth_core);
+	ASSERT3U(off, <, leaf->bth_count);
+
+	memmove(p, p + size, (leaf->bth_count - off - 1) * size);
+	leaf->bth_count--;
+	tree->bt_num_elems--;
+
+	if (leaf->bth_parent == NULL) {
+		ASSERT3P(leaf, ==, tree->bt_root);
+		if (leaf->bth_count == 0) {
+			zfs_btree_node_free(tree, leaf);
+			tree->bt_root = NULL;
+			tree->bt_height = 0;
+		}
+		return;
+	}
+
+	if (off == 0 && leaf->bth_count > 0)
+		zfs_btree_fix_sep(tree, leaf);
+	if (leaf->bth_count < tree->bt_leaf_cap / 2)
+		zfs_btree_rebalance_leaf(tree, leaf);
+}
+
+void
+zfs_btree_remove(zfs_btree_t *tree, const void *value)
+{
+	zfs_btree_index_t where;
+
+	VERIFY3P(zfs_btree_find(tree, value, &where), !=, NULL);
+	zfs_btree_remove_idx(tree, &where);
+}
+
+void
+zfs_btree_update(zfs_btree_t *tree, const zfs_btree_index_t *where)
+{
+	if (where->bti_offset == 0)
+		zfs_btree_fix_sep(tree, where->bti_node);
+}
+
+void *
+zfs_btree_get(zfs_btree_t *tree, const zfs_btree_index_t *idx)
+{
+	ASSERT3U(idx->bti_offset, <, idx->bti_node->bth_count);
+	return (BT_LEAF_ELEM(tree, idx->bti_node, idx->bti_offset));
+}
+
+void *
+zfs_btree_first(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+
+	if (hdr == NULL)
+		return (NULL);
+	while (hdr->bth_core)
+		hdr = ((zfs_btree_core_t *)hdr)->btc_children[0];
+	if (where != NULL) {
+		where->bti_node = hdr;
+		where->bti_offset = 0;
+	}
+	return (BT_LEAF_ELEM(tree, hdr, 0));
+}
+
+void *
+zfs_btree_last(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+
+	if (hdr == NULL)
+		return (NULL);
+	while (hdr->bth_core)
+		hdr = ((zfs_btree_core_t *)hdr)->btc_children[hdr->bth_count];
+	if (where != NULL) {
+		where->bti_node = hdr;
+		where->bti_offset = hdr->bth_count - 1;
+	}
+	return (BT_LEAF_ELEM(tree, hdr, hdr->bth_count - 1));
+}
+
+/*
+ * The first element of the leaf after this one, or NULL.
+ */
+static void *
+zfs_btree_next_leaf(zfs_btree_t *tree, zfs_btree_hdr_t *hdr,
+    zfs_btree_index_t *out)
+{
+	zfs_btree_core_t *parent;
+
+	while ((parent = hdr->bth_parent) != NULL) {
+		uint32_t c = zfs_btree_child_idx(parent, hdr);
+
+		if (c < parent->btc_hdr.bth_count) {
+			hdr = parent->btc_children[c + 1];
+			while (hdr->bth_core) {
+				hdr = ((zfs_btree_core_t *)hdr)->
+				    btc_children[0];
+			}
+			out->bti_node = hdr;
+			out->bti_offset = 0;
+			return (BT_LEAF_ELEM(tree, hdr, 0));
+		}
+		hdr = &parent->btc_hdr;
+	}
+	return (NULL);
+}
+
+/*
+ * The last element of the leaf before this one, or NULL.
+ */
+static void *
+zfs_btree_prev_leaf(zfs_btree_t *tree, zfs_btree_hdr_t *hdr,
+    zfs_btree_index_t *out)
+{
+	zfs_btree_core_t *parent;
+
+	while ((parent = hdr->bth_parent) != NULL) {
+		uint32_t c = zfs_btree_child_idx(parent, hdr);
+
+		if (c > 0) {
+			hdr = parent->btc_children[c - 1];
+			while (hdr->bth_core) {
+				hdr = ((zfs_btree_core_t *)hdr)->
+				    btc_children[hdr->bth_count];
+			}
+			out->bti_node = hdr;
+			out->bti_offset = hdr->bth_count - 1;
+			return (BT_LEAF_ELEM(tree, hdr, hdr->bth_count - 1));
+		}
+		hdr = &parent->btc_hdr;
+	}
+	return (NULL);
+}
+
+/*
+ * The index arguments may point to the same index.
+ */
+void *
+zfs_btree_next(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t off = idx->bti_offset + 1;
+
+	if (off < hdr->bth_count) {
+		out->bti_node = hdr;
+		out->bti_offset = off;
+		return (BT_LEAF_ELEM(tree, hdr, off));
+	}
+	return (zfs_btree_next_leaf(tree, hdr, out));
+}
+
+void *
+zfs_btree_prev(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t off = idx->bti_offset;
+
+	if (off > 0) {
+		out->bti_node = hdr;
+		out->bti_offset = off - 1;
+		return (BT_LEAF_ELEM(tree, hdr, off - 1));
+	}
+	return (zfs_btree_prev_leaf(tree, hdr, out));
+}
+
+void *
+zfs_btree_nearest_after(zfs_btree_t *tree, const zfs_btree_index_t *where,
+    zfs_btree_index_t *out)
+{
+	zfs_btree_hdr_t *hdr = where->bti_node;
+	uint32_t off = where->bti_offset;
+
+	if (hdr == NULL)
+		return (NULL);
+	if (off < hdr->bth_count) {
+		out->bti_node = hdr;
+		out->bti_offset = off;
+		return (BT_LEAF_ELEM(tree, hdr, off));
+	}
+	return (zfs_btree_next_leaf(tree, hdr, out));
+}
+
+void *
+zfs_btree_nearest_before(zfs_btree_t *tree, const zfs_btree_index_t *where,
+    zfs_btree_index_t *out)
+{
+	if (where->bti_node == NULL)
+		return (NULL);
+	return (zfs_btree_prev(tree, where, out));
+}
+
+ulong_t
+zfs_btree_numnodes(zfs_btree_t *tree)
+{
+	return (tree->bt_num_elems);
+}
+
+static void
+zfs_btree_clear_node(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	uint32_t i;
+
+	if (hdr->bth_core) {
+		zfs_btree_core_t *core = (zfs_btree_core_t *)hdr;
+
+		for (i = 0; i <= hdr->bth_count; i++)
+			zfs_btree_clear_node(tree, core->btc_children[i]);
+	}
+	zfs_btree_node_free(tree, hdr);
+}
+
+/*
+ * Remove all of the elements at once.
+ */
+void
+zfs_btree_clear(zfs_btree_t *tree)
+{
+	if (tree->bt_root != NULL)
+		zfs_btree_clear_node(tree, tree->bt_root);
+	tree->bt_root = NULL;
+	tree->bt_height = 0;
+	tree->bt_num_elems = 0;
+	ASSERT0(tree->bt_num_nodes);
+}
+
+/*
+ * Check the structure of the subtree and return the number of elements
+ * in it.  The first element below the node must equal sep, if given.
+ */
+static uint64_t
+zfs_btree_verify_node(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, int level,
+    const void *sep, uint64_t *nodes)
+{
+	zfs_btree_core_t *core = (zfs_btree_core_t *)hdr;
+	uint64_t elems = 0;
+	uint32_t i;
+
+	(*nodes)++;
+	if (level == tree->bt_height) {
+		VERIFY(!hdr->bth_core);
+		VERIFY3U(hdr->bth_count, >, 0);
+		VERIFY3U(hdr->bth_count, <=, tree->bt_leaf_cap);
+		if (sep != NULL) {
+			VERIFY0(bcmp(sep, BT_LEAF_ELEM(tree, hdr, 0),
+			    tree->bt_elem_size));
+		}
+		for (i = 1; i < hdr->bth_count; i++) {
+			VERIFY3S(tree->bt_compar(BT_LEAF_ELEM(tree, hdr, i - 1),
+			    BT_LEAF_ELEM(tree, hdr, i)), <, 0);
+		}
+		return (hdr->bth_count);
+	}
+
+	VERIFY(hdr->bth_core);
+	VERIFY3U(hdr->bth_count, >, 0);
+	VERIFY3U(hdr->bth_count, <=, BTREE_CORE_ELEMS);
+	for (i = 0; i <= hdr->bth_count; i++) {
+		VERIFY3P(core->btc_children[i]->bth_parent, ==, core);
+		elems += zfs_btree_verify_node(tree, core->btc_children[i],
+		    level + 1, i == 0 ? sep : BT_CORE_ELEM(tree, core, i - 1),
+		    nodes);
+	}
+	return (elems);
+}
+
+void
+zfs_btree_verify(zfs_btree_t *tree)
+{
+	zfs_btree_index_t where;
+	uint64_t nodes = 0;
+	void *prev, *elem;
+
+	if (tree->bt_root == NULL) {
+		VERIFY0(tree->bt_num_elems);
+		VERIFY0(tree->bt_num_nodes);
+		return;
+	}
+
+	VERIFY3P(tree->bt_root->bth_parent, ==, NULL);
+	VERIFY3U(zfs_btree_verify_node(tree, tree->bt_root, 0, NULL, &nodes),
+	    ==, tree->bt_num_elems);
+	VERIFY3U(nodes, ==, tree->bt_num_nodes);
+
+	prev = zfs_btree_first(tree, &where);
+	while ((elem = zfs_btree_next(tree, &where, &where)) != NULL) {
+		VERIFY3S(tree->bt_compar(prev, elem), <, 0);
+		prev = elem;
+	}
+}
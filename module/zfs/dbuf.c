@@ -102,6 +102,16 @@ static boolean_t dbuf_evict_thread_exit;
  * be removed from the cache and later re-added to the head of the cache.
  * Dbufs that are aged out of the cache will be immediately destroyed and
  * become eligible for arc eviction.
+ *
+ * With compressed ARC the dbuf cache is also the only place a decompressed
+ * copy of a compressed block survives without a hold, since the ARC itself
+ * only keeps the compressed data once the arc buf is destroyed.  To keep
+ * frequently used blocks from being decompressed on every access, a dbuf
+ * about to be aged out which has been hit in the cache since it was last
+ * spared, and whose data would have to be decompressed again, is moved back
+ * to the head of the cache instead, with its hit count halved.  At most
+ * dbuf_cache_hot_retain dbufs are spared per eviction, which bounds the hot
+ * tier and the cost of finding an eviction candidate.
  */
 static multilist_t *dbuf_cache;
 static refcount_t dbuf_cache_size;
@@ -110,6 +120,9 @@ unsigned long  dbuf_cache_max_bytes = 100 * 1024 * 1024;
 /* Cap the size of the dbuf cache to log2 fraction of arc size. */
 int dbuf_cache_max_shift = 5;
 
+/* Max number of hot decompressed dbufs spared by one eviction. */
+int dbuf_cache_hot_retain = 8;
+
 /*
  * The dbuf cache uses a three-stage eviction policy:
  *	- A low water marker designates when the dbuf eviction thread
@@ -187,7 +200,34 @@ dbuf_dest(void *vdb, void *unused)
  */
 static dbuf_hash_table_t dbuf_hash_table;
 
-static uint64_t dbuf_hash_count;
+/*
+ * The hash table is grown once it holds more than this many dbufs per
+ * chain on average; 0 keeps it at its initial size.
+ */
+int dbuf_hash_load_factor = 2;
+
+/*
+ * Issue the writes of the dirty children of an indirect block in blkid
+ * order, see dbuf_sort_children().
+ */
+int dbuf_sort_dirty_children = 1;
+
+/*
+ * Split the sync of an object's level-1 indirect blocks across
+ * dp_sync_indirect_taskq once at least twice this many of them are dirty
+ * under one parent, giving each thread at least this many; 0 disables it.
+ */
+int dbuf_sync_parallel_min = 16;
+
+/*
+ * Writes of part of a data block of at least this size, in whole
+ * sectors, are staged without reading the block when it isn't cached;
+ * the rest of it is read in when the dirty record is synced, or earlier
+ * if the dbuf is read.  0 disables it.
+ */
+int dbuf_partial_min_blksz = 64 * 1024;
+
+static taskq_t *dbuf_hash_taskq;
 
 static uint64_t
 dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
@@ -223,20 +263,34 @@ dbuf_find(objset_t *os, uint64_t obj, uint8_t level, uint64_t blkid)
 	dmu_buf_impl_t *db;
 
 	hv = dbuf_hash(os, obj, level, blkid);
-	idx = hv & h->hash_table_mask;
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
+	mutex_enter(DBUF_HASH_MUTEX(h, hv));
+	idx = hv & h->hash_table_mask;
 	for (db = h->hash_table[idx]; db != NULL; db = db->db_hash_next) {
 		if (DBUF_EQUAL(db, os, obj, level, blkid)) {
 			mutex_enter(&db->db_mtx);
 			if (db->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				mutex_exit(DBUF_HASH_MUTEX(h, hv));
 				return (db);
 			}
 			mutex_exit(&db->db_mtx);
 		}
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	if (h->hash_old_table != NULL) {
+		idx = hv & h->hash_old_mask;
+		for (db = h->hash_old_table[idx]; db != NULL;
+		    db = db->db_hash_next) {
+			if (DBUF_EQUAL(db, os, obj, level, blkid)) {
+				mutex_enter(&db->db_mtx);
+				if (db->db_state != DB_EVICTING) {
+					mutex_exit(DBUF_HASH_MUTEX(h, hv));
+					return (db);
+				}
+				mutex_exit(&db->db_mtx);
+			}
+		}
+	}
+	mutex_exit(DBUF_HASH_MUTEX(h, hv));
 	return (NULL);
 }
 
@@ -258,6 +312,99 @@ dbuf_find_bonus(objset_t *os, uint64_t object)
 	return (db);
 }
 
+static void
+dbuf_hash_enter_all(dbuf_hash_table_t *h)
+{
+	uint64_t i;
+
+	for (i = 0; i <= h->hash_mutex_mask; i++)
+		mutex_enter(&h->hash_mutexes[i]);
+}
+
+static void
+dbuf_hash_exit_all(dbuf_hash_table_t *h)
+{
+	uint64_t i;
+
+	for (i = 0; i <= h->hash_mutex_mask; i++)
+		mutex_exit(&h->hash_mutexes[i]);
+}
+
+static dmu_buf_impl_t **
+dbuf_hash_table_alloc(uint64_t hsize, int kmflag)
+{
+#if defined(_KERNEL) && defined(HAVE_SPL)
+	/*
+	 * Large allocations which do not require contiguous pages
+	 * should be using vmem_alloc() in the linux kernel
+	 */
+	return (vmem_zalloc(hsize * sizeof (void *), kmflag));
+#else
+	return (kmem_zalloc(hsize * sizeof (void *), kmflag));
+#endif
+}
+
+static void
+dbuf_hash_table_free(dmu_buf_impl_t **table, uint64_t hsize)
+{
+#if defined(_KERNEL) && defined(HAVE_SPL)
+	vmem_free(table, hsize * sizeof (void *));
+#else
+	kmem_free(table, hsize * sizeof (void *));
+#endif
+}
+
+/*
+ * Double the size of the hash table, then move the dbufs over one old
+ * chain at a time so lookups are never held up for more than a chain.
+ * Runs from dbuf_hash_taskq, dispatched by dbuf_hash_insert().
+ */
+static void
+dbuf_hash_grow(void *arg)
+{
+	dbuf_hash_table_t *h = arg;
+	uint64_t osize = h->hash_table_mask + 1;
+	dmu_buf_impl_t **table, *db;
+	uint64_t i;
+
+	table = dbuf_hash_table_alloc(osize << 1, KM_NOSLEEP);
+	if (table == NULL) {
+		atomic_swap_32(&h->hash_growing, 0);
+		return;
+	}
+
+	dbuf_hash_enter_all(h);
+	h->hash_old_table = h->hash_table;
+	h->hash_old_mask = h->hash_table_mask;
+	h->hash_table = table;
+	h->hash_table_mask = (osize << 1) - 1;
+	dbuf_hash_exit_all(h);
+
+	for (i = 0; i < osize; i++) {
+		mutex_enter(DBUF_HASH_MUTEX(h, i));
+		while ((db = h->hash_old_table[i]) != NULL) {
+			uint64_t idx = dbuf_hash(db->db_objset,
+			    db->db.db_object, db->db_level, db->db_blkid) &
+			    h->hash_table_mask;
+
+			h->hash_old_table[i] = db->db_hash_next;
+			db->db_hash_next = h->hash_table[idx];
+			h->hash_table[idx] = db;
+		}
+		mutex_exit(DBUF_HASH_MUTEX(h, i));
+	}
+
+	dbuf_hash_enter_all(h);
+	table = h->hash_old_table;
+	h->hash_old_table = NULL;
+	h->hash_old_mask = 0;
+	dbuf_hash_exit_all(h);
+
+	dbuf_hash_table_free(table, osize);
+	DBUF_CACHE_STAT_BUMP(hash_resizes);
+	atomic_swap_32(&h->hash_growing, 0);
+}
+
 /*
  * Insert an entry into the hash table.  If there is already an element
  * equal to elem in the hash table, then the already existing element
@@ -271,19 +418,34 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	objset_t *os = db->db_objset;
 	uint64_t obj = db->db.db_object;
 	int level = db->db_level;
-	uint64_t blkid, hv, idx;
+	uint64_t blkid, hv, idx, count, chain = 0;
 	dmu_buf_impl_t *dbf;
 
 	blkid = db->db_blkid;
 	hv = dbuf_hash(os, obj, level, blkid);
-	idx = hv & h->hash_table_mask;
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
+	mutex_enter(DBUF_HASH_MUTEX(h, hv));
+	if (h->hash_old_table != NULL) {
+		idx = hv & h->hash_old_mask;
+		for (dbf = h->hash_old_table[idx]; dbf != NULL;
+		    dbf = dbf->db_hash_next) {
+			if (DBUF_EQUAL(dbf, os, obj, level, blkid)) {
+				mutex_enter(&dbf->db_mtx);
+				if (dbf->db_state != DB_EVICTING) {
+					mutex_exit(DBUF_HASH_MUTEX(h, hv));
+					return (dbf);
+				}
+				mutex_exit(&dbf->db_mtx);
+			}
+		}
+	}
+	idx = hv & h->hash_table_mask;
 	for (dbf = h->hash_table[idx]; dbf != NULL; dbf = dbf->db_hash_next) {
+		chain++;
 		if (DBUF_EQUAL(dbf, os, obj, level, blkid)) {
 			mutex_enter(&dbf->db_mtx);
 			if (dbf->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				mutex_exit(DBUF_HASH_MUTEX(h, hv));
 				return (dbf);
 			}
 			mutex_exit(&dbf->db_mtx);
@@ -293,8 +455,27 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	mutex_enter(&db->db_mtx);
 	db->db_hash_next = h->hash_table[idx];
 	h->hash_table[idx] = db;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_inc_64(&dbuf_hash_count);
+	mutex_exit(DBUF_HASH_MUTEX(h, hv));
+
+	if (chain != 0) {
+		DBUF_CACHE_STAT_BUMP(hash_collisions);
+		if (chain + 1 > dbuf_cache_stats.hash_chain_max.value.ui64)
+			dbuf_cache_stats.hash_chain_max.value.ui64 = chain + 1;
+	}
+
+	/*
+	 * Grow the table once the chains get long.  Only one grow may be
+	 * in flight, and we stop doubling once there is a chain for every
+	 * SPA_MINBLOCKSIZE of memory.
+	 */
+	count = atomic_inc_64_nv(&h->hash_count);
+	if (dbuf_hash_load_factor > 0 &&
+	    count > (h->hash_table_mask + 1) * dbuf_hash_load_factor &&
+	    (h->hash_table_mask + 1) < physmem * PAGESIZE / SPA_MINBLOCKSIZE &&
+	    atomic_cas_32(&h->hash_growing, 0, 1) == 0) {
+		taskq_dispatch_ent(dbuf_hash_taskq, dbuf_hash_grow, h, 0,
+		    &h->hash_grow_ent);
+	}
 
 	return (NULL);
 }
@@ -311,7 +492,6 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 
 	hv = dbuf_hash(db->db_objset, db->db.db_object,
 	    db->db_level, db->db_blkid);
-	idx = hv & h->hash_table_mask;
 
 	/*
 	 * We mustn't hold db_mtx to maintain lock ordering:
@@ -321,16 +501,27 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 	ASSERT(db->db_state == DB_EVICTING);
 	ASSERT(!MUTEX_HELD(&db->db_mtx));
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
+	mutex_enter(DBUF_HASH_MUTEX(h, hv));
+	idx = hv & h->hash_table_mask;
 	dbp = &h->hash_table[idx];
 	while ((dbf = *dbp) != db) {
+		if (dbf == NULL) {
+			/* Not moved out of the old table yet */
+			ASSERT(h->hash_old_table != NULL);
+			idx = hv & h->hash_old_mask;
+			dbp = &h->hash_old_table[idx];
+			while ((dbf = *dbp) != db) {
+				dbp = &dbf->db_hash_next;
+				ASSERT(dbf != NULL);
+			}
+			break;
+		}
 		dbp = &dbf->db_hash_next;
-		ASSERT(dbf != NULL);
 	}
 	*dbp = db->db_hash_next;
 	db->db_hash_next = NULL;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_dec_64(&dbuf_hash_count);
+	mutex_exit(DBUF_HASH_MUTEX(h, hv));
+	atomic_dec_64(&h->hash_count);
 }
 
 typedef enum {
@@ -463,13 +654,32 @@ dbuf_cache_multilist_index_func(multilist_t *ml, void *obj)
 	    multilist_get_num_sublists(ml));
 }
 
-static inline unsigned long
+uint64_t
 dbuf_cache_target_bytes(void)
 {
 	return MIN(dbuf_cache_max_bytes,
 	    arc_target_bytes() >> dbuf_cache_max_shift);
 }
 
+uint64_t
+dbuf_cache_size_bytes(void)
+{
+	return (refcount_count(&dbuf_cache_size));
+}
+
+/*
+ * A dbuf is worth keeping in the cache past its turn if it has been hit
+ * in the cache and recreating its data would cost a decompression.
+ */
+static boolean_t
+dbuf_cache_is_hot(dmu_buf_impl_t *db)
+{
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+
+	return (db->db_cache_hits > 0 && db->db_buf != NULL &&
+	    arc_buf_is_decompressed(db->db_buf));
+}
+
 static inline boolean_t
 dbuf_cache_above_hiwater(void)
 {
@@ -503,6 +713,7 @@ dbuf_evict_one(void)
 	int idx = multilist_get_random_index(dbuf_cache);
 	multilist_sublist_t *mls = multilist_sublist_lock(dbuf_cache, idx);
 	dmu_buf_impl_t *db;
+	int retained = 0;
 	ASSERT(!MUTEX_HELD(&dbuf_evict_lock));
 
 	/*
@@ -514,8 +725,23 @@ dbuf_evict_one(void)
 	(void) tsd_set(zfs_dbuf_evict_key, (void *)B_TRUE);
 
 	db = multilist_sublist_tail(mls);
-	while (db != NULL && mutex_tryenter(&db->db_mtx) == 0) {
-		db = multilist_sublist_prev(mls, db);
+	while (db != NULL) {
+		dmu_buf_impl_t *prev = multilist_sublist_prev(mls, db);
+
+		if (mutex_tryenter(&db->db_mtx) == 0) {
+			db = prev;
+			continue;
+		}
+		if (retained >= dbuf_cache_hot_retain || !dbuf_cache_is_hot(db))
+			break;
+
+		db->db_cache_hits >>= 1;
+		multilist_sublist_remove(mls, db);
+		multilist_sublist_insert_head(mls, db);
+		mutex_exit(&db->db_mtx);
+		DBUF_CACHE_STAT_BUMP(cache_hot_retained);
+		retained++;
+		db = prev;
 	}
 
 	DTRACE_PROBE2(dbuf__evict__one, dmu_buf_impl_t *, db,
@@ -526,6 +752,8 @@ dbuf_evict_one(void)
 		multilist_sublist_unlock(mls);
 		(void) refcount_remove_many(&dbuf_cache_size,
 		    db->db.db_size, db);
+		DBUF_CACHE_STAT_BUMPDOWN(cache_count);
+		DBUF_CACHE_STAT_BUMP(cache_total_evicts);
 		dbuf_destroy(db);
 	} else {
 		multilist_sublist_unlock(mls);
@@ -624,6 +852,7 @@ void
 dbuf_init(void)
 {
 	uint64_t hsize = 1ULL << 16;
+	uint64_t nmutexes = DBUF_MUTEXES;
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	int i;
 
@@ -638,27 +867,36 @@ dbuf_init(void)
 
 retry:
 	h->hash_table_mask = hsize - 1;
-#if defined(_KERNEL) && defined(HAVE_SPL)
-	/*
-	 * Large allocations which do not require contiguous pages
-	 * should be using vmem_alloc() in the linux kernel
-	 */
-	h->hash_table = vmem_zalloc(hsize * sizeof (void *), KM_SLEEP);
-#else
-	h->hash_table = kmem_zalloc(hsize * sizeof (void *), KM_NOSLEEP);
-#endif
+	h->hash_table = dbuf_hash_table_alloc(hsize, KM_NOSLEEP);
 	if (h->hash_table == NULL) {
 		/* XXX - we should really return an error instead of assert */
 		ASSERT(hsize > (1ULL << 10));
 		hsize >>= 1;
 		goto retry;
 	}
+	h->hash_old_table = NULL;
+	h->hash_old_mask = 0;
+	h->hash_count = 0;
+	h->hash_growing = 0;
+	taskq_init_ent(&h->hash_grow_ent);
+
+	/*
+	 * Stripe the chains over more mutexes on larger systems, but never
+	 * over more mutexes than there are chains (see dbuf.h).
+	 */
+	while (nmutexes < boot_ncpus * 1024 && nmutexes < hsize)
+		nmutexes <<= 1;
+	nmutexes = MIN(nmutexes, hsize);
+	h->hash_mutex_mask = nmutexes - 1;
+	h->hash_mutexes = kmem_alloc(nmutexes * sizeof (kmutex_t), KM_SLEEP);
+	dbuf_hash_taskq = taskq_create("dbuf_hash_grow", 1, defclsyspri,
+	    0, 0, 0);
 
 	dbuf_kmem_cache = kmem_cache_create("dmu_buf_impl_t",
 	    sizeof (dmu_buf_impl_t),
 	    0, dbuf_cons, dbuf_dest, NULL, NULL, NULL, 0);
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
+	for (i = 0; i < nmutexes; i++)
 		mutex_init(&h->hash_mutexes[i], NULL, MUTEX_DEFAULT, NULL);
 
 	dbuf_stats_init(h);
@@ -697,17 +935,15 @@ dbuf_fini(void)
 
 	dbuf_stats_destroy();
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
+	/* Waits for any grow in progress */
+	taskq_destroy(dbuf_hash_taskq);
+	ASSERT3P(h->hash_old_table, ==, NULL);
+
+	for (i = 0; i <= h->hash_mutex_mask; i++)
 		mutex_destroy(&h->hash_mutexes[i]);
-#if defined(_KERNEL) && defined(HAVE_SPL)
-	/*
-	 * Large allocations which do not require contiguous pages
-	 * should be using vmem_free() in the linux kernel
-	 */
-	vmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
-#else
-	kmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
-#endif
+	kmem_free(h->hash_mutexes,
+	    (h->hash_mutex_mask + 1) * sizeof (kmutex_t));
+	dbuf_hash_table_free(h->hash_table, h->hash_table_mask + 1);
 	kmem_cache_destroy(dbuf_kmem_cache);
 	taskq_destroy(dbu_evict_taskq);
 
@@ -1088,6 +1324,18 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 
 	DB_DNODE_EXIT(db);
 
+	/*
+	 * Scan reads of data blocks, and any read of a block the dataset's
+	 * primarycache setting excludes, are neither cached in the ARC nor
+	 * kept in the dbuf cache once the last hold is released.  Indirect
+	 * blocks are left alone since the reader is about to reuse them.
+	 */
+	if (db->db_level == 0 &&
+	    ((flags & DB_RF_UNCACHED) || !DBUF_IS_CACHEABLE(db))) {
+		aflags |= ARC_FLAG_UNCACHED;
+		db->db_pending_evict = TRUE;
+	}
+
 	db->db_state = DB_READ;
 	mutex_exit(&db->db_mtx);
 
@@ -1105,6 +1353,13 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	    (flags & DB_RF_CANFAIL) ? ZIO_FLAG_CANFAIL : ZIO_FLAG_MUSTSUCCEED,
 	    &aflags, &zb);
 
+	if (aflags & ARC_FLAG_CACHED)
+		DBUF_OS_STAT_BUMP(db->db_objset, ods_arc_hits);
+	else
+		DBUF_OS_STAT_BUMP(db->db_objset, ods_misses);
+	if (aflags & ARC_FLAG_PREFETCH_HIT)
+		DBUF_OS_STAT_BUMP(db->db_objset, ods_prefetch_hits);
+
 	return (err);
 }
 
@@ -1171,6 +1426,229 @@ dbuf_fix_old_data(dmu_buf_impl_t *db, uint64_t txg)
 	}
 }
 
+#define	DBUF_PARTIAL_WORDS(size)	\
+	howmany((size) >> SPA_MINBLOCKSHIFT, 64)
+#define	DBUF_PARTIAL_TEST(mask, i)	\
+	(((mask)[(i) >> 6] >> ((i) & 63)) & 1)
+
+boolean_t
+dbuf_partial_write_ok(uint64_t blksz, uint64_t off, uint64_t len)
+{
+	return (dbuf_partial_min_blksz > 0 &&
+	    blksz >= dbuf_partial_min_blksz &&
+	    P2PHASE(off | len, SPA_MINBLOCKSIZE) == 0);
+}
+
+/*
+ * Return the dirty record of a level-0 dbuf which only holds part of its
+ * block, there is at most one.
+ */
+static dbuf_dirty_record_t *
+dbuf_partial_dr(dmu_buf_impl_t *db)
+{
+	dbuf_dirty_record_t *dr;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+
+	if (db->db_level != 0 || db->db_blkid == DMU_BONUS_BLKID)
+		return (NULL);
+	for (dr = db->db_last_dirty; dr != NULL; dr = dr->dr_next) {
+		if (dr->dt.dl.dr_partial != NULL)
+			return (dr);
+	}
+	return (NULL);
+}
+
+/*
+ * Whether a PARTIAL dbuf is waiting on someone else: either the thread
+ * staging the first write, or the read of the old block.
+ */
+static boolean_t
+dbuf_partial_busy(dmu_buf_impl_t *db)
+{
+	dbuf_dirty_record_t *dr = dbuf_partial_dr(db);
+
+	ASSERT3U(db->db_state, ==, DB_PARTIAL);
+	return (dr == NULL || dr->dt.dl.dr_partial_io);
+}
+
+static void
+dbuf_partial_free(dmu_buf_impl_t *db, dbuf_dirty_record_t *dr)
+{
+	kmem_free(dr->dt.dl.dr_partial,
+	    DBUF_PARTIAL_WORDS(db->db.db_size) * sizeof (uint64_t));
+	dr->dt.dl.dr_partial = NULL;
+	dr->dt.dl.dr_partial_count = 0;
+}
+
+/*
+ * Fill in the sectors of a partially written block which weren't
+ * written from old, the old contents of the block, or with zeros if it
+ * was a hole.  The dbuf is CACHED again unless the dirty record's data
+ * has been copied away from it by dbuf_fix_old_data().
+ */
+static void
+dbuf_partial_fill(dmu_buf_impl_t *db, dbuf_dirty_record_t *dr,
+    const char *old)
+{
+	char *data = dr->dt.dl.dr_data->b_data;
+	uint64_t *mask = dr->dt.dl.dr_partial;
+	int nsect = db->db.db_size >> SPA_MINBLOCKSHIFT;
+	int i, j;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+	ASSERT3U(arc_buf_size(dr->dt.dl.dr_data), ==, db->db.db_size);
+
+	for (i = 0; i < nsect; i = j) {
+		for (j = i; j < nsect && !DBUF_PARTIAL_TEST(mask, j); j++)
+			;
+		if (j > i) {
+			uint64_t off = (uint64_t)i << SPA_MINBLOCKSHIFT;
+			uint64_t len = (uint64_t)(j - i) << SPA_MINBLOCKSHIFT;
+
+			if (old != NULL)
+				bcopy(old + off, data + off, len);
+			else
+				bzero(data + off, len);
+		}
+		while (j < nsect && DBUF_PARTIAL_TEST(mask, j))
+			j++;
+	}
+	dbuf_partial_free(db, dr);
+
+	if (dr->dt.dl.dr_data == db->db_buf && db->db_state == DB_PARTIAL)
+		db->db_state = DB_CACHED;
+	cv_broadcast(&db->db_changed);
+}
+
+/*
+ * Drop the partial write of a dirty record which is discarded without
+ * being synced, along with what the dbuf holds of it.
+ */
+void
+dbuf_partial_discard(dmu_buf_impl_t *db, dbuf_dirty_record_t *dr)
+{
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+
+	if (dr->dt.dl.dr_partial == NULL)
+		return;
+	dbuf_partial_free(db, dr);
+	if (db->db_state == DB_PARTIAL) {
+		ASSERT3P(dr->dt.dl.dr_data, ==, db->db_buf);
+		arc_buf_destroy(db->db_buf, db);
+		db->db_buf = NULL;
+		dbuf_clear_data(db);
+		cv_broadcast(&db->db_changed);
+	}
+}
+
+/*
+ * Note the sectors of [off, off + len) as written; once all of them are,
+ * there is nothing left to read.
+ */
+static void
+dbuf_partial_mark(dmu_buf_impl_t *db, dbuf_dirty_record_t *dr,
+    uint64_t off, uint64_t len)
+{
+	uint64_t *mask = dr->dt.dl.dr_partial;
+	uint64_t i;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+
+	for (i = off >> SPA_MINBLOCKSHIFT;
+	    i < (off + len) >> SPA_MINBLOCKSHIFT; i++) {
+		if (!DBUF_PARTIAL_TEST(mask, i)) {
+			mask[i >> 6] |= 1ULL << (i & 63);
+			dr->dt.dl.dr_partial_count++;
+		}
+	}
+	if (dr->dt.dl.dr_partial_count == db->db.db_size >> SPA_MINBLOCKSHIFT)
+		dbuf_partial_fill(db, dr, NULL);
+}
+
+static void
+dbuf_partial_read_done(zio_t *zio, arc_buf_t *buf, void *vdb)
+{
+	dmu_buf_impl_t *db = vdb;
+	dbuf_dirty_record_t *dr;
+
+	mutex_enter(&db->db_mtx);
+	/*
+	 * The dirty record may have been undirtied, or completely
+	 * written, while we were reading.
+	 */
+	dr = dbuf_partial_dr(db);
+	if (dr != NULL) {
+		ASSERT(dr->dt.dl.dr_partial_io);
+		dr->dt.dl.dr_partial_io = B_FALSE;
+		if (zio == NULL || zio->io_error == 0)
+			dbuf_partial_fill(db, dr, buf->b_data);
+	}
+	cv_broadcast(&db->db_changed);
+	arc_buf_destroy(buf, db);
+	dbuf_rele_and_unlock(db, NULL);
+}
+
+/*
+ * Start the read of the block under a partial write, as a child of zio.
+ * The caller must keep db_blkptr from changing, either by holding the
+ * dn_struct_rwlock or by being the sync thread.  db_mtx is dropped
+ * while the read is issued.
+ */
+static void
+dbuf_partial_read(dmu_buf_impl_t *db, dbuf_dirty_record_t *dr, zio_t *zio,
+    enum zio_flag flags)
+{
+	zbookmark_phys_t zb;
+	uint32_t aflags = ARC_FLAG_NOWAIT;
+	blkptr_t bp;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+	ASSERT(dr->dt.dl.dr_partial != NULL);
+	ASSERT(!dr->dt.dl.dr_partial_io);
+
+	if (db->db_blkptr == NULL || BP_IS_HOLE(db->db_blkptr)) {
+		dbuf_partial_fill(db, dr, NULL);
+		return;
+	}
+
+	bp = *db->db_blkptr;
+	dr->dt.dl.dr_partial_io = B_TRUE;
+	dbuf_add_ref(db, NULL);
+	mutex_exit(&db->db_mtx);
+
+	SET_BOOKMARK(&zb, db->db_objset->os_dsl_dataset ?
+	    db->db_objset->os_dsl_dataset->ds_object : DMU_META_OBJSET,
+	    db->db.db_object, db->db_level, db->db_blkid);
+	(void) arc_read(zio, db->db_objset->os_spa, &bp,
+	    dbuf_partial_read_done, db, ZIO_PRIORITY_SYNC_READ, flags,
+	    &aflags, &zb);
+
+	mutex_enter(&db->db_mtx);
+}
+
+/*
+ * Merge the old block in under the partial write of a PARTIAL dbuf which
+ * is about to be dirtied or filled whole.  Called and returns with db_mtx
+ * held, which is dropped to read the block.
+ */
+static void
+dbuf_partial_resolve(dmu_buf_impl_t *db)
+{
+	uint32_t rf = DB_RF_MUST_SUCCEED | DB_RF_NOPREFETCH;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+	ASSERT3U(db->db_state, ==, DB_PARTIAL);
+
+	mutex_exit(&db->db_mtx);
+	DB_DNODE_ENTER(db);
+	if (RW_WRITE_HELD(&DB_DNODE(db)->dn_struct_rwlock))
+		rf |= DB_RF_HAVESTRUCT;
+	DB_DNODE_EXIT(db);
+	(void) dbuf_read(db, NULL, rf);
+	mutex_enter(&db->db_mtx);
+}
+
 int
 dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 {
@@ -1197,7 +1675,51 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	    DBUF_IS_CACHEABLE(db);
 
 	mutex_enter(&db->db_mtx);
-	if (db->db_state == DB_CACHED) {
+	if (db->db_state == DB_PARTIAL) {
+		dbuf_dirty_record_t *dr = dbuf_partial_dr(db);
+		zio_t *pio = zio;
+		boolean_t need_wait = B_FALSE;
+		boolean_t retry;
+
+		/*
+		 * Only part of the block has been written since it was
+		 * uncached, read the rest of it in unless that is already
+		 * being done.
+		 */
+		if (dr != NULL && !dr->dt.dl.dr_partial_io) {
+			if (pio == NULL || (flags & DB_RF_NEVERWAIT) == 0) {
+				pio = zio_root(dn->dn_objset->os_spa, NULL,
+				    NULL, ZIO_FLAG_CANFAIL);
+				need_wait = B_TRUE;
+			}
+			dbuf_partial_read(db, dr, pio,
+			    (flags & DB_RF_CANFAIL) ? ZIO_FLAG_CANFAIL :
+			    ZIO_FLAG_MUSTSUCCEED);
+		}
+		mutex_exit(&db->db_mtx);
+		if ((flags & DB_RF_HAVESTRUCT) == 0)
+			rw_exit(&dn->dn_struct_rwlock);
+		DB_DNODE_EXIT(db);
+
+		if (need_wait)
+			err = zio_wait(pio);
+		if ((flags & DB_RF_NEVERWAIT) != 0)
+			return (err);
+
+		mutex_enter(&db->db_mtx);
+		while (db->db_state == DB_PARTIAL && dbuf_partial_busy(db))
+			cv_wait(&db->db_changed, &db->db_mtx);
+		retry = (err == 0 && db->db_state != DB_CACHED);
+		mutex_exit(&db->db_mtx);
+
+		/*
+		 * Someone else's read failed, or the block was freed and
+		 * uncached meanwhile.
+		 */
+		if (retry)
+			return (dbuf_read(db, zio, flags));
+		return (err);
+	} else if (db->db_state == DB_CACHED) {
 		/*
 		 * If the arc buf is compressed, we need to decompress it to
 		 * read the data. This could happen during the "zfs receive" of
@@ -1211,6 +1733,7 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 			dbuf_set_data(db, db->db_buf);
 		}
 		mutex_exit(&db->db_mtx);
+		DBUF_OS_STAT_BUMP(db->db_objset, ods_hits);
 		if (prefetch)
 			dmu_zfetch(&dn->dn_zfetch, db->db_blkid, 1, B_TRUE);
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
@@ -1280,8 +1803,13 @@ dbuf_noread(dmu_buf_impl_t *db)
 	ASSERT(!refcount_is_zero(&db->db_holds));
 	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
 	mutex_enter(&db->db_mtx);
-	while (db->db_state == DB_READ || db->db_state == DB_FILL)
-		cv_wait(&db->db_changed, &db->db_mtx);
+	while (db->db_state == DB_READ || db->db_state == DB_FILL ||
+	    db->db_state == DB_PARTIAL) {
+		if (db->db_state == DB_PARTIAL)
+			dbuf_partial_resolve(db);
+		else
+			cv_wait(&db->db_changed, &db->db_mtx);
+	}
 	if (db->db_state == DB_UNCACHED) {
 		arc_buf_contents_t type = DBUF_GET_BUFC_TYPE(db);
 		spa_t *spa = db->db_objset->os_spa;
@@ -1427,12 +1955,19 @@ dbuf_free_range(dnode_t *dn, uint64_t start_blkid, uint64_t end_blkid,
 				dbuf_fix_old_data(db, txg);
 			}
 		}
-		/* clear the contents if its cached */
-		if (db->db_state == DB_CACHED) {
+		/*
+		 * clear the contents if its cached, or if it only holds a
+		 * partial write which is no longer dirty in this txg
+		 */
+		if (db->db_state == DB_CACHED || db->db_state == DB_PARTIAL) {
 			ASSERT(db->db.db_data != NULL);
 			arc_release(db->db_buf, db);
 			bzero(db->db.db_data, db->db.db_size);
 			arc_buf_freeze(db->db_buf);
+			if (db->db_state == DB_PARTIAL) {
+				db->db_state = DB_CACHED;
+				cv_broadcast(&db->db_changed);
+			}
 		}
 
 		mutex_exit(&db->db_mtx);
@@ -1483,6 +2018,8 @@ dbuf_new_size(dmu_buf_impl_t *db, int size, dmu_tx_t *tx)
 	mutex_enter(&db->db_mtx);
 	dbuf_set_data(db, buf);
 	arc_buf_destroy(obuf, db);
+	DBUF_OS_STAT_ADD(db->db_objset, ods_cached_bytes,
+	    (int64_t)size - osize);
 	db->db.db_size = size;
 
 	if (db->db_level == 0) {
@@ -1583,7 +2120,7 @@ dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	 */
 	ASSERT(db->db_level != 0 ||
 	    db->db_state == DB_CACHED || db->db_state == DB_FILL ||
-	    db->db_state == DB_NOFILL);
+	    db->db_state == DB_NOFILL || db->db_state == DB_PARTIAL);
 
 	mutex_enter(&dn->dn_mtx);
 	/*
@@ -1805,7 +2342,7 @@ dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 			mutex_enter(&di->dt.di.dr_mtx);
 			ASSERT3U(di->dr_txg, ==, tx->tx_txg);
 			ASSERT(!list_link_active(&dr->dr_dirty_node));
-			list_insert_tail(&di->dt.di.dr_children, dr);
+			dbuf_dirty_add_child(di, dr);
 			mutex_exit(&di->dt.di.dr_mtx);
 			dr->dr_parent = di;
 		}
@@ -1871,7 +2408,7 @@ dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 
 	ASSERT(db->db.db_size != 0);
 
-	dsl_pool_undirty_space(dmu_objset_pool(dn->dn_objset),
+	dsl_pool_undirty_space(dmu_objset_pool(dn->dn_objset), dn->dn_objset,
 	    dr->dr_accounted, txg);
 
 	*drp = dr->dr_next;
@@ -1902,6 +2439,8 @@ dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 		ASSERT(dr->dt.dl.dr_data != NULL);
 		if (dr->dt.dl.dr_data != db->db_buf)
 			arc_buf_destroy(dr->dt.dl.dr_data, db);
+		if (dr->dt.dl.dr_partial != NULL)
+			dbuf_partial_free(db, dr);
 	}
 
 	kmem_free(dr, sizeof (dbuf_dirty_record_t));
@@ -1960,6 +2499,90 @@ dmu_buf_will_dirty(dmu_buf_t *db_fake, dmu_tx_t *tx)
 	(void) dbuf_dirty(db, tx);
 }
 
+/*
+ * Dirty a data block for a write of only [off, off + len) of it.  When
+ * the block is neither cached nor dirty, the old block is not read here:
+ * the dbuf is made PARTIAL, with a buffer in which only the sectors
+ * written are valid, and the rest of them are read in from the old block
+ * by the sync thread, where the reads of all of the partially written
+ * blocks of an object are issued together.  Anything else which needs
+ * the whole block first merges it in, see dbuf_read().
+ */
+void
+dmu_buf_will_dirty_range(dmu_buf_t *db_fake, uint64_t off, uint64_t len,
+    dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
+	dbuf_dirty_record_t *dr;
+	dnode_t *dn;
+	boolean_t havestruct;
+	boolean_t staged = B_FALSE, partial = B_FALSE;
+
+	ASSERT(tx->tx_txg != 0);
+	ASSERT(!refcount_is_zero(&db->db_holds));
+	ASSERT3U(off + len, <=, db->db.db_size);
+
+	if (db->db_level != 0 || db->db_blkid == DMU_BONUS_BLKID ||
+	    db->db_blkid == DMU_SPILL_BLKID ||
+	    db->db.db_object == DMU_META_DNODE_OBJECT ||
+	    dmu_tx_is_syncing(tx) ||
+	    !dbuf_partial_write_ok(db->db.db_size, off, len)) {
+		dmu_buf_will_dirty(db_fake, tx);
+		return;
+	}
+
+	DB_DNODE_ENTER(db);
+	dn = DB_DNODE(db);
+	havestruct = RW_WRITE_HELD(&dn->dn_struct_rwlock);
+	if (!havestruct)
+		rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	mutex_enter(&db->db_mtx);
+	dr = db->db_last_dirty;
+	if (db->db_state == DB_PARTIAL && dr != NULL &&
+	    dr->dr_txg == tx->tx_txg && dr->dt.dl.dr_partial != NULL) {
+		/* Another part of the block written in this txg */
+		dbuf_redirty(dr);
+		dbuf_partial_mark(db, dr, off, len);
+		staged = B_TRUE;
+	} else if (db->db_state == DB_UNCACHED && dr == NULL &&
+	    db->db_blkptr != NULL && !BP_IS_HOLE(db->db_blkptr) &&
+	    !BP_IS_EMBEDDED(db->db_blkptr) &&
+	    !dnode_block_freed(dn, db->db_blkid)) {
+		dbuf_set_data(db, arc_alloc_buf(dn->dn_objset->os_spa, db,
+		    DBUF_GET_BUFC_TYPE(db), db->db.db_size));
+		db->db_state = DB_PARTIAL;
+		partial = B_TRUE;
+	}
+	mutex_exit(&db->db_mtx);
+	if (!havestruct)
+		rw_exit(&dn->dn_struct_rwlock);
+	DB_DNODE_EXIT(db);
+
+	if (staged)
+		return;
+	if (!partial) {
+		dmu_buf_will_dirty(db_fake, tx);
+		return;
+	}
+
+	/*
+	 * Until the mask is set, readers of the dbuf wait for us.  If the
+	 * block was freed meanwhile it is now cached, zero filled.
+	 */
+	dr = dbuf_dirty(db, tx);
+	mutex_enter(&db->db_mtx);
+	if (db->db_state == DB_PARTIAL) {
+		ASSERT3P(db->db_last_dirty, ==, dr);
+		ASSERT3P(dr->dt.dl.dr_data, ==, db->db_buf);
+		dr->dt.dl.dr_partial = kmem_zalloc(
+		    DBUF_PARTIAL_WORDS(db->db.db_size) * sizeof (uint64_t),
+		    KM_SLEEP);
+		dbuf_partial_mark(db, dr, off, len);
+	}
+	cv_broadcast(&db->db_changed);
+	mutex_exit(&db->db_mtx);
+}
+
 void
 dmu_buf_will_not_fill(dmu_buf_t *db_fake, dmu_tx_t *tx)
 {
@@ -2066,8 +2689,13 @@ dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx)
 
 	mutex_enter(&db->db_mtx);
 
-	while (db->db_state == DB_READ || db->db_state == DB_FILL)
-		cv_wait(&db->db_changed, &db->db_mtx);
+	while (db->db_state == DB_READ || db->db_state == DB_FILL ||
+	    db->db_state == DB_PARTIAL) {
+		if (db->db_state == DB_PARTIAL)
+			dbuf_partial_resolve(db);
+		else
+			cv_wait(&db->db_changed, &db->db_mtx);
+	}
 
 	ASSERT(db->db_state == DB_CACHED || db->db_state == DB_UNCACHED);
 
@@ -2139,6 +2767,7 @@ dbuf_destroy(dmu_buf_impl_t *db)
 		multilist_remove(dbuf_cache, db);
 		(void) refcount_remove_many(&dbuf_cache_size,
 		    db->db.db_size, db);
+		DBUF_CACHE_STAT_BUMPDOWN(cache_count);
 	}
 
 	ASSERT(db->db_state == DB_UNCACHED || db->db_state == DB_NOFILL);
@@ -2163,6 +2792,8 @@ dbuf_destroy(dmu_buf_impl_t *db)
 			mutex_enter(&dn->dn_dbufs_mtx);
 		avl_remove(&dn->dn_dbufs, db);
 		atomic_dec_32(&dn->dn_dbufs_count);
+		DBUF_OS_STAT_ADD(db->db_objset, ods_cached_bytes,
+		    -(int64_t)db->db.db_size);
 		membar_producer();
 		DB_DNODE_EXIT(db);
 		if (needlock)
@@ -2307,6 +2938,31 @@ dbuf_findbp(dnode_t *dn, int level, uint64_t blkid, int fail_sparse,
 	}
 }
 
+/*
+ * Return a copy of the block pointer of the given block, as found in its
+ * parent.  The caller must hold dn_struct_rwlock.
+ */
+int
+dbuf_dnode_findbp(dnode_t *dn, uint64_t level, uint64_t blkid, blkptr_t *bp)
+{
+	dmu_buf_impl_t *dbp = NULL;
+	blkptr_t *bp2;
+	int err;
+
+	ASSERT(RW_LOCK_HELD(&dn->dn_struct_rwlock));
+
+	err = dbuf_findbp(dn, level, blkid, B_FALSE, &dbp, &bp2, NULL);
+	if (err == 0) {
+		if (bp2 != NULL)
+			*bp = *bp2;
+		else
+			BP_ZERO(bp);
+		if (dbp != NULL)
+			dbuf_rele(dbp, NULL);
+	}
+	return (err);
+}
+
 static dmu_buf_impl_t *
 dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
     dmu_buf_impl_t *parent, blkptr_t *blkptr)
@@ -2333,6 +2989,7 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 	db->db_user_immediate_evict = FALSE;
 	db->db_freed_in_flight = FALSE;
 	db->db_pending_evict = FALSE;
+	db->db_cache_hits = 0;
 
 	if (blkid == DMU_BONUS_BLKID) {
 		ASSERT3P(parent, ==, dn->dn_dbuf);
@@ -2375,6 +3032,7 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 	db->db_state = DB_UNCACHED;
 	mutex_exit(&dn->dn_dbufs_mtx);
 	arc_space_consume(sizeof (dmu_buf_impl_t), ARC_SPACE_DBUF);
+	DBUF_OS_STAT_ADD(os, ods_cached_bytes, db->db.db_size);
 
 	if (parent && parent != dn->dn_dbuf)
 		dbuf_add_ref(parent, db);
@@ -2745,6 +3403,10 @@ __dbuf_hold_impl(struct dbuf_hold_impl_data *dh)
 		multilist_remove(dbuf_cache, dh->dh_db);
 		(void) refcount_remove_many(&dbuf_cache_size,
 		    dh->dh_db->db.db_size, dh->dh_db);
+		if (dh->dh_db->db_cache_hits < UINT8_MAX)
+			dh->dh_db->db_cache_hits++;
+		DBUF_CACHE_STAT_BUMPDOWN(cache_count);
+		DBUF_CACHE_STAT_BUMP(cache_hits);
 	}
 	(void) refcount_add(&dh->dh_db->db_holds, dh->dh_tag);
 	DBUF_VERIFY(dh->dh_db);
@@ -3016,6 +3678,7 @@ dbuf_rele_and_unlock(dmu_buf_impl_t *db, void *tag)
 				multilist_insert(dbuf_cache, db);
 				(void) refcount_add_many(&dbuf_cache_size,
 				    db->db.db_size, db);
+				DBUF_CACHE_STAT_BUMP(cache_count);
 				mutex_exit(&db->db_mtx);
 
 				dbuf_evict_notify();
@@ -3165,6 +3828,72 @@ dbuf_check_blkptr(dnode_t *dn, dmu_buf_impl_t *db)
 	}
 }
 
+/*
+ * Append a dirty record to the children of its parent's dirty record,
+ * noting whether the children are still in blkid order.  Sequential
+ * writes keep them sorted for free; only the parents that saw writes out
+ * of order need dbuf_sort_children() at sync time.
+ */
+void
+dbuf_dirty_add_child(dbuf_dirty_record_t *parent, dbuf_dirty_record_t *dr)
+{
+	uint64_t blkid = dr->dr_dbuf->db_blkid;
+
+	ASSERT(MUTEX_HELD(&parent->dt.di.dr_mtx));
+
+	if (!list_is_empty(&parent->dt.di.dr_children) &&
+	    blkid < parent->dt.di.dr_last_blkid)
+		parent->dt.di.dr_unsorted = B_TRUE;
+	parent->dt.di.dr_last_blkid = blkid;
+	list_insert_tail(&parent->dt.di.dr_children, dr);
+}
+
+/*
+ * Put the dirty children of an indirect block back in blkid order, so that
+ * their writes are issued, and their blocks allocated, in offset order.
+ * The blkids of the children fall in the range their parent spans, which
+ * makes this a linear bucket sort.  Anything not fitting a bucket goes
+ * last, in its old order.
+ */
+static void
+dbuf_sort_children(dbuf_dirty_record_t *dr)
+{
+	dmu_buf_impl_t *db = dr->dr_dbuf;
+	list_t *list = &dr->dt.di.dr_children;
+	uint64_t nslots, first, idx, i;
+	dbuf_dirty_record_t **slots, *cdr;
+	list_t rest;
+
+	ASSERT(MUTEX_HELD(&dr->dt.di.dr_mtx));
+
+	nslots = db->db.db_size >> SPA_BLKPTRSHIFT;
+	first = db->db_blkid * nslots;
+	slots = kmem_zalloc(nslots * sizeof (dbuf_dirty_record_t *),
+	    KM_NOSLEEP);
+	if (slots == NULL)
+		return;
+
+	list_create(&rest, sizeof (dbuf_dirty_record_t),
+	    offsetof(dbuf_dirty_record_t, dr_dirty_node));
+	while ((cdr = list_remove_head(list)) != NULL) {
+		idx = cdr->dr_dbuf->db_blkid - first;
+		if (cdr->dr_dbuf->db_blkid < first || idx >= nslots ||
+		    slots[idx] != NULL)
+			list_insert_tail(&rest, cdr);
+		else
+			slots[idx] = cdr;
+	}
+	for (i = 0; i < nslots; i++) {
+		if (slots[i] != NULL)
+			list_insert_tail(list, slots[i]);
+	}
+	list_move_tail(list, &rest);
+	list_destroy(&rest);
+	kmem_free(slots, nslots * sizeof (dbuf_dirty_record_t *));
+
+	dr->dt.di.dr_unsorted = B_FALSE;
+}
+
 /*
  * dbuf_sync_indirect() is called recursively from dbuf_sync_list() so it
  * is critical the we not allow the compiler to inline this function in to
@@ -3210,6 +3939,8 @@ dbuf_sync_indirect(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 
 	zio = dr->dr_zio;
 	mutex_enter(&dr->dt.di.dr_mtx);
+	if (dr->dt.di.dr_unsorted && dbuf_sort_dirty_children)
+		dbuf_sort_children(dr);
 	dbuf_sync_list(&dr->dt.di.dr_children, db->db_level - 1, tx);
 	ASSERT(list_head(&dr->dt.di.dr_children) == NULL);
 	mutex_exit(&dr->dt.di.dr_mtx);
@@ -3235,6 +3966,23 @@ dbuf_sync_leaf(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 	dprintf_dbuf_bp(db, db->db_blkptr, "blkptr=%p", db->db_blkptr);
 
 	mutex_enter(&db->db_mtx);
+	/*
+	 * Wait for the old block to be merged in under a partial write,
+	 * reading it now if dbuf_sync_list() didn't start it.
+	 */
+	while (dr->dt.dl.dr_partial != NULL) {
+		if (dr->dt.dl.dr_partial_io) {
+			cv_wait(&db->db_changed, &db->db_mtx);
+		} else {
+			zio_t *zio = zio_root(dmu_objset_spa(db->db_objset),
+			    NULL, NULL, ZIO_FLAG_MUSTSUCCEED);
+
+			dbuf_partial_read(db, dr, zio, ZIO_FLAG_MUSTSUCCEED);
+			mutex_exit(&db->db_mtx);
+			(void) zio_wait(zio);
+			mutex_enter(&db->db_mtx);
+		}
+	}
 	/*
 	 * To be synced, we must be dirtied.  But we
 	 * might have been freed after the dirty.
@@ -3388,11 +4136,158 @@ dbuf_sync_leaf(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 	}
 }
 
+/*
+ * One share of the level-1 dirty records of a dbuf_sync_list() call, see
+ * dbuf_sync_list_parallel().
+ */
+typedef struct dbuf_sync_share {
+	list_t		dss_list;
+	dmu_tx_t	*dss_tx;
+	kmutex_t	*dss_lock;
+	kcondvar_t	*dss_cv;
+	int		*dss_pending;
+} dbuf_sync_share_t;
+
+static void
+dbuf_sync_share(void *arg)
+{
+	dbuf_sync_share_t *dss = arg;
+	dbuf_dirty_record_t *dr;
+
+	while ((dr = list_remove_head(&dss->dss_list)) != NULL)
+		dbuf_sync_indirect(dr, dss->dss_tx);
+
+	mutex_enter(dss->dss_lock);
+	if (--(*dss->dss_pending) == 0)
+		cv_broadcast(dss->dss_cv);
+	mutex_exit(dss->dss_lock);
+}
+
+/*
+ * Sync a long list of level-1 dirty records of one object by splitting it
+ * into contiguous shares, which are synced by dp_sync_indirect_taskq while
+ * this thread handles the first one.  Every L1 write zio is created, with
+ * its children, before we return, so the caller's parent zio is still only
+ * issued after all of its children exist.  The workers only sync level-1
+ * subtrees and never dispatch again, so waiting for them can't deadlock.
+ */
+static void
+dbuf_sync_list_parallel(list_t *list, int count, dmu_tx_t *tx)
+{
+	dbuf_sync_share_t *shares;
+	dbuf_dirty_record_t *dr;
+	kmutex_t lock;
+	kcondvar_t cv;
+	int nshares, per, pending = 0, i;
+
+	nshares = MIN(MAX(boot_ncpus, 1), count / dbuf_sync_parallel_min);
+	per = (count + nshares - 1) / nshares;
+	shares = kmem_alloc(nshares * sizeof (dbuf_sync_share_t), KM_SLEEP);
+	mutex_init(&lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&cv, NULL, CV_DEFAULT, NULL);
+
+	for (i = 0; i < nshares; i++) {
+		dbuf_sync_share_t *dss = &shares[i];
+		int n;
+
+		list_create(&dss->dss_list, sizeof (dbuf_dirty_record_t),
+		    offsetof(dbuf_dirty_record_t, dr_dirty_node));
+		dss->dss_tx = tx;
+		dss->dss_lock = &lock;
+		dss->dss_cv = &cv;
+		dss->dss_pending = &pending;
+		for (n = 0; n < per && (dr = list_head(list)) != NULL &&
+		    dr->dr_dbuf->db_level == 1; n++) {
+			list_remove(list, dr);
+			list_insert_tail(&dss->dss_list, dr);
+		}
+	}
+
+	for (i = 1; i < nshares; i++) {
+		if (list_is_empty(&shares[i].dss_list))
+			continue;
+		mutex_enter(&lock);
+		pending++;
+		mutex_exit(&lock);
+		if (taskq_dispatch(tx->tx_pool->dp_sync_indirect_taskq,
+		    dbuf_sync_share, &shares[i], TQ_SLEEP) == TASKQID_INVALID)
+			dbuf_sync_share(&shares[i]);
+	}
+	while ((dr = list_remove_head(&shares[0].dss_list)) != NULL)
+		dbuf_sync_indirect(dr, tx);
+
+	mutex_enter(&lock);
+	while (pending != 0)
+		cv_wait(&cv, &lock);
+	mutex_exit(&lock);
+
+	for (i = 0; i < nshares; i++)
+		list_destroy(&shares[i].dss_list);
+	cv_destroy(&cv);
+	mutex_destroy(&lock);
+	kmem_free(shares, nshares * sizeof (dbuf_sync_share_t));
+}
+
+/*
+ * Start reading the old blocks under the partial writes of a list of
+ * level-0 dirty records, all at once, so that dbuf_sync_leaf() only has
+ * to wait for those it gets to before they are done.
+ */
+static void
+dbuf_sync_partial_reads(list_t *list, dmu_tx_t *tx)
+{
+	dbuf_dirty_record_t *dr;
+	zio_t *zio = NULL;
+
+	for (dr = list_head(list); dr != NULL; dr = list_next(list, dr)) {
+		dmu_buf_impl_t *db = dr->dr_dbuf;
+
+		if (db->db_level != 0 || db->db_blkid == DMU_BONUS_BLKID ||
+		    db->db.db_object == DMU_META_DNODE_OBJECT)
+			continue;
+
+		mutex_enter(&db->db_mtx);
+		if (dr->dt.dl.dr_partial != NULL && !dr->dt.dl.dr_partial_io) {
+			if (zio == NULL) {
+				zio = zio_root(tx->tx_pool->dp_spa, NULL, NULL,
+				    ZIO_FLAG_MUSTSUCCEED);
+			}
+			dbuf_partial_read(db, dr, zio, ZIO_FLAG_MUSTSUCCEED);
+		}
+		mutex_exit(&db->db_mtx);
+	}
+	if (zio != NULL)
+		zio_nowait(zio);
+}
+
 void
 dbuf_sync_list(list_t *list, int level, dmu_tx_t *tx)
 {
 	dbuf_dirty_record_t *dr;
 
+	if (level == 0 && dbuf_partial_min_blksz > 0)
+		dbuf_sync_partial_reads(list, tx);
+
+	/*
+	 * The level-1 subtrees of a large object are independent of each
+	 * other, spread their sync over several threads.  The meta dnode
+	 * is left alone, see below.
+	 */
+	if (level == 1 && dbuf_sync_parallel_min > 0 &&
+	    (dr = list_head(list)) != NULL &&
+	    dr->dr_dbuf->db.db_object != DMU_META_DNODE_OBJECT) {
+		int count = 0;
+
+		for (; dr != NULL && count < 2 * dbuf_sync_parallel_min;
+		    dr = list_next(list, dr))
+			count++;
+		if (count >= 2 * dbuf_sync_parallel_min) {
+			for (; dr != NULL; dr = list_next(list, dr))
+				count++;
+			dbuf_sync_list_parallel(list, count, tx);
+		}
+	}
+
 	while ((dr = list_head(list))) {
 		if (dr->dr_zio != NULL) {
 			/*
@@ -3581,7 +4476,7 @@ dbuf_write_physdone(zio_t *zio, arc_buf_t *buf, void *arg)
 	 * dsl_pool_undirty_space().
 	 */
 	delta = dr->dr_accounted / zio->io_phys_children;
-	dsl_pool_undirty_space(dp, delta, zio->io_txg);
+	dsl_pool_undirty_space(dp, os, delta, zio->io_txg);
 }
 
 /* ARGSUSED */
@@ -3856,6 +4751,7 @@ EXPORT_SYMBOL(dbuf_new_size);
 EXPORT_SYMBOL(dbuf_release_bp);
 EXPORT_SYMBOL(dbuf_dirty);
 EXPORT_SYMBOL(dmu_buf_will_dirty);
+EXPORT_SYMBOL(dmu_buf_will_dirty_range);
 EXPORT_SYMBOL(dmu_buf_will_not_fill);
 EXPORT_SYMBOL(dmu_buf_will_fill);
 EXPORT_SYMBOL(dmu_buf_fill_done);
@@ -3896,5 +4792,25 @@ MODULE_PARM_DESC(dbuf_cache_lowater_pct,
 module_param(dbuf_cache_max_shift, int, 0644);
 MODULE_PARM_DESC(dbuf_cache_max_shift,
 	"Cap the size of the dbuf cache to a log2 fraction of arc size.");
+
+module_param(dbuf_sync_parallel_min, int, 0644);
+MODULE_PARM_DESC(dbuf_sync_parallel_min,
+	"Min dirty L1 blocks per thread to sync an object's L1s in parallel");
+
+module_param(dbuf_partial_min_blksz, int, 0644);
+MODULE_PARM_DESC(dbuf_partial_min_blksz,
+	"Min block size to merge partial writes with the old block at sync");
+
+module_param(dbuf_sort_dirty_children, int, 0644);
+MODULE_PARM_DESC(dbuf_sort_dirty_children,
+	"Write the dirty children of an indirect block in offset order");
+
+module_param(dbuf_hash_load_factor, int, 0644);
+MODULE_PARM_DESC(dbuf_hash_load_factor,
+	"Average dbufs per hash chain before the hash table is grown.");
+
+module_param(dbuf_cache_hot_retain, int, 0644);
+MODULE_PARM_DESC(dbuf_cache_hot_retain,
+	"Max number of hot decompressed dbufs spared by one eviction.");
 /* END CSTYLED */
 #endif
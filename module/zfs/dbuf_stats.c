@@ -124,19 +124,13 @@ __dbuf_stats_hash_table_data(char *buf, size_t size, dmu_buf_impl_t *db)
 }
 
 static int
-dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
+dbuf_stats_hash_chain_data(char **bufp, size_t *sizep, dmu_buf_impl_t *db)
 {
-	dbuf_stats_t *dsh = (dbuf_stats_t *)data;
-	dbuf_hash_table_t *h = dsh->hash;
-	dmu_buf_impl_t *db;
+	char *buf = *bufp;
+	size_t size = *sizep;
 	int length, error = 0;
 
-	ASSERT3S(dsh->idx, >=, 0);
-	ASSERT3S(dsh->idx, <=, h->hash_table_mask);
-	memset(buf, 0, size);
-
-	mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
-	for (db = h->hash_table[dsh->idx]; db != NULL; db = db->db_hash_next) {
+	for (; db != NULL; db = db->db_hash_next) {
 		/*
 		 * Returning ENOMEM will cause the data and header functions
 		 * to be called with a larger scratch buffers.
@@ -156,6 +150,35 @@ dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
 
 		mutex_exit(&db->db_mtx);
 	}
+
+	*bufp = buf;
+	*sizep = size;
+	return (error);
+}
+
+static int
+dbuf_stats_hash_table_data(char *buf, size_t size, void *data)
+{
+	dbuf_stats_t *dsh = (dbuf_stats_t *)data;
+	dbuf_hash_table_t *h = dsh->hash;
+	int error;
+
+	ASSERT3S(dsh->idx, >=, 0);
+	ASSERT3S(dsh->idx, <=, h->hash_table_mask);
+	memset(buf, 0, size);
+
+	/*
+	 * While the table is being grown, old chain idx shares its mutex
+	 * with new chain idx, so dump it along with that one.
+	 */
+	mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
+	error = dbuf_stats_hash_chain_data(&buf, &size,
+	    h->hash_table[dsh->idx]);
+	if (error == 0 && h->hash_old_table != NULL &&
+	    dsh->idx <= h->hash_old_mask) {
+		error = dbuf_stats_hash_chain_data(&buf, &size,
+		    h->hash_old_table[dsh->idx]);
+	}
 	mutex_exit(DBUF_HASH_MUTEX(h, dsh->idx));
 
 	return (error);
@@ -212,15 +235,163 @@ dbuf_stats_hash_table_destroy(void)
 	mutex_destroy(&dsh->lock);
 }
 
+/*
+ * ==========================================================================
+ * Dbuf Cache Statistics
+ * ==========================================================================
+ */
+dbuf_cache_stats_t dbuf_cache_stats = {
+	{ "cache_count",		KSTAT_DATA_UINT64 },
+	{ "cache_size_bytes",		KSTAT_DATA_UINT64 },
+	{ "cache_target_bytes",		KSTAT_DATA_UINT64 },
+	{ "cache_hits",			KSTAT_DATA_UINT64 },
+	{ "cache_hot_retained",		KSTAT_DATA_UINT64 },
+	{ "cache_total_evicts",		KSTAT_DATA_UINT64 },
+	{ "hash_elements",		KSTAT_DATA_UINT64 },
+	{ "hash_table_size",		KSTAT_DATA_UINT64 },
+	{ "hash_chain_max",		KSTAT_DATA_UINT64 },
+	{ "hash_collisions",		KSTAT_DATA_UINT64 },
+	{ "hash_resizes",		KSTAT_DATA_UINT64 },
+};
+
+static kstat_t *dbuf_cache_ksp;
+
+static int
+dbuf_cache_stats_update(kstat_t *ksp, int rw)
+{
+	dbuf_cache_stats_t *dcs = ksp->ks_data;
+	dbuf_hash_table_t *h = dbuf_stats_hash_table.hash;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	dcs->cache_size_bytes.value.ui64 = dbuf_cache_size_bytes();
+	dcs->cache_target_bytes.value.ui64 = dbuf_cache_target_bytes();
+	dcs->hash_elements.value.ui64 = h->hash_count;
+	dcs->hash_table_size.value.ui64 = h->hash_table_mask + 1;
+
+	return (0);
+}
+
+static void
+dbuf_cache_stats_init(void)
+{
+	dbuf_cache_ksp = kstat_create("zfs", 0, "dbufstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dbuf_cache_stats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+
+	if (dbuf_cache_ksp != NULL) {
+		dbuf_cache_ksp->ks_data = &dbuf_cache_stats;
+		dbuf_cache_ksp->ks_update = dbuf_cache_stats_update;
+		kstat_install(dbuf_cache_ksp);
+	}
+}
+
+static void
+dbuf_cache_stats_destroy(void)
+{
+	if (dbuf_cache_ksp != NULL) {
+		kstat_delete(dbuf_cache_ksp);
+		dbuf_cache_ksp = NULL;
+	}
+}
+
+/*
+ * ==========================================================================
+ * Per-objset Dbuf Statistics
+ * ==========================================================================
+ */
+typedef struct dbuf_objset_kstat {
+	kstat_named_t cached_bytes;
+	kstat_named_t hits;
+	kstat_named_t arc_hits;
+	kstat_named_t misses;
+	kstat_named_t prefetch_hits;
+} dbuf_objset_kstat_t;
+
+static const dbuf_objset_kstat_t dbuf_objset_kstat_template = {
+	{ "cached_bytes",		KSTAT_DATA_UINT64 },
+	{ "hits",			KSTAT_DATA_UINT64 },
+	{ "arc_hits",			KSTAT_DATA_UINT64 },
+	{ "misses",			KSTAT_DATA_UINT64 },
+	{ "prefetch_hits",		KSTAT_DATA_UINT64 },
+};
+
+static int
+dbuf_objset_kstat_update(kstat_t *ksp, int rw)
+{
+	dbuf_objset_kstat_t *dok = ksp->ks_data;
+	objset_dbuf_stats_t *ods = ksp->ks_private;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	dok->cached_bytes.value.ui64 = ods->ods_cached_bytes;
+	dok->hits.value.ui64 = ods->ods_hits;
+	dok->arc_hits.value.ui64 = ods->ods_arc_hits;
+	dok->misses.value.ui64 = ods->ods_misses;
+	dok->prefetch_hits.value.ui64 = ods->ods_prefetch_hits;
+
+	return (0);
+}
+
+/*
+ * The "objset-0x<id>-dbufs" kstat of the pool, a view of os_dbuf_stats,
+ * which dbuf.c maintains as dbufs are created, resized, read and
+ * destroyed.  Reading it costs five loads, whatever the number of dbufs.
+ */
+void
+dbuf_stats_objset_init(objset_t *os)
+{
+	char module[KSTAT_STRLEN];
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	(void) snprintf(module, KSTAT_STRLEN, "zfs/%s",
+	    spa_name(os->os_spa));
+	(void) snprintf(name, KSTAT_STRLEN, "objset-0x%llx-dbufs",
+	    (u_longlong_t)dmu_objset_id(os));
+	ksp = kstat_create(module, 0, name, "misc", KSTAT_TYPE_NAMED,
+	    sizeof (dbuf_objset_kstat_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (ksp != NULL) {
+		ksp->ks_data = kmem_alloc(sizeof (dbuf_objset_kstat_t),
+		    KM_SLEEP);
+		bcopy(&dbuf_objset_kstat_template, ksp->ks_data,
+		    sizeof (dbuf_objset_kstat_t));
+		ksp->ks_private = &os->os_dbuf_stats;
+		ksp->ks_update = dbuf_objset_kstat_update;
+		kstat_install(ksp);
+	}
+	os->os_dbuf_ksp = ksp;
+}
+
+void
+dbuf_stats_objset_destroy(objset_t *os)
+{
+	kstat_t *ksp = os->os_dbuf_ksp;
+	void *data;
+
+	if (ksp != NULL) {
+		data = ksp->ks_data;
+		kstat_delete(ksp);
+		kmem_free(data, sizeof (dbuf_objset_kstat_t));
+		os->os_dbuf_ksp = NULL;
+	}
+}
+
 void
 dbuf_stats_init(dbuf_hash_table_t *hash)
 {
 	dbuf_stats_hash_table_init(hash);
+	dbuf_cache_stats_init();
 }
 
 void
 dbuf_stats_destroy(void)
 {
+	dbuf_cache_stats_destroy();
 	dbuf_stats_hash_table_destroy();
 }
 
@@ -40,12 +40,19 @@
 
 static kmem_cache_t *ddt_cache;
 static kmem_cache_t *ddt_entry_cache;
+static kmem_cache_t *ddt_cache_entry_cache;
 
 /*
  * Enable/disable prefetching of dedup-ed blocks which are going to be freed.
  */
 int zfs_dedup_prefetch = 0;
 
+/*
+ * Memory for the cache of synced entries of each dedup table, see
+ * ddt_cache_lookup().  0 disables the cache.
+ */
+unsigned long zfs_ddt_cache_size = 64 << 20;
+
 static const ddt_ops_t *ddt_ops[DDT_TYPES] = {
 	&ddt_zap_ops,
 };
@@ -107,9 +114,6 @@ ddt_object_destroy(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
 static int
 ddt_object_load(ddt_t *ddt, enum ddt_type type, enum ddt_class class)
 {
-	ddt_object_t *ddo = &ddt->ddt_object_stats[type][class];
-	dmu_object_info_t doi;
-	uint64_t count;
 	char name[DDT_NAMELEN];
 	int error;
 
@@ -120,28 +124,47 @@ ddt_object_load(ddt_t *ddt, enum ddt_type type, enum ddt_class class)
 	if (error != 0)
 		return (error);
 
-	error = zap_lookup(ddt->ddt_os, ddt->ddt_spa->spa_ddt_stat_object, name,
+	return (zap_lookup(ddt->ddt_os, ddt->ddt_spa->spa_ddt_stat_object, name,
 	    sizeof (uint64_t), sizeof (ddt_histogram_t) / sizeof (uint64_t),
-	    &ddt->ddt_histogram[type][class]);
-	if (error != 0)
-		return (error);
+	    &ddt->ddt_histogram[type][class]));
+}
 
-	/*
-	 * Seed the cached statistics.
-	 */
-	error = ddt_object_info(ddt, type, class, &doi);
-	if (error)
-		return (error);
+/*
+ * Seed the cached statistics of the objects of ddt that haven't been
+ * synced since the pool was loaded.  Counting the entries of an object
+ * reads its ZAP header, so rather than doing that for every object at
+ * import, it is left until the statistics are first asked for.
+ */
+static void
+ddt_object_stats_load(ddt_t *ddt)
+{
+	enum ddt_type type;
+	enum ddt_class class;
+	dmu_object_info_t doi;
+	uint64_t count;
 
-	error = ddt_object_count(ddt, type, class, &count);
-	if (error)
-		return (error);
+	ddt_enter(ddt);
+	if (ddt->ddt_stats_loaded) {
+		ddt_exit(ddt);
+		return;
+	}
+	for (type = 0; type < DDT_TYPES; type++) {
+		for (class = 0; class < DDT_CLASSES; class++) {
+			ddt_object_t *ddo = &ddt->ddt_object_stats[type][class];
 
-	ddo->ddo_count = count;
-	ddo->ddo_dspace = doi.doi_physical_blocks_512 << 9;
-	ddo->ddo_mspace = doi.doi_fill_count * doi.doi_data_block_size;
+			if (!ddt_object_exists(ddt, type, class) ||
+			    ddt_object_info(ddt, type, class, &doi) != 0 ||
+			    ddt_object_count(ddt, type, class, &count) != 0)
+				continue;
 
-	return (0);
+			ddo->ddo_count = count;
+			ddo->ddo_dspace = doi.doi_physical_blocks_512 << 9;
+			ddo->ddo_mspace = doi.doi_fill_count *
+			    doi.doi_data_block_size;
+		}
+	}
+	ddt->ddt_stats_loaded = B_TRUE;
+	ddt_exit(ddt);
 }
 
 static void
@@ -477,6 +500,7 @@ ddt_get_dedup_object_stats(spa_t *spa, ddt_object_t *ddo_total)
 	/* Sum the statistics we cached in ddt_object_sync(). */
 	for (c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
 		ddt_t *ddt = spa->spa_ddt[c];
+		ddt_object_stats_load(ddt);
 		for (type = 0; type < DDT_TYPES; type++) {
 			for (class = 0; class < DDT_CLASSES;
 			    class++) {
@@ -681,15 +705,27 @@ ddt_init(void)
 	    sizeof (ddt_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	ddt_entry_cache = kmem_cache_create("ddt_entry_cache",
 	    sizeof (ddt_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	ddt_cache_entry_cache = kmem_cache_create("ddt_cache_entry_cache",
+	    sizeof (ddt_cache_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 }
 
 void
 ddt_fini(void)
 {
+	kmem_cache_destroy(ddt_cache_entry_cache);
 	kmem_cache_destroy(ddt_entry_cache);
 	kmem_cache_destroy(ddt_cache);
 }
 
+/*
+ * Opaque struct used for ddt_key comparison
+ */
+#define	DDT_KEY_CMP_LEN	(sizeof (ddt_key_t) / sizeof (uint16_t))
+
+typedef struct ddt_key_cmp {
+	uint16_t	u16[DDT_KEY_CMP_LEN];
+} ddt_key_cmp_t;
+
 static ddt_entry_t *
 ddt_alloc(const ddt_key_t *ddk)
 {
@@ -721,6 +757,142 @@ ddt_free(ddt_entry_t *dde)
 	kmem_cache_free(ddt_entry_cache, dde);
 }
 
+/*
+ * The in-core entries of the ddt_tree only live until the txg they were
+ * looked up in has synced, so every dedup write and free of a block whose
+ * entry was last used in an earlier txg has to look it up in the ZAPs
+ * again, at the cost of random leaf reads.  The entries written out by
+ * ddt_sync_entry() are therefore also kept in a cache of their own, which
+ * ddt_lookup() checks first.  It is bounded by zfs_ddt_cache_size and
+ * entries are evicted by a clock: an entry which was looked up since the
+ * hand last passed it gets another round.  The cache always matches the
+ * on-disk tables, entries are updated as they are synced and removed with
+ * their on-disk copy.  It is protected by ddt_lock.
+ */
+static int
+ddt_cache_compare(const void *x1, const void *x2)
+{
+	const ddt_cache_entry_t *dce1 = x1;
+	const ddt_cache_entry_t *dce2 = x2;
+	const ddt_key_cmp_t *k1 = (const ddt_key_cmp_t *)&dce1->dce_key;
+	const ddt_key_cmp_t *k2 = (const ddt_key_cmp_t *)&dce2->dce_key;
+	int32_t cmp = 0;
+	int i;
+
+	for (i = 0; i < DDT_KEY_CMP_LEN; i++) {
+		cmp = (int32_t)k1->u16[i] - (int32_t)k2->u16[i];
+		if (likely(cmp))
+			break;
+	}
+
+	return (AVL_ISIGN(cmp));
+}
+
+static ddt_cache_entry_t *
+ddt_cache_find(ddt_t *ddt, const ddt_key_t *ddk, avl_index_t *where)
+{
+	ddt_cache_entry_t dce_search;
+
+	dce_search.dce_key = *ddk;
+	return (avl_find(&ddt->ddt_cache_tree, &dce_search, where));
+}
+
+static void
+ddt_cache_remove(ddt_t *ddt, ddt_cache_entry_t *dce)
+{
+	avl_remove(&ddt->ddt_cache_tree, dce);
+	list_remove(&ddt->ddt_cache_clock, dce);
+	ddt->ddt_cache_count--;
+	kmem_cache_free(ddt_cache_entry_cache, dce);
+}
+
+static void
+ddt_cache_evict(ddt_t *ddt)
+{
+	ddt_cache_entry_t *dce;
+
+	while ((dce = list_remove_head(&ddt->ddt_cache_clock)) != NULL) {
+		if (!dce->dce_referenced)
+			break;
+		dce->dce_referenced = B_FALSE;
+		list_insert_tail(&ddt->ddt_cache_clock, dce);
+	}
+	if (dce != NULL) {
+		list_insert_head(&ddt->ddt_cache_clock, dce);
+		ddt_cache_remove(ddt, dce);
+	}
+}
+
+/*
+ * Fill in dde from the cache.  Returns ENOENT if it has no copy of the
+ * entry, which may still be on disk.
+ */
+static int
+ddt_cache_lookup(ddt_t *ddt, ddt_entry_t *dde)
+{
+	ddt_cache_entry_t *dce;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	dce = ddt_cache_find(ddt, &dde->dde_key, NULL);
+	if (dce == NULL)
+		return (SET_ERROR(ENOENT));
+
+	bcopy(dce->dce_phys, dde->dde_phys, sizeof (dde->dde_phys));
+	dde->dde_type = dce->dce_type;
+	dde->dde_class = dce->dce_class;
+	dce->dce_referenced = B_TRUE;
+	return (0);
+}
+
+/*
+ * Bring the cache in line with the on-disk copy of dde which was just
+ * synced, or removed if it no longer has any references.
+ */
+static void
+ddt_cache_update(ddt_t *ddt, ddt_entry_t *dde, boolean_t removed)
+{
+	ddt_cache_entry_t *dce;
+	avl_index_t where;
+	uint64_t max = zfs_ddt_cache_size / sizeof (ddt_cache_entry_t);
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	dce = ddt_cache_find(ddt, &dde->dde_key, &where);
+	if (removed || max == 0) {
+		if (dce != NULL)
+			ddt_cache_remove(ddt, dce);
+		return;
+	}
+
+	if (dce == NULL) {
+		while (ddt->ddt_cache_count >= max)
+			ddt_cache_evict(ddt);
+		dce = kmem_cache_alloc(ddt_cache_entry_cache, KM_SLEEP);
+		dce->dce_key = dde->dde_key;
+		dce->dce_referenced = B_FALSE;
+		(void) ddt_cache_find(ddt, &dde->dde_key, &where);
+		avl_insert(&ddt->ddt_cache_tree, dce, where);
+		list_insert_tail(&ddt->ddt_cache_clock, dce);
+		ddt->ddt_cache_count++;
+	}
+	bcopy(dde->dde_phys, dce->dce_phys, sizeof (dce->dce_phys));
+	dce->dce_type = dde->dde_type;
+	dce->dce_class = dde->dde_class;
+}
+
+static void
+ddt_cache_destroy(ddt_t *ddt)
+{
+	ddt_cache_entry_t *dce;
+
+	while ((dce = list_head(&ddt->ddt_cache_clock)) != NULL)
+		ddt_cache_remove(ddt, dce);
+	ASSERT0(ddt->ddt_cache_count);
+	avl_destroy(&ddt->ddt_cache_tree);
+	list_destroy(&ddt->ddt_cache_clock);
+}
+
 void
 ddt_remove(ddt_t *ddt, ddt_entry_t *dde)
 {
@@ -757,6 +929,12 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 	if (dde->dde_loaded)
 		return (dde);
 
+	if (ddt_cache_lookup(ddt, dde) == 0) {
+		dde->dde_loaded = B_TRUE;
+		ddt_stat_update(ddt, dde, -1ULL);
+		return (dde);
+	}
+
 	dde->dde_loading = B_TRUE;
 
 	ddt_exit(ddt);
@@ -820,13 +998,37 @@ ddt_prefetch(spa_t *spa, const blkptr_t *bp)
 }
 
 /*
- * Opaque struct used for ddt_key comparison
+ * Start reading the on-disk entry of bp, unless the entry is in core or in
+ * the cache of synced entries already.  Returns B_TRUE if reads may have
+ * been issued, so that a lookup now would have to wait for them.
  */
-#define	DDT_KEY_CMP_LEN	(sizeof (ddt_key_t) / sizeof (uint16_t))
+boolean_t
+ddt_prefetch_entry(ddt_t *ddt, const blkptr_t *bp)
+{
+	ddt_entry_t dde;
+	enum ddt_type type;
+	enum ddt_class class;
+	boolean_t found;
 
-typedef struct ddt_key_cmp {
-	uint16_t	u16[DDT_KEY_CMP_LEN];
-} ddt_key_cmp_t;
+	ddt_key_fill(&dde.dde_key, bp);
+
+	ddt_enter(ddt);
+	found = (avl_find(&ddt->ddt_tree, &dde, NULL) != NULL ||
+	    ddt_cache_find(ddt, &dde.dde_key, NULL) != NULL);
+	ddt_exit(ddt);
+	if (found)
+		return (B_FALSE);
+
+	for (type = 0; type < DDT_TYPES; type++) {
+		for (class = 0; class < DDT_CLASSES; class++) {
+			if (ddt_object_exists(ddt, type, class)) {
+				ddt_object_prefetch(ddt, type, class, &dde);
+				found = B_TRUE;
+			}
+		}
+	}
+	return (found);
+}
 
 int
 ddt_entry_compare(const void *x1, const void *x2)
@@ -860,6 +1062,10 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
 	avl_create(&ddt->ddt_repair_tree, ddt_entry_compare,
 	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
+	avl_create(&ddt->ddt_cache_tree, ddt_cache_compare,
+	    sizeof (ddt_cache_entry_t), offsetof(ddt_cache_entry_t, dce_node));
+	list_create(&ddt->ddt_cache_clock, sizeof (ddt_cache_entry_t),
+	    offsetof(ddt_cache_entry_t, dce_clock_node));
 	ddt->ddt_checksum = c;
 	ddt->ddt_spa = spa;
 	ddt->ddt_os = spa->spa_meta_objset;
@@ -874,6 +1080,7 @@ ddt_table_free(ddt_t *ddt)
 	ASSERT(avl_numnodes(&ddt->ddt_repair_tree) == 0);
 	avl_destroy(&ddt->ddt_tree);
 	avl_destroy(&ddt->ddt_repair_tree);
+	ddt_cache_destroy(ddt);
 	mutex_destroy(&ddt->ddt_lock);
 	kmem_cache_free(ddt_cache, ddt);
 }
@@ -1145,6 +1352,10 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 			    ddt->ddt_checksum, dde, tx);
 		}
 	}
+
+	ddt_enter(ddt);
+	ddt_cache_update(ddt, dde, total_refcnt == 0);
+	ddt_exit(ddt);
 }
 
 static void
@@ -1251,4 +1462,8 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 #if defined(_KERNEL) && defined(HAVE_SPL)
 module_param(zfs_dedup_prefetch, int, 0644);
 MODULE_PARM_DESC(zfs_dedup_prefetch, "Enable prefetching dedup-ed blks");
+
+/* CSTYLED */
+module_param(zfs_ddt_cache_size, ulong, 0644);
+MODULE_PARM_DESC(zfs_ddt_cache_size, "Memory for synced entries per DDT");
 #endif
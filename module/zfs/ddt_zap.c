@@ -31,20 +31,29 @@
 #include <sys/dmu_tx.h>
 #include <util/sscanf.h>
 
-int ddt_zap_leaf_blockshift = 12;
-int ddt_zap_indirect_blockshift = 12;
+/*
+ * A DDT grows to millions of entries and is looked up at random, so its
+ * ZAPs use 32k leaves: each leaf read brings in eight times as many entries
+ * as a 4k leaf, and the pointer table needs an eighth of the leaves.  Only
+ * tables created after a change of these pick up the new sizes.
+ */
+int ddt_zap_leaf_blockshift = 15;
+int ddt_zap_indirect_blockshift = 15;
 
 static int
 ddt_zap_create(objset_t *os, uint64_t *objectp, dmu_tx_t *tx, boolean_t prehash)
 {
 	zap_flags_t flags = ZAP_FLAG_HASH64 | ZAP_FLAG_UINT64_KEY;
+	int leaf_bs = MIN(MAX(ddt_zap_leaf_blockshift, SPA_MINBLOCKSHIFT),
+	    SPA_OLD_MAXBLOCKSHIFT);
+	int ind_bs = MIN(MAX(ddt_zap_indirect_blockshift, SPA_MINBLOCKSHIFT),
+	    SPA_OLD_MAXBLOCKSHIFT);
 
 	if (prehash)
 		flags |= ZAP_FLAG_PRE_HASHED_KEY;
 
 	*objectp = zap_create_flags(os, 0, flags, DMU_OT_DDT_ZAP,
-	    ddt_zap_leaf_blockshift, ddt_zap_indirect_blockshift,
-	    DMU_OT_NONE, 0, tx);
+	    leaf_bs, ind_bs, DMU_OT_NONE, 0, tx);
 
 	return (*objectp == 0 ? ENOTSUP : 0);
 }
@@ -155,3 +164,13 @@ const ddt_ops_t ddt_zap_ops = {
 	ddt_zap_walk,
 	ddt_zap_count,
 };
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(ddt_zap_leaf_blockshift, int, 0644);
+MODULE_PARM_DESC(ddt_zap_leaf_blockshift,
+	"Leaf block shift of new DDT ZAPs");
+
+module_param(ddt_zap_indirect_blockshift, int, 0644);
+MODULE_PARM_DESC(ddt_zap_indirect_blockshift,
+	"Indirect block shift of new DDT ZAPs");
+#endif
@@ -50,6 +50,7 @@
 #include <sys/abd.h>
 #include <sys/trace_dmu.h>
 #include <sys/zfs_rlock.h>
+#include <sys/zvol.h>
 #ifdef _KERNEL
 #include <sys/vmsystm.h>
 #include <sys/zfs_znode.h>
@@ -443,22 +444,58 @@ dmu_spill_hold_by_bonus(dmu_buf_t *bonus, void *tag, dmu_buf_t **dbp)
 	return (err);
 }
 
+/*
+ * Number of blocks of dn covered by offset, length, or 0 if the range runs
+ * past the end of an object with a single block of odd size.
+ */
+static uint64_t
+dmu_buf_hold_nblks(dnode_t *dn, uint64_t offset, uint64_t length)
+{
+	ASSERT(RW_LOCK_HELD(&dn->dn_struct_rwlock));
+
+	if (dn->dn_datablkshift) {
+		int blkshift = dn->dn_datablkshift;
+		return ((P2ROUNDUP(offset + length, 1ULL << blkshift) -
+		    P2ALIGN(offset, 1ULL << blkshift)) >> blkshift);
+	}
+
+	if (offset + length > dn->dn_datablksz) {
+		zfs_panic_recover("zfs: accessing past end of object "
+		    "%llx/%llx (size=%u access=%llu+%llu)",
+		    (longlong_t)dn->dn_objset->
+		    os_dsl_dataset->ds_object,
+		    (longlong_t)dn->dn_object, dn->dn_datablksz,
+		    (longlong_t)offset, (longlong_t)length);
+		return (0);
+	}
+	return (1);
+}
+
 /*
  * Note: longer-term, we should modify all of the dmu_buf_*() interfaces
  * to take a held dnode rather than <os, object> -- the lookup is wasteful,
  * and can induce severe lock contention when writing to several files
  * whose dnodes are in the same block.
+ *
+ * Hold the dbufs of every range in vecs, in order, in one array.  All of
+ * them are held, and the reads of all of them issued, under a single
+ * acquisition of dn_struct_rwlock and waited for under a single zio.
+ * Ranges sharing a block each get their own hold on it.  Empty ranges
+ * hold nothing, unless they are the only one.
  */
 static int
-dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset, uint64_t length,
-    boolean_t read, void *tag, int *numbufsp, dmu_buf_t ***dbpp, uint32_t flags)
+dmu_buf_hold_vec_by_dnode(dnode_t *dn, const dmu_vec_t *vecs, int nvecs,
+    boolean_t read, void *tag, int *numbufsp, dmu_buf_t ***dbpp,
+    uint32_t flags)
 {
 	dmu_buf_t **dbp;
-	uint64_t blkid, nblks, i;
+	uint64_t blkid, nblks, length = 0, i, n;
 	uint32_t dbuf_flags;
-	int err;
+	int err, v;
 	zio_t *zio;
 
+	for (v = 0; v < nvecs; v++)
+		length += vecs[v].dv_len;
 	ASSERT(length <= DMU_MAX_ACCESS);
 
 	/*
@@ -468,48 +505,53 @@ dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset, uint64_t length,
 	 */
 	dbuf_flags = DB_RF_CANFAIL | DB_RF_NEVERWAIT | DB_RF_HAVESTRUCT |
 	    DB_RF_NOPREFETCH;
+	if (flags & DMU_READ_UNCACHED)
+		dbuf_flags |= DB_RF_UNCACHED;
 
 	rw_enter(&dn->dn_struct_rwlock, RW_READER);
-	if (dn->dn_datablkshift) {
-		int blkshift = dn->dn_datablkshift;
-		nblks = (P2ROUNDUP(offset + length, 1ULL << blkshift) -
-		    P2ALIGN(offset, 1ULL << blkshift)) >> blkshift;
-	} else {
-		if (offset + length > dn->dn_datablksz) {
-			zfs_panic_recover("zfs: accessing past end of object "
-			    "%llx/%llx (size=%u access=%llu+%llu)",
-			    (longlong_t)dn->dn_objset->
-			    os_dsl_dataset->ds_object,
-			    (longlong_t)dn->dn_object, dn->dn_datablksz,
-			    (longlong_t)offset, (longlong_t)length);
+	nblks = 0;
+	for (v = 0; v < nvecs; v++) {
+		if (vecs[v].dv_len == 0 && nvecs > 1)
+			continue;
+		n = dmu_buf_hold_nblks(dn, vecs[v].dv_offset, vecs[v].dv_len);
+		if (n == 0 && vecs[v].dv_len != 0) {
 			rw_exit(&dn->dn_struct_rwlock);
 			return (SET_ERROR(EIO));
 		}
-		nblks = 1;
+		nblks += n;
 	}
 	dbp = kmem_zalloc(sizeof (dmu_buf_t *) * nblks, KM_SLEEP);
 
 	zio = zio_root(dn->dn_objset->os_spa, NULL, NULL, ZIO_FLAG_CANFAIL);
-	blkid = dbuf_whichblock(dn, 0, offset);
-	for (i = 0; i < nblks; i++) {
-		dmu_buf_impl_t *db = dbuf_hold(dn, blkid + i, tag);
-		if (db == NULL) {
-			rw_exit(&dn->dn_struct_rwlock);
-			dmu_buf_rele_array(dbp, nblks, tag);
-			zio_nowait(zio);
-			return (SET_ERROR(EIO));
-		}
+	for (v = 0, n = 0; v < nvecs; v++) {
+		uint64_t vblks;
 
-		/* initiate async i/o */
-		if (read)
-			(void) dbuf_read(db, zio, dbuf_flags);
-		dbp[i] = &db->db;
-	}
+		if (vecs[v].dv_len == 0 && nvecs > 1)
+			continue;
+		vblks = dmu_buf_hold_nblks(dn, vecs[v].dv_offset,
+		    vecs[v].dv_len);
+		blkid = dbuf_whichblock(dn, 0, vecs[v].dv_offset);
+		for (i = 0; i < vblks; i++, n++) {
+			dmu_buf_impl_t *db = dbuf_hold(dn, blkid + i, tag);
+			if (db == NULL) {
+				rw_exit(&dn->dn_struct_rwlock);
+				dmu_buf_rele_array(dbp, nblks, tag);
+				zio_nowait(zio);
+				return (SET_ERROR(EIO));
+			}
+
+			/* initiate async i/o */
+			if (read)
+				(void) dbuf_read(db, zio, dbuf_flags);
+			dbp[n] = &db->db;
+		}
 
-	if ((flags & DMU_READ_NO_PREFETCH) == 0 &&
-	    DNODE_META_IS_CACHEABLE(dn) && length <= zfetch_array_rd_sz) {
-		dmu_zfetch(&dn->dn_zfetch, blkid, nblks,
-		    read && DNODE_IS_CACHEABLE(dn));
+		if ((flags & DMU_READ_NO_PREFETCH) == 0 &&
+		    DNODE_META_IS_CACHEABLE(dn) &&
+		    vecs[v].dv_len <= zfetch_array_rd_sz) {
+			dmu_zfetch(&dn->dn_zfetch, blkid, vblks,
+			    read && DNODE_IS_CACHEABLE(dn));
+		}
 	}
 	rw_exit(&dn->dn_struct_rwlock);
 
@@ -524,13 +566,21 @@ dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset, uint64_t length,
 	if (read) {
 		for (i = 0; i < nblks; i++) {
 			dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbp[i];
+			boolean_t partial;
+
 			mutex_enter(&db->db_mtx);
 			while (db->db_state == DB_READ ||
 			    db->db_state == DB_FILL)
 				cv_wait(&db->db_changed, &db->db_mtx);
 			if (db->db_state == DB_UNCACHED)
 				err = SET_ERROR(EIO);
+			partial = (db->db_state == DB_PARTIAL);
 			mutex_exit(&db->db_mtx);
+			/* a partial write not merged with the old block yet */
+			if (err == 0 && partial) {
+				err = dbuf_read(db, NULL,
+				    DB_RF_CANFAIL | DB_RF_NOPREFETCH);
+			}
 			if (err) {
 				dmu_buf_rele_array(dbp, nblks, tag);
 				return (err);
@@ -543,6 +593,20 @@ dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset, uint64_t length,
 	return (0);
 }
 
+static int
+dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset, uint64_t length,
+    boolean_t read, void *tag, int *numbufsp, dmu_buf_t ***dbpp, uint32_t flags)
+{
+	dmu_vec_t vec;
+
+	vec.dv_offset = offset;
+	vec.dv_len = length;
+	vec.dv_buf = NULL;
+
+	return (dmu_buf_hold_vec_by_dnode(dn, &vec, 1, read, tag, numbufsp,
+	    dbpp, flags));
+}
+
 static int
 dmu_buf_hold_array(objset_t *os, uint64_t object, uint64_t offset,
     uint64_t length, int read, void *tag, int *numbufsp, dmu_buf_t ***dbpp)
@@ -763,8 +827,9 @@ dmu_free_long_range_impl(objset_t *os, dnode_t *dn, uint64_t offset,
 		length = object_size - offset;
 
 	while (length != 0) {
-		uint64_t chunk_end, chunk_begin, chunk_len;
+		uint64_t chunk_end, chunk_begin, chunk_len, chunk_blocks;
 		uint64_t long_free_dirty_all_txgs = 0;
+		uint64_t long_free_blocks_all_txgs = 0;
 		dmu_tx_t *tx;
 
 		if (dmu_objset_zfs_unmounting(dn->dn_objset))
@@ -780,21 +845,29 @@ dmu_free_long_range_impl(objset_t *os, dnode_t *dn, uint64_t offset,
 		ASSERT3U(chunk_begin, <=, chunk_end);
 
 		chunk_len = chunk_end - chunk_begin;
+		chunk_blocks = howmany(chunk_len, dn->dn_datablksz);
 
 		mutex_enter(&dp->dp_lock);
 		for (t = 0; t < TXG_SIZE; t++) {
 			long_free_dirty_all_txgs +=
 			    dp->dp_long_free_dirty_pertxg[t];
+			long_free_blocks_all_txgs +=
+			    dp->dp_long_free_blocks_pertxg[t];
 		}
 		mutex_exit(&dp->dp_lock);
 
 		/*
 		 * To avoid filling up a TXG with just frees wait for
 		 * the next TXG to open before freeing more chunks if
-		 * we have reached the threshold of frees
+		 * we have reached the threshold of frees, or the
+		 * number of blocks the pool frees per txg (see
+		 * zfs_free_sync_target_ms).
 		 */
-		if (dirty_frees_threshold != 0 &&
-		    long_free_dirty_all_txgs >= dirty_frees_threshold) {
+		if ((dirty_frees_threshold != 0 &&
+		    long_free_dirty_all_txgs >= dirty_frees_threshold) ||
+		    (long_free_blocks_all_txgs != 0 &&
+		    long_free_blocks_all_txgs + chunk_blocks >
+		    dp->dp_free_budget)) {
 			txg_wait_open(dp, 0);
 			continue;
 		}
@@ -816,6 +889,8 @@ dmu_free_long_range_impl(objset_t *os, dnode_t *dn, uint64_t offset,
 		mutex_enter(&dp->dp_lock);
 		dp->dp_long_free_dirty_pertxg[dmu_tx_get_txg(tx) & TXG_MASK] +=
 		    chunk_len;
+		dp->dp_long_free_blocks_pertxg[dmu_tx_get_txg(tx) & TXG_MASK] +=
+		    chunk_blocks;
 		mutex_exit(&dp->dp_lock);
 		DTRACE_PROBE3(free__long__range,
 		    uint64_t, long_free_dirty_all_txgs, uint64_t, chunk_len,
@@ -969,6 +1044,234 @@ dmu_read_by_dnode(dnode_t *dn, uint64_t offset, uint64_t size, void *buf,
 	return (dmu_read_impl(dn, offset, size, buf, flags));
 }
 
+/*
+ * Return how many of the leading ranges in vecs, at least one, can be held
+ * together while staying within half of DMU_MAX_ACCESS.
+ */
+static int
+dmu_vec_span(const dmu_vec_t *vecs, int nvecs)
+{
+	uint64_t total = vecs[0].dv_len;
+	int n;
+
+	for (n = 1; n < nvecs; n++) {
+		if (total + vecs[n].dv_len > DMU_MAX_ACCESS / 2)
+			break;
+		total += vecs[n].dv_len;
+	}
+	return (n);
+}
+
+/*
+ * Read a batch of discontiguous ranges of one object into their buffers.
+ * Unlike a dmu_read_by_dnode() per range, the dbufs of consecutive ranges
+ * are held under one acquisition of dn_struct_rwlock and their reads
+ * issued and waited for together.
+ */
+int
+dmu_read_vec_by_dnode(dnode_t *dn, dmu_vec_t *vecs, int nvecs,
+    uint32_t flags)
+{
+	dmu_buf_t **dbp;
+	int numbufs, n, v, b, err = 0;
+
+	while (nvecs > 0) {
+		n = dmu_vec_span(vecs, nvecs);
+		if (n == 1 || dn->dn_maxblkid == 0) {
+			/* Big ranges and odd-sized objects */
+			err = dmu_read_impl(dn, vecs[0].dv_offset,
+			    vecs[0].dv_len, vecs[0].dv_buf, flags);
+			if (err)
+				break;
+			vecs++;
+			nvecs--;
+			continue;
+		}
+
+		err = dmu_buf_hold_vec_by_dnode(dn, vecs, n, TRUE, FTAG,
+		    &numbufs, &dbp, flags);
+		if (err)
+			break;
+
+		for (v = 0, b = 0; v < n; v++) {
+			uint64_t offset = vecs[v].dv_offset;
+			uint64_t size = vecs[v].dv_len;
+			char *buf = vecs[v].dv_buf;
+
+			while (size > 0) {
+				dmu_buf_t *db = dbp[b++];
+				int64_t bufoff = offset - db->db_offset;
+				uint64_t tocpy;
+
+				ASSERT3S(b, <=, numbufs);
+				tocpy = MIN(db->db_size - bufoff, size);
+				(void) memcpy(buf, (char *)db->db_data + bufoff,
+				    tocpy);
+
+				offset += tocpy;
+				size -= tocpy;
+				buf += tocpy;
+			}
+		}
+		dmu_buf_rele_array(dbp, numbufs, FTAG);
+		vecs += n;
+		nvecs -= n;
+	}
+	return (err);
+}
+
+/*
+ * Read the data block of an object that contains offset in its on-disk,
+ * compressed form, e.g. to forward it to another pool which can store it
+ * without recompressing (see arc_loan_compressed_buf() and
+ * dmu_assign_arcbuf()).  ENOTSUP is returned for blocks that can't be
+ * shipped this way: holes, embedded or uncompressed blocks, and blocks with
+ * dirty data that hasn't reached the disk yet.  Callers fall back to
+ * dmu_read() for those.  The caller must keep writers out of the block.
+ */
+int
+dmu_read_compressed(objset_t *os, uint64_t object, uint64_t offset,
+    arc_buf_t **abufp)
+{
+	arc_flags_t aflags = ARC_FLAG_WAIT;
+	dmu_buf_impl_t *db;
+	zbookmark_phys_t zb;
+	boolean_t dirty = B_FALSE;
+	uint64_t blkid;
+	dnode_t *dn;
+	blkptr_t bp;
+	int err;
+
+	*abufp = NULL;
+
+	err = dnode_hold(os, object, FTAG, &dn);
+	if (err != 0)
+		return (err);
+
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	blkid = dbuf_whichblock(dn, 0, offset);
+	db = dbuf_find(os, object, 0, blkid);
+	if (db != NULL) {
+		dirty = (db->db_last_dirty != NULL);
+		mutex_exit(&db->db_mtx);
+	}
+	if (!dirty)
+		err = dbuf_dnode_findbp(dn, 0, blkid, &bp);
+	rw_exit(&dn->dn_struct_rwlock);
+	dnode_rele(dn, FTAG);
+
+	if (err != 0)
+		return (err);
+	if (dirty || BP_IS_HOLE(&bp) || BP_IS_EMBEDDED(&bp) ||
+	    BP_GET_COMPRESS(&bp) == ZIO_COMPRESS_OFF)
+		return (SET_ERROR(ENOTSUP));
+
+	SET_BOOKMARK(&zb, dmu_objset_id(os), object, 0, blkid);
+	err = arc_read(NULL, os->os_spa, &bp, arc_getbuf_func, abufp,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_CANFAIL | ZIO_FLAG_RAW,
+	    &aflags, &zb);
+	if (err != 0)
+		return (err);
+
+	if (arc_get_compression(*abufp) == ZIO_COMPRESS_OFF) {
+		arc_buf_destroy(*abufp, abufp);
+		*abufp = NULL;
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	return (0);
+}
+
+/*
+ * Copy the block pointer of a data block of dn as it is on disk, or return
+ * EBUSY if the block has changes that haven't reached the disk yet.
+ */
+static int
+dmu_synced_bp(dnode_t *dn, uint64_t blkid, blkptr_t *bp)
+{
+	dmu_buf_impl_t *db;
+	boolean_t dirty = B_FALSE;
+	int err;
+
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	db = dbuf_find(dn->dn_objset, dn->dn_object, 0, blkid);
+	if (db != NULL) {
+		dirty = (db->db_last_dirty != NULL);
+		mutex_exit(&db->db_mtx);
+	}
+	if (dirty || dnode_block_freed(dn, blkid))
+		err = SET_ERROR(EBUSY);
+	else
+		err = dbuf_dnode_findbp(dn, 0, blkid, bp);
+	rw_exit(&dn->dn_struct_rwlock);
+
+	if (err == ENOENT) {
+		BP_ZERO(bp);
+		err = 0;
+	}
+	return (err);
+}
+
+/*
+ * Find how much of [offset, offset + len) of an object is stored in the
+ * very same blocks in two objsets of a pool, such as a clone and its origin
+ * where neither has rewritten them since the clone was made.  The length
+ * of the run which starts at offset is returned in *sharedp; it ends at the
+ * first block which differs, or which has dirty data in either objset.
+ * Only block pointers are looked at, so copying the data of one objset
+ * into the other can skip the shared runs for the cost of reading the
+ * indirect blocks.
+ */
+int
+dmu_range_shared(objset_t *os1, objset_t *os2, uint64_t object,
+    uint64_t offset, uint64_t len, uint64_t *sharedp)
+{
+	dnode_t *dn1, *dn2;
+	blkptr_t bp1, bp2;
+	uint64_t blkid, blksz, end = offset + len;
+	int err;
+
+	*sharedp = 0;
+	if (dmu_objset_spa(os1) != dmu_objset_spa(os2) || len == 0)
+		return (0);
+
+	err = dnode_hold(os1, object, FTAG, &dn1);
+	if (err != 0)
+		return (err);
+	err = dnode_hold(os2, object, FTAG, &dn2);
+	if (err != 0) {
+		dnode_rele(dn1, FTAG);
+		return (err);
+	}
+
+	blksz = dn1->dn_datablksz;
+	if (blksz != dn2->dn_datablksz || dn1->dn_datablkshift == 0)
+		goto out;
+
+	for (blkid = offset >> dn1->dn_datablkshift; blkid * blksz < end;
+	    blkid++) {
+		if ((err = dmu_synced_bp(dn1, blkid, &bp1)) != 0 ||
+		    (err = dmu_synced_bp(dn2, blkid, &bp2)) != 0)
+			break;
+		if (BP_IS_HOLE(&bp1) && BP_IS_HOLE(&bp2)) {
+			/* nothing to copy either way */
+		} else if (BP_IS_EMBEDDED(&bp1) || BP_IS_EMBEDDED(&bp2)) {
+			if (bcmp(&bp1, &bp2, sizeof (bp1)) != 0)
+				break;
+		} else if (BP_IS_HOLE(&bp1) || BP_IS_HOLE(&bp2) ||
+		    !BP_EQUAL(&bp1, &bp2)) {
+			break;
+		}
+		*sharedp = MIN(end, (blkid + 1) * blksz) - offset;
+	}
+	if (err == EBUSY)
+		err = 0;
+out:
+	dnode_rele(dn2, FTAG);
+	dnode_rele(dn1, FTAG);
+	return (err);
+}
+
 static void
 dmu_write_impl(dmu_buf_t **dbp, int numbufs, uint64_t offset, uint64_t size,
     const void *buf, dmu_tx_t *tx)
@@ -990,7 +1293,7 @@ dmu_write_impl(dmu_buf_t **dbp, int numbufs, uint64_t offset, uint64_t size,
 		if (tocpy == db->db_size)
 			dmu_buf_will_fill(db, tx);
 		else
-			dmu_buf_will_dirty(db, tx);
+			dmu_buf_will_dirty_range(db, bufoff, tocpy, tx);
 
 		(void) memcpy((char *)db->db_data + bufoff, buf, tocpy);
 
@@ -1035,6 +1338,58 @@ dmu_write_by_dnode(dnode_t *dn, uint64_t offset, uint64_t size,
 	dmu_buf_rele_array(dbp, numbufs, FTAG);
 }
 
+/*
+ * Write a batch of discontiguous ranges of one object, the vectored
+ * counterpart of dmu_write_by_dnode().  The caller must hold every range
+ * in tx.
+ */
+void
+dmu_write_vec_by_dnode(dnode_t *dn, const dmu_vec_t *vecs, int nvecs,
+    dmu_tx_t *tx)
+{
+	dmu_buf_t **dbp;
+	int numbufs, n, v, b;
+
+	while (nvecs > 0) {
+		n = dmu_vec_span(vecs, nvecs);
+		if (n == 1) {
+			dmu_write_by_dnode(dn, vecs[0].dv_offset,
+			    vecs[0].dv_len, vecs[0].dv_buf, tx);
+			vecs++;
+			nvecs--;
+			continue;
+		}
+
+		VERIFY0(dmu_buf_hold_vec_by_dnode(dn, vecs, n, FALSE, FTAG,
+		    &numbufs, &dbp, DMU_READ_PREFETCH));
+		for (v = 0, b = 0; v < n; v++) {
+			uint64_t offset = vecs[v].dv_offset;
+			uint64_t size = vecs[v].dv_len;
+			int nb;
+
+			/* Count the blocks of this range, the next in dbp */
+			for (nb = 0; size > 0; nb++) {
+				dmu_buf_t *db = dbp[b + nb];
+				uint64_t tocpy = MIN(db->db_size -
+				    (offset - db->db_offset), size);
+
+				ASSERT3S(b + nb, <, numbufs);
+				offset += tocpy;
+				size -= tocpy;
+			}
+			if (nb == 0)
+				continue;
+
+			dmu_write_impl(dbp + b, nb, vecs[v].dv_offset,
+			    vecs[v].dv_len, vecs[v].dv_buf, tx);
+			b += nb;
+		}
+		dmu_buf_rele_array(dbp, numbufs, FTAG);
+		vecs += n;
+		nvecs -= n;
+	}
+}
+
 void
 dmu_prealloc(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
     dmu_tx_t *tx)
@@ -1225,6 +1580,66 @@ xuio_stat_wbuf_nocopy(void)
 	XUIOSTAT_BUMP(xuiostat_wbuf_nocopy);
 }
 
+/*
+ * Hold the dbufs backing [offset, offset + size) and fill in an iovec array
+ * pointing directly at their data.  The range may be at most
+ * DMU_MAX_ACCESS / 2 bytes; larger reads must be split by the caller.
+ */
+int
+dmu_read_loan_by_dnode(dnode_t *dn, uint64_t offset, uint64_t size,
+    dmu_read_loan_t *drl, void *tag, uint32_t flags)
+{
+	uint64_t resid = size;
+	int i, err;
+
+	bzero(drl, sizeof (dmu_read_loan_t));
+
+	if (size == 0)
+		return (0);
+	if (size > DMU_MAX_ACCESS / 2)
+		return (SET_ERROR(EINVAL));
+
+	err = dmu_buf_hold_array_by_dnode(dn, offset, size, TRUE, tag,
+	    &drl->drl_numbufs, &drl->drl_dbp, flags);
+	if (err)
+		return (err);
+
+	drl->drl_iov = kmem_alloc(drl->drl_numbufs * sizeof (iovec_t),
+	    KM_SLEEP);
+
+	for (i = 0; i < drl->drl_numbufs && resid > 0; i++) {
+		dmu_buf_t *db = drl->drl_dbp[i];
+		int64_t bufoff = offset - db->db_offset;
+		uint64_t tocpy = MIN(db->db_size - bufoff, resid);
+
+		drl->drl_iov[i].iov_base = (char *)db->db_data + bufoff;
+		drl->drl_iov[i].iov_len = tocpy;
+
+		offset += tocpy;
+		resid -= tocpy;
+	}
+	drl->drl_iovcnt = i;
+	drl->drl_size = size - resid;
+
+	XUIOSTAT_INCR(xuiostat_onloan_rbuf, drl->drl_numbufs);
+	XUIOSTAT_BUMP(xuiostat_rbuf_nocopy);
+
+	return (0);
+}
+
+void
+dmu_read_loan_return(dmu_read_loan_t *drl, void *tag)
+{
+	if (drl->drl_numbufs == 0)
+		return;
+
+	XUIOSTAT_INCR(xuiostat_onloan_rbuf, -drl->drl_numbufs);
+
+	kmem_free(drl->drl_iov, drl->drl_numbufs * sizeof (iovec_t));
+	dmu_buf_rele_array(drl->drl_dbp, drl->drl_numbufs, tag);
+	bzero(drl, sizeof (dmu_read_loan_t));
+}
+
 #ifdef _KERNEL
 int
 dmu_read_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size)
@@ -1363,7 +1778,7 @@ dmu_write_uio_dnode(dnode_t *dn, uio_t *uio, uint64_t size, dmu_tx_t *tx)
 		if (tocpy == db->db_size)
 			dmu_buf_will_fill(db, tx);
 		else
-			dmu_buf_will_dirty(db, tx);
+			dmu_buf_will_dirty_range(db, bufoff, tocpy, tx);
 
 		/*
 		 * XXX uiomove could block forever (eg.nfs-backed
@@ -1469,22 +1884,17 @@ dmu_return_arcbuf(arc_buf_t *buf)
  * dmu_write().
  */
 void
-dmu_assign_arcbuf(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
+dmu_assign_arcbuf_by_dnode(dnode_t *dn, uint64_t offset, arc_buf_t *buf,
     dmu_tx_t *tx)
 {
-	dmu_buf_impl_t *dbuf = (dmu_buf_impl_t *)handle;
-	dnode_t *dn;
 	dmu_buf_impl_t *db;
 	uint32_t blksz = (uint32_t)arc_buf_lsize(buf);
 	uint64_t blkid;
 
-	DB_DNODE_ENTER(dbuf);
-	dn = DB_DNODE(dbuf);
 	rw_enter(&dn->dn_struct_rwlock, RW_READER);
 	blkid = dbuf_whichblock(dn, 0, offset);
 	VERIFY((db = dbuf_hold(dn, blkid, FTAG)) != NULL);
 	rw_exit(&dn->dn_struct_rwlock);
-	DB_DNODE_EXIT(dbuf);
 
 	/*
 	 * We can only assign if the offset is aligned, the arc buf is the
@@ -1494,26 +1904,28 @@ dmu_assign_arcbuf(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
 		dbuf_assign_arcbuf(db, buf, tx);
 		dbuf_rele(db, FTAG);
 	} else {
-		objset_t *os;
-		uint64_t object;
-
 		/* compressed bufs must always be assignable to their dbuf */
 		ASSERT3U(arc_get_compression(buf), ==, ZIO_COMPRESS_OFF);
 		ASSERT(!(buf->b_flags & ARC_BUF_FLAG_COMPRESSED));
 
-		DB_DNODE_ENTER(dbuf);
-		dn = DB_DNODE(dbuf);
-		os = dn->dn_objset;
-		object = dn->dn_object;
-		DB_DNODE_EXIT(dbuf);
-
 		dbuf_rele(db, FTAG);
-		dmu_write(os, object, offset, blksz, buf->b_data, tx);
+		dmu_write_by_dnode(dn, offset, blksz, buf->b_data, tx);
 		dmu_return_arcbuf(buf);
 		XUIOSTAT_BUMP(xuiostat_wbuf_copied);
 	}
 }
 
+void
+dmu_assign_arcbuf(dmu_buf_t *handle, uint64_t offset, arc_buf_t *buf,
+    dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *dbuf = (dmu_buf_impl_t *)handle;
+
+	DB_DNODE_ENTER(dbuf);
+	dmu_assign_arcbuf_by_dnode(DB_DNODE(dbuf), offset, buf, tx);
+	DB_DNODE_EXIT(dbuf);
+}
+
 typedef struct {
 	dbuf_dirty_record_t	*dsa_dr;
 	dmu_sync_cb_t		*dsa_done;
@@ -1775,6 +2187,16 @@ dmu_sync(zio_t *pio, uint64_t txg, dmu_sync_cb_t *done, zgd_t *zgd)
 
 	ASSERT(dr->dr_next == NULL || dr->dr_next->dr_txg < txg);
 
+	if (dr->dt.dl.dr_partial != NULL) {
+		/*
+		 * Only part of the block is in this dirty record until it
+		 * is synced (see dmu_buf_will_dirty_range()), log the
+		 * current data of the dbuf instead.
+		 */
+		mutex_exit(&db->db_mtx);
+		return (dmu_sync_late_arrival(pio, os, done, zgd, &zp, &zb));
+	}
+
 	if (db->db_blkptr != NULL) {
 		/*
 		 * We need to fill in zgd_bp with the current blkptr so that
@@ -1918,6 +2340,7 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	    (wp & WP_SPILL));
 	enum zio_checksum checksum = os->os_checksum;
 	enum zio_compress compress = os->os_compress;
+	uint16_t complevel = os->os_complevel;
 	enum zio_checksum dedup_checksum = os->os_dedup_checksum;
 	boolean_t dedup = B_FALSE;
 	boolean_t nopwrite = B_FALSE;
@@ -1932,6 +2355,7 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	 *	 3. all other level 0 blocks
 	 */
 	if (ismd) {
+		complevel = 0;
 		if (zfs_mdcomp_disable) {
 			compress = ZIO_COMPRESS_EMPTY;
 		} else {
@@ -1971,8 +2395,12 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 		 * pipeline.
 		 */
 		compress = ZIO_COMPRESS_OFF;
+		complevel = 0;
 		checksum = ZIO_CHECKSUM_OFF;
 	} else {
+		/* A per-object algorithm drops the dataset's level. */
+		if (dn->dn_compress != ZIO_COMPRESS_INHERIT)
+			complevel = 0;
 		compress = zio_compress_select(os->os_spa, dn->dn_compress,
 		    compress);
 
@@ -2009,6 +2437,7 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 
 	zp->zp_checksum = checksum;
 	zp->zp_compress = compress;
+	zp->zp_complevel = complevel;
 	ASSERT3U(zp->zp_compress, !=, ZIO_COMPRESS_INHERIT);
 
 	zp->zp_type = (wp & WP_SPILL) ? dn->dn_bonustype : type;
@@ -2017,6 +2446,13 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	zp->zp_dedup = dedup;
 	zp->zp_dedup_verify = dedup && dedup_verify;
 	zp->zp_nopwrite = nopwrite;
+
+	/*
+	 * The io_num metadata of a zvol is read on every rebuild, so it is
+	 * kept with the metadata in the special class.
+	 */
+	zp->zp_special = (dn != NULL && dn->dn_object == ZVOL_META_OBJ &&
+	    dmu_objset_type(os) == DMU_OST_ZVOL);
 }
 
 /*
@@ -2261,9 +2697,12 @@ EXPORT_SYMBOL(dmu_free_long_range);
 EXPORT_SYMBOL(dmu_free_long_object);
 EXPORT_SYMBOL(dmu_read);
 EXPORT_SYMBOL(dmu_read_by_dnode);
+EXPORT_SYMBOL(dmu_read_compressed);
 EXPORT_SYMBOL(dmu_write);
 EXPORT_SYMBOL(dmu_write_by_dnode);
 EXPORT_SYMBOL(dmu_prealloc);
+EXPORT_SYMBOL(dmu_read_loan_by_dnode);
+EXPORT_SYMBOL(dmu_read_loan_return);
 EXPORT_SYMBOL(dmu_object_info);
 EXPORT_SYMBOL(dmu_object_info_from_dnode);
 EXPORT_SYMBOL(dmu_object_info_from_db);
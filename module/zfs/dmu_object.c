@@ -65,7 +65,7 @@ dmu_object_alloc_dnsize(objset_t *os, dmu_object_type_t ot, int blocksize,
 
 	kpreempt_disable();
 	cpuobj = &os->os_obj_next_percpu[CPU_SEQID %
-	    os->os_obj_next_percpu_len];
+	    os->os_obj_next_percpu_len].oon_object;
 	kpreempt_enable();
 
 	if (dn_slots == 0) {
@@ -78,6 +78,27 @@ int dmu_find_threads = 0;
  */
 int dmu_rescan_dnode_threshold = 1 << DN_MAX_INDBLKSHIFT;
 
+/*
+ * An objset which has been idle may issue this many milliseconds worth of
+ * its i/o limits at once before dmu_objset_io_throttle() delays it.
+ */
+int zfs_objset_io_limit_burst_ms = 100;
+
+/*
+ * Snapshots waiting in dmu_objset_snapshot_batched(), see there.
+ */
+typedef struct dmu_snap_batch_ent {
+	list_node_t	dsbe_node;
+	const char	*dsbe_name;	/* fs@snap */
+	int		dsbe_error;
+	boolean_t	dsbe_done;
+} dmu_snap_batch_ent_t;
+
+static kmutex_t dmu_snap_batch_lock;
+static kcondvar_t dmu_snap_batch_cv;
+static list_t dmu_snap_batch_list;
+static boolean_t dmu_snap_batch_busy;
+
 static void dmu_objset_find_dp_cb(void *arg);
 
 static void dmu_objset_upgrade(objset_t *os, dmu_objset_upgrade_cb_t cb);
@@ -87,11 +108,18 @@ void
 dmu_objset_init(void)
 {
 	rw_init(&os_lock, NULL, RW_DEFAULT, NULL);
+	mutex_init(&dmu_snap_batch_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&dmu_snap_batch_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&dmu_snap_batch_list, sizeof (dmu_snap_batch_ent_t),
+	    offsetof(dmu_snap_batch_ent_t, dsbe_node));
 }
 
 void
 dmu_objset_fini(void)
 {
+	list_destroy(&dmu_snap_batch_list);
+	cv_destroy(&dmu_snap_batch_cv);
+	mutex_destroy(&dmu_snap_batch_lock);
 	rw_destroy(&os_lock);
 }
 
@@ -185,8 +213,9 @@ compression_changed_cb(void *arg, uint64_t newval)
 	 */
 	ASSERT(newval != ZIO_COMPRESS_INHERIT);
 
-	os->os_compress = zio_compress_select(os->os_spa, newval,
-	    ZIO_COMPRESS_ON);
+	os->os_compress = zio_compress_select(os->os_spa,
+	    ZIO_COMPRESS_RAW(newval), ZIO_COMPRESS_ON);
+	os->os_complevel = ZIO_COMPRESS_LEVEL(newval);
 }
 
 static void
@@ -327,6 +356,38 @@ recordsize_changed_cb(void *arg, uint64_t newval)
 	os->os_recordsize = newval;
 }
 
+static void
+read_iops_limit_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_io_bucket[OS_IO_READ_IOPS].oib_rate = newval;
+}
+
+static void
+write_iops_limit_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_io_bucket[OS_IO_WRITE_IOPS].oib_rate = newval;
+}
+
+static void
+read_bw_limit_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_io_bucket[OS_IO_READ_BW].oib_rate = newval;
+}
+
+static void
+write_bw_limit_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_io_bucket[OS_IO_WRITE_BW].oib_rate = newval;
+}
+
 void
 dmu_objset_byteswap(void *buf, size_t size)
 {
@@ -505,6 +566,27 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 				    zfs_prop_to_name(ZFS_PROP_DNODESIZE),
 				    dnodesize_changed_cb, os);
 			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_READ_IOPS_LIMIT),
+				    read_iops_limit_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(
+				    ZFS_PROP_WRITE_IOPS_LIMIT),
+				    write_iops_limit_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_READ_BW_LIMIT),
+				    read_bw_limit_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_WRITE_BW_LIMIT),
+				    write_bw_limit_changed_cb, os);
+			}
 		}
 		if (needlock)
 			dsl_pool_config_exit(dmu_objset_pool(os), FTAG);
@@ -547,9 +629,12 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	mutex_init(&os->os_userused_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&os->os_obj_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&os->os_user_ptr_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&os->os_io_lock, NULL, MUTEX_DEFAULT, NULL);
+	rw_init(&os->os_pinned_lock, NULL, RW_DEFAULT, NULL);
 	os->os_obj_next_percpu_len = boot_ncpus;
 	os->os_obj_next_percpu = kmem_zalloc(os->os_obj_next_percpu_len *
 	    sizeof (os->os_obj_next_percpu[0]), KM_SLEEP);
+	dbuf_stats_objset_init(os);
 
 	dnode_special_open(os, &os->os_phys->os_meta_dnode,
 	    DMU_META_DNODE_OBJECT, &os->os_meta_dnode);
@@ -740,6 +825,121 @@ dmu_objset_disown(objset_t *os, void *tag)
 	dsl_dataset_disown(os->os_dsl_dataset, tag);
 }
 
+/*
+ * Keep a hold on a hot object's dnode for as long as the objset stays
+ * open, so that dnode_hold() of it can skip the meta dnode dbuf and the
+ * dnode_children slot locks and just add a reference.  Meant for the few
+ * objects every I/O to a dataset touches, such as ZVOL_OBJ and
+ * ZVOL_META_OBJ, which are never freed; a pinned object can't be freed
+ * and reallocated until it is unpinned.  The pins are dropped when the
+ * objset is evicted.
+ */
+int
+dmu_objset_pin_dnode(objset_t *os, uint64_t object)
+{
+	dnode_t *dn;
+	int err, i;
+
+	if (DMU_OBJECT_IS_SPECIAL(object))
+		return (SET_ERROR(EINVAL));
+
+	err = dnode_hold(os, object, os, &dn);
+	if (err != 0)
+		return (err);
+
+	rw_enter(&os->os_pinned_lock, RW_WRITER);
+	for (i = 0; i < os->os_pinned_count; i++) {
+		if (os->os_pinned[i]->dn_object == object) {
+			rw_exit(&os->os_pinned_lock);
+			dnode_rele(dn, os);
+			return (0);
+		}
+	}
+	if (os->os_pinned_count == DMU_OBJSET_PINNED_DNODES) {
+		rw_exit(&os->os_pinned_lock);
+		dnode_rele(dn, os);
+		return (SET_ERROR(ENOSPC));
+	}
+	os->os_pinned[os->os_pinned_count++] = dn;
+	rw_exit(&os->os_pinned_lock);
+
+	return (0);
+}
+
+void
+dmu_objset_unpin_dnode(objset_t *os, uint64_t object)
+{
+	dnode_t *dn = NULL;
+	int i;
+
+	rw_enter(&os->os_pinned_lock, RW_WRITER);
+	for (i = 0; i < os->os_pinned_count; i++) {
+		if (os->os_pinned[i]->dn_object == object) {
+			dn = os->os_pinned[i];
+			os->os_pinned[i] = os->os_pinned[--os->os_pinned_count];
+			os->os_pinned[os->os_pinned_count] = NULL;
+			break;
+		}
+	}
+	rw_exit(&os->os_pinned_lock);
+
+	if (dn != NULL)
+		dnode_rele(dn, os);
+}
+
+static void
+dmu_objset_unpin_all(objset_t *os)
+{
+	dnode_t *pinned[DMU_OBJSET_PINNED_DNODES];
+	int i, n;
+
+	rw_enter(&os->os_pinned_lock, RW_WRITER);
+	n = os->os_pinned_count;
+	for (i = 0; i < n; i++) {
+		pinned[i] = os->os_pinned[i];
+		os->os_pinned[i] = NULL;
+	}
+	os->os_pinned_count = 0;
+	rw_exit(&os->os_pinned_lock);
+
+	for (i = 0; i < n; i++)
+		dnode_rele(pinned[i], os);
+}
+
+/*
+ * dnode_hold() fast path: add a hold to a pinned dnode of object, if
+ * there is one and the object is still allocated.
+ */
+boolean_t
+dmu_objset_hold_pinned(objset_t *os, uint64_t object, void *tag,
+    dnode_t **dnp)
+{
+	dnode_t *dn;
+	int i;
+
+	rw_enter(&os->os_pinned_lock, RW_READER);
+	for (i = 0; i < os->os_pinned_count; i++) {
+		dn = os->os_pinned[i];
+		if (dn->dn_object != object)
+			continue;
+
+		mutex_enter(&dn->dn_mtx);
+		if (dn->dn_type == DMU_OT_NONE || dn->dn_free_txg != 0) {
+			mutex_exit(&dn->dn_mtx);
+			break;
+		}
+		VERIFY3U(refcount_add(&dn->dn_holds, tag), >, 1);
+		mutex_exit(&dn->dn_mtx);
+		rw_exit(&os->os_pinned_lock);
+
+		*dnp = dn;
+		return (B_TRUE);
+	}
+	rw_exit(&os->os_pinned_lock);
+
+	return (B_FALSE);
+}
+
 void
 dmu_objset_evict_dbufs(objset_t *os)
 {
@@ -810,6 +1010,7 @@ dmu_objset_evict(objset_t *os)
 	if (os->os_sa)
 		sa_tear_down(os);
 
+	dmu_objset_unpin_all(os);
 	dmu_objset_evict_dbufs(os);
 
 	mutex_enter(&os->os_lock);
@@ -847,12 +1048,15 @@ dmu_objset_evict_done(objset_t *os)
 
 	kmem_free(os->os_obj_next_percpu,
 	    os->os_obj_next_percpu_len * sizeof (os->os_obj_next_percpu[0]));
+	dbuf_stats_objset_destroy(os);
 
 	mutex_destroy(&os->os_lock);
 	mutex_destroy(&os->os_userused_lock);
 	mutex_destroy(&os->os_obj_lock);
 	mutex_destroy(&os->os_user_ptr_lock);
+	mutex_destroy(&os->os_io_lock);
 	mutex_destroy(&os->os_upgrade_lock);
+	rw_destroy(&os->os_pinned_lock);
 	for (int i = 0; i < TXG_SIZE; i++) {
 		multilist_destroy(os->os_dirty_dnodes[i]);
 	}
@@ -866,6 +1070,58 @@ dmu_objset_snap_cmtime(objset_t *os)
 	return (dsl_dir_snap_cmtime(os->os_dsl_dataset->ds_dir));
 }
 
+/*
+ * Take cost from the bucket and return when the i/o may start.  A bucket
+ * which has been idle holds at most zfs_objset_io_limit_burst_ms worth of
+ * its rate.
+ */
+static hrtime_t
+dmu_objset_io_bucket_take(objset_io_bucket_t *oib, uint64_t cost,
+    hrtime_t now)
+{
+	uint64_t rate = oib->oib_rate;
+	hrtime_t start;
+
+	if (rate == 0)
+		return (0);
+
+	start = MAX(oib->oib_next,
+	    now - MSEC2NSEC(zfs_objset_io_limit_burst_ms));
+	oib->oib_next = start + (hrtime_t)(cost * NANOSEC / rate);
+
+	return (start);
+}
+
+/*
+ * Delay nios i/os of size bytes in total until the read or write limits
+ * of the objset allow them.  The limits are token buckets, one for the
+ * i/os and one for the bytes per second, set by the io.openebs:*_limit
+ * properties.  Callers throttle before they assign a tx or take locks the
+ * txg sync needs, and before any zio is issued, so a throttled objset does
+ * not hold up the pipeline which all objsets share.
+ */
+void
+dmu_objset_io_throttle(objset_t *os, boolean_t write, uint64_t nios,
+    uint64_t size)
+{
+	objset_io_bucket_t *iops, *bw;
+	hrtime_t now, wakeup;
+
+	iops = &os->os_io_bucket[write ? OS_IO_WRITE_IOPS : OS_IO_READ_IOPS];
+	bw = &os->os_io_bucket[write ? OS_IO_WRITE_BW : OS_IO_READ_BW];
+	if (iops->oib_rate == 0 && bw->oib_rate == 0)
+		return;
+
+	now = gethrtime();
+	mutex_enter(&os->os_io_lock);
+	wakeup = MAX(dmu_objset_io_bucket_take(iops, nios, now),
+	    dmu_objset_io_bucket_take(bw, size, now));
+	mutex_exit(&os->os_io_lock);
+
+	if (wakeup > now)
+		zfs_sleep_until(wakeup);
+}
+
 /* called from dsl for meta-objset */
 objset_t *
 dmu_objset_create_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
@@ -1141,6 +1397,125 @@ dmu_objset_snapshot_one(const char *fsname, const char *snapname)
 	return (err);
 }
 
+/*
+ * First half of a snapshot taken while the caller holds off writes, to
+ * be called before they are held off.  It checks that fsname exists and
+ * waits for the open txg to sync, so that the txg the snapshot is then
+ * created in only has to carry the writes made since, and the writes
+ * are held off for a short sync rather than for a full one.
+ */
+int
+dmu_objset_snapshot_prepare(const char *fsname)
+{
+	dsl_pool_t *dp;
+	dsl_dataset_t *ds;
+	int error;
+
+	error = dsl_pool_hold(fsname, FTAG, &dp);
+	if (error != 0)
+		return (error);
+	error = dsl_dataset_hold(dp, fsname, FTAG, &ds);
+	if (error != 0) {
+		dsl_pool_rele(dp, FTAG);
+		return (error);
+	}
+	dsl_dataset_rele(ds, FTAG);
+
+	/* Keep the pool open across the wait, without the config lock */
+	dsl_pool_config_exit(dp, FTAG);
+	txg_wait_synced(dp, 0);
+	spa_close(dp->dp_spa, FTAG);
+
+	return (0);
+}
+
+static boolean_t
+dmu_snap_same_pool(const char *a, const char *b)
+{
+	size_t len = strcspn(a, "/@");
+
+	return (strncmp(a, b, len) == 0 && strchr("/@", b[len]) != NULL &&
+	    b[len] != '\0');
+}
+
+/*
+ * Like dmu_objset_snapshot_one(), but snapshots requested while another
+ * batch is being synced are taken together by the next batch, in a
+ * single sync task, so that snapshotting many volumes of a pool at once
+ * costs about one txg sync rather than one each.  Only snapshots of the
+ * same pool are batched.  Since a sync task is all or nothing, a batch
+ * that fails is retried one snapshot at a time to give each its own
+ * error.
+ */
+int
+dmu_objset_snapshot_batched(const char *fsname, const char *snapname)
+{
+	dmu_snap_batch_ent_t ent, *e, *next;
+	list_t batch;
+	nvlist_t *snaps;
+	int error, n;
+
+	ent.dsbe_name = kmem_asprintf("%s@%s", fsname, snapname);
+	ent.dsbe_error = 0;
+	ent.dsbe_done = B_FALSE;
+	list_create(&batch, sizeof (dmu_snap_batch_ent_t),
+	    offsetof(dmu_snap_batch_ent_t, dsbe_node));
+
+	mutex_enter(&dmu_snap_batch_lock);
+	list_insert_tail(&dmu_snap_batch_list, &ent);
+	while (!ent.dsbe_done) {
+		if (dmu_snap_batch_busy) {
+			cv_wait(&dmu_snap_batch_cv, &dmu_snap_batch_lock);
+			continue;
+		}
+
+		/* Lead the batch of the pool of the oldest request */
+		dmu_snap_batch_busy = B_TRUE;
+		snaps = fnvlist_alloc();
+		n = 0;
+		e = list_head(&dmu_snap_batch_list);
+		for (; e != NULL; e = next) {
+			next = list_next(&dmu_snap_batch_list, e);
+			if (n != 0 && !dmu_snap_same_pool(
+			    ((dmu_snap_batch_ent_t *)list_head(&batch))->
+			    dsbe_name, e->dsbe_name))
+				continue;
+			list_remove(&dmu_snap_batch_list, e);
+			list_insert_tail(&batch, e);
+			fnvlist_add_boolean(snaps, e->dsbe_name);
+			n++;
+		}
+		mutex_exit(&dmu_snap_batch_lock);
+
+		error = dsl_dataset_snapshot(snaps, NULL, NULL);
+		for (e = list_head(&batch); e != NULL;
+		    e = list_next(&batch, e)) {
+			if (error == 0 || n == 1) {
+				e->dsbe_error = error;
+			} else {
+				nvlist_t *one = fnvlist_alloc();
+
+				fnvlist_add_boolean(one, e->dsbe_name);
+				e->dsbe_error = dsl_dataset_snapshot(one,
+				    NULL, NULL);
+				fnvlist_free(one);
+			}
+		}
+		fnvlist_free(snaps);
+
+		mutex_enter(&dmu_snap_batch_lock);
+		while ((e = list_remove_head(&batch)) != NULL)
+			e->dsbe_done = B_TRUE;
+		dmu_snap_batch_busy = B_FALSE;
+		cv_broadcast(&dmu_snap_batch_cv);
+	}
+	mutex_exit(&dmu_snap_batch_lock);
+
+	list_destroy(&batch);
+	strfree((char *)ent.dsbe_name);
+	return (ent.dsbe_error);
+}
+
 static void
 dmu_objset_upgrade_task_cb(void *data)
 {
@@ -2483,7 +2858,7 @@ dmu_objset_willuse_space(objset_t *os, int64_t space, dmu_tx_t *tx)
 
 	if (ds != NULL) {
 		dsl_dir_willuse_space(ds->ds_dir, aspace, tx);
-		dsl_pool_dirty_space(dmu_tx_pool(tx), space, tx);
+		dsl_pool_dirty_space(dmu_tx_pool(tx), os, space, tx);
 	}
 }
 
@@ -2509,6 +2884,7 @@ EXPORT_SYMBOL(dmu_objset_find);
 EXPORT_SYMBOL(dmu_objset_byteswap);
 EXPORT_SYMBOL(dmu_objset_evict_dbufs);
 EXPORT_SYMBOL(dmu_objset_snap_cmtime);
+EXPORT_SYMBOL(dmu_objset_io_throttle);
 EXPORT_SYMBOL(dmu_objset_dnodesize);
 
 EXPORT_SYMBOL(dmu_objset_sync);
@@ -2526,4 +2902,8 @@ EXPORT_SYMBOL(dmu_objset_userobjused_enabled);
 EXPORT_SYMBOL(dmu_objset_userobjspace_upgrade);
 EXPORT_SYMBOL(dmu_objset_userobjspace_upgradable);
 EXPORT_SYMBOL(dmu_objset_userobjspace_present);
+
+module_param(zfs_objset_io_limit_burst_ms, int, 0644);
+MODULE_PARM_DESC(zfs_objset_io_limit_burst_ms,
+	"Burst allowed by the objset i/o limits, in milliseconds");
 #endif
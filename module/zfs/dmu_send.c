@@ -62,7 +62,9 @@
 /* Set this tunable to TRUE to replace corrupt data with 0x2f5baddb10c */
 int zfs_send_corrupt_data = B_FALSE;
 int zfs_send_queue_length = SPA_MAXBLOCKSIZE;
+int zfs_send_prefetch_data = B_TRUE;
 int zfs_recv_queue_length = SPA_MAXBLOCKSIZE;
+int zfs_recv_write_batch_size = 8 * 1024 * 1024;
 /* Set this tunable to FALSE to disable setting of DRR_FLAG_FREERECORDS */
 int zfs_send_set_freerecords_bit = B_TRUE;
 
@@ -83,8 +85,16 @@ struct send_thread_arg {
 	int		error_code;
 	boolean_t	cancel;
 	zbookmark_phys_t resume;
+	uint64_t	featureflags;	/* of the stream, for send_read_flags */
 };
 
+/*
+ * A block found by the traverse thread.  The data of a level-0 block of a
+ * regular object is read as it is queued, so that the reads of everything
+ * in the queue run in parallel while the stream is written out in order.
+ * The reader leaves the buffer, or the error, in the record and wakes
+ * up do_dump() when it gets to it.
+ */
 struct send_block_record {
 	boolean_t		eos_marker; /* Marks the end of the stream */
 	blkptr_t		bp;
@@ -92,6 +102,12 @@ struct send_block_record {
 	uint8_t			indblkshift;
 	uint16_t		datablkszsec;
 	bqueue_node_t		ln;
+	boolean_t		read_issued;
+	boolean_t		read_done;	/* protected by read_lock */
+	int			read_err;
+	arc_buf_t		*abuf;
+	kmutex_t		read_lock;
+	kcondvar_t		read_cv;
 };
 
 typedef struct dump_bytes_io {
@@ -565,6 +581,75 @@ backup_do_embed(dmu_sendarg_t *dsp, const blkptr_t *bp)
 	return (B_FALSE);
 }
 
+/*
+ * The flags to read a level-0 block of a regular object with.  We should
+ * only request compressed data from the ARC if all the following are true:
+ *  - stream compression was requested
+ *  - we aren't splitting large blocks into smaller chunks
+ *  - the data won't need to be byteswapped before sending
+ *  - this isn't an embedded block
+ *  - this isn't metadata (if receiving on a different endian
+ *    system it can be byteswapped more easily)
+ */
+static enum zio_flag
+send_read_flags(uint64_t featureflags, const blkptr_t *bp)
+{
+	boolean_t split_large_blocks =
+	    BP_GET_LSIZE(bp) > SPA_OLD_MAXBLOCKSIZE &&
+	    !(featureflags & DMU_BACKUP_FEATURE_LARGE_BLOCKS);
+	enum zio_flag zioflags = ZIO_FLAG_CANFAIL;
+
+	if ((featureflags & DMU_BACKUP_FEATURE_COMPRESSED) &&
+	    !split_large_blocks && !BP_SHOULD_BYTESWAP(bp) &&
+	    !BP_IS_EMBEDDED(bp) && !DMU_OT_IS_METADATA(BP_GET_TYPE(bp)))
+		zioflags |= ZIO_FLAG_RAW;
+
+	return (zioflags);
+}
+
+static void
+send_read_done(zio_t *zio, arc_buf_t *buf, void *arg)
+{
+	struct send_block_record *record = arg;
+
+	mutex_enter(&record->read_lock);
+	if (zio != NULL && zio->io_error != 0) {
+		arc_buf_destroy(buf, record);
+		record->read_err = zio->io_error;
+	} else {
+		record->abuf = buf;
+	}
+	record->read_done = B_TRUE;
+	cv_signal(&record->read_cv);
+	mutex_exit(&record->read_lock);
+}
+
+/*
+ * Wait for the read issued by send_cb(), and take over its buffer, which
+ * is held with the record as its tag.
+ */
+static int
+send_read_wait(struct send_block_record *record, arc_buf_t **abufp)
+{
+	int err;
+
+	ASSERT(record->read_issued);
+
+	mutex_enter(&record->read_lock);
+	while (!record->read_done)
+		cv_wait(&record->read_cv, &record->read_lock);
+	mutex_exit(&record->read_lock);
+
+	*abufp = record->abuf;
+	err = record->read_err;
+	record->abuf = NULL;
+	record->read_issued = B_FALSE;
+	mutex_destroy(&record->read_lock);
+	cv_destroy(&record->read_cv);
+
+	return (err);
+}
+
 /*
  * This is the callback function to traverse_dataset that acts as the worker
  * thread for dmu_send_impl.
@@ -599,6 +684,23 @@ send_cb(spa_t *spa, zilog_t *zilog, const blkptr_t *bp,
 	record->indblkshift = dnp->dn_indblkshift;
 	record->datablkszsec = dnp->dn_datablkszsec;
 	record_size = dnp->dn_datablkszsec << SPA_MINBLOCKSHIFT;
+
+	if (zfs_send_prefetch_data && zb->zb_level == 0 &&
+	    !DMU_OBJECT_IS_SPECIAL(zb->zb_object) &&
+	    !BP_IS_HOLE(bp) && !BP_IS_EMBEDDED(bp) &&
+	    BP_GET_TYPE(bp) != DMU_OT_DNODE && BP_GET_TYPE(bp) != DMU_OT_SA &&
+	    BP_GET_TYPE(bp) != DMU_OT_OBJSET &&
+	    BP_GET_LSIZE(bp) == record_size) {
+		arc_flags_t aflags = ARC_FLAG_NOWAIT;
+
+		mutex_init(&record->read_lock, NULL, MUTEX_DEFAULT, NULL);
+		cv_init(&record->read_cv, NULL, CV_DEFAULT, NULL);
+		record->read_issued = B_TRUE;
+		(void) arc_read(NULL, spa, bp, send_read_done, record,
+		    ZIO_PRIORITY_ASYNC_READ,
+		    send_read_flags(sta->featureflags, bp), &aflags, zb);
+	}
+
 	bqueue_enqueue(&sta->q, record, record_size);
 
 	return (err);
@@ -714,6 +816,7 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 		/* it's a level-0 block of a regular object */
 		arc_flags_t aflags = ARC_FLAG_WAIT;
 		arc_buf_t *abuf;
+		void *tag = &abuf;
 		int blksz = dblkszsec << SPA_MINBLOCKSHIFT;
 		uint64_t offset;
 
@@ -724,20 +827,6 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 		 */
 		boolean_t split_large_blocks = blksz > SPA_OLD_MAXBLOCKSIZE &&
 		    !(dsa->dsa_featureflags & DMU_BACKUP_FEATURE_LARGE_BLOCKS);
-		/*
-		 * We should only request compressed data from the ARC if all
-		 * the following are true:
-		 *  - stream compression was requested
-		 *  - we aren't splitting large blocks into smaller chunks
-		 *  - the data won't need to be byteswapped before sending
-		 *  - this isn't an embedded block
-		 *  - this isn't metadata (if receiving on a different endian
-		 *    system it can be byteswapped more easily)
-		 */
-		boolean_t request_compressed =
-		    (dsa->dsa_featureflags & DMU_BACKUP_FEATURE_COMPRESSED) &&
-		    !split_large_blocks && !BP_SHOULD_BYTESWAP(bp) &&
-		    !BP_IS_EMBEDDED(bp) && !DMU_OT_IS_METADATA(BP_GET_TYPE(bp));
 
 		ASSERT0(zb->zb_level);
 		ASSERT(zb->zb_object > dsa->dsa_resume_object ||
@@ -746,16 +835,22 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 
 		ASSERT3U(blksz, ==, BP_GET_LSIZE(bp));
 
-		enum zio_flag zioflags = ZIO_FLAG_CANFAIL;
-		if (request_compressed)
-			zioflags |= ZIO_FLAG_RAW;
-
-		if (arc_read(NULL, spa, bp, arc_getbuf_func, &abuf,
-		    ZIO_PRIORITY_ASYNC_READ, zioflags, &aflags, zb) != 0) {
+		if (data->read_issued) {
+			err = send_read_wait(data, &abuf);
+			tag = data;
+		} else {
+			err = arc_read(NULL, spa, bp, arc_getbuf_func, &abuf,
+			    ZIO_PRIORITY_ASYNC_READ,
+			    send_read_flags(dsa->dsa_featureflags, bp),
+			    &aflags, zb);
+		}
+		if (err != 0) {
+			err = 0;
 			if (zfs_send_corrupt_data) {
 				/* Send a block filled with 0x"zfs badd bloc" */
 				abuf = arc_alloc_buf(spa, &abuf, ARC_BUFC_DATA,
 				    blksz);
+				tag = &abuf;
 				uint64_t *ptr;
 				for (ptr = abuf->b_data;
 				    (char *)ptr < (char *)abuf->b_data + blksz;
@@ -785,7 +880,7 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 			    blksz, arc_buf_size(abuf), bp,
 			    abuf->b_data);
 		}
-		arc_buf_destroy(abuf, &abuf);
+		arc_buf_destroy(abuf, tag);
 	}
 
 	ASSERT(err == 0 || err == EINTR);
@@ -793,12 +888,20 @@ do_dump(dmu_sendarg_t *dsa, struct send_block_record *data)
 }
 
 /*
- * Pop the new data off the queue, and free the old data.
+ * Pop the new data off the queue, and free the old data, along with the
+ * data read for it if do_dump() didn't get to use it.
  */
 static struct send_block_record *
 get_next_record(bqueue_t *bq, struct send_block_record *data)
 {
 	struct send_block_record *tmp = bqueue_dequeue(bq);
+
+	if (data->read_issued) {
+		arc_buf_t *abuf;
+
+		if (send_read_wait(data, &abuf) == 0)
+			arc_buf_destroy(abuf, data);
+	}
 	kmem_free(data, sizeof (*data));
 	return (tmp);
 }
@@ -953,6 +1056,7 @@ dmu_send_impl(void *tag, dsl_pool_t *dp, dsl_dataset_t *to_ds,
 	to_arg.ds = to_ds;
 	to_arg.fromtxg = fromtxg;
 	to_arg.flags = TRAVERSE_PRE | TRAVERSE_PREFETCH;
+	to_arg.featureflags = featureflags;
 	(void) thread_create(NULL, 0, send_traverse_thread, &to_arg, 0, curproc,
 	    TS_RUN, minclsyspri);
 
@@ -1867,6 +1971,7 @@ struct receive_record_arg {
 	uint64_t bytes_read; /* bytes read from stream when record created */
 	boolean_t eos_marker; /* Marks the end of the stream */
 	bqueue_node_t node;
+	list_node_t batch_node; /* on write_batch */
 };
 
 struct receive_writer_arg {
@@ -1890,6 +1995,11 @@ struct receive_writer_arg {
 	uint64_t last_offset;
 	uint64_t max_object; /* highest object ID referenced in stream */
 	uint64_t bytes_read; /* bytes read when current record created */
+	/*
+	 * Consecutive DRR_WRITE records to one object, which are applied in
+	 * a single tx, see receive_write_batch_flush().
+	 */
+	list_t write_batch;
 };
 
 struct objlist {
@@ -1995,6 +2105,70 @@ receive_read(struct receive_arg *ra, int len, void *buf)
 	return (0);
 }
 
+/*
+ * Read a record payload and the header of the record that follows it.  In
+ * userland the two are read with a single readv() of the stream where
+ * possible: nearly every record has a payload, so this halves the number
+ * of system calls made on the stream, which is usually a socket.  The
+ * header is read unconditionally after a payload anyway, so this never
+ * reads past the end of the stream.  If the payload can not be read, its
+ * error is returned; an error reading the header is returned in *herrp.
+ */
+static int
+receive_read_pair(struct receive_arg *ra, int len, void *buf, int hlen,
+    void *hbuf, int *herrp)
+{
+#ifdef _KERNEL
+	int err;
+
+	if ((err = receive_read(ra, len, buf)) != 0)
+		return (err);
+	*herrp = receive_read(ra, hlen, hbuf);
+	return (0);
+#else
+	int done = 0;
+
+	ASSERT0(len % 8);
+	ASSERT0(hlen % 8);
+
+	while (done < len + hlen) {
+		struct iovec iov[2];
+		int iovcnt = 0;
+		ssize_t resid;
+
+		if (done < len) {
+			iov[iovcnt].iov_base = (char *)buf + done;
+			iov[iovcnt++].iov_len = len - done;
+		}
+		iov[iovcnt].iov_base = (char *)hbuf + MAX(done - len, 0);
+		iov[iovcnt++].iov_len = hlen - MAX(done - len, 0);
+
+		ra->err = vn_readv(ra->vp, iov, iovcnt, ra->voff, &resid);
+		if (resid == len + hlen - done) {
+			/*
+			 * Note: ECKSUM indicates that the receive
+			 * was interrupted and can potentially be resumed.
+			 */
+			ra->err = SET_ERROR(ECKSUM);
+		}
+		ra->voff += len + hlen - done - resid;
+		if (done < len && len + hlen - resid >= len)
+			ra->bytes_read += len;
+		done = len + hlen - resid;
+		if (ra->err != 0) {
+			if (done < len)
+				return (ra->err);
+			*herrp = ra->err;
+			return (0);
+		}
+	}
+
+	ra->bytes_read += hlen;
+	*herrp = 0;
+	return (0);
+#endif
+}
+
 noinline static void
 byteswap_record(dmu_replay_record_t *drr)
 {
@@ -2274,13 +2448,14 @@ receive_freeobjects(struct receive_writer_arg *rwa,
 	return (0);
 }
 
+/*
+ * Check a DRR_WRITE record and add it to the write batch, which takes
+ * over the record and its arc_buf.
+ */
 noinline static int
-receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
-    arc_buf_t *abuf)
+receive_write(struct receive_writer_arg *rwa, struct receive_record_arg *rrd)
 {
-	dmu_tx_t *tx;
-	dmu_buf_t *bonus;
-	int err;
+	struct drr_write *drrw = &rrd->header.drr_u.drr_write;
 
 	if (drrw->drr_offset + drrw->drr_logical_size < drrw->drr_offset ||
 	    !DMU_OT_IS_VALID(drrw->drr_type))
@@ -2304,26 +2479,108 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 	if (dmu_object_info(rwa->os, drrw->drr_object, NULL) != 0)
 		return (SET_ERROR(EINVAL));
 
-	tx = dmu_tx_create(rwa->os);
-
-	dmu_tx_hold_write(tx, drrw->drr_object,
-	    drrw->drr_offset, drrw->drr_logical_size);
-	err = dmu_tx_assign(tx, TXG_WAIT);
-	if (err != 0) {
-		dmu_tx_abort(tx);
-		return (err);
-	}
 	if (rwa->byteswap) {
 		dmu_object_byteswap_t byteswap =
 		    DMU_OT_BYTESWAP(drrw->drr_type);
-		dmu_ot_byteswap[byteswap].ob_func(abuf->b_data,
+		dmu_ot_byteswap[byteswap].ob_func(rrd->write_buf->b_data,
 		    DRR_WRITE_PAYLOAD_SIZE(drrw));
 	}
 
+	list_insert_tail(&rwa->write_batch, rrd);
+
+	return (0);
+}
+
+/*
+ * Whether rrd can be added to the write batch: it must write to the same
+ * object as the batch, and the batch must still span no more than
+ * zfs_recv_write_batch_size bytes with it.
+ */
+static boolean_t
+receive_write_batch_fits(struct receive_writer_arg *rwa,
+    struct receive_record_arg *rrd)
+{
+	struct receive_record_arg *first = list_head(&rwa->write_batch);
+	struct drr_write *drrw = &rrd->header.drr_u.drr_write;
+	struct drr_write *first_drrw;
+	uint64_t limit = MIN(MAX(zfs_recv_write_batch_size, 0),
+	    DMU_MAX_ACCESS / 2);
+
+	if (first == NULL)
+		return (B_TRUE);
+	if (rrd->header.drr_type != DRR_WRITE)
+		return (B_FALSE);
+
+	first_drrw = &first->header.drr_u.drr_write;
+	return (drrw->drr_object == first_drrw->drr_object &&
+	    drrw->drr_offset >= first_drrw->drr_offset &&
+	    drrw->drr_offset + drrw->drr_logical_size -
+	    first_drrw->drr_offset <= limit);
+}
+
+/*
+ * Free the records of the write batch, returning the arc_bufs that
+ * weren't assigned.
+ */
+static void
+receive_write_batch_free(struct receive_writer_arg *rwa)
+{
+	struct receive_record_arg *rrd;
+
+	while ((rrd = list_remove_head(&rwa->write_batch)) != NULL) {
+		if (rrd->write_buf != NULL)
+			dmu_return_arcbuf(rrd->write_buf);
+		kmem_free(rrd, sizeof (*rrd));
+	}
+}
+
+/*
+ * Apply the write batch in one tx, instead of taking a tx for each of
+ * its records.
+ */
+static int
+receive_write_batch_flush(struct receive_writer_arg *rwa)
+{
+	struct receive_record_arg *first = list_head(&rwa->write_batch);
+	struct receive_record_arg *last = list_tail(&rwa->write_batch);
+	struct receive_record_arg *rrd;
+	struct drr_write *first_drrw, *last_drrw;
+	dmu_buf_t *bonus;
+	dmu_tx_t *tx;
+	int err;
+
+	if (first == NULL)
+		return (0);
+
+	first_drrw = &first->header.drr_u.drr_write;
+	last_drrw = &last->header.drr_u.drr_write;
+	ASSERT3U(rwa->bytes_read, ==, last->bytes_read);
+
 	/* use the bonus buf to look up the dnode in dmu_assign_arcbuf */
-	if (dmu_bonus_hold(rwa->os, drrw->drr_object, FTAG, &bonus) != 0)
+	if (dmu_bonus_hold(rwa->os, first_drrw->drr_object, FTAG,
+	    &bonus) != 0) {
+		receive_write_batch_free(rwa);
 		return (SET_ERROR(EINVAL));
-	dmu_assign_arcbuf(bonus, drrw->drr_offset, abuf, tx);
+	}
+
+	tx = dmu_tx_create(rwa->os);
+	dmu_tx_hold_write(tx, first_drrw->drr_object, first_drrw->drr_offset,
+	    last_drrw->drr_offset + last_drrw->drr_logical_size -
+	    first_drrw->drr_offset);
+	err = dmu_tx_assign(tx, TXG_WAIT);
+	if (err != 0) {
+		dmu_tx_abort(tx);
+		dmu_buf_rele(bonus, FTAG);
+		receive_write_batch_free(rwa);
+		return (err);
+	}
+
+	for (rrd = first; rrd != NULL;
+	    rrd = list_next(&rwa->write_batch, rrd)) {
+		dmu_assign_arcbuf(bonus, rrd->header.drr_u.drr_write.drr_offset,
+		    rrd->write_buf, tx);
+		rrd->write_buf = NULL;
+	}
 
 	/*
 	 * Note: If the receive fails, we want the resume stream to start
@@ -2331,9 +2588,11 @@ receive_write(struct receive_writer_arg *rwa, struct drr_write *drrw,
 	 * to the next record), so that we can verify that we are
 	 * resuming from the correct location.
 	 */
-	save_resume_state(rwa, drrw->drr_object, drrw->drr_offset, tx);
+	save_resume_state(rwa, last_drrw->drr_object, last_drrw->drr_offset,
+	    tx);
 	dmu_tx_commit(tx);
 	dmu_buf_rele(bonus, FTAG);
+	receive_write_batch_free(rwa);
 
 	return (0);
 }
@@ -2552,30 +2811,38 @@ receive_cksum(struct receive_arg *ra, int len, void *buf)
 static int
 receive_read_payload_and_next_header(struct receive_arg *ra, int len, void *buf)
 {
-	int err;
+	int err, herr;
 	zio_cksum_t cksum_orig;
 	zio_cksum_t *cksump;
 
+	ra->next_rrd = kmem_zalloc(sizeof (*ra->next_rrd), KM_SLEEP);
 	if (len != 0) {
 		ASSERT3U(len, <=, SPA_MAXBLOCKSIZE);
-		err = receive_read(ra, len, buf);
-		if (err != 0)
+		err = receive_read_pair(ra, len, buf,
+		    sizeof (ra->next_rrd->header), &ra->next_rrd->header,
+		    &herr);
+		if (err != 0) {
+			kmem_free(ra->next_rrd, sizeof (*ra->next_rrd));
+			ra->next_rrd = NULL;
 			return (err);
+		}
 		receive_cksum(ra, len, buf);
 
 		/* note: rrd is NULL when reading the begin record's payload */
 		if (ra->rrd != NULL) {
 			ra->rrd->payload = buf;
 			ra->rrd->payload_size = len;
-			ra->rrd->bytes_read = ra->bytes_read;
+			ra->rrd->bytes_read = ra->bytes_read -
+			    (herr == 0 ? sizeof (ra->next_rrd->header) : 0);
 		}
+	} else {
+		herr = receive_read(ra, sizeof (ra->next_rrd->header),
+		    &ra->next_rrd->header);
 	}
 
 	ra->prev_cksum = ra->cksum;
 
-	ra->next_rrd = kmem_zalloc(sizeof (*ra->next_rrd), KM_SLEEP);
-	err = receive_read(ra, sizeof (ra->next_rrd->header),
-	    &ra->next_rrd->header);
+	err = herr;
 	ra->next_rrd->bytes_read = ra->bytes_read;
 	if (err != 0) {
 		kmem_free(ra->next_rrd, sizeof (*ra->next_rrd));
@@ -2926,6 +3193,16 @@ receive_process_record(struct receive_writer_arg *rwa,
 {
 	int err;
 
+	/*
+	 * Apply the pending writes before a record that can't join them,
+	 * while bytes_read is still that of the last of them.
+	 */
+	if (!receive_write_batch_fits(rwa, rrd)) {
+		err = receive_write_batch_flush(rwa);
+		if (err != 0)
+			return (err);
+	}
+
 	/* Processing in order, therefore bytes_read should be increasing. */
 	ASSERT3U(rrd->bytes_read, >=, rwa->bytes_read);
 	rwa->bytes_read = rrd->bytes_read;
@@ -2948,11 +3225,11 @@ receive_process_record(struct receive_writer_arg *rwa,
 	}
 	case DRR_WRITE:
 	{
-		struct drr_write *drrw = &rrd->header.drr_u.drr_write;
-		err = receive_write(rwa, drrw, rrd->write_buf);
-		/* if receive_write() is successful, it consumes the arc_buf */
-		if (err != 0)
-			dmu_return_arcbuf(rrd->write_buf);
+		err = receive_write(rwa, rrd);
+		/* if receive_write() is successful, it takes the record */
+		if (err == 0)
+			return (SET_ERROR(EAGAIN));
+		dmu_return_arcbuf(rrd->write_buf);
 		rrd->write_buf = NULL;
 		rrd->payload = NULL;
 		break;
@@ -3017,7 +3294,13 @@ receive_writer_thread(void *arg)
 		 */
 		if (rwa->err == 0) {
 			rwa->err = receive_process_record(rwa, rrd);
-		} else if (rrd->write_buf != NULL) {
+			/* EAGAIN: the record was added to the write batch */
+			if (rwa->err == EAGAIN) {
+				rwa->err = 0;
+				continue;
+			}
+		}
+		if (rrd->write_buf != NULL) {
 			dmu_return_arcbuf(rrd->write_buf);
 			rrd->write_buf = NULL;
 			rrd->payload = NULL;
@@ -3028,6 +3311,10 @@ receive_writer_thread(void *arg)
 		kmem_free(rrd, sizeof (*rrd));
 	}
 	kmem_free(rrd, sizeof (*rrd));
+	if (rwa->err == 0)
+		rwa->err = receive_write_batch_flush(rwa);
+	else
+		receive_write_batch_free(rwa);
 	mutex_enter(&rwa->mutex);
 	rwa->done = B_TRUE;
 	cv_signal(&rwa->cv);
@@ -3180,6 +3467,8 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 	    offsetof(struct receive_record_arg, node));
 	cv_init(&rwa->cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&rwa->mutex, NULL, MUTEX_DEFAULT, NULL);
+	list_create(&rwa->write_batch, sizeof (struct receive_record_arg),
+	    offsetof(struct receive_record_arg, batch_node));
 	rwa->os = ra->os;
 	rwa->byteswap = drc->drc_byteswap;
 	rwa->resumable = drc->drc_resumable;
@@ -3262,6 +3551,7 @@ dmu_recv_stream(dmu_recv_cookie_t *drc, vnode_t *vp, offset_t *voffp,
 
 	cv_destroy(&rwa->cv);
 	mutex_destroy(&rwa->mutex);
+	list_destroy(&rwa->write_batch);
 	bqueue_destroy(&rwa->q);
 	if (err == 0)
 		err = rwa->err;
@@ -3554,9 +3844,15 @@ dmu_objset_is_receiving(objset_t *os)
 module_param(zfs_send_corrupt_data, int, 0644);
 MODULE_PARM_DESC(zfs_send_corrupt_data, "Allow sending corrupt data");
 
+module_param(zfs_send_prefetch_data, int, 0644);
+MODULE_PARM_DESC(zfs_send_prefetch_data, "Read send data as it is queued");
+
 module_param(zfs_send_queue_length, int, 0644);
 MODULE_PARM_DESC(zfs_send_queue_length, "Maximum send queue length");
 
+module_param(zfs_recv_write_batch_size, int, 0644);
+MODULE_PARM_DESC(zfs_recv_write_batch_size, "Max bytes of writes in one tx");
+
 module_param(zfs_recv_queue_length, int, 0644);
 MODULE_PARM_DESC(zfs_recv_queue_length, "Maximum receive queue length");
 #endif
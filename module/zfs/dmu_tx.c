@@ -223,6 +223,7 @@ static void
 dmu_tx_count_write(dmu_tx_hold_t *txh, uint64_t off, uint64_t len)
 {
 	dnode_t *dn = txh->txh_dnode;
+	boolean_t partial;
 	int err = 0;
 
 	if (len == 0)
@@ -240,10 +241,14 @@ dmu_tx_count_write(dmu_tx_hold_t *txh, uint64_t off, uint64_t len)
 	 * For i/o error checking, read the blocks that will be needed
 	 * to perform the write: the first and last level-0 blocks (if
 	 * they are not aligned, i.e. if they are partial-block writes),
-	 * and all the level-1 blocks.
+	 * and all the level-1 blocks.  Partial writes which will be merged
+	 * with the old block when it is synced don't need it now, see
+	 * dmu_buf_will_dirty_range().
 	 */
+	partial = (dn->dn_object != DMU_META_DNODE_OBJECT &&
+	    dbuf_partial_write_ok(dn->dn_datablksz, off, len));
 	if (dn->dn_maxblkid == 0) {
-		if (off < dn->dn_datablksz &&
+		if (off < dn->dn_datablksz && !partial &&
 		    (off > 0 || len < dn->dn_datablksz)) {
 			err = dmu_tx_check_ioerr(NULL, dn, 0, 0);
 			if (err != 0) {
@@ -256,7 +261,8 @@ dmu_tx_count_write(dmu_tx_hold_t *txh, uint64_t off, uint64_t len)
 
 		/* first level-0 block */
 		uint64_t start = off >> dn->dn_datablkshift;
-		if (P2PHASE(off, dn->dn_datablksz) || len < dn->dn_datablksz) {
+		if (!partial &&
+		    (P2PHASE(off, dn->dn_datablksz) || len < dn->dn_datablksz)) {
 			err = dmu_tx_check_ioerr(zio, dn, 0, start);
 			if (err != 0) {
 				txh->txh_tx->tx_err = err;
@@ -265,7 +271,7 @@ dmu_tx_count_write(dmu_tx_hold_t *txh, uint64_t off, uint64_t len)
 
 		/* last level-0 block */
 		uint64_t end = (off + len - 1) >> dn->dn_datablkshift;
-		if (end != start && end <= dn->dn_maxblkid &&
+		if (end != start && end <= dn->dn_maxblkid && !partial &&
 		    P2PHASE(off + len, dn->dn_datablksz)) {
 			err = dmu_tx_check_ioerr(zio, dn, 0, end);
 			if (err != 0) {
@@ -775,14 +781,23 @@ int zfs_delay_resolution_ns = 100 * 1000; /* 100 microseconds */
  * ensuring that the appropriate limits are set for the I/O scheduler to reach
  * optimal throughput on the backend storage, and then by changing the value
  * of zfs_delay_scale to increase the steepness of the curve.
+ *
+ * With zfs_delay_fairness set, the delay of a transaction on a dataset is
+ * further scaled by that objset's share of the pool's dirty data, and
+ * each objset's transactions are only spaced out relative to each other
+ * (os_last_wakeup).  A bulk writer holding most of the dirty data is then
+ * delayed almost as much as if it were alone, while a light writer next
+ * to it is barely delayed at all.  The dirty data limit itself is still
+ * shared: once it is reached, every writer waits for space.
  */
 static void
 dmu_tx_delay(dmu_tx_t *tx, uint64_t dirty)
 {
 	dsl_pool_t *dp = tx->tx_pool;
+	objset_t *os = tx->tx_objset;
 	uint64_t delay_min_bytes =
 	    zfs_dirty_data_max * zfs_delay_min_dirty_percent / 100;
-	hrtime_t wakeup, min_tx_time, now;
+	hrtime_t wakeup, min_tx_time, now, *last_wakeup;
 
 	if (dirty <= delay_min_bytes)
 		return;
@@ -799,16 +814,35 @@ dmu_tx_delay(dmu_tx_t *tx, uint64_t dirty)
 	min_tx_time = zfs_delay_scale *
 	    (dirty - delay_min_bytes) / (zfs_dirty_data_max - dirty);
 	min_tx_time = MIN(min_tx_time, zfs_delay_max_ns);
-	if (now > tx->tx_start + min_tx_time)
+
+	mutex_enter(&dp->dp_lock);
+	last_wakeup = &dp->dp_last_wakeup;
+	if (zfs_delay_fairness && os != NULL && os->os_dsl_dataset != NULL &&
+	    dp->dp_dirty_total != 0) {
+		uint64_t os_dirty = 0;
+		uint64_t share;
+		int t;
+
+		for (t = 0; t < TXG_SIZE; t++)
+			os_dirty += os->os_dirty_pertxg[t];
+
+		/* In 1/1024ths, to keep the multiply from overflowing */
+		share = MIN(os_dirty, dp->dp_dirty_total) * 1024 /
+		    dp->dp_dirty_total;
+		min_tx_time = min_tx_time * share / 1024;
+		last_wakeup = &os->os_last_wakeup;
+	}
+	if (now > tx->tx_start + min_tx_time) {
+		mutex_exit(&dp->dp_lock);
 		return;
+	}
 
 	DTRACE_PROBE3(delay__mintime, dmu_tx_t *, tx, uint64_t, dirty,
 	    uint64_t, min_tx_time);
 
-	mutex_enter(&dp->dp_lock);
 	wakeup = MAX(tx->tx_start + min_tx_time,
-	    dp->dp_last_wakeup + min_tx_time);
-	dp->dp_last_wakeup = wakeup;
+	    *last_wakeup + min_tx_time);
+	*last_wakeup = wakeup;
 	mutex_exit(&dp->dp_lock);
 
 	zfs_sleep_until(wakeup);
@@ -46,6 +46,8 @@ int zfs_prefetch_disable = B_FALSE;
 
 /* max # of streams per zfetch */
 unsigned int	zfetch_max_streams = 8;
+/* max # of streams per zfetch once all of them are in use */
+unsigned int	zfetch_max_streams_limit = 64;
 /* min time before stream reclaim */
 unsigned int	zfetch_min_sec_reap = 2;
 /* max bytes to prefetch per stream (default 8MB) */
@@ -59,16 +61,26 @@ typedef struct zfetch_stats {
 	kstat_named_t zfetchstat_hits;
 	kstat_named_t zfetchstat_misses;
 	kstat_named_t zfetchstat_max_streams;
+	kstat_named_t zfetchstat_stride_hits;
+	kstat_named_t zfetchstat_reverse_hits;
+	kstat_named_t zfetchstat_streams_grown;
+	kstat_named_t zfetchstat_io_issued;
 } zfetch_stats_t;
 
 static zfetch_stats_t zfetch_stats = {
 	{ "hits",			KSTAT_DATA_UINT64 },
 	{ "misses",			KSTAT_DATA_UINT64 },
 	{ "max_streams",		KSTAT_DATA_UINT64 },
+	{ "stride_hits",		KSTAT_DATA_UINT64 },
+	{ "reverse_hits",		KSTAT_DATA_UINT64 },
+	{ "streams_grown",		KSTAT_DATA_UINT64 },
+	{ "io_issued",			KSTAT_DATA_UINT64 },
 };
 
 #define	ZFETCHSTAT_BUMP(stat) \
 	atomic_inc_64(&zfetch_stats.stat.value.ui64);
+#define	ZFETCHSTAT_INCR(stat, val) \
+	atomic_add_64(&zfetch_stats.stat.value.ui64, (val));
 
 kstat_t		*zfetch_ksp;
 
@@ -106,6 +118,7 @@ dmu_zfetch_init(zfetch_t *zf, dnode_t *dno)
 		return;
 
 	zf->zf_dnode = dno;
+	zf->zf_max_streams = zfetch_max_streams;
 
 	list_create(&zf->zf_stream, sizeof (zstream_t),
 	    offsetof(zstream_t, zs_node));
@@ -145,17 +158,21 @@ dmu_zfetch_fini(zfetch_t *zf)
 
 /*
  * If there aren't too many streams already, create a new stream.
- * The "blkid" argument is the next block that we expect this stream to access.
+ * The "blkid" argument is the next block that we expect this stream to access,
+ * "stride" is 0 for a sequential stream.  "last" and "nblks" describe the
+ * access which started the stream.
  * While we're here, clean up old streams (which haven't been
  * accessed for at least zfetch_min_sec_reap seconds).
  */
 static void
-dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
+dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid, int64_t stride,
+    uint64_t last, uint64_t nblks)
 {
 	zstream_t *zs;
 	zstream_t *zs_next;
 	int numstreams = 0;
 	uint32_t max_streams;
+	boolean_t idle = B_FALSE;
 
 	ASSERT(RW_WRITE_HELD(&zf->zf_rwlock));
 
@@ -166,38 +183,132 @@ dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
 	    zs != NULL; zs = zs_next) {
 		zs_next = list_next(&zf->zf_stream, zs);
 		if (((gethrtime() - zs->zs_atime) / NANOSEC) >
-		    zfetch_min_sec_reap)
+		    zfetch_min_sec_reap) {
 			dmu_zfetch_stream_remove(zf, zs);
-		else
+		} else {
 			numstreams++;
+			if (zs->zs_hits == 0)
+				idle = B_TRUE;
+		}
 	}
 
 	/*
-	 * The maximum number of streams is normally zfetch_max_streams,
+	 * Give back a grown stream table once most of it has been reaped.
+	 */
+	while (zf->zf_max_streams > zfetch_max_streams &&
+	    numstreams < zf->zf_max_streams / 4)
+		zf->zf_max_streams /= 2;
+
+	/*
+	 * The maximum number of streams is normally zf_max_streams,
 	 * but for small files we lower it such that it's at least possible
 	 * for all the streams to be non-overlapping.
 	 *
 	 * If we are already at the maximum number of streams for this file,
-	 * even after removing old streams, then don't create this stream.
+	 * even after removing old streams, then don't create this stream,
+	 * unless every stream has been matched, in which case the file has
+	 * more live streams than the table holds and the table is doubled,
+	 * up to zfetch_max_streams_limit.
 	 */
-	max_streams = MAX(1, MIN(zfetch_max_streams,
+	max_streams = MAX(1, MIN(zf->zf_max_streams,
 	    zf->zf_dnode->dn_maxblkid * zf->zf_dnode->dn_datablksz /
 	    zfetch_max_distance));
 	if (numstreams >= max_streams) {
-		ZFETCHSTAT_BUMP(zfetchstat_max_streams);
-		return;
+		if (idle || max_streams < zf->zf_max_streams ||
+		    zf->zf_max_streams >= zfetch_max_streams_limit) {
+			ZFETCHSTAT_BUMP(zfetchstat_max_streams);
+			return;
+		}
+		zf->zf_max_streams = MIN(zf->zf_max_streams * 2,
+		    zfetch_max_streams_limit);
+		ZFETCHSTAT_BUMP(zfetchstat_streams_grown);
 	}
 
 	zs = kmem_zalloc(sizeof (*zs), KM_SLEEP);
 	zs->zs_blkid = blkid;
 	zs->zs_pf_blkid = blkid;
 	zs->zs_ipf_blkid = blkid;
+	zs->zs_stride = stride;
+	zs->zs_nblks = nblks;
+	zs->zs_last_blkid = last;
 	zs->zs_atime = gethrtime();
 	mutex_init(&zs->zs_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	list_insert_head(&zf->zf_stream, zs);
 }
 
+/*
+ * Look for a fresh sequential stream whose first access, together with
+ * this one, could be the start of a strided or backward scan, and if
+ * there is one return the distance between the two accesses.  Strides
+ * which would have the accesses overlap, or which are further than
+ * zfetch_max_distance, are not considered.
+ */
+static int64_t
+dmu_zfetch_stride(zfetch_t *zf, uint64_t blkid, uint64_t nblks)
+{
+	int64_t max_dist_blks, stride;
+	zstream_t *zs;
+
+	ASSERT(RW_WRITE_HELD(&zf->zf_rwlock));
+
+	max_dist_blks = zfetch_max_distance >> zf->zf_dnode->dn_datablkshift;
+	for (zs = list_head(&zf->zf_stream); zs != NULL;
+	    zs = list_next(&zf->zf_stream, zs)) {
+		if (zs->zs_stride != 0 || zs->zs_hits != 0 ||
+		    zs->zs_nblks != nblks)
+			continue;
+
+		stride = (int64_t)blkid - (int64_t)zs->zs_last_blkid;
+		if (stride == (int64_t)nblks ||
+		    ABS(stride) < (int64_t)nblks || ABS(stride) > max_dist_blks)
+			continue;
+		if ((int64_t)blkid + stride <= 0)
+			continue;
+
+		return (stride);
+	}
+
+	return (0);
+}
+
+/*
+ * Continue a strided stream.  The number of accesses we are ahead of
+ * the reader is doubled every time, but the data prefetched ahead is
+ * kept within zfetch_max_distance.  Returns the number of accesses to
+ * prefetch, starting at *pf_start, which is 0 unless fetch_data is set.
+ */
+static int64_t
+dmu_zfetch_strided(zfetch_t *zf, zstream_t *zs, uint64_t blkid,
+    boolean_t fetch_data, int64_t *pf_start)
+{
+	int64_t stride = zs->zs_stride;
+	int64_t ahead, end, max_acc, first;
+
+	ASSERT(MUTEX_HELD(&zs->zs_lock));
+
+	max_acc = MAX(1, (zfetch_max_distance >>
+	    zf->zf_dnode->dn_datablkshift) / zs->zs_nblks);
+	ahead = MAX(0, ((int64_t)zs->zs_pf_blkid - (int64_t)blkid) / stride);
+	first = MAX(ahead, 1);
+	end = MIN(2 * ahead + 2, max_acc + 1);
+
+	/* Don't run off the front of a backward scan */
+	if (stride < 0)
+		end = MIN(end, (int64_t)blkid / -stride + 1);
+
+	zs->zs_hits++;
+	zs->zs_last_blkid = blkid;
+	zs->zs_blkid = blkid + stride;
+	zs->zs_atime = gethrtime();
+	if (!fetch_data || end <= first)
+		return (0);
+
+	*pf_start = blkid + first * stride;
+	zs->zs_pf_blkid = blkid + end * stride;
+	return (end - first);
+}
+
 /*
  * This is the predictive prefetch entry point.  It associates dnode access
  * specified with blkid and nblks arguments with prefetch stream, predicts
@@ -211,9 +322,9 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 {
 	zstream_t *zs;
 	int64_t pf_start, ipf_start, ipf_istart, ipf_iend;
-	int64_t pf_ahead_blks, max_blks, iblk;
+	int64_t pf_ahead_blks, max_blks, iblk, stride, pf_nacc;
 	int epbs, max_dist_blks, pf_nblks, ipf_nblks, i;
-	uint64_t end_of_access_blkid;
+	uint64_t end_of_access_blkid, j;
 	end_of_access_blkid = blkid + nblks;
 
 	if (zfs_prefetch_disable)
@@ -235,7 +346,18 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 	 */
 	for (zs = list_head(&zf->zf_stream); zs != NULL;
 	    zs = list_next(&zf->zf_stream, zs)) {
-		if (blkid == zs->zs_blkid || blkid + 1 == zs->zs_blkid) {
+		if (zs->zs_stride != 0) {
+			/*
+			 * A strided stream only matches an access of the
+			 * same size at the expected block.
+			 */
+			if (blkid != zs->zs_blkid || nblks != zs->zs_nblks)
+				continue;
+			mutex_enter(&zs->zs_lock);
+			if (blkid == zs->zs_blkid)
+				break;
+			mutex_exit(&zs->zs_lock);
+		} else if (blkid == zs->zs_blkid || blkid + 1 == zs->zs_blkid) {
 			mutex_enter(&zs->zs_lock);
 			/*
 			 * zs_blkid could have changed before we
@@ -264,9 +386,51 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 		 * a new stream for it.
 		 */
 		ZFETCHSTAT_BUMP(zfetchstat_misses);
-		if (rw_tryupgrade(&zf->zf_rwlock))
-			dmu_zfetch_stream_create(zf, end_of_access_blkid);
+		if (rw_tryupgrade(&zf->zf_rwlock)) {
+			/*
+			 * If this access could be the second of a strided
+			 * or backward scan, also start a strided stream for
+			 * it.  The sequential stream is started regardless,
+			 * so interleaved sequential readers can't take each
+			 * other's streams.
+			 */
+			stride = dmu_zfetch_stride(zf, blkid, nblks);
+			dmu_zfetch_stream_create(zf, end_of_access_blkid, 0,
+			    blkid, nblks);
+			if (stride != 0) {
+				dmu_zfetch_stream_create(zf, blkid + stride,
+				    stride, blkid, nblks);
+			}
+		}
+		rw_exit(&zf->zf_rwlock);
+		return;
+	}
+
+	if (zs->zs_stride != 0) {
+		stride = zs->zs_stride;
+		pf_start = 0;
+		pf_nacc = dmu_zfetch_strided(zf, zs, blkid, fetch_data,
+		    &pf_start);
+		mutex_exit(&zs->zs_lock);
 		rw_exit(&zf->zf_rwlock);
+
+		/*
+		 * dbuf_prefetch() fetches the indirect blocks it needs
+		 * itself, so there is no separate indirect prefetch here.
+		 */
+		for (i = 0; i < pf_nacc; i++) {
+			for (j = 0; j < nblks; j++) {
+				dbuf_prefetch(zf->zf_dnode, 0,
+				    pf_start + i * stride + j,
+				    ZIO_PRIORITY_ASYNC_READ,
+				    ARC_FLAG_PREDICTIVE_PREFETCH);
+			}
+		}
+		ZFETCHSTAT_INCR(zfetchstat_io_issued, pf_nacc * nblks);
+		if (stride < 0)
+			ZFETCHSTAT_BUMP(zfetchstat_reverse_hits);
+		ZFETCHSTAT_BUMP(zfetchstat_stride_hits);
+		ZFETCHSTAT_BUMP(zfetchstat_hits);
 		return;
 	}
 
@@ -329,6 +493,9 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 
 	zs->zs_atime = gethrtime();
 	zs->zs_blkid = end_of_access_blkid;
+	zs->zs_last_blkid = blkid;
+	zs->zs_nblks = nblks;
+	zs->zs_hits++;
 	mutex_exit(&zs->zs_lock);
 	rw_exit(&zf->zf_rwlock);
 
@@ -346,6 +513,7 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data)
 		dbuf_prefetch(zf->zf_dnode, 1, iblk,
 		    ZIO_PRIORITY_ASYNC_READ, ARC_FLAG_PREDICTIVE_PREFETCH);
 	}
+	ZFETCHSTAT_INCR(zfetchstat_io_issued, pf_nblks);
 	ZFETCHSTAT_BUMP(zfetchstat_hits);
 }
 
@@ -357,6 +525,10 @@ MODULE_PARM_DESC(zfs_prefetch_disable, "Disable all ZFS prefetching");
 module_param(zfetch_max_streams, uint, 0644);
 MODULE_PARM_DESC(zfetch_max_streams, "Max number of streams per zfetch");
 
+module_param(zfetch_max_streams_limit, uint, 0644);
+MODULE_PARM_DESC(zfetch_max_streams_limit,
+	"Max number of streams per zfetch once all streams are in use");
+
 module_param(zfetch_min_sec_reap, uint, 0644);
 MODULE_PARM_DESC(zfetch_min_sec_reap, "Min time before stream reclaim");
 
@@ -43,6 +43,7 @@ dnode_stats_t dnode_stats = {
 	{ "dnode_hold_dbuf_hold",		KSTAT_DATA_UINT64 },
 	{ "dnode_hold_dbuf_read",		KSTAT_DATA_UINT64 },
 	{ "dnode_hold_alloc_hits",		KSTAT_DATA_UINT64 },
+	{ "dnode_hold_pinned_hits",		KSTAT_DATA_UINT64 },
 	{ "dnode_hold_alloc_misses",		KSTAT_DATA_UINT64 },
 	{ "dnode_hold_alloc_interior",		KSTAT_DATA_UINT64 },
 	{ "dnode_hold_alloc_lock_retry",	KSTAT_DATA_UINT64 },
@@ -1209,6 +1210,12 @@ dnode_hold_impl(objset_t *os, uint64_t object, int flag, int slots,
 	if (object == 0 || object >= DN_MAX_OBJECT)
 		return (SET_ERROR(EINVAL));
 
+	if ((flag & DNODE_MUST_BE_ALLOCATED) && os->os_pinned_count != 0 &&
+	    dmu_objset_hold_pinned(os, object, tag, dnp)) {
+		DNODE_STAT_BUMP(dnode_hold_pinned_hits);
+		return (0);
+	}
+
 	mdn = DMU_META_DNODE(os);
 	ASSERT(mdn->dn_object == DMU_META_DNODE_OBJECT);
 
@@ -1712,7 +1719,7 @@ dnode_new_blkid(dnode_t *dn, uint64_t blkid, dmu_tx_t *tx, boolean_t have_read)
 			    dr->dr_dbuf->db_blkid != DMU_SPILL_BLKID) {
 				ASSERT(dr->dr_dbuf->db_level == old_nlevels-1);
 				list_remove(&dn->dn_dirty_records[txgoff], dr);
-				list_insert_tail(&new->dt.di.dr_children, dr);
+				dbuf_dirty_add_child(new, dr);
 				dr->dr_parent = new;
 			}
 		}
@@ -71,6 +71,18 @@
  */
 int zfs_max_recordsize = 1 * 1024 * 1024;
 
+/*
+ * A clone whose livelist is longer than this is destroyed by traversing
+ * it; see dsl_dataset_livelist_free().
+ */
+unsigned long zfs_livelist_max_entries = 500000;
+
+/*
+ * Bumped whenever a snapshot is created, destroyed or renamed, or moves to
+ * another dataset, so that lists of snapshots can be cached until then.
+ */
+uint64_t dsl_dataset_snapshot_gen = 0;
+
 #define	SWITCH64(x, y) \
 	{ \
 		uint64_t __tmp = (x); \
@@ -134,6 +146,8 @@ dsl_dataset_block_born(dsl_dataset_t *ds, const blkptr_t *bp, dmu_tx_t *tx)
 	}
 
 	ASSERT3U(bp->blk_birth, >, dsl_dataset_phys(ds)->ds_prev_snap_txg);
+	if (dsl_dataset_has_livelist(ds))
+		bplist_append(&ds->ds_pending_born, bp);
 	dmu_buf_will_dirty(ds->ds_dbuf, tx);
 	mutex_enter(&ds->ds_lock);
 	delta = parent_delta(ds, used);
@@ -188,6 +202,8 @@ dsl_dataset_block_kill(dsl_dataset_t *ds, const blkptr_t *bp, dmu_tx_t *tx,
 
 		dprintf_bp(bp, "freeing ds=%llu", ds->ds_object);
 		dsl_free(tx->tx_pool, tx->tx_txg, bp);
+		if (dsl_dataset_has_livelist(ds))
+			bplist_append(&ds->ds_pending_freed, bp);
 
 		mutex_enter(&ds->ds_lock);
 		ASSERT(dsl_dataset_phys(ds)->ds_unique_bytes >= used ||
@@ -242,6 +258,198 @@ dsl_dataset_block_kill(dsl_dataset_t *ds, const blkptr_t *bp, dmu_tx_t *tx,
 	return (used);
 }
 
+/*
+ * A clone made while the clone_livelist feature is enabled keeps a
+ * livelist: every block born in it, and every block born in it which it
+ * has freed again, is appended to one of two bpobjs (see DS_FIELD_LIVELIST).
+ * The blocks that destroying the clone has to free are the born ones that
+ * weren't freed, so they can be found from the lists, for a cost that grows
+ * with what was written to the clone rather than with the size of the
+ * tree of blocks born since its origin.  Blocks are born and killed from
+ * zio completion, where the bpobjs can't be written, so they are queued on
+ * ds_pending_born and ds_pending_freed until dsl_dataset_sync_done().
+ *
+ * Once a clone has a snapshot, killing one of its blocks no longer always
+ * frees it, so the livelist is dropped then, as it is when the clone is
+ * promoted or has its contents swapped.
+ */
+boolean_t
+dsl_dataset_has_livelist(dsl_dataset_t *ds)
+{
+	return (ds->ds_livelist_born.bpo_object != 0);
+}
+
+static void
+dsl_dataset_livelist_create(dsl_pool_t *dp, uint64_t dsobj, dmu_tx_t *tx)
+{
+	objset_t *mos = dp->dp_meta_objset;
+	uint64_t obj[2];
+
+	obj[0] = bpobj_alloc(mos, SPA_OLD_MAXBLOCKSIZE, tx);
+	obj[1] = bpobj_alloc(mos, SPA_OLD_MAXBLOCKSIZE, tx);
+	dmu_object_zapify(mos, dsobj, DMU_OT_DSL_DATASET, tx);
+	VERIFY0(zap_add(mos, dsobj, DS_FIELD_LIVELIST,
+	    sizeof (uint64_t), 2, obj, tx));
+	spa_feature_incr(dp->dp_spa, SPA_FEATURE_CLONE_LIVELIST, tx);
+}
+
+static void
+dsl_dataset_livelist_open(dsl_dataset_t *ds, objset_t *mos)
+{
+	uint64_t obj[2];
+	int err;
+
+	err = zap_lookup(mos, ds->ds_object, DS_FIELD_LIVELIST,
+	    sizeof (uint64_t), 2, obj);
+	if (err == ENOENT)
+		return;
+	VERIFY0(err);
+	VERIFY0(bpobj_open(&ds->ds_livelist_born, mos, obj[0]));
+	VERIFY0(bpobj_open(&ds->ds_livelist_freed, mos, obj[1]));
+}
+
+static void
+dsl_dataset_livelist_close(dsl_dataset_t *ds)
+{
+	bpobj_close(&ds->ds_livelist_born);
+	bpobj_close(&ds->ds_livelist_freed);
+}
+
+static int
+livelist_enqueue_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	bpobj_enqueue(arg, bp, tx);
+	return (0);
+}
+
+static void
+dsl_dataset_livelist_sync(dsl_dataset_t *ds, dmu_tx_t *tx)
+{
+	bplist_iterate(&ds->ds_pending_born, livelist_enqueue_cb,
+	    &ds->ds_livelist_born, tx);
+	bplist_iterate(&ds->ds_pending_freed, livelist_enqueue_cb,
+	    &ds->ds_livelist_freed, tx);
+}
+
+void
+dsl_dataset_livelist_destroy(dsl_dataset_t *ds, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = dmu_tx_pool(tx);
+	uint64_t born, freed;
+
+	if (!dsl_dataset_has_livelist(ds))
+		return;
+
+	dsl_dataset_livelist_sync(ds, tx);
+	born = ds->ds_livelist_born.bpo_object;
+	freed = ds->ds_livelist_freed.bpo_object;
+	dsl_dataset_livelist_close(ds);
+	bpobj_free(dp->dp_meta_objset, born, tx);
+	bpobj_free(dp->dp_meta_objset, freed, tx);
+	VERIFY0(zap_remove(dp->dp_meta_objset, ds->ds_object,
+	    DS_FIELD_LIVELIST, tx));
+	spa_feature_decr(dp->dp_spa, SPA_FEATURE_CLONE_LIVELIST, tx);
+}
+
+typedef struct livelist_entry {
+	avl_node_t	le_node;
+	blkptr_t	le_bp;
+	uint64_t	le_count;	/* times it was freed */
+} livelist_entry_t;
+
+static int
+livelist_entry_compare(const void *x1, const void *x2)
+{
+	const blkptr_t *bp1 = &((const livelist_entry_t *)x1)->le_bp;
+	const blkptr_t *bp2 = &((const livelist_entry_t *)x2)->le_bp;
+	int cmp;
+
+	cmp = AVL_CMP(DVA_GET_VDEV(&bp1->blk_dva[0]),
+	    DVA_GET_VDEV(&bp2->blk_dva[0]));
+	if (likely(cmp))
+		return (cmp);
+	cmp = AVL_CMP(DVA_GET_OFFSET(&bp1->blk_dva[0]),
+	    DVA_GET_OFFSET(&bp2->blk_dva[0]));
+	if (likely(cmp))
+		return (cmp);
+	cmp = AVL_CMP(BP_PHYSICAL_BIRTH(bp1), BP_PHYSICAL_BIRTH(bp2));
+	if (likely(cmp))
+		return (cmp);
+	return (AVL_CMP(bp1->blk_prop, bp2->blk_prop));
+}
+
+static int
+livelist_freed_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	avl_tree_t *freed = arg;
+	livelist_entry_t search, *le;
+	avl_index_t where;
+
+	search.le_bp = *bp;
+	le = avl_find(freed, &search, &where);
+	if (le == NULL) {
+		le = kmem_alloc(sizeof (*le), KM_SLEEP);
+		le->le_bp = *bp;
+		le->le_count = 0;
+		avl_insert(freed, le, where);
+	}
+	le->le_count++;
+	return (0);
+}
+
+static int
+livelist_born_cb(void *arg, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	avl_tree_t *freed = arg;
+	livelist_entry_t search, *le;
+
+	search.le_bp = *bp;
+	le = avl_find(freed, &search, NULL);
+	if (le != NULL && le->le_count > 0)
+		le->le_count--;
+	else
+		bpobj_enqueue(&dmu_tx_pool(tx)->dp_free_bpobj, bp, tx);
+	return (0);
+}
+
+/*
+ * Queue the blocks a clone being destroyed still references on the pool's
+ * free bpobj, for dsl_scan_sync() to free, and drop its livelist.  Returns
+ * B_FALSE if the clone has no livelist, or one too long to match up here,
+ * in which case the caller has to find the blocks by traversing it.
+ */
+boolean_t
+dsl_dataset_livelist_free(dsl_dataset_t *ds, dmu_tx_t *tx)
+{
+	livelist_entry_t *le;
+	avl_tree_t freed;
+	void *cookie = NULL;
+
+	if (!dsl_dataset_has_livelist(ds))
+		return (B_FALSE);
+
+	dsl_dataset_livelist_sync(ds, tx);
+	if (ds->ds_livelist_born.bpo_phys->bpo_num_blkptrs +
+	    ds->ds_livelist_freed.bpo_phys->bpo_num_blkptrs >
+	    zfs_livelist_max_entries) {
+		dsl_dataset_livelist_destroy(ds, tx);
+		return (B_FALSE);
+	}
+
+	avl_create(&freed, livelist_entry_compare, sizeof (livelist_entry_t),
+	    offsetof(livelist_entry_t, le_node));
+	VERIFY0(bpobj_iterate_nofree(&ds->ds_livelist_freed,
+	    livelist_freed_cb, &freed, tx));
+	VERIFY0(bpobj_iterate_nofree(&ds->ds_livelist_born,
+	    livelist_born_cb, &freed, tx));
+	while ((le = avl_destroy_nodes(&freed, &cookie)) != NULL)
+		kmem_free(le, sizeof (*le));
+	avl_destroy(&freed);
+
+	dsl_dataset_livelist_destroy(ds, tx);
+	return (B_TRUE);
+}
+
 /*
  * We have to release the fsid syncronously or we risk that a subsequent
  * mount of the same dataset will fail to unique_insert the fsid.  This
@@ -276,6 +484,9 @@ dsl_dataset_evict_async(void *dbu)
 	}
 
 	bplist_destroy(&ds->ds_pending_deadlist);
+	bplist_destroy(&ds->ds_pending_born);
+	bplist_destroy(&ds->ds_pending_freed);
+	dsl_dataset_livelist_close(ds);
 	if (ds->ds_deadlist.dl_os != NULL)
 		dsl_deadlist_close(&ds->ds_deadlist);
 	if (ds->ds_dir)
@@ -425,6 +636,8 @@ dsl_dataset_hold_obj(dsl_pool_t *dp, uint64_t dsobj, void *tag,
 		refcount_create(&ds->ds_longholds);
 
 		bplist_create(&ds->ds_pending_deadlist);
+		bplist_create(&ds->ds_pending_born);
+		bplist_create(&ds->ds_pending_freed);
 		dsl_deadlist_open(&ds->ds_deadlist,
 		    mos, dsl_dataset_phys(ds)->ds_deadlist_obj);
 
@@ -460,6 +673,8 @@ dsl_dataset_hold_obj(dsl_pool_t *dp, uint64_t dsobj, void *tag,
 			mutex_destroy(&ds->ds_sendstream_lock);
 			refcount_destroy(&ds->ds_longholds);
 			bplist_destroy(&ds->ds_pending_deadlist);
+			bplist_destroy(&ds->ds_pending_born);
+			bplist_destroy(&ds->ds_pending_freed);
 			dsl_deadlist_close(&ds->ds_deadlist);
 			kmem_free(ds, sizeof (dsl_dataset_t));
 			dmu_buf_rele(dbuf, tag);
@@ -480,6 +695,7 @@ dsl_dataset_hold_obj(dsl_pool_t *dp, uint64_t dsobj, void *tag,
 				    &ds->ds_bookmarks);
 				if (zaperr != ENOENT)
 					VERIFY0(zaperr);
+				dsl_dataset_livelist_open(ds, mos);
 			}
 		} else {
 			if (zfs_flags & ZFS_DEBUG_SNAPNAMES)
@@ -513,6 +729,9 @@ dsl_dataset_hold_obj(dsl_pool_t *dp, uint64_t dsobj, void *tag,
 
 		if (err != 0 || winner != NULL) {
 			bplist_destroy(&ds->ds_pending_deadlist);
+			bplist_destroy(&ds->ds_pending_born);
+			bplist_destroy(&ds->ds_pending_freed);
+			dsl_dataset_livelist_close(ds);
 			dsl_deadlist_close(&ds->ds_deadlist);
 			if (ds->ds_prev)
 				dsl_dataset_rele(ds->ds_prev, ds);
@@ -788,6 +1007,9 @@ dsl_dataset_create_sync_dd(dsl_dir_t *dd, dsl_dataset_t *origin,
 	dsl_dataset_phys_t *dsphys;
 	uint64_t dsobj;
 	objset_t *mos = dp->dp_meta_objset;
+	boolean_t livelist = (origin != NULL &&
+	    !(flags & DS_CREATE_FLAG_NODIRTY) &&
+	    spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_CLONE_LIVELIST));
 
 	if (origin == NULL)
 		origin = dp->dp_origin_snap;
@@ -844,6 +1066,8 @@ dsl_dataset_create_sync_dd(dsl_dir_t *dd, dsl_dataset_t *origin,
 			if (origin->ds_feature_inuse[f])
 				dsl_dataset_activate_feature(dsobj, f, tx);
 		}
+		if (livelist && origin != dp->dp_origin_snap)
+			dsl_dataset_livelist_create(dp, dsobj, tx);
 
 		dmu_buf_will_dirty(origin->ds_dbuf, tx);
 		dsl_dataset_phys(origin)->ds_num_children++;
@@ -1324,7 +1548,8 @@ dsl_dataset_snapshot_sync_impl(dsl_dataset_t *ds, const char *snapname,
 	ASSERTV(static zil_header_t zero_zil);
 	ASSERTV(objset_t *os);
 
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
+	atomic_inc_64(&dsl_dataset_snapshot_gen);
 
 	/*
 	 * If we are on an old pool, the zil must not be active, in which
@@ -1340,6 +1565,7 @@ dsl_dataset_snapshot_sync_impl(dsl_dataset_t *ds, const char *snapname,
 	    ds, tx->tx_txg));
 
 	dsl_fs_ss_count_adjust(ds->ds_dir, 1, DD_FIELD_SNAPSHOT_COUNT, tx);
+	dsl_dataset_livelist_destroy(ds, tx);
 
 	/*
 	 * The origin's ds_creation_txg has to be < TXG_INITIAL
@@ -1703,6 +1929,8 @@ dsl_dataset_sync_done(dsl_dataset_t *ds, dmu_tx_t *tx)
 
 	bplist_iterate(&ds->ds_pending_deadlist,
 	    deadlist_enqueue_cb, &ds->ds_deadlist, tx);
+	if (dsl_dataset_has_livelist(ds))
+		dsl_dataset_livelist_sync(ds, tx);
 
 	if (os->os_synced_dnodes != NULL) {
 		multilist_destroy(os->os_synced_dnodes);
@@ -2121,6 +2349,7 @@ dsl_dataset_rename_snapshot_sync_impl(dsl_pool_t *dp,
 	}
 
 	VERIFY0(dsl_dataset_hold_obj(dp, val, FTAG, &ds));
+	atomic_inc_64(&dsl_dataset_snapshot_gen);
 
 	/* log before we change the name */
 	spa_history_log_internal_ds(ds, "rename", tx,
@@ -2594,6 +2823,8 @@ dsl_dataset_promote_sync(void *arg, dmu_tx_t *tx)
 
 	VERIFY0(promote_hold(ddpa, dp, FTAG));
 	hds = ddpa->ddpa_clone;
+	atomic_inc_64(&dsl_dataset_snapshot_gen);
+	dsl_dataset_livelist_destroy(hds, tx);
 
 	ASSERT0(dsl_dataset_phys(hds)->ds_flags & DS_FLAG_NOPROMOTE);
 
@@ -3019,6 +3250,10 @@ dsl_dataset_clone_swap_sync_impl(dsl_dataset_t *clone,
 	    DMU_MAX_ACCESS * spa_asize_inflation);
 	ASSERT3P(clone->ds_prev, ==, origin_head->ds_prev);
 
+	/* Neither livelist describes its dataset's blocks after the swap */
+	dsl_dataset_livelist_destroy(clone, tx);
+	dsl_dataset_livelist_destroy(origin_head, tx);
+
 	/*
 	 * Swap per-dataset feature flags.
 	 */
@@ -3691,6 +3926,10 @@ module_param(zfs_max_recordsize, int, 0444);
 MODULE_PARM_DESC(zfs_max_recordsize, "Max allowed record size");
 #endif
 
+module_param(zfs_livelist_max_entries, ulong, 0644);
+MODULE_PARM_DESC(zfs_livelist_max_entries,
+	"Longest livelist used to destroy a clone");
+
 EXPORT_SYMBOL(dsl_dataset_hold);
 EXPORT_SYMBOL(dsl_dataset_hold_obj);
 EXPORT_SYMBOL(dsl_dataset_own);
@@ -257,7 +257,8 @@ dsl_destroy_snapshot_sync_impl(dsl_dataset_t *ds, boolean_t defer, dmu_tx_t *tx)
 	dsl_dataset_t *ds_next, *ds_head, *hds;
 
 
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
+	atomic_inc_64(&dsl_dataset_snapshot_gen);
 	rrw_enter(&ds->ds_bp_rwlock, RW_READER, FTAG);
 	ASSERT3U(dsl_dataset_phys(ds)->ds_bp.blk_birth, <=, tx->tx_txg);
 	rrw_exit(&ds->ds_bp_rwlock, FTAG);
@@ -480,12 +481,53 @@ dsl_destroy_snapshot_sync_impl(dsl_dataset_t *ds, boolean_t defer, dmu_tx_t *tx)
 	dmu_object_free_zapified(mos, obj, tx);
 }
 
+typedef struct destroy_snap_node {
+	const char	*dsn_name;
+	uint64_t	dsn_dirobj;
+	uint64_t	dsn_txg;
+	avl_node_t	dsn_node;
+} destroy_snap_node_t;
+
+/*
+ * Snapshots of the same dataset sort newest first.
+ */
+static int
+destroy_snap_compare(const void *x1, const void *x2)
+{
+	const destroy_snap_node_t *dsn1 = x1;
+	const destroy_snap_node_t *dsn2 = x2;
+	int cmp;
+
+	cmp = AVL_CMP(dsn1->dsn_dirobj, dsn2->dsn_dirobj);
+	if (cmp != 0)
+		return (cmp);
+	cmp = AVL_CMP(dsn2->dsn_txg, dsn1->dsn_txg);
+	if (cmp != 0)
+		return (cmp);
+	return (AVL_ISIGN(strcmp(dsn1->dsn_name, dsn2->dsn_name)));
+}
+
+/*
+ * Destroying a snapshot merges its deadlist into that of the next one.  A
+ * batch is destroyed newest first within each dataset, so that each deadlist
+ * is merged once, directly into the surviving snapshot after a run of
+ * adjacent ones, rather than into a neighbour which is destroyed next and
+ * merged again.  The blocks freed are not freed here but moved onto the
+ * pool's free bpobj, which is drained in the background at the rate set by
+ * zfs_free_max_blocks and zfs_free_min_time_ms.
+ */
 static void
 dsl_destroy_snapshot_sync(void *arg, dmu_tx_t *tx)
 {
 	dmu_snapshots_destroy_arg_t *dsda = arg;
 	dsl_pool_t *dp = dmu_tx_pool(tx);
+	destroy_snap_node_t *dsn;
+	avl_tree_t snaps;
 	nvpair_t *pair;
+	void *cookie = NULL;
+
+	avl_create(&snaps, destroy_snap_compare, sizeof (destroy_snap_node_t),
+	    offsetof(destroy_snap_node_t, dsn_node));
 
 	for (pair = nvlist_next_nvpair(dsda->dsda_successful_snaps, NULL);
 	    pair != NULL;
@@ -493,11 +535,28 @@ dsl_destroy_snapshot_sync(void *arg, dmu_tx_t *tx)
 		dsl_dataset_t *ds;
 
 		VERIFY0(dsl_dataset_hold(dp, nvpair_name(pair), FTAG, &ds));
+		dsn = kmem_alloc(sizeof (destroy_snap_node_t), KM_SLEEP);
+		dsn->dsn_name = nvpair_name(pair);
+		dsn->dsn_dirobj = ds->ds_dir->dd_object;
+		dsn->dsn_txg = dsl_dataset_phys(ds)->ds_creation_txg;
+		avl_add(&snaps, dsn);
+		dsl_dataset_rele(ds, FTAG);
+	}
+
+	for (dsn = avl_first(&snaps); dsn != NULL;
+	    dsn = AVL_NEXT(&snaps, dsn)) {
+		dsl_dataset_t *ds;
+
+		VERIFY0(dsl_dataset_hold(dp, dsn->dsn_name, FTAG, &ds));
 
 		dsl_destroy_snapshot_sync_impl(ds, dsda->dsda_defer, tx);
-		zvol_remove_minors(dp->dp_spa, nvpair_name(pair), B_TRUE);
+		zvol_remove_minors(dp->dp_spa, dsn->dsn_name, B_TRUE);
 		dsl_dataset_rele(ds, FTAG);
 	}
+
+	while ((dsn = avl_destroy_nodes(&snaps, &cookie)) != NULL)
+		kmem_free(dsn, sizeof (destroy_snap_node_t));
+	avl_destroy(&snaps);
 }
 
 /*
@@ -681,7 +740,7 @@ dsl_dir_destroy_sync(uint64_t ddobj, dmu_tx_t *tx)
 	objset_t *mos = dp->dp_meta_objset;
 	dd_used_t t;
 
-	ASSERT(RRW_WRITE_HELD(&dmu_tx_pool(tx)->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dmu_tx_pool(tx)->dp_config_rwlock));
 
 	VERIFY0(dsl_dir_hold_obj(dp, ddobj, NULL, FTAG, &dd));
 
@@ -736,7 +795,7 @@ dsl_destroy_head_sync_impl(dsl_dataset_t *ds, dmu_tx_t *tx)
 	rrw_enter(&ds->ds_bp_rwlock, RW_READER, FTAG);
 	ASSERT3U(dsl_dataset_phys(ds)->ds_bp.blk_birth, <=, tx->tx_txg);
 	rrw_exit(&ds->ds_bp_rwlock, FTAG);
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 
 	/* We need to log before removing it from the namespace. */
 	spa_history_log_internal_ds(ds, "destroy", tx, "");
@@ -795,17 +854,22 @@ dsl_destroy_head_sync_impl(dsl_dataset_t *ds, dmu_tx_t *tx)
 	VERIFY0(dmu_objset_from_ds(ds, &os));
 
 	if (!spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_ASYNC_DESTROY)) {
+		dsl_dataset_livelist_destroy(ds, tx);
 		old_synchronous_dataset_destroy(ds, tx);
 	} else {
 		/*
 		 * Move the bptree into the pool's list of trees to
 		 * clean up and update space accounting information.
+		 * The blocks of a clone with a livelist are put on the
+		 * pool's free bpobj instead, with no tree to traverse.
 		 */
 		uint64_t used, comp, uncomp;
+		boolean_t livelist;
 
 		zil_destroy_sync(dmu_objset_zil(os), tx);
 
-		if (!spa_feature_is_active(dp->dp_spa,
+		livelist = dsl_dataset_livelist_free(ds, tx);
+		if (!livelist && !spa_feature_is_active(dp->dp_spa,
 		    SPA_FEATURE_ASYNC_DESTROY)) {
 			dsl_scan_t *scn = dp->dp_scan;
 			spa_feature_incr(dp->dp_spa, SPA_FEATURE_ASYNC_DESTROY,
@@ -826,12 +890,14 @@ dsl_destroy_head_sync_impl(dsl_dataset_t *ds, dmu_tx_t *tx)
 		ASSERT(!DS_UNIQUE_IS_ACCURATE(ds) ||
 		    dsl_dataset_phys(ds)->ds_unique_bytes == used);
 
-		rrw_enter(&ds->ds_bp_rwlock, RW_READER, FTAG);
-		bptree_add(mos, dp->dp_bptree_obj,
-		    &dsl_dataset_phys(ds)->ds_bp,
-		    dsl_dataset_phys(ds)->ds_prev_snap_txg,
-		    used, comp, uncomp, tx);
-		rrw_exit(&ds->ds_bp_rwlock, FTAG);
+		if (!livelist) {
+			rrw_enter(&ds->ds_bp_rwlock, RW_READER, FTAG);
+			bptree_add(mos, dp->dp_bptree_obj,
+			    &dsl_dataset_phys(ds)->ds_bp,
+			    dsl_dataset_phys(ds)->ds_prev_snap_txg,
+			    used, comp, uncomp, tx);
+			rrw_exit(&ds->ds_bp_rwlock, FTAG);
+		}
 		dsl_dir_diduse_space(ds->ds_dir, DD_USED_HEAD,
 		    -used, -comp, -uncomp, tx);
 		dsl_dir_diduse_space(dp->dp_free_dir, DD_USED_HEAD,
@@ -1896,6 +1896,7 @@ dsl_dir_rename_sync(void *arg, dmu_tx_t *tx)
 	VERIFY0(dsl_dir_hold(dp, ddra->ddra_oldname, FTAG, &dd, NULL));
 	VERIFY0(dsl_dir_hold(dp, ddra->ddra_newname, FTAG, &newparent,
 	    &mynewname));
+	atomic_inc_64(&dsl_dataset_snapshot_gen);
 
 	/* Log this before we change the name. */
 	spa_history_log_internal_dd(dd, "rename", tx,
@@ -104,7 +104,8 @@ int zfs_dirty_data_max_percent = 10;
 int zfs_dirty_data_max_max_percent = 25;
 
 /*
- * If there is at least this much dirty data, push out a txg.
+ * If there is at least this much dirty data, push out a txg.  The sync
+ * thread adapts the threshold to the pool, see zfs_txg_sync_target_ms.
  */
 unsigned long zfs_dirty_data_sync = 64 * 1024 * 1024;
 
@@ -130,6 +131,13 @@ int zfs_delay_min_dirty_percent = 60;
  */
 unsigned long zfs_delay_scale = 1000 * 1000 * 1000 / 2000;
 
+/*
+ * Scale each transaction's delay by its objset's share of the dirty data,
+ * so that a bulk writer doesn't delay the writes of light ones as much as
+ * its own.  See dmu_tx_delay().
+ */
+int zfs_delay_fairness = 1;
+
 /*
  * This determines the number of threads used by the dp_sync_taskq.
  */
@@ -159,7 +167,8 @@ dsl_pool_open_impl(spa_t *spa, uint64_t txg)
 	dp = kmem_zalloc(sizeof (dsl_pool_t), KM_SLEEP);
 	dp->dp_spa = spa;
 	dp->dp_meta_rootbp = *bp;
-	rrw_init(&dp->dp_config_rwlock, B_TRUE);
+	dp->dp_free_budget = zfs_free_max_blocks;
+	rrm_init(&dp->dp_config_rwlock, B_TRUE);
 	txg_init(dp, txg);
 	mmp_init(spa);
 
@@ -175,6 +184,10 @@ dsl_pool_open_impl(spa_t *spa, uint64_t txg)
 	dp->dp_sync_taskq = taskq_create("dp_sync_taskq",
 	    zfs_sync_taskq_batch_pct, minclsyspri, 1, INT_MAX,
 	    TASKQ_THREADS_CPU_PCT);
+	/* See dbuf_sync_list(), must not be dp_sync_taskq */
+	dp->dp_sync_indirect_taskq = taskq_create("dp_sync_indirect_taskq",
+	    zfs_sync_taskq_batch_pct, minclsyspri, 1, INT_MAX,
+	    TASKQ_THREADS_CPU_PCT);
 
 	mutex_init(&dp->dp_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&dp->dp_spaceavail_cv, NULL, CV_DEFAULT, NULL);
@@ -217,7 +230,7 @@ dsl_pool_open(dsl_pool_t *dp)
 	dsl_dataset_t *ds;
 	uint64_t obj;
 
-	rrw_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
+	rrm_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
 	err = zap_lookup(dp->dp_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
 	    DMU_POOL_ROOT_DATASET, sizeof (uint64_t), 1,
 	    &dp->dp_root_dir_obj);
@@ -298,7 +311,7 @@ dsl_pool_open(dsl_pool_t *dp)
 	err = dsl_scan_init(dp, dp->dp_tx.tx_open_txg);
 
 out:
-	rrw_exit(&dp->dp_config_rwlock, FTAG);
+	rrm_exit(&dp->dp_config_rwlock, FTAG);
 	return (err);
 }
 
@@ -334,6 +347,7 @@ dsl_pool_close(dsl_pool_t *dp)
 	txg_list_destroy(&dp->dp_sync_tasks);
 	txg_list_destroy(&dp->dp_dirty_dirs);
 
+	taskq_destroy(dp->dp_sync_indirect_taskq);
 	taskq_destroy(dp->dp_sync_taskq);
 
 	/*
@@ -349,7 +363,7 @@ dsl_pool_close(dsl_pool_t *dp)
 	dsl_scan_fini(dp);
 	dmu_buf_user_evict_wait();
 
-	rrw_destroy(&dp->dp_config_rwlock);
+	rrm_destroy(&dp->dp_config_rwlock);
 	mutex_destroy(&dp->dp_lock);
 	cv_destroy(&dp->dp_spaceavail_cv);
 	taskq_destroy(dp->dp_iput_taskq);
@@ -368,7 +382,7 @@ dsl_pool_create(spa_t *spa, nvlist_t *zplprops, uint64_t txg)
 	dsl_dataset_t *ds;
 	uint64_t obj;
 
-	rrw_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
+	rrm_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
 
 	/* create and open the MOS (meta-objset) */
 	dp->dp_meta_objset = dmu_objset_create_impl(spa,
@@ -426,7 +440,7 @@ dsl_pool_create(spa_t *spa, nvlist_t *zplprops, uint64_t txg)
 
 	dmu_tx_commit(tx);
 
-	rrw_exit(&dp->dp_config_rwlock, FTAG);
+	rrm_exit(&dp->dp_config_rwlock, FTAG);
 
 	return (dp);
 }
@@ -483,6 +497,7 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 	dsl_dataset_t *ds;
 	objset_t *mos = dp->dp_meta_objset;
 	list_t synced_datasets;
+	hrtime_t t = gethrtime();
 
 	list_create(&synced_datasets, sizeof (dsl_dataset_t),
 	    offsetof(dsl_dataset_t, ds_synced_link));
@@ -512,13 +527,17 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 	 * rounding error in dbuf_write_physdone).
 	 * Shore up the accounting of any dirtied space now.
 	 */
-	dsl_pool_undirty_space(dp, dp->dp_dirty_pertxg[txg & TXG_MASK], txg);
+	dsl_pool_undirty_space(dp, NULL, dp->dp_dirty_pertxg[txg & TXG_MASK],
+	    txg);
 
 	/*
 	 * Update the long range free counter after
 	 * we're done syncing user data
 	 */
 	mutex_enter(&dp->dp_lock);
+	for (ds = list_head(&synced_datasets); ds != NULL;
+	    ds = list_next(&synced_datasets, ds))
+		ds->ds_objset->os_dirty_pertxg[txg & TXG_MASK] = 0;
 	ASSERT(spa_sync_pass(dp->dp_spa) == 1 ||
 	    dp->dp_long_free_dirty_pertxg[txg & TXG_MASK] == 0);
 	dp->dp_long_free_dirty_pertxg[txg & TXG_MASK] = 0;
@@ -550,6 +569,7 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 		dsl_dataset_sync(ds, zio, tx);
 	}
 	VERIFY0(zio_wait(zio));
+	t = spa_sync_phase_end(dp->dp_spa, SPA_SYNC_DATASETS, t);
 
 	/*
 	 * Now that the datasets have been completely synced, we can
@@ -607,6 +627,7 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 	}
 
 	dmu_tx_commit(tx);
+	(void) spa_sync_phase_end(dp->dp_spa, SPA_SYNC_MOS, t);
 
 	DTRACE_PROBE2(dsl_pool_sync__done, dsl_pool_t *dp, dp, uint64_t, txg);
 }
@@ -630,6 +651,10 @@ dsl_pool_sync_done(dsl_pool_t *dp, uint64_t txg)
 		dmu_buf_rele(ds->ds_dbuf, zilog);
 	}
 	ASSERT(!dmu_objset_is_dirty(dp->dp_meta_objset, txg));
+
+	mutex_enter(&dp->dp_lock);
+	dp->dp_long_free_blocks_pertxg[txg & TXG_MASK] = 0;
+	mutex_exit(&dp->dp_lock);
 }
 
 /*
@@ -641,7 +666,8 @@ dsl_pool_sync_context(dsl_pool_t *dp)
 {
 	return (curthread == dp->dp_tx.tx_sync_thread ||
 	    spa_is_initializing(dp->dp_spa) ||
-	    taskq_member(dp->dp_sync_taskq, curthread));
+	    taskq_member(dp->dp_sync_taskq, curthread) ||
+	    taskq_member(dp->dp_sync_indirect_taskq, curthread));
 }
 
 uint64_t
@@ -670,7 +696,7 @@ dsl_pool_need_dirty_delay(dsl_pool_t *dp)
 	boolean_t rv;
 
 	mutex_enter(&dp->dp_lock);
-	if (dp->dp_dirty_total > zfs_dirty_data_sync)
+	if (dp->dp_dirty_total > txg_dirty_sync_threshold(dp))
 		txg_kick(dp);
 	rv = (dp->dp_dirty_total > delay_min_bytes);
 	mutex_exit(&dp->dp_lock);
@@ -678,24 +704,35 @@ dsl_pool_need_dirty_delay(dsl_pool_t *dp)
 }
 
 void
-dsl_pool_dirty_space(dsl_pool_t *dp, int64_t space, dmu_tx_t *tx)
+dsl_pool_dirty_space(dsl_pool_t *dp, objset_t *os, int64_t space,
+    dmu_tx_t *tx)
 {
 	if (space > 0) {
 		mutex_enter(&dp->dp_lock);
 		dp->dp_dirty_pertxg[tx->tx_txg & TXG_MASK] += space;
+		os->os_dirty_pertxg[tx->tx_txg & TXG_MASK] += space;
 		dsl_pool_dirty_delta(dp, space);
 		mutex_exit(&dp->dp_lock);
 	}
 }
 
+/*
+ * Retire space dirtied in txg, of os if it's known.  dsl_pool_sync() writes
+ * off what is left of a txg, of the pool and of each synced objset.
+ */
 void
-dsl_pool_undirty_space(dsl_pool_t *dp, int64_t space, uint64_t txg)
+dsl_pool_undirty_space(dsl_pool_t *dp, objset_t *os, int64_t space,
+    uint64_t txg)
 {
 	ASSERT3S(space, >=, 0);
 	if (space == 0)
 		return;
 
 	mutex_enter(&dp->dp_lock);
+	if (os != NULL) {
+		os->os_dirty_pertxg[txg & TXG_MASK] -=
+		    MIN(os->os_dirty_pertxg[txg & TXG_MASK], space);
+	}
 	if (dp->dp_dirty_pertxg[txg & TXG_MASK] < space) {
 		/* XXX writing something we didn't dirty? */
 		space = dp->dp_dirty_pertxg[txg & TXG_MASK];
@@ -861,7 +898,7 @@ dsl_pool_create_origin(dsl_pool_t *dp, dmu_tx_t *tx)
 
 	ASSERT(dmu_tx_is_syncing(tx));
 	ASSERT(dp->dp_origin_snap == NULL);
-	ASSERT(rrw_held(&dp->dp_config_rwlock, RW_WRITER));
+	ASSERT(rrm_held(&dp->dp_config_rwlock, RW_WRITER));
 
 	/* create the origin dir, ds, & snap-ds */
 	dsobj = dsl_dataset_create_sync(dp->dp_root_dir, ORIGIN_DIR_NAME,
@@ -1079,33 +1116,33 @@ dsl_pool_config_enter(dsl_pool_t *dp, void *tag)
 	 * read, but not *which* threads, so rw_held(RW_READER) returns TRUE
 	 * if any thread holds it for read, even if this thread doesn't).
 	 */
-	ASSERT(!rrw_held(&dp->dp_config_rwlock, RW_READER));
-	rrw_enter(&dp->dp_config_rwlock, RW_READER, tag);
+	ASSERT(!rrm_held(&dp->dp_config_rwlock, RW_READER));
+	rrm_enter(&dp->dp_config_rwlock, RW_READER, tag);
 }
 
 void
 dsl_pool_config_enter_prio(dsl_pool_t *dp, void *tag)
 {
-	ASSERT(!rrw_held(&dp->dp_config_rwlock, RW_READER));
-	rrw_enter_read_prio(&dp->dp_config_rwlock, tag);
+	ASSERT(!rrm_held(&dp->dp_config_rwlock, RW_READER));
+	rrm_enter_read_prio(&dp->dp_config_rwlock, tag);
 }
 
 void
 dsl_pool_config_exit(dsl_pool_t *dp, void *tag)
 {
-	rrw_exit(&dp->dp_config_rwlock, tag);
+	rrm_exit(&dp->dp_config_rwlock, tag);
 }
 
 boolean_t
 dsl_pool_config_held(dsl_pool_t *dp)
 {
-	return (RRW_LOCK_HELD(&dp->dp_config_rwlock));
+	return (RRM_LOCK_HELD(&dp->dp_config_rwlock));
 }
 
 boolean_t
 dsl_pool_config_held_writer(dsl_pool_t *dp)
 {
-	return (RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	return (RRM_WRITE_HELD(&dp->dp_config_rwlock));
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
@@ -1139,6 +1176,10 @@ MODULE_PARM_DESC(zfs_dirty_data_sync, "sync txg when this much dirty data");
 module_param(zfs_delay_scale, ulong, 0644);
 MODULE_PARM_DESC(zfs_delay_scale, "how quickly delay approaches infinity");
 
+module_param(zfs_delay_fairness, int, 0644);
+MODULE_PARM_DESC(zfs_delay_fairness,
+	"scale transaction delay by the objset's share of dirty data");
+
 module_param(zfs_sync_taskq_batch_pct, int, 0644);
 MODULE_PARM_DESC(zfs_sync_taskq_batch_pct,
 	"max percent of CPUs that are used to sync dirty data");
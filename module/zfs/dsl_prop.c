@@ -563,7 +563,7 @@ void
 dsl_prop_notify_all(dsl_dir_t *dd)
 {
 	dsl_pool_t *dp = dd->dd_pool;
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 	(void) dmu_objset_find_dp(dp, dd->dd_object, dsl_prop_notify_all_cb,
 	    NULL, DS_FIND_CHILDREN);
 }
@@ -580,7 +580,7 @@ dsl_prop_changed_notify(dsl_pool_t *dp, uint64_t ddobj,
 	zap_attribute_t *za;
 	int err;
 
-	ASSERT(RRW_WRITE_HELD(&dp->dp_config_rwlock));
+	ASSERT(RRM_WRITE_HELD(&dp->dp_config_rwlock));
 	err = dsl_dir_hold_obj(dp, ddobj, NULL, FTAG, &dd);
 	if (err)
 		return;
@@ -846,21 +846,19 @@ typedef struct dsl_props_set_arg {
 } dsl_props_set_arg_t;
 
 static int
-dsl_props_set_check(void *arg, dmu_tx_t *tx)
+dsl_props_set_check_impl(dsl_pool_t *dp, const char *dsname, nvlist_t *props)
 {
-	dsl_props_set_arg_t *dpsa = arg;
-	dsl_pool_t *dp = dmu_tx_pool(tx);
 	dsl_dataset_t *ds;
 	uint64_t version;
 	nvpair_t *elem = NULL;
 	int err;
 
-	err = dsl_dataset_hold(dp, dpsa->dpsa_dsname, FTAG, &ds);
+	err = dsl_dataset_hold(dp, dsname, FTAG, &ds);
 	if (err != 0)
 		return (err);
 
 	version = spa_version(ds->ds_dir->dd_pool->dp_spa);
-	while ((elem = nvlist_next_nvpair(dpsa->dpsa_props, elem)) != NULL) {
+	while ((elem = nvlist_next_nvpair(props, elem)) != NULL) {
 		if (strlen(nvpair_name(elem)) >= ZAP_MAXNAMELEN) {
 			dsl_dataset_rele(ds, FTAG);
 			return (SET_ERROR(ENAMETOOLONG));
@@ -884,6 +882,15 @@ dsl_props_set_check(void *arg, dmu_tx_t *tx)
 	return (0);
 }
 
+static int
+dsl_props_set_check(void *arg, dmu_tx_t *tx)
+{
+	dsl_props_set_arg_t *dpsa = arg;
+
+	return (dsl_props_set_check_impl(dmu_tx_pool(tx), dpsa->dpsa_dsname,
+	    dpsa->dpsa_props));
+}
+
 void
 dsl_props_set_sync_impl(dsl_dataset_t *ds, zprop_source_t source,
     nvlist_t *props, dmu_tx_t *tx)
@@ -959,6 +966,80 @@ dsl_props_set(const char *dsname, zprop_source_t source, nvlist_t *props)
 	    &dpsa, nblks, ZFS_SPACE_CHECK_RESERVED));
 }
 
+typedef struct dsl_props_set_multi_arg {
+	zprop_source_t dpsma_source;
+	nvlist_t *dpsma_dsprops;	/* dataset name -> props */
+} dsl_props_set_multi_arg_t;
+
+static int
+dsl_props_set_multi_check(void *arg, dmu_tx_t *tx)
+{
+	dsl_props_set_multi_arg_t *dpsma = arg;
+	dsl_pool_t *dp = dmu_tx_pool(tx);
+	nvpair_t *pair;
+	int err;
+
+	for (pair = nvlist_next_nvpair(dpsma->dpsma_dsprops, NULL);
+	    pair != NULL;
+	    pair = nvlist_next_nvpair(dpsma->dpsma_dsprops, pair)) {
+		err = dsl_props_set_check_impl(dp, nvpair_name(pair),
+		    fnvpair_value_nvlist(pair));
+		if (err != 0)
+			return (err);
+	}
+	return (0);
+}
+
+static void
+dsl_props_set_multi_sync(void *arg, dmu_tx_t *tx)
+{
+	dsl_props_set_multi_arg_t *dpsma = arg;
+	dsl_pool_t *dp = dmu_tx_pool(tx);
+	dsl_dataset_t *ds;
+	nvpair_t *pair;
+
+	for (pair = nvlist_next_nvpair(dpsma->dpsma_dsprops, NULL);
+	    pair != NULL;
+	    pair = nvlist_next_nvpair(dpsma->dpsma_dsprops, pair)) {
+		VERIFY0(dsl_dataset_hold(dp, nvpair_name(pair), FTAG, &ds));
+		dsl_props_set_sync_impl(ds, dpsma->dpsma_source,
+		    fnvpair_value_nvlist(pair), tx);
+		dsl_dataset_rele(ds, FTAG);
+	}
+}
+
+/*
+ * Set the properties of many datasets of one pool in a single sync task,
+ * so that they all land in the same txg.  dsprops maps each dataset name
+ * to the nvlist of properties to set on it.  All-or-nothing, like
+ * dsl_props_set(): if any dataset or prop fails the check, nothing will be
+ * modified.
+ */
+int
+dsl_props_set_multi(const char *poolname, zprop_source_t source,
+    nvlist_t *dsprops)
+{
+	dsl_props_set_multi_arg_t dpsma;
+	nvpair_t *pair;
+	int nblks = 0;
+
+	dpsma.dpsma_source = source;
+	dpsma.dpsma_dsprops = dsprops;
+
+	for (pair = nvlist_next_nvpair(dsprops, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(dsprops, pair)) {
+		if (nvpair_type(pair) != DATA_TYPE_NVLIST)
+			return (SET_ERROR(EINVAL));
+		if ((source & ZPROP_SRC_NONE) == 0)
+			nblks += 2 * fnvlist_num_pairs(
+			    fnvpair_value_nvlist(pair));
+	}
+
+	return (dsl_sync_task(poolname, dsl_props_set_multi_check,
+	    dsl_props_set_multi_sync, &dpsma, nblks,
+	    ZFS_SPACE_CHECK_RESERVED));
+}
+
 typedef enum dsl_prop_getflags {
 	DSL_PROP_GET_INHERITING = 0x1,	/* searching parent of target ds */
 	DSL_PROP_GET_SNAPSHOT = 0x2,	/* snapshot dataset */
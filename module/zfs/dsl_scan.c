@@ -58,6 +58,8 @@ typedef int (scan_cb_t)(dsl_pool_t *, const blkptr_t *,
     const zbookmark_phys_t *);
 
 static scan_cb_t dsl_scan_scrub_cb;
+static void dsl_scan_queues_create(dsl_scan_t *);
+static void dsl_scan_queues_issue(dsl_scan_t *);
 static void dsl_scan_cancel_sync(void *, dmu_tx_t *);
 static void dsl_scan_sync_state(dsl_scan_t *, dmu_tx_t *);
 static boolean_t dsl_scan_restarting(dsl_scan_t *, dmu_tx_t *);
@@ -70,13 +72,43 @@ int zfs_scan_idle = 50;			/* idle window in clock ticks */
 int zfs_scan_min_time_ms = 1000; /* min millisecs to scrub per txg */
 int zfs_free_min_time_ms = 1000; /* min millisecs to free per txg */
 int zfs_resilver_min_time_ms = 3000; /* min millisecs to resilver per txg */
+int zfs_resilver_open_first = B_TRUE; /* resilver datasets in use first */
 int zfs_no_scrub_io = B_FALSE; /* set to disable scrub i/o */
 int zfs_no_scrub_prefetch = B_FALSE; /* set to disable scrub prefetch */
+int zfs_scan_legacy = B_FALSE; /* set to issue scrub i/o unsorted */
+int zfs_scan_mem_lim_fact = 20; /* fraction of ram for scrub i/o queues */
+unsigned long zfs_scan_queue_limit = 256 << 20; /* queued bytes per vdev */
+
+/*
+ * Scrub and resilver i/o can instead be paced by the latency of the
+ * synchronous reads of the pool.  Every DSL_SCAN_PACE_INTERVAL_MS, if more
+ * than (100 - zfs_scan_latency_pctile) percent of the sync reads took
+ * longer than zfs_scan_latency_target_us, the scan i/o allowed in flight
+ * is halved, otherwise it grows by a tenth of zfs_top_maxinflight, up to
+ * the full amount.  The zfs_scan_idle delays are not used then.
+ */
+int zfs_scan_latency_target_us = 0;	/* 0 disables pacing by latency */
+int zfs_scan_latency_pctile = 99;
+
+#define	DSL_SCAN_PACE_INTERVAL_MS	100
+#define	DSL_SCAN_PACE_MIN_SAMPLES	16
+#define	DSL_SCAN_PACE_MIN_PCT		1
 enum ddt_class zfs_scrub_ddt_class_max = DDT_CLASS_DUPLICATE;
 int dsl_scan_delay_completion = B_FALSE; /* set to delay scan completion */
 /* max number of blocks to free in a single TXG */
 unsigned long zfs_free_max_blocks = 100000;
 
+/*
+ * The number of blocks actually freed per txg, dp_free_budget, adapts to
+ * the time the txgs take to sync: it is halved after a txg which took
+ * longer than zfs_free_sync_target_ms, down to a hundredth of
+ * zfs_free_max_blocks, and otherwise grows by an eighth back up to it.
+ * The budget is shared between the async destroys and frees of the free
+ * bpobj done here and the long range frees of dmu_free_long_range(), such
+ * as zvol discards and file deletes.
+ */
+int zfs_free_sync_target_ms = 2000;	/* 0 disables the adaptation */
+
 #define	DSL_SCAN_IS_SCRUB_RESILVER(scn) \
 	((scn)->scn_phys.scn_func == POOL_SCAN_SCRUB || \
 	(scn)->scn_phys.scn_func == POOL_SCAN_RESILVER)
@@ -320,6 +352,10 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		scn->scn_phys.scn_queue_obj = 0;
 	}
 
+	/* stop counting sync reads for dsl_scan_pace() */
+	spa->spa_scan_lat_target = 0;
+	scn->scn_pace_pct = 0;
+
 	scn->scn_phys.scn_flags &= ~DSF_SCRUB_PAUSED;
 
 	/*
@@ -561,6 +597,10 @@ dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 	 *  - we have scanned for the maximum time: an entire txg
 	 *    timeout (default 5 sec)
 	 *  or
+	 *  - the sorted i/o queues have used up their share of memory
+	 *    (default 1/20th of ram), or hold as much data as we want to
+	 *    read in one txg (default 256M per top-level vdev)
+	 *  or
 	 *  - we have scanned for at least the minimum time (default 1 sec
 	 *    for scrub, 3 sec for resilver), and either we have sufficient
 	 *    dirty data that we are starting to write more quickly
@@ -575,6 +615,10 @@ dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
 	dirty_pct = scn->scn_dp->dp_dirty_total * 100 / zfs_dirty_data_max;
 	if (elapsed_nanosecs / NANOSEC >= zfs_txg_timeout ||
+	    (scn->scn_queues != NULL &&
+	    (scn->scn_queued_bytes >= physmem * PAGESIZE /
+	    MAX(zfs_scan_mem_lim_fact, 1) || scn->scn_queued_psize >=
+	    scn->scn_nqueues * zfs_scan_queue_limit)) ||
 	    (NSEC2MSEC(elapsed_nanosecs) > mintime &&
 	    (txg_sync_waiting(scn->scn_dp) ||
 	    dirty_pct >= zfs_vdev_async_write_active_min_dirty_percent)) ||
@@ -1452,6 +1496,45 @@ dsl_scan_ddt_entry(dsl_scan_t *scn, enum zio_checksum checksum,
 	}
 }
 
+/*
+ * Look up the next dataset in the scan queue.  A resilver takes the
+ * datasets that are open, such as the zvols being served, ahead of the
+ * rest, so that the data in use is redundant again as soon as possible.
+ * The cursor is left initialized for the caller to zap_cursor_fini().
+ */
+static boolean_t
+dsl_scan_queue_next(dsl_scan_t *scn, zap_cursor_t *zc, zap_attribute_t *za)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	uint64_t queue_obj = scn->scn_phys.scn_queue_obj;
+	boolean_t found = B_FALSE;
+
+	if (scn->scn_phys.scn_func == POOL_SCAN_RESILVER &&
+	    zfs_resilver_open_first) {
+		for (zap_cursor_init(zc, dp->dp_meta_objset, queue_obj);
+		    zap_cursor_retrieve(zc, za) == 0;
+		    zap_cursor_advance(zc)) {
+			dsl_dataset_t *ds;
+
+			if (dsl_dataset_hold_obj(dp,
+			    zfs_strtonum(za->za_name, NULL), FTAG, &ds) != 0)
+				continue;
+			found = dsl_dataset_has_owner(ds);
+			dsl_dataset_rele(ds, FTAG);
+			if (found)
+				break;
+		}
+		zap_cursor_fini(zc);
+		zap_cursor_init(zc, dp->dp_meta_objset, queue_obj);
+		if (found)
+			return (B_TRUE);
+	} else {
+		zap_cursor_init(zc, dp->dp_meta_objset, queue_obj);
+	}
+
+	return (zap_cursor_retrieve(zc, za) == 0);
+}
+
 static void
 dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 {
@@ -1509,9 +1592,7 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 	za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
 
 	/* keep pulling things out of the zap-object-as-queue */
-	while (zap_cursor_init(zc, dp->dp_meta_objset,
-	    scn->scn_phys.scn_queue_obj),
-	    zap_cursor_retrieve(zc, za) == 0) {
+	while (dsl_scan_queue_next(scn, zc, za)) {
 		dsl_dataset_t *ds;
 		uint64_t dsobj;
 
@@ -1544,6 +1625,37 @@ out:
 	kmem_free(zc, sizeof (zap_cursor_t));
 }
 
+void
+dsl_scan_free_budget_update(dsl_pool_t *dp, hrtime_t synctime)
+{
+	uint64_t budget = dp->dp_free_budget;
+	uint64_t floor = MAX(zfs_free_max_blocks / 100, 1);
+
+	if (zfs_free_sync_target_ms == 0)
+		budget = zfs_free_max_blocks;
+	else if (NSEC2MSEC(synctime) > zfs_free_sync_target_ms)
+		budget = MAX(budget / 2, floor);
+	else
+		budget += budget / 8 + 1;
+	dp->dp_free_budget = MIN(budget, zfs_free_max_blocks);
+}
+
+/*
+ * The part of the free budget of the syncing txg not already taken by the
+ * long range frees in it.  An eighth of it is left for the async frees
+ * regardless, so that they still make progress under constant discards.
+ */
+static uint64_t
+dsl_scan_free_budget(dsl_scan_t *scn)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	uint64_t txg = spa_syncing_txg(dp->dp_spa);
+	uint64_t budget = dp->dp_free_budget;
+	uint64_t used = dp->dp_long_free_blocks_pertxg[txg & TXG_MASK];
+
+	return (MAX(budget - MIN(used, budget), budget / 8));
+}
+
 static boolean_t
 dsl_scan_free_should_suspend(dsl_scan_t *scn)
 {
@@ -1552,7 +1664,7 @@ dsl_scan_free_should_suspend(dsl_scan_t *scn)
 	if (zfs_recover)
 		return (B_FALSE);
 
-	if (scn->scn_visited_this_txg >= zfs_free_max_blocks)
+	if (scn->scn_visited_this_txg >= dsl_scan_free_budget(scn))
 		return (B_TRUE);
 
 	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
@@ -1743,12 +1855,12 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 		 * space to the dp_leak_dir.
 		 */
 		if (dp->dp_leak_dir == NULL) {
-			rrw_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
+			rrm_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
 			(void) dsl_dir_create_sync(dp, dp->dp_root_dir,
 			    LEAK_DIR_NAME, tx);
 			VERIFY0(dsl_pool_open_special_dir(dp,
 			    LEAK_DIR_NAME, &dp->dp_leak_dir));
-			rrw_exit(&dp->dp_config_rwlock, FTAG);
+			rrm_exit(&dp->dp_config_rwlock, FTAG);
 		}
 		dsl_dir_diduse_space(dp->dp_leak_dir, DD_USED_HEAD,
 		    dsl_dir_phys(dp->dp_free_dir)->dd_used_bytes,
@@ -1806,9 +1918,13 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 
 	scn->scn_zio_root = zio_root(dp->dp_spa, NULL,
 	    NULL, ZIO_FLAG_CANFAIL);
+	if (DSL_SCAN_IS_SCRUB_RESILVER(scn) && !zfs_scan_legacy)
+		dsl_scan_queues_create(scn);
 	dsl_pool_config_enter(dp, FTAG);
 	dsl_scan_visit(scn, tx);
 	dsl_pool_config_exit(dp, FTAG);
+	if (scn->scn_queues != NULL)
+		dsl_scan_queues_issue(scn);
 	(void) zio_wait(scn->scn_zio_root);
 	scn->scn_zio_root = NULL;
 
@@ -1933,6 +2049,203 @@ dsl_scan_scrub_done(zio_t *zio)
 	mutex_exit(&spa->spa_scrub_lock);
 }
 
+/*
+ * Adjust scn_pace_pct once an interval from the sync reads counted by
+ * vdev_queue_io_done().  Returns B_FALSE if the scan isn't paced by
+ * latency.
+ */
+static boolean_t
+dsl_scan_pace(dsl_scan_t *scn)
+{
+	spa_t *spa = scn->scn_dp->dp_spa;
+	hrtime_t now = gethrtime();
+	hrtime_t target = USEC2NSEC(zfs_scan_latency_target_us);
+	uint64_t reads, slow, allowed;
+
+	if (target <= 0) {
+		spa->spa_scan_lat_target = 0;
+		return (B_FALSE);
+	}
+
+	if (spa->spa_scan_lat_target == 0 || scn->scn_pace_pct == 0) {
+		spa->spa_scan_lat_target = target;
+		scn->scn_pace_pct = 100;
+		scn->scn_pace_start = now;
+		scn->scn_pace_reads = spa->spa_scan_lat_reads;
+		scn->scn_pace_slow = spa->spa_scan_lat_slow;
+		return (B_TRUE);
+	}
+	if (now - scn->scn_pace_start < MSEC2NSEC(DSL_SCAN_PACE_INTERVAL_MS))
+		return (B_TRUE);
+
+	reads = spa->spa_scan_lat_reads - scn->scn_pace_reads;
+	slow = spa->spa_scan_lat_slow - scn->scn_pace_slow;
+	allowed = reads * (100 - MIN(MAX(zfs_scan_latency_pctile, 0), 100)) /
+	    100;
+
+	if (reads >= DSL_SCAN_PACE_MIN_SAMPLES && slow > allowed) {
+		scn->scn_pace_pct = MAX(scn->scn_pace_pct / 2,
+		    DSL_SCAN_PACE_MIN_PCT);
+	} else {
+		scn->scn_pace_pct = MIN(scn->scn_pace_pct + 10, 100);
+	}
+
+	spa->spa_scan_lat_target = target;
+	scn->scn_pace_start = now;
+	scn->scn_pace_reads = spa->spa_scan_lat_reads;
+	scn->scn_pace_slow = spa->spa_scan_lat_slow;
+
+	return (B_TRUE);
+}
+
+/*
+ * Read a block for a scrub or resilver, waiting for a slot if the pool
+ * already has its fill of scan i/o outstanding.
+ */
+static void
+dsl_scan_scrub_issue(dsl_scan_t *scn, const blkptr_t *bp,
+    const zbookmark_phys_t *zb, int zio_flags)
+{
+	spa_t *spa = scn->scn_dp->dp_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
+	size_t psize = BP_GET_PSIZE(bp);
+	boolean_t paced = dsl_scan_pace(scn);
+	int scan_delay;
+
+	scan_delay = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
+	    zfs_resilver_delay : zfs_scrub_delay;
+	if (paced)
+		maxinflight = MAX(maxinflight * scn->scn_pace_pct / 100, 1);
+
+	mutex_enter(&spa->spa_scrub_lock);
+	while (spa->spa_scrub_inflight >= maxinflight)
+		cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
+	spa->spa_scrub_inflight++;
+	mutex_exit(&spa->spa_scrub_lock);
+
+	/*
+	 * If we're seeing recent (zfs_scan_idle) "important" I/Os
+	 * then throttle our workload to limit the impact of a scan.
+	 */
+	if (!paced && ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
+		delay(scan_delay);
+
+	zio_nowait(zio_read(NULL, spa, bp,
+	    abd_alloc_for_io(psize, B_FALSE),
+	    psize, dsl_scan_scrub_done, NULL,
+	    ZIO_PRIORITY_SCRUB, zio_flags, zb));
+}
+
+/*
+ * A block waiting in a scan queue to be read.
+ */
+typedef struct scan_io {
+	blkptr_t		sio_bp;
+	zbookmark_phys_t	sio_zb;
+	int			sio_flags;
+	avl_node_t		sio_node;
+} scan_io_t;
+
+static int
+scan_io_compare(const void *x1, const void *x2)
+{
+	const scan_io_t *s1 = x1;
+	const scan_io_t *s2 = x2;
+
+	return (AVL_CMP(DVA_GET_OFFSET(&s1->sio_bp.blk_dva[0]),
+	    DVA_GET_OFFSET(&s2->sio_bp.blk_dva[0])));
+}
+
+/*
+ * Set up a queue for each top-level vdev for the traversal in this txg.
+ * The vdev tree can't change under us, as spa_sync() holds SCL_CONFIG.
+ */
+static void
+dsl_scan_queues_create(dsl_scan_t *scn)
+{
+	uint64_t q;
+
+	ASSERT3P(scn->scn_queues, ==, NULL);
+
+	scn->scn_nqueues = scn->scn_dp->dp_spa->spa_root_vdev->vdev_children;
+	scn->scn_queues = kmem_alloc(scn->scn_nqueues * sizeof (avl_tree_t),
+	    KM_SLEEP);
+	scn->scn_queued_bytes = 0;
+	scn->scn_queued_psize = 0;
+	for (q = 0; q < scn->scn_nqueues; q++) {
+		avl_create(&scn->scn_queues[q], scan_io_compare,
+		    sizeof (scan_io_t), offsetof(scan_io_t, sio_node));
+	}
+}
+
+/*
+ * Queue a block to be read later, by the offset of its first copy.  A
+ * block found again at the same place, as happens with dedup, is only
+ * read once.  Returns B_FALSE if the block can't be queued and must be
+ * read right away.
+ */
+static boolean_t
+dsl_scan_enqueue(dsl_scan_t *scn, const blkptr_t *bp,
+    const zbookmark_phys_t *zb, int zio_flags)
+{
+	uint64_t q = DVA_GET_VDEV(&bp->blk_dva[0]);
+	scan_io_t *sio;
+	avl_index_t where;
+
+	if (q >= scn->scn_nqueues)
+		return (B_FALSE);
+
+	sio = kmem_alloc(sizeof (scan_io_t), KM_SLEEP);
+	sio->sio_bp = *bp;
+	sio->sio_zb = *zb;
+	sio->sio_flags = zio_flags;
+
+	if (avl_find(&scn->scn_queues[q], sio, &where) != NULL) {
+		kmem_free(sio, sizeof (scan_io_t));
+		return (B_TRUE);
+	}
+	avl_insert(&scn->scn_queues[q], sio, where);
+	scn->scn_queued_bytes += sizeof (scan_io_t);
+	scn->scn_queued_psize += BP_GET_PSIZE(bp);
+
+	return (B_TRUE);
+}
+
+/*
+ * Read everything queued in this txg and tear the queues down.  The vdevs
+ * are taken in turn, a block at a time, so that they are all kept busy
+ * while each one sees its blocks in offset order.
+ */
+static void
+dsl_scan_queues_issue(dsl_scan_t *scn)
+{
+	boolean_t issued;
+	scan_io_t *sio;
+	uint64_t q;
+
+	do {
+		issued = B_FALSE;
+		for (q = 0; q < scn->scn_nqueues; q++) {
+			if ((sio = avl_first(&scn->scn_queues[q])) == NULL)
+				continue;
+			avl_remove(&scn->scn_queues[q], sio);
+			dsl_scan_scrub_issue(scn, &sio->sio_bp, &sio->sio_zb,
+			    sio->sio_flags);
+			kmem_free(sio, sizeof (scan_io_t));
+			issued = B_TRUE;
+		}
+	} while (issued);
+
+	for (q = 0; q < scn->scn_nqueues; q++)
+		avl_destroy(&scn->scn_queues[q]);
+	kmem_free(scn->scn_queues, scn->scn_nqueues * sizeof (avl_tree_t));
+	scn->scn_queues = NULL;
+	scn->scn_nqueues = 0;
+	scn->scn_queued_bytes = 0;
+	scn->scn_queued_psize = 0;
+}
+
 static boolean_t
 dsl_scan_need_resilver(spa_t *spa, const dva_t *dva, size_t psize,
     uint64_t phys_birth)
@@ -1982,7 +2295,6 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	uint64_t phys_birth = BP_PHYSICAL_BIRTH(bp);
 	boolean_t needs_io = B_FALSE;
 	int zio_flags = ZIO_FLAG_SCAN_THREAD | ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL;
-	int scan_delay = 0;
 	int d;
 
 	if (phys_birth <= scn->scn_phys.scn_min_txg ||
@@ -1998,12 +2310,10 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	if (scn->scn_phys.scn_func == POOL_SCAN_SCRUB) {
 		zio_flags |= ZIO_FLAG_SCRUB;
 		needs_io = B_TRUE;
-		scan_delay = zfs_scrub_delay;
 	} else {
 		ASSERT3U(scn->scn_phys.scn_func, ==, POOL_SCAN_RESILVER);
 		zio_flags |= ZIO_FLAG_RESILVER;
 		needs_io = B_FALSE;
-		scan_delay = zfs_resilver_delay;
 	}
 
 	/* If it's an intent log block, failure is expected. */
@@ -2027,26 +2337,9 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	}
 
 	if (needs_io && !zfs_no_scrub_io) {
-		vdev_t *rvd = spa->spa_root_vdev;
-		uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
-
-		mutex_enter(&spa->spa_scrub_lock);
-		while (spa->spa_scrub_inflight >= maxinflight)
-			cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
-		spa->spa_scrub_inflight++;
-		mutex_exit(&spa->spa_scrub_lock);
-
-		/*
-		 * If we're seeing recent (zfs_scan_idle) "important" I/Os
-		 * then throttle our workload to limit the impact of a scan.
-		 */
-		if (ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
-			delay(scan_delay);
-
-		zio_nowait(zio_read(NULL, spa, bp,
-		    abd_alloc_for_io(psize, B_FALSE),
-		    psize, dsl_scan_scrub_done, NULL,
-		    ZIO_PRIORITY_SCRUB, zio_flags, zb));
+		if (scn->scn_queues == NULL ||
+		    !dsl_scan_enqueue(scn, bp, zb, zio_flags))
+			dsl_scan_scrub_issue(scn, bp, zb, zio_flags);
 	}
 
 	/* do not relocate this block */
@@ -2119,16 +2412,39 @@ MODULE_PARM_DESC(zfs_free_min_time_ms, "Min millisecs to free per txg");
 module_param(zfs_resilver_min_time_ms, int, 0644);
 MODULE_PARM_DESC(zfs_resilver_min_time_ms, "Min millisecs to resilver per txg");
 
+module_param(zfs_resilver_open_first, int, 0644);
+MODULE_PARM_DESC(zfs_resilver_open_first, "Resilver open datasets first");
+
 module_param(zfs_no_scrub_io, int, 0644);
 MODULE_PARM_DESC(zfs_no_scrub_io, "Set to disable scrub I/O");
 
 module_param(zfs_no_scrub_prefetch, int, 0644);
 MODULE_PARM_DESC(zfs_no_scrub_prefetch, "Set to disable scrub prefetching");
 
+module_param(zfs_scan_latency_target_us, int, 0644);
+MODULE_PARM_DESC(zfs_scan_latency_target_us, "Sync read latency goal of scans");
+
+module_param(zfs_scan_latency_pctile, int, 0644);
+MODULE_PARM_DESC(zfs_scan_latency_pctile, "Percentile of the latency goal");
+
+module_param(zfs_scan_legacy, int, 0644);
+MODULE_PARM_DESC(zfs_scan_legacy, "Issue scrub i/o in traversal order");
+
+module_param(zfs_scan_mem_lim_fact, int, 0644);
+MODULE_PARM_DESC(zfs_scan_mem_lim_fact, "Fraction of RAM for scrub i/o queues");
+
+/* CSTYLED */
+module_param(zfs_scan_queue_limit, ulong, 0644);
+MODULE_PARM_DESC(zfs_scan_queue_limit, "Max bytes queued per vdev in one txg");
+
 /* CSTYLED */
 module_param(zfs_free_max_blocks, ulong, 0644);
 MODULE_PARM_DESC(zfs_free_max_blocks, "Max number of blocks freed in one txg");
 
+module_param(zfs_free_sync_target_ms, int, 0644);
+MODULE_PARM_DESC(zfs_free_sync_target_ms,
+	"Sync time above which the blocks freed per txg are cut");
+
 module_param(zfs_free_bpobj_enabled, int, 0644);
 MODULE_PARM_DESC(zfs_free_bpobj_enabled, "Enable processing of the free_bpobj");
 #endif
@@ -176,11 +176,11 @@ dsl_sync_task_sync(dsl_sync_task_t *dst, dmu_tx_t *tx)
 	/*
 	 * Check for errors by calling checkfunc.
 	 */
-	rrw_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
+	rrm_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
 	dst->dst_error = dst->dst_checkfunc(dst->dst_arg, tx);
 	if (dst->dst_error == 0)
 		dst->dst_syncfunc(dst->dst_arg, tx);
-	rrw_exit(&dp->dp_config_rwlock, FTAG);
+	rrm_exit(&dp->dp_config_rwlock, FTAG);
 	if (dst->dst_nowaiter)
 		kmem_free(dst, sizeof (*dst));
 }
@@ -143,10 +143,20 @@ int metaslab_load_pct = 50;
 int metaslab_unload_delay = TXG_SIZE * 2;
 
 /*
- * Max number of metaslabs per group to preload.
+ * Min number of metaslabs per group to preload.
  */
 int metaslab_preload_limit = SPA_DVAS_PER_BP;
 
+/*
+ * Beyond metaslab_preload_limit, keep preloading metaslabs, up to
+ * metaslab_preload_max of them, until they can absorb about
+ * metaslab_preload_txgs txgs worth of allocations at the group's recent
+ * allocation rate. This keeps the allocators from having to load a space
+ * map synchronously when a burst of writes uses up the active metaslabs.
+ */
+int metaslab_preload_txgs = 2;
+int metaslab_preload_max = 16;
+
 /*
  * Enable/disable preloading of metaslab.
  */
@@ -216,14 +226,17 @@ metaslab_class_t *
 metaslab_class_create(spa_t *spa, metaslab_ops_t *ops)
 {
 	metaslab_class_t *mc;
+	int i;
 
 	mc = kmem_zalloc(sizeof (metaslab_class_t), KM_SLEEP);
 
 	mc->mc_spa = spa;
-	mc->mc_rotor = NULL;
 	mc->mc_ops = ops;
 	mutex_init(&mc->mc_lock, NULL, MUTEX_DEFAULT, NULL);
-	refcount_create_tracked(&mc->mc_alloc_slots);
+	mc->mc_allocator = kmem_zalloc(spa->spa_alloc_count *
+	    sizeof (metaslab_class_allocator_t), KM_SLEEP);
+	for (i = 0; i < spa->spa_alloc_count; i++)
+		refcount_create_tracked(&mc->mc_allocator[i].mca_alloc_slots);
 
 	return (mc);
 }
@@ -231,13 +244,22 @@ metaslab_class_create(spa_t *spa, metaslab_ops_t *ops)
 void
 metaslab_class_destroy(metaslab_class_t *mc)
 {
-	ASSERT(mc->mc_rotor == NULL);
+	spa_t *spa = mc->mc_spa;
+	int i;
+
 	ASSERT(mc->mc_alloc == 0);
 	ASSERT(mc->mc_deferred == 0);
 	ASSERT(mc->mc_space == 0);
 	ASSERT(mc->mc_dspace == 0);
 
-	refcount_destroy(&mc->mc_alloc_slots);
+	for (i = 0; i < spa->spa_alloc_count; i++) {
+		metaslab_class_allocator_t *mca = &mc->mc_allocator[i];
+
+		ASSERT(mca->mca_rotor == NULL);
+		refcount_destroy(&mca->mca_alloc_slots);
+	}
+	kmem_free(mc->mc_allocator, spa->spa_alloc_count *
+	    sizeof (metaslab_class_allocator_t));
 	mutex_destroy(&mc->mc_lock);
 	kmem_free(mc, sizeof (metaslab_class_t));
 }
@@ -254,7 +276,7 @@ metaslab_class_validate(metaslab_class_t *mc)
 	ASSERT(spa_config_held(mc->mc_spa, SCL_ALL, RW_READER) ||
 	    spa_config_held(mc->mc_spa, SCL_ALL, RW_WRITER));
 
-	if ((mg = mc->mc_rotor) == NULL)
+	if ((mg = mc->mc_allocator[0].mca_rotor) == NULL)
 		return (0);
 
 	do {
@@ -263,7 +285,7 @@ metaslab_class_validate(metaslab_class_t *mc)
 		ASSERT3P(vd->vdev_top, ==, vd);
 		ASSERT3P(mg->mg_class, ==, mc);
 		ASSERT3P(vd->vdev_ops, !=, &vdev_hole_ops);
-	} while ((mg = mg->mg_next) != mc->mc_rotor);
+	} while ((mg = mg->mg_next) != mc->mc_allocator[0].mca_rotor);
 
 	return (0);
 }
@@ -430,8 +452,26 @@ metaslab_compare(const void *x1, const void *x2)
 {
 	const metaslab_t *m1 = (const metaslab_t *)x1;
 	const metaslab_t *m2 = (const metaslab_t *)x2;
+	int sort1 = 0, sort2 = 0, cmp;
 
-	int cmp = AVL_CMP(m2->ms_weight, m1->ms_weight);
+	if (m1->ms_allocator != -1)
+		sort1 = m1->ms_primary ? 1 : 2;
+	if (m2->ms_allocator != -1)
+		sort2 = m2->ms_primary ? 1 : 2;
+
+	/*
+	 * Sort inactive metaslabs first, then primaries, then secondaries.
+	 * When selecting a metaslab to allocate from, an allocator first
+	 * tries its own primary and secondary metaslabs.  If it has none, or
+	 * can't allocate from them, it searches for an inactive metaslab to
+	 * activate, and only if none is suitable does it steal an active
+	 * metaslab from another allocator.
+	 */
+	cmp = AVL_CMP(sort1, sort2);
+	if (likely(cmp))
+		return (cmp);
+
+	cmp = AVL_CMP(m2->ms_weight, m1->ms_weight);
 	if (likely(cmp))
 		return (cmp);
 
@@ -575,6 +615,7 @@ metaslab_group_t *
 metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 {
 	metaslab_group_t *mg;
+	int i;
 
 	mg = kmem_zalloc(sizeof (metaslab_group_t), KM_SLEEP);
 	mutex_init(&mg->mg_lock, NULL, MUTEX_DEFAULT, NULL);
@@ -585,7 +626,13 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 	mg->mg_activation_count = 0;
 	mg->mg_initialized = B_FALSE;
 	mg->mg_no_free_space = B_TRUE;
-	refcount_create_tracked(&mg->mg_alloc_queue_depth);
+	mg->mg_allocators = mc->mc_spa->spa_alloc_count;
+	mg->mg_allocator = kmem_zalloc(mg->mg_allocators *
+	    sizeof (metaslab_group_allocator_t), KM_SLEEP);
+	for (i = 0; i < mg->mg_allocators; i++) {
+		refcount_create_tracked(
+		    &mg->mg_allocator[i].mga_alloc_queue_depth);
+	}
 
 	mg->mg_taskq = taskq_create("metaslab_group_taskq", metaslab_load_pct,
 	    maxclsyspri, 10, INT_MAX, TASKQ_THREADS_CPU_PCT | TASKQ_DYNAMIC);
@@ -596,6 +643,8 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd)
 void
 metaslab_group_destroy(metaslab_group_t *mg)
 {
+	int i;
+
 	ASSERT(mg->mg_prev == NULL);
 	ASSERT(mg->mg_next == NULL);
 	/*
@@ -608,7 +657,15 @@ metaslab_group_destroy(metaslab_group_t *mg)
 	taskq_destroy(mg->mg_taskq);
 	avl_destroy(&mg->mg_metaslab_tree);
 	mutex_destroy(&mg->mg_lock);
-	refcount_destroy(&mg->mg_alloc_queue_depth);
+	for (i = 0; i < mg->mg_allocators; i++) {
+		metaslab_group_allocator_t *mga = &mg->mg_allocator[i];
+
+		ASSERT3P(mga->mga_primary, ==, NULL);
+		ASSERT3P(mga->mga_secondary, ==, NULL);
+		refcount_destroy(&mga->mga_alloc_queue_depth);
+	}
+	kmem_free(mg->mg_allocator, mg->mg_allocators *
+	    sizeof (metaslab_group_allocator_t));
 	kmem_free(mg, sizeof (metaslab_group_t));
 }
 
@@ -616,11 +673,12 @@ void
 metaslab_group_activate(metaslab_group_t *mg)
 {
 	metaslab_class_t *mc = mg->mg_class;
+	spa_t *spa = mc->mc_spa;
 	metaslab_group_t *mgprev, *mgnext;
+	int i;
 
-	ASSERT(spa_config_held(mc->mc_spa, SCL_ALLOC, RW_WRITER));
+	ASSERT(spa_config_held(spa, SCL_ALLOC, RW_WRITER));
 
-	ASSERT(mc->mc_rotor != mg);
 	ASSERT(mg->mg_prev == NULL);
 	ASSERT(mg->mg_next == NULL);
 	ASSERT(mg->mg_activation_count <= 0);
@@ -631,7 +689,7 @@ metaslab_group_activate(metaslab_group_t *mg)
 	mg->mg_aliquot = metaslab_aliquot * MAX(1, mg->mg_vd->vdev_children);
 	metaslab_group_alloc_update(mg);
 
-	if ((mgprev = mc->mc_rotor) == NULL) {
+	if ((mgprev = mc->mc_allocator[0].mca_rotor) == NULL) {
 		mg->mg_prev = mg;
 		mg->mg_next = mg;
 	} else {
@@ -641,19 +699,30 @@ metaslab_group_activate(metaslab_group_t *mg)
 		mgprev->mg_next = mg;
 		mgnext->mg_prev = mg;
 	}
-	mc->mc_rotor = mg;
+
+	/*
+	 * Start the rotors of the allocators at consecutive groups, so that
+	 * they don't all allocate from the same group at the same time.
+	 */
+	for (i = 0; i < spa->spa_alloc_count; i++) {
+		mc->mc_allocator[i].mca_rotor = mg;
+		mg = mg->mg_next;
+	}
 }
 
 void
 metaslab_group_passivate(metaslab_group_t *mg)
 {
 	metaslab_class_t *mc = mg->mg_class;
+	spa_t *spa = mc->mc_spa;
 	metaslab_group_t *mgprev, *mgnext;
+	int i;
 
-	ASSERT(spa_config_held(mc->mc_spa, SCL_ALLOC, RW_WRITER));
+	ASSERT(spa_config_held(spa, SCL_ALLOC, RW_WRITER));
 
 	if (--mg->mg_activation_count != 0) {
-		ASSERT(mc->mc_rotor != mg);
+		for (i = 0; i < spa->spa_alloc_count; i++)
+			ASSERT(mc->mc_allocator[i].mca_rotor != mg);
 		ASSERT(mg->mg_prev == NULL);
 		ASSERT(mg->mg_next == NULL);
 		ASSERT(mg->mg_activation_count < 0);
@@ -666,10 +735,16 @@ metaslab_group_passivate(metaslab_group_t *mg)
 	mgprev = mg->mg_prev;
 	mgnext = mg->mg_next;
 
-	if (mg == mgnext) {
-		mc->mc_rotor = NULL;
-	} else {
-		mc->mc_rotor = mgnext;
+	for (i = 0; i < spa->spa_alloc_count; i++) {
+		metaslab_class_allocator_t *mca = &mc->mc_allocator[i];
+
+		if (mg == mgnext)
+			mca->mca_rotor = NULL;
+		else if (mca->mca_rotor == mg)
+			mca->mca_rotor = mgnext;
+	}
+
+	if (mg != mgnext) {
 		mgprev->mg_next = mgnext;
 		mgnext->mg_prev = mgprev;
 	}
@@ -789,6 +864,32 @@ metaslab_group_add(metaslab_group_t *mg, metaslab_t *msp)
 	mutex_exit(&msp->ms_lock);
 }
 
+/*
+ * Give up the primary or secondary slot a metaslab holds in its
+ * allocator.  The metaslab must be out of the group's tree, since the
+ * slot is one of its sort keys.
+ */
+static void
+metaslab_group_release_allocator(metaslab_group_t *mg, metaslab_t *msp)
+{
+	metaslab_group_allocator_t *mga;
+
+	ASSERT(MUTEX_HELD(&mg->mg_lock));
+
+	if (msp->ms_allocator == -1)
+		return;
+
+	mga = &mg->mg_allocator[msp->ms_allocator];
+	if (msp->ms_primary) {
+		ASSERT3P(mga->mga_primary, ==, msp);
+		mga->mga_primary = NULL;
+	} else {
+		ASSERT3P(mga->mga_secondary, ==, msp);
+		mga->mga_secondary = NULL;
+	}
+	msp->ms_allocator = -1;
+}
+
 static void
 metaslab_group_remove(metaslab_group_t *mg, metaslab_t *msp)
 {
@@ -799,10 +900,26 @@ metaslab_group_remove(metaslab_group_t *mg, metaslab_t *msp)
 	mutex_enter(&mg->mg_lock);
 	ASSERT(msp->ms_group == mg);
 	avl_remove(&mg->mg_metaslab_tree, msp);
+	metaslab_group_release_allocator(mg, msp);
 	msp->ms_group = NULL;
 	mutex_exit(&mg->mg_lock);
 }
 
+static void
+metaslab_group_sort_impl(metaslab_group_t *mg, metaslab_t *msp,
+    uint64_t weight)
+{
+	ASSERT(MUTEX_HELD(&mg->mg_lock));
+	ASSERT(msp->ms_group == mg);
+
+	avl_remove(&mg->mg_metaslab_tree, msp);
+	if ((weight & (METASLAB_WEIGHT_PRIMARY | METASLAB_WEIGHT_SECONDARY)) ==
+	    0)
+		metaslab_group_release_allocator(mg, msp);
+	msp->ms_weight = weight;
+	avl_add(&mg->mg_metaslab_tree, msp);
+}
+
 static void
 metaslab_group_sort(metaslab_group_t *mg, metaslab_t *msp, uint64_t weight)
 {
@@ -814,10 +931,7 @@ metaslab_group_sort(metaslab_group_t *mg, metaslab_t *msp, uint64_t weight)
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 
 	mutex_enter(&mg->mg_lock);
-	ASSERT(msp->ms_group == mg);
-	avl_remove(&mg->mg_metaslab_tree, msp);
-	msp->ms_weight = weight;
-	avl_add(&mg->mg_metaslab_tree, msp);
+	metaslab_group_sort_impl(mg, msp, weight);
 	mutex_exit(&mg->mg_lock);
 }
 
@@ -866,7 +980,7 @@ metaslab_group_fragmentation(metaslab_group_t *mg)
  */
 static boolean_t
 metaslab_group_allocatable(metaslab_group_t *mg, metaslab_group_t *rotor,
-    uint64_t psize)
+    uint64_t psize, int allocator)
 {
 	spa_t *spa = mg->mg_vd->vdev_spa;
 	metaslab_class_t *mc = mg->mg_class;
@@ -885,17 +999,19 @@ metaslab_group_allocatable(metaslab_group_t *mg, metaslab_group_t *rotor,
 	 * in metaslab_group_alloc_update() for more information) and
 	 * the allocation throttle is disabled then allow allocations to this
 	 * device. However, if the allocation throttle is enabled then
-	 * check if we have reached our allocation limit (mg_alloc_queue_depth)
-	 * to determine if we should allow allocations to this metaslab group.
+	 * check if we have reached this allocator's limit
+	 * (mga_alloc_queue_depth) to determine if we should allow
+	 * allocations to this metaslab group.
 	 * If all metaslab groups are no longer considered allocatable
 	 * (mc_alloc_groups == 0) or we're trying to allocate the smallest
 	 * gang block size then we allow allocations on this metaslab group
 	 * regardless of the mg_allocatable or throttle settings.
 	 */
 	if (mg->mg_allocatable) {
+		metaslab_group_allocator_t *mga = &mg->mg_allocator[allocator];
 		metaslab_group_t *mgp;
 		int64_t qdepth;
-		uint64_t qmax = mg->mg_max_alloc_queue_depth;
+		uint64_t qmax = mga->mga_cur_max_alloc_queue_depth;
 
 		if (!mc->mc_alloc_throttle_enabled)
 			return (B_TRUE);
@@ -907,7 +1023,7 @@ metaslab_group_allocatable(metaslab_group_t *mg, metaslab_group_t *rotor,
 		if (mg->mg_no_free_space)
 			return (B_FALSE);
 
-		qdepth = refcount_count(&mg->mg_alloc_queue_depth);
+		qdepth = refcount_count(&mga->mga_alloc_queue_depth);
 
 		/*
 		 * If this metaslab group is below its qmax or it's
@@ -926,9 +1042,10 @@ metaslab_group_allocatable(metaslab_group_t *mg, metaslab_group_t *rotor,
 		 * groups at the same time when we make this check.
 		 */
 		for (mgp = mg->mg_next; mgp != rotor; mgp = mgp->mg_next) {
-			qmax = mgp->mg_max_alloc_queue_depth;
+			mga = &mgp->mg_allocator[allocator];
+			qmax = mga->mga_cur_max_alloc_queue_depth;
 
-			qdepth = refcount_count(&mgp->mg_alloc_queue_depth);
+			qdepth = refcount_count(&mga->mga_alloc_queue_depth);
 
 			/*
 			 * If there is another metaslab group that
@@ -977,6 +1094,68 @@ metaslab_rangesize_compare(const void *x1, const void *x2)
 	return (AVL_CMP(r1->rs_start, r2->rs_start));
 }
 
+#if defined(WITH_SF_BLOCK_ALLOCATOR)
+/*
+ * The segregated fit allocator's size buckets, each ordered by offset.
+ */
+static int
+metaslab_sf_compare(const void *x1, const void *x2)
+{
+	const range_seg_t *r1 = x1;
+	const range_seg_t *r2 = x2;
+
+	return (AVL_CMP(r1->rs_start, r2->rs_start));
+}
+
+static int
+metaslab_sf_bucket_idx(metaslab_t *msp, uint64_t size)
+{
+	int idx = highbit64(size) - 1 - msp->ms_group->mg_vd->vdev_ashift;
+
+	return (MIN(MAX(idx, 0), METASLAB_SF_BUCKETS - 1));
+}
+
+static zfs_btree_t *
+metaslab_sf_bucket(metaslab_t *msp, uint64_t size)
+{
+	return (&msp->ms_sf_buckets[metaslab_sf_bucket_idx(msp, size)]);
+}
+
+static void
+metaslab_sf_create(metaslab_t *msp)
+{
+	int b;
+
+	msp->ms_sf_buckets = kmem_alloc(METASLAB_SF_BUCKETS *
+	    sizeof (zfs_btree_t), KM_SLEEP);
+	for (b = 0; b < METASLAB_SF_BUCKETS; b++) {
+		zfs_btree_create(&msp->ms_sf_buckets[b], metaslab_sf_compare,
+		    sizeof (range_seg_t));
+	}
+}
+
+static void
+metaslab_sf_destroy(metaslab_t *msp)
+{
+	int b;
+
+	for (b = 0; b < METASLAB_SF_BUCKETS; b++)
+		zfs_btree_destroy(&msp->ms_sf_buckets[b]);
+	kmem_free(msp->ms_sf_buckets, METASLAB_SF_BUCKETS *
+	    sizeof (zfs_btree_t));
+	msp->ms_sf_buckets = NULL;
+}
+
+static void
+metaslab_sf_vacate(metaslab_t *msp)
+{
+	int b;
+
+	for (b = 0; b < METASLAB_SF_BUCKETS; b++)
+		zfs_btree_clear(&msp->ms_sf_buckets[b]);
+}
+#endif /* WITH_SF_BLOCK_ALLOCATOR */
+
 /*
  * Create any block allocator specific components. The current allocators
  * rely on using both a size-ordered range_tree_t and an array of uint64_t's.
@@ -989,8 +1168,11 @@ metaslab_rt_create(range_tree_t *rt, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT(msp->ms_tree == NULL);
 
-	avl_create(&msp->ms_size_tree, metaslab_rangesize_compare,
-	    sizeof (range_seg_t), offsetof(range_seg_t, rs_pp_node));
+	zfs_btree_create(&msp->ms_size_tree, metaslab_rangesize_compare,
+	    sizeof (range_seg_t));
+#if defined(WITH_SF_BLOCK_ALLOCATOR)
+	metaslab_sf_create(msp);
+#endif
 }
 
 /*
@@ -1003,9 +1185,12 @@ metaslab_rt_destroy(range_tree_t *rt, void *arg)
 
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
-	ASSERT0(avl_numnodes(&msp->ms_size_tree));
+	ASSERT0(zfs_btree_numnodes(&msp->ms_size_tree));
 
-	avl_destroy(&msp->ms_size_tree);
+	zfs_btree_destroy(&msp->ms_size_tree);
+#if defined(WITH_SF_BLOCK_ALLOCATOR)
+	metaslab_sf_destroy(msp);
+#endif
 }
 
 static void
@@ -1016,7 +1201,10 @@ metaslab_rt_add(range_tree_t *rt, range_seg_t *rs, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
 	VERIFY(!msp->ms_condensing);
-	avl_add(&msp->ms_size_tree, rs);
+	zfs_btree_add(&msp->ms_size_tree, rs);
+#if defined(WITH_SF_BLOCK_ALLOCATOR)
+	zfs_btree_add(metaslab_sf_bucket(msp, rs->rs_end - rs->rs_start), rs);
+#endif
 }
 
 static void
@@ -1027,7 +1215,11 @@ metaslab_rt_remove(range_tree_t *rt, range_seg_t *rs, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
 	VERIFY(!msp->ms_condensing);
-	avl_remove(&msp->ms_size_tree, rs);
+	zfs_btree_remove(&msp->ms_size_tree, rs);
+#if defined(WITH_SF_BLOCK_ALLOCATOR)
+	zfs_btree_remove(metaslab_sf_bucket(msp, rs->rs_end - rs->rs_start),
+	    rs);
+#endif
 }
 
 static void
@@ -1038,14 +1230,10 @@ metaslab_rt_vacate(range_tree_t *rt, void *arg)
 	ASSERT3P(rt->rt_arg, ==, msp);
 	ASSERT3P(msp->ms_tree, ==, rt);
 
-	/*
-	 * Normally one would walk the tree freeing nodes along the way.
-	 * Since the nodes are shared with the range trees we can avoid
-	 * walking all nodes and just reinitialize the avl tree. The nodes
-	 * will be freed by the range tree, so we don't want to free them here.
-	 */
-	avl_create(&msp->ms_size_tree, metaslab_rangesize_compare,
-	    sizeof (range_seg_t), offsetof(range_seg_t, rs_pp_node));
+	zfs_btree_clear(&msp->ms_size_tree);
+#if defined(WITH_SF_BLOCK_ALLOCATOR)
+	metaslab_sf_vacate(msp);
+#endif
 }
 
 static range_tree_ops_t metaslab_rt_ops = {
@@ -1068,28 +1256,26 @@ static range_tree_ops_t metaslab_rt_ops = {
 uint64_t
 metaslab_block_maxsize(metaslab_t *msp)
 {
-	avl_tree_t *t = &msp->ms_size_tree;
 	range_seg_t *rs;
 
-	if (t == NULL || (rs = avl_last(t)) == NULL)
+	if ((rs = zfs_btree_last(&msp->ms_size_tree, NULL)) == NULL)
 		return (0ULL);
 
 	return (rs->rs_end - rs->rs_start);
 }
 
 static range_seg_t *
-metaslab_block_find(avl_tree_t *t, uint64_t start, uint64_t size)
+metaslab_block_find(zfs_btree_t *t, uint64_t start, uint64_t size,
+    zfs_btree_index_t *where)
 {
 	range_seg_t *rs, rsearch;
-	avl_index_t where;
 
 	rsearch.rs_start = start;
 	rsearch.rs_end = start + size;
 
-	rs = avl_find(t, &rsearch, &where);
-	if (rs == NULL) {
-		rs = avl_nearest(t, where, AVL_AFTER);
-	}
+	rs = zfs_btree_find(t, &rsearch, where);
+	if (rs == NULL)
+		rs = zfs_btree_nearest_after(t, where, where);
 
 	return (rs);
 }
@@ -1099,14 +1285,15 @@ metaslab_block_find(avl_tree_t *t, uint64_t start, uint64_t size)
     defined(WITH_CF_BLOCK_ALLOCATOR)
 /*
  * This is a helper function that can be used by the allocator to find
- * a suitable block to allocate. This will search the specified AVL
- * tree looking for a block that matches the specified criteria.
+ * a suitable block to allocate. This will search the specified B-tree
+ * looking for a block that matches the specified criteria.
  */
 static uint64_t
-metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
+metaslab_block_picker(zfs_btree_t *t, uint64_t *cursor, uint64_t size,
     uint64_t align)
 {
-	range_seg_t *rs = metaslab_block_find(t, *cursor, size);
+	zfs_btree_index_t where;
+	range_seg_t *rs = metaslab_block_find(t, *cursor, size, &where);
 
 	while (rs != NULL) {
 		uint64_t offset = P2ROUNDUP(rs->rs_start, align);
@@ -1115,7 +1302,7 @@ metaslab_block_picker(avl_tree_t *t, uint64_t *cursor, uint64_t size,
 			*cursor = offset + size;
 			return (offset);
 		}
-		rs = AVL_NEXT(t, rs);
+		rs = zfs_btree_next(t, &where, &where);
 	}
 
 	/*
@@ -1148,7 +1335,7 @@ metaslab_ff_alloc(metaslab_t *msp, uint64_t size)
 	 */
 	uint64_t align = size & -size;
 	uint64_t *cursor = &msp->ms_lbas[highbit64(align) - 1];
-	avl_tree_t *t = &msp->ms_tree->rt_root;
+	zfs_btree_t *t = &msp->ms_tree->rt_root;
 
 	return (metaslab_block_picker(t, cursor, size, align));
 }
@@ -1182,19 +1369,20 @@ metaslab_df_alloc(metaslab_t *msp, uint64_t size)
 	uint64_t align = size & -size;
 	uint64_t *cursor = &msp->ms_lbas[highbit64(align) - 1];
 	range_tree_t *rt = msp->ms_tree;
-	avl_tree_t *t = &rt->rt_root;
+	zfs_btree_t *t = &rt->rt_root;
 	uint64_t max_size = metaslab_block_maxsize(msp);
 	int free_pct = range_tree_space(rt) * 100 / msp->ms_size;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==, avl_numnodes(&msp->ms_size_tree));
+	ASSERT3U(zfs_btree_numnodes(t), ==,
+	    zfs_btree_numnodes(&msp->ms_size_tree));
 
 	if (max_size < size)
 		return (-1ULL);
 
 	/*
 	 * If we're running low on space switch to using the size
-	 * sorted AVL tree (best-fit).
+	 * sorted tree (best-fit).
 	 */
 	if (max_size < metaslab_df_alloc_threshold ||
 	    free_pct < metaslab_df_free_pct) {
@@ -1226,20 +1414,20 @@ static uint64_t
 metaslab_cf_alloc(metaslab_t *msp, uint64_t size)
 {
 	range_tree_t *rt = msp->ms_tree;
-	avl_tree_t *t = &msp->ms_size_tree;
+	zfs_btree_t *t = &msp->ms_size_tree;
 	uint64_t *cursor = &msp->ms_lbas[0];
 	uint64_t *cursor_end = &msp->ms_lbas[1];
 	uint64_t offset = 0;
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==, avl_numnodes(&rt->rt_root));
+	ASSERT3U(zfs_btree_numnodes(t), ==, zfs_btree_numnodes(&rt->rt_root));
 
 	ASSERT3U(*cursor_end, >=, *cursor);
 
 	if ((*cursor + size) > *cursor_end) {
 		range_seg_t *rs;
 
-		rs = avl_last(&msp->ms_size_tree);
+		rs = zfs_btree_last(&msp->ms_size_tree, NULL);
 		if (rs == NULL || (rs->rs_end - rs->rs_start) < size)
 			return (-1ULL);
 
@@ -1279,15 +1467,16 @@ uint64_t metaslab_ndf_clump_shift = 4;
 static uint64_t
 metaslab_ndf_alloc(metaslab_t *msp, uint64_t size)
 {
-	avl_tree_t *t = &msp->ms_tree->rt_root;
-	avl_index_t where;
+	zfs_btree_t *t = &msp->ms_tree->rt_root;
+	zfs_btree_index_t where;
 	range_seg_t *rs, rsearch;
 	uint64_t hbit = highbit64(size);
 	uint64_t *cursor = &msp->ms_lbas[hbit - 1];
 	uint64_t max_size = metaslab_block_maxsize(msp);
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
-	ASSERT3U(avl_numnodes(t), ==, avl_numnodes(&msp->ms_size_tree));
+	ASSERT3U(zfs_btree_numnodes(t), ==,
+	    zfs_btree_numnodes(&msp->ms_size_tree));
 
 	if (max_size < size)
 		return (-1ULL);
@@ -1295,16 +1484,16 @@ metaslab_ndf_alloc(metaslab_t *msp, uint64_t size)
 	rsearch.rs_start = *cursor;
 	rsearch.rs_end = *cursor + size;
 
-	rs = avl_find(t, &rsearch, &where);
+	rs = zfs_btree_find(t, &rsearch, &where);
 	if (rs == NULL || (rs->rs_end - rs->rs_start) < size) {
 		t = &msp->ms_size_tree;
 
 		rsearch.rs_start = 0;
 		rsearch.rs_end = MIN(max_size,
 		    1ULL << (hbit + metaslab_ndf_clump_shift));
-		rs = avl_find(t, &rsearch, &where);
+		rs = zfs_btree_find(t, &rsearch, &where);
 		if (rs == NULL)
-			rs = avl_nearest(t, where, AVL_AFTER);
+			rs = zfs_btree_nearest_after(t, &where, &where);
 		ASSERT(rs != NULL);
 	}
 
@@ -1322,6 +1511,69 @@ static metaslab_ops_t metaslab_ndf_ops = {
 metaslab_ops_t *zfs_metaslab_ops = &metaslab_ndf_ops;
 #endif /* WITH_NDF_BLOCK_ALLOCATOR */
 
+#if defined(WITH_SF_BLOCK_ALLOCATOR)
+/*
+ * ==========================================================================
+ * Segregated fit allocator -
+ * The free segments are also kept in offset-ordered trees by size class
+ * (see METASLAB_SF_BUCKETS). Every segment in a class above the one of the
+ * request is big enough, so the lowest one of the smallest non-empty such
+ * class is taken without searching. A power of two sized request, which is
+ * the common case for zvols, fits any segment of its own class, so that is
+ * tried first. Only when no larger class has space is the request's own
+ * class searched.
+ * ==========================================================================
+ */
+static uint64_t
+metaslab_sf_search(zfs_btree_t *t, uint64_t size)
+{
+	zfs_btree_index_t where;
+	range_seg_t *rs;
+
+	for (rs = zfs_btree_first(t, &where); rs != NULL;
+	    rs = zfs_btree_next(t, &where, &where)) {
+		if (rs->rs_end - rs->rs_start >= size)
+			return (rs->rs_start);
+	}
+	return (-1ULL);
+}
+
+static uint64_t
+metaslab_sf_alloc(metaslab_t *msp, uint64_t size)
+{
+	int idx = metaslab_sf_bucket_idx(msp, size);
+	zfs_btree_t *buckets = msp->ms_sf_buckets;
+	range_seg_t *rs;
+	int b;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT3U(zfs_btree_numnodes(&msp->ms_tree->rt_root), ==,
+	    zfs_btree_numnodes(&msp->ms_size_tree));
+
+	if (metaslab_block_maxsize(msp) < size)
+		return (-1ULL);
+
+	if (ISP2(size) && idx < METASLAB_SF_BUCKETS - 1 &&
+	    (rs = zfs_btree_first(&buckets[idx], NULL)) != NULL) {
+		ASSERT3U(rs->rs_end - rs->rs_start, >=, size);
+		return (rs->rs_start);
+	}
+
+	for (b = idx + 1; b < METASLAB_SF_BUCKETS; b++) {
+		if ((rs = zfs_btree_first(&buckets[b], NULL)) != NULL)
+			return (rs->rs_start);
+	}
+
+	return (metaslab_sf_search(&buckets[idx], size));
+}
+
+static metaslab_ops_t metaslab_sf_ops = {
+	metaslab_sf_alloc
+};
+
+metaslab_ops_t *zfs_metaslab_ops = &metaslab_sf_ops;
+#endif /* WITH_SF_BLOCK_ALLOCATOR */
+
 
 /*
  * ==========================================================================
@@ -1389,8 +1641,18 @@ metaslab_unload(metaslab_t *msp)
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 	range_tree_vacate(msp->ms_tree, NULL, NULL);
 	msp->ms_loaded = B_FALSE;
-	msp->ms_weight &= ~METASLAB_ACTIVE_MASK;
 	msp->ms_max_size = 0;
+
+	/*
+	 * The allocator slot is a sort key, so an active metaslab has to
+	 * be passivated through the group's tree rather than in place.
+	 */
+	if (msp->ms_group != NULL) {
+		metaslab_group_sort(msp->ms_group, msp,
+		    msp->ms_weight & ~METASLAB_ACTIVE_MASK);
+	} else {
+		msp->ms_weight &= ~METASLAB_ACTIVE_MASK;
+	}
 }
 
 int
@@ -1405,9 +1667,11 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	ms = kmem_zalloc(sizeof (metaslab_t), KM_SLEEP);
 	mutex_init(&ms->ms_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&ms->ms_load_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&ms->ms_trim_cv, NULL, CV_DEFAULT, NULL);
 	ms->ms_id = id;
 	ms->ms_start = id << vd->vdev_ms_shift;
 	ms->ms_size = 1ULL << vd->vdev_ms_shift;
+	ms->ms_allocator = -1;
 
 	/*
 	 * We only open space map objects that already exist. All others
@@ -1433,6 +1697,7 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	 * data fault on any attempt to use this metaslab before it's ready.
 	 */
 	ms->ms_tree = range_tree_create(&metaslab_rt_ops, ms, &ms->ms_lock);
+	ms->ms_trimtree = range_tree_create(NULL, ms, &ms->ms_lock);
 	metaslab_group_add(mg, ms);
 
 	metaslab_set_fragmentation(ms);
@@ -1487,6 +1752,8 @@ metaslab_fini(metaslab_t *msp)
 
 	metaslab_unload(msp);
 	range_tree_destroy(msp->ms_tree);
+	range_tree_vacate(msp->ms_trimtree, NULL, NULL);
+	range_tree_destroy(msp->ms_trimtree);
 	range_tree_destroy(msp->ms_freeingtree);
 	range_tree_destroy(msp->ms_freedtree);
 
@@ -1502,6 +1769,7 @@ metaslab_fini(metaslab_t *msp)
 
 	mutex_exit(&msp->ms_lock);
 	cv_destroy(&msp->ms_load_cv);
+	cv_destroy(&msp->ms_trim_cv);
 	mutex_destroy(&msp->ms_lock);
 
 	kmem_free(msp, sizeof (metaslab_t));
@@ -1902,24 +2170,76 @@ metaslab_weight(metaslab_t *msp)
 	return (weight);
 }
 
+/*
+ * Make the metaslab the primary or secondary of the given allocator.
+ * Claims don't belong to any allocator; the metaslab is only marked
+ * active so that it stays loaded, and any allocator may later take it.
+ */
+static int
+metaslab_activate_allocator(metaslab_group_t *mg, metaslab_t *msp,
+    int allocator, uint64_t activation_weight)
+{
+	metaslab_group_allocator_t *mga;
+	metaslab_t **slot;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	mutex_enter(&mg->mg_lock);
+	if (activation_weight == METASLAB_WEIGHT_CLAIM) {
+		msp->ms_activation_weight = msp->ms_weight;
+		metaslab_group_sort_impl(mg, msp,
+		    msp->ms_weight | activation_weight);
+		mutex_exit(&mg->mg_lock);
+		return (0);
+	}
+
+	mga = &mg->mg_allocator[allocator];
+	slot = (activation_weight == METASLAB_WEIGHT_PRIMARY) ?
+	    &mga->mga_primary : &mga->mga_secondary;
+	if (*slot != NULL) {
+		mutex_exit(&mg->mg_lock);
+		return (EEXIST);
+	}
+
+	avl_remove(&mg->mg_metaslab_tree, msp);
+	*slot = msp;
+	msp->ms_allocator = allocator;
+	msp->ms_primary = (activation_weight == METASLAB_WEIGHT_PRIMARY);
+	msp->ms_activation_weight = msp->ms_weight;
+	msp->ms_weight |= activation_weight;
+	avl_add(&mg->mg_metaslab_tree, msp);
+	mutex_exit(&mg->mg_lock);
+
+	return (0);
+}
+
 static int
-metaslab_activate(metaslab_t *msp, uint64_t activation_weight)
+metaslab_activate(metaslab_t *msp, int allocator, uint64_t activation_weight)
 {
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 
 	if ((msp->ms_weight & METASLAB_ACTIVE_MASK) == 0) {
+		int error;
+
 		metaslab_load_wait(msp);
 		if (!msp->ms_loaded) {
-			int error = metaslab_load(msp);
-			if (error) {
+			if ((error = metaslab_load(msp)) != 0) {
 				metaslab_group_sort(msp->ms_group, msp, 0);
 				return (error);
 			}
 		}
 
-		msp->ms_activation_weight = msp->ms_weight;
-		metaslab_group_sort(msp->ms_group, msp,
-		    msp->ms_weight | activation_weight);
+		/*
+		 * The metaslab lock is dropped while loading, so another
+		 * allocator may have activated the metaslab in the meantime.
+		 */
+		if ((msp->ms_weight & METASLAB_ACTIVE_MASK) != 0)
+			return (EBUSY);
+
+		error = metaslab_activate_allocator(msp->ms_group, msp,
+		    allocator, activation_weight);
+		if (error != 0)
+			return (error);
 	}
 	ASSERT(msp->ms_loaded);
 	ASSERT(msp->ms_weight & METASLAB_ACTIVE_MASK);
@@ -1998,12 +2318,29 @@ metaslab_preload(void *arg)
 	spl_fstrans_unmark(cookie);
 }
 
+/*
+ * A rough estimate of how much space can be allocated from a metaslab,
+ * based on its weight. A space based weight is the free space already
+ * discounted for fragmentation; a segment based one only tells us about
+ * the segments in its largest bucket, which makes it a lower bound.
+ */
+static uint64_t
+metaslab_weight_space(uint64_t weight)
+{
+	if (WEIGHT_IS_SPACEBASED(weight))
+		return (weight & ~METASLAB_ACTIVE_MASK & ~METASLAB_WEIGHT_TYPE);
+
+	return (WEIGHT_GET_COUNT(weight) << WEIGHT_GET_INDEX(weight));
+}
+
 static void
 metaslab_group_preload(metaslab_group_t *mg)
 {
 	spa_t *spa = mg->mg_vd->vdev_spa;
 	metaslab_t *msp;
 	avl_tree_t *t = &mg->mg_metaslab_tree;
+	uint64_t want = mg->mg_alloc_rate * metaslab_preload_txgs;
+	uint64_t ready = 0;
 	int m = 0;
 
 	if (spa_shutting_down(spa) || !metaslab_preload_enabled) {
@@ -2012,19 +2349,39 @@ metaslab_group_preload(metaslab_group_t *mg)
 	}
 
 	mutex_enter(&mg->mg_lock);
+	/*
+	 * Nothing is loaded ahead of the first allocation from the group,
+	 * so that importing a pool doesn't build the range trees of
+	 * metaslabs which may not be needed for a long time.
+	 */
+	if (mg->mg_allocations == 0) {
+		mutex_exit(&mg->mg_lock);
+		return;
+	}
+
 	/*
 	 * Load the next potential metaslabs
 	 */
 	for (msp = avl_first(t); msp != NULL; msp = AVL_NEXT(t, msp)) {
 		/*
-		 * We preload only the maximum number of metaslabs specified
-		 * by metaslab_preload_limit. If a metaslab is being forced
-		 * to condense then we preload it too. This will ensure
-		 * that force condensing happens in the next txg.
+		 * We preload metaslab_preload_limit metaslabs, and more if
+		 * the ones we have preloaded so far would not last
+		 * metaslab_preload_txgs txgs at the recent allocation rate.
+		 * If a metaslab is being forced to condense then we preload
+		 * it too. This will ensure that force condensing happens in
+		 * the next txg.
 		 */
-		if (++m > metaslab_preload_limit && !msp->ms_condense_wanted) {
+		if (m >= metaslab_preload_limit &&
+		    (m >= metaslab_preload_max || ready >= want)) {
+			if (msp->ms_condense_wanted) {
+				VERIFY(taskq_dispatch(mg->mg_taskq,
+				    metaslab_preload, msp, TQ_SLEEP) !=
+				    TASKQID_INVALID);
+			}
 			continue;
 		}
+		m++;
+		ready += metaslab_weight_space(msp->ms_weight);
 
 		VERIFY(taskq_dispatch(mg->mg_taskq, metaslab_preload,
 		    msp, TQ_SLEEP) != TASKQID_INVALID);
@@ -2068,7 +2425,7 @@ metaslab_should_condense(metaslab_t *msp)
 {
 	space_map_t *sm = msp->ms_sm;
 	range_seg_t *rs;
-	uint64_t size, entries, segsz, object_size, optimal_size, record_size;
+	uint64_t segsz, object_size, optimal_size, record_size;
 	dmu_object_info_t doi;
 	uint64_t vdev_blocksize = 1ULL << msp->ms_group->mg_vd->vdev_ashift;
 
@@ -2081,7 +2438,7 @@ metaslab_should_condense(metaslab_t *msp)
 	 * metaslabs that are empty and metaslabs for which a condense
 	 * request has been made.
 	 */
-	rs = avl_last(&msp->ms_size_tree);
+	rs = zfs_btree_last(&msp->ms_size_tree, NULL);
 	if (rs == NULL || msp->ms_condense_wanted)
 		return (B_TRUE);
 
@@ -2091,11 +2448,10 @@ metaslab_should_condense(metaslab_t *msp)
 	 * larger on-disk than the entire current on-disk structure, then
 	 * clearly condensing will increase the on-disk structure size.
 	 */
-	size = (rs->rs_end - rs->rs_start) >> sm->sm_shift;
-	entries = size / (MIN(size, SM_RUN_MAX));
-	segsz = entries * sizeof (uint64_t);
+	segsz = space_map_segment_size(sm, rs->rs_end - rs->rs_start);
 
-	optimal_size = sizeof (uint64_t) * avl_numnodes(&msp->ms_tree->rt_root);
+	optimal_size = sizeof (uint64_t) *
+	    zfs_btree_numnodes(&msp->ms_tree->rt_root);
 	object_size = space_map_length(msp->ms_sm);
 
 	dmu_object_info_from_db(sm->sm_dbuf, &doi);
@@ -2128,7 +2484,8 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	    "spa %s, smp size %llu, segments %lu, forcing condense=%s", txg,
 	    msp->ms_id, msp, msp->ms_group->mg_vd->vdev_id,
 	    msp->ms_group->mg_vd->vdev_spa->spa_name,
-	    space_map_length(msp->ms_sm), avl_numnodes(&msp->ms_tree->rt_root),
+	    space_map_length(msp->ms_sm),
+	    zfs_btree_numnodes(&msp->ms_tree->rt_root),
 	    msp->ms_condense_wanted ? "TRUE" : "FALSE");
 
 	msp->ms_condense_wanted = B_FALSE;
@@ -2232,6 +2589,7 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	    !(msp->ms_loaded && msp->ms_condense_wanted))
 		return;
 
+	atomic_add_64(&mg->mg_alloc_txg, range_tree_space(alloctree));
 
 	VERIFY(txg <= spa_final_dirty_txg(spa));
 
@@ -2432,13 +2790,20 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 * Move the frees from the defer_tree back to the free
 	 * range tree (if it's loaded). Swap the freed_tree and the
 	 * defer_tree -- this is safe to do because we've just emptied out
-	 * the defer_tree.
+	 * the defer_tree.  With autotrim on, the frees are queued to be
+	 * trimmed as well.
 	 */
+	if (spa->spa_autotrim)
+		range_tree_walk(*defer_tree, range_tree_add, msp->ms_trimtree);
 	range_tree_vacate(*defer_tree,
 	    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
 	if (defer_allowed) {
 		range_tree_swap(&msp->ms_freedtree, defer_tree);
 	} else {
+		if (spa->spa_autotrim) {
+			range_tree_walk(msp->ms_freedtree, range_tree_add,
+			    msp->ms_trimtree);
+		}
 		range_tree_vacate(msp->ms_freedtree,
 		    msp->ms_loaded ? range_tree_add : NULL, msp->ms_tree);
 	}
@@ -2481,12 +2846,71 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	mutex_exit(&msp->ms_lock);
 }
 
+/*
+ * Copy the ranges of the metaslab which are to be trimmed into rt: all of
+ * its free space for a manual trim, or the frees queued by autotrim.  The
+ * metaslab is not allocated from until metaslab_trim_done(), so that none
+ * of the ranges can be reused while their trims are in flight.  Returns
+ * the space copied.
+ */
+uint64_t
+metaslab_trim_start(metaslab_t *msp, range_tree_t *rt, boolean_t manual)
+{
+	uint64_t space;
+
+	mutex_enter(&msp->ms_lock);
+	ASSERT(!msp->ms_trimming);
+
+	/* A new metaslab has no free space until its first sync */
+	if (msp->ms_freedtree == NULL) {
+		mutex_exit(&msp->ms_lock);
+		return (0);
+	}
+
+	if (manual) {
+		metaslab_load_wait(msp);
+		if (!msp->ms_loaded && metaslab_load(msp) != 0) {
+			mutex_exit(&msp->ms_lock);
+			return (0);
+		}
+		range_tree_walk(msp->ms_tree, range_tree_add, rt);
+	} else {
+		range_tree_walk(msp->ms_trimtree, range_tree_add, rt);
+	}
+	range_tree_vacate(msp->ms_trimtree, NULL, NULL);
+
+	space = range_tree_space(rt);
+	if (space != 0) {
+		if (msp->ms_weight & METASLAB_ACTIVE_MASK) {
+			metaslab_passivate(msp,
+			    msp->ms_weight & ~METASLAB_ACTIVE_MASK);
+		}
+		msp->ms_trimming = B_TRUE;
+	}
+	mutex_exit(&msp->ms_lock);
+
+	return (space);
+}
+
+void
+metaslab_trim_done(metaslab_t *msp)
+{
+	mutex_enter(&msp->ms_lock);
+	ASSERT(msp->ms_trimming);
+	msp->ms_trimming = B_FALSE;
+	cv_broadcast(&msp->ms_trim_cv);
+	mutex_exit(&msp->ms_lock);
+}
+
 void
 metaslab_sync_reassess(metaslab_group_t *mg)
 {
 	metaslab_group_alloc_update(mg);
 	mg->mg_fragmentation = metaslab_group_fragmentation(mg);
 
+	mg->mg_alloc_rate = (mg->mg_alloc_rate * 3 +
+	    atomic_swap_64(&mg->mg_alloc_txg, 0)) / 4;
+
 	/*
 	 * Preload the next potential metaslabs
 	 */
@@ -2651,7 +3075,8 @@ metaslab_trace_fini(zio_alloc_list_t *zal)
  */
 
 static void
-metaslab_group_alloc_increment(spa_t *spa, uint64_t vdev, void *tag, int flags)
+metaslab_group_alloc_increment(spa_t *spa, uint64_t vdev, void *tag, int flags,
+    int allocator)
 {
 	metaslab_group_t *mg;
 
@@ -2663,11 +3088,38 @@ metaslab_group_alloc_increment(spa_t *spa, uint64_t vdev, void *tag, int flags)
 	if (!mg->mg_class->mc_alloc_throttle_enabled)
 		return;
 
-	(void) refcount_add(&mg->mg_alloc_queue_depth, tag);
+	(void) refcount_add(&mg->mg_allocator[allocator].mga_alloc_queue_depth,
+	    tag);
+}
+
+/*
+ * Each completed allocation lets its allocator queue one more to the
+ * group, up to mg_max_alloc_queue_depth, and gives the allocator one more
+ * slot in the class's throttle to go with it.  Both are reset at the
+ * start of every txg by spa_sync().
+ */
+static void
+metaslab_group_increment_qdepth(metaslab_group_t *mg, int allocator)
+{
+	metaslab_group_allocator_t *mga = &mg->mg_allocator[allocator];
+	metaslab_class_allocator_t *mca =
+	    &mg->mg_class->mc_allocator[allocator];
+	uint64_t max = mg->mg_max_alloc_queue_depth;
+	uint64_t cur = mga->mga_cur_max_alloc_queue_depth;
+
+	while (cur < max) {
+		if (atomic_cas_64(&mga->mga_cur_max_alloc_queue_depth,
+		    cur, cur + 1) == cur) {
+			atomic_inc_64(&mca->mca_alloc_max_slots);
+			return;
+		}
+		cur = mga->mga_cur_max_alloc_queue_depth;
+	}
 }
 
 void
-metaslab_group_alloc_decrement(spa_t *spa, uint64_t vdev, void *tag, int flags)
+metaslab_group_alloc_decrement(spa_t *spa, uint64_t vdev, void *tag, int flags,
+    int allocator, boolean_t io_complete)
 {
 	metaslab_group_t *mg;
 
@@ -2679,11 +3131,15 @@ metaslab_group_alloc_decrement(spa_t *spa, uint64_t vdev, void *tag, int flags)
 	if (!mg->mg_class->mc_alloc_throttle_enabled)
 		return;
 
-	(void) refcount_remove(&mg->mg_alloc_queue_depth, tag);
+	(void) refcount_remove(
+	    &mg->mg_allocator[allocator].mga_alloc_queue_depth, tag);
+	if (io_complete)
+		metaslab_group_increment_qdepth(mg, allocator);
 }
 
 void
-metaslab_group_alloc_verify(spa_t *spa, const blkptr_t *bp, void *tag)
+metaslab_group_alloc_verify(spa_t *spa, const blkptr_t *bp, void *tag,
+    int allocator)
 {
 #ifdef ZFS_DEBUG
 	const dva_t *dva = bp->blk_dva;
@@ -2693,7 +3149,9 @@ metaslab_group_alloc_verify(spa_t *spa, const blkptr_t *bp, void *tag)
 	for (d = 0; d < ndvas; d++) {
 		uint64_t vdev = DVA_GET_VDEV(&dva[d]);
 		metaslab_group_t *mg = vdev_lookup_top(spa, vdev)->vdev_mg;
-		VERIFY(refcount_not_held(&mg->mg_alloc_queue_depth, tag));
+		metaslab_group_allocator_t *mga = &mg->mg_allocator[allocator];
+
+		VERIFY(refcount_not_held(&mga->mga_alloc_queue_depth, tag));
 	}
 #endif
 }
@@ -2716,6 +3174,7 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 		VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
 		VERIFY3U(range_tree_space(rt) - size, <=, msp->ms_size);
 		range_tree_remove(rt, start, size);
+		range_tree_clear(msp->ms_trimtree, start, size);
 
 		if (range_tree_space(msp->ms_alloctree[txg & TXG_MASK]) == 0)
 			vdev_dirty(mg->mg_vd, VDD_METASLAB, msp, txg);
@@ -2735,15 +3194,77 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 	return (start);
 }
 
+/*
+ * Find the metaslab with the highest weight that is less than what we've
+ * already tried.  Inactive metaslabs sort first, so one of those is
+ * activated if possible, and only otherwise do we fall back to a metaslab
+ * that is active for another allocator.
+ */
+static metaslab_t *
+find_valid_metaslab(metaslab_group_t *mg, uint64_t activation_weight,
+    dva_t *dva, int d, uint64_t min_distance, uint64_t asize,
+    zio_alloc_list_t *zal, metaslab_t *search, boolean_t *was_active)
+{
+	avl_tree_t *t = &mg->mg_metaslab_tree;
+	avl_index_t idx;
+	metaslab_t *msp;
+	uint64_t target_distance;
+	int i;
+
+	ASSERT(MUTEX_HELD(&mg->mg_lock));
+
+	msp = avl_find(t, search, &idx);
+	if (msp == NULL)
+		msp = avl_nearest(t, idx, AVL_AFTER);
+
+	for (; msp != NULL; msp = AVL_NEXT(t, msp)) {
+		if (!metaslab_should_allocate(msp, asize)) {
+			metaslab_trace_add(zal, mg, msp, asize, d,
+			    TRACE_TOO_SMALL);
+			continue;
+		}
+
+		/*
+		 * If the selected metaslab is condensing or being trimmed,
+		 * skip it.
+		 */
+		if (msp->ms_condensing || msp->ms_trimming)
+			continue;
+
+		*was_active = (msp->ms_allocator != -1);
+		if (activation_weight == METASLAB_WEIGHT_PRIMARY || *was_active)
+			break;
+
+		target_distance = min_distance +
+		    (space_map_allocated(msp->ms_sm) != 0 ? 0 :
+		    min_distance >> 1);
+
+		for (i = 0; i < d; i++) {
+			if (metaslab_distance(msp, &dva[i]) < target_distance)
+				break;
+		}
+		if (i == d)
+			break;
+	}
+
+	if (msp != NULL) {
+		search->ms_weight = msp->ms_weight;
+		search->ms_start = msp->ms_start + 1;
+		search->ms_allocator = msp->ms_allocator;
+		search->ms_primary = msp->ms_primary;
+	}
+	return (msp);
+}
+
 static uint64_t
 metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
-    uint64_t asize, uint64_t txg, uint64_t min_distance, dva_t *dva, int d)
+    uint64_t asize, uint64_t txg, uint64_t min_distance, dva_t *dva, int d,
+    int allocator)
 {
 	metaslab_t *msp = NULL;
 	metaslab_t *search;
 	uint64_t offset = -1ULL;
 	uint64_t activation_weight;
-	uint64_t target_distance;
 	int i;
 
 	activation_weight = METASLAB_WEIGHT_PRIMARY;
@@ -2754,20 +3275,26 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 		}
 	}
 
+	/*
+	 * If the group doesn't have enough metaslabs for every allocator to
+	 * keep a primary and a secondary active with some left to choose
+	 * from, all allocations share the first allocator's.
+	 */
+	if (mg->mg_vd->vdev_ms_count < mg->mg_allocators * 3)
+		allocator = 0;
+
 	search = kmem_alloc(sizeof (*search), KM_SLEEP);
 	search->ms_weight = UINT64_MAX;
 	search->ms_start = 0;
+	search->ms_allocator = -1;
+	search->ms_primary = B_TRUE;
 	for (;;) {
-		boolean_t was_active;
-		avl_tree_t *t = &mg->mg_metaslab_tree;
-		avl_index_t idx;
+		metaslab_group_allocator_t *mga = &mg->mg_allocator[allocator];
+		boolean_t was_active = B_FALSE;
 
 		mutex_enter(&mg->mg_lock);
 
 		/*
-		 * Find the metaslab with the highest weight that is less
-		 * than what we've already tried.  In the common case, this
-		 * means that we will examine each metaslab at most once.
 		 * Note that concurrent callers could reorder metaslabs
 		 * by activation/passivation once we have dropped the mg_lock.
 		 * If a metaslab is activated by another thread, and we fail
@@ -2778,46 +3305,24 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 		 * if every metaslab is completely full except for the
 		 * the newly-activated metaslab which we fail to examine).
 		 */
-		msp = avl_find(t, search, &idx);
-		if (msp == NULL)
-			msp = avl_nearest(t, idx, AVL_AFTER);
-		for (; msp != NULL; msp = AVL_NEXT(t, msp)) {
-
-			if (!metaslab_should_allocate(msp, asize)) {
-				metaslab_trace_add(zal, mg, msp, asize, d,
-				    TRACE_TOO_SMALL);
-				continue;
-			}
-
-			/*
-			 * If the selected metaslab is condensing, skip it.
-			 */
-			if (msp->ms_condensing)
-				continue;
-
-			was_active = msp->ms_weight & METASLAB_ACTIVE_MASK;
-			if (activation_weight == METASLAB_WEIGHT_PRIMARY)
-				break;
-
-			target_distance = min_distance +
-			    (space_map_allocated(msp->ms_sm) != 0 ? 0 :
-			    min_distance >> 1);
-
-			for (i = 0; i < d; i++) {
-				if (metaslab_distance(msp, &dva[i]) <
-				    target_distance)
-					break;
-			}
-			if (i == d)
-				break;
+		if (activation_weight == METASLAB_WEIGHT_PRIMARY &&
+		    mga->mga_primary != NULL) {
+			msp = mga->mga_primary;
+			was_active = B_TRUE;
+		} else if (activation_weight == METASLAB_WEIGHT_SECONDARY &&
+		    mga->mga_secondary != NULL) {
+			msp = mga->mga_secondary;
+			was_active = B_TRUE;
+		} else {
+			msp = find_valid_metaslab(mg, activation_weight, dva, d,
+			    min_distance, asize, zal, search, &was_active);
 		}
+
 		mutex_exit(&mg->mg_lock);
 		if (msp == NULL) {
 			kmem_free(search, sizeof (*search));
 			return (-1ULL);
 		}
-		search->ms_weight = msp->ms_weight;
-		search->ms_start = msp->ms_start + 1;
 
 		mutex_enter(&msp->ms_lock);
 
@@ -2834,15 +3339,39 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 			continue;
 		}
 
-		if ((msp->ms_weight & METASLAB_WEIGHT_SECONDARY) &&
-		    activation_weight == METASLAB_WEIGHT_PRIMARY) {
+		/*
+		 * If the metaslab was activated in the meantime for another
+		 * allocator, or as a primary when we want a secondary (or
+		 * vice versa), select again.
+		 */
+		if (!was_active && msp->ms_allocator != -1 &&
+		    (msp->ms_allocator != allocator || msp->ms_primary !=
+		    (activation_weight == METASLAB_WEIGHT_PRIMARY))) {
+			mutex_exit(&msp->ms_lock);
+			continue;
+		}
+
+		/*
+		 * A metaslab that was only activated to claim blocks is
+		 * passivated, so that it can be activated for our allocator.
+		 */
+		if (msp->ms_weight & METASLAB_WEIGHT_CLAIM) {
 			metaslab_passivate(msp,
-			    msp->ms_weight & ~METASLAB_ACTIVE_MASK);
+			    msp->ms_weight & ~METASLAB_WEIGHT_CLAIM);
+			mutex_exit(&msp->ms_lock);
+			continue;
+		}
+
+		/*
+		 * A metaslab which started trimming since it was selected is
+		 * skipped by the next selection.
+		 */
+		if (msp->ms_trimming) {
 			mutex_exit(&msp->ms_lock);
 			continue;
 		}
 
-		if (metaslab_activate(msp, activation_weight) != 0) {
+		if (metaslab_activate(msp, allocator, activation_weight) != 0) {
 			mutex_exit(&msp->ms_lock);
 			continue;
 		}
@@ -2932,13 +3461,14 @@ next:
 
 static uint64_t
 metaslab_group_alloc(metaslab_group_t *mg, zio_alloc_list_t *zal,
-    uint64_t asize, uint64_t txg, uint64_t min_distance, dva_t *dva, int d)
+    uint64_t asize, uint64_t txg, uint64_t min_distance, dva_t *dva, int d,
+    int allocator)
 {
 	uint64_t offset;
 	ASSERT(mg->mg_initialized);
 
 	offset = metaslab_group_alloc_normal(mg, zal, asize, txg,
-	    min_distance, dva, d);
+	    min_distance, dva, d, allocator);
 
 	mutex_enter(&mg->mg_lock);
 	if (offset == -1ULL) {
@@ -2979,8 +3509,9 @@ int ditto_same_vdev_distance_shift = 3;
 static int
 metaslab_alloc_dva(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
     dva_t *dva, int d, dva_t *hintdva, uint64_t txg, int flags,
-    zio_alloc_list_t *zal)
+    zio_alloc_list_t *zal, int allocator)
 {
+	metaslab_class_allocator_t *mca = &mc->mc_allocator[allocator];
 	metaslab_group_t *mg, *fast_mg, *rotor;
 	vdev_t *vd;
 	boolean_t try_hard = B_FALSE;
@@ -2997,7 +3528,8 @@ metaslab_alloc_dva(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
 
 	/*
 	 * Start at the rotor and loop through all mgs until we find something.
-	 * Note that there's no locking on mc_rotor or mc_aliquot because
+	 * Each allocator has a rotor of its own.
+	 * Note that there's no locking on mca_rotor or mca_aliquot because
 	 * nothing actually breaks if we miss a few updates -- we just won't
 	 * allocate quite as evenly.  It all balances out over time.
 	 *
@@ -3032,22 +3564,22 @@ metaslab_alloc_dva(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
 			    mg->mg_next != NULL)
 				mg = mg->mg_next;
 		} else {
-			mg = mc->mc_rotor;
+			mg = mca->mca_rotor;
 		}
 	} else if (d != 0) {
 		vd = vdev_lookup_top(spa, DVA_GET_VDEV(&dva[d - 1]));
 		mg = vd->vdev_mg->mg_next;
 	} else if (flags & METASLAB_FASTWRITE) {
-		mg = fast_mg = mc->mc_rotor;
+		mg = fast_mg = mca->mca_rotor;
 
 		do {
 			if (fast_mg->mg_vd->vdev_pending_fastwrite <
 			    mg->mg_vd->vdev_pending_fastwrite)
 				mg = fast_mg;
-		} while ((fast_mg = fast_mg->mg_next) != mc->mc_rotor);
+		} while ((fast_mg = fast_mg->mg_next) != mca->mca_rotor);
 
 	} else {
-		mg = mc->mc_rotor;
+		mg = mca->mca_rotor;
 	}
 
 	/*
@@ -3055,7 +3587,7 @@ metaslab_alloc_dva(spa_t *spa, metaslab_class_t *mc, uint64_t psize,
 	 * metaslab group that has been passivated, just follow the rotor.
 	 */
 	if (mg->mg_class != mc || mg->mg_activation_count <= 0)
-		mg = mc->mc_rotor;
+		mg = mca->mca_rotor;
 
 	rotor = mg;
 top:
@@ -3087,7 +3619,7 @@ top:
 		 */
 		if (allocatable && !GANG_ALLOCATION(flags) && !try_hard) {
 			allocatable = metaslab_group_allocatable(mg, rotor,
-			    psize);
+			    psize, allocator);
 		}
 
 		if (!allocatable) {
@@ -3131,7 +3663,7 @@ top:
 		ASSERT(P2PHASE(asize, 1ULL << vd->vdev_ashift) == 0);
 
 		offset = metaslab_group_alloc(mg, zal, asize, txg, distance,
-		    dva, d);
+		    dva, d, allocator);
 
 		if (offset != -1ULL) {
 			/*
@@ -3143,7 +3675,7 @@ top:
 			 * Bias is also used to compensate for unequally
 			 * sized vdevs so that space is allocated fairly.
 			 */
-			if (mc->mc_aliquot == 0 && metaslab_bias_enabled) {
+			if (mca->mca_aliquot == 0 && metaslab_bias_enabled) {
 				vdev_stat_t *vs = &vd->vdev_stat;
 				int64_t vs_free = vs->vs_space - vs->vs_alloc;
 				int64_t mc_free = mc->mc_space - mc->mc_alloc;
@@ -3181,10 +3713,10 @@ top:
 			}
 
 			if ((flags & METASLAB_FASTWRITE) ||
-			    atomic_add_64_nv(&mc->mc_aliquot, asize) >=
+			    atomic_add_64_nv(&mca->mca_aliquot, asize) >=
 			    mg->mg_aliquot + mg->mg_bias) {
-				mc->mc_rotor = mg->mg_next;
-				mc->mc_aliquot = 0;
+				mca->mca_rotor = mg->mg_next;
+				mca->mca_aliquot = 0;
 			}
 
 			DVA_SET_VDEV(&dva[d], vd->vdev_id);
@@ -3201,8 +3733,8 @@ top:
 			return (0);
 		}
 next:
-		mc->mc_rotor = mg->mg_next;
-		mc->mc_aliquot = 0;
+		mca->mca_rotor = mg->mg_next;
+		mca->mca_aliquot = 0;
 	} while ((mg = mg->mg_next) != rotor);
 
 	/*
@@ -3302,8 +3834,22 @@ metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
 
 	mutex_enter(&msp->ms_lock);
 
-	if ((txg != 0 && spa_writeable(spa)) || !msp->ms_loaded)
-		error = metaslab_activate(msp, METASLAB_WEIGHT_SECONDARY);
+	/* The block may be in a range which is being trimmed */
+	while (msp->ms_trimming)
+		cv_wait(&msp->ms_trim_cv, &msp->ms_lock);
+
+	if ((txg != 0 && spa_writeable(spa)) || !msp->ms_loaded) {
+		error = metaslab_activate(msp, 0, METASLAB_WEIGHT_CLAIM);
+		/*
+		 * Another thread activated the metaslab while it was being
+		 * loaded, which is just as good for claiming from it.
+		 */
+		if (error == EBUSY) {
+			ASSERT(msp->ms_loaded);
+			ASSERT(msp->ms_weight & METASLAB_ACTIVE_MASK);
+			error = 0;
+		}
+	}
 
 	if (error == 0 && !range_tree_contains(msp->ms_tree, offset, size))
 		error = SET_ERROR(ENOENT);
@@ -3318,6 +3864,7 @@ metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
 	VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
 	VERIFY3U(range_tree_space(msp->ms_tree) - size, <=, msp->ms_size);
 	range_tree_remove(msp->ms_tree, offset, size);
+	range_tree_clear(msp->ms_trimtree, offset, size);
 
 	if (spa_writeable(spa)) {	/* don't dirty if we're zdb(1M) */
 		if (range_tree_space(msp->ms_alloctree[txg & TXG_MASK]) == 0)
@@ -3338,9 +3885,10 @@ metaslab_claim_dva(spa_t *spa, const dva_t *dva, uint64_t txg)
  * the reservation.
  */
 boolean_t
-metaslab_class_throttle_reserve(metaslab_class_t *mc, int slots, zio_t *zio,
-    int flags)
+metaslab_class_throttle_reserve(metaslab_class_t *mc, int slots, int allocator,
+    zio_t *zio, int flags)
 {
+	metaslab_class_allocator_t *mca = &mc->mc_allocator[allocator];
 	uint64_t available_slots = 0;
 	uint64_t reserved_slots;
 	boolean_t slot_reserved = B_FALSE;
@@ -3348,9 +3896,9 @@ metaslab_class_throttle_reserve(metaslab_class_t *mc, int slots, zio_t *zio,
 	ASSERT(mc->mc_alloc_throttle_enabled);
 	mutex_enter(&mc->mc_lock);
 
-	reserved_slots = refcount_count(&mc->mc_alloc_slots);
-	if (reserved_slots < mc->mc_alloc_max_slots)
-		available_slots = mc->mc_alloc_max_slots - reserved_slots;
+	reserved_slots = refcount_count(&mca->mca_alloc_slots);
+	if (reserved_slots < mca->mca_alloc_max_slots)
+		available_slots = mca->mca_alloc_max_slots - reserved_slots;
 
 	if (slots <= available_slots || GANG_ALLOCATION(flags)) {
 		int d;
@@ -3360,7 +3908,8 @@ metaslab_class_throttle_reserve(metaslab_class_t *mc, int slots, zio_t *zio,
 		 * them individually when an I/O completes.
 		 */
 		for (d = 0; d < slots; d++) {
-			reserved_slots = refcount_add(&mc->mc_alloc_slots, zio);
+			reserved_slots = refcount_add(&mca->mca_alloc_slots,
+			    zio);
 		}
 		zio->io_flags |= ZIO_FLAG_IO_ALLOCATING;
 		slot_reserved = B_TRUE;
@@ -3371,14 +3920,16 @@ metaslab_class_throttle_reserve(metaslab_class_t *mc, int slots, zio_t *zio,
 }
 
 void
-metaslab_class_throttle_unreserve(metaslab_class_t *mc, int slots, zio_t *zio)
+metaslab_class_throttle_unreserve(metaslab_class_t *mc, int slots,
+    int allocator, zio_t *zio)
 {
+	metaslab_class_allocator_t *mca = &mc->mc_allocator[allocator];
 	int d;
 
 	ASSERT(mc->mc_alloc_throttle_enabled);
 	mutex_enter(&mc->mc_lock);
 	for (d = 0; d < slots; d++) {
-		(void) refcount_remove(&mc->mc_alloc_slots, zio);
+		(void) refcount_remove(&mca->mca_alloc_slots, zio);
 	}
 	mutex_exit(&mc->mc_lock);
 }
@@ -3386,7 +3937,7 @@ metaslab_class_throttle_unreserve(metaslab_class_t *mc, int slots, zio_t *zio)
 int
 metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize, blkptr_t *bp,
     int ndvas, uint64_t txg, blkptr_t *hintbp, int flags,
-    zio_alloc_list_t *zal, zio_t *zio)
+    zio_alloc_list_t *zal, zio_t *zio, int allocator)
 {
 	dva_t *dva = bp->blk_dva;
 	dva_t *hintdva = hintbp->blk_dva;
@@ -3397,7 +3948,8 @@ metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize, blkptr_t *bp,
 
 	spa_config_enter(spa, SCL_ALLOC, FTAG, RW_READER);
 
-	if (mc->mc_rotor == NULL) {	/* no vdevs in this class */
+	/* no vdevs in this class */
+	if (mc->mc_allocator[allocator].mca_rotor == NULL) {
 		spa_config_exit(spa, SCL_ALLOC, FTAG);
 		return (SET_ERROR(ENOSPC));
 	}
@@ -3409,12 +3961,13 @@ metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize, blkptr_t *bp,
 
 	for (d = 0; d < ndvas; d++) {
 		error = metaslab_alloc_dva(spa, mc, psize, dva, d, hintdva,
-		    txg, flags, zal);
+		    txg, flags, zal, allocator);
 		if (error != 0) {
 			for (d--; d >= 0; d--) {
 				metaslab_free_dva(spa, &dva[d], txg, B_TRUE);
 				metaslab_group_alloc_decrement(spa,
-				    DVA_GET_VDEV(&dva[d]), zio, flags);
+				    DVA_GET_VDEV(&dva[d]), zio, flags,
+				    allocator, B_FALSE);
 				bzero(&dva[d], sizeof (dva_t));
 			}
 			spa_config_exit(spa, SCL_ALLOC, FTAG);
@@ -3425,7 +3978,7 @@ metaslab_alloc(spa_t *spa, metaslab_class_t *mc, uint64_t psize, blkptr_t *bp,
 			 * based on the newly allocated dva.
 			 */
 			metaslab_group_alloc_increment(spa,
-			    DVA_GET_VDEV(&dva[d]), zio, flags);
+			    DVA_GET_VDEV(&dva[d]), zio, flags, allocator);
 		}
 
 	}
@@ -3581,6 +4134,18 @@ module_param(metaslab_preload_enabled, int, 0644);
 MODULE_PARM_DESC(metaslab_preload_enabled,
 	"preload potential metaslabs during reassessment");
 
+module_param(metaslab_preload_limit, int, 0644);
+MODULE_PARM_DESC(metaslab_preload_limit,
+	"min number of metaslabs per group to preload");
+
+module_param(metaslab_preload_max, int, 0644);
+MODULE_PARM_DESC(metaslab_preload_max,
+	"max number of metaslabs per group to preload");
+
+module_param(metaslab_preload_txgs, int, 0644);
+MODULE_PARM_DESC(metaslab_preload_txgs,
+	"txgs of allocations that preloaded metaslabs should absorb");
+
 module_param(zfs_mg_noalloc_threshold, int, 0644);
 MODULE_PARM_DESC(zfs_mg_noalloc_threshold,
 	"percentage of free space for metaslab group to allow allocation");
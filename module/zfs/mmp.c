@@ -371,6 +371,7 @@ mmp_update_uberblock(spa_t *spa, uberblock_t *ub)
 	mutex_enter(&mmp->mmp_io_lock);
 	mmp->mmp_ub = *ub;
 	mmp->mmp_ub.ub_timestamp = gethrestime_sec();
+	mmp->mmp_last_sync = gethrtime();
 	mmp_delay_update(spa, B_TRUE);
 	mutex_exit(&mmp->mmp_io_lock);
 }
@@ -387,6 +388,7 @@ mmp_write_uberblock(spa_t *spa)
 	mmp_thread_t *mmp = &spa->spa_mmp;
 	uberblock_t *ub;
 	vdev_t *vd = NULL;
+	zio_t *wzio;
 	int label, error;
 	uint64_t offset;
 
@@ -448,10 +450,19 @@ mmp_write_uberblock(spa_t *spa)
 	offset = VDEV_UBERBLOCK_OFFSET(vd, VDEV_UBERBLOCK_COUNT(vd) -
 	    MMP_BLOCKS_PER_LABEL + spa_get_random(MMP_BLOCKS_PER_LABEL));
 
+	/*
+	 * The write is queued with a deadline which has already passed, so
+	 * the leaf's queue issues it ahead of the data and ZIL writes it
+	 * would otherwise wait behind in the sync write class.
+	 */
 	label = spa_get_random(VDEV_LABELS);
-	vdev_label_write(zio, vd, label, ub_abd, offset,
-	    VDEV_UBERBLOCK_SIZE(vd), mmp_write_done, mmp,
-	    flags | ZIO_FLAG_DONT_PROPAGATE);
+	wzio = zio_write_phys(zio, vd,
+	    vdev_label_offset(vd->vdev_psize, label, offset),
+	    VDEV_UBERBLOCK_SIZE(vd), ub_abd, ZIO_CHECKSUM_LABEL,
+	    mmp_write_done, mmp, ZIO_PRIORITY_SYNC_WRITE,
+	    flags | ZIO_FLAG_DONT_PROPAGATE, B_TRUE);
+	wzio->io_deadline = gethrtime();
+	zio_nowait(wzio);
 
 	(void) spa_mmp_history_add(spa, ub->ub_txg, ub->ub_timestamp,
 	    ub->ub_mmp_delay, vd, label, vd->vdev_mmp_kstat_id, 0);
@@ -487,14 +498,23 @@ mmp_thread(spa_t *spa)
 		    MAX(zfs_multihost_interval, MMP_MIN_INTERVAL));
 		boolean_t suspended = spa_suspended(spa);
 		boolean_t multihost = spa_multihost(spa);
-		hrtime_t next_time;
+		hrtime_t mmp_period, next_time, last_sync;
 
-		if (multihost)
-			next_time = gethrtime() + mmp_interval /
+		/*
+		 * The period is jittered by up to 1/8th either way so that
+		 * the writes of the pools sharing a set of disks, and of the
+		 * hosts sharing a pool, do not fall into step.  The mean
+		 * period is unchanged.
+		 */
+		if (multihost) {
+			mmp_period = mmp_interval /
 			    MAX(vdev_count_leaves(spa), 1);
-		else
-			next_time = gethrtime() +
-			    MSEC2NSEC(MMP_DEFAULT_INTERVAL);
+			next_time = gethrtime() + mmp_period - mmp_period / 8 +
+			    spa_get_random(MAX(mmp_period / 4, 1));
+		} else {
+			mmp_period = MSEC2NSEC(MMP_DEFAULT_INTERVAL);
+			next_time = gethrtime() + mmp_period;
+		}
 
 		/*
 		 * MMP off => on, or suspended => !suspended:
@@ -546,7 +566,17 @@ mmp_thread(spa_t *spa)
 			zio_suspend(spa, NULL, ZIO_SUSPEND_MMP);
 		}
 
-		if (multihost && !suspended)
+		/*
+		 * A txg sync which wrote out a new uberblock during the last
+		 * period already told other hosts the pool is in use, and
+		 * updated mmp_last_write, so the mmp write is not needed.
+		 */
+		mutex_enter(&mmp->mmp_io_lock);
+		last_sync = mmp->mmp_last_sync;
+		mutex_exit(&mmp->mmp_io_lock);
+
+		if (multihost && !suspended &&
+		    gethrtime() - last_sync >= mmp_period)
 			mmp_write_uberblock(spa);
 
 		CALLB_CPR_SAFE_BEGIN(&cpr);
@@ -25,6 +25,7 @@
 #include <linux/pagemap.h>
 #include <linux/completion.h>
 #include <sys/zfs_context.h>
+#include <sys/zio_compress.h>
 #include "qat_compress.h"
 
 /*
@@ -191,6 +192,49 @@ qat_clean(void)
 	qat_init_done = B_FALSE;
 }
 
+/*
+ * The engine produces zlib streams, registered for every gzip level; the
+ * session's level is used whatever the dataset asks for.
+ */
+/*ARGSUSED*/
+static boolean_t
+qat_accel_usable(enum zio_compress c, size_t len)
+{
+	return (qat_use_accel(len));
+}
+
+/*ARGSUSED*/
+static int
+qat_accel_compress(enum zio_compress c, int level, void *src, void *dst,
+    size_t s_len, size_t d_len, size_t *c_len)
+{
+	return (qat_compress(QAT_COMPRESS, src, s_len, dst, d_len,
+	    c_len) != CPA_STATUS_SUCCESS);
+}
+
+/*ARGSUSED*/
+static int
+qat_accel_decompress(enum zio_compress c, int level, void *src, void *dst,
+    size_t s_len, size_t d_len)
+{
+	size_t dstlen;
+
+	return (qat_compress(QAT_DECOMPRESS, src, s_len, dst, d_len,
+	    &dstlen) != CPA_STATUS_SUCCESS);
+}
+
+#define	QAT_ACCEL_ALGS	\
+	(((1ULL << (ZIO_COMPRESS_GZIP_9 + 1)) - 1) & \
+	~((1ULL << ZIO_COMPRESS_GZIP_1) - 1))
+
+static const zio_compress_accel_t qat_accel = {
+	"qat",
+	QAT_ACCEL_ALGS,
+	qat_accel_usable,
+	qat_accel_compress,
+	qat_accel_decompress
+};
+
 int
 qat_init(void)
 {
@@ -304,6 +348,7 @@ qat_init(void)
 	}
 
 	qat_init_done = B_TRUE;
+	(void) zio_compress_accel_register(&qat_accel);
 	return (0);
 fail:
 	qat_clean();
@@ -313,6 +358,7 @@ fail:
 void
 qat_fini(void)
 {
+	zio_compress_accel_unregister(&qat_accel);
 	qat_clean();
 
 	if (qat_ksp != NULL) {
@@ -33,32 +33,26 @@
 #include <sys/zio.h>
 #include <sys/range_tree.h>
 
-kmem_cache_t *range_seg_cache;
-
-void
-range_tree_init(void)
-{
-	ASSERT(range_seg_cache == NULL);
-	range_seg_cache = kmem_cache_create("range_seg_cache",
-	    sizeof (range_seg_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
-}
-
-void
-range_tree_fini(void)
-{
-	kmem_cache_destroy(range_seg_cache);
-	range_seg_cache = NULL;
-}
+/*
+ * Segments are kept by value in a B-tree rather than each in its own AVL
+ * node.  A loaded metaslab can have millions of segments, and storing
+ * them as arrays avoids an allocation for each one, uses a third of the
+ * memory, and keeps lookups within a few cache lines.  Since segments
+ * move around in the tree as it changes, a segment found in it may only
+ * be used until the next insertion or removal, and one that is trimmed
+ * or extended in place must be passed to zfs_btree_update().
+ */
 
 void
 range_tree_stat_verify(range_tree_t *rt)
 {
+	zfs_btree_index_t where;
 	range_seg_t *rs;
 	uint64_t hist[RANGE_TREE_HISTOGRAM_SIZE] = { 0 };
 	int i;
 
-	for (rs = avl_first(&rt->rt_root); rs != NULL;
-	    rs = AVL_NEXT(&rt->rt_root, rs)) {
+	for (rs = zfs_btree_first(&rt->rt_root, &where); rs != NULL;
+	    rs = zfs_btree_next(&rt->rt_root, &where, &where)) {
 		uint64_t size = rs->rs_end - rs->rs_start;
 		int idx	= highbit64(size) - 1;
 
@@ -127,8 +121,8 @@ range_tree_create(range_tree_ops_t *ops, void *arg, kmutex_t *lp)
 
 	rt = kmem_zalloc(sizeof (range_tree_t), KM_SLEEP);
 
-	avl_create(&rt->rt_root, range_tree_seg_compare,
-	    sizeof (range_seg_t), offsetof(range_seg_t, rs_node));
+	zfs_btree_create(&rt->rt_root, range_tree_seg_compare,
+	    sizeof (range_seg_t));
 
 	rt->rt_lock = lp;
 	rt->rt_ops = ops;
@@ -148,7 +142,7 @@ range_tree_destroy(range_tree_t *rt)
 	if (rt->rt_ops != NULL)
 		rt->rt_ops->rtop_destroy(rt, rt->rt_arg);
 
-	avl_destroy(&rt->rt_root);
+	zfs_btree_destroy(&rt->rt_root);
 	kmem_free(rt, sizeof (*rt));
 }
 
@@ -156,8 +150,8 @@ void
 range_tree_add(void *arg, uint64_t start, uint64_t size)
 {
 	range_tree_t *rt = arg;
-	avl_index_t where;
-	range_seg_t rsearch, *rs_before, *rs_after, *rs;
+	zfs_btree_index_t where, where_before, where_after;
+	range_seg_t rsearch, *rs_before, *rs_after, *rs, seg;
 	uint64_t end = start + size;
 	boolean_t merge_before, merge_after;
 
@@ -166,7 +160,7 @@ range_tree_add(void *arg, uint64_t start, uint64_t size)
 
 	rsearch.rs_start = start;
 	rsearch.rs_end = end;
-	rs = avl_find(&rt->rt_root, &rsearch, &where);
+	rs = zfs_btree_find(&rt->rt_root, &rsearch, &where);
 
 	if (rs != NULL && rs->rs_start <= start && rs->rs_end >= end) {
 		zfs_panic_recover("zfs: allocating allocated segment"
@@ -178,14 +172,14 @@ range_tree_add(void *arg, uint64_t start, uint64_t size)
 	/* Make sure we don't overlap with either of our neighbors */
 	VERIFY(rs == NULL);
 
-	rs_before = avl_nearest(&rt->rt_root, where, AVL_BEFORE);
-	rs_after = avl_nearest(&rt->rt_root, where, AVL_AFTER);
+	rs_before = zfs_btree_nearest_before(&rt->rt_root, &where,
+	    &where_before);
+	rs_after = zfs_btree_nearest_after(&rt->rt_root, &where, &where_after);
 
 	merge_before = (rs_before != NULL && rs_before->rs_end == start);
 	merge_after = (rs_after != NULL && rs_after->rs_start == end);
 
 	if (merge_before && merge_after) {
-		avl_remove(&rt->rt_root, rs_before);
 		if (rt->rt_ops != NULL) {
 			rt->rt_ops->rtop_remove(rt, rs_before, rt->rt_arg);
 			rt->rt_ops->rtop_remove(rt, rs_after, rt->rt_arg);
@@ -194,9 +188,14 @@ range_tree_add(void *arg, uint64_t start, uint64_t size)
 		range_tree_stat_decr(rt, rs_before);
 		range_tree_stat_decr(rt, rs_after);
 
+		/*
+		 * Extend the segment after over the one before, then drop
+		 * the one before; the removal may move both of them.
+		 */
 		rs_after->rs_start = rs_before->rs_start;
-		kmem_cache_free(range_seg_cache, rs_before);
-		rs = rs_after;
+		zfs_btree_update(&rt->rt_root, &where_after);
+		seg = *rs_after;
+		zfs_btree_remove_idx(&rt->rt_root, &where_before);
 	} else if (merge_before) {
 		if (rt->rt_ops != NULL)
 			rt->rt_ops->rtop_remove(rt, rs_before, rt->rt_arg);
@@ -204,7 +203,8 @@ range_tree_add(void *arg, uint64_t start, uint64_t size)
 		range_tree_stat_decr(rt, rs_before);
 
 		rs_before->rs_end = end;
-		rs = rs_before;
+		zfs_btree_update(&rt->rt_root, &where_before);
+		seg = *rs_before;
 	} else if (merge_after) {
 		if (rt->rt_ops != NULL)
 			rt->rt_ops->rtop_remove(rt, rs_after, rt->rt_arg);
@@ -212,18 +212,18 @@ range_tree_add(void *arg, uint64_t start, uint64_t size)
 		range_tree_stat_decr(rt, rs_after);
 
 		rs_after->rs_start = start;
-		rs = rs_after;
+		zfs_btree_update(&rt->rt_root, &where_after);
+		seg = *rs_after;
 	} else {
-		rs = kmem_cache_alloc(range_seg_cache, KM_SLEEP);
-		rs->rs_start = start;
-		rs->rs_end = end;
-		avl_insert(&rt->rt_root, rs, where);
+		seg.rs_start = start;
+		seg.rs_end = end;
+		zfs_btree_add_idx(&rt->rt_root, &seg, &where);
 	}
 
 	if (rt->rt_ops != NULL)
-		rt->rt_ops->rtop_add(rt, rs, rt->rt_arg);
+		rt->rt_ops->rtop_add(rt, &seg, rt->rt_arg);
 
-	range_tree_stat_incr(rt, rs);
+	range_tree_stat_incr(rt, &seg);
 	rt->rt_space += size;
 }
 
@@ -231,8 +231,8 @@ void
 range_tree_remove(void *arg, uint64_t start, uint64_t size)
 {
 	range_tree_t *rt = arg;
-	avl_index_t where;
-	range_seg_t rsearch, *rs, *newseg;
+	zfs_btree_index_t where, where_new;
+	range_seg_t rsearch, *rs, seg, newseg;
 	uint64_t end = start + size;
 	boolean_t left_over, right_over;
 
@@ -242,7 +242,7 @@ range_tree_remove(void *arg, uint64_t start, uint64_t size)
 
 	rsearch.rs_start = start;
 	rsearch.rs_end = end;
-	rs = avl_find(&rt->rt_root, &rsearch, &where);
+	rs = zfs_btree_find(&rt->rt_root, &rsearch, &where);
 
 	/* Make sure we completely overlap with someone */
 	if (rs == NULL) {
@@ -263,31 +263,38 @@ range_tree_remove(void *arg, uint64_t start, uint64_t size)
 		rt->rt_ops->rtop_remove(rt, rs, rt->rt_arg);
 
 	if (left_over && right_over) {
-		newseg = kmem_cache_alloc(range_seg_cache, KM_SLEEP);
-		newseg->rs_start = end;
-		newseg->rs_end = rs->rs_end;
-		range_tree_stat_incr(rt, newseg);
+		newseg.rs_start = end;
+		newseg.rs_end = rs->rs_end;
+		range_tree_stat_incr(rt, &newseg);
 
 		rs->rs_end = start;
+		zfs_btree_update(&rt->rt_root, &where);
+		seg = *rs;
 
-		avl_insert_here(&rt->rt_root, newseg, rs, AVL_AFTER);
+		/* The new segment goes right after the old one */
+		where_new = where;
+		where_new.bti_offset++;
+		zfs_btree_add_idx(&rt->rt_root, &newseg, &where_new);
 		if (rt->rt_ops != NULL)
-			rt->rt_ops->rtop_add(rt, newseg, rt->rt_arg);
+			rt->rt_ops->rtop_add(rt, &newseg, rt->rt_arg);
 	} else if (left_over) {
 		rs->rs_end = start;
+		zfs_btree_update(&rt->rt_root, &where);
+		seg = *rs;
 	} else if (right_over) {
 		rs->rs_start = end;
+		zfs_btree_update(&rt->rt_root, &where);
+		seg = *rs;
 	} else {
-		avl_remove(&rt->rt_root, rs);
-		kmem_cache_free(range_seg_cache, rs);
+		zfs_btree_remove_idx(&rt->rt_root, &where);
 		rs = NULL;
 	}
 
 	if (rs != NULL) {
-		range_tree_stat_incr(rt, rs);
+		range_tree_stat_incr(rt, &seg);
 
 		if (rt->rt_ops != NULL)
-			rt->rt_ops->rtop_add(rt, rs, rt->rt_arg);
+			rt->rt_ops->rtop_add(rt, &seg, rt->rt_arg);
 	}
 
 	rt->rt_space -= size;
@@ -296,7 +303,6 @@ range_tree_remove(void *arg, uint64_t start, uint64_t size)
 static range_seg_t *
 range_tree_find_impl(range_tree_t *rt, uint64_t start, uint64_t size)
 {
-	avl_index_t where;
 	range_seg_t rsearch;
 	uint64_t end = start + size;
 
@@ -305,7 +311,7 @@ range_tree_find_impl(range_tree_t *rt, uint64_t start, uint64_t size)
 
 	rsearch.rs_start = start;
 	rsearch.rs_end = end;
-	return (avl_find(&rt->rt_root, &rsearch, &where));
+	return (zfs_btree_find(&rt->rt_root, &rsearch, NULL));
 }
 
 static range_seg_t *
@@ -358,7 +364,7 @@ range_tree_swap(range_tree_t **rtsrc, range_tree_t **rtdst)
 
 	ASSERT(MUTEX_HELD((*rtsrc)->rt_lock));
 	ASSERT0(range_tree_space(*rtdst));
-	ASSERT0(avl_numnodes(&(*rtdst)->rt_root));
+	ASSERT0(zfs_btree_numnodes(&(*rtdst)->rt_root));
 
 	rt = *rtsrc;
 	*rtsrc = *rtdst;
@@ -368,19 +374,20 @@ range_tree_swap(range_tree_t **rtsrc, range_tree_t **rtdst)
 void
 range_tree_vacate(range_tree_t *rt, range_tree_func_t *func, void *arg)
 {
+	zfs_btree_index_t where;
 	range_seg_t *rs;
-	void *cookie = NULL;
 
 	ASSERT(MUTEX_HELD(rt->rt_lock));
 
 	if (rt->rt_ops != NULL)
 		rt->rt_ops->rtop_vacate(rt, rt->rt_arg);
 
-	while ((rs = avl_destroy_nodes(&rt->rt_root, &cookie)) != NULL) {
-		if (func != NULL)
+	if (func != NULL) {
+		for (rs = zfs_btree_first(&rt->rt_root, &where); rs != NULL;
+		    rs = zfs_btree_next(&rt->rt_root, &where, &where))
 			func(arg, rs->rs_start, rs->rs_end - rs->rs_start);
-		kmem_cache_free(range_seg_cache, rs);
 	}
+	zfs_btree_clear(&rt->rt_root);
 
 	bzero(rt->rt_histogram, sizeof (rt->rt_histogram));
 	rt->rt_space = 0;
@@ -389,11 +396,13 @@ range_tree_vacate(range_tree_t *rt, range_tree_func_t *func, void *arg)
 void
 range_tree_walk(range_tree_t *rt, range_tree_func_t *func, void *arg)
 {
+	zfs_btree_index_t where;
 	range_seg_t *rs;
 
 	ASSERT(MUTEX_HELD(rt->rt_lock));
 
-	for (rs = avl_first(&rt->rt_root); rs; rs = AVL_NEXT(&rt->rt_root, rs))
+	for (rs = zfs_btree_first(&rt->rt_root, &where); rs != NULL;
+	    rs = zfs_btree_next(&rt->rt_root, &where, &where))
 		func(arg, rs->rs_start, rs->rs_end - rs->rs_start);
 }
 
@@ -318,13 +318,19 @@ rrw_tsd_destroy(void *arg)
  * it is used (filesystem unmount) performance is not critical.
  *
  * All the functions below are direct wrappers around functions above.
+ * The number of locks is read from zfs_rrm_locks by rrm_init(), so it can
+ * be raised for locks taken by many threads at once without rebuilding.
  */
+int zfs_rrm_locks = RRM_NUM_LOCKS;
+
 void
 rrm_init(rrmlock_t *rrl, boolean_t track_all)
 {
 	int i;
 
-	for (i = 0; i < RRM_NUM_LOCKS; i++)
+	rrl->nlocks = MIN(MAX(zfs_rrm_locks, 1), RRM_MAX_LOCKS);
+	rrl->locks = kmem_alloc(rrl->nlocks * sizeof (rrwlock_t), KM_SLEEP);
+	for (i = 0; i < rrl->nlocks; i++)
 		rrw_init(&rrl->locks[i], track_all);
 }
 
@@ -333,8 +339,10 @@ rrm_destroy(rrmlock_t *rrl)
 {
 	int i;
 
-	for (i = 0; i < RRM_NUM_LOCKS; i++)
+	for (i = 0; i < rrl->nlocks; i++)
 		rrw_destroy(&rrl->locks[i]);
+	kmem_free(rrl->locks, rrl->nlocks * sizeof (rrwlock_t));
+	rrl->locks = NULL;
 }
 
 void
@@ -354,12 +362,19 @@ rrm_enter(rrmlock_t *rrl, krw_t rw, void *tag)
  * is faster than 64-bit division, and the high 32 bits have little
  * entropy anyway.
  */
-#define	RRM_TD_LOCK()	(((uint32_t)(uintptr_t)(curthread)) % RRM_NUM_LOCKS)
+#define	RRM_TD_LOCK(rrl) \
+	(((uint32_t)(uintptr_t)(curthread)) % (uint32_t)(rrl)->nlocks)
 
 void
 rrm_enter_read(rrmlock_t *rrl, void *tag)
 {
-	rrw_enter_read(&rrl->locks[RRM_TD_LOCK()], tag);
+	rrw_enter_read(&rrl->locks[RRM_TD_LOCK(rrl)], tag);
+}
+
+void
+rrm_enter_read_prio(rrmlock_t *rrl, void *tag)
+{
+	rrw_enter_read_prio(&rrl->locks[RRM_TD_LOCK(rrl)], tag);
 }
 
 void
@@ -367,7 +382,7 @@ rrm_enter_write(rrmlock_t *rrl)
 {
 	int i;
 
-	for (i = 0; i < RRM_NUM_LOCKS; i++)
+	for (i = 0; i < rrl->nlocks; i++)
 		rrw_enter_write(&rrl->locks[i]);
 }
 
@@ -377,10 +392,10 @@ rrm_exit(rrmlock_t *rrl, void *tag)
 	int i;
 
 	if (rrl->locks[0].rr_writer == curthread) {
-		for (i = 0; i < RRM_NUM_LOCKS; i++)
+		for (i = 0; i < rrl->nlocks; i++)
 			rrw_exit(&rrl->locks[i], tag);
 	} else {
-		rrw_exit(&rrl->locks[RRM_TD_LOCK()], tag);
+		rrw_exit(&rrl->locks[RRM_TD_LOCK(rrl)], tag);
 	}
 }
 
@@ -390,6 +405,12 @@ rrm_held(rrmlock_t *rrl, krw_t rw)
 	if (rw == RW_WRITER) {
 		return (rrw_held(&rrl->locks[0], rw));
 	} else {
-		return (rrw_held(&rrl->locks[RRM_TD_LOCK()], rw));
+		return (rrw_held(&rrl->locks[RRM_TD_LOCK(rrl)], rw));
 	}
 }
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zfs_rrm_locks, int, 0644);
+MODULE_PARM_DESC(zfs_rrm_locks,
+	"Number of locks a reader-mostly lock is split into");
+#endif
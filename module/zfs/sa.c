@@ -394,6 +394,62 @@ sa_attr_op(sa_handle_t *hdl, sa_bulk_attr_t *bulk, int count,
 	return (error);
 }
 
+/*
+ * Enter a new layout into the cache indexed by layout number.
+ */
+static void
+sa_layout_cache_add(sa_os_t *sa, sa_lot_t *tb)
+{
+	ASSERT(MUTEX_HELD(&sa->sa_lock));
+
+	if (tb->lot_num >= SA_LAYOUT_CACHE_MAX)
+		return;
+
+	if (tb->lot_num >= sa->sa_layout_cache_sz) {
+		int newsz = MAX(sa->sa_layout_cache_sz * 2, 16);
+		sa_lot_t **newcache;
+
+		while (newsz <= tb->lot_num)
+			newsz *= 2;
+		newcache = kmem_zalloc(newsz * sizeof (sa_lot_t *), KM_SLEEP);
+		if (sa->sa_layout_cache != NULL) {
+			bcopy(sa->sa_layout_cache, newcache,
+			    sa->sa_layout_cache_sz * sizeof (sa_lot_t *));
+			kmem_free(sa->sa_layout_cache,
+			    sa->sa_layout_cache_sz * sizeof (sa_lot_t *));
+		}
+		sa->sa_layout_cache = newcache;
+		sa->sa_layout_cache_sz = newsz;
+	}
+	sa->sa_layout_cache[tb->lot_num] = tb;
+}
+
+static void
+sa_layout_cache_free(sa_os_t *sa)
+{
+	if (sa->sa_layout_cache != NULL) {
+		kmem_free(sa->sa_layout_cache,
+		    sa->sa_layout_cache_sz * sizeof (sa_lot_t *));
+	}
+	sa->sa_layout_cache = NULL;
+	sa->sa_layout_cache_sz = 0;
+}
+
+static sa_lot_t *
+sa_layout_find_num(sa_os_t *sa, uint64_t lot_num)
+{
+	sa_lot_t search;
+
+	ASSERT(MUTEX_HELD(&sa->sa_lock));
+
+	if (lot_num < sa->sa_layout_cache_sz &&
+	    sa->sa_layout_cache[lot_num] != NULL)
+		return (sa->sa_layout_cache[lot_num]);
+
+	search.lot_num = lot_num;
+	return (avl_find(&sa->sa_layout_num_tree, &search, NULL));
+}
+
 static sa_lot_t *
 sa_add_layout_entry(objset_t *os, sa_attr_type_t *attrs, int attr_count,
     uint64_t lot_num, uint64_t hash, boolean_t zapadd, dmu_tx_t *tx)
@@ -437,6 +493,7 @@ sa_add_layout_entry(objset_t *os, sa_attr_type_t *attrs, int attr_count,
 	}
 
 	avl_add(&sa->sa_layout_num_tree, tb);
+	sa_layout_cache_add(sa, tb);
 
 	/* verify we don't have a hash collision */
 	if ((findtb = avl_find(&sa->sa_layout_hash_tree, tb, &loc)) != NULL) {
@@ -461,10 +518,15 @@ sa_find_layout(objset_t *os, uint64_t hash, sa_attr_type_t *attrs,
 	boolean_t found = B_FALSE;
 
 	mutex_enter(&sa->sa_lock);
-	tbsearch.lot_hash = hash;
-	tbsearch.lot_instance = 0;
-	tb = avl_find(&sa->sa_layout_hash_tree, &tbsearch, &loc);
-	if (tb) {
+	tb = sa->sa_layout_hash_cache[hash % SA_LAYOUT_HASH_CACHE];
+	if (tb != NULL && tb->lot_hash == hash &&
+	    sa_layout_equal(tb, attrs, count) == 0)
+		found = B_TRUE;
+
+	if (!found) {
+		tbsearch.lot_hash = hash;
+		tbsearch.lot_instance = 0;
+		tb = avl_find(&sa->sa_layout_hash_tree, &tbsearch, &loc);
 		for (; tb && tb->lot_hash == hash;
 		    tb = AVL_NEXT(&sa->sa_layout_hash_tree, tb)) {
 			if (sa_layout_equal(tb, attrs, count) == 0) {
@@ -477,6 +539,7 @@ sa_find_layout(objset_t *os, uint64_t hash, sa_attr_type_t *attrs,
 		tb = sa_add_layout_entry(os, attrs, count,
 		    avl_numnodes(&sa->sa_layout_num_tree), hash, B_TRUE, tx);
 	}
+	sa->sa_layout_hash_cache[hash % SA_LAYOUT_HASH_CACHE] = tb;
 	mutex_exit(&sa->sa_lock);
 	*lot = tb;
 }
@@ -1102,6 +1165,7 @@ fail:
 	if (sa->sa_user_table)
 		kmem_free(sa->sa_user_table, sa->sa_user_table_sz);
 	mutex_exit(&sa->sa_lock);
+	sa_layout_cache_free(sa);
 	avl_destroy(&sa->sa_layout_hash_tree);
 	avl_destroy(&sa->sa_layout_num_tree);
 	mutex_destroy(&sa->sa_lock);
@@ -1139,6 +1203,7 @@ sa_tear_down(objset_t *os)
 		kmem_free(layout, sizeof (sa_lot_t));
 	}
 
+	sa_layout_cache_free(sa);
 	avl_destroy(&sa->sa_layout_hash_tree);
 	avl_destroy(&sa->sa_layout_num_tree);
 	mutex_destroy(&sa->sa_lock);
@@ -1503,8 +1568,9 @@ sa_find_idx_tab(objset_t *os, dmu_object_type_t bonustype, sa_hdr_phys_t *hdr)
 {
 	sa_idx_tab_t *idx_tab;
 	sa_os_t *sa = os->os_sa;
-	sa_lot_t *tb, search;
-	avl_index_t loc;
+	sa_lot_t *tb;
+
+	ASSERT(MUTEX_HELD(&sa->sa_lock));
 
 	/*
 	 * Deterimine layout number.  If SA node and header == 0 then
@@ -1515,9 +1581,7 @@ sa_find_idx_tab(objset_t *os, dmu_object_type_t bonustype, sa_hdr_phys_t *hdr)
 	 * doesn't write any attributes to the bonus buffer.
 	 */
 
-	search.lot_num = SA_LAYOUT_NUM(hdr, bonustype);
-
-	tb = avl_find(&sa->sa_layout_num_tree, &search, &loc);
+	tb = sa_layout_find_num(sa, SA_LAYOUT_NUM(hdr, bonustype));
 
 	/* Verify header size is consistent with layout information */
 	ASSERT(tb);
@@ -1545,6 +1609,11 @@ sa_find_idx_tab(objset_t *os, dmu_object_type_t bonustype, sa_hdr_phys_t *hdr)
 			}
 		}
 		if (valid_idx) {
+			/* keep the most recently used table first */
+			if (idx_tab != list_head(&tb->lot_idx_tab)) {
+				list_remove(&tb->lot_idx_tab, idx_tab);
+				list_insert_head(&tb->lot_idx_tab, idx_tab);
+			}
 			sa_idx_tab_hold(os, idx_tab);
 			return (idx_tab);
 		}
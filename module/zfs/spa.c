@@ -104,6 +104,7 @@ static int zfs_ccw_retry_interval = 300;
 typedef enum zti_modes {
 	ZTI_MODE_FIXED,			/* value is # of threads (min 1) */
 	ZTI_MODE_BATCH,			/* cpu-intensive; value is ignored */
+	ZTI_MODE_SCALE,			/* one taskq per CPU shard */
 	ZTI_MODE_NULL,			/* don't create a taskq */
 	ZTI_NMODES
 } zti_modes_t;
@@ -111,6 +112,7 @@ typedef enum zti_modes {
 #define	ZTI_P(n, q)	{ ZTI_MODE_FIXED, (n), (q) }
 #define	ZTI_PCT(n)	{ ZTI_MODE_ONLINE_PERCENT, (n), 1 }
 #define	ZTI_BATCH	{ ZTI_MODE_BATCH, 0, 1 }
+#define	ZTI_SCALE	{ ZTI_MODE_SCALE, 0, 1 }
 #define	ZTI_NULL	{ ZTI_MODE_NULL, 0, 0 }
 
 #define	ZTI_N(n)	ZTI_P(n, 1)
@@ -137,7 +139,10 @@ static const char *const zio_taskq_types[ZIO_TASKQ_TYPES] = {
  * point of lock contention. The ZTI_P(#, #) macro indicates that we need an
  * additional degree of parallelism specified by the number of threads per-
  * taskq and the number of taskqs; when dispatching an event in this case, the
- * particular taskq is chosen at random.
+ * particular taskq is chosen by the CPU the zio was created on.  ZTI_SCALE
+ * is ZTI_BATCH split into one taskq per zio_taskq_shard_cpus CPUs, with
+ * the same choice, so that the issue and interrupt stages of a zio run on
+ * the shard of the CPU which issued it.
  *
  * The different taskq priorities are to handle the different contexts (issue
  * and interrupt) and then to reserve threads for ZIO_PRIORITY_NOW I/Os that
@@ -146,8 +151,8 @@ static const char *const zio_taskq_types[ZIO_TASKQ_TYPES] = {
 const zio_taskq_info_t zio_taskqs[ZIO_TYPES][ZIO_TASKQ_TYPES] = {
 	/* ISSUE	ISSUE_HIGH	INTR		INTR_HIGH */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* NULL */
-	{ ZTI_N(4),	ZTI_NULL,	ZTI_BATCH,	ZTI_NULL }, /* READ */
-	{ ZTI_BATCH,	ZTI_N(3),	ZTI_ONE,	ZTI_ONE  }, /* WRITE */
+	{ ZTI_SCALE,	ZTI_NULL,	ZTI_SCALE,	ZTI_NULL }, /* READ */
+	{ ZTI_SCALE,	ZTI_N(3),	ZTI_SCALE,	ZTI_ONE  }, /* WRITE */
 	{ ZTI_P(2, 4),	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* FREE */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* CLAIM */
 	{ ZTI_ONE,	ZTI_NULL,	ZTI_ONE,	ZTI_NULL }, /* IOCTL */
@@ -163,8 +168,11 @@ static inline int spa_load_impl(spa_t *spa, uint64_t, nvlist_t *config,
     spa_load_state_t state, spa_import_type_t type, boolean_t mosconfig,
     char **ereport);
 static void spa_vdev_resilver_done(spa_t *spa);
+static void spa_stats_cache_set(spa_t *spa, nvlist_t *config, uint64_t gen,
+    hrtime_t time);
 
 uint_t		zio_taskq_batch_pct = 75;	/* 1 thread per cpu in pset */
+uint_t		zio_taskq_shard_cpus = 4;	/* CPUs per ZTI_SCALE taskq */
 id_t		zio_taskq_psrset_bind = PS_NONE;
 boolean_t	zio_taskq_sysdc = B_TRUE;	/* use SDC scheduling class */
 uint_t		zio_taskq_basedc = 80;		/* base duty cycle */
@@ -221,8 +229,10 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 	ASSERT(MUTEX_HELD(&spa->spa_props_lock));
 
 	if (rvd != NULL) {
-		alloc = metaslab_class_get_alloc(spa_normal_class(spa));
-		size = metaslab_class_get_space(spa_normal_class(spa));
+		alloc = metaslab_class_get_alloc(spa_normal_class(spa)) +
+		    metaslab_class_get_alloc(spa_special_class(spa));
+		size = metaslab_class_get_space(spa_normal_class(spa)) +
+		    metaslab_class_get_space(spa_special_class(spa));
 		spa_prop_add_list(*nvp, ZPOOL_PROP_NAME, spa_name(spa), 0, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_SIZE, NULL, size, src);
 		spa_prop_add_list(*nvp, ZPOOL_PROP_ALLOCATED, NULL, alloc, src);
@@ -490,6 +500,7 @@ spa_prop_validate(spa_t *spa, nvlist_t *props)
 		case ZPOOL_PROP_AUTOREPLACE:
 		case ZPOOL_PROP_LISTSNAPS:
 		case ZPOOL_PROP_AUTOEXPAND:
+		case ZPOOL_PROP_AUTOTRIM:
 			error = nvpair_value_uint64(elem, &intval);
 			if (!error && intval > 1)
 				error = SET_ERROR(EINVAL);
@@ -929,6 +940,17 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 		return;
 	}
 
+	if (mode == ZTI_MODE_SCALE) {
+		if (zio_taskq_shard_cpus == 0 ||
+		    zio_taskq_shard_cpus >= boot_ncpus) {
+			mode = ZTI_MODE_BATCH;
+		} else {
+			count = boot_ncpus / zio_taskq_shard_cpus;
+			value = MAX(1, zio_taskq_shard_cpus *
+			    MIN(zio_taskq_batch_pct, 100) / 100);
+		}
+	}
+
 	ASSERT3U(count, >, 0);
 
 	tqs->stqs_count = count;
@@ -947,6 +969,11 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 		value = MIN(zio_taskq_batch_pct, 100);
 		break;
 
+	case ZTI_MODE_SCALE:
+		batch = B_TRUE;
+		flags |= TASKQ_DYNAMIC;
+		break;
+
 	default:
 		panic("unrecognized mode for %s_%s taskq (%u:%u) in "
 		    "spa_activate()",
@@ -1014,12 +1041,12 @@ spa_taskqs_fini(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 /*
  * Dispatch a task to the appropriate taskq for the ZFS I/O type and priority.
  * Note that a type may have multiple discrete taskqs to avoid lock contention
- * on the taskq itself. In that case we choose which taskq at random by using
- * the low bits of gethrtime().
+ * on the taskq itself. In that case hint, the CPU the zio was created on,
+ * chooses the taskq: every stage of a zio is dispatched to the same shard.
  */
 void
 spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
-    task_func_t *func, void *arg, uint_t flags, taskq_ent_t *ent)
+    task_func_t *func, void *arg, uint_t flags, taskq_ent_t *ent, uint_t hint)
 {
 	spa_taskqs_t *tqs = &spa->spa_zio_taskq[t][q];
 	taskq_t *tq;
@@ -1029,8 +1056,11 @@ spa_taskq_dispatch_ent(spa_t *spa, zio_type_t t, zio_taskq_type_t q,
 
 	if (tqs->stqs_count == 1) {
 		tq = tqs->stqs_taskq[0];
+	} else if (zio_taskq_shard_cpus != 0) {
+		tq = tqs->stqs_taskq[(hint / zio_taskq_shard_cpus) %
+		    tqs->stqs_count];
 	} else {
-		tq = tqs->stqs_taskq[((uint64_t)gethrtime()) % tqs->stqs_count];
+		tq = tqs->stqs_taskq[hint % tqs->stqs_count];
 	}
 
 	taskq_dispatch_ent(tq, func, arg, flags, ent);
@@ -1156,6 +1186,7 @@ spa_activate(spa_t *spa, int mode)
 
 	spa->spa_normal_class = metaslab_class_create(spa, zfs_metaslab_ops);
 	spa->spa_log_class = metaslab_class_create(spa, zfs_metaslab_ops);
+	spa->spa_special_class = metaslab_class_create(spa, zfs_metaslab_ops);
 
 	/* Try to create a covering process */
 	mutex_enter(&spa->spa_proc_lock);
@@ -1294,6 +1325,9 @@ spa_deactivate(spa_t *spa)
 	metaslab_class_destroy(spa->spa_log_class);
 	spa->spa_log_class = NULL;
 
+	metaslab_class_destroy(spa->spa_special_class);
+	spa->spa_special_class = NULL;
+
 	/*
 	 * If this was part of an import or the open otherwise failed, we may
 	 * still have errors left in the queues.  Empty them just in case.
@@ -1389,11 +1423,20 @@ spa_unload(spa_t *spa)
 
 	ASSERT(MUTEX_HELD(&spa_namespace_lock));
 
+	spa_stats_cache_set(spa, NULL, 0, 0);
+
 	/*
 	 * Stop async tasks.
 	 */
 	spa_async_suspend(spa);
 
+	/*
+	 * Stop trimming, while the trim thread can still log to the pool
+	 * history.
+	 */
+	if (spa->spa_trim.tt_thread)
+		vdev_trim_thread_stop(spa);
+
 	/*
 	 * Stop syncing.
 	 */
@@ -3159,6 +3202,7 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		spa_prop_find(spa, ZPOOL_PROP_DELEGATION, &spa->spa_delegation);
 		spa_prop_find(spa, ZPOOL_PROP_FAILUREMODE, &spa->spa_failmode);
 		spa_prop_find(spa, ZPOOL_PROP_AUTOEXPAND, &spa->spa_autoexpand);
+		spa_prop_find(spa, ZPOOL_PROP_AUTOTRIM, &spa->spa_autotrim);
 		spa_prop_find(spa, ZPOOL_PROP_MULTIHOST, &spa->spa_multihost);
 		spa_prop_find(spa, ZPOOL_PROP_DEDUPDITTO,
 		    &spa->spa_dedup_ditto);
@@ -3306,6 +3350,7 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		spa->spa_sync_on = B_TRUE;
 		txg_sync_start(spa->spa_dsl_pool);
 		mmp_thread_start(spa);
+		vdev_trim_thread_start(spa);
 
 		/*
 		 * Wait for all claims to sync.  We sync up to the highest
@@ -3841,14 +3886,92 @@ spa_add_feature_stats(spa_t *spa, nvlist_t *config)
 	mutex_exit(&spa->spa_feat_stats_lock);
 }
 
+/*
+ * The config returned by spa_get_stats() is kept for this many milliseconds
+ * and handed out again to pollers, rather than being regenerated under the
+ * config locks on every call.  Any vdev state or config change, and pool
+ * suspension, drops it at once, so only the I/O counters can be this old.
+ * Zero disables the cache.
+ */
+int zfs_pool_stats_cache_ms = 100;
+
+/*
+ * Drop the cached stats config of a pool; called whenever something it
+ * reports other than the I/O counters changes.
+ */
+void
+spa_stats_cache_invalidate(spa_t *spa)
+{
+	atomic_inc_64(&spa->spa_stats_cache_gen);
+}
+
+/*
+ * Return a copy of the cached stats config when it is recent enough.  No
+ * config lock is taken, so pollers never wait for config changes or I/O.
+ */
+static nvlist_t *
+spa_stats_cache_get(spa_t *spa)
+{
+	nvlist_t *config = NULL;
+
+	mutex_enter(&spa->spa_stats_cache_lock);
+	if (spa->spa_stats_cache != NULL &&
+	    spa->spa_stats_cache_valid == spa->spa_stats_cache_gen &&
+	    gethrtime() - spa->spa_stats_cache_time <
+	    MSEC2NSEC(zfs_pool_stats_cache_ms))
+		config = fnvlist_dup(spa->spa_stats_cache);
+	mutex_exit(&spa->spa_stats_cache_lock);
+
+	return (config);
+}
+
+static void
+spa_stats_cache_set(spa_t *spa, nvlist_t *config, uint64_t gen,
+    hrtime_t time)
+{
+	mutex_enter(&spa->spa_stats_cache_lock);
+	nvlist_free(spa->spa_stats_cache);
+	spa->spa_stats_cache = config != NULL ? fnvlist_dup(config) : NULL;
+	spa->spa_stats_cache_valid = gen;
+	spa->spa_stats_cache_time = time;
+	mutex_exit(&spa->spa_stats_cache_lock);
+}
+
 int
 spa_get_stats(const char *name, nvlist_t **config,
     char *altroot, size_t buflen)
 {
 	int error;
 	spa_t *spa;
+	boolean_t cacheable = B_FALSE;
+	uint64_t gen = 0;
+	hrtime_t time = 0;
 
 	*config = NULL;
+
+	if (zfs_pool_stats_cache_ms > 0) {
+		mutex_enter(&spa_namespace_lock);
+		spa = spa_lookup(name);
+		if (spa != NULL && spa->spa_state == POOL_STATE_ACTIVE) {
+			*config = spa_stats_cache_get(spa);
+			if (*config != NULL) {
+				if (altroot)
+					spa_altroot(spa, altroot, buflen);
+				mutex_exit(&spa_namespace_lock);
+				return (0);
+			}
+
+			/*
+			 * Read before the config is generated, so that a
+			 * change racing with that leaves the result stale.
+			 */
+			gen = spa->spa_stats_cache_gen;
+			time = gethrtime();
+			cacheable = B_TRUE;
+		}
+		mutex_exit(&spa_namespace_lock);
+	}
+
 	error = spa_open_common(name, &spa, FTAG, NULL, config);
 
 	if (spa != NULL) {
@@ -3883,6 +4006,9 @@ spa_get_stats(const char *name, nvlist_t **config,
 			spa_add_spares(spa, *config);
 			spa_add_l2cache(spa, *config);
 			spa_add_feature_stats(spa, *config);
+
+			if (cacheable && error == 0)
+				spa_stats_cache_set(spa, *config, gen, time);
 		}
 	}
 
@@ -4310,6 +4436,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	spa->spa_delegation = zpool_prop_default_numeric(ZPOOL_PROP_DELEGATION);
 	spa->spa_failmode = zpool_prop_default_numeric(ZPOOL_PROP_FAILUREMODE);
 	spa->spa_autoexpand = zpool_prop_default_numeric(ZPOOL_PROP_AUTOEXPAND);
+	spa->spa_autotrim = zpool_prop_default_numeric(ZPOOL_PROP_AUTOTRIM);
 	spa->spa_multihost = zpool_prop_default_numeric(ZPOOL_PROP_MULTIHOST);
 
 	if (props != NULL) {
@@ -4322,6 +4449,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	spa->spa_sync_on = B_TRUE;
 	txg_sync_start(spa->spa_dsl_pool);
 	mmp_thread_start(spa);
+	vdev_trim_thread_start(spa);
 
 	/*
 	 * We explicitly wait for the first transaction to complete so that our
@@ -6745,6 +6873,10 @@ spa_sync_props(void *arg, dmu_tx_t *tx)
 			case ZPOOL_PROP_MULTIHOST:
 				spa->spa_multihost = intval;
 				break;
+			case ZPOOL_PROP_AUTOTRIM:
+				spa->spa_autotrim = intval;
+				vdev_trim_wakeup(spa);
+				break;
 			case ZPOOL_PROP_DEDUPDITTO:
 				spa->spa_dedup_ditto = intval;
 				break;
@@ -6772,7 +6904,7 @@ spa_sync_upgrades(spa_t *spa, dmu_tx_t *tx)
 
 	ASSERT(spa->spa_sync_pass == 1);
 
-	rrw_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
+	rrm_enter(&dp->dp_config_rwlock, RW_WRITER, FTAG);
 
 	if (spa->spa_ubsync.ub_version < SPA_VERSION_ORIGIN &&
 	    spa->spa_uberblock.ub_version >= SPA_VERSION_ORIGIN) {
@@ -6829,7 +6961,7 @@ spa_sync_upgrades(spa_t *spa, dmu_tx_t *tx)
 		    spa->spa_cksum_salt.zcs_bytes, tx));
 	}
 
-	rrw_exit(&dp->dp_config_rwlock, FTAG);
+	rrm_exit(&dp->dp_config_rwlock, FTAG);
 }
 
 /*
@@ -6849,7 +6981,9 @@ spa_sync(spa_t *spa, uint64_t txg)
 	int error;
 	uint32_t max_queue_depth = zfs_vdev_async_write_max_active *
 	    zfs_vdev_queue_depth_pct / 100;
-	uint64_t queue_depth_total;
+	uint64_t slots_per_allocator;
+	hrtime_t t;
+	int i;
 	int c;
 
 	VERIFY(spa_writeable(spa));
@@ -6862,9 +6996,11 @@ spa_sync(spa_t *spa, uint64_t txg)
 	spa->spa_syncing_txg = txg;
 	spa->spa_sync_pass = 0;
 
-	mutex_enter(&spa->spa_alloc_lock);
-	VERIFY0(avl_numnodes(&spa->spa_alloc_tree));
-	mutex_exit(&spa->spa_alloc_lock);
+	for (i = 0; i < spa->spa_alloc_count; i++) {
+		mutex_enter(&spa->spa_alloc_locks[i]);
+		VERIFY0(avl_numnodes(&spa->spa_alloc_trees[i]));
+		mutex_exit(&spa->spa_alloc_locks[i]);
+	}
 
 	/*
 	 * If there are any pending vdev state changes, convert them
@@ -6893,6 +7029,7 @@ spa_sync(spa_t *spa, uint64_t txg)
 	tx = dmu_tx_create_assigned(dp, txg);
 
 	spa->spa_sync_starttime = gethrtime();
+	bzero(spa->spa_sync_phase_ns, sizeof (spa->spa_sync_phase_ns));
 	taskq_cancel_id(system_delay_taskq, spa->spa_deadman_tqid);
 	spa->spa_deadman_tqid = taskq_dispatch_delay(system_delay_taskq,
 	    spa_deadman, spa, TQ_SLEEP, ddi_get_lbolt() +
@@ -6904,8 +7041,6 @@ spa_sync(spa_t *spa, uint64_t txg)
 	 */
 	if (spa->spa_ubsync.ub_version < SPA_VERSION_RAIDZ_DEFLATE &&
 	    spa->spa_uberblock.ub_version >= SPA_VERSION_RAIDZ_DEFLATE) {
-		int i;
-
 		for (i = 0; i < rvd->vdev_children; i++) {
 			vd = rvd->vdev_child[i];
 			if (vd->vdev_deflate_ratio != SPA_MINBLOCKSIZE)
@@ -6923,9 +7058,11 @@ spa_sync(spa_t *spa, uint64_t txg)
 	 * Set the top-level vdev's max queue depth. Evaluate each
 	 * top-level's async write queue depth in case it changed.
 	 * The max queue depth will not change in the middle of syncing
-	 * out this txg.
+	 * out this txg.  Each allocator starts out with a queue depth of
+	 * zfs_vdev_def_queue_depth per top-level vdev, which grows towards
+	 * the max as its allocations complete.
 	 */
-	queue_depth_total = 0;
+	slots_per_allocator = 0;
 	for (c = 0; c < rvd->vdev_children; c++) {
 		vdev_t *tvd = rvd->vdev_child[c];
 		metaslab_group_t *mg = tvd->vdev_mg;
@@ -6939,16 +7076,24 @@ spa_sync(spa_t *spa, uint64_t txg)
 		 * allocations look at mg_max_alloc_queue_depth, and async
 		 * allocations all happen from spa_sync().
 		 */
-		ASSERT0(refcount_count(&mg->mg_alloc_queue_depth));
+		for (i = 0; i < mg->mg_allocators; i++) {
+			ASSERT0(refcount_count(
+			    &mg->mg_allocator[i].mga_alloc_queue_depth));
+			mg->mg_allocator[i].mga_cur_max_alloc_queue_depth =
+			    MIN(zfs_vdev_def_queue_depth, max_queue_depth);
+		}
 		mg->mg_max_alloc_queue_depth = max_queue_depth;
-		queue_depth_total += mg->mg_max_alloc_queue_depth;
+		slots_per_allocator +=
+		    MIN(zfs_vdev_def_queue_depth, max_queue_depth);
 	}
 	mc = spa_normal_class(spa);
-	ASSERT0(refcount_count(&mc->mc_alloc_slots));
-	mc->mc_alloc_max_slots = queue_depth_total;
+	for (i = 0; i < spa->spa_alloc_count; i++) {
+		ASSERT0(refcount_count(&mc->mc_allocator[i].mca_alloc_slots));
+		mc->mc_allocator[i].mca_alloc_max_slots = slots_per_allocator;
+	}
 	mc->mc_alloc_throttle_enabled = zio_dva_throttle_enabled;
 
-	ASSERT3U(mc->mc_alloc_max_slots, <=,
+	ASSERT3U(slots_per_allocator, <=,
 	    max_queue_depth * rvd->vdev_children);
 
 	/*
@@ -6957,14 +7102,20 @@ spa_sync(spa_t *spa, uint64_t txg)
 	do {
 		int pass = ++spa->spa_sync_pass;
 
+		t = gethrtime();
 		spa_sync_config_object(spa, tx);
 		spa_sync_aux_dev(spa, &spa->spa_spares, tx,
 		    ZPOOL_CONFIG_SPARES, DMU_POOL_SPARES);
 		spa_sync_aux_dev(spa, &spa->spa_l2cache, tx,
 		    ZPOOL_CONFIG_L2CACHE, DMU_POOL_L2CACHE);
 		spa_errlog_sync(spa, txg);
+		(void) spa_sync_phase_end(spa, SPA_SYNC_CONFIG, t);
+
+		/* dsl_pool_sync() charges its own phases */
 		dsl_pool_sync(dp, txg);
 
+		t = gethrtime();
+
 		if (pass < zfs_sync_pass_deferred_free) {
 			spa_sync_frees(spa, free_bpl, tx);
 		} else {
@@ -6976,15 +7127,19 @@ spa_sync(spa_t *spa, uint64_t txg)
 			bplist_iterate(free_bpl, bpobj_enqueue_cb,
 			    &spa->spa_deferred_bpobj, tx);
 		}
+		t = spa_sync_phase_end(spa, SPA_SYNC_FREES, t);
 
 		ddt_sync(spa, txg);
 		dsl_scan_sync(dp, tx);
+		t = spa_sync_phase_end(spa, SPA_SYNC_SCAN, t);
 
 		while ((vd = txg_list_remove(&spa->spa_vdev_txg_list, txg)))
 			vdev_sync(vd, txg);
+		t = spa_sync_phase_end(spa, SPA_SYNC_VDEVS, t);
 
 		if (pass == 1) {
 			spa_sync_upgrades(spa, tx);
+			t = spa_sync_phase_end(spa, SPA_SYNC_CONFIG, t);
 			ASSERT3U(txg, >=,
 			    spa->spa_uberblock.ub_rootbp.blk_birth);
 			/*
@@ -7013,6 +7168,7 @@ spa_sync(spa_t *spa, uint64_t txg)
 				break;
 			}
 			spa_sync_deferred_frees(spa, tx);
+			(void) spa_sync_phase_end(spa, SPA_SYNC_FREES, t);
 		}
 
 	} while (dmu_objset_is_dirty(mos, txg));
@@ -7043,6 +7199,7 @@ spa_sync(spa_t *spa, uint64_t txg)
 	 * config cache (see spa_vdev_add() for a complete description).
 	 * If there *are* dirty vdevs, sync the uberblock to all vdevs.
 	 */
+	t = gethrtime();
 	for (;;) {
 		/*
 		 * We hold SCL_STATE to prevent vdev open/close/etc.
@@ -7080,6 +7237,7 @@ spa_sync(spa_t *spa, uint64_t txg)
 		zio_suspend(spa, NULL, ZIO_SUSPEND_IOERR);
 		zio_resume_wait(spa);
 	}
+	t = spa_sync_phase_end(spa, SPA_SYNC_UBERBLOCK, t);
 	dmu_tx_commit(tx);
 
 	taskq_cancel_id(system_delay_taskq, spa->spa_deadman_tqid);
@@ -7102,10 +7260,13 @@ spa_sync(spa_t *spa, uint64_t txg)
 	}
 
 	dsl_pool_sync_done(dp, txg);
+	dsl_scan_free_budget_update(dp, gethrtime() - spa->spa_sync_starttime);
 
-	mutex_enter(&spa->spa_alloc_lock);
-	VERIFY0(avl_numnodes(&spa->spa_alloc_tree));
-	mutex_exit(&spa->spa_alloc_lock);
+	for (i = 0; i < spa->spa_alloc_count; i++) {
+		mutex_enter(&spa->spa_alloc_locks[i]);
+		VERIFY0(avl_numnodes(&spa->spa_alloc_trees[i]));
+		mutex_exit(&spa->spa_alloc_locks[i]);
+	}
 
 	/*
 	 * Update usable space statistics.
@@ -7123,6 +7284,8 @@ spa_sync(spa_t *spa, uint64_t txg)
 	ASSERT(txg_list_empty(&dp->dp_dirty_dirs, txg));
 	ASSERT(txg_list_empty(&spa->spa_vdev_txg_list, txg));
 
+	(void) spa_sync_phase_end(spa, SPA_SYNC_DONE, t);
+	spa->spa_sync_passes = spa->spa_sync_pass;
 	spa->spa_sync_pass = 0;
 
 	/*
@@ -7394,6 +7557,10 @@ EXPORT_SYMBOL(spa_event_notify);
 #endif
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zfs_pool_stats_cache_ms, int, 0644);
+MODULE_PARM_DESC(zfs_pool_stats_cache_ms,
+	"Milliseconds to reuse pool stats for, 0 to disable");
+
 module_param(spa_load_verify_maxinflight, int, 0644);
 MODULE_PARM_DESC(spa_load_verify_maxinflight,
 	"Max concurrent traversal I/Os while verifying pool during import -X");
@@ -7411,4 +7578,9 @@ module_param(zio_taskq_batch_pct, uint, 0444);
 MODULE_PARM_DESC(zio_taskq_batch_pct,
 	"Percentage of CPUs to run an IO worker thread");
 
+/* CSTYLED */
+module_param(zio_taskq_shard_cpus, uint, 0444);
+MODULE_PARM_DESC(zio_taskq_shard_cpus,
+	"Number of CPUs sharing each sharded IO taskq");
+
 #endif
@@ -69,6 +69,22 @@ char *spa_config_path = ZPOOL_CACHE;
 int zfs_autoimport_disable = 0;
 int zfs_do_write_coalesce = 1;
 
+/*
+ * When non-zero, routine cache file updates are not written out by
+ * spa_config_sync() itself but by a task run this many milliseconds
+ * later, which writes every cache file once.  Provisioning many pools, or
+ * a burst of vdev state changes, then costs one write and fsync per cache
+ * file per interval instead of one per change.  The cache file may lag the
+ * in-core configuration by up to the interval, so a crash in that window
+ * can require an explicit import; zero keeps the writes synchronous.
+ * Pool removals and cachefile changes are always written synchronously.
+ */
+int zfs_spa_config_sync_delay_ms = 0;
+
+/* Protected by spa_namespace_lock */
+static boolean_t spa_config_deferred = B_FALSE;
+static taskqid_t spa_config_deferred_tqid;
+
 /*
  * Called when the module is first loaded, this routine loads the configuration
  * file into the SPA namespace.  It does not actually open or load the pools; it
@@ -240,6 +256,125 @@ spa_config_write(spa_config_dirent_t *dp, nvlist_t *nvl)
 	return (err);
 }
 
+/*
+ * Gather the configs of all pools whose cache file is 'path', skipping
+ * 'skip' when it is about to be removed from the namespace.  Returns NULL
+ * when there are none.
+ */
+static nvlist_t *
+spa_config_collect(const char *path, spa_t *skip)
+{
+	spa_t *spa = NULL;
+	spa_config_dirent_t *tdp;
+	nvlist_t *nvl = NULL;
+	char *pool_name;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	while ((spa = spa_next(spa)) != NULL) {
+		/*
+		 * Skip over our own pool if we're about to remove
+		 * ourselves from the spa namespace or any pool that
+		 * is readonly. Since we cannot guarantee that a
+		 * readonly pool would successfully import upon reboot,
+		 * we don't allow them to be written to the cache file.
+		 */
+		if (spa == skip || !spa_writeable(spa))
+			continue;
+
+		mutex_enter(&spa->spa_props_lock);
+		tdp = list_head(&spa->spa_config_list);
+		if (spa->spa_config == NULL ||
+		    tdp == NULL ||
+		    tdp->scd_path == NULL ||
+		    strcmp(tdp->scd_path, path) != 0) {
+			mutex_exit(&spa->spa_props_lock);
+			continue;
+		}
+
+		if (nvl == NULL)
+			nvl = fnvlist_alloc();
+
+		if (spa->spa_import_flags & ZFS_IMPORT_TEMP_NAME)
+			pool_name = fnvlist_lookup_string(
+			    spa->spa_config, ZPOOL_CONFIG_POOL_NAME);
+		else
+			pool_name = spa_name(spa);
+
+		fnvlist_add_nvlist(nvl, pool_name, spa->spa_config);
+		mutex_exit(&spa->spa_props_lock);
+	}
+
+	return (nvl);
+}
+
+/*
+ * Write out every cache file in use, each once.  Returns non-zero if any
+ * write failed.
+ */
+static int
+spa_config_write_all(void)
+{
+	spa_config_dirent_t *dp;
+	spa_t *spa = NULL;
+	nvlist_t *done, *nvl;
+	int error = 0;
+
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	done = fnvlist_alloc();
+	while ((spa = spa_next(spa)) != NULL) {
+		dp = list_head(&spa->spa_config_list);
+		if (dp == NULL || dp->scd_path == NULL ||
+		    nvlist_exists(done, dp->scd_path))
+			continue;
+
+		fnvlist_add_boolean(done, dp->scd_path);
+		nvl = spa_config_collect(dp->scd_path, NULL);
+		if (spa_config_write(dp, nvl) != 0)
+			error = SET_ERROR(EIO);
+		nvlist_free(nvl);
+	}
+	nvlist_free(done);
+
+	return (error);
+}
+
+static void
+spa_config_sync_deferred(void *arg)
+{
+	mutex_enter(&spa_namespace_lock);
+	if (spa_config_deferred) {
+		spa_config_deferred = B_FALSE;
+		if (spa_config_write_all() != 0) {
+			/* Try again after another interval */
+			spa_config_deferred = B_TRUE;
+			spa_config_deferred_tqid = taskq_dispatch_delay(
+			    system_delay_taskq, spa_config_sync_deferred,
+			    NULL, TQ_SLEEP, ddi_get_lbolt() +
+			    MSEC_TO_TICK(MAX(zfs_spa_config_sync_delay_ms, 1)));
+		}
+	}
+	mutex_exit(&spa_namespace_lock);
+}
+
+/*
+ * Write out a deferred cache file update now, e.g. before the module is
+ * unloaded.  Must be called without the namespace lock held.
+ */
+void
+spa_config_sync_flush(void)
+{
+	mutex_enter(&spa_namespace_lock);
+	if (spa_config_deferred) {
+		spa_config_deferred = B_FALSE;
+		(void) spa_config_write_all();
+	}
+	mutex_exit(&spa_namespace_lock);
+
+	taskq_cancel_id(system_delay_taskq, spa_config_deferred_tqid);
+}
+
 /*
  * Synchronize pool configuration to disk.  This must be called with the
  * namespace lock held. Synchronizing the pool cache is typically done after
@@ -254,7 +389,6 @@ spa_config_sync(spa_t *target, boolean_t removing, boolean_t postsysevent)
 {
 	spa_config_dirent_t *dp, *tdp;
 	nvlist_t *nvl;
-	char *pool_name;
 	boolean_t ccw_failure;
 	int error = 0;
 
@@ -263,6 +397,23 @@ spa_config_sync(spa_t *target, boolean_t removing, boolean_t postsysevent)
 	if (rootdir == NULL || !(spa_mode_global & FWRITE))
 		return;
 
+	/*
+	 * Leave a routine update to the deferred writer, unless an older
+	 * cache file of this pool still has to be rewritten without it.
+	 */
+	dp = list_head(&target->spa_config_list);
+	if (zfs_spa_config_sync_delay_ms > 0 && !removing && dp != NULL &&
+	    list_next(&target->spa_config_list, dp) == NULL) {
+		if (!spa_config_deferred) {
+			spa_config_deferred = B_TRUE;
+			spa_config_deferred_tqid = taskq_dispatch_delay(
+			    system_delay_taskq, spa_config_sync_deferred,
+			    NULL, TQ_SLEEP, ddi_get_lbolt() +
+			    MSEC_TO_TICK(zfs_spa_config_sync_delay_ms));
+		}
+		goto out;
+	}
+
 	/*
 	 * Iterate over all cachefiles for the pool, past or present.  When the
 	 * cachefile is changed, the new one is pushed onto this list, allowing
@@ -271,48 +422,14 @@ spa_config_sync(spa_t *target, boolean_t removing, boolean_t postsysevent)
 	ccw_failure = B_FALSE;
 	for (dp = list_head(&target->spa_config_list); dp != NULL;
 	    dp = list_next(&target->spa_config_list, dp)) {
-		spa_t *spa = NULL;
 		if (dp->scd_path == NULL)
 			continue;
 
 		/*
 		 * Iterate over all pools, adding any matching pools to 'nvl'.
 		 */
-		nvl = NULL;
-		while ((spa = spa_next(spa)) != NULL) {
-			/*
-			 * Skip over our own pool if we're about to remove
-			 * ourselves from the spa namespace or any pool that
-			 * is readonly. Since we cannot guarantee that a
-			 * readonly pool would successfully import upon reboot,
-			 * we don't allow them to be written to the cache file.
-			 */
-			if ((spa == target && removing) ||
-			    !spa_writeable(spa))
-				continue;
-
-			mutex_enter(&spa->spa_props_lock);
-			tdp = list_head(&spa->spa_config_list);
-			if (spa->spa_config == NULL ||
-			    tdp == NULL ||
-			    tdp->scd_path == NULL ||
-			    strcmp(tdp->scd_path, dp->scd_path) != 0) {
-				mutex_exit(&spa->spa_props_lock);
-				continue;
-			}
-
-			if (nvl == NULL)
-				nvl = fnvlist_alloc();
-
-			if (spa->spa_import_flags & ZFS_IMPORT_TEMP_NAME)
-				pool_name = fnvlist_lookup_string(
-				    spa->spa_config, ZPOOL_CONFIG_POOL_NAME);
-			else
-				pool_name = spa_name(spa);
-
-			fnvlist_add_nvlist(nvl, pool_name, spa->spa_config);
-			mutex_exit(&spa->spa_props_lock);
-		}
+		nvl = spa_config_collect(dp->scd_path,
+		    removing ? target : NULL);
 
 		error = spa_config_write(dp, nvl);
 		if (error != 0)
@@ -351,6 +468,7 @@ spa_config_sync(spa_t *target, boolean_t removing, boolean_t postsysevent)
 		kmem_free(tdp, sizeof (spa_config_dirent_t));
 	}
 
+out:
 	spa_config_generation++;
 
 	if (postsysevent)
@@ -615,4 +733,8 @@ MODULE_PARM_DESC(zfs_autoimport_disable, "Disable pool import at module load");
 module_param(zfs_do_write_coalesce, int, 0644);
 MODULE_PARM_DESC(zfs_do_write_coalesce, "Coalesce write IOs at ZIO");
 
+module_param(zfs_spa_config_sync_delay_ms, int, 0644);
+MODULE_PARM_DESC(zfs_spa_config_sync_delay_ms,
+	"Milliseconds to batch pool cache file updates for, 0 to disable");
+
 #endif
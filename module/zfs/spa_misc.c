@@ -59,6 +59,7 @@
 #include "qat_compress.h"
 #ifndef _KERNEL
 #include <sys/vdev_disk_aio.h>
+#include <sys/zvol.h>
 #endif
 
 /*
@@ -355,6 +356,23 @@ int spa_asize_inflation = 24;
 int spa_slop_shift = 5;
 uint64_t spa_min_slop = 128 * 1024 * 1024;
 
+/*
+ * The number of allocators of each metaslab class, which each have their
+ * own rotor and active metaslabs in each metaslab group so that concurrent
+ * allocations don't all serialize on the same locks.  It is set when the
+ * pool is imported or created.
+ */
+int spa_allocators = 4;
+
+/*
+ * Level 0 blocks of at most this size are also placed in the special
+ * allocation class, as long as less than (100 -
+ * zfs_special_class_metadata_reserve_pct) percent of it is allocated.
+ * The rest is kept for metadata.
+ */
+unsigned long zfs_special_small_blocks = 0;
+int zfs_special_class_metadata_reserve_pct = 25;
+
 /*
  * ==========================================================================
  * SPA config locking
@@ -579,12 +597,12 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 	mutex_init(&spa->spa_history_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_proc_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_props_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_stats_cache_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_cksum_tmpls_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_scrub_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_suspend_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_vdev_top_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_feat_stats_lock, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&spa->spa_alloc_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	cv_init(&spa->spa_async_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_evicting_os_cv, NULL, CV_DEFAULT, NULL);
@@ -592,6 +610,9 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 	cv_init(&spa->spa_scrub_io_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_suspend_cv, NULL, CV_DEFAULT, NULL);
 
+	zil_flush_group_init(spa);
+	vdev_trim_init(spa);
+
 	for (t = 0; t < TXG_SIZE; t++)
 		bplist_create(&spa->spa_free_bplist[t]);
 
@@ -617,8 +638,16 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 	if (altroot)
 		spa->spa_root = spa_strdup(altroot);
 
-	avl_create(&spa->spa_alloc_tree, zio_bookmark_compare,
-	    sizeof (zio_t), offsetof(zio_t, io_alloc_node));
+	spa->spa_alloc_count = MAX(1, spa_allocators);
+	spa->spa_alloc_locks = kmem_zalloc(spa->spa_alloc_count *
+	    sizeof (kmutex_t), KM_SLEEP);
+	spa->spa_alloc_trees = kmem_zalloc(spa->spa_alloc_count *
+	    sizeof (avl_tree_t), KM_SLEEP);
+	for (i = 0; i < spa->spa_alloc_count; i++) {
+		mutex_init(&spa->spa_alloc_locks[i], NULL, MUTEX_DEFAULT, NULL);
+		avl_create(&spa->spa_alloc_trees[i], zio_bookmark_compare,
+		    sizeof (zio_t), offsetof(zio_t, io_alloc_node));
+	}
 
 	/*
 	 * Every pool starts with the default cachefile
@@ -679,7 +708,7 @@ void
 spa_remove(spa_t *spa)
 {
 	spa_config_dirent_t *dp;
-	int t;
+	int t, i;
 
 	ASSERT(MUTEX_HELD(&spa_namespace_lock));
 	ASSERT(spa->spa_state == POOL_STATE_UNINITIALIZED);
@@ -700,7 +729,14 @@ spa_remove(spa_t *spa)
 		kmem_free(dp, sizeof (spa_config_dirent_t));
 	}
 
-	avl_destroy(&spa->spa_alloc_tree);
+	for (i = 0; i < spa->spa_alloc_count; i++) {
+		avl_destroy(&spa->spa_alloc_trees[i]);
+		mutex_destroy(&spa->spa_alloc_locks[i]);
+	}
+	kmem_free(spa->spa_alloc_locks, spa->spa_alloc_count *
+	    sizeof (kmutex_t));
+	kmem_free(spa->spa_alloc_trees, spa->spa_alloc_count *
+	    sizeof (avl_tree_t));
 	list_destroy(&spa->spa_config_list);
 
 	nvlist_free(spa->spa_label_features);
@@ -718,13 +754,16 @@ spa_remove(spa_t *spa)
 
 	zio_checksum_templates_free(spa);
 
+	zil_flush_group_fini(spa);
+
+	vdev_trim_fini(spa);
+
 	cv_destroy(&spa->spa_async_cv);
 	cv_destroy(&spa->spa_evicting_os_cv);
 	cv_destroy(&spa->spa_proc_cv);
 	cv_destroy(&spa->spa_scrub_io_cv);
 	cv_destroy(&spa->spa_suspend_cv);
 
-	mutex_destroy(&spa->spa_alloc_lock);
 	mutex_destroy(&spa->spa_async_lock);
 	mutex_destroy(&spa->spa_errlist_lock);
 	mutex_destroy(&spa->spa_errlog_lock);
@@ -732,6 +771,7 @@ spa_remove(spa_t *spa)
 	mutex_destroy(&spa->spa_history_lock);
 	mutex_destroy(&spa->spa_proc_lock);
 	mutex_destroy(&spa->spa_props_lock);
+	mutex_destroy(&spa->spa_stats_cache_lock);
 	mutex_destroy(&spa->spa_cksum_tmpls_lock);
 	mutex_destroy(&spa->spa_scrub_lock);
 	mutex_destroy(&spa->spa_suspend_lock);
@@ -1102,6 +1142,7 @@ spa_vdev_config_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error, char *tag)
 	 */
 	ASSERT(metaslab_class_validate(spa_normal_class(spa)) == 0);
 	ASSERT(metaslab_class_validate(spa_log_class(spa)) == 0);
+	ASSERT(metaslab_class_validate(spa_special_class(spa)) == 0);
 
 	spa_config_exit(spa, SCL_ALL, spa);
 
@@ -1678,6 +1719,7 @@ void
 spa_update_dspace(spa_t *spa)
 {
 	spa->spa_dspace = metaslab_class_get_dspace(spa_normal_class(spa)) +
+	    metaslab_class_get_dspace(spa_special_class(spa)) +
 	    ddt_get_dedup_dspace(spa);
 }
 
@@ -1721,6 +1763,43 @@ spa_log_class(spa_t *spa)
 	return (spa->spa_log_class);
 }
 
+metaslab_class_t *
+spa_special_class(spa_t *spa)
+{
+	return (spa->spa_special_class);
+}
+
+/*
+ * Return the class a block should be allocated from first.  Metadata, which
+ * includes all indirect blocks, goes to the special class if the pool has
+ * one, as do blocks the caller asks to be kept there (special), and small
+ * level 0 blocks subject to zfs_special_small_blocks.  If the special class
+ * is full the allocation falls back to the normal class.
+ */
+metaslab_class_t *
+spa_preferred_class(spa_t *spa, uint64_t size, dmu_object_type_t objtype,
+    uint_t level, boolean_t special)
+{
+	metaslab_class_t *mc = spa_special_class(spa);
+	uint64_t limit;
+
+	if (mc->mc_groups == 0)
+		return (spa_normal_class(spa));
+
+	if (special || level > 0 || DMU_OT_IS_METADATA(objtype))
+		return (mc);
+
+	if (size <= zfs_special_small_blocks) {
+		limit = metaslab_class_get_space(mc) *
+		    (100 - MIN(zfs_special_class_metadata_reserve_pct, 100)) /
+		    100;
+		if (metaslab_class_get_alloc(mc) < limit)
+			return (mc);
+	}
+
+	return (spa_normal_class(spa));
+}
+
 void
 spa_evicting_os_register(spa_t *spa, objset_t *os)
 {
@@ -1883,7 +1962,7 @@ spa_init(int mode)
 	fm_init();
 	refcount_init();
 	unique_init();
-	range_tree_init();
+	zfs_btree_init();
 	metaslab_alloc_trace_init();
 	ddt_init();
 	zio_init();
@@ -1894,6 +1973,7 @@ spa_init(int mode)
 	vdev_file_init();
 #ifdef  _UZFS
 	vdev_disk_aio_init();
+	zvol_snap_list_cache_init();
 #endif
 	zfs_prop_init();
 	zpool_prop_init();
@@ -1906,11 +1986,13 @@ spa_init(int mode)
 void
 spa_fini(void)
 {
+	spa_config_sync_flush();
 	l2arc_stop();
 
 	spa_evict_all();
 
 #ifdef  _UZFS
+	zvol_snap_list_cache_fini();
 	vdev_disk_aio_fini();
 #endif
 	vdev_file_fini();
@@ -1921,7 +2003,7 @@ spa_fini(void)
 	zio_fini();
 	ddt_fini();
 	metaslab_alloc_trace_fini();
-	range_tree_fini();
+	zfs_btree_fini();
 	unique_fini();
 	refcount_fini();
 	fm_fini();
@@ -1945,7 +2027,7 @@ spa_fini(void)
 boolean_t
 spa_has_slogs(spa_t *spa)
 {
-	return (spa->spa_log_class->mc_rotor != NULL);
+	return (spa->spa_log_class->mc_allocator[0].mca_rotor != NULL);
 }
 
 spa_log_state_t
@@ -2156,6 +2238,8 @@ EXPORT_SYMBOL(spa_update_dspace);
 EXPORT_SYMBOL(spa_deflate);
 EXPORT_SYMBOL(spa_normal_class);
 EXPORT_SYMBOL(spa_log_class);
+EXPORT_SYMBOL(spa_special_class);
+EXPORT_SYMBOL(spa_preferred_class);
 EXPORT_SYMBOL(spa_max_replication);
 EXPORT_SYMBOL(spa_prev_software_version);
 EXPORT_SYMBOL(spa_get_failmode);
@@ -2215,5 +2299,16 @@ MODULE_PARM_DESC(spa_asize_inflation,
 
 module_param(spa_slop_shift, int, 0644);
 MODULE_PARM_DESC(spa_slop_shift, "Reserved free space in pool");
+
+module_param(spa_allocators, int, 0644);
+MODULE_PARM_DESC(spa_allocators, "Number of allocators per metaslab class");
+
+module_param(zfs_special_small_blocks, ulong, 0644);
+MODULE_PARM_DESC(zfs_special_small_blocks,
+	"Largest data block placed in the special allocation class");
+
+module_param(zfs_special_class_metadata_reserve_pct, int, 0644);
+MODULE_PARM_DESC(zfs_special_class_metadata_reserve_pct,
+	"Percent of the special class kept for metadata");
 /* END CSTYLED */
 #endif
@@ -22,6 +22,7 @@
 #include <sys/zfs_context.h>
 #include <sys/spa_impl.h>
 #include <sys/vdev_impl.h>
+#include <sys/zio_impl.h>
 
 /*
  * Keeps stats on last N reads per spa_t, disabled by default.
@@ -43,6 +44,11 @@ int zfs_txg_history = 0;
  */
 int zfs_multihost_history = 0;
 
+/*
+ * Keep histograms of the time zios spend in each pipeline stage.
+ */
+int zio_stage_histograms = 0;
+
 /*
  * ==========================================================================
  * SPA Read History Routines
@@ -253,6 +259,8 @@ typedef struct spa_txg_history {
 	uint64_t	writes;		/* number of write operations */
 	uint64_t	ndirty;		/* number of dirty bytes */
 	hrtime_t	times[TXG_STATE_COMMITTED]; /* completion times */
+	hrtime_t	phases[SPA_SYNC_PHASES]; /* time in each sync phase */
+	uint64_t	passes;		/* number of sync passes */
 	list_node_t	sth_link;
 } spa_txg_history_t;
 
@@ -260,9 +268,11 @@ static int
 spa_txg_history_headers(char *buf, size_t size)
 {
 	(void) snprintf(buf, size, "%-8s %-16s %-5s %-12s %-12s %-12s "
-	    "%-8s %-8s %-12s %-12s %-12s %-12s\n", "txg", "birth", "state",
+	    "%-8s %-8s %-12s %-12s %-12s %-12s %-6s %-12s %-12s %-12s "
+	    "%-12s %-12s %-12s %-12s %-12s\n", "txg", "birth", "state",
 	    "ndirty", "nread", "nwritten", "reads", "writes",
-	    "otime", "qtime", "wtime", "stime");
+	    "otime", "qtime", "wtime", "stime", "passes", "config",
+	    "datasets", "mos", "frees", "scan", "vdevs", "uberblock", "done");
 
 	return (0);
 }
@@ -301,13 +311,23 @@ spa_txg_history_data(char *buf, size_t size, void *data)
 		    sth->times[TXG_STATE_WAIT_FOR_SYNC];
 
 	(void) snprintf(buf, size, "%-8llu %-16llu %-5c %-12llu "
-	    "%-12llu %-12llu %-8llu %-8llu %-12llu %-12llu %-12llu %-12llu\n",
+	    "%-12llu %-12llu %-8llu %-8llu %-12llu %-12llu %-12llu %-12llu "
+	    "%-6llu %-12llu %-12llu %-12llu %-12llu %-12llu %-12llu %-12llu "
+	    "%-12llu\n",
 	    (longlong_t)sth->txg, sth->times[TXG_STATE_BIRTH], state,
 	    (u_longlong_t)sth->ndirty,
 	    (u_longlong_t)sth->nread, (u_longlong_t)sth->nwritten,
 	    (u_longlong_t)sth->reads, (u_longlong_t)sth->writes,
 	    (u_longlong_t)open, (u_longlong_t)quiesce, (u_longlong_t)wait,
-	    (u_longlong_t)sync);
+	    (u_longlong_t)sync, (u_longlong_t)sth->passes,
+	    (u_longlong_t)sth->phases[SPA_SYNC_CONFIG],
+	    (u_longlong_t)sth->phases[SPA_SYNC_DATASETS],
+	    (u_longlong_t)sth->phases[SPA_SYNC_MOS],
+	    (u_longlong_t)sth->phases[SPA_SYNC_FREES],
+	    (u_longlong_t)sth->phases[SPA_SYNC_SCAN],
+	    (u_longlong_t)sth->phases[SPA_SYNC_VDEVS],
+	    (u_longlong_t)sth->phases[SPA_SYNC_UBERBLOCK],
+	    (u_longlong_t)sth->phases[SPA_SYNC_DONE]);
 
 	return (0);
 }
@@ -500,6 +520,9 @@ spa_txg_history_set_io(spa_t *spa, uint64_t txg, uint64_t nread,
 			sth->reads = reads;
 			sth->writes = writes;
 			sth->ndirty = ndirty;
+			sth->passes = spa->spa_sync_passes;
+			bcopy(spa->spa_sync_phase_ns, sth->phases,
+			    sizeof (sth->phases));
 			error = 0;
 			break;
 		}
@@ -557,14 +580,33 @@ spa_txg_history_fini_io(spa_t *spa, txg_stat_t *ts)
 	kmem_free(ts, sizeof (txg_stat_t));
 }
 
+/*
+ * Charge the time since start to a phase of the txg being synced, and
+ * return the current time so that the next phase can start from it.  This
+ * is only called by the sync thread.
+ */
+hrtime_t
+spa_sync_phase_end(spa_t *spa, spa_sync_phase_t phase, hrtime_t start)
+{
+	hrtime_t now = gethrtime();
+
+	ASSERT3U(phase, <, SPA_SYNC_PHASES);
+	spa->spa_sync_phase_ns[phase] += now - start;
+
+	return (now);
+}
+
 /*
  * ==========================================================================
- * SPA TX Assign Histogram Routines
+ * SPA TX Assign and TXG Wait Histogram Routines
  * ==========================================================================
  */
 
 /*
- * Tx statistics - Information exported regarding dmu_tx_assign time.
+ * Tx statistics - Information exported regarding dmu_tx_assign time, and
+ * the time threads block in txg_wait_open() and txg_wait_synced().  The
+ * latter show how long writers stall at txg boundaries, e.g. while the
+ * quiescing txg waits for sync to catch up.
  */
 
 /*
@@ -573,10 +615,9 @@ spa_txg_history_fini_io(spa_t *spa, txg_stat_t *ts)
  * such that they are not output.
  */
 static int
-spa_tx_assign_update(kstat_t *ksp, int rw)
+spa_histogram_update(kstat_t *ksp, int rw)
 {
-	spa_t *spa = ksp->ks_private;
-	spa_stats_history_t *ssh = &spa->spa_stats.tx_assign_histogram;
+	spa_stats_history_t *ssh = ksp->ks_private;
 	int i;
 
 	if (rw == KSTAT_WRITE) {
@@ -595,9 +636,8 @@ spa_tx_assign_update(kstat_t *ksp, int rw)
 }
 
 static void
-spa_tx_assign_init(spa_t *spa)
+spa_histogram_init(spa_t *spa, spa_stats_history_t *ssh, const char *kname)
 {
-	spa_stats_history_t *ssh = &spa->spa_stats.tx_assign_histogram;
 	char name[KSTAT_STRLEN];
 	kstat_named_t *ks;
 	kstat_t *ksp;
@@ -619,7 +659,7 @@ spa_tx_assign_init(spa_t *spa)
 		    (u_longlong_t)1 << i);
 	}
 
-	ksp = kstat_create(name, 0, "dmu_tx_assign", "misc",
+	ksp = kstat_create(name, 0, kname, "misc",
 	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
 	ssh->kstat = ksp;
 
@@ -628,16 +668,15 @@ spa_tx_assign_init(spa_t *spa)
 		ksp->ks_data = ssh->priv;
 		ksp->ks_ndata = ssh->count;
 		ksp->ks_data_size = ssh->size;
-		ksp->ks_private = spa;
-		ksp->ks_update = spa_tx_assign_update;
+		ksp->ks_private = ssh;
+		ksp->ks_update = spa_histogram_update;
 		kstat_install(ksp);
 	}
 }
 
 static void
-spa_tx_assign_destroy(spa_t *spa)
+spa_histogram_destroy(spa_stats_history_t *ssh)
 {
-	spa_stats_history_t *ssh = &spa->spa_stats.tx_assign_histogram;
 	kstat_t *ksp;
 
 	ksp = ssh->kstat;
@@ -648,18 +687,80 @@ spa_tx_assign_destroy(spa_t *spa)
 	mutex_destroy(&ssh->lock);
 }
 
-void
-spa_tx_assign_add_nsecs(spa_t *spa, uint64_t nsecs)
+static void
+spa_histogram_add_nsecs(spa_stats_history_t *ssh, uint64_t nsecs)
 {
-	spa_stats_history_t *ssh = &spa->spa_stats.tx_assign_histogram;
 	uint64_t idx = 0;
 
-	while (((1ULL << idx) < nsecs) && (idx < ssh->size - 1))
+	while (((1ULL << idx) < nsecs) && (idx < ssh->count - 1))
 		idx++;
 
 	atomic_inc_64(&((kstat_named_t *)ssh->priv)[idx].value.ui64);
 }
 
+static void
+spa_tx_assign_init(spa_t *spa)
+{
+	spa_histogram_init(spa, &spa->spa_stats.tx_assign_histogram,
+	    "dmu_tx_assign");
+	spa_histogram_init(spa, &spa->spa_stats.txg_wait_open_histogram,
+	    "txg_wait_open");
+	spa_histogram_init(spa, &spa->spa_stats.txg_wait_synced_histogram,
+	    "txg_wait_synced");
+}
+
+static void
+spa_tx_assign_destroy(spa_t *spa)
+{
+	spa_histogram_destroy(&spa->spa_stats.txg_wait_synced_histogram);
+	spa_histogram_destroy(&spa->spa_stats.txg_wait_open_histogram);
+	spa_histogram_destroy(&spa->spa_stats.tx_assign_histogram);
+}
+
+void
+spa_tx_assign_add_nsecs(spa_t *spa, uint64_t nsecs)
+{
+	spa_histogram_add_nsecs(&spa->spa_stats.tx_assign_histogram, nsecs);
+}
+
+void
+spa_txg_wait_open_add_nsecs(spa_t *spa, uint64_t nsecs)
+{
+	spa_histogram_add_nsecs(&spa->spa_stats.txg_wait_open_histogram,
+	    nsecs);
+}
+
+void
+spa_txg_wait_synced_add_nsecs(spa_t *spa, uint64_t nsecs)
+{
+	spa_histogram_add_nsecs(&spa->spa_stats.txg_wait_synced_histogram,
+	    nsecs);
+}
+
+/*
+ * Config sync histogram - the time vdev_config_sync() takes to write the
+ * labels and uberblocks of a txg, including the cache flushes between its
+ * phases.  Txgs which write nothing are not counted.
+ */
+static void
+spa_config_sync_init(spa_t *spa)
+{
+	spa_histogram_init(spa, &spa->spa_stats.config_sync_histogram,
+	    "config_sync");
+}
+
+static void
+spa_config_sync_destroy(spa_t *spa)
+{
+	spa_histogram_destroy(&spa->spa_stats.config_sync_histogram);
+}
+
+void
+spa_config_sync_add_nsecs(spa_t *spa, uint64_t nsecs)
+{
+	spa_histogram_add_nsecs(&spa->spa_stats.config_sync_histogram, nsecs);
+}
+
 /*
  * ==========================================================================
  * SPA IO History Routines
@@ -992,24 +1093,443 @@ spa_mmp_history_add(spa_t *spa, uint64_t txg, uint64_t timestamp,
 	return ((void *)smh);
 }
 
+/*
+ * ==========================================================================
+ * SPA zio Pipeline Stage Histogram Routines
+ * ==========================================================================
+ */
+
+/*
+ * With zio_stage_histograms set, zio_execute() records two latencies for
+ * every pipeline stage: the time spent running the stage function (exec),
+ * and the time from the start of the stage to the start of the next one
+ * (elapsed).  The latter includes the taskq or device queueing the stage
+ * hands the zio to, so comparing the two shows whether CPU work such as
+ * compression and checksums or waiting dominates.
+ */
+typedef enum spa_zio_stage_kind {
+	ZSH_EXEC,
+	ZSH_ELAPSED,
+	ZSH_KINDS
+} spa_zio_stage_kind_t;
+
+static const char *spa_zio_stage_names[ZIO_STAGES] = {
+	"open", "read_bp_init", "write_bp_init", "free_bp_init",
+	"issue_async", "write_compress", "checksum_generate", "nop_write",
+	"ddt_read_start", "ddt_read_done", "ddt_write", "ddt_free",
+	"gang_assemble", "gang_issue", "dva_throttle", "dva_allocate",
+	"dva_free", "dva_claim", "ready", "vdev_io_start", "vdev_io_done",
+	"vdev_io_assess", "checksum_verify", "done"
+};
+
+static const char *spa_zio_stage_kind_names[ZSH_KINDS] = {
+	"exec", "elapsed"
+};
+
+/*
+ * Return upper bound in ns of the bucket in which the given percentile
+ * (in tenths of a percent) of the samples falls.
+ */
+uint64_t
+zfs_lat_histogram_percentile(const uint64_t *buckets, uint64_t count,
+    uint64_t permille)
+{
+	uint64_t target, sum = 0;
+	int i;
+
+	target = (count * permille + 999) / 1000;
+	for (i = 0; i < VDEV_L_HISTO_BUCKETS; i++) {
+		sum += buckets[i];
+		if (sum >= target)
+			break;
+	}
+	if (i == VDEV_L_HISTO_BUCKETS)
+		i--;
+	return (1ULL << (i + 1));
+}
+
+/*
+ * Add an nvlist with the count, percentiles and buckets of the histogram
+ * under name, unless it is empty.  The histogram is read without a lock,
+ * so the percentiles are approximate while IOs are running.
+ */
+void
+zfs_lat_histogram_to_nvl(nvlist_t *nvl, const char *name,
+    const zfs_lat_histogram_t *zlh)
+{
+	uint64_t buckets[VDEV_L_HISTO_BUCKETS];
+	uint64_t count = 0;
+	nvlist_t *snvl;
+	int i;
+
+	for (i = 0; i < VDEV_L_HISTO_BUCKETS; i++) {
+		buckets[i] = zlh->zlh_buckets[i];
+		count += buckets[i];
+	}
+	if (count == 0)
+		return;
+
+	snvl = fnvlist_alloc();
+	fnvlist_add_uint64(snvl, "count", count);
+	fnvlist_add_uint64(snvl, "p50",
+	    zfs_lat_histogram_percentile(buckets, count, 500));
+	fnvlist_add_uint64(snvl, "p90",
+	    zfs_lat_histogram_percentile(buckets, count, 900));
+	fnvlist_add_uint64(snvl, "p99",
+	    zfs_lat_histogram_percentile(buckets, count, 990));
+	fnvlist_add_uint64(snvl, "p999",
+	    zfs_lat_histogram_percentile(buckets, count, 999));
+	fnvlist_add_uint64_array(snvl, "histogram", buckets,
+	    VDEV_L_HISTO_BUCKETS);
+	fnvlist_add_nvlist(nvl, name, snvl);
+	fnvlist_free(snvl);
+}
+
+static const char *zfs_size_lat_op_names[ZFS_SIZE_LAT_OPS] = {
+	"read", "write"
+};
+
+/*
+ * Add an nvlist under name with, for reads and writes, the latency
+ * histogram of each IO size bucket that has seen IOs, keyed by the lower
+ * bound of the bucket.  The shards are summed into each histogram.
+ */
+void
+zfs_size_lat_histogram_to_nvl(nvlist_t *nvl, const char *name,
+    const zfs_size_lat_histogram_t *shards)
+{
+	zfs_lat_histogram_t zlh;
+	nvlist_t *snvl, *onvl;
+	char key[32];
+	int op, size, shard, i;
+
+	snvl = fnvlist_alloc();
+	for (op = 0; op < ZFS_SIZE_LAT_OPS; op++) {
+		onvl = fnvlist_alloc();
+		for (size = 0; size < ZFS_SIZE_HISTO_BUCKETS; size++) {
+			bzero(&zlh, sizeof (zlh));
+			for (shard = 0; shard < ZFS_SIZE_LAT_SHARDS; shard++) {
+				for (i = 0; i < VDEV_L_HISTO_BUCKETS; i++) {
+					zlh.zlh_buckets[i] += shards[shard].
+					    zslh_buckets[op][size][i];
+				}
+			}
+			(void) snprintf(key, sizeof (key), "%lluB",
+			    1ULL << (size + ZFS_SIZE_HISTO_SHIFT));
+			zfs_lat_histogram_to_nvl(onvl, key, &zlh);
+		}
+		if (!nvlist_empty(onvl))
+			fnvlist_add_nvlist(snvl, zfs_size_lat_op_names[op],
+			    onvl);
+		fnvlist_free(onvl);
+	}
+	fnvlist_add_nvlist(nvl, name, snvl);
+	fnvlist_free(snvl);
+}
+
+typedef struct spa_zio_stage_histogram {
+	const char		*zsh_name;
+	zfs_lat_histogram_t	zsh_lat[ZSH_KINDS];
+} spa_zio_stage_histogram_t;
+
+static uint64_t
+spa_zio_stage_percentile(const zfs_lat_histogram_t *zlh, uint64_t permille)
+{
+	uint64_t count = 0;
+	int i;
+
+	for (i = 0; i < VDEV_L_HISTO_BUCKETS; i++)
+		count += zlh->zlh_buckets[i];
+	if (count == 0)
+		return (0);
+
+	return (zfs_lat_histogram_percentile(zlh->zlh_buckets, count,
+	    permille));
+}
+
+static int
+spa_zio_stage_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-18s %-12s %-12s %-12s %-12s %-12s "
+	    "%-12s\n", "stage", "count", "exec_p50", "exec_p99",
+	    "elapsed_p50", "elapsed_p99", "elapsed_p999");
+
+	return (0);
+}
+
+static int
+spa_zio_stage_data(char *buf, size_t size, void *data)
+{
+	spa_zio_stage_histogram_t *zsh = data;
+	zfs_lat_histogram_t *exec = &zsh->zsh_lat[ZSH_EXEC];
+	zfs_lat_histogram_t *elapsed = &zsh->zsh_lat[ZSH_ELAPSED];
+	uint64_t count = 0;
+	int i;
+
+	for (i = 0; i < VDEV_L_HISTO_BUCKETS; i++)
+		count += exec->zlh_buckets[i];
+
+	(void) snprintf(buf, size, "%-18s %-12llu %-12llu %-12llu %-12llu "
+	    "%-12llu %-12llu\n", zsh->zsh_name, (u_longlong_t)count,
+	    (u_longlong_t)spa_zio_stage_percentile(exec, 500),
+	    (u_longlong_t)spa_zio_stage_percentile(exec, 990),
+	    (u_longlong_t)spa_zio_stage_percentile(elapsed, 500),
+	    (u_longlong_t)spa_zio_stage_percentile(elapsed, 990),
+	    (u_longlong_t)spa_zio_stage_percentile(elapsed, 999));
+
+	return (0);
+}
+
+static void *
+spa_zio_stage_addr(kstat_t *ksp, loff_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stage_histogram;
+
+	if (n >= ssh->count)
+		return (NULL);
+
+	return (&((spa_zio_stage_histogram_t *)ssh->priv)[n]);
+}
+
+/*
+ * When the kstat is written zero all histograms.
+ */
+static int
+spa_zio_stage_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stage_histogram;
+	spa_zio_stage_histogram_t *zsh = ssh->priv;
+	int i;
+
+	if (rw == KSTAT_WRITE) {
+		for (i = 0; i < ssh->count; i++)
+			bzero(zsh[i].zsh_lat, sizeof (zsh[i].zsh_lat));
+	}
+
+	return (0);
+}
+
+static void
+spa_zio_stage_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stage_histogram;
+	spa_zio_stage_histogram_t *zsh;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+	int i;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = ZIO_STAGES;
+	ssh->size = ssh->count * sizeof (spa_zio_stage_histogram_t);
+	ssh->priv = zsh = kmem_zalloc(ssh->size, KM_SLEEP);
+	for (i = 0; i < ssh->count; i++)
+		zsh[i].zsh_name = spa_zio_stage_names[i];
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "zio_stages", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_zio_stage_update;
+		kstat_set_raw_ops(ksp, spa_zio_stage_headers,
+		    spa_zio_stage_data, spa_zio_stage_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_zio_stage_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stage_histogram;
+	kstat_t *ksp;
+
+	ksp = ssh->kstat;
+	if (ksp)
+		kstat_delete(ksp);
+
+	kmem_free(ssh->priv, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+static void
+spa_zio_stage_record(spa_t *spa, int stage, spa_zio_stage_kind_t kind,
+    hrtime_t ns)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stage_histogram;
+	spa_zio_stage_histogram_t *zsh = ssh->priv;
+	int idx = highbit64(stage) - 1;
+
+	ASSERT3S(idx, >=, 0);
+	ASSERT3S(idx, <, ZIO_STAGES);
+
+	atomic_inc_64(&zsh[idx].zsh_lat[kind].zlh_buckets[L_HISTO(ns)]);
+}
+
+/*
+ * Record the time spent running the stage function of stage, which is a
+ * zio_stage bit.
+ */
+void
+spa_zio_stage_exec(spa_t *spa, int stage, hrtime_t ns)
+{
+	spa_zio_stage_record(spa, stage, ZSH_EXEC, ns);
+}
+
+/*
+ * Record the time from the start of stage to the start of the next stage
+ * of the same zio.
+ */
+void
+spa_zio_stage_elapsed(spa_t *spa, int stage, hrtime_t ns)
+{
+	spa_zio_stage_record(spa, stage, ZSH_ELAPSED, ns);
+}
+
+/*
+ * Add an nvlist with the exec and elapsed histograms of all stages which
+ * have seen zios.
+ */
+void
+spa_zio_stage_histogram_to_nvl(spa_t *spa, nvlist_t *nvl)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stage_histogram;
+	spa_zio_stage_histogram_t *zsh = ssh->priv;
+	nvlist_t *snvl, *knvl;
+	int i, kind;
+
+	snvl = fnvlist_alloc();
+	for (i = 0; i < ssh->count; i++) {
+		knvl = fnvlist_alloc();
+		for (kind = 0; kind < ZSH_KINDS; kind++) {
+			zfs_lat_histogram_to_nvl(knvl,
+			    spa_zio_stage_kind_names[kind],
+			    &zsh[i].zsh_lat[kind]);
+		}
+		if (!nvlist_empty(knvl))
+			fnvlist_add_nvlist(snvl, zsh[i].zsh_name, knvl);
+		fnvlist_free(knvl);
+	}
+	fnvlist_add_nvlist(nvl, "zioStages", snvl);
+	fnvlist_free(snvl);
+}
+
+/*
+ * ==========================================================================
+ * SPA Load Progress Routines
+ * ==========================================================================
+ */
+static const char *spa_load_stat_names[SPA_LOAD_STATS] = {
+	"metaslabs",
+	"metaslabs_loaded",
+	"metaslab_load_ns",
+};
+
+static void
+spa_load_stats_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.load_stats;
+	char name[KSTAT_STRLEN];
+	kstat_named_t *ks;
+	kstat_t *ksp;
+	int i;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = SPA_LOAD_STATS;
+	ssh->size = ssh->count * sizeof (kstat_named_t);
+	ssh->priv = kmem_alloc(ssh->size, KM_SLEEP);
+
+	for (i = 0; i < ssh->count; i++) {
+		ks = &((kstat_named_t *)ssh->priv)[i];
+		ks->data_type = KSTAT_DATA_UINT64;
+		ks->value.ui64 = 0;
+		(void) strlcpy(ks->name, spa_load_stat_names[i],
+		    KSTAT_STRLEN);
+	}
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "load", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->priv;
+		ksp->ks_ndata = ssh->count;
+		ksp->ks_data_size = ssh->size;
+		ksp->ks_private = spa;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_load_stats_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.load_stats;
+	kstat_t *ksp;
+
+	ksp = ssh->kstat;
+	if (ksp)
+		kstat_delete(ksp);
+
+	kmem_free(ssh->priv, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+void
+spa_load_stat_set(spa_t *spa, spa_load_stat_t stat, uint64_t value)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.load_stats;
+
+	ASSERT3S(stat, <, SPA_LOAD_STATS);
+	(void) atomic_swap_64(&((kstat_named_t *)ssh->priv)[stat].value.ui64,
+	    value);
+}
+
+void
+spa_load_stat_add(spa_t *spa, spa_load_stat_t stat, uint64_t delta)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.load_stats;
+
+	ASSERT3S(stat, <, SPA_LOAD_STATS);
+	atomic_add_64(&((kstat_named_t *)ssh->priv)[stat].value.ui64, delta);
+}
+
 void
 spa_stats_init(spa_t *spa)
 {
 	spa_read_history_init(spa);
 	spa_txg_history_init(spa);
 	spa_tx_assign_init(spa);
+	spa_config_sync_init(spa);
 	spa_io_history_init(spa);
 	spa_mmp_history_init(spa);
+	spa_zio_stage_init(spa);
+	spa_load_stats_init(spa);
 }
 
 void
 spa_stats_destroy(spa_t *spa)
 {
+	spa_config_sync_destroy(spa);
 	spa_tx_assign_destroy(spa);
 	spa_txg_history_destroy(spa);
 	spa_read_history_destroy(spa);
 	spa_io_history_destroy(spa);
 	spa_mmp_history_destroy(spa);
+	spa_zio_stage_destroy(spa);
+	spa_load_stats_destroy(spa);
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
@@ -1029,5 +1549,9 @@ MODULE_PARM_DESC(zfs_txg_history,
 module_param(zfs_multihost_history, int, 0644);
 MODULE_PARM_DESC(zfs_multihost_history,
 	"Historical statistics for last N multihost writes");
+
+module_param(zio_stage_histograms, int, 0644);
+MODULE_PARM_DESC(zio_stage_histograms,
+	"Keep histograms of the time zios spend in each pipeline stage");
 /* END CSTYLED */
 #endif
@@ -46,89 +46,149 @@
 int space_map_blksz = (1 << 12);
 
 /*
- * Load the space map disk into the specified range tree. Segments of maptype
- * are added to the range tree, other segment types are removed.
+ * Call the callback on each allocation and free recorded in the space map,
+ * in order. Entries are decoded straight out of the space map's dbufs, one
+ * block at a time, with the rest of the object being prefetched.
  *
- * Note: space_map_load() will drop sm_lock across dmu_read() calls.
+ * Note: space_map_iterate() will drop sm_lock across dmu_buf_hold() calls.
  * The caller must be OK with this.
  */
 int
-space_map_load(space_map_t *sm, range_tree_t *rt, maptype_t maptype)
+space_map_iterate(space_map_t *sm, sm_cb_t callback, void *arg)
 {
-	uint64_t *entry, *entry_map, *entry_map_end;
-	uint64_t bufsize, size, offset, end, space;
+	uint64_t end = space_map_length(sm);
+	uint64_t blksz = sm->sm_blksz;
+	uint64_t block_base;
 	int error = 0;
 
 	ASSERT(MUTEX_HELD(sm->sm_lock));
-
-	end = space_map_length(sm);
-	space = space_map_allocated(sm);
-
-	VERIFY0(range_tree_space(rt));
-
-	if (maptype == SM_FREE) {
-		range_tree_add(rt, sm->sm_start, sm->sm_size);
-		space = sm->sm_size - space;
-	}
-
-	bufsize = MAX(sm->sm_blksz, SPA_MINBLOCKSIZE);
-	entry_map = vmem_alloc(bufsize, KM_SLEEP);
+	ASSERT3U(blksz, !=, 0);
+	VERIFY0(P2PHASE(end, sizeof (uint64_t)));
 
 	mutex_exit(sm->sm_lock);
-	if (end > bufsize) {
-		dmu_prefetch(sm->sm_os, space_map_object(sm), 0, bufsize,
-		    end - bufsize, ZIO_PRIORITY_SYNC_READ);
+	if (end > blksz) {
+		dmu_prefetch(sm->sm_os, space_map_object(sm), 0, blksz,
+		    end - blksz, ZIO_PRIORITY_SYNC_READ);
 	}
 	mutex_enter(sm->sm_lock);
 
-	for (offset = 0; offset < end; offset += bufsize) {
-		size = MIN(end - offset, bufsize);
-		VERIFY(P2PHASE(size, sizeof (uint64_t)) == 0);
-		VERIFY(size != 0);
-		ASSERT3U(sm->sm_blksz, !=, 0);
+	for (block_base = 0; block_base < end && error == 0;
+	    block_base += blksz) {
+		uint64_t *entry, *block_end;
+		dmu_buf_t *db;
 
 		dprintf("object=%llu  offset=%llx  size=%llx\n",
-		    space_map_object(sm), offset, size);
+		    space_map_object(sm), block_base, blksz);
 
 		mutex_exit(sm->sm_lock);
-		error = dmu_read(sm->sm_os, space_map_object(sm), offset, size,
-		    entry_map, DMU_READ_PREFETCH);
+		error = dmu_buf_hold(sm->sm_os, space_map_object(sm),
+		    block_base, FTAG, &db, DMU_READ_PREFETCH);
 		mutex_enter(sm->sm_lock);
 		if (error != 0)
 			break;
 
-		entry_map_end = entry_map + (size / sizeof (uint64_t));
-		for (entry = entry_map; entry < entry_map_end; entry++) {
+		ASSERT3U(db->db_size, ==, blksz);
+		entry = db->db_data;
+		block_end = entry + MIN(end - block_base, blksz) /
+		    sizeof (uint64_t);
+
+		for (; entry < block_end && error == 0; entry++) {
 			uint64_t e = *entry;
-			uint64_t offset, size;
+			space_map_entry_t sme;
 
-			if (SM_DEBUG_DECODE(e))		/* Skip debug entries */
+			if (SM_ENTRY_IS_DEBUG(e))	/* Skip debug entries */
 				continue;
 
-			offset = (SM_OFFSET_DECODE(e) << sm->sm_shift) +
-			    sm->sm_start;
-			size = SM_RUN_DECODE(e) << sm->sm_shift;
-
-			VERIFY0(P2PHASE(offset, 1ULL << sm->sm_shift));
-			VERIFY0(P2PHASE(size, 1ULL << sm->sm_shift));
-			VERIFY3U(offset, >=, sm->sm_start);
-			VERIFY3U(offset + size, <=, sm->sm_start + sm->sm_size);
-			if (SM_TYPE_DECODE(e) == maptype) {
-				VERIFY3U(range_tree_space(rt) + size, <=,
-				    sm->sm_size);
-				range_tree_add(rt, offset, size);
+			if (SM_ENTRY_IS_DOUBLE(e)) {
+				uint64_t e2;
+
+				/* Two-word entries never straddle a block */
+				VERIFY3P(entry + 1, <, block_end);
+				e2 = *++entry;
+				sme.sme_type = SM2_TYPE_DECODE(e2);
+				sme.sme_vdev = SM2_VDEV_DECODE(e);
+				sme.sme_offset = SM2_OFFSET_DECODE(e2);
+				sme.sme_run = SM2_RUN_DECODE(e);
 			} else {
-				range_tree_remove(rt, offset, size);
+				sme.sme_type = SM_TYPE_DECODE(e);
+				sme.sme_vdev = 0;
+				sme.sme_offset = SM_OFFSET_DECODE(e);
+				sme.sme_run = SM_RUN_DECODE(e);
 			}
+			sme.sme_offset = (sme.sme_offset << sm->sm_shift) +
+			    sm->sm_start;
+			sme.sme_run <<= sm->sm_shift;
+
+			VERIFY0(P2PHASE(sme.sme_offset, 1ULL << sm->sm_shift));
+			VERIFY3U(sme.sme_offset, >=, sm->sm_start);
+			VERIFY3U(sme.sme_offset + sme.sme_run, <=,
+			    sm->sm_start + sm->sm_size);
+
+			error = callback(&sme, arg);
 		}
+		dmu_buf_rele(db, FTAG);
 	}
 
+	return (error);
+}
+
+typedef struct space_map_load_arg {
+	space_map_t	*smla_sm;
+	range_tree_t	*smla_rt;
+	maptype_t	smla_type;
+} space_map_load_arg_t;
+
+static int
+space_map_load_callback(space_map_entry_t *sme, void *arg)
+{
+	space_map_load_arg_t *smla = arg;
+	range_tree_t *rt = smla->smla_rt;
+
+	if (sme->sme_type == smla->smla_type) {
+		VERIFY3U(range_tree_space(rt) + sme->sme_run, <=,
+		    smla->smla_sm->sm_size);
+		range_tree_add(rt, sme->sme_offset, sme->sme_run);
+	} else {
+		range_tree_remove(rt, sme->sme_offset, sme->sme_run);
+	}
+	return (0);
+}
+
+/*
+ * Load the space map disk into the specified range tree. Segments of maptype
+ * are added to the range tree, other segment types are removed.
+ *
+ * Note: space_map_load() will drop sm_lock across dmu_buf_hold() calls.
+ * The caller must be OK with this.
+ */
+int
+space_map_load(space_map_t *sm, range_tree_t *rt, maptype_t maptype)
+{
+	space_map_load_arg_t smla;
+	uint64_t space;
+	int error;
+
+	ASSERT(MUTEX_HELD(sm->sm_lock));
+
+	space = space_map_allocated(sm);
+
+	VERIFY0(range_tree_space(rt));
+
+	if (maptype == SM_FREE) {
+		range_tree_add(rt, sm->sm_start, sm->sm_size);
+		space = sm->sm_size - space;
+	}
+
+	smla.smla_sm = sm;
+	smla.smla_rt = rt;
+	smla.smla_type = maptype;
+	error = space_map_iterate(sm, space_map_load_callback, &smla);
+
 	if (error == 0)
 		VERIFY3U(range_tree_space(rt), ==, space);
 	else
 		range_tree_vacate(rt, NULL, NULL);
 
-	vmem_free(entry_map, bufsize);
 	return (error);
 }
 
@@ -209,12 +269,54 @@ space_map_histogram_add(space_map_t *sm, range_tree_t *rt, dmu_tx_t *tx)
 	}
 }
 
+/*
+ * Returns the number of entries needed to record a segment of the given
+ * size in sm_shift units, and in *words how many words they take up.
+ */
+static uint64_t
+space_map_seg_entries(boolean_t v2, uint64_t size, uint64_t *words)
+{
+	uint64_t entries;
+
+	if (v2 && size > SM_RUN_MAX) {
+		entries = howmany(size, SM2_RUN_MAX);
+		*words = 2 * entries;
+	} else {
+		entries = howmany(size, SM_RUN_MAX);
+		*words = entries;
+	}
+	return (entries);
+}
+
+static boolean_t
+space_map_v2(space_map_t *sm)
+{
+	return (spa_feature_is_active(dmu_objset_spa(sm->sm_os),
+	    SPA_FEATURE_SPACEMAP_V2));
+}
+
+/*
+ * Returns the on-disk size of the entries for a segment of the given size
+ * in bytes, not counting any padding.
+ */
+uint64_t
+space_map_segment_size(space_map_t *sm, uint64_t size)
+{
+	uint64_t words;
+
+	(void) space_map_seg_entries(space_map_v2(sm), size >> sm->sm_shift,
+	    &words);
+	return (words * sizeof (uint64_t));
+}
+
 uint64_t
 space_map_entries(space_map_t *sm, range_tree_t *rt)
 {
-	avl_tree_t *t = &rt->rt_root;
+	zfs_btree_t *t = &rt->rt_root;
+	zfs_btree_index_t where;
 	range_seg_t *rs;
-	uint64_t size, entries;
+	uint64_t size, entries, words;
+	boolean_t v2 = space_map_v2(sm);
 
 	/*
 	 * All space_maps always have a debug entry so account for it here.
@@ -225,9 +327,10 @@ space_map_entries(space_map_t *sm, range_tree_t *rt)
 	 * Traverse the range tree and calculate the number of space map
 	 * entries that would be required to write out the range tree.
 	 */
-	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs)) {
+	for (rs = zfs_btree_first(t, &where); rs != NULL;
+	    rs = zfs_btree_next(t, &where, &where)) {
 		size = (rs->rs_end - rs->rs_start) >> sm->sm_shift;
-		entries += howmany(size, SM_RUN_MAX);
+		entries += space_map_seg_entries(v2, size, &words);
 	}
 	return (entries);
 }
@@ -241,11 +344,13 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 {
 	objset_t *os = sm->sm_os;
 	spa_t *spa = dmu_objset_spa(os);
-	avl_tree_t *t = &rt->rt_root;
+	zfs_btree_t *t = &rt->rt_root;
+	zfs_btree_index_t where;
 	range_seg_t *rs;
-	uint64_t size, total, rt_space, nodes;
+	uint64_t size, total, rt_space, nodes, len;
 	uint64_t *entry, *entry_map, *entry_map_end;
 	uint64_t expected_entries, actual_entries = 1;
+	boolean_t v2 = space_map_v2(sm);
 
 	ASSERT(MUTEX_HELD(rt->rt_lock));
 	ASSERT(dsl_pool_sync_context(dmu_objset_pool(os)));
@@ -271,8 +376,14 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 
 	expected_entries = space_map_entries(sm, rt);
 
+	/*
+	 * Each buffer written out ends on a block boundary of the object,
+	 * so that two-word entries can be kept from straddling one.
+	 */
 	entry_map = vmem_alloc(sm->sm_blksz, KM_SLEEP);
-	entry_map_end = entry_map + (sm->sm_blksz / sizeof (uint64_t));
+	entry_map_end = entry_map + (sm->sm_blksz -
+	    P2PHASE(sm->sm_phys->smp_objsize, sm->sm_blksz)) /
+	    sizeof (uint64_t);
 	entry = entry_map;
 
 	*entry++ = SM_DEBUG_ENCODE(1) |
@@ -281,9 +392,10 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 	    SM_DEBUG_TXG_ENCODE(dmu_tx_get_txg(tx));
 
 	total = 0;
-	nodes = avl_numnodes(&rt->rt_root);
+	nodes = zfs_btree_numnodes(t);
 	rt_space = range_tree_space(rt);
-	for (rs = avl_first(t); rs != NULL; rs = AVL_NEXT(t, rs)) {
+	for (rs = zfs_btree_first(t, &where); rs != NULL;
+	    rs = zfs_btree_next(t, &where, &where)) {
 		uint64_t start;
 
 		size = (rs->rs_end - rs->rs_start) >> sm->sm_shift;
@@ -293,22 +405,44 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 
 		while (size != 0) {
 			uint64_t run_len;
+			int words;
 
-			run_len = MIN(size, SM_RUN_MAX);
+			if (v2 && size > SM_RUN_MAX) {
+				run_len = MIN(size, SM2_RUN_MAX);
+				words = 2;
+			} else {
+				run_len = MIN(size, SM_RUN_MAX);
+				words = 1;
+			}
+
+			if (entry_map_end - entry < words) {
+				/* Pad out the block with a debug entry */
+				if (entry != entry_map_end)
+					*entry++ = SM_DEBUG_ENCODE(1);
 
-			if (entry == entry_map_end) {
+				len = (entry - entry_map) * sizeof (uint64_t);
 				mutex_exit(rt->rt_lock);
 				dmu_write(os, space_map_object(sm),
-				    sm->sm_phys->smp_objsize, sm->sm_blksz,
+				    sm->sm_phys->smp_objsize, len,
 				    entry_map, tx);
 				mutex_enter(rt->rt_lock);
-				sm->sm_phys->smp_objsize += sm->sm_blksz;
+				sm->sm_phys->smp_objsize += len;
 				entry = entry_map;
+				entry_map_end = entry_map +
+				    (sm->sm_blksz / sizeof (uint64_t));
 			}
 
-			*entry++ = SM_OFFSET_ENCODE(start) |
-			    SM_TYPE_ENCODE(maptype) |
-			    SM_RUN_ENCODE(run_len);
+			if (words == 2) {
+				*entry++ = SM_PREFIX_ENCODE(SM2_PREFIX) |
+				    SM2_RUN_ENCODE(run_len) |
+				    SM2_VDEV_ENCODE(0);
+				*entry++ = SM2_TYPE_ENCODE(maptype) |
+				    SM2_OFFSET_ENCODE(start);
+			} else {
+				*entry++ = SM_OFFSET_ENCODE(start) |
+				    SM_TYPE_ENCODE(maptype) |
+				    SM_RUN_ENCODE(run_len);
+			}
 
 			start += run_len;
 			size -= run_len;
@@ -317,12 +451,12 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 	}
 
 	if (entry != entry_map) {
-		size = (entry - entry_map) * sizeof (uint64_t);
+		len = (entry - entry_map) * sizeof (uint64_t);
 		mutex_exit(rt->rt_lock);
 		dmu_write(os, space_map_object(sm), sm->sm_phys->smp_objsize,
-		    size, entry_map, tx);
+		    len, entry_map, tx);
 		mutex_enter(rt->rt_lock);
-		sm->sm_phys->smp_objsize += size;
+		sm->sm_phys->smp_objsize += len;
 	}
 	ASSERT3U(expected_entries, ==, actual_entries);
 
@@ -330,7 +464,7 @@ space_map_write(space_map_t *sm, range_tree_t *rt, maptype_t maptype,
 	 * Ensure that the space_map's accounting wasn't changed
 	 * while we were in the middle of writing it out.
 	 */
-	VERIFY3U(nodes, ==, avl_numnodes(&rt->rt_root));
+	VERIFY3U(nodes, ==, zfs_btree_numnodes(t));
 	VERIFY3U(range_tree_space(rt), ==, rt_space);
 	VERIFY3U(range_tree_space(rt), ==, total);
 
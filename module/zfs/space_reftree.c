@@ -109,11 +109,13 @@ space_reftree_add_seg(avl_tree_t *t, uint64_t start, uint64_t end,
 void
 space_reftree_add_map(avl_tree_t *t, range_tree_t *rt, int64_t refcnt)
 {
+	zfs_btree_index_t where;
 	range_seg_t *rs;
 
 	ASSERT(MUTEX_HELD(rt->rt_lock));
 
-	for (rs = avl_first(&rt->rt_root); rs; rs = AVL_NEXT(&rt->rt_root, rs))
+	for (rs = zfs_btree_first(&rt->rt_root, &where); rs != NULL;
+	    rs = zfs_btree_next(&rt->rt_root, &where, &where))
 		space_reftree_add_seg(t, rs->rs_start, rs->rs_end, refcnt);
 }
 
@@ -113,6 +113,17 @@ static void txg_sync_thread(dsl_pool_t *dp);
 static void txg_quiesce_thread(dsl_pool_t *dp);
 
 int zfs_txg_timeout = 5;	/* max seconds worth of delta per txg */
+
+/*
+ * Target duration of a txg sync, in milliseconds.  The sync thread keeps
+ * track of how fast txgs are written out, and pushes a txg out once as
+ * much dirty data has accumulated as can be synced in about this time,
+ * rather than at a fixed zfs_dirty_data_sync.  The threshold stays between
+ * a quarter of zfs_dirty_data_sync, below which the fixed cost of a sync
+ * dominates, and the amount of dirty data at which writes start being
+ * delayed.  0 goes back to zfs_dirty_data_sync.
+ */
+int zfs_txg_sync_target_ms = 1000;
 /* max thresholds are in seconds */
 volatile int sync_threshold = 15;
 volatile int quiesce_threshold = 15;
@@ -193,6 +204,48 @@ txg_fini(dsl_pool_t *dp)
 	bzero(tx, sizeof (tx_state_t));
 }
 
+/*
+ * The amount of dirty data at which a txg is pushed out.
+ */
+uint64_t
+txg_dirty_sync_threshold(dsl_pool_t *dp)
+{
+	uint64_t threshold = dp->dp_tx.tx_dirty_sync;
+
+	if (zfs_txg_sync_target_ms <= 0 || threshold == 0)
+		return (zfs_dirty_data_sync);
+	return (threshold);
+}
+
+/*
+ * Fold the sync of dirty bytes in sync_time into the estimate of the write
+ * bandwidth of the pool, and scale the sync threshold to the amount of
+ * data that bandwidth writes in zfs_txg_sync_target_ms.  A txg smaller
+ * than the lower bound says more about the fixed cost of a sync than about
+ * the bandwidth, and is left out.
+ */
+static void
+txg_sync_adapt(dsl_pool_t *dp, uint64_t dirty, hrtime_t sync_time)
+{
+	tx_state_t *tx = &dp->dp_tx;
+	uint64_t lo = zfs_dirty_data_sync / 4;
+	uint64_t hi = zfs_dirty_data_max * zfs_delay_min_dirty_percent / 100;
+	uint64_t bw;
+
+	if (zfs_txg_sync_target_ms <= 0 || dirty < lo || sync_time <= 0)
+		return;
+
+	/* bytes per millisecond */
+	bw = dirty / MAX(sync_time / MSEC2NSEC(1), 1);
+	if (tx->tx_sync_bw == 0)
+		tx->tx_sync_bw = bw;
+	else
+		tx->tx_sync_bw = (3 * tx->tx_sync_bw + bw) / 4;
+
+	tx->tx_dirty_sync = MIN(MAX(tx->tx_sync_bw * zfs_txg_sync_target_ms,
+	    lo), hi);
+}
+
 /*
  * Start syncing transaction groups.
  */
@@ -495,9 +548,9 @@ txg_sync_thread(dsl_pool_t *dp)
 	for (;;) {
 		clock_t timeout = zfs_txg_timeout * hz;
 		clock_t timer;
-		uint64_t txg;
+		uint64_t txg, dirty;
 		txg_stat_t *ts;
-		hrtime_t timestamp;
+		hrtime_t timestamp, sync_time;
 
 		/*
 		 * We sync when we're scanning, there's someone waiting
@@ -509,7 +562,7 @@ txg_sync_thread(dsl_pool_t *dp)
 		    !tx->tx_exiting && timer > 0 &&
 		    tx->tx_synced_txg >= tx->tx_sync_txg_waiting &&
 		    tx->tx_quiesced_txg == 0 &&
-		    dp->dp_dirty_total < zfs_dirty_data_sync) {
+		    dp->dp_dirty_total < txg_dirty_sync_threshold(dp)) {
 			dprintf("waiting; tx_synced=%llu waiting=%llu dp=%p\n",
 			    tx->tx_synced_txg, tx->tx_sync_txg_waiting, dp);
 			txg_thread_wait(tx, &cpr, &tx->tx_sync_more_cv, timer);
@@ -547,17 +600,23 @@ txg_sync_thread(dsl_pool_t *dp)
 		    txg, tx->tx_quiesce_txg_waiting, tx->tx_sync_txg_waiting);
 		mutex_exit(&tx->tx_sync_lock);
 
+		mutex_enter(&dp->dp_lock);
+		dirty = dp->dp_dirty_pertxg[txg & TXG_MASK];
+		mutex_exit(&dp->dp_lock);
+
 		start = ddi_get_lbolt();
 		timestamp = gethrtime();
 		spa_sync(spa, txg);
 		delta = ddi_get_lbolt() - start;
-		timestamp = (gethrtime() - timestamp) / 1000000000;
+		sync_time = gethrtime() - timestamp;
+		timestamp = sync_time / 1000000000;
 		if (timestamp > sync_threshold) {
 			zfs_ereport_post(FM_EREPORT_ZFS_SYNC_SLOW, spa,
 			    NULL, NULL, 0, 0);
 		}
 
 		mutex_enter(&tx->tx_sync_lock);
+		txg_sync_adapt(dp, dirty, sync_time);
 		tx->tx_synced_txg = txg;
 		tx->tx_syncing_txg = 0;
 		DTRACE_PROBE2(txg__synced, dsl_pool_t *, dp, uint64_t, txg);
@@ -661,6 +720,7 @@ void
 txg_wait_synced(dsl_pool_t *dp, uint64_t txg)
 {
 	tx_state_t *tx = &dp->dp_tx;
+	hrtime_t before = 0;
 
 	ASSERT(!dsl_pool_config_held(dp));
 
@@ -676,16 +736,22 @@ txg_wait_synced(dsl_pool_t *dp, uint64_t txg)
 		dprintf("broadcasting sync more "
 		    "tx_synced=%llu waiting=%llu dp=%p\n",
 		    tx->tx_synced_txg, tx->tx_sync_txg_waiting, dp);
+		if (before == 0)
+			before = gethrtime();
 		cv_broadcast(&tx->tx_sync_more_cv);
 		cv_wait(&tx->tx_sync_done_cv, &tx->tx_sync_lock);
 	}
 	mutex_exit(&tx->tx_sync_lock);
+
+	if (before != 0)
+		spa_txg_wait_synced_add_nsecs(dp->dp_spa, gethrtime() - before);
 }
 
 void
 txg_wait_open(dsl_pool_t *dp, uint64_t txg)
 {
 	tx_state_t *tx = &dp->dp_tx;
+	hrtime_t before = 0;
 
 	ASSERT(!dsl_pool_config_held(dp));
 
@@ -698,10 +764,15 @@ txg_wait_open(dsl_pool_t *dp, uint64_t txg)
 	dprintf("txg=%llu quiesce_txg=%llu sync_txg=%llu\n",
 	    txg, tx->tx_quiesce_txg_waiting, tx->tx_sync_txg_waiting);
 	while (tx->tx_open_txg < txg) {
+		if (before == 0)
+			before = gethrtime();
 		cv_broadcast(&tx->tx_quiesce_more_cv);
 		cv_wait(&tx->tx_quiesce_done_cv, &tx->tx_sync_lock);
 	}
 	mutex_exit(&tx->tx_sync_lock);
+
+	if (before != 0)
+		spa_txg_wait_open_add_nsecs(dp->dp_spa, gethrtime() - before);
 }
 
 /*
@@ -969,4 +1040,8 @@ EXPORT_SYMBOL(txg_sync_waiting);
 
 module_param(zfs_txg_timeout, int, 0644);
 MODULE_PARM_DESC(zfs_txg_timeout, "Max seconds worth of delta per txg");
+
+module_param(zfs_txg_sync_target_ms, int, 0644);
+MODULE_PARM_DESC(zfs_txg_sync_target_ms,
+	"Target txg sync time in ms, 0 to sync at zfs_dirty_data_sync");
 #endif
@@ -49,6 +49,7 @@
 #include <sys/abd.h>
 #include <sys/zvol.h>
 #include <sys/zfs_ratelimit.h>
+#include <sys/zfeature.h>
 
 /*
  * When a vdev is added, it will be divided into approximately (but no
@@ -72,6 +73,13 @@ unsigned int zfs_checksums_per_second = 20;
  */
 int zfs_scan_ignore_errors = 0;
 
+/*
+ * When a pool is opened, the metaslabs of each top-level vdev are
+ * initialized in batches of this many, and the batches of all top-level
+ * vdevs are run in parallel.
+ */
+int zfs_vdev_ms_load_batch = 16;
+
 /*
  * Virtual device management.
  */
@@ -412,6 +420,8 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	vdev_ops_t *ops;
 	char *type;
 	uint64_t guid = 0, islog, nparity;
+	vdev_alloc_bias_t alloc_bias = VDEV_BIAS_NONE;
+	char *bias;
 	vdev_t *vd;
 	char *tmp = NULL;
 	int rc;
@@ -465,6 +475,24 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	if (ops == &vdev_hole_ops && spa_version(spa) < SPA_VERSION_HOLES)
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * Determine whether a top-level vdev belongs to the special class.
+	 * A pool being created enables its features only after its vdevs
+	 * are allocated, so the feature can only be checked when adding.
+	 */
+	if (parent != NULL && parent->vdev_parent == NULL && !islog &&
+	    nvlist_lookup_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS,
+	    &bias) == 0) {
+		if (strcmp(bias, VDEV_ALLOC_BIAS_SPECIAL) != 0)
+			return (SET_ERROR(EINVAL));
+		if (alloctype == VDEV_ALLOC_ADD &&
+		    spa->spa_load_state != SPA_LOAD_CREATE &&
+		    !spa_feature_is_enabled(spa,
+		    SPA_FEATURE_ALLOCATION_CLASSES))
+			return (SET_ERROR(ENOTSUP));
+		alloc_bias = VDEV_BIAS_SPECIAL;
+	}
+
 	/*
 	 * Set the nparity property for RAID-Z vdevs.
 	 */
@@ -504,6 +532,7 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	vd = vdev_alloc_common(spa, id, guid, ops);
 
 	vd->vdev_islog = islog;
+	vd->vdev_alloc_bias = alloc_bias;
 	vd->vdev_nparity = nparity;
 
 	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &vd->vdev_path) == 0)
@@ -584,8 +613,14 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		    alloctype == VDEV_ALLOC_ADD ||
 		    alloctype == VDEV_ALLOC_SPLIT ||
 		    alloctype == VDEV_ALLOC_ROOTPOOL);
-		vd->vdev_mg = metaslab_group_create(islog ?
-		    spa_log_class(spa) : spa_normal_class(spa), vd);
+		metaslab_class_t *mc = spa_normal_class(spa);
+
+		if (islog)
+			mc = spa_log_class(spa);
+		else if (alloc_bias == VDEV_BIAS_SPECIAL)
+			mc = spa_special_class(spa);
+
+		vd->vdev_mg = metaslab_group_create(mc, vd);
 	}
 
 	if (vd->vdev_ops->vdev_op_leaf &&
@@ -825,6 +860,9 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 
 	tvd->vdev_islog = svd->vdev_islog;
 	svd->vdev_islog = 0;
+
+	tvd->vdev_alloc_bias = svd->vdev_alloc_bias;
+	svd->vdev_alloc_bias = VDEV_BIAS_NONE;
 }
 
 static void
@@ -928,24 +966,16 @@ vdev_remove_parent(vdev_t *cvd)
 	vdev_free(mvd);
 }
 
-int
-vdev_metaslab_init(vdev_t *vd, uint64_t txg)
+/*
+ * Grow the metaslab array of vd to cover its whole asize.  The new slots
+ * are left empty for vdev_metaslab_init_range().
+ */
+static void
+vdev_metaslab_grow(vdev_t *vd)
 {
-	spa_t *spa = vd->vdev_spa;
-	objset_t *mos = spa->spa_meta_objset;
-	uint64_t m;
 	uint64_t oldc = vd->vdev_ms_count;
 	uint64_t newc = vd->vdev_asize >> vd->vdev_ms_shift;
 	metaslab_t **mspp;
-	int error;
-
-	ASSERT(txg == 0 || spa_config_held(spa, SCL_ALLOC, RW_WRITER));
-
-	/*
-	 * This vdev is not being allocated from yet or is a hole.
-	 */
-	if (vd->vdev_ms_shift == 0)
-		return (0);
 
 	ASSERT(!vd->vdev_ishole);
 
@@ -969,8 +999,21 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 
 	vd->vdev_ms = mspp;
 	vd->vdev_ms_count = newc;
+}
 
-	for (m = oldc; m < newc; m++) {
+/*
+ * Initialize metaslabs [start, end) of vd.  Distinct ranges of the same
+ * vdev may be initialized concurrently.
+ */
+static int
+vdev_metaslab_init_range(vdev_t *vd, uint64_t start, uint64_t end,
+    uint64_t txg)
+{
+	objset_t *mos = vd->vdev_spa->spa_meta_objset;
+	uint64_t m;
+	int error;
+
+	for (m = start; m < end; m++) {
 		uint64_t object = 0;
 
 		if (txg == 0) {
@@ -987,6 +1030,14 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 			return (error);
 	}
 
+	return (0);
+}
+
+static void
+vdev_metaslab_activate(vdev_t *vd, uint64_t oldc, uint64_t txg)
+{
+	spa_t *spa = vd->vdev_spa;
+
 	if (txg == 0)
 		spa_config_enter(spa, SCL_ALLOC, FTAG, RW_WRITER);
 
@@ -1000,6 +1051,30 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 
 	if (txg == 0)
 		spa_config_exit(spa, SCL_ALLOC, FTAG);
+}
+
+int
+vdev_metaslab_init(vdev_t *vd, uint64_t txg)
+{
+	uint64_t oldc = vd->vdev_ms_count;
+	int error;
+
+	ASSERT(txg == 0 ||
+	    spa_config_held(vd->vdev_spa, SCL_ALLOC, RW_WRITER));
+
+	/*
+	 * This vdev is not being allocated from yet or is a hole.
+	 */
+	if (vd->vdev_ms_shift == 0)
+		return (0);
+
+	vdev_metaslab_grow(vd);
+
+	error = vdev_metaslab_init_range(vd, oldc, vd->vdev_ms_count, txg);
+	if (error)
+		return (error);
+
+	vdev_metaslab_activate(vd, oldc, txg);
 
 	return (0);
 }
@@ -1290,6 +1365,7 @@ vdev_open(vdev_t *vd)
 		return (SET_ERROR(ENXIO));
 	}
 
+	vd->vdev_max_transfer = 0;
 	error = vd->vdev_ops->vdev_op_open(vd, &osize, &max_osize, &ashift);
 
 	/*
@@ -1885,7 +1961,7 @@ vdev_dtl_min(vdev_t *vd)
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_first(&vd->vdev_dtl[DTL_MISSING]->rt_root);
+	rs = zfs_btree_first(&vd->vdev_dtl[DTL_MISSING]->rt_root, NULL);
 	return (rs->rs_start - 1);
 }
 
@@ -1901,7 +1977,7 @@ vdev_dtl_max(vdev_t *vd)
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_last(&vd->vdev_dtl[DTL_MISSING]->rt_root);
+	rs = zfs_btree_last(&vd->vdev_dtl[DTL_MISSING]->rt_root, NULL);
 	return (rs->rs_end);
 }
 
@@ -2317,8 +2393,119 @@ vdev_resilver_needed(vdev_t *vd, uint64_t *minp, uint64_t *maxp)
 	return (needed);
 }
 
-void
-vdev_load(vdev_t *vd)
+typedef struct vdev_ms_load {
+	vdev_t		*vml_vd;
+	uint64_t	vml_start;
+	uint64_t	vml_end;
+	int		vml_error;
+} vdev_ms_load_t;
+
+static void
+vdev_metaslab_load_batch(void *arg)
+{
+	vdev_ms_load_t *vml = arg;
+	vdev_t *vd = vml->vml_vd;
+
+	vml->vml_error = vdev_metaslab_init_range(vd, vml->vml_start,
+	    vml->vml_end, 0);
+	if (vml->vml_error == 0) {
+		spa_load_stat_add(vd->vdev_spa, SPA_LOAD_METASLABS_LOADED,
+		    vml->vml_end - vml->vml_start);
+	}
+}
+
+/*
+ * Initialize the metaslabs of all top-level vdevs of the pool, which
+ * reads the header of every space map in the MOS.  On pools with many
+ * metaslabs this dominates the time taken to open the pool, so the work
+ * is split into batches of zfs_vdev_ms_load_batch metaslabs which are
+ * run from a taskq.  Vdev state changes are made here afterwards, since
+ * they propagate up the tree.
+ */
+static void
+vdev_load_metaslabs(vdev_t *rvd)
+{
+	spa_t *spa = rvd->vdev_spa;
+	uint64_t batch = MAX(zfs_vdev_ms_load_batch, 1);
+	uint64_t nbatches = 0, total = 0, b, m;
+	vdev_ms_load_t *vml;
+	hrtime_t start;
+	taskq_t *tq = NULL;
+	int c;
+
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *tvd = rvd->vdev_child[c];
+
+		if (tvd->vdev_ishole || tvd->vdev_ashift == 0 ||
+		    tvd->vdev_asize == 0 || tvd->vdev_ms_shift == 0)
+			continue;
+
+		ASSERT0(tvd->vdev_ms_count);
+		vdev_metaslab_grow(tvd);
+		nbatches += howmany(tvd->vdev_ms_count, batch);
+		total += tvd->vdev_ms_count;
+	}
+
+	spa_load_stat_set(spa, SPA_LOAD_METASLABS, total);
+	spa_load_stat_set(spa, SPA_LOAD_METASLABS_LOADED, 0);
+	start = gethrtime();
+
+	vml = kmem_zalloc(MAX(nbatches, 1) * sizeof (vdev_ms_load_t),
+	    KM_SLEEP);
+	if (nbatches > 1) {
+		tq = taskq_create("z_vdev_load", MIN(nbatches, boot_ncpus),
+		    minclsyspri, 1, INT_MAX, TASKQ_PREPOPULATE);
+	}
+
+	for (c = 0, b = 0; c < rvd->vdev_children; c++) {
+		vdev_t *tvd = rvd->vdev_child[c];
+
+		for (m = 0; m < tvd->vdev_ms_count; m += batch, b++) {
+			vml[b].vml_vd = tvd;
+			vml[b].vml_start = m;
+			vml[b].vml_end = MIN(m + batch, tvd->vdev_ms_count);
+
+			if (tq == NULL || taskq_dispatch(tq,
+			    vdev_metaslab_load_batch, &vml[b], TQ_SLEEP) ==
+			    TASKQID_INVALID)
+				vdev_metaslab_load_batch(&vml[b]);
+		}
+	}
+	ASSERT3U(b, ==, nbatches);
+
+	if (tq != NULL)
+		taskq_destroy(tq);
+
+	spa_load_stat_set(spa, SPA_LOAD_METASLAB_NS, gethrtime() - start);
+
+	for (c = 0, b = 0; c < rvd->vdev_children; c++) {
+		vdev_t *tvd = rvd->vdev_child[c];
+		int error = 0;
+
+		if (tvd->vdev_ishole)
+			continue;
+
+		if (tvd->vdev_ashift == 0 || tvd->vdev_asize == 0)
+			error = SET_ERROR(EINVAL);
+
+		for (m = 0; m < tvd->vdev_ms_count; m += batch, b++) {
+			if (error == 0)
+				error = vml[b].vml_error;
+		}
+
+		if (error != 0) {
+			vdev_set_state(tvd, B_FALSE, VDEV_STATE_CANT_OPEN,
+			    VDEV_AUX_CORRUPT_DATA);
+		} else if (tvd->vdev_ms_count != 0) {
+			vdev_metaslab_activate(tvd, 0, 0);
+		}
+	}
+
+	kmem_free(vml, MAX(nbatches, 1) * sizeof (vdev_ms_load_t));
+}
+
+static void
+vdev_load_impl(vdev_t *vd, boolean_t ms_init)
 {
 	int c;
 
@@ -2326,12 +2513,12 @@ vdev_load(vdev_t *vd)
 	 * Recursively load all children.
 	 */
 	for (c = 0; c < vd->vdev_children; c++)
-		vdev_load(vd->vdev_child[c]);
+		vdev_load_impl(vd->vdev_child[c], ms_init);
 
 	/*
 	 * If this is a top-level vdev, initialize its metaslabs.
 	 */
-	if (vd == vd->vdev_top && !vd->vdev_ishole &&
+	if (ms_init && vd == vd->vdev_top && !vd->vdev_ishole &&
 	    (vd->vdev_ashift == 0 || vd->vdev_asize == 0 ||
 	    vdev_metaslab_init(vd, 0) != 0))
 		vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
@@ -2344,6 +2531,17 @@ vdev_load(vdev_t *vd)
 		    VDEV_AUX_CORRUPT_DATA);
 }
 
+void
+vdev_load(vdev_t *vd)
+{
+	if (vd == vd->vdev_spa->spa_root_vdev) {
+		vdev_load_metaslabs(vd);
+		vdev_load_impl(vd, B_FALSE);
+	} else {
+		vdev_load_impl(vd, B_TRUE);
+	}
+}
+
 /*
  * The special vdev case is used for hot spares and l2cache devices.  Its
  * sole purpose it to set the vdev state for the associated vdev.  To do this,
@@ -2495,6 +2693,19 @@ vdev_sync(vdev_t *vd, uint64_t txg)
 	while ((lvd = txg_list_remove(&vd->vdev_dtl_list, txg)) != NULL)
 		vdev_dtl_sync(lvd, txg);
 
+	/*
+	 * Software that doesn't know about allocation classes would put
+	 * any kind of block on a special vdev, so it may only open the pool
+	 * read-only once one has been written to.
+	 */
+	if (vd->vdev_alloc_bias == VDEV_BIAS_SPECIAL &&
+	    spa_feature_is_enabled(spa, SPA_FEATURE_ALLOCATION_CLASSES) &&
+	    !spa_feature_is_active(spa, SPA_FEATURE_ALLOCATION_CLASSES)) {
+		tx = dmu_tx_create_assigned(spa->spa_dsl_pool, txg);
+		spa_feature_incr(spa, SPA_FEATURE_ALLOCATION_CLASSES, tx);
+		dmu_tx_commit(tx);
+	}
+
 	(void) txg_list_add(&spa->spa_vdev_txg_list, vd, TXG_CLEAN(txg));
 }
 
@@ -2963,6 +3174,8 @@ vdev_get_child_stat_ex(vdev_t *cvd, vdev_stat_ex_t *vsx, vdev_stat_ex_t *cvsx)
 
 		for (b = 0; b < ARRAY_SIZE(vsx->vsx_agg_histo[0]); b++)
 			vsx->vsx_agg_histo[t][b] += cvsx->vsx_agg_histo[t][b];
+
+		vsx->vsx_agg_merged[t] += cvsx->vsx_agg_merged[t];
 	}
 
 }
@@ -3013,6 +3226,8 @@ vdev_get_stats_ex_impl(vdev_t *vd, vdev_stat_t *vs, vdev_stat_ex_t *vsx)
 			    vd->vdev_queue.vq_class[t].vqc_active;
 			vsx->vsx_pend_queue[t] = avl_numnodes(
 			    &vd->vdev_queue.vq_class[t].vqc_queued_tree);
+			vsx->vsx_agg_merged[t] =
+			    vd->vdev_queue.vq_class[t].vqc_merged;
 		}
 	}
 }
@@ -3308,7 +3523,7 @@ vdev_space_update(vdev_t *vd, int64_t alloc_delta, int64_t defer_delta,
 	vd->vdev_stat.vs_dspace += dspace_delta;
 	mutex_exit(&vd->vdev_stat_lock);
 
-	if (mc == spa_normal_class(spa)) {
+	if (mc == spa_normal_class(spa) || mc == spa_special_class(spa)) {
 		mutex_enter(&rvd->vdev_stat_lock);
 		rvd->vdev_stat.vs_alloc += alloc_delta;
 		rvd->vdev_stat.vs_space += space_delta;
@@ -3339,6 +3554,8 @@ vdev_config_dirty(vdev_t *vd)
 
 	ASSERT(spa_writeable(spa));
 
+	spa_stats_cache_invalidate(spa);
+
 	/*
 	 * If this is an aux vdev (as with l2cache and spare devices), then we
 	 * update the vdev config manually and set the sync flag.
@@ -3531,6 +3748,8 @@ vdev_set_state(vdev_t *vd, boolean_t isopen, vdev_state_t state, vdev_aux_t aux)
 	uint64_t save_state;
 	spa_t *spa = vd->vdev_spa;
 
+	spa_stats_cache_invalidate(spa);
+
 	if (state == vd->vdev_state) {
 		/*
 		 * Since vdev_offline() code path is already in an offline
@@ -3836,6 +4055,10 @@ module_param(zfs_checksums_per_second, uint, 0644);
 	"to this many checksum errors per second (do not set below zed"
 	"threshold).");
 
+module_param(zfs_vdev_ms_load_batch, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_ms_load_batch,
+	"Metaslabs initialized per task when opening a pool");
+
 module_param(zfs_scan_ignore_errors, int, 0644);
 MODULE_PARM_DESC(zfs_scan_ignore_errors,
 	"Ignore errors during resilver/scrub");
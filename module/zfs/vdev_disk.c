@@ -316,12 +316,22 @@ skip_open:
 	/*  Determine the physical block size */
 	block_size = vdev_bdev_block_size(vd->vd_bdev);
 
-	/* Clear the nowritecache bit, causes vdev_reopen() to try again. */
-	v->vdev_nowritecache = B_FALSE;
+	/*
+	 * Reset the nowritecache bit, causes vdev_reopen() to try again.
+	 * Devices without a volatile write cache, such as persistent memory,
+	 * never need a flush; marking them up front lets ZIL commits on a
+	 * pmem log device complete without a flush round trip.
+	 */
+	v->vdev_nowritecache =
+	    !blk_queue_has_write_cache(bdev_get_queue(vd->vd_bdev));
 
 	/* Inform the ZIO pipeline that we are non-rotational */
 	v->vdev_nonrot = blk_queue_nonrot(bdev_get_queue(vd->vd_bdev));
 
+	/* Larger requests are split by the block layer */
+	v->vdev_max_transfer =
+	    (uint64_t)queue_max_sectors(bdev_get_queue(vd->vd_bdev)) << 9;
+
 	/* Physical volume size in bytes */
 	*psize = bdev_capacity(vd->vd_bdev);
 
@@ -482,6 +492,27 @@ bio_map(struct bio *bio, void *bio_ptr, unsigned int bio_size)
 static unsigned int
 bio_map_abd_off(struct bio *bio, abd_t *abd, unsigned int size, size_t off)
 {
+	if (abd_is_gang(abd)) {
+		abd_t *cabd = abd_gang_get_offset(abd, &off);
+
+		/* map the children in turn until the bio is full */
+		while (size > 0 && cabd != NULL) {
+			unsigned int len = MIN(size, cabd->abd_size - off);
+			unsigned int left;
+
+			left = bio_map_abd_off(bio, cabd, len, off);
+
+			size -= len - left;
+			if (left != 0)
+				break;
+			off = 0;
+			cabd = list_next(&abd->abd_u.abd_gang.abd_gang_chain,
+			    cabd);
+		}
+
+		return (size);
+	}
+
 	if (abd_is_linear(abd))
 		return (bio_map(bio, ((char *)abd_to_buf(abd)) + off, size));
 
@@ -705,6 +736,28 @@ vdev_disk_io_start(zio_t *zio)
 
 			break;
 
+		case DKIOCTRIM:
+
+			if (v->vdev_notrim) {
+				zio->io_error = SET_ERROR(ENOTSUP);
+				break;
+			}
+
+			/*
+			 * The discard is waited for here, trims are few and
+			 * limited by zfs_vdev_trim_max_active.  As a queued
+			 * i/o it is completed by zio_interrupt(), so that the
+			 * next i/o is not issued from this stack.
+			 */
+			error = -blkdev_issue_discard(vd->vd_bdev,
+			    zio->io_offset >> 9, zio->io_size >> 9,
+			    GFP_NOFS, 0);
+			if (error == EOPNOTSUPP)
+				error = ENOTSUP;
+			zio->io_error = error != 0 ? SET_ERROR(error) : 0;
+			zio_interrupt(zio);
+			return;
+
 		default:
 			zio->io_error = SET_ERROR(ENOTSUP);
 		}
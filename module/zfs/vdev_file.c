@@ -33,12 +33,482 @@
 #include <sys/fm/fs/zfs.h>
 #include <sys/abd.h>
 
+#if !defined(_KERNEL)
+#include <libaio.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+#if !defined(_KERNEL) && defined(HAVE_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 /*
  * Virtual device vector for files.
  */
 
 static taskq_t *vdev_file_taskq;
 
+#if !defined(_KERNEL)
+/*
+ * One read or write of a user space vdev.  Its data is described by an
+ * iovec of the ABD's own chunks, so that no bounce buffer is copied, or by
+ * a buffer borrowed from the ABD if that can't be done.
+ */
+typedef struct vdev_file_rio {
+	zio_t		*vfi_zio;
+	void		*vfi_buf;	/* borrowed buffer, or NULL */
+	struct iovec	*vfi_iov;
+	int		vfi_niov;
+	struct iovec	vfi_iov1;	/* vfi_iov of a borrowed buffer */
+	struct iocb	vfi_iocb;
+} vdev_file_rio_t;
+
+/* Alignment of the memory and length of O_DIRECT IO */
+#define	VDEV_FILE_DIRECT_ALIGN	SPA_MINBLOCKSIZE
+
+typedef struct vdev_file_iov_arg {
+	struct iovec	*via_iov;	/* NULL while counting */
+	int		via_niov;
+	boolean_t	via_direct;
+} vdev_file_iov_arg_t;
+
+static int
+vdev_file_iov_cb(void *buf, size_t len, void *private)
+{
+	vdev_file_iov_arg_t *via = private;
+
+	if (via->via_direct &&
+	    !IS_P2ALIGNED((uintptr_t)buf | len, VDEV_FILE_DIRECT_ALIGN))
+		return (EINVAL);
+	if (via->via_iov != NULL) {
+		via->via_iov[via->via_niov].iov_base = buf;
+		via->via_iov[via->via_niov].iov_len = len;
+	}
+	if (++via->via_niov > IOV_MAX)
+		return (E2BIG);
+
+	return (0);
+}
+
+static vdev_file_rio_t *
+vdev_file_rio_alloc(zio_t *zio)
+{
+	vdev_file_t *vf = zio->io_vd->vdev_tsd;
+	vdev_file_rio_t *vfi;
+	vdev_file_iov_arg_t via;
+
+	vfi = kmem_alloc(sizeof (vdev_file_rio_t), KM_SLEEP);
+	vfi->vfi_zio = zio;
+
+	if (!abd_is_linear(zio->io_abd)) {
+		via.via_iov = NULL;
+		via.via_niov = 0;
+		via.via_direct = vf->vf_direct;
+		if (abd_iterate_func(zio->io_abd, 0, zio->io_size,
+		    vdev_file_iov_cb, &via) == 0) {
+			vfi->vfi_buf = NULL;
+			vfi->vfi_niov = via.via_niov;
+			vfi->vfi_iov = kmem_alloc(via.via_niov *
+			    sizeof (struct iovec), KM_SLEEP);
+			via.via_iov = vfi->vfi_iov;
+			via.via_niov = 0;
+			VERIFY0(abd_iterate_func(zio->io_abd, 0, zio->io_size,
+			    vdev_file_iov_cb, &via));
+			return (vfi);
+		}
+	}
+
+	if (zio->io_type == ZIO_TYPE_READ)
+		vfi->vfi_buf = abd_borrow_buf(zio->io_abd, zio->io_size);
+	else
+		vfi->vfi_buf = abd_borrow_buf_copy(zio->io_abd, zio->io_size);
+	vfi->vfi_iov1.iov_base = vfi->vfi_buf;
+	vfi->vfi_iov1.iov_len = zio->io_size;
+	vfi->vfi_iov = &vfi->vfi_iov1;
+	vfi->vfi_niov = 1;
+
+	return (vfi);
+}
+
+static void
+vdev_file_rio_done(vdev_file_rio_t *vfi, long res)
+{
+	zio_t *zio = vfi->vfi_zio;
+
+	if (vfi->vfi_buf == NULL)
+		kmem_free(vfi->vfi_iov, vfi->vfi_niov * sizeof (struct iovec));
+	else if (zio->io_type == ZIO_TYPE_READ)
+		abd_return_buf_copy(zio->io_abd, vfi->vfi_buf, zio->io_size);
+	else
+		abd_return_buf(zio->io_abd, vfi->vfi_buf, zio->io_size);
+	kmem_free(vfi, sizeof (vdev_file_rio_t));
+
+	/* Same results as vn_rdwr(), a short transfer is ENOSPC */
+	if (res < 0)
+		zio->io_error = SET_ERROR(-res);
+	else if (res != zio->io_size)
+		zio->io_error = SET_ERROR(ENOSPC);
+	else
+		zio->io_error = 0;
+
+	zio_delay_interrupt(zio);
+}
+#endif
+
+#if !defined(_KERNEL) && defined(HAVE_IO_URING)
+/*
+ * In user space reads and writes are submitted to an io_uring per vdev,
+ * rather than each taking a vdev_file_taskq thread for a blocking
+ * pread/pwrite.  A poller thread reaps the completions.  The file is
+ * registered with the ring; the zio buffers are not, since they are
+ * borrowed from arbitrary ABDs.  Number of entries of the ring, which
+ * bounds the IOs in flight per vdev; 0 disables it.
+ */
+int vdev_file_ring_entries = 256;
+
+typedef struct vdev_file_ring {
+	int		vfr_fd;
+	kmutex_t	vfr_lock;	/* serializes submission */
+	kcondvar_t	vfr_cv;		/* a slot was freed */
+	uint_t		vfr_entries;
+	uint_t		vfr_inflight;
+	kt_did_t	vfr_poller;
+
+	void		*vfr_sq_ring;
+	size_t		vfr_sq_ring_size;
+	uint_t		*vfr_sq_tail;
+	uint_t		*vfr_sq_mask;
+	uint_t		*vfr_sq_array;
+	struct io_uring_sqe *vfr_sqes;
+	size_t		vfr_sqes_size;
+
+	void		*vfr_cq_ring;
+	size_t		vfr_cq_ring_size;
+	uint_t		*vfr_cq_head;
+	uint_t		*vfr_cq_tail;
+	uint_t		*vfr_cq_mask;
+	struct io_uring_cqe *vfr_cqes;
+} vdev_file_ring_t;
+
+/*
+ * Push one sqe.  A NULL vfi submits a no-op which wakes the poller, used
+ * to stop it.
+ */
+static void
+vdev_file_ring_submit(vdev_file_ring_t *vfr, vdev_file_rio_t *vfi)
+{
+	struct io_uring_sqe *sqe;
+	uint_t tail, idx;
+	int rc;
+
+	mutex_enter(&vfr->vfr_lock);
+	while (vfr->vfr_inflight >= vfr->vfr_entries)
+		cv_wait(&vfr->vfr_cv, &vfr->vfr_lock);
+	vfr->vfr_inflight++;
+
+	tail = *vfr->vfr_sq_tail;
+	idx = tail & *vfr->vfr_sq_mask;
+	sqe = &vfr->vfr_sqes[idx];
+	bzero(sqe, sizeof (*sqe));
+	if (vfi == NULL) {
+		sqe->opcode = IORING_OP_NOP;
+	} else {
+		zio_t *zio = vfi->vfi_zio;
+
+		sqe->opcode = (zio->io_type == ZIO_TYPE_READ) ?
+		    IORING_OP_READV : IORING_OP_WRITEV;
+		sqe->flags = IOSQE_FIXED_FILE;
+		sqe->fd = 0;
+		sqe->off = zio->io_offset;
+		sqe->addr = (uint64_t)(uintptr_t)vfi->vfi_iov;
+		sqe->len = vfi->vfi_niov;
+	}
+	sqe->user_data = (uint64_t)(uintptr_t)vfi;
+	vfr->vfr_sq_array[idx] = idx;
+	__atomic_store_n(vfr->vfr_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	do {
+		rc = syscall(__NR_io_uring_enter, vfr->vfr_fd, 1, 0, 0,
+		    NULL, 0);
+	} while (rc < 0 && (errno == EINTR || errno == EAGAIN));
+	VERIFY3S(rc, ==, 1);
+	mutex_exit(&vfr->vfr_lock);
+}
+
+static void
+vdev_file_ring_poller(void *arg)
+{
+	vdev_file_ring_t *vfr = arg;
+	struct io_uring_cqe *cqe;
+	uint_t head, reaped;
+	boolean_t exiting = B_FALSE;
+
+	while (!exiting) {
+		if (syscall(__NR_io_uring_enter, vfr->vfr_fd, 0, 1,
+		    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+			VERIFY3S(errno, ==, EAGAIN);
+
+		head = *vfr->vfr_cq_head;
+		reaped = 0;
+		while (head != __atomic_load_n(vfr->vfr_cq_tail,
+		    __ATOMIC_ACQUIRE)) {
+			cqe = &vfr->vfr_cqes[head & *vfr->vfr_cq_mask];
+			if (cqe->user_data == 0)
+				exiting = B_TRUE;
+			else
+				vdev_file_rio_done((vdev_file_rio_t *)
+				    (uintptr_t)cqe->user_data, cqe->res);
+			head++;
+			reaped++;
+		}
+		__atomic_store_n(vfr->vfr_cq_head, head, __ATOMIC_RELEASE);
+
+		if (reaped != 0) {
+			mutex_enter(&vfr->vfr_lock);
+			vfr->vfr_inflight -= reaped;
+			cv_broadcast(&vfr->vfr_cv);
+			mutex_exit(&vfr->vfr_lock);
+		}
+	}
+
+	thread_exit();
+}
+
+static void
+vdev_file_ring_destroy(vdev_file_ring_t *vfr)
+{
+	if (vfr->vfr_sqes != NULL)
+		(void) munmap(vfr->vfr_sqes, vfr->vfr_sqes_size);
+	if (vfr->vfr_cq_ring != NULL)
+		(void) munmap(vfr->vfr_cq_ring, vfr->vfr_cq_ring_size);
+	if (vfr->vfr_sq_ring != NULL)
+		(void) munmap(vfr->vfr_sq_ring, vfr->vfr_sq_ring_size);
+	(void) close(vfr->vfr_fd);
+	cv_destroy(&vfr->vfr_cv);
+	mutex_destroy(&vfr->vfr_lock);
+	kmem_free(vfr, sizeof (vdev_file_ring_t));
+}
+
+/*
+ * Set up a ring for the file, or return NULL if io_uring can't be used (it
+ * is disabled, or the running kernel lacks it).
+ */
+static vdev_file_ring_t *
+vdev_file_ring_create(vnode_t *vp)
+{
+	struct io_uring_params p;
+	vdev_file_ring_t *vfr;
+	kthread_t *kt;
+	char *sq, *cq;
+	int fd;
+
+	/* ztest's dump files are written by vn_rdwr() */
+	if (vdev_file_ring_entries <= 0 || vp->v_dump_fd != -1)
+		return (NULL);
+
+	bzero(&p, sizeof (p));
+	fd = syscall(__NR_io_uring_setup, vdev_file_ring_entries, &p);
+	if (fd < 0)
+		return (NULL);
+
+	vfr = kmem_zalloc(sizeof (vdev_file_ring_t), KM_SLEEP);
+	vfr->vfr_fd = fd;
+	vfr->vfr_entries = p.sq_entries;
+	mutex_init(&vfr->vfr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vfr->vfr_cv, NULL, CV_DEFAULT, NULL);
+
+	vfr->vfr_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (uint_t);
+	vfr->vfr_cq_ring_size = p.cq_off.cqes +
+	    p.cq_entries * sizeof (struct io_uring_cqe);
+	vfr->vfr_sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+
+	sq = mmap(NULL, vfr->vfr_sq_ring_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	cq = mmap(NULL, vfr->vfr_cq_ring_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	vfr->vfr_sqes = mmap(NULL, vfr->vfr_sqes_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	vfr->vfr_sq_ring = (sq == MAP_FAILED) ? NULL : sq;
+	vfr->vfr_cq_ring = (cq == MAP_FAILED) ? NULL : cq;
+	if (vfr->vfr_sqes == MAP_FAILED)
+		vfr->vfr_sqes = NULL;
+	if (vfr->vfr_sq_ring == NULL || vfr->vfr_cq_ring == NULL ||
+	    vfr->vfr_sqes == NULL ||
+	    syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES,
+	    &vp->v_fd, 1) < 0) {
+		vdev_file_ring_destroy(vfr);
+		return (NULL);
+	}
+
+	vfr->vfr_sq_tail = (uint_t *)(sq + p.sq_off.tail);
+	vfr->vfr_sq_mask = (uint_t *)(sq + p.sq_off.ring_mask);
+	vfr->vfr_sq_array = (uint_t *)(sq + p.sq_off.array);
+	vfr->vfr_cq_head = (uint_t *)(cq + p.cq_off.head);
+	vfr->vfr_cq_tail = (uint_t *)(cq + p.cq_off.tail);
+	vfr->vfr_cq_mask = (uint_t *)(cq + p.cq_off.ring_mask);
+	vfr->vfr_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	kt = zk_thread_create(NULL, 0, (thread_func_t)vdev_file_ring_poller,
+	    vfr, 0, NULL, TS_RUN, minclsyspri, PTHREAD_CREATE_JOINABLE);
+	vfr->vfr_poller = kt->t_tid;
+
+	return (vfr);
+}
+
+static void
+vdev_file_ring_fini(vdev_file_ring_t *vfr)
+{
+	/* The vdev is closing, all of its IOs have completed */
+	vdev_file_ring_submit(vfr, NULL);
+	zk_thread_join(vfr->vfr_poller);
+	ASSERT0(vfr->vfr_inflight);
+	vdev_file_ring_destroy(vfr);
+}
+#endif
+
+#if !defined(_KERNEL)
+/*
+ * Without io_uring, IO to files opened O_DIRECT (block devices) goes
+ * through a Linux AIO context per vdev; io_submit() would block on
+ * buffered files, those stay on the taskq.  Number of events of the
+ * context, which bounds the IOs in flight per vdev; 0 disables it.
+ */
+int vdev_file_aio_events = 256;
+
+/* Completions reaped per io_getevents() call */
+#define	VDEV_FILE_AIO_BATCH	16
+
+typedef struct vdev_file_aio {
+	io_context_t	vfa_ctx;
+	int		vfa_fd;
+	kmutex_t	vfa_lock;
+	kcondvar_t	vfa_cv;		/* a slot was freed */
+	uint_t		vfa_events;
+	uint_t		vfa_inflight;
+	boolean_t	vfa_exiting;
+	kt_did_t	vfa_poller;
+} vdev_file_aio_t;
+
+static void
+vdev_file_aio_submit(vdev_file_aio_t *vfa, vdev_file_rio_t *vfi)
+{
+	zio_t *zio = vfi->vfi_zio;
+	struct iocb *iocb = &vfi->vfi_iocb;
+	int rc;
+
+	if (zio->io_type == ZIO_TYPE_READ)
+		io_prep_preadv(iocb, vfa->vfa_fd, vfi->vfi_iov, vfi->vfi_niov,
+		    zio->io_offset);
+	else
+		io_prep_pwritev(iocb, vfa->vfa_fd, vfi->vfi_iov, vfi->vfi_niov,
+		    zio->io_offset);
+	iocb->data = vfi;
+
+	mutex_enter(&vfa->vfa_lock);
+	while (vfa->vfa_inflight >= vfa->vfa_events)
+		cv_wait(&vfa->vfa_cv, &vfa->vfa_lock);
+	vfa->vfa_inflight++;
+	mutex_exit(&vfa->vfa_lock);
+
+	while ((rc = io_submit(vfa->vfa_ctx, 1, &iocb)) == -EAGAIN ||
+	    rc == -EINTR)
+		continue;
+	if (rc != 1) {
+		mutex_enter(&vfa->vfa_lock);
+		vfa->vfa_inflight--;
+		cv_broadcast(&vfa->vfa_cv);
+		mutex_exit(&vfa->vfa_lock);
+		vdev_file_rio_done(vfi, rc < 0 ? rc : -EIO);
+	}
+}
+
+/*
+ * Reap completions in batches.  io_getevents() waits with a timeout so
+ * that the poller notices vfa_exiting, there is nothing to wake it with.
+ */
+static void
+vdev_file_aio_poller(void *arg)
+{
+	vdev_file_aio_t *vfa = arg;
+	struct io_event events[VDEV_FILE_AIO_BATCH];
+	struct timespec ts;
+	int i, n;
+
+	for (;;) {
+		mutex_enter(&vfa->vfa_lock);
+		if (vfa->vfa_exiting && vfa->vfa_inflight == 0) {
+			mutex_exit(&vfa->vfa_lock);
+			break;
+		}
+		mutex_exit(&vfa->vfa_lock);
+
+		ts.tv_sec = 0;
+		ts.tv_nsec = 100 * (NANOSEC / MILLISEC);
+		n = io_getevents(vfa->vfa_ctx, 1, VDEV_FILE_AIO_BATCH, events,
+		    &ts);
+		if (n <= 0) {
+			VERIFY(n == 0 || n == -EINTR);
+			continue;
+		}
+
+		for (i = 0; i < n; i++)
+			vdev_file_rio_done(events[i].data, (long)events[i].res);
+
+		mutex_enter(&vfa->vfa_lock);
+		vfa->vfa_inflight -= n;
+		cv_broadcast(&vfa->vfa_cv);
+		mutex_exit(&vfa->vfa_lock);
+	}
+
+	thread_exit();
+}
+
+static vdev_file_aio_t *
+vdev_file_aio_create(vnode_t *vp)
+{
+	vdev_file_aio_t *vfa;
+	kthread_t *kt;
+
+	if (vdev_file_aio_events <= 0 || vp->v_dump_fd != -1)
+		return (NULL);
+
+	vfa = kmem_zalloc(sizeof (vdev_file_aio_t), KM_SLEEP);
+	if (io_setup(vdev_file_aio_events, &vfa->vfa_ctx) != 0) {
+		kmem_free(vfa, sizeof (vdev_file_aio_t));
+		return (NULL);
+	}
+	vfa->vfa_fd = vp->v_fd;
+	vfa->vfa_events = vdev_file_aio_events;
+	mutex_init(&vfa->vfa_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vfa->vfa_cv, NULL, CV_DEFAULT, NULL);
+
+	kt = zk_thread_create(NULL, 0, (thread_func_t)vdev_file_aio_poller,
+	    vfa, 0, NULL, TS_RUN, minclsyspri, PTHREAD_CREATE_JOINABLE);
+	vfa->vfa_poller = kt->t_tid;
+
+	return (vfa);
+}
+
+static void
+vdev_file_aio_fini(vdev_file_aio_t *vfa)
+{
+	mutex_enter(&vfa->vfa_lock);
+	vfa->vfa_exiting = B_TRUE;
+	mutex_exit(&vfa->vfa_lock);
+	zk_thread_join(vfa->vfa_poller);
+
+	(void) io_destroy(vfa->vfa_ctx);
+	cv_destroy(&vfa->vfa_cv);
+	mutex_destroy(&vfa->vfa_lock);
+	kmem_free(vfa, sizeof (vdev_file_aio_t));
+}
+#endif
+
 static void
 vdev_file_hold(vdev_t *vd)
 {
@@ -99,6 +569,14 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	}
 
 	vf->vf_vnode = vp;
+#if !defined(_KERNEL) && defined(HAVE_IO_URING)
+	vf->vf_ring = vdev_file_ring_create(vp);
+#endif
+#if !defined(_KERNEL)
+	vf->vf_direct = !!(fcntl(vp->v_fd, F_GETFL) & O_DIRECT);
+	if (vf->vf_ring == NULL && vf->vf_direct)
+		vf->vf_aio = vdev_file_aio_create(vp);
+#endif
 
 #ifdef _KERNEL
 	/*
@@ -135,6 +613,15 @@ vdev_file_close(vdev_t *vd)
 	if (vd->vdev_reopening || vf == NULL)
 		return;
 
+#if !defined(_KERNEL) && defined(HAVE_IO_URING)
+	if (vf->vf_ring != NULL)
+		vdev_file_ring_fini(vf->vf_ring);
+#endif
+#if !defined(_KERNEL)
+	if (vf->vf_aio != NULL)
+		vdev_file_aio_fini(vf->vf_aio);
+#endif
+
 	if (vf->vf_vnode != NULL) {
 		(void) VOP_PUTPAGE(vf->vf_vnode, 0, 0, B_INVAL, kcred, NULL);
 		(void) VOP_CLOSE(vf->vf_vnode, spa_mode(vd->vdev_spa), 1, 0,
@@ -155,6 +642,23 @@ vdev_file_io_strategy(void *arg)
 	ssize_t resid;
 	void *buf;
 
+#if !defined(_KERNEL)
+	/* Reads are copied to ztest's dump files by vn_rdwr() */
+	if (vf->vf_vnode->v_dump_fd == -1) {
+		vdev_file_rio_t *vfi = vdev_file_rio_alloc(zio);
+		ssize_t res;
+
+		if (zio->io_type == ZIO_TYPE_READ)
+			res = preadv(vf->vf_vnode->v_fd, vfi->vfi_iov,
+			    vfi->vfi_niov, zio->io_offset);
+		else
+			res = pwritev(vf->vf_vnode->v_fd, vfi->vfi_iov,
+			    vfi->vfi_niov, zio->io_offset);
+		vdev_file_rio_done(vfi, res < 0 ? -errno : res);
+		return;
+	}
+#endif
+
 	if (zio->io_type == ZIO_TYPE_READ)
 		buf = abd_borrow_buf(zio->io_abd, zio->io_size);
 	else
@@ -186,6 +690,50 @@ vdev_file_io_fsync(void *arg)
 	zio_interrupt(zio);
 }
 
+/*
+ * Trims punch a hole in a file, and are passed on as discards to a block
+ * device opened as a file.  Either can block for a while, so they are run
+ * from the taskq.
+ */
+static void
+vdev_file_io_trim(void *arg)
+{
+	zio_t *zio = (zio_t *)arg;
+	vdev_file_t *vf = zio->io_vd->vdev_tsd;
+	int error;
+
+#if !defined(_KERNEL)
+	int fd = vf->vf_vnode->v_fd;
+	struct stat64 st;
+
+	if (fstat64(fd, &st) != 0) {
+		error = errno;
+	} else if (S_ISBLK(st.st_mode)) {
+		uint64_t range[2] = { zio->io_offset, zio->io_size };
+
+		error = ioctl(fd, BLKDISCARD, range) != 0 ? errno : 0;
+	} else {
+		error = fallocate(fd, FALLOC_FL_PUNCH_HOLE |
+		    FALLOC_FL_KEEP_SIZE, zio->io_offset, zio->io_size) != 0 ?
+		    errno : 0;
+	}
+	if (error == EOPNOTSUPP)
+		error = ENOTSUP;
+#else
+	flock64_t fl;
+
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = zio->io_offset;
+	fl.l_len = zio->io_size;
+	error = VOP_SPACE(vf->vf_vnode, F_FREESP, &fl, FWRITE,
+	    zio->io_offset, kcred, NULL);
+#endif
+	zio->io_error = error != 0 ? SET_ERROR(error) : 0;
+
+	zio_interrupt(zio);
+}
+
 static void
 vdev_file_io_start(zio_t *zio)
 {
@@ -223,6 +771,11 @@ vdev_file_io_start(zio_t *zio)
 			zio->io_error = VOP_FSYNC(vf->vf_vnode, FSYNC | FDSYNC,
 			    kcred, NULL);
 			break;
+		case DKIOCTRIM:
+			VERIFY3U(taskq_dispatch(vdev_file_taskq,
+			    vdev_file_io_trim, zio, TQ_SLEEP), !=,
+			    TASKQID_INVALID);
+			return;
 		default:
 			zio->io_error = SET_ERROR(ENOTSUP);
 		}
@@ -233,6 +786,19 @@ vdev_file_io_start(zio_t *zio)
 
 	zio->io_target_timestamp = zio_handle_io_delay(zio);
 
+#if !defined(_KERNEL) && defined(HAVE_IO_URING)
+	if (vf->vf_ring != NULL) {
+		vdev_file_ring_submit(vf->vf_ring, vdev_file_rio_alloc(zio));
+		return;
+	}
+#endif
+#if !defined(_KERNEL)
+	if (vf->vf_aio != NULL) {
+		vdev_file_aio_submit(vf->vf_aio, vdev_file_rio_alloc(zio));
+		return;
+	}
+#endif
+
 	VERIFY3U(taskq_dispatch(vdev_file_taskq, vdev_file_io_strategy, zio,
 	    TQ_SLEEP), !=, TASKQID_INVALID);
 }
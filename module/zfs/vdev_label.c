@@ -344,6 +344,9 @@ vdev_config_generate_stats(vdev_t *vd, nvlist_t *nv)
 	    vsx->vsx_agg_histo[ZIO_PRIORITY_SCRUB],
 	    ARRAY_SIZE(vsx->vsx_agg_histo[ZIO_PRIORITY_SCRUB]));
 
+	fnvlist_add_uint64_array(nvx, ZPOOL_CONFIG_VDEV_AGG_MERGED,
+	    vsx->vsx_agg_merged, ARRAY_SIZE(vsx->vsx_agg_merged));
+
 	/* Add extended stats nvlist to main nvlist */
 	fnvlist_add_nvlist(nv, ZPOOL_CONFIG_VDEV_STATS_EX, nvx);
 
@@ -425,6 +428,10 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_ASIZE,
 		    vd->vdev_asize);
 		fnvlist_add_uint64(nv, ZPOOL_CONFIG_IS_LOG, vd->vdev_islog);
+		if (vd->vdev_alloc_bias == VDEV_BIAS_SPECIAL) {
+			fnvlist_add_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS,
+			    VDEV_ALLOC_BIAS_SPECIAL);
+		}
 		if (vd->vdev_removing)
 			fnvlist_add_uint64(nv, ZPOOL_CONFIG_REMOVING,
 			    vd->vdev_removing);
@@ -1311,12 +1318,15 @@ vdev_label_sync_ignore_done(zio_t *zio)
 }
 
 /*
- * Write all even or odd labels to all leaves of the specified vdev.
+ * Write all even or odd labels to all leaves of the specified vdev.  The
+ * label describes the top-level config to which the leaves belong; it is
+ * generated once by the caller and only the identity of each leaf is
+ * filled in here, rather than regenerating the whole top-level vdev tree
+ * for every leaf.
  */
 static void
-vdev_label_sync(zio_t *zio, vdev_t *vd, int l, uint64_t txg, int flags)
+vdev_label_sync(zio_t *zio, vdev_t *vd, nvlist_t *label, int l, int flags)
 {
-	nvlist_t *label;
 	vdev_phys_t *vp;
 	abd_t *vp_abd;
 	char *buf;
@@ -1324,7 +1334,7 @@ vdev_label_sync(zio_t *zio, vdev_t *vd, int l, uint64_t txg, int flags)
 	int c;
 
 	for (c = 0; c < vd->vdev_children; c++)
-		vdev_label_sync(zio, vd->vdev_child[c], l, txg, flags);
+		vdev_label_sync(zio, vd->vdev_child[c], label, l, flags);
 
 	if (!vd->vdev_ops->vdev_op_leaf)
 		return;
@@ -1332,10 +1342,13 @@ vdev_label_sync(zio_t *zio, vdev_t *vd, int l, uint64_t txg, int flags)
 	if (!vdev_writeable(vd))
 		return;
 
-	/*
-	 * Generate a label describing the top-level config to which we belong.
-	 */
-	label = spa_config_generate(vd->vdev_spa, vd, txg, B_FALSE);
+	fnvlist_add_uint64(label, ZPOOL_CONFIG_GUID, vd->vdev_guid);
+	(void) nvlist_remove_all(label, ZPOOL_CONFIG_IS_SPARE);
+	if (vd->vdev_isspare)
+		fnvlist_add_uint64(label, ZPOOL_CONFIG_IS_SPARE, 1ULL);
+	(void) nvlist_remove_all(label, ZPOOL_CONFIG_IS_LOG);
+	if (vd->vdev_islog)
+		fnvlist_add_uint64(label, ZPOOL_CONFIG_IS_LOG, 1ULL);
 
 	vp_abd = abd_alloc_linear(sizeof (vdev_phys_t), B_TRUE);
 	abd_zero(vp_abd, sizeof (vdev_phys_t));
@@ -1355,7 +1368,6 @@ vdev_label_sync(zio_t *zio, vdev_t *vd, int l, uint64_t txg, int flags)
 	}
 
 	abd_free(vp_abd);
-	nvlist_free(label);
 }
 
 int
@@ -1373,6 +1385,7 @@ vdev_label_sync_list(spa_t *spa, int l, uint64_t txg, int flags)
 
 	for (vd = list_head(dl); vd != NULL; vd = list_next(dl, vd)) {
 		uint64_t *good_writes;
+		nvlist_t *label;
 		zio_t *vio;
 
 		ASSERT(!vd->vdev_ishole);
@@ -1382,7 +1395,9 @@ vdev_label_sync_list(spa_t *spa, int l, uint64_t txg, int flags)
 		    (vd->vdev_islog || vd->vdev_aux != NULL) ?
 		    vdev_label_sync_ignore_done : vdev_label_sync_top_done,
 		    good_writes, flags);
-		vdev_label_sync(vio, vd, l, txg, flags);
+		label = spa_config_generate(spa, vd, txg, B_FALSE);
+		vdev_label_sync(vio, vd, label, l, flags);
+		nvlist_free(label);
 		zio_nowait(vio);
 	}
 
@@ -1419,6 +1434,7 @@ vdev_config_sync(vdev_t **svd, int svdcount, uint64_t txg)
 	uberblock_t *ub = &spa->spa_uberblock;
 	vdev_t *vd;
 	zio_t *zio;
+	hrtime_t start = 0;
 	int error = 0;
 	int flags = ZIO_FLAG_CONFIG_WRITER | ZIO_FLAG_CANFAIL;
 
@@ -1431,8 +1447,10 @@ retry:
 	 * bailing out and declaring the pool faulted.
 	 */
 	if (error != 0) {
-		if ((flags & ZIO_FLAG_TRYHARD) != 0)
+		if ((flags & ZIO_FLAG_TRYHARD) != 0) {
+			spa_config_sync_add_nsecs(spa, gethrtime() - start);
 			return (error);
+		}
 		flags |= ZIO_FLAG_TRYHARD;
 	}
 
@@ -1457,6 +1475,9 @@ retry:
 
 	ASSERT(txg <= spa->spa_final_txg);
 
+	if (start == 0)
+		start = gethrtime();
+
 	/*
 	 * Flush the write cache of every disk that's been written to
 	 * in this transaction group.  This ensures that all blocks
@@ -1517,5 +1538,7 @@ retry:
 	if ((error = vdev_label_sync_list(spa, 1, txg, flags)) != 0)
 		goto retry;
 
+	spa_config_sync_add_nsecs(spa, gethrtime() - start);
+
 	return (0);
 }
@@ -78,6 +78,13 @@ static int zfs_vdev_mirror_rotating_seek_offset = 1 * 1024 * 1024;
 static int zfs_vdev_mirror_non_rotating_inc = 0;
 static int zfs_vdev_mirror_non_rotating_seek_inc = 1;
 
+/*
+ * Load increment of a child per multiple of the latency of the fastest
+ * child it is slower by, see vdev_mirror_latency_load().  0 disables it.
+ */
+static int zfs_vdev_mirror_latency_inc = 1;
+#define	VDEV_MIRROR_LATENCY_LOAD_MAX	1000
+
 static inline size_t
 vdev_mirror_map_size(int children)
 {
@@ -113,8 +120,28 @@ static const zio_vsd_ops_t vdev_mirror_vsd_ops = {
 	.vsd_cksum_report = zio_vsd_default_cksum_report
 };
 
+/*
+ * The queue length does not tell a disk that takes 10ms per i/o from one
+ * taking 100us, nor a disk going bad from its healthy twin.  A child whose
+ * average latency is k times that of the fastest child gets a load
+ * increment of (k - 1) * zfs_vdev_mirror_latency_inc, as if that many more
+ * i/os were queued on it.
+ */
 static int
-vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
+vdev_mirror_latency_load(vdev_t *vd, hrtime_t min_lat)
+{
+	hrtime_t lat = vdev_queue_latency(vd);
+
+	if (min_lat == 0 || lat <= min_lat)
+		return (0);
+
+	return (MIN((lat - min_lat) * zfs_vdev_mirror_latency_inc / min_lat,
+	    VDEV_MIRROR_LATENCY_LOAD_MAX));
+}
+
+static int
+vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset,
+    hrtime_t min_lat)
 {
 	uint64_t last_offset;
 	int64_t offset_diff;
@@ -134,8 +161,8 @@ vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
 	if (vd->vdev_ops->vdev_op_leaf)
 		zio_offset += VDEV_LABEL_START_SIZE;
 
-	/* Standard load based on pending queue length. */
-	load = vdev_queue_length(vd);
+	/* Standard load based on pending queue length and latency. */
+	load = vdev_queue_length(vd) + vdev_mirror_latency_load(vd, min_lat);
 	last_offset = vdev_queue_last_offset(vd);
 
 	if (vd->vdev_nonrot) {
@@ -348,10 +375,23 @@ vdev_mirror_child_select(zio_t *zio)
 {
 	mirror_map_t *mm = zio->io_vsd;
 	uint64_t txg = zio->io_txg;
+	hrtime_t lat, min_lat = 0;
 	int c, lowest_load;
 
 	ASSERT(zio->io_bp == NULL || BP_PHYSICAL_BIRTH(zio->io_bp) == txg);
 
+	/* Find the latency of the fastest child, loads are relative to it. */
+	for (c = 0; c < mm->mm_children && zfs_vdev_mirror_latency_inc != 0;
+	    c++) {
+		mirror_child_t *mc = &mm->mm_child[c];
+
+		if (mc->mc_tried || mc->mc_skipped || mc->mc_vd == NULL)
+			continue;
+		lat = vdev_queue_latency(mc->mc_vd);
+		if (lat != 0 && (min_lat == 0 || lat < min_lat))
+			min_lat = lat;
+	}
+
 	lowest_load = INT_MAX;
 	mm->mm_preferred_cnt = 0;
 	for (c = 0; c < mm->mm_children; c++) {
@@ -375,7 +415,8 @@ vdev_mirror_child_select(zio_t *zio)
 			continue;
 		}
 
-		mc->mc_load = vdev_mirror_load(mm, mc->mc_vd, mc->mc_offset);
+		mc->mc_load = vdev_mirror_load(mm, mc->mc_vd, mc->mc_offset,
+		    min_lat);
 		if (mc->mc_load > lowest_load)
 			continue;
 
@@ -667,5 +708,9 @@ MODULE_PARM_DESC(zfs_vdev_mirror_non_rotating_inc,
 module_param(zfs_vdev_mirror_non_rotating_seek_inc, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_mirror_non_rotating_seek_inc,
 	"Non-rotating media load increment for seeking I/O's");
+
+module_param(zfs_vdev_mirror_latency_inc, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_mirror_latency_inc,
+	"Load increment per multiple of the fastest child's latency");
 /* END CSTYLED */
 #endif
@@ -45,9 +45,9 @@
  *
  * ZFS issues I/O operations to leaf vdevs to satisfy and complete zios.  The
  * I/O scheduler determines when and in what order those operations are
- * issued.  The I/O scheduler divides operations into five I/O classes
+ * issued.  The I/O scheduler divides operations into six I/O classes
  * prioritized in the following order: sync read, sync write, async read,
- * async write, and scrub/resilver.  Each queue defines the minimum and
+ * async write, scrub/resilver and trim.  Each queue defines the minimum and
  * maximum number of concurrent operations that may be issued to the device.
  * In addition, the device has an aggregate maximum. Note that the sum of the
  * per-queue minimums must not exceed the aggregate maximum. If the
@@ -149,7 +149,8 @@ const uint32_t zfs_vdev_max_active = 128;
  * between reads, writes, and scrubs.  E.g., increasing
  * zfs_vdev_scrub_max_active will cause the scrub or resilver to complete
  * more quickly, but reads and writes to have higher latency and lower
- * throughput.
+ * throughput.  Trims are kept to a couple at a time, as many devices cannot
+ * service other i/o well while discarding.
  */
 uint32_t zfs_vdev_sync_read_min_active = 10;
 uint32_t zfs_vdev_sync_read_max_active = 20;
@@ -161,6 +162,47 @@ uint32_t zfs_vdev_async_write_min_active = 2;
 uint32_t zfs_vdev_async_write_max_active = 20;
 uint32_t zfs_vdev_scrub_min_active = 1;
 uint32_t zfs_vdev_scrub_max_active = 4;
+uint32_t zfs_vdev_trim_min_active = 1;
+uint32_t zfs_vdev_trim_max_active = 2;
+
+/*
+ * The max_active of the queues above is scaled per device, between
+ * zfs_vdev_adaptive_min_pct and zfs_vdev_adaptive_max_pct percent, by the
+ * latency the device shows.  In each interval of
+ * zfs_vdev_adaptive_interval_ms the lowest latency of the completed i/os
+ * is compared with the lowest seen in recent intervals.  If it is
+ * more than zfs_vdev_adaptive_latency_pct percent of that baseline, i/os
+ * queue up in the device itself and the depth is cut by an eighth.
+ * Otherwise, if a queue was held back by its max_active, the depth grows
+ * by a tenth of the static limits.  As with CoDel, the lowest latency of
+ * an interval only rises when there is a standing queue, so bursts do not
+ * shrink the depth, while a device which keeps up gets as deep a queue
+ * as the load offers.
+ */
+int zfs_vdev_adaptive_max_active = 1;
+int zfs_vdev_adaptive_interval_ms = 100;
+int zfs_vdev_adaptive_latency_pct = 200;
+uint32_t zfs_vdev_adaptive_min_pct = 25;
+uint32_t zfs_vdev_adaptive_max_pct = 400;
+
+/*
+ * The synchronous classes can also be given a deadline.  An i/o which has
+ * been queued for longer than its class's deadline is issued ahead of the
+ * class order and even when its class is at max_active, as long as the
+ * device is below zfs_vdev_max_active.  This bounds the tail latency of
+ * e.g. the ZIL writes of a replica while a rebuild keeps the device busy.
+ * Expired i/os are still aggregated with their neighbours.  A deadline of
+ * zero disables it for the class.
+ */
+int zfs_vdev_sync_read_deadline_ms = 0;
+int zfs_vdev_sync_write_deadline_ms = 10;
+
+/* Fewer completions than this in an interval are not acted upon */
+#define	VDEV_QUEUE_ADAPT_MIN_SAMPLES	16
+/* Intervals after which the baseline latency is measured again */
+#define	VDEV_QUEUE_ADAPT_BASE_INTERVALS	100
+/* Inverse of the weight of an i/o in the average latency */
+#define	VDEV_QUEUE_LAT_EWMA_WEIGHT	8
 
 /*
  * When the pool has less than zfs_vdev_async_write_active_min_dirty_percent
@@ -176,9 +218,12 @@ int zfs_vdev_async_write_active_max_dirty_percent = 60;
  * To reduce IOPs, we aggregate small adjacent I/Os into one large I/O.
  * For read I/Os, we also aggregate across small adjacency gaps; for writes
  * we include spans of optional I/Os to aid aggregation at the disk even when
- * they aren't able to help us aggregate at this level.
+ * they aren't able to help us aggregate at this level.  I/Os of all classes
+ * of one type are merged.  An aggregate is not a block, so it is bounded by
+ * SPA_MAXBLOCKSIZE rather than the pool's largest block size, and by the
+ * largest transfer the device takes, where it reports one.
  */
-int zfs_vdev_aggregation_limit = SPA_OLD_MAXBLOCKSIZE;
+int zfs_vdev_aggregation_limit = 1 << 20;
 int zfs_vdev_read_gap_limit = 32 << 10;
 int zfs_vdev_write_gap_limit = 4 << 10;
 
@@ -198,6 +243,15 @@ int zfs_vdev_queue_depth_pct = 1000;
 int zfs_vdev_queue_depth_pct = 300;
 #endif
 
+/*
+ * When there are multiple metaslab allocators, each of them starts out
+ * allowed zfs_vdev_def_queue_depth allocations per top-level vdev, rather
+ * than the full queue depth above.  The limit of an allocator grows by one
+ * for each of its allocations that completes, so busy allocators still
+ * reach the full depth while idle ones don't hold slots they won't use.
+ */
+int zfs_vdev_def_queue_depth = 32;
+
 
 int
 vdev_queue_offset_compare(const void *x1, const void *x2)
@@ -222,11 +276,14 @@ vdev_queue_class_tree(vdev_queue_t *vq, zio_priority_t p)
 static inline avl_tree_t *
 vdev_queue_type_tree(vdev_queue_t *vq, zio_type_t t)
 {
-	ASSERT(t == ZIO_TYPE_READ || t == ZIO_TYPE_WRITE);
+	ASSERT(t == ZIO_TYPE_READ || t == ZIO_TYPE_WRITE ||
+	    t == ZIO_TYPE_IOCTL);
 	if (t == ZIO_TYPE_READ)
 		return (&vq->vq_read_offset_tree);
-	else
+	else if (t == ZIO_TYPE_WRITE)
 		return (&vq->vq_write_offset_tree);
+	else
+		return (&vq->vq_trim_offset_tree);
 }
 
 int
@@ -243,6 +300,20 @@ vdev_queue_timestamp_compare(const void *x1, const void *x2)
 	return (AVL_PCMP(z1, z2));
 }
 
+static int
+vdev_queue_deadline_compare(const void *x1, const void *x2)
+{
+	const zio_t *z1 = (const zio_t *)x1;
+	const zio_t *z2 = (const zio_t *)x2;
+
+	int cmp = AVL_CMP(z1->io_deadline, z2->io_deadline);
+
+	if (likely(cmp))
+		return (cmp);
+
+	return (AVL_PCMP(z1, z2));
+}
+
 static int
 vdev_queue_class_min_active(zio_priority_t p)
 {
@@ -257,12 +328,27 @@ vdev_queue_class_min_active(zio_priority_t p)
 		return (zfs_vdev_async_write_min_active);
 	case ZIO_PRIORITY_SCRUB:
 		return (zfs_vdev_scrub_min_active);
+	case ZIO_PRIORITY_TRIM:
+		return (zfs_vdev_trim_min_active);
 	default:
 		panic("invalid priority %u", p);
 		return (0);
 	}
 }
 
+static int
+vdev_queue_class_deadline_ms(zio_priority_t p)
+{
+	switch (p) {
+	case ZIO_PRIORITY_SYNC_READ:
+		return (zfs_vdev_sync_read_deadline_ms);
+	case ZIO_PRIORITY_SYNC_WRITE:
+		return (zfs_vdev_sync_write_deadline_ms);
+	default:
+		return (0);
+	}
+}
+
 static int
 vdev_queue_max_async_writes(spa_t *spa)
 {
@@ -312,23 +398,83 @@ vdev_queue_max_async_writes(spa_t *spa)
 }
 
 static int
-vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
+vdev_queue_class_max_active(vdev_queue_t *vq, spa_t *spa, zio_priority_t p)
 {
+	int max;
+
 	switch (p) {
 	case ZIO_PRIORITY_SYNC_READ:
-		return (zfs_vdev_sync_read_max_active);
+		max = zfs_vdev_sync_read_max_active;
+		break;
 	case ZIO_PRIORITY_SYNC_WRITE:
-		return (zfs_vdev_sync_write_max_active);
+		max = zfs_vdev_sync_write_max_active;
+		break;
 	case ZIO_PRIORITY_ASYNC_READ:
-		return (zfs_vdev_async_read_max_active);
+		max = zfs_vdev_async_read_max_active;
+		break;
 	case ZIO_PRIORITY_ASYNC_WRITE:
-		return (vdev_queue_max_async_writes(spa));
+		max = vdev_queue_max_async_writes(spa);
+		break;
 	case ZIO_PRIORITY_SCRUB:
-		return (zfs_vdev_scrub_max_active);
+		max = zfs_vdev_scrub_max_active;
+		break;
+	case ZIO_PRIORITY_TRIM:
+		max = zfs_vdev_trim_max_active;
+		break;
 	default:
 		panic("invalid priority %u", p);
 		return (0);
 	}
+
+	if (zfs_vdev_adaptive_max_active && vq->vq_depth_pct != 100) {
+		max = MAX((uint64_t)max * vq->vq_depth_pct / 100,
+		    vdev_queue_class_min_active(p));
+	}
+
+	return (max);
+}
+
+/*
+ * Called with the latency of each completed i/o, adjusts vq_depth_pct once
+ * an interval.
+ */
+static void
+vdev_queue_adapt(vdev_queue_t *vq, hrtime_t lat, hrtime_t now)
+{
+	uint32_t pct = vq->vq_depth_pct;
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (vq->vq_depth_samples++ == 0 || lat < vq->vq_depth_min_lat)
+		vq->vq_depth_min_lat = lat;
+	if (now - vq->vq_depth_start < MSEC2NSEC(zfs_vdev_adaptive_interval_ms))
+		return;
+
+	if (vq->vq_depth_samples >= VDEV_QUEUE_ADAPT_MIN_SAMPLES) {
+		/*
+		 * Measure the baseline again now and then, so that it
+		 * follows a device which permanently got slower.
+		 */
+		if (vq->vq_depth_base_lat == 0 ||
+		    vq->vq_depth_min_lat < vq->vq_depth_base_lat ||
+		    ++vq->vq_depth_intervals >=
+		    VDEV_QUEUE_ADAPT_BASE_INTERVALS) {
+			vq->vq_depth_base_lat = vq->vq_depth_min_lat;
+			vq->vq_depth_intervals = 0;
+		}
+
+		if (vq->vq_depth_min_lat > vq->vq_depth_base_lat *
+		    zfs_vdev_adaptive_latency_pct / 100)
+			pct -= pct / 8;
+		else if (vq->vq_depth_limited)
+			pct += 10;
+		vq->vq_depth_pct = MIN(MAX(pct, zfs_vdev_adaptive_min_pct),
+		    MAX(zfs_vdev_adaptive_max_pct, zfs_vdev_adaptive_min_pct));
+	}
+
+	vq->vq_depth_start = now;
+	vq->vq_depth_samples = 0;
+	vq->vq_depth_limited = B_FALSE;
 }
 
 /*
@@ -357,10 +503,12 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 	 * maximum # outstanding i/os.
 	 */
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
-		if (avl_numnodes(vdev_queue_class_tree(vq, p)) > 0 &&
-		    vq->vq_class[p].vqc_active <
-		    vdev_queue_class_max_active(spa, p))
+		if (avl_numnodes(vdev_queue_class_tree(vq, p)) == 0)
+			continue;
+		if (vq->vq_class[p].vqc_active <
+		    vdev_queue_class_max_active(vq, spa, p))
 			return (p);
+		vq->vq_depth_limited = B_TRUE;
 	}
 
 	/* No eligible queued i/os */
@@ -385,6 +533,11 @@ vdev_queue_init(vdev_t *vd)
 	avl_create(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE),
 	    vdev_queue_offset_compare, sizeof (zio_t),
 	    offsetof(struct zio, io_offset_node));
+	avl_create(vdev_queue_type_tree(vq, ZIO_TYPE_IOCTL),
+	    vdev_queue_offset_compare, sizeof (zio_t),
+	    offsetof(struct zio, io_offset_node));
+	avl_create(&vq->vq_deadline_tree, vdev_queue_deadline_compare,
+	    sizeof (zio_t), offsetof(struct zio, io_deadline_node));
 
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
 		int (*compfn) (const void *, const void *);
@@ -403,6 +556,29 @@ vdev_queue_init(vdev_t *vd)
 	}
 
 	vq->vq_last_offset = 0;
+	vq->vq_depth_pct = 100;
+	vq->vq_depth_start = gethrtime();
+
+	/*
+	 * Leaf vdevs export their own wait and run queue statistics next to
+	 * the pool's "io" kstat.  They are updated under vq_lock, which the
+	 * queue holds anyway, so they cost no extra locking.
+	 */
+	if (vd->vdev_ops->vdev_op_leaf) {
+		char module[KSTAT_STRLEN], name[KSTAT_STRLEN];
+
+		(void) snprintf(module, KSTAT_STRLEN, "zfs/%s",
+		    spa_name(vd->vdev_spa));
+		(void) snprintf(name, KSTAT_STRLEN, "vdev-%llu",
+		    (u_longlong_t)vd->vdev_guid);
+		vq->vq_io_kstat = kstat_create(module, 0, name, "disk",
+		    KSTAT_TYPE_IO, 1, KSTAT_FLAG_VIRTUAL);
+		if (vq->vq_io_kstat != NULL) {
+			vq->vq_io_kstat->ks_data = &vq->vq_io_stats;
+			vq->vq_io_kstat->ks_lock = &vq->vq_lock;
+			kstat_install(vq->vq_io_kstat);
+		}
+	}
 }
 
 void
@@ -411,11 +587,18 @@ vdev_queue_fini(vdev_t *vd)
 	vdev_queue_t *vq = &vd->vdev_queue;
 	zio_priority_t p;
 
+	if (vq->vq_io_kstat != NULL) {
+		kstat_delete(vq->vq_io_kstat);
+		vq->vq_io_kstat = NULL;
+	}
+
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++)
 		avl_destroy(vdev_queue_class_tree(vq, p));
 	avl_destroy(&vq->vq_active_tree);
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_READ));
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE));
+	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_IOCTL));
+	avl_destroy(&vq->vq_deadline_tree);
 
 	mutex_destroy(&vq->vq_lock);
 }
@@ -429,6 +612,9 @@ vdev_queue_io_add(vdev_queue_t *vq, zio_t *zio)
 	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
 	avl_add(vdev_queue_class_tree(vq, zio->io_priority), zio);
 	avl_add(vdev_queue_type_tree(vq, zio->io_type), zio);
+	if (zio->io_deadline != 0)
+		avl_add(&vq->vq_deadline_tree, zio);
+	kstat_waitq_enter(&vq->vq_io_stats);
 
 	if (ssh->kstat != NULL) {
 		mutex_enter(&ssh->lock);
@@ -446,6 +632,10 @@ vdev_queue_io_remove(vdev_queue_t *vq, zio_t *zio)
 	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
 	avl_remove(vdev_queue_class_tree(vq, zio->io_priority), zio);
 	avl_remove(vdev_queue_type_tree(vq, zio->io_type), zio);
+	if (zio->io_deadline != 0)
+		avl_remove(&vq->vq_deadline_tree, zio);
+	zio->io_deadline = 0;
+	kstat_waitq_exit(&vq->vq_io_stats);
 
 	if (ssh->kstat != NULL) {
 		mutex_enter(&ssh->lock);
@@ -464,6 +654,7 @@ vdev_queue_pending_add(vdev_queue_t *vq, zio_t *zio)
 	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
 	vq->vq_class[zio->io_priority].vqc_active++;
 	avl_add(&vq->vq_active_tree, zio);
+	kstat_runq_enter(&vq->vq_io_stats);
 
 	if (ssh->kstat != NULL) {
 		mutex_enter(&ssh->lock);
@@ -482,6 +673,14 @@ vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
 	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
 	vq->vq_class[zio->io_priority].vqc_active--;
 	avl_remove(&vq->vq_active_tree, zio);
+	kstat_runq_exit(&vq->vq_io_stats);
+	if (zio->io_type == ZIO_TYPE_READ) {
+		vq->vq_io_stats.reads++;
+		vq->vq_io_stats.nread += zio->io_size;
+	} else if (zio->io_type == ZIO_TYPE_WRITE) {
+		vq->vq_io_stats.writes++;
+		vq->vq_io_stats.nwritten += zio->io_size;
+	}
 
 	if (ssh->kstat != NULL) {
 		kstat_io_t *ksio = ssh->kstat->ks_data;
@@ -502,15 +701,10 @@ vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
 static void
 vdev_queue_agg_io_done(zio_t *aio)
 {
-	if (aio->io_type == ZIO_TYPE_READ) {
-		zio_t *pio;
-		zio_link_t *zl = NULL;
-		while ((pio = zio_walk_parents(aio, &zl)) != NULL) {
-			abd_copy_off(pio->io_abd, aio->io_abd,
-			    0, pio->io_offset - aio->io_offset, pio->io_size);
-		}
-	}
-
+	/*
+	 * The aggregated ABD is a gang of the delegated I/Os' own buffers,
+	 * so reads have already landed where they belong.
+	 */
 	abd_free(aio->io_abd);
 }
 
@@ -529,19 +723,26 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	zio_t *first, *last, *aio, *dio, *mandatory, *nio;
 	uint64_t maxgap = 0;
 	uint64_t size;
+	uint64_t next_offset;
 	uint64_t limit;
-	int maxblocksize;
+	uint64_t maxsize;
 	boolean_t stretch = B_FALSE;
 	avl_tree_t *t = vdev_queue_type_tree(vq, zio->io_type);
 	enum zio_flag flags = zio->io_flags & ZIO_FLAG_AGG_INHERIT;
 	abd_t *abd;
 
-	maxblocksize = spa_maxblocksize(vq->vq_vdev->vdev_spa);
-	limit = MAX(MIN(zfs_vdev_aggregation_limit, maxblocksize), 0);
+	maxsize = SPA_MAXBLOCKSIZE;
+	if (vq->vq_vdev->vdev_max_transfer != 0)
+		maxsize = MIN(maxsize, vq->vq_vdev->vdev_max_transfer);
+	limit = MIN(MAX(zfs_vdev_aggregation_limit, 0), maxsize);
 
 	if (zio->io_flags & ZIO_FLAG_DONT_AGGREGATE || limit == 0)
 		return (NULL);
 
+	/* Trims have no data, and are already as large as they can be */
+	if (zio->io_type == ZIO_TYPE_IOCTL)
+		return (NULL);
+
 	first = last = zio;
 
 	if (zio->io_type == ZIO_TYPE_READ)
@@ -594,7 +795,7 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	    (dio->io_flags & ZIO_FLAG_AGG_INHERIT) == flags &&
 	    (IO_SPAN(first, dio) <= limit ||
 	    (dio->io_flags & ZIO_FLAG_OPTIONAL)) &&
-	    IO_SPAN(first, dio) <= maxblocksize &&
+	    IO_SPAN(first, dio) <= maxsize &&
 	    IO_GAP(last, dio) <= maxgap) {
 		last = dio;
 		if (!(last->io_flags & ZIO_FLAG_OPTIONAL))
@@ -646,11 +847,43 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 		return (NULL);
 
 	size = IO_SPAN(first, last);
-	ASSERT3U(size, <=, maxblocksize);
+	ASSERT3U(size, <=, maxsize);
 
-	abd = abd_alloc_for_io(size, B_TRUE);
-	if (abd == NULL)
-		return (NULL);
+	/*
+	 * Chain the buffers of the I/Os together rather than copying them
+	 * into one large buffer. Only read gaps and the empty buffers of
+	 * optional writes need memory of their own.
+	 */
+	abd = abd_alloc_gang();
+	next_offset = first->io_offset;
+	nio = first;
+	do {
+		dio = nio;
+		nio = AVL_NEXT(t, dio);
+
+		if (dio->io_offset != next_offset) {
+			ASSERT3U(dio->io_type, ==, ZIO_TYPE_READ);
+			ASSERT3U(dio->io_offset, >, next_offset);
+			abd_gang_add(abd, abd_alloc_for_io(
+			    dio->io_offset - next_offset, B_TRUE), B_TRUE);
+		}
+		if (dio->io_flags & ZIO_FLAG_NODATA) {
+			abd_t *zabd;
+
+			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
+			zabd = abd_alloc_for_io(dio->io_size, B_TRUE);
+			abd_zero(zabd, dio->io_size);
+			abd_gang_add(abd, zabd, B_TRUE);
+		} else if (dio->io_abd->abd_size != dio->io_size) {
+			ASSERT3U(dio->io_abd->abd_size, >, dio->io_size);
+			abd_gang_add(abd, abd_get_offset_size(dio->io_abd, 0,
+			    dio->io_size), B_TRUE);
+		} else {
+			abd_gang_add(abd, dio->io_abd, B_FALSE);
+		}
+		next_offset = dio->io_offset + dio->io_size;
+	} while (dio != last);
+	ASSERT3U(abd->abd_size, ==, size);
 
 	aio = zio_vdev_delegated_io(first->io_vd, first->io_offset,
 	    abd, size, first->io_type, zio->io_priority,
@@ -664,16 +897,8 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 		nio = AVL_NEXT(t, dio);
 		ASSERT3U(dio->io_type, ==, aio->io_type);
 
-		if (dio->io_flags & ZIO_FLAG_NODATA) {
-			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
-			abd_zero_off(aio->io_abd,
-			    dio->io_offset - aio->io_offset, dio->io_size);
-		} else if (dio->io_type == ZIO_TYPE_WRITE) {
-			abd_copy_off(aio->io_abd, dio->io_abd,
-			    dio->io_offset - aio->io_offset, 0, dio->io_size);
-		}
-
 		zio_add_child(dio, aio);
+		vq->vq_class[dio->io_priority].vqc_merged++;
 		vdev_queue_io_remove(vq, dio);
 		zio_vdev_io_bypass(dio);
 		zio_execute(dio);
@@ -682,6 +907,25 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	return (aio);
 }
 
+/*
+ * Return the queued i/o with the earliest deadline if that has passed and
+ * the device can take another i/o.
+ */
+static zio_t *
+vdev_queue_deadline_io(vdev_queue_t *vq)
+{
+	zio_t *zio;
+
+	if (avl_numnodes(&vq->vq_active_tree) >= zfs_vdev_max_active)
+		return (NULL);
+
+	zio = avl_first(&vq->vq_deadline_tree);
+	if (zio == NULL || zio->io_deadline > gethrtime())
+		return (NULL);
+
+	return (zio);
+}
+
 static zio_t *
 vdev_queue_io_to_issue(vdev_queue_t *vq)
 {
@@ -693,6 +937,16 @@ vdev_queue_io_to_issue(vdev_queue_t *vq)
 again:
 	ASSERT(MUTEX_HELD(&vq->vq_lock));
 
+	/*
+	 * An i/o which is past its deadline goes first, whatever the
+	 * state of its class.
+	 */
+	zio = vdev_queue_deadline_io(vq);
+	if (zio != NULL) {
+		p = zio->io_priority;
+		goto issue;
+	}
+
 	p = vdev_queue_class_to_issue(vq);
 
 	if (p == ZIO_PRIORITY_NUM_QUEUEABLE) {
@@ -713,6 +967,7 @@ again:
 	zio = avl_nearest(tree, idx, AVL_AFTER);
 	if (zio == NULL)
 		zio = avl_first(tree);
+issue:
 	ASSERT3U(zio->io_priority, ==, p);
 
 	aio = vdev_queue_aggregate(vq, zio);
@@ -746,6 +1001,7 @@ vdev_queue_io(zio_t *zio)
 {
 	vdev_queue_t *vq = &zio->io_vd->vdev_queue;
 	zio_t *nio;
+	int deadline;
 
 	if (zio->io_flags & ZIO_FLAG_DONT_QUEUE)
 		return (zio);
@@ -759,17 +1015,26 @@ vdev_queue_io(zio_t *zio)
 		    zio->io_priority != ZIO_PRIORITY_ASYNC_READ &&
 		    zio->io_priority != ZIO_PRIORITY_SCRUB)
 			zio->io_priority = ZIO_PRIORITY_ASYNC_READ;
-	} else {
-		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
+	} else if (zio->io_type == ZIO_TYPE_WRITE) {
 		if (zio->io_priority != ZIO_PRIORITY_SYNC_WRITE &&
 		    zio->io_priority != ZIO_PRIORITY_ASYNC_WRITE)
 			zio->io_priority = ZIO_PRIORITY_ASYNC_WRITE;
+	} else {
+		ASSERT(ZIO_IS_TRIM(zio));
+		zio->io_priority = ZIO_PRIORITY_TRIM;
 	}
 
 	zio->io_flags |= ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE;
 
 	mutex_enter(&vq->vq_lock);
 	zio->io_timestamp = gethrtime();
+	/*
+	 * A deadline set by the issuer, e.g. for MMP writes, overrides the
+	 * one of the class.
+	 */
+	deadline = vdev_queue_class_deadline_ms(zio->io_priority);
+	if (zio->io_deadline == 0 && deadline > 0)
+		zio->io_deadline = zio->io_timestamp + MSEC2NSEC(deadline);
 	vdev_queue_io_add(vq, zio);
 	nio = vdev_queue_io_to_issue(vq);
 	mutex_exit(&vq->vq_lock);
@@ -799,6 +1064,38 @@ vdev_queue_io_done(zio_t *zio)
 	vq->vq_io_complete_ts = gethrtime();
 	vq->vq_io_delta_ts = vq->vq_io_complete_ts - zio->io_timestamp;
 
+	/*
+	 * io_delay is the time spent in the device, unless aggregated.  Trims
+	 * are left out, their latency says little about that of other i/o.
+	 */
+	if (zfs_vdev_adaptive_max_active && zio->io_delay != 0 &&
+	    zio->io_type != ZIO_TYPE_IOCTL)
+		vdev_queue_adapt(vq, zio->io_delay, vq->vq_io_complete_ts);
+
+	/*
+	 * Keep an exponentially weighted average of the device latency, each
+	 * i/o weighing 1/VDEV_QUEUE_LAT_EWMA_WEIGHT.  Mirrors use it to steer
+	 * reads away from slow children.
+	 */
+	if (zio->io_delay != 0 && zio->io_type != ZIO_TYPE_IOCTL) {
+		if (vq->vq_lat_ewma == 0)
+			vq->vq_lat_ewma = zio->io_delay;
+		else
+			vq->vq_lat_ewma += (zio->io_delay - vq->vq_lat_ewma) /
+			    VDEV_QUEUE_LAT_EWMA_WEIGHT;
+	}
+
+	/*
+	 * While a scan paces itself by foreground latency, count the sync
+	 * reads and those that missed the goal, including their queueing.
+	 */
+	if (zio->io_priority == ZIO_PRIORITY_SYNC_READ &&
+	    zio->io_spa->spa_scan_lat_target != 0) {
+		atomic_inc_64(&zio->io_spa->spa_scan_lat_reads);
+		if (zio->io_delta > zio->io_spa->spa_scan_lat_target)
+			atomic_inc_64(&zio->io_spa->spa_scan_lat_slow);
+	}
+
 	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
 		mutex_exit(&vq->vq_lock);
 		if (nio->io_done == vdev_queue_agg_io_done) {
@@ -831,6 +1128,15 @@ vdev_queue_last_offset(vdev_t *vd)
 	return (vd->vdev_queue.vq_last_offset);
 }
 
+/*
+ * The average latency of the device, or 0 if it has not done any i/o.
+ */
+hrtime_t
+vdev_queue_latency(vdev_t *vd)
+{
+	return (vd->vdev_queue.vq_lat_ewma);
+}
+
 #if defined(_KERNEL) && defined(HAVE_SPL)
 module_param(zfs_vdev_aggregation_limit, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_aggregation_limit, "Max vdev I/O aggregation size");
@@ -874,6 +1180,12 @@ MODULE_PARM_DESC(zfs_vdev_scrub_max_active, "Max active scrub I/Os per vdev");
 module_param(zfs_vdev_scrub_min_active, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_scrub_min_active, "Min active scrub I/Os per vdev");
 
+module_param(zfs_vdev_trim_max_active, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_trim_max_active, "Max active trim I/Os per vdev");
+
+module_param(zfs_vdev_trim_min_active, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_trim_min_active, "Min active trim I/Os per vdev");
+
 module_param(zfs_vdev_sync_read_max_active, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_sync_read_max_active,
 	"Max active sync read I/Os per vdev");
@@ -893,4 +1205,38 @@ MODULE_PARM_DESC(zfs_vdev_sync_write_min_active,
 module_param(zfs_vdev_queue_depth_pct, int, 0644);
 MODULE_PARM_DESC(zfs_vdev_queue_depth_pct,
 	"Queue depth percentage for each top-level vdev");
+
+module_param(zfs_vdev_def_queue_depth, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_def_queue_depth,
+	"Default queue depth of each metaslab allocator per top-level vdev");
+
+module_param(zfs_vdev_adaptive_max_active, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_adaptive_max_active,
+	"Scale per-vdev max active I/Os by device latency");
+
+module_param(zfs_vdev_adaptive_interval_ms, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_adaptive_interval_ms,
+	"Interval of the adaptive max active controller");
+
+module_param(zfs_vdev_adaptive_latency_pct, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_adaptive_latency_pct,
+	"Latency, relative to the baseline, above which max active shrinks");
+
+/* CSTYLED */
+module_param(zfs_vdev_adaptive_min_pct, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_adaptive_min_pct,
+	"Lowest adaptive scale of max active, in percent");
+
+/* CSTYLED */
+module_param(zfs_vdev_adaptive_max_pct, uint, 0644);
+MODULE_PARM_DESC(zfs_vdev_adaptive_max_pct,
+	"Highest adaptive scale of max active, in percent");
+
+module_param(zfs_vdev_sync_read_deadline_ms, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_sync_read_deadline_ms,
+	"Deadline of sync read I/Os, in milliseconds, 0 to disable");
+
+module_param(zfs_vdev_sync_write_deadline_ms, int, 0644);
+MODULE_PARM_DESC(zfs_vdev_sync_write_deadline_ms,
+	"Deadline of sync write I/Os, in milliseconds, 0 to disable");
 #endif
@@ -63,6 +63,9 @@ const raidz_impl_ops_t *raidz_all_maths[] = {
 #if defined(__x86_64) && defined(HAVE_AVX512BW)	/* only x86_64 for now */
 	&vdev_raidz_avx512bw_impl,
 #endif
+#if defined(__x86_64) && defined(HAVE_AVX512BW) && defined(HAVE_GFNI)
+	&vdev_raidz_gfni_impl,
+#endif
 #if defined(__aarch64__)
 	&vdev_raidz_aarch64_neon_impl,
 	&vdev_raidz_aarch64_neonx2_impl,
@@ -0,0 +1,463 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/vdev_trim.h>
+#include <sys/metaslab_impl.h>
+#include <sys/range_tree.h>
+#include <sys/zio.h>
+
+/*
+ * TRIM of free space.
+ *
+ * An SSD which is told which of its blocks no longer hold data has more
+ * room to garbage collect in, and keeps its write performance as it fills
+ * up.  The pool's trim thread tells it, one metaslab at a time: the free
+ * space of a metaslab is copied aside, the metaslab is kept from being
+ * allocated from while its trims are in flight, and each free extent is
+ * trimmed on the leaf vdevs below the top-level vdev.
+ *
+ * A manual trim, started by 'zpool trim', trims all of the free space of
+ * the pool once.  With the autotrim pool property on, the space freed by
+ * each txg is queued on its metaslab instead, and the queued space of all
+ * metaslabs is trimmed every zfs_trim_txg_batch txgs.  The queue is kept
+ * in core only, so space freed shortly before an export is not trimmed
+ * until the next manual trim.
+ *
+ * Trims are ioctl zios which are queued by the vdev queue in their own,
+ * lowest priority class.  A device which fails them as unsupported is not
+ * sent any more.
+ */
+
+/*
+ * Largest trim issued to a device; larger extents are split.
+ */
+unsigned int zfs_trim_extent_bytes_max = 16 * 1024 * 1024;
+
+/*
+ * Smallest free extent trimmed.  Small discards are ignored or handled
+ * poorly by many devices.
+ */
+unsigned int zfs_trim_extent_bytes_min = 32 * 1024;
+
+/*
+ * Number of txgs whose frees autotrim collects before trimming them.
+ */
+unsigned int zfs_trim_txg_batch = 32;
+
+/*
+ * Trim rate in bytes per second, of autotrim and of manual trims started
+ * without one.  Zero is unlimited.
+ */
+unsigned long zfs_trim_rate = 0;
+
+typedef struct vdev_trim_arg {
+	zio_t		*vta_zio;	/* parent of the trims */
+	vdev_t		*vta_vd;	/* top-level vdev */
+	uint64_t	vta_extent_max;
+	uint64_t	vta_bytes;	/* bytes trimmed */
+} vdev_trim_arg_t;
+
+static void vdev_trim_thread(spa_t *spa);
+
+void
+vdev_trim_init(spa_t *spa)
+{
+	trim_thread_t *tt = &spa->spa_trim;
+
+	mutex_init(&tt->tt_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&tt->tt_cv, NULL, CV_DEFAULT, NULL);
+}
+
+void
+vdev_trim_fini(spa_t *spa)
+{
+	trim_thread_t *tt = &spa->spa_trim;
+
+	ASSERT3P(tt->tt_thread, ==, NULL);
+	mutex_destroy(&tt->tt_lock);
+	cv_destroy(&tt->tt_cv);
+}
+
+static void
+vdev_trim_thread_enter(trim_thread_t *tt, callb_cpr_t *cpr)
+{
+	CALLB_CPR_INIT(cpr, &tt->tt_lock, callb_generic_cpr, FTAG);
+	mutex_enter(&tt->tt_lock);
+}
+
+static void
+vdev_trim_thread_exit(trim_thread_t *tt, kthread_t **tpp, callb_cpr_t *cpr)
+{
+	ASSERT(*tpp != NULL);
+	*tpp = NULL;
+	cv_broadcast(&tt->tt_cv);
+	CALLB_CPR_EXIT(cpr);		/* drops &tt->tt_lock */
+	thread_exit();
+}
+
+void
+vdev_trim_thread_start(spa_t *spa)
+{
+	trim_thread_t *tt = &spa->spa_trim;
+
+	if (spa_writeable(spa)) {
+		mutex_enter(&tt->tt_lock);
+		if (!tt->tt_thread) {
+			tt->tt_thread = thread_create(NULL, 0,
+			    vdev_trim_thread, spa, 0, &p0, TS_RUN,
+			    minclsyspri);
+		}
+		mutex_exit(&tt->tt_lock);
+	}
+}
+
+void
+vdev_trim_thread_stop(spa_t *spa)
+{
+	trim_thread_t *tt = &spa->spa_trim;
+
+	mutex_enter(&tt->tt_lock);
+	tt->tt_exiting = B_TRUE;
+	cv_broadcast(&tt->tt_cv);
+
+	while (tt->tt_thread) {
+		cv_wait(&tt->tt_cv, &tt->tt_lock);
+	}
+	mutex_exit(&tt->tt_lock);
+
+	ASSERT(tt->tt_thread == NULL);
+	tt->tt_exiting = B_FALSE;
+}
+
+/*
+ * Wake the trim thread to have it look at the autotrim property again.
+ */
+void
+vdev_trim_wakeup(spa_t *spa)
+{
+	trim_thread_t *tt = &spa->spa_trim;
+
+	mutex_enter(&tt->tt_lock);
+	cv_broadcast(&tt->tt_cv);
+	mutex_exit(&tt->tt_lock);
+}
+
+/*
+ * A pass ends early when the pool is unloaded or, for a manual trim, when
+ * it is stopped.  An automatic pass gives way to a manual trim, which
+ * covers the same space.
+ */
+static boolean_t
+vdev_trim_stopping(trim_thread_t *tt, boolean_t manual)
+{
+	ASSERT(MUTEX_HELD(&tt->tt_lock));
+
+	return (tt->tt_exiting || (manual ? tt->tt_stop : tt->tt_manual));
+}
+
+/*
+ * Trim the range of vd, in the offsets of vd, on all leaves below it.
+ */
+static void
+vdev_trim_issue(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size)
+{
+	uint64_t c;
+
+	if (vd->vdev_ops->vdev_op_leaf) {
+		if (vd->vdev_notrim || !vdev_writeable(vd))
+			return;
+		zio_nowait(zio_trim(pio, vd->vdev_spa, vd,
+		    offset + VDEV_LABEL_START_SIZE, size, NULL, NULL,
+		    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+		    ZIO_FLAG_DONT_RETRY));
+		return;
+	}
+
+	if (vd->vdev_ops == &vdev_raidz_ops) {
+		/*
+		 * Sector b of a raidz vdev is sector b / dcols of child
+		 * b % dcols, parity included, so the sectors of a range on
+		 * each child are contiguous as well.
+		 */
+		uint64_t shift = vd->vdev_top->vdev_ashift;
+		uint64_t dcols = vd->vdev_children;
+		uint64_t b = offset >> shift;
+		uint64_t e = (offset + size) >> shift;
+
+		for (c = 0; c < dcols; c++) {
+			uint64_t lo = b > c ? (b - c + dcols - 1) / dcols : 0;
+			uint64_t hi = e > c ? (e - c + dcols - 1) / dcols : 0;
+
+			if (hi > lo) {
+				vdev_trim_issue(pio, vd->vdev_child[c],
+				    lo << shift, (hi - lo) << shift);
+			}
+		}
+		return;
+	}
+
+	/* mirror, replacing and spare vdevs have the same range on each */
+	for (c = 0; c < vd->vdev_children; c++)
+		vdev_trim_issue(pio, vd->vdev_child[c], offset, size);
+}
+
+static void
+vdev_trim_range(void *arg, uint64_t start, uint64_t size)
+{
+	vdev_trim_arg_t *vta = arg;
+
+	if (size < zfs_trim_extent_bytes_min)
+		return;
+
+	while (size > 0) {
+		uint64_t len = MIN(size, vta->vta_extent_max);
+
+		vdev_trim_issue(vta->vta_zio, vta->vta_vd, start, len);
+		vta->vta_bytes += len;
+		start += len;
+		size -= len;
+	}
+}
+
+/*
+ * Trim a metaslab and wait for the trims, returning the bytes trimmed.
+ */
+static uint64_t
+vdev_trim_metaslab(spa_t *spa, metaslab_t *msp, boolean_t manual)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	vdev_trim_arg_t vta;
+	range_tree_t *rt;
+	kmutex_t rtlock;
+
+	vta.vta_vd = vd;
+	vta.vta_extent_max = MAX(P2ALIGN(MIN(zfs_trim_extent_bytes_max,
+	    SPA_MAXBLOCKSIZE), 1ULL << vd->vdev_ashift),
+	    1ULL << vd->vdev_ashift);
+	vta.vta_bytes = 0;
+
+	mutex_init(&rtlock, NULL, MUTEX_DEFAULT, NULL);
+	rt = range_tree_create(NULL, NULL, &rtlock);
+
+	mutex_enter(&rtlock);
+	if (metaslab_trim_start(msp, rt, manual) != 0) {
+		vta.vta_zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+		range_tree_walk(rt, vdev_trim_range, &vta);
+		(void) zio_wait(vta.vta_zio);
+		metaslab_trim_done(msp);
+	}
+	range_tree_vacate(rt, NULL, NULL);
+	range_tree_destroy(rt);
+	mutex_exit(&rtlock);
+	mutex_destroy(&rtlock);
+
+	return (vta.vta_bytes);
+}
+
+/*
+ * Sleep until bytes trimmed since start are within rate.
+ */
+static void
+vdev_trim_delay(trim_thread_t *tt, boolean_t manual, hrtime_t start,
+    uint64_t bytes, uint64_t rate)
+{
+	hrtime_t deadline = start + SEC2NSEC(bytes / rate) +
+	    (bytes % rate) * MICROSEC / rate * (NANOSEC / MICROSEC);
+
+	mutex_enter(&tt->tt_lock);
+	while (!vdev_trim_stopping(tt, manual) && gethrtime() < deadline) {
+		(void) cv_timedwait_hires(&tt->tt_cv, &tt->tt_lock, deadline,
+		    MSEC2NSEC(1), CALLOUT_FLAG_ABSOLUTE);
+	}
+	mutex_exit(&tt->tt_lock);
+}
+
+/*
+ * Trim each metaslab of the pool, or only the frees queued on them for
+ * autotrim.  Returns B_TRUE if the pass was not stopped.
+ */
+static boolean_t
+vdev_trim_pool(spa_t *spa, boolean_t manual, uint64_t rate)
+{
+	trim_thread_t *tt = &spa->spa_trim;
+	hrtime_t start = gethrtime();
+	uint64_t bytes = 0;
+	uint64_t c = 0, m = 0;
+
+	for (;;) {
+		vdev_t *rvd = spa->spa_root_vdev;
+		metaslab_t *msp = NULL;
+		boolean_t stopping;
+		vdev_t *vd;
+
+		mutex_enter(&tt->tt_lock);
+		stopping = vdev_trim_stopping(tt, manual);
+		mutex_exit(&tt->tt_lock);
+		if (stopping)
+			return (B_FALSE);
+
+		/*
+		 * The config lock is taken again for each metaslab, so that
+		 * vdevs can be added or removed during a long pass.
+		 */
+		spa_config_enter(spa, SCL_STATE_ALL, FTAG, RW_READER);
+		if (c >= rvd->vdev_children) {
+			spa_config_exit(spa, SCL_STATE_ALL, FTAG);
+			return (B_TRUE);
+		}
+		vd = rvd->vdev_child[c];
+		if (m < vd->vdev_ms_count && vdev_writeable(vd)) {
+			msp = vd->vdev_ms[m++];
+		} else {
+			c++;
+			m = 0;
+		}
+		if (msp != NULL)
+			bytes += vdev_trim_metaslab(spa, msp, manual);
+		spa_config_exit(spa, SCL_STATE_ALL, FTAG);
+
+		if (msp != NULL && rate != 0)
+			vdev_trim_delay(tt, manual, start, bytes, rate);
+	}
+}
+
+static void
+vdev_trim_thread(spa_t *spa)
+{
+	trim_thread_t *tt = &spa->spa_trim;
+	callb_cpr_t cpr;
+
+	vdev_trim_thread_enter(tt, &cpr);
+	tt->tt_last_txg = spa_last_synced_txg(spa);
+
+	while (!tt->tt_exiting) {
+		uint64_t txg = spa_last_synced_txg(spa);
+		boolean_t manual = tt->tt_manual;
+
+		if (!spa_suspended(spa) && (manual || (spa->spa_autotrim &&
+		    txg >= tt->tt_last_txg + zfs_trim_txg_batch))) {
+			uint64_t rate = manual && tt->tt_rate != 0 ?
+			    tt->tt_rate : zfs_trim_rate;
+			boolean_t done;
+
+			tt->tt_last_txg = txg;
+			mutex_exit(&tt->tt_lock);
+
+			done = vdev_trim_pool(spa, manual, rate);
+			if (manual && done && !spa_suspended(spa)) {
+				spa_history_log_internal(spa, "trim done",
+				    NULL, "rate=%llu", (u_longlong_t)rate);
+			}
+
+			mutex_enter(&tt->tt_lock);
+			if (manual) {
+				tt->tt_manual = B_FALSE;
+				tt->tt_stop = B_FALSE;
+			}
+			continue;
+		}
+
+		CALLB_CPR_SAFE_BEGIN(&cpr);
+		(void) cv_timedwait_sig_hires(&tt->tt_cv, &tt->tt_lock,
+		    gethrtime() + SEC2NSEC(1), MSEC2NSEC(1),
+		    CALLOUT_FLAG_ABSOLUTE);
+		CALLB_CPR_SAFE_END(&cpr, &tt->tt_lock);
+	}
+
+	tt->tt_manual = B_FALSE;
+	tt->tt_stop = B_FALSE;
+	vdev_trim_thread_exit(tt, &tt->tt_thread, &cpr);
+}
+
+/*
+ * Start a manual trim of the pool's free space, at rate bytes per second,
+ * or at zfs_trim_rate if rate is zero.
+ */
+int
+spa_trim(spa_t *spa, uint64_t rate)
+{
+	trim_thread_t *tt = &spa->spa_trim;
+
+	if (!spa_writeable(spa))
+		return (SET_ERROR(EROFS));
+
+	mutex_enter(&tt->tt_lock);
+	if (tt->tt_thread == NULL) {
+		mutex_exit(&tt->tt_lock);
+		return (SET_ERROR(EROFS));
+	}
+	if (tt->tt_manual) {
+		mutex_exit(&tt->tt_lock);
+		return (SET_ERROR(EBUSY));
+	}
+	tt->tt_manual = B_TRUE;
+	tt->tt_stop = B_FALSE;
+	tt->tt_rate = rate;
+	cv_broadcast(&tt->tt_cv);
+	mutex_exit(&tt->tt_lock);
+
+	spa_history_log_internal(spa, "trim", NULL, "rate=%llu",
+	    (u_longlong_t)rate);
+
+	return (0);
+}
+
+int
+spa_trim_stop(spa_t *spa)
+{
+	trim_thread_t *tt = &spa->spa_trim;
+	uint64_t rate;
+
+	mutex_enter(&tt->tt_lock);
+	if (!tt->tt_manual) {
+		mutex_exit(&tt->tt_lock);
+		return (SET_ERROR(ENOENT));
+	}
+	tt->tt_stop = B_TRUE;
+	rate = tt->tt_rate;
+	cv_broadcast(&tt->tt_cv);
+	mutex_exit(&tt->tt_lock);
+
+	spa_history_log_internal(spa, "trim stopped", NULL, "rate=%llu",
+	    (u_longlong_t)rate);
+
+	return (0);
+}
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+/* BEGIN CSTYLED */
+module_param(zfs_trim_extent_bytes_max, uint, 0644);
+MODULE_PARM_DESC(zfs_trim_extent_bytes_max, "Max size of a trim");
+
+module_param(zfs_trim_extent_bytes_min, uint, 0644);
+MODULE_PARM_DESC(zfs_trim_extent_bytes_min, "Min size of a trimmed extent");
+
+module_param(zfs_trim_txg_batch, uint, 0644);
+MODULE_PARM_DESC(zfs_trim_txg_batch, "Txgs of frees collected by autotrim");
+
+module_param(zfs_trim_rate, ulong, 0644);
+MODULE_PARM_DESC(zfs_trim_rate, "Trim rate in bytes/sec, 0 for no limit");
+/* END CSTYLED */
+#endif
@@ -1357,3 +1357,9 @@ fzap_get_stats(zap_t *zap, zap_stats_t *zs)
 		}
 	}
 }
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(fzap_default_block_shift, int, 0644);
+MODULE_PARM_DESC(fzap_default_block_shift,
+	"Leaf block shift of microzaps upgraded to fat ZAPs");
+#endif
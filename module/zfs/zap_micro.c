@@ -282,12 +282,15 @@ zap_byteswap(void *buf, size_t size)
 	}
 }
 
+/*
+ * Smallest number of entries the in-core index of a microzap is allocated
+ * for.  The index grows by doubling, up to the number of chunks.
+ */
+#define	MZE_MIN_SIZE	8
+
 static int
-mze_compare(const void *arg1, const void *arg2)
+mze_compare(const mzap_ent_t *mze1, const mzap_ent_t *mze2)
 {
-	const mzap_ent_t *mze1 = arg1;
-	const mzap_ent_t *mze2 = arg2;
-
 	int cmp = AVL_CMP(mze1->mze_hash, mze2->mze_hash);
 	if (likely(cmp))
 		return (cmp);
@@ -295,42 +298,136 @@ mze_compare(const void *arg1, const void *arg2)
 	return (AVL_CMP(mze1->mze_cd, mze2->mze_cd));
 }
 
+static void
+mze_sift_down(mzap_ent_t *mze, int root, int n)
+{
+	mzap_ent_t tmp;
+	int child;
+
+	while ((child = 2 * root + 1) < n) {
+		if (child + 1 < n &&
+		    mze_compare(&mze[child], &mze[child + 1]) < 0)
+			child++;
+		if (mze_compare(&mze[root], &mze[child]) >= 0)
+			return;
+		tmp = mze[root];
+		mze[root] = mze[child];
+		mze[child] = tmp;
+		root = child;
+	}
+}
+
+/*
+ * Sort the index built in chunk order by mzap_open().  A heapsort needs
+ * no allocation, and keeps opening a large microzap at n log n compares.
+ */
+static void
+mze_sort(mzap_ent_t *mze, int n)
+{
+	mzap_ent_t tmp;
+	int i;
+
+	for (i = n / 2 - 1; i >= 0; i--)
+		mze_sift_down(mze, i, n);
+	for (i = n - 1; i > 0; i--) {
+		tmp = mze[0];
+		mze[0] = mze[i];
+		mze[i] = tmp;
+		mze_sift_down(mze, 0, i);
+	}
+}
+
+/*
+ * Return the index of the first entry at or after (hash, cd).
+ */
+static int
+mze_search(zap_t *zap, uint64_t hash, uint32_t cd)
+{
+	mzap_ent_t mze_tofind;
+	int lo = 0;
+	int hi = zap->zap_m.zap_mze_count;
+
+	mze_tofind.mze_hash = hash;
+	mze_tofind.mze_cd = cd;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (mze_compare(&zap->zap_m.zap_mze[mid], &mze_tofind) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo);
+}
+
+static void
+mze_resize(zap_t *zap, int size)
+{
+	mzap_ent_t *mze;
+
+	ASSERT3S(size, >=, zap->zap_m.zap_mze_count);
+	ASSERT3S(size, >, 0);
+
+	mze = kmem_alloc(size * sizeof (mzap_ent_t), KM_SLEEP);
+	if (zap->zap_m.zap_mze != NULL) {
+		bcopy(zap->zap_m.zap_mze, mze,
+		    zap->zap_m.zap_mze_count * sizeof (mzap_ent_t));
+		kmem_free(zap->zap_m.zap_mze,
+		    zap->zap_m.zap_mze_size * sizeof (mzap_ent_t));
+	}
+	zap->zap_m.zap_mze = mze;
+	zap->zap_m.zap_mze_size = size;
+}
+
 static void
 mze_insert(zap_t *zap, int chunkid, uint64_t hash)
 {
 	mzap_ent_t *mze;
+	uint32_t cd;
+	int idx;
 
 	ASSERT(zap->zap_ismicro);
 	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(zap_m_phys(zap)->mz_chunk[chunkid].mze_name[0] != 0);
+
+	if (zap->zap_m.zap_mze_count == zap->zap_m.zap_mze_size) {
+		mze_resize(zap, MIN(2 * zap->zap_m.zap_mze_size,
+		    zap->zap_m.zap_num_chunks));
+	}
+
+	cd = zap_m_phys(zap)->mz_chunk[chunkid].mze_cd;
+	idx = mze_search(zap, hash, cd);
+	mze = &zap->zap_m.zap_mze[idx];
+	ASSERT(idx == zap->zap_m.zap_mze_count ||
+	    mze->mze_hash != hash || mze->mze_cd != cd);
 
-	mze = kmem_alloc(sizeof (mzap_ent_t), KM_SLEEP);
+	memmove(mze + 1, mze,
+	    (zap->zap_m.zap_mze_count - idx) * sizeof (mzap_ent_t));
 	mze->mze_chunkid = chunkid;
 	mze->mze_hash = hash;
-	mze->mze_cd = MZE_PHYS(zap, mze)->mze_cd;
-	ASSERT(MZE_PHYS(zap, mze)->mze_name[0] != 0);
-	avl_add(&zap->zap_m.zap_avl, mze);
+	mze->mze_cd = cd;
+	zap->zap_m.zap_mze_count++;
 }
 
 static mzap_ent_t *
 mze_find(zap_name_t *zn)
 {
-	mzap_ent_t mze_tofind;
+	zap_t *zap = zn->zn_zap;
 	mzap_ent_t *mze;
-	avl_index_t idx;
-	avl_tree_t *avl = &zn->zn_zap->zap_m.zap_avl;
-
-	ASSERT(zn->zn_zap->zap_ismicro);
-	ASSERT(RW_LOCK_HELD(&zn->zn_zap->zap_rwlock));
+	int idx;
 
-	mze_tofind.mze_hash = zn->zn_hash;
-	mze_tofind.mze_cd = 0;
+	ASSERT(zap->zap_ismicro);
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
 
-	mze = avl_find(avl, &mze_tofind, &idx);
-	if (mze == NULL)
-		mze = avl_nearest(avl, idx, AVL_AFTER);
-	for (; mze && mze->mze_hash == zn->zn_hash; mze = AVL_NEXT(avl, mze)) {
-		ASSERT3U(mze->mze_cd, ==, MZE_PHYS(zn->zn_zap, mze)->mze_cd);
-		if (zap_match(zn, MZE_PHYS(zn->zn_zap, mze)->mze_name))
+	for (idx = mze_search(zap, zn->zn_hash, 0);
+	    idx < zap->zap_m.zap_mze_count; idx++) {
+		mze = &zap->zap_m.zap_mze[idx];
+		if (mze->mze_hash != zn->zn_hash)
+			break;
+		ASSERT3U(mze->mze_cd, ==, MZE_PHYS(zap, mze)->mze_cd);
+		if (zap_match(zn, MZE_PHYS(zap, mze)->mze_name))
 			return (mze);
 	}
 
@@ -340,22 +437,18 @@ mze_find(zap_name_t *zn)
 static uint32_t
 mze_find_unused_cd(zap_t *zap, uint64_t hash)
 {
-	mzap_ent_t mze_tofind;
 	mzap_ent_t *mze;
-	avl_index_t idx;
-	avl_tree_t *avl = &zap->zap_m.zap_avl;
 	uint32_t cd;
+	int idx;
 
 	ASSERT(zap->zap_ismicro);
 	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
 
-	mze_tofind.mze_hash = hash;
-	mze_tofind.mze_cd = 0;
-
 	cd = 0;
-	for (mze = avl_find(avl, &mze_tofind, &idx);
-	    mze && mze->mze_hash == hash; mze = AVL_NEXT(avl, mze)) {
-		if (mze->mze_cd != cd)
+	for (idx = mze_search(zap, hash, 0);
+	    idx < zap->zap_m.zap_mze_count; idx++) {
+		mze = &zap->zap_m.zap_mze[idx];
+		if (mze->mze_hash != hash || mze->mze_cd != cd)
 			break;
 		cd++;
 	}
@@ -366,22 +459,27 @@ mze_find_unused_cd(zap_t *zap, uint64_t hash)
 static void
 mze_remove(zap_t *zap, mzap_ent_t *mze)
 {
+	int idx = mze - zap->zap_m.zap_mze;
+
 	ASSERT(zap->zap_ismicro);
 	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT3S(idx, <, zap->zap_m.zap_mze_count);
 
-	avl_remove(&zap->zap_m.zap_avl, mze);
-	kmem_free(mze, sizeof (mzap_ent_t));
+	memmove(mze, mze + 1,
+	    (zap->zap_m.zap_mze_count - idx - 1) * sizeof (mzap_ent_t));
+	zap->zap_m.zap_mze_count--;
 }
 
 static void
 mze_destroy(zap_t *zap)
 {
-	mzap_ent_t *mze;
-	void *avlcookie = NULL;
-
-	while ((mze = avl_destroy_nodes(&zap->zap_m.zap_avl, &avlcookie)))
-		kmem_free(mze, sizeof (mzap_ent_t));
-	avl_destroy(&zap->zap_m.zap_avl);
+	if (zap->zap_m.zap_mze != NULL) {
+		kmem_free(zap->zap_m.zap_mze,
+		    zap->zap_m.zap_mze_size * sizeof (mzap_ent_t));
+	}
+	zap->zap_m.zap_mze = NULL;
+	zap->zap_m.zap_mze_count = 0;
+	zap->zap_m.zap_mze_size = 0;
 }
 
 static zap_t *
@@ -430,21 +528,36 @@ mzap_open(objset_t *os, uint64_t obj, dmu_buf_t *db)
 		zap->zap_salt = zap_m_phys(zap)->mz_salt;
 		zap->zap_normflags = zap_m_phys(zap)->mz_normflags;
 		zap->zap_m.zap_num_chunks = db->db_size / MZAP_ENT_LEN - 1;
-		avl_create(&zap->zap_m.zap_avl, mze_compare,
-		    sizeof (mzap_ent_t), offsetof(mzap_ent_t, mze_node));
+
+		/*
+		 * Size the index for the entries present, read them in
+		 * chunk order, and sort them once.
+		 */
+		for (i = 0; i < zap->zap_m.zap_num_chunks; i++) {
+			if (zap_m_phys(zap)->mz_chunk[i].mze_name[0])
+				zap->zap_m.zap_num_entries++;
+		}
+		mze_resize(zap, MIN(MAX(zap->zap_m.zap_num_entries,
+		    MZE_MIN_SIZE), zap->zap_m.zap_num_chunks));
 
 		for (i = 0; i < zap->zap_m.zap_num_chunks; i++) {
 			mzap_ent_phys_t *mze =
 			    &zap_m_phys(zap)->mz_chunk[i];
 			if (mze->mze_name[0]) {
+				mzap_ent_t *ent = &zap->zap_m.zap_mze[
+				    zap->zap_m.zap_mze_count++];
 				zap_name_t *zn;
 
-				zap->zap_m.zap_num_entries++;
 				zn = zap_name_alloc(zap, mze->mze_name, 0);
-				mze_insert(zap, i, zn->zn_hash);
+				ent->mze_chunkid = i;
+				ent->mze_hash = zn->zn_hash;
+				ent->mze_cd = mze->mze_cd;
 				zap_name_free(zn);
 			}
 		}
+		ASSERT3S(zap->zap_m.zap_mze_count, ==,
+		    zap->zap_m.zap_num_entries);
+		mze_sort(zap->zap_m.zap_mze, zap->zap_m.zap_mze_count);
 	} else {
 		zap->zap_salt = zap_f_phys(zap)->zap_salt;
 		zap->zap_normflags = zap_f_phys(zap)->zap_normflags;
@@ -616,8 +729,11 @@ mzap_upgrade(zap_t **zapp, void *tag, dmu_tx_t *tx, zap_flags_t flags)
 	nchunks = zap->zap_m.zap_num_chunks;
 
 	if (!flags) {
+		int bs = MIN(MAX(fzap_default_block_shift, SPA_MINBLOCKSHIFT),
+		    SPA_OLD_MAXBLOCKSHIFT);
+
 		err = dmu_object_set_blocksize(zap->zap_objset, zap->zap_object,
-		    1ULL << fzap_default_block_shift, 0, tx);
+		    1ULL << bs, 0, tx);
 		if (err) {
 			vmem_free(mzp, sz);
 			return (err);
@@ -626,7 +742,7 @@ mzap_upgrade(zap_t **zapp, void *tag, dmu_tx_t *tx, zap_flags_t flags)
 
 	dprintf("upgrading obj=%llu with %u chunks\n",
 	    zap->zap_object, nchunks);
-	/* XXX destroy the avl later, so we can use the stored hash value */
+	/* XXX destroy the index later, so we can use the stored hash value */
 	mze_destroy(zap);
 
 	fzap_upgrade(zap, tx, flags);
@@ -858,16 +974,20 @@ static boolean_t
 mzap_normalization_conflict(zap_t *zap, zap_name_t *zn, mzap_ent_t *mze)
 {
 	mzap_ent_t *other;
-	int direction = AVL_BEFORE;
+	int idx = mze - zap->zap_m.zap_mze;
+	int direction = -1;
+	int i;
 	boolean_t allocdzn = B_FALSE;
 
 	if (zap->zap_normflags == 0)
 		return (B_FALSE);
 
 again:
-	for (other = avl_walk(&zap->zap_m.zap_avl, mze, direction);
-	    other && other->mze_hash == mze->mze_hash;
-	    other = avl_walk(&zap->zap_m.zap_avl, other, direction)) {
+	for (i = idx + direction; i >= 0 && i < zap->zap_m.zap_mze_count;
+	    i += direction) {
+		other = &zap->zap_m.zap_mze[i];
+		if (other->mze_hash != mze->mze_hash)
+			break;
 
 		if (zn == NULL) {
 			zn = zap_name_alloc(zap, MZE_PHYS(zap, mze)->mze_name,
@@ -881,8 +1001,8 @@ again:
 		}
 	}
 
-	if (direction == AVL_BEFORE) {
-		direction = AVL_AFTER;
+	if (direction == -1) {
+		direction = 1;
 		goto again;
 	}
 
@@ -1504,8 +1624,7 @@ int
 zap_cursor_retrieve(zap_cursor_t *zc, zap_attribute_t *za)
 {
 	int err;
-	avl_index_t idx;
-	mzap_ent_t mze_tofind;
+	int idx;
 	mzap_ent_t *mze;
 
 	if (zc->zc_hash == -1ULL)
@@ -1535,15 +1654,9 @@ zap_cursor_retrieve(zap_cursor_t *zc, zap_attribute_t *za)
 	if (!zc->zc_zap->zap_ismicro) {
 		err = fzap_cursor_retrieve(zc->zc_zap, zc, za);
 	} else {
-		mze_tofind.mze_hash = zc->zc_hash;
-		mze_tofind.mze_cd = zc->zc_cd;
-
-		mze = avl_find(&zc->zc_zap->zap_m.zap_avl, &mze_tofind, &idx);
-		if (mze == NULL) {
-			mze = avl_nearest(&zc->zc_zap->zap_m.zap_avl,
-			    idx, AVL_AFTER);
-		}
-		if (mze) {
+		idx = mze_search(zc->zc_zap, zc->zc_hash, zc->zc_cd);
+		if (idx < zc->zc_zap->zap_m.zap_mze_count) {
+			mze = &zc->zc_zap->zap_m.zap_mze[idx];
 			mzap_ent_phys_t *mzep = MZE_PHYS(zc->zc_zap, mze);
 			ASSERT3U(mze->mze_cd, ==, mzep->mze_cd);
 			za->za_normalization_conflict =
@@ -508,6 +508,8 @@ zfs_acl_free(zfs_acl_t *aclp)
 {
 	zfs_acl_release_nodes(aclp);
 	list_destroy(&aclp->z_acl);
+	if (aclp->z_acc_cred != NULL)
+		crfree(aclp->z_acc_cred);
 	kmem_free(aclp, sizeof (zfs_acl_t));
 }
 
@@ -2213,6 +2215,12 @@ zfs_zaccess_dataset_check(znode_t *zp, uint32_t v4_mode)
  * This mode is chosen by setting anyaccess to B_TRUE.  The
  * working_mode is not a denied access mask upon exit if the function
  * is used in this manner.
+ *
+ * The outcome of the last full check is remembered in the znode's cached
+ * ACL, keyed by credential, requested mode and file owner and group, so
+ * that a process repeatedly opening or looking up the same file does not
+ * walk a long ACL every time.  Changing the ACL or the mode replaces the
+ * cached ACL, which discards the outcome with it.
  */
 static int
 zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
@@ -2231,6 +2239,7 @@ zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
 	boolean_t	checkit;
 	uid_t		gowner;
 	uid_t		fowner;
+	uint32_t	checked_mode;
 
 	zfs_fuid_map_ids(zp, cr, &fowner, &gowner);
 
@@ -2244,6 +2253,16 @@ zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
 
 	ASSERT(zp->z_acl_cached);
 
+	if (!anyaccess && cr != NULL && aclp->z_acc_cred == cr &&
+	    aclp->z_acc_mode == *working_mode &&
+	    aclp->z_acc_fowner == fowner && aclp->z_acc_gowner == gowner) {
+		*working_mode = aclp->z_acc_left;
+		error = aclp->z_acc_error;
+		mutex_exit(&zp->z_acl_lock);
+		return (error);
+	}
+	checked_mode = *working_mode;
+
 	while ((acep = zfs_acl_next_ace(aclp, acep, &who, &access_mask,
 	    &iflags, &type))) {
 		uint32_t mask_matched;
@@ -2321,17 +2340,31 @@ zfs_zaccess_aces_check(znode_t *zp, uint32_t *working_mode,
 			break;
 	}
 
-	mutex_exit(&zp->z_acl_lock);
-
 	/* Put the found 'denies' back on the working mode */
 	if (deny_mask) {
 		*working_mode |= deny_mask;
-		return (SET_ERROR(EACCES));
+		error = SET_ERROR(EACCES);
 	} else if (*working_mode) {
-		return (-1);
+		error = -1;
 	}
 
-	return (0);
+	if (!anyaccess && cr != NULL) {
+		if (aclp->z_acc_cred != cr) {
+			if (aclp->z_acc_cred != NULL)
+				crfree(aclp->z_acc_cred);
+			crhold(cr);
+			aclp->z_acc_cred = cr;
+		}
+		aclp->z_acc_fowner = fowner;
+		aclp->z_acc_gowner = gowner;
+		aclp->z_acc_mode = checked_mode;
+		aclp->z_acc_left = *working_mode;
+		aclp->z_acc_error = error;
+	}
+
+	mutex_exit(&zp->z_acl_lock);
+
+	return (error);
 }
 
 /*
@@ -298,8 +298,12 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 	return (0);
 }
 
+/*
+ * Unpacks the caller's nvlist in place, allocating the nvpairs from nva, or
+ * with the default allocator if nva is NULL.
+ */
 static int
-get_nvlist(uint64_t nvl, uint64_t size, int iflag, nvlist_t **nvp)
+get_nvlist_nva(uint64_t nvl, uint64_t size, nv_alloc_t *nva, nvlist_t **nvp)
 {
 	char *packed;
 	int error;
@@ -313,13 +317,35 @@ get_nvlist(uint64_t nvl, uint64_t size, int iflag, nvlist_t **nvp)
 
 	packed = (void *)(uintptr_t)nvl;
 
-	if ((error = nvlist_unpack(packed, size, &list, 0)) != 0)
+	if (nva != NULL)
+		error = nvlist_xunpack(packed, size, &list, nva);
+	else
+		error = nvlist_unpack(packed, size, &list, 0);
+	if (error != 0)
 		return (error);
 
 	*nvp = list;
 	return (0);
 }
 
+static int
+get_nvlist(uint64_t nvl, uint64_t size, int iflag, nvlist_t **nvp)
+{
+	return (get_nvlist_nva(nvl, size, NULL, nvp));
+}
+
+/*
+ * Allocates an nvlist from the arena of the ioctl being handled.
+ */
+static nvlist_t *
+uzfs_ioc_nvlist_alloc(nv_alloc_t *nva)
+{
+	nvlist_t *nvl;
+
+	VERIFY0(nvlist_xalloc(&nvl, NV_UNIQUE_NAME, nva));
+	return (nvl);
+}
+
 static int
 put_nvlist(zfs_cmd_t *zc, nvlist_t *nvl)
 {
@@ -333,9 +359,13 @@ put_nvlist(zfs_cmd_t *zc, nvlist_t *nvl)
 	if (size > zc->zc_nvlist_dst_size) {
 		error = SET_ERROR(ENOMEM);
 	} else {
-		packed = fnvlist_pack(nvl, &size);
-		memcpy((void *)(uintptr_t)zc->zc_nvlist_dst, packed, size);
-		fnvlist_pack_free(packed, size);
+		/*
+		 * The destination is in our address space, so pack straight
+		 * into it rather than into a buffer that is then copied.
+		 */
+		packed = (char *)(uintptr_t)zc->zc_nvlist_dst;
+		VERIFY0(nvlist_pack(nvl, &packed, &size, NV_ENCODE_NATIVE,
+		    KM_SLEEP));
 		zc->zc_nvlist_dst_filled = B_TRUE;
 	}
 
@@ -1512,11 +1542,17 @@ put_nvlist(zfs_cmd_t *zc, nvlist_t *nvl)
 	if (size > zc->zc_nvlist_dst_size) {
 		error = SET_ERROR(ENOMEM);
 	} else {
-		packed = fnvlist_pack(nvl, &size);
+		/*
+		 * Pack into a buffer of the size just computed, so that
+		 * nvlist_pack() doesn't walk the nvlist to size it again.
+		 */
+		packed = vmem_alloc(size, KM_SLEEP);
+		VERIFY0(nvlist_pack(nvl, &packed, &size, NV_ENCODE_NATIVE,
+		    KM_SLEEP));
 		if (ddi_copyout(packed, (void *)(uintptr_t)zc->zc_nvlist_dst,
 		    size, zc->zc_iflags) != 0)
 			error = SET_ERROR(EFAULT);
-		fnvlist_pack_free(packed, size);
+		vmem_free(packed, size);
 	}
 
 	zc->zc_nvlist_dst_size = size;
@@ -2175,34 +2211,52 @@ zfs_ioc_vdev_setfru(zfs_cmd_t *zc)
 #endif /* _KERNEL */
 
 static int
-zfs_ioc_objset_stats_impl(zfs_cmd_t *zc, objset_t *os)
+zfs_objset_stats_nvl(objset_t *os, dmu_objset_stats_t *stat, nvlist_t **nvp)
 {
-	int error = 0;
+	int error;
 	nvlist_t *nv;
 
-	dmu_objset_fast_stat(os, &zc->zc_objset_stats);
+	dmu_objset_fast_stat(os, stat);
 
-	if (zc->zc_nvlist_dst != 0 &&
-	    (error = dsl_prop_get_all(os, &nv)) == 0) {
-		dmu_objset_stats(os, nv);
-		/*
-		 * NB: zvol_get_stats() will read the objset contents,
-		 * which we aren't supposed to do with a
-		 * DS_MODE_USER hold, because it could be
-		 * inconsistent.  So this is a bit of a workaround...
-		 * XXX reading with out owning
-		 */
-		if (!zc->zc_objset_stats.dds_inconsistent &&
-		    dmu_objset_type(os) == DMU_OST_ZVOL) {
-			error = zvol_get_stats(os, nv);
-			if (error == EIO) {
-				nvlist_free(nv);
-				return (error);
-			}
-			VERIFY0(error);
+	if ((error = dsl_prop_get_all(os, &nv)) != 0)
+		return (error);
+
+	dmu_objset_stats(os, nv);
+	/*
+	 * NB: zvol_get_stats() will read the objset contents,
+	 * which we aren't supposed to do with a
+	 * DS_MODE_USER hold, because it could be
+	 * inconsistent.  So this is a bit of a workaround...
+	 * XXX reading with out owning
+	 */
+	if (!stat->dds_inconsistent &&
+	    dmu_objset_type(os) == DMU_OST_ZVOL) {
+		error = zvol_get_stats(os, nv);
+		if (error == EIO) {
+			nvlist_free(nv);
+			return (error);
 		}
-		if (error == 0)
-			error = put_nvlist(zc, nv);
+		VERIFY0(error);
+	}
+
+	*nvp = nv;
+	return (0);
+}
+
+static int
+zfs_ioc_objset_stats_impl(zfs_cmd_t *zc, objset_t *os)
+{
+	int error;
+	nvlist_t *nv;
+
+	if (zc->zc_nvlist_dst == 0) {
+		dmu_objset_fast_stat(os, &zc->zc_objset_stats);
+		return (0);
+	}
+
+	error = zfs_objset_stats_nvl(os, &zc->zc_objset_stats, &nv);
+	if (error == 0) {
+		error = put_nvlist(zc, nv);
 		nvlist_free(nv);
 	}
 
@@ -2364,14 +2418,12 @@ dataset_name_hidden(const char *name)
  * zc_nvlist_dst_size	size of property nvlist
  */
 static int
-zfs_ioc_dataset_list_next(zfs_cmd_t *zc)
+zfs_dataset_list_next_name(zfs_cmd_t *zc)
 {
 	objset_t *os;
 	int error;
 	char *p;
-	size_t orig_len = strlen(zc->zc_name);
 
-top:
 	if ((error = dmu_objset_hold(zc->zc_name, FTAG, &os))) {
 		if (error == ENOENT)
 			error = SET_ERROR(ESRCH);
@@ -2392,6 +2444,18 @@ top:
 	} while (error == 0 && dataset_name_hidden(zc->zc_name));
 	dmu_objset_rele(os, FTAG);
 
+	return (error);
+}
+
+static int
+zfs_ioc_dataset_list_next(zfs_cmd_t *zc)
+{
+	int error;
+	size_t orig_len = strlen(zc->zc_name);
+
+top:
+	error = zfs_dataset_list_next_name(zc);
+
 	/*
 	 * If it's an internal dataset (ie. with a '$' in its name),
 	 * don't try to get stats for it, otherwise we'll return ENOENT.
@@ -2407,6 +2471,82 @@ top:
 	return (error);
 }
 
+/*
+ * inputs:
+ * zc_name		name of filesystem
+ * zc_cookie		zap cursor
+ * zc_nvlist_dst_size	size of buffer for the batch nvlist
+ *
+ * outputs:
+ * zc_cookie		zap cursor past the last child returned
+ * zc_nvlist_dst	batch nvlist: for each child, its name mapped to
+ *			"stats" (dmu_objset_stats_t) and "props" (nvlist)
+ * zc_nvlist_dst_size	size of batch nvlist
+ *
+ * Returns as many children as fit in the buffer in one call, and ESRCH
+ * once none are left.  A child which does not fit even on its own fails
+ * the call with ENOMEM and the size it needs, as in
+ * ZFS_IOC_DATASET_LIST_NEXT.
+ */
+static int
+zfs_ioc_dataset_list_batch(zfs_cmd_t *zc)
+{
+	char parent[ZFS_MAX_DATASET_NAME_LEN];
+	dmu_objset_stats_t stats;
+	nvlist_t *batch, *entry, *props;
+	objset_t *os;
+	uint64_t cookie;
+	int error, count = 0;
+
+	(void) strlcpy(parent, zc->zc_name, sizeof (parent));
+	batch = fnvlist_alloc();
+
+	for (;;) {
+		cookie = zc->zc_cookie;
+		(void) strlcpy(zc->zc_name, parent, sizeof (zc->zc_name));
+		if ((error = zfs_dataset_list_next_name(zc)) != 0)
+			break;
+		if (strchr(zc->zc_name, '$') != NULL)
+			continue;
+
+		/* A child that was destroyed meanwhile is skipped. */
+		if ((error = dmu_objset_hold(zc->zc_name, FTAG, &os)) == 0) {
+			error = zfs_objset_stats_nvl(os, &stats, &props);
+			dmu_objset_rele(os, FTAG);
+		}
+		if (error == ENOENT)
+			continue;
+		if (error != 0)
+			break;
+
+		entry = fnvlist_alloc();
+		fnvlist_add_uint8_array(entry, "stats", (uint8_t *)&stats,
+		    sizeof (stats));
+		fnvlist_add_nvlist(entry, "props", props);
+		fnvlist_add_nvlist(batch, zc->zc_name, entry);
+		nvlist_free(entry);
+		nvlist_free(props);
+		count++;
+
+		if (fnvlist_size(batch) > zc->zc_nvlist_dst_size) {
+			/* leave this child for the next call */
+			zc->zc_cookie = cookie;
+			if (count > 1)
+				fnvlist_remove(batch, zc->zc_name);
+			break;
+		}
+	}
+
+	if (error == ESRCH && count > 0)
+		error = 0;
+	if (error == 0)
+		error = put_nvlist(zc, batch);
+
+	(void) strlcpy(zc->zc_name, parent, sizeof (zc->zc_name));
+	nvlist_free(batch);
+	return (error);
+}
+
 /*
  * inputs:
  * zc_name		name of filesystem
@@ -2624,26 +2764,20 @@ zfs_prop_set_special(const char *dsname, zprop_source_t source,
 }
 
 /*
- * This function is best effort. If it fails to set any of the given properties,
- * it continues to set as many as it can and returns the last error
- * encountered. If the caller provides a non-NULL errlist, it will be filled in
- * with the list of names of all the properties that failed along with the
- * corresponding error numbers.
- *
- * If every property is set successfully, zero is returned and errlist is not
- * modified.
+ * Validate the properties in nvl and set the ones that need special
+ * handling, like zfs_set_prop_nvlist(), but leave the generic ones in
+ * genericnvl for the caller to set, so that they can be batched with the
+ * properties of other datasets.
  */
-int
-zfs_set_prop_nvlist(const char *dsname, zprop_source_t source, nvlist_t *nvl,
-    nvlist_t *errlist)
+static int
+zfs_set_prop_nvlist_impl(const char *dsname, zprop_source_t source,
+    nvlist_t *nvl, nvlist_t *errlist, nvlist_t *genericnvl)
 {
 	nvpair_t *pair;
 	nvpair_t *propval;
 	int rv = 0;
 	uint64_t intval;
-	char *strval;
 
-	nvlist_t *genericnvl = fnvlist_alloc();
 	nvlist_t *retrynvl = fnvlist_alloc();
 retry:
 	pair = NULL;
@@ -2742,50 +2876,82 @@ retry:
 		nvl = retrynvl;
 		goto retry;
 	}
+	nvlist_free(retrynvl);
 
-	if (!nvlist_empty(genericnvl) &&
-	    dsl_props_set(dsname, source, genericnvl) != 0) {
-		/*
-		 * If this fails, we still want to set as many properties as we
-		 * can, so try setting them individually.
-		 */
-		pair = NULL;
-		while ((pair = nvlist_next_nvpair(genericnvl, pair)) != NULL) {
-			const char *propname = nvpair_name(pair);
-			int err = 0;
-
-			propval = pair;
-			if (nvpair_type(pair) == DATA_TYPE_NVLIST) {
-				nvlist_t *attrs;
-				attrs = fnvpair_value_nvlist(pair);
-				propval = fnvlist_lookup_nvpair(attrs,
-				    ZPROP_VALUE);
-			}
+	return (rv);
+}
 
-			if (nvpair_type(propval) == DATA_TYPE_STRING) {
-				strval = fnvpair_value_string(propval);
-				err = dsl_prop_set_string(dsname, propname,
-				    source, strval);
-			} else if (nvpair_type(propval) == DATA_TYPE_BOOLEAN) {
-				err = dsl_prop_inherit(dsname, propname,
-				    source);
-			} else {
-				intval = fnvpair_value_uint64(propval);
-				err = dsl_prop_set_int(dsname, propname, source,
-				    intval);
-			}
+/*
+ * Set the generic properties of a dataset one at a time, after setting them
+ * all in a single transaction failed: we still want to set as many
+ * properties as we can.
+ */
+static int
+zfs_set_prop_generic(const char *dsname, zprop_source_t source,
+    nvlist_t *genericnvl, nvlist_t *errlist)
+{
+	nvpair_t *pair = NULL;
+	nvpair_t *propval;
+	int rv = 0;
 
-			if (err != 0) {
-				if (errlist != NULL) {
-					fnvlist_add_int32(errlist, propname,
-					    err);
-				}
-				rv = err;
-			}
+	while ((pair = nvlist_next_nvpair(genericnvl, pair)) != NULL) {
+		const char *propname = nvpair_name(pair);
+		int err = 0;
+
+		propval = pair;
+		if (nvpair_type(pair) == DATA_TYPE_NVLIST) {
+			nvlist_t *attrs;
+			attrs = fnvpair_value_nvlist(pair);
+			propval = fnvlist_lookup_nvpair(attrs, ZPROP_VALUE);
+		}
+
+		if (nvpair_type(propval) == DATA_TYPE_STRING) {
+			err = dsl_prop_set_string(dsname, propname, source,
+			    fnvpair_value_string(propval));
+		} else if (nvpair_type(propval) == DATA_TYPE_BOOLEAN) {
+			err = dsl_prop_inherit(dsname, propname, source);
+		} else {
+			err = dsl_prop_set_int(dsname, propname, source,
+			    fnvpair_value_uint64(propval));
+		}
+
+		if (err != 0) {
+			if (errlist != NULL)
+				fnvlist_add_int32(errlist, propname, err);
+			rv = err;
 		}
 	}
+
+	return (rv);
+}
+
+/*
+ * This function is best effort. If it fails to set any of the given properties,
+ * it continues to set as many as it can and returns the last error
+ * encountered. If the caller provides a non-NULL errlist, it will be filled in
+ * with the list of names of all the properties that failed along with the
+ * corresponding error numbers.
+ *
+ * If every property is set successfully, zero is returned and errlist is not
+ * modified.
+ */
+int
+zfs_set_prop_nvlist(const char *dsname, zprop_source_t source, nvlist_t *nvl,
+    nvlist_t *errlist)
+{
+	nvlist_t *genericnvl = fnvlist_alloc();
+	int rv;
+
+	rv = zfs_set_prop_nvlist_impl(dsname, source, nvl, errlist,
+	    genericnvl);
+	if (!nvlist_empty(genericnvl) &&
+	    dsl_props_set(dsname, source, genericnvl) != 0) {
+		int err = zfs_set_prop_generic(dsname, source, genericnvl,
+		    errlist);
+		if (err != 0)
+			rv = err;
+	}
 	nvlist_free(genericnvl);
-	nvlist_free(retrynvl);
 
 	return (rv);
 }
@@ -2932,6 +3098,52 @@ zfs_set_targetip_posthook(const char *name, char *targetip, char *curtargetip)
 }
 #endif
 
+#ifdef  _UZFS
+/*
+ * targetip and the zvol readonly property also update the zvol_info.
+ * This should have been done during sync time similar to
+ * dsl_dir_set_quorum_sync, but, doing it here as it involves
+ * locks in zinfo layer in the form of 'prehook'.
+ * Due to this prehook, posthook is also required, in case of any error
+ * while syncing the property, to revert the changes done in prehook.
+ */
+static boolean_t
+zfs_set_prop_needs_prehook(nvlist_t *nvl)
+{
+	return (nvlist_exists(nvl, ZFS_PROP_TARGET_IP) ||
+	    nvlist_exists(nvl, zfs_prop_to_name(ZFS_PROP_ZVOL_READONLY)));
+}
+
+static int
+zfs_set_prop_uzfs(const char *dsname, zprop_source_t source, nvlist_t *nvl,
+    nvlist_t *errors)
+{
+	char *val;
+	char *targetip = NULL;
+	char curtargetip[MAXNAMELEN];
+	int error = 0;
+
+	curtargetip[0] = '\0';
+	(void) nvlist_lookup_string(nvl, ZFS_PROP_TARGET_IP, &targetip);
+	if (targetip != NULL) {
+		error = zfs_set_targetip_prehook(dsname, source, targetip,
+		    &curtargetip[0]);
+	}
+	if (error == 0 && nvlist_lookup_string(nvl,
+	    zfs_prop_to_name(ZFS_PROP_ZVOL_READONLY), &val) == 0) {
+		error = uzfs_zinfo_update_rdonly(dsname, val);
+	}
+
+	if (error == 0)
+		error = zfs_set_prop_nvlist(dsname, source, nvl, errors);
+
+	if (targetip != NULL && nvlist_exists(errors, ZFS_PROP_TARGET_IP))
+		zfs_set_targetip_posthook(dsname, targetip, &curtargetip[0]);
+
+	return (error);
+}
+#endif
+
 /*
  * inputs:
  * zc_name		name of filesystem
@@ -2952,13 +3164,6 @@ zfs_ioc_set_prop(zfs_cmd_t *zc)
 	nvlist_t *errors;
 	int error;
 
-#ifdef  _UZFS
-	char *val;
-	int targetip_error;
-	char *targetip = NULL;
-	char curtargetip[MAXNAMELEN];
-#endif
-
 	if ((error = get_nvlist(zc->zc_nvlist_src, zc->zc_nvlist_src_size,
 	    zc->zc_iflags, &nvl)) != 0)
 		return (error);
@@ -2975,43 +3180,136 @@ zfs_ioc_set_prop(zfs_cmd_t *zc)
 		error = dsl_prop_set_hasrecvd(zc->zc_name);
 	}
 
+	errors = fnvlist_alloc();
+	if (error == 0) {
 #ifdef  _UZFS
-	/*
-	 * Below code is to set/unset targetip property for zvol_info.
-	 * This should have been done during sync time similar to
-	 * dsl_dir_set_quorum_sync, but, doing it here as it involves
-	 * locks in zinfo layer in the form of 'prehook'.
-	 * Due to this prehook, posthook is also required, in case of any error
-	 * while syncing the property, to revert the changes done in prehook.
-	 */
-	curtargetip[0] = '\0';
-	(void) nvlist_lookup_string(nvl, ZFS_PROP_TARGET_IP, &targetip);
-	if (targetip != NULL) {
-		error = zfs_set_targetip_prehook(zc->zc_name, source, targetip,
-		    &curtargetip[0]);
+		error = zfs_set_prop_uzfs(zc->zc_name, source, nvl, errors);
+#else
+		error = zfs_set_prop_nvlist(zc->zc_name, source, nvl, errors);
+#endif
 	}
-	if (error == 0 && nvlist_lookup_string(nvl,
-	    zfs_prop_to_name(ZFS_PROP_ZVOL_READONLY), &val) == 0) {
-		error = uzfs_zinfo_update_rdonly(zc->zc_name, val);
+
+	if (zc->zc_nvlist_dst != 0 && errors != NULL)
+		(void) put_nvlist(zc, errors);
+
+	nvlist_free(errors);
+	nvlist_free(nvl);
+	return (error);
+}
+
+/*
+ * Set local properties on many datasets of a pool at once.  Properties that
+ * need special handling are set per dataset as in zfs_ioc_set_prop(); the
+ * generic ones of all the datasets are set by a single sync task, and so in
+ * a single txg.  If that fails, they are set one dataset at a time.
+ *
+ * dsprops maps dataset names to nvlists of properties.  errors is filled
+ * in with dataset name -> property name -> error for the failed properties.
+ */
+static int
+zfs_set_props_multi(const char *poolname, nvlist_t *dsprops, nvlist_t *errors)
+{
+	nvlist_t *generic, *dserrs, *props;
+	nvpair_t *pair;
+	size_t poollen;
+	int error = 0, err;
+
+	/* every dataset must belong to the pool */
+	poollen = strlen(poolname);
+	for (pair = nvlist_next_nvpair(dsprops, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(dsprops, pair)) {
+		const char *dsname = nvpair_name(pair);
+
+		if (nvpair_type(pair) != DATA_TYPE_NVLIST ||
+		    dataset_namecheck(dsname, NULL, NULL) != 0 ||
+		    strncmp(dsname, poolname, poollen) != 0 ||
+		    strchr("/@", dsname[poollen]) == NULL)
+			return (SET_ERROR(EINVAL));
 	}
-#endif
 
-	errors = fnvlist_alloc();
-	if (error == 0)
-		error = zfs_set_prop_nvlist(zc->zc_name, source, nvl, errors);
+	generic = fnvlist_alloc();
+	for (pair = nvlist_next_nvpair(dsprops, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(dsprops, pair)) {
+		const char *dsname = nvpair_name(pair);
 
-	if (zc->zc_nvlist_dst != 0 && errors != NULL) {
+		props = fnvpair_value_nvlist(pair);
+		dserrs = fnvlist_alloc();
 #ifdef  _UZFS
-		if (nvlist_lookup_int32(errors, ZFS_PROP_TARGET_IP,
-		    &targetip_error) == 0)
-			zfs_set_targetip_posthook(zc->zc_name, targetip,
-			    &curtargetip[0]);
+		if (zfs_set_prop_needs_prehook(props)) {
+			err = zfs_set_prop_uzfs(dsname, ZPROP_SRC_LOCAL, props,
+			    dserrs);
+		} else
 #endif
-		(void) put_nvlist(zc, errors);
+		{
+			nvlist_t *genericnvl = fnvlist_alloc();
+
+			err = zfs_set_prop_nvlist_impl(dsname, ZPROP_SRC_LOCAL,
+			    props, dserrs, genericnvl);
+			if (!nvlist_empty(genericnvl))
+				fnvlist_add_nvlist(generic, dsname, genericnvl);
+			nvlist_free(genericnvl);
+		}
+		if (err != 0)
+			error = err;
+		if (!nvlist_empty(dserrs))
+			fnvlist_add_nvlist(errors, dsname, dserrs);
+		nvlist_free(dserrs);
+	}
+
+	if (!nvlist_empty(generic) &&
+	    dsl_props_set_multi(poolname, ZPROP_SRC_LOCAL, generic) != 0) {
+		for (pair = nvlist_next_nvpair(generic, NULL); pair != NULL;
+		    pair = nvlist_next_nvpair(generic, pair)) {
+			const char *dsname = nvpair_name(pair);
+
+			props = fnvpair_value_nvlist(pair);
+			if (dsl_props_set(dsname, ZPROP_SRC_LOCAL, props) == 0)
+				continue;
+
+			if (nvlist_lookup_nvlist(errors, dsname, &dserrs) != 0)
+				dserrs = fnvlist_alloc();
+			else
+				dserrs = fnvlist_dup(dserrs);
+			err = zfs_set_prop_generic(dsname, ZPROP_SRC_LOCAL,
+			    props, dserrs);
+			if (err != 0)
+				error = err;
+			if (!nvlist_empty(dserrs))
+				fnvlist_add_nvlist(errors, dsname, dserrs);
+			nvlist_free(dserrs);
+		}
 	}
+	nvlist_free(generic);
+
+	return (error);
+}
+
+/*
+ * inputs:
+ * zc_name		name of the pool
+ * zc_nvlist_src{_size}	nvlist of dataset name -> nvlist of properties
+ *
+ * outputs:
+ * zc_nvlist_dst{_size}	nvlist of dataset name -> nvlist of property name
+ *			-> error, for the datasets with failed properties
+ */
+static int
+zfs_ioc_set_props_multi(zfs_cmd_t *zc)
+{
+	nvlist_t *dsprops, *errors;
+	int error;
+
+	if ((error = get_nvlist(zc->zc_nvlist_src, zc->zc_nvlist_src_size,
+	    zc->zc_iflags, &dsprops)) != 0)
+		return (error);
+
+	errors = fnvlist_alloc();
+	error = zfs_set_props_multi(zc->zc_name, dsprops, errors);
+	if (zc->zc_nvlist_dst != 0 && !nvlist_empty(errors))
+		(void) put_nvlist(zc, errors);
 
 	nvlist_free(errors);
-	nvlist_free(nvl);
+	nvlist_free(dsprops);
 	return (error);
 }
 
@@ -3667,6 +3965,208 @@ zfs_ioc_snapshot(const char *poolname, nvlist_t *innvl, nvlist_t *outnvl)
 	return (error);
 }
 
+#if defined(_KERNEL)
+/*
+ * Check the permissions of one operation of a batch against the policy of
+ * the ioctl it stands for.
+ */
+static int
+zfs_batch_secpolicy(zfs_secpolicy_func_t *secpolicy, const char *name,
+    nvlist_t *innvl)
+{
+	zfs_cmd_t *zc;
+	int error;
+
+	zc = kmem_zalloc(sizeof (zfs_cmd_t), KM_SLEEP);
+	(void) strlcpy(zc->zc_name, name, sizeof (zc->zc_name));
+	error = secpolicy(zc, innvl, CRED());
+	kmem_free(zc, sizeof (zfs_cmd_t));
+	return (error);
+}
+#endif
+
+/*
+ * Returns B_TRUE if a snapshot in snaps is of a filesystem that also has one
+ * in merged; zfs_ioc_snapshot() takes a single snapshot per filesystem.
+ */
+static boolean_t
+zfs_batch_snaps_overlap(nvlist_t *merged, nvlist_t *snaps)
+{
+	nvpair_t *pair, *pair2;
+
+	for (pair = nvlist_next_nvpair(snaps, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(snaps, pair)) {
+		const char *name = nvpair_name(pair);
+		const char *cp = strchr(name, '@');
+
+		if (cp == NULL)
+			return (B_TRUE);
+		for (pair2 = nvlist_next_nvpair(merged, NULL); pair2 != NULL;
+		    pair2 = nvlist_next_nvpair(merged, pair2)) {
+			if (strncmp(name, nvpair_name(pair2),
+			    cp - name + 1) == 0)
+				return (B_TRUE);
+		}
+	}
+	return (B_FALSE);
+}
+
+/*
+ * Run a list of dataset operations in order, stopping at the first one that
+ * fails.  Besides saving a round trip per operation, runs of operations
+ * that can share a sync task are merged, so that they take a single txg:
+ * consecutive snapshot ops without properties become one snapshot of all
+ * their filesystems, and consecutive set_props ops of distinct datasets are
+ * set as by ZFS_IOC_SET_PROPS_MULTI.  Each merged run is all-or-nothing as
+ * far as the underlying ioctl is, and is reported under the index of its
+ * first op.
+ *
+ * innvl: {
+ *     "ops" -> [ op, ... ], each op one of
+ *         { "op" -> "create", "name" -> fsname, "type" -> int32,
+ *           (optional) "props" -> { prop -> value } }
+ *         { "op" -> "snapshot", "snaps" -> { snapshot1, snapshot2 },
+ *           (optional) "props" -> { prop -> value (string) } }
+ *         { "op" -> "set_props", "name" -> dataset,
+ *           "props" -> { prop -> value } }
+ *         { "op" -> "stats", "name" -> dataset }
+ * }
+ *
+ * outnvl: {
+ *     "<op index>" -> { output of the op: the errors of the create,
+ *         snapshot or set_props, or "stats" (dmu_objset_stats_t) and
+ *         "props" (nvlist) for a stats op }
+ *     (on failure) "failed_op" -> index of the op that failed (int32)
+ * }
+ */
+static int
+zfs_ioc_batch(const char *poolname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	nvlist_t **ops;
+	uint_t nops, i, j;
+	int error = 0;
+
+	if (nvlist_lookup_nvlist_array(innvl, "ops", &ops, &nops) != 0)
+		return (SET_ERROR(EINVAL));
+
+	for (i = 0; i < nops && error == 0; i = j) {
+		nvlist_t *opout = fnvlist_alloc();
+		char *op, *name;
+		char idx[16];
+
+		j = i + 1;
+		if (nvlist_lookup_string(ops[i], "op", &op) != 0) {
+			error = SET_ERROR(EINVAL);
+		} else if (strcmp(op, "snapshot") == 0) {
+			nvlist_t *snapnvl = ops[i];
+			nvlist_t *merged = NULL, *mergedsnaps, *snaps;
+
+			/* merge the following snapshot ops into this one */
+			while (j < nops && !nvlist_exists(ops[i], "props") &&
+			    !nvlist_exists(ops[j], "props") &&
+			    nvlist_lookup_string(ops[j], "op", &op) == 0 &&
+			    strcmp(op, "snapshot") == 0 &&
+			    nvlist_lookup_nvlist(ops[j], "snaps",
+			    &snaps) == 0) {
+				if (merged == NULL) {
+					merged = fnvlist_dup(ops[i]);
+					snapnvl = merged;
+				}
+				mergedsnaps = fnvlist_lookup_nvlist(merged,
+				    "snaps");
+				if (zfs_batch_snaps_overlap(mergedsnaps, snaps))
+					break;
+				fnvlist_merge(mergedsnaps, snaps);
+				j++;
+			}
+#if defined(_KERNEL)
+			error = zfs_batch_secpolicy(zfs_secpolicy_snapshot,
+			    poolname, snapnvl);
+#endif
+			if (error == 0) {
+				error = zfs_ioc_snapshot(poolname, snapnvl,
+				    opout);
+			}
+			nvlist_free(merged);
+		} else if (strcmp(op, "set_props") == 0) {
+			nvlist_t *dsprops = fnvlist_alloc();
+			nvlist_t *props;
+
+			for (j = i; j < nops; j++) {
+				if (nvlist_lookup_string(ops[j], "op",
+				    &op) != 0 || strcmp(op, "set_props") != 0 ||
+				    nvlist_lookup_string(ops[j], "name",
+				    &name) != 0 ||
+				    nvlist_lookup_nvlist(ops[j], "props",
+				    &props) != 0 ||
+				    nvlist_exists(dsprops, name))
+					break;
+				fnvlist_add_nvlist(dsprops, name, props);
+			}
+			if (j == i) {
+				error = SET_ERROR(EINVAL);
+				j++;
+			} else {
+				error = zfs_set_props_multi(poolname, dsprops,
+				    opout);
+			}
+			nvlist_free(dsprops);
+		} else if (strcmp(op, "create") == 0) {
+			size_t poollen = strlen(poolname);
+
+			if (nvlist_lookup_string(ops[i], "name", &name) != 0)
+				error = SET_ERROR(EINVAL);
+			else if (strncmp(name, poolname, poollen) != 0 ||
+			    name[poollen] != '/')
+				error = SET_ERROR(EXDEV);
+#if defined(_KERNEL)
+			if (error == 0) {
+				error = zfs_batch_secpolicy(
+				    zfs_secpolicy_create_clone, name, ops[i]);
+			}
+#endif
+			if (error == 0)
+				error = zfs_ioc_create(name, ops[i], opout);
+		} else if (strcmp(op, "stats") == 0) {
+			dmu_objset_stats_t stats;
+			nvlist_t *props;
+			objset_t *os;
+
+			if (nvlist_lookup_string(ops[i], "name", &name) != 0)
+				error = SET_ERROR(EINVAL);
+#if defined(_KERNEL)
+			if (error == 0) {
+				error = zfs_batch_secpolicy(zfs_secpolicy_read,
+				    name, ops[i]);
+			}
+#endif
+			if (error == 0)
+				error = dmu_objset_hold(name, FTAG, &os);
+			if (error == 0) {
+				error = zfs_objset_stats_nvl(os, &stats, &props);
+				dmu_objset_rele(os, FTAG);
+			}
+			if (error == 0) {
+				fnvlist_add_uint8_array(opout, "stats",
+				    (uint8_t *)&stats, sizeof (stats));
+				fnvlist_add_nvlist(opout, "props", props);
+				nvlist_free(props);
+			}
+		} else {
+			error = SET_ERROR(ENOTSUP);
+		}
+
+		(void) snprintf(idx, sizeof (idx), "%u", i);
+		if (!nvlist_empty(opout))
+			fnvlist_add_nvlist(outnvl, idx, opout);
+		if (error != 0)
+			fnvlist_add_int32(outnvl, "failed_op", i);
+		nvlist_free(opout);
+	}
+
+	return (error);
+}
+
 /*
  * innvl: "message" -> string
  */
@@ -4181,6 +4681,24 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 				spa_close(spa, FTAG);
 			}
 
+			if (ZIO_COMPRESS_RAW(intval) == ZIO_COMPRESS_ZSTD) {
+				spa_t *spa;
+
+				if (zio_compress_table[ZIO_COMPRESS_ZSTD].
+				    ci_compress == NULL)
+					return (SET_ERROR(ENOTSUP));
+
+				if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+					return (err);
+
+				if (!spa_feature_is_enabled(spa,
+				    SPA_FEATURE_ZSTD_COMPRESS)) {
+					spa_close(spa, FTAG);
+					return (SET_ERROR(ENOTSUP));
+				}
+				spa_close(spa, FTAG);
+			}
+
 			/*
 			 * If this is a bootable dataset then
 			 * verify that the compression algorithm
@@ -5361,6 +5879,34 @@ zfs_ioc_clear(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * inputs:
+ * zc_name              name of the pool
+ * zc_flags             start or stop (pool_trim_cmd_t)
+ * zc_cookie            rate in bytes/sec, 0 for zfs_trim_rate
+ */
+static int
+zfs_ioc_pool_trim(zfs_cmd_t *zc)
+{
+	spa_t *spa;
+	int error;
+
+	if (zc->zc_flags >= POOL_TRIM_CMDS_END)
+		return (SET_ERROR(EINVAL));
+
+	if ((error = spa_open(zc->zc_name, &spa, FTAG)) != 0)
+		return (error);
+
+	if (zc->zc_flags == POOL_TRIM_STOP)
+		error = spa_trim_stop(spa);
+	else
+		error = spa_trim(spa, zc->zc_cookie);
+
+	spa_close(spa, FTAG);
+
+	return (error);
+}
+
 #if defined(_KERNEL)
 static int
 zfs_ioc_pool_reopen(zfs_cmd_t *zc)
@@ -6481,6 +7027,10 @@ zfs_ioctl_init(void)
 	    zfs_ioc_snapshot, zfs_secpolicy_snapshot, POOL_NAME,
 	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_TRUE, B_TRUE);
 
+	zfs_ioctl_register("batch", ZFS_IOC_BATCH,
+	    zfs_ioc_batch, zfs_secpolicy_none, POOL_NAME,
+	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_FALSE, B_TRUE);
+
 	zfs_ioctl_register("log_history", ZFS_IOC_LOG_HISTORY,
 	    zfs_ioc_log_history, zfs_secpolicy_log_history, NO_NAME,
 	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_FALSE, B_FALSE);
@@ -6554,6 +7104,8 @@ zfs_ioctl_init(void)
 	    zfs_secpolicy_config, B_TRUE, POOL_CHECK_NONE);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_SCAN,
 	    zfs_ioc_pool_scan);
+	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_TRIM,
+	    zfs_ioc_pool_trim);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_POOL_UPGRADE,
 	    zfs_ioc_pool_upgrade);
 	zfs_ioctl_register_pool_modify(ZFS_IOC_VDEV_ADD,
@@ -6634,6 +7186,8 @@ zfs_ioctl_init(void)
 	    zfs_ioc_objset_zplprops);
 	zfs_ioctl_register_dataset_read(ZFS_IOC_DATASET_LIST_NEXT,
 	    zfs_ioc_dataset_list_next);
+	zfs_ioctl_register_dataset_read(ZFS_IOC_DATASET_LIST_BATCH,
+	    zfs_ioc_dataset_list_batch);
 	zfs_ioctl_register_dataset_read(ZFS_IOC_SNAPSHOT_LIST_NEXT,
 	    zfs_ioc_snapshot_list_next);
 	zfs_ioctl_register_dataset_read(ZFS_IOC_SEND_PROGRESS,
@@ -6654,6 +7208,9 @@ zfs_ioctl_init(void)
 
 	zfs_ioctl_register_dataset_modify(ZFS_IOC_SET_PROP, zfs_ioc_set_prop,
 	    zfs_secpolicy_none);
+	zfs_ioctl_register_legacy(ZFS_IOC_SET_PROPS_MULTI,
+	    zfs_ioc_set_props_multi, zfs_secpolicy_none, POOL_NAME, B_TRUE,
+	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY);
 	zfs_ioctl_register_dataset_modify(ZFS_IOC_DESTROY, zfs_ioc_destroy,
 	    zfs_secpolicy_destroy);
 	zfs_ioctl_register_dataset_modify(ZFS_IOC_RENAME, zfs_ioc_rename,
@@ -7222,6 +7779,7 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 	int puterror = 0;
 	int err;
 	nvlist_t *innvl = NULL;
+	nv_alloc_t nva;
 	uzfs_ioctl_t *uzfs_cmd = &ucmd_info->uzfs_cmd;
 
 	if (zc->zc_nvlist_src_size > MAX_NVLIST_SRC_SIZE) {
@@ -7239,11 +7797,21 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		 * zcmd_expand_dst_nvlist() for details.
 		 */
 		return (EINVAL); /* User's size too big */
-	} else if (zc->zc_nvlist_src_size != 0) {
-		err = get_nvlist(zc->zc_nvlist_src, zc->zc_nvlist_src_size, 0,
-		    &innvl);
-		if (err != 0)
+	}
+
+	/*
+	 * The nvlists passed in and out of the ioctl are allocated from an
+	 * arena, which is thrown away as a whole once the reply is packed.
+	 */
+	VERIFY0(nv_alloc_init(&nva, nv_arena_ops, (size_t)0));
+
+	if (zc->zc_nvlist_src_size != 0) {
+		err = get_nvlist_nva(zc->zc_nvlist_src, zc->zc_nvlist_src_size,
+		    &nva, &innvl);
+		if (err != 0) {
+			nv_alloc_fini(&nva);
 			return (err);
+		}
 	}
 
 	err = ENOTSUP;
@@ -7264,7 +7832,7 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		err = zfs_ioc_pool_tryimport(zc);
 		break;
 	case ZFS_IOC_CREATE: {
-		nvlist_t *outnvl = fnvlist_alloc();
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
 
 		err = zfs_ioc_create(zc->zc_name, innvl, outnvl);
 		if (!nvlist_empty(outnvl) || zc->zc_nvlist_dst_size != 0) {
@@ -7289,8 +7857,11 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 	case ZFS_IOC_DATASET_LIST_NEXT:
 		err = zfs_ioc_dataset_list_next(zc);
 		break;
+	case ZFS_IOC_DATASET_LIST_BATCH:
+		err = zfs_ioc_dataset_list_batch(zc);
+		break;
 	case ZFS_IOC_GET_BOOKMARKS: {
-		nvlist_t *outnvl = fnvlist_alloc();
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
 		err = zfs_ioc_get_bookmarks(zc->zc_name, innvl, outnvl);
 		if (!nvlist_empty(outnvl) || zc->zc_nvlist_dst_size != 0) {
 			int smusherror = 0;
@@ -7318,7 +7889,7 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		err = zfs_ioc_pool_get_history(zc);
 		break;
 	case ZFS_IOC_LOG_HISTORY: {
-		nvlist_t *outnvl = fnvlist_alloc();
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
 
 		err = zfs_ioc_log_history(pool, innvl, outnvl);
 		if (!nvlist_empty(outnvl) || zc->zc_nvlist_dst_size != 0) {
@@ -7337,7 +7908,7 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		break;
 	}
 	case ZFS_IOC_SNAPSHOT: {
-		nvlist_t *outnvl = fnvlist_alloc();
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
 
 		err = zfs_ioc_snapshot(zc->zc_name, innvl, outnvl);
 		if (!nvlist_empty(outnvl) || zc->zc_nvlist_dst_size != 0) {
@@ -7355,6 +7926,18 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		nvlist_free(outnvl);
 		break;
 	}
+	case ZFS_IOC_BATCH: {
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
+
+		err = zfs_ioc_batch(zc->zc_name, innvl, outnvl);
+		if (!nvlist_empty(outnvl) || zc->zc_nvlist_dst_size != 0)
+			puterror = put_nvlist(zc, outnvl);
+		if (puterror != 0)
+			err = puterror;
+
+		nvlist_free(outnvl);
+		break;
+	}
 	case ZFS_IOC_SNAPSHOT_LIST_NEXT:
 		err = zfs_ioc_snapshot_list_next(zc);
 		break;
@@ -7362,7 +7945,7 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		err = zfs_ioc_pool_destroy(zc);
 		break;
 	case ZFS_IOC_DESTROY_SNAPS: {
-		nvlist_t *outnvl = fnvlist_alloc();
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
 
 		err = zfs_ioc_destroy_snaps(zc->zc_name, innvl, outnvl);
 		if (!nvlist_empty(outnvl) || zc->zc_nvlist_dst_size != 0) {
@@ -7389,11 +7972,14 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 	case ZFS_IOC_SET_PROP:
 		err = zfs_ioc_set_prop(zc);
 		break;
+	case ZFS_IOC_SET_PROPS_MULTI:
+		err = zfs_ioc_set_props_multi(zc);
+		break;
 	case ZFS_IOC_SEND:
 		err = zfs_ioc_send(zc, ucmd_info);
 		break;
 	case ZFS_IOC_SEND_NEW: {
-		nvlist_t *outnvl = fnvlist_alloc();
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
 
 		err = zfs_ioc_send_new(zc->zc_name, innvl, outnvl, ucmd_info);
 		if (!nvlist_empty(outnvl) || zc->zc_nvlist_dst_size != 0) {
@@ -7415,7 +8001,7 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		err = zfs_ioc_recv(zc, ucmd_info);
 		break;
 	case ZFS_IOC_RECV_NEW: {
-		nvlist_t *outnvl = fnvlist_alloc();
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
 
 		err = zfs_ioc_recv_new(zc->zc_name, innvl, outnvl, ucmd_info);
 		if (!nvlist_empty(outnvl) || zc->zc_nvlist_dst_size != 0) {
@@ -7455,7 +8041,7 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		err = zfs_ioc_promote(zc);
 		break;
 	case ZFS_IOC_CLONE: {
-		nvlist_t *outnvl = fnvlist_alloc();
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
 
 		err = zfs_ioc_clone(zc->zc_name, innvl, outnvl);
 		if (!nvlist_empty(outnvl) || zc->zc_nvlist_dst_size != 0) {
@@ -7477,7 +8063,7 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		break;
 #ifdef  _UZFS
 	case ZFS_IOC_STATS: {
-		nvlist_t *outnvl = fnvlist_alloc();
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
 		err = uzfs_ioc_stats(zc, outnvl);
 		if (err == 0)
 			err = put_nvlist(zc, outnvl);
@@ -7485,18 +8071,24 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 		break;
 	}
 	case ZFS_IOC_LIST_SNAP: {
-		nvlist_t *outnvl = fnvlist_alloc();
+		nvlist_t *outnvl = uzfs_ioc_nvlist_alloc(&nva);
 		err = uzfs_ioc_list_snap(zc, outnvl);
 		if (err == 0)
 			err = put_nvlist(zc, outnvl);
 		nvlist_free(outnvl);
 		break;
 	}
+	case ZFS_IOC_STATS_BINARY:
+		err = uzfs_ioc_stats_binary(zc);
+		break;
 #endif
 	case ZFS_IOC_CLEAR: {
 		err = zfs_ioc_clear(zc);
 		break;
 	}
+	case ZFS_IOC_POOL_TRIM:
+		err = zfs_ioc_pool_trim(zc);
+		break;
 	default:
 		fprintf(stderr, "ioctl(0x%lx) not supported!\n",
 		    uzfs_cmd->ioc_num);
@@ -7504,26 +8096,72 @@ uzfs_handle_ioctl(const char *pool, zfs_cmd_t *zc, uzfs_info_t *ucmd_info)
 	}
 
 	nvlist_free(innvl);
+	nv_alloc_fini(&nva);
 
 	return (err);
 }
 
+#ifdef _UZFS
+/*
+ * Connection of each thread other than the main one, stored as fd + 1 so
+ * that 0 means none, and closed when the thread exits.
+ */
+static pthread_key_t uzfs_thread_fd_key;
+static pthread_once_t uzfs_thread_fd_once = PTHREAD_ONCE_INIT;
+
+static void
+uzfs_thread_fd_close(void *arg)
+{
+	(void) close((int)(uintptr_t)arg - 1);
+}
+
+static void
+uzfs_thread_fd_init(void)
+{
+	VERIFY0(pthread_key_create(&uzfs_thread_fd_key, uzfs_thread_fd_close));
+}
+
+static int
+uzfs_thread_fd(boolean_t reconnect)
+{
+	uintptr_t v;
+	int fd;
+
+	(void) pthread_once(&uzfs_thread_fd_once, uzfs_thread_fd_init);
+	v = (uintptr_t)pthread_getspecific(uzfs_thread_fd_key);
+	if (v != 0 && !reconnect)
+		return ((int)v - 1);
+	if (v != 0)
+		(void) close((int)v - 1);
+
+	fd = uzfs_client_init(UZFS_SOCK);
+	VERIFY0(pthread_setspecific(uzfs_thread_fd_key,
+	    (void *)(uintptr_t)(fd < 0 ? 0 : fd + 1)));
+	return (fd);
+}
+#endif
+
 int
 uzfs_ioctl(int fd, unsigned long request, zfs_cmd_t *zc)
 {
 #ifndef _UZFS
 	return (ioctl(fd, request, zc));
 #else
+	boolean_t main_thread = is_main_thread();
+
 	/*
 	 * uZFS kernel(tgt) does not handle multithreaded ioctl call parallely.
 	 * Here giving an illusion to the kernel that the call is coming
 	 * from a different process so that it can execute it parallely.
+	 * Each thread keeps its connection for later calls rather than
+	 * connecting again every time; one the target has dropped is
+	 * replaced once.
 	 */
-	if (!is_main_thread()) {
-		fd = uzfs_client_init(UZFS_SOCK);
-	}
+	if (!main_thread)
+		fd = uzfs_thread_fd(B_FALSE);
 
-	if (uzfs_send_ioctl(fd, request, zc)) {
+	if (uzfs_send_ioctl(fd, request, zc) && (main_thread ||
+	    uzfs_send_ioctl(fd = uzfs_thread_fd(B_TRUE), request, zc))) {
 		perror("ioctl send failed\n");
 		exit(1);
 	}
@@ -7532,9 +8170,9 @@ uzfs_ioctl(int fd, unsigned long request, zfs_cmd_t *zc)
 
 	int err = (ret < 0 ? errno : ret);
 
-	if (!is_main_thread()) {
-		close(fd);
-	}
+	/* the reply was lost, so the stream is out of step: start over */
+	if (ret < 0 && !main_thread)
+		(void) uzfs_thread_fd(B_TRUE);
 
 	if (err)
 		return (SET_ERR(err));
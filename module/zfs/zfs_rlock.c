@@ -93,10 +93,31 @@
  * So if the block size needs to be grown then the whole file is
  * exclusively locked, then later the caller will reduce the lock
  * range to just the range to be written using zfs_reduce_range.
+ *
+ * Sharding
+ * --------
+ * Every lock and unlock takes zr_mutex, so a zvol receiving I/O from many
+ * threads serialises on it even when the ranges never overlap.  A range
+ * lock set up with zfs_rlock_init_sharded() is instead made of
+ * zfs_rlock_shards independent range locks.  The offsets are cut into
+ * stripes of 1 << zfs_rlock_shard_shift bytes which are dealt out to the
+ * shards in turn, and a range is locked, whole, in the shard of every
+ * stripe it touches (in all shards if it touches more stripes than there
+ * are shards).  Two overlapping ranges share a stripe and so meet in its
+ * shard, while the common small I/O touches a single stripe and takes a
+ * single shard's mutex.  A range spanning shards locks them in ascending
+ * order, which keeps waiters from deadlocking, and its rl_t keeps the
+ * shard locks in r_shard_rl.  Appends and block size growth change the
+ * range while it is being locked, so the ZPL does not shard its locks.
  */
 
 #include <sys/zfs_rlock.h>
 
+int zfs_rlock_shards = 16;
+int zfs_rlock_shard_shift = 20;
+
+#define	ZFS_RLOCK_SHARDS_MAX	64
+
 /*
  * Check if a write lock can be grabbed, or wait and recheck until available.
  */
@@ -422,8 +443,9 @@ got_lock:
  * for later unlocking or reduce range (if entire file
  * previously locked as RL_WRITER).
  */
-rl_t *
-zfs_range_lock(zfs_rlock_t *zrl, uint64_t off, uint64_t len, rl_type_t type)
+static rl_t *
+zfs_range_lock_impl(zfs_rlock_t *zrl, uint64_t off, uint64_t len,
+    rl_type_t type)
 {
 	rl_t *new;
 
@@ -431,6 +453,7 @@ zfs_range_lock(zfs_rlock_t *zrl, uint64_t off, uint64_t len, rl_type_t type)
 
 	new = kmem_alloc(sizeof (rl_t), KM_SLEEP);
 	new->r_zrl = zrl;
+	new->r_shard_rl = NULL;
 	new->r_off = off;
 	if (len + off < off)	/* overflow */
 		len = UINT64_MAX - off;
@@ -456,6 +479,64 @@ zfs_range_lock(zfs_rlock_t *zrl, uint64_t off, uint64_t len, rl_type_t type)
 	return (new);
 }
 
+/*
+ * Return the mask of shards a range must be locked in.
+ */
+static uint64_t
+zfs_range_shards(zfs_rlock_t *zrl, uint64_t off, uint64_t len)
+{
+	uint64_t first = off >> zrl->zr_shard_shift;
+	uint64_t last = (off + MAX(len, 1) - 1) >> zrl->zr_shard_shift;
+	uint64_t mask = 0;
+	uint64_t s;
+
+	if (last - first + 1 >= zrl->zr_nshards)
+		return (-1ULL >> (64 - zrl->zr_nshards));
+
+	for (s = first; s <= last; s++)
+		mask |= 1ULL << (s % zrl->zr_nshards);
+
+	return (mask);
+}
+
+rl_t *
+zfs_range_lock(zfs_rlock_t *zrl, uint64_t off, uint64_t len, rl_type_t type)
+{
+	rl_t *rl;
+	uint64_t mask;
+	int i;
+
+	if (zrl->zr_shards == NULL)
+		return (zfs_range_lock_impl(zrl, off, len, type));
+
+	ASSERT3U(type, !=, RL_APPEND);
+	if (len + off < off)	/* overflow */
+		len = UINT64_MAX - off;
+
+	mask = zfs_range_shards(zrl, off, len);
+	if (ISP2(mask)) {
+		return (zfs_range_lock_impl(
+		    &zrl->zr_shards[highbit64(mask) - 1], off, len, type));
+	}
+
+	/* lock in every shard, in ascending order */
+	rl = kmem_zalloc(sizeof (rl_t), KM_SLEEP);
+	rl->r_zrl = zrl;
+	rl->r_off = off;
+	rl->r_len = len;
+	rl->r_type = type;
+	rl->r_shard_rl = kmem_zalloc(zrl->zr_nshards * sizeof (rl_t *),
+	    KM_SLEEP);
+	for (i = 0; i < zrl->zr_nshards; i++) {
+		if (mask & (1ULL << i)) {
+			rl->r_shard_rl[i] = zfs_range_lock_impl(
+			    &zrl->zr_shards[i], off, len, type);
+		}
+	}
+
+	return (rl);
+}
+
 static void
 zfs_range_free(void *arg)
 {
@@ -547,6 +628,18 @@ zfs_range_unlock(rl_t *rl)
 	list_t free_list;
 	rl_t *free_rl;
 
+	if (rl->r_shard_rl != NULL) {
+		int i;
+
+		for (i = zrl->zr_nshards - 1; i >= 0; i--) {
+			if (rl->r_shard_rl[i] != NULL)
+				zfs_range_unlock(rl->r_shard_rl[i]);
+		}
+		kmem_free(rl->r_shard_rl, zrl->zr_nshards * sizeof (rl_t *));
+		kmem_free(rl, sizeof (rl_t));
+		return;
+	}
+
 	ASSERT(rl->r_type == RL_WRITER || rl->r_type == RL_READER);
 	ASSERT(rl->r_cnt == 1 || rl->r_cnt == 0);
 	ASSERT(!rl->r_proxy);
@@ -590,6 +683,8 @@ zfs_range_reduce(rl_t *rl, uint64_t off, uint64_t len)
 {
 	zfs_rlock_t *zrl = rl->r_zrl;
 
+	ASSERT3P(rl->r_shard_rl, ==, NULL);
+
 	/* Ensure there are no other locks */
 	ASSERT(avl_numnodes(&zrl->zr_avl) == 1);
 	ASSERT(rl->r_off == 0);
@@ -623,9 +718,51 @@ zfs_range_compare(const void *arg1, const void *arg2)
 	return (AVL_CMP(rl1->r_off, rl2->r_off));
 }
 
+void
+zfs_rlock_init_sharded(zfs_rlock_t *zrl)
+{
+	int i;
+
+	zfs_rlock_init(zrl);
+	zrl->zr_nshards = MIN(MAX(zfs_rlock_shards, 1), ZFS_RLOCK_SHARDS_MAX);
+	zrl->zr_shard_shift = MIN(MAX(zfs_rlock_shard_shift, 9), 63);
+	if (zrl->zr_nshards == 1) {
+		zrl->zr_nshards = 0;
+		return;
+	}
+
+	zrl->zr_shards = kmem_alloc(zrl->zr_nshards * sizeof (zfs_rlock_t),
+	    KM_SLEEP);
+	for (i = 0; i < zrl->zr_nshards; i++)
+		zfs_rlock_init(&zrl->zr_shards[i]);
+}
+
+void
+zfs_rlock_destroy_shards(zfs_rlock_t *zrl)
+{
+	int i;
+
+	for (i = 0; i < zrl->zr_nshards; i++)
+		zfs_rlock_destroy(&zrl->zr_shards[i]);
+	kmem_free(zrl->zr_shards, zrl->zr_nshards * sizeof (zfs_rlock_t));
+	zrl->zr_shards = NULL;
+	zrl->zr_nshards = 0;
+}
+
 #ifdef _KERNEL
+EXPORT_SYMBOL(zfs_rlock_init_sharded);
+EXPORT_SYMBOL(zfs_rlock_destroy_shards);
 EXPORT_SYMBOL(zfs_range_lock);
 EXPORT_SYMBOL(zfs_range_unlock);
 EXPORT_SYMBOL(zfs_range_reduce);
 EXPORT_SYMBOL(zfs_range_compare);
 #endif
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+module_param(zfs_rlock_shards, int, 0644);
+MODULE_PARM_DESC(zfs_rlock_shards, "Number of shards of a zvol range lock");
+
+module_param(zfs_rlock_shard_shift, int, 0644);
+MODULE_PARM_DESC(zfs_rlock_shard_shift,
+	"log2 of the stripe of a zvol mapped to one range lock shard");
+#endif
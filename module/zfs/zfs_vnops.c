@@ -983,7 +983,7 @@ zfs_get_done(zgd_t *zgd, int error)
 	zfs_iput_async(ZTOI(zp));
 
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	kmem_free(zgd, sizeof (zgd_t));
 }
@@ -996,7 +996,8 @@ static int zil_fault_io = 0;
  * Get data to generate a TX_WRITE intent log record.
  */
 int
-zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
+zfs_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio)
 {
 	zfsvfs_t *zfsvfs = arg;
 	objset_t *os = zfsvfs->z_os;
@@ -1026,7 +1027,7 @@ zfs_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
 	}
 
 	zgd = (zgd_t *)kmem_zalloc(sizeof (zgd_t), KM_SLEEP);
-	zgd->zgd_zilog = zfsvfs->z_log;
+	zgd->zgd_lwb = lwb;
 	zgd->zgd_private = zp;
 
 	/*
@@ -1420,7 +1421,12 @@ top:
 		fuid_dirtied = zfsvfs->z_fuid_dirty;
 		if (fuid_dirtied)
 			zfs_fuid_txhold(zfsvfs, tx);
-		dmu_tx_hold_zap(tx, dzp->z_id, TRUE, name);
+		/*
+		 * zfs_dirent_lock() has just looked the name up, which read
+		 * in the leaf it goes in, so the hold need not look it up a
+		 * second time to check for i/o errors.
+		 */
+		dmu_tx_hold_zap(tx, dzp->z_id, TRUE, NULL);
 		dmu_tx_hold_sa(tx, dzp->z_sa_hdl, B_FALSE);
 		if (!zfsvfs->z_use_sa &&
 		    acl_ids.z_aclp->z_acl_bytes > ZFS_ACE_SPACE) {
@@ -2004,7 +2010,7 @@ top:
 	 * Add a new entry to the directory.
 	 */
 	tx = dmu_tx_create(zfsvfs->z_os);
-	dmu_tx_hold_zap(tx, dzp->z_id, TRUE, dirname);
+	dmu_tx_hold_zap(tx, dzp->z_id, TRUE, NULL);
 	dmu_tx_hold_zap(tx, DMU_NEW_OBJECT, FALSE, NULL);
 	fuid_dirtied = zfsvfs->z_fuid_dirty;
 	if (fuid_dirtied)
@@ -2201,6 +2207,40 @@ out:
 	return (error);
 }
 
+/*
+ * Number of directory entries whose dnodes are prefetched together.
+ */
+#define	ZFS_READDIR_PREFETCH_BATCH	64
+
+/*
+ * Prefetch the dnodes (and with them the bonus buffers, which hold the
+ * SA attributes) of the objects collected by zfs_readdir().  A dnode
+ * block holds many dnodes, and the objects of a directory are often
+ * allocated close together while its entries come out in hash order, so
+ * the object numbers are sorted and each dnode block is prefetched once.
+ */
+static void
+zfs_readdir_prefetch(objset_t *os, uint64_t *objs, int nobjs)
+{
+	uint64_t obj, blk, lastblk = UINT64_MAX;
+	int i, j;
+
+	for (i = 1; i < nobjs; i++) {
+		obj = objs[i];
+		for (j = i; j > 0 && objs[j - 1] > obj; j--)
+			objs[j] = objs[j - 1];
+		objs[j] = obj;
+	}
+
+	for (i = 0; i < nobjs; i++) {
+		blk = objs[i] >> DNODES_PER_BLOCK_SHIFT;
+		if (blk == lastblk)
+			continue;
+		lastblk = blk;
+		dmu_prefetch(os, objs[i], 0, 0, 0, ZIO_PRIORITY_SYNC_READ);
+	}
+}
+
 /*
  * Read as many directory entries as will fit into the provided
  * dirent buffer from the given directory cursor position.
@@ -2236,6 +2276,8 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 	int		done = 0;
 	uint64_t	parent;
 	uint64_t	offset; /* must be unsigned; checks for < 1 */
+	uint64_t	*pf_objs = NULL;
+	int		pf_nobjs = 0;
 
 	ZFS_ENTER(zfsvfs);
 	ZFS_VERIFY_ZP(zp);
@@ -2254,6 +2296,10 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 	os = zfsvfs->z_os;
 	offset = ctx->pos;
 	prefetch = zp->z_zn_prefetch;
+	if (prefetch) {
+		pf_objs = kmem_alloc(ZFS_READDIR_PREFETCH_BATCH *
+		    sizeof (uint64_t), KM_SLEEP);
+	}
 
 	/*
 	 * Initialize the iterator cursor.
@@ -2333,10 +2379,13 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 		if (done)
 			break;
 
-		/* Prefetch znode */
+		/* Prefetch znode, a batch at a time */
 		if (prefetch) {
-			dmu_prefetch(os, objnum, 0, 0, 0,
-			    ZIO_PRIORITY_SYNC_READ);
+			pf_objs[pf_nobjs++] = objnum;
+			if (pf_nobjs == ZFS_READDIR_PREFETCH_BATCH) {
+				zfs_readdir_prefetch(os, pf_objs, pf_nobjs);
+				pf_nobjs = 0;
+			}
 		}
 
 		/*
@@ -2353,6 +2402,11 @@ zfs_readdir(struct inode *ip, zpl_dir_context_t *ctx, cred_t *cr)
 	zp->z_zn_prefetch = B_FALSE; /* a lookup will re-enable pre-fetching */
 
 update:
+	if (pf_objs != NULL) {
+		zfs_readdir_prefetch(os, pf_objs, pf_nobjs);
+		kmem_free(pf_objs, ZFS_READDIR_PREFETCH_BATCH *
+		    sizeof (uint64_t));
+	}
 	zap_cursor_fini(&zc);
 	if (error == ENOENT)
 		error = 0;
@@ -3805,7 +3859,7 @@ top:
 	tx = dmu_tx_create(zfsvfs->z_os);
 	fuid_dirtied = zfsvfs->z_fuid_dirty;
 	dmu_tx_hold_write(tx, DMU_NEW_OBJECT, 0, MAX(1, len));
-	dmu_tx_hold_zap(tx, dzp->z_id, TRUE, name);
+	dmu_tx_hold_zap(tx, dzp->z_id, TRUE, NULL);
 	dmu_tx_hold_sa_create(tx, acl_ids.z_aclp->z_acl_bytes +
 	    ZFS_SA_BASE_ATTR_SIZE + len);
 	dmu_tx_hold_sa(tx, dzp->z_sa_hdl, B_FALSE);
@@ -4035,7 +4089,7 @@ top:
 
 	tx = dmu_tx_create(zfsvfs->z_os);
 	dmu_tx_hold_sa(tx, szp->z_sa_hdl, B_FALSE);
-	dmu_tx_hold_zap(tx, dzp->z_id, TRUE, name);
+	dmu_tx_hold_zap(tx, dzp->z_id, TRUE, NULL);
 	if (is_tmpfile)
 		dmu_tx_hold_zap(tx, zfsvfs->z_unlinkedobj, FALSE, NULL);
 
@@ -97,7 +97,7 @@
 
 static kmem_cache_t *znode_cache = NULL;
 static kmem_cache_t *znode_hold_cache = NULL;
-unsigned int zfs_object_mutex_size = ZFS_OBJ_MTX_SZ;
+unsigned int zfs_object_mutex_size = 0;
 
 /*ARGSUSED*/
 static int
@@ -226,6 +226,27 @@ zfs_znode_fini(void)
  * allocated and freed.  However, because these are backed by a kmem cache
  * and very short lived this cost is minimal.
  */
+/*
+ * Return the number of buckets for a new file system's znode hold table.
+ * Unless zfs_object_mutex_size sets it, the table grows with the number
+ * of CPUs that may look up znodes at once, as far as one bucket per 2MB
+ * of memory allows, so that parallel creates and stats rarely contend on
+ * a bucket lock.  The result is a power of two.
+ */
+int
+zfs_znode_hold_size(void)
+{
+	uint64_t size = zfs_object_mutex_size;
+
+	if (size == 0) {
+		size = MIN((uint64_t)max_ncpus * 32,
+		    (uint64_t)physmem * PAGESIZE / (2 * 1024 * 1024));
+		size = MAX(size, ZFS_OBJ_MTX_SZ);
+	}
+
+	return (MIN(1ULL << (highbit64(size) - 1), ZFS_OBJ_MTX_MAX));
+}
+
 int
 zfs_znode_hold_compare(const void *a, const void *b)
 {
@@ -1871,7 +1892,7 @@ zfs_create_fs(objset_t *os, cred_t *cr, nvlist_t *zplprops, dmu_tx_t *tx)
 	list_create(&zfsvfs->z_all_znodes, sizeof (znode_t),
 	    offsetof(znode_t, z_link_node));
 
-	size = MIN(1 << (highbit64(zfs_object_mutex_size)-1), ZFS_OBJ_MTX_MAX);
+	size = zfs_znode_hold_size();
 	zfsvfs->z_hold_size = size;
 	zfsvfs->z_hold_trees = vmem_zalloc(sizeof (avl_tree_t) * size,
 	    KM_SLEEP);
@@ -2174,5 +2195,6 @@ EXPORT_SYMBOL(zfs_obj_to_path);
 
 /* CSTYLED */
 module_param(zfs_object_mutex_size, uint, 0644);
-MODULE_PARM_DESC(zfs_object_mutex_size, "Size of znode hold array");
+MODULE_PARM_DESC(zfs_object_mutex_size,
+	"Size of znode hold array (0 to size by CPUs and memory)");
 #endif
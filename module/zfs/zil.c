@@ -28,6 +28,7 @@
 
 #include <sys/zfs_context.h>
 #include <sys/spa.h>
+#include <sys/spa_impl.h>
 #include <sys/dmu.h>
 #include <sys/zap.h>
 #include <sys/arc.h>
@@ -86,15 +87,34 @@ zil_stats_t zil_stats = {
 	{ "zil_itx_metaslab_normal_bytes",	KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_slog_count",	KSTAT_DATA_UINT64 },
 	{ "zil_itx_metaslab_slog_bytes",	KSTAT_DATA_UINT64 },
+	{ "zil_flush_count",			KSTAT_DATA_UINT64 },
+	{ "zil_flush_merged_count",		KSTAT_DATA_UINT64 },
 };
 
 static kstat_t *zil_ksp;
 
+/*
+ * This controls the amount of time that a ZIL block (lwb) will remain
+ * "open" when it isn't "full", and it has a thread waiting for it to be
+ * committed to stable storage.  Please refer to the zil_commit_waiter()
+ * function (and the comments within it) for more details.
+ */
+int zfs_commit_timeout_pct = 5;
+
 /*
  * Disable intent logging replay.  This global ZIL switch affects all pools.
  */
 int zil_replay_disable = 0;
 
+/*
+ * Number of threads replaying the log of a dataset whose records can be
+ * sorted into disjoint ranges (see zil_replay_parallel()), and the most
+ * record data replayed between two waits for all of them.  Setting
+ * zil_replay_threads to 1 or less replays one record at a time.
+ */
+int zil_replay_threads = 8;
+unsigned long zil_replay_batch_size = 64 * 1024 * 1024;
+
 /*
  * Tunable parameter for debugging or performance analysis.  Setting
  * zfs_nocacheflush will cause corruption on power loss if a volatile
@@ -110,8 +130,11 @@ int zfs_nocacheflush = 0;
 unsigned long zil_slog_bulk = 768 * 1024;
 
 static kmem_cache_t *zil_lwb_cache;
+static kmem_cache_t *zil_zcw_cache;
 
 static void zil_async_to_sync(zilog_t *zilog, uint64_t foid);
+static void zil_commit_waiter_skip(zil_commit_waiter_t *zcw);
+static void zil_commit_impl(zilog_t *zilog, uint64_t foid);
 
 #define	LWB_EMPTY(lwb) ((BP_GET_LSIZE(&lwb->lwb_blk) - \
     sizeof (zil_chain_t)) == (lwb->lwb_sz - lwb->lwb_nused))
@@ -466,10 +489,14 @@ zil_alloc_lwb(zilog_t *zilog, blkptr_t *bp, boolean_t slog, uint64_t txg,
 	lwb->lwb_blk = *bp;
 	lwb->lwb_fastwrite = fastwrite;
 	lwb->lwb_slog = slog;
+	lwb->lwb_state = LWB_STATE_CLOSED;
 	lwb->lwb_buf = zio_buf_alloc(BP_GET_LSIZE(bp));
 	lwb->lwb_max_txg = txg;
-	lwb->lwb_zio = NULL;
+	lwb->lwb_write_zio = NULL;
+	lwb->lwb_root_zio = NULL;
+	lwb->lwb_flush_zio = NULL;
 	lwb->lwb_tx = NULL;
+	lwb->lwb_issued_timestamp = 0;
 	if (BP_GET_CHECKSUM(bp) == ZIO_CHECKSUM_ZILOG2) {
 		lwb->lwb_nused = sizeof (zil_chain_t);
 		lwb->lwb_sz = BP_GET_LSIZE(bp);
@@ -482,9 +509,37 @@ zil_alloc_lwb(zilog_t *zilog, blkptr_t *bp, boolean_t slog, uint64_t txg,
 	list_insert_tail(&zilog->zl_lwb_list, lwb);
 	mutex_exit(&zilog->zl_lock);
 
+	ASSERT(!MUTEX_HELD(&lwb->lwb_vdev_lock));
+	ASSERT(avl_is_empty(&lwb->lwb_vdev_tree));
+	VERIFY(list_is_empty(&lwb->lwb_waiters));
+	VERIFY(list_is_empty(&lwb->lwb_itxs));
+
 	return (lwb);
 }
 
+static void
+zil_free_lwb(zilog_t *zilog, lwb_t *lwb)
+{
+	ASSERT(MUTEX_HELD(&zilog->zl_lock));
+	ASSERT(!MUTEX_HELD(&lwb->lwb_vdev_lock));
+	VERIFY(list_is_empty(&lwb->lwb_waiters));
+	VERIFY(list_is_empty(&lwb->lwb_itxs));
+	ASSERT(avl_is_empty(&lwb->lwb_vdev_tree));
+	ASSERT3P(lwb->lwb_write_zio, ==, NULL);
+	ASSERT3P(lwb->lwb_root_zio, ==, NULL);
+	ASSERT(lwb->lwb_state == LWB_STATE_CLOSED ||
+	    lwb->lwb_state == LWB_STATE_DONE);
+
+	/*
+	 * Clear the zilog's field to indicate this lwb is no longer
+	 * valid, and prevent use-after-free errors.
+	 */
+	if (zilog->zl_last_lwb_opened == lwb)
+		zilog->zl_last_lwb_opened = NULL;
+
+	kmem_cache_free(zil_lwb_cache, lwb);
+}
+
 /*
  * Called when we create in-memory log transactions so that we know
  * to cleanup the itxs at the end of spa_sync().
@@ -579,8 +634,9 @@ zil_create(zilog_t *zilog)
 			BP_ZERO(&blk);
 		}
 
-		error = zio_alloc_zil(zilog->zl_spa, txg, &blk,
-		    ZIL_MIN_BLKSZ, &slog);
+		error = zio_alloc_zil(zilog->zl_spa,
+		    dmu_objset_id(zilog->zl_os), txg, &blk, ZIL_MIN_BLKSZ,
+		    &slog);
 		fastwrite = TRUE;
 
 		if (error == 0)
@@ -650,7 +706,7 @@ zil_destroy(zilog_t *zilog, boolean_t keep_first)
 		ASSERT(zh->zh_claim_txg == 0);
 		VERIFY(!keep_first);
 		while ((lwb = list_head(&zilog->zl_lwb_list)) != NULL) {
-			ASSERT(lwb->lwb_zio == NULL);
+			ASSERT(lwb->lwb_write_zio == NULL);
 			if (lwb->lwb_fastwrite)
 				metaslab_fastwrite_unmark(zilog->zl_spa,
 				    &lwb->lwb_blk);
@@ -658,7 +714,7 @@ zil_destroy(zilog_t *zilog, boolean_t keep_first)
 			if (lwb->lwb_buf != NULL)
 				zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
 			zio_free_zil(zilog->zl_spa, txg, &lwb->lwb_blk);
-			kmem_cache_free(zil_lwb_cache, lwb);
+			zil_free_lwb(zilog, lwb);
 		}
 	} else if (!keep_first) {
 		zil_destroy_sync(zilog, tx);
@@ -807,9 +863,9 @@ zil_vdev_compare(const void *x1, const void *x2)
 }
 
 void
-zil_add_block(zilog_t *zilog, const blkptr_t *bp)
+zil_lwb_add_block(lwb_t *lwb, const blkptr_t *bp)
 {
-	avl_tree_t *t = &zilog->zl_vdev_tree;
+	avl_tree_t *t = &lwb->lwb_vdev_tree;
 	avl_index_t where;
 	zil_vdev_node_t *zv, zvsearch;
 	int ndvas = BP_GET_NDVAS(bp);
@@ -818,14 +874,12 @@ zil_add_block(zilog_t *zilog, const blkptr_t *bp)
 	if (zfs_nocacheflush)
 		return;
 
-	ASSERT(zilog->zl_writer);
-
 	/*
-	 * Even though we're zl_writer, we still need a lock because the
-	 * zl_get_data() callbacks may have dmu_sync() done callbacks
-	 * that will run concurrently.
+	 * The zl_get_data() callbacks may have dmu_sync() done callbacks
+	 * that run concurrently with the thread writing this lwb, so we
+	 * need a lock here.
 	 */
-	mutex_enter(&zilog->zl_vdev_lock);
+	mutex_enter(&lwb->lwb_vdev_lock);
 	for (i = 0; i < ndvas; i++) {
 		zvsearch.zv_vdev = DVA_GET_VDEV(&bp->blk_dva[i]);
 		if (avl_find(t, &zvsearch, &where) == NULL) {
@@ -834,56 +888,311 @@ zil_add_block(zilog_t *zilog, const blkptr_t *bp)
 			avl_insert(t, zv, where);
 		}
 	}
-	mutex_exit(&zilog->zl_vdev_lock);
+	mutex_exit(&lwb->lwb_vdev_lock);
 }
 
-static void
-zil_flush_vdevs(zilog_t *zilog)
+void
+zil_flush_group_init(spa_t *spa)
 {
-	spa_t *spa = zilog->zl_spa;
-	avl_tree_t *t = &zilog->zl_vdev_tree;
+	mutex_init(&spa->spa_zil_flush_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&spa->spa_zil_flush_tree, zil_vdev_compare,
+	    sizeof (zil_vdev_node_t), offsetof(zil_vdev_node_t, zv_node));
+	list_create(&spa->spa_zil_flush_list, sizeof (lwb_t),
+	    offsetof(lwb_t, lwb_flush_node));
+}
+
+void
+zil_flush_group_fini(spa_t *spa)
+{
+	ASSERT(!spa->spa_zil_flushing);
+	ASSERT0(avl_numnodes(&spa->spa_zil_flush_tree));
+
+	list_destroy(&spa->spa_zil_flush_list);
+	avl_destroy(&spa->spa_zil_flush_tree);
+	mutex_destroy(&spa->spa_zil_flush_lock);
+}
+
+static void zil_flush_round_done(zio_t *zio);
+
+/*
+ * Start a flush round for the vdevs queued in spa_zil_flush_tree, on behalf
+ * of the lwbs on spa_zil_flush_list.  The round's flushes are issued, but
+ * the caller must issue the returned root zio once it has dropped the
+ * spa_zil_flush_lock, as its done callback takes that lock.
+ */
+static zio_t *
+zil_flush_round_start(spa_t *spa)
+{
+	avl_tree_t *t = &spa->spa_zil_flush_tree;
 	void *cookie = NULL;
 	zil_vdev_node_t *zv;
+	list_t *lwbs;
 	zio_t *zio;
 
-	ASSERT(zilog->zl_writer);
-
-	/*
-	 * We don't need zl_vdev_lock here because we're the zl_writer,
-	 * and all zl_get_data() callbacks are done.
-	 */
-	if (avl_numnodes(t) == 0)
-		return;
+	ASSERT(MUTEX_HELD(&spa->spa_zil_flush_lock));
+	ASSERT(!spa->spa_zil_flushing);
 
-	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+	lwbs = kmem_alloc(sizeof (list_t), KM_SLEEP);
+	list_create(lwbs, sizeof (lwb_t), offsetof(lwb_t, lwb_flush_node));
+	list_move_tail(lwbs, &spa->spa_zil_flush_list);
+	spa->spa_zil_flushing = B_TRUE;
 
-	zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	ZIL_STAT_BUMP(zil_flush_count);
 
+	/*
+	 * We don't need the config lock to look up the vdevs, every lwb
+	 * of the round holds it as a reader until its root zio is done.
+	 * Not all devices actually support the DKIOCFLUSHWRITECACHE ioctl,
+	 * so it's OK if the flushes fail.  Devices known to have no write
+	 * cache, such as persistent memory, are skipped.
+	 */
+	zio = zio_root(spa, zil_flush_round_done, lwbs, ZIO_FLAG_CANFAIL);
 	while ((zv = avl_destroy_nodes(t, &cookie)) != NULL) {
 		vdev_t *vd = vdev_lookup_top(spa, zv->zv_vdev);
-		if (vd != NULL)
+		if (vd != NULL && !vd->vdev_nowritecache)
 			zio_flush(zio, vd);
 		kmem_free(zv, sizeof (*zv));
 	}
 
+	return (zio);
+}
+
+/*
+ * Called when the flushes of a round complete.  The lwbs of the round are
+ * released so they can complete, and the next round is started for the
+ * lwbs whose writes completed while this one was in progress.
+ */
+static void
+zil_flush_round_done(zio_t *zio)
+{
+	spa_t *spa = zio->io_spa;
+	list_t *lwbs = zio->io_private;
+	zio_t *next = NULL;
+	lwb_t *lwb;
+
+	mutex_enter(&spa->spa_zil_flush_lock);
+	ASSERT(spa->spa_zil_flushing);
+	spa->spa_zil_flushing = B_FALSE;
+	if (!list_is_empty(&spa->spa_zil_flush_list))
+		next = zil_flush_round_start(spa);
+	mutex_exit(&spa->spa_zil_flush_lock);
+
+	while ((lwb = list_remove_head(lwbs)) != NULL) {
+		zio_t *fzio = lwb->lwb_flush_zio;
+
+		lwb->lwb_flush_zio = NULL;
+		zio_nowait(fzio);
+	}
+	list_destroy(lwbs);
+	kmem_free(lwbs, sizeof (list_t));
+
+	if (next != NULL)
+		zio_nowait(next);
+}
+
+/*
+ * Queue the flushes of the vdevs written by an lwb.
+ *
+ * Log blocks of different datasets of a pool share flushes: the vdevs of an
+ * lwb are merged into the pool wide spa_zil_flush_tree. The lwbs whose
+ * writes complete while a flush round is in progress are collected and
+ * a single round is then issued for the vdevs of all of them.  An lwb is
+ * done once a round which started after its write completed has completed;
+ * until then its root zio is held open by an unissued null child.
+ */
+static void
+zil_lwb_flush_queue(lwb_t *lwb)
+{
+	spa_t *spa = lwb->lwb_zilog->zl_spa;
+	avl_tree_t *t = &lwb->lwb_vdev_tree;
+	void *cookie = NULL;
+	avl_index_t where;
+	zil_vdev_node_t *zv;
+	zio_t *zio = NULL;
+
+	ASSERT3P(lwb->lwb_flush_zio, ==, NULL);
+	lwb->lwb_flush_zio = zio_null(lwb->lwb_root_zio, spa, NULL, NULL,
+	    NULL, ZIO_FLAG_CANFAIL);
+
+	mutex_enter(&spa->spa_zil_flush_lock);
+	while ((zv = avl_destroy_nodes(t, &cookie)) != NULL) {
+		if (avl_find(&spa->spa_zil_flush_tree, zv, &where) == NULL)
+			avl_insert(&spa->spa_zil_flush_tree, zv, where);
+		else
+			kmem_free(zv, sizeof (*zv));
+	}
+
+	if (!list_is_empty(&spa->spa_zil_flush_list))
+		ZIL_STAT_BUMP(zil_flush_merged_count);
+	list_insert_tail(&spa->spa_zil_flush_list, lwb);
+
+	if (!spa->spa_zil_flushing)
+		zio = zil_flush_round_start(spa);
+	mutex_exit(&spa->spa_zil_flush_lock);
+
+	if (zio != NULL)
+		zio_nowait(zio);
+}
+
+/*
+ * This function is used when the given waiter is to be linked into an
+ * lwb's "lwb_waiter" list; i.e. when the itx is committed to the lwb.
+ * At this point, the waiter will no longer be referenced by the itx,
+ * and instead, will be referenced by the lwb.
+ */
+static void
+zil_commit_waiter_link_lwb(zil_commit_waiter_t *zcw, lwb_t *lwb)
+{
 	/*
-	 * Wait for all the flushes to complete.  Not all devices actually
-	 * support the DKIOCFLUSHWRITECACHE ioctl, so it's OK if it fails.
+	 * The lwb_waiters field of the lwb is protected by the zilog's
+	 * zl_lock, thus it must be held when calling this function.
 	 */
-	(void) zio_wait(zio);
+	ASSERT(MUTEX_HELD(&lwb->lwb_zilog->zl_lock));
+
+	mutex_enter(&zcw->zcw_lock);
+	ASSERT(!list_link_active(&zcw->zcw_node));
+	ASSERT3P(zcw->zcw_lwb, ==, NULL);
+	ASSERT3P(lwb, !=, NULL);
+	ASSERT(lwb->lwb_state == LWB_STATE_OPENED ||
+	    lwb->lwb_state == LWB_STATE_ISSUED);
+
+	list_insert_tail(&lwb->lwb_waiters, zcw);
+	zcw->zcw_lwb = lwb;
+	mutex_exit(&zcw->zcw_lock);
+}
 
-	spa_config_exit(spa, SCL_STATE, FTAG);
+/*
+ * This function is used when zio_alloc_zil() fails to allocate a ZIL
+ * block, and the given waiter must be linked to the "nolwb waiters"
+ * list inside of zil_process_commit_list().
+ */
+static void
+zil_commit_waiter_link_nolwb(zil_commit_waiter_t *zcw, list_t *nolwb)
+{
+	mutex_enter(&zcw->zcw_lock);
+	ASSERT(!list_link_active(&zcw->zcw_node));
+	ASSERT3P(zcw->zcw_lwb, ==, NULL);
+	list_insert_tail(nolwb, zcw);
+	mutex_exit(&zcw->zcw_lock);
 }
 
 /*
- * Function called when a log block write completes
+ * Mark a waiter done without it having been committed to an lwb; the itxs
+ * it waits for are either already on stable storage, or the caller is about
+ * to make sure they are with txg_wait_synced().
  */
 static void
-zil_lwb_write_done(zio_t *zio)
+zil_commit_waiter_skip(zil_commit_waiter_t *zcw)
+{
+	mutex_enter(&zcw->zcw_lock);
+	ASSERT(!zcw->zcw_done);
+	zcw->zcw_done = B_TRUE;
+	cv_broadcast(&zcw->zcw_cv);
+	mutex_exit(&zcw->zcw_lock);
+}
+
+/*
+ * This is called when an lwb's write zio completes and the flushes of the
+ * vdevs it touched are done, which makes the lwb and the itxs it holds
+ * stable.  The waiters on the lwb are signalled here.
+ */
+static void
+zil_lwb_flush_vdevs_done(zio_t *zio)
 {
 	lwb_t *lwb = zio->io_private;
 	zilog_t *zilog = lwb->lwb_zilog;
 	dmu_tx_t *tx = lwb->lwb_tx;
+	zil_commit_waiter_t *zcw;
+	itx_t *itx;
+
+	spa_config_exit(zilog->zl_spa, SCL_STATE, lwb);
+
+	zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
+
+	mutex_enter(&zilog->zl_lock);
+
+	/*
+	 * Ensure the lwb buffer pointer is cleared before releasing the
+	 * txg. If we have had an allocation failure and the txg is
+	 * waiting to sync then we want zil_sync() to remove the lwb so
+	 * that it's not picked up as the next new one in
+	 * zil_process_commit_list(). zil_sync() will only remove the
+	 * lwb if lwb_buf is null.
+	 */
+	lwb->lwb_buf = NULL;
+	lwb->lwb_tx = NULL;
+
+	ASSERT3U(lwb->lwb_issued_timestamp, >, 0);
+	zilog->zl_last_lwb_latency = gethrtime() - lwb->lwb_issued_timestamp;
+
+	lwb->lwb_root_zio = NULL;
+	lwb->lwb_state = LWB_STATE_DONE;
+
+	/*
+	 * Remember the highest committed log sequence number for ztest.
+	 * We only update this value when all the log writes succeeded,
+	 * because ztest wants to ASSERT that it got the whole log chain.
+	 * The root zio of each lwb depends on the one opened before it,
+	 * so write errors are passed along the chain.
+	 */
+	if (zio->io_error == 0 && zilog->zl_last_lwb_opened == lwb)
+		zilog->zl_commit_lr_seq = zilog->zl_lr_seq;
+
+	while ((itx = list_head(&lwb->lwb_itxs)) != NULL) {
+		if (itx->itx_callback != NULL)
+			itx->itx_callback(itx->itx_callback_data);
+		list_remove(&lwb->lwb_itxs, itx);
+		zil_itx_destroy(itx);
+	}
+
+	while ((zcw = list_head(&lwb->lwb_waiters)) != NULL) {
+		mutex_enter(&zcw->zcw_lock);
+
+		ASSERT(list_link_active(&zcw->zcw_node));
+		list_remove(&lwb->lwb_waiters, zcw);
+
+		ASSERT3P(zcw->zcw_lwb, ==, lwb);
+		zcw->zcw_lwb = NULL;
+
+		zcw->zcw_zio_error = zio->io_error;
+
+		ASSERT(!zcw->zcw_done);
+		zcw->zcw_done = B_TRUE;
+		cv_broadcast(&zcw->zcw_cv);
+
+		mutex_exit(&zcw->zcw_lock);
+	}
+
+	mutex_exit(&zilog->zl_lock);
+
+	/*
+	 * Now that we've written this log block, we have a stable pointer
+	 * to the next block in the chain, so it's OK to let the txg in
+	 * which we allocated the next block sync.
+	 */
+	dmu_tx_commit(tx);
+}
+
+/*
+ * This is called when an lwb write completes. This means, this specific
+ * lwb was written to disk, and all dependent lwb have also been
+ * written to disk.
+ *
+ * At this point, a DKIOCFLUSHWRITECACHE command hasn't been issued to
+ * the VDEVs involved in writing out this specific lwb. The lwb will be
+ * "done" once zil_lwb_flush_vdevs_done() is called, which occurs in the
+ * zio completion callback for the lwb's root zio.
+ */
+static void
+zil_lwb_write_done(zio_t *zio)
+{
+	lwb_t *lwb = zio->io_private;
+	zilog_t *zilog = lwb->lwb_zilog;
+	avl_tree_t *t = &lwb->lwb_vdev_tree;
+	void *cookie = NULL;
+	zil_vdev_node_t *zv;
+
+	ASSERT3S(spa_config_held(zio->io_spa, SCL_STATE, RW_READER), !=, 0);
 
 	ASSERT(BP_GET_COMPRESS(zio->io_bp) == ZIO_COMPRESS_OFF);
 	ASSERT(BP_GET_TYPE(zio->io_bp) == DMU_OT_INTENT_LOG);
@@ -893,54 +1202,62 @@ zil_lwb_write_done(zio_t *zio)
 	ASSERT(!BP_IS_HOLE(zio->io_bp));
 	ASSERT(BP_GET_FILL(zio->io_bp) == 0);
 
-	/*
-	 * Ensure the lwb buffer pointer is cleared before releasing
-	 * the txg. If we have had an allocation failure and
-	 * the txg is waiting to sync then we want want zil_sync()
-	 * to remove the lwb so that it's not picked up as the next new
-	 * one in zil_commit_writer(). zil_sync() will only remove
-	 * the lwb if lwb_buf is null.
-	 */
 	abd_put(zio->io_abd);
-	zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
+
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_ISSUED);
+
 	mutex_enter(&zilog->zl_lock);
-	lwb->lwb_zio = NULL;
+	lwb->lwb_write_zio = NULL;
 	lwb->lwb_fastwrite = FALSE;
-	lwb->lwb_buf = NULL;
-	lwb->lwb_tx = NULL;
 	mutex_exit(&zilog->zl_lock);
 
+	if (avl_numnodes(t) == 0)
+		return;
+
 	/*
-	 * Now that we've written this log block, we have a stable pointer
-	 * to the next block in the chain, so it's OK to let the txg in
-	 * which we allocated the next block sync.
+	 * If there was an IO error, we're not going to flush these vdevs,
+	 * so we simply empty the tree and free the nodes. There isn't any
+	 * good reason for flushing after the lwb block failed to be
+	 * written out.
 	 */
-	dmu_tx_commit(tx);
+	if (zio->io_error != 0) {
+		while ((zv = avl_destroy_nodes(t, &cookie)) != NULL)
+			kmem_free(zv, sizeof (*zv));
+		return;
+	}
+
+	zil_lwb_flush_queue(lwb);
 }
 
 /*
- * Initialize the io for a log block.
+ * This function's purpose is to "open" an lwb such that it is ready to
+ * accept new itxs being committed to it. To do this, the lwb's zio
+ * structures are created, and linked to the lwb. This function is
+ * idempotent; if the passed in lwb has already been opened, this
+ * function is essentially a no-op.
  */
 static void
-zil_lwb_write_init(zilog_t *zilog, lwb_t *lwb)
+zil_lwb_write_open(zilog_t *zilog, lwb_t *lwb)
 {
 	zbookmark_phys_t zb;
 	zio_priority_t prio;
 
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
+	ASSERT3P(lwb, !=, NULL);
+	EQUIV(lwb->lwb_root_zio == NULL, lwb->lwb_state == LWB_STATE_CLOSED);
+	EQUIV(lwb->lwb_root_zio != NULL, lwb->lwb_state == LWB_STATE_OPENED);
+
 	SET_BOOKMARK(&zb, lwb->lwb_blk.blk_cksum.zc_word[ZIL_ZC_OBJSET],
 	    ZB_ZIL_OBJECT, ZB_ZIL_LEVEL,
 	    lwb->lwb_blk.blk_cksum.zc_word[ZIL_ZC_SEQ]);
 
-	if (zilog->zl_root_zio == NULL) {
-		zilog->zl_root_zio = zio_root(zilog->zl_spa, NULL, NULL,
-		    ZIO_FLAG_CANFAIL);
-	}
-
 	/* Lock so zil_sync() doesn't fastwrite_unmark after zio is created */
 	mutex_enter(&zilog->zl_lock);
-	if (lwb->lwb_zio == NULL) {
+	if (lwb->lwb_root_zio == NULL) {
 		abd_t *lwb_abd = abd_get_from_buf(lwb->lwb_buf,
 		    BP_GET_LSIZE(&lwb->lwb_blk));
+		lwb_t *last = zilog->zl_last_lwb_opened;
+
 		if (!lwb->lwb_fastwrite) {
 			metaslab_fastwrite_mark(zilog->zl_spa, &lwb->lwb_blk);
 			lwb->lwb_fastwrite = 1;
@@ -949,13 +1266,33 @@ zil_lwb_write_init(zilog_t *zilog, lwb_t *lwb)
 			prio = ZIO_PRIORITY_SYNC_WRITE;
 		else
 			prio = ZIO_PRIORITY_ASYNC_WRITE;
-		lwb->lwb_zio = zio_rewrite(zilog->zl_root_zio, zilog->zl_spa,
-		    0, &lwb->lwb_blk, lwb_abd, BP_GET_LSIZE(&lwb->lwb_blk),
-		    zil_lwb_write_done, lwb, prio,
-		    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
-		    ZIO_FLAG_FASTWRITE, &zb);
+
+		lwb->lwb_root_zio = zio_root(zilog->zl_spa,
+		    zil_lwb_flush_vdevs_done, lwb, ZIO_FLAG_CANFAIL);
+		lwb->lwb_write_zio = zio_rewrite(lwb->lwb_root_zio,
+		    zilog->zl_spa, 0, &lwb->lwb_blk, lwb_abd,
+		    BP_GET_LSIZE(&lwb->lwb_blk), zil_lwb_write_done, lwb,
+		    prio, ZIO_FLAG_CANFAIL | ZIO_FLAG_FASTWRITE, &zb);
+
+		lwb->lwb_state = LWB_STATE_OPENED;
+
+		/*
+		 * The lwb must not be done before the lwb opened ahead of
+		 * it, as a waiter on it may rely on all earlier log blocks
+		 * being stable.  Make its root zio wait for the previous
+		 * one's, unless that one is already done.
+		 */
+		if (last != NULL && last->lwb_state != LWB_STATE_DONE) {
+			ASSERT3P(last->lwb_root_zio, !=, NULL);
+			zio_add_child(lwb->lwb_root_zio, last->lwb_root_zio);
+		}
+		zilog->zl_last_lwb_opened = lwb;
 	}
 	mutex_exit(&zilog->zl_lock);
+
+	ASSERT3P(lwb->lwb_root_zio, !=, NULL);
+	ASSERT3P(lwb->lwb_write_zio, !=, NULL);
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_OPENED);
 }
 
 /*
@@ -972,12 +1309,51 @@ uint64_t zil_block_buckets[] = {
     UINT64_MAX
 };
 
+/*
+ * Log blocks are pre-allocated, so the size of the next block has to be
+ * chosen before the records going into it are known.
+ * - While records of the commit being written are left, the block is
+ *   sized to hold all of them, so that a large commit is written in as
+ *   few blocks as possible.
+ * - Otherwise it is sized for the next commit, predicted as the largest
+ *   of the recent commits.  This lessens a picket fence effect of wrongly
+ *   guessing the size if we have a stream of say 2k, 64k, 2k, 64k
+ *   commits, while a single large commit doesn't oversize the blocks of
+ *   the small commits following it for more than ZIL_PREV_BLKS commits.
+ * The size is then rounded up to the smallest bucket that fits it from
+ * a limited set of block sizes, as it's faster to write blocks allocated
+ * from the same metaslab as they are adjacent or close.
+ *
+ * Note we only write what is used, but we can't just allocate the
+ * maximum block size because we can exhaust the available pool log space.
+ */
+static uint64_t
+zil_lwb_plan(zilog_t *zilog)
+{
+	uint64_t size = zilog->zl_cur_left;
+	int i;
+
+	if (size == 0) {
+		for (i = 0; i < ZIL_PREV_BLKS; i++)
+			size = MAX(size, zilog->zl_prev_blks[i]);
+	}
+
+	size += sizeof (zil_chain_t);
+	for (i = 0; size > zil_block_buckets[i]; i++)
+		continue;
+	size = zil_block_buckets[i];
+	if (size == UINT64_MAX)
+		size = SPA_OLD_MAXBLOCKSIZE;
+
+	return (size);
+}
+
 /*
  * Start a log block write and advance to the next log block.
  * Calls are serialized.
  */
 static lwb_t *
-zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
+zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
 {
 	lwb_t *nlwb = NULL;
 	zil_chain_t *zilc;
@@ -986,9 +1362,14 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	dmu_tx_t *tx;
 	uint64_t txg;
 	uint64_t zil_blksz, wsz;
-	int i, error;
+	int error;
 	boolean_t slog;
 
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
+	ASSERT3P(lwb->lwb_root_zio, !=, NULL);
+	ASSERT3P(lwb->lwb_write_zio, !=, NULL);
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_OPENED);
+
 	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2) {
 		zilc = (zil_chain_t *)lwb->lwb_buf;
 		bp = &zilc->zc_next_blk;
@@ -1004,9 +1385,10 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	 * before writing it in order to establish the log chain.
 	 * Note that if the allocation of nlwb synced before we wrote
 	 * the block that points at it (lwb), we'd leak it if we crashed.
-	 * Therefore, we don't do dmu_tx_commit() until zil_lwb_write_done().
-	 * We dirty the dataset to ensure that zil_sync() will be called
-	 * to clean up in the event of allocation failure or I/O failure.
+	 * Therefore, we don't do dmu_tx_commit() until
+	 * zil_lwb_flush_vdevs_done().  We dirty the dataset to ensure that
+	 * zil_sync() will be called to clean up in the event of allocation
+	 * failure or I/O failure.
 	 */
 	tx = dmu_tx_create(zilog->zl_os);
 	VERIFY(dmu_tx_assign(tx, TXG_WAIT) == 0);
@@ -1015,35 +1397,11 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 
 	lwb->lwb_tx = tx;
 
-	/*
-	 * Log blocks are pre-allocated. Here we select the size of the next
-	 * block, based on size used in the last block.
-	 * - first find the smallest bucket that will fit the block from a
-	 *   limited set of block sizes. This is because it's faster to write
-	 *   blocks allocated from the same metaslab as they are adjacent or
-	 *   close.
-	 * - next find the maximum from the new suggested size and an array of
-	 *   previous sizes. This lessens a picket fence effect of wrongly
-	 *   guesssing the size if we have a stream of say 2k, 64k, 2k, 64k
-	 *   requests.
-	 *
-	 * Note we only write what is used, but we can't just allocate
-	 * the maximum block size because we can exhaust the available
-	 * pool log space.
-	 */
-	zil_blksz = zilog->zl_cur_used + sizeof (zil_chain_t);
-	for (i = 0; zil_blksz > zil_block_buckets[i]; i++)
-		continue;
-	zil_blksz = zil_block_buckets[i];
-	if (zil_blksz == UINT64_MAX)
-		zil_blksz = SPA_OLD_MAXBLOCKSIZE;
-	zilog->zl_prev_blks[zilog->zl_prev_rotor] = zil_blksz;
-	for (i = 0; i < ZIL_PREV_BLKS; i++)
-		zil_blksz = MAX(zil_blksz, zilog->zl_prev_blks[i]);
-	zilog->zl_prev_rotor = (zilog->zl_prev_rotor + 1) & (ZIL_PREV_BLKS - 1);
+	zil_blksz = zil_lwb_plan(zilog);
 
 	BP_ZERO(bp);
-	error = zio_alloc_zil(spa, txg, bp, zil_blksz, &slog);
+	error = zio_alloc_zil(spa, dmu_objset_id(zilog->zl_os), txg, bp,
+	    zil_blksz, &slog);
 	if (slog) {
 		ZIL_STAT_BUMP(zil_itx_metaslab_slog_count);
 		ZIL_STAT_INCR(zil_itx_metaslab_slog_bytes, lwb->lwb_nused);
@@ -1057,19 +1415,16 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 		bp->blk_cksum.zc_word[ZIL_ZC_SEQ]++;
 
 		/*
-		 * Allocate a new log write buffer (lwb).
+		 * Allocate a new log write block (lwb).
 		 */
 		nlwb = zil_alloc_lwb(zilog, bp, slog, txg, TRUE);
-
-		/* Record the block for later vdev flushing */
-		zil_add_block(zilog, &lwb->lwb_blk);
 	}
 
 	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2) {
 		/* For Slim ZIL only write what is used. */
 		wsz = P2ROUNDUP_TYPED(lwb->lwb_nused, ZIL_MIN_BLKSZ, uint64_t);
 		ASSERT3U(wsz, <=, lwb->lwb_sz);
-		zio_shrink(lwb->lwb_zio, wsz);
+		zio_shrink(lwb->lwb_write_zio, wsz);
 
 	} else {
 		wsz = lwb->lwb_sz;
@@ -1084,7 +1439,22 @@ zil_lwb_write_start(zilog_t *zilog, lwb_t *lwb)
 	 */
 	bzero(lwb->lwb_buf + lwb->lwb_nused, wsz - lwb->lwb_nused);
 
-	zio_nowait(lwb->lwb_zio); /* Kick off the write for the old log block */
+	/*
+	 * The config lock is held until the lwb is done, so that the vdevs
+	 * it is flushed on can't go away.
+	 */
+	spa_config_enter(zilog->zl_spa, SCL_STATE, lwb, RW_READER);
+
+	/* Record the block for later vdev flushing */
+	zil_lwb_add_block(lwb, &lwb->lwb_blk);
+
+	mutex_enter(&zilog->zl_lock);
+	lwb->lwb_issued_timestamp = gethrtime();
+	lwb->lwb_state = LWB_STATE_ISSUED;
+	mutex_exit(&zilog->zl_lock);
+
+	zio_nowait(lwb->lwb_root_zio);
+	zio_nowait(lwb->lwb_write_zio);
 
 	/*
 	 * If there was an allocation failure then nlwb will be null which
@@ -1101,13 +1471,35 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 	char *lr_buf;
 	uint64_t dlen, dnow, lwb_sp, reclen, txg;
 
-	if (lwb == NULL)
-		return (NULL);
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
+	ASSERT3P(lwb, !=, NULL);
+	ASSERT3P(lwb->lwb_buf, !=, NULL);
 
-	ASSERT(lwb->lwb_buf != NULL);
+	zil_lwb_write_open(zilog, lwb);
 
 	lrc = &itx->itx_lr;		/* Common log record inside itx. */
 	lrw = (lr_write_t *)lrc;	/* Write log record inside itx. */
+
+	/*
+	 * A commit itx doesn't represent any on-disk state; instead
+	 * it's simply used as a place holder on the commit list, and
+	 * provides a mechanism for attaching a "commit waiter" onto the
+	 * correct lwb (such that the waiter can be signalled upon
+	 * completion of that lwb). Thus, we don't process this itx's
+	 * log record if it's a commit itx (these itx's don't have log
+	 * records), and instead link the itx's waiter onto the lwb's
+	 * list of waiters.
+	 *
+	 * For more details, see the comment above zil_commit().
+	 */
+	if (lrc->lrc_txtype == TX_COMMIT) {
+		mutex_enter(&zilog->zl_lock);
+		zil_commit_waiter_link_lwb(itx->itx_private, lwb);
+		itx->itx_private = NULL;
+		mutex_exit(&zilog->zl_lock);
+		return (lwb);
+	}
+
 	if (lrc->lrc_txtype == TX_WRITE && itx->itx_wr_state == WR_NEED_COPY) {
 		dlen = P2ROUNDUP_TYPED(
 		    lrw->lr_length, sizeof (uint64_t), uint64_t);
@@ -1118,7 +1510,7 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 	zilog->zl_cur_used += (reclen + dlen);
 	txg = lrc->lrc_txg;
 
-	zil_lwb_write_init(zilog, lwb);
+	ASSERT3U(zilog->zl_cur_used, <, UINT64_MAX - (reclen + dlen));
 
 cont:
 	/*
@@ -1129,10 +1521,10 @@ cont:
 	if (reclen > lwb_sp || (reclen + dlen > lwb_sp &&
 	    lwb_sp < ZIL_MAX_WASTE_SPACE && (dlen % ZIL_MAX_LOG_DATA == 0 ||
 	    lwb_sp < reclen + dlen % ZIL_MAX_LOG_DATA))) {
-		lwb = zil_lwb_write_start(zilog, lwb);
+		lwb = zil_lwb_write_issue(zilog, lwb);
 		if (lwb == NULL)
 			return (NULL);
-		zil_lwb_write_init(zilog, lwb);
+		zil_lwb_write_open(zilog, lwb);
 		ASSERT(LWB_EMPTY(lwb));
 		lwb_sp = lwb->lwb_sz - lwb->lwb_nused;
 		ASSERT3U(reclen + MIN(dlen, sizeof (uint64_t)), <=, lwb_sp);
@@ -1175,8 +1567,21 @@ cont:
 				ZIL_STAT_INCR(zil_itx_indirect_bytes,
 				    lrw->lr_length);
 			}
-			error = zilog->zl_get_data(
-			    itx->itx_private, lrwb, dbuf, lwb->lwb_zio);
+
+			/*
+			 * We pass in the "lwb_write_zio" rather than
+			 * "lwb_root_zio" so that the "lwb_write_zio"
+			 * becomes the parent of any zio's created by
+			 * the "zl_get_data" callback. The vdevs are
+			 * flushed after the "lwb_write_zio" completes,
+			 * so we want to make sure that completion
+			 * callback waits for these additional zio's,
+			 * such that the vdevs used by those zio's will
+			 * be included in the lwb's vdev tree, and those
+			 * vdevs will be properly flushed.
+			 */
+			error = zilog->zl_get_data(itx->itx_private, lrwb,
+			    dbuf, lwb, lwb->lwb_write_zio);
 			if (error == EIO) {
 				txg_wait_synced(zilog->zl_dmu_pool, txg);
 				return (lwb);
@@ -1195,8 +1600,9 @@ cont:
 	 * equal to the itx sequence number because not all transactions
 	 * are synchronous, and sometimes spa_sync() gets there first.
 	 */
-	lrcb->lrc_seq = ++zilog->zl_lr_seq; /* we are single threaded */
+	lrcb->lrc_seq = ++zilog->zl_lr_seq;
 	lwb->lwb_nused += reclen + dnow;
+	zilog->zl_cur_left -= MIN(zilog->zl_cur_left, reclen + dnow);
 	lwb->lwb_max_txg = MAX(lwb->lwb_max_txg, txg);
 	ASSERT3U(lwb->lwb_nused, <=, lwb->lwb_sz);
 	ASSERT0(P2PHASE(lwb->lwb_nused, sizeof (uint64_t)));
@@ -1210,6 +1616,26 @@ cont:
 	return (lwb);
 }
 
+/*
+ * The log space taken by an itx's record and the data copied with it.
+ */
+static uint64_t
+zil_itx_record_size(itx_t *itx)
+{
+	lr_t *lrc = &itx->itx_lr;
+	lr_write_t *lrw = (lr_write_t *)lrc;
+
+	if (lrc->lrc_txtype == TX_COMMIT)
+		return (0);
+
+	if (lrc->lrc_txtype == TX_WRITE && itx->itx_wr_state == WR_NEED_COPY) {
+		return (lrc->lrc_reclen + P2ROUNDUP_TYPED(lrw->lr_length,
+		    sizeof (uint64_t), uint64_t));
+	}
+
+	return (lrc->lrc_reclen);
+}
+
 itx_t *
 zil_itx_create(uint64_t txtype, size_t lrsize)
 {
@@ -1252,6 +1678,24 @@ zil_itxg_clean(itxs_t *itxs)
 
 	list = &itxs->i_sync_list;
 	while ((itx = list_head(list)) != NULL) {
+		/*
+		 * In the general case, commit itxs will not be found
+		 * here, as they'll be committed to an lwb via
+		 * zil_lwb_commit(), and free'd in that function. Having
+		 * said that, it is still possible for commit itxs to be
+		 * found here, due to the following race:
+		 *
+		 *	- a thread calls zil_commit() which assigns the
+		 *	  commit itx to a per-txg i_sync_list
+		 *	- zil_itxg_clean() is called (e.g. via spa_sync())
+		 *	  while the waiting thread is still on the itx
+		 *	  list
+		 *
+		 * Thus, we need to be prepared to signal the waiter of
+		 * any commit itxs found here.
+		 */
+		if (itx->itx_lr.lrc_txtype == TX_COMMIT)
+			zil_commit_waiter_skip(itx->itx_private);
 		if (itx->itx_callback != NULL)
 			itx->itx_callback(itx->itx_callback_data);
 		list_remove(list, itx);
@@ -1551,154 +1995,816 @@ zil_async_to_sync(zilog_t *zilog, uint64_t foid)
 	}
 }
 
+/*
+ * This function will prune commit itxs that are at the head of the
+ * commit list (it won't prune past the first non-commit itx), and
+ * either: a) attach them to the last lwb that's still pending
+ * completion, or b) skip them altogether.
+ *
+ * This is used as a performance optimization to prevent commit itxs
+ * from generating new lwbs when it's unnecessary to do so.
+ */
 static void
-zil_commit_writer(zilog_t *zilog)
+zil_prune_commit_list(zilog_t *zilog)
 {
-	uint64_t txg;
 	itx_t *itx;
-	lwb_t *lwb;
-	spa_t *spa = zilog->zl_spa;
-	int error = 0;
 
-	ASSERT(zilog->zl_root_zio == NULL);
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 
-	mutex_exit(&zilog->zl_lock);
+	while ((itx = list_head(&zilog->zl_itx_commit_list)) != NULL) {
+		lr_t *lrc = &itx->itx_lr;
+		lwb_t *last_lwb;
 
-	zil_get_commit_list(zilog);
+		if (lrc->lrc_txtype != TX_COMMIT)
+			break;
 
-	/*
-	 * Return if there's nothing to commit before we dirty the fs by
-	 * calling zil_create().
-	 */
-	if (list_head(&zilog->zl_itx_commit_list) == NULL) {
 		mutex_enter(&zilog->zl_lock);
-		return;
-	}
 
-	if (zilog->zl_suspend) {
-		lwb = NULL;
-	} else {
-		lwb = list_tail(&zilog->zl_lwb_list);
-		if (lwb == NULL)
-			lwb = zil_create(zilog);
-	}
+		last_lwb = zilog->zl_last_lwb_opened;
+		if (last_lwb == NULL || last_lwb->lwb_state == LWB_STATE_DONE) {
+			/*
+			 * All of the itxs this waiter was waiting on
+			 * must have already completed (or there were
+			 * never any itx's for it to wait on), so it's
+			 * safe to skip this waiter and mark it done.
+			 */
+			zil_commit_waiter_skip(itx->itx_private);
+		} else {
+			zil_commit_waiter_link_lwb(itx->itx_private, last_lwb);
+			itx->itx_private = NULL;
+		}
 
-	DTRACE_PROBE1(zil__cw1, zilog_t *, zilog);
-	for (itx = list_head(&zilog->zl_itx_commit_list); itx != NULL;
-	    itx = list_next(&zilog->zl_itx_commit_list, itx)) {
-		txg = itx->itx_lr.lrc_txg;
-		ASSERT3U(txg, !=, 0);
+		mutex_exit(&zilog->zl_lock);
 
-		/*
-		 * This is inherently racy and may result in us writing
-		 * out a log block for a txg that was just synced. This is
-		 * ok since we'll end cleaning up that log block the next
-		 * time we call zil_sync().
-		 */
-		if (txg > spa_last_synced_txg(spa) || txg > spa_freeze_txg(spa))
-			lwb = zil_lwb_commit(zilog, itx, lwb);
+		list_remove(&zilog->zl_itx_commit_list, itx);
+		zil_itx_destroy(itx);
 	}
-	DTRACE_PROBE1(zil__cw2, zilog_t *, zilog);
 
-	/* write the last block out */
-	if (lwb != NULL && lwb->lwb_zio != NULL)
-		lwb = zil_lwb_write_start(zilog, lwb);
+	IMPLY(itx != NULL, itx->itx_lr.lrc_txtype != TX_COMMIT);
+}
 
-	zilog->zl_cur_used = 0;
+/*
+ * When zio_alloc_zil() fails to allocate the next lwb block on disk, we
+ * must call txg_wait_synced() to ensure all of the lwbs in the zilog's
+ * zl_lwb_list are synced and then freed (in zil_sync()), such that any
+ * subsequent calls to zil_process_commit_list() will have to call
+ * zil_create(), and start a new ZIL chain.
+ *
+ * Since the zl_issuer_lock is held while waiting, no other thread can
+ * write out lwbs in the meantime; this stalls the ZIL write pipeline.
+ */
+static void
+zil_commit_writer_stall(zilog_t *zilog)
+{
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
+	txg_wait_synced(zilog->zl_dmu_pool, 0);
+	ASSERT3P(list_tail(&zilog->zl_lwb_list), ==, NULL);
+}
+
+/*
+ * This function will traverse the commit list, creating new lwbs as
+ * needed, and committing the itxs from the commit list to these newly
+ * created lwbs. Additionally, as a new lwb is created, the previous
+ * lwb will be issued to the zio layer to be written to disk.
+ */
+static void
+zil_process_commit_list(zilog_t *zilog)
+{
+	spa_t *spa = zilog->zl_spa;
+	list_t nolwb_itxs;
+	list_t nolwb_waiters;
+	zil_commit_waiter_t *zcw;
+	lwb_t *lwb;
+	itx_t *itx;
+
+	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 
 	/*
-	 * Wait if necessary for the log blocks to be on stable storage.
+	 * Return if there's nothing to commit before we dirty the fs by
+	 * calling zil_create().
 	 */
-	if (zilog->zl_root_zio) {
-		error = zio_wait(zilog->zl_root_zio);
-		zilog->zl_root_zio = NULL;
-		zil_flush_vdevs(zilog);
+	if (list_head(&zilog->zl_itx_commit_list) == NULL)
+		return;
+
+	list_create(&nolwb_itxs, sizeof (itx_t), offsetof(itx_t, itx_node));
+	list_create(&nolwb_waiters, sizeof (zil_commit_waiter_t),
+	    offsetof(zil_commit_waiter_t, zcw_node));
+
+	/*
+	 * Account for the size of this commit up front, so that the lwbs
+	 * allocated while it is written can be sized to fit the rest of it;
+	 * see zil_lwb_plan().
+	 */
+	zilog->zl_cur_used = 0;
+	zilog->zl_cur_left = 0;
+	for (itx = list_head(&zilog->zl_itx_commit_list); itx != NULL;
+	    itx = list_next(&zilog->zl_itx_commit_list, itx))
+		zilog->zl_cur_left += zil_itx_record_size(itx);
+
+	lwb = list_tail(&zilog->zl_lwb_list);
+	if (lwb == NULL) {
+		lwb = zil_create(zilog);
+	} else {
+		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_ISSUED);
+		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_DONE);
 	}
 
-	if (error || lwb == NULL)
-		txg_wait_synced(zilog->zl_dmu_pool, 0);
+	DTRACE_PROBE1(zil__cw1, zilog_t *, zilog);
+	while ((itx = list_head(&zilog->zl_itx_commit_list)) != NULL) {
+		lr_t *lrc = &itx->itx_lr;
+		uint64_t txg = lrc->lrc_txg;
+		boolean_t synced, frozen;
+
+		ASSERT3U(txg, !=, 0);
+
+		/*
+		 * This is inherently racy and may result in us writing
+		 * out a log block for a txg that was just synced. This is
+		 * ok since we'll end cleaning up that log block the next
+		 * time we call zil_sync().
+		 */
+		synced = txg <= spa_last_synced_txg(spa);
+		frozen = txg > spa_freeze_txg(spa);
+
+		list_remove(&zilog->zl_itx_commit_list, itx);
 
-	while ((itx = list_head(&zilog->zl_itx_commit_list))) {
-		txg = itx->itx_lr.lrc_txg;
-		ASSERT(txg);
+		if (!synced || frozen) {
+			if (lwb != NULL) {
+				lwb = zil_lwb_commit(zilog, itx, lwb);
 
+				if (lwb == NULL)
+					list_insert_tail(&nolwb_itxs, itx);
+				else
+					list_insert_tail(&lwb->lwb_itxs, itx);
+				continue;
+			}
+
+			if (lrc->lrc_txtype == TX_COMMIT) {
+				zil_commit_waiter_link_nolwb(
+				    itx->itx_private, &nolwb_waiters);
+			}
+			list_insert_tail(&nolwb_itxs, itx);
+			continue;
+		}
+
+		/*
+		 * This itx has already been committed to disk via
+		 * spa_sync(), so we don't bother committing it to an lwb.
+		 * If it's a commit itx, there is a thread either waiting
+		 * for it or soon to be waiting, and as we cannot use the
+		 * lwb zio callback to signal the waiter and mark it done,
+		 * we must do that here.
+		 */
+		if (lrc->lrc_txtype == TX_COMMIT)
+			zil_commit_waiter_skip(itx->itx_private);
 		if (itx->itx_callback != NULL)
 			itx->itx_callback(itx->itx_callback_data);
-		list_remove(&zilog->zl_itx_commit_list, itx);
+		zilog->zl_cur_left -= MIN(zilog->zl_cur_left,
+		    zil_itx_record_size(itx));
 		zil_itx_destroy(itx);
 	}
+	DTRACE_PROBE1(zil__cw2, zilog_t *, zilog);
 
-	mutex_enter(&zilog->zl_lock);
+	/*
+	 * Remember how much this commit logged, to predict the size of
+	 * the next one.
+	 */
+	zilog->zl_cur_left = 0;
+	if (zilog->zl_cur_used != 0) {
+		zilog->zl_prev_blks[zilog->zl_prev_rotor] =
+		    MIN(zilog->zl_cur_used, UINT_MAX);
+		zilog->zl_prev_rotor =
+		    (zilog->zl_prev_rotor + 1) & (ZIL_PREV_BLKS - 1);
+	}
+
+	if (lwb == NULL) {
+		/*
+		 * This indicates zio_alloc_zil() failed to allocate the
+		 * "next" lwb on-disk, or we were suspended.  When this
+		 * happens, we must stall the ZIL write pipeline; see the
+		 * comment within zil_commit_writer_stall() for more
+		 * details.
+		 */
+		zil_commit_writer_stall(zilog);
+
+		/*
+		 * Additionally, we have to signal and mark the "nolwb"
+		 * waiters as "done" here, since without an lwb, we
+		 * can't do this via zil_lwb_flush_vdevs_done() like
+		 * normal.
+		 */
+		while ((zcw = list_head(&nolwb_waiters)) != NULL) {
+			list_remove(&nolwb_waiters, zcw);
+			zil_commit_waiter_skip(zcw);
+		}
+
+		/*
+		 * And finally, we have to destroy the itx's that
+		 * couldn't be committed to an lwb; this will also call
+		 * the itx's callback if one exists for the itx.
+		 */
+		while ((itx = list_head(&nolwb_itxs)) != NULL) {
+			if (itx->itx_callback != NULL)
+				itx->itx_callback(itx->itx_callback_data);
+			list_remove(&nolwb_itxs, itx);
+			zil_itx_destroy(itx);
+		}
+	} else {
+		ASSERT(list_is_empty(&nolwb_waiters));
+		ASSERT(list_is_empty(&nolwb_itxs));
+		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_ISSUED);
+		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_DONE);
+
+		/*
+		 * At this point, the ZIL block pointed at by the "lwb"
+		 * variable is in one of the following states: "closed"
+		 * or "open".
+		 *
+		 * If it's "closed", then no itxs have been committed to
+		 * it, so there's no point in issuing its zio (i.e. it's
+		 * "empty").
+		 *
+		 * If it's "open", then it contains one or more itxs that
+		 * eventually need to be committed to stable storage. In
+		 * this case we intentionally do not issue the lwb's zio
+		 * to disk yet, and instead rely on one of the following
+		 * two mechanisms for issuing the zio:
+		 *
+		 * 1. Ideally, there will be more ZIL activity occurring
+		 * on the system, such that this function will be
+		 * immediately called again (not necessarily by the same
+		 * thread) and this lwb's zio will be issued via
+		 * zil_lwb_commit(). This way, the lwb is guaranteed to
+		 * be "full" when it is issued to disk, and we'll make
+		 * use of the lwb's size the best we can.
+		 *
+		 * 2. If there isn't sufficient ZIL activity occurring on
+		 * the system, such that this lwb's zio isn't issued via
+		 * zil_lwb_commit(), zil_commit_waiter() will issue the
+		 * lwb's zio once its timeout expires. If this occurs,
+		 * the lwb is not guaranteed to be "full" by the time its
+		 * zio is issued, and means the size of the lwb was "too
+		 * large" given the amount of ZIL activity occurring on
+		 * the system at that time.
+		 *
+		 * This way more itxs can be committed to stable storage
+		 * with fewer writes, without significantly impacting the
+		 * latency of each individual itx.
+		 */
+	}
+
+	list_destroy(&nolwb_itxs);
+	list_destroy(&nolwb_waiters);
+}
+
+/*
+ * This function is responsible for ensuring the passed in commit waiter
+ * (and associated commit itx) is committed to an lwb. If the waiter is
+ * not already committed to an lwb, all itxs in the zilog's queue of
+ * itxs will be processed. The assumption is the passed in waiter's
+ * commit itx will found in the queue just like the other non-commit
+ * itxs, such that when the entire queue is processed, the waiter will
+ * have been committed to an lwb.
+ *
+ * The lwb associated with the passed in waiter is not guaranteed to
+ * have been issued by the time this function completes. If the lwb is
+ * not issued, we rely on future calls to zil_commit_writer() to issue
+ * the lwb, or the timeout mechanism found in zil_commit_waiter().
+ */
+static void
+zil_commit_writer(zilog_t *zilog, zil_commit_waiter_t *zcw)
+{
+	ASSERT(!MUTEX_HELD(&zilog->zl_lock));
+	ASSERT(spa_writeable(zilog->zl_spa));
+
+	mutex_enter(&zilog->zl_issuer_lock);
+
+	if (zcw->zcw_lwb != NULL || zcw->zcw_done) {
+		/*
+		 * It's possible that, while we were waiting to acquire
+		 * the "zl_issuer_lock", another thread committed this
+		 * waiter to an lwb. If that occurs, we bail out early,
+		 * without processing any of the zilog's queue of itxs.
+		 *
+		 * On certain workloads and system configurations, the
+		 * "zl_issuer_lock" can become highly contended. In an
+		 * attempt to reduce this contention, we immediately drop
+		 * the lock if the waiter has already been processed.
+		 *
+		 * We've measured this optimization to reduce CPU spent
+		 * contending on this lock by up to 5%, using a system
+		 * with 32 CPUs, low latency storage (~50 usec writes),
+		 * and 1024 threads performing sync writes.
+		 */
+		goto out;
+	}
+
+	ZIL_STAT_BUMP(zil_commit_writer_count);
+
+	zil_get_commit_list(zilog);
+	zil_prune_commit_list(zilog);
+	zil_process_commit_list(zilog);
+
+out:
+	mutex_exit(&zilog->zl_issuer_lock);
+}
+
+static void
+zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
+{
+	lwb_t *lwb, *nlwb;
+
+	ASSERT(!MUTEX_HELD(&zilog->zl_issuer_lock));
+	ASSERT(MUTEX_HELD(&zcw->zcw_lock));
+	ASSERT(!zcw->zcw_done);
+
+	lwb = zcw->zcw_lwb;
+	ASSERT3P(lwb, !=, NULL);
+	ASSERT3S(lwb->lwb_state, !=, LWB_STATE_CLOSED);
 
 	/*
-	 * Remember the highest committed log sequence number for ztest.
-	 * We only update this value when all the log writes succeeded,
-	 * because ztest wants to ASSERT that it got the whole log chain.
+	 * If the lwb has already been issued by another thread, we can
+	 * immediately return since there's no work to be done (the
+	 * point of this function is to issue the lwb). Additionally, we
+	 * do this prior to acquiring the zl_issuer_lock, to avoid
+	 * acquiring it when it's not necessary to do so.
 	 */
-	if (error == 0 && lwb != NULL)
-		zilog->zl_commit_lr_seq = zilog->zl_lr_seq;
+	if (lwb->lwb_state == LWB_STATE_ISSUED ||
+	    lwb->lwb_state == LWB_STATE_DONE)
+		return;
+
+	/*
+	 * In order to call zil_lwb_write_issue() we must hold the
+	 * zilog's "zl_issuer_lock". We can't simply acquire that lock,
+	 * since we're already holding the commit waiter's "zcw_lock",
+	 * and those two locks are acquired in the opposite order
+	 * elsewhere.
+	 */
+	mutex_exit(&zcw->zcw_lock);
+	mutex_enter(&zilog->zl_issuer_lock);
+	mutex_enter(&zcw->zcw_lock);
+
+	/*
+	 * Since we just dropped and re-acquired the commit waiter's
+	 * lock, we have to re-check to see if the waiter was marked
+	 * "done" during that process. If the waiter was marked "done",
+	 * the "lwb" pointer is no longer valid (it can be free'd after
+	 * the waiter is marked "done"), so without this check we could
+	 * wind up with a use-after-free error below.
+	 */
+	if (zcw->zcw_done)
+		goto out;
+
+	ASSERT3P(lwb, ==, zcw->zcw_lwb);
+
+	/*
+	 * We've already checked this above, but since we hadn't
+	 * acquired the zilog's zl_issuer_lock, we have to perform this
+	 * check a second time while holding the lock. We don't need to
+	 * hold the zl_lock since the lwb cannot transition from OPENED
+	 * to ISSUED while we hold the zl_issuer_lock. The lwb _can_
+	 * transition from ISSUED to DONE, but it's OK to race with that
+	 * transition since we treat the lwb the same, whether it's in
+	 * the ISSUED or DONE states.
+	 */
+	if (lwb->lwb_state == LWB_STATE_ISSUED ||
+	    lwb->lwb_state == LWB_STATE_DONE)
+		goto out;
+
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_OPENED);
+
+	/*
+	 * As described in the comments above zil_commit_waiter() and
+	 * zil_process_commit_list(), we need to issue this lwb's zio
+	 * since we've reached the commit waiter's timeout and it still
+	 * hasn't been issued.
+	 */
+	nlwb = zil_lwb_write_issue(zilog, lwb);
+
+	ASSERT3S(lwb->lwb_state, !=, LWB_STATE_OPENED);
+
+	if (nlwb == NULL) {
+		/*
+		 * When zil_lwb_write_issue() returns NULL, this
+		 * indicates zio_alloc_zil() failed to allocate the
+		 * "next" lwb on-disk. When this occurs, the ZIL write
+		 * pipeline must be stalled; see the comment within the
+		 * zil_commit_writer_stall() function for more details.
+		 *
+		 * We must drop the commit waiter's lock prior to
+		 * calling zil_commit_writer_stall() or else we can wind
+		 * up with the following deadlock:
+		 *
+		 * - This thread is waiting for the txg to sync while
+		 *   holding the waiter's lock; txg_wait_synced() is
+		 *   used within zil_commit_writer_stall().
+		 *
+		 * - The txg can't sync because it is waiting for this
+		 *   lwb's zio callback to call dmu_tx_commit().
+		 *
+		 * - The lwb's zio callback can't call dmu_tx_commit()
+		 *   because it's blocked trying to acquire the waiter's
+		 *   lock, which occurs prior to calling dmu_tx_commit()
+		 */
+		mutex_exit(&zcw->zcw_lock);
+		zil_commit_writer_stall(zilog);
+		mutex_enter(&zcw->zcw_lock);
+	}
+
+out:
+	mutex_exit(&zilog->zl_issuer_lock);
+	ASSERT(MUTEX_HELD(&zcw->zcw_lock));
 }
 
 /*
- * Commit zfs transactions to stable storage.
- * If foid is 0 push out all transactions, otherwise push only those
- * for that object or might reference that object.
+ * This function is responsible for performing the following two tasks:
+ *
+ * 1. its primary responsibility is to block until the given "commit
+ *    waiter" is considered "done".
+ *
+ * 2. its secondary responsibility is to issue the zio for the lwb that
+ *    the given "commit waiter" is waiting on, if this function has
+ *    waited "long enough" and the lwb is still in the "open" state.
+ *
+ * Given a sufficient amount of itxs being generated and written using
+ * the ZIL, the lwb's zio will be issued via the zil_lwb_commit()
+ * function. If this does not occur, this secondary responsibility will
+ * ensure the lwb is issued even if there is not other synchronous
+ * activity on the system.
+ *
+ * For more details, see zil_process_commit_list(); more specifically,
+ * the comment at the bottom of that function.
+ */
+static void
+zil_commit_waiter(zilog_t *zilog, zil_commit_waiter_t *zcw)
+{
+	boolean_t timedout = B_FALSE;
+	hrtime_t sleep, wakeup;
+	int pct;
+
+	ASSERT(!MUTEX_HELD(&zilog->zl_lock));
+	ASSERT(!MUTEX_HELD(&zilog->zl_issuer_lock));
+	ASSERT(spa_writeable(zilog->zl_spa));
+
+	mutex_enter(&zcw->zcw_lock);
+
+	/*
+	 * The timeout is scaled based on the lwb latency to avoid
+	 * significantly impacting the latency of each individual itx.
+	 * For more details, see the comment at the bottom of the
+	 * zil_process_commit_list() function.
+	 */
+	pct = MAX(zfs_commit_timeout_pct, 1);
+	sleep = (zilog->zl_last_lwb_latency * pct) / 100;
+	wakeup = gethrtime() + sleep;
+
+	while (!zcw->zcw_done) {
+		lwb_t *lwb = zcw->zcw_lwb;
+
+		ASSERT(MUTEX_HELD(&zcw->zcw_lock));
+
+		/*
+		 * Usually, the waiter will have a non-NULL lwb field here,
+		 * but it's possible for it to be NULL as a result of
+		 * zil_commit() racing with spa_sync().
+		 *
+		 * When zil_clean() is called, it's possible for the itxg
+		 * list (which may be cleaned via a taskq) to contain
+		 * commit itxs. When this occurs, the commit waiters linked
+		 * off of these commit itxs will not be committed to an
+		 * lwb.  Additionally, these commit waiters will not be
+		 * marked done until zil_commit_waiter_skip() is called via
+		 * zil_itxg_clean().
+		 *
+		 * Thus, it's possible for this commit waiter (i.e. the
+		 * "zcw" variable) to be found in this "in between" state;
+		 * where it's "zcw_lwb" field is NULL, and it hasn't yet
+		 * been skipped, so it's "zcw_done" field is still B_FALSE.
+		 */
+		IMPLY(lwb != NULL, lwb->lwb_state != LWB_STATE_CLOSED);
+
+		if (lwb != NULL && lwb->lwb_state == LWB_STATE_OPENED) {
+			clock_t timeleft;
+
+			ASSERT(!timedout);
+
+			/*
+			 * If the lwb hasn't been issued yet, then we
+			 * need to wait with a timeout, in case this
+			 * function needs to issue the lwb after the
+			 * timeout is reached; responsibility (2) from
+			 * the comment above this function.
+			 */
+			timeleft = cv_timedwait_hires(&zcw->zcw_cv,
+			    &zcw->zcw_lock, wakeup, USEC2NSEC(1),
+			    CALLOUT_FLAG_ABSOLUTE);
+
+			if (timeleft >= 0 || zcw->zcw_done)
+				continue;
+
+			timedout = B_TRUE;
+			zil_commit_waiter_timeout(zilog, zcw);
+
+			if (!zcw->zcw_done) {
+				/*
+				 * If the commit waiter has already been
+				 * marked "done", it's possible for the
+				 * waiter's lwb structure to have already
+				 * been freed.  Thus, we can only reliably
+				 * make these assertions if the waiter
+				 * isn't done.
+				 */
+				ASSERT3P(lwb, ==, zcw->zcw_lwb);
+				ASSERT3S(lwb->lwb_state, !=, LWB_STATE_OPENED);
+			}
+		} else {
+			/*
+			 * If the lwb isn't open, then it must have already
+			 * been issued. In that case, there's no need to
+			 * use a timeout when waiting for the lwb to
+			 * complete.
+			 *
+			 * Additionally, if the lwb is NULL, the waiter
+			 * will soon be signalled and marked done via
+			 * zil_clean() and zil_itxg_clean(), so no timeout
+			 * is required.
+			 */
+			IMPLY(lwb != NULL,
+			    lwb->lwb_state == LWB_STATE_ISSUED ||
+			    lwb->lwb_state == LWB_STATE_DONE);
+			cv_wait(&zcw->zcw_cv, &zcw->zcw_lock);
+		}
+	}
+
+	mutex_exit(&zcw->zcw_lock);
+}
+
+static zil_commit_waiter_t *
+zil_alloc_commit_waiter(void)
+{
+	zil_commit_waiter_t *zcw = kmem_cache_alloc(zil_zcw_cache, KM_SLEEP);
+
+	cv_init(&zcw->zcw_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&zcw->zcw_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_link_init(&zcw->zcw_node);
+	zcw->zcw_lwb = NULL;
+	zcw->zcw_done = B_FALSE;
+	zcw->zcw_zio_error = 0;
+
+	return (zcw);
+}
+
+static void
+zil_free_commit_waiter(zil_commit_waiter_t *zcw)
+{
+	ASSERT(!list_link_active(&zcw->zcw_node));
+	ASSERT3P(zcw->zcw_lwb, ==, NULL);
+	ASSERT(zcw->zcw_done);
+	mutex_destroy(&zcw->zcw_lock);
+	cv_destroy(&zcw->zcw_cv);
+	kmem_cache_free(zil_zcw_cache, zcw);
+}
+
+/*
+ * This function is used to create a TX_COMMIT itx and assign it. This
+ * way, it will be linked into the ZIL's list of synchronous itxs, and
+ * then later committed to an lwb (or skipped) when
+ * zil_process_commit_list() is called.
+ */
+static void
+zil_commit_itx_assign(zilog_t *zilog, zil_commit_waiter_t *zcw)
+{
+	dmu_tx_t *tx = dmu_tx_create(zilog->zl_os);
+	itx_t *itx;
+
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+
+	itx = zil_itx_create(TX_COMMIT, sizeof (lr_t));
+	itx->itx_sync = B_TRUE;
+	itx->itx_private = zcw;
+
+	zil_itx_assign(zilog, itx, tx);
+
+	dmu_tx_commit(tx);
+}
+
+/*
+ * Commit ZFS Intent Log transactions (itxs) to stable storage.
+ *
+ * When writing ZIL transactions to the on-disk representation of the
+ * ZIL, the itxs are committed to a Log Write Block (lwb). Multiple
+ * itxs can be committed to a single lwb. Once a lwb is written and
+ * committed to stable storage (i.e. the lwb is written, and vdevs have
+ * been flushed), each itx that was committed to that lwb is also
+ * considered to be committed to stable storage.
+ *
+ * When an itx is committed to an lwb, the log record (lr_t) contained
+ * by the itx is copied into the lwb's zio buffer, and once this buffer
+ * is written to disk, it becomes an on-disk ZIL block.
+ *
+ * As itxs are generated, they're inserted into the ZIL's queue of
+ * uncommitted itxs. The semantics of zil_commit() are such that it will
+ * block until all itxs that were in the queue when it was called, are
+ * committed to stable storage.
+ *
+ * If "foid" is zero, this means all "synchronous" and "asynchronous"
+ * itxs, for all objects in the dataset, will be committed to stable
+ * storage prior to zil_commit() returning. If "foid" is non-zero, all
+ * "synchronous" itxs for all objects, but only "asynchronous" itxs
+ * that correspond to the foid passed in, will be committed to stable
+ * storage prior to zil_commit() returning.
+ *
+ * Generally speaking, when zil_commit() is called, the consumer doesn't
+ * actually care about _all_ of the uncommitted itxs. Instead, they're
+ * simply trying to waiting for a specific itx to be committed to disk,
+ * but the interface(s) for interacting with the ZIL don't allow such
+ * fine-grained communication. A better interface would allow a consumer
+ * to create and assign an itx, and then pass a reference to this itx to
+ * zil_commit(); such that zil_commit() would return as soon as that
+ * specific itx was committed to disk (instead of waiting for _all_
+ * itxs to be committed).
+ *
+ * When a thread calls zil_commit() a special "commit itx" will be
+ * generated, along with a corresponding "waiter" for this commit itx.
+ * zil_commit() will wait on this waiter's CV, such that when the waiter
+ * is marked done, and signalled, zil_commit() will return.
+ *
+ * This commit itx is inserted into the queue of uncommitted itxs. This
+ * provides an easy mechanism for determining which itxs were in the
+ * queue prior to zil_commit() having been called, and which itxs were
+ * added after zil_commit() was called.
+ *
+ * The commit it is special; it doesn't have any on-disk representation.
+ * When a commit itx is "committed" to an lwb, the waiter associated
+ * with it is linked onto the lwb's list of waiters. Then, when that lwb
+ * completes, each waiter on the lwb's list is marked done and signalled
+ * -- allowing the thread waiting on the waiter to return from zil_commit().
+ *
+ * It's important to point out a few critical factors that allow us
+ * to make use of the commit itxs, commit waiters, per-lwb lists of
+ * commit waiters, and zio completion callbacks like we're doing:
+ *
+ *   1. The list of waiters for each lwb is traversed, and each commit
+ *      waiter is marked "done" and signalled, in the zio completion
+ *      callback of the lwb's zio[*].
+ *
+ *      * Actually, the waiters are signalled in the zio completion
+ *        callback of the root zio for the lwb, which waits for the
+ *        lwb's write and the flushes of the vdevs it touched.
+ *        For the sake of simplicity, let's just ignore this fact.
+ *
+ *   2. When the itxs are inserted into the ZIL's queue of uncommitted
+ *      itxs, the order in which they are inserted is preserved[*]; as
+ *      itxs are added to the queue, they are added to the tail of
+ *      in-memory linked lists.
+ *
+ *      When committing the itxs to lwbs (to be written to disk), they
+ *      are committed in the same order in which the itxs were added to
+ *      the uncommitted queue's linked list(s); i.e. the linked list of
+ *      itxs to commit is traversed from head to tail, and each itx is
+ *      committed to an lwb in that order.
+ *
+ *      * To clarify:
+ *
+ *        - the order of "sync" itxs is preserved w.r.t. other
+ *          "sync" itxs, regardless of the corresponding objects.
+ *        - the order of "async" itxs is preserved w.r.t. other
+ *          "async" itxs corresponding to the same object.
+ *        - the order of "async" itxs is *not* preserved w.r.t. other
+ *          "async" itxs corresponding to different objects.
+ *        - the order of "sync" itxs w.r.t. "async" itxs (or vice
+ *          versa) is *not* preserved, even for itxs that correspond
+ *          to the same object.
  *
- * itxs are committed in batches. In a heavily stressed zil there will be
- * a commit writer thread who is writing out a bunch of itxs to the log
- * for a set of committing threads (cthreads) in the same batch as the writer.
- * Those cthreads are all waiting on the same cv for that batch.
+ *      For more details, see: zil_itx_assign(), zil_async_to_sync(),
+ *      zil_get_commit_list(), and zil_process_commit_list().
  *
- * There will also be a different and growing batch of threads that are
- * waiting to commit (qthreads). When the committing batch completes
- * a transition occurs such that the cthreads exit and the qthreads become
- * cthreads. One of the new cthreads becomes the writer thread for the
- * batch. Any new threads arriving become new qthreads.
+ *   3. The lwbs represent a linked list of blocks on disk. Thus, any
+ *      lwb cannot be considered committed to stable storage, until its
+ *      "previous" lwb is also committed to stable storage. This fact,
+ *      coupled with the fact described above, means that itxs are
+ *      committed in (roughly) the order in which they were generated.
+ *      This is essential because itxs are dependent on prior itxs.
+ *      Thus, we *must not* deem an itx as being committed to stable
+ *      storage, until *all* prior itxs have also been committed to
+ *      stable storage.
  *
- * Only 2 condition variables are needed and there's no transition
- * between the two cvs needed. They just flip-flop between qthreads
- * and cthreads.
+ *      To enforce this ordering of lwb zio's, while still leveraging as
+ *      much of the underlying storage performance as possible, we rely
+ *      on two fundamental concepts:
  *
- * Using this scheme we can efficiently wakeup up only those threads
- * that have been committed.
+ *          1. The creation and issuance of lwb zio's is protected by
+ *             the zilog's "zl_issuer_lock", which ensures only a single
+ *             thread is creating and/or issuing lwb's at a time
+ *          2. The "previous" lwb is a child of the "current" lwb
+ *             (leveraging the zio parent-child depenency graph)
+ *
+ *      By relying on this parent-child zio relationship, we can have
+ *      many lwb zio's concurrently issued to the underlying storage,
+ *      but the order in which they complete will be the same order in
+ *      which they were created.
  */
 void
 zil_commit(zilog_t *zilog, uint64_t foid)
 {
-	uint64_t mybatch;
+	/*
+	 * We should never attempt to call zil_commit on a snapshot for
+	 * a couple of reasons:
+	 *
+	 * 1. A snapshot may never be modified, thus it cannot have any
+	 *    in-flight itxs that would have modified the dataset.
+	 *
+	 * 2. By design, when zil_commit() is called, a commit itx will
+	 *    be assigned to this zilog; as a result, the zilog will be
+	 *    dirtied. We must not dirty the zilog of a snapshot; there's
+	 *    checks in the code that enforce this invariant, and will
+	 *    cause a panic if it's not upheld.
+	 */
+	ASSERT(!dmu_objset_is_snapshot(zilog->zl_os));
 
 	if (zilog->zl_sync == ZFS_SYNC_DISABLED)
 		return;
 
+	if (!spa_writeable(zilog->zl_spa)) {
+		/*
+		 * If the SPA is not writable, there should never be any
+		 * pending itxs waiting to be committed to disk. If that
+		 * weren't true, we'd skip writing those itxs out, and
+		 * would break the semantics of zil_commit(); thus, we're
+		 * verifying that truth before we return to the caller.
+		 */
+		ASSERT(list_is_empty(&zilog->zl_lwb_list));
+		ASSERT3P(zilog->zl_last_lwb_opened, ==, NULL);
+		return;
+	}
+
+	/*
+	 * If the ZIL is suspended, we don't want to dirty it by calling
+	 * zil_commit_itx_assign() below, nor can we write out
+	 * lwbs like would be done in zil_commit_write(). Thus, we
+	 * simply rely on txg_wait_synced() to maintain the necessary
+	 * semantics, and avoid calling those functions altogether.
+	 */
+	if (zilog->zl_suspend > 0) {
+		txg_wait_synced(zilog->zl_dmu_pool, 0);
+		return;
+	}
+
+	zil_commit_impl(zilog, foid);
+}
+
+static void
+zil_commit_impl(zilog_t *zilog, uint64_t foid)
+{
+	zil_commit_waiter_t *zcw;
+
 	ZIL_STAT_BUMP(zil_commit_count);
 
-	/* move the async itxs for the foid to the sync queues */
+	/*
+	 * Move the "async" itxs for the specified foid to the "sync"
+	 * queues, such that they will be later committed (or skipped)
+	 * to an lwb when zil_process_commit_list() is called.
+	 *
+	 * Since these "async" itxs must be committed prior to this
+	 * call to zil_commit returning, we must perform this operation
+	 * before we call zil_commit_itx_assign().
+	 */
 	zil_async_to_sync(zilog, foid);
 
-	mutex_enter(&zilog->zl_lock);
-	mybatch = zilog->zl_next_batch;
-	while (zilog->zl_writer) {
-		cv_wait(&zilog->zl_cv_batch[mybatch & 1], &zilog->zl_lock);
-		if (mybatch <= zilog->zl_com_batch) {
-			mutex_exit(&zilog->zl_lock);
-			return;
-		}
-	}
-
-	zilog->zl_next_batch++;
-	zilog->zl_writer = B_TRUE;
-	ZIL_STAT_BUMP(zil_commit_writer_count);
-	zil_commit_writer(zilog);
-	zilog->zl_com_batch = mybatch;
-	zilog->zl_writer = B_FALSE;
+	/*
+	 * We allocate a new "waiter" structure which will initially be
+	 * linked to the commit itx using the itx's "itx_private" field.
+	 * Since the commit itx doesn't represent any on-disk state,
+	 * when it's committed to an lwb, rather than copying the its
+	 * lr_t into the lwb's buffer, the commit itx's "waiter" will be
+	 * added to the lwb's list of waiters. Then, when the lwb is
+	 * committed to stable storage, each waiter in the lwb's list of
+	 * waiters will be marked "done", and signalled.
+	 *
+	 * We must create the waiter and assign the commit itx prior to
+	 * calling zil_commit_writer(), or else our specific commit itx
+	 * is not guaranteed to be committed to an lwb prior to calling
+	 * zil_commit_waiter().
+	 */
+	zcw = zil_alloc_commit_waiter();
+	zil_commit_itx_assign(zilog, zcw);
 
-	/* wake up one thread to become the next writer */
-	cv_signal(&zilog->zl_cv_batch[(mybatch+1) & 1]);
+	zil_commit_writer(zilog, zcw);
+	zil_commit_waiter(zilog, zcw);
 
-	/* wake up all threads waiting for this batch to be committed */
-	cv_broadcast(&zilog->zl_cv_batch[mybatch & 1]);
+	if (zcw->zcw_zio_error != 0) {
+		/*
+		 * If there was an error writing out the ZIL blocks that
+		 * this thread is waiting on, then we fallback to
+		 * relying on spa_sync() to write out the data this
+		 * thread is waiting on. Obviously this has performance
+		 * implications, but the expectation is for this to be
+		 * an exceptional case, and shouldn't occur often.
+		 */
+		txg_wait_synced(zilog->zl_dmu_pool, 0);
+	}
 
-	mutex_exit(&zilog->zl_lock);
+	zil_free_commit_waiter(zcw);
 }
 
 /*
@@ -1725,7 +2831,11 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 	ASSERT(zilog->zl_stop_sync == 0);
 
 	if (*replayed_seq != 0) {
-		ASSERT(zh->zh_replay_seq < *replayed_seq);
+		/*
+		 * A parallel replay records the same seq for all the
+		 * transactions of a batch, which may span txgs.
+		 */
+		ASSERT(zh->zh_replay_seq <= *replayed_seq);
 		zh->zh_replay_seq = *replayed_seq;
 		*replayed_seq = 0;
 	}
@@ -1757,11 +2867,11 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 		if (lwb->lwb_buf != NULL || lwb->lwb_max_txg > txg)
 			break;
 
-		ASSERT(lwb->lwb_zio == NULL);
+		ASSERT(lwb->lwb_write_zio == NULL);
 
 		list_remove(&zilog->zl_lwb_list, lwb);
 		zio_free_zil(spa, txg, &lwb->lwb_blk);
-		kmem_cache_free(zil_lwb_cache, lwb);
+		zil_free_lwb(zilog, lwb);
 
 		/*
 		 * If we don't have anything left in the lwb list then
@@ -1779,7 +2889,7 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 	 * unused, long-lived LWBs.
 	 */
 	for (; lwb != NULL; lwb = list_next(&zilog->zl_lwb_list, lwb)) {
-		if (lwb->lwb_fastwrite && !lwb->lwb_zio) {
+		if (lwb->lwb_fastwrite && !lwb->lwb_write_zio) {
 			metaslab_fastwrite_unmark(zilog->zl_spa, &lwb->lwb_blk);
 			lwb->lwb_fastwrite = 0;
 		}
@@ -1788,11 +2898,43 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 	mutex_exit(&zilog->zl_lock);
 }
 
+/* ARGSUSED */
+static int
+zil_lwb_cons(void *vbuf, void *unused, int kmflag)
+{
+	lwb_t *lwb = vbuf;
+
+	list_create(&lwb->lwb_waiters, sizeof (zil_commit_waiter_t),
+	    offsetof(zil_commit_waiter_t, zcw_node));
+	list_create(&lwb->lwb_itxs, sizeof (itx_t),
+	    offsetof(itx_t, itx_node));
+	avl_create(&lwb->lwb_vdev_tree, zil_vdev_compare,
+	    sizeof (zil_vdev_node_t), offsetof(zil_vdev_node_t, zv_node));
+	mutex_init(&lwb->lwb_vdev_lock, NULL, MUTEX_DEFAULT, NULL);
+	list_link_init(&lwb->lwb_flush_node);
+	return (0);
+}
+
+/* ARGSUSED */
+static void
+zil_lwb_dest(void *vbuf, void *unused)
+{
+	lwb_t *lwb = vbuf;
+
+	mutex_destroy(&lwb->lwb_vdev_lock);
+	avl_destroy(&lwb->lwb_vdev_tree);
+	list_destroy(&lwb->lwb_waiters);
+	list_destroy(&lwb->lwb_itxs);
+}
+
 void
 zil_init(void)
 {
 	zil_lwb_cache = kmem_cache_create("zil_lwb_cache",
-	    sizeof (struct lwb), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	    sizeof (lwb_t), 0, zil_lwb_cons, zil_lwb_dest, NULL, NULL, NULL, 0);
+
+	zil_zcw_cache = kmem_cache_create("zil_zcw_cache",
+	    sizeof (zil_commit_waiter_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 
 	zil_ksp = kstat_create("zfs", 0, "zil", "misc",
 	    KSTAT_TYPE_NAMED, sizeof (zil_stats) / sizeof (kstat_named_t),
@@ -1807,6 +2949,7 @@ zil_init(void)
 void
 zil_fini(void)
 {
+	kmem_cache_destroy(zil_zcw_cache);
 	kmem_cache_destroy(zil_lwb_cache);
 
 	if (zil_ksp != NULL) {
@@ -1842,9 +2985,10 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	zilog->zl_destroy_txg = TXG_INITIAL - 1;
 	zilog->zl_logbias = dmu_objset_logbias(os);
 	zilog->zl_sync = dmu_objset_syncprop(os);
-	zilog->zl_next_batch = 1;
+	zilog->zl_last_lwb_latency = 0;
 
 	mutex_init(&zilog->zl_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&zilog->zl_issuer_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	for (i = 0; i < TXG_SIZE; i++) {
 		mutex_init(&zilog->zl_itxg[i].itxg_lock, NULL,
@@ -1857,15 +3001,7 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	list_create(&zilog->zl_itx_commit_list, sizeof (itx_t),
 	    offsetof(itx_t, itx_node));
 
-	mutex_init(&zilog->zl_vdev_lock, NULL, MUTEX_DEFAULT, NULL);
-
-	avl_create(&zilog->zl_vdev_tree, zil_vdev_compare,
-	    sizeof (zil_vdev_node_t), offsetof(zil_vdev_node_t, zv_node));
-
-	cv_init(&zilog->zl_cv_writer, NULL, CV_DEFAULT, NULL);
 	cv_init(&zilog->zl_cv_suspend, NULL, CV_DEFAULT, NULL);
-	cv_init(&zilog->zl_cv_batch[0], NULL, CV_DEFAULT, NULL);
-	cv_init(&zilog->zl_cv_batch[1], NULL, CV_DEFAULT, NULL);
 
 	return (zilog);
 }
@@ -1883,9 +3019,6 @@ zil_free(zilog_t *zilog)
 	ASSERT(list_is_empty(&zilog->zl_lwb_list));
 	list_destroy(&zilog->zl_lwb_list);
 
-	avl_destroy(&zilog->zl_vdev_tree);
-	mutex_destroy(&zilog->zl_vdev_lock);
-
 	ASSERT(list_is_empty(&zilog->zl_itx_commit_list));
 	list_destroy(&zilog->zl_itx_commit_list);
 
@@ -1902,12 +3035,10 @@ zil_free(zilog_t *zilog)
 		mutex_destroy(&zilog->zl_itxg[i].itxg_lock);
 	}
 
+	mutex_destroy(&zilog->zl_issuer_lock);
 	mutex_destroy(&zilog->zl_lock);
 
-	cv_destroy(&zilog->zl_cv_writer);
 	cv_destroy(&zilog->zl_cv_suspend);
-	cv_destroy(&zilog->zl_cv_batch[0]);
-	cv_destroy(&zilog->zl_cv_batch[1]);
 
 	kmem_free(zilog, sizeof (zilog_t));
 }
@@ -1940,7 +3071,12 @@ zil_close(zilog_t *zilog)
 	lwb_t *lwb;
 	uint64_t txg = 0;
 
-	zil_commit(zilog, 0); /* commit all itx */
+	if (!dmu_objset_is_snapshot(zilog->zl_os)) {
+		zil_commit(zilog, 0); /* commit all itx */
+	} else {
+		ASSERT3P(list_tail(&zilog->zl_lwb_list), ==, NULL);
+		ASSERT(!zilog_is_dirty(zilog));
+	}
 
 	/*
 	 * The lwb_max_txg for the stubby lwb will reflect the last activity
@@ -1972,12 +3108,12 @@ zil_close(zilog_t *zilog)
 	lwb = list_head(&zilog->zl_lwb_list);
 	if (lwb != NULL) {
 		ASSERT(lwb == list_tail(&zilog->zl_lwb_list));
-		ASSERT(lwb->lwb_zio == NULL);
+		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_ISSUED);
 		if (lwb->lwb_fastwrite)
 			metaslab_fastwrite_unmark(zilog->zl_spa, &lwb->lwb_blk);
 		list_remove(&zilog->zl_lwb_list, lwb);
 		zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
-		kmem_cache_free(zil_lwb_cache, lwb);
+		zil_free_lwb(zilog, lwb);
 	}
 	mutex_exit(&zilog->zl_lock);
 }
@@ -2079,7 +3215,15 @@ zil_suspend(const char *osname, void **cookiep)
 	zilog->zl_suspending = B_TRUE;
 	mutex_exit(&zilog->zl_lock);
 
-	zil_commit(zilog, 0);
+	/*
+	 * We need to use zil_commit_impl to ensure we wait for all
+	 * LWB_STATE_OPENED and LWB_STATE_ISSUED lwb's to be committed
+	 * to disk before proceeding. If we used zil_commit instead, it
+	 * would just call txg_wait_synced(), because zl_suspend is set.
+	 * txg_wait_synced() doesn't wait for these lwb's to be
+	 * LWB_STATE_DONE before returning.
+	 */
+	zil_commit_impl(zilog, 0);
 
 	zil_destroy(zilog, B_FALSE);
 
@@ -2110,19 +3254,41 @@ zil_resume(void *cookie)
 }
 
 typedef struct zil_replay_arg {
+	zilog_t		*zr_zilog;
 	zil_replay_func_t *zr_replay;
+	zil_replay_range_func_t *zr_range;
 	void		*zr_arg;
 	boolean_t	zr_byteswap;
 	char		*zr_lr;
+	taskq_t		*zr_taskq;	/* workers of a parallel replay */
+	avl_tree_t	zr_ranges;	/* ranges in the current batch */
+	uint64_t	zr_batch_size;	/* bytes of records in the batch */
+	uint64_t	zr_batch_seq;	/* last seq in the batch */
+	kmutex_t	zr_lock;	/* protects zr_error */
+	int		zr_error;	/* first error in the batch */
 } zil_replay_arg_t;
 
-static int
-zil_replay_error(zilog_t *zilog, lr_t *lr, int error)
+/*
+ * A record of a parallel replay batch, with the part of an object it
+ * changes.  The ranges in a batch never overlap, so their records can be
+ * replayed in any order.
+ */
+typedef struct zil_replay_range {
+	avl_node_t	zrr_node;
+	zil_replay_arg_t *zrr_zr;
+	uint64_t	zrr_obj;
+	uint64_t	zrr_start;
+	uint64_t	zrr_end;
+	lr_t		zrr_lrc;	/* header as parsed, for errors */
+	lr_t		*zrr_lr;	/* copy of the record and its data */
+	size_t		zrr_size;
+} zil_replay_range_t;
+
+static void
+zil_replay_warn(zilog_t *zilog, lr_t *lr, int error)
 {
 	char name[ZFS_MAX_DATASET_NAME_LEN];
 
-	zilog->zl_replaying_seq--;	/* didn't actually replay this one */
-
 	dmu_objset_name(zilog->zl_os, name);
 
 	cmn_err(CE_WARN, "ZFS replay transaction error %d, "
@@ -2130,32 +3296,28 @@ zil_replay_error(zilog_t *zilog, lr_t *lr, int error)
 	    (u_longlong_t)lr->lrc_seq,
 	    (u_longlong_t)(lr->lrc_txtype & ~TX_CI),
 	    (lr->lrc_txtype & TX_CI) ? "CI" : "");
-
-	return (error);
 }
 
 static int
-zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
+zil_replay_error(zilog_t *zilog, lr_t *lr, int error)
 {
-	zil_replay_arg_t *zr = zra;
-	const zil_header_t *zh = zilog->zl_header;
-	uint64_t reclen = lr->lrc_reclen;
-	uint64_t txtype = lr->lrc_txtype;
-	int error = 0;
+	zilog->zl_replaying_seq--;	/* didn't actually replay this one */
 
-	zilog->zl_replaying_seq = lr->lrc_seq;
+	zil_replay_warn(zilog, lr, error);
 
-	if (lr->lrc_seq <= zh->zh_replay_seq)	/* already replayed */
-		return (0);
-
-	if (lr->lrc_txg < claim_txg)		/* already committed */
-		return (0);
-
-	/* Strip case-insensitive bit, still present in log record */
-	txtype &= ~TX_CI;
+	return (error);
+}
 
-	if (txtype == 0 || txtype >= TX_MAX_TYPE)
-		return (zil_replay_error(zilog, lr, EINVAL));
+/*
+ * Replay the record at lr, a copy of a log record in which the record
+ * may be revised and extended by its data.
+ */
+static int
+zil_replay_record(zilog_t *zilog, zil_replay_arg_t *zr, lr_t *lr)
+{
+	uint64_t reclen = lr->lrc_reclen;
+	uint64_t txtype = lr->lrc_txtype & ~TX_CI;
+	int error;
 
 	/*
 	 * If this record type can be logged out of order, the object
@@ -2168,19 +3330,14 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 			return (0);
 	}
 
-	/*
-	 * Make a copy of the data so we can revise and extend it.
-	 */
-	bcopy(lr, zr->zr_lr, reclen);
-
 	/*
 	 * If this is a TX_WRITE with a blkptr, suck in the data.
 	 */
 	if (txtype == TX_WRITE && reclen == sizeof (lr_write_t)) {
 		error = zil_read_log_data(zilog, (lr_write_t *)lr,
-		    zr->zr_lr + reclen);
+		    (char *)lr + reclen);
 		if (error != 0)
-			return (zil_replay_error(zilog, lr, error));
+			return (error);
 	}
 
 	/*
@@ -2191,7 +3348,7 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 	 * the lr was byteswapped, undo it before invoking the replay vector.
 	 */
 	if (zr->zr_byteswap)
-		byteswap_uint64_array(zr->zr_lr, reclen);
+		byteswap_uint64_array(lr, reclen);
 
 	/*
 	 * We must now do two things atomically: replay this log record,
@@ -2199,7 +3356,7 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 	 * we did so. At the end of each replay function the sequence number
 	 * is updated if we are in replay mode.
 	 */
-	error = zr->zr_replay[txtype](zr->zr_arg, zr->zr_lr, zr->zr_byteswap);
+	error = zr->zr_replay[txtype](zr->zr_arg, (char *)lr, zr->zr_byteswap);
 	if (error != 0) {
 		/*
 		 * The DMU's dnode layer doesn't see removes until the txg
@@ -2209,10 +3366,190 @@ zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
 		 * specify B_FALSE for byteswap now, so we don't do it twice.
 		 */
 		txg_wait_synced(spa_get_dsl(zilog->zl_spa), 0);
-		error = zr->zr_replay[txtype](zr->zr_arg, zr->zr_lr, B_FALSE);
+		error = zr->zr_replay[txtype](zr->zr_arg, (char *)lr, B_FALSE);
+	}
+	return (error);
+}
+
+static int
+zil_replay_log_record(zilog_t *zilog, lr_t *lr, void *zra, uint64_t claim_txg)
+{
+	zil_replay_arg_t *zr = zra;
+	const zil_header_t *zh = zilog->zl_header;
+	uint64_t txtype = lr->lrc_txtype & ~TX_CI;
+	int error;
+
+	zilog->zl_replaying_seq = lr->lrc_seq;
+
+	if (lr->lrc_seq <= zh->zh_replay_seq)	/* already replayed */
+		return (0);
+
+	if (lr->lrc_txg < claim_txg)		/* already committed */
+		return (0);
+
+	if (txtype == 0 || txtype >= TX_MAX_TYPE)
+		return (zil_replay_error(zilog, lr, EINVAL));
+
+	/*
+	 * Make a copy of the data so we can revise and extend it.
+	 */
+	bcopy(lr, zr->zr_lr, lr->lrc_reclen);
+
+	error = zil_replay_record(zilog, zr, (lr_t *)zr->zr_lr);
+	if (error != 0)
+		return (zil_replay_error(zilog, lr, error));
+	return (0);
+}
+
+static int
+zil_replay_range_compare(const void *x1, const void *x2)
+{
+	const zil_replay_range_t *r1 = x1;
+	const zil_replay_range_t *r2 = x2;
+
+	int cmp = AVL_CMP(r1->zrr_obj, r2->zrr_obj);
+	if (likely(cmp))
+		return (cmp);
+
+	return (AVL_CMP(r1->zrr_start, r2->zrr_start));
+}
+
+static void
+zil_replay_range_task(void *arg)
+{
+	zil_replay_range_t *zrr = arg;
+	zil_replay_arg_t *zr = zrr->zrr_zr;
+	int error;
+
+	/* Once a record has failed, replay stops at this batch */
+	if (zr->zr_error != 0)
+		return;
+
+	error = zil_replay_record(zr->zr_zilog, zr, zrr->zrr_lr);
+	if (error != 0) {
+		mutex_enter(&zr->zr_lock);
+		if (zr->zr_error == 0)
+			zr->zr_error = error;
+		mutex_exit(&zr->zr_lock);
+		zil_replay_warn(zr->zr_zilog, &zrr->zrr_lrc, error);
+	}
+}
+
+/*
+ * Wait for the records of the current batch to be replayed.  Only then is
+ * zl_replaying_seq moved past them: the transactions of a batch all record
+ * the seq of the last record of the batch before, so that a crash during
+ * a batch replays it again as a whole.  Records of a batch change disjoint
+ * ranges in their log order, so doing that again is harmless.
+ */
+static int
+zil_replay_batch_wait(zilog_t *zilog, zil_replay_arg_t *zr)
+{
+	zil_replay_range_t *zrr;
+	void *cookie = NULL;
+
+	if (avl_numnodes(&zr->zr_ranges) == 0)
+		return (0);
+
+	taskq_wait(zr->zr_taskq);
+
+	while ((zrr = avl_destroy_nodes(&zr->zr_ranges, &cookie)) != NULL) {
+		vmem_free(zrr->zrr_lr, zrr->zrr_size);
+		kmem_free(zrr, sizeof (zil_replay_range_t));
+	}
+	zr->zr_batch_size = 0;
+
+	if (zr->zr_error != 0)
+		return (zr->zr_error);
+
+	zilog->zl_replaying_seq = zr->zr_batch_seq;
+	return (0);
+}
+
+/*
+ * The zil_parse() callback of a parallel replay.  Records are gathered
+ * into a batch and handed to the workers right away, until one overlaps
+ * a range already in the batch; the batch is then waited for and a new
+ * one started.  Records the range function has no range for are replayed
+ * alone, between two batches.
+ */
+static int
+zil_replay_log_record_parallel(zilog_t *zilog, lr_t *lr, void *zra,
+    uint64_t claim_txg)
+{
+	zil_replay_arg_t *zr = zra;
+	const zil_header_t *zh = zilog->zl_header;
+	uint64_t reclen = lr->lrc_reclen;
+	uint64_t txtype = lr->lrc_txtype & ~TX_CI;
+	zil_replay_range_t *zrr, *prev, *next;
+	uint64_t obj, offset, length;
+	avl_index_t where;
+	boolean_t overlap;
+	size_t size;
+	int error;
+
+	if (lr->lrc_seq <= zh->zh_replay_seq)	/* already replayed */
+		return (0);
+
+	if (lr->lrc_txg < claim_txg)		/* already committed */
+		return (0);
+
+	if (txtype == 0 || txtype >= TX_MAX_TYPE ||
+	    zr->zr_range(zr->zr_arg, lr, &obj, &offset, &length) != 0) {
+		error = zil_replay_batch_wait(zilog, zr);
 		if (error != 0)
-			return (zil_replay_error(zilog, lr, error));
+			return (error);
+		return (zil_replay_log_record(zilog, lr, zr, claim_txg));
 	}
+
+	size = reclen;
+	if (txtype == TX_WRITE && reclen == sizeof (lr_write_t)) {
+		size += MAX(BP_GET_LSIZE(&((lr_write_t *)lr)->lr_blkptr),
+		    ((lr_write_t *)lr)->lr_length);
+	}
+
+	zrr = kmem_alloc(sizeof (zil_replay_range_t), KM_SLEEP);
+	zrr->zrr_zr = zr;
+	zrr->zrr_obj = obj;
+	zrr->zrr_start = offset;
+	zrr->zrr_end = (length > UINT64_MAX - offset) ?
+	    UINT64_MAX : offset + length;
+	zrr->zrr_lrc = *lr;
+	zrr->zrr_lr = vmem_alloc(size, KM_SLEEP);
+	zrr->zrr_size = size;
+	bcopy(lr, zrr->zrr_lr, reclen);
+
+	/*
+	 * The ranges of a batch are disjoint, so only the ranges just
+	 * before and after this one can overlap it.
+	 */
+	if (avl_find(&zr->zr_ranges, zrr, &where) != NULL) {
+		overlap = B_TRUE;
+	} else {
+		prev = avl_nearest(&zr->zr_ranges, where, AVL_BEFORE);
+		next = avl_nearest(&zr->zr_ranges, where, AVL_AFTER);
+		overlap = (prev != NULL && prev->zrr_obj == obj &&
+		    prev->zrr_end > zrr->zrr_start) ||
+		    (next != NULL && next->zrr_obj == obj &&
+		    next->zrr_start < zrr->zrr_end);
+	}
+	if (overlap || (avl_numnodes(&zr->zr_ranges) != 0 &&
+	    zr->zr_batch_size + size > zil_replay_batch_size)) {
+		error = zil_replay_batch_wait(zilog, zr);
+		if (error != 0) {
+			vmem_free(zrr->zrr_lr, zrr->zrr_size);
+			kmem_free(zrr, sizeof (zil_replay_range_t));
+			return (error);
+		}
+		VERIFY3P(avl_find(&zr->zr_ranges, zrr, &where), ==, NULL);
+	}
+
+	avl_insert(&zr->zr_ranges, zrr, where);
+	zr->zr_batch_size += size;
+	zr->zr_batch_seq = lr->lrc_seq;
+	VERIFY3U(taskq_dispatch(zr->zr_taskq, zil_replay_range_task, zrr,
+	    TQ_SLEEP), !=, TASKQID_INVALID);
+
 	return (0);
 }
 
@@ -2230,6 +3567,21 @@ zil_incr_blks(zilog_t *zilog, blkptr_t *bp, void *arg, uint64_t claim_txg)
  */
 void
 zil_replay(objset_t *os, void *arg, zil_replay_func_t replay_func[TX_MAX_TYPE])
+{
+	zil_replay_parallel(os, arg, replay_func, NULL);
+}
+
+/*
+ * Like zil_replay(), but with range_func telling which records change
+ * only a range of an object, and would change it the same way if
+ * replayed in any order with records for other ranges.  Those records
+ * are replayed by zil_replay_threads workers, while the log order is kept
+ * for records of overlapping ranges and for all other records.
+ */
+void
+zil_replay_parallel(objset_t *os, void *arg,
+    zil_replay_func_t replay_func[TX_MAX_TYPE],
+    zil_replay_range_func_t *range_func)
 {
 	zilog_t *zilog = dmu_objset_zil(os);
 	const zil_header_t *zh = zilog->zl_header;
@@ -2240,11 +3592,24 @@ zil_replay(objset_t *os, void *arg, zil_replay_func_t replay_func[TX_MAX_TYPE])
 		return;
 	}
 
+	bzero(&zr, sizeof (zr));
+	zr.zr_zilog = zilog;
 	zr.zr_replay = replay_func;
+	zr.zr_range = range_func;
 	zr.zr_arg = arg;
 	zr.zr_byteswap = BP_SHOULD_BYTESWAP(&zh->zh_log);
 	zr.zr_lr = vmem_alloc(2 * SPA_MAXBLOCKSIZE, KM_SLEEP);
 
+	if (range_func != NULL && zil_replay_threads > 1) {
+		zr.zr_taskq = taskq_create("zil_replay", zil_replay_threads,
+		    defclsyspri, zil_replay_threads, INT_MAX,
+		    TASKQ_PREPOPULATE);
+		avl_create(&zr.zr_ranges, zil_replay_range_compare,
+		    sizeof (zil_replay_range_t),
+		    offsetof(zil_replay_range_t, zrr_node));
+		mutex_init(&zr.zr_lock, NULL, MUTEX_DEFAULT, NULL);
+	}
+
 	/*
 	 * Wait for in-progress removes to sync before starting replay.
 	 */
@@ -2252,9 +3617,19 @@ zil_replay(objset_t *os, void *arg, zil_replay_func_t replay_func[TX_MAX_TYPE])
 
 	zilog->zl_replay = B_TRUE;
 	zilog->zl_replay_time = ddi_get_lbolt();
+	zilog->zl_replaying_seq = zh->zh_replay_seq;
 	ASSERT(zilog->zl_replay_blks == 0);
-	(void) zil_parse(zilog, zil_incr_blks, zil_replay_log_record, &zr,
-	    zh->zh_claim_txg);
+	if (zr.zr_taskq != NULL) {
+		(void) zil_parse(zilog, zil_incr_blks,
+		    zil_replay_log_record_parallel, &zr, zh->zh_claim_txg);
+		(void) zil_replay_batch_wait(zilog, &zr);
+		taskq_destroy(zr.zr_taskq);
+		avl_destroy(&zr.zr_ranges);
+		mutex_destroy(&zr.zr_lock);
+	} else {
+		(void) zil_parse(zilog, zil_incr_blks, zil_replay_log_record,
+		    &zr, zh->zh_claim_txg);
+	}
 	vmem_free(zr.zr_lr, 2 * SPA_MAXBLOCKSIZE);
 
 	zil_destroy(zilog, B_FALSE);
@@ -2296,6 +3671,7 @@ EXPORT_SYMBOL(zil_free);
 EXPORT_SYMBOL(zil_open);
 EXPORT_SYMBOL(zil_close);
 EXPORT_SYMBOL(zil_replay);
+EXPORT_SYMBOL(zil_replay_parallel);
 EXPORT_SYMBOL(zil_replaying);
 EXPORT_SYMBOL(zil_destroy);
 EXPORT_SYMBOL(zil_destroy_sync);
@@ -2310,7 +3686,7 @@ EXPORT_SYMBOL(zil_sync);
 EXPORT_SYMBOL(zil_clean);
 EXPORT_SYMBOL(zil_suspend);
 EXPORT_SYMBOL(zil_resume);
-EXPORT_SYMBOL(zil_add_block);
+EXPORT_SYMBOL(zil_lwb_add_block);
 EXPORT_SYMBOL(zil_bp_tree_add);
 EXPORT_SYMBOL(zil_set_sync);
 EXPORT_SYMBOL(zil_set_logbias);
@@ -2319,10 +3695,20 @@ EXPORT_SYMBOL(zil_set_logbias);
 module_param(zil_replay_disable, int, 0644);
 MODULE_PARM_DESC(zil_replay_disable, "Disable intent logging replay");
 
+module_param(zil_replay_threads, int, 0644);
+MODULE_PARM_DESC(zil_replay_threads, "Threads replaying a volume's intent log");
+
+module_param(zil_replay_batch_size, ulong, 0644);
+MODULE_PARM_DESC(zil_replay_batch_size,
+	"Max record bytes replayed in parallel between two waits");
+
 module_param(zfs_nocacheflush, int, 0644);
 MODULE_PARM_DESC(zfs_nocacheflush, "Disable cache flushes");
 
 module_param(zil_slog_bulk, ulong, 0644);
 MODULE_PARM_DESC(zil_slog_bulk, "Limit in bytes slog sync writes per commit");
+
+module_param(zfs_commit_timeout_pct, int, 0644);
+MODULE_PARM_DESC(zfs_commit_timeout_pct, "ZIL block open timeout percentage");
 /* END CSTYLED */
 #endif
@@ -45,6 +45,7 @@
 #include <sys/abd.h>
 
 extern int zfs_do_write_coalesce;
+extern int zio_stage_histograms;
 
 /*
  * ==========================================================================
@@ -60,6 +61,7 @@ const char *zio_type_name[ZIO_TYPES] = {
 };
 
 int zio_dva_throttle_enabled = B_TRUE;
+int zfs_dedup_write_prefetch = B_TRUE;	/* see zio_checksum_generate() */
 
 /*
  * ==========================================================================
@@ -77,6 +79,43 @@ uint64_t zio_buf_cache_frees[SPA_MAXBLOCKSIZE >> SPA_MINBLOCKSHIFT];
 
 int zio_delay_max = ZIO_DELAY_MAX;
 
+/*
+ * Gang blocks are written when no metaslab can hold a block contiguously,
+ * and cost an extra write now and an extra read every time the block is
+ * read back.  These count how often that happens.
+ */
+typedef struct zio_gang_stats {
+	/*
+	 * Number of gang block headers written, and the logical size of
+	 * the blocks they replace.
+	 */
+	kstat_named_t	zgs_gang_count;
+	kstat_named_t	zgs_gang_bytes;
+	/*
+	 * Number of those which are themselves members of a gang block.
+	 */
+	kstat_named_t	zgs_gang_nested_count;
+	/*
+	 * Number of times not even the gang block header could be
+	 * allocated.
+	 */
+	kstat_named_t	zgs_gang_failed_count;
+} zio_gang_stats_t;
+
+static zio_gang_stats_t zio_gang_stats = {
+	{ "gang_count",				KSTAT_DATA_UINT64 },
+	{ "gang_bytes",				KSTAT_DATA_UINT64 },
+	{ "gang_nested_count",			KSTAT_DATA_UINT64 },
+	{ "gang_failed_count",			KSTAT_DATA_UINT64 },
+};
+
+#define	ZIO_GANG_STAT_INCR(stat, val) \
+	atomic_add_64(&zio_gang_stats.stat.value.ui64, (val))
+#define	ZIO_GANG_STAT_BUMP(stat) \
+	ZIO_GANG_STAT_INCR(stat, 1)
+
+static kstat_t *zio_gang_ksp;
+
 #define	ZIO_PIPELINE_CONTINUE		0x100
 #define	ZIO_PIPELINE_STOP		0x101
 
@@ -94,9 +133,23 @@ int zio_delay_max = ZIO_DELAY_MAX;
  *
  * The 'zfs_sync_pass_deferred_free' pass must be greater than 1 to ensure that
  * regular blocks are not deferred.
+ *
+ * Starting in sync pass 8 (zfs_sync_pass_dont_compress), we disable
+ * compression (including of metadata).  In practice, we don't have this
+ * many sync passes, so this has no effect.
+ *
+ * The original intent was that disabling compression would help the sync
+ * passes to converge.  However, in practice disabling compression increases
+ * the average number of sync passes, because when we turn compression off,
+ * the size of a lot of blocks changes and thus we have to re-allocate (not
+ * overwrite) them.  It also increases the number of 128KB allocations (e.g.
+ * for indirect blocks and spacemaps) because these will not be compressed.
+ * The 128K allocations are especially detrimental to performance on highly
+ * fragmented systems, which may have very few free segments of this size,
+ * and may need to load new metaslabs to satisfy 128K allocations.
  */
 int zfs_sync_pass_deferred_free = 2; /* defer frees starting in this pass */
-int zfs_sync_pass_dont_compress = 5; /* don't compress starting in this pass */
+int zfs_sync_pass_dont_compress = 8; /* don't compress starting in this pass */
 int zfs_sync_pass_rewrite = 2; /* rewrite new bps starting in this pass */
 
 /*
@@ -199,9 +252,19 @@ zio_init(void)
 			zio_data_buf_cache[c - 1] = zio_data_buf_cache[c];
 	}
 
+	zio_gang_ksp = kstat_create("zfs", 0, "zio_gang", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zio_gang_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (zio_gang_ksp != NULL) {
+		zio_gang_ksp->ks_data = &zio_gang_stats;
+		kstat_install(zio_gang_ksp);
+	}
+
 	zio_inject_init();
 
 	lz4_init();
+	zstd_init();
 }
 
 void
@@ -243,8 +306,14 @@ zio_fini(void)
 	kmem_cache_destroy(zio_link_cache);
 	kmem_cache_destroy(zio_cache);
 
+	if (zio_gang_ksp != NULL) {
+		kstat_delete(zio_gang_ksp);
+		zio_gang_ksp = NULL;
+	}
+
 	zio_inject_fini();
 
+	zstd_fini();
 	lz4_fini();
 }
 
@@ -651,6 +720,7 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 
 	zio->io_spa = spa;
 	zio->io_txg = txg;
+	zio->io_taskq_hint = CPU_SEQID;
 	zio->io_done = done;
 	zio->io_private = private;
 	zio->io_type = type;
@@ -1012,6 +1082,29 @@ zio_ioctl(zio_t *pio, spa_t *spa, vdev_t *vd, int cmd,
 	return (zio);
 }
 
+/*
+ * Discard a range of a leaf vdev.  Unlike other ioctls, trims go through
+ * the vdev queue, in the ZIO_PRIORITY_TRIM class.  The offset is that of
+ * the device, including the front labels.
+ */
+zio_t *
+zio_trim(zio_t *pio, spa_t *spa, vdev_t *vd, uint64_t offset, uint64_t size,
+    zio_done_func_t *done, void *private, enum zio_flag flags)
+{
+	zio_t *zio;
+
+	ASSERT(vd->vdev_ops->vdev_op_leaf);
+	ASSERT0(P2PHASE(offset, 1ULL << vd->vdev_top->vdev_ashift));
+	ASSERT0(P2PHASE(size, 1ULL << vd->vdev_top->vdev_ashift));
+
+	zio = zio_create(pio, spa, 0, NULL, NULL, size, size, done, private,
+	    ZIO_TYPE_IOCTL, ZIO_PRIORITY_TRIM, flags, vd, offset, NULL,
+	    ZIO_STAGE_OPEN, ZIO_TRIM_PIPELINE);
+	zio->io_cmd = DKIOCTRIM;
+
+	return (zio);
+}
+
 zio_t *
 zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
     abd_t *data, int checksum, zio_done_func_t *done, void *private,
@@ -1308,6 +1401,9 @@ zio_write_compress(zio_t *zio)
 		return (ZIO_PIPELINE_STOP);
 	}
 
+	/* Anything left from an earlier execution of this zio is stale */
+	zio->io_fused_checksum = ZIO_CHECKSUM_INHERIT;
+
 	if (!IO_IS_ALLOCATING(zio))
 		return (ZIO_PIPELINE_CONTINUE);
 
@@ -1351,7 +1447,8 @@ zio_write_compress(zio_t *zio)
 	/* If it's a compressed write that is not raw, compress the buffer. */
 	if (compress != ZIO_COMPRESS_OFF && psize == lsize) {
 		void *cbuf = zio_buf_alloc(lsize);
-		psize = zio_compress_data(compress, zio->io_abd, cbuf, lsize);
+		psize = zio_compress_data(compress, zio->io_abd, cbuf, lsize,
+		    zp->zp_complevel);
 		if (psize == 0 || psize == lsize) {
 			compress = ZIO_COMPRESS_OFF;
 			zio_buf_free(cbuf, lsize);
@@ -1398,6 +1495,17 @@ zio_write_compress(zio_t *zio)
 			}
 		}
 
+		/*
+		 * Checksum the block now, while the compressed output (or
+		 * the source, when it didn't compress) is still in the
+		 * cache, rather than reading it back from memory in
+		 * zio_checksum_generate().
+		 */
+		if (zp->zp_checksum != ZIO_CHECKSUM_OFF) {
+			zio_checksum_compute_fused(zio, zp->zp_checksum,
+			    zio->io_abd, zio->io_size);
+		}
+
 		/*
 		 * We were unable to handle this as an override bp, treat
 		 * it as a regular write I/O.
@@ -1521,7 +1629,7 @@ zio_taskq_dispatch(zio_t *zio, zio_taskq_type_t q, boolean_t cutinline)
 	 */
 	ASSERT(taskq_empty_ent(&zio->io_tqent));
 	spa_taskq_dispatch_ent(spa, t, q, (task_func_t *)zio_execute, zio,
-	    flags, &zio->io_tqent);
+	    flags, &zio->io_tqent, zio->io_taskq_hint);
 }
 
 static boolean_t
@@ -1696,6 +1804,8 @@ __zio_execute(zio_t *zio)
 	while (zio->io_stage < ZIO_STAGE_DONE) {
 		enum zio_stage pipeline = zio->io_pipeline;
 		enum zio_stage stage = zio->io_stage;
+		spa_t *spa = zio->io_spa;
+		hrtime_t start = 0;
 		int rv;
 
 		ASSERT(!MUTEX_HELD(&zio->io_lock));
@@ -1736,10 +1846,26 @@ __zio_execute(zio_t *zio)
 			return;
 		}
 
+		/*
+		 * The zio may be gone once the stage function returns, so the
+		 * time from the start of the previous stage is recorded here.
+		 */
+		if (zio_stage_histograms) {
+			start = gethrtime();
+			if (zio->io_stage_timestamp != 0) {
+				spa_zio_stage_elapsed(spa, zio->io_stage,
+				    start - zio->io_stage_timestamp);
+			}
+			zio->io_stage_timestamp = start;
+		}
+
 		zio->io_stage = stage;
 		zio->io_pipeline_trace |= zio->io_stage;
 		rv = zio_pipeline[highbit64(stage) - 1](zio);
 
+		if (start != 0)
+			spa_zio_stage_exec(spa, stage, gethrtime() - start);
+
 		if (rv == ZIO_PIPELINE_STOP)
 			return;
 
@@ -1829,6 +1955,7 @@ zio_reexecute(zio_t *pio)
 	pio->io_reexecute = 0;
 	pio->io_flags |= ZIO_FLAG_REEXECUTED;
 	pio->io_pipeline_trace = 0;
+	pio->io_stage_timestamp = 0;
 	pio->io_error = 0;
 	for (w = 0; w < ZIO_WAIT_TYPES; w++)
 		pio->io_state[w] = 0;
@@ -1886,6 +2013,7 @@ zio_suspend(spa_t *spa, zio_t *zio, zio_suspend_reason_t reason)
 		    ZIO_FLAG_GODFATHER);
 
 	spa->spa_suspended = reason;
+	spa_stats_cache_invalidate(spa);
 
 	if (zio != NULL) {
 		ASSERT(!(zio->io_flags & ZIO_FLAG_GODFATHER));
@@ -1909,6 +2037,7 @@ zio_resume(spa_t *spa)
 	 */
 	mutex_enter(&spa->spa_suspend_lock);
 	spa->spa_suspended = ZIO_SUSPEND_NONE;
+	spa_stats_cache_invalidate(spa);
 	cv_broadcast(&spa->spa_suspend_cv);
 	pio = spa->spa_suspend_zio_root;
 	spa->spa_suspend_zio_root = NULL;
@@ -2317,7 +2446,8 @@ zio_write_gang_block(zio_t *pio)
 		ASSERT(!(pio->io_flags & ZIO_FLAG_NODATA));
 
 		flags |= METASLAB_ASYNC_ALLOC;
-		VERIFY(refcount_held(&mc->mc_alloc_slots, pio));
+		VERIFY(refcount_held(&mc->mc_allocator[pio->io_allocator].
+		    mca_alloc_slots, pio));
 
 		/*
 		 * The logical zio has already placed a reservation for
@@ -2328,12 +2458,12 @@ zio_write_gang_block(zio_t *pio)
 		 * additional reservations for gang blocks.
 		 */
 		VERIFY(metaslab_class_throttle_reserve(mc, gbh_copies - copies,
-		    pio, flags));
+		    pio->io_allocator, pio, flags));
 	}
 
 	error = metaslab_alloc(spa, mc, SPA_GANGBLOCKSIZE,
 	    bp, gbh_copies, txg, pio == gio ? NULL : gio->io_bp, flags,
-	    &pio->io_alloc_list, pio);
+	    &pio->io_alloc_list, pio, pio->io_allocator);
 	if (error) {
 		if (pio->io_flags & ZIO_FLAG_IO_ALLOCATING) {
 			ASSERT(pio->io_priority == ZIO_PRIORITY_ASYNC_WRITE);
@@ -2347,13 +2477,19 @@ zio_write_gang_block(zio_t *pio)
 			 * stage.
 			 */
 			metaslab_class_throttle_unreserve(mc,
-			    gbh_copies - copies, pio);
+			    gbh_copies - copies, pio->io_allocator, pio);
 		}
 
+		ZIO_GANG_STAT_BUMP(zgs_gang_failed_count);
 		pio->io_error = error;
 		return (ZIO_PIPELINE_CONTINUE);
 	}
 
+	ZIO_GANG_STAT_BUMP(zgs_gang_count);
+	ZIO_GANG_STAT_INCR(zgs_gang_bytes, pio->io_size);
+	if (pio != gio)
+		ZIO_GANG_STAT_BUMP(zgs_gang_nested_count);
+
 	if (pio == gio) {
 		gnpp = &gio->io_gang_tree;
 	} else {
@@ -2385,12 +2521,14 @@ zio_write_gang_block(zio_t *pio)
 
 		zp.zp_checksum = gio->io_prop.zp_checksum;
 		zp.zp_compress = ZIO_COMPRESS_OFF;
+		zp.zp_complevel = 0;
 		zp.zp_type = DMU_OT_NONE;
 		zp.zp_level = 0;
 		zp.zp_copies = gio->io_prop.zp_copies;
 		zp.zp_dedup = B_FALSE;
 		zp.zp_dedup_verify = B_FALSE;
 		zp.zp_nopwrite = B_FALSE;
+		zp.zp_special = B_FALSE;
 
 		cio = zio_write(zio, spa, txg, &gbh->zg_blkptr[g],
 		    abd_get_offset(pio->io_abd, pio->io_size - resid), lsize,
@@ -2405,10 +2543,11 @@ zio_write_gang_block(zio_t *pio)
 			/*
 			 * Gang children won't throttle but we should
 			 * account for their work, so reserve an allocation
-			 * slot for them here.
+			 * slot for them here, from the same allocator.
 			 */
+			cio->io_allocator = pio->io_allocator;
 			VERIFY(metaslab_class_throttle_reserve(mc,
-			    zp.zp_copies, cio, flags));
+			    zp.zp_copies, cio->io_allocator, cio, flags));
 		}
 		zio_nowait(cio);
 	}
@@ -2927,14 +3066,34 @@ zio_ddt_free(zio_t *zio)
  * ==========================================================================
  */
 
+/*
+ * Pick the allocator a write uses.  Spreading writes over the allocators
+ * lets them allocate in parallel, but logically adjacent blocks should
+ * still land next to each other for the sake of sequential reads; so the
+ * hash is of the objset, object and level, and of the block id in 2^20
+ * block regions.
+ */
+static int
+zio_allocator(spa_t *spa, const zbookmark_phys_t *zb)
+{
+	const uint64_t mul = 0x9e3779b97f4a7c15ULL;
+	uint64_t h = zb->zb_objset;
+
+	h = (h ^ zb->zb_object) * mul;
+	h = (h ^ zb->zb_level) * mul;
+	h = (h ^ (zb->zb_blkid >> 20)) * mul;
+
+	return ((h >> 32) % spa->spa_alloc_count);
+}
+
 static zio_t *
-zio_io_to_allocate(spa_t *spa)
+zio_io_to_allocate(spa_t *spa, int allocator)
 {
 	zio_t *zio;
 
-	ASSERT(MUTEX_HELD(&spa->spa_alloc_lock));
+	ASSERT(MUTEX_HELD(&spa->spa_alloc_locks[allocator]));
 
-	zio = avl_first(&spa->spa_alloc_tree);
+	zio = avl_first(&spa->spa_alloc_trees[allocator]);
 	if (zio == NULL)
 		return (NULL);
 
@@ -2944,12 +3103,13 @@ zio_io_to_allocate(spa_t *spa)
 	 * Try to place a reservation for this zio. If we're unable to
 	 * reserve then we throttle.
 	 */
+	ASSERT3U(zio->io_allocator, ==, allocator);
 	if (!metaslab_class_throttle_reserve(spa_normal_class(spa),
-	    zio->io_prop.zp_copies, zio, 0)) {
+	    zio->io_prop.zp_copies, allocator, zio, 0)) {
 		return (NULL);
 	}
 
-	avl_remove(&spa->spa_alloc_tree, zio);
+	avl_remove(&spa->spa_alloc_trees[allocator], zio);
 	ASSERT3U(zio->io_stage, <, ZIO_STAGE_DVA_ALLOCATE);
 
 	return (zio);
@@ -2961,6 +3121,13 @@ zio_dva_throttle(zio_t *zio)
 	spa_t *spa = zio->io_spa;
 	zio_t *nio;
 
+	/*
+	 * Gang children use the allocator of the gang header's parent,
+	 * which is set when they are created.
+	 */
+	if (zio->io_child_type != ZIO_CHILD_GANG)
+		zio->io_allocator = zio_allocator(spa, &zio->io_bookmark);
+
 	if (zio->io_priority == ZIO_PRIORITY_SYNC_WRITE ||
 	    !spa_normal_class(zio->io_spa)->mc_alloc_throttle_enabled ||
 	    zio->io_child_type == ZIO_CHILD_GANG ||
@@ -2973,13 +3140,13 @@ zio_dva_throttle(zio_t *zio)
 	ASSERT3U(zio->io_queued_timestamp, >, 0);
 	ASSERT(zio->io_stage == ZIO_STAGE_DVA_THROTTLE);
 
-	mutex_enter(&spa->spa_alloc_lock);
+	mutex_enter(&spa->spa_alloc_locks[zio->io_allocator]);
 
 	ASSERT(zio->io_type == ZIO_TYPE_WRITE);
-	avl_add(&spa->spa_alloc_tree, zio);
+	avl_add(&spa->spa_alloc_trees[zio->io_allocator], zio);
 
-	nio = zio_io_to_allocate(zio->io_spa);
-	mutex_exit(&spa->spa_alloc_lock);
+	nio = zio_io_to_allocate(zio->io_spa, zio->io_allocator);
+	mutex_exit(&spa->spa_alloc_locks[zio->io_allocator]);
 
 	if (nio == zio)
 		return (ZIO_PIPELINE_CONTINUE);
@@ -3000,13 +3167,13 @@ zio_dva_throttle(zio_t *zio)
 }
 
 void
-zio_allocate_dispatch(spa_t *spa)
+zio_allocate_dispatch(spa_t *spa, int allocator)
 {
 	zio_t *zio;
 
-	mutex_enter(&spa->spa_alloc_lock);
-	zio = zio_io_to_allocate(spa);
-	mutex_exit(&spa->spa_alloc_lock);
+	mutex_enter(&spa->spa_alloc_locks[allocator]);
+	zio = zio_io_to_allocate(spa, allocator);
+	mutex_exit(&spa->spa_alloc_locks[allocator]);
 	if (zio == NULL)
 		return;
 
@@ -3043,9 +3210,24 @@ zio_dva_allocate(zio_t *zio)
 	if (zio->io_priority == ZIO_PRIORITY_ASYNC_WRITE)
 		flags |= METASLAB_ASYNC_ALLOC;
 
+	/*
+	 * Try the special class first for blocks which belong there, and
+	 * fall back to the normal class when it is full.
+	 */
+	mc = spa_preferred_class(spa, zio->io_size, zio->io_prop.zp_type,
+	    zio->io_prop.zp_level, zio->io_prop.zp_special);
+	if (mc != spa_normal_class(spa)) {
+		error = metaslab_alloc(spa, mc, zio->io_size, bp,
+		    zio->io_prop.zp_copies, zio->io_txg, NULL, flags,
+		    &zio->io_alloc_list, zio, zio->io_allocator);
+		if (error == 0)
+			return (ZIO_PIPELINE_CONTINUE);
+		mc = spa_normal_class(spa);
+	}
+
 	error = metaslab_alloc(spa, mc, zio->io_size, bp,
 	    zio->io_prop.zp_copies, zio->io_txg, NULL, flags,
-	    &zio->io_alloc_list, zio);
+	    &zio->io_alloc_list, zio, zio->io_allocator);
 
 	if (error != 0) {
 		spa_dbgmsg(spa, "%s: metaslab allocation failure: zio %p, "
@@ -3107,23 +3289,32 @@ zio_dva_unallocate(zio_t *zio, zio_gang_node_t *gn, blkptr_t *bp)
  * Try to allocate an intent log block.  Return 0 on success, errno on failure.
  */
 int
-zio_alloc_zil(spa_t *spa, uint64_t txg, blkptr_t *new_bp, uint64_t size,
-    boolean_t *slog)
+zio_alloc_zil(spa_t *spa, uint64_t objset, uint64_t txg, blkptr_t *new_bp,
+    uint64_t size, boolean_t *slog)
 {
 	int error = 1;
 	zio_alloc_list_t io_alloc_list;
+	zbookmark_phys_t zb;
+	int allocator;
 
 	ASSERT(txg > spa_syncing_txg(spa));
 
+	/*
+	 * All of a dataset's log blocks come from the same allocator, so
+	 * that the logs of different datasets are written in parallel.
+	 */
+	SET_BOOKMARK(&zb, objset, ZB_ZIL_OBJECT, ZB_ZIL_LEVEL, 0);
+	allocator = zio_allocator(spa, &zb);
+
 	metaslab_trace_init(&io_alloc_list);
 	error = metaslab_alloc(spa, spa_log_class(spa), size, new_bp, 1,
-	    txg, NULL, METASLAB_FASTWRITE, &io_alloc_list, NULL);
+	    txg, NULL, METASLAB_FASTWRITE, &io_alloc_list, NULL, allocator);
 	if (error == 0) {
 		*slog = TRUE;
 	} else {
 		error = metaslab_alloc(spa, spa_normal_class(spa), size,
 		    new_bp, 1, txg, NULL, METASLAB_FASTWRITE,
-		    &io_alloc_list, NULL);
+		    &io_alloc_list, NULL, allocator);
 		if (error == 0)
 			*slog = FALSE;
 	}
@@ -3275,7 +3466,8 @@ zio_vdev_io_start(zio_t *zio)
 	}
 
 	if (vd->vdev_ops->vdev_op_leaf &&
-	    (zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE)) {
+	    (zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE ||
+	    ZIO_IS_TRIM(zio))) {
 
 		if (zio->io_type == ZIO_TYPE_READ && vdev_cache_read(zio))
 			return (ZIO_PIPELINE_CONTINUE);
@@ -3310,7 +3502,8 @@ zio_vdev_io_done(zio_t *zio)
 		return (ZIO_PIPELINE_STOP);
 	}
 
-	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
+	ASSERT(zio->io_type == ZIO_TYPE_READ ||
+	    zio->io_type == ZIO_TYPE_WRITE || ZIO_IS_TRIM(zio));
 
 	if (zio->io_delay)
 		zio->io_delay = gethrtime() - zio->io_delay;
@@ -3329,7 +3522,8 @@ zio_vdev_io_done(zio_t *zio)
 		if (zio_injection_enabled && zio->io_error == 0)
 			zio->io_error = zio_handle_label_injection(zio, EIO);
 
-		if (zio->io_error) {
+		/* A failed trim does not say anything about the device */
+		if (zio->io_error && !ZIO_IS_TRIM(zio)) {
 			if (!vdev_accessible(vd, zio)) {
 				zio->io_error = SET_ERROR(ENXIO);
 			} else {
@@ -3437,6 +3631,9 @@ zio_vdev_io_assess(zio_t *zio)
 	    zio->io_type == ZIO_TYPE_IOCTL &&
 	    zio->io_cmd == DKIOCFLUSHWRITECACHE && vd != NULL)
 		vd->vdev_nowritecache = B_TRUE;
+	if ((zio->io_error == ENOTSUP || zio->io_error == ENOTTY) &&
+	    ZIO_IS_TRIM(zio) && vd != NULL)
+		vd->vdev_notrim = B_TRUE;
 
 	if (zio->io_error)
 		zio->io_pipeline = ZIO_INTERLOCK_PIPELINE;
@@ -3509,7 +3706,26 @@ zio_checksum_generate(zio_t *zio)
 		}
 	}
 
-	zio_checksum_compute(zio, checksum, zio->io_abd, zio->io_size);
+	if (bp != NULL && checksum == zio->io_fused_checksum) {
+		bp->blk_cksum = zio->io_fused_cksum;
+	} else {
+		zio_checksum_compute(zio, checksum, zio->io_abd, zio->io_size);
+	}
+	zio->io_fused_checksum = ZIO_CHECKSUM_INHERIT;
+
+	/*
+	 * A dedup write looks up its entry as soon as it reaches the DDT
+	 * stage, and blocks on the read of the ZAP leaf if the entry isn't
+	 * in core.  Rather than wait, start the read now and go to the back
+	 * of the issue queue; the other writes of the txg get compressed and
+	 * checksummed, and issue their own reads, in the meantime.
+	 */
+	if (zfs_dedup_write_prefetch && bp != NULL &&
+	    (zio->io_pipeline & ZIO_STAGE_DDT_WRITE) && BP_GET_DEDUP(bp) &&
+	    ddt_prefetch_entry(ddt_select(zio->io_spa, bp), bp)) {
+		zio_taskq_dispatch(zio, ZIO_TASKQ_ISSUE, B_FALSE);
+		return (ZIO_PIPELINE_STOP);
+	}
 
 	return (ZIO_PIPELINE_CONTINUE);
 }
@@ -3623,8 +3839,8 @@ zio_ready(zio_t *zio)
 			 */
 			metaslab_class_throttle_unreserve(
 			    spa_normal_class(zio->io_spa),
-			    zio->io_prop.zp_copies, zio);
-			zio_allocate_dispatch(zio->io_spa);
+			    zio->io_prop.zp_copies, zio->io_allocator, zio);
+			zio_allocate_dispatch(zio->io_spa, zio->io_allocator);
 		}
 	}
 
@@ -3708,18 +3924,19 @@ zio_dva_throttle_done(zio_t *zio)
 	ASSERT0(zio->io_flags & ZIO_FLAG_NOPWRITE);
 
 	mutex_enter(&pio->io_lock);
-	metaslab_group_alloc_decrement(zio->io_spa, vd->vdev_id, pio, flags);
+	metaslab_group_alloc_decrement(zio->io_spa, vd->vdev_id, pio, flags,
+	    pio->io_allocator, B_TRUE);
 	mutex_exit(&pio->io_lock);
 
 	metaslab_class_throttle_unreserve(spa_normal_class(zio->io_spa),
-	    1, pio);
+	    1, pio->io_allocator, pio);
 
 	/*
 	 * Call into the pipeline to see if there is more work that
 	 * needs to be done. If there is work to be done it will be
 	 * dispatched to another taskq thread.
 	 */
-	zio_allocate_dispatch(zio->io_spa);
+	zio_allocate_dispatch(zio->io_spa, pio->io_allocator);
 }
 
 static int
@@ -3763,9 +3980,10 @@ zio_done(zio_t *zio)
 		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
 		ASSERT(zio->io_priority == ZIO_PRIORITY_ASYNC_WRITE);
 		ASSERT(zio->io_bp != NULL);
-		metaslab_group_alloc_verify(zio->io_spa, zio->io_bp, zio);
-		VERIFY(refcount_not_held(
-		    &(spa_normal_class(zio->io_spa)->mc_alloc_slots), zio));
+		metaslab_group_alloc_verify(zio->io_spa, zio->io_bp, zio,
+		    zio->io_allocator);
+		VERIFY(refcount_not_held(&(spa_normal_class(zio->io_spa)->
+		    mc_allocator[zio->io_allocator].mca_alloc_slots), zio));
 	}
 
 
@@ -3991,7 +4209,7 @@ zio_done(zio_t *zio)
 			spa_taskq_dispatch_ent(zio->io_spa,
 			    ZIO_TYPE_CLAIM, ZIO_TASKQ_ISSUE,
 			    (task_func_t *)zio_reexecute, zio, 0,
-			    &zio->io_tqent);
+			    &zio->io_tqent, zio->io_taskq_hint);
 		}
 		return (ZIO_PIPELINE_STOP);
 	}
@@ -4234,4 +4452,8 @@ MODULE_PARM_DESC(zfs_sync_pass_rewrite,
 module_param(zio_dva_throttle_enabled, int, 0644);
 MODULE_PARM_DESC(zio_dva_throttle_enabled,
 	"Throttle block allocations in the ZIO pipeline");
+
+module_param(zfs_dedup_write_prefetch, int, 0644);
+MODULE_PARM_DESC(zfs_dedup_write_prefetch,
+	"Prefetch DDT entries of dedup writes ahead of the DDT stage");
 #endif
@@ -195,6 +195,10 @@ zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS] = {
 	    abd_checksum_edonr_tmpl_init, abd_checksum_edonr_tmpl_free,
 	    ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_SALTED |
 	    ZCHECKSUM_FLAG_NOPWRITE, "edonr"},
+	{{abd_checksum_blake3_native,	abd_checksum_blake3_byteswap},
+	    abd_checksum_blake3_tmpl_init, abd_checksum_blake3_tmpl_free,
+	    ZCHECKSUM_FLAG_METADATA | ZCHECKSUM_FLAG_DEDUP |
+	    ZCHECKSUM_FLAG_SALTED | ZCHECKSUM_FLAG_NOPWRITE, "blake3"},
 };
 
 /*
@@ -213,6 +217,8 @@ zio_checksum_to_feature(enum zio_checksum cksum)
 		return (SPA_FEATURE_SKEIN);
 	case ZIO_CHECKSUM_EDONR:
 		return (SPA_FEATURE_EDONR);
+	case ZIO_CHECKSUM_BLAKE3:
+		return (SPA_FEATURE_BLAKE3);
 	default:
 		return (SPA_FEATURE_NONE);
 	}
@@ -375,6 +381,31 @@ zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
 	}
 }
 
+/*
+ * Compute the checksum zio_checksum_compute() would store in the block
+ * pointer ahead of time, saving it in the zio for zio_checksum_generate()
+ * to use.  Embedded checksums are stored in the data itself and can't be
+ * computed early, so they are left alone.
+ */
+void
+zio_checksum_compute_fused(zio_t *zio, enum zio_checksum checksum,
+    abd_t *abd, uint64_t size)
+{
+	zio_checksum_info_t *ci = &zio_checksum_table[checksum];
+	spa_t *spa = zio->io_spa;
+
+	ASSERT((uint_t)checksum < ZIO_CHECKSUM_FUNCTIONS);
+	ASSERT(ci->ci_func[0] != NULL);
+
+	if (ci->ci_flags & ZCHECKSUM_FLAG_EMBEDDED)
+		return;
+
+	zio_checksum_template_init(checksum, spa);
+	ci->ci_func[0](abd, size, spa->spa_cksum_tmpls[checksum],
+	    &zio->io_fused_cksum);
+	zio->io_fused_checksum = checksum;
+}
+
 int
 zio_checksum_error_impl(spa_t *spa, const blkptr_t *bp,
     enum zio_checksum checksum, abd_t *abd, uint64_t size, uint64_t offset,
@@ -38,6 +38,26 @@
 #include <sys/zio.h>
 #include <sys/zio_compress.h>
 
+/*
+ * Blocks of at least this many bytes are probed before a full compression
+ * pass: lz4 is run over a few small samples spread across the block, and
+ * if none of them shrinks by the usual 12.5% the block is written
+ * uncompressed.  Encrypted or already compressed data then costs a
+ * fraction of a pass instead of a whole one.  0 disables probing.
+ */
+unsigned long zfs_compress_probe_min = 32 * 1024;
+
+#define	ZIO_COMPRESS_PROBE_SIZE		2048
+#define	ZIO_COMPRESS_PROBE_SAMPLES	3
+
+/*
+ * Registered compression accelerators, tried in order.  Slots are claimed
+ * with a compare-and-swap and read without a lock, so providers can come
+ * and go independently of zio_init() and zio_fini().
+ */
+static const zio_compress_accel_t
+	*volatile zio_compress_accel[ZIO_COMPRESS_ACCEL_MAX];
+
 /*
  * Compression vectors.
  */
@@ -57,7 +77,13 @@ zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
 	{"gzip-8",		8,	gzip_compress,	gzip_decompress},
 	{"gzip-9",		9,	gzip_compress,	gzip_decompress},
 	{"zle",			64,	zle_compress,	zle_decompress},
-	{"lz4",			0,	lz4_compress_zfs, lz4_decompress_zfs}
+	{"lz4",			0,	lz4_compress_zfs, lz4_decompress_zfs},
+#if defined(HAVE_ZSTD) && !defined(_KERNEL)
+	{"zstd",		ZIO_ZSTD_LEVEL_DEFAULT,
+	    zstd_compress_zfs,	zstd_decompress_zfs}
+#else
+	{"zstd",		ZIO_ZSTD_LEVEL_DEFAULT,	NULL,	NULL}
+#endif
 };
 
 enum zio_compress
@@ -74,6 +100,14 @@ zio_compress_select(spa_t *spa, enum zio_compress child,
 	if (result == ZIO_COMPRESS_INHERIT)
 		result = parent;
 
+	/*
+	 * A dataset may carry zstd from a build that had it (e.g. a pool
+	 * moved between hosts); write with the default algorithm instead.
+	 */
+	if (result == ZIO_COMPRESS_ZSTD &&
+	    zio_compress_table[ZIO_COMPRESS_ZSTD].ci_compress == NULL)
+		result = ZIO_COMPRESS_ON;
+
 	if (result == ZIO_COMPRESS_ON) {
 		if (spa_feature_is_active(spa, SPA_FEATURE_LZ4_COMPRESS))
 			result = ZIO_COMPRESS_LZ4_ON_VALUE;
@@ -84,22 +118,146 @@ zio_compress_select(spa_t *spa, enum zio_compress child,
 	return (result);
 }
 
+/*
+ * Return B_TRUE if len bytes at buf, a multiple of 8, are all zero.  Most
+ * data that isn't zero shows it in the first word.  Past that the words
+ * are tested eight at a time, OR-ed together without branches, a loop the
+ * compiler turns into vector code.
+ */
+boolean_t
+zio_buf_is_zero(const void *buf, size_t len)
+{
+	const uint64_t *word = buf;
+	const uint64_t *end = (const uint64_t *)((const char *)buf + len);
+
+	ASSERT0(P2PHASE(len, sizeof (uint64_t)));
+
+	if (len == 0)
+		return (B_TRUE);
+	if (*word != 0)
+		return (B_FALSE);
+
+	while (end - word >= 8) {
+		if ((word[0] | word[1] | word[2] | word[3] |
+		    word[4] | word[5] | word[6] | word[7]) != 0)
+			return (B_FALSE);
+		word += 8;
+	}
+	for (; word < end; word++) {
+		if (*word != 0)
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
 /*ARGSUSED*/
 static int
 zio_compress_zeroed_cb(void *data, size_t len, void *private)
 {
-	uint64_t *end = (uint64_t *)((char *)data + len);
-	uint64_t *word;
+	return (zio_buf_is_zero(data, len) ? 0 : 1);
+}
 
-	for (word = data; word < end; word++)
-		if (*word != 0)
-			return (1);
+int
+zio_compress_accel_register(const zio_compress_accel_t *zca)
+{
+	int i;
+
+	for (i = 0; i < ZIO_COMPRESS_ACCEL_MAX; i++) {
+		if (atomic_cas_ptr(&zio_compress_accel[i], NULL,
+		    (void *)zca) == NULL)
+			return (0);
+	}
+
+	return (SET_ERROR(ENOSPC));
+}
+
+void
+zio_compress_accel_unregister(const zio_compress_accel_t *zca)
+{
+	int i;
 
-	return (0);
+	for (i = 0; i < ZIO_COMPRESS_ACCEL_MAX; i++) {
+		if (zio_compress_accel[i] == zca)
+			zio_compress_accel[i] = NULL;
+	}
 }
 
+/*
+ * Offer a request for algorithm c to the accelerators.  Returns B_TRUE if
+ * one of them did the work.
+ */
+static boolean_t
+zio_compress_accel_compress(enum zio_compress c, int level, void *src,
+    void *dst, size_t s_len, size_t d_len, size_t *c_len)
+{
+	int i;
+
+	for (i = 0; i < ZIO_COMPRESS_ACCEL_MAX; i++) {
+		const zio_compress_accel_t *zca = zio_compress_accel[i];
+
+		if (zca != NULL && (zca->zca_algs & (1ULL << c)) &&
+		    zca->zca_usable(c, s_len) &&
+		    zca->zca_compress(c, level, src, dst, s_len, d_len,
+		    c_len) == 0)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+static boolean_t
+zio_compress_accel_decompress(enum zio_compress c, int level, void *src,
+    void *dst, size_t s_len, size_t d_len)
+{
+	int i;
+
+	for (i = 0; i < ZIO_COMPRESS_ACCEL_MAX; i++) {
+		const zio_compress_accel_t *zca = zio_compress_accel[i];
+
+		if (zca != NULL && (zca->zca_algs & (1ULL << c)) &&
+		    zca->zca_usable(c, d_len) &&
+		    zca->zca_decompress(c, level, src, dst, s_len,
+		    d_len) == 0)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Return B_FALSE if none of the samples of buf compresses.  The caller's
+ * destination may be smaller than a sample, so the probe has its own.
+ */
+static boolean_t
+zio_compress_probe(void *buf, size_t s_len)
+{
+	size_t d_len = ZIO_COMPRESS_PROBE_SIZE - (ZIO_COMPRESS_PROBE_SIZE >> 3);
+	void *dst = zio_buf_alloc(ZIO_COMPRESS_PROBE_SIZE);
+	boolean_t compressible = B_FALSE;
+	int i;
+
+	for (i = 0; i < ZIO_COMPRESS_PROBE_SAMPLES && !compressible; i++) {
+		size_t off = (s_len - ZIO_COMPRESS_PROBE_SIZE) * i /
+		    (ZIO_COMPRESS_PROBE_SAMPLES - 1);
+
+		if (lz4_compress_zfs((char *)buf + off, dst,
+		    ZIO_COMPRESS_PROBE_SIZE, d_len, 0) <= d_len)
+			compressible = B_TRUE;
+	}
+	zio_buf_free(dst, ZIO_COMPRESS_PROBE_SIZE);
+
+	return (compressible);
+}
+
+/*
+ * Compress s_len bytes of src into dst.  A level of 0 uses the level in
+ * the algorithm's table entry, anything else is handed to the algorithm
+ * as is (only zstd consults it).
+ */
 size_t
-zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
+zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len,
+    int level)
 {
 	size_t c_len, d_len;
 	zio_compress_info_t *ci = &zio_compress_table[c];
@@ -120,10 +278,19 @@ zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
 
 	/* Compress at least 12.5% */
 	d_len = s_len - (s_len >> 3);
+	if (level == 0)
+		level = ci->ci_level;
 
 	/* No compression algorithms can read from ABDs directly */
 	tmp = abd_borrow_buf_copy(src, s_len);
-	c_len = ci->ci_compress(tmp, dst, s_len, d_len, ci->ci_level);
+	if (zfs_compress_probe_min != 0 && s_len >= zfs_compress_probe_min &&
+	    s_len >= ZIO_COMPRESS_PROBE_SIZE &&
+	    !zio_compress_probe(tmp, s_len)) {
+		c_len = s_len;
+	} else if (!zio_compress_accel_compress(c, level, tmp, dst, s_len,
+	    d_len, &c_len)) {
+		c_len = ci->ci_compress(tmp, dst, s_len, d_len, level);
+	}
 	abd_return_buf(src, tmp, s_len);
 
 	if (c_len > d_len)
@@ -141,6 +308,10 @@ zio_decompress_data_buf(enum zio_compress c, void *src, void *dst,
 	if ((uint_t)c >= ZIO_COMPRESS_FUNCTIONS || ci->ci_decompress == NULL)
 		return (SET_ERROR(EINVAL));
 
+	if (zio_compress_accel_decompress(c, ci->ci_level, src, dst,
+	    s_len, d_len))
+		return (0);
+
 	return (ci->ci_decompress(src, dst, s_len, d_len, ci->ci_level));
 }
 
@@ -154,3 +325,13 @@ zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
 
 	return (ret);
 }
+
+#if defined(_KERNEL) && defined(HAVE_SPL)
+EXPORT_SYMBOL(zio_compress_accel_register);
+EXPORT_SYMBOL(zio_compress_accel_unregister);
+
+/* CSTYLED */
+module_param(zfs_compress_probe_min, ulong, 0644);
+MODULE_PARM_DESC(zfs_compress_probe_min,
+	"Min block size to probe for compressibility, 0 to disable");
+#endif
@@ -61,6 +61,7 @@ typedef struct inject_handler {
 	zinject_record_t	zi_record;
 	uint64_t		*zi_lanes;
 	int			zi_next_lane;
+	hrtime_t		zi_pipe_idle;
 	list_node_t		zi_link;
 } inject_handler_t;
 
@@ -424,16 +425,105 @@ spa_handle_ignored_writes(spa_t *spa)
 	rw_exit(&inject_lock);
 }
 
+/*
+ * Cap on the doubling of the long tail latency, see zio_inject_latency().
+ */
+#define	ZI_TAIL_MAX_SHIFT	10
+
+/*
+ * Latency of one IO for the given delay record.  Floating point isn't
+ * available here, so a normal deviate is built as the sum of 12 uniform
+ * ones, and the long tail is Pareto-like: the extra latency doubles each
+ * time its probability halves, up to 2^ZI_TAIL_MAX_SHIFT times zi_jitter.
+ */
+static hrtime_t
+zio_inject_latency(const zinject_record_t *record)
+{
+	int64_t latency = record->zi_timer;
+	int64_t sum = 0;
+	int i;
+
+	switch (record->zi_delay_dist) {
+	case ZINJECT_DELAY_NORMAL:
+		for (i = 0; i < 12; i++)
+			sum += spa_get_random(1 << 16);
+		latency += (int64_t)record->zi_jitter *
+		    (sum - 6 * (1 << 16)) / (1 << 16);
+		break;
+	case ZINJECT_DELAY_TAIL:
+		for (i = 0; i < ZI_TAIL_MAX_SHIFT && spa_get_random(2) == 0;
+		    i++)
+			;
+		latency += record->zi_jitter * ((1ULL << i) - 1);
+		break;
+	default:
+		break;
+	}
+
+	return (MAX(latency, 0));
+}
+
+/*
+ * The device is stalled for the first zi_stall_time of every
+ * zi_stall_period; an IO that would complete during a stall completes
+ * when the stall ends.
+ */
+static hrtime_t
+zio_inject_stall(const zinject_record_t *record, hrtime_t target)
+{
+	hrtime_t phase;
+
+	if (record->zi_stall_period == 0)
+		return (target);
+
+	phase = target % record->zi_stall_period;
+	if (phase < record->zi_stall_time)
+		target += record->zi_stall_time - phase;
+
+	return (target);
+}
+
+/*
+ * The lane of the handler that becomes idle the soonest.  With a fixed
+ * latency and no shaping the lanes are used round robin, so that is
+ * always the next one; otherwise they have to be scanned.
+ */
+static int
+zio_inject_lane(const inject_handler_t *handler)
+{
+	const zinject_record_t *record = &handler->zi_record;
+	int lane = handler->zi_next_lane;
+	int i;
+
+	if (record->zi_delay_dist == ZINJECT_DELAY_FIXED &&
+	    record->zi_bandwidth == 0 && record->zi_stall_period == 0)
+		return (lane);
+
+	for (i = 0; i < record->zi_nlanes; i++) {
+		if (handler->zi_lanes[i] < handler->zi_lanes[lane])
+			lane = i;
+	}
+
+	return (lane);
+}
+
 hrtime_t
 zio_handle_io_delay(zio_t *zio)
 {
 	vdev_t *vd = zio->io_vd;
 	inject_handler_t *min_handler = NULL;
 	hrtime_t min_target = 0;
+	hrtime_t min_pipe = 0;
+	int min_lane = 0;
 	inject_handler_t *handler;
+	zinject_record_t *record;
+	hrtime_t now;
+	hrtime_t latency;
 	hrtime_t idle;
 	hrtime_t busy;
+	hrtime_t pipe;
 	hrtime_t target;
+	int lane;
 
 	rw_enter(&inject_lock, RW_READER);
 
@@ -485,16 +575,19 @@ zio_handle_io_delay(zio_t *zio)
 	 * multiple requests simultaneously, which shouldn't be possible.
 	 */
 	mutex_enter(&inject_delay_mtx);
+	now = gethrtime();
 
 	for (handler = list_head(&inject_handlers);
 	    handler != NULL; handler = list_next(&inject_handlers, handler)) {
-		if (handler->zi_record.zi_cmd != ZINJECT_DELAY_IO)
+		record = &handler->zi_record;
+
+		if (record->zi_cmd != ZINJECT_DELAY_IO)
 			continue;
 
-		if (!freq_triggered(handler->zi_record.zi_freq))
+		if (!freq_triggered(record->zi_freq))
 			continue;
 
-		if (vd->vdev_guid != handler->zi_record.zi_guid)
+		if (vd->vdev_guid != record->zi_guid)
 			continue;
 
 		/*
@@ -518,34 +611,47 @@ zio_handle_io_delay(zio_t *zio)
 		 * specific handler can complete the IO with all other
 		 * handlers, to find the lowest value of all possible
 		 * lanes. We then use this lane to submit the request.
-		 *
-		 * Since each handler has a constant value for its
-		 * delay, we can just use the "next" lane for that
-		 * handler; as it will always be the lane with the
-		 * lowest value for that particular handler (i.e. the
-		 * lane that will become idle the soonest). This saves a
-		 * scan of each handler's lanes array.
+		 * zio_inject_lane() picks the candidate lane of this
+		 * handler.
 		 *
 		 * There's two cases to consider when determining when
 		 * this specific IO request should complete. If this
 		 * lane is idle, we want to "submit" the request now so
-		 * it will complete after zi_timer milliseconds. Thus,
-		 * we set the target to now + zi_timer.
+		 * it will complete after its latency. Thus, we set the
+		 * target to now + latency.
 		 *
 		 * If the lane is busy, we want this request to complete
-		 * zi_timer milliseconds after the lane becomes idle.
-		 * Since the 'zi_lanes' array holds the time at which
-		 * each lane will become idle, we use that value to
-		 * determine when this request should complete.
+		 * its latency after the lane becomes idle. Since the
+		 * 'zi_lanes' array holds the time at which each lane
+		 * will become idle, we use that value to determine when
+		 * this request should complete.
+		 *
+		 * A bandwidth cap is a single pipe shared by all lanes
+		 * of the handler: the request also can't complete
+		 * before its transfer through the pipe, which starts
+		 * once the previous transfer is done.  Finally, a
+		 * target falling into a periodic stall is pushed to
+		 * the end of the stall.
 		 */
-		idle = handler->zi_record.zi_timer + gethrtime();
-		busy = handler->zi_record.zi_timer +
-		    handler->zi_lanes[handler->zi_next_lane];
+		lane = zio_inject_lane(handler);
+		latency = zio_inject_latency(record);
+		idle = latency + now;
+		busy = latency + handler->zi_lanes[lane];
 		target = MAX(idle, busy);
 
+		pipe = 0;
+		if (record->zi_bandwidth != 0) {
+			pipe = MAX(now, handler->zi_pipe_idle) +
+			    zio->io_size * NANOSEC / record->zi_bandwidth;
+			target = MAX(target, pipe);
+		}
+		target = zio_inject_stall(record, target);
+
 		if (min_handler == NULL) {
 			min_handler = handler;
 			min_target = target;
+			min_pipe = pipe;
+			min_lane = lane;
 			continue;
 		}
 
@@ -564,6 +670,8 @@ zio_handle_io_delay(zio_t *zio)
 		if (target < min_target) {
 			min_handler = handler;
 			min_target = target;
+			min_pipe = pipe;
+			min_lane = lane;
 		}
 	}
 
@@ -574,14 +682,16 @@ zio_handle_io_delay(zio_t *zio)
 	 */
 	if (min_handler != NULL) {
 		ASSERT3U(min_target, !=, 0);
-		min_handler->zi_lanes[min_handler->zi_next_lane] = min_target;
+		min_handler->zi_lanes[min_lane] = min_target;
+		if (min_pipe != 0)
+			min_handler->zi_pipe_idle = min_pipe;
 
 		/*
 		 * If we've used all possible lanes for this handler,
 		 * loop back and start using the first lane again;
 		 * otherwise, just increment the lane index.
 		 */
-		min_handler->zi_next_lane = (min_handler->zi_next_lane + 1) %
+		min_handler->zi_next_lane = (min_lane + 1) %
 		    min_handler->zi_record.zi_nlanes;
 	}
 
@@ -614,10 +724,16 @@ zio_inject_fault(char *name, int flags, int *id, zinject_record_t *record)
 
 	if (record->zi_cmd == ZINJECT_DELAY_IO) {
 		/*
-		 * A value of zero for the number of lanes or for the
-		 * delay time doesn't make sense.
+		 * A value of zero for the number of lanes doesn't make
+		 * sense, nor does a handler that neither delays, caps
+		 * the bandwidth nor stalls.
 		 */
-		if (record->zi_timer == 0 || record->zi_nlanes == 0)
+		if (record->zi_nlanes == 0 || (record->zi_timer == 0 &&
+		    record->zi_bandwidth == 0 && record->zi_stall_period == 0))
+			return (SET_ERROR(EINVAL));
+
+		if (record->zi_delay_dist > ZINJECT_DELAY_TAIL ||
+		    record->zi_stall_time >= MAX(record->zi_stall_period, 1))
 			return (SET_ERROR(EINVAL));
 
 		/*
@@ -653,6 +769,7 @@ zio_inject_fault(char *name, int flags, int *id, zinject_record_t *record)
 			handler->zi_lanes = NULL;
 			handler->zi_next_lane = 0;
 		}
+		handler->zi_pipe_idle = 0;
 
 		rw_enter(&inject_lock, RW_WRITER);
 
@@ -275,9 +275,23 @@ zpl_xattr_get_dir(struct inode *ip, const char *name, void *value,
 {
 	struct inode *dxip = NULL;
 	struct inode *xip = NULL;
+	znode_t *zp = ITOZ(ip);
+	uint64_t xattr_obj;
 	loff_t pos = 0;
 	int error;
 
+	/*
+	 * Most files have no xattr directory, and with xattr=sa every
+	 * lookup of a name that is not in the SA ends up here.  Answer
+	 * those from the SA without going through zfs_lookup().
+	 */
+	if (!(zp->z_pflags & ZFS_XATTR) && zp->z_sa_hdl != NULL) {
+		error = sa_lookup(zp->z_sa_hdl, SA_ZPL_XATTR(ZTOZSB(zp)),
+		    &xattr_obj, sizeof (xattr_obj));
+		if (error == ENOENT || (error == 0 && xattr_obj == 0))
+			return (-ENOENT);
+	}
+
 	/* Lookup the xattr directory */
 	error = -zfs_lookup(ip, NULL, &dxip, LOOKUP_XATTR, cr, NULL, NULL);
 	if (error)
@@ -0,0 +1,349 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * zstd compression, backed by the system libzstd in user space.
+ *
+ * Each compressed block starts with a small header holding the length of
+ * the zstd frame, since the block is padded out to the allocation size
+ * and zstd will not decode trailing zeroes, and the level it was written
+ * with, kept for diagnostics.  Both are big-endian.
+ *
+ * Compression contexts are expensive to set up (a level 19 context is
+ * several megabytes), so they are kept in one slot per CPU and reused.
+ * A caller takes the slot of the CPU it runs on, or the next free one;
+ * if every slot is busy it builds a private context for the one block.
+ * Decompression contexts are kept the same way.
+ *
+ * Large blocks can be split into chunks of zfs_zstd_chunk_size bytes that
+ * are compressed in parallel on the z_zstd taskq, each into a frame of its
+ * own.  zstd decodes concatenated frames as one stream, so such blocks
+ * need no special handling on read, and older readers decode them too.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio.h>
+#include <sys/zio_compress.h>
+
+/*
+ * Blocks of more than one chunk are compressed in parallel chunks of this
+ * many bytes; 0 compresses every block as a single frame.
+ */
+unsigned long zfs_zstd_chunk_size = 0;
+
+#if defined(HAVE_ZSTD) && !defined(_KERNEL)
+
+#include <zstd.h>
+
+typedef struct zstd_header {
+	uint32_t	zh_c_len;	/* length of the zstd frames */
+	uint32_t	zh_level;	/* level, as in the property value */
+} zstd_header_t;
+
+typedef struct zstd_slot {
+	kmutex_t	zs_lock;
+	void		*zs_ctx;	/* ZSTD_CCtx or ZSTD_DCtx */
+} zstd_slot_t;
+
+typedef struct zstd_chunk {
+	void		*zc_src;
+	void		*zc_dst;
+	size_t		zc_s_len;
+	size_t		zc_d_len;	/* capacity, then frame length */
+	int		zc_level;
+} zstd_chunk_t;
+
+static zstd_slot_t *zstd_cctx_slots;
+static zstd_slot_t *zstd_dctx_slots;
+static uint_t zstd_nslots;
+static taskq_t *zstd_taskq;
+
+/*
+ * Take a free slot, starting with the current CPU's, or return NULL if
+ * they are all in use.
+ */
+static zstd_slot_t *
+zstd_slot_enter(zstd_slot_t *slots)
+{
+	uint_t start = CPU_SEQID % zstd_nslots;
+	uint_t i;
+
+	for (i = 0; i < zstd_nslots; i++) {
+		zstd_slot_t *zs = &slots[(start + i) % zstd_nslots];
+
+		if (mutex_tryenter(&zs->zs_lock))
+			return (zs);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Translate a property level into a libzstd one: fast levels become
+ * negative, out of range levels fall back to the default.
+ */
+static int
+zstd_level_to_zstd(int level)
+{
+	if (level >= ZIO_ZSTD_LEVEL_FAST)
+		return (-MIN(level - ZIO_ZSTD_LEVEL_FAST,
+		    ZIO_ZSTD_LEVEL_FAST_MAX));
+	if (level < 1 || level > ZIO_ZSTD_LEVEL_MAX)
+		return (ZIO_ZSTD_LEVEL_DEFAULT);
+	return (level);
+}
+
+/*
+ * Compress one frame, returning its length or a zstd error code.
+ */
+static size_t
+zstd_compress_frame(void *src, void *dst, size_t s_len, size_t d_len,
+    int zlevel)
+{
+	zstd_slot_t *zs;
+	ZSTD_CCtx *cctx;
+	size_t c_len;
+
+	zs = zstd_slot_enter(zstd_cctx_slots);
+	if (zs != NULL) {
+		if (zs->zs_ctx == NULL)
+			zs->zs_ctx = ZSTD_createCCtx();
+		cctx = zs->zs_ctx;
+	} else {
+		cctx = ZSTD_createCCtx();
+	}
+
+	if (cctx == NULL) {
+		c_len = (size_t)-1;
+	} else {
+		c_len = ZSTD_compressCCtx(cctx, dst, d_len, src, s_len,
+		    zlevel);
+	}
+
+	if (zs != NULL)
+		mutex_exit(&zs->zs_lock);
+	else if (cctx != NULL)
+		ZSTD_freeCCtx(cctx);
+
+	return (c_len);
+}
+
+static void
+zstd_compress_chunk(void *arg)
+{
+	zstd_chunk_t *zc = arg;
+
+	zc->zc_d_len = zstd_compress_frame(zc->zc_src, zc->zc_dst,
+	    zc->zc_s_len, zc->zc_d_len, zc->zc_level);
+}
+
+/*
+ * Compress s_len bytes as frames of chunk bytes each, in parallel, and
+ * concatenate them into dst.  Each chunk gets a buffer large enough for
+ * the worst case, so one incompressible chunk does not fail the block.
+ */
+static size_t
+zstd_compress_chunks(void *src, void *dst, size_t s_len, size_t d_len,
+    int zlevel, size_t chunk)
+{
+	uint_t nchunks = (s_len + chunk - 1) / chunk;
+	size_t bufsize = P2ROUNDUP(ZSTD_compressBound(chunk),
+	    SPA_MINBLOCKSIZE);
+	zstd_chunk_t *zcs;
+	taskqid_t *tqids;
+	size_t c_len = 0;
+	uint_t i;
+
+	zcs = kmem_zalloc(sizeof (*zcs) * nchunks, KM_SLEEP);
+	tqids = kmem_zalloc(sizeof (*tqids) * nchunks, KM_SLEEP);
+
+	for (i = 0; i < nchunks; i++) {
+		zstd_chunk_t *zc = &zcs[i];
+
+		zc->zc_src = (char *)src + i * chunk;
+		zc->zc_dst = zio_buf_alloc(bufsize);
+		zc->zc_s_len = MIN(chunk, s_len - i * chunk);
+		zc->zc_d_len = bufsize;
+		zc->zc_level = zlevel;
+
+		/*
+		 * If the dispatch fails, compress this chunk from the
+		 * calling thread below instead.
+		 */
+		if (i > 0) {
+			tqids[i] = taskq_dispatch(zstd_taskq,
+			    zstd_compress_chunk, zc, TQ_NOSLEEP);
+		}
+	}
+
+	for (i = 0; i < nchunks; i++) {
+		if (tqids[i] == TASKQID_INVALID)
+			zstd_compress_chunk(&zcs[i]);
+	}
+
+	for (i = 0; i < nchunks; i++) {
+		zstd_chunk_t *zc = &zcs[i];
+
+		if (tqids[i] != TASKQID_INVALID)
+			taskq_wait_id(zstd_taskq, tqids[i]);
+
+		if (ZSTD_isError(zc->zc_d_len) || c_len == (size_t)-1 ||
+		    c_len + zc->zc_d_len > d_len) {
+			c_len = (size_t)-1;
+		} else {
+			bcopy(zc->zc_dst, (char *)dst + c_len, zc->zc_d_len);
+			c_len += zc->zc_d_len;
+		}
+		zio_buf_free(zc->zc_dst, bufsize);
+	}
+
+	kmem_free(tqids, sizeof (*tqids) * nchunks);
+	kmem_free(zcs, sizeof (*zcs) * nchunks);
+
+	return (c_len);
+}
+
+size_t
+zstd_compress_zfs(void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int level)
+{
+	zstd_header_t *hdr = d_start;
+	size_t chunk = zfs_zstd_chunk_size;
+	void *dst = (char *)d_start + sizeof (*hdr);
+	size_t c_len;
+
+	if (d_len <= sizeof (*hdr))
+		return (s_len);
+
+	if (chunk >= SPA_MINBLOCKSIZE && s_len > chunk && zstd_taskq != NULL) {
+		c_len = zstd_compress_chunks(s_start, dst, s_len,
+		    d_len - sizeof (*hdr), zstd_level_to_zstd(level), chunk);
+	} else {
+		c_len = zstd_compress_frame(s_start, dst, s_len,
+		    d_len - sizeof (*hdr), zstd_level_to_zstd(level));
+	}
+
+	/* Too large for d_len or an error: store the block uncompressed. */
+	if (ZSTD_isError(c_len))
+		return (s_len);
+
+	hdr->zh_c_len = BE_32((uint32_t)c_len);
+	hdr->zh_level = BE_32((uint32_t)level);
+
+	return (c_len + sizeof (*hdr));
+}
+
+/*ARGSUSED*/
+int
+zstd_decompress_zfs(void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int level)
+{
+	const zstd_header_t *hdr = s_start;
+	uint32_t c_len = BE_32(hdr->zh_c_len);
+	zstd_slot_t *zs;
+	ZSTD_DCtx *dctx;
+	size_t ret = 0;
+
+	/* invalid compressed buffer size encoded at start */
+	if (s_len < sizeof (*hdr) || c_len > s_len - sizeof (*hdr))
+		return (1);
+
+	zs = zstd_slot_enter(zstd_dctx_slots);
+	if (zs != NULL) {
+		if (zs->zs_ctx == NULL)
+			zs->zs_ctx = ZSTD_createDCtx();
+		dctx = zs->zs_ctx;
+	} else {
+		dctx = ZSTD_createDCtx();
+	}
+
+	if (dctx != NULL) {
+		ret = ZSTD_decompressDCtx(dctx, d_start, d_len,
+		    (const char *)s_start + sizeof (*hdr), c_len);
+	}
+
+	if (zs != NULL)
+		mutex_exit(&zs->zs_lock);
+	else if (dctx != NULL)
+		ZSTD_freeDCtx(dctx);
+
+	return (dctx == NULL || ZSTD_isError(ret));
+}
+
+void
+zstd_init(void)
+{
+	uint_t i;
+
+	zstd_nslots = boot_ncpus;
+	zstd_cctx_slots = kmem_zalloc(zstd_nslots * sizeof (zstd_slot_t),
+	    KM_SLEEP);
+	zstd_dctx_slots = kmem_zalloc(zstd_nslots * sizeof (zstd_slot_t),
+	    KM_SLEEP);
+	for (i = 0; i < zstd_nslots; i++) {
+		mutex_init(&zstd_cctx_slots[i].zs_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
+		mutex_init(&zstd_dctx_slots[i].zs_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
+	}
+
+	zstd_taskq = taskq_create("z_zstd", boot_ncpus, minclsyspri,
+	    boot_ncpus, INT_MAX, TASKQ_PREPOPULATE | TASKQ_DYNAMIC);
+}
+
+void
+zstd_fini(void)
+{
+	uint_t i;
+
+	if (zstd_cctx_slots == NULL)
+		return;
+
+	taskq_destroy(zstd_taskq);
+	zstd_taskq = NULL;
+
+	for (i = 0; i < zstd_nslots; i++) {
+		if (zstd_cctx_slots[i].zs_ctx != NULL)
+			ZSTD_freeCCtx(zstd_cctx_slots[i].zs_ctx);
+		if (zstd_dctx_slots[i].zs_ctx != NULL)
+			ZSTD_freeDCtx(zstd_dctx_slots[i].zs_ctx);
+		mutex_destroy(&zstd_cctx_slots[i].zs_lock);
+		mutex_destroy(&zstd_dctx_slots[i].zs_lock);
+	}
+	kmem_free(zstd_cctx_slots, zstd_nslots * sizeof (zstd_slot_t));
+	kmem_free(zstd_dctx_slots, zstd_nslots * sizeof (zstd_slot_t));
+	zstd_cctx_slots = NULL;
+	zstd_dctx_slots = NULL;
+}
+
+#else /* HAVE_ZSTD && !_KERNEL */
+
+void
+zstd_init(void)
+{
+}
+
+void
+zstd_fini(void)
+{
+}
+
+#endif /* HAVE_ZSTD && !_KERNEL */
@@ -84,6 +84,7 @@
 #include <sys/zil_impl.h>
 #include <sys/dmu_tx.h>
 #include <sys/zio.h>
+#include <sys/zio_compress.h>
 #include <sys/zfs_rlock.h>
 #include <sys/zfs_znode.h>
 #include <sys/spa_impl.h>
@@ -103,6 +104,7 @@ unsigned int zvol_inhibit_dev = 0;
 unsigned int zvol_major = ZVOL_MAJOR;
 unsigned int zvol_threads = 32;
 unsigned int zvol_request_sync = 0;
+unsigned int zvol_direct_read_max_blocks = 4;
 unsigned int zvol_prefetch_bytes = (128 * 1024);
 unsigned long zvol_max_discard_blocks = 16384;
 unsigned int zvol_volmode = ZFS_VOLMODE_GEOM;
@@ -330,41 +332,249 @@ zvol_create_cb(objset_t *os, void *arg, cred_t *cr, dmu_tx_t *tx)
 
 #ifdef  _UZFS
 
-static const char *
-status_to_str(zvol_info_t *zv)
+/*
+ * The dbuf statistics of the objset of a volume, NULL if it isn't open.
+ */
+static objset_dbuf_stats_t *
+zinfo_dbuf_stats(zvol_info_t *zv)
+{
+	objset_t *os = zv->main_zv->zv_objset;
+
+	return (os != NULL ? &os->os_dbuf_stats : NULL);
+}
+
+static zvol_stats_status_t
+zinfo_status(zvol_info_t *zv)
 {
 	zvol_rebuild_status_t rebuild_status;
 	if (zv->mgmt_conn == NULL)
-		return ("Offline");
+		return (ZVOL_STATS_OFFLINE);
 	if ((zv->is_io_receiver_created == 0) ||
 	    (zv->is_io_ack_sender_created == 0))
-		return ("Offline");
+		return (ZVOL_STATS_OFFLINE);
 	if (ZINFO_IS_HEALTHY(zv))
-		return ("Healthy");
+		return (ZVOL_STATS_HEALTHY);
 	rebuild_status = zv->main_zv->rebuild_info.zv_rebuild_status;
 	if ((rebuild_status != ZVOL_REBUILDING_INIT) &&
 	    (rebuild_status != ZVOL_REBUILDING_DONE))
+		return (ZVOL_STATS_REBUILDING);
+	return (ZVOL_STATS_DEGRADED);
+}
+
+static const char *
+status_to_str(zvol_info_t *zv)
+{
+	switch (zinfo_status(zv)) {
+	case ZVOL_STATS_HEALTHY:
+		return ("Healthy");
+	case ZVOL_STATS_REBUILDING:
 		return ("Rebuilding");
-	return ("Degraded");
+	case ZVOL_STATS_DEGRADED:
+		return ("Degraded");
+	default:
+		return ("Offline");
+	}
+}
+
+/*
+ * ZFS_IOC_LIST_SNAP is polled for every volume by the control plane, and
+ * building a list walks the snapshots under dp_config_rwlock.  The lists
+ * are cached by volume name until a snapshot is created, destroyed or
+ * renamed anywhere (dsl_dataset_snapshot_gen moves on), or for at most
+ * zvol_snap_list_cache_secs, which bounds how stale the space stats in
+ * them get.  0 disables the cache.
+ */
+typedef struct zvol_snap_list_entry {
+	char		zsl_name[ZFS_MAX_DATASET_NAME_LEN];
+	hrtime_t	zsl_time;
+	nvlist_t	*zsl_nvl;
+	avl_node_t	zsl_node;
+} zvol_snap_list_entry_t;
+
+int zvol_snap_list_cache_secs = 60;
+
+static kmutex_t zvol_snap_list_lock;
+static avl_tree_t zvol_snap_list_cache;
+static uint64_t zvol_snap_list_gen;
+
+static int
+zvol_snap_list_compare(const void *x1, const void *x2)
+{
+	const zvol_snap_list_entry_t *zsl1 = x1;
+	const zvol_snap_list_entry_t *zsl2 = x2;
+
+	return (AVL_ISIGN(strcmp(zsl1->zsl_name, zsl2->zsl_name)));
+}
+
+static void
+zvol_snap_list_entry_free(zvol_snap_list_entry_t *zsl)
+{
+	fnvlist_free(zsl->zsl_nvl);
+	kmem_free(zsl, sizeof (zvol_snap_list_entry_t));
+}
+
+static void
+zvol_snap_list_cache_clear(void)
+{
+	zvol_snap_list_entry_t *zsl;
+	void *cookie = NULL;
+
+	ASSERT(MUTEX_HELD(&zvol_snap_list_lock));
+	while ((zsl = avl_destroy_nodes(&zvol_snap_list_cache, &cookie)) !=
+	    NULL)
+		zvol_snap_list_entry_free(zsl);
+}
+
+void
+zvol_snap_list_cache_init(void)
+{
+	mutex_init(&zvol_snap_list_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&zvol_snap_list_cache, zvol_snap_list_compare,
+	    sizeof (zvol_snap_list_entry_t),
+	    offsetof(zvol_snap_list_entry_t, zsl_node));
+}
+
+void
+zvol_snap_list_cache_fini(void)
+{
+	mutex_enter(&zvol_snap_list_lock);
+	zvol_snap_list_cache_clear();
+	mutex_exit(&zvol_snap_list_lock);
+	avl_destroy(&zvol_snap_list_cache);
+	mutex_destroy(&zvol_snap_list_lock);
+}
+
+/*
+ * Add the cached list of name to nvl.  Returns ENOENT if there is none,
+ * or it is out of date.
+ */
+static int
+zvol_snap_list_cache_lookup(const char *name, nvlist_t *nvl)
+{
+	zvol_snap_list_entry_t search, *zsl;
+	int error = SET_ERROR(ENOENT);
+
+	if (zvol_snap_list_cache_secs == 0)
+		return (error);
+
+	(void) strlcpy(search.zsl_name, name, sizeof (search.zsl_name));
+
+	mutex_enter(&zvol_snap_list_lock);
+	if (zvol_snap_list_gen != dsl_dataset_snapshot_gen) {
+		zvol_snap_list_cache_clear();
+		zvol_snap_list_gen = dsl_dataset_snapshot_gen;
+	}
+	zsl = avl_find(&zvol_snap_list_cache, &search, NULL);
+	if (zsl != NULL && gethrtime() - zsl->zsl_time >
+	    SEC2NSEC(zvol_snap_list_cache_secs)) {
+		avl_remove(&zvol_snap_list_cache, zsl);
+		zvol_snap_list_entry_free(zsl);
+		zsl = NULL;
+	}
+	if (zsl != NULL) {
+		fnvlist_merge(nvl, zsl->zsl_nvl);
+		error = 0;
+	}
+	mutex_exit(&zvol_snap_list_lock);
+
+	return (error);
+}
+
+/*
+ * Cache the list of name built while the snapshots were at generation gen.
+ * A list which might have missed a change since is not cached.
+ */
+static void
+zvol_snap_list_cache_insert(const char *name, nvlist_t *nvl, uint64_t gen)
+{
+	zvol_snap_list_entry_t *zsl, *old;
+	avl_index_t where;
+
+	if (zvol_snap_list_cache_secs == 0)
+		return;
+
+	zsl = kmem_zalloc(sizeof (zvol_snap_list_entry_t), KM_SLEEP);
+	(void) strlcpy(zsl->zsl_name, name, sizeof (zsl->zsl_name));
+	zsl->zsl_time = gethrtime();
+	zsl->zsl_nvl = fnvlist_dup(nvl);
+
+	mutex_enter(&zvol_snap_list_lock);
+	if (gen != zvol_snap_list_gen || gen != dsl_dataset_snapshot_gen) {
+		mutex_exit(&zvol_snap_list_lock);
+		zvol_snap_list_entry_free(zsl);
+		return;
+	}
+	old = avl_find(&zvol_snap_list_cache, zsl, &where);
+	if (old != NULL) {
+		avl_remove(&zvol_snap_list_cache, old);
+		zvol_snap_list_entry_free(old);
+		(void) avl_find(&zvol_snap_list_cache, zsl, &where);
+	}
+	avl_insert(&zvol_snap_list_cache, zsl, where);
+	mutex_exit(&zvol_snap_list_lock);
 }
 
 int
 uzfs_ioc_list_snap(zfs_cmd_t *zc, nvlist_t *nvl)
 {
 	zvol_info_t *zinfo;
+	uint64_t gen;
 	int error;
 
 	zinfo = uzfs_zinfo_lookup(zc->zc_name);
 	if (zinfo == NULL)
 		return (ENOENT);
 
+	if (zvol_snap_list_cache_lookup(zc->zc_name, nvl) == 0) {
+		uzfs_zinfo_drop_refcnt(zinfo);
+		return (0);
+	}
+
+	gen = dsl_dataset_snapshot_gen;
 	error = uzfs_zvol_add_nvl_snapshot_list(zinfo, nvl);
+	if (error == 0)
+		zvol_snap_list_cache_insert(zc->zc_name, nvl, gen);
 
 	uzfs_zinfo_drop_refcnt(zinfo);
 
 	return (error);
 }
 
+static const char *zfs_lat_op_names[ZFS_LAT_OPS] = {
+	"read", "write", "sync", "rebuildStep"
+};
+
+static const char *zfs_lat_stage_names[ZFS_LAT_STAGES] = {
+	"netRecv", "txWait", "zilCommit", "ackSend"
+};
+
+/*
+ * Add nvlist with latency histograms and percentiles of all opcodes and
+ * stages which have seen IOs.
+ */
+static void
+uzfs_lat_histogram_to_nvl(zfs_lat_histogram_t hist[][ZFS_LAT_STAGES],
+    nvlist_t *nvl)
+{
+	int op, stage;
+
+	nvlist_t *lnvl = fnvlist_alloc();
+
+	for (op = 0; op < ZFS_LAT_OPS; op++) {
+		nvlist_t *onvl = fnvlist_alloc();
+
+		for (stage = 0; stage < ZFS_LAT_STAGES; stage++) {
+			zfs_lat_histogram_to_nvl(onvl,
+			    zfs_lat_stage_names[stage], &hist[op][stage]);
+		}
+		if (!nvlist_empty(onvl))
+			fnvlist_add_nvlist(lnvl, zfs_lat_op_names[op], onvl);
+		fnvlist_free(onvl);
+	}
+	fnvlist_add_nvlist(nvl, "latency", lnvl);
+	fnvlist_free(lnvl);
+}
+
 int
 uzfs_ioc_stats(zfs_cmd_t *zc, nvlist_t *nvl)
 {
@@ -444,6 +654,20 @@ uzfs_ioc_stats(zfs_cmd_t *zc, nvlist_t *nvl)
 			fnvlist_add_uint64(innvl, "dispatchedIOCnt",
 			    zv->dispatched_io_cnt);
 
+			objset_dbuf_stats_t *ods = zinfo_dbuf_stats(zv);
+			if (ods != NULL) {
+				fnvlist_add_uint64(innvl, "dbufCachedBytes",
+				    ods->ods_cached_bytes);
+				fnvlist_add_uint64(innvl, "dbufHits",
+				    ods->ods_hits);
+				fnvlist_add_uint64(innvl, "dbufArcHits",
+				    ods->ods_arc_hits);
+				fnvlist_add_uint64(innvl, "dbufMisses",
+				    ods->ods_misses);
+				fnvlist_add_uint64(innvl, "dbufPrefetchHits",
+				    ods->ods_prefetch_hits);
+			}
+
 			nvlist_t *rnvl = fnvlist_alloc();
 
 			for (i = 0; i <= len; i++) {
@@ -477,6 +701,11 @@ uzfs_ioc_stats(zfs_cmd_t *zc, nvlist_t *nvl)
 			fnvlist_add_nvlist(innvl, "wuio", wnvl);
 			fnvlist_free(wnvl);
 
+			uzfs_lat_histogram_to_nvl(zv->uzfs_lat_histogram,
+			    innvl);
+			zfs_size_lat_histogram_to_nvl(innvl, "sizeLatency",
+			    zv->uzfs_size_lat_histogram);
+
 			fnvlist_add_nvlist(nvl, zv->name, innvl);
 			fnvlist_free(innvl);
 
@@ -522,6 +751,7 @@ uzfs_ioc_stats(zfs_cmd_t *zc, nvlist_t *nvl)
 				}
 			}
 			fnvlist_add_nvlist(pnvl, "wzio", innvl);
+			spa_zio_stage_histogram_to_nvl(spa, pnvl);
 			fnvlist_add_nvlist(tnvl, spa->spa_name, pnvl);
 			fnvlist_free(innvl);
 			fnvlist_free(pnvl);
@@ -536,6 +766,103 @@ uzfs_ioc_stats(zfs_cmd_t *zc, nvlist_t *nvl)
 	}
 	return (0);
 }
+
+static void
+zinfo_to_stats_rec(zvol_info_t *zv, zvol_stats_rec_t *zsr)
+{
+	objset_dbuf_stats_t *ods = zinfo_dbuf_stats(zv);
+
+	bzero(zsr, sizeof (*zsr));
+	(void) strlcpy(zsr->zsr_name, zv->name, sizeof (zsr->zsr_name));
+	zsr->zsr_status = zinfo_status(zv);
+	zsr->zsr_readonly = IS_ZVOL_READONLY(zv->main_zv) ? 1 : 0;
+	zsr->zsr_rebuild_status =
+	    zv->main_zv->rebuild_info.zv_rebuild_status;
+	zsr->zsr_io_ack_sender_created = zv->is_io_ack_sender_created ? 1 : 0;
+	zsr->zsr_io_receiver_created = zv->is_io_receiver_created ? 1 : 0;
+	zsr->zsr_running_ionum = zv->running_ionum;
+	zsr->zsr_checkpointed_ionum = zv->checkpointed_ionum;
+	zsr->zsr_degraded_checkpointed_ionum = zv->degraded_checkpointed_ionum;
+	zsr->zsr_checkpointed_time = zv->checkpointed_time;
+	zsr->zsr_zvol_workers = zv->main_zv->zvol_workers;
+	zsr->zsr_quorum = uzfs_zinfo_get_quorum(zv);
+	zsr->zsr_rebuild_bytes = zv->main_zv->rebuild_info.rebuild_bytes;
+	zsr->zsr_rebuild_cnt = zv->main_zv->rebuild_info.rebuild_cnt;
+	zsr->zsr_rebuild_done_cnt = zv->main_zv->rebuild_info.rebuild_done_cnt;
+	zsr->zsr_rebuild_failed_cnt =
+	    zv->main_zv->rebuild_info.rebuild_failed_cnt;
+	zsr->zsr_read_count = zv->read_req_ack_cnt;
+	zsr->zsr_read_latency = zv->read_latency;
+	zsr->zsr_read_bytes = zv->read_byte;
+	zsr->zsr_write_count = zv->write_req_ack_cnt;
+	zsr->zsr_write_latency = zv->write_latency;
+	zsr->zsr_write_bytes = zv->write_byte;
+	zsr->zsr_sync_count = zv->sync_req_ack_cnt;
+	zsr->zsr_sync_latency = zv->sync_latency;
+	zsr->zsr_inflight_io_cnt = zv->inflight_io_cnt;
+	zsr->zsr_dispatched_io_cnt = zv->dispatched_io_cnt;
+	if (ods != NULL) {
+		zsr->zsr_dbuf_cached_bytes = ods->ods_cached_bytes;
+		zsr->zsr_dbuf_hits = ods->ods_hits;
+		zsr->zsr_dbuf_arc_hits = ods->ods_arc_hits;
+		zsr->zsr_dbuf_misses = ods->ods_misses;
+		zsr->zsr_dbuf_prefetch_hits = ods->ods_prefetch_hits;
+	}
+}
+
+/*
+ * ZFS_IOC_STATS_BINARY: the counters of uzfs_ioc_stats() without the
+ * histograms, as fixed-layout records written straight into the caller's
+ * buffer.  Exporters that poll every volume of a node every few seconds
+ * then pay for no nvlist building, packing and unpacking, nor string keys.
+ * An empty zc_name returns all volumes.  If the buffer is too small,
+ * ENOMEM is returned with zc_nvlist_dst_size set to the size needed.  The
+ * reply is not an nvlist: only lzc_stats_binary() issues this ioctl.
+ */
+int
+uzfs_ioc_stats_binary(zfs_cmd_t *zc)
+{
+	zvol_stats_hdr_t *zsh;
+	zvol_stats_rec_t *zsr;
+	zvol_info_t *zv = NULL;
+	uint64_t nrecs = 0;
+	uint64_t size;
+
+	zsh = (zvol_stats_hdr_t *)(uintptr_t)zc->zc_nvlist_dst;
+	zsr = (zvol_stats_rec_t *)(zsh + 1);
+
+	(void) mutex_enter(&zvol_list_mutex);
+	SLIST_FOREACH(zv, &zvol_list, zinfo_next) {
+		if (zc->zc_name[0] != '\0' &&
+		    uzfs_zvol_name_compare(zv, zc->zc_name) != 0)
+			continue;
+
+		size = sizeof (*zsh) + (nrecs + 1) * sizeof (*zsr);
+		if (size <= zc->zc_nvlist_dst_size)
+			zinfo_to_stats_rec(zv, &zsr[nrecs]);
+		nrecs++;
+
+		if (zc->zc_name[0] != '\0')
+			break;
+	}
+	(void) mutex_exit(&zvol_list_mutex);
+
+	size = sizeof (*zsh) + nrecs * sizeof (*zsr);
+	if (size > zc->zc_nvlist_dst_size) {
+		zc->zc_nvlist_dst_size = size;
+		return (SET_ERROR(ENOMEM));
+	}
+
+	zsh->zsh_magic = ZVOL_STATS_MAGIC;
+	zsh->zsh_version = ZVOL_STATS_VERSION;
+	zsh->zsh_reclen = sizeof (*zsr);
+	zsh->zsh_nrecs = nrecs;
+	zsh->zsh_time = gethrtime();
+	zc->zc_nvlist_dst_size = size;
+	zc->zc_nvlist_dst_filled = B_TRUE;
+
+	return (0);
+}
 #endif
 
 /*
@@ -606,14 +933,23 @@ zvol_check_volsize(uint64_t volsize, uint64_t blocksize)
 }
 
 /*
- * Ensure the zap is flushed then inform the VFS of the capacity change.
+ * Update the size in the zap.  Growing a volume needs nothing more: a
+ * write beyond the old size is in the same txg as the new size or in a
+ * later one, so it never reaches the disk before the size does, and
+ * ZVOL_META_OBJ is sparse, its blocks past the old size are created by
+ * the first write of their io_num.  IO can thus go on while a volume
+ * grows.  Shrinking waits for the new size to be on disk before freeing
+ * the data past it.
  */
 int
 zvol_update_volsize(uint64_t volsize, objset_t *os)
 {
 	dmu_tx_t *tx;
 	int error;
-	uint64_t txg;
+	uint64_t txg, oldsize;
+
+	if (zap_lookup(os, ZVOL_ZAP_OBJ, "size", 8, 1, &oldsize) != 0)
+		oldsize = UINT64_MAX;
 
 	tx = dmu_tx_create(os);
 	dmu_tx_hold_zap(tx, ZVOL_ZAP_OBJ, TRUE, NULL);
@@ -629,6 +965,9 @@ zvol_update_volsize(uint64_t volsize, objset_t *os)
 	    &volsize, tx);
 	dmu_tx_commit(tx);
 
+	if (error == 0 && volsize >= oldsize)
+		return (0);
+
 	txg_wait_synced(dmu_objset_pool(os), txg);
 
 	if (error == 0)
@@ -818,265 +1157,1346 @@ zvol_set_volblocksize(const char *name, uint64_t volblocksize)
 	mutex_exit(&zv->zv_state_lock);
 	rw_exit(&zv->zv_suspend_lock);
 
-	return (SET_ERROR(error));
+	return (SET_ERROR(error));
+}
+#endif
+
+/*
+ * Replay a TX_TRUNCATE ZIL transaction if asked.  TX_TRUNCATE is how we
+ * implement DKIOCFREE/free-long-range.
+ */
+static int
+zvol_replay_truncate(zvol_state_t *zv, lr_truncate_t *lr, boolean_t byteswap)
+{
+	uint64_t offset, length;
+
+	if (byteswap)
+		byteswap_uint64_array(lr, sizeof (*lr));
+
+	offset = lr->lr_offset;
+	length = lr->lr_length;
+
+	return (dmu_free_long_range(zv->zv_objset, ZVOL_OBJ, offset, length));
+}
+
+#if !defined(_KERNEL)
+/*
+ * Finds m_offset, m_length in metadata for data at offset, len
+ * blocksize is granularity at which metadata is maintained
+ * metablocksize is metadata's blocksize
+ * metadatasize is the size of metadata of one block 'blocksize'
+ */
+void
+get_metaobj_block_details(metaobj_blk_offset_t *m, uint64_t blocksize,
+    uint64_t metablocksize, uint64_t metadatasize, uint64_t offset,
+    uint64_t len)
+{
+	uint64_t s_offset, e_offset;
+
+	s_offset = (offset / blocksize) * metadatasize;
+	e_offset = ((offset + len - 1) / blocksize) * metadatasize;
+
+	m->r_offset = P2ALIGN_TYPED(s_offset, metablocksize, uint64_t);
+	m->r_len = P2ALIGN_TYPED(e_offset, metablocksize, uint64_t) -
+	    m->r_offset + metablocksize;
+	m->m_offset = s_offset;
+	m->m_len = (e_offset - s_offset + metadatasize);
+}
+
+void
+get_zv_metaobj_block_details(metaobj_blk_offset_t *m, zvol_state_t *zv,
+    uint64_t offset, uint64_t len)
+{
+	uint64_t blocksize = zv->zv_metavolblocksize;
+	uint64_t metablocksize = zv->zv_volmetablocksize;
+	uint64_t metadatasize = zv->zv_volmetadatasize;
+
+	get_metaobj_block_details(m, blocksize, metablocksize,
+	    metadatasize, offset, len);
+}
+
+uint64_t
+get_metadata_len(zvol_state_t *zv, uint64_t offset, uint64_t len)
+{
+	uint64_t blocksize = zv->zv_metavolblocksize;
+	uint64_t metadatasize = zv->zv_volmetadatasize;
+	uint64_t m_th_entry, n_th_entry;
+
+	m_th_entry = (offset / blocksize);
+	n_th_entry = ((offset + len - 1) / blocksize);
+
+	return ((n_th_entry - m_th_entry + 1) * metadatasize);
+}
+
+/*
+ * Record one io_num for the data range offset, len in ZVOL_META_OBJ.  The
+ * range is a single run of identical entries, so rather than expanding it
+ * into a buffer as long as all its metadata, one metadata block worth of
+ * entries is built and written once per metadata block the run spans.
+ * Metadata blocks covered by the run are thus fully overwritten, without
+ * reading their old contents.  The caller must hold the metadata range in
+ * tx.
+ */
+void
+zvol_write_metadata_run(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    blk_metadata_t *metadata, dmu_tx_t *tx)
+{
+	uint64_t metablocksize = zv->zv_volmetablocksize;
+	uint64_t metadatasize = zv->zv_volmetadatasize;
+	metaobj_blk_offset_t metablk;
+	uint64_t moff, mend, bufsize, n;
+	char *mdata, *tmdata;
+
+	get_zv_metaobj_block_details(&metablk, zv, offset, len);
+	moff = metablk.m_offset;
+	mend = metablk.m_offset + metablk.m_len;
+
+	bufsize = MIN(metablk.m_len, metablocksize);
+	mdata = kmem_alloc(bufsize, KM_SLEEP);
+	for (tmdata = mdata; tmdata < mdata + bufsize; tmdata += metadatasize)
+		memcpy(tmdata, metadata, metadatasize);
+
+	while (moff < mend) {
+		n = MIN(mend - moff, metablocksize - P2PHASE(moff,
+		    metablocksize));
+		dmu_write(zv->zv_objset, ZVOL_META_OBJ, moff, n, mdata, tx);
+		moff += n;
+	}
+	kmem_free(mdata, bufsize);
+}
+
+#endif
+
+/*
+ * Replay a TX_WRITE ZIL transaction that didn't get committed
+ * after a system failure
+ */
+static int
+zvol_replay_write(zvol_state_t *zv, lr_write_t *lr, boolean_t byteswap)
+{
+	objset_t *os = zv->zv_objset;
+	char *data = (char *)(lr + 1);  /* data follows lr_write_t */
+	uint64_t offset, length;
+	dmu_tx_t *tx;
+	int error;
+#if !defined(_KERNEL)
+	blk_metadata_t *metadata = NULL;
+	metaobj_blk_offset_t metablk;
+#endif
+	if (byteswap)
+		byteswap_uint64_array(lr, sizeof (*lr));
+
+	offset = lr->lr_offset;
+	length = lr->lr_length;
+#if !defined(_KERNEL)
+	metadata = &(lr->lr_metadata);
+#endif
+	/* If it's a dmu_sync() block, write the whole block */
+	if (lr->lr_common.lrc_reclen == sizeof (lr_write_t)) {
+		uint64_t blocksize = BP_GET_LSIZE(&lr->lr_blkptr);
+		if (length < blocksize) {
+			offset -= offset % blocksize;
+			length = blocksize;
+		}
+	}
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, ZVOL_OBJ, offset, length);
+
+#if !defined(_KERNEL)
+	if (lr->lr_version == VERSION_1) {
+		get_zv_metaobj_block_details(&metablk, zv, offset, length);
+		dmu_tx_hold_write(tx, ZVOL_META_OBJ, metablk.m_offset,
+		    metablk.m_len);
+	}
+#endif
+
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+	} else {
+		dmu_write(os, ZVOL_OBJ, offset, length, data, tx);
+#if !defined(_KERNEL)
+		if (lr->lr_version == VERSION_1)
+			zvol_write_metadata_run(zv, offset, length, metadata,
+			    tx);
+#endif
+		(void) zil_replaying(dmu_objset_zil(os), tx);
+		dmu_tx_commit(tx);
+	}
+
+	return (error);
+}
+
+static int
+zvol_replay_err(zvol_state_t *zv, lr_t *lr, boolean_t byteswap)
+{
+	return (SET_ERROR(ENOTSUP));
+}
+
+/*
+ * Tell zil_replay_parallel() which part of the volume a TX_WRITE or
+ * TX_TRUNCATE record changes, widened like zvol_replay_write() widens
+ * dmu_sync() blocks.  In userspace a versioned write also sets the io_num
+ * of every metadata entry it touches, so its range is rounded out to
+ * whole zv_metavolblocksize units: writes sharing an entry must still be
+ * replayed in log order for the last io_num to win.
+ */
+static int
+zvol_replay_range(zvol_state_t *zv, const lr_t *lrc, uint64_t *objp,
+    uint64_t *offsetp, uint64_t *lengthp)
+{
+	/* lr_truncate_t starts with the same fields as lr_write_t */
+	const lr_write_t *lr = (const lr_write_t *)lrc;
+	uint64_t txtype = lrc->lrc_txtype & ~TX_CI;
+	uint64_t offset, length;
+
+	if (txtype != TX_WRITE && txtype != TX_TRUNCATE)
+		return (SET_ERROR(ENOTSUP));
+
+	offset = lr->lr_offset;
+	length = lr->lr_length;
+	if (txtype == TX_WRITE && lrc->lrc_reclen == sizeof (lr_write_t)) {
+		uint64_t blocksize = BP_GET_LSIZE(&lr->lr_blkptr);
+		if (length < blocksize) {
+			offset -= offset % blocksize;
+			length = blocksize;
+		}
+	}
+#if !defined(_KERNEL)
+	if (txtype == TX_WRITE && lr->lr_version == VERSION_1 &&
+	    zv->zv_metavolblocksize != 0) {
+		uint64_t blocksize = zv->zv_metavolblocksize;
+		uint64_t end = (offset + length + blocksize - 1) /
+		    blocksize * blocksize;
+
+		offset -= offset % blocksize;
+		length = end - offset;
+	}
+#endif
+
+	*objp = ZVOL_OBJ;
+	*offsetp = offset;
+	*lengthp = length;
+	return (0);
+}
+
+/*
+ * Callback vectors for replaying records.
+ * Only TX_WRITE and TX_TRUNCATE are needed for zvol.
+ */
+zil_replay_func_t zvol_replay_vector[TX_MAX_TYPE] = {
+	(zil_replay_func_t)zvol_replay_err,	/* no such transaction type */
+	(zil_replay_func_t)zvol_replay_err,	/* TX_CREATE */
+	(zil_replay_func_t)zvol_replay_err,	/* TX_MKDIR */
+	(zil_replay_func_t)zvol_replay_err,	/* TX_MKXATTR */
+	(zil_replay_func_t)zvol_replay_err,	/* TX_SYMLINK */
+	(zil_replay_func_t)zvol_replay_err,	/* TX_REMOVE */
+	(zil_replay_func_t)zvol_replay_err,	/* TX_RMDIR */
+	(zil_replay_func_t)zvol_replay_err,	/* TX_LINK */
+	(zil_replay_func_t)zvol_replay_err,	/* TX_RENAME */
+	(zil_replay_func_t)zvol_replay_write,	/* TX_WRITE */
+	(zil_replay_func_t)zvol_replay_truncate, /* TX_TRUNCATE */
+	(zil_replay_func_t)zvol_replay_err,	/* TX_SETATTR */
+	(zil_replay_func_t)zvol_replay_err,	/* TX_ACL */
+};
+
+/*
+ * zvol_log_write() handles synchronous writes using TX_WRITE ZIL transactions.
+ *
+ * We store data in the log buffers if it's small enough.
+ * Otherwise we will later flush the data out via dmu_sync().
+ *
+ * With a slog, whole blocks are copied into the log too, so the commit
+ * doesn't wait for dmu_sync() to write them to the main pool.  Once the
+ * commit being written has logged more than zil_slog_bulk bytes though,
+ * its log blocks go out at async priority anyway (see
+ * zil_lwb_write_issue()), and copying more whole blocks would only take
+ * slog bandwidth from the other datasets' commits, so this volume's
+ * whole blocks are then written indirectly until its commits get small
+ * again.
+ */
+ssize_t zvol_immediate_write_sz = 32768;
+
+#if defined(_KERNEL)
+void
+zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, uint64_t offset,
+    uint64_t size, int sync)
+#else
+void
+zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, uint64_t offset,
+    uint64_t size, int sync, blk_metadata_t *metadata)
+#endif
+{
+	uint32_t blocksize = zv->zv_volblocksize;
+	zilog_t *zilog = zv->zv_zilog;
+	itx_wr_state_t write_state;
+
+#if !defined(_KERNEL)
+	blk_metadata_t *md;
+#endif
+	if (zil_replaying(zilog, tx))
+		return;
+
+	if (zilog->zl_logbias == ZFS_LOGBIAS_THROUGHPUT)
+		write_state = WR_INDIRECT;
+	else if (size >= blocksize && blocksize > zvol_immediate_write_sz &&
+	    (!spa_has_slogs(zilog->zl_spa) ||
+	    zilog->zl_cur_used > zil_slog_bulk))
+		write_state = WR_INDIRECT;
+	else if (sync)
+		write_state = WR_COPIED;
+	else
+		write_state = WR_NEED_COPY;
+
+	while (size) {
+		itx_t *itx;
+		lr_write_t *lr;
+		itx_wr_state_t wr_state = write_state;
+		ssize_t len = size;
+
+		if (wr_state == WR_COPIED && size > ZIL_MAX_COPIED_DATA)
+			wr_state = WR_NEED_COPY;
+		else if (wr_state == WR_INDIRECT)
+			len = MIN(blocksize - P2PHASE(offset, blocksize), size);
+
+		itx = zil_itx_create(TX_WRITE, sizeof (*lr) +
+		    (wr_state == WR_COPIED ? len : 0));
+		lr = (lr_write_t *)&itx->itx_lr;
+		if (wr_state == WR_COPIED && dmu_read_by_dnode(zv->zv_dn,
+		    offset, len, lr+1, DMU_READ_NO_PREFETCH) != 0) {
+			zil_itx_destroy(itx);
+			itx = zil_itx_create(TX_WRITE, sizeof (*lr));
+			lr = (lr_write_t *)&itx->itx_lr;
+			wr_state = WR_NEED_COPY;
+		}
+
+		itx->itx_wr_state = wr_state;
+		lr->lr_foid = ZVOL_OBJ;
+		lr->lr_offset = offset;
+		lr->lr_length = len;
+#if !defined(_KERNEL)
+		if (metadata != NULL) {
+			lr->lr_version = VERSION_1;
+			md = &(lr->lr_metadata);
+			memcpy(md, metadata, sizeof (blk_metadata_t));
+		}
+		else
+			lr->lr_version = VERSION_0;
+#endif
+		lr->lr_blkoff = 0;
+		BP_ZERO(&lr->lr_blkptr);
+
+		itx->itx_private = zv;
+		itx->itx_sync = sync;
+
+		(void) zil_itx_assign(zilog, itx, tx);
+
+		offset += len;
+		size -= len;
+	}
+}
+
+#if !defined(_KERNEL)
+/*
+ * Loan an ARC buffer of one volume block, for receiving a write straight
+ * into the memory the dbuf will keep (see zvol_write_req_t).  A buffer
+ * that ends up unused goes back with dmu_return_arcbuf().
+ */
+arc_buf_t *
+zvol_request_buf(zvol_state_t *zv)
+{
+	return (arc_loan_buf(dmu_objset_spa(zv->zv_objset), B_FALSE,
+	    zv->zv_volblocksize));
+}
+
+/*
+ * Upper bound on the data carried by one zvol_write_batch() call, so that a
+ * single transaction never holds more than a bounded amount of dirty data.
+ */
+uint64_t zvol_write_batch_max_bytes = 1024 * 1024;
+
+/*
+ * Turn block aligned writes of all-zero data into frees, so that a replica
+ * being rebuilt or zero-filled by its initiator keeps holes instead of
+ * allocating (and, without compression, storing) blocks of zeros.
+ */
+int zvol_write_zero_detect = 1;
+
+static boolean_t
+zvol_write_req_is_zero(zvol_state_t *zv, zvol_write_req_t *req)
+{
+	const void *buf;
+
+	if (req->zwr_buf == NULL && req->zwr_abuf == NULL)
+		return (B_TRUE);
+	if (!zvol_write_zero_detect || req->zwr_len == 0 ||
+	    !IS_P2ALIGNED(req->zwr_offset | req->zwr_len, zv->zv_volblocksize))
+		return (B_FALSE);
+
+	buf = (req->zwr_abuf != NULL) ? req->zwr_abuf->b_data : req->zwr_buf;
+	return (zio_buf_is_zero(buf, req->zwr_len));
+}
+
+typedef struct zvol_ionum_ckpt_cb_arg {
+	zvol_ionum_ckpt_t	*zca_zic;
+	uint64_t		zca_io_num;
+} zvol_ionum_ckpt_cb_arg_t;
+
+static void
+zvol_ionum_ckpt_synced(void *arg, int error)
+{
+	zvol_ionum_ckpt_cb_arg_t *zca = arg;
+	zvol_ionum_ckpt_t *zic = zca->zca_zic;
+
+	if (error == 0) {
+		mutex_enter(&zic->zic_lock);
+		zic->zic_synced = MAX(zic->zic_synced, zca->zca_io_num);
+		mutex_exit(&zic->zic_lock);
+	}
+	kmem_free(zca, sizeof (*zca));
+}
+
+/*
+ * Start checkpointing in the zap entry key, from the io_num it holds if
+ * it exists already.
+ */
+int
+zvol_ionum_ckpt_init(zvol_state_t *zv, zvol_ionum_ckpt_t *zic,
+    const char *key)
+{
+	uint64_t io_num = 0;
+	int error;
+
+	error = zap_lookup(zv->zv_objset, ZVOL_ZAP_OBJ, key, sizeof (io_num),
+	    1, &io_num);
+	if (error != 0 && error != ENOENT)
+		return (error);
+
+	mutex_init(&zic->zic_lock, NULL, MUTEX_DEFAULT, NULL);
+	zic->zic_key = key;
+	zic->zic_committed = io_num;
+	zic->zic_txg = 0;
+	zic->zic_synced = io_num;
+	return (0);
+}
+
+/*
+ * The last checkpoint is only registered for the sync of its txg, which
+ * has to be waited for before zic goes away.
+ */
+void
+zvol_ionum_ckpt_fini(zvol_state_t *zv, zvol_ionum_ckpt_t *zic)
+{
+	if (zic->zic_txg != 0)
+		txg_wait_synced(dmu_objset_pool(zv->zv_objset), zic->zic_txg);
+	mutex_destroy(&zic->zic_lock);
+}
+
+int
+zvol_write_batch(zvol_state_t *zv, zvol_write_req_t *reqs, int nreqs,
+    boolean_t sync)
+{
+	return (zvol_write_batch_ckpt(zv, reqs, nreqs, sync, NULL));
+}
+
+/*
+ * Commit a batch of writes, together with their io_num metadata updates, in
+ * one transaction.  Adjacent data and metadata ranges share a single tx hold,
+ * which amortizes dmu_tx_assign() and the txg_hold contention across the
+ * batch.  Whole blocks of zeros are freed rather than written (see
+ * zvol_write_zero_detect), their io_num is recorded all the same.  The
+ * batch is first held to the write limits of the volume, as nreqs i/os.
+ * If zic is given, the io_num checkpoint rides along with the first batch
+ * of each txg (see zvol_ionum_ckpt_t).  The caller is responsible for
+ * range locking every write.
+ */
+int
+zvol_write_batch_ckpt(zvol_state_t *zv, zvol_write_req_t *reqs, int nreqs,
+    boolean_t sync, zvol_ionum_ckpt_t *zic)
+{
+	objset_t *os = zv->zv_objset;
+	uint64_t total = 0, hoff = 0, hlen = 0, moff = 0, mlen = 0;
+	uint64_t max_io_num = 0, txg;
+	metaobj_blk_offset_t metablk;
+	dmu_vec_t *vecs;
+	dmu_tx_t *tx;
+	boolean_t *zero, ckpt = B_FALSE;
+	int i, nvecs, error;
+
+	if (nreqs == 0)
+		return (0);
+
+	for (i = 0; i < nreqs; i++)
+		total += reqs[i].zwr_len;
+	if (total > zvol_write_batch_max_bytes)
+		return (SET_ERROR(E2BIG));
+
+	dmu_objset_io_throttle(os, B_TRUE, nreqs, total);
+
+	zero = kmem_alloc(nreqs * sizeof (boolean_t), KM_SLEEP);
+	for (i = 0; i < nreqs; i++)
+		zero[i] = zvol_write_req_is_zero(zv, &reqs[i]);
+
+	tx = dmu_tx_create(os);
+	for (i = 0; i < nreqs; i++) {
+		zvol_write_req_t *req = &reqs[i];
+
+		if (zero[i]) {
+			dmu_tx_hold_free(tx, ZVOL_OBJ, req->zwr_offset,
+			    req->zwr_len);
+		} else if (hlen != 0 && req->zwr_offset == hoff + hlen) {
+			hlen += req->zwr_len;
+		} else {
+			if (hlen != 0)
+				dmu_tx_hold_write(tx, ZVOL_OBJ, hoff, hlen);
+			hoff = req->zwr_offset;
+			hlen = req->zwr_len;
+		}
+
+		if (req->zwr_metadata == NULL)
+			continue;
+
+		max_io_num = MAX(max_io_num, req->zwr_metadata->io_num);
+		get_zv_metaobj_block_details(&metablk, zv, req->zwr_offset,
+		    req->zwr_len);
+		if (mlen != 0 && metablk.m_offset >= moff &&
+		    metablk.m_offset <= moff + mlen) {
+			mlen = MAX(moff + mlen,
+			    metablk.m_offset + metablk.m_len) - moff;
+		} else {
+			if (mlen != 0)
+				dmu_tx_hold_write(tx, ZVOL_META_OBJ, moff,
+				    mlen);
+			moff = metablk.m_offset;
+			mlen = metablk.m_len;
+		}
+	}
+	if (hlen != 0)
+		dmu_tx_hold_write(tx, ZVOL_OBJ, hoff, hlen);
+	if (mlen != 0)
+		dmu_tx_hold_write(tx, ZVOL_META_OBJ, moff, mlen);
+
+	/*
+	 * The open txg is peeked at without its lock: a batch that misses
+	 * the txg change leaves the checkpoint to the next one, and one
+	 * that holds the zap in vain just does not update it.
+	 */
+	if (zic != NULL && zic->zic_txg <
+	    dmu_objset_pool(os)->dp_tx.tx_open_txg) {
+		dmu_tx_hold_zap(tx, ZVOL_ZAP_OBJ, TRUE, zic->zic_key);
+		ckpt = B_TRUE;
+	}
+
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+		kmem_free(zero, nreqs * sizeof (boolean_t));
+		return (error);
+	}
+
+	txg = dmu_tx_get_txg(tx);
+	if (ckpt) {
+		zvol_ionum_ckpt_cb_arg_t *zca = NULL;
+
+		mutex_enter(&zic->zic_lock);
+		if (zic->zic_txg < txg && zic->zic_committed != 0) {
+			zic->zic_txg = txg;
+			zca = kmem_alloc(sizeof (*zca), KM_SLEEP);
+			zca->zca_zic = zic;
+			zca->zca_io_num = zic->zic_committed;
+		}
+		mutex_exit(&zic->zic_lock);
+
+		if (zca != NULL) {
+			VERIFY0(zap_update(os, ZVOL_ZAP_OBJ, zic->zic_key,
+			    sizeof (uint64_t), 1, &zca->zca_io_num, tx));
+			dmu_tx_callback_register(tx, zvol_ionum_ckpt_synced,
+			    zca);
+		}
+	}
+
+	/*
+	 * Copied writes go out in vectored runs, loaned buffers and frees
+	 * are applied between them, keeping the batch's order for
+	 * overlapping writes.
+	 */
+	vecs = kmem_alloc(nreqs * sizeof (dmu_vec_t), KM_SLEEP);
+	for (i = 0, nvecs = 0; i < nreqs; i++) {
+		zvol_write_req_t *req = &reqs[i];
+
+		if (req->zwr_abuf == NULL && !zero[i]) {
+			vecs[nvecs].dv_offset = req->zwr_offset;
+			vecs[nvecs].dv_len = req->zwr_len;
+			vecs[nvecs].dv_buf = (void *)req->zwr_buf;
+			nvecs++;
+			continue;
+		}
+		if (nvecs != 0) {
+			dmu_write_vec_by_dnode(zv->zv_dn, vecs, nvecs, tx);
+			nvecs = 0;
+		}
+		if (zero[i]) {
+			if (req->zwr_abuf != NULL)
+				dmu_return_arcbuf(req->zwr_abuf);
+			VERIFY0(dmu_free_range(os, ZVOL_OBJ, req->zwr_offset,
+			    req->zwr_len, tx));
+			continue;
+		}
+		ASSERT3U(arc_buf_lsize(req->zwr_abuf), ==, req->zwr_len);
+		dmu_assign_arcbuf_by_dnode(zv->zv_dn, req->zwr_offset,
+		    req->zwr_abuf, tx);
+	}
+	if (nvecs != 0)
+		dmu_write_vec_by_dnode(zv->zv_dn, vecs, nvecs, tx);
+	kmem_free(vecs, nreqs * sizeof (dmu_vec_t));
+	kmem_free(zero, nreqs * sizeof (boolean_t));
+
+	for (i = 0; i < nreqs; i++) {
+		zvol_write_req_t *req = &reqs[i];
+
+		if (req->zwr_metadata != NULL)
+			zvol_write_metadata_run(zv, req->zwr_offset,
+			    req->zwr_len, req->zwr_metadata, tx);
+
+		zvol_log_write(zv, tx, req->zwr_offset, req->zwr_len, sync,
+		    req->zwr_metadata);
+	}
+
+	dmu_tx_commit(tx);
+
+	if (zic != NULL && max_io_num != 0) {
+		mutex_enter(&zic->zic_lock);
+		zic->zic_committed = MAX(zic->zic_committed, max_io_num);
+		mutex_exit(&zic->zic_lock);
+	}
+
+	if (sync)
+		zil_commit(zv->zv_zilog, ZVOL_OBJ);
+
+	return (0);
+}
+
+zvol_dirty_log_t *
+zvol_dirty_log_create(void)
+{
+	zvol_dirty_log_t *zdl = kmem_zalloc(sizeof (*zdl), KM_SLEEP);
+
+	mutex_init(&zdl->zdl_lock, NULL, MUTEX_DEFAULT, NULL);
+	zdl->zdl_ranges = range_tree_create(NULL, NULL, &zdl->zdl_lock);
+	return (zdl);
+}
+
+void
+zvol_dirty_log_destroy(zvol_dirty_log_t *zdl)
+{
+	ASSERT0(zdl->zdl_inflight);
+	mutex_enter(&zdl->zdl_lock);
+	range_tree_vacate(zdl->zdl_ranges, NULL, NULL);
+	range_tree_destroy(zdl->zdl_ranges);
+	mutex_exit(&zdl->zdl_lock);
+	mutex_destroy(&zdl->zdl_lock);
+	kmem_free(zdl, sizeof (*zdl));
+}
+
+/*
+ * zvol_write_batch() for a replica out of quorum: the data is written,
+ * and its io_num metadata replaced by an entry in zdl.  Once zdl is
+ * reconciled, writes carry their metadata again.
+ */
+int
+zvol_write_batch_degraded(zvol_state_t *zv, zvol_write_req_t *reqs,
+    int nreqs, boolean_t sync, zvol_dirty_log_t *zdl)
+{
+	blk_metadata_t **mds;
+	uint64_t io_num = 0;
+	int i, error;
+
+	mutex_enter(&zdl->zdl_lock);
+	if (zdl->zdl_closed) {
+		mutex_exit(&zdl->zdl_lock);
+		return (zvol_write_batch(zv, reqs, nreqs, sync));
+	}
+	zdl->zdl_inflight++;
+	mutex_exit(&zdl->zdl_lock);
+
+	mds = kmem_alloc(nreqs * sizeof (blk_metadata_t *), KM_SLEEP);
+	for (i = 0; i < nreqs; i++) {
+		mds[i] = reqs[i].zwr_metadata;
+		reqs[i].zwr_metadata = NULL;
+		if (mds[i] != NULL)
+			io_num = MAX(io_num, mds[i]->io_num);
+	}
+
+	error = zvol_write_batch(zv, reqs, nreqs, sync);
+
+	mutex_enter(&zdl->zdl_lock);
+	for (i = 0; i < nreqs; i++) {
+		reqs[i].zwr_metadata = mds[i];
+		if (error != 0 || mds[i] == NULL)
+			continue;
+		range_tree_clear(zdl->zdl_ranges, reqs[i].zwr_offset,
+		    reqs[i].zwr_len);
+		range_tree_add(zdl->zdl_ranges, reqs[i].zwr_offset,
+		    reqs[i].zwr_len);
+	}
+	if (error == 0)
+		zdl->zdl_io_num = MAX(zdl->zdl_io_num, io_num);
+	zdl->zdl_inflight--;
+	mutex_exit(&zdl->zdl_lock);
+
+	kmem_free(mds, nreqs * sizeof (blk_metadata_t *));
+	return (error);
+}
+
+/*
+ * Volume bytes whose metadata zvol_dirty_log_reconcile() rewrites in one
+ * transaction.
+ */
+uint64_t zvol_dirty_log_reconcile_bytes = 64 * 1024 * 1024;
+
+/*
+ * Write the highest logged io_num as the metadata of every logged range,
+ * which never understates the io_num of the data there.  Degraded writes
+ * may go on meanwhile: a range written again is logged again, with a
+ * higher io_num, and stamped once more.  The log is closed when it is
+ * found empty with no degraded write in flight, and writes carry their
+ * own metadata from then on.  No range lock is needed, as the metadata
+ * of a range is only ever raised.
+ */
+int
+zvol_dirty_log_reconcile(zvol_state_t *zv, zvol_dirty_log_t *zdl)
+{
+	objset_t *os = zv->zv_objset;
+	metaobj_blk_offset_t metablk;
+	zfs_btree_index_t where;
+	blk_metadata_t md;
+	range_seg_t *rs;
+	uint64_t offset, len;
+	dmu_tx_t *tx;
+	int error;
+
+	for (;;) {
+		mutex_enter(&zdl->zdl_lock);
+		rs = zfs_btree_first(&zdl->zdl_ranges->rt_root, &where);
+		if (rs == NULL) {
+			if (zdl->zdl_inflight == 0) {
+				zdl->zdl_closed = B_TRUE;
+				mutex_exit(&zdl->zdl_lock);
+				return (0);
+			}
+			mutex_exit(&zdl->zdl_lock);
+			delay(1);
+			continue;
+		}
+		offset = rs->rs_start;
+		len = MIN(rs->rs_end - rs->rs_start,
+		    zvol_dirty_log_reconcile_bytes);
+		range_tree_remove(zdl->zdl_ranges, offset, len);
+		md.io_num = zdl->zdl_io_num;
+		mutex_exit(&zdl->zdl_lock);
+
+		get_zv_metaobj_block_details(&metablk, zv, offset, len);
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_write(tx, ZVOL_META_OBJ, metablk.m_offset,
+		    metablk.m_len);
+		error = dmu_tx_assign(tx, TXG_WAIT);
+		if (error != 0) {
+			dmu_tx_abort(tx);
+			mutex_enter(&zdl->zdl_lock);
+			range_tree_clear(zdl->zdl_ranges, offset, len);
+			range_tree_add(zdl->zdl_ranges, offset, len);
+			mutex_exit(&zdl->zdl_lock);
+			return (SET_ERROR(error));
+		}
+		zvol_write_metadata_run(zv, offset, len, &md, tx);
+		dmu_tx_commit(tx);
+	}
+}
+
+/*
+ * Granularity of the in-memory io_num index.  A 1TB volume is summarized
+ * by 64K entries (512KB) with the default of 16MB.
+ */
+uint64_t zvol_ionum_index_region_size = 16 * 1024 * 1024;
+
+zvol_ionum_index_t *
+zvol_ionum_index_alloc(uint64_t volsize)
+{
+	zvol_ionum_index_t *zir;
+
+	zir = kmem_zalloc(sizeof (zvol_ionum_index_t), KM_SLEEP);
+	zir->zir_region_shift = highbit64(zvol_ionum_index_region_size) - 1;
+	zir->zir_nregions = MAX(1, P2ROUNDUP(volsize,
+	    1ULL << zir->zir_region_shift) >> zir->zir_region_shift);
+	zir->zir_max_ionum = vmem_zalloc(zir->zir_nregions * sizeof (uint64_t),
+	    KM_SLEEP);
+
+	return (zir);
+}
+
+void
+zvol_ionum_index_free(zvol_ionum_index_t *zir)
+{
+	vmem_free(zir->zir_max_ionum, zir->zir_nregions * sizeof (uint64_t));
+	kmem_free(zir, sizeof (zvol_ionum_index_t));
+}
+
+/*
+ * Record that [offset, offset + len) was written with io_num.  Safe to call
+ * concurrently from several writers, the per-region maximum only grows.
+ */
+void
+zvol_ionum_index_update(zvol_ionum_index_t *zir, uint64_t offset,
+    uint64_t len, uint64_t io_num)
+{
+	uint64_t r, first, last, cur;
+
+	if (len == 0)
+		return;
+
+	first = offset >> zir->zir_region_shift;
+	last = MIN((offset + len - 1) >> zir->zir_region_shift,
+	    zir->zir_nregions - 1);
+
+	for (r = first; r <= last; r++) {
+		do {
+			cur = zir->zir_max_ionum[r];
+			if (cur >= io_num)
+				break;
+		} while (atomic_cas_64(&zir->zir_max_ionum[r], cur,
+		    io_num) != cur);
+	}
+}
+
+/*
+ * Return the offset of the first region at or after offset that has been
+ * written with an io_num greater than base_io_num, or UINT64_MAX if there
+ * is none.  The returned offset is region aligned.
+ */
+uint64_t
+zvol_ionum_index_next_changed(zvol_ionum_index_t *zir, uint64_t offset,
+    uint64_t base_io_num)
+{
+	uint64_t r;
+
+	for (r = offset >> zir->zir_region_shift; r < zir->zir_nregions; r++) {
+		if (zir->zir_max_ionum[r] > base_io_num)
+			return (r << zir->zir_region_shift);
+	}
+
+	return (UINT64_MAX);
+}
+
+/*
+ * Populate the index from ZVOL_META_OBJ.  This is the only full walk of the
+ * metadata object; holes in it are skipped.
+ */
+int
+zvol_ionum_index_load(zvol_state_t *zv, zvol_ionum_index_t *zir)
+{
+	objset_t *os = zv->zv_objset;
+	uint64_t metadatasize = zv->zv_volmetadatasize;
+	uint64_t metavolblocksize = zv->zv_metavolblocksize;
+	uint64_t metasize, moff = 0, len, i;
+	uint64_t chunk = 1024 * 1024;
+	dmu_object_info_t doi;
+	blk_metadata_t *md;
+	char *buf;
+	int error;
+
+	if ((error = dmu_object_info(os, ZVOL_META_OBJ, &doi)) != 0)
+		return (error);
+	metasize = (doi.doi_max_offset / metadatasize) * metadatasize;
+	chunk = P2ALIGN_TYPED(chunk, metadatasize, uint64_t);
+
+	buf = vmem_alloc(chunk, KM_SLEEP);
+	while (moff < metasize) {
+		uint64_t next = moff;
+
+		/*
+		 * Skip holes, they hold no io_num.  A dirty object can't be
+		 * searched (EBUSY), it is then read in full.
+		 */
+		error = dmu_offset_next(os, ZVOL_META_OBJ, B_FALSE, &next);
+		if (error == ESRCH || (error == 0 && next >= metasize)) {
+			error = 0;
+			break;
+		}
+		if (error == 0)
+			moff = P2ALIGN_TYPED(next, metadatasize, uint64_t);
+
+		len = MIN(chunk, metasize - moff);
+		error = dmu_read(os, ZVOL_META_OBJ, moff, len, buf,
+		    DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+
+		for (i = 0; i < len; i += metadatasize) {
+			md = (blk_metadata_t *)(buf + i);
+			if (md->io_num != 0)
+				zvol_ionum_index_update(zir, ((moff + i) /
+				    metadatasize) * metavolblocksize,
+				    metavolblocksize, md->io_num);
+		}
+		moff += len;
+	}
+	vmem_free(buf, chunk);
+
+	return (error);
+}
+
+/*
+ * How far ahead of a rebuild cursor zvol_rebuild_prefetch() reads, in bytes
+ * of volume data; 0 disables it.  The metadata is prefetched twice as far.
+ */
+uint64_t zvol_rebuild_prefetch_window = 16 * 1024 * 1024;
+
+/*
+ * Issue asynchronous reads ahead of a rebuild which walks the volume upwards
+ * from offset, copying the data whose io_num is newer than base_io_num.
+ * The L1 indirects and then the blocks of ZVOL_META_OBJ are prefetched two
+ * windows ahead, so that by the time the cursor is a window away from them
+ * they are cached and can be searched here for the changed data ranges,
+ * which are then prefetched from ZVOL_OBJ.  The rebuild's own reads then
+ * find their blocks in the ARC or in flight instead of waiting for each in
+ * turn.  Each range is prefetched once per cursor, so the rebuild may call
+ * this as often as it likes.
+ */
+void
+zvol_rebuild_prefetch(zvol_state_t *zv, zvol_prefetch_cursor_t *zpc,
+    uint64_t offset, uint64_t base_io_num)
+{
+	objset_t *os = zv->zv_objset;
+	uint64_t window = zvol_rebuild_prefetch_window;
+	uint64_t blocksize = zv->zv_metavolblocksize;
+	uint64_t metadatasize = zv->zv_volmetadatasize;
+	uint64_t bufsize = zv->zv_volmetablocksize;
+	uint64_t start, end, len, run_off, run_len, i;
+	metaobj_blk_offset_t metablk;
+	blk_metadata_t *md;
+	char *buf;
+
+	if (window == 0 || offset >= zv->zv_volsize)
+		return;
+
+	end = MIN(zv->zv_volsize, offset + 2 * window);
+	start = MAX(zpc->zpc_meta_off, offset);
+	if (start < end) {
+		get_zv_metaobj_block_details(&metablk, zv, start, end - start);
+		dmu_prefetch(os, ZVOL_META_OBJ, 1, metablk.m_offset,
+		    metablk.m_len, ZIO_PRIORITY_ASYNC_READ);
+		dmu_prefetch(os, ZVOL_META_OBJ, 0, metablk.m_offset,
+		    metablk.m_len, ZIO_PRIORITY_ASYNC_READ);
+		zpc->zpc_meta_off = end;
+	}
+
+	end = MIN(zv->zv_volsize, offset + window);
+	start = P2ALIGN_TYPED(MAX(zpc->zpc_data_off, offset), blocksize,
+	    uint64_t);
+	if (start >= end)
+		return;
+	zpc->zpc_data_off = end;
+
+	buf = kmem_alloc(bufsize, KM_SLEEP);
+	run_off = run_len = 0;
+	while (start < end) {
+		len = MIN(end - start, (bufsize / metadatasize) * blocksize);
+		get_zv_metaobj_block_details(&metablk, zv, start, len);
+		if (dmu_read(os, ZVOL_META_OBJ, metablk.m_offset,
+		    metablk.m_len, buf, DMU_READ_NO_PREFETCH) != 0)
+			break;
+
+		for (i = 0; i < metablk.m_len; i += metadatasize) {
+			md = (blk_metadata_t *)(buf + i);
+			if (md->io_num <= base_io_num)
+				continue;
+			if (run_len != 0 && run_off + run_len ==
+			    start + (i / metadatasize) * blocksize) {
+				run_len += blocksize;
+				continue;
+			}
+			if (run_len != 0) {
+				dmu_prefetch(os, ZVOL_OBJ, 0, run_off, run_len,
+				    ZIO_PRIORITY_ASYNC_READ);
+			}
+			run_off = start + (i / metadatasize) * blocksize;
+			run_len = blocksize;
+		}
+		start += len;
+	}
+	if (run_len != 0) {
+		dmu_prefetch(os, ZVOL_OBJ, 0, run_off, run_len,
+		    ZIO_PRIORITY_ASYNC_READ);
+	}
+	kmem_free(buf, bufsize);
+}
+
+/*
+ * Bounds of the window zvol_readahead() prefetches ahead of a sequential
+ * stream, in bytes; a zvol_readahead_max of 0 disables it.  A stream is
+ * taken as sequential once zvol_readahead_hits reads in a row have each
+ * started where the previous one ended.
+ */
+uint64_t zvol_readahead_min = 128 * 1024;
+uint64_t zvol_readahead_max = 8 * 1024 * 1024;
+uint64_t zvol_readahead_hits = 2;
+
+/*
+ * Called with each read of a stream, before it is served.  dmu_zfetch
+ * only sees the dbufs of one read at a time, and with few reads in flight
+ * it never gets far enough ahead to keep the disks busy.  Once the stream
+ * is sequential, the data and metadata past the read are prefetched, the
+ * window doubling each time it is refilled up to zvol_readahead_max.  It
+ * is refilled when less than half of it is left ahead of the stream, so
+ * most reads issue nothing.  A read anywhere else restarts the detector.
+ * The caller serializes the calls for one zvol_readahead_t.
+ */
+void
+zvol_readahead(zvol_state_t *zv, zvol_readahead_t *zra, uint64_t offset,
+    uint64_t len)
+{
+	objset_t *os = zv->zv_objset;
+	uint64_t end = offset + len;
+	uint64_t start, window;
+	metaobj_blk_offset_t metablk;
+
+	if (offset != zra->zra_next) {
+		zra->zra_next = end;
+		zra->zra_off = 0;
+		zra->zra_window = 0;
+		zra->zra_hits = 1;
+		return;
+	}
+	zra->zra_next = end;
+	if (zra->zra_hits < zvol_readahead_hits)
+		zra->zra_hits++;
+	if (zra->zra_hits < zvol_readahead_hits || zvol_readahead_max == 0)
+		return;
+	if (zra->zra_off > end && zra->zra_off - end >= zra->zra_window / 2)
+		return;
+
+	if (zra->zra_window == 0)
+		window = MAX(zvol_readahead_min, 2 * len);
+	else
+		window = 2 * zra->zra_window;
+	window = MIN(window, zvol_readahead_max);
+	zra->zra_window = window;
+
+	start = MAX(zra->zra_off, end);
+	end = MIN(zv->zv_volsize, end + window);
+	if (start >= end)
+		return;
+	zra->zra_off = end;
+
+	dmu_prefetch(os, ZVOL_OBJ, 0, start, end - start,
+	    ZIO_PRIORITY_ASYNC_READ);
+	if (zv->zv_volmetablocksize != 0) {
+		get_zv_metaobj_block_details(&metablk, zv, start, end - start);
+		dmu_prefetch(os, ZVOL_META_OBJ, 0, metablk.m_offset,
+		    metablk.m_len, ZIO_PRIORITY_ASYNC_READ);
+	}
+}
+
+/*
+ * Bytes of ZVOL_META_OBJ blocks pinned by a zvol_meta_cache_t created
+ * without a limit of its own.
+ */
+uint64_t zvol_meta_cache_max = 64 * 1024 * 1024;
+
+typedef struct zvol_meta_pin {
+	avl_node_t	zmp_node;
+	list_node_t	zmp_lru;
+	uint64_t	zmp_blkid;
+	uint64_t	zmp_size;
+	dmu_buf_t	*zmp_db;
+} zvol_meta_pin_t;
+
+static int
+zvol_meta_pin_compare(const void *x1, const void *x2)
+{
+	const zvol_meta_pin_t *p1 = x1;
+	const zvol_meta_pin_t *p2 = x2;
+
+	return (AVL_CMP(p1->zmp_blkid, p2->zmp_blkid));
+}
+
+zvol_meta_cache_t *
+zvol_meta_cache_create(uint64_t max)
+{
+	zvol_meta_cache_t *zmc = kmem_zalloc(sizeof (*zmc), KM_SLEEP);
+
+	mutex_init(&zmc->zmc_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&zmc->zmc_tree, zvol_meta_pin_compare,
+	    sizeof (zvol_meta_pin_t), offsetof(zvol_meta_pin_t, zmp_node));
+	list_create(&zmc->zmc_lru, sizeof (zvol_meta_pin_t),
+	    offsetof(zvol_meta_pin_t, zmp_lru));
+	zmc->zmc_max = (max != 0) ? max : zvol_meta_cache_max;
+	return (zmc);
+}
+
+static void
+zvol_meta_cache_release(zvol_meta_cache_t *zmc, list_t *list)
+{
+	zvol_meta_pin_t *zmp;
+
+	while ((zmp = list_remove_head(list)) != NULL) {
+		dmu_buf_rele(zmp->zmp_db, zmc);
+		kmem_free(zmp, sizeof (*zmp));
+	}
+}
+
+void
+zvol_meta_cache_destroy(zvol_meta_cache_t *zmc)
+{
+	void *cookie = NULL;
+
+	while (avl_destroy_nodes(&zmc->zmc_tree, &cookie) != NULL)
+		;
+	avl_destroy(&zmc->zmc_tree);
+	zvol_meta_cache_release(zmc, &zmc->zmc_lru);
+	list_destroy(&zmc->zmc_lru);
+	mutex_destroy(&zmc->zmc_lock);
+	kmem_free(zmc, sizeof (*zmc));
 }
-#endif
 
 /*
- * Replay a TX_TRUNCATE ZIL transaction if asked.  TX_TRUNCATE is how we
- * implement DKIOCFREE/free-long-range.
+ * Called with each IO of a zvol, before or after it is served: pin the
+ * ZVOL_META_OBJ blocks with the metadata of offset, len, so that the
+ * read-modify-write of metadata by later IOs to the same region finds them
+ * cached even when the ARC is short of memory.  A block not cached yet is
+ * read in without waiting for it.  The blocks are held in LRU order, and
+ * the least recently used ones are let go once more than zmc_max bytes are
+ * pinned.  Holding a dbuf makes the sync of a dirty one copy it, which for
+ * a small metadata block is much cheaper than reading it back in.
  */
-static int
-zvol_replay_truncate(zvol_state_t *zv, lr_truncate_t *lr, boolean_t byteswap)
+void
+zvol_meta_cache_hold(zvol_state_t *zv, zvol_meta_cache_t *zmc,
+    uint64_t offset, uint64_t len)
 {
-	uint64_t offset, length;
+	metaobj_blk_offset_t metablk;
+	zvol_meta_pin_t search, *zmp;
+	list_t evict;
+	avl_index_t where;
+	zio_t *zio = NULL;
+	dmu_buf_impl_t *db;
+	dnode_t *dn;
+	uint64_t moff, mend;
+
+	if (len == 0 || zv->zv_volmetablocksize == 0)
+		return;
+	if (dnode_hold(zv->zv_objset, ZVOL_META_OBJ, FTAG, &dn) != 0)
+		return;
 
-	if (byteswap)
-		byteswap_uint64_array(lr, sizeof (*lr));
+	list_create(&evict, sizeof (zvol_meta_pin_t),
+	    offsetof(zvol_meta_pin_t, zmp_lru));
+	get_zv_metaobj_block_details(&metablk, zv, offset, len);
+	mend = metablk.m_offset + metablk.m_len;
+	for (moff = metablk.m_offset; moff < mend;
+	    moff = (search.zmp_blkid + 1) * dn->dn_datablksz) {
+		search.zmp_blkid = dbuf_whichblock(dn, 0, moff);
+
+		mutex_enter(&zmc->zmc_lock);
+		zmp = avl_find(&zmc->zmc_tree, &search, NULL);
+		if (zmp != NULL) {
+			list_remove(&zmc->zmc_lru, zmp);
+			list_insert_head(&zmc->zmc_lru, zmp);
+			mutex_exit(&zmc->zmc_lock);
+			continue;
+		}
+		mutex_exit(&zmc->zmc_lock);
 
-	offset = lr->lr_offset;
-	length = lr->lr_length;
+		rw_enter(&dn->dn_struct_rwlock, RW_READER);
+		db = dbuf_hold(dn, search.zmp_blkid, zmc);
+		rw_exit(&dn->dn_struct_rwlock);
+		if (db == NULL)
+			continue;
+		if (zio == NULL) {
+			zio = zio_root(dmu_objset_spa(zv->zv_objset), NULL,
+			    NULL, ZIO_FLAG_CANFAIL);
+		}
+		(void) dbuf_read(db, zio, DB_RF_CANFAIL | DB_RF_NOPREFETCH |
+		    DB_RF_NEVERWAIT);
+
+		zmp = kmem_alloc(sizeof (*zmp), KM_SLEEP);
+		zmp->zmp_blkid = search.zmp_blkid;
+		zmp->zmp_size = db->db.db_size;
+		zmp->zmp_db = &db->db;
+
+		mutex_enter(&zmc->zmc_lock);
+		if (avl_find(&zmc->zmc_tree, zmp, &where) != NULL) {
+			/* pinned by another IO meanwhile */
+			list_insert_head(&evict, zmp);
+		} else {
+			avl_insert(&zmc->zmc_tree, zmp, where);
+			list_insert_head(&zmc->zmc_lru, zmp);
+			zmc->zmc_bytes += zmp->zmp_size;
+		}
+		while (zmc->zmc_bytes > zmc->zmc_max) {
+			zmp = list_remove_tail(&zmc->zmc_lru);
+			avl_remove(&zmc->zmc_tree, zmp);
+			zmc->zmc_bytes -= zmp->zmp_size;
+			list_insert_tail(&evict, zmp);
+		}
+		mutex_exit(&zmc->zmc_lock);
+	}
+	dnode_rele(dn, FTAG);
 
-	return (dmu_free_long_range(zv->zv_objset, ZVOL_OBJ, offset, length));
+	if (zio != NULL)
+		zio_nowait(zio);
+	zvol_meta_cache_release(zmc, &evict);
+	list_destroy(&evict);
 }
 
-#if !defined(_KERNEL)
 /*
- * Finds m_offset, m_length in metadata for data at offset, len
- * blocksize is granularity at which metadata is maintained
- * metablocksize is metadata's blocksize
- * metadatasize is the size of metadata of one block 'blocksize'
+ * Find the extent of [offset, end) starting at offset which is either all
+ * hole or all data in ZVOL_OBJ, so that a rebuild can send holes as ranges
+ * to free instead of as buffers of zeros.  Only a clean volume, such as a
+ * snapshot, can be searched; a dirty one is reported as data throughout.
  */
 void
-get_metaobj_block_details(metaobj_blk_offset_t *m, uint64_t blocksize,
-    uint64_t metablocksize, uint64_t metadatasize, uint64_t offset,
-    uint64_t len)
+zvol_next_extent(zvol_state_t *zv, uint64_t offset, uint64_t end,
+    uint64_t *lenp, boolean_t *holep)
 {
-	uint64_t s_offset, e_offset;
+	objset_t *os = zv->zv_objset;
+	uint64_t next = offset;
+	int error;
 
-	s_offset = (offset / blocksize) * metadatasize;
-	e_offset = ((offset + len - 1) / blocksize) * metadatasize;
+	ASSERT3U(offset, <, end);
 
-	m->r_offset = P2ALIGN_TYPED(s_offset, metablocksize, uint64_t);
-	m->r_len = P2ALIGN_TYPED(e_offset, metablocksize, uint64_t) -
-	    m->r_offset + metablocksize;
-	m->m_offset = s_offset;
-	m->m_len = (e_offset - s_offset + metadatasize);
+	error = dmu_offset_next(os, ZVOL_OBJ, B_FALSE, &next);
+	if (error == ESRCH || (error == 0 && next > offset)) {
+		*holep = B_TRUE;
+		*lenp = (error == ESRCH) ? end - offset :
+		    MIN(next, end) - offset;
+		return;
+	}
+
+	*holep = B_FALSE;
+	next = offset;
+	if (error == 0 &&
+	    dmu_offset_next(os, ZVOL_OBJ, B_TRUE, &next) == 0 &&
+	    next > offset)
+		*lenp = MIN(next, end) - offset;
+	else
+		*lenp = end - offset;
 }
 
-void
-get_zv_metaobj_block_details(metaobj_blk_offset_t *m, zvol_state_t *zv,
-    uint64_t offset, uint64_t len)
+/*
+ * Read a range of the live volume for a rebuild, rather than of a snapshot
+ * of it.  The data and its io_num metadata are read under one reader range
+ * lock, which every write holds as writer, so the two are consistent even
+ * while writes keep coming in.  md receives get_metadata_len() bytes of
+ * entries.  The data is only read if some entry is newer than base_io_num,
+ * *changedp tells which; blocks no newer than base_io_num are already on
+ * the replica being rebuilt and are to be skipped by the caller.
+ */
+int
+zvol_rebuild_read(zvol_state_t *zv, uint64_t offset, uint64_t len,
+    void *buf, blk_metadata_t *md, uint64_t base_io_num, boolean_t *changedp)
 {
-	uint64_t blocksize = zv->zv_metavolblocksize;
-	uint64_t metablocksize = zv->zv_volmetablocksize;
+	objset_t *os = zv->zv_objset;
 	uint64_t metadatasize = zv->zv_volmetadatasize;
+	metaobj_blk_offset_t metablk;
+	rl_t *rl;
+	uint64_t i;
+	int error;
 
-	get_metaobj_block_details(m, blocksize, metablocksize,
-	    metadatasize, offset, len);
-}
+	ASSERT(IS_P2ALIGNED(offset | len, zv->zv_metavolblocksize));
 
-uint64_t
-get_metadata_len(zvol_state_t *zv, uint64_t offset, uint64_t len)
-{
-	uint64_t blocksize = zv->zv_metavolblocksize;
-	uint64_t metadatasize = zv->zv_volmetadatasize;
-	uint64_t m_th_entry, n_th_entry;
+	*changedp = B_FALSE;
+	get_zv_metaobj_block_details(&metablk, zv, offset, len);
 
-	m_th_entry = (offset / blocksize);
-	n_th_entry = ((offset + len - 1) / blocksize);
+	rl = zfs_range_lock(&zv->zv_range_lock, offset, len, RL_READER);
+	error = dmu_read(os, ZVOL_META_OBJ, metablk.m_offset, metablk.m_len,
+	    md, DMU_READ_PREFETCH);
+	if (error == 0) {
+		for (i = 0; i < metablk.m_len / metadatasize; i++) {
+			blk_metadata_t *m = (blk_metadata_t *)
+			    ((char *)md + i * metadatasize);
 
-	return ((n_th_entry - m_th_entry + 1) * metadatasize);
+			if (m->io_num > base_io_num) {
+				*changedp = B_TRUE;
+				break;
+			}
+		}
+	}
+	if (error == 0 && *changedp)
+		error = dmu_read(os, ZVOL_OBJ, offset, len, buf,
+		    DMU_READ_PREFETCH);
+	zfs_range_unlock(rl);
+
+	return (error);
 }
 
-#endif
+#define	ZVOL_REBUILD_CURSOR	"rebuild_cursor"
+#define	ZVOL_REBUILD_CURSOR_INTS \
+	(sizeof (zvol_rebuild_cursor_t) / sizeof (uint64_t))
 
 /*
- * Replay a TX_WRITE ZIL transaction that didn't get committed
- * after a system failure
+ * Checkpoint the progress of a rebuild.  The update is not waited for: it
+ * goes out with a txg no earlier than that of the rebuilt data below
+ * zrc_offset, and txgs reach the disk in order, so the checkpoint found
+ * after a restart never runs ahead of the data.
  */
-static int
-zvol_replay_write(zvol_state_t *zv, lr_write_t *lr, boolean_t byteswap)
+int
+zvol_rebuild_cursor_save(zvol_state_t *zv, const zvol_rebuild_cursor_t *zrc)
 {
 	objset_t *os = zv->zv_objset;
-	char *data = (char *)(lr + 1);  /* data follows lr_write_t */
-	uint64_t offset, length;
 	dmu_tx_t *tx;
 	int error;
-#if !defined(_KERNEL)
-	blk_metadata_t *metadata = NULL;
-	metaobj_blk_offset_t metablk;
-	uint64_t version, metadatasize;
-	char *mdata = NULL, *tmdata, *tmdataend;
-#endif
-	if (byteswap)
-		byteswap_uint64_array(lr, sizeof (*lr));
-
-	offset = lr->lr_offset;
-	length = lr->lr_length;
-#if !defined(_KERNEL)
-	version = lr->lr_version;
-	metadata = &(lr->lr_metadata);
-#endif
-	/* If it's a dmu_sync() block, write the whole block */
-	if (lr->lr_common.lrc_reclen == sizeof (lr_write_t)) {
-		uint64_t blocksize = BP_GET_LSIZE(&lr->lr_blkptr);
-		if (length < blocksize) {
-			offset -= offset % blocksize;
-			length = blocksize;
-		}
-	}
 
 	tx = dmu_tx_create(os);
-	dmu_tx_hold_write(tx, ZVOL_OBJ, offset, length);
-
-#if !defined(_KERNEL)
-	if (lr->lr_version == VERSION_1) {
-		get_zv_metaobj_block_details(&metablk, zv, offset, length);
-		metadatasize = zv->zv_volmetadatasize;
-		tmdata = mdata = kmem_alloc(metablk.m_len, KM_SLEEP);
-		tmdataend = mdata + metablk.m_len;
-		while (tmdata < tmdataend) {
-			memcpy(tmdata, metadata, metadatasize);
-			tmdata += metadatasize;
-		}
-		dmu_tx_hold_write(tx, ZVOL_META_OBJ, metablk.m_offset,
-		    metablk.m_len);
-	}
-#endif
-
+	dmu_tx_hold_zap(tx, ZVOL_ZAP_OBJ, TRUE, ZVOL_REBUILD_CURSOR);
 	error = dmu_tx_assign(tx, TXG_WAIT);
 	if (error) {
 		dmu_tx_abort(tx);
-	} else {
-		dmu_write(os, ZVOL_OBJ, offset, length, data, tx);
-#if !defined(_KERNEL)
-		if (lr->lr_version == VERSION_1) {
-			get_zv_metaobj_block_details(&metablk, zv, offset,
-			    length);
-			dmu_write(os, ZVOL_META_OBJ, metablk.m_offset,
-			    metablk.m_len, mdata, tx);
-		}
-		if (mdata != NULL)
-			kmem_free(mdata, metablk.m_len);
-#endif
-		dmu_tx_commit(tx);
+		return (SET_ERROR(error));
 	}
 
-	return (error);
-}
+	error = zap_update(os, ZVOL_ZAP_OBJ, ZVOL_REBUILD_CURSOR, 8,
+	    ZVOL_REBUILD_CURSOR_INTS, zrc, tx);
+	dmu_tx_commit(tx);
 
-static int
-zvol_replay_err(zvol_state_t *zv, lr_t *lr, boolean_t byteswap)
-{
-	return (SET_ERROR(ENOTSUP));
+	return (error);
 }
 
 /*
- * Callback vectors for replaying records.
- * Only TX_WRITE and TX_TRUNCATE are needed for zvol.
+ * Look up the checkpoint of an unfinished rebuild.  Returns ENOENT if
+ * there is none, and the rebuild has to start from the beginning.
  */
-zil_replay_func_t zvol_replay_vector[TX_MAX_TYPE] = {
-	(zil_replay_func_t)zvol_replay_err,	/* no such transaction type */
-	(zil_replay_func_t)zvol_replay_err,	/* TX_CREATE */
-	(zil_replay_func_t)zvol_replay_err,	/* TX_MKDIR */
-	(zil_replay_func_t)zvol_replay_err,	/* TX_MKXATTR */
-	(zil_replay_func_t)zvol_replay_err,	/* TX_SYMLINK */
-	(zil_replay_func_t)zvol_replay_err,	/* TX_REMOVE */
-	(zil_replay_func_t)zvol_replay_err,	/* TX_RMDIR */
-	(zil_replay_func_t)zvol_replay_err,	/* TX_LINK */
-	(zil_replay_func_t)zvol_replay_err,	/* TX_RENAME */
-	(zil_replay_func_t)zvol_replay_write,	/* TX_WRITE */
-	(zil_replay_func_t)zvol_replay_truncate, /* TX_TRUNCATE */
-	(zil_replay_func_t)zvol_replay_err,	/* TX_SETATTR */
-	(zil_replay_func_t)zvol_replay_err,	/* TX_ACL */
-};
+int
+zvol_rebuild_cursor_load(zvol_state_t *zv, zvol_rebuild_cursor_t *zrc)
+{
+	return (zap_lookup(zv->zv_objset, ZVOL_ZAP_OBJ, ZVOL_REBUILD_CURSOR,
+	    8, ZVOL_REBUILD_CURSOR_INTS, zrc));
+}
 
 /*
- * zvol_log_write() handles synchronous writes using TX_WRITE ZIL transactions.
- *
- * We store data in the log buffers if it's small enough.
- * Otherwise we will later flush the data out via dmu_sync().
+ * Drop the checkpoint once the rebuild is done, or has to start over
+ * against a different base.
  */
-ssize_t zvol_immediate_write_sz = 32768;
-
-#if defined(_KERNEL)
-void
-zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, uint64_t offset,
-    uint64_t size, int sync)
-#else
-void
-zvol_log_write(zvol_state_t *zv, dmu_tx_t *tx, uint64_t offset,
-    uint64_t size, int sync, blk_metadata_t *metadata)
-#endif
+int
+zvol_rebuild_cursor_clear(zvol_state_t *zv)
 {
-	uint32_t blocksize = zv->zv_volblocksize;
-	zilog_t *zilog = zv->zv_zilog;
-	itx_wr_state_t write_state;
-
-#if !defined(_KERNEL)
-	blk_metadata_t *md;
-#endif
-	if (zil_replaying(zilog, tx))
-		return;
-
-	if (zilog->zl_logbias == ZFS_LOGBIAS_THROUGHPUT)
-		write_state = WR_INDIRECT;
-	else if (!spa_has_slogs(zilog->zl_spa) &&
-	    size >= blocksize && blocksize > zvol_immediate_write_sz)
-		write_state = WR_INDIRECT;
-	else if (sync)
-		write_state = WR_COPIED;
-	else
-		write_state = WR_NEED_COPY;
-
-	while (size) {
-		itx_t *itx;
-		lr_write_t *lr;
-		itx_wr_state_t wr_state = write_state;
-		ssize_t len = size;
-
-		if (wr_state == WR_COPIED && size > ZIL_MAX_COPIED_DATA)
-			wr_state = WR_NEED_COPY;
-		else if (wr_state == WR_INDIRECT)
-			len = MIN(blocksize - P2PHASE(offset, blocksize), size);
-
-		itx = zil_itx_create(TX_WRITE, sizeof (*lr) +
-		    (wr_state == WR_COPIED ? len : 0));
-		lr = (lr_write_t *)&itx->itx_lr;
-		if (wr_state == WR_COPIED && dmu_read_by_dnode(zv->zv_dn,
-		    offset, len, lr+1, DMU_READ_NO_PREFETCH) != 0) {
-			zil_itx_destroy(itx);
-			itx = zil_itx_create(TX_WRITE, sizeof (*lr));
-			lr = (lr_write_t *)&itx->itx_lr;
-			wr_state = WR_NEED_COPY;
-		}
-
-		itx->itx_wr_state = wr_state;
-		lr->lr_foid = ZVOL_OBJ;
-		lr->lr_offset = offset;
-		lr->lr_length = len;
-#if !defined(_KERNEL)
-		if (metadata != NULL) {
-			lr->lr_version = VERSION_1;
-			md = &(lr->lr_metadata);
-			memcpy(md, metadata, sizeof (blk_metadata_t));
-		}
-		else
-			lr->lr_version = VERSION_0;
-#endif
-		lr->lr_blkoff = 0;
-		BP_ZERO(&lr->lr_blkptr);
+	objset_t *os = zv->zv_objset;
+	dmu_tx_t *tx;
+	int error;
 
-		itx->itx_private = zv;
-		itx->itx_sync = sync;
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_zap(tx, ZVOL_ZAP_OBJ, FALSE, ZVOL_REBUILD_CURSOR);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+		return (SET_ERROR(error));
+	}
 
-		(void) zil_itx_assign(zilog, itx, tx);
+	error = zap_remove(os, ZVOL_ZAP_OBJ, ZVOL_REBUILD_CURSOR, tx);
+	dmu_tx_commit(tx);
 
-		offset += len;
-		size -= len;
-	}
+	return (error == ENOENT ? 0 : error);
 }
+#endif
 
 #if defined(_KERNEL)
 typedef struct zv_request {
@@ -1286,6 +2706,41 @@ zvol_read(void *arg)
 	kmem_free(zvr, sizeof (zv_request_t));
 }
 
+/*
+ * A read of at most zvol_direct_read_max_blocks volume blocks whose dbufs
+ * are all cached is served by zvol_request() itself rather than handed to
+ * zvol_taskq: copying out of the dbuf cache costs less than the round trip
+ * through a taskq thread.  The check does not hold the dbufs, so one may
+ * be evicted before it is read; the read then just blocks on the pool in
+ * the submitting thread, as with zvol_request_sync.
+ */
+static boolean_t
+zvol_read_is_cached(zvol_state_t *zv, uint64_t offset, uint64_t size)
+{
+	dmu_buf_impl_t *db;
+	uint64_t blkid, end;
+	boolean_t cached = B_TRUE;
+
+	if (size == 0 || zvol_direct_read_max_blocks == 0)
+		return (B_FALSE);
+
+	blkid = dbuf_whichblock(zv->zv_dn, 0, offset);
+	end = dbuf_whichblock(zv->zv_dn, 0, offset + size - 1);
+	if (end - blkid >= zvol_direct_read_max_blocks)
+		return (B_FALSE);
+
+	for (; cached && blkid <= end; blkid++) {
+		/* dbuf_find() returns with db_mtx held */
+		db = dbuf_find(zv->zv_objset, ZVOL_OBJ, 0, blkid);
+		if (db == NULL)
+			return (B_FALSE);
+		cached = (db->db_state == DB_CACHED);
+		mutex_exit(&db->db_mtx);
+	}
+
+	return (cached);
+}
+
 static MAKE_REQUEST_FN_RET
 zvol_request(struct request_queue *q, struct bio *bio)
 {
@@ -1332,6 +2787,9 @@ zvol_request(struct request_queue *q, struct bio *bio)
 			goto out;
 		}
 
+		if (!bio_is_discard(bio) && !bio_is_secure_erase(bio))
+			dmu_objset_io_throttle(zv->zv_objset, B_TRUE, 1, size);
+
 		zvr = kmem_alloc(sizeof (zv_request_t), KM_SLEEP);
 		zvr->zv = zv;
 		zvr->bio = bio;
@@ -1369,11 +2827,14 @@ zvol_request(struct request_queue *q, struct bio *bio)
 		zvr->bio = bio;
 
 		rw_enter(&zv->zv_suspend_lock, RW_READER);
+		dmu_objset_io_throttle(zv->zv_objset, B_FALSE, 1, size);
 
 		zvr->rl = zfs_range_lock(&zv->zv_range_lock, offset, size,
 		    RL_READER);
-		if (zvol_request_sync || taskq_dispatch(zvol_taskq,
-		    zvol_read, zvr, TQ_SLEEP) == TASKQID_INVALID)
+		if (zvol_request_sync ||
+		    zvol_read_is_cached(zv, offset, size) ||
+		    taskq_dispatch(zvol_taskq, zvol_read, zvr,
+		    TQ_SLEEP) == TASKQID_INVALID)
 			zvol_read(zvr);
 	}
 
@@ -1396,7 +2857,7 @@ zvol_get_done(zgd_t *zgd, int error)
 	zfs_range_unlock(zgd->zgd_rl);
 
 	if (error == 0 && zgd->zgd_bp)
-		zil_add_block(zgd->zgd_zilog, zgd->zgd_bp);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
 
 	kmem_free(zgd, sizeof (zgd_t));
 }
@@ -1405,7 +2866,8 @@ zvol_get_done(zgd_t *zgd, int error)
  * Get data to generate a TX_WRITE intent log record.
  */
 int
-zvol_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
+zvol_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
+    zio_t *zio)
 {
 	zvol_state_t *zv = arg;
 	uint64_t offset = lr->lr_offset;
@@ -1418,7 +2880,7 @@ zvol_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
 	ASSERT(size != 0);
 
 	zgd = (zgd_t *)kmem_zalloc(sizeof (zgd_t), KM_SLEEP);
-	zgd->zgd_zilog = zv->zv_zilog;
+	zgd->zgd_lwb = lwb;
 
 	/*
 	 * Write records come in two flavors: immediate and indirect.
@@ -2032,7 +3494,7 @@ zvol_alloc(dev_t dev, const char *name)
 	zv->zv_open_count = 0;
 	strlcpy(zv->zv_name, name, MAXNAMELEN);
 
-	zfs_rlock_init(&zv->zv_range_lock);
+	zfs_rlock_init_sharded(&zv->zv_range_lock);
 	rw_init(&zv->zv_suspend_lock, NULL, RW_DEFAULT, NULL);
 
 	zv->zv_disk->major = zvol_major;
@@ -2184,7 +3646,8 @@ zvol_create_minor_impl(const char *name)
 		if (zil_replay_disable)
 			zil_destroy(dmu_objset_zil(os), B_FALSE);
 		else
-			zil_replay(os, zv, zvol_replay_vector);
+			zil_replay_parallel(os, zv, zvol_replay_vector,
+			    (zil_replay_range_func_t *)zvol_replay_range);
 	}
 
 	/*
@@ -3062,6 +4525,10 @@ MODULE_PARM_DESC(zvol_threads, "Max number of threads to handle I/O requests");
 module_param(zvol_request_sync, uint, 0644);
 MODULE_PARM_DESC(zvol_request_sync, "Synchronously handle bio requests");
 
+module_param(zvol_direct_read_max_blocks, uint, 0644);
+MODULE_PARM_DESC(zvol_direct_read_max_blocks,
+	"Max blocks of a cached read to serve without the zvol taskq");
+
 module_param(zvol_max_discard_blocks, ulong, 0444);
 MODULE_PARM_DESC(zvol_max_discard_blocks, "Max number of blocks to discard");
 
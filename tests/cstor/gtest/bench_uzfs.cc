@@ -0,0 +1,265 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Micro-benchmarks of the uzfs data path, built with Google Benchmark.
+ * They run against a pool on a file vdev in /tmp, in this process, so
+ * that a regression of the data path itself shows up without network or
+ * target noise.  Use --benchmark_format=json (or --benchmark_out=FILE
+ * --benchmark_out_format=json) to get results that can be compared
+ * between commits.
+ */
+
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+/* Avoid including conflicting C++ declarations for LE-BE conversions */
+#define _SYS_BYTEORDER_H
+#include <sys/spa.h>
+#include <sys/zvol.h>
+#include <sys/dsl_destroy.h>
+#include <libuzfs.h>
+#include <zrepl_mgmt.h>
+
+#include "gtest_utils.h"
+
+#define BENCH_VDEV	"/tmp/uzbench.1a"
+#define BENCH_POOL	"benchpool"
+#define VOLSIZE		(1024 * 1024 * 1024ULL)
+#define VDEVSIZE	(2 * VOLSIZE)
+#define BLOCKSIZE	(4096)
+#define MAXIOSIZE	(128 * 1024)
+
+static spa_t *spa;
+static zvol_state_t *zv;	/* target of the read/write benchmarks */
+static zvol_state_t *diff_zv;	/* volume with the io_diff metadata */
+static zvol_state_t *diff_snap_zv;
+static uint64_t diff_base_io;
+
+static void
+make_vdev(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		printf("can't open %s\n", path);
+		exit(1);
+	}
+	if (ftruncate(fd, VDEVSIZE) != 0) {
+		printf("can't ftruncate %s\n", path);
+		exit(1);
+	}
+	(void) close(fd);
+}
+
+static void
+open_volume(const char *name, zvol_state_t **zvp)
+{
+	if (uzfs_create_dataset(spa, (char *)name, VOLSIZE, BLOCKSIZE,
+	    zvp) != 0) {
+		printf("can't create %s\n", name);
+		exit(1);
+	}
+	uzfs_hold_dataset(*zvp);
+	uzfs_update_metadata_granularity(*zvp, 512);
+}
+
+/*
+ * Fill the first 64M of the diff volume in 4 passes of increasing io_num,
+ * each pass rewriting every other block of the previous one, then take
+ * the snapshot that uzfs_get_io_diff() reads from.
+ */
+static void
+setup_io_diff(void)
+{
+	char buf[BLOCKSIZE];
+	blk_metadata_t md;
+	uint64_t io_num = 1;
+	uint64_t offset;
+	int pass;
+
+	GtestUtils::init_buf(buf, sizeof (buf), "io_diff");
+	for (pass = 0; pass < 4; pass++) {
+		for (offset = 0; offset < 64 * 1024 * 1024ULL;
+		    offset += BLOCKSIZE << pass) {
+			md.io_num = io_num++;
+			if (uzfs_write_data(diff_zv, buf, offset, BLOCKSIZE,
+			    &md, B_FALSE) != 0) {
+				printf("io_diff setup write failed\n");
+				exit(1);
+			}
+		}
+		if (pass == 1)
+			diff_base_io = io_num;
+	}
+	if (uzfs_zvol_create_internal_snapshot(diff_zv, &diff_snap_zv,
+	    io_num) != 0) {
+		printf("can't create io_diff snapshot\n");
+		exit(1);
+	}
+}
+
+static void
+bench_setup(void)
+{
+	signal(SIGPIPE, SIG_IGN);
+	if (uzfs_init() != 0) {
+		printf("uzfs_init failed\n");
+		exit(1);
+	}
+	make_vdev(BENCH_VDEV);
+	if (uzfs_create_pool((char *)BENCH_POOL, (char *)BENCH_VDEV,
+	    &spa) != 0) {
+		printf("can't create pool %s\n", BENCH_POOL);
+		exit(1);
+	}
+	open_volume("benchvol", &zv);
+	open_volume("diffvol", &diff_zv);
+	setup_io_diff();
+}
+
+static void
+bench_teardown(void)
+{
+	char *snap_name = kmem_asprintf("%s", diff_snap_zv->zv_name);
+
+	uzfs_close_dataset(diff_snap_zv);
+	(void) dsl_destroy_snapshot(snap_name, B_FALSE);
+	strfree(snap_name);
+	uzfs_close_dataset(diff_zv);
+	uzfs_close_dataset(zv);
+	uzfs_close_pool(spa);
+	uzfs_fini();
+	(void) unlink(BENCH_VDEV);
+}
+
+/*
+ * Writes of state.range(0) bytes with metadata, walking the first 512M of
+ * the volume so that most of them land on blocks already written.
+ */
+static void
+BM_WriteData(benchmark::State &state)
+{
+	uint64_t len = state.range(0);
+	uint64_t nblocks = 512 * 1024 * 1024ULL / len;
+	char *buf = (char *)malloc(len);
+	blk_metadata_t md;
+	uint64_t i = 0;
+
+	GtestUtils::init_buf(buf, len, "bench_write");
+	md.io_num = 1;
+	for (auto _ : state) {
+		if (uzfs_write_data(zv, buf, (i++ % nblocks) * len, len, &md,
+		    B_FALSE) != 0) {
+			state.SkipWithError("uzfs_write_data failed");
+			break;
+		}
+		md.io_num++;
+	}
+	state.SetBytesProcessed(state.iterations() * len);
+	free(buf);
+}
+BENCHMARK(BM_WriteData)->RangeMultiplier(4)->Range(BLOCKSIZE, MAXIOSIZE);
+
+/*
+ * Reads of state.range(0) bytes and of their metadata, over the blocks
+ * written by BM_WriteData.
+ */
+static void
+BM_ReadData(benchmark::State &state)
+{
+	uint64_t len = state.range(0);
+	uint64_t nblocks = 512 * 1024 * 1024ULL / len;
+	char *buf = (char *)malloc(len);
+	metadata_desc_t *md;
+	uint64_t i = 0;
+
+	for (auto _ : state) {
+		if (uzfs_read_data(zv, buf, (i++ % nblocks) * len, len,
+		    &md) != 0) {
+			state.SkipWithError("uzfs_read_data failed");
+			break;
+		}
+		FREE_METADATA_LIST(md);
+	}
+	state.SetBytesProcessed(state.iterations() * len);
+	free(buf);
+}
+BENCHMARK(BM_ReadData)->RangeMultiplier(4)->Range(BLOCKSIZE, MAXIOSIZE);
+
+/* The metadata offset math done for every IO with metadata */
+static void
+BM_MetaobjBlockDetails(benchmark::State &state)
+{
+	metaobj_blk_offset_t m;
+	uint64_t offset = 0;
+
+	for (auto _ : state) {
+		get_metaobj_block_details(&m, 512, 4096,
+		    sizeof (blk_metadata_t), offset, state.range(0));
+		benchmark::DoNotOptimize(m);
+		offset = (offset + 3 * 512) % VOLSIZE;
+	}
+}
+BENCHMARK(BM_MetaobjBlockDetails)->Arg(512)->Arg(BLOCKSIZE)->Arg(MAXIOSIZE);
+
+static int
+io_diff_count_cb(off_t offset, size_t len, blk_metadata_t *md,
+    zvol_state_t *snap_zv, void *arg)
+{
+	(*(uint64_t *)arg) += len;
+	return (0);
+}
+
+/*
+ * Walk of the metadata of the 64M written by setup_io_diff(), looking for
+ * the blocks written after the first two passes, as a rebuild does.
+ */
+static void
+BM_GetIoDiff(benchmark::State &state)
+{
+	blk_metadata_t low;
+	uint64_t bytes = 0;
+
+	low.io_num = diff_base_io;
+	for (auto _ : state) {
+		if (uzfs_get_io_diff(diff_zv, &low, diff_snap_zv,
+		    io_diff_count_cb, 0, 64 * 1024 * 1024ULL, &bytes) != 0) {
+			state.SkipWithError("uzfs_get_io_diff failed");
+			break;
+		}
+	}
+	state.counters["diff_bytes"] = benchmark::Counter(bytes,
+	    benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_GetIoDiff)->Unit(benchmark::kMillisecond);
+
+int
+main(int argc, char **argv)
+{
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return (1);
+
+	bench_setup();
+	benchmark::RunSpecifiedBenchmarks();
+	bench_teardown();
+	return (0);
+}
@@ -41,6 +41,10 @@
 #include <sys/epoll.h>
 #include <sys/dsl_destroy.h>
 #include <sys/dsl_prop.h>
+#include <sys/dsl_dataset.h>
+#include <sys/dbuf.h>
+#include <sys/zvol.h>
+#include <sys/zap.h>
 #include <uzfs_rebuilding.h>
 
 #include "gtest_utils.h"
@@ -1066,6 +1070,305 @@ TEST(uZFS, TestZInfoRefcnt) {
 	EXPECT_EQ(2, zinfo->refcnt);
 }
 
+TEST(uZFS, WriteBatch) {
+	char wbuf[3][BLOCKSIZE];
+	char rbuf[2 * BLOCKSIZE];
+	blk_metadata_t mds[3];
+	zvol_write_req_t reqs[3];
+	metadata_desc_t *md;
+
+	for (int i = 0; i < 3; i++) {
+		memset(wbuf[i], 'a' + i, BLOCKSIZE);
+		mds[i].io_num = 100 + i;
+		reqs[i].zwr_len = BLOCKSIZE;
+		reqs[i].zwr_buf = wbuf[i];
+		reqs[i].zwr_metadata = &mds[i];
+	}
+	/* two adjacent writes and one that is not */
+	reqs[0].zwr_offset = 0;
+	reqs[1].zwr_offset = BLOCKSIZE;
+	reqs[2].zwr_offset = 8 * BLOCKSIZE;
+
+	EXPECT_EQ(0, zvol_write_batch(zv_todelete, reqs, 3, B_TRUE));
+
+	EXPECT_EQ(0, uzfs_read_data(zv_todelete, rbuf, 0, sizeof (rbuf), &md));
+	EXPECT_EQ(0, memcmp(rbuf, wbuf[0], BLOCKSIZE));
+	EXPECT_EQ(0, memcmp(rbuf + BLOCKSIZE, wbuf[1], BLOCKSIZE));
+	EXPECT_EQ(100, md->metadata.io_num);
+	EXPECT_EQ(101, md->next->metadata.io_num);
+	EXPECT_EQ(NULL, md->next->next);
+	FREE_METADATA_LIST(md);
+
+	EXPECT_EQ(0, uzfs_read_data(zv_todelete, rbuf, 8 * BLOCKSIZE,
+	    BLOCKSIZE, &md));
+	EXPECT_EQ(0, memcmp(rbuf, wbuf[2], BLOCKSIZE));
+	EXPECT_EQ(102, md->metadata.io_num);
+	EXPECT_EQ(NULL, md->next);
+	FREE_METADATA_LIST(md);
+
+	reqs[0].zwr_len = zvol_write_batch_max_bytes + 1;
+	EXPECT_EQ(E2BIG, zvol_write_batch(zv_todelete, reqs, 1, B_FALSE));
+}
+
+TEST(uZFS, WriteBatchCheckpoint) {
+	dsl_pool_t *dp = spa_get_dsl(dmu_objset_spa(zv_todelete->zv_objset));
+	char wbuf[BLOCKSIZE];
+	blk_metadata_t md;
+	zvol_write_req_t req;
+	zvol_ionum_ckpt_t zic;
+	uint64_t io_num;
+
+	memset(wbuf, 'c', BLOCKSIZE);
+	req.zwr_offset = 16 * BLOCKSIZE;
+	req.zwr_len = BLOCKSIZE;
+	req.zwr_buf = wbuf;
+	req.zwr_abuf = NULL;
+	req.zwr_metadata = &md;
+
+	EXPECT_EQ(0, zvol_ionum_ckpt_init(zv_todelete, &zic, "test_ckpt"));
+	EXPECT_EQ(0, zic.zic_synced);
+
+	/* nothing committed before the first batch, nothing to store */
+	md.io_num = 200;
+	EXPECT_EQ(0, zvol_write_batch_ckpt(zv_todelete, &req, 1, B_FALSE,
+	    &zic));
+	txg_wait_synced(dp, 0);
+	EXPECT_EQ(0, zic.zic_synced);
+
+	/* the next txg stores what the previous batches committed */
+	md.io_num = 300;
+	EXPECT_EQ(0, zvol_write_batch_ckpt(zv_todelete, &req, 1, B_FALSE,
+	    &zic));
+	txg_wait_synced(dp, 0);
+	EXPECT_EQ(200, zic.zic_synced);
+	EXPECT_EQ(300, zic.zic_committed);
+	zvol_ionum_ckpt_fini(zv_todelete, &zic);
+
+	EXPECT_EQ(0, zap_lookup(zv_todelete->zv_objset, ZVOL_ZAP_OBJ,
+	    "test_ckpt", sizeof (io_num), 1, &io_num));
+	EXPECT_EQ(200, io_num);
+}
+
+TEST(uZFS, WriteBatchDegraded) {
+	zvol_dirty_log_t *zdl = zvol_dirty_log_create();
+	char wbuf[BLOCKSIZE], rbuf[BLOCKSIZE];
+	blk_metadata_t md;
+	zvol_write_req_t req;
+	metadata_desc_t *mdl;
+
+	memset(wbuf, 'd', BLOCKSIZE);
+	req.zwr_offset = 32 * BLOCKSIZE;
+	req.zwr_len = BLOCKSIZE;
+	req.zwr_buf = wbuf;
+	req.zwr_abuf = NULL;
+	req.zwr_metadata = &md;
+	md.io_num = 400;
+
+	/* data is written, metadata only logged */
+	EXPECT_EQ(0, zvol_write_batch_degraded(zv_todelete, &req, 1, B_FALSE,
+	    zdl));
+	EXPECT_EQ(&md, req.zwr_metadata);
+	EXPECT_EQ(0, uzfs_read_data(zv_todelete, rbuf, req.zwr_offset,
+	    BLOCKSIZE, &mdl));
+	EXPECT_EQ(0, memcmp(rbuf, wbuf, BLOCKSIZE));
+	EXPECT_NE(400, mdl->metadata.io_num);
+	FREE_METADATA_LIST(mdl);
+	EXPECT_EQ(BLOCKSIZE, range_tree_space(zdl->zdl_ranges));
+
+	EXPECT_EQ(0, zvol_dirty_log_reconcile(zv_todelete, zdl));
+	EXPECT_EQ(B_TRUE, zdl->zdl_closed);
+	EXPECT_EQ(0, uzfs_read_data(zv_todelete, rbuf, req.zwr_offset,
+	    BLOCKSIZE, &mdl));
+	EXPECT_EQ(400, mdl->metadata.io_num);
+	FREE_METADATA_LIST(mdl);
+
+	/* once reconciled, writes carry their metadata */
+	md.io_num = 401;
+	EXPECT_EQ(0, zvol_write_batch_degraded(zv_todelete, &req, 1, B_FALSE,
+	    zdl));
+	EXPECT_EQ(0, uzfs_read_data(zv_todelete, rbuf, req.zwr_offset,
+	    BLOCKSIZE, &mdl));
+	EXPECT_EQ(401, mdl->metadata.io_num);
+	FREE_METADATA_LIST(mdl);
+
+	zvol_dirty_log_destroy(zdl);
+}
+
+TEST(uZFS, ReadAhead) {
+	zvol_readahead_t zra = { 0 };
+	uint64_t off;
+
+	/* two reads in a row make a stream */
+	zvol_readahead(zv_todelete, &zra, 0, BLOCKSIZE);
+	EXPECT_EQ(0, zra.zra_window);
+	zvol_readahead(zv_todelete, &zra, BLOCKSIZE, BLOCKSIZE);
+	EXPECT_EQ(zvol_readahead_min, zra.zra_window);
+	EXPECT_EQ(2 * BLOCKSIZE + zvol_readahead_min, zra.zra_off);
+
+	/* the window doubles each time it is refilled, up to the max */
+	for (off = 2 * BLOCKSIZE; off < 4 * zvol_readahead_max;
+	    off += BLOCKSIZE)
+		zvol_readahead(zv_todelete, &zra, off, BLOCKSIZE);
+	EXPECT_EQ(zvol_readahead_max, zra.zra_window);
+	EXPECT_GT(zra.zra_off, off);
+
+	/* a random read restarts it */
+	zvol_readahead(zv_todelete, &zra, BLOCKSIZE, BLOCKSIZE);
+	EXPECT_EQ(0, zra.zra_window);
+	EXPECT_EQ(0, zra.zra_off);
+}
+
+/*
+ * The metadata blocks of recent IOs stay cached through an eviction of the
+ * dbufs, up to the limit of the cache.
+ */
+TEST(uZFS, MetaCache) {
+	objset_t *os = zv_todelete->zv_objset;
+	dsl_pool_t *dp = spa_get_dsl(dmu_objset_spa(os));
+	uint64_t mblksz = zv_todelete->zv_volmetablocksize;
+	uint64_t span = (mblksz / zv_todelete->zv_volmetadatasize) *
+	    zv_todelete->zv_metavolblocksize;
+	zvol_meta_cache_t *zmc = zvol_meta_cache_create(mblksz);
+	char buf[BLOCKSIZE];
+	blk_metadata_t md;
+	dmu_buf_impl_t *db;
+
+	memset(buf, 'm', BLOCKSIZE);
+	md.io_num = 500;
+	EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf, 0, BLOCKSIZE, &md,
+	    B_FALSE));
+	EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf, span, BLOCKSIZE, &md,
+	    B_FALSE));
+	zvol_meta_cache_hold(zv_todelete, zmc, 0, BLOCKSIZE);
+	EXPECT_EQ(mblksz, zmc->zmc_bytes);
+	txg_wait_synced(dp, 0);
+	dmu_objset_evict_dbufs(os);
+	db = dbuf_find(os, ZVOL_META_OBJ, 0, 0);
+	ASSERT_TRUE(db != NULL);
+	EXPECT_EQ(DB_CACHED, db->db_state);
+	mutex_exit(&db->db_mtx);
+
+	/* pinning another block lets go of the least recently used one */
+	zvol_meta_cache_hold(zv_todelete, zmc, span, BLOCKSIZE);
+	EXPECT_EQ(mblksz, zmc->zmc_bytes);
+	dmu_objset_evict_dbufs(os);
+	EXPECT_TRUE(dbuf_find(os, ZVOL_META_OBJ, 0, 0) == NULL);
+	db = dbuf_find(os, ZVOL_META_OBJ, 0, 1);
+	ASSERT_TRUE(db != NULL);
+	mutex_exit(&db->db_mtx);
+
+	zvol_meta_cache_destroy(zmc);
+}
+
+/*
+ * A txg large enough to measure the pool by scales the amount of dirty
+ * data txgs are pushed out at, within its bounds.
+ */
+TEST(uZFS, TxgSyncAdapt) {
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	uint64_t len = 1024 * 1024;
+	uint64_t total = zfs_dirty_data_sync / 2;
+	char *buf = (char *)malloc(len);
+	blk_metadata_t md;
+	uint64_t off, threshold;
+
+	memset(buf, 't', len);
+	md.io_num = 600;
+	for (off = 0; off < total; off += len)
+		EXPECT_EQ(0, uzfs_write_data(zv_todelete, buf, off, len, &md,
+		    B_FALSE));
+	txg_wait_synced(dp, 0);
+
+	EXPECT_GT(dp->dp_tx.tx_sync_bw, 0);
+	threshold = txg_dirty_sync_threshold(dp);
+	EXPECT_GE(threshold, zfs_dirty_data_sync / 4);
+	EXPECT_LE(threshold,
+	    zfs_dirty_data_max * zfs_delay_min_dirty_percent / 100);
+	free(buf);
+}
+
+/*
+ * A small write to an uncached large block is staged without reading it,
+ * and merged with the old block when synced, or when read before that.
+ */
+TEST(uZFS, PartialWrite) {
+	char *name = kmem_asprintf("%s/partvol", pool);
+	uint64_t blksz = 128 * 1024;
+	char *buf = (char *)malloc(blksz);
+	char *rbuf = (char *)malloc(blksz);
+	metadata_desc_t *mdl;
+	blk_metadata_t md;
+	dmu_buf_impl_t *db;
+	zvol_state_t *pzv;
+	dsl_pool_t *dp;
+
+	EXPECT_EQ(0, uzfs_create_dataset(spa, name, VOLSIZE, blksz, &pzv));
+	uzfs_hold_dataset(pzv);
+	dp = spa_get_dsl(dmu_objset_spa(pzv->zv_objset));
+
+	memset(buf, 'a', blksz);
+	md.io_num = 1;
+	EXPECT_EQ(0, uzfs_write_data(pzv, buf, 0, blksz, &md, B_FALSE));
+	txg_wait_synced(dp, 0);
+	dmu_objset_evict_dbufs(pzv->zv_objset);
+
+	/* merged by the sync thread */
+	memset(buf + 8192, 'b', 4096);
+	md.io_num = 2;
+	EXPECT_EQ(0, uzfs_write_data(pzv, buf + 8192, 8192, 4096, &md,
+	    B_FALSE));
+	db = dbuf_find(pzv->zv_objset, ZVOL_OBJ, 0, 0);
+	ASSERT_TRUE(db != NULL);
+	EXPECT_EQ(DB_PARTIAL, db->db_state);
+	mutex_exit(&db->db_mtx);
+	txg_wait_synced(dp, 0);
+	EXPECT_EQ(0, uzfs_read_data(pzv, rbuf, 0, blksz, &mdl));
+	FREE_METADATA_LIST(mdl);
+	EXPECT_EQ(0, memcmp(buf, rbuf, blksz));
+
+	/* merged by a read in open context */
+	dmu_objset_evict_dbufs(pzv->zv_objset);
+	memset(buf + 65536, 'c', 4096);
+	md.io_num = 3;
+	EXPECT_EQ(0, uzfs_write_data(pzv, buf + 65536, 65536, 4096, &md,
+	    B_FALSE));
+	EXPECT_EQ(0, uzfs_read_data(pzv, rbuf, 0, blksz, &mdl));
+	FREE_METADATA_LIST(mdl);
+	EXPECT_EQ(0, memcmp(buf, rbuf, blksz));
+	txg_wait_synced(dp, 0);
+	dmu_objset_evict_dbufs(pzv->zv_objset);
+	EXPECT_EQ(0, uzfs_read_data(pzv, rbuf, 0, blksz, &mdl));
+	FREE_METADATA_LIST(mdl);
+	EXPECT_EQ(0, memcmp(buf, rbuf, blksz));
+
+	uzfs_close_dataset(pzv);
+	EXPECT_EQ(0, dsl_destroy_head(name));
+	strfree(name);
+	free(rbuf);
+	free(buf);
+}
+
+TEST(uZFS, IONumIndex) {
+	uint64_t rsz = zvol_ionum_index_region_size;
+	zvol_ionum_index_t *zir = zvol_ionum_index_alloc(VOLSIZE);
+
+	EXPECT_EQ(VOLSIZE / rsz, zir->zir_nregions);
+	EXPECT_EQ(UINT64_MAX, zvol_ionum_index_next_changed(zir, 0, 0));
+
+	zvol_ionum_index_update(zir, rsz + 512, 512, 10);
+	zvol_ionum_index_update(zir, 3 * rsz - 512, 1024, 20);
+	/* older io_num must not lower the summary */
+	zvol_ionum_index_update(zir, rsz, 512, 5);
+
+	EXPECT_EQ(rsz, zvol_ionum_index_next_changed(zir, 0, 0));
+	EXPECT_EQ(rsz, zvol_ionum_index_next_changed(zir, 0, 9));
+	EXPECT_EQ(2 * rsz, zvol_ionum_index_next_changed(zir, 0, 10));
+	EXPECT_EQ(3 * rsz, zvol_ionum_index_next_changed(zir, 3 * rsz, 10));
+	EXPECT_EQ(UINT64_MAX, zvol_ionum_index_next_changed(zir, 0, 20));
+
+	zvol_ionum_index_free(zir);
+}
+
 TEST(uZFS, RemovePendingCmds) {
 	zvol_io_hdr_t hdr;
 	zvol_io_cmd_t *zio_cmd;
@@ -1193,6 +1496,71 @@ TEST(SnapRebuild, CloneCreate) {
 	EXPECT_EQ(NULL, zinfo->clone_zv);
 }
 
+/* The clone shares with the volume the blocks it hasn't rewritten */
+TEST(SnapRebuild, CloneRangeShared) {
+	dsl_pool_t *dp = spa_get_dsl(dmu_objset_spa(zinfo->main_zv->zv_objset));
+	uint64_t blksz = zinfo->main_zv->zv_volblocksize;
+	char *buf = (char *)malloc(blksz);
+	blk_metadata_t md;
+	uint64_t shared;
+	int ret_val = 0;
+
+	EXPECT_EQ(0, uzfs_zvol_get_or_create_internal_clone(
+	    zinfo->main_zv, &zinfo->snapshot_zv, &zinfo->clone_zv, &ret_val));
+	txg_wait_synced(dp, 0);
+	EXPECT_EQ(0, dmu_range_shared(zinfo->main_zv->zv_objset,
+	    zinfo->clone_zv->zv_objset, ZVOL_OBJ, 0, 16 * blksz, &shared));
+	EXPECT_EQ(16 * blksz, shared);
+
+	/* dirty, and then rewritten, blocks end the shared run */
+	memset(buf, 's', blksz);
+	md.io_num = 1;
+	EXPECT_EQ(0, uzfs_write_data(zinfo->clone_zv, buf, 4 * blksz, blksz,
+	    &md, B_FALSE));
+	EXPECT_EQ(0, dmu_range_shared(zinfo->main_zv->zv_objset,
+	    zinfo->clone_zv->zv_objset, ZVOL_OBJ, 0, 16 * blksz, &shared));
+	EXPECT_EQ(4 * blksz, shared);
+	txg_wait_synced(dp, 0);
+	EXPECT_EQ(0, dmu_range_shared(zinfo->main_zv->zv_objset,
+	    zinfo->clone_zv->zv_objset, ZVOL_OBJ, 0, 16 * blksz, &shared));
+	EXPECT_EQ(4 * blksz, shared);
+	EXPECT_EQ(0, dmu_range_shared(zinfo->main_zv->zv_objset,
+	    zinfo->clone_zv->zv_objset, ZVOL_OBJ, 5 * blksz, 11 * blksz,
+	    &shared));
+	EXPECT_EQ(11 * blksz, shared);
+
+	EXPECT_EQ(0, uzfs_zinfo_destroy_internal_clone(zinfo));
+	free(buf);
+}
+
+/* What is written to and freed from a clone is kept in its livelist */
+TEST(SnapRebuild, CloneLivelist) {
+	dsl_pool_t *dp = spa_get_dsl(dmu_objset_spa(zinfo->main_zv->zv_objset));
+	uint64_t blksz = zinfo->main_zv->zv_volblocksize;
+	char *buf = (char *)malloc(blksz);
+	blk_metadata_t md;
+	dsl_dataset_t *ds;
+	int ret_val = 0;
+
+	EXPECT_EQ(0, uzfs_zvol_get_or_create_internal_clone(
+	    zinfo->main_zv, &zinfo->snapshot_zv, &zinfo->clone_zv, &ret_val));
+	ds = dmu_objset_ds(zinfo->clone_zv->zv_objset);
+	EXPECT_EQ(B_TRUE, dsl_dataset_has_livelist(ds));
+
+	memset(buf, 'l', blksz);
+	for (md.io_num = 1; md.io_num <= 2; md.io_num++) {
+		EXPECT_EQ(0, uzfs_write_data(zinfo->clone_zv, buf, 2 * blksz,
+		    blksz, &md, B_FALSE));
+		txg_wait_synced(dp, 0);
+	}
+	EXPECT_GT(ds->ds_livelist_born.bpo_phys->bpo_num_blkptrs, 0);
+	EXPECT_GT(ds->ds_livelist_freed.bpo_phys->bpo_num_blkptrs, 0);
+
+	EXPECT_EQ(0, uzfs_zinfo_destroy_internal_clone(zinfo));
+	txg_wait_synced(dp, 0);
+	free(buf);
+}
+
 uint64_t snapshot_io_num = 1000;
 char *snapname = (char *)"hello_snap";
 
@@ -1327,6 +1695,17 @@ TEST(GetSnapFromIO, CreateInternalSnap) {
 	EXPECT_EQ(0, dsl_destroy_snapshot("pool1/vol1@snapz", B_FALSE));
 }
 
+TEST(GetSnapFromIO, PreparedBatchedSnap) {
+	EXPECT_EQ(ENOENT, dmu_objset_snapshot_prepare("pool1/novol"));
+
+	EXPECT_EQ(0, dmu_objset_snapshot_prepare("pool1/vol1"));
+	EXPECT_EQ(0, dmu_objset_snapshot_batched("pool1/vol1", "snapbatch"));
+	EXPECT_EQ(EEXIST, dmu_objset_snapshot_batched("pool1/vol1",
+	    "snapbatch"));
+
+	EXPECT_EQ(0, dsl_destroy_snapshot("pool1/vol1@snapbatch", B_FALSE));
+}
+
 /* Retrieve Snap dataset and IO number */
 TEST(SnapCreate, SnapRetrieve) {
 
@@ -0,0 +1,232 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * This is just to keep the compiler happy about sys/time.h not declaring
+ * gettimeofday due to -D_KERNEL (we can do this since we're actually
+ * running in userspace, but we need -D_KERNEL for the remaining BLAKE3 code).
+ */
+#ifdef	_KERNEL
+#undef	_KERNEL
+#endif
+
+#include <sys/blake3.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <sys/time.h>
+#define	NOTE(x)
+
+typedef	enum boolean { B_FALSE, B_TRUE } boolean_t;
+typedef	unsigned long long	u_longlong_t;
+
+/*
+ * BLAKE3 test suite using the official test vectors from
+ * https://github.com/BLAKE3-team/BLAKE3/blob/master/test_vectors: the
+ * input is len bytes of i % 251 and the key for keyed hashing is
+ * "whats the Elvish word for friend".
+ */
+static const char	*test_key = "whats the Elvish word for friend";
+
+static const struct {
+	size_t		len;
+	const char	*hash;
+	const char	*keyed_hash;
+} test_vectors[] = {
+	{ 0,
+	    "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262",
+	    "92b2b75604ed3c761f9d6f62392c8a9227ad0ea3f09573e783f1498a4ed60d26"
+	},
+	{ 1,
+	    "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213",
+	    "6d7878dfff2f485635d39013278ae14f1454b8c0a3a2d34bc1ab38228a80c95b"
+	},
+	{ 1023,
+	    "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11",
+	    "c951ecdf03288d0fcc96ee3413563d8a6d3589547f2c2fb36d9786470f1b9d6e"
+	},
+	{ 1024,
+	    "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7",
+	    "75c46f6f3d9eb4f55ecaaee480db732e6c2105546f1e675003687c31719c7ba4"
+	},
+	{ 1025,
+	    "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444",
+	    "357dc55de0c7e382c900fd6e320acc04146be01db6a8ce7210b7189bd664ea69"
+	},
+	{ 2048,
+	    "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a",
+	    "879cf1fa2ea0e79126cb1063617a05b6ad9d0b696d0d757cf053439f60a99dd1"
+	},
+	{ 2049,
+	    "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030",
+	    "9f29700902f7c86e514ddc4df1e3049f258b2472b6dd5267f61bf13983b78dd5"
+	},
+	{ 3072,
+	    "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2",
+	    "044a0e7b172a312dc02a4c9a818c036ffa2776368d7f528268d2e6b5df191770"
+	},
+	{ 3073,
+	    "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3",
+	    "68dede9bef00ba89e43f31a6825f4cf433389fedae75c04ee9f0cf16a427c95a"
+	},
+	{ 4096,
+	    "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969",
+	    "befc660aea2f1718884cd8deb9902811d332f4fc4a38cf7c7300d597a081bfc0"
+	},
+	{ 4097,
+	    "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995",
+	    "00df940cd36bb9fa7cbbc3556744e0dbc8191401afe70520ba292ee3ca80abbc"
+	},
+	{ 5120,
+	    "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833",
+	    "2c493e48e9b9bf31e0553a22b23503c0a3388f035cece68eb438d22fa1943e20"
+	},
+	{ 8192,
+	    "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63",
+	    "dc9637c8845a770b4cbf76b8daec0eebf7dc2eac11498517f08d44c8fc00d58a"
+	},
+	{ 31744,
+	    "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47",
+	    "efa53b389ab67c593dba624d898d0f7353ab99e4ac9d42302ee64cbf9939a419"
+	},
+	{ 102400,
+	    "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085",
+	    "1c35d1a5811083fd7119f5d5d1ba027b4d01c0c6c49fb6ff2cf75393ea5db4a7"
+	},
+};
+
+/* Every implementation that may be built, generic first */
+static const char	*test_impls[] = {
+	"generic", "sse41", "avx2", "avx512", "neon"
+};
+
+static uint8_t	test_input[102400];
+
+/*
+ * Hash the first len bytes of test_input in pieces of at most piece bytes
+ * and compare the result with the expected hex digest.
+ */
+static boolean_t
+blake3_check(size_t len, size_t piece, const uint8_t *key, const char *hex)
+{
+	BLAKE3_CTX	ctx;
+	uint8_t		digest[BLAKE3_OUT_LEN];
+	char		result[2 * BLAKE3_OUT_LEN + 1];
+	size_t		off;
+	int		i;
+
+	if (key != NULL)
+		Blake3_InitKeyed(&ctx, key);
+	else
+		Blake3_Init(&ctx);
+	for (off = 0; off < len; off += piece) {
+		size_t n = len - off < piece ? len - off : piece;
+		Blake3_Update(&ctx, test_input + off, n);
+	}
+	Blake3_Final(&ctx, digest);
+
+	for (i = 0; i < BLAKE3_OUT_LEN; i++)
+		(void) sprintf(result + 2 * i, "%02x", digest[i]);
+	return (strcmp(result, hex) == 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	boolean_t	failed = B_FALSE;
+	uint64_t	cpu_mhz = 0;
+	size_t		pieces[] = { sizeof (test_input), 4096, 1000, 1 };
+	int		i, j, p;
+
+	if (argc == 2)
+		cpu_mhz = atoi(argv[1]);
+
+	for (i = 0; i < sizeof (test_input); i++)
+		test_input[i] = i % 251;
+
+	blake3_impl_init();
+
+	(void) printf("Running algorithm correctness tests:\n");
+	for (j = 0; j < sizeof (test_impls) / sizeof (test_impls[0]); j++) {
+		if (blake3_impl_set(test_impls[j]) != 0)
+			continue;
+
+		for (i = 0; i < sizeof (test_vectors) /
+		    sizeof (test_vectors[0]); i++) {
+			boolean_t ok = B_TRUE;
+
+			for (p = 0; p < sizeof (pieces) / sizeof (pieces[0]);
+			    p++) {
+				ok &= blake3_check(test_vectors[i].len,
+				    pieces[p], NULL, test_vectors[i].hash);
+				ok &= blake3_check(test_vectors[i].len,
+				    pieces[p], (const uint8_t *)test_key,
+				    test_vectors[i].keyed_hash);
+			}
+			(void) printf("BLAKE3/%s\tMessage: %llu bytes\t"
+			    "Result: %s\n", test_impls[j],
+			    (u_longlong_t)test_vectors[i].len,
+			    ok ? "OK" : "FAILED!");
+			if (!ok)
+				failed = B_TRUE;
+		}
+	}
+	if (failed)
+		return (1);
+
+#define	BLAKE3_PERF_TEST(impl)						\
+	do {								\
+		BLAKE3_CTX	ctx;					\
+		uint8_t		digest[BLAKE3_OUT_LEN];			\
+		uint8_t		block[131072];				\
+		uint64_t	delta;					\
+		double		cpb = 0;				\
+		int		i;					\
+		struct timeval	start, end;				\
+		bzero(block, sizeof (block));				\
+		(void) gettimeofday(&start, NULL);			\
+		for (i = 0; i < 8192; i++) {				\
+			Blake3_Init(&ctx);				\
+			Blake3_Update(&ctx, block, sizeof (block));	\
+			Blake3_Final(&ctx, digest);			\
+		}							\
+		(void) gettimeofday(&end, NULL);			\
+		delta = (end.tv_sec * 1000000llu + end.tv_usec) -	\
+		    (start.tv_sec * 1000000llu + start.tv_usec);	\
+		if (cpu_mhz != 0) {					\
+			cpb = (cpu_mhz * 1e6 * ((double)delta /		\
+			    1000000)) / (8192 * 128 * 1024);		\
+		}							\
+		(void) printf("BLAKE3/%s\t%llu us (%.02f CPB)\n",	\
+		    impl, (u_longlong_t)delta, cpb);			\
+		NOTE(CONSTCOND)						\
+	} while (0)
+
+	(void) printf("Running performance tests (hashing 1024 MiB of "
+	    "data):\n");
+	for (j = 0; j < sizeof (test_impls) / sizeof (test_impls[0]); j++) {
+		if (blake3_impl_set(test_impls[j]) == 0)
+			BLAKE3_PERF_TEST(test_impls[j]);
+	}
+
+	return (0);
+}
@@ -54,6 +54,8 @@ const char	*test_msg1 = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmn"
 	"lmnomnopnopq";
 const char	*test_msg2 = "abcdefghbcdefghicdefghijdefghijkefghijklfghi"
 	"jklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+/* one million repetitions of "a", filled in by main() */
+char		test_msg3[1000001];
 
 /*
  * Test digests from:
@@ -73,8 +75,18 @@ const uint8_t	sha256_test_digests[][32] = {
 		0xE5, 0xC0, 0x26, 0x93, 0x0C, 0x3E, 0x60, 0x39,
 		0xA3, 0x3C, 0xE4, 0x59, 0x64, 0xFF, 0x21, 0x67,
 		0xF6, 0xEC, 0xED, 0xD4, 0x19, 0xDB, 0x06, 0xC1
+	},
+	{
+		/* no test vector for test_msg2 */
+		0
+	},
+	{
+		/* for test_msg3 */
+		0xCD, 0xC7, 0x6E, 0x5C, 0x99, 0x14, 0xFB, 0x92,
+		0x81, 0xA1, 0xC7, 0xE2, 0x84, 0xD7, 0x3E, 0x67,
+		0xF1, 0x80, 0x9A, 0x48, 0xA4, 0x97, 0x20, 0x0E,
+		0x04, 0x6D, 0x39, 0xCC, 0xC7, 0x11, 0x2C, 0xD0
 	}
-	/* no test vector for test_msg2 */
 };
 
 const uint8_t	sha384_test_digests[][48] = {
@@ -128,6 +140,17 @@ const uint8_t	sha512_test_digests[][64] = {
 		0x33, 0x1B, 0x99, 0xDE, 0xC4, 0xB5, 0x43, 0x3A,
 		0xC7, 0xD3, 0x29, 0xEE, 0xB6, 0xDD, 0x26, 0x54,
 		0x5E, 0x96, 0xE5, 0x5B, 0x87, 0x4B, 0xE9, 0x09
+	},
+	{
+		/* for test_msg3 */
+		0xE7, 0x18, 0x48, 0x3D, 0x0C, 0xE7, 0x69, 0x64,
+		0x4E, 0x2E, 0x42, 0xC7, 0xBC, 0x15, 0xB4, 0x63,
+		0x8E, 0x1F, 0x98, 0xB1, 0x3B, 0x20, 0x44, 0x28,
+		0x56, 0x32, 0xA8, 0x03, 0xAF, 0xA9, 0x73, 0xEB,
+		0xDE, 0x0F, 0xF2, 0x44, 0x87, 0x7E, 0xA6, 0x0A,
+		0x4C, 0xB0, 0x43, 0x2C, 0xE5, 0x77, 0xC3, 0x1B,
+		0xEB, 0x00, 0x9C, 0x5C, 0x2C, 0x49, 0xAA, 0x2E,
+		0x4E, 0xAD, 0xB2, 0x17, 0xAD, 0x8C, 0xC0, 0x9B
 	}
 };
 
@@ -173,6 +196,11 @@ const uint8_t	sha512_256_test_digests[][32] = {
 	}
 };
 
+/* Every block transform that may be built, generic first */
+static const char	*test_impls[] = {
+	"generic", "x86_64", "shani", "armv8"
+};
+
 /*
  * Local reimplementation of cmn_err, since it's used in sha2.c.
  */
@@ -192,10 +220,15 @@ main(int argc, char *argv[])
 {
 	boolean_t	failed = B_FALSE;
 	uint64_t	cpu_mhz = 0;
+	const char	*impl;
+	int		j;
 
 	if (argc == 2)
 		cpu_mhz = atoi(argv[1]);
 
+	(void) memset(test_msg3, 'a', sizeof (test_msg3) - 1);
+	sha2_impl_init();
+
 #define	SHA2_ALGO_TEST(_m, mode, diglen, testdigest)			\
 	do {								\
 		SHA2_CTX		ctx;				\
@@ -203,8 +236,8 @@ main(int argc, char *argv[])
 		SHA2Init(SHA ## mode ## _MECH_INFO_TYPE, &ctx);		\
 		SHA2Update(&ctx, _m, strlen(_m));			\
 		SHA2Final(digest, &ctx);				\
-		(void) printf("SHA%-9sMessage: " #_m			\
-		    "\tResult: ", #mode);				\
+		(void) printf("SHA%-9s%-8sMessage: " #_m		\
+		    "\tResult: ", #mode, impl);				\
 		if (bcmp(digest, testdigest, diglen / 8) == 0) {	\
 			(void) printf("OK\n");				\
 		} else {						\
@@ -236,30 +269,60 @@ main(int argc, char *argv[])
 			cpb = (cpu_mhz * 1e6 * ((double)delta /		\
 			    1000000)) / (8192 * 128 * 1024);		\
 		}							\
-		(void) printf("SHA%-9s%llu us (%.02f CPB)\n", #mode,	\
-		    (u_longlong_t)delta, cpb);				\
+		(void) printf("SHA%-9s%-8s%llu us (%.02f CPB)\n", #mode, \
+		    impl, (u_longlong_t)delta, cpb);			\
 		NOTE(CONSTCOND)						\
 	} while (0)
 
 	(void) printf("Running algorithm correctness tests:\n");
-	SHA2_ALGO_TEST(test_msg0, 256, 256, sha256_test_digests[0]);
-	SHA2_ALGO_TEST(test_msg1, 256, 256, sha256_test_digests[1]);
-	SHA2_ALGO_TEST(test_msg0, 384, 384, sha384_test_digests[0]);
-	SHA2_ALGO_TEST(test_msg2, 384, 384, sha384_test_digests[2]);
-	SHA2_ALGO_TEST(test_msg0, 512, 512, sha512_test_digests[0]);
-	SHA2_ALGO_TEST(test_msg2, 512, 512, sha512_test_digests[2]);
-	SHA2_ALGO_TEST(test_msg0, 512_224, 224, sha512_224_test_digests[0]);
-	SHA2_ALGO_TEST(test_msg2, 512_224, 224, sha512_224_test_digests[2]);
-	SHA2_ALGO_TEST(test_msg0, 512_256, 256, sha512_256_test_digests[0]);
-	SHA2_ALGO_TEST(test_msg2, 512_256, 256, sha512_256_test_digests[2]);
+	for (j = 0; j < sizeof (test_impls) / sizeof (test_impls[0]); j++) {
+		boolean_t has256, has512;
+
+		impl = test_impls[j];
+		has256 = (sha256_impl_set(impl) == 0);
+		has512 = (sha512_impl_set(impl) == 0);
+		if (has256) {
+			SHA2_ALGO_TEST(test_msg0, 256, 256,
+			    sha256_test_digests[0]);
+			SHA2_ALGO_TEST(test_msg1, 256, 256,
+			    sha256_test_digests[1]);
+			SHA2_ALGO_TEST(test_msg3, 256, 256,
+			    sha256_test_digests[3]);
+		}
+		if (has512) {
+			SHA2_ALGO_TEST(test_msg0, 384, 384,
+			    sha384_test_digests[0]);
+			SHA2_ALGO_TEST(test_msg2, 384, 384,
+			    sha384_test_digests[2]);
+			SHA2_ALGO_TEST(test_msg0, 512, 512,
+			    sha512_test_digests[0]);
+			SHA2_ALGO_TEST(test_msg2, 512, 512,
+			    sha512_test_digests[2]);
+			SHA2_ALGO_TEST(test_msg3, 512, 512,
+			    sha512_test_digests[3]);
+			SHA2_ALGO_TEST(test_msg0, 512_224, 224,
+			    sha512_224_test_digests[0]);
+			SHA2_ALGO_TEST(test_msg2, 512_224, 224,
+			    sha512_224_test_digests[2]);
+			SHA2_ALGO_TEST(test_msg0, 512_256, 256,
+			    sha512_256_test_digests[0]);
+			SHA2_ALGO_TEST(test_msg2, 512_256, 256,
+			    sha512_256_test_digests[2]);
+		}
+	}
 
 	if (failed)
 		return (1);
 
 	(void) printf("Running performance tests (hashing 1024 MiB of "
 	    "data):\n");
-	SHA2_PERF_TEST(256, 256);
-	SHA2_PERF_TEST(512, 512);
+	for (j = 0; j < sizeof (test_impls) / sizeof (test_impls[0]); j++) {
+		impl = test_impls[j];
+		if (sha256_impl_set(impl) == 0)
+			SHA2_PERF_TEST(256, 256);
+		if (sha512_impl_set(impl) == 0)
+			SHA2_PERF_TEST(512, 512);
+	}
 
 	return (0);
 }